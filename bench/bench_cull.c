@@ -0,0 +1,376 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* Frustum culling benchmark. Culls a field of randomly placed and rotated 
+ * boxes against a view frustum, once by testing the boxes one at a time with
+ * 'C_FrustumOBBIntersectionFast' and once with the batched 'C_FrustumOBBsCull',
+ * and reports the time of each. The single test stops at the first plane the 
+ * box straddles, so it lets through some boxes which are behind a later plane. 
+ * The batched results are checked against testing all 8 corners of every box 
+ * against every plane.
+ *
+ * Picking is timed the same way, casting rays from the camera at random points 
+ * on the field through all of the boxes with 'C_RayIntersectsOBB' one box at a 
+ * time and with the batched 'C_RayOBBsIntersect'. Both must hit the same boxes 
+ * at the same distances.
+ *
+ * usage: bench_cull [-b <boxes>] [-n <iterations>]
+ *
+ *   -b  number of boxes (default 5000)
+ *   -n  number of times each way is timed, the best being reported (default 50)
+ */
+
+#include "../src/collision.h"
+#include "../src/pf_math.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+
+#define FIELD_DIM   (1024.0f)
+#define NUM_RAYS    (16)
+#define CAM_POS     ((vec3_t){0.0f, 150.0f, 0.0f})
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static float frand(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+static vec3_t rand_unit_vec(void)
+{
+    vec3_t ret;
+    do{
+        ret = (vec3_t){frand(-1.0f, 1.0f), frand(-1.0f, 1.0f), frand(-1.0f, 1.0f)};
+    }while(PFM_Vec3_Len(&ret) < 0.1f);
+
+    PFM_Vec3_Normal(&ret, &ret);
+    return ret;
+}
+
+static void rand_obb(struct obb *out)
+{
+    out->center = (vec3_t){frand(-FIELD_DIM, FIELD_DIM), frand(0.0f, 20.0f), frand(-FIELD_DIM, FIELD_DIM)};
+
+    /* An orthonormal basis from two random directions */
+    vec3_t a = rand_unit_vec(), b = rand_unit_vec(), c;
+    PFM_Vec3_Cross(&a, &b, &c);
+    PFM_Vec3_Normal(&c, &c);
+    PFM_Vec3_Cross(&c, &a, &b);
+
+    out->axes[0] = a;
+    out->axes[1] = b;
+    out->axes[2] = c;
+    for(int i = 0; i < 3; i++)
+        out->half_lengths[i] = frand(0.5f, 8.0f);
+
+    for(int i = 0; i < 8; i++) {
+
+        out->corners[i] = out->center;
+        for(int j = 0; j < 3; j++) {
+
+            float sign = (i & (4 >> j)) ? 1.0f : -1.0f;
+            vec3_t off;
+            PFM_Vec3_Scale(&out->axes[j], sign * out->half_lengths[j], &off);
+            PFM_Vec3_Add(&out->corners[i], &off, &out->corners[i]);
+        }
+    }
+}
+
+/* A perspective frustum at the origin looking down and along -Z, like an RTS 
+ * camera. Only the planes are set, as the fast tests don't use the corners. */
+static void make_frustum(struct frustum *out)
+{
+    const float fov = 45.0f * M_PI / 180.0f, aspect = 16.0f / 9.0f;
+    const float near = 0.1f, far = 1000.0f;
+
+    vec3_t pos = CAM_POS;
+    vec3_t dir = (vec3_t){0.0f, -0.7f, -0.7f}, up, right;
+    vec3_t world_up = (vec3_t){0.0f, 1.0f, 0.0f};
+
+    PFM_Vec3_Normal(&dir, &dir);
+    PFM_Vec3_Cross(&dir, &world_up, &right);
+    PFM_Vec3_Normal(&right, &right);
+    PFM_Vec3_Cross(&right, &dir, &up);
+
+    float tan_v = tanf(fov / 2.0f), tan_h = tan_v * aspect;
+    vec3_t tmp, n;
+
+    out->near = (struct plane){pos, dir};
+    PFM_Vec3_Scale(&dir, far, &tmp);
+    PFM_Vec3_Add(&pos, &tmp, &tmp);
+    out->far = (struct plane){tmp, (vec3_t){-dir.x, -dir.y, -dir.z}};
+    PFM_Vec3_Scale(&dir, near, &tmp);
+    PFM_Vec3_Add(&pos, &tmp, &out->near.point);
+
+    /* Each side plane's normal points into the frustum */
+    for(int side = 0; side < 4; side++) {
+
+        vec3_t axis = (side < 2) ? up : right;
+        float tangent = (side < 2) ? tan_v : tan_h;
+        float sign = (side % 2) ? -1.0f : 1.0f;
+
+        /* The plane contains the direction 'dir + sign * tangent * axis' */
+        PFM_Vec3_Scale(&axis, -sign, &n);
+        PFM_Vec3_Scale(&dir, tangent, &tmp);
+        PFM_Vec3_Add(&n, &tmp, &n);
+        PFM_Vec3_Normal(&n, &n);
+
+        struct plane *planes[4] = {&out->top, &out->bot, &out->right, &out->left};
+        *planes[side] = (struct plane){pos, n};
+    }
+}
+
+static bool behind_any_plane(const struct frustum *frustum, const struct obb *obb)
+{
+    const struct plane *planes[] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                    &frustum->right, &frustum->near, &frustum->far};
+
+    for(int i = 0; i < 6; i++) {
+
+        bool all_behind = true;
+        for(int j = 0; j < 8; j++) {
+
+            vec3_t diff;
+            PFM_Vec3_Sub((vec3_t*)&obb->corners[j], (vec3_t*)&planes[i]->point, &diff);
+            if(PFM_Vec3_Dot(&diff, (vec3_t*)&planes[i]->normal) >= 0.0f)
+                all_behind = false;
+        }
+        if(all_behind)
+            return true;
+    }
+    return false;
+}
+
+static void make_rays(vec3_t dirs[NUM_RAYS])
+{
+    for(int i = 0; i < NUM_RAYS; i++) {
+
+        vec3_t target = (vec3_t){frand(-FIELD_DIM, FIELD_DIM), 0.0f, frand(-FIELD_DIM, FIELD_DIM)};
+        PFM_Vec3_Sub(&target, &CAM_POS, &dirs[i]);
+        PFM_Vec3_Normal(&dirs[i], &dirs[i]);
+    }
+}
+
+/* Returns the number of boxes which both ways didn't agree on */
+static size_t bench_rays(const struct obb *obbs, const struct obb_soa *soa, int iters, 
+                         double *out_single, double *out_batch)
+{
+    size_t nboxes = soa->size;
+    float *single_t = malloc(nboxes * sizeof(float));
+    float *batch_t = malloc(nboxes * sizeof(float));
+    uint32_t *single_mask = calloc((nboxes + 31) / 32, sizeof(uint32_t));
+    uint32_t *batch_mask = calloc((nboxes + 31) / 32, sizeof(uint32_t));
+    size_t mismatched = 0;
+
+    if(!single_t || !batch_t || !single_mask || !batch_mask) {
+        mismatched = nboxes;
+        goto out;
+    }
+
+    vec3_t dirs[NUM_RAYS];
+    make_rays(dirs);
+    *out_single = *out_batch = 0.0;
+
+    for(int r = 0; r < NUM_RAYS; r++) {
+
+        double single_best = 0.0, batch_best = 0.0;
+        for(int i = 0; i < iters; i++) {
+
+            uint64_t start = SDL_GetPerformanceCounter();
+            memset(single_mask, 0, ((nboxes + 31) / 32) * sizeof(uint32_t));
+            for(int j = 0; j < nboxes; j++) {
+                if(C_RayIntersectsOBB(CAM_POS, dirs[r], obbs[j], &single_t[j]))
+                    single_mask[j / 32] |= (1u << (j % 32));
+            }
+            double ms = ms_since(start);
+            if(i == 0 || ms < single_best)
+                single_best = ms;
+
+            start = SDL_GetPerformanceCounter();
+            C_RayOBBsIntersect(CAM_POS, dirs[r], soa, batch_t, batch_mask);
+            ms = ms_since(start);
+            if(i == 0 || ms < batch_best)
+                batch_best = ms;
+        }
+        *out_single += single_best;
+        *out_batch += batch_best;
+
+        for(int j = 0; j < nboxes; j++) {
+
+            bool single = single_mask[j / 32] & (1u << (j % 32));
+            bool batch = batch_mask[j / 32] & (1u << (j % 32));
+            if(single != batch || (single && fabsf(single_t[j] - batch_t[j]) > 1e-3f * (1.0f + single_t[j])))
+                mismatched++;
+        }
+    }
+
+out:
+    free(batch_mask);
+    free(single_mask);
+    free(batch_t);
+    free(single_t);
+    return mismatched;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    size_t nboxes = 5000;
+    int iters = 50;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-b") && i + 1 < argc)
+            nboxes = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtoul(argv[++i], NULL, 10);
+        else
+            goto usage;
+    }
+    if(nboxes < 1 || iters < 1)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+
+    struct obb *obbs = malloc(nboxes * sizeof(struct obb));
+    uint32_t *single_mask = calloc((nboxes + 31) / 32, sizeof(uint32_t));
+    uint32_t *batch_mask = calloc((nboxes + 31) / 32, sizeof(uint32_t));
+    struct obb_soa soa;
+    C_OBBSoA_Init(&soa);
+
+    if(!obbs || !single_mask || !batch_mask || !C_OBBSoA_Resize(&soa, nboxes)) {
+        fprintf(stderr, "Failed to allocate %zu boxes\n", nboxes);
+        goto fail_alloc;
+    }
+
+    srand(1);
+    for(int i = 0; i < nboxes; i++) {
+        rand_obb(&obbs[i]);
+        C_OBBSoA_Set(&soa, i, &obbs[i]);
+    }
+
+    struct frustum frustum;
+    make_frustum(&frustum);
+
+    double single_best = 0.0, batch_best = 0.0;
+    for(int i = 0; i < iters; i++) {
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        memset(single_mask, 0, ((nboxes + 31) / 32) * sizeof(uint32_t));
+        for(int j = 0; j < nboxes; j++) {
+            if(C_FrustumOBBIntersectionFast(&frustum, &obbs[j]) != VOLUME_INTERSEC_OUTSIDE)
+                single_mask[j / 32] |= (1u << (j % 32));
+        }
+        double ms = ms_since(start);
+        if(i == 0 || ms < single_best)
+            single_best = ms;
+
+        start = SDL_GetPerformanceCounter();
+        C_FrustumOBBsCull(&frustum, &soa, batch_mask);
+        ms = ms_since(start);
+        if(i == 0 || ms < batch_best)
+            batch_best = ms;
+    }
+
+    size_t single_visible = 0, batch_visible = 0, mismatched = 0;
+    for(int j = 0; j < nboxes; j++) {
+
+        bool single = single_mask[j / 32] & (1u << (j % 32));
+        bool batch = batch_mask[j / 32] & (1u << (j % 32));
+        single_visible += single;
+        batch_visible += batch;
+        mismatched += (batch == behind_any_plane(&frustum, &obbs[j]));
+    }
+
+    printf("boxes: %zu, visible: %zu one at a time, %zu batched\n", 
+        nboxes, single_visible, batch_visible);
+    printf("  %-22s best %10.3f ms\n", "one at a time", single_best);
+    printf("  %-22s best %10.3f ms\n", "batched", batch_best);
+    printf("speedup: %.1fx\n", batch_best > 0.0 ? single_best / batch_best : 0.0);
+
+    if(mismatched) {
+        fprintf(stderr, "Mismatch: %zu boxes culled differently from the corner test\n", mismatched);
+        goto fail_alloc;
+    }
+
+    double ray_single, ray_batch;
+    mismatched = bench_rays(obbs, &soa, iters, &ray_single, &ray_batch);
+
+    printf("rays: %d, through %zu boxes each\n", NUM_RAYS, nboxes);
+    printf("  %-22s best %10.3f ms per ray\n", "one at a time", ray_single / NUM_RAYS);
+    printf("  %-22s best %10.3f ms per ray\n", "batched", ray_batch / NUM_RAYS);
+    printf("speedup: %.1fx\n", ray_batch > 0.0 ? ray_single / ray_batch : 0.0);
+
+    if(mismatched) {
+        fprintf(stderr, "Mismatch: %zu ray tests differ\n", mismatched);
+        goto fail_alloc;
+    }
+
+    ret = EXIT_SUCCESS;
+fail_alloc:
+    C_OBBSoA_Destroy(&soa);
+    free(batch_mask);
+    free(single_mask);
+    free(obbs);
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-b <boxes>] [-n <iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,427 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* Navigation grid benchmark. Times the searches over a single chunk's cost 
+ * field, which are the inner loops of path and flow field generation:
+ *
+ *   path    - A* paths between random passable tiles (AStar_GridPath)
+ *   costs   - the costs from a tile to the portals of a chunk (AStar_GridCosts)
+ *   flow    - flow fields towards a tile, integrated with a Dijkstra search 
+ *             (N_FlowFieldUpdate), on chunks with and without blockers
+ *   init    - the flow fields of the impassable tiles, which lead back to the 
+ *             portals of a chunk (N_FlowFieldInit)
+ *   repair  - flow fields brought up to date after a unit-sized group of 
+ *             blockers was added or removed (N_FlowFieldRepair), compared to 
+ *             rebuilding them. Every repaired field is checked against the 
+ *             rebuilt one.
+ *
+ * The cost fields are random, with walls of impassable tiles. A checksum of 
+ * the results is printed along with the timings, which must be the same for 
+ * any two builds that are compared.
+ *
+ * usage: bench_grid [-f <fields>] [-n <iterations>] [-s <seed>]
+ *
+ *   -f  number of random cost fields (default 16)
+ *   -n  number of times each search is timed, the best being reported (default 10)
+ *   -s  seed for the random cost fields (default 1)
+ */
+
+#include "../src/navigation/a_star.h"
+#include "../src/navigation/field.h"
+#include "../src/navigation/nav_data.h"
+#include "../src/navigation/nav_private.h"
+#include "../src/event.h"
+#include "../src/mem.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+
+#define QUERIES_PER_FIELD   (32)
+#define NUM_COST_TARGETS    (8)
+#define NUM_WALLS           (24)
+#define REPAIRS_PER_FIELD   (32)
+#define BLOCKER_RADIUS      (1)
+
+struct query{
+    struct coord src;
+    struct coord dst[NUM_COST_TARGETS];
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static struct coord random_passable(const struct nav_chunk *chunk)
+{
+    struct coord ret;
+    do{
+        ret = (struct coord){rand() % FIELD_RES_R, rand() % FIELD_RES_C};
+    }while(chunk->cost_base[ret.r][ret.c] == COST_IMPASSABLE);
+    return ret;
+}
+
+/* Horizontal and vertical walls with gaps, on ground of uneven cost. Every 
+ * other field has some tiles covered by blockers. */
+static void make_field(struct nav_chunk *chunk, bool blockers)
+{
+    memset(chunk, 0, sizeof(*chunk));
+    for(int r = 0; r < FIELD_RES_R; r++)
+        for(int c = 0; c < FIELD_RES_C; c++)
+            chunk->cost_base[r][c] = 1 + (rand() % 8 == 0);
+
+    for(int i = 0; i < NUM_WALLS; i++) {
+
+        bool vertical = rand() % 2;
+        int len = 8 + rand() % 24;
+        int r = rand() % FIELD_RES_R, c = rand() % FIELD_RES_C;
+        int gap = rand() % len;
+
+        for(int j = 0; j < len; j++) {
+            int wr = vertical ? r + j : r;
+            int wc = vertical ? c : c + j;
+            if(wr >= FIELD_RES_R || wc >= FIELD_RES_C || abs(j - gap) < 2)
+                continue;
+            chunk->cost_base[wr][wc] = COST_IMPASSABLE;
+        }
+    }
+
+    /* A portal on every edge of the chunk */
+    for(int i = 0; i < 4; i++) {
+
+        int begin = rand() % (FIELD_RES_C / 2);
+        int end = begin + 1 + rand() % (FIELD_RES_C / 2 - 1);
+        /* Along the top, bottom, left and right edges, in turn */
+        int edge = (i % 2) ? FIELD_RES_R - 1 : 0;
+        bool horizontal = (i < 2);
+
+        struct portal *port = &chunk->portals[chunk->num_portals++];
+        port->endpoints[0] = horizontal ? (struct coord){edge, begin} : (struct coord){begin, edge};
+        port->endpoints[1] = horizontal ? (struct coord){edge, end}   : (struct coord){end, edge};
+    }
+
+    if(!blockers)
+        return;
+    for(int i = 0; i < FIELD_RES_R * FIELD_RES_C / 16; i++) {
+        struct coord tile = random_passable(chunk);
+        if(!chunk->blockers[tile.r][tile.c]++)
+            chunk->num_blocked++;
+    }
+}
+
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static uint32_t hash_float(uint32_t hash, float val)
+{
+    return hash_bytes(hash, &val, sizeof(val));
+}
+
+/* Add or remove the blockers of a unit holding its' position at 'center' */
+static void change_blockers(struct nav_chunk *chunk, struct coord center, int delta)
+{
+    for(int r = center.r - BLOCKER_RADIUS; r <= center.r + BLOCKER_RADIUS; r++) {
+        for(int c = center.c - BLOCKER_RADIUS; c <= center.c + BLOCKER_RADIUS; c++) {
+
+            if(r < 0 || r >= FIELD_RES_R || c < 0 || c >= FIELD_RES_C)
+                continue;
+
+            uint8_t *count = &chunk->blockers[r][c];
+            if(delta > 0 && (*count)++ == 0)
+                chunk->num_blocked++;
+            if(delta < 0 && --(*count) == 0)
+                chunk->num_blocked--;
+        }
+    }
+}
+
+/* Keep a flow field for every chunk up to date while units come and go, both by 
+ * repairing it and by rebuilding it. Returns the number of repaired fields which 
+ * differ from the rebuilt ones. */
+static int run_repairs(struct nav_chunk *chunks, const struct query *queries, int nfields,
+                       double *out_repair_ms, double *out_rebuild_ms)
+{
+    struct flow_field *repaired = malloc(sizeof(struct flow_field));
+    struct flow_field *rebuilt = malloc(sizeof(struct flow_field));
+    struct ff_integration *state = malloc(sizeof(struct ff_integration));
+    int ret = 0;
+
+    *out_repair_ms = *out_rebuild_ms = 0.0;
+    if(!repaired || !rebuilt || !state)
+        goto out;
+
+    for(int i = 0; i < nfields; i++) {
+
+        struct nav_chunk *chunk = &chunks[i];
+        struct field_target target = (struct field_target){
+            .type = TARGET_TILE,
+            .tile = queries[i * QUERIES_PER_FIELD].src,
+        };
+        struct coord units[REPAIRS_PER_FIELD];
+        int num_units = 0;
+
+        memset(repaired, 0, sizeof(*repaired));
+        state->valid = false;
+        N_FlowFieldRepair(chunk, target, FIELD_INTEGRATE_DIJKSTRA, state, repaired);
+
+        for(int j = 0; j < REPAIRS_PER_FIELD; j++) {
+
+            if(num_units > 0 && rand() % 3 == 0) {
+                int idx = rand() % num_units;
+                change_blockers(chunk, units[idx], -1);
+                units[idx] = units[--num_units];
+            }else{
+                units[num_units] = random_passable(chunk);
+                change_blockers(chunk, units[num_units++], +1);
+            }
+
+            uint64_t start = SDL_GetPerformanceCounter();
+            N_FlowFieldRepair(chunk, target, FIELD_INTEGRATE_DIJKSTRA, state, repaired);
+            *out_repair_ms += ms_since(start);
+
+            start = SDL_GetPerformanceCounter();
+            memset(rebuilt, 0, sizeof(*rebuilt));
+            N_FlowFieldUpdate(chunk, target, FIELD_INTEGRATE_DIJKSTRA, rebuilt);
+            *out_rebuild_ms += ms_since(start);
+
+            if(0 != memcmp(repaired->field, rebuilt->field, sizeof(rebuilt->field)))
+                ret++;
+        }
+
+        while(num_units > 0)
+            change_blockers(chunk, units[--num_units], -1);
+    }
+
+out:
+    free(state);
+    free(rebuilt);
+    free(repaired);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The navigation code draws debug overlays and hooks into the engine's frame 
+ * events. Stand in for the parts of the engine that are not linked in. */
+void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count, 
+                              mat4x4_t *model, const struct map *map) {}
+
+void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t count,
+                        mat4x4_t *model, const struct map *map) {}
+
+bool E_Global_RegisterNamed(enum eventtype event, handler_t handler, const char *name, 
+                            void *user_arg) { return true; }
+
+bool E_Global_Unregister(enum eventtype event, handler_t handler) { return true; }
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    int nfields = 16;
+    int iters = 10;
+    unsigned seed = 1;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-f") && i + 1 < argc)
+            nfields = strtol(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtol(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-s") && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else
+            goto usage;
+    }
+    if(nfields < 1 || iters < 1)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+    if(!MEM_Init()) {
+        fprintf(stderr, "Failed to initialize the memory subsystem\n");
+        goto fail_mem;
+    }
+    if(!AStar_Init()) {
+        fprintf(stderr, "Failed to initialize the grid searches\n");
+        goto fail_astar;
+    }
+
+    /* The chunks make up a single row of navigation data, for N_FlowFieldInit */
+    struct nav_private *priv = calloc(1, sizeof(struct nav_private) + nfields * sizeof(struct nav_chunk));
+    struct nav_chunk *chunks = priv ? priv->chunks : NULL;
+    struct query *queries = malloc(nfields * QUERIES_PER_FIELD * sizeof(struct query));
+    struct flow_field *flow = malloc(sizeof(struct flow_field));
+    coord_vec_t path;
+    sv_init(path);
+
+    if(!priv || !queries || !flow) {
+        fprintf(stderr, "Failed to allocate %d fields\n", nfields);
+        goto fail_alloc;
+    }
+
+    priv->width = nfields;
+    priv->height = 1;
+
+    srand(seed);
+    for(int i = 0; i < nfields; i++) {
+
+        make_field(&chunks[i], i % 2);
+        for(int j = 0; j < QUERIES_PER_FIELD; j++) {
+            struct query *q = &queries[i * QUERIES_PER_FIELD + j];
+            q->src = random_passable(&chunks[i]);
+            for(int k = 0; k < NUM_COST_TARGETS; k++)
+                q->dst[k] = random_passable(&chunks[i]);
+        }
+    }
+
+    double best_path = INFINITY, best_costs = INFINITY, best_flow = INFINITY, best_init = INFINITY;
+    uint32_t path_hash = 2166136261u, costs_hash = 2166136261u, flow_hash = 2166136261u, 
+        init_hash = 2166136261u;
+
+    for(int it = 0; it < iters; it++) {
+
+        /* Only the results of the first run are hashed */
+        bool hash = (it == 0);
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        for(int i = 0; i < nfields * QUERIES_PER_FIELD; i++) {
+
+            const struct query *q = &queries[i];
+            float cost;
+            bool found = AStar_GridPath(q->src, q->dst[0], chunks[i / QUERIES_PER_FIELD].cost_base, 
+                &path, &cost);
+            if(hash)
+                path_hash = hash_float(path_hash, found ? cost : -1.0f);
+        }
+        double elapsed = ms_since(start);
+        best_path = elapsed < best_path ? elapsed : best_path;
+
+        start = SDL_GetPerformanceCounter();
+        for(int i = 0; i < nfields * QUERIES_PER_FIELD; i++) {
+
+            const struct query *q = &queries[i];
+            float costs[NUM_COST_TARGETS];
+            AStar_GridCosts(q->src, chunks[i / QUERIES_PER_FIELD].cost_base, 
+                NUM_COST_TARGETS, q->dst, costs);
+            if(hash)
+                costs_hash = hash_bytes(costs_hash, costs, sizeof(costs));
+        }
+        elapsed = ms_since(start);
+        best_costs = elapsed < best_costs ? elapsed : best_costs;
+
+        start = SDL_GetPerformanceCounter();
+        for(int i = 0; i < nfields; i++) {
+
+            struct field_target target = (struct field_target){
+                .type = TARGET_TILE,
+                .tile = queries[i * QUERIES_PER_FIELD].src,
+            };
+            memset(flow, 0, sizeof(*flow));
+            N_FlowFieldUpdate(&chunks[i], target, FIELD_INTEGRATE_DIJKSTRA, flow);
+            if(hash)
+                flow_hash = hash_bytes(flow_hash, flow->field, sizeof(flow->field));
+        }
+        elapsed = ms_since(start);
+        best_flow = elapsed < best_flow ? elapsed : best_flow;
+
+        start = SDL_GetPerformanceCounter();
+        for(int i = 0; i < nfields; i++) {
+
+            N_FlowFieldInit((struct coord){0, i}, priv, flow);
+            if(hash)
+                init_hash = hash_bytes(init_hash, flow->field, sizeof(flow->field));
+        }
+        elapsed = ms_since(start);
+        best_init = elapsed < best_init ? elapsed : best_init;
+    }
+
+    int nqueries = nfields * QUERIES_PER_FIELD;
+    printf("fields: %d, queries: %d\n", nfields, nqueries);
+    printf("  %-8s best %8.3f us per call  (checksum %08x)\n", "path", 
+        best_path * 1000.0 / nqueries, path_hash);
+    printf("  %-8s best %8.3f us per call  (checksum %08x)\n", "costs", 
+        best_costs * 1000.0 / nqueries, costs_hash);
+    printf("  %-8s best %8.3f us per call  (checksum %08x)\n", "flow", 
+        best_flow * 1000.0 / nfields, flow_hash);
+    printf("  %-8s best %8.3f us per call  (checksum %08x)\n", "init", 
+        best_init * 1000.0 / nfields, init_hash);
+
+    double repair_ms, rebuild_ms;
+    int mismatches = run_repairs(chunks, queries, nfields, &repair_ms, &rebuild_ms);
+    printf("  %-8s      %8.3f us per call  (rebuild %.3f us, %d of %d differ)\n", "repair", 
+        repair_ms * 1000.0 / (nfields * REPAIRS_PER_FIELD), 
+        rebuild_ms * 1000.0 / (nfields * REPAIRS_PER_FIELD), mismatches, nfields * REPAIRS_PER_FIELD);
+
+    if(mismatches == 0)
+        ret = EXIT_SUCCESS;
+
+fail_alloc:
+    sv_destroy(path);
+    free(flow);
+    free(queries);
+    free(priv);
+    AStar_Shutdown();
+fail_astar:
+    MEM_Shutdown();
+fail_mem:
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-f <fields>] [-n <iterations>] [-s <seed>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
@@ -0,0 +1,309 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* Hash table benchmark. Times khash against the flat hash table on the key 
+ * patterns of the engine's hottest integer-keyed tables:
+ *
+ *   uid    - entity UIDs, which are handed out in increasing order with gaps
+ *            left by removed entities. Every lookup hits, as when the movement
+ *            tick finds the slot of every steered entity.
+ *   e_key  - (UID, event type) pairs, as looked up by the event system for 
+ *            every entity event. Most entities have no handlers for most 
+ *            events, so most of the lookups miss.
+ *   field  - (destination, chunk) pairs, as in the navigation field cache. 
+ *            The destinations are hashes of the targets. Entries are evicted 
+ *            and replaced all the time.
+ *
+ * For every pattern, the time to insert all the keys, to look up the probes
+ * and to delete and insert again a quarter as many keys ('churn') is taken.
+ * Both tables must find the same entries.
+ *
+ * usage: bench_hash [-e <entries>] [-n <iterations>]
+ *
+ *   -e  number of entries in each table (default 20000)
+ *   -n  number of times each table is timed, the best being reported (default 20)
+ */
+
+#include "../src/lib/public/khash.h"
+#include "../src/lib/public/flat_hash.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#define NUM_PROBES  (1 << 20)
+
+struct timings{
+    double insert;
+    double lookup;
+    double churn;
+    /* Sum of the values of the entries found by the lookups */
+    uint64_t found;
+};
+
+KHASH_MAP_INIT_INT(kh_int, uint32_t)
+KHASH_MAP_INIT_INT64(kh_int64, uint32_t)
+FLATHASH_MAP_INIT_INT(fh_int, uint32_t)
+FLATHASH_MAP_INIT_INT64(fh_int64, uint32_t)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static uint64_t rand64(void)
+{
+    return ((uint64_t)rand() << 48) ^ ((uint64_t)rand() << 24) ^ (uint64_t)rand();
+}
+
+static void shuffle(uint64_t *keys, size_t n)
+{
+    for(size_t i = n - 1; i > 0; i--) {
+        size_t j = rand64() % (i + 1);
+        uint64_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+static void keep_best(struct timings *best, const struct timings *curr, int iter)
+{
+    if(iter == 0 || curr->insert < best->insert)
+        best->insert = curr->insert;
+    if(iter == 0 || curr->lookup < best->lookup)
+        best->lookup = curr->lookup;
+    if(iter == 0 || curr->churn < best->churn)
+        best->churn = curr->churn;
+    best->found = curr->found;
+}
+
+/* The same run for each table. The churn replaces the first entries with the
+ * 'fresh' keys, which are not in the table. */
+#define BENCH_TABLE(fn, prefix, name, key_t)                                        \
+    static void fn(const uint64_t *keys, size_t n, const uint64_t *fresh,           \
+                   const uint64_t *probes, int iters, struct timings *out)          \
+    {                                                                               \
+        for(int it = 0; it < iters; it++) {                                         \
+            struct timings curr = {0};                                              \
+            prefix##_t(name) *h = prefix##_init(name);                              \
+            int ret;                                                                \
+                                                                                    \
+            uint64_t start = SDL_GetPerformanceCounter();                           \
+            for(size_t i = 0; i < n; i++) {                                         \
+                uint32_t x = prefix##_put(name, h, (key_t)keys[i], &ret);           \
+                prefix##_value(h, x) = (uint32_t)i;                                 \
+            }                                                                       \
+            curr.insert = ms_since(start);                                          \
+                                                                                    \
+            start = SDL_GetPerformanceCounter();                                    \
+            for(size_t i = 0; i < NUM_PROBES; i++) {                                \
+                uint32_t x = prefix##_get(name, h, (key_t)probes[i]);               \
+                if(x != prefix##_end(h))                                            \
+                    curr.found += prefix##_value(h, x);                             \
+            }                                                                       \
+            curr.lookup = ms_since(start);                                          \
+                                                                                    \
+            start = SDL_GetPerformanceCounter();                                    \
+            for(size_t i = 0; i < n / 4; i++) {                                     \
+                prefix##_del(name, h, prefix##_get(name, h, (key_t)keys[i]));       \
+                uint32_t x = prefix##_put(name, h, (key_t)fresh[i], &ret);          \
+                prefix##_value(h, x) = (uint32_t)i;                                 \
+            }                                                                       \
+            curr.churn = ms_since(start);                                           \
+                                                                                    \
+            prefix##_destroy(name, h);                                              \
+            keep_best(out, &curr, it);                                              \
+        }                                                                           \
+    }
+
+/* Both tables are named the same way in BENCH_TABLE. Deleting the end 
+ * iterator, as the churn does for repeated keys, is a no-op for both. */
+#define kh_t(name) khash_t(name)
+
+BENCH_TABLE(bench_kh_int,   kh, kh_int,   uint32_t)
+BENCH_TABLE(bench_kh_int64, kh, kh_int64, uint64_t)
+BENCH_TABLE(bench_fh_int,   fh, fh_int,   uint32_t)
+BENCH_TABLE(bench_fh_int64, fh, fh_int64, uint64_t)
+
+/* Half of the probes are of keys in the table when 'hit_rate' is 0.5 */
+static void make_probes(const uint64_t *keys, size_t n, const uint64_t *misses, 
+                        float hit_rate, uint64_t *out)
+{
+    for(size_t i = 0; i < NUM_PROBES; i++) {
+        if(rand() / (float)RAND_MAX < hit_rate)
+            out[i] = keys[rand64() % n];
+        else
+            out[i] = misses[rand64() % n];
+    }
+}
+
+static void make_uid_keys(size_t n, uint64_t *keys, uint64_t *fresh)
+{
+    uint64_t uid = 1;
+    for(size_t i = 0; i < n; i++) {
+        /* Every so often, a run of entities has since been removed */
+        if(rand() % 8 == 0)
+            uid += rand() % 16;
+        keys[i] = uid++;
+    }
+    for(size_t i = 0; i < n; i++)
+        fresh[i] = uid++;
+}
+
+static void make_event_keys(size_t n, uint64_t *keys, uint64_t *misses)
+{
+    /* A few handlers each on the entities, for the 64 event types */
+    uint64_t uid = 1;
+    for(size_t i = 0; i < n; i++) {
+        if(i % 4 == 0)
+            uid += 1 + rand() % 4;
+        keys[i] = (uid << 32) | (rand() % 64);
+    }
+    for(size_t i = 0; i < n; i++)
+        misses[i] = ((uid + 1 + i) << 32) | (rand() % 64);
+}
+
+static void make_field_keys(size_t n, uint64_t *keys, uint64_t *fresh)
+{
+    /* The path of every destination goes through 64 chunks of the map */
+    for(size_t i = 0; i < n; i++) {
+        uint64_t dest = (uint32_t)rand64();
+        for(size_t j = 0; j < 64 && i < n; j++, i++)
+            keys[i] = (dest << 32) | (uint64_t)(rand() % 64) << 16 | (rand() % 64);
+        i--;
+    }
+    for(size_t i = 0; i < n; i++)
+        fresh[i] = ((uint64_t)(uint32_t)rand64() << 32) | (uint64_t)(rand() % 64) << 16 | (rand() % 64);
+}
+
+static void print_timings(const char *pattern, const char *table, const struct timings *t)
+{
+    printf("%-6s %-6s  insert: %8.3f ms  lookup: %8.3f ms  churn: %8.3f ms\n",
+        pattern, table, t->insert, t->lookup, t->churn);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    size_t nentries = 20000;
+    int iters = 20;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-e") && i + 1 < argc)
+            nentries = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtoul(argv[++i], NULL, 10);
+        else
+            goto usage;
+    }
+    if(nentries < 4 || iters < 1)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+
+    uint64_t *keys = malloc(nentries * sizeof(uint64_t));
+    uint64_t *others = malloc(nentries * sizeof(uint64_t));
+    uint64_t *probes = malloc(NUM_PROBES * sizeof(uint64_t));
+
+    if(!keys || !others || !probes) {
+        fprintf(stderr, "Failed to allocate %zu entries\n", nentries);
+        goto fail_alloc;
+    }
+
+    srand(1);
+    bool agree = true;
+    struct timings kh, fh;
+
+    make_uid_keys(nentries, keys, others);
+    make_probes(keys, nentries, others, 1.0f, probes);
+    shuffle(keys, nentries);
+    bench_kh_int(keys, nentries, others, probes, iters, &kh);
+    bench_fh_int(keys, nentries, others, probes, iters, &fh);
+    print_timings("uid", "khash", &kh);
+    print_timings("uid", "flat", &fh);
+    agree &= (kh.found == fh.found);
+
+    make_event_keys(nentries, keys, others);
+    make_probes(keys, nentries, others, 0.25f, probes);
+    bench_kh_int64(keys, nentries, others, probes, iters, &kh);
+    bench_fh_int64(keys, nentries, others, probes, iters, &fh);
+    print_timings("e_key", "khash", &kh);
+    print_timings("e_key", "flat", &fh);
+    agree &= (kh.found == fh.found);
+
+    make_field_keys(nentries, keys, others);
+    make_probes(keys, nentries, others, 0.75f, probes);
+    bench_kh_int64(keys, nentries, others, probes, iters, &kh);
+    bench_fh_int64(keys, nentries, others, probes, iters, &fh);
+    print_timings("field", "khash", &kh);
+    print_timings("field", "flat", &fh);
+    agree &= (kh.found == fh.found);
+
+    if(!agree) {
+        fprintf(stderr, "The tables found different entries\n");
+        goto fail_alloc;
+    }
+    ret = EXIT_SUCCESS;
+
+fail_alloc:
+    free(probes);
+    free(others);
+    free(keys);
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-e <entries>] [-n <iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
@@ -0,0 +1,725 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+/* Microbenchmarks of the collision and math kernels used by culling, picking
+ * and steering. Builds without SDL or GL, so that it can be run anywhere the
+ * sources compile. Every kernel is timed over a batch of randomized inputs,
+ * one call at a time and, where there is one, with its' batched variant, and
+ * reported in nanoseconds per operation. The batched results are checked 
+ * against the scalar ones:
+ *
+ *   frustum_aabb_exact  - 'C_FrustumAABBIntersectionExact'. Has no batched 
+ *                         variant, but no box culled by 'C_FrustumAABBsCull' 
+ *                         may be found to intersect the frustum.
+ *   frustum_aabb_cull   - 'C_FrustumAABBIntersectionFast' and 
+ *                         'C_FrustumAABBsCull', checked against testing the 8
+ *                         corners of every box against every plane.
+ *   frustum_obb_cull    - 'C_FrustumOBBIntersectionFast' and 
+ *                         'C_FrustumOBBsCull', checked the same way.
+ *   ray_obb             - 'C_RayIntersectsOBB' and 'C_RayOBBsIntersect', which
+ *                         must hit the same boxes at the same distances.
+ *   line_circle         - 'C_LineCircleIntersection' and 
+ *                         'C_LineCirclesIntersect', likewise for circles. 
+ *                         Segments which only just graze a circle are left 
+ *                         out of the check, as the rounding decides those.
+ *   mat4_mult           - 'PFM_Mat4x4_Mult4x4' and 'PFM_Mat4x4_Mult4x4N'.
+ *   mat4_transform      - 'PFM_Mat4x4_Mult4x1' and 'PFM_Mat4x4_TransformPoints'.
+ *   mat4_inverse        - 'PFM_Mat4x4_Inverse', checked by multiplying the 
+ *                         inverse back with the matrix.
+ *
+ * usage: bench_kernels [-c <count>] [-n <iterations>]
+ *
+ *   -c  number of inputs in each batch (default 4096)
+ *   -n  number of times each batch is timed, the best being reported (default 50)
+ */
+
+/* For 'clock_gettime' */
+#define _POSIX_C_SOURCE 199309L
+
+#include "../src/collision.h"
+#include "../src/pf_math.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+
+#define FIELD_DIM   (1024.0f)
+#define CAM_POS     ((vec3_t){0.0f, 150.0f, 0.0f})
+#define LINE_LEN    (64.0f)
+#define TOLERANCE   (1e-3f)
+#define MASK_WORDS(n) (((n) + 31) / 32)
+#define MASK_GET(mask, i) (!!((mask)[(i) / 32] & (1u << ((i) % 32))))
+#define MASK_SET(mask, i) ((mask)[(i) / 32] |= (1u << ((i) % 32)))
+
+struct result{
+    const char *name;
+    double      scalar_ns;
+    /* Negative when the kernel has no batched variant */
+    double      batch_ns;
+    size_t      mismatched;
+};
+
+struct inputs{
+    size_t          count;
+    struct frustum  frustum;
+    struct aabb    *aabbs;
+    float          *aabb_center[3];
+    float          *aabb_half[3];
+    struct obb     *obbs;
+    struct obb_soa  obb_soa;
+    vec3_t          ray_dir;
+    struct line_seg_2d line;
+    float          *circle_x;
+    float          *circle_z;
+    float          *circle_r;
+    mat4x4_t       *mats_a;
+    mat4x4_t       *mats_b;
+    vec3_t         *points;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Scalar results are summed into this, so that the calls can't be optimized 
+ * away */
+static volatile float s_sink;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t now_ns(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(count.QuadPart * (1e9 / freq.QuadPart));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static void keep_best(double *best, uint64_t start, int iter)
+{
+    double ns = (double)(now_ns() - start);
+    if(iter == 0 || ns < *best)
+        *best = ns;
+}
+
+static float frand(float min, float max)
+{
+    return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+static vec3_t rand_unit_vec(void)
+{
+    vec3_t ret;
+    do{
+        ret = (vec3_t){frand(-1.0f, 1.0f), frand(-1.0f, 1.0f), frand(-1.0f, 1.0f)};
+    }while(PFM_Vec3_Len(&ret) < 0.1f);
+
+    PFM_Vec3_Normal(&ret, &ret);
+    return ret;
+}
+
+static void rand_obb(struct obb *out)
+{
+    out->center = (vec3_t){frand(-FIELD_DIM, FIELD_DIM), frand(0.0f, 20.0f), frand(-FIELD_DIM, FIELD_DIM)};
+
+    /* An orthonormal basis from two random directions */
+    vec3_t a = rand_unit_vec(), b = rand_unit_vec(), c;
+    PFM_Vec3_Cross(&a, &b, &c);
+    PFM_Vec3_Normal(&c, &c);
+    PFM_Vec3_Cross(&c, &a, &b);
+
+    out->axes[0] = a;
+    out->axes[1] = b;
+    out->axes[2] = c;
+    for(int i = 0; i < 3; i++)
+        out->half_lengths[i] = frand(0.5f, 8.0f);
+
+    for(int i = 0; i < 8; i++) {
+
+        out->corners[i] = out->center;
+        for(int j = 0; j < 3; j++) {
+
+            float sign = (i & (4 >> j)) ? 1.0f : -1.0f;
+            vec3_t off;
+            PFM_Vec3_Scale(&out->axes[j], sign * out->half_lengths[j], &off);
+            PFM_Vec3_Add(&out->corners[i], &off, &out->corners[i]);
+        }
+    }
+}
+
+static void rand_aabb(struct aabb *out)
+{
+    float x = frand(-FIELD_DIM, FIELD_DIM), y = frand(0.0f, 20.0f), z = frand(-FIELD_DIM, FIELD_DIM);
+    float hx = frand(0.5f, 8.0f), hy = frand(0.5f, 8.0f), hz = frand(0.5f, 8.0f);
+    *out = (struct aabb){x - hx, x + hx, y - hy, y + hy, z - hz, z + hz};
+}
+
+/* A rotation, scale and translation, which is always invertible */
+static void rand_affine(mat4x4_t *out)
+{
+    mat4x4_t rot, scale, trans, tmp;
+    PFM_Mat4x4_RotFromEuler(frand(-180.0f, 180.0f), frand(-180.0f, 180.0f), frand(-180.0f, 180.0f), &rot);
+    PFM_Mat4x4_MakeScale(frand(0.5f, 2.0f), frand(0.5f, 2.0f), frand(0.5f, 2.0f), &scale);
+    PFM_Mat4x4_MakeTrans(frand(-100.0f, 100.0f), frand(-100.0f, 100.0f), frand(-100.0f, 100.0f), &trans);
+    PFM_Mat4x4_Mult4x4(&rot, &scale, &tmp);
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
+}
+
+/* A perspective frustum looking down and along -Z, like an RTS camera, with
+ * both its' planes and its' corners set for the exact tests */
+static void make_frustum(struct frustum *out)
+{
+    const float fov = 45.0f * M_PI / 180.0f, aspect = 16.0f / 9.0f;
+    const float near = 0.1f, far = 1000.0f;
+
+    vec3_t pos = CAM_POS;
+    vec3_t dir = (vec3_t){0.0f, -0.7f, -0.7f}, up, right;
+    vec3_t world_up = (vec3_t){0.0f, 1.0f, 0.0f};
+
+    PFM_Vec3_Normal(&dir, &dir);
+    PFM_Vec3_Cross(&dir, &world_up, &right);
+    PFM_Vec3_Normal(&right, &right);
+    PFM_Vec3_Cross(&right, &dir, &up);
+
+    float tan_v = tanf(fov / 2.0f), tan_h = tan_v * aspect;
+    vec3_t tmp, n;
+
+    out->near = (struct plane){pos, dir};
+    PFM_Vec3_Scale(&dir, far, &tmp);
+    PFM_Vec3_Add(&pos, &tmp, &tmp);
+    out->far = (struct plane){tmp, (vec3_t){-dir.x, -dir.y, -dir.z}};
+    PFM_Vec3_Scale(&dir, near, &tmp);
+    PFM_Vec3_Add(&pos, &tmp, &out->near.point);
+
+    /* Each side plane's normal points into the frustum */
+    for(int side = 0; side < 4; side++) {
+
+        vec3_t axis = (side < 2) ? up : right;
+        float tangent = (side < 2) ? tan_v : tan_h;
+        float sign = (side % 2) ? -1.0f : 1.0f;
+
+        /* The plane contains the direction 'dir + sign * tangent * axis' */
+        PFM_Vec3_Scale(&axis, -sign, &n);
+        PFM_Vec3_Scale(&dir, tangent, &tmp);
+        PFM_Vec3_Add(&n, &tmp, &n);
+        PFM_Vec3_Normal(&n, &n);
+
+        struct plane *planes[4] = {&out->top, &out->bot, &out->right, &out->left};
+        *planes[side] = (struct plane){pos, n};
+    }
+
+    const float dists[2] = {near, far};
+    vec3_t *corners[2][4] = {
+        {&out->ntl, &out->ntr, &out->nbl, &out->nbr},
+        {&out->ftl, &out->ftr, &out->fbl, &out->fbr},
+    };
+
+    for(int i = 0; i < 2; i++) {
+        for(int j = 0; j < 4; j++) {
+
+            float v = (j < 2 ? 1.0f : -1.0f) * dists[i] * tan_v;
+            float h = (j % 2 ? 1.0f : -1.0f) * dists[i] * tan_h;
+            vec3_t corner = pos, off;
+
+            PFM_Vec3_Scale(&dir, dists[i], &off);
+            PFM_Vec3_Add(&corner, &off, &corner);
+            PFM_Vec3_Scale(&up, v, &off);
+            PFM_Vec3_Add(&corner, &off, &corner);
+            PFM_Vec3_Scale(&right, h, &off);
+            PFM_Vec3_Add(&corner, &off, &corner);
+            *corners[i][j] = corner;
+        }
+    }
+}
+
+static bool corners_behind_any_plane(const struct frustum *frustum, const vec3_t corners[8])
+{
+    const struct plane *planes[] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                    &frustum->right, &frustum->near, &frustum->far};
+
+    for(int i = 0; i < 6; i++) {
+
+        bool all_behind = true;
+        for(int j = 0; j < 8; j++) {
+
+            vec3_t diff;
+            PFM_Vec3_Sub((vec3_t*)&corners[j], (vec3_t*)&planes[i]->point, &diff);
+            if(PFM_Vec3_Dot(&diff, (vec3_t*)&planes[i]->normal) >= 0.0f)
+                all_behind = false;
+        }
+        if(all_behind)
+            return true;
+    }
+    return false;
+}
+
+static void aabb_corners(const struct aabb *aabb, vec3_t out[8])
+{
+    for(int i = 0; i < 8; i++) {
+        out[i] = (vec3_t){
+            (i & 4) ? aabb->x_max : aabb->x_min,
+            (i & 2) ? aabb->y_max : aabb->y_min,
+            (i & 1) ? aabb->z_max : aabb->z_min,
+        };
+    }
+}
+
+static bool close_enough(float a, float b)
+{
+    return fabsf(a - b) <= TOLERANCE * (1.0f + fabsf(a));
+}
+
+/* Whether the segment only just grazes or misses the circle, in which case 
+ * the rounding of the single precision kernels decides if it is a hit */
+static bool grazes_circle(struct line_seg_2d line, float cx, float cz, float r)
+{
+    double dx = line.bx - line.ax, dz = line.bz - line.az;
+    double t = ((cx - line.ax) * dx + (cz - line.az) * dz) / (dx * dx + dz * dz);
+    t = t < 0.0 ? 0.0 : t > 1.0 ? 1.0 : t;
+    double dist = hypot(line.ax + t * dx - cx, line.az + t * dz - cz);
+    return fabs(dist - r) <= TOLERANCE * (1.0 + r);
+}
+
+static bool inputs_init(struct inputs *in, size_t count)
+{
+    memset(in, 0, sizeof(*in));
+    in->count = count;
+    C_OBBSoA_Init(&in->obb_soa);
+
+    in->aabbs = malloc(count * sizeof(struct aabb));
+    in->obbs = malloc(count * sizeof(struct obb));
+    in->circle_x = malloc(count * sizeof(float));
+    in->circle_z = malloc(count * sizeof(float));
+    in->circle_r = malloc(count * sizeof(float));
+    in->mats_a = malloc(count * sizeof(mat4x4_t));
+    in->mats_b = malloc(count * sizeof(mat4x4_t));
+    in->points = malloc(count * sizeof(vec3_t));
+
+    bool ok = in->aabbs && in->obbs && in->circle_x && in->circle_z && in->circle_r
+           && in->mats_a && in->mats_b && in->points
+           && C_OBBSoA_Resize(&in->obb_soa, count);
+
+    for(int i = 0; i < 3; i++) {
+        in->aabb_center[i] = malloc(count * sizeof(float));
+        in->aabb_half[i] = malloc(count * sizeof(float));
+        ok = ok && in->aabb_center[i] && in->aabb_half[i];
+    }
+    if(!ok)
+        return false;
+
+    make_frustum(&in->frustum);
+
+    for(int i = 0; i < count; i++) {
+
+        struct aabb *aabb = &in->aabbs[i];
+        rand_aabb(aabb);
+        in->aabb_center[0][i] = (aabb->x_min + aabb->x_max) / 2.0f;
+        in->aabb_center[1][i] = (aabb->y_min + aabb->y_max) / 2.0f;
+        in->aabb_center[2][i] = (aabb->z_min + aabb->z_max) / 2.0f;
+        in->aabb_half[0][i] = (aabb->x_max - aabb->x_min) / 2.0f;
+        in->aabb_half[1][i] = (aabb->y_max - aabb->y_min) / 2.0f;
+        in->aabb_half[2][i] = (aabb->z_max - aabb->z_min) / 2.0f;
+
+        rand_obb(&in->obbs[i]);
+        C_OBBSoA_Set(&in->obb_soa, i, &in->obbs[i]);
+
+        /* Units around the look-ahead segment of a steered unit */
+        in->circle_x[i] = frand(-LINE_LEN, LINE_LEN);
+        in->circle_z[i] = frand(-LINE_LEN / 4.0f, LINE_LEN / 4.0f);
+        in->circle_r[i] = frand(1.0f, 8.0f);
+
+        rand_affine(&in->mats_a[i]);
+        rand_affine(&in->mats_b[i]);
+        in->points[i] = (vec3_t){frand(-100.0f, 100.0f), frand(-100.0f, 100.0f), frand(-100.0f, 100.0f)};
+    }
+
+    vec3_t target = (vec3_t){frand(-FIELD_DIM / 8.0f, FIELD_DIM / 8.0f), 0.0f, frand(-FIELD_DIM, 0.0f)};
+    PFM_Vec3_Sub(&target, &CAM_POS, &in->ray_dir);
+    PFM_Vec3_Normal(&in->ray_dir, &in->ray_dir);
+
+    in->line = (struct line_seg_2d){-LINE_LEN / 2.0f, frand(-8.0f, 8.0f), LINE_LEN / 2.0f, frand(-8.0f, 8.0f)};
+    return true;
+}
+
+static void inputs_destroy(struct inputs *in)
+{
+    for(int i = 0; i < 3; i++) {
+        free(in->aabb_center[i]);
+        free(in->aabb_half[i]);
+    }
+    free(in->points);
+    free(in->mats_b);
+    free(in->mats_a);
+    free(in->circle_r);
+    free(in->circle_z);
+    free(in->circle_x);
+    free(in->obbs);
+    free(in->aabbs);
+    C_OBBSoA_Destroy(&in->obb_soa);
+}
+
+static void bench_frustum_aabb_exact(const struct inputs *in, int iters, uint32_t *mask, struct result *out)
+{
+    size_t n = in->count;
+    bool *visible = malloc(n * sizeof(bool));
+    out->batch_ns = -1.0;
+    if(!visible) {
+        out->mismatched = n;
+        return;
+    }
+
+    for(int it = 0; it < iters; it++) {
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++)
+            visible[i] = C_FrustumAABBIntersectionExact(&in->frustum, &in->aabbs[i]);
+        keep_best(&out->scalar_ns, start, it);
+    }
+
+    C_FrustumAABBsCull(&in->frustum, n, (const float *const *)in->aabb_center, 
+        (const float *const *)in->aabb_half, mask);
+    for(int i = 0; i < n; i++)
+        out->mismatched += (visible[i] && !MASK_GET(mask, i));
+    free(visible);
+}
+
+static void bench_frustum_aabb_cull(const struct inputs *in, int iters, uint32_t *mask, struct result *out)
+{
+    size_t n = in->count;
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        float sum = 0.0f;
+        for(int i = 0; i < n; i++)
+            sum += (C_FrustumAABBIntersectionFast(&in->frustum, &in->aabbs[i]) != VOLUME_INTERSEC_OUTSIDE);
+        keep_best(&out->scalar_ns, start, it);
+        s_sink += sum;
+
+        start = now_ns();
+        C_FrustumAABBsCull(&in->frustum, n, (const float *const *)in->aabb_center, 
+            (const float *const *)in->aabb_half, mask);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++) {
+        vec3_t corners[8];
+        aabb_corners(&in->aabbs[i], corners);
+        out->mismatched += (MASK_GET(mask, i) == corners_behind_any_plane(&in->frustum, corners));
+    }
+}
+
+static void bench_frustum_obb_cull(const struct inputs *in, int iters, uint32_t *mask, struct result *out)
+{
+    size_t n = in->count;
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        float sum = 0.0f;
+        for(int i = 0; i < n; i++)
+            sum += (C_FrustumOBBIntersectionFast(&in->frustum, &in->obbs[i]) != VOLUME_INTERSEC_OUTSIDE);
+        keep_best(&out->scalar_ns, start, it);
+        s_sink += sum;
+
+        start = now_ns();
+        C_FrustumOBBsCull(&in->frustum, &in->obb_soa, mask);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++)
+        out->mismatched += (MASK_GET(mask, i) == corners_behind_any_plane(&in->frustum, in->obbs[i].corners));
+}
+
+static void bench_ray_obb(const struct inputs *in, int iters, uint32_t *mask, float *t, 
+                          float *batch_t, struct result *out)
+{
+    size_t n = in->count;
+    bool *hit = malloc(n * sizeof(bool));
+    if(!hit) {
+        out->mismatched = n;
+        return;
+    }
+
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++)
+            hit[i] = C_RayIntersectsOBB(CAM_POS, in->ray_dir, in->obbs[i], &t[i]);
+        keep_best(&out->scalar_ns, start, it);
+
+        start = now_ns();
+        C_RayOBBsIntersect(CAM_POS, in->ray_dir, &in->obb_soa, batch_t, mask);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++) {
+        bool batch = MASK_GET(mask, i);
+        out->mismatched += (hit[i] != batch || (hit[i] && !close_enough(t[i], batch_t[i])));
+    }
+    free(hit);
+}
+
+static void bench_line_circle(const struct inputs *in, int iters, uint32_t *mask, float *t, 
+                              float *batch_t, struct result *out)
+{
+    size_t n = in->count;
+    bool *hit = malloc(n * sizeof(bool));
+    if(!hit) {
+        out->mismatched = n;
+        return;
+    }
+
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++) {
+            vec2_t center = (vec2_t){in->circle_x[i], in->circle_z[i]};
+            hit[i] = C_LineCircleIntersection(in->line, center, in->circle_r[i], &t[i]);
+        }
+        keep_best(&out->scalar_ns, start, it);
+
+        start = now_ns();
+        C_LineCirclesIntersect(in->line, n, in->circle_x, in->circle_z, in->circle_r, batch_t, mask);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++) {
+        bool batch = MASK_GET(mask, i);
+        if(grazes_circle(in->line, in->circle_x[i], in->circle_z[i], in->circle_r[i]))
+            continue;
+        out->mismatched += (hit[i] != batch || (hit[i] && !close_enough(t[i], batch_t[i])));
+    }
+    free(hit);
+}
+
+static bool mats_close(const mat4x4_t *a, const mat4x4_t *b)
+{
+    for(int i = 0; i < 16; i++) {
+        if(!close_enough(a->raw[i], b->raw[i]))
+            return false;
+    }
+    return true;
+}
+
+static void bench_mat4_mult(const struct inputs *in, int iters, mat4x4_t *scalar, mat4x4_t *batch, 
+                            struct result *out)
+{
+    size_t n = in->count;
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++)
+            PFM_Mat4x4_Mult4x4(&in->mats_a[i], &in->mats_b[i], &scalar[i]);
+        keep_best(&out->scalar_ns, start, it);
+
+        start = now_ns();
+        PFM_Mat4x4_Mult4x4N(n, in->mats_a, in->mats_b, batch);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++)
+        out->mismatched += !mats_close(&scalar[i], &batch[i]);
+}
+
+static void bench_mat4_transform(const struct inputs *in, int iters, vec3_t *scalar, vec3_t *batch, 
+                                 struct result *out)
+{
+    size_t n = in->count;
+    const mat4x4_t *mat = &in->mats_a[0];
+
+    for(int it = 0; it < iters; it++) {
+
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++) {
+            vec4_t point = (vec4_t){in->points[i].x, in->points[i].y, in->points[i].z, 1.0f}, res;
+            PFM_Mat4x4_Mult4x1(mat, &point, &res);
+            scalar[i] = (vec3_t){res.x, res.y, res.z};
+        }
+        keep_best(&out->scalar_ns, start, it);
+
+        start = now_ns();
+        PFM_Mat4x4_TransformPoints(mat, n, in->points, batch);
+        keep_best(&out->batch_ns, start, it);
+    }
+
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < 3; j++)
+            if(!close_enough(scalar[i].raw[j], batch[i].raw[j])) {
+                out->mismatched++;
+                break;
+            }
+    }
+}
+
+static void bench_mat4_inverse(const struct inputs *in, int iters, mat4x4_t *inv, struct result *out)
+{
+    size_t n = in->count;
+    out->batch_ns = -1.0;
+
+    for(int it = 0; it < iters; it++) {
+        uint64_t start = now_ns();
+        for(int i = 0; i < n; i++)
+            PFM_Mat4x4_Inverse((mat4x4_t*)&in->mats_a[i], &inv[i]);
+        keep_best(&out->scalar_ns, start, it);
+    }
+
+    mat4x4_t identity;
+    PFM_Mat4x4_Identity(&identity);
+
+    for(int i = 0; i < n; i++) {
+        mat4x4_t prod;
+        PFM_Mat4x4_Mult4x4(&in->mats_a[i], &inv[i], &prod);
+        out->mismatched += !mats_close(&prod, &identity);
+    }
+}
+
+static void print_result(const struct result *res, size_t count)
+{
+    double scalar = res->scalar_ns / count;
+    if(res->batch_ns < 0.0) {
+        printf("  %-20s %12.2f %12s %9s %10zu\n", res->name, scalar, "-", "-", res->mismatched);
+        return;
+    }
+
+    double batch = res->batch_ns / count;
+    printf("  %-20s %12.2f %12.2f %8.1fx %10zu\n", res->name, scalar, batch, 
+        batch > 0.0 ? scalar / batch : 0.0, res->mismatched);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    size_t count = 4096;
+    int iters = 50;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-c") && i + 1 < argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtoul(argv[++i], NULL, 10);
+        else
+            goto usage;
+    }
+    if(count < 1 || iters < 1)
+        goto usage;
+
+    struct inputs in;
+    uint32_t *mask = malloc(MASK_WORDS(count) * sizeof(uint32_t));
+    float *t = malloc(count * sizeof(float));
+    float *batch_t = malloc(count * sizeof(float));
+    mat4x4_t *mats = malloc(count * sizeof(mat4x4_t));
+    mat4x4_t *batch_mats = malloc(count * sizeof(mat4x4_t));
+    vec3_t *points = malloc(count * sizeof(vec3_t));
+    vec3_t *batch_points = malloc(count * sizeof(vec3_t));
+
+    srand(1);
+    if(!inputs_init(&in, count) || !mask || !t || !batch_t || !mats || !batch_mats 
+    || !points || !batch_points) {
+        fprintf(stderr, "Failed to allocate %zu inputs\n", count);
+        goto fail_alloc;
+    }
+
+    struct result results[] = {
+        {"frustum_aabb_exact"},
+        {"frustum_aabb_cull"},
+        {"frustum_obb_cull"},
+        {"ray_obb"},
+        {"line_circle"},
+        {"mat4_mult"},
+        {"mat4_transform"},
+        {"mat4_inverse"},
+    };
+
+    bench_frustum_aabb_exact(&in, iters, mask, &results[0]);
+    bench_frustum_aabb_cull(&in, iters, mask, &results[1]);
+    bench_frustum_obb_cull(&in, iters, mask, &results[2]);
+    bench_ray_obb(&in, iters, mask, t, batch_t, &results[3]);
+    bench_line_circle(&in, iters, mask, t, batch_t, &results[4]);
+    bench_mat4_mult(&in, iters, mats, batch_mats, &results[5]);
+    bench_mat4_transform(&in, iters, points, batch_points, &results[6]);
+    bench_mat4_inverse(&in, iters, mats, &results[7]);
+
+    printf("inputs: %zu, best of %d\n", count, iters);
+    printf("  %-20s %12s %12s %9s %10s\n", "kernel", "scalar ns/op", "batch ns/op", "speedup", "mismatched");
+
+    size_t mismatched = 0;
+    for(int i = 0; i < sizeof(results)/sizeof(results[0]); i++) {
+        print_result(&results[i], count);
+        mismatched += results[i].mismatched;
+    }
+
+    if(mismatched) {
+        fprintf(stderr, "Mismatch: %zu results differ from the scalar kernels\n", mismatched);
+        goto fail_alloc;
+    }
+
+    ret = EXIT_SUCCESS;
+fail_alloc:
+    free(batch_points);
+    free(points);
+    free(batch_mats);
+    free(mats);
+    free(batch_t);
+    free(t);
+    free(mask);
+    inputs_destroy(&in);
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-c <count>] [-n <iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
@@ -0,0 +1,308 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+/* Map size benchmark. Builds the navigation data for synthetic maps of 
+ * growing size and reports the time and memory each one takes:
+ *
+ *   tiles    - allocating and generating the tiles, a block per chunk, the 
+ *              way the map loader does
+ *   build    - building the navigation data for every layer (N_BuildForMapData)
+ *   cutout   - cutting out a set of static obstacles (N_CutoutStaticObjects)
+ *   portals  - updating the portals of the chunks that were cut (N_UpdatePortals)
+ *
+ * along with the bytes held by the map tiles and the navigation data. The 
+ * peak is since the start of the run, so the sizes should be given in 
+ * increasing order. A size whose navigation data would not fit in the 
+ * system's RAM is skipped.
+ *
+ * usage: bench_mapsize [-s <seed>] [<chunks> ...]
+ *
+ *   -s  seed for the random tiles and obstacles (default 1)
+ *
+ * Every size is the number of chunks along each side of a square map 
+ * (default 16 64 128).
+ */
+
+#include "../src/navigation/public/nav.h"
+#include "../src/navigation/nav_private.h"
+#include "../src/map/public/map.h"
+#include "../src/map/public/tile.h"
+#include "../src/collision.h"
+#include "../src/event.h"
+#include "../src/parallel.h"
+#include "../src/mem.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+
+#define CHUNK_TILES         (TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT)
+/* Impassable patches scattered over every chunk */
+#define WALLS_PER_CHUNK     (4)
+#define OBSTACLES_PER_CHUNK (0.25f)
+#define MAX_SIZES           (16)
+#define MB                  (1024.0 * 1024.0)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void make_chunk(struct tile *tiles)
+{
+    memset(tiles, 0, CHUNK_TILES * sizeof(struct tile));
+    for(int i = 0; i < CHUNK_TILES; i++)
+        tiles[i].pathable = true;
+
+    for(int i = 0; i < WALLS_PER_CHUNK; i++) {
+
+        int r = rand() % TILES_PER_CHUNK_HEIGHT;
+        int c = rand() % TILES_PER_CHUNK_WIDTH;
+        int len = 1 + rand() % (TILES_PER_CHUNK_WIDTH / 2);
+        bool vertical = rand() % 2;
+
+        for(int j = 0; j < len; j++) {
+            int wr = vertical ? r + j : r;
+            int wc = vertical ? c : c + j;
+            if(wr >= TILES_PER_CHUNK_HEIGHT || wc >= TILES_PER_CHUNK_WIDTH)
+                break;
+            tiles[wr * TILES_PER_CHUNK_WIDTH + wc].pathable = false;
+        }
+    }
+}
+
+/* An axis-aligned box with its' corners in the same order as the entity OBBs */
+static struct obb random_obstacle(size_t size, vec3_t map_pos)
+{
+    float x_extent = size * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    float z_extent = size * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    float half[3] = {1.0f + rand() % 8, 4.0f, 1.0f + rand() % 8};
+
+    struct obb ret = (struct obb){
+        .center = (vec3_t){
+            map_pos.x - half[0] - fmodf(rand(), x_extent - 2 * half[0]),
+            0.0f,
+            map_pos.z + half[2] + fmodf(rand(), z_extent - 2 * half[2])
+        },
+        .axes = {{1.0f, 0.0f, 0.0f}, {0.0f, 1.0f, 0.0f}, {0.0f, 0.0f, 1.0f}},
+        .half_lengths = {half[0], half[1], half[2]},
+    };
+
+    for(int i = 0; i < 8; i++) {
+        ret.corners[i] = (vec3_t){
+            ret.center.x + ((i & 4) ? half[0] : -half[0]),
+            ret.center.y + ((i & 2) ? half[1] : -half[1]),
+            ret.center.z + ((i & 1) ? half[2] : -half[2]),
+        };
+    }
+    return ret;
+}
+
+static void print_mem(const char *name, enum mem_tag tag)
+{
+    struct mem_stats stats;
+    MEM_GetStats(tag, &stats);
+    printf("  %-8s live %10.2f MB  peak %10.2f MB  (%zu allocations)\n", name, 
+        stats.live / MB, stats.peak / MB, stats.num_allocs);
+}
+
+static bool run(size_t size)
+{
+    bool ret = false;
+    const size_t nchunks = size * size;
+
+    /* Every layer holds the full set of chunks */
+    double nav_mb = (double)NAV_LAYER_MAX * nchunks * sizeof(struct nav_chunk) / MB;
+    printf("map: %zux%zu chunks, %zu tiles, ~%.0f MB of navigation data\n", 
+        size, size, nchunks * CHUNK_TILES, nav_mb);
+
+    if(nav_mb > SDL_GetSystemRAM()) {
+        printf("  skipped: more than the %d MB of system RAM\n", SDL_GetSystemRAM());
+        return true;
+    }
+
+    const struct tile **chunk_tiles = calloc(nchunks, sizeof(struct tile*));
+    size_t num_obstacles = nchunks * OBSTACLES_PER_CHUNK + 1;
+    struct obb *obstacles = malloc(num_obstacles * sizeof(struct obb));
+    if(!chunk_tiles || !obstacles) {
+        fprintf(stderr, "Failed to allocate the map\n");
+        goto out;
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    for(int i = 0; i < nchunks; i++) {
+
+        struct tile *tiles = MEM_Malloc(MEM_TAG_MAP, CHUNK_TILES * sizeof(struct tile));
+        if(!tiles) {
+            fprintf(stderr, "Failed to allocate the tiles\n");
+            goto out;
+        }
+        make_chunk(tiles);
+        chunk_tiles[i] = tiles;
+    }
+    double tiles_ms = ms_since(start);
+
+    start = SDL_GetPerformanceCounter();
+    void *nav = N_BuildForMapData(size, size, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 
+        chunk_tiles);
+    double build_ms = ms_since(start);
+
+    if(!nav) {
+        fprintf(stderr, "Failed to build the navigation data\n");
+        goto out;
+    }
+
+    /* Same placement as the engine's 'M_CenterAtOrigin' */
+    vec3_t map_pos = (vec3_t){
+        size * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE / 2.0f, 
+        0.0f, 
+        -(size * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE / 2.0f)
+    };
+    for(int i = 0; i < num_obstacles; i++)
+        obstacles[i] = random_obstacle(size, map_pos);
+
+    start = SDL_GetPerformanceCounter();
+    N_CutoutStaticObjects(nav, map_pos, num_obstacles, obstacles);
+    double cutout_ms = ms_since(start);
+
+    start = SDL_GetPerformanceCounter();
+    N_UpdatePortals(nav);
+    double portals_ms = ms_since(start);
+
+    printf("  %-8s %10.2f ms\n", "tiles", tiles_ms);
+    printf("  %-8s %10.2f ms\n", "build", build_ms);
+    printf("  %-8s %10.2f ms  (%zu obstacles)\n", "cutout", cutout_ms, num_obstacles);
+    printf("  %-8s %10.2f ms\n", "portals", portals_ms);
+    print_mem("map", MEM_TAG_MAP);
+    print_mem("nav", MEM_TAG_NAV);
+
+    N_FreePrivate(nav);
+    ret = true;
+
+out:
+    for(int i = 0; chunk_tiles && i < nchunks; i++)
+        MEM_Free((void*)chunk_tiles[i]);
+    free(obstacles);
+    free(chunk_tiles);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The navigation code draws debug overlays and hooks into the engine's frame 
+ * events. Stand in for the parts of the engine that are not linked in. */
+void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count, 
+                              mat4x4_t *model, const struct map *map) {}
+
+void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t count,
+                        mat4x4_t *model, const struct map *map) {}
+
+bool E_Global_RegisterNamed(enum eventtype event, handler_t handler, const char *name, 
+                            void *user_arg) { return true; }
+
+bool E_Global_Unregister(enum eventtype event, handler_t handler) { return true; }
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    size_t sizes[MAX_SIZES] = {16, 64, 128};
+    size_t num_sizes = 0;
+    unsigned seed = 1;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+
+        long size = strtol(argv[i], NULL, 10);
+        if(size < 1 || num_sizes == MAX_SIZES)
+            goto usage;
+        sizes[num_sizes++] = size;
+    }
+    if(num_sizes == 0)
+        num_sizes = 3;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+    if(!MEM_Init()) {
+        fprintf(stderr, "Failed to initialize the memory subsystem\n");
+        goto fail_mem;
+    }
+    if(!PL_Init()) {
+        fprintf(stderr, "Failed to initialize the worker pool\n");
+        goto fail_pool;
+    }
+    if(!N_Init()) {
+        fprintf(stderr, "Failed to initialize the navigation subsystem\n");
+        goto fail_nav;
+    }
+
+    ret = EXIT_SUCCESS;
+    for(int i = 0; i < num_sizes; i++) {
+        srand(seed);
+        if(!run(sizes[i]))
+            ret = EXIT_FAILURE;
+    }
+
+    N_Shutdown();
+fail_nav:
+    PL_Shutdown();
+fail_pool:
+    MEM_Shutdown();
+fail_mem:
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-s <seed>] [<chunks> ...]\n", argv[0]);
+    return EXIT_FAILURE;
+}
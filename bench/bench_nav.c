@@ -0,0 +1,678 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* Headless navigation benchmark. Builds the navigation data for a .pfmap 
+ * file without creating a rendering context, replays a set of path and 
+ * steering queries against it and reports the time spent in every stage.
+ *
+ * usage: bench_nav <map.pfmap> [-q <queries>] [-r <queries>] [-n <count>] 
+ *                  [-s <seed>] [-b <cache budget>] [-c]
+ *
+ *   -q  replay the queries in the file instead of generating random ones
+ *   -r  record the queries used to the file, for replaying later
+ *   -n  number of random queries to generate (default 500)
+ *   -s  seed for the random queries (default 1)
+ *   -b  field cache budget in bytes (default CONFIG_NAV_CACHE_BUDGET)
+ *   -c  also save the built data to a .pfnav file, load it back and check 
+ *       that the loaded data is identical to the built data
+ *
+ * The query file holds one query per line:
+ *
+ *   path <layer> <src x> <src z> <dest x> <dest z> <steps>
+ *
+ * A path is requested from the source to the destination on the layer, after
+ * which a unit is steered along the flow field for up to 'steps' steps.
+ */
+
+#include "../src/navigation/public/nav.h"
+#include "../src/navigation/nav_private.h"
+#include "../src/map/public/map.h"
+#include "../src/map/public/tile.h"
+#include "../src/config.h"
+#include "../src/event.h"
+#include "../src/parallel.h"
+#include "../src/mem.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+
+#define MAX_LINE_LEN     (1024)
+#define MAX_QUERIES      (1 << 16)
+/* Distance travelled by the steered unit on every step */
+#define STEP_LEN         (1.0f)
+#define DEFAULT_STEPS    (256)
+
+struct query{
+    enum nav_layer layer;
+    vec2_t         src;
+    vec2_t         dest;
+    int            steps;
+};
+
+struct map_data{
+    const char   *path;
+    size_t        width, height;
+    struct tile  *tiles;
+    vec3_t        pos;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct query s_queries[MAX_QUERIES];
+static size_t       s_num_queries;
+/* The navigation subsystem's per-frame handler, run once every step */
+static handler_t    s_update_handler;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static bool read_line(FILE *stream, char *out)
+{
+    if(!fgets(out, MAX_LINE_LEN, stream))
+        return false;
+    out[strcspn(out, "\r\n")] = '\0';
+    return true;
+}
+
+static bool parse_tile(const char *str, struct tile *out)
+{
+    if(strlen(str) != 6)
+        return false;
+
+    char type_hexstr[2] = {str[0], '\0'};
+
+    memset(out, 0, sizeof(struct tile));
+    out->type          = (enum tiletype) strtol(type_hexstr, NULL, 16);
+    out->pathable      = (bool)          (str[1] - '0');
+    out->base_height   = (int)           (str[2] - '0');
+    out->top_mat_idx   = (int)           (str[3] - '0');
+    out->sides_mat_idx = (int)           (str[4] - '0');
+    out->ramp_height   = (int)           (str[5] - '0');
+    return true;
+}
+
+static bool read_chunk(FILE *stream, struct tile *out)
+{
+    char line[MAX_LINE_LEN];
+
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+
+        if(!read_line(stream, line))
+            return false;
+
+        char *saveptr;
+        char *string = strtok_r(line, " \t", &saveptr);
+
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+
+            if(!string || !parse_tile(string, &out[r * TILES_PER_CHUNK_WIDTH + c]))
+                return false;
+            string = strtok_r(NULL, " \t", &saveptr);
+        }
+        if(string)
+            return false;
+    }
+
+    /* Skip over the materials, which only matter for rendering */
+    for(int i = 0; i < MATERIALS_PER_CHUNK; i++) {
+
+        if(!read_line(stream, line))
+            return false;
+        if(strstr(line, "__none__"))
+            continue;
+
+        for(int j = 0; j < 4; j++) {
+            if(!read_line(stream, line))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool load_map(const char *path, struct map_data *out)
+{
+    char line[MAX_LINE_LEN];
+    float version;
+    unsigned num_rows, num_cols;
+
+    FILE *stream = fopen(path, "r");
+    if(!stream)
+        goto fail_open;
+
+    if(!read_line(stream, line) || 1 != sscanf(line, "version %f", &version))
+        goto fail_parse;
+    if(!read_line(stream, line) || 1 != sscanf(line, "num_rows %u", &num_rows))
+        goto fail_parse;
+    if(!read_line(stream, line) || 1 != sscanf(line, "num_cols %u", &num_cols))
+        goto fail_parse;
+
+    out->path = path;
+    out->width = num_cols;
+    out->height = num_rows;
+    out->tiles = malloc(num_rows * num_cols * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT 
+                        * sizeof(struct tile));
+    if(!out->tiles)
+        goto fail_parse;
+
+    for(int i = 0; i < num_rows * num_cols; i++) {
+        if(!read_chunk(stream, out->tiles + i * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT))
+            goto fail_chunk;
+    }
+
+    /* Same placement as the engine's 'M_CenterAtOrigin' */
+    out->pos = (vec3_t){
+        num_cols * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE / 2.0f, 
+        0.0f, 
+        -(num_rows * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE / 2.0f)
+    };
+
+    fclose(stream);
+    return true;
+
+fail_chunk:
+    free(out->tiles);
+fail_parse:
+    fclose(stream);
+fail_open:
+    return false;
+}
+
+static vec2_t random_pos(const struct map_data *map)
+{
+    int x_extent = map->width * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    int z_extent = map->height * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    /* Keep clear of the map edges. The X axis points the opposite way to the 
+     * tile columns. */
+    return (vec2_t){
+        map->pos.x - 1 - (rand() % (x_extent - 2)),
+        map->pos.z + 1 + (rand() % (z_extent - 2))
+    };
+}
+
+static void generate_queries(const struct map_data *map, size_t count)
+{
+    for(int i = 0; i < count && s_num_queries < MAX_QUERIES; i++) {
+
+        s_queries[s_num_queries++] = (struct query){
+            .layer = rand() % NAV_LAYER_MAX,
+            .src   = random_pos(map),
+            .dest  = random_pos(map),
+            .steps = DEFAULT_STEPS,
+        };
+    }
+}
+
+static bool read_queries(const char *path)
+{
+    char line[MAX_LINE_LEN];
+
+    FILE *stream = fopen(path, "r");
+    if(!stream)
+        return false;
+
+    while(read_line(stream, line) && s_num_queries < MAX_QUERIES) {
+
+        if(line[0] == '#' || line[0] == '\0')
+            continue;
+
+        struct query *q = &s_queries[s_num_queries];
+        int layer;
+        if(6 != sscanf(line, "path %d %f %f %f %f %d", &layer, 
+            &q->src.x, &q->src.y, &q->dest.x, &q->dest.y, &q->steps)
+        || layer < 0 || layer >= NAV_LAYER_MAX) {
+
+            fprintf(stderr, "Bad query: '%s'\n", line);
+            fclose(stream);
+            return false;
+        }
+        q->layer = layer;
+        s_num_queries++;
+    }
+
+    fclose(stream);
+    return true;
+}
+
+static bool write_queries(const char *path)
+{
+    FILE *stream = fopen(path, "w");
+    if(!stream)
+        return false;
+
+    fprintf(stream, "# path <layer> <src x> <src z> <dest x> <dest z> <steps>\n");
+    for(int i = 0; i < s_num_queries; i++) {
+
+        const struct query *q = &s_queries[i];
+        fprintf(stream, "path %d %.3f %.3f %.3f %.3f %d\n", q->layer, 
+            q->src.x, q->src.y, q->dest.x, q->dest.y, q->steps);
+    }
+    return (0 == fclose(stream));
+}
+
+static bool in_bounds(const struct map_data *map, vec2_t pos)
+{
+    float x_extent = map->width * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    float z_extent = map->height * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    return (pos.x < map->pos.x && pos.x > map->pos.x - x_extent)
+        && (pos.y > map->pos.z && pos.y < map->pos.z + z_extent);
+}
+
+static bool portal_equal(const struct nav_private *a, const struct portal *pa,
+                         const struct nav_private *b, const struct portal *pb)
+{
+    /* Pointers are compared by their offsets within the navigation data */
+    const char *base_a = (const char*)a->chunks, *base_b = (const char*)b->chunks;
+    if((const char*)pa->connected - base_a != (const char*)pb->connected - base_b)
+        return false;
+
+    if(0 != memcmp(&pa->chunk, &pb->chunk, sizeof(pa->chunk))
+    || 0 != memcmp(pa->endpoints, pb->endpoints, sizeof(pa->endpoints))
+    || pa->num_neighbours != pb->num_neighbours
+    || pa->island != pb->island
+    || pa->component != pb->component
+    || pa->cluster_node != pb->cluster_node)
+        return false;
+
+    for(int i = 0; i < pa->num_neighbours; i++) {
+
+        if((const char*)pa->edges[i].neighbour - base_a != (const char*)pb->edges[i].neighbour - base_b)
+            return false;
+        if(pa->edges[i].cost != pb->edges[i].cost)
+            return false;
+    }
+    return true;
+}
+
+static bool chunk_equal(const struct nav_private *a, const struct nav_chunk *ca,
+                        const struct nav_private *b, const struct nav_chunk *cb)
+{
+    if(ca->num_portals != cb->num_portals
+    || ca->dirty != cb->dirty
+    || ca->num_blocked != cb->num_blocked
+    || 0 != memcmp(ca->cost_base, cb->cost_base, sizeof(ca->cost_base))
+    || 0 != memcmp(ca->islands, cb->islands, sizeof(ca->islands))
+    || 0 != memcmp(ca->blockers, cb->blockers, sizeof(ca->blockers)))
+        return false;
+
+    for(int i = 0; i < ca->num_portals; i++) {
+        if(!portal_equal(a, &ca->portals[i], b, &cb->portals[i]))
+            return false;
+    }
+    return true;
+}
+
+static bool cluster_equal(const struct nav_private *a, const struct nav_cluster *ca,
+                          const struct nav_private *b, const struct nav_cluster *cb)
+{
+    if(kv_size(ca->nodes) != kv_size(cb->nodes))
+        return false;
+
+    for(int i = 0; i < kv_size(ca->nodes); i++) {
+
+        const struct cluster_node *na = &kv_A(ca->nodes, i);
+        const struct cluster_node *nb = &kv_A(cb->nodes, i);
+
+        if((const char*)na->portal - (const char*)a->chunks 
+        != (const char*)nb->portal - (const char*)b->chunks)
+            return false;
+        if(kv_size(na->edges) != kv_size(nb->edges))
+            return false;
+
+        for(int j = 0; j < kv_size(na->edges); j++) {
+            if(kv_A(na->edges, j).node != kv_A(nb->edges, j).node
+            || kv_A(na->edges, j).cost != kv_A(nb->edges, j).cost)
+                return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the number of parts (headers, chunks and clusters) of the layer
+ * that differ */
+static size_t layer_mismatches(const struct nav_private *a, const struct nav_private *b)
+{
+    if(a->layer != b->layer
+    || a->width != b->width
+    || a->height != b->height
+    || a->cluster_width != b->cluster_width
+    || a->cluster_height != b->cluster_height)
+        return 1;
+
+    size_t ret = 0;
+    if(a->version != b->version || a->portal_version != b->portal_version)
+        ret++;
+
+    for(int i = 0; i < a->width * a->height; i++)
+        ret += !chunk_equal(a, &a->chunks[i], b, &b->chunks[i]);
+
+    for(int i = 0; i < a->cluster_width * a->cluster_height; i++)
+        ret += !cluster_equal(a, &a->clusters[i], b, &b->clusters[i]);
+    return ret;
+}
+
+/* The .pfnav cache must be a drop-in replacement for building the data, else 
+ * the peers of a session that built it and the ones that loaded it go out 
+ * of sync */
+static bool check_cache(const struct map_data *map, void *built, const struct tile **chunk_tiles)
+{
+    char path[MAX_LINE_LEN];
+    snprintf(path, sizeof(path), "%s.check.pfnav", map->path);
+
+    if(!N_SaveForMapData(built, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, path)) {
+        fprintf(stderr, "Failed to write the navigation data: %s\n", path);
+        return false;
+    }
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    void *loaded = N_LoadForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, path);
+    double load_ms = ms_since(start);
+    remove(path);
+
+    if(!loaded) {
+        fprintf(stderr, "Failed to load the navigation data back: %s\n", path);
+        return false;
+    }
+
+    const struct nav_layers *a = built, *b = loaded;
+    size_t mismatched = 0;
+    for(int i = 0; i < NAV_LAYER_MAX; i++)
+        mismatched += layer_mismatches(a->layers[i], b->layers[i]);
+    N_FreePrivate(loaded);
+
+    printf("  load             %10.2f ms\n", load_ms);
+    if(mismatched) {
+        fprintf(stderr, "Mismatch: %zu parts of the loaded navigation data differ from the built data\n", 
+            mismatched);
+        return false;
+    }
+    return true;
+}
+
+static void print_stage(const char *name, uint64_t count, uint64_t total_us)
+{
+    printf("  %-16s %8llu  total %10.2f ms  avg %8.2f us\n", name, (unsigned long long)count,
+        total_us / 1000.0, count ? (double)total_us / count : 0.0);
+}
+
+static bool run(const struct map_data *map, size_t budget, bool check)
+{
+    if(!MEM_Init()) {
+        fprintf(stderr, "Failed to initialize the memory arenas\n");
+        return false;
+    }
+
+    if(!PL_Init()) {
+        fprintf(stderr, "Failed to initialize the worker pool\n");
+        MEM_Shutdown();
+        return false;
+    }
+
+    if(!N_Init()) {
+        fprintf(stderr, "Failed to initialize the navigation subsystem\n");
+        PL_Shutdown();
+        MEM_Shutdown();
+        return false;
+    }
+    N_SetCacheBudget(budget);
+
+    const struct tile **chunk_tiles = malloc(map->width * map->height * sizeof(struct tile*));
+    if(!chunk_tiles) {
+        fprintf(stderr, "Failed to allocate the chunk list\n");
+        goto fail_build;
+    }
+    for(int i = 0; i < map->width * map->height; i++)
+        chunk_tiles[i] = map->tiles + i * TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    void *nav = N_BuildForMapData(map->width, map->height, 
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles);
+    double build_ms = ms_since(start);
+
+    if(!nav) {
+        fprintf(stderr, "Failed to build the navigation data\n");
+        free(chunk_tiles);
+        goto fail_build;
+    }
+
+    printf("map: %s (%zux%zu chunks)\n", map->path, map->width, map->height);
+    printf("  build            %10.2f ms\n", build_ms);
+
+    bool consistent = !check || check_cache(map, nav, chunk_tiles);
+    free(chunk_tiles);
+
+    size_t num_found = 0, num_steps = 0, num_stalled = 0;
+    double path_ms = 0.0, steer_ms = 0.0;
+
+    for(int i = 0; i < s_num_queries; i++) {
+
+        const struct query *q = &s_queries[i];
+        if(!in_bounds(map, q->src) || !in_bounds(map, q->dest))
+            continue;
+
+        dest_id_t id;
+        start = SDL_GetPerformanceCounter();
+        bool found = N_RequestPath(nav, q->src, q->dest, map->pos, q->layer, &id);
+        path_ms += ms_since(start);
+
+        if(!found)
+            continue;
+        num_found++;
+
+        /* Steer a unit along the path, the way the movement code does */
+        vec2_t pos = q->src, dest = q->dest;
+        start = SDL_GetPerformanceCounter();
+
+        for(int j = 0; j < q->steps; j++) {
+
+            if(s_update_handler)
+                s_update_handler(NULL, NULL);
+
+            vec2_t vel;
+            if(N_HasDestLOS(id, pos, nav, map->pos)) {
+                PFM_Vec2_Sub(&dest, &pos, &vel);
+                if(PFM_Vec2_Len(&vel) < STEP_LEN)
+                    break;
+                PFM_Vec2_Normal(&vel, &vel);
+            }else{
+                vel = N_DesiredVelocity(id, pos, dest, nav, map->pos);
+            }
+
+            num_steps++;
+
+            /* The fields ahead are being computed in the background */
+            if(vel.x == 0.0f && vel.y == 0.0f) {
+                num_stalled++;
+                continue;
+            }
+
+            PFM_Vec2_Scale(&vel, STEP_LEN, &vel);
+            vec2_t next;
+            PFM_Vec2_Add(&pos, &vel, &next);
+
+            if(!in_bounds(map, next))
+                break;
+            pos = next;
+        }
+        steer_ms += ms_since(start);
+    }
+
+    struct nav_perf_stats perf;
+    struct nav_cache_stats cache;
+    N_GetPerfStats(&perf);
+    N_GetCacheStats(&cache);
+
+    uint64_t lookups = cache.hits + cache.misses;
+    printf("queries: %zu, paths found: %zu\n", s_num_queries, num_found);
+    printf("  path requests    %10.2f ms  avg %8.2f us\n", path_ms, 
+        s_num_queries ? path_ms * 1000.0 / s_num_queries : 0.0);
+    printf("  steering steps   %8zu  total %10.2f ms  avg %8.2f us  (%zu waiting for fields)\n", 
+        num_steps, steer_ms, num_steps ? steer_ms * 1000.0 / num_steps : 0.0, num_stalled);
+    printf("stages:\n");
+    print_stage("portal A*", perf.portal_searches, perf.portal_search_us);
+    print_stage("flow fields", perf.flow_fields, perf.flow_field_us);
+    print_stage("LOS fields", perf.los_fields, perf.los_field_us);
+    printf("cache: hits %llu, misses %llu, hit rate %.1f%%, evictions %llu, resident %zu/%zu bytes\n",
+        (unsigned long long)cache.hits, (unsigned long long)cache.misses, 
+        lookups ? cache.hits * 100.0 / lookups : 0.0, (unsigned long long)cache.evictions,
+        cache.bytes_resident, cache.bytes_budget);
+
+    N_FreePrivate(nav);
+    N_Shutdown();
+    PL_Shutdown();
+    MEM_Shutdown();
+    return consistent;
+
+fail_build:
+    N_Shutdown();
+    PL_Shutdown();
+    MEM_Shutdown();
+    return false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The navigation code draws debug overlays and hooks into the engine's frame 
+ * events. Stand in for the parts of the engine that are not linked in. */
+void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count, 
+                              mat4x4_t *model, const struct map *map) {}
+
+void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t count,
+                        mat4x4_t *model, const struct map *map) {}
+
+bool E_Global_RegisterNamed(enum eventtype event, handler_t handler, const char *name, 
+                            void *user_arg) 
+{
+    if(event == EVENT_UPDATE_START)
+        s_update_handler = handler;
+    return true; 
+}
+
+bool E_Global_Unregister(enum eventtype event, handler_t handler) 
+{
+    if(event == EVENT_UPDATE_START && handler == s_update_handler)
+        s_update_handler = NULL;
+    return true; 
+}
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    const char *map_path = NULL, *query_path = NULL, *record_path = NULL;
+    size_t count = 500, budget = CONFIG_NAV_CACHE_BUDGET;
+    unsigned seed = 1;
+    bool check = false;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-q") && i + 1 < argc)
+            query_path = argv[++i];
+        else if(0 == strcmp(argv[i], "-r") && i + 1 < argc)
+            record_path = argv[++i];
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-s") && i + 1 < argc)
+            seed = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-b") && i + 1 < argc)
+            budget = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-c"))
+            check = true;
+        else if(!map_path && argv[i][0] != '-')
+            map_path = argv[i];
+        else
+            goto usage;
+    }
+    if(!map_path)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+
+    struct map_data map;
+    if(!load_map(map_path, &map)) {
+        fprintf(stderr, "Failed to load map: %s\n", map_path);
+        goto fail_map;
+    }
+
+    srand(seed);
+    if(query_path && !read_queries(query_path)) {
+        fprintf(stderr, "Failed to read queries: %s\n", query_path);
+        goto fail_queries;
+    }
+    if(!query_path)
+        generate_queries(&map, count);
+
+    if(record_path && !write_queries(record_path)) {
+        fprintf(stderr, "Failed to write queries: %s\n", record_path);
+        goto fail_queries;
+    }
+
+    if(!run(&map, budget, check))
+        goto fail_run;
+
+    ret = EXIT_SUCCESS;
+fail_run:
+fail_queries:
+    free(map.tiles);
+fail_map:
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s <map.pfmap> [-q <queries>] [-r <queries>] [-n <count>] "
+        "[-s <seed>] [-b <cache budget>] [-c]\n", argv[0]);
+    return EXIT_FAILURE;
+}
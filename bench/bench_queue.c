@@ -0,0 +1,205 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+/* Render queue sort benchmark. Times sorting the keys of a frame's worth of
+ * randomized draw commands, as done on every flush of the render queue, and 
+ * checks the order they come out in:
+ *
+ *   - The passes are drawn in order.
+ *   - Translucent commands are drawn back-to-front, at least to the top 8 bits
+ *     of their depth, whatever their textures and VAOs.
+ *   - Two translucent commands whose depths differ only in the top 8 bits, 
+ *     with their VAOs ordered the other way, are drawn back-to-front.
+ *
+ * usage: bench_queue [-c <count>] [-n <iterations>]
+ *
+ *   -c  number of commands sorted (default 20000)
+ *   -n  number of times the sort is timed, the best being reported (default 50)
+ */
+
+#include "../src/render/render_queue_key.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* The engine's passes, opaque first */
+#define NUM_PASSES  (2)
+#define PASS_TRANSLUCENT (1)
+
+struct cmd{
+    uint64_t key;
+    unsigned pass;
+    uint16_t depth;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int compare_cmds(const void *a, const void *b)
+{
+    uint64_t ka = ((const struct cmd*)a)->key;
+    uint64_t kb = ((const struct cmd*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static void make_cmds(struct cmd *cmds, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+
+        unsigned pass = rand() % NUM_PASSES;
+        uint16_t depth = rand() % (UINT16_MAX + 1);
+        cmds[i] = (struct cmd){
+            .key = R_Queue_Key(pass, pass == PASS_TRANSLUCENT, 1 + rand() % 16,
+                               1 + rand() % 64, 1 + rand() % 512, depth),
+            .pass = pass,
+            .depth = depth,
+        };
+    }
+}
+
+static double bench_sort(const struct cmd *cmds, struct cmd *sorted, size_t count, int iters)
+{
+    double best = 0.0;
+    for(int i = 0; i < iters; i++) {
+
+        memcpy(sorted, cmds, count * sizeof(struct cmd));
+        uint64_t start = SDL_GetPerformanceCounter();
+        qsort(sorted, count, sizeof(struct cmd), compare_cmds);
+        uint64_t end = SDL_GetPerformanceCounter();
+
+        double ms = (end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+        if(i == 0 || ms < best)
+            best = ms;
+    }
+    return best;
+}
+
+static size_t count_misordered(const struct cmd *sorted, size_t count)
+{
+    size_t ret = 0;
+    for(size_t i = 1; i < count; i++) {
+
+        const struct cmd *prev = &sorted[i - 1], *curr = &sorted[i];
+        if(prev->pass > curr->pass)
+            ret++;
+        else if(prev->pass == PASS_TRANSLUCENT && curr->pass == PASS_TRANSLUCENT
+        && (prev->depth >> 8) < (curr->depth >> 8))
+            ret++;
+    }
+    return ret;
+}
+
+static bool check_high_byte(void)
+{
+    uint16_t near = 0x1000, far = 0x2000;
+    uint64_t near_key = R_Queue_Key(PASS_TRANSLUCENT, true, 1, 1, 2, near);
+    uint64_t far_key = R_Queue_Key(PASS_TRANSLUCENT, true, 1, 1, 1, far);
+    if(far_key < near_key)
+        return true;
+
+    near_key = R_Queue_Key(PASS_TRANSLUCENT, true, 1, 1, 1, near);
+    far_key = R_Queue_Key(PASS_TRANSLUCENT, true, 1, 1, 2, far);
+    return (far_key < near_key);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    size_t count = 20000;
+    int iters = 50;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-c") && i + 1 < argc)
+            count = strtoul(argv[++i], NULL, 10);
+        else if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtoul(argv[++i], NULL, 10);
+        else
+            goto usage;
+    }
+    if(count < 2 || iters < 1)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+
+    struct cmd *cmds = malloc(count * sizeof(struct cmd));
+    struct cmd *sorted = malloc(count * sizeof(struct cmd));
+    if(!cmds || !sorted) {
+        fprintf(stderr, "Failed to allocate %zu commands\n", count);
+        goto fail_alloc;
+    }
+
+    srand(1);
+    make_cmds(cmds, count);
+    double ms = bench_sort(cmds, sorted, count, iters);
+    size_t misordered = count_misordered(sorted, count);
+    printf("sort %zu keys: %8.3f ms, %zu misordered\n", count, ms, misordered);
+
+    if(misordered) {
+        fprintf(stderr, "Mismatch: %zu commands sorted out of order\n", misordered);
+        goto fail_alloc;
+    }
+    if(!check_high_byte()) {
+        fprintf(stderr, "Mismatch: translucent depths differing in the top 8 bits sorted by VAO\n");
+        goto fail_alloc;
+    }
+    ret = EXIT_SUCCESS;
+
+fail_alloc:
+    free(sorted);
+    free(cmds);
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s [-c <count>] [-n <iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
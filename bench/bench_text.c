@@ -0,0 +1,276 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+/* Text asset parsing benchmark. Reads a text asset file the way the loaders
+ * did before the buffered reader was introduced (one SDL_RWread call per 
+ * character and 'sscanf' for the numbers) and the way they do now (block 
+ * reads, line views and the 'AL_Parse*' tokenizer), and reports the time of
+ * each. The parsed numbers are checked to come out identical both ways.
+ *
+ * usage: bench_text <file> [-n <iterations>]
+ *
+ *   -n  number of times each way is timed, the best being reported (default 5)
+ *
+ * Only the lines that make up the bulk of PFOBJ files are parsed: vertex 
+ * attributes ('v', 'vt', 'vn', 'vw', 'vm') and animation samples. Every line
+ * is still read, so other text assets can be used to time the reading alone.
+ */
+
+#include "../src/asset_load.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* The totals are compared bit for bit, so that any difference in the parsed 
+ * numbers shows up */
+struct totals{
+    size_t   lines;
+    size_t   numbers;
+    uint64_t hash;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static double ms_since(uint64_t start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void add_floats(struct totals *out, const float *vals, size_t count)
+{
+    for(int i = 0; i < count; i++) {
+
+        uint32_t bits;
+        memcpy(&bits, &vals[i], sizeof(bits));
+        /* FNV-1a over the bit patterns */
+        out->hash = (out->hash ^ bits) * UINT64_C(1099511628211);
+    }
+    out->numbers += count;
+}
+
+static void add_int(struct totals *out, int val)
+{
+    float as_float = val;
+    add_floats(out, &as_float, 1);
+}
+
+static void parse_line_sscanf(const char *line, struct totals *out)
+{
+    float f[10];
+    int i;
+
+    if(3 == sscanf(line, "v %f %f %f", &f[0], &f[1], &f[2])
+    || 3 == sscanf(line, "vn %f %f %f", &f[0], &f[1], &f[2])) {
+        add_floats(out, f, 3);
+
+    }else if(2 == sscanf(line, "vt %f %f", &f[0], &f[1])) {
+        add_floats(out, f, 2);
+
+    }else if(1 == sscanf(line, "vm %d", &i)) {
+        add_int(out, i);
+
+    }else if(0 == strncmp(line, "vw", 2)) {
+
+        int consumed, pos = 2;
+        while(2 == sscanf(line + pos, "%d/%f%n", &i, &f[0], &consumed)) {
+            add_int(out, i);
+            add_floats(out, f, 1);
+            pos += consumed;
+        }
+
+    }else if(11 == sscanf(line, "%d %f/%f/%f %f/%f/%f/%f %f/%f/%f", &i,
+        &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6], &f[7], &f[8], &f[9])) {
+
+        add_int(out, i);
+        add_floats(out, f, 10);
+    }
+}
+
+static void parse_line_tokenizer(const char *line, struct totals *out)
+{
+    const char *curr = line;
+    float f[10];
+    int i;
+
+    if((AL_ParseTag(&curr, "v") || AL_ParseTag(&curr, "vn")) 
+    && AL_ParseFloats(&curr, 3, ' ', f)) {
+        add_floats(out, f, 3);
+
+    }else if(AL_ParseTag(&curr, "vt") && AL_ParseFloats(&curr, 2, ' ', f)) {
+        add_floats(out, f, 2);
+
+    }else if(AL_ParseTag(&curr, "vm") && AL_ParseInt(&curr, &i)) {
+        add_int(out, i);
+
+    }else if(AL_ParseTag(&curr, "vw")) {
+
+        while(AL_ParseInt(&curr, &i) && *curr++ == '/' && AL_ParseFloat(&curr, &f[0])) {
+            add_int(out, i);
+            add_floats(out, f, 1);
+        }
+
+    }else if(AL_ParseInt(&curr, &i)
+    && AL_ParseFloats(&curr, 3, '/', f + 0)
+    && AL_ParseFloats(&curr, 4, '/', f + 3)
+    && AL_ParseFloats(&curr, 3, '/', f + 7)) {
+
+        add_int(out, i);
+        add_floats(out, f, 10);
+    }
+}
+
+static bool run_bytewise(const char *path, struct totals *out)
+{
+    char line[MAX_LINE_LEN];
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return false;
+
+    while(AL_ReadLine(stream, line)) {
+        out->lines++;
+        parse_line_sscanf(line, out);
+    }
+
+    SDL_RWclose(stream);
+    return true;
+}
+
+static bool run_buffered(const char *path, struct totals *out)
+{
+    char *line;
+
+    SDL_RWops *stream = AL_OpenText(path);
+    if(!stream)
+        return false;
+
+    while((line = AL_ReadLineView(stream))) {
+        out->lines++;
+        parse_line_tokenizer(line, out);
+    }
+
+    SDL_RWclose(stream);
+    return true;
+}
+
+static bool time_run(const char *name, bool (*run)(const char*, struct totals*), 
+                     const char *path, int iters, struct totals *out, double *out_best)
+{
+    double best = 0.0, total = 0.0;
+
+    for(int i = 0; i < iters; i++) {
+
+        *out = (struct totals){.hash = UINT64_C(14695981039346656037)};
+        uint64_t start = SDL_GetPerformanceCounter();
+        if(!run(path, out))
+            return false;
+        double ms = ms_since(start);
+
+        total += ms;
+        if(i == 0 || ms < best)
+            best = ms;
+    }
+
+    printf("  %-22s best %10.2f ms  avg %10.2f ms\n", name, best, total / iters);
+    *out_best = best;
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+int main(int argc, char **argv)
+{
+    int ret = EXIT_FAILURE;
+    const char *path = NULL;
+    int iters = 5;
+
+    for(int i = 1; i < argc; i++) {
+
+        if(0 == strcmp(argv[i], "-n") && i + 1 < argc)
+            iters = strtoul(argv[++i], NULL, 10);
+        else if(!path && argv[i][0] != '-')
+            path = argv[i];
+        else
+            goto usage;
+    }
+    if(!path || iters < 1)
+        goto usage;
+
+    if(0 != SDL_Init(SDL_INIT_TIMER)) {
+        fprintf(stderr, "Failed to initialize SDL: %s\n", SDL_GetError());
+        goto fail_sdl;
+    }
+
+    struct totals before, after;
+    double before_ms, after_ms;
+
+    printf("file: %s\n", path);
+    if(!time_run("bytewise + sscanf", run_bytewise, path, iters, &before, &before_ms)
+    || !time_run("buffered + tokenizer", run_buffered, path, iters, &after, &after_ms)) {
+        fprintf(stderr, "Failed to read file: %s\n", path);
+        goto fail_run;
+    }
+
+    printf("lines: %zu, numbers: %zu, speedup: %.1fx\n", after.lines, after.numbers, 
+        after_ms > 0.0 ? before_ms / after_ms : 0.0);
+
+    if(before.lines != after.lines || before.numbers != after.numbers 
+    || before.hash != after.hash) {
+        fprintf(stderr, "Mismatch: %zu lines, %zu numbers before; %zu lines, %zu numbers after\n",
+            before.lines, before.numbers, after.lines, after.numbers);
+        goto fail_run;
+    }
+
+    ret = EXIT_SUCCESS;
+fail_run:
+    SDL_Quit();
+fail_sdl:
+    return ret;
+
+usage:
+    fprintf(stderr, "usage: %s <file> [-n <iterations>]\n", argv[0]);
+    return EXIT_FAILURE;
+}
+
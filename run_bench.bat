@@ -0,0 +1 @@
+start ./lib/pf.exe ./ ./scripts/bench/%1.py
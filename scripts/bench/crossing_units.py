@@ -0,0 +1,87 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+"""
+Two groups of units crossing the map in opposite directions and meeting in 
+the middle, which stresses the pathfinding, the flow field cache and the 
+steering. The movement is deterministic, so every run issues the same work.
+"""
+
+import pf
+import harness
+
+NUM_UNITS = 200
+SPACING = 5.0
+# Distance of the groups' starting points from the center of the map
+OFFSET = 380.0
+
+class CrossingUnits(harness.Scenario):
+
+    name = "crossing_units"
+    ticks = 1800
+
+    def spawn(self, center):
+        candidates = harness.grid_points(center, NUM_UNITS / 2, SPACING)
+        ret = []
+        for xz, ok in zip(candidates, pf.pathable(candidates, 3.0)):
+            if not ok:
+                continue
+            unit = pf.AnimEntity("assets/models/goblin", "goblin.pfobj", "Goblin", "Walk")
+            unit.scale = [0.9, 0.9, 0.9]
+            unit.selection_radius = 3.0
+            unit.speed = 20.0
+            harness.place(unit, xz)
+            unit.activate()
+            ret.append(unit)
+        return ret
+
+    def setup(self):
+        pf.enable_deterministic_movement()
+        self.east = self.spawn((-OFFSET, 0.0))
+        self.west = self.spawn((OFFSET, 0.0))
+
+    def tick(self, n):
+        # Send both groups across, then back again halfway through
+        if n == 0 or n == (self.warmup_ticks + self.ticks) / 2:
+            sign = 1.0 if n == 0 else -1.0
+            move_tick = pf.movement_checksum()[0]
+            pf.move_order(self.east, (sign * OFFSET, 0.0), move_tick)
+            pf.move_order(self.west, (-sign * OFFSET, 0.0), move_tick)
+
+    def params(self):
+        return {"units": len(self.east) + len(self.west), "offset": OFFSET}
+
+runner = harness.run(CrossingUnits())
+
@@ -0,0 +1,61 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+"""
+The whole map densely covered in trees, which stresses the culling and the 
+static entity draw calls.
+"""
+
+import pf
+import harness
+
+PROPS_PER_TILE = 0.5
+SEED = 1
+
+class Forest(harness.Scenario):
+
+    name = "forest"
+
+    def setup(self):
+        extent = harness.MAP_HALF_EXTENT
+        self.num_props = pf.scatter_static("assets/models/pine_tree/pine_tree.pfobj", 
+            ((-extent, -extent), (extent, extent)), PROPS_PER_TILE, SEED, 
+            {"min_spacing": 4.0, "scale": (0.8, 1.2)})
+
+    def params(self):
+        return {"props_per_tile": PROPS_PER_TILE, "props": self.num_props, "seed": SEED}
+
+runner = harness.run(Forest())
+
@@ -0,0 +1,196 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+"""
+Shared driver for the benchmark scenarios. Every scenario sets up its' scene,
+then runs for a fixed number of simulation ticks while the frame times and 
+the profiler's zone totals are gathered. The results are written as JSON to 
+'bench_results/<scenario>.json' under the base directory and the engine is 
+shut down, so that the scenarios can be run one after another from a script.
+"""
+
+import pf
+import os
+import sys
+import json
+import time
+import timeit
+
+MAP_DIR = "assets/maps"
+MAP_NAME = "demo.pfmap"
+# The demo map is 4x4 chunks of 32x32 tiles, 8 units wide, centered on the origin
+MAP_HALF_EXTENT = 512.0
+TILES_PER_CHUNK = 32
+MAP_CHUNKS = 4
+
+class Scenario(object):
+
+    name = None
+    # Ticks of the 60Hz simulation step, not frames
+    ticks = 1200
+    # Ticks run before measuring, to let the caches and the allocators settle
+    warmup_ticks = 120
+
+    def setup(self):
+        """ Called once the map is loaded, before the first tick """
+        pass
+
+    def tick(self, n):
+        """ Called on every simulation tick, starting from 0 """
+        pass
+
+    def params(self):
+        """ Scenario settings recorded alongside the results """
+        return {}
+
+
+def percentile(sorted_vals, pct):
+    if not sorted_vals:
+        return 0.0
+    idx = int(round((pct / 100.0) * (len(sorted_vals) - 1)))
+    return sorted_vals[idx]
+
+
+def grid_points(center, count, spacing):
+    """ (X, Z) points of a square grid of 'count' cells around 'center' """
+    side = int(count ** 0.5 + 0.999)
+    half = (side - 1) * spacing / 2.0
+    ret = []
+    for i in range(count):
+        r, c = divmod(i, side)
+        ret.append((center[0] - half + c * spacing, center[1] - half + r * spacing))
+    return ret
+
+
+def place(ent, xz):
+    height = pf.map_height_at_point(xz[0], xz[1])
+    ent.pos = [xz[0], height if height is not None else 0.0, xz[1]]
+
+
+class Runner(object):
+
+    def __init__(self, scenario):
+        self.scenario = scenario
+        self.tick_count = 0
+        self.frame_ms = []
+        self.last_frame_ts = None
+        self.done = False
+
+    def start(self):
+        pf.new_game(MAP_DIR, MAP_NAME)
+        pf.set_map_render_mode(pf.CHUNK_RENDER_MODE_PREBAKED)
+        # Numbers taken with the frame rate limit on only measure the limit
+        pf.set_frame_rate_limit(0)
+        self.scenario.setup()
+
+        pf.register_event_handler(pf.EVENT_60HZ_TICK, Runner.on_tick, self)
+        pf.register_event_handler(pf.EVENT_UPDATE_START, Runner.on_frame, self)
+
+    def on_tick(self, event):
+        if self.done:
+            return
+
+        self.scenario.tick(self.tick_count)
+        self.tick_count += 1
+
+        if self.tick_count == self.scenario.warmup_ticks:
+            pf.reset_perf_totals()
+            self.last_frame_ts = None
+            self.frame_ms = []
+        elif self.tick_count == self.scenario.warmup_ticks + self.scenario.ticks:
+            self.finish()
+
+    def on_frame(self, event):
+        if self.done or self.tick_count < self.scenario.warmup_ticks:
+            return
+        now = timeit.default_timer()
+        if self.last_frame_ts is not None:
+            self.frame_ms.append((now - self.last_frame_ts) * 1000.0)
+        self.last_frame_ts = now
+
+    def results(self):
+        frames = sorted(self.frame_ms)
+        totals = pf.perf_totals()
+        num_frames = max(totals["frames"], 1)
+
+        zones = {}
+        for name, zone in totals["zones"].items():
+            zones[name] = {
+                "total_ms"     : zone["total_ms"],
+                "per_frame_ms" : zone["total_ms"] / num_frames,
+                "max_ms"       : zone["max_ms"],
+                "calls"        : zone["calls"],
+            }
+
+        return {
+            "scenario"     : self.scenario.name,
+            "params"       : self.scenario.params(),
+            "ticks"        : self.scenario.ticks,
+            "warmup_ticks" : self.scenario.warmup_ticks,
+            "platform"     : sys.platform,
+            "date"         : time.strftime("%Y-%m-%d %H:%M:%S"),
+            "frames"       : len(frames),
+            "frame_ms"     : {
+                "avg" : sum(frames) / len(frames) if frames else 0.0,
+                "p50" : percentile(frames, 50),
+                "p90" : percentile(frames, 90),
+                "p99" : percentile(frames, 99),
+                "max" : frames[-1] if frames else 0.0,
+            },
+            "zones"        : zones,
+            "gpu_ms"       : pf.render_stats()["gpu_ms"],
+            "memory"       : pf.memory_stats(),
+        }
+
+    def finish(self):
+        self.done = True
+        out_dir = os.path.join(pf.get_basedir(), "bench_results")
+        if not os.path.isdir(out_dir):
+            os.makedirs(out_dir)
+
+        path = os.path.join(out_dir, self.scenario.name + ".json")
+        with open(path, "w") as out:
+            json.dump(self.results(), out, indent=4, sort_keys=True)
+        print("Wrote benchmark results to " + path)
+
+        pf.global_event(pf.SDL_QUIT, None)
+
+
+def run(scenario):
+    """ The returned runner must be kept alive for the duration of the run """
+    ret = Runner(scenario)
+    ret.start()
+    return ret
+
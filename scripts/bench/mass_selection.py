@@ -0,0 +1,83 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+"""
+A large army being selected and ordered around as a whole, which stresses 
+the selection, its' overlays and the large move orders.
+"""
+
+import pf
+import harness
+
+NUM_UNITS = 400
+SPACING = 5.0
+# Ticks between re-selecting the army and ordering it to the next waypoint
+ORDER_INTERVAL = 180
+WAYPOINTS = [(200.0, 200.0), (-200.0, 200.0), (-200.0, -200.0), (200.0, -200.0)]
+
+class MassSelection(harness.Scenario):
+
+    name = "mass_selection"
+
+    def setup(self):
+        pf.enable_deterministic_movement()
+        candidates = harness.grid_points(WAYPOINTS[-1], NUM_UNITS, SPACING)
+        self.units = []
+        for xz, ok in zip(candidates, pf.pathable(candidates, 3.0)):
+            if not ok:
+                continue
+            unit = pf.AnimEntity("assets/models/goblin", "goblin.pfobj", "Goblin", "Idle")
+            unit.scale = [0.9, 0.9, 0.9]
+            unit.selection_radius = 3.0
+            unit.selectable = True
+            unit.speed = 20.0
+            harness.place(unit, xz)
+            unit.activate()
+            self.units.append(unit)
+
+    def tick(self, n):
+        if n % ORDER_INTERVAL != 0:
+            return
+        pf.clear_unit_selection()
+        for unit in self.units:
+            unit.select()
+        waypoint = WAYPOINTS[(n / ORDER_INTERVAL) % len(WAYPOINTS)]
+        pf.move_order(pf.get_unit_selection(), waypoint, pf.movement_checksum()[0])
+
+    def params(self):
+        return {"units": len(self.units), "order_interval": ORDER_INTERVAL}
+
+runner = harness.run(MassSelection())
+
@@ -0,0 +1,72 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+"""
+A terrain brush sweeping over the map row by row, raising and lowering the 
+tiles under it on every tick, which stresses the chunk rebuilds, the 
+navigation updates and the uploads of the changed geometry.
+"""
+
+import pf
+import harness
+
+BRUSH_SIZE = 6
+TILES_PER_SIDE = harness.MAP_CHUNKS * harness.TILES_PER_CHUNK
+
+class TerrainBrush(harness.Scenario):
+
+    name = "terrain_brush"
+
+    def setup(self):
+        self.raised = pf.Tile()
+        self.raised.base_height = 1
+        self.flat = pf.Tile()
+
+    def tick(self, n):
+        per_row = TILES_PER_SIDE / BRUSH_SIZE
+        row = (n / per_row) % (TILES_PER_SIDE / BRUSH_SIZE) * BRUSH_SIZE
+        col = (n % per_row) * BRUSH_SIZE
+        # Every other pass over the map undoes the previous one
+        tile = self.raised if (n / (per_row * per_row)) % 2 == 0 else self.flat
+
+        chunk = (row / harness.TILES_PER_CHUNK, col / harness.TILES_PER_CHUNK)
+        origin = (row % harness.TILES_PER_CHUNK, col % harness.TILES_PER_CHUNK)
+        pf.update_tile_region(chunk, origin, (BRUSH_SIZE, BRUSH_SIZE), tile)
+
+    def params(self):
+        return {"brush_size": BRUSH_SIZE}
+
+runner = harness.run(TerrainBrush())
+
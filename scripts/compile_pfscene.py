@@ -0,0 +1,58 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+
+import pf
+import os
+
+# Writes the binary variant of every PFSCENE file under 'assets/maps'. Use 
+# this script as the engine argument after changing any of the scenes, or 
+# after updating the engine.
+
+basedir = os.path.realpath(pf.get_basedir())
+compiled, failed = 0, 0
+
+for dirpath, dirnames, filenames in os.walk(os.path.join(basedir, "assets", "maps")):
+    relpath = os.path.relpath(dirpath, basedir)
+    for filename in sorted(f for f in filenames if f.endswith(".pfscene")):
+        if pf.compile_scene(os.path.join(relpath, filename)):
+            compiled += 1
+        else:
+            failed += 1
+            print("Failed to compile: {0}".format(os.path.join(relpath, filename)))
+
+print("Compiled {0} PFSCENE file(s), {1} failed.".format(compiled, failed))
+
+pf.new_game("assets/maps", "demo.pfmap") # for a clean exit
+pf.global_event(pf.SDL_QUIT, None)
@@ -0,0 +1,98 @@
+#
+#  This file is part of Permafrost Engine. 
+#  Copyright (C) 2018 Eduard Permyakov 
+#
+#  Permafrost Engine is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#
+#  Permafrost Engine is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+# 
+#  Linking this software statically or dynamically with other modules is making 
+#  a combined work based on this software. Thus, the terms and conditions of 
+#  the GNU General Public License cover the whole combination. 
+#  
+#  As a special exception, the copyright holders of Permafrost Engine give 
+#  you permission to link Permafrost Engine with independent modules to produce 
+#  an executable, regardless of the license terms of these independent 
+#  modules, and to copy and distribute the resulting executable under 
+#  terms of your choice, provided that you also meet, for each linked 
+#  independent module, the terms and conditions of the license of that 
+#  module. An independent module is a module which is not derived from 
+#  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+#  extend this exception to your version of Permafrost Engine, but you are not 
+#  obliged to do so. If you do not wish to do so, delete this exception 
+#  statement from your version.
+#
+
+import pf
+import os
+import imp
+import time
+import struct
+import marshal
+import zipfile
+
+# Writes the precompiled bundle of every game script under 'scripts' (every 
+# 'main.py' one directory down), as 'main.pfbundle' next to it. It holds the 
+# bytecode of all the modules in the script's directory and below, and is 
+# what the engine runs the script from when it exists, importing the modules
+# from the one archive. Use this script as the engine argument to build the 
+# bundles for shipping, and again after changing any of the modules - while 
+# a bundle exists, the changes to the source files are not picked up.
+
+basedir = os.path.realpath(pf.get_basedir())
+scriptsdir = os.path.join(basedir, "scripts")
+
+def compiled_module(path):
+    with open(path, "rU") as source:
+        code = compile(source.read() + "\n", path, "exec")
+    mtime = int(os.stat(path).st_mtime)
+    return imp.get_magic() + struct.pack("<I", mtime & 0xffffffff) + marshal.dumps(code)
+
+def write_bundle(topdir, path):
+    num_modules = 0
+    tmp_path = path + ".tmp"
+    # Stored without compression, so that nothing has to be inflated on import
+    with zipfile.ZipFile(tmp_path, "w", zipfile.ZIP_STORED) as bundle:
+        for dirpath, dirnames, filenames in os.walk(topdir):
+            dirnames.sort()
+            relpath = os.path.relpath(dirpath, topdir)
+            for filename in sorted(f for f in filenames if f.endswith(".py")):
+                name = os.path.normpath(os.path.join(relpath, filename[:-3] + ".pyc"))
+                bundle.writestr(name.replace(os.sep, "/"), compiled_module(os.path.join(dirpath, filename)))
+                num_modules += 1
+    os.rename(tmp_path, path)
+    return num_modules
+
+built, failed = 0, 0
+
+for dirname in sorted(os.listdir(scriptsdir)):
+    topdir = os.path.join(scriptsdir, dirname)
+    if not os.path.isfile(os.path.join(topdir, "main.py")):
+        continue
+
+    path = os.path.join(topdir, "main.pfbundle")
+    begin = time.time()
+    try:
+        num_modules = write_bundle(topdir, path)
+    except (SyntaxError, IOError, OSError) as e:
+        failed += 1
+        print("Failed to bundle {0}: {1}".format(os.path.relpath(topdir, basedir), e))
+        continue
+
+    built += 1
+    print("Bundled {0} module(s) of {1} in {2:.2f} ms ({3} bytes)".format(num_modules, 
+        os.path.relpath(topdir, basedir), (time.time() - begin) * 1000.0, os.path.getsize(path)))
+
+print("Wrote {0} script bundle(s), {1} failed.".format(built, failed))
+
+pf.new_game("assets/maps", "demo.pfmap") # for a clean exit
+pf.global_event(pf.SDL_QUIT, None)
@@ -35,6 +35,7 @@
 import pf
 import traceback
 import copy
+import struct
 
 
 EDITOR_PFMAP_VERSION = 1.0
@@ -53,6 +54,9 @@ TILETYPE_CORNER_CONVEX_NW  = 0xa
 TILETYPE_CORNER_CONCAVE_NE = 0xb
 TILETYPE_CORNER_CONVEX_NE  = 0xc
 
+# The layout of a tile in the buffers returned by 'pf.map_chunk_tiles'
+TILE_STRUCT = struct.Struct("=BBbbBB")
+
 
 def tile_to_string(tile):
     ret = ""
@@ -212,6 +216,9 @@ class Map(object):
 
     def __init__(self, chunk_rows, chunk_cols):
         self.filename = None
+        # When set to a list, the changes to the chunk material lists are 
+        # appended to it as (chunk coords, old materials, new materials)
+        self.mat_changes = None
         self.chunk_rows = chunk_rows
         self.chunk_cols = chunk_cols
         self.chunks = []
@@ -231,17 +238,19 @@ class Map(object):
         return ret
 
     def write_to_file(self):
+        # The engine's copy of the map is kept in sync with every edit, so it 
+        # is saved on the C side rather than building the text here
         if self.filename is not None:
-            with open(self.filename, "w") as mapfile:
-                mapfile.write(self.pfmap_str())
+            pf.save_map(self.filename)
 
-    def update_tile_mat(self, tile_coords, top_material):
+    def update_tile_mat(self, tile_coords, top_material, batch=None):
 
         chunk = self.chunks[tile_coords[0][0]][tile_coords[0][1]]
         tile = chunk.tiles[tile_coords[1][0]][tile_coords[1][1]]
 
         if chunk.materials[tile.top_mat_idx] != top_material:
 
+            old_materials = list(chunk.materials)
             chunk.materials[tile.top_mat_idx].refcount -= 1
             mat_deleted = chunk.materials[tile.top_mat_idx].refcount == 0
             if mat_deleted:
@@ -261,12 +270,41 @@ class Map(object):
             assert mat_idx >= 0 and mat_idx < pf.MATERIALS_PER_CHUNK
             chunk.materials[mat_idx].refcount += 1
             tile.top_mat_idx = mat_idx
-            pf.update_tile(tile_coords[0], tile_coords[1], tile)
+            self.__commit_tile(tile_coords, tile, batch)
 
             if mat_deleted or mat_added:
                 pf.update_chunk_materials(tile_coords[0], chunk.materials_str())
+                if self.mat_changes is not None:
+                    self.mat_changes.append((tile_coords[0], old_materials, list(chunk.materials)))
+
+    def set_chunk_materials(self, chunk_coords, materials):
+        chunk = self.chunks[chunk_coords[0]][chunk_coords[1]]
+        chunk.materials = list(materials)
+        pf.update_chunk_materials(chunk_coords, chunk.materials_str())
+
+    def reload_chunk_tiles(self, chunk_coords):
+        """
+        Bring the tiles of a chunk back in sync with the engine's copy of the map, after 
+        it was changed on the C side (such as by 'pf.undo_map_edit'), and count the uses 
+        of the chunk's materials again.
+        """
+        chunk = self.chunks[chunk_coords[0]][chunk_coords[1]]
+        data = memoryview(pf.map_chunk_tiles(chunk_coords)).tobytes()
+
+        for m in chunk.materials:
+            if m is not None:
+                m.refcount = 0
 
-    def update_tile(self, tile_coords, newheight=None, newtype=None, new_ramp_height=None):
+        for r in range(0, pf.TILES_PER_CHUNK_HEIGHT):
+            for c in range(0, pf.TILES_PER_CHUNK_WIDTH):
+                tile = chunk.tiles[r][c]
+                tile.pathable, tile.type, tile.base_height, tile.ramp_height, \
+                tile.top_mat_idx, tile.sides_mat_idx = \
+                    TILE_STRUCT.unpack_from(data, (r * pf.TILES_PER_CHUNK_WIDTH + c) * TILE_STRUCT.size)
+                chunk.materials[tile.top_mat_idx].refcount += 1
+                chunk.materials[tile.sides_mat_idx].refcount += 1
+
+    def update_tile(self, tile_coords, newheight=None, newtype=None, new_ramp_height=None, batch=None):
         chunk = self.chunks[tile_coords[0][0]][tile_coords[0][1]]
         tile = chunk.tiles[tile_coords[1][0]][tile_coords[1][1]]
         if newheight is not None:
@@ -275,7 +313,17 @@ class Map(object):
             tile.type = newtype
         if new_ramp_height is not None:
             tile.ramp_height = new_ramp_height
-        pf.update_tile(tile_coords[0], tile_coords[1], tile)
+        self.__commit_tile(tile_coords, tile, batch)
+
+    def __commit_tile(self, tile_coords, tile, batch):
+        """
+        When a 'batch' list is given, the change is only queued in it, to be applied 
+        together with the rest of the batch by a single 'pf.update_tiles' call.
+        """
+        if batch is None:
+            pf.update_tile(tile_coords[0], tile_coords[1], tile)
+        else:
+            batch.append((tile_coords[0], tile_coords[1], tile))
 
     def relative_tile_coords(self, global_r, global_c, dr, dc):
 
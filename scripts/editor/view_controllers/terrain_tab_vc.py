@@ -124,6 +124,10 @@ class TerrainTabVC(vc.ViewController):
         self.view = view
         self.selected_tile = None
         self.painting = False
+        # The chunk material changes of each stroke, kept alongside the engine's 
+        # history of the tile changes so that they are undone together
+        self.undo_mats = []
+        self.redo_mats = []
 
         self.view.materials_list = TerrainTabVC.MATERIALS_LIST
 
@@ -142,6 +146,9 @@ class TerrainTabVC(vc.ViewController):
         global_r = self.selected_tile[0][0] * pf.TILES_PER_CHUNK_HEIGHT + self.selected_tile[1][0]
         global_c = self.selected_tile[0][1] * pf.TILES_PER_CHUNK_WIDTH  + self.selected_tile[1][1]
 
+        # The whole stroke is applied to the engine's map at once
+        batch = []
+
         for r in range(-((self.view.brush_size_idx + 1) // 2), ((self.view.brush_size_idx + 1) // 2) + 1):
             for c in range(-((self.view.brush_size_idx + 1) // 2), ((self.view.brush_size_idx + 1) // 2) + 1):
 
@@ -149,14 +156,18 @@ class TerrainTabVC(vc.ViewController):
                 if tile_coords is not None:
 
                     if self.view.brush_type_idx == 0:
-                        globals.active_map.update_tile_mat(tile_coords, TerrainTabVC.MATERIALS_LIST[self.view.selected_mat_idx])
+                        globals.active_map.update_tile_mat(tile_coords, TerrainTabVC.MATERIALS_LIST[self.view.selected_mat_idx], batch=batch)
                     elif self.view.brush_type_idx == 1:
                         center_height = self.view.heights[self.view.selected_height_idx]
-                        globals.active_map.update_tile(tile_coords, center_height, newtype=map.TILETYPE_FLAT)
+                        globals.active_map.update_tile(tile_coords, center_height, newtype=map.TILETYPE_FLAT, batch=batch)
+
+        if self.view.edges_type_idx == 1:
+            self.__paint_smooth_border(self.view.brush_size_idx + 1, 'down', batch)
+            self.__paint_smooth_border(self.view.brush_size_idx + 1, 'up', batch)
+
+        pf.update_tiles(batch)
 
         if self.view.edges_type_idx == 1:
-            self.__paint_smooth_border(self.view.brush_size_idx + 1, 'down')
-            self.__paint_smooth_border(self.view.brush_size_idx + 1, 'up')
             self.__update_objects_for_height_change()
 
     def __tile_make_smooth(self, tile_coords, dir):
@@ -254,7 +265,7 @@ class TerrainTabVC(vc.ViewController):
 
         return base_height, new_type, ramp_height
 
-    def __paint_smooth_border(self, radius, dir='up'):
+    def __paint_smooth_border(self, radius, dir='up', batch=None):
         assert self.selected_tile is not None
         global_r = self.selected_tile[0][0] * pf.TILES_PER_CHUNK_HEIGHT + self.selected_tile[1][0]
         global_c = self.selected_tile[0][1] * pf.TILES_PER_CHUNK_WIDTH  + self.selected_tile[1][1]
@@ -279,7 +290,7 @@ class TerrainTabVC(vc.ViewController):
                     results.append((tile_coords) + self.__tile_make_smooth(tile_coords, dir))
 
         for r in results:
-            globals.active_map.update_tile( (r[0], r[1]), *r[2:] )
+            globals.active_map.update_tile( (r[0], r[1]), *r[2:], batch=batch )
 
         corner_tiles_coords = [
             globals.active_map.relative_tile_coords(global_r, global_c, -radius, -radius),
@@ -289,7 +300,7 @@ class TerrainTabVC(vc.ViewController):
         ]
         for coords in [c for c in corner_tiles_coords if c is not None]:
             r = self.__tile_make_smooth(coords, dir)
-            globals.active_map.update_tile(coords, *r)
+            globals.active_map.update_tile(coords, *r, batch=batch)
 
     def __on_selected_tile_changed(self, event):
         self.selected_tile = event
@@ -298,15 +309,71 @@ class TerrainTabVC(vc.ViewController):
         if self.painting == True and self.selected_tile is not None:
             self.__paint_selection() 
 
+    def __begin_stroke(self):
+        if pf.begin_map_edit():
+            globals.active_map.mat_changes = []
+
+    def __end_stroke(self):
+        changes = globals.active_map.mat_changes
+        if changes is None:
+            return
+        globals.active_map.mat_changes = None
+
+        if pf.end_map_edit():
+            self.undo_mats.append(changes)
+            self.redo_mats = []
+
+        # The engine drops the oldest edits once its' history grows too large
+        num_undo = pf.map_edit_stats()['undo']
+        del self.undo_mats[:max(0, len(self.undo_mats) - num_undo)]
+
+    def __undo(self):
+        chunks = pf.undo_map_edit()
+        if chunks is None:
+            return
+
+        changes = self.undo_mats.pop() if self.undo_mats else []
+        for chunk_coords, old_mats, new_mats in reversed(changes):
+            globals.active_map.set_chunk_materials(chunk_coords, old_mats)
+        for chunk_coords in chunks:
+            globals.active_map.reload_chunk_tiles(chunk_coords)
+
+        self.redo_mats.append(changes)
+        self.__update_objects_for_height_change()
+
+    def __redo(self):
+        chunks = pf.redo_map_edit()
+        if chunks is None:
+            return
+
+        changes = self.redo_mats.pop() if self.redo_mats else []
+        for chunk_coords, old_mats, new_mats in changes:
+            globals.active_map.set_chunk_materials(chunk_coords, new_mats)
+        for chunk_coords in chunks:
+            globals.active_map.reload_chunk_tiles(chunk_coords)
+
+        self.undo_mats.append(changes)
+        self.__update_objects_for_height_change()
+
     def __on_mouse_pressed(self, event):
         if event[0] == pf.SDL_BUTTON_LEFT:
             self.painting = True
+            self.__begin_stroke()
         if self.selected_tile is not None:
             self.__paint_selection() 
 
     def __on_mouse_released(self, event):
         if event[0] == pf.SDL_BUTTON_LEFT:
             self.painting = False
+            self.__end_stroke()
+
+    def __on_key_pressed(self, event):
+        if self.painting:
+            return
+        if event[0] == pf.SDL_SCANCODE_Z:
+            self.__undo()
+        elif event[0] == pf.SDL_SCANCODE_Y:
+            self.__redo()
 
     def __on_brush_size_changed(self, event):
         pf.set_map_highlight_size(self.view.brush_size_idx + 1)
@@ -315,13 +382,17 @@ class TerrainTabVC(vc.ViewController):
         pf.set_map_highlight_size(self.view.brush_size_idx + 1)
         pf.register_event_handler(pf.SDL_MOUSEBUTTONDOWN, TerrainTabVC.__on_mouse_pressed, self)
         pf.register_event_handler(pf.SDL_MOUSEBUTTONUP, TerrainTabVC.__on_mouse_released, self)
+        pf.register_event_handler(pf.SDL_KEYDOWN, TerrainTabVC.__on_key_pressed, self)
         pf.register_event_handler(pf.EVENT_SELECTED_TILE_CHANGED, TerrainTabVC.__on_selected_tile_changed, self)
         pf.register_event_handler(EVENT_TERRAIN_BRUSH_SIZE_CHANGED, TerrainTabVC.__on_brush_size_changed, self)
 
     def deactivate(self):
+        self.painting = False
+        self.__end_stroke()
         pf.set_map_highlight_size(0)
         pf.unregister_event_handler(pf.SDL_MOUSEBUTTONDOWN, TerrainTabVC.__on_mouse_pressed)
         pf.unregister_event_handler(pf.SDL_MOUSEBUTTONUP, TerrainTabVC.__on_mouse_released)
+        pf.unregister_event_handler(pf.SDL_KEYDOWN, TerrainTabVC.__on_key_pressed)
         pf.unregister_event_handler(pf.EVENT_SELECTED_TILE_CHANGED, TerrainTabVC.__on_selected_tile_changed)
         pf.unregister_event_handler(EVENT_TERRAIN_BRUSH_SIZE_CHANGED, TerrainTabVC.__on_brush_size_changed)
 
@@ -33,13 +33,15 @@
 #
 import bpy
 import math
+import re
 from bpy import context
 from mathutils import Matrix
 from mathutils import Quaternion
 from mathutils import Euler
 from mathutils import Vector
 
-PFOBJ_VER = 1.0
+PFOBJ_VER = 1.1
+MAX_LODS = 4
 
 def mesh_triangulate(mesh):
     import bmesh
@@ -67,11 +69,94 @@ def current_pose_bbox(global_matrix, mesh_objs, local_origin):
 
     return min_x, max_x, min_y, max_y, min_z, max_z
 
+def write_vertices(ofile, objs, global_matrix, local_origin, arms, textured_mats):
+    for obj in objs:
+        mesh = obj.data
+
+        for face in mesh.polygons:
+            for loop_idx in face.loop_indices:
+
+                ws_mat = Matrix.Identity(4) if local_origin else obj.matrix_world
+                trans = global_matrix * ws_mat
+
+                v = mesh.vertices[mesh.loops[loop_idx].vertex_index]
+                v_co_world = trans * v.co
+
+                line = "v {v.x:.6f} {v.y:.6f} {v.z:.6f}\n"
+                line = line.format(v=v_co_world)
+                ofile.write(line)
+
+                uv_coords = mesh.uv_layers.active.data[loop_idx].uv
+                line = "vt {uv.x:.6f} {uv.y:.6f}\n"
+                line = line.format(uv=uv_coords)
+                ofile.write(line)
+
+                # The following line will give per-face normals instead
+                # Make it an option at some point ...
+                #normal = global_matrix * mesh.loops[loop_idx].normal
+                normal = global_matrix * v.normal
+                line = "vn {n[0]:.6f} {n[1]:.6f} {n[2]:.6f}\n"
+                line = line.format(n=normal)
+                ofile.write(line)
+
+                line = "vw ";
+                joint_idx_weight_map = {}
+                for vg in v.groups:
+
+                    if vg.weight == 0:
+                        continue
+
+                    bone_name = obj.vertex_groups[vg.group].name
+                    if bone_name not in arms[0].data.bones.keys():
+                        continue
+
+                    joint = arms[0].data.bones[bone_name]
+                    joint_idx = arms[0].data.bones.values().index(joint)
+
+                    joint_idx_weight_map[joint_idx] = vg.weight
+
+                # Write the joints ordered by weight - we only use the top 6 highest weights
+                # in the engine
+                from operator import itemgetter
+                for tuple in sorted(joint_idx_weight_map.items(), key=itemgetter(1), reverse=True):
+                    next_elem = " {g}/{w:.6f}"
+                    next_elem = next_elem.format(g=tuple[0], w=tuple[1])
+                    line += next_elem
+
+                line += "\n"
+                ofile.write(line)
+
+                mat_idx = textured_mats.index( mesh.materials[face.material_index] )
+                line = "vm {idx}\n"
+                line = line.format(idx=mat_idx)
+                ofile.write(line)
+
+def lod_levels(objs):
+    # The coarser versions of the mesh are the objects named with an '_LOD<N>'
+    # suffix, N starting at 1. The screen size that a level is used below is 
+    # taken from the 'pf_lod_screen_size' property of its' objects, and halves 
+    # with every level by default.
+    levels = {}
+    for obj in objs:
+        match = re.search(r"_LOD(\d+)$", obj.name)
+        if match and int(match.group(1)) > 0:
+            levels.setdefault(int(match.group(1)), []).append(obj)
+
+    ret = []
+    for level in sorted(levels.keys())[:MAX_LODS]:
+        objs = levels[level]
+        size = objs[0].get("pf_lod_screen_size", 0.3 / 2**(level - 1))
+        ret.append((float(size), objs))
+    return ret
+
 def save(operator, context, filepath, global_matrix, export_bbox, local_origin):
     with open(filepath, "w", encoding="ascii") as ofile:
 
-        mesh_objs = [obj for obj in bpy.context.selected_objects if obj.type == 'MESH']
-        meshes = [obj.data for obj in mesh_objs]
+        all_mesh_objs = [obj for obj in bpy.context.selected_objects if obj.type == 'MESH']
+        lods = lod_levels(all_mesh_objs)
+        lod_objs = [obj for size, objs in lods for obj in objs]
+        mesh_objs = [obj for obj in all_mesh_objs if obj not in lod_objs]
+        meshes = [obj.data for obj in all_mesh_objs]
         arms   = [obj for obj in bpy.context.selected_objects if obj.type == 'ARMATURE']
 
         textured_mats = []
@@ -85,8 +170,8 @@ def save(operator, context, filepath, global_matrix, export_bbox, local_origin):
             mesh.calc_normals_split()
 
         num_verts = 0
-        for mesh in meshes: 
-            num_verts += sum([face.loop_total for face in mesh.polygons])
+        for obj in mesh_objs: 
+            num_verts += sum([face.loop_total for face in obj.data.polygons])
 
         num_joints    = sum([len(arm.pose.bones) for arm in arms])
         num_as        = len(bpy.data.actions.items())
@@ -104,71 +189,13 @@ def save(operator, context, filepath, global_matrix, export_bbox, local_origin):
         ofile.write("num_as         " + str(num_as) + "\n")
         ofile.write("frame_counts   " + " ".join(frame_counts) + "\n")
         ofile.write("has_collision  " + str(1 if export_bbox is True else 0) + "\n")
+        ofile.write("num_lods       " + str(len(lods)) + "\n")
 
         #####################################################################
         # Write vertices and their attributes 
         #####################################################################
 
-        for obj in mesh_objs:
-            mesh = obj.data
-
-            for face in mesh.polygons:
-                for loop_idx in face.loop_indices:
-
-                    ws_mat = Matrix.Identity(4) if local_origin else obj.matrix_world
-                    trans = global_matrix * ws_mat
-
-                    v = mesh.vertices[mesh.loops[loop_idx].vertex_index]
-                    v_co_world = trans * v.co
-
-                    line = "v {v.x:.6f} {v.y:.6f} {v.z:.6f}\n"
-                    line = line.format(v=v_co_world)
-                    ofile.write(line)
-
-                    uv_coords = mesh.uv_layers.active.data[loop_idx].uv
-                    line = "vt {uv.x:.6f} {uv.y:.6f}\n"
-                    line = line.format(uv=uv_coords)
-                    ofile.write(line)
-
-                    # The following line will give per-face normals instead
-                    # Make it an option at some point ...
-                    #normal = global_matrix * mesh.loops[loop_idx].normal
-                    normal = global_matrix * v.normal
-                    line = "vn {n[0]:.6f} {n[1]:.6f} {n[2]:.6f}\n"
-                    line = line.format(n=normal)
-                    ofile.write(line)
-
-                    line = "vw ";
-                    joint_idx_weight_map = {}
-                    for vg in v.groups:
-
-                        if vg.weight == 0:
-                            continue
-
-                        bone_name = obj.vertex_groups[vg.group].name
-                        if bone_name not in arms[0].data.bones.keys():
-                            continue
-
-                        joint = arms[0].data.bones[bone_name]
-                        joint_idx = arms[0].data.bones.values().index(joint)
-
-                        joint_idx_weight_map[joint_idx] = vg.weight
-
-                    # Write the joints ordered by weight - we only use the top 6 highest weights
-                    # in the engine
-                    from operator import itemgetter
-                    for tuple in sorted(joint_idx_weight_map.items(), key=itemgetter(1), reverse=True):
-                        next_elem = " {g}/{w:.6f}"
-                        next_elem = next_elem.format(g=tuple[0], w=tuple[1])
-                        line += next_elem
-
-                    line += "\n"
-                    ofile.write(line)
-
-                    mat_idx = textured_mats.index( mesh.materials[face.material_index] )
-                    line = "vm {idx}\n"
-                    line = line.format(idx=mat_idx)
-                    ofile.write(line)
+        write_vertices(ofile, mesh_objs, global_matrix, local_origin, arms, textured_mats)
 
         #####################################################################
         # Write materials 
@@ -193,6 +220,16 @@ def save(operator, context, filepath, global_matrix, export_bbox, local_origin):
             line = "    texture " + material.active_texture.image.name + "\n"
             ofile.write(line)
 
+        #####################################################################
+        # Write levels of detail
+        #####################################################################
+
+        for size, objs in lods:
+
+            lod_verts = sum([face.loop_total for obj in objs for face in obj.data.polygons])
+            ofile.write("lod {s:.6f} {n}\n".format(s=size, n=lod_verts))
+            write_vertices(ofile, objs, global_matrix, local_origin, arms, textured_mats)
+
         #####################################################################
         # Write joints
         #####################################################################
@@ -0,0 +1,252 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 430 core
+
+/* Tests every instance against the view frustum, the fog of war and the 
+ * Hi-Z pyramid, and appends the model matrices of those which pass to the 
+ * run of the draw command of the level of detail they are to be drawn at. 
+ * The commands' instance counts must be reset to 0 beforehand. */
+
+#define MAX_LODS (4)
+
+layout (local_size_x = 64) in;
+
+struct instance{
+    mat4  model;
+    /* The center and radius of the bounding sphere */
+    vec4  sphere;
+    uint  group;
+};
+
+/* The instances of the same mesh. Its' levels of detail are drawn with the 
+ * consecutive commands from 'first_cmd': the mesh itself, then each of the 
+ * coarser levels, then the impostor. Each command has a run of 'capacity' 
+ * model matrices from 'first_slot' on. */
+struct group{
+    vec4  screen_sizes;
+    uint  first_cmd;
+    uint  num_lods;
+    /* 1 if the impostor is ready to be drawn, 0 otherwise */
+    uint  impostor;
+    uint  first_slot;
+    uint  capacity;
+};
+
+struct draw_cmd{
+    uint  count;
+    uint  instance_count;
+    uint  first;
+    uint  base_vertex;
+    uint  base_instance;
+};
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+layout (std430, binding = 0) readonly buffer instances
+{
+    instance instances_in[];
+};
+
+layout (std430, binding = 1) readonly buffer groups
+{
+    group groups_in[];
+};
+
+layout (std430, binding = 2) buffer commands
+{
+    draw_cmd commands_out[];
+};
+
+layout (std430, binding = 3) writeonly buffer models
+{
+    mat4 models_out[];
+};
+
+uniform uint      num_instances;
+uniform float     lod_scale;
+uniform float     impostor_size;
+uniform bool      hiz_enabled;
+uniform sampler2D texture0; /* The Hi-Z pyramid */
+
+uniform bool      fog_enabled;
+uniform vec4      fog_rect;
+uniform sampler2D texture1; /* The fog of war */
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+bool in_frustum(vec4 sphere, mat4 view_proj)
+{
+    mat4 rows = transpose(view_proj);
+    vec4 planes[6] = vec4[6](
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2]
+    );
+
+    for(int i = 0; i < 6; i++) {
+        vec4 plane = planes[i] / length(planes[i].xyz);
+        if(dot(plane.xyz, sphere.xyz) + plane.w < -sphere.w)
+            return false;
+    }
+    return true;
+}
+
+/* Static entities are shown anywhere that has been explored */
+bool explored(vec3 pos)
+{
+    vec2 uv = (pos.xz - fog_rect.xy) * fog_rect.zw;
+    if(any(lessThan(uv, vec2(0.0))) || any(greaterThanEqual(uv, vec2(1.0))))
+        return false;
+
+    ivec2 texel = ivec2(uv * vec2(textureSize(texture1, 0)));
+    return (texelFetch(texture1, texel, 0).r > 0.0);
+}
+
+/* The box around the sphere is projected to the screen, and compared with 
+ * the farthest depth of the texels it covers at the level of the pyramid 
+ * where it spans no more than two of them each way */
+bool occluded(vec4 sphere, mat4 view_proj)
+{
+    vec3 ndc_min = vec3( 1.0);
+    vec3 ndc_max = vec3(-1.0);
+
+    for(int i = 0; i < 8; i++) {
+
+        vec3 corner = sphere.xyz + sphere.w * vec3(
+            (i & 4) != 0 ? 1.0 : -1.0,
+            (i & 2) != 0 ? 1.0 : -1.0,
+            (i & 1) != 0 ? 1.0 : -1.0
+        );
+        vec4 clip = view_proj * vec4(corner, 1.0);
+
+        /* Behind the camera, the projection can't be trusted */
+        if(clip.w <= 0.0)
+            return false;
+
+        vec3 ndc = clip.xyz / clip.w;
+        ndc_min = min(ndc_min, ndc);
+        ndc_max = max(ndc_max, ndc);
+    }
+
+    vec2 uv_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uv_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0);
+    float nearest = ndc_min.z * 0.5 + 0.5;
+
+    ivec2 size = textureSize(texture0, 0);
+    vec2 extent = (uv_max - uv_min) * vec2(size);
+    int levels = textureQueryLevels(texture0);
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, levels - 1);
+
+    ivec2 level_size = textureSize(texture0, level);
+    ivec2 lo = clamp(ivec2(uv_min * vec2(level_size)), ivec2(0), level_size - 1);
+    ivec2 hi = clamp(ivec2(uv_max * vec2(level_size)), ivec2(0), level_size - 1);
+
+    if(any(greaterThan(hi - lo, ivec2(1))) && level < levels - 1) {
+        level++;
+        level_size = textureSize(texture0, level);
+        lo = clamp(ivec2(uv_min * vec2(level_size)), ivec2(0), level_size - 1);
+        hi = clamp(ivec2(uv_max * vec2(level_size)), ivec2(0), level_size - 1);
+    }
+
+    float farthest = 0.0;
+    for(int y = lo.y; y <= min(hi.y, lo.y + 1); y++) {
+        for(int x = lo.x; x <= min(hi.x, lo.x + 1); x++) {
+            farthest = max(farthest, texelFetch(texture0, ivec2(x, y), level).r);
+        }
+    }
+    return (nearest > farthest);
+}
+
+/* Mirrors the choice of the level of detail made on the CPU */
+uint lod_level(vec4 sphere, group grp)
+{
+    float dist = length(sphere.xyz - view_pos);
+    if(dist <= sphere.w)
+        return 0;
+
+    float size = lod_scale * sphere.w / dist;
+    if(grp.impostor != 0 && size < impostor_size)
+        return grp.num_lods + 1;
+
+    uint ret = 0;
+    for(uint i = 0; i < grp.num_lods && i < MAX_LODS; i++) {
+        if(size > grp.screen_sizes[i])
+            break;
+        ret = i + 1;
+    }
+    return ret;
+}
+
+void main()
+{
+    uint idx = gl_GlobalInvocationID.x;
+    if(idx >= num_instances)
+        return;
+
+    instance inst = instances_in[idx];
+    mat4 view_proj = projection * view;
+
+    if(!in_frustum(inst.sphere, view_proj))
+        return;
+
+    if(fog_enabled && !explored(inst.model[3].xyz))
+        return;
+
+    if(hiz_enabled && occluded(inst.sphere, view_proj))
+        return;
+
+    group grp = groups_in[inst.group];
+    uint level = lod_level(inst.sphere, grp);
+    uint cmd = grp.first_cmd + level;
+
+    uint slot = atomicAdd(commands_out[cmd].instance_count, 1u);
+    models_out[grp.first_slot + level * grp.capacity + slot] = inst.model;
+}
+
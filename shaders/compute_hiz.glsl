@@ -0,0 +1,91 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 430 core
+
+/* Builds a level of the Hi-Z pyramid, where every texel holds the farthest
+ * depth of the texels of the level below that it covers. The first level is
+ * reduced from the scene's depth buffer. Where the level below has an odd 
+ * size, the last texel of the row or column also takes in the one left over,
+ * so that no depth is ever missed. */
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+uniform sampler2D texture0;
+uniform ivec2     src_size;
+uniform bool      first_level;
+
+layout (r32f, binding = 0) uniform readonly  image2D hiz_src;
+layout (r32f, binding = 1) uniform writeonly image2D hiz_dst;
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+float src_depth(ivec2 coord, ivec2 size)
+{
+    coord = min(coord, size - 1);
+    if(first_level)
+        return texelFetch(texture0, coord, 0).r;
+    return imageLoad(hiz_src, coord).r;
+}
+
+void main()
+{
+    ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 dst_size = imageSize(hiz_dst);
+    if(any(greaterThanEqual(dst, dst_size)))
+        return;
+
+    ivec2 size = first_level ? src_size : imageSize(hiz_src);
+    ivec2 src = dst * 2;
+
+    int last_x = ((size.x & 1) != 0 && dst.x == dst_size.x - 1) ? 2 : 1;
+    int last_y = ((size.y & 1) != 0 && dst.y == dst_size.y - 1) ? 2 : 1;
+
+    float depth = 0.0;
+    for(int y = 0; y <= last_y; y++) {
+        for(int x = 0; x <= last_x; x++) {
+            depth = max(depth, src_depth(src + ivec2(x, y), size));
+        }
+    }
+
+    imageStore(hiz_dst, dst, vec4(depth));
+}
+
@@ -0,0 +1,74 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+#define STYLE_ARROW 0
+#define STYLE_SPARK 1
+
+out vec4 o_frag_color;
+
+in VertexToFrag {
+         vec2  uv;
+    flat vec4  color;
+}from_vertex;
+
+uniform int effect_style;
+
+void main()
+{
+    vec2 uv = from_vertex.uv;
+    float alpha;
+
+    if(effect_style == STYLE_ARROW) {
+
+        /* A chevron with its tip at the top of the quad */
+        float d = uv.y + abs(uv.x - 0.5) * 1.2;
+        alpha = smoothstep(0.55, 0.6, d) * (1.0 - smoothstep(0.9, 0.95, d));
+
+    }else {
+
+        /* A disc that is brightest in the middle */
+        float r = length(uv - vec2(0.5)) * 2.0;
+        alpha = pow(max(1.0 - r, 0.0), 2.0);
+    }
+
+    alpha *= from_vertex.color.a;
+    if(alpha < 0.01)
+        discard;
+
+    o_frag_color = vec4(from_vertex.color.rgb, alpha);
+}
+
@@ -0,0 +1,105 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+/* Darkens the scene by the fog of war and the shadows at the world position 
+ * of each pixel */
+
+/* The fraction of the light left in the shadows */
+#define SHADOW_BRIGHTNESS  0.55
+/* Keeps surfaces from shadowing themselves, in light clip space depth */
+#define SHADOW_BIAS        0.0015
+
+in VertexToFrag {
+         vec2 uv;
+    flat mat4 inv_view_proj;
+}from_vertex;
+
+out vec4 o_frag_color;
+
+/* The scene's color and depth, the fog texture, and the shadow maps of the 
+ * static geometry and of the moving objects */
+uniform sampler2D texture0;
+uniform sampler2D texture1;
+uniform sampler2D texture2;
+uniform sampler2DShadow texture3;
+uniform sampler2DShadow texture4;
+
+uniform vec4 fog_rect;
+uniform vec2 uv_scale;
+uniform bool fog_enabled;
+uniform bool shadows_enabled;
+uniform mat4 light_view_proj;
+
+float shadow_light(vec3 world)
+{
+    vec4 light_clip = light_view_proj * vec4(world, 1.0);
+    vec3 coord = (light_clip.xyz / light_clip.w) * 0.5 + 0.5;
+
+    /* Outside of the shadowed region */
+    if(any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0))))
+        return 1.0;
+
+    coord.z -= SHADOW_BIAS;
+    float lit = min(texture(texture3, coord), texture(texture4, coord));
+    return mix(SHADOW_BRIGHTNESS, 1.0, lit);
+}
+
+void main()
+{
+    vec2 uv = from_vertex.uv * uv_scale;
+    vec4 color = texture(texture0, uv);
+    float depth = texture(texture1, uv).r;
+
+    /* Nothing was drawn here */
+    if(depth == 1.0) {
+        o_frag_color = color;
+        return;
+    }
+
+    vec4 ndc = vec4(from_vertex.uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+    vec4 world = from_vertex.inv_view_proj * ndc;
+    world /= world.w;
+
+    float light = 1.0;
+    if(fog_enabled)
+        light *= texture(texture2, (world.xz - fog_rect.xy) * fog_rect.zw).r;
+    if(shadows_enabled)
+        light *= shadow_light(world.xyz);
+
+    o_frag_color = vec4(color.rgb * light, color.a);
+}
+
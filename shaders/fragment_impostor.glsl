@@ -0,0 +1,106 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+#define MAX_MATERIALS 8
+
+/*****************************************************************************/
+/* INPUTS                                                                    */
+/*****************************************************************************/
+
+in VertexToFrag {
+         vec2 uv;
+    flat int  mat_idx;
+         vec3 world_pos;
+         vec3 normal;
+}from_vertex;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out vec4 o_frag_color;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+struct material{
+    float ambient_intensity;
+    vec3  diffuse_clr;
+    vec3  specular_clr;
+};
+
+uniform material materials[MAX_MATERIALS];
+
+/* The unlit views of the mesh, side by side */
+uniform sampler2D texture0;
+
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
+
+void main()
+{
+    vec4 tex_color = texture(texture0, from_vertex.uv);
+
+    /* The atlas is cleared to transparent black, which the coarser mip levels
+     * blend into the edges of the views */
+    if(tex_color.a < 0.5)
+        discard;
+    tex_color.rgb /= tex_color.a;
+
+    /* Only the ambient and the directional diffuse light are applied, for
+     * the whole billboard facing the camera */
+    vec3 ambient = materials[0].ambient_intensity * ambient_color;
+
+    vec3 light_dir = normalize(light_pos - from_vertex.world_pos);  
+    float diff = max(dot(from_vertex.normal, light_dir), 0.0);
+    vec3 diffuse = light_color * (diff * materials[0].diffuse_clr);
+
+    o_frag_color = vec4((ambient + diffuse) * tex_color.rgb, 1.0);
+}
+
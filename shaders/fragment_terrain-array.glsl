@@ -0,0 +1,477 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+#define MAX_MATERIALS 16
+
+/* TODO: Make these as material parameters */
+#define SPECULAR_STRENGTH  0.5
+#define SPECULAR_SHININESS 2
+
+#define Y_COORDS_PER_TILE  4 
+#define EXTRA_AMBIENT_PER_LEVEL 0.03
+
+#define BLEND_MODE_NOBLEND  0
+#define BLEND_MODE_BLUR     1
+
+/* NO_BLEND is defined by the program variant which is only used to draw chunks
+ * without any blended tiles. It leaves out the blending altogether, along with 
+ * the registers it needs. */
+
+/*****************************************************************************/
+/* INPUTS                                                                    */
+/*****************************************************************************/
+
+in VertexToFrag {
+         vec2  uv;
+    flat int   mat_idx;
+         vec3  world_pos;
+         vec3  normal;
+    flat int   blend_mode;
+    flat ivec4 adjacent_mat_indices;
+}from_vertex;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+layout(location = 0) out vec4 o_frag_color;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* Must match the definitions in render_gl_lights.c */
+#define MAX_POINT_LIGHTS 64
+#define CLUSTER_CELLS    1728
+#define CLUSTER_INDICES  6144
+
+/* Each cell holds the offset of its' lights in 'cluster_indices' in the low 
+ * 16 bits and their count in the high 16 bits. The indices are 8 bits each, 
+ * packed 16 to a uvec4. */
+layout (std140) uniform point_lights
+{
+    vec4  light_pos_radius[MAX_POINT_LIGHTS];
+    vec4  light_colors[MAX_POINT_LIGHTS];
+    ivec4 cluster_dims;  /* x, y, z, number of lights */
+    vec4  cluster_depth; /* near, 1 / log(far / near) */
+    uvec4 cluster_cells[CLUSTER_CELLS / 4];
+    uvec4 cluster_indices[CLUSTER_INDICES / 16];
+};
+
+/* Must match the definitions in render_gl_decals.c and tile.h */
+#define MAX_DECALS        256
+#define DECAL_RING        0
+#define DECAL_TILES       1
+#define DECAL_MIN_NORMAL  0.5
+#define X_COORDS_PER_TILE 8
+#define Z_COORDS_PER_TILE 8
+
+/* The shapes are in world XZ: the center, followed by the outer radius of 
+ * a ring or the half extents of a rect of tiles. The alpha of the color is 
+ * the width of the band drawn inside the edges. The kinds are packed 4 to 
+ * an ivec4. */
+layout (std140) uniform decals
+{
+    ivec4 decal_count;  /* x: number of decals */
+    vec4  decal_bounds; /* min x, min z, max x, max z */
+    vec4  decal_shapes[MAX_DECALS];
+    vec4  decal_colors[MAX_DECALS];
+    ivec4 decal_kinds[MAX_DECALS / 4];
+};
+
+/* Layer 'i' holds the texture of material 'i' */
+uniform sampler2DArray texture_array;
+
+struct material{
+    float ambient_intensity;
+    vec3  diffuse_clr;
+    vec3  specular_clr;
+};
+
+uniform material materials[MAX_MATERIALS];
+uniform bool skip_lighting = false;
+
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
+
+/* Returns the color of the topmost decal covering the fragment, or 'color' 
+ * if there is none. Only the surfaces facing up get the decals. */
+vec3 decals_apply(vec3 world_pos, vec3 normal, vec3 color)
+{
+    vec2 xz = world_pos.xz;
+    if(decal_count.x == 0 || normal.y < DECAL_MIN_NORMAL)
+        return color;
+    if(any(lessThan(xz, decal_bounds.xy)) || any(greaterThan(xz, decal_bounds.zw)))
+        return color;
+
+    for(int i = 0; i < decal_count.x; i++) {
+
+        vec4 shape = decal_shapes[i];
+        float width = decal_colors[i].a;
+        bool covered;
+
+        if(decal_kinds[i / 4][i % 4] == DECAL_RING) {
+
+            float dist = length(xz - shape.xy);
+            covered = (dist <= shape.z) && (dist >= shape.z - width);
+        }else{
+
+            vec2 local = xz - shape.xy + shape.zw;
+            vec2 tile_dims = vec2(X_COORDS_PER_TILE, Z_COORDS_PER_TILE);
+            vec2 in_tile = mod(local, tile_dims);
+            covered = all(greaterThanEqual(local, vec2(0.0)))
+                   && all(lessThanEqual(local, shape.zw * 2.0))
+                   && (any(lessThan(in_tile, vec2(width))) 
+                   ||  any(greaterThan(in_tile, tile_dims - width)));
+        }
+
+        if(covered)
+            color = decal_colors[i].rgb;
+    }
+    return color;
+}
+
+vec3 point_lights_diffuse(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
+{
+    if(cluster_dims.w == 0)
+        return vec3(0.0);
+
+    vec4 view_space = view * vec4(world_pos, 1.0);
+    vec4 clip = projection * view_space;
+    vec2 ndc = clip.xy / clip.w;
+
+    ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(cluster_dims.xy)), ivec2(0), cluster_dims.xy - 1);
+    float depth = max(-view_space.z, cluster_depth.x);
+    int slice = clamp(int(log(depth / cluster_depth.x) * cluster_depth.y * float(cluster_dims.z)), 
+        0, cluster_dims.z - 1);
+
+    int cell_idx = (slice * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+    uint cell = cluster_cells[cell_idx / 4][cell_idx % 4];
+    int offset = int(cell & 0xffffu);
+    int count = int(cell >> 16u);
+
+    vec3 ret = vec3(0.0);
+    for(int i = 0; i < count; i++) {
+
+        int slot = offset + i;
+        uint word = cluster_indices[slot / 16][(slot / 4) % 4];
+        int light = int((word >> uint((slot % 4) * 8)) & 0xffu);
+
+        vec3 to_light = light_pos_radius[light].xyz - world_pos;
+        float dist = length(to_light);
+        float atten = clamp(1.0 - dist / light_pos_radius[light].w, 0.0, 1.0);
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += light_colors[light].rgb * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
+}
+
+vec4 texture_val(int mat_idx, vec2 uv)
+{
+    return texture(texture_array, vec3(uv, mat_idx));
+}
+
+vec4 mixed_texture_val(int adjacency_mats, vec2 uv)
+{
+    vec4 ret = vec4(0.0f);
+    for(int i = 0; i < 8; i++) {
+        int idx = (adjacency_mats >> (i * 4)) & 0xf;
+        ret += texture_val(idx, uv) * (1.0/8.0);
+    }
+    return ret;
+}
+
+material mixed_material_from_adj(int adjacency_mats)
+{
+    material ret = material(0.0, vec3(0.0), vec3(0.0));
+    for(int i = 0; i < 8; i++) {
+        int idx = (adjacency_mats >> (i * 4)) & 0xf;
+        ret.ambient_intensity += materials[idx].ambient_intensity * (1.0f/8.0f);
+        ret.diffuse_clr += materials[idx].diffuse_clr * (1.0f/8.0f);
+        ret.specular_clr += materials[idx].specular_clr * (1.0f/8.0f);
+    }
+    return ret;
+}
+
+material mix_materials(material x, material y, float a)
+{
+    return material(
+        x.ambient_intensity * (1.0 - a) + y.ambient_intensity * a, 
+        x.diffuse_clr       * (1.0 - a) + y.diffuse_clr       * a, 
+        x.specular_clr      * (1.0 - a) + y.specular_clr      * a
+    );
+}
+
+vec4 bilinear_interp_vec4
+(
+    vec4 q11, vec4 q12, vec4 q21, vec4 q22, 
+    float x1, float x2, 
+    float y1, float y2, 
+    float x, float y
+)
+{
+    float x2x1, y2y1, x2x, y2y, yy1, xx1;
+
+    x2x1 = x2 - x1;
+    y2y1 = y2 - y1;
+    x2x = x2 - x;
+    y2y = y2 - y;
+    yy1 = y - y1;
+    xx1 = x - x1;
+
+    return 1.0 / (x2x1 * y2y1) * (
+        q11 * x2x * y2y +
+        q21 * xx1 * y2y +
+        q12 * x2x * yy1 +
+        q22 * xx1 * yy1
+    );
+}
+
+void main()
+{
+    vec4 tex_color;
+    material frag_material;
+
+#if defined(NO_BLEND)
+    tex_color = texture_val(from_vertex.mat_idx, from_vertex.uv);     
+    frag_material = materials[from_vertex.mat_idx];
+#else
+    switch(from_vertex.blend_mode) {
+    case BLEND_MODE_NOBLEND: 
+        tex_color = texture_val(from_vertex.mat_idx, from_vertex.uv);     
+        frag_material = materials[from_vertex.mat_idx];
+        break;
+    case BLEND_MODE_BLUR:
+
+        /* 
+         * This shader will blend this tile's texture(s) with adjacent tiles' textures 
+         * based on adjacency information of neighboring tiles' materials.
+         *
+         * Our top tile faces are made up of 4 triangles in the following configuration:
+         *
+         *  +----+----+
+         *  | \ top / |
+         *  |  \   /  |
+         *  + l -+- r +
+         *  |  /   \  |
+         *  | / bot \ |
+         *  +----+----+
+         *
+         * Each of the 4 triangles has a vertex at the center of the tile. The 'adjacent_mat_indices'
+         * is a 'flat' attribute, so it will be the same for all fragments of a triangle.
+         *
+         * The UV coordinates for a tile go from (0.0, 1.0) to (1.0, 1.0) in the diagonal corner so
+         * we are able to determine which of the 4 triangles this fragment is in by checking 
+         * the interpolated UV coordinate.
+         *
+         * For a single tile, there are 9 reference points on the face of the tile: The 4 corners
+         * of the tile, the midpoints of the 4 edges, and the center point.
+         *
+         *  +---+---+
+         *  | 1 | 2 |
+         *  +---+---+
+         *  | 4 | 3 |
+         *  +---+---+ 
+         *
+         * Based on which quadrant we're in (which can be determined from UV), we will select the closest 
+         * 4 points and use bilinear interpolation to select the texture color for this fragment using 
+         * the UV coordinate.
+         *
+         * The first two elements of 'adjacent_mat_indices' hold the adjacency information for the 
+         * two non-center vertices for this triangle. Each element has 8 4-bit indices packed into the 
+         * least significant 32 bits, resulting in 8 indices for each of the two vertices. Each index
+         * is the material of one of the 8 triangles touching the vertex.
+         *
+         * The next element of 'adjacent_mat_indices' holds the materials for the centers of the 
+         * edges of the tile, with 2 4-bit indices for each edge.
+         * 
+         * The last element of 'adjacent_mat_indices' holds the 2 materials at the central point of 
+         * the tile in the lowest 8 bits. Usually the 2 indices are the same except for some corner tiles
+         * where half of the tile uses a different material.
+         *
+         */
+
+        bool bot   = (from_vertex.uv.x > from_vertex.uv.y) && (1.0 - from_vertex.uv.x > from_vertex.uv.y);
+        bool top   = (from_vertex.uv.x < from_vertex.uv.y) && (1.0 - from_vertex.uv.x < from_vertex.uv.y);
+        bool left  = (from_vertex.uv.x < from_vertex.uv.y) && (1.0 - from_vertex.uv.x > from_vertex.uv.y);
+        bool right = (from_vertex.uv.x > from_vertex.uv.y) && (1.0 - from_vertex.uv.x < from_vertex.uv.y);
+
+        bool left_half = from_vertex.uv.x < 0.5f;
+        bool bot_half = from_vertex.uv.y < 0.5f;
+
+        /***********************************************************************
+         * Set the fragment material 
+         **********************************************************************/
+
+        float alpha_edge = (bot)   ? (0.5f - from_vertex.uv.y)/0.5f
+                         : (top)   ? 1.0f - (1.0 - from_vertex.uv.y)/0.5f
+                         : (left)  ? (0.5f - from_vertex.uv.x)/0.5f
+                         : /*right*/ 1.0f - (1.0 - from_vertex.uv.x)/0.5f;
+
+        material m1 = mixed_material_from_adj(from_vertex.adjacent_mat_indices[0]);
+        material m2 = mixed_material_from_adj(from_vertex.adjacent_mat_indices[1]);
+
+        material edge_mat = mix_materials(m1, m2, (bot || top) ? from_vertex.uv.x : from_vertex.uv.y);
+        material tile_mat = mix_materials(
+            materials[(from_vertex.adjacent_mat_indices[3] >> 0) & 0xf], 
+            materials[(from_vertex.adjacent_mat_indices[3] >> 4) & 0xf], 
+            0.5
+        );
+        frag_material = mix_materials(tile_mat, edge_mat, alpha_edge);
+
+        /***********************************************************************
+         * Set the fragment texture color
+         **********************************************************************/
+        vec4 color1 = mixed_texture_val(from_vertex.adjacent_mat_indices[0], from_vertex.uv);
+        vec4 color2 = mixed_texture_val(from_vertex.adjacent_mat_indices[1], from_vertex.uv);
+
+        vec4 tile_color = mix(
+            texture_val((from_vertex.adjacent_mat_indices[3] >> 0) & 0xf, from_vertex.uv), 
+            texture_val((from_vertex.adjacent_mat_indices[3] >> 4) & 0xf, from_vertex.uv), 
+            0.5f
+        );
+        vec4 left_center_color =  mix(
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 0) & 0xf, from_vertex.uv), 
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 4) & 0xf, from_vertex.uv), 
+            0.5f
+        );
+        vec4 bot_center_color = mix(
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 8) & 0xf, from_vertex.uv),
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 12) & 0xf, from_vertex.uv),
+            0.5f
+        );
+        vec4 right_center_color = mix(
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 16) & 0xf, from_vertex.uv), 
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 20) & 0xf, from_vertex.uv), 
+            0.5f
+        );
+        vec4 top_center_color = mix(
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 24) & 0xf, from_vertex.uv), 
+            texture_val((from_vertex.adjacent_mat_indices[2] >> 28) & 0xf, from_vertex.uv), 
+            0.5f
+        );
+
+        if(top){
+
+            if(left_half)
+                tex_color = bilinear_interp_vec4(left_center_color, color1, tile_color, top_center_color,
+                    0.0f, 0.5f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);        
+            else
+                tex_color = bilinear_interp_vec4(tile_color, top_center_color, right_center_color, color2,
+                    0.5f, 1.0f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
+        }else if(bot){
+
+            if(left_half)
+                tex_color = bilinear_interp_vec4(color1, left_center_color, bot_center_color, tile_color,
+                    0.0f, 0.5f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
+            else
+                tex_color = bilinear_interp_vec4(bot_center_color, tile_color, color2, right_center_color,
+                    0.5f, 1.0f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);
+        }else if(left){
+
+            if(bot_half)
+                tex_color = bilinear_interp_vec4(color1, left_center_color, bot_center_color, tile_color,
+                    0.0f, 0.5f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
+            else
+                tex_color = bilinear_interp_vec4(left_center_color, color2, tile_color, top_center_color,
+                    0.0f, 0.5f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
+        }else if(right){
+
+            if(bot_half)
+                tex_color = bilinear_interp_vec4(bot_center_color, tile_color, color1, right_center_color,
+                    0.5f, 1.0f, 0.0f, 0.5f, from_vertex.uv.x, from_vertex.uv.y);        
+            else
+                tex_color = bilinear_interp_vec4(tile_color, top_center_color, right_center_color, color2,
+                    0.5f, 1.0f, 0.5f, 1.0f, from_vertex.uv.x, from_vertex.uv.y);
+        }
+
+        break;
+    default:
+        tex_color = vec4(1.0, 0.0, 1.0, 1.0);
+        return;
+    }
+#endif
+
+    /* Simple alpha test to reject transparent pixels */
+    if(tex_color.a == 0.0)
+        discard;
+
+    if(skip_lighting) {
+        o_frag_color = vec4(tex_color.xyz, 1.0);
+        return;
+    }
+
+    /* We increase the amount of ambient light that taller tiles get, in order to make
+     * them not blend with lower terrain. */
+    float height = from_vertex.world_pos.y / Y_COORDS_PER_TILE;
+
+    /* Ambient calculations */
+    vec3 ambient = (frag_material.ambient_intensity + height * EXTRA_AMBIENT_PER_LEVEL) * ambient_color;
+
+    /* Diffuse calculations */
+    vec3 light_dir = normalize(light_pos - from_vertex.world_pos);  
+    float diff = max(dot(from_vertex.normal, light_dir), 0.0);
+    vec3 diffuse = light_color * (diff * frag_material.diffuse_clr);
+    diffuse += point_lights_diffuse(from_vertex.world_pos, from_vertex.normal, frag_material.diffuse_clr);
+
+    /* Since, for optimization reasons, we currently render the terrain top surface to a texture 
+     * with the lighting calculations already included, we skip the specular lighting, as it is 
+     * dependent on the camera position. */
+
+    /* Specular calculations */
+    #if 0
+    vec3 view_dir = normalize(view_pos - from_vertex.world_pos);
+    vec3 reflect_dir = reflect(-light_dir, from_vertex.normal);  
+    float spec = pow(max(dot(view_dir, reflect_dir), 0.0), SPECULAR_SHININESS);
+    vec3 specular = SPECULAR_STRENGTH * light_color * (spec * frag_material.specular_clr);
+    #endif
+
+    vec3 lit = (ambient + diffuse) * tex_color.xyz;
+    o_frag_color = vec4(decals_apply(from_vertex.world_pos, from_vertex.normal, lit), 1.0);
+}
+
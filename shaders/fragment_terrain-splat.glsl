@@ -0,0 +1,297 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+#define MAX_MATERIALS 16
+
+#define Y_COORDS_PER_TILE  4 
+#define EXTRA_AMBIENT_PER_LEVEL 0.03
+
+/* TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE, TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE */
+#define CHUNK_WIDTH  256.0
+#define CHUNK_HEIGHT 256.0
+
+#define BLEND_MODE_NOBLEND  0
+#define BLEND_MODE_BLUR     1
+
+/*****************************************************************************/
+/* INPUTS                                                                    */
+/*****************************************************************************/
+
+in VertexToFrag {
+         vec2  uv;
+    flat int   mat_idx;
+         vec3  world_pos;
+         vec3  normal;
+    flat int   blend_mode;
+    flat ivec4 adjacent_mat_indices;
+}from_vertex;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+layout(location = 0) out vec4 o_frag_color;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* Must match the definitions in render_gl_lights.c */
+#define MAX_POINT_LIGHTS 64
+#define CLUSTER_CELLS    1728
+#define CLUSTER_INDICES  6144
+
+/* Each cell holds the offset of its' lights in 'cluster_indices' in the low 
+ * 16 bits and their count in the high 16 bits. The indices are 8 bits each, 
+ * packed 16 to a uvec4. */
+layout (std140) uniform point_lights
+{
+    vec4  light_pos_radius[MAX_POINT_LIGHTS];
+    vec4  light_colors[MAX_POINT_LIGHTS];
+    ivec4 cluster_dims;  /* x, y, z, number of lights */
+    vec4  cluster_depth; /* near, 1 / log(far / near) */
+    uvec4 cluster_cells[CLUSTER_CELLS / 4];
+    uvec4 cluster_indices[CLUSTER_INDICES / 16];
+};
+
+/* Must match the definitions in render_gl_decals.c and tile.h */
+#define MAX_DECALS        256
+#define DECAL_RING        0
+#define DECAL_TILES       1
+#define DECAL_MIN_NORMAL  0.5
+#define X_COORDS_PER_TILE 8
+#define Z_COORDS_PER_TILE 8
+
+/* The shapes are in world XZ: the center, followed by the outer radius of 
+ * a ring or the half extents of a rect of tiles. The alpha of the color is 
+ * the width of the band drawn inside the edges. The kinds are packed 4 to 
+ * an ivec4. */
+layout (std140) uniform decals
+{
+    ivec4 decal_count;  /* x: number of decals */
+    vec4  decal_bounds; /* min x, min z, max x, max z */
+    vec4  decal_shapes[MAX_DECALS];
+    vec4  decal_colors[MAX_DECALS];
+    ivec4 decal_kinds[MAX_DECALS / 4];
+};
+
+/* Layer 'i' holds the texture of material 'i' */
+uniform sampler2DArray texture_array;
+
+/* Layer 'i' holds the weights of the 4 materials of chunk 'i', which are
+ * in texel 'i' of 'splat_mats' */
+uniform sampler2DArray splat_weights;
+uniform usampler2D     splat_mats;
+
+/* The worldspace XZ position of the map's corner and its' size in chunks */
+uniform vec2  splat_origin;
+uniform ivec2 splat_grid;
+
+struct material{
+    float ambient_intensity;
+    vec3  diffuse_clr;
+    vec3  specular_clr;
+};
+
+uniform material materials[MAX_MATERIALS];
+uniform bool skip_lighting = false;
+
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
+
+/* Returns the color of the topmost decal covering the fragment, or 'color' 
+ * if there is none. Only the surfaces facing up get the decals. */
+vec3 decals_apply(vec3 world_pos, vec3 normal, vec3 color)
+{
+    vec2 xz = world_pos.xz;
+    if(decal_count.x == 0 || normal.y < DECAL_MIN_NORMAL)
+        return color;
+    if(any(lessThan(xz, decal_bounds.xy)) || any(greaterThan(xz, decal_bounds.zw)))
+        return color;
+
+    for(int i = 0; i < decal_count.x; i++) {
+
+        vec4 shape = decal_shapes[i];
+        float width = decal_colors[i].a;
+        bool covered;
+
+        if(decal_kinds[i / 4][i % 4] == DECAL_RING) {
+
+            float dist = length(xz - shape.xy);
+            covered = (dist <= shape.z) && (dist >= shape.z - width);
+        }else{
+
+            vec2 local = xz - shape.xy + shape.zw;
+            vec2 tile_dims = vec2(X_COORDS_PER_TILE, Z_COORDS_PER_TILE);
+            vec2 in_tile = mod(local, tile_dims);
+            covered = all(greaterThanEqual(local, vec2(0.0)))
+                   && all(lessThanEqual(local, shape.zw * 2.0))
+                   && (any(lessThan(in_tile, vec2(width))) 
+                   ||  any(greaterThan(in_tile, tile_dims - width)));
+        }
+
+        if(covered)
+            color = decal_colors[i].rgb;
+    }
+    return color;
+}
+
+vec3 point_lights_diffuse(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
+{
+    if(cluster_dims.w == 0)
+        return vec3(0.0);
+
+    vec4 view_space = view * vec4(world_pos, 1.0);
+    vec4 clip = projection * view_space;
+    vec2 ndc = clip.xy / clip.w;
+
+    ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(cluster_dims.xy)), ivec2(0), cluster_dims.xy - 1);
+    float depth = max(-view_space.z, cluster_depth.x);
+    int slice = clamp(int(log(depth / cluster_depth.x) * cluster_depth.y * float(cluster_dims.z)), 
+        0, cluster_dims.z - 1);
+
+    int cell_idx = (slice * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+    uint cell = cluster_cells[cell_idx / 4][cell_idx % 4];
+    int offset = int(cell & 0xffffu);
+    int count = int(cell >> 16u);
+
+    vec3 ret = vec3(0.0);
+    for(int i = 0; i < count; i++) {
+
+        int slot = offset + i;
+        uint word = cluster_indices[slot / 16][(slot / 4) % 4];
+        int light = int((word >> uint((slot % 4) * 8)) & 0xffu);
+
+        vec3 to_light = light_pos_radius[light].xyz - world_pos;
+        float dist = length(to_light);
+        float atten = clamp(1.0 - dist / light_pos_radius[light].w, 0.0, 1.0);
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += light_colors[light].rgb * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
+}
+
+vec4 texture_val(int mat_idx, vec2 uv)
+{
+    return texture(texture_array, vec3(uv, mat_idx));
+}
+
+void main()
+{
+    vec4 tex_color;
+    material frag_material;
+
+    switch(from_vertex.blend_mode) {
+    case BLEND_MODE_NOBLEND: 
+        tex_color = texture_val(from_vertex.mat_idx, from_vertex.uv);     
+        frag_material = materials[from_vertex.mat_idx];
+        break;
+    case BLEND_MODE_BLUR:
+
+        /* 
+         * Instead of sampling the textures of all the materials around the 
+         * tile, the weights of the chunk's 4 dominant materials are looked up 
+         * in its' splat layer, which was built when the terrain was loaded. 
+         * Only the materials with a non-zero weight are sampled.
+         *
+         * The map grows towards -X and +Z from its' corner.
+         */
+        vec2 map_pos = vec2(splat_origin.x - from_vertex.world_pos.x, from_vertex.world_pos.z - splat_origin.y);
+        ivec2 chunk = clamp(ivec2(floor(map_pos / vec2(CHUNK_WIDTH, CHUNK_HEIGHT))), ivec2(0), splat_grid - 1);
+        int layer = chunk.y * splat_grid.x + chunk.x;
+
+        vec2 splat_uv = map_pos / vec2(CHUNK_WIDTH, CHUNK_HEIGHT) - vec2(chunk);
+        vec4 weights = texture(splat_weights, vec3(splat_uv, layer));
+        weights /= max(dot(weights, vec4(1.0)), 0.001);
+        uvec4 mats = texelFetch(splat_mats, ivec2(layer, 0), 0);
+
+        tex_color = vec4(0.0);
+        frag_material = material(0.0, vec3(0.0), vec3(0.0));
+
+        for(int i = 0; i < 4; i++) {
+
+            if(weights[i] == 0.0)
+                continue;
+
+            int idx = int(mats[i]);
+            tex_color += texture_val(idx, from_vertex.uv) * weights[i];
+            frag_material.ambient_intensity += materials[idx].ambient_intensity * weights[i];
+            frag_material.diffuse_clr += materials[idx].diffuse_clr * weights[i];
+            frag_material.specular_clr += materials[idx].specular_clr * weights[i];
+        }
+        break;
+    default:
+        tex_color = vec4(1.0, 0.0, 1.0, 1.0);
+        return;
+    }
+
+    /* Simple alpha test to reject transparent pixels */
+    if(tex_color.a == 0.0)
+        discard;
+
+    if(skip_lighting) {
+        o_frag_color = vec4(tex_color.xyz, 1.0);
+        return;
+    }
+
+    /* We increase the amount of ambient light that taller tiles get, in order to make
+     * them not blend with lower terrain. */
+    float height = from_vertex.world_pos.y / Y_COORDS_PER_TILE;
+
+    /* Ambient calculations */
+    vec3 ambient = (frag_material.ambient_intensity + height * EXTRA_AMBIENT_PER_LEVEL) * ambient_color;
+
+    /* Diffuse calculations */
+    vec3 light_dir = normalize(light_pos - from_vertex.world_pos);  
+    float diff = max(dot(from_vertex.normal, light_dir), 0.0);
+    vec3 diffuse = light_color * (diff * frag_material.diffuse_clr);
+    diffuse += point_lights_diffuse(from_vertex.world_pos, from_vertex.normal, frag_material.diffuse_clr);
+
+    vec3 lit = (ambient + diffuse) * tex_color.xyz;
+    o_frag_color = vec4(decals_apply(from_vertex.world_pos, from_vertex.normal, lit), 1.0);
+}
@@ -70,10 +70,54 @@ layout(location = 0) out vec4 o_frag_color;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform vec3 ambient_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* Must match the definitions in render_gl_lights.c */
+#define MAX_POINT_LIGHTS 64
+#define CLUSTER_CELLS    1728
+#define CLUSTER_INDICES  6144
+
+/* Each cell holds the offset of its' lights in 'cluster_indices' in the low 
+ * 16 bits and their count in the high 16 bits. The indices are 8 bits each, 
+ * packed 16 to a uvec4. */
+layout (std140) uniform point_lights
+{
+    vec4  light_pos_radius[MAX_POINT_LIGHTS];
+    vec4  light_colors[MAX_POINT_LIGHTS];
+    ivec4 cluster_dims;  /* x, y, z, number of lights */
+    vec4  cluster_depth; /* near, 1 / log(far / near) */
+    uvec4 cluster_cells[CLUSTER_CELLS / 4];
+    uvec4 cluster_indices[CLUSTER_INDICES / 16];
+};
+
+/* Must match the definitions in render_gl_decals.c and tile.h */
+#define MAX_DECALS        256
+#define DECAL_RING        0
+#define DECAL_TILES       1
+#define DECAL_MIN_NORMAL  0.5
+#define X_COORDS_PER_TILE 8
+#define Z_COORDS_PER_TILE 8
+
+/* The shapes are in world XZ: the center, followed by the outer radius of 
+ * a ring or the half extents of a rect of tiles. The alpha of the color is 
+ * the width of the band drawn inside the edges. The kinds are packed 4 to 
+ * an ivec4. */
+layout (std140) uniform decals
+{
+    ivec4 decal_count;  /* x: number of decals */
+    vec4  decal_bounds; /* min x, min z, max x, max z */
+    vec4  decal_shapes[MAX_DECALS];
+    vec4  decal_colors[MAX_DECALS];
+    ivec4 decal_kinds[MAX_DECALS / 4];
+};
 
 uniform sampler2D texture0;
 uniform sampler2D texture1;
@@ -105,6 +149,78 @@ uniform bool skip_lighting = false;
 /* PROGRAM                                                                   */
 /*****************************************************************************/
 
+/* Returns the color of the topmost decal covering the fragment, or 'color' 
+ * if there is none. Only the surfaces facing up get the decals. */
+vec3 decals_apply(vec3 world_pos, vec3 normal, vec3 color)
+{
+    vec2 xz = world_pos.xz;
+    if(decal_count.x == 0 || normal.y < DECAL_MIN_NORMAL)
+        return color;
+    if(any(lessThan(xz, decal_bounds.xy)) || any(greaterThan(xz, decal_bounds.zw)))
+        return color;
+
+    for(int i = 0; i < decal_count.x; i++) {
+
+        vec4 shape = decal_shapes[i];
+        float width = decal_colors[i].a;
+        bool covered;
+
+        if(decal_kinds[i / 4][i % 4] == DECAL_RING) {
+
+            float dist = length(xz - shape.xy);
+            covered = (dist <= shape.z) && (dist >= shape.z - width);
+        }else{
+
+            vec2 local = xz - shape.xy + shape.zw;
+            vec2 tile_dims = vec2(X_COORDS_PER_TILE, Z_COORDS_PER_TILE);
+            vec2 in_tile = mod(local, tile_dims);
+            covered = all(greaterThanEqual(local, vec2(0.0)))
+                   && all(lessThanEqual(local, shape.zw * 2.0))
+                   && (any(lessThan(in_tile, vec2(width))) 
+                   ||  any(greaterThan(in_tile, tile_dims - width)));
+        }
+
+        if(covered)
+            color = decal_colors[i].rgb;
+    }
+    return color;
+}
+
+vec3 point_lights_diffuse(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
+{
+    if(cluster_dims.w == 0)
+        return vec3(0.0);
+
+    vec4 view_space = view * vec4(world_pos, 1.0);
+    vec4 clip = projection * view_space;
+    vec2 ndc = clip.xy / clip.w;
+
+    ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(cluster_dims.xy)), ivec2(0), cluster_dims.xy - 1);
+    float depth = max(-view_space.z, cluster_depth.x);
+    int slice = clamp(int(log(depth / cluster_depth.x) * cluster_depth.y * float(cluster_dims.z)), 
+        0, cluster_dims.z - 1);
+
+    int cell_idx = (slice * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+    uint cell = cluster_cells[cell_idx / 4][cell_idx % 4];
+    int offset = int(cell & 0xffffu);
+    int count = int(cell >> 16u);
+
+    vec3 ret = vec3(0.0);
+    for(int i = 0; i < count; i++) {
+
+        int slot = offset + i;
+        uint word = cluster_indices[slot / 16][(slot / 4) % 4];
+        int light = int((word >> uint((slot % 4) * 8)) & 0xffu);
+
+        vec3 to_light = light_pos_radius[light].xyz - world_pos;
+        float dist = length(to_light);
+        float atten = clamp(1.0 - dist / light_pos_radius[light].w, 0.0, 1.0);
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += light_colors[light].rgb * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
+}
+
 vec4 texture_val(int mat_idx, vec2 uv)
 {
     switch(mat_idx) {
@@ -364,6 +480,7 @@ void main()
     vec3 light_dir = normalize(light_pos - from_vertex.world_pos);  
     float diff = max(dot(from_vertex.normal, light_dir), 0.0);
     vec3 diffuse = light_color * (diff * frag_material.diffuse_clr);
+    diffuse += point_lights_diffuse(from_vertex.world_pos, from_vertex.normal, frag_material.diffuse_clr);
 
     /* Since, for optimization reasons, we currently render the terrain top surface to a texture 
      * with the lighting calculations already included, we skip the specular lighting, as it is 
@@ -377,6 +494,7 @@ void main()
     vec3 specular = SPECULAR_STRENGTH * light_color * (spec * frag_material.specular_clr);
     #endif
 
-    o_frag_color = vec4( (ambient + diffuse) * tex_color.xyz, 1.0);
+    vec3 lit = (ambient + diffuse) * tex_color.xyz;
+    o_frag_color = vec4(decals_apply(from_vertex.world_pos, from_vertex.normal, lit), 1.0);
 }
 
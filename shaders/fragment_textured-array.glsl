@@ -35,15 +35,6 @@
 
 #version 330 core
 
-#define BORDER_PERCENT_WIDTH (0.05)
-#define EPSILON              (1.0 / 1000000.0) 
-
-/*****************************************************************************/
-/* OUTPUTS                                                                   */
-/*****************************************************************************/
-
-out vec4 o_frag_color;
-
 /*****************************************************************************/
 /* INPUTS                                                                    */
 /*****************************************************************************/
@@ -56,35 +47,59 @@ in VertexToFrag {
 }from_vertex;
 
 /*****************************************************************************/
-/* UNIFORMS                                                                  */
+/* OUTPUTS                                                                   */
 /*****************************************************************************/
 
-uniform vec3 color;
+out vec4 o_frag_color;
 
 /*****************************************************************************/
-/* PROGRAM                                                                   */
+/* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-bool inside_border()
+uniform sampler2DArray texture0;
+uniform sampler2DArray texture1;
+uniform sampler2DArray texture2;
+uniform sampler2DArray texture3;
+
+/* Must match the definition in shader.h */
+#define MAX_TABLE_MATERIALS 512
+
+struct material{
+    vec3  diffuse_clr;
+    float ambient_intensity;
+    vec3  specular_clr;
+    int   tex;
+};
+
+layout (std140) uniform material_table
 {
-    if(from_vertex.uv.x < BORDER_PERCENT_WIDTH || from_vertex.uv.x > 1.0 - BORDER_PERCENT_WIDTH)
-        return true;
+    material materials[MAX_TABLE_MATERIALS];
+};
 
-    /* Dont' draw top and bottom edges for side faces */
-    if(abs(from_vertex.normal.y) < EPSILON)
-        return false;
+uniform int material_base;
 
-    if(from_vertex.uv.y < BORDER_PERCENT_WIDTH || from_vertex.uv.y > 1.0 - BORDER_PERCENT_WIDTH)
-        return true;
- 
-    return false;
-}
+/*****************************************************************************/
+/* PROGRAM                                                                   */
+/*****************************************************************************/
 
 void main()
 {
-    if(!inside_border())
+    int tex = materials[material_base + from_vertex.mat_idx].tex;
+    vec3 uvw = vec3(from_vertex.uv, float(tex & 0xffff));
+    vec4 tex_color;
+
+    switch(tex >> 16) {
+    case 0:  tex_color = texture(texture0, uvw); break;
+    case 1:  tex_color = texture(texture1, uvw); break;
+    case 2:  tex_color = texture(texture2, uvw); break;
+    case 3:  tex_color = texture(texture3, uvw); break;
+    default: tex_color = vec4(1.0);              break;
+    }
+
+    /* Simple alpha test to reject transparent pixels */
+    if(tex_color.a== 0.0)
         discard;
 
-    o_frag_color = vec4(color, 1.0);
+    o_frag_color = vec4(tex_color.xyz, 1.0);
 }
 
@@ -35,8 +35,6 @@
 
 #version 330 core
 
-#define MAX_MATERIALS 8
-
 /* TODO: Make these as material parameters */
 #define SPECULAR_STRENGTH  0.5
 #define SPECULAR_SHININESS 2
@@ -62,61 +60,111 @@ out vec4 o_frag_color;
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
-uniform vec3 ambient_color;
-uniform vec3 light_color;
-uniform vec3 light_pos;
-uniform vec3 view_pos;
-
-uniform sampler2D texture0;
-uniform sampler2D texture1;
-uniform sampler2D texture2;
-uniform sampler2D texture3;
-uniform sampler2D texture4;
-uniform sampler2D texture5;
-uniform sampler2D texture6;
-uniform sampler2D texture7;
-uniform sampler2D texture8;
-uniform sampler2D texture9;
-uniform sampler2D texture10;
-uniform sampler2D texture11;
-uniform sampler2D texture12;
-uniform sampler2D texture13;
-uniform sampler2D texture14;
-uniform sampler2D texture15;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* Must match the definitions in render_gl_lights.c */
+#define MAX_POINT_LIGHTS 64
+#define CLUSTER_CELLS    1728
+#define CLUSTER_INDICES  6144
+
+/* Each cell holds the offset of its' lights in 'cluster_indices' in the low 
+ * 16 bits and their count in the high 16 bits. The indices are 8 bits each, 
+ * packed 16 to a uvec4. */
+layout (std140) uniform point_lights
+{
+    vec4  light_pos_radius[MAX_POINT_LIGHTS];
+    vec4  light_colors[MAX_POINT_LIGHTS];
+    ivec4 cluster_dims;  /* x, y, z, number of lights */
+    vec4  cluster_depth; /* near, 1 / log(far / near) */
+    uvec4 cluster_cells[CLUSTER_CELLS / 4];
+    uvec4 cluster_indices[CLUSTER_INDICES / 16];
+};
+
+/* The arrays holding the textures of the object's materials */
+uniform sampler2DArray texture0;
+uniform sampler2DArray texture1;
+uniform sampler2DArray texture2;
+uniform sampler2DArray texture3;
+
+/* Must match the definition in shader.h */
+#define MAX_TABLE_MATERIALS 512
 
+/* The tex member holds the unit of the array that the texture is in,
+ * in the high 16 bits, and its' layer in the low ones, or -1 for none */
 struct material{
-    float ambient_intensity;
     vec3  diffuse_clr;
+    float ambient_intensity;
     vec3  specular_clr;
+    int   tex;
+};
+
+layout (std140) uniform material_table
+{
+    material materials[MAX_TABLE_MATERIALS];
 };
 
-uniform material materials[MAX_MATERIALS];
+/* The index of the object's first material in the table */
+uniform int material_base;
 
 /*****************************************************************************/
 /* PROGRAM                                                                   */
 /*****************************************************************************/
 
+vec3 point_lights_diffuse(vec3 world_pos, vec3 normal, vec3 diffuse_clr)
+{
+    if(cluster_dims.w == 0)
+        return vec3(0.0);
+
+    vec4 view_space = view * vec4(world_pos, 1.0);
+    vec4 clip = projection * view_space;
+    vec2 ndc = clip.xy / clip.w;
+
+    ivec2 tile = clamp(ivec2((ndc * 0.5 + 0.5) * vec2(cluster_dims.xy)), ivec2(0), cluster_dims.xy - 1);
+    float depth = max(-view_space.z, cluster_depth.x);
+    int slice = clamp(int(log(depth / cluster_depth.x) * cluster_depth.y * float(cluster_dims.z)), 
+        0, cluster_dims.z - 1);
+
+    int cell_idx = (slice * cluster_dims.y + tile.y) * cluster_dims.x + tile.x;
+    uint cell = cluster_cells[cell_idx / 4][cell_idx % 4];
+    int offset = int(cell & 0xffffu);
+    int count = int(cell >> 16u);
+
+    vec3 ret = vec3(0.0);
+    for(int i = 0; i < count; i++) {
+
+        int slot = offset + i;
+        uint word = cluster_indices[slot / 16][(slot / 4) % 4];
+        int light = int((word >> uint((slot % 4) * 8)) & 0xffu);
+
+        vec3 to_light = light_pos_radius[light].xyz - world_pos;
+        float dist = length(to_light);
+        float atten = clamp(1.0 - dist / light_pos_radius[light].w, 0.0, 1.0);
+        float diff = max(dot(normal, to_light / max(dist, 0.0001)), 0.0);
+        ret += light_colors[light].rgb * (diff * atten * atten);
+    }
+    return ret * diffuse_clr;
+}
+
 void main()
 {
+    material mat = materials[material_base + from_vertex.mat_idx];
+    vec3 uvw = vec3(from_vertex.uv, float(mat.tex & 0xffff));
     vec4 tex_color;
 
-    switch(from_vertex.mat_idx) {
-    case 0:  tex_color = texture(texture0,  from_vertex.uv); break;
-    case 1:  tex_color = texture(texture1,  from_vertex.uv); break;
-    case 2:  tex_color = texture(texture2,  from_vertex.uv); break;
-    case 3:  tex_color = texture(texture3,  from_vertex.uv); break;
-    case 4:  tex_color = texture(texture4,  from_vertex.uv); break;
-    case 5:  tex_color = texture(texture5,  from_vertex.uv); break;
-    case 6:  tex_color = texture(texture6,  from_vertex.uv); break;
-    case 7:  tex_color = texture(texture7,  from_vertex.uv); break;
-    case 8:  tex_color = texture(texture8,  from_vertex.uv); break;
-    case 9:  tex_color = texture(texture9,  from_vertex.uv); break;
-    case 10: tex_color = texture(texture10, from_vertex.uv); break;
-    case 11: tex_color = texture(texture11, from_vertex.uv); break;
-    case 12: tex_color = texture(texture12, from_vertex.uv); break;
-    case 13: tex_color = texture(texture13, from_vertex.uv); break;
-    case 14: tex_color = texture(texture14, from_vertex.uv); break;
-    case 15: tex_color = texture(texture15, from_vertex.uv); break;
+    switch(mat.tex >> 16) {
+    case 0:  tex_color = texture(texture0, uvw); break;
+    case 1:  tex_color = texture(texture1, uvw); break;
+    case 2:  tex_color = texture(texture2, uvw); break;
+    case 3:  tex_color = texture(texture3, uvw); break;
+    default: tex_color = vec4(1.0);              break;
     }
 
     /* Simple alpha test to reject transparent pixels */
@@ -124,18 +172,20 @@ void main()
         discard;
 
     /* Ambient calculations */
-    vec3 ambient = materials[from_vertex.mat_idx].ambient_intensity * ambient_color;
+    vec3 ambient = mat.ambient_intensity * ambient_color;
 
     /* Diffuse calculations */
     vec3 light_dir = normalize(light_pos - from_vertex.world_pos);  
     float diff = max(dot(from_vertex.normal, light_dir), 0.0);
-    vec3 diffuse = light_color * (diff * materials[from_vertex.mat_idx].diffuse_clr);
+    vec3 diffuse = light_color * (diff * mat.diffuse_clr);
+    diffuse += point_lights_diffuse(from_vertex.world_pos, from_vertex.normal, 
+        mat.diffuse_clr);
 
     /* Specular calculations */
     vec3 view_dir = normalize(view_pos - from_vertex.world_pos);
     vec3 reflect_dir = reflect(-light_dir, from_vertex.normal);  
     float spec = pow(max(dot(view_dir, reflect_dir), 0.0), SPECULAR_SHININESS);
-    vec3 specular = SPECULAR_STRENGTH * light_color * (spec * materials[from_vertex.mat_idx].specular_clr);  
+    vec3 specular = SPECULAR_STRENGTH * light_color * (spec * mat.specular_clr);  
 
     o_frag_color = vec4( (ambient + diffuse + specular) * tex_color.xyz, 1.0);
 }
@@ -0,0 +1,126 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+/* Draws a particle, one instance per particle. The particle only holds its
+ * state at the time it was emitted and its current position is worked out 
+ * from its age. The quad is made up from the vertex index. */
+
+#define STYLE_ARROW 0
+#define STYLE_SPARK 1
+
+/* Per-instance attributes */
+layout (location = 0) in vec4 in_pos_lifetime;
+layout (location = 1) in vec4 in_velocity_gravity;
+layout (location = 2) in vec4 in_color;
+layout (location = 3) in vec3 in_size_spawn;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out VertexToFrag {
+         vec2  uv;
+    flat vec4  color;
+}to_fragment;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+uniform float curr_time;
+uniform int effect_style;
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+void main()
+{
+    const vec2 corners[6] = vec2[6](
+        vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+        vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+    );
+    vec2 corner = corners[gl_VertexID];
+
+    float lifetime = in_pos_lifetime.w;
+    float age = curr_time - in_size_spawn.z;
+
+    /* Dead (and never emitted) particles are moved outside the clip volume */
+    if(lifetime <= 0.0 || age < 0.0 || age >= lifetime) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+    float t = age / lifetime;
+
+    vec3 pos = in_pos_lifetime.xyz + in_velocity_gravity.xyz * age;
+    pos.y -= 0.5 * in_velocity_gravity.w * age * age;
+    float size = mix(in_size_spawn.x, in_size_spawn.y, t);
+    vec2 offset = (corner - vec2(0.5)) * size;
+
+    if(effect_style == STYLE_ARROW) {
+
+        /* Lies flat on the ground with the tip (top of the quad) pointing 
+         * where the particle is heading */
+        vec2 dir = in_velocity_gravity.xz;
+        dir = (length(dir) > 0.0) ? normalize(dir) : vec2(0.0, 1.0);
+        vec2 side = vec2(dir.y, -dir.x);
+        pos.xz += dir * offset.y + side * offset.x;
+
+    }else {
+
+        /* Faces the camera */
+        vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+        vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+        pos += right * offset.x + up * offset.y;
+    }
+
+    to_fragment.uv = corner;
+    to_fragment.color = vec4(in_color.rgb, in_color.a * (1.0 - t));
+
+    gl_Position = projection * view * vec4(pos, 1.0);
+}
+
@@ -0,0 +1,105 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+/* Must match the number of views baked in render_gl_lod.c */
+#define NUM_VIEWS 8
+#define PI 3.14159265359
+
+/* The vertices of the quad all sit on the vertical axis of the mesh. 'in_uv.x'
+ * holds the signed distance to expand the vertex out by, sideways to the 
+ * camera, and 'in_uv.y' its' height in the atlas. */
+layout (location = 0) in vec3 in_pos;
+layout (location = 1) in vec2 in_uv;
+layout (location = 2) in vec3 in_normal;
+layout (location = 3) in int  in_material_idx;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out VertexToFrag {
+         vec2 uv;
+    flat int  mat_idx;
+         vec3 world_pos;
+         vec3 normal;
+}to_fragment;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+uniform mat4 model;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+void main()
+{
+    vec3 center = (model * vec4(in_pos, 1.0)).xyz;
+
+    /* The quad only turns about the vertical axis */
+    vec3 to_eye = view_pos - center;
+    to_eye.y = 0.0;
+    to_eye = length(to_eye) > 0.0 ? normalize(to_eye) : vec3(0.0, 0.0, 1.0);
+    vec3 right = vec3(-to_eye.z, 0.0, to_eye.x);
+
+    vec3 world_pos = center + right * (in_uv.x * length(model[0].xyz));
+
+    /* Pick the baked view closest to the direction of the camera, in the 
+     * mesh's own space */
+    vec3 local_eye = transpose(mat3(model)) * to_eye;
+    float angle = atan(local_eye.x, local_eye.z);
+    float view_idx = mod(floor(angle * NUM_VIEWS / (2.0 * PI) + 0.5), NUM_VIEWS);
+
+    to_fragment.uv = vec2((view_idx + step(0.0, in_uv.x)) / NUM_VIEWS, in_uv.y);
+    to_fragment.mat_idx = 0;
+    to_fragment.world_pos = world_pos;
+    to_fragment.normal = to_eye;
+
+    gl_Position = projection * view * vec4(world_pos, 1.0);
+}
+
@@ -0,0 +1,98 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+/* Draws a screen-aligned bar over a point in the world, one instance per bar.
+ * The quad is made up from the vertex index. */
+
+/* Per-instance attributes */
+layout (location = 0) in vec4 in_anchor;
+layout (location = 1) in vec4 in_fg_color;
+layout (location = 2) in vec4 in_bg_color;
+layout (location = 3) in vec2 in_size;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out VertexToFrag {
+         vec2  uv;
+    flat float fill;
+    flat vec4  fg_color;
+    flat vec4  bg_color;
+}to_fragment;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+uniform vec2 viewport_size;
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+void main()
+{
+    const vec2 corners[6] = vec2[6](
+        vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+        vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0)
+    );
+    vec2 corner = corners[gl_VertexID];
+
+    /* The bar sits centered above the anchor and is sized in pixels */
+    vec4 clip = projection * view * vec4(in_anchor.xyz, 1.0);
+    vec2 offset = (corner - vec2(0.5, 0.0)) * in_size;
+    clip.xy += offset * 2.0 / viewport_size * clip.w;
+
+    to_fragment.uv = corner;
+    to_fragment.fill = in_anchor.w;
+    to_fragment.fg_color = in_fg_color;
+    to_fragment.bg_color = in_bg_color;
+
+    gl_Position = clip;
+}
+
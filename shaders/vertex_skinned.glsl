@@ -35,8 +35,6 @@
 
 #version 330 core
 
-#define MAX_JOINTS 96
-
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec2 in_uv;
 layout (location = 2) in vec3 in_normal;
@@ -48,6 +46,17 @@ layout (location = 6) in mat2x3 in_joint_weights; /* 2x3 mat to alias array of 6
 /* OUTPUTS                                                                   */
 /*****************************************************************************/
 
+#ifdef PRESKIN
+
+/* Captured by transform feedback, interleaved in this order, as the object
+ * space vertices of the pose. They are drawn with the static programs. */
+     out vec3 out_pos;
+     out vec2 out_uv;
+     out vec3 out_normal;
+flat out int  out_material_idx;
+
+#else
+
 out VertexToFrag {
          vec2 uv;
     flat int  mat_idx;
@@ -59,73 +68,129 @@ out VertexToGeo {
     vec3 normal;
 }to_geometry;
 
+#endif
+
 /*****************************************************************************/
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-
-uniform mat4 anim_curr_pose_mats[MAX_JOINTS];
-uniform mat4 anim_inv_bind_mats [MAX_JOINTS];
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* The skinning matrices (pose * inverse bind pose) of all animated entities 
+ * drawn this frame, one matrix column per texel. This entity's pose is a blend
+ * of the samples whose joints start at 'anim_palette_bases'. */
+uniform samplerBuffer anim_palette;
+uniform ivec2 anim_palette_bases;
+uniform float anim_palette_blend;
+/* The skinning matrices of the clips baked for the whole session, which the
+ * bases point into instead when 'anim_palette_baked' is set */
+uniform samplerBuffer anim_baked;
+uniform bool anim_palette_baked;
 
 /*****************************************************************************/
 /* PROGRAM
 /*****************************************************************************/
 
-void main()
+vec4 palette_texel(int idx)
 {
-    to_fragment.uv = in_uv;
-    to_fragment.mat_idx = in_material_idx;
-    to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
+    return anim_palette_baked ? texelFetch(anim_baked, idx) 
+                              : texelFetch(anim_palette, idx);
+}
 
-    /* TODO: compute normal matrix on CPU once per model each frame and pass as uniform 
-     */
-    mat3 normal_matrix_geo = mat3(transpose(inverse(view * model)));
-    mat3 normal_matrix = mat3(transpose(inverse(model)));
+mat4 skin_mat(int joint_idx)
+{
+    ivec2 base = (anim_palette_bases + joint_idx) * 4;
+    mat4 ret;
+    for(int i = 0; i < 4; i++) {
+        ret[i] = mix(palette_texel(base.x + i), palette_texel(base.y + i), anim_palette_blend);
+    }
+    return ret;
+}
+
+/* The vertex's position and normal in the pose, in object space */
+void skin_vertex(float tot_weight, out vec3 pos, out vec3 normal)
+{
+    pos = vec3(0.0, 0.0, 0.0);
+    normal = vec3(0.0, 0.0, 0.0);
+
+    for(int w_idx = 0; w_idx < 6; w_idx++) {
+
+        int r = w_idx / 3;
+        int c = w_idx % 3;
+
+        int joint_idx = int(in_joint_indices[r][c]);
+
+        mat4 skin = skin_mat(joint_idx);
 
+        float fraction = in_joint_weights[r][c] / tot_weight;
+
+        mat4 bone_mat = fraction * skin;
+        /* Should calculate the rot mat on the CPU as well... */
+        mat3 rot_mat = fraction * mat3(transpose(inverse(skin)));
+        
+        pos += (bone_mat * vec4(in_pos, 1.0)).xyz;
+        normal += rot_mat * in_normal;
+    }
+}
+
+void main()
+{
     float tot_weight = in_joint_weights[0][0] + in_joint_weights[0][1] + in_joint_weights[0][2]
                      + in_joint_weights[1][0] + in_joint_weights[1][1] + in_joint_weights[1][2];
 
     /* If all weights are 0, treat this vertex as a static one.
      * Non-animated vertices will have their weights explicitly zeroed out. 
      */
-    if(tot_weight == 0.0) {
+    bool rest = (tot_weight == 0.0 || anim_palette_bases.x < 0);
 
-        to_geometry.normal = normalize(vec3(projection * vec4(normal_matrix_geo * in_normal, 1.0)));
-        to_fragment.normal = normalize(normal_matrix * in_normal);
-        gl_Position = projection * view * model * vec4(in_pos, 1.0);
+#ifdef PRESKIN
 
+    out_uv = in_uv;
+    out_material_idx = in_material_idx;
+
+    if(rest) {
+        out_pos = in_pos;
+        out_normal = in_normal;
     }else {
+        skin_vertex(tot_weight, out_pos, out_normal);
+    }
 
-        vec3 new_pos =  vec3(0.0, 0.0, 0.0);
-        vec3 new_normal = vec3(0.0, 0.0, 0.0);
+#else
 
-        for(int w_idx = 0; w_idx < 6; w_idx++) {
+    to_fragment.uv = in_uv;
+    to_fragment.mat_idx = in_material_idx;
+    to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
 
-            int r = w_idx / 3;
-            int c = w_idx % 3;
+    /* TODO: compute normal matrix on CPU once per model each frame and pass as uniform 
+     */
+    mat3 normal_matrix_geo = mat3(transpose(inverse(view * model)));
+    mat3 normal_matrix = mat3(transpose(inverse(model)));
 
-            int joint_idx = int(in_joint_indices[r][c]);
+    if(rest) {
 
-            mat4 inv_bind_mat = anim_inv_bind_mats [joint_idx];
-            mat4 pose_mat     = anim_curr_pose_mats[joint_idx];
+        to_geometry.normal = normalize(vec3(projection * vec4(normal_matrix_geo * in_normal, 1.0)));
+        to_fragment.normal = normalize(normal_matrix * in_normal);
+        gl_Position = projection * view * model * vec4(in_pos, 1.0);
 
-            float fraction = in_joint_weights[r][c] / tot_weight;
+    }else {
 
-            mat4 bone_mat = fraction * pose_mat * inv_bind_mat;
-            /* Should calculate the rot mat on the CPU as well... */
-            mat3 rot_mat = fraction * mat3(transpose(inverse(pose_mat * inv_bind_mat)));
-            
-            new_pos += (bone_mat * vec4(in_pos, 1.0)).xyz;
-            new_normal += rot_mat * in_normal;
-        }
+        vec3 new_pos, new_normal;
+        skin_vertex(tot_weight, new_pos, new_normal);
 
         to_geometry.normal = normalize(normal_matrix_geo * new_normal);
         to_fragment.normal = normalize(normal_matrix * new_normal);
         gl_Position = projection * view * model * vec4(new_pos, 1.0f);
 
     }
-}
 
+#endif
+}
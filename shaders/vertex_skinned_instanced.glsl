@@ -0,0 +1,163 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2017-2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+layout (location = 0) in vec3 in_pos;
+layout (location = 1) in vec2 in_uv;
+layout (location = 2) in vec3 in_normal;
+layout (location = 3) in int  in_material_idx;
+layout (location = 4) in mat2x3 in_joint_indices; /* 2x3 mat to alias array of 6 floats */
+layout (location = 6) in mat2x3 in_joint_weights; /* 2x3 mat to alias array of 6 floats */
+
+/* Per-instance attributes - the model matrix occupies locations 8 through 11 */
+layout (location = 8)  in mat4 in_model;
+layout (location = 12) in ivec2 in_palette_bases;
+layout (location = 13) in float in_palette_blend;
+layout (location = 14) in int   in_palette_baked;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out VertexToFrag {
+         vec2 uv;
+    flat int  mat_idx;
+         vec3 world_pos;
+         vec3 normal;
+}to_fragment;
+
+out VertexToGeo {
+    vec3 normal;
+}to_geometry;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/* The skinning matrices (pose * inverse bind pose) of all animated entities 
+ * drawn this frame, one matrix column per texel. This entity's pose is a blend
+ * of the samples whose joints start at 'in_palette_bases'. */
+uniform samplerBuffer anim_palette;
+/* The skinning matrices of the clips baked for the whole session, which the
+ * bases point into instead when 'in_palette_baked' is set */
+uniform samplerBuffer anim_baked;
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+vec4 palette_texel(int idx)
+{
+    return (in_palette_baked != 0) ? texelFetch(anim_baked, idx) 
+                                   : texelFetch(anim_palette, idx);
+}
+
+mat4 skin_mat(int joint_idx)
+{
+    ivec2 base = (in_palette_bases + joint_idx) * 4;
+    mat4 ret;
+    for(int i = 0; i < 4; i++) {
+        ret[i] = mix(palette_texel(base.x + i), palette_texel(base.y + i), in_palette_blend);
+    }
+    return ret;
+}
+
+void main()
+{
+    mat4 model = in_model;
+
+    to_fragment.uv = in_uv;
+    to_fragment.mat_idx = in_material_idx;
+    to_fragment.world_pos = (model * vec4(in_pos, 1.0)).xyz;
+
+    /* TODO: compute normal matrix on CPU once per model each frame and pass as uniform 
+     */
+    mat3 normal_matrix_geo = mat3(transpose(inverse(view * model)));
+    mat3 normal_matrix = mat3(transpose(inverse(model)));
+
+    float tot_weight = in_joint_weights[0][0] + in_joint_weights[0][1] + in_joint_weights[0][2]
+                     + in_joint_weights[1][0] + in_joint_weights[1][1] + in_joint_weights[1][2];
+
+    /* If all weights are 0, treat this vertex as a static one.
+     * Non-animated vertices will have their weights explicitly zeroed out. 
+     */
+    if(tot_weight == 0.0 || in_palette_bases.x < 0) {
+
+        to_geometry.normal = normalize(vec3(projection * vec4(normal_matrix_geo * in_normal, 1.0)));
+        to_fragment.normal = normalize(normal_matrix * in_normal);
+        gl_Position = projection * view * model * vec4(in_pos, 1.0);
+
+    }else {
+
+        vec3 new_pos =  vec3(0.0, 0.0, 0.0);
+        vec3 new_normal = vec3(0.0, 0.0, 0.0);
+
+        for(int w_idx = 0; w_idx < 6; w_idx++) {
+
+            int r = w_idx / 3;
+            int c = w_idx % 3;
+
+            int joint_idx = int(in_joint_indices[r][c]);
+
+            mat4 skin = skin_mat(joint_idx);
+
+            float fraction = in_joint_weights[r][c] / tot_weight;
+
+            mat4 bone_mat = fraction * skin;
+            /* Should calculate the rot mat on the CPU as well... */
+            mat3 rot_mat = fraction * mat3(transpose(inverse(skin)));
+            
+            new_pos += (bone_mat * vec4(in_pos, 1.0)).xyz;
+            new_normal += rot_mat * in_normal;
+        }
+
+        to_geometry.normal = normalize(normal_matrix_geo * new_normal);
+        to_fragment.normal = normalize(normal_matrix * new_normal);
+        gl_Position = projection * view * model * vec4(new_pos, 1.0f);
+
+    }
+}
+
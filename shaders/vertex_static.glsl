@@ -60,8 +60,15 @@ out VertexToGeo {
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 /*****************************************************************************/
 /* PROGRAM
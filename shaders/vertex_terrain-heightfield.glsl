@@ -0,0 +1,264 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#version 330 core
+
+#define X_COORDS_PER_TILE       8
+#define Y_COORDS_PER_TILE       4
+#define Z_COORDS_PER_TILE       8
+#define TILES_PER_CHUNK_WIDTH   32
+#define TILES_PER_CHUNK_HEIGHT  32
+
+#define BLEND_MODE_NOBLEND      0
+#define BLEND_MODE_BLUR         1
+
+#define GRID_SIDE               (1u << 14)
+
+#define FACE_FRONT              0
+#define FACE_BACK               1
+#define FACE_LEFT               2
+#define FACE_RIGHT              3
+
+/* The corners of the tile's top face, with the center of the face last */
+#define NW                      0
+#define NE                      1
+#define SE                      2
+#define SW                      3
+#define CENTER                  4
+
+/*****************************************************************************/
+/* INPUTS                                                                    */
+/*****************************************************************************/
+
+/* The vertex of the tile within the chunk, or of a side face */
+layout (location = 0) in uint in_grid;
+/* The chunk whose top is drawn, or the side face of a tile */
+layout (location = 1) in uint in_instance;
+
+/*****************************************************************************/
+/* OUTPUTS                                                                   */
+/*****************************************************************************/
+
+out VertexToFrag {
+         vec2  uv;
+    flat int   mat_idx;
+         vec3  world_pos;
+         vec3  normal;
+    flat int   blend_mode;
+    flat ivec4 adjacent_mat_indices;
+}to_fragment;
+
+/* The depth prepass uses this same stage, and the depth of the two must 
+ * match exactly */
+invariant gl_Position;
+
+/*****************************************************************************/
+/* UNIFORMS                                                                  */
+/*****************************************************************************/
+
+/* Each tile has two texels in the layer of its' chunk:
+ *   [0].x - NW and NE heights         [1].x - south adjacent materials (west)
+ *   [0].y - SE and SW heights         [1].y - south adjacent materials (east)
+ *   [0].z - center height, middle     [1].z - north adjacent materials (west)
+ *           mask, alignment and       [1].w - north adjacent materials (east)
+ *           sides material
+ *   [0].w - center mask
+ * The heights are signed 16-bit values, in halves of a level.
+ */
+uniform usampler2DArray heightfield;
+uniform int chunks_wide;
+
+uniform mat4 model;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
+
+/*****************************************************************************/
+/* PROGRAM
+/*****************************************************************************/
+
+const int top_left_aligned[12] = int[12](SW, SE, CENTER, CENTER, NE, SE, NW, NE, CENTER, CENTER, SW, NW);
+const int top_right_aligned[12] = int[12](SW, SE, CENTER, CENTER, NW, SW, NW, NE, CENTER, CENTER, SE, NE);
+
+float height(uint packed, bool high)
+{
+    int half_levels = high ? (int(packed) >> 16) : (int(packed << 16u) >> 16);
+    return half_levels * (Y_COORDS_PER_TILE / 2.0);
+}
+
+vec3 corner(uvec4 geom, int tile_r, int tile_c, int which)
+{
+    switch(which) {
+    case NW: return vec3(-(tile_c + 0) * X_COORDS_PER_TILE, height(geom.x, false), (tile_r + 0) * Z_COORDS_PER_TILE);
+    case NE: return vec3(-(tile_c + 1) * X_COORDS_PER_TILE, height(geom.x, true),  (tile_r + 0) * Z_COORDS_PER_TILE);
+    case SE: return vec3(-(tile_c + 1) * X_COORDS_PER_TILE, height(geom.y, false), (tile_r + 1) * Z_COORDS_PER_TILE);
+    case SW: return vec3(-(tile_c + 0) * X_COORDS_PER_TILE, height(geom.y, true),  (tile_r + 1) * Z_COORDS_PER_TILE);
+    }
+    return vec3(0.0);
+}
+
+vec2 corner_uv(int which)
+{
+    switch(which) {
+    case NW: return vec2(0.0, 1.0);
+    case NE: return vec2(1.0, 1.0);
+    case SE: return vec2(1.0, 0.0);
+    case SW: return vec2(0.0, 0.0);
+    }
+    return vec2(0.5, 0.5);
+}
+
+vec3 plane_normal(vec3 a, vec3 b, vec3 c)
+{
+    vec3 ret = normalize(cross(b - a, c - a));
+    return ret.y < 0.0 ? -ret : ret;
+}
+
+bool same_indices(int mask)
+{
+    return (mask & 0xffff) == ((mask >> 16) & 0xffff)
+        && (mask & 0xff)   == ((mask >> 8) & 0xff)
+        && (mask & 0xf)    == ((mask >> 4) & 0xf);
+}
+
+void main()
+{
+    bool side = (in_grid & GRID_SIDE) != 0u;
+    int slot = int(in_grid & 0xfu);
+
+    int chunk, r, c, face = 0;
+    if(side) {
+        face  = int(in_instance & 0x3u);
+        c     = int((in_instance >> 2) & 0x1fu);
+        r     = int((in_instance >> 7) & 0x1fu);
+        chunk = int(in_instance >> 12);
+    }else{
+        c     = int((in_grid >> 4) & 0x1fu);
+        r     = int((in_grid >> 9) & 0x1fu);
+        chunk = int(in_instance);
+    }
+
+    uvec4 geom = texelFetch(heightfield, ivec3(2 * c + 0, r, chunk), 0);
+    uvec4 adj  = texelFetch(heightfield, ivec3(2 * c + 1, r, chunk), 0);
+
+    int tile_r = (chunk / chunks_wide) * TILES_PER_CHUNK_HEIGHT + r;
+    int tile_c = (chunk % chunks_wide) * TILES_PER_CHUNK_WIDTH  + c;
+
+    vec3 pos, normal;
+    vec2 uv;
+
+    if(side) {
+
+        int a, b;
+        switch(face) {
+        case FACE_FRONT: a = SW; b = SE; normal = vec3( 0.0, 0.0,  1.0); break;
+        case FACE_BACK:  a = NW; b = NE; normal = vec3( 0.0, 0.0, -1.0); break;
+        case FACE_LEFT:  a = SW; b = NW; normal = vec3( 1.0, 0.0,  0.0); break;
+        default:         a = NE; b = SE; normal = vec3(-1.0, 0.0,  0.0); break;
+        }
+
+        /* The two triangles are (A top, B top, A bottom) and (B bottom, A bottom, B top) */
+        bool is_b = (slot == 1 || slot == 3 || slot == 5);
+        bool is_top = (slot == 0 || slot == 1 || slot == 5);
+
+        pos = corner(geom, tile_r, tile_c, is_b ? b : a);
+        uv = vec2(is_b ? 1.0 : 0.0, is_top ? pos.y / X_COORDS_PER_TILE : 0.0);
+        if(!is_top)
+            pos.y = -1.0 * Y_COORDS_PER_TILE;
+
+        to_fragment.mat_idx = int(geom.z >> 28);
+        to_fragment.blend_mode = BLEND_MODE_NOBLEND;
+        to_fragment.adjacent_mat_indices = ivec4(0);
+
+    }else{
+
+        bool left_aligned = ((geom.z >> 24) & 0x1u) != 0u;
+        int middle = int((geom.z >> 16) & 0xffu);
+        int which = left_aligned ? top_left_aligned[slot] : top_right_aligned[slot];
+        bool south = slot < 6;
+
+        if(which == CENTER) {
+            /* Each 'major' triangle has its' own center vertex, moved slightly
+             * so that the triangles overlap and leave no gap between them */
+            vec3 nw = corner(geom, tile_r, tile_c, NW);
+            pos = vec3(nw.x - X_COORDS_PER_TILE / 2.0, height(geom.z, false), 
+                       nw.z + Z_COORDS_PER_TILE / 2.0 + (south ? -0.005 : 0.005));
+        }else{
+            pos = corner(geom, tile_r, tile_c, which);
+        }
+        uv = corner_uv(which);
+
+        /* All the vertices of a 'major' triangle share the normal of its' plane */
+        if(south) {
+            normal = plane_normal(corner(geom, tile_r, tile_c, SW), corner(geom, tile_r, tile_c, SE),
+                                  corner(geom, tile_r, tile_c, left_aligned ? NE : NW));
+        }else{
+            normal = plane_normal(corner(geom, tile_r, tile_c, NW), corner(geom, tile_r, tile_c, NE),
+                                  corner(geom, tile_r, tile_c, left_aligned ? SW : SE));
+        }
+
+        int mat = south ? ((middle >> 4) & 0xf) : (middle & 0xf);
+
+        /* The south, west, north and east triangles blend with the materials 
+         * around their' two outer corners */
+        ivec2 west = ivec2(adj.x, adj.z);
+        ivec2 east = ivec2(adj.y, adj.w);
+        ivec2 outer;
+        switch(slot / 3) {
+        case 0:  outer = ivec2(adj.x, adj.y);            break;
+        case 1:  outer = left_aligned ? east : west;    break;
+        case 2:  outer = ivec2(adj.z, adj.w);            break;
+        default: outer = left_aligned ? west : east;    break;
+        }
+
+        to_fragment.mat_idx = mat;
+        to_fragment.adjacent_mat_indices = ivec4(outer.x, outer.y, int(geom.w), middle);
+        to_fragment.blend_mode = (same_indices(outer.x) && outer.x == outer.y && (outer.x & 0xf) == mat)
+                               ? BLEND_MODE_NOBLEND : BLEND_MODE_BLUR;
+    }
+
+    to_fragment.uv = uv;
+    to_fragment.world_pos = (model * vec4(pos, 1.0)).xyz;
+    to_fragment.normal = normalize(mat3(model) * normal);
+
+    gl_Position = projection * view * model * vec4(pos, 1.0);
+}
+
@@ -59,13 +59,24 @@ out VertexToGeo {
     vec3 normal;
 }to_geometry;
 
+/* The depth prepass uses this same stage, and the depth of the two must 
+ * match exactly */
+invariant gl_Position;
+
 /*****************************************************************************/
 /* UNIFORMS                                                                  */
 /*****************************************************************************/
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform globals
+{
+    mat4 view;
+    mat4 projection;
+    vec3 view_pos;
+    vec3 ambient_color;
+    vec3 light_color;
+    vec3 light_pos;
+};
 
 /*****************************************************************************/
 /* PROGRAM
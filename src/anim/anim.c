@@ -40,6 +40,8 @@
 #include "../entity.h"
 #include "../event.h"
 #include "../render/public/render.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #include <SDL.h>
 
@@ -48,101 +50,127 @@
 
 
 /*****************************************************************************/
-/* STATIC FUNCTIONS                                                          */
+/* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static const struct anim_clip *a_clip_for_name(const struct entity *ent, const char *name)
-{
-    struct anim_data *priv = ent->anim_private;
-    for(int i = 0; i < priv->num_anims; i++) {
-
-        const struct anim_clip *curr = &priv->anims[i];
-        if(!strcmp(curr->name, name)) 
-            return curr;
-    }
+/* The time that all the animations are played by, in SDL ticks. It is only
+ * advanced once per frame. */
+static uint32_t s_clock_ticks;
 
-    return NULL;
-}
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
 
 static void a_mat_from_sqt(const struct SQT *sqt, mat4x4_t *out)
 {
-    mat4x4_t rot, trans, scale;
-    mat4x4_t tmp;
-
-    PFM_Mat4x4_MakeScale(sqt->scale.x, sqt->scale.y, sqt->scale.z, &scale);
-    PFM_Mat4x4_MakeTrans(sqt->trans.x, sqt->trans.y, sqt->trans.z, &trans);
-    PFM_Mat4x4_RotFromQuat(&sqt->quat_rotation, &rot);
-
     /*  (T * R * S) 
+     *
+     * Scaling only multiplies each column of the rotation and the translation 
+     * only fills in the last column, so the product is built directly.
      */
-    PFM_Mat4x4_Mult4x4(&rot, &scale, &tmp);
-    PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
+    PFM_Mat4x4_RotFromQuat(&sqt->quat_rotation, out);
+    for(int r = 0; r < 3; r++) {
+        out->cols[0][r] *= sqt->scale.x;
+        out->cols[1][r] *= sqt->scale.y;
+        out->cols[2][r] *= sqt->scale.z;
+    }
+    out->cols[3][0] = sqt->trans.x;
+    out->cols[3][1] = sqt->trans.y;
+    out->cols[3][2] = sqt->trans.z;
 }
 
-static void a_make_bind_mat(int joint_idx, const struct skeleton *skel, mat4x4_t *out)
+static void a_make_model_mat(const struct skeleton *skel, const struct SQT *local_sqts,
+                             int joint_idx, bool *done, mat4x4_t *out)
 {
-    mat4x4_t bind_trans;
-    PFM_Mat4x4_Identity(&bind_trans);
-
-    /* Walk up the bone heirarchy, multiplying our bind transform matrix by the parent-relative
-     * transform of each bone we visit. In the end, this the bind matrix will hold a transformation
-     * from the object's space to the current joint's space. Since each joint is positioned at the
-     * origin of its' local space, this gives us the object-space position of this joint in the bind
-     * pose.
-     */
-    while(joint_idx >= 0) {
+    if(done[joint_idx])
+        return;
+
+    const struct joint *joint = &skel->joints[joint_idx];
+    mat4x4_t to_parent;
+    a_mat_from_sqt(&local_sqts[joint_idx], &to_parent);
+
+    /* The parent's matrix already holds the transformation from its' space all 
+     * the way up to the object's space, so each joint only takes a single 
+     * multiplication on top of it. */
+    if(joint->parent_idx < 0) {
+        out[joint_idx] = to_parent;
+    }else{
+        a_make_model_mat(skel, local_sqts, joint->parent_idx, done, out);
+        PFM_Mat4x4_Mult4x4(&out[joint->parent_idx], &to_parent, &out[joint_idx]);
+    }
 
-        struct joint *joint = &skel->joints[joint_idx];
-        struct SQT   *bind_sqt = &skel->bind_sqts[joint_idx];
-        mat4x4_t to_parent, to_curr = bind_trans;
+    done[joint_idx] = true;
+}
 
-        a_mat_from_sqt(bind_sqt, &to_parent);
-        PFM_Mat4x4_Mult4x4(&to_parent, &to_curr, &bind_trans);
+/* Computes the transformation from each joint's space to the object's space,
+ * given the parent-relative transform of each joint. Every parent is visited
+ * before its' children, regardless of the joint order. */
+static void a_make_model_mats(const struct skeleton *skel, const struct SQT *local_sqts, mat4x4_t *out)
+{
+    bool done[skel->num_joints];
+    memset(done, 0, sizeof(done));
 
-        joint_idx = joint->parent_idx;
+    for(int j = 0; j < skel->num_joints; j++) {
+        a_make_model_mat(skel, local_sqts, j, done, out);
     }
+}
 
-    *out = bind_trans;
+/* The skinning matrices of a clip's samples are laid out one after another 
+ * (see 'al_set_layout'), so the whole clip is baked in one go */
+static bool a_bake_clip(struct anim_clip *clip)
+{
+    if(clip->baked_base == -1) {
+        int base = R_GL_AnimBake(clip->samples[0].skin_mats, clip->num_frames * clip->skel->num_joints);
+        clip->baked_base = (base >= 0) ? base : -2;
+    }
+    return (clip->baked_base >= 0);
 }
 
-static void a_make_pose_mat(const struct entity *ent, int joint_idx, const struct skeleton *skel, mat4x4_t *out)
+/* Moves the active clip on by all the key frames that went by on the clock,
+ * however many there were. Returns how far along the current frame the clock 
+ * is, from 0 to 1. */
+static float a_advance(const struct entity *ent)
 {
-    struct anim_data *priv = ent->anim_private;
     struct anim_ctx *ctx = ent->anim_ctx;
-    struct anim_sample *sample = &ctx->active->samples[ctx->curr_frame];
-
-    mat4x4_t pose_trans;
-    PFM_Mat4x4_Identity(&pose_trans);
 
-    /* Same as a_make_bind_mat, except for the current pose. */
-    while(joint_idx >= 0) {
-
-        struct joint *joint = &skel->joints[joint_idx];
-        struct SQT   *pose_sqt = &sample->local_joint_poses[joint_idx];
-        mat4x4_t to_parent, to_curr = pose_trans;
+    float frame_period_secs = 1.0f/ctx->key_fps;
+    float elapsed_frames = (s_clock_ticks - ctx->curr_frame_start_ticks)/1000.0f / frame_period_secs;
+    if(elapsed_frames < 1.0f)
+        return elapsed_frames;
 
-        a_mat_from_sqt(pose_sqt, &to_parent);
-        PFM_Mat4x4_Mult4x4(&to_parent, &to_curr, &pose_trans);
+    unsigned skipped = (unsigned)elapsed_frames;
+    if(ctx->mode == ANIM_MODE_ONCE && ctx->curr_frame + skipped >= ctx->active->num_frames) {
 
-        joint_idx = joint->parent_idx;
+        E_Entity_Notify(EVENT_ANIM_FINISHED, ent->uid, NULL, ES_ENGINE);
+        struct anim_data *priv = ent->anim_private;
+        A_SetActiveClipID(ent, ctx->idle - priv->anims, ANIM_MODE_LOOP, ctx->key_fps);
+        return 0.0f;
     }
 
-    *out = pose_trans;
+    ctx->curr_frame = (ctx->curr_frame + skipped) % ctx->active->num_frames;
+    ctx->curr_frame_start_ticks += skipped * 1000 / ctx->key_fps;
+    return elapsed_frames - skipped;
 }
 
-void a_set_uniforms_curr_frame(const struct entity *ent)
+void a_set_uniforms_curr_frame(const struct entity *ent, float frame_frac)
 {
     struct anim_data *priv = (struct anim_data*)ent->anim_private;
+    struct anim_ctx *ctx = ent->anim_ctx;
 
-    size_t float_per_mat = sizeof(mat4x4_t) / sizeof(float);
-    size_t num_joints = priv->skel.num_joints;
+    /* A clip that is played once holds its' last frame instead of blending 
+     * back into the first one */
+    int next_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
+    if(next_frame == 0 && ctx->mode == ANIM_MODE_ONCE)
+        next_frame = ctx->curr_frame;
 
-    mat4x4_t curr_pose_mats[num_joints];
-    for(int j = 0; j < num_joints; j++) {
-        a_make_pose_mat(ent, j, &priv->skel, &curr_pose_mats[j]);
-    }
+    const struct anim_sample *curr = &ctx->active->samples[ctx->curr_frame];
+    const struct anim_sample *next = &ctx->active->samples[next_frame];
 
-    R_GL_SetAnimUniforms(priv->skel.inv_bind_poses, curr_pose_mats, num_joints);
+    /* The samples' matrices are shared by every entity of this type playing 
+     * the same clip at the same frame, so they are only added to the frame's
+     * joint palette by the first one. The blending between them is done by 
+     * the vertex shader. */
+    R_GL_SetAnimPose(curr->skin_mats, next->skin_mats, frame_frac, priv->skel.num_joints);
 }
 
 
@@ -150,56 +178,148 @@ void a_set_uniforms_curr_frame(const struct entity *ent)
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
+void A_TickClock(void)
+{
+    s_clock_ticks = SDL_GetTicks();
+}
+
 void A_InitCtx(const struct entity *ent, const char *idle_clip, unsigned key_fps)
 {
     struct anim_data *priv = ent->anim_private;
     struct anim_ctx *ctx = ent->anim_ctx;
 
-    const struct anim_clip *idle = a_clip_for_name(ent, idle_clip);
-    assert(idle);
+    int idle = A_ClipID(ent, idle_clip);
+    assert(idle >= 0);
 
-    ctx->idle = idle;
-    A_SetActiveClip(ent, idle_clip, ANIM_MODE_LOOP, key_fps);
+    ctx->idle = &priv->anims[idle];
+    A_SetActiveClipID(ent, idle, ANIM_MODE_LOOP, key_fps);
 }
 
-void A_SetActiveClip(const struct entity *ent, const char *name, 
-                     enum anim_mode mode, unsigned key_fps)
+int A_ClipID(const struct entity *ent, const char *name)
+{
+    struct anim_data *priv = ent->anim_private;
+    uint32_t hash = A_ClipNameHash(name);
+
+    for(int i = 0; i < priv->num_anims; i++) {
+
+        const struct anim_clip *curr = &priv->anims[i];
+        if(curr->name_hash == hash && !strcmp(curr->name, name))
+            return i;
+    }
+    return -1;
+}
+
+bool A_SetActiveClipID(const struct entity *ent, int clip_id, 
+                       enum anim_mode mode, unsigned key_fps)
 {
     struct anim_data *priv = ent->anim_private;
     struct anim_ctx *ctx = ent->anim_ctx;
 
-    const struct anim_clip *clip = a_clip_for_name(ent, name);
-    assert(clip);
+    if(clip_id < 0 || clip_id >= priv->num_anims)
+        return false;
 
-    ctx->active = clip;
+    ctx->active = &priv->anims[clip_id];
     ctx->mode = mode;
     ctx->key_fps = key_fps;
     ctx->curr_frame = 0;
-    ctx->curr_frame_start_ticks = SDL_GetTicks();
+    ctx->curr_frame_start_ticks = s_clock_ticks;
+    ctx->blend = 0.0f;
+    ctx->next_eval_ticks = s_clock_ticks;
+    return true;
 }
 
-void A_Update(const struct entity *ent)
+void A_SetActiveClip(const struct entity *ent, const char *name, 
+                     enum anim_mode mode, unsigned key_fps)
+{
+    bool found = A_SetActiveClipID(ent, A_ClipID(ent, name), mode, key_fps);
+    assert(found);
+    (void)found;
+}
+
+void A_GetState(const struct entity *ent, struct anim_state *out)
 {
     struct anim_data *priv = ent->anim_private;
     struct anim_ctx *ctx = ent->anim_ctx;
 
-    a_set_uniforms_curr_frame(ent);
+    *out = (struct anim_state){
+        .active_clip      = ctx->active - priv->anims,
+        .idle_clip        = ctx->idle - priv->anims,
+        .mode             = ctx->mode,
+        .key_fps          = ctx->key_fps,
+        .curr_frame       = ctx->curr_frame,
+        .frame_elapsed_ms = s_clock_ticks - ctx->curr_frame_start_ticks,
+    };
+}
 
-    float frame_period_secs = 1.0f/ctx->key_fps;
-    uint32_t curr_ticks = SDL_GetTicks();
-    float elapsed_secs = (curr_ticks - ctx->curr_frame_start_ticks)/1000.0f;
+bool A_SetState(const struct entity *ent, const struct anim_state *state)
+{
+    struct anim_data *priv = ent->anim_private;
+    struct anim_ctx *ctx = ent->anim_ctx;
 
-    if(elapsed_secs > frame_period_secs) {
+    if(state->active_clip < 0 || state->active_clip >= priv->num_anims
+    || state->idle_clip < 0 || state->idle_clip >= priv->num_anims
+    || (state->mode != ANIM_MODE_LOOP && state->mode != ANIM_MODE_ONCE)
+    || state->key_fps == 0)
+        return false;
+
+    const struct anim_clip *active = &priv->anims[state->active_clip];
+    if(state->curr_frame < 0 || state->curr_frame >= active->num_frames)
+        return false;
+
+    ctx->active = active;
+    ctx->idle = &priv->anims[state->idle_clip];
+    ctx->mode = state->mode;
+    ctx->key_fps = state->key_fps;
+    ctx->curr_frame = state->curr_frame;
+    ctx->curr_frame_start_ticks = s_clock_ticks - state->frame_elapsed_ms;
+    ctx->blend = 0.0f;
+    ctx->next_eval_ticks = s_clock_ticks;
+    return true;
+}
 
-        ctx->curr_frame = (ctx->curr_frame + 1) % ctx->active->num_frames;
-        ctx->curr_frame_start_ticks = curr_ticks;
+void A_Update(const struct entity *ent)
+{
+    struct anim_ctx *ctx = ent->anim_ctx;
 
-        if(ctx->curr_frame == 0 && ctx->mode == ANIM_MODE_ONCE) {
+    ctx->blend = a_advance(ent);
+    a_set_uniforms_curr_frame(ent, ctx->blend);
+}
 
-            E_Entity_Notify(EVENT_ANIM_FINISHED, ent->uid, NULL, ES_ENGINE);
-            A_SetActiveClip(ent, ctx->idle->name, ANIM_MODE_LOOP, ctx->key_fps);
-        }
+void A_UpdateThrottled(const struct entity *ent, unsigned hz)
+{
+    struct anim_ctx *ctx = ent->anim_ctx;
+
+    /* The samples of the last pose are still shared with the other entities
+     * drawn in them, so setting it again is cheap */
+    if(hz > 0 && (int32_t)(s_clock_ticks - ctx->next_eval_ticks) < 0) {
+        a_set_uniforms_curr_frame(ent, ctx->blend);
+        return;
     }
+
+    A_Update(ent);
+    if(hz > 0)
+        ctx->next_eval_ticks = s_clock_ticks + 1000 / hz;
+}
+
+bool A_UpdateBaked(const struct entity *ent)
+{
+    struct anim_data *priv = ent->anim_private;
+    struct anim_ctx *ctx = ent->anim_ctx;
+
+    if(ctx->mode == ANIM_MODE_ONCE)
+        return false;
+
+    struct anim_clip *clip = &priv->anims[ctx->active - priv->anims];
+    if(!a_bake_clip(clip))
+        return false;
+
+    ctx->blend = a_advance(ent);
+
+    int num_joints = priv->skel.num_joints;
+    int next_frame = (ctx->curr_frame + 1) % clip->num_frames;
+    R_GL_SetBakedAnimPose(clip->baked_base + ctx->curr_frame * num_joints, 
+                          clip->baked_base + next_frame * num_joints, ctx->blend);
+    return true;
 }
 
 const struct skeleton *A_GetBindSkeleton(const struct entity *ent)
@@ -241,31 +361,118 @@ const struct skeleton *A_GetCurrPoseSkeleton(const struct entity *ent)
 
     ret->inv_bind_poses = (void*)((char*)ret->bind_sqts + num_joints * sizeof(struct SQT));
 
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena) {
+        free(ret);
+        return NULL;
+    }
+    struct arena_mark mark = arena_mark(arena);
+
+    struct SQT *pose_sqts = arena_alloc(arena, num_joints * sizeof(struct SQT));
+    mat4x4_t *pose_mats = arena_alloc(arena, num_joints * sizeof(mat4x4_t));
+    if(!pose_sqts || !pose_mats) {
+        arena_rewind(arena, mark);
+        free(ret);
+        return NULL;
+    }
+
     struct anim_ctx *ctx = ent->anim_ctx;
-    struct anim_sample *sample =  &ctx->active->samples[ctx->curr_frame];
+    A_ClipSampleSQTs(ctx->active, ctx->curr_frame, pose_sqts);
+    a_make_model_mats(ret, pose_sqts, pose_mats);
 
+    /* Update the inverse bind matrices for the current frame */
     for(int i = 0; i < ret->num_joints; i++) {
-    
-        /* Update the inverse bind matrices for the current frame */
-        mat4x4_t pose_mat;
-        a_make_pose_mat(ent, i, ret, &pose_mat);
-        PFM_Mat4x4_Inverse(&pose_mat, &ret->inv_bind_poses[i]);
+        PFM_Mat4x4_Inverse(&pose_mats[i], &ret->inv_bind_poses[i]);
     }
 
+    arena_rewind(arena, mark);
     return ret;
 }
 
-void A_PrepareInvBindMatrices(const struct skeleton *skel)
+bool A_PrepareInvBindMatrices(const struct skeleton *skel)
 {
     assert(skel->inv_bind_poses);
 
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return false;
+    struct arena_mark mark = arena_mark(arena);
+
+    mat4x4_t *bind_mats = arena_alloc(arena, skel->num_joints * sizeof(mat4x4_t));
+    if(!bind_mats) {
+        arena_rewind(arena, mark);
+        return false;
+    }
+
+    a_make_model_mats(skel, skel->bind_sqts, bind_mats);
     for(int i = 0; i < skel->num_joints; i++) {
+        PFM_Mat4x4_Inverse(&bind_mats[i], &skel->inv_bind_poses[i]);
+    }
+
+    arena_rewind(arena, mark);
+    return true;
+}
+
+bool A_PrepareSkinMatrices(const struct skeleton *skel, const struct anim_clip *clip)
+{
+    assert(skel->inv_bind_poses);
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return false;
+    struct arena_mark mark = arena_mark(arena);
+
+    struct SQT *pose_sqts = arena_alloc(arena, skel->num_joints * sizeof(struct SQT));
+    mat4x4_t *pose_mats = arena_alloc(arena, skel->num_joints * sizeof(mat4x4_t));
+    if(!pose_sqts || !pose_mats) {
+        arena_rewind(arena, mark);
+        return false;
+    }
+
+    for(int f = 0; f < clip->num_frames; f++) {
+
+        const struct anim_sample *sample = &clip->samples[f];
+        assert(sample->skin_mats);
+
+        A_ClipSampleSQTs(clip, f, pose_sqts);
+        a_make_model_mats(skel, pose_sqts, pose_mats);
+        PFM_Mat4x4_Mult4x4N(skel->num_joints, pose_mats, skel->inv_bind_poses, sample->skin_mats);
+    }
+
+    arena_rewind(arena, mark);
+    return true;
+}
+
+uint32_t A_ClipNameHash(const char *name)
+{
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    for(; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void A_ClipSampleSQTs(const struct anim_clip *clip, unsigned frame, struct SQT *out)
+{
+    assert(frame < clip->num_frames);
+
+    for(int j = 0; j < clip->skel->num_joints; j++) {
+
+        const struct joint_track *track = &clip->tracks[j];
+        const struct quant_quat *rot = &track->rot[track->num_rot > 1 ? frame : 0];
 
-        const struct joint *joint = &skel->joints[i];
+        out[j].trans = track->trans[track->num_trans > 1 ? frame : 0];
+        out[j].scale = track->scale[track->num_scale > 1 ? frame : 0];
 
-        mat4x4_t bind_mat;
-        a_make_bind_mat(i, skel, &bind_mat);
-        PFM_Mat4x4_Inverse(&bind_mat, &skel->inv_bind_poses[i]);
+        quat_t quat = (quat_t){
+            (float)rot->x / INT16_MAX, 
+            (float)rot->y / INT16_MAX, 
+            (float)rot->z / INT16_MAX, 
+            (float)rot->w / INT16_MAX
+        };
+        PFM_Quat_Normal(&quat, &out[j].quat_rotation);
     }
 }
 
@@ -39,9 +39,13 @@
 #include "anim_ctx.h"
 
 #include "../asset_load.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #define __USE_POSIX
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
 
 
 /*****************************************************************************/
@@ -67,23 +71,15 @@ static bool al_read_joint(SDL_RWops *stream, struct joint *out, struct SQT *out_
     strtok_r(NULL, " \t", &saveptr);
     strtok_r(NULL, " \t", &saveptr);
 
-    string = strtok_r(NULL, " \t", &saveptr);  
-    if(!sscanf(string, "%f/%f/%f", 
-        &out_bind->scale.x, &out_bind->scale.y, &out_bind->scale.z))
+    string = strtok_r(NULL, "", &saveptr);
+    if(!string)
         goto fail;
 
-    string = strtok_r(NULL, " \t", &saveptr);  
-    if(!sscanf(string, "%f/%f/%f/%f", &out_bind->quat_rotation.x, &out_bind->quat_rotation.y, 
-        &out_bind->quat_rotation.z, &out_bind->quat_rotation.w))
-        goto fail;
-
-    string = strtok_r(NULL, " \t", &saveptr);  
-    if(!sscanf(string, "%f/%f/%f", 
-        &out_bind->trans.x, &out_bind->trans.y, &out_bind->trans.z))
-        goto fail;
-
-    string = strtok_r(NULL, " \t", &saveptr);  
-    if(!sscanf(string, "%f/%f/%f", &out->tip.x, &out->tip.y, &out->tip.z))
+    const char *curr = string;
+    if(!AL_ParseFloats(&curr, 3, '/', out_bind->scale.raw)
+    || !AL_ParseFloats(&curr, 4, '/', out_bind->quat_rotation.raw)
+    || !AL_ParseFloats(&curr, 3, '/', out_bind->trans.raw)
+    || !AL_ParseFloats(&curr, 3, '/', out->tip.raw))
         goto fail;
 
     return true;
@@ -93,7 +89,7 @@ fail:
 }
 
 static bool al_read_anim_clip(SDL_RWops *stream, struct anim_clip *out, 
-                              const struct pfobj_hdr *header)
+                              const struct pfobj_hdr *header, struct SQT *out_poses)
 {
     char line[MAX_LINE_LEN];
 
@@ -105,23 +101,15 @@ static bool al_read_anim_clip(SDL_RWops *stream, struct anim_clip *out,
         for(int j = 0; j < header->num_joints; j++) {
 
             int joint_idx;  /* unused */
-            struct SQT *curr_joint_trans = &out->samples[f].local_joint_poses[j];
+            struct SQT *curr_joint_trans = &out_poses[f * header->num_joints + j];
         
-            READ_LINE(stream, line, fail);
-            if(!sscanf(line, "%d %f/%f/%f %f/%f/%f/%f %f/%f/%f",
-                &joint_idx, 
-                &curr_joint_trans->scale.x,
-                &curr_joint_trans->scale.y,
-                &curr_joint_trans->scale.z,
-                &curr_joint_trans->quat_rotation.x,
-                &curr_joint_trans->quat_rotation.y,
-                &curr_joint_trans->quat_rotation.z,
-                &curr_joint_trans->quat_rotation.w,
-                &curr_joint_trans->trans.x,
-                &curr_joint_trans->trans.y,
-                &curr_joint_trans->trans.z)) {
+            const char *curr;
+            READ_LINE_VIEW(stream, curr, fail);
+            if(!AL_ParseInt(&curr, &joint_idx)
+            || !AL_ParseFloats(&curr, 3, '/', curr_joint_trans->scale.raw)
+            || !AL_ParseFloats(&curr, 4, '/', curr_joint_trans->quat_rotation.raw)
+            || !AL_ParseFloats(&curr, 3, '/', curr_joint_trans->trans.raw))
                 goto fail;
-            }
         
         }
 
@@ -138,7 +126,145 @@ fail:
     return false;
 }
 
-size_t al_data_buffsize_from_header(const struct pfobj_hdr *header)
+static struct quant_quat al_quantize_quat(quat_t quat)
+{
+    quat_t norm;
+    PFM_Quat_Normal(&quat, &norm);
+
+    /* 'q' and '-q' are the same rotation. Keep 'w' positive so that they 
+     * quantize to the same value. */
+    float sign = norm.w < 0.0f ? -1.0f : 1.0f;
+
+    return (struct quant_quat){
+        (int16_t)lroundf(sign * norm.x * INT16_MAX),
+        (int16_t)lroundf(sign * norm.y * INT16_MAX),
+        (int16_t)lroundf(sign * norm.z * INT16_MAX),
+        (int16_t)lroundf(sign * norm.w * INT16_MAX),
+    };
+}
+
+static bool al_rot_constant(const struct SQT *poses, size_t stride, unsigned num_frames)
+{
+    struct quant_quat first = al_quantize_quat(poses[0].quat_rotation);
+    for(int f = 1; f < num_frames; f++) {
+
+        struct quant_quat curr = al_quantize_quat(poses[f * stride].quat_rotation);
+        if(memcmp(&first, &curr, sizeof(struct quant_quat)))
+            return false;
+    }
+    return true;
+}
+
+static bool al_vec_constant(const struct SQT *poses, size_t stride, unsigned num_frames, size_t offset)
+{
+    const vec3_t *first = (const vec3_t*)((const char*)&poses[0] + offset);
+    for(int f = 1; f < num_frames; f++) {
+
+        const vec3_t *curr = (const vec3_t*)((const char*)&poses[f * stride] + offset);
+        if(memcmp(first, curr, sizeof(vec3_t)))
+            return false;
+    }
+    return true;
+}
+
+/* Sets the channel counts of every joint track of the clip based on which 
+ * channels change over its' course. */
+static void al_count_channels(struct anim_clip *clip, const struct SQT *poses, size_t num_joints)
+{
+    for(int j = 0; j < num_joints; j++) {
+
+        struct joint_track *track = &clip->tracks[j];
+        const struct SQT *first = &poses[j];
+
+        track->num_rot = al_rot_constant(first, num_joints, clip->num_frames) 
+                       ? 1 : clip->num_frames;
+        track->num_trans = al_vec_constant(first, num_joints, clip->num_frames, offsetof(struct SQT, trans)) 
+                         ? 1 : clip->num_frames;
+        track->num_scale = al_vec_constant(first, num_joints, clip->num_frames, offsetof(struct SQT, scale)) 
+                         ? 1 : clip->num_frames;
+    }
+}
+
+static size_t al_vec_channels_buffsize(const struct anim_data *data)
+{
+    size_t ret = 0;
+
+    for(int i = 0; i < data->num_anims; i++) {
+        for(int j = 0; j < data->skel.num_joints; j++) {
+
+            const struct joint_track *track = &data->anims[i].tracks[j];
+            ret += (track->num_trans + track->num_scale) * sizeof(vec3_t);
+        }
+    }
+
+    return ret;
+}
+
+static size_t al_tracks_buffsize(const struct anim_data *data)
+{
+    size_t ret = al_vec_channels_buffsize(data);
+
+    for(int i = 0; i < data->num_anims; i++) {
+        for(int j = 0; j < data->skel.num_joints; j++) {
+
+            const struct joint_track *track = &data->anims[i].tracks[j];
+            ret += track->num_rot * sizeof(struct quant_quat);
+        }
+    }
+
+    return ret;
+}
+
+/* Points the joint tracks at their channels, which are packed into the buffer
+ * at 'base', with all the vectors ahead of the (less strictly aligned) 
+ * quaternions. The channel counts must already be set. */
+static void al_set_track_layout(struct anim_data *data, char *base)
+{
+    vec3_t *vec_cursor = (void*)base;
+    struct quant_quat *quat_cursor = (void*)(base + al_vec_channels_buffsize(data));
+
+    for(int i = 0; i < data->num_anims; i++) {
+
+        const struct anim_clip *clip = &data->anims[i];
+        for(int j = 0; j < data->skel.num_joints; j++) {
+
+            struct joint_track *track = &clip->tracks[j];
+
+            track->trans = vec_cursor;
+            vec_cursor += track->num_trans;
+            track->scale = vec_cursor;
+            vec_cursor += track->num_scale;
+            track->rot = quat_cursor;
+            quat_cursor += track->num_rot;
+        }
+    }
+}
+
+/* Fills in the joint tracks from the uncompressed samples of every clip */
+static void al_fill_tracks(struct anim_data *data, const struct SQT *poses, char *base)
+{
+    size_t num_joints = data->skel.num_joints;
+    al_set_track_layout(data, base);
+
+    for(int i = 0; i < data->num_anims; i++) {
+
+        const struct anim_clip *clip = &data->anims[i];
+        for(int j = 0; j < num_joints; j++) {
+
+            struct joint_track *track = &clip->tracks[j];
+
+            for(int f = 0; f < track->num_trans; f++)
+                track->trans[f] = poses[f * num_joints + j].trans;
+            for(int f = 0; f < track->num_scale; f++)
+                track->scale[f] = poses[f * num_joints + j].scale;
+            for(int f = 0; f < track->num_rot; f++)
+                track->rot[f] = al_quantize_quat(poses[f * num_joints + j].quat_rotation);
+        }
+        poses += clip->num_frames * num_joints;
+    }
+}
+
+static size_t al_fixed_buffsize(const struct pfobj_hdr *header)
 {
     size_t ret = 0;
 
@@ -148,23 +274,73 @@ size_t al_data_buffsize_from_header(const struct pfobj_hdr *header)
     ret += header->num_joints * sizeof(mat4x4_t);
     ret += header->num_joints * sizeof(struct joint);
     ret += header->num_as     * sizeof(struct anim_clip);
+    ret += header->num_as     * header->num_joints * sizeof(struct joint_track);
 
     /*
      * For each frame of each animation clip, we also require:
      *
-     *    1. a 'struct anim_sample' (for referencing this frame's SQT array)
-     *    2. num_joint number of 'struct SQT's (each joint's transform
-     *       for the current frame)
+     *    1. a 'struct anim_sample' (for referencing this frame's matrices)
+     *    2. num_joint number of 'mat4x4_t's (each joint's skinning 
+     *       matrix for the current frame)
      */
     for(unsigned as_idx  = 0; as_idx < header->num_as; as_idx++) {
 
         ret += header->frame_counts[as_idx] * 
-               (sizeof(struct anim_sample) + header->num_joints * sizeof(struct SQT));
+               (sizeof(struct anim_sample) + header->num_joints * sizeof(mat4x4_t));
     }
 
     return ret;
 }
 
+/* Divides up the fixed-size part of the buffer betwen data members, and sets
+ * counts and pointers. Returns the end of the fixed-size part. */
+static char *al_set_layout(struct anim_data *data, const struct pfobj_hdr *header)
+{
+    char *unused_base = (char*)(data + 1);
+
+    data->num_anims = header->num_as; 
+    data->skel.num_joints = header->num_joints;
+
+    data->skel.bind_sqts = (void*)unused_base;
+    unused_base += sizeof(struct SQT) * header->num_joints;
+
+    data->skel.inv_bind_poses = (void*)unused_base;
+    unused_base += sizeof(mat4x4_t) * header->num_joints;
+
+    data->skel.joints = (void*)unused_base;
+    unused_base += sizeof(struct joint) * header->num_joints;
+
+    data->anims = (void*)unused_base;
+    unused_base += sizeof(struct anim_clip) * header->num_as;
+
+    for(int i = 0; i < header->num_as; i++) {
+
+        data->anims[i].samples = (void*)unused_base;
+        unused_base += sizeof(struct anim_sample) * header->frame_counts[i];
+    }
+
+    for(int i = 0; i < header->num_as; i++) {
+
+        data->anims[i].skel = &data->skel;
+        data->anims[i].num_frames = header->frame_counts[i];
+        data->anims[i].baked_base = -1;
+        data->anims[i].name_hash = A_ClipNameHash(data->anims[i].name);
+
+        data->anims[i].tracks = (void*)unused_base;
+        unused_base += sizeof(struct joint_track) * header->num_joints;
+    }
+
+    for(int i = 0; i < header->num_as; i++) {
+        for(int f = 0; f < header->frame_counts[i]; f++) {
+
+            data->anims[i].samples[f].skin_mats = (void*)unused_base;
+            unused_base += sizeof(mat4x4_t) * header->num_joints;
+        }
+    }
+
+    return unused_base;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -191,84 +367,174 @@ size_t A_AL_CtxBuffSize(void)
  *  | struct anim_samples[num_as      |
  *  |    * num_frames]                |
  *  +---------------------------------+
- *  | struct SQT[num_as * num_joints] |
+ *  | struct joint_track[num_as       |
+ *  |    * num_joints]                |
+ *  +---------------------------------+
+ *  | mat4x4_t[num_as * num_frames    |
+ *  |    * num_joints] (skinning)     |
  *  |    (stored in clip-major order) |
  *  +---------------------------------+
+ *  | vec3_t[...] (translation and    |
+ *  |    scale channels)              |
+ *  +---------------------------------+
+ *  | struct quant_quat[...]          |
+ *  |    (rotation channels)          |
+ *  +---------------------------------+
  *
+ * The size of the channels is only known once every clip has been read. The
+ * file is first parsed into a temporary buffer holding just the fixed-size 
+ * part, with the uncompressed samples kept off to the side.
  */
 
 void *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream)
 {
-    struct anim_data *ret = malloc(al_data_buffsize_from_header(header));
-    if(!ret)
-        goto fail_alloc;
+    size_t total_frames = 0;
+    for(int i = 0; i < header->num_as; i++) {
+        total_frames += header->frame_counts[i];
+    }
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return NULL;
+    struct arena_mark mark = arena_mark(arena);
 
-    /*-----------------------------------------------------------
-     * First divide up the buffer betwen data members,
-     * set counts and pointers 
-     *-----------------------------------------------------------
+    size_t fixed_size = al_fixed_buffsize(header);
+    struct anim_data *ret = NULL;
+    struct anim_data *parsed = arena_alloc(arena, fixed_size);
+    struct SQT *poses = arena_alloc(arena, total_frames * header->num_joints * sizeof(struct SQT));
+    if(!parsed || !poses)
+        goto fail;
+
+    al_set_layout(parsed, header);
+
+    /*---------------------------------------------------------------
+     * First we populate the temporary buffer with the file data 
+     *---------------------------------------------------------------
      */
+    for(int i = 0; i < header->num_joints; i++) {
 
-    char *unused_base = (char*)(ret + 1);
+        if(!al_read_joint(stream, &parsed->skel.joints[i], &parsed->skel.bind_sqts[i]))
+            goto fail;
+    }
 
-    ret->num_anims = header->num_as; 
-    ret->skel.num_joints = header->num_joints;
+    struct SQT *clip_poses = poses;
+    for(int i = 0; i < header->num_as; i++) {
+        
+        if(!al_read_anim_clip(stream, &parsed->anims[i], header, clip_poses))
+            goto fail;
 
-    ret->skel.bind_sqts = (void*)unused_base;
-    unused_base += sizeof(struct SQT) * header->num_joints;
+        al_count_channels(&parsed->anims[i], clip_poses, header->num_joints);
+        clip_poses += header->frame_counts[i] * header->num_joints;
+    }
 
-    ret->skel.inv_bind_poses = (void*)unused_base;
-    unused_base += sizeof(mat4x4_t) * header->num_joints;
+    /*---------------------------------------------------------------
+     * Then we move it into a buffer that also fits the compressed 
+     * tracks, and fill them in
+     *---------------------------------------------------------------
+     */
+    ret = MEM_Malloc(MEM_TAG_ANIM, fixed_size + al_tracks_buffsize(parsed));
+    if(!ret)
+        goto fail;
 
-    ret->skel.joints = (void*)unused_base;
-    unused_base += sizeof(struct joint) * header->num_joints;
+    memcpy(ret, parsed, fixed_size);
+    char *tracks_base = al_set_layout(ret, header);
+    al_fill_tracks(ret, poses, tracks_base);
 
-    ret->anims = (void*)unused_base;
-    unused_base += sizeof(struct anim_clip) * header->num_as;
+    if(!A_PrepareInvBindMatrices(&ret->skel))
+        goto fail_prepare;
 
     for(int i = 0; i < header->num_as; i++) {
-
-        ret->anims[i].samples = (void*)unused_base;
-        unused_base += sizeof(struct anim_sample) * header->frame_counts[i];
+        if(!A_PrepareSkinMatrices(&ret->skel, &ret->anims[i]))
+            goto fail_prepare;
     }
 
-    for(int i = 0; i < header->num_as; i++) {
+    arena_rewind(arena, mark);
+    return ret;
 
-        ret->anims[i].skel = &ret->skel;
-        ret->anims[i].num_frames = header->frame_counts[i];
+fail_prepare:
+    MEM_Free(ret);
+fail:
+    arena_rewind(arena, mark);
+    return NULL;
+}
 
-        for(int f = 0; f < header->frame_counts[i]; f++) {
+/*
+ * Binary animation section layout:
+ *
+ *  +---------------------------------+ <-- base
+ *  | uint64_t (buffer size)          |
+ *  +---------------------------------+
+ *  | animation data buffer, laid out |
+ *  |    as above                     |
+ *  +---------------------------------+
+ *
+ * The buffer is stored just as it's held in memory, skinning matrices and 
+ * all. Only the pointers within it need to be set up again after loading.
+ */
 
-            ret->anims[i].samples[f].local_joint_poses = (void*)unused_base;
-            unused_base += sizeof(struct SQT) * header->num_joints;
-        }
-    }
+bool A_AL_WriteBinary(const struct pfobj_hdr *header, SDL_RWops *in, SDL_RWops *out)
+{
+    struct anim_data *data = A_AL_PrivFromStream(header, in);
+    if(!data)
+        return false;
 
-    /*---------------------------------------------------------------
-     * Then we populate priv members with the file data 
-     *---------------------------------------------------------------
-     */
-    for(int i = 0; i < header->num_joints; i++) {
+    uint64_t size = al_fixed_buffsize(header) + al_tracks_buffsize(data);
+    bool ret = AL_WriteBytes(out, &size, sizeof(size))
+            && AL_WriteBytes(out, data, size);
 
-        if(!al_read_joint(stream, &ret->skel.joints[i], &ret->skel.bind_sqts[i]))
-            goto fail_parse;
-    }
+    A_AL_FreePrivate(data);
+    return ret;
+}
 
-    for(int i = 0; i < header->num_as; i++) {
-        
-        if(!al_read_anim_clip(stream, &ret->anims[i], header))
-            goto fail_parse;
+void *A_AL_PrivFromBinary(const struct pfobj_hdr *header, const void *data, size_t size)
+{
+    uint64_t buffsize;
+    if(size < sizeof(buffsize))
+        return NULL;
+
+    memcpy(&buffsize, data, sizeof(buffsize));
+    size_t fixed_size = al_fixed_buffsize(header);
+    if(buffsize < fixed_size || buffsize > size - sizeof(buffsize))
+        return NULL;
+
+    struct anim_data *ret = MEM_Malloc(MEM_TAG_ANIM, buffsize);
+    if(!ret)
+        return NULL;
+
+    memcpy(ret, (const char*)data + sizeof(buffsize), buffsize);
+    char *tracks_base = al_set_layout(ret, header);
+
+    /* The channel counts come from the file - make sure they add up before
+     * pointing anything at the channels */
+    for(int i = 0; i < ret->num_anims; i++) {
+        for(int j = 0; j < ret->skel.num_joints; j++) {
+
+            const struct anim_clip *clip = &ret->anims[i];
+            const struct joint_track *track = &clip->tracks[j];
+
+            if((track->num_rot   != 1 && track->num_rot   != clip->num_frames)
+            || (track->num_trans != 1 && track->num_trans != clip->num_frames)
+            || (track->num_scale != 1 && track->num_scale != clip->num_frames))
+                goto fail;
+        }
     }
 
-    A_PrepareInvBindMatrices(&ret->skel);
+    if(fixed_size + al_tracks_buffsize(ret) != buffsize)
+        goto fail;
+
+    al_set_track_layout(ret, tracks_base);
     return ret;
 
-fail_parse:
-    free(ret);
-fail_alloc:
+fail:
+    MEM_Free(ret);
     return NULL;
 }
 
+void A_AL_FreePrivate(void *priv_data)
+{
+    MEM_Free(priv_data);
+}
+
 void A_AL_DumpPrivate(FILE *stream, void *priv_data)
 {
     struct anim_data *priv = priv_data;
@@ -297,9 +563,13 @@ void A_AL_DumpPrivate(FILE *stream, void *priv_data)
         fprintf(stream, "as %s %d\n", ac->name, ac->num_frames); 
 
         for(int f = 0; f < ac->num_frames; f++) {
+
+            struct SQT sqts[ac->skel->num_joints];
+            A_ClipSampleSQTs(ac, f, sqts);
+
             for(int j = 0; j < ac->skel->num_joints; j++) {
 
-                struct SQT *sqt = &ac->samples[f].local_joint_poses[j]; 
+                struct SQT *sqt = &sqts[j]; 
 
                 float roll, pitch, yaw;
                 PFM_Quat_ToEuler(&sqt->quat_rotation, &roll, &pitch, &yaw);
@@ -45,6 +45,10 @@ struct anim_ctx{
     unsigned                key_fps;
     int                     curr_frame;
     uint32_t                curr_frame_start_ticks;
+    /* How far along 'curr_frame' the pose was last evaluated, and when it is
+     * next due to be evaluated by 'A_UpdateThrottled' */
+    float                   blend;
+    uint32_t                next_eval_ticks;
 };
 
 #endif
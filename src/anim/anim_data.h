@@ -41,19 +41,48 @@
 #include "../collision.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #define ANIM_NAME_LEN  32
 
+/* A unit quaternion with each component scaled to the range of a signed 
+ * 16-bit integer */
+struct quant_quat{
+    int16_t x, y, z, w;
+};
+
+/* The parent-relative transform of a single joint over the course of a clip. 
+ * Each channel holds either one value per frame or, if it stays the same for
+ * the whole clip, just a single value. */
+struct joint_track{
+    unsigned           num_rot;
+    unsigned           num_trans;
+    unsigned           num_scale;
+    struct quant_quat *rot;
+    vec3_t            *trans;
+    vec3_t            *scale;
+};
+
 struct anim_sample{
-    struct SQT  *local_joint_poses;
+    /* The final skinning matrix (pose * inverse bind pose) of each joint, 
+     * computed once at load time */
+    mat4x4_t    *skin_mats;
     struct aabb  sample_aabb;
 };
 
 struct anim_clip{
     char                name[ANIM_NAME_LEN];
+    /* Hash of 'name', so that looking a clip up by name seldom needs to 
+     * compare any strings */
+    uint32_t            name_hash;
     struct skeleton    *skel;
     unsigned            num_frames;
     struct anim_sample *samples;
+    /* One track for each joint of 'skel' */
+    struct joint_track *tracks;
+    /* Offset of the samples' skinning matrices in the renderer's baked 
+     * palette, -1 until they are baked and -2 if they could not be */
+    int                 baked_base;
 };
 
 struct anim_data{
@@ -36,7 +36,12 @@
 #ifndef ANIM_PRIVATE_H
 #define ANIM_PRIVATE_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 struct skeleton;
+struct anim_clip;
+struct SQT;
 
 /* Computes the inverse bind matrix for each joint based on the 
  * joint's bind SQT. The inverse bind matrix will be used by the vertex
@@ -44,8 +49,25 @@ struct skeleton;
  * it is bound to (i.e. give a position of the vertex relative to 
  * a joint in bind pose). The matrices will be written to the memory
  * pointed to by 'skel->inv_bind_poses' which is expected to be 
- * allocated already.
+ * allocated already. Returns false if the working memory could not be
+ * allocated.
+ */
+bool A_PrepareInvBindMatrices(const struct skeleton *skel);
+
+/* Computes the skinning matrices of every sample of the clip, which take a
+ * vertex from the bind pose to the sample's pose. The inverse bind matrices
+ * must be prepared already, and each sample's 'skin_mats' allocated.
+ * Returns false if the working memory could not be allocated.
+ */
+bool A_PrepareSkinMatrices(const struct skeleton *skel, const struct anim_clip *clip);
+
+/* The hash of a clip's name that is kept in 'name_hash' 
+ */
+uint32_t A_ClipNameHash(const char *name);
+
+/* Decompresses the parent-relative transform of each joint at the given frame 
+ * of the clip. 'out' must have space for one SQT per joint.
  */
-void A_PrepareInvBindMatrices(const struct skeleton *skel);
+void A_ClipSampleSQTs(const struct anim_clip *clip, unsigned frame, struct SQT *out);
 
 #endif
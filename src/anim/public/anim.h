@@ -39,6 +39,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <SDL.h> /* for SDL_RWops */
 
@@ -51,11 +52,31 @@ enum anim_mode{
     ANIM_MODE_ONCE
 };
 
+/* The state of an entity's animation context, for saving and restoring it. 
+ * The clips are referred to by their handles (see 'A_ClipID'). */
+struct anim_state{
+    int32_t  active_clip;
+    int32_t  idle_clip;
+    uint32_t mode;
+    uint32_t key_fps;
+    int32_t  curr_frame;
+    /* Time spent on 'curr_frame' so far */
+    uint32_t frame_elapsed_ms;
+};
+
 
 /*###########################################################################*/
 /* ANIM GENERAL                                                              */
 /*###########################################################################*/
 
+/* ---------------------------------------------------------------------------
+ * Advances the clock that all the animations are played by to the current 
+ * time. Called once per frame, before any entities are updated, so that the 
+ * cost of playing the animations does not depend on the frame rate.
+ * ---------------------------------------------------------------------------
+ */
+void                   A_TickClock(void);
+
 /* ---------------------------------------------------------------------------
  * Perform one-time context initialization and set the animation clip that will 
  * play when no other animation clips are active.
@@ -67,6 +88,32 @@ enum anim_mode{
 void                   A_InitCtx(const struct entity *ent, const char *idle_clip, 
                                  unsigned key_fps);
 
+/* ---------------------------------------------------------------------------
+ * Returns the handle of the entity's clip with the name, or -1 if it has none.
+ * The handle stays valid for all the entities with the same animation data,
+ * so it can be looked up once and used for every state change after.
+ * ---------------------------------------------------------------------------
+ */
+int                    A_ClipID(const struct entity *ent, const char *name);
+
+/* ---------------------------------------------------------------------------
+ * 'A_SetActiveClip' by the handle returned from 'A_ClipID'. Returns false, 
+ * leaving the active clip as it was, if the handle is not one of the entity's.
+ * ---------------------------------------------------------------------------
+ */
+bool                   A_SetActiveClipID(const struct entity *ent, int clip_id, 
+                                         enum anim_mode mode, unsigned key_fps);
+
+/* ---------------------------------------------------------------------------
+ * 'A_GetState' reads the state of the entity's animation context and 
+ * 'A_SetState' puts it back, to continue playing the same frame of the same
+ * clip. The latter returns false, leaving the context as it was, if the clips
+ * or the frame are not the entity's.
+ * ---------------------------------------------------------------------------
+ */
+void                   A_GetState(const struct entity *ent, struct anim_state *out);
+bool                   A_SetState(const struct entity *ent, const struct anim_state *state);
+
 /* ---------------------------------------------------------------------------
  * If anim_mode is 'ANIM_MODE_ONCE', the entity will fire an 'EVENT_ANIM_FINISHED'
  * event and go back to playing the 'idle' animtion once the clip has played once. 
@@ -77,12 +124,30 @@ void                   A_SetActiveClip(const struct entity *ent, const char *nam
                                        enum anim_mode mode, unsigned key_fps);
 
 /* ---------------------------------------------------------------------------
- * Should be called once per render loop, prior to rendering. Will update OpenGL
- * state based on the current active clip and time.
+ * Should be called once per render loop, prior to rendering. Will set the pose
+ * that the entity's mesh will be drawn or submitted for drawing in, based on 
+ * the current active clip and time.
  * ---------------------------------------------------------------------------
  */
 void                   A_Update(const struct entity *ent);
 
+/* ---------------------------------------------------------------------------
+ * Like 'A_Update', but the pose is only evaluated 'hz' times a second. In 
+ * between, the entity is drawn in the pose that was last evaluated.
+ * ---------------------------------------------------------------------------
+ */
+void                   A_UpdateThrottled(const struct entity *ent, unsigned hz);
+
+/* ---------------------------------------------------------------------------
+ * A cheaper 'A_Update' for crowds of entities seen from afar. The active clip
+ * is baked into the renderer's palette the first time, after which setting 
+ * the pose only takes picking the frames. Returns false, without setting a 
+ * pose, for the clips played once (whose end must be caught by 'A_Update') 
+ * and for those which could not be baked.
+ * ---------------------------------------------------------------------------
+ */
+bool                   A_UpdateBaked(const struct entity *ent);
+
 /* ---------------------------------------------------------------------------
  * Simple utility to get a reference to the skeleton structure in its' default
  * bind pose. The skeleton structure shoould not be modified or freed.
@@ -122,11 +187,33 @@ size_t A_AL_CtxBuffSize(void);
 
 /* ---------------------------------------------------------------------------
  * Consumes lines of the stream and uses them to populate the private data, 
- * which is then returned in a malloc'd buffer.
+ * which is then returned in a buffer freed with 'A_AL_FreePrivate'. The 
+ * stream must be a text stream (see 'AL_OpenText').
  * ---------------------------------------------------------------------------
  */
 void  *A_AL_PrivFromStream(const struct pfobj_hdr *header, SDL_RWops *stream);
 
+/* ---------------------------------------------------------------------------
+ * Consumes the same lines as 'A_AL_PrivFromStream' and writes the resulting
+ * private data to 'out' as the animation section of a binary PFOBJ.
+ * ---------------------------------------------------------------------------
+ */
+bool   A_AL_WriteBinary(const struct pfobj_hdr *header, SDL_RWops *in, SDL_RWops *out);
+
+/* ---------------------------------------------------------------------------
+ * Creates the private data from an animation section written by 
+ * 'A_AL_WriteBinary', returning it in a buffer freed with 'A_AL_FreePrivate'.
+ * ---------------------------------------------------------------------------
+ */
+void  *A_AL_PrivFromBinary(const struct pfobj_hdr *header, const void *data, size_t size);
+
+/* ---------------------------------------------------------------------------
+ * Free the private data returned by 'A_AL_PrivFromStream' or 
+ * 'A_AL_PrivFromBinary'.
+ * ---------------------------------------------------------------------------
+ */
+void   A_AL_FreePrivate(void *priv_data);
+
 /* ---------------------------------------------------------------------------
  * Dumps private animation data in PF Object format.
  * ---------------------------------------------------------------------------
@@ -36,6 +36,12 @@
 #include "asset_load.h"
 #include "entity.h"
 
+#include "parallel.h"
+#include "hot_reload.h"
+#include "config.h"
+#include "mem.h"
+#include "perf.h"
+
 #include "render/public/render.h"
 #include "anim/public/anim.h"
 #include "map/public/map.h"
@@ -43,46 +49,129 @@
     #define __USE_POSIX /* strtok_r */
 #endif
 #include "lib/public/khash.h"
+#include "lib/public/str_map.h"
+#include "lib/public/file_replace.h"
 
 #include <SDL.h>
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h> 
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#define PFOBJB_MAGIC    (0x424f4650) /* 'PFOB' */
+/* Must be bumped whenever the layout of the file, or of any of the engine's
+ * structures that are stored just as they're held in memory, changes. */
+#define PFOBJB_VERSION  (5)
+
+#define FNV_OFFSET_BASIS (0xcbf29ce484222325ull)
+#define FNV_PRIME        (0x100000001b3ull)
+
+/* The header of a binary PFOBJ file. As with the other caches, everything
+ * is stored in the native byte order. The render and animation sections are
+ * aligned to BIN_SECTION_ALIGN bytes and their format is private to the 
+ * respective subsystems. */
+struct pfobjb_header{
+    uint32_t    magic;
+    uint32_t    version;
+    /* Files written by a build with a different pointer size are rejected, 
+     * as the structures they hold won't have the same layout */
+    uint32_t    ptr_size;
+    float       text_version;
+    uint32_t    num_verts;
+    uint32_t    num_joints;
+    uint32_t    num_materials;
+    uint32_t    num_as;
+    uint32_t    frame_counts[MAX_ANIM_SETS];
+    uint32_t    has_collision;
+    struct aabb aabb;
+    uint32_t    num_lods;
+    uint64_t    render_offset, render_size;
+    uint64_t    anim_offset, anim_size;
+};
+
+struct file_mapping{
+    const char *base;
+    size_t      size;
+};
 
+/* A stream in memory, growing as it is written to */
+struct mem_stream{
+    char   *data;
+    size_t  size;
+    size_t  cap;
+    size_t  pos;
+};
+
+struct al_preload{
+    struct preload_job *jobs;
+    size_t              num_jobs;
+};
 
+struct preload_job{
+    const char *base_path;
+    const char *pfobj_name;
+    /* The contents of the binary PFOBJ file, either read from disk or 
+     * converted from the text file */
+    char       *blob;
+    size_t      size;
+    /* The line of the text file that could not be converted, if any */
+    size_t      err_line;
+};
+
+/* Render or animation data, shared by all the loaded files whose section of 
+ * the binary PFOBJ holds the same bytes */
+struct shared_section{
+    uint64_t  hash;
+    /* The number of loaded files using the section */
+    unsigned  refcount;
+    void     *priv;
+};
+
+/* A loaded PFOBJ file. Its' text file is watched for hot reloading, with the
+ * resource as the user data. */
 struct shared_resource{
-    char         key[64];
-    uint32_t     ent_flags;
-    void        *render_private;
-    void        *anim_private;
-    struct aabb  aabb;
+    char                   base_path[128];
+    char                   pfobj_name[128];
+    uint32_t               ent_flags;
+    uint32_t               num_joints;
+    struct aabb            aabb;
+    struct shared_section *render;
+    struct shared_section *anim;
+    /* The number of entities created from the file. The resource is unloaded
+     * along with the last of them. */
+    unsigned               refcount;
 };
 
+/* Keyed by the path of the PFOBJ file. The table owns copies of the key 
+ * strings. */
+STRMAP_INIT(entity_res, struct shared_resource*)
+/* Keyed by the hash of the section's contents */
+KHASH_MAP_INIT_INT64(section, struct shared_section*)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-KHASH_MAP_INIT_STR(entity_res, struct shared_resource)
-khash_t(entity_res) *s_name_resource_table;
+static khash_t(entity_res) *s_resource_table;
+static khash_t(section)    *s_render_sections;
+static khash_t(section)    *s_anim_sections;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* A copy of the key string is stored in the 'struct shared_resource' itself. Make the key 
- * (string pointer) be a pointer to that buffer in order to avoid allocating/storing the key 
- * strings separately. All keys must be patched in case rehashing took place. */
-static void kh_update_str_keys(khash_t(entity_res) *table)
-{
-    for(khiter_t k = kh_begin(table); k != kh_end(table); k++) {
-        if(!kh_exist(table, k)) continue;
-        kh_key(table, k) = kh_value(table, k).key;
-    }
-}
-
 static bool al_parse_pfobj_header(SDL_RWops *stream, struct pfobj_hdr *out)
 {
     char line[MAX_LINE_LEN];
@@ -135,12 +224,694 @@ static bool al_parse_pfobj_header(SDL_RWops *stream, struct pfobj_hdr *out)
         goto fail;
     out->has_collision = tmp;
 
+    /* The level of detail meshes were added in version 1.1 */
+    out->num_lods = 0;
+    if(out->version >= 1.1f) {
+
+        READ_LINE(stream, line, fail);
+        if(!sscanf(line, "num_lods %d", &out->num_lods))
+            goto fail;
+        if(out->num_lods > MAX_LODS)
+            goto fail;
+    }
+
     return true;
 
 fail:
     return false;
 }
 
+static bool al_pfobj_path(const char *base_path, const char *pfobj_name, char *out, size_t size)
+{
+    if(strlen(base_path) + strlen(pfobj_name) + 1 >= size)
+        return false;
+
+    strcpy(out, base_path);
+    strcat(out, "/");
+    strcat(out, pfobj_name);
+    return true;
+}
+
+static uint64_t al_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static struct shared_section *al_section_get(khash_t(section) *table, uint64_t hash)
+{
+    khiter_t k = kh_get(section, table, hash);
+    if(k == kh_end(table))
+        return NULL;
+
+    struct shared_section *ret = kh_value(table, k);
+    ret->refcount++;
+    return ret;
+}
+
+static struct shared_section *al_section_add(khash_t(section) *table, uint64_t hash, void *priv)
+{
+    struct shared_section *ret = malloc(sizeof(struct shared_section));
+    if(!ret)
+        return NULL;
+
+    int status;
+    khiter_t k = kh_put(section, table, hash, &status);
+    if(status == -1) {
+        free(ret);
+        return NULL;
+    }
+    assert(status != 0);
+
+    *ret = (struct shared_section){
+        .hash = hash,
+        .refcount = 1,
+        .priv = priv,
+    };
+    kh_value(table, k) = ret;
+    return ret;
+}
+
+/* A section that was reloaded in place is filed under the hash of its' new 
+ * contents. If another section already holds the same contents, this one 
+ * can no longer be found, but stays in use until it is released. */
+static void al_section_rehash(khash_t(section) *table, struct shared_section *sec, uint64_t hash)
+{
+    khiter_t k = kh_get(section, table, sec->hash);
+    if(k != kh_end(table) && kh_value(table, k) == sec)
+        kh_del(section, table, k);
+
+    int status;
+    sec->hash = hash;
+    k = kh_put(section, table, hash, &status);
+    if(status > 0)
+        kh_value(table, k) = sec;
+}
+
+static void al_section_release(khash_t(section) *table, struct shared_section *sec, 
+                               void (*free_priv)(void*))
+{
+    assert(sec->refcount > 0);
+    if(--sec->refcount > 0)
+        return;
+
+    khiter_t k = kh_get(section, table, sec->hash);
+    if(k != kh_end(table) && kh_value(table, k) == sec)
+        kh_del(section, table, k);
+
+    free_priv(sec->priv);
+    free(sec);
+}
+
+/* The binary variant is named after the PFOBJ file, with the extension 
+ * replaced */
+static bool al_binary_path(const char *pfobj_path, char *out, size_t size)
+{
+    if(strlen(pfobj_path) + sizeof(".pfobjb") > size)
+        return false;
+
+    strcpy(out, pfobj_path);
+    char *ext = strrchr(out, '.');
+    if(ext && !strchr(ext, '/'))
+        *ext = '\0';
+    strcat(out, ".pfobjb");
+    return true;
+}
+
+/* The binary file is out of date when the text file has been modified since
+ * it was written. It's fine for only the binary file to be present. */
+static bool al_binary_up_to_date(const char *pfobj_path, const char *bin_path)
+{
+    struct stat text_stat, bin_stat;
+    if(stat(bin_path, &bin_stat))
+        return false;
+    if(stat(pfobj_path, &text_stat))
+        return true;
+    return (bin_stat.st_mtime >= text_stat.st_mtime);
+}
+
+static bool al_map_file(const char *path, struct file_mapping *out)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        goto fail_open;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+        goto fail_size;
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(!mapping)
+        goto fail_size;
+
+    /* The view keeps the file mapped after the handles are closed */
+    out->base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    out->size = size.QuadPart;
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return (out->base != NULL);
+
+fail_size:
+    CloseHandle(file);
+fail_open:
+    return false;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        goto fail_open;
+
+    struct stat st;
+    if(fstat(fd, &st) || st.st_size == 0)
+        goto fail_size;
+
+    /* The mapping stays valid after the descriptor is closed */
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(base == MAP_FAILED)
+        goto fail_size;
+    close(fd);
+
+    out->base = base;
+    out->size = st.st_size;
+    return true;
+
+fail_size:
+    close(fd);
+fail_open:
+    return false;
+#endif
+}
+
+static void al_unmap_file(struct file_mapping *map)
+{
+#if defined(_WIN32)
+    UnmapViewOfFile(map->base);
+#else
+    munmap((void*)map->base, map->size);
+#endif
+}
+
+static bool al_section_valid(size_t file_size, uint64_t offset, uint64_t size)
+{
+    return (offset % BIN_SECTION_ALIGN == 0)
+        && (offset <= file_size)
+        && (size <= file_size - offset);
+}
+
+/* Returns the header of the binary file if it can be loaded by this build */
+static const struct pfobjb_header *al_binary_header(const char *base, size_t size)
+{
+    const struct pfobjb_header *bhdr = (const void*)base;
+    if(size < sizeof(*bhdr)
+    || bhdr->magic != PFOBJB_MAGIC
+    || bhdr->version != PFOBJB_VERSION
+    || bhdr->ptr_size != sizeof(void*)
+    || bhdr->num_as > MAX_ANIM_SETS
+    || bhdr->num_lods > MAX_LODS
+    || !bhdr->has_collision
+    || !al_section_valid(size, bhdr->render_offset, bhdr->render_size)
+    || !al_section_valid(size, bhdr->anim_offset, bhdr->anim_size))
+        return NULL;
+    return bhdr;
+}
+
+static void al_header_from_binary(const struct pfobjb_header *bhdr, struct pfobj_hdr *out)
+{
+    *out = (struct pfobj_hdr){
+        .version       = bhdr->text_version,
+        .num_verts     = bhdr->num_verts,
+        .num_joints    = bhdr->num_joints,
+        .num_materials = bhdr->num_materials,
+        .num_as        = bhdr->num_as,
+        .num_lods      = bhdr->num_lods,
+        .has_collision = true,
+    };
+    for(int i = 0; i < bhdr->num_as; i++) {
+        out->frame_counts[i] = bhdr->frame_counts[i];
+    }
+}
+
+/* The subsystems read their sections according to the counts in the header,
+ * so those are hashed along with the section */
+static uint64_t al_section_hash(const struct pfobjb_header *bhdr, const char *section, size_t size)
+{
+    const uint32_t counts[] = {bhdr->num_verts, bhdr->num_joints, bhdr->num_materials, bhdr->num_as,
+                               bhdr->num_lods};
+    uint64_t ret = al_hash(FNV_OFFSET_BASIS, counts, sizeof(counts));
+    ret = al_hash(ret, bhdr->frame_counts, sizeof(bhdr->frame_counts));
+    return al_hash(ret, section, size);
+}
+
+/* The vertex and index data is uploaded straight from the file contents at
+ * 'base', and the rest is copied out with as little processing as possible. 
+ * Sections holding the same bytes as those of an already loaded file are 
+ * shared with it instead. 'base' must be aligned to BIN_SECTION_ALIGN. */
+static bool al_load_pfobj_blob(const char *base, size_t size, struct shared_resource *out)
+{
+    const struct pfobjb_header *bhdr = al_binary_header(base, size);
+    if(!bhdr)
+        return false;
+
+    struct pfobj_hdr header;
+    al_header_from_binary(bhdr, &header);
+
+    out->ent_flags = ENTITY_FLAG_COLLISION;
+    out->num_joints = header.num_joints;
+    if(header.num_as > 0) {
+        out->ent_flags |= ENTITY_FLAG_ANIMATED;
+    }
+    out->aabb = bhdr->aabb;
+
+    const char *render = base + bhdr->render_offset;
+    uint64_t render_hash = al_section_hash(bhdr, render, bhdr->render_size);
+
+    if(!(out->render = al_section_get(s_render_sections, render_hash))) {
+
+        void *priv = R_AL_PrivFromBinary(out->base_path, &header, render, bhdr->render_size);
+        if(!priv)
+            goto fail_render;
+
+        if(!(out->render = al_section_add(s_render_sections, render_hash, priv))) {
+            R_AL_FreePrivate(priv);
+            goto fail_render;
+        }
+    }
+
+    const char *anim = base + bhdr->anim_offset;
+    uint64_t anim_hash = al_section_hash(bhdr, anim, bhdr->anim_size);
+
+    if(!(out->anim = al_section_get(s_anim_sections, anim_hash))) {
+
+        void *priv = A_AL_PrivFromBinary(&header, anim, bhdr->anim_size);
+        if(!priv)
+            goto fail_anim;
+
+        if(!(out->anim = al_section_add(s_anim_sections, anim_hash, priv))) {
+            A_AL_FreePrivate(priv);
+            goto fail_anim;
+        }
+    }
+    return true;
+
+fail_anim:
+    al_section_release(s_render_sections, out->render, R_AL_FreePrivate);
+fail_render:
+    return false;
+}
+
+static void al_release_sections(struct shared_resource *res)
+{
+    al_section_release(s_render_sections, res->render, R_AL_FreePrivate);
+    al_section_release(s_anim_sections, res->anim, A_AL_FreePrivate);
+}
+
+/*
+ * Binary PFOBJ file layout:
+ *
+ *  +---------------------------------+ <-- base
+ *  | struct pfobjb_header[1]         |
+ *  +---------------------------------+ <-- base + render_offset (aligned)
+ *  | render section                  |
+ *  +---------------------------------+ <-- base + anim_offset (aligned)
+ *  | animation section               |
+ *  +---------------------------------+
+ *
+ */
+
+static bool al_convert_stream(SDL_RWops *in, SDL_RWops *out)
+{
+    struct pfobj_hdr header;
+    if(!al_parse_pfobj_header(in, &header) || !header.has_collision)
+        return false;
+
+    struct pfobjb_header bhdr = (struct pfobjb_header){
+        .magic         = PFOBJB_MAGIC,
+        .version       = PFOBJB_VERSION,
+        .ptr_size      = sizeof(void*),
+        .text_version  = header.version,
+        .num_verts     = header.num_verts,
+        .num_joints    = header.num_joints,
+        .num_materials = header.num_materials,
+        .num_as        = header.num_as,
+        .num_lods      = header.num_lods,
+        .has_collision = header.has_collision,
+    };
+    for(int i = 0; i < header.num_as; i++) {
+        bhdr.frame_counts[i] = header.frame_counts[i];
+    }
+
+    /* The header is written again once the sections are in place */
+    if(!AL_WriteBytes(out, &bhdr, sizeof(bhdr))
+    || !AL_WritePadding(out, BIN_ALIGN_UP(sizeof(bhdr)) - sizeof(bhdr)))
+        return false;
+
+    bhdr.render_offset = SDL_RWtell(out);
+    if(!R_AL_WriteBinary(&header, in, out))
+        return false;
+    bhdr.render_size = SDL_RWtell(out) - bhdr.render_offset;
+
+    if(!AL_WritePadding(out, BIN_ALIGN_UP(bhdr.render_offset + bhdr.render_size) 
+                           - (bhdr.render_offset + bhdr.render_size)))
+        return false;
+
+    bhdr.anim_offset = SDL_RWtell(out);
+    if(!A_AL_WriteBinary(&header, in, out))
+        return false;
+    bhdr.anim_size = SDL_RWtell(out) - bhdr.anim_offset;
+
+    if(!AL_ParseAABB(in, &bhdr.aabb))
+        return false;
+
+    Sint64 end = SDL_RWtell(out);
+    return (SDL_RWseek(out, 0, RW_SEEK_SET) == 0)
+        && AL_WriteBytes(out, &bhdr, sizeof(bhdr))
+        && (SDL_RWseek(out, end, RW_SEEK_SET) == end);
+}
+
+static Sint64 al_mem_size(SDL_RWops *ctx)
+{
+    struct mem_stream *ms = ctx->hidden.unknown.data1;
+    return ms->size;
+}
+
+static Sint64 al_mem_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    struct mem_stream *ms = ctx->hidden.unknown.data1;
+    Sint64 pos;
+
+    switch(whence) {
+    case RW_SEEK_SET: pos = offset;            break;
+    case RW_SEEK_CUR: pos = ms->pos + offset;  break;
+    case RW_SEEK_END: pos = ms->size + offset; break;
+    default:          return -1;
+    }
+
+    if(pos < 0 || pos > ms->size)
+        return -1;
+    ms->pos = pos;
+    return pos;
+}
+
+static size_t al_mem_read(SDL_RWops *ctx, void *ptr, size_t size, size_t num)
+{
+    struct mem_stream *ms = ctx->hidden.unknown.data1;
+    size_t avail = (ms->size - ms->pos) / (size ? size : 1);
+    num = num < avail ? num : avail;
+
+    memcpy(ptr, ms->data + ms->pos, size * num);
+    ms->pos += size * num;
+    return num;
+}
+
+static size_t al_mem_write(SDL_RWops *ctx, const void *ptr, size_t size, size_t num)
+{
+    struct mem_stream *ms = ctx->hidden.unknown.data1;
+    size_t end = ms->pos + size * num;
+
+    if(end > ms->cap) {
+
+        size_t new_cap = ms->cap ? ms->cap : 4096;
+        while(new_cap < end)
+            new_cap *= 2;
+
+        char *new_data = realloc(ms->data, new_cap);
+        if(!new_data)
+            return 0;
+        ms->data = new_data;
+        ms->cap = new_cap;
+    }
+
+    memcpy(ms->data + ms->pos, ptr, size * num);
+    ms->pos = end;
+    ms->size = end > ms->size ? end : ms->size;
+    return num;
+}
+
+/* Leaves the data with the 'struct mem_stream' */
+static int al_mem_close(SDL_RWops *ctx)
+{
+    SDL_FreeRW(ctx);
+    return 0;
+}
+
+static SDL_RWops *al_mem_stream_open(struct mem_stream *ms)
+{
+    SDL_RWops *ret = SDL_AllocRW();
+    if(!ret)
+        return NULL;
+
+    *ms = (struct mem_stream){0};
+    ret->type = SDL_RWOPS_UNKNOWN;
+    ret->size = al_mem_size;
+    ret->seek = al_mem_seek;
+    ret->read = al_mem_read;
+    ret->write = al_mem_write;
+    ret->close = al_mem_close;
+    ret->hidden.unknown.data1 = ms;
+    return ret;
+}
+
+static char *al_read_file(const char *path, size_t *out_size)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        goto fail_open;
+
+    Sint64 size = SDL_RWsize(stream);
+    if(size <= 0)
+        goto fail_read;
+
+    char *ret = malloc(size);
+    if(!ret)
+        goto fail_read;
+
+    if(1 != SDL_RWread(stream, ret, size, 1)) {
+        free(ret);
+        goto fail_read;
+    }
+
+    SDL_RWclose(stream);
+    *out_size = size;
+    return ret;
+
+fail_read:
+    SDL_RWclose(stream);
+fail_open:
+    return NULL;
+}
+
+/* Parses the text file and converts it to the binary format in memory. On 
+ * failure, the line that couldn't be parsed is written to 'out_err_line'. */
+static char *al_convert_text(const char *pfobj_path, size_t *out_size, size_t *out_err_line)
+{
+    *out_err_line = 0;
+
+    SDL_RWops *in = AL_OpenText(pfobj_path);
+    if(!in)
+        return NULL;
+
+    char *ret = NULL;
+    struct mem_stream ms = {0};
+    SDL_RWops *out = al_mem_stream_open(&ms);
+
+    if(out && al_convert_stream(in, out)) {
+        ret = ms.data;
+        *out_size = ms.size;
+    }else{
+        free(ms.data);
+        *out_err_line = AL_LineNumber(in);
+    }
+
+    if(out)
+        SDL_RWclose(out);
+    SDL_RWclose(in);
+    return ret;
+}
+
+/* Runs on the pool threads. Everything short of creating the GL objects is
+ * done here: the file is read and, if there's no up-to-date binary variant,
+ * the text is parsed and converted to the binary format in memory. */
+static void al_preload_read(void *arg, size_t idx)
+{
+    struct preload_job *job = &((struct preload_job*)arg)[idx];
+    job->blob = NULL;
+    job->err_line = 0;
+
+    char pfobj_path[128];
+    char bin_path[sizeof(pfobj_path) + sizeof(".pfobjb")];
+    if(!al_pfobj_path(job->base_path, job->pfobj_name, pfobj_path, sizeof(pfobj_path))
+    || !al_binary_path(pfobj_path, bin_path, sizeof(bin_path)))
+        return;
+
+    if(al_binary_up_to_date(pfobj_path, bin_path)) {
+
+        job->blob = al_read_file(bin_path, &job->size);
+        if(job->blob && al_binary_header(job->blob, job->size))
+            return;
+
+        free(job->blob);
+        job->blob = NULL;
+    }
+
+    job->blob = al_convert_text(pfobj_path, &job->size, &job->err_line);
+}
+
+static void al_hr_free(void *data)
+{
+    struct preload_job *job = data;
+    free(job->blob);
+    free(job);
+}
+
+/* Runs on the hot reloading thread, the same way as on the pool threads when
+ * preloading */
+static void *al_hr_load(void *user, const char *path)
+{
+    struct shared_resource *res = user;
+
+    struct preload_job *job = malloc(sizeof(struct preload_job));
+    if(!job)
+        return NULL;
+
+    *job = (struct preload_job){
+        .base_path  = res->base_path,
+        .pfobj_name = res->pfobj_name,
+    };
+    al_preload_read(job, 0);
+
+    if(!job->blob) {
+        free(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* The entities that were created from the file share its' render data, which
+ * is replaced in place - along with that of the other files that held the 
+ * same model. The entities also hold on to the animation data, so only the 
+ * meshes and materials of models that have the same skeleton are reloaded. */
+static bool al_hr_apply(void *user, void *data)
+{
+    struct shared_resource *res = user;
+    struct preload_job *job = data;
+    bool ret = false;
+
+    const struct pfobjb_header *bhdr = al_binary_header(job->blob, job->size);
+    if(!bhdr)
+        goto out;
+
+    if(bhdr->num_joints != res->num_joints) {
+        fprintf(stderr, "The skeleton of '%s' changed. It can't be reloaded.\n", res->pfobj_name);
+        goto out;
+    }
+
+    struct pfobj_hdr header;
+    al_header_from_binary(bhdr, &header);
+
+    const char *render = job->blob + bhdr->render_offset;
+    void *priv = R_AL_PrivFromBinary(res->base_path, &header, render, bhdr->render_size);
+    if(!priv)
+        goto out;
+
+    ret = R_AL_ReplacePrivate(res->render->priv, priv);
+    if(ret) {
+        al_section_rehash(s_render_sections, res->render, 
+            al_section_hash(bhdr, render, bhdr->render_size));
+    }
+
+out:
+    al_hr_free(job);
+    return ret;
+}
+
+static struct shared_resource *al_add_resource(const char *base_path, const char *pfobj_name,
+                                               const char *blob, size_t size)
+{
+    struct shared_resource *res = malloc(sizeof(struct shared_resource));
+    if(!res)
+        goto fail_alloc;
+
+    char pfobj_path[128];
+    if(strlen(base_path) >= sizeof(res->base_path)
+    || strlen(pfobj_name) >= sizeof(res->pfobj_name)
+    || !al_pfobj_path(base_path, pfobj_name, pfobj_path, sizeof(pfobj_path)))
+        goto fail_load;
+
+    strcpy(res->base_path, base_path);
+    strcpy(res->pfobj_name, pfobj_name);
+    res->refcount = 0;
+
+    if(!al_load_pfobj_blob(blob, size, res))
+        goto fail_load;
+
+    int status;
+    khiter_t k = strmap_put(entity_res, s_resource_table, pfobj_path, &status);
+    if(status == -1)
+        goto fail_put;
+    assert(status != 0);
+    kh_value(s_resource_table, k) = res;
+
+    if(CONFIG_HOT_RELOAD)
+        HR_Watch(pfobj_path, al_hr_load, al_hr_apply, al_hr_free, res);
+    return res;
+
+fail_put:
+    al_release_sections(res);
+fail_load:
+    free(res);
+fail_alloc:
+    return NULL;
+}
+
+static void al_unload_resource(khiter_t k)
+{
+    struct shared_resource *res = kh_value(s_resource_table, k);
+
+    HR_Unwatch(res);
+    al_release_sections(res);
+
+    strmap_del(entity_res, s_resource_table, k);
+    free(res);
+}
+
+/* The binary variant is used when it is up to date. Otherwise, the text file
+ * is converted in memory first. */
+static struct shared_resource *al_load_resource(const char *base_path, const char *pfobj_name)
+{
+    char pfobj_path[128];
+    char bin_path[sizeof(pfobj_path) + sizeof(".pfobjb")];
+    if(!al_pfobj_path(base_path, pfobj_name, pfobj_path, sizeof(pfobj_path))
+    || !al_binary_path(pfobj_path, bin_path, sizeof(bin_path)))
+        return NULL;
+
+    struct shared_resource *ret = NULL;
+    struct file_mapping map;
+
+    if(al_binary_up_to_date(pfobj_path, bin_path) && al_map_file(bin_path, &map)) {
+
+        ret = al_add_resource(base_path, pfobj_name, map.base, map.size);
+        al_unmap_file(&map);
+        if(ret)
+            return ret;
+    }
+
+    size_t size, err_line;
+    char *blob = al_convert_text(pfobj_path, &size, &err_line);
+    if(blob) {
+        ret = al_add_resource(base_path, pfobj_name, blob, size);
+        free(blob);
+    }
+
+    if(!ret)
+        fprintf(stderr, "%s:%zu: Failed to load PFOBJ file.\n", pfobj_path, err_line);
+    return ret;
+}
+
 static bool al_parse_pfmap_header(SDL_RWops *stream, struct pfmap_hdr *out)
 {
     char line[MAX_LINE_LEN];
@@ -163,7 +934,8 @@ fail:
     return false;
 }
 
-static struct map *al_map_from_stream(const char *base_path, SDL_RWops *stream)
+static struct map *al_map_from_stream(const char *base_path, const char *cache_path, 
+                                      SDL_RWops *stream)
 {
     struct map *ret;
     struct pfmap_hdr header;
@@ -171,33 +943,144 @@ static struct map *al_map_from_stream(const char *base_path, SDL_RWops *stream)
     if(!al_parse_pfmap_header(stream, &header))
         goto fail_parse;
 
-    ret = malloc(M_AL_BuffSizeFromHeader(&header));
+    ret = MEM_Malloc(MEM_TAG_MAP, M_AL_BuffSizeFromHeader(&header));
     if(!ret)
         goto fail_alloc;
 
-    if(!M_AL_InitMapFromStream(&header, base_path, stream, ret))
+    if(!M_AL_InitMapFromStream(&header, base_path, cache_path, stream, ret))
         goto fail_init;
 
     return ret;
 
 fail_init:
-    free(ret);
+    MEM_Free(ret);
 fail_alloc:
 fail_parse:
     return NULL;
 }
 
+static struct map *al_map_from_binary(const char *base_path, const char *cache_path, 
+                                      const char *bin_path)
+{
+    struct map *ret = NULL;
+    struct pfmap_hdr header;
+
+    struct file_mapping file;
+    if(!al_map_file(bin_path, &file))
+        return NULL;
+
+    if(!M_AL_HeaderFromBinary(file.base, file.size, &header))
+        goto out;
+
+    ret = MEM_Malloc(MEM_TAG_MAP, M_AL_BuffSizeFromHeader(&header));
+    if(!ret)
+        goto out;
+
+    if(!M_AL_InitMapFromBinary(&header, base_path, cache_path, file.base, ret)) {
+        MEM_Free(ret);
+        ret = NULL;
+    }
+
+out:
+    al_unmap_file(&file);
+    return ret;
+}
+
+static size_t al_preload_jobs(size_t count, const char *const base_paths[], 
+                              const char *const pfobj_names[], bool skip_loaded,
+                              struct preload_job *out)
+{
+    size_t num_jobs = 0;
+    for(int i = 0; i < count; i++) {
+
+        char pfobj_path[128];
+        if(!al_pfobj_path(base_paths[i], pfobj_names[i], pfobj_path, sizeof(pfobj_path)))
+            continue;
+        if(skip_loaded && kh_get(entity_res, s_resource_table, pfobj_path) != kh_end(s_resource_table))
+            continue;
+
+        bool dup = false;
+        for(int j = 0; !dup && j < num_jobs; j++) {
+            dup = (0 == strcmp(out[j].pfobj_name, pfobj_names[i]))
+               && (0 == strcmp(out[j].base_path, base_paths[i]));
+        }
+        if(dup)
+            continue;
+
+        out[num_jobs++] = (struct preload_job){
+            .base_path  = base_paths[i],
+            .pfobj_name = pfobj_names[i],
+        };
+    }
+    return num_jobs;
+}
+
+/* The GL objects can only be created on the main thread. Files that failed
+ * to load are left for 'AL_EntityFromPFObj' to report. */
+static void al_preload_commit(struct preload_job *jobs, size_t num_jobs)
+{
+    for(int i = 0; i < num_jobs; i++) {
+
+        char pfobj_path[128];
+        if(jobs[i].blob
+        && al_pfobj_path(jobs[i].base_path, jobs[i].pfobj_name, pfobj_path, sizeof(pfobj_path))
+        && kh_get(entity_res, s_resource_table, pfobj_path) == kh_end(s_resource_table))
+            al_add_resource(jobs[i].base_path, jobs[i].pfobj_name, jobs[i].blob, jobs[i].size);
+        free(jobs[i].blob);
+    }
+}
+
+static struct map *al_map_from_pfmap(const char *base_path, const char *pfmap_name)
+{
+    struct map *ret;
+    SDL_RWops *stream;
+
+    char pfmap_path[128];
+    assert( strlen(base_path) + strlen(pfmap_name) + 1 < sizeof(pfmap_path) );
+    strcpy(pfmap_path, base_path);
+    strcat(pfmap_path, "/");
+    strcat(pfmap_path, pfmap_name);
+
+    /* The binary map, navigation data and baked texture caches are kept 
+     * alongside the map, named after it with the extension stripped */
+    char cache_path[sizeof(pfmap_path)];
+    strcpy(cache_path, pfmap_path);
+    char *ext = strrchr(cache_path, '.');
+    if(ext && !strchr(ext, '/'))
+        *ext = '\0';
+
+    char bin_path[sizeof(cache_path) + sizeof(".pfmapb")];
+    sprintf(bin_path, "%s.pfmapb", cache_path);
+
+    if(al_binary_up_to_date(pfmap_path, bin_path)
+    && (ret = al_map_from_binary(base_path, cache_path, bin_path)))
+        return ret;
+
+    stream = AL_OpenText(pfmap_path);
+    if(!stream)
+        goto fail_open;
+
+    ret = al_map_from_stream(base_path, cache_path, stream);
+    if(!ret)
+        goto fail_parse;
+
+    SDL_RWclose(stream);
+    return ret;
+
+fail_parse:
+    fprintf(stderr, "%s:%zu: Failed to load PFMAP file.\n", pfmap_path, AL_LineNumber(stream));
+    SDL_RWclose(stream);
+fail_open:
+    return NULL;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 struct entity *AL_EntityFromPFObj(const char *base_path, const char *pfobj_name, const char *name)
 {
-    struct shared_resource res;
-    SDL_RWops *stream;
-
-    size_t alloc_size = sizeof(struct entity) + A_AL_CtxBuffSize();
-    struct entity *ret = malloc(alloc_size);
+    struct entity *ret = Entity_PoolAlloc();
     if(!ret)
         goto fail_alloc;
 
@@ -205,131 +1088,179 @@ struct entity *AL_EntityFromPFObj(const char *base_path, const char *pfobj_name,
     ret->scale =    (vec3_t){1.0f, 1.0f, 1.0f};
     ret->pos =      (vec3_t){1.0f, 1.0f, 1.0f};
     ret->rotation = (quat_t){0.0f, 0.0f, 0.0f, 1.0f};
+    ret->prev_pos = ret->pos;
+    ret->prev_rotation = ret->rotation;
+    ret->transform_dirty = true;
+    ret->obb_cache_aabb = NULL;
     ret->selection_radius = 0.0f;
     ret->max_speed = 0.0f;
     ret->anim_ctx = (void*)(ret + 1);
 
     if(strlen(name) >= sizeof(ret->name))
-        return NULL;
-    strcpy(ret->name, name);
-
-    if(strlen(name) >= sizeof(ret->name))
-        return NULL;
+        goto fail_name;
     strcpy(ret->name, name);
 
     if(strlen(pfobj_name) >= sizeof(ret->filename))
-        return NULL;
+        goto fail_name;
     strcpy(ret->filename, pfobj_name);
 
     assert(strlen(base_path) < sizeof(ret->basedir));
     strcpy(ret->basedir, base_path);
-    strcpy(res.key, pfobj_name);
 
-    khiter_t k = kh_get(entity_res, s_name_resource_table, pfobj_name);
-    if(k != kh_end(s_name_resource_table)) {
+    char pfobj_path[128];
+    if(!al_pfobj_path(base_path, pfobj_name, pfobj_path, sizeof(pfobj_path)))
+        goto fail_name;
 
-        res = kh_value(s_name_resource_table, k);
-    }else{
-
-        struct pfobj_hdr header;
-
-        char pfobj_path[128];
-        assert( strlen(base_path) + strlen(pfobj_name) + 1 < sizeof(pfobj_path) );
-        strcpy(pfobj_path, base_path);
-        strcat(pfobj_path, "/");
-        strcat(pfobj_path, pfobj_name);
-
-        stream = SDL_RWFromFile(pfobj_path, "r");
-        if(!stream)
-            goto fail_stream; 
-
-        if(!al_parse_pfobj_header(stream, &header))
-            goto fail_parse;
-
-        res.ent_flags = 0;
-        res.render_private = R_AL_PrivFromStream(base_path, &header, stream);
-        if(!res.render_private)
-            goto fail_parse;
-
-        res.anim_private = A_AL_PrivFromStream(&header, stream);
-        if(!res.anim_private)
-            goto fail_parse;
-
-        /* Entities with no animation sets are considered static. */
-        if(header.num_as > 0) {
-            res.ent_flags |= ENTITY_FLAG_ANIMATED;
-        }
+    struct shared_resource *res;
+    khiter_t k = kh_get(entity_res, s_resource_table, pfobj_path);
 
-        if(!header.has_collision) {
-            fprintf(stderr, "Imported entities required to have bounding boxes.\n");
-            goto fail_parse;
-        }
-
-        res.ent_flags |= ENTITY_FLAG_COLLISION;
-        if(!AL_ParseAABB(stream, &res.aabb))
-            goto fail_parse;
-
-        SDL_RWclose(stream);
-
-        int put_ret;
-        k = kh_put(entity_res, s_name_resource_table, pfobj_name, &put_ret);
-        assert(put_ret != -1 && put_ret != 0);
-        kh_value(s_name_resource_table, k) = res;
-        kh_update_str_keys(s_name_resource_table);
+    if(k != kh_end(s_resource_table)) {
+        res = kh_value(s_resource_table, k);
+    }else{
+        /* Only the loads of new resources are worth tracing */
+        Perf_StartupPush(__func__, pfobj_path);
+        res = al_load_resource(base_path, pfobj_name);
+        Perf_StartupPop();
+        if(!res)
+            goto fail_load;
     }
 
-    ret->flags |= res.ent_flags;
-    ret->render_private = res.render_private;
-    ret->anim_private = res.anim_private;
-    ret->identity_aabb = res.aabb;
-    ret->uid = Entity_NewUID();
+    res->refcount++;
+    ret->flags |= res->ent_flags;
+    ret->render_private = res->render->priv;
+    ret->anim_private = res->anim->priv;
+    ret->identity_aabb = res->aabb;
     return ret;
 
-fail_parse:
-    SDL_RWclose(stream);
-fail_stream:
-    free(ret);
+fail_load:
+fail_name:
+    Entity_PoolFree(ret);
 fail_alloc:
     return NULL;
 }
 
 void AL_EntityFree(struct entity *entity)
 {
-    free(entity);
+    char pfobj_path[128];
+    khiter_t k = kh_end(s_resource_table);
+    if(al_pfobj_path(entity->basedir, entity->filename, pfobj_path, sizeof(pfobj_path)))
+        k = kh_get(entity_res, s_resource_table, pfobj_path);
+    assert(k != kh_end(s_resource_table));
+
+    Entity_PoolFree(entity);
+    if(k == kh_end(s_resource_table))
+        return;
+
+    struct shared_resource *res = kh_value(s_resource_table, k);
+    assert(res->refcount > 0);
+    if(--res->refcount == 0)
+        al_unload_resource(k);
 }
 
-struct map *AL_MapFromPFMap(const char *base_path, const char *pfmap_name)
+bool AL_ConvertPFObj(const char *base_path, const char *pfobj_name)
 {
-    struct map *ret;
-    SDL_RWops *stream;
+    char pfobj_path[128];
+    if(!al_pfobj_path(base_path, pfobj_name, pfobj_path, sizeof(pfobj_path)))
+        goto fail_path;
+
+    char bin_path[sizeof(pfobj_path) + sizeof(".pfobjb")];
+    char tmp_path[sizeof(bin_path) + sizeof(".tmp")];
+    if(!al_binary_path(pfobj_path, bin_path, sizeof(bin_path)))
+        goto fail_path;
+    sprintf(tmp_path, "%s.tmp", bin_path);
+
+    SDL_RWops *in = AL_OpenText(pfobj_path);
+    if(!in)
+        goto fail_path;
+
+    /* Write to a temporary file first, so that a partially written file 
+     * never replaces a good one */
+    SDL_RWops *out = SDL_RWFromFile(tmp_path, "wb");
+    if(!out)
+        goto fail_out;
+
+    bool ret = al_convert_stream(in, out);
+    ret = (0 == SDL_RWclose(out)) && ret;
+    SDL_RWclose(in);
+
+    return file_replace(bin_path, tmp_path, ret);
+
+fail_out:
+    SDL_RWclose(in);
+fail_path:
+    return false;
+}
 
-    char pfmap_path[128];
-    assert( strlen(base_path) + strlen(pfmap_name) + 1 < sizeof(pfmap_path) );
-    strcpy(pfmap_path, base_path);
-    strcat(pfmap_path, "/");
-    strcat(pfmap_path, pfmap_name);
+void AL_PreloadPFObjs(size_t count, const char *const base_paths[], const char *const pfobj_names[])
+{
+    struct preload_job *jobs = malloc((count + 1) * sizeof(struct preload_job));
+    if(!jobs)
+        return;
+
+    size_t num_jobs = al_preload_jobs(count, base_paths, pfobj_names, true, jobs);
+    PL_For(num_jobs, al_preload_read, jobs);
+    al_preload_commit(jobs, num_jobs);
+    free(jobs);
+}
 
-    stream = SDL_RWFromFile(pfmap_path, "r");
-    ret = al_map_from_stream(base_path, stream);
+struct al_preload *AL_PreloadRead(size_t count, const char *const base_paths[], 
+                                  const char *const pfobj_names[])
+{
+    struct al_preload *ret = malloc(sizeof(struct al_preload));
     if(!ret)
-        goto fail_parse;
+        goto fail_alloc;
+
+    ret->jobs = malloc((count + 1) * sizeof(struct preload_job));
+    if(!ret->jobs)
+        goto fail_jobs;
+
+    /* The resource table belongs to the main thread, so files that are 
+     * already loaded are only skipped once the preload is committed */
+    ret->num_jobs = al_preload_jobs(count, base_paths, pfobj_names, false, ret->jobs);
+    for(int i = 0; i < ret->num_jobs; i++)
+        al_preload_read(ret->jobs, i);
 
-    SDL_RWclose(stream);
     return ret;
 
-fail_parse:
-    SDL_RWclose(stream);
-fail_open:
+fail_jobs:
+    free(ret);
+fail_alloc:
     return NULL;
 }
 
+void AL_PreloadCommit(struct al_preload *preload)
+{
+    al_preload_commit(preload->jobs, preload->num_jobs);
+    free(preload->jobs);
+    free(preload);
+}
+
+void AL_PreloadFree(struct al_preload *preload)
+{
+    for(int i = 0; i < preload->num_jobs; i++)
+        free(preload->jobs[i].blob);
+    free(preload->jobs);
+    free(preload);
+}
+
+struct map *AL_MapFromPFMap(const char *base_path, const char *pfmap_name)
+{
+    Perf_StartupPush(__func__, pfmap_name);
+    struct map *ret = al_map_from_pfmap(base_path, pfmap_name);
+    Perf_StartupPop();
+    return ret;
+}
+
 struct map *AL_MapFromPFMapString(const char *str)
 {
     struct map *ret;
     SDL_RWops *stream;
 
-    stream = SDL_RWFromConstMem(str, strlen(str));
-    ret = al_map_from_stream(NULL, stream);
+    stream = AL_TextStream(SDL_RWFromConstMem(str, strlen(str)));
+    if(!stream)
+        goto fail_open;
+
+    ret = al_map_from_stream(NULL, NULL, stream);
     if(!ret)
         goto fail_parse;
 
@@ -345,27 +1276,28 @@ fail_open:
 void AL_MapFree(struct map *map)
 {
     M_AL_FreePrivate(map);
-    free(map);
+    MEM_Free(map);
 }
 
-bool AL_ReadLine(SDL_RWops *stream, char *outbuff)
+bool AL_WriteBytes(SDL_RWops *stream, const void *data, size_t size)
 {
-    bool done = false;
-    int idx = 0;
-    do {
-         
-        if(!SDL_RWread(stream, outbuff + idx, 1, 1))
-            return false; 
+    if(size == 0)
+        return true;
+    return (1 == SDL_RWwrite(stream, data, size, 1));
+}
 
-        if(outbuff[idx] == '\n') {
-            outbuff[++idx] = '\0';
-            return true;
-        }
-        
-        idx++; 
-    }while(idx < MAX_LINE_LEN);
+bool AL_WritePadding(SDL_RWops *stream, size_t size)
+{
+    static const char zeros[BIN_SECTION_ALIGN] = {0};
+    assert(size < sizeof(zeros));
+    return AL_WriteBytes(stream, zeros, size);
+}
 
-    return false;
+bool AL_ReadBytes(SDL_RWops *stream, void *out, size_t size)
+{
+    if(size == 0)
+        return true;
+    return (1 == SDL_RWread(stream, out, size, 1));
 }
 
 bool AL_ParseAABB(SDL_RWops *stream, struct aabb *out)
@@ -392,12 +1324,39 @@ fail:
 
 bool AL_Init(void)
 {
-    s_name_resource_table = kh_init(entity_res);
-    return (s_name_resource_table != NULL);
+    s_resource_table = kh_init(entity_res);
+    s_render_sections = kh_init(section);
+    s_anim_sections = kh_init(section);
+    if(!s_resource_table || !s_render_sections || !s_anim_sections)
+        goto fail_table;
+
+    /* The animation context of every entity is stored right after it */
+    if(!Entity_PoolInit(A_AL_CtxBuffSize()))
+        goto fail_table;
+
+    return true;
+
+fail_table:
+    kh_destroy(section, s_anim_sections);
+    kh_destroy(section, s_render_sections);
+    strmap_destroy(entity_res, s_resource_table);
+    return false;
 }
 
 void AL_Shutdown(void)
 {
-    kh_destroy(entity_res, s_name_resource_table);
+    Entity_PoolShutdown();
+
+    /* Resources that were preloaded but never used, or whose entities were
+     * never freed */
+    for(khiter_t k = kh_begin(s_resource_table); k != kh_end(s_resource_table); k++) {
+        if(!kh_exist(s_resource_table, k)) continue;
+        al_unload_resource(k);
+    }
+
+    assert(kh_size(s_render_sections) == 0 && kh_size(s_anim_sections) == 0);
+    kh_destroy(section, s_anim_sections);
+    kh_destroy(section, s_render_sections);
+    strmap_destroy(entity_res, s_resource_table);
 }
 
@@ -42,8 +42,13 @@
 #include <SDL.h> /* for SDL_RWops */
 
 #define MAX_ANIM_SETS 16
+#define MAX_LODS      4
 #define MAX_LINE_LEN  256
 
+/* The sections of binary PFOBJ files start at offsets aligned to this */
+#define BIN_SECTION_ALIGN   (16)
+#define BIN_ALIGN_UP(size)  (((size) + BIN_SECTION_ALIGN - 1) & ~((size_t)BIN_SECTION_ALIGN - 1))
+
 #if defined(_WIN32)
     #define strtok_r strtok_s
 #endif
@@ -55,6 +60,12 @@
         buff[MAX_LINE_LEN - 1] = '\0';                  \
     }while(0)
 
+#define READ_LINE_VIEW(rwops, ptr, fail_label)          \
+    do{                                                 \
+        if(!((ptr) = AL_ReadLineView(rwops)))           \
+            goto fail_label;                            \
+    }while(0)
+
 
 struct entity;
 struct map;
@@ -68,6 +79,8 @@ struct pfobj_hdr{
     unsigned num_as;
     unsigned frame_counts[MAX_ANIM_SETS];
     bool     has_collision;
+    /* The number of coarser versions of the mesh following the materials */
+    unsigned num_lods;
 };
 
 struct pfmap_hdr{
@@ -80,14 +93,121 @@ struct pfmap_hdr{
 bool           AL_Init(void);
 void           AL_Shutdown(void);
 
+/* ---------------------------------------------------------------------------
+ * Entities are loaded from the binary variant of the PFOBJ file, written by
+ * 'AL_ConvertPFObj', whenever there is an up-to-date one alongside it. 
+ * Otherwise, the text file is parsed.
+ *
+ * The entities created from the same file share its' render and animation 
+ * data, as do files whose meshes or skeletons and clips are identical, even
+ * when they're found under different paths. The data is reference counted 
+ * and unloaded once the last entity using it is freed with 'AL_EntityFree'.
+ * ---------------------------------------------------------------------------
+ */
 struct entity *AL_EntityFromPFObj(const char *base_path, const char *pfobj_name, const char *name);
 void           AL_EntityFree(struct entity *entity);
 
+/* ---------------------------------------------------------------------------
+ * Writes the binary variant of the PFOBJ file, named after it with the 
+ * '.pfobjb' extension. The binary file holds the data as the engine keeps it
+ * in memory, so it is only meant to be read by the same build of the engine.
+ * ---------------------------------------------------------------------------
+ */
+bool           AL_ConvertPFObj(const char *base_path, const char *pfobj_name);
+
+/* ---------------------------------------------------------------------------
+ * Loads the PFOBJ files ahead of creating the entities that use them, so that
+ * the following 'AL_EntityFromPFObj' calls find them already loaded. Reading
+ * and parsing is spread over the pool threads, leaving only the creation of 
+ * the GL objects to the calling (main) thread. Files that are already loaded
+ * or that are listed more than once are only loaded once. Preloaded files
+ * that no entity is created from stay loaded until 'AL_Shutdown'.
+ * ---------------------------------------------------------------------------
+ */
+void           AL_PreloadPFObjs(size_t count, const char *const base_paths[], 
+                                const char *const pfobj_names[]);
+
+/* ---------------------------------------------------------------------------
+ * The same as 'AL_PreloadPFObjs', split in two so that the files can be read 
+ * on a thread of the caller's own: 'AL_PreloadRead' may be called from any 
+ * thread, and reads all the files on it. 'AL_PreloadCommit' must then be 
+ * called from the main thread to create the GL objects. The paths must stay
+ * valid until the preload is committed or freed. Both free the preload.
+ * ---------------------------------------------------------------------------
+ */
+struct al_preload;
+
+struct al_preload *AL_PreloadRead(size_t count, const char *const base_paths[], 
+                                  const char *const pfobj_names[]);
+void               AL_PreloadCommit(struct al_preload *preload);
+void               AL_PreloadFree(struct al_preload *preload);
+
+/* ---------------------------------------------------------------------------
+ * Maps are loaded from the binary '.pfmapb' file alongside the PFMAP file 
+ * whenever it is up to date. Otherwise, the text file is parsed and the 
+ * binary file is (re)written from it.
+ * ---------------------------------------------------------------------------
+ */
 struct map    *AL_MapFromPFMap(const char *base_path, const char *pfmap_name);
 struct map    *AL_MapFromPFMapString(const char *str);
 void           AL_MapFree(struct map *map);
 
+/* ---------------------------------------------------------------------------
+ * Text asset files are read through a buffered stream, which reads the file 
+ * in large blocks and hands out lines as views into its buffer. 'AL_TextStream'
+ * wraps any other stream (and closes it when it is closed itself), while 
+ * 'AL_OpenText' opens a file.
+ * ---------------------------------------------------------------------------
+ */
+SDL_RWops     *AL_TextStream(SDL_RWops *src);
+SDL_RWops     *AL_OpenText(const char *path);
+
+/* ---------------------------------------------------------------------------
+ * Returns the next line of a stream returned by 'AL_OpenText' or 'AL_TextStream'
+ * without copying it. The view is null-terminated, does not include the 
+ * newline and may be modified in place (i.e. by 'strtok_r'). It stays valid 
+ * until the next read from the stream. Returns NULL at the end of the stream,
+ * on errors, or for any other kind of stream.
+ * ---------------------------------------------------------------------------
+ */
+char          *AL_ReadLineView(SDL_RWops *stream);
+
+/* ---------------------------------------------------------------------------
+ * Copies the next line, including the newline character, into 'outbuff', 
+ * which must hold at least MAX_LINE_LEN characters. Streams that weren't 
+ * opened as text are read one character at a time.
+ * ---------------------------------------------------------------------------
+ */
 bool           AL_ReadLine(SDL_RWops *stream, char *outbuff);
+
+/* ---------------------------------------------------------------------------
+ * The number of lines read from a text stream so far, for pointing at the 
+ * line that failed to parse. 0 for streams that weren't opened as text.
+ * ---------------------------------------------------------------------------
+ */
+size_t         AL_LineNumber(SDL_RWops *stream);
+
+/* ---------------------------------------------------------------------------
+ * Locale-independent parsing of the tokens of the text asset formats. Leading
+ * whitespace is skipped and, on success, '*str' is advanced past the token.
+ * Floats are rounded the same way as by 'strtof'.
+ *
+ * 'AL_ParseTag' matches a keyword, such as the 'v' at the start of a vertex
+ * line, that must be followed by whitespace or the end of the string.
+ *
+ * 'AL_ParseFloats' parses 'count' floats separated by 'sep', as in the 
+ * 'x/y/z' vectors of the PFOBJ format. A 'sep' of ' ' allows any whitespace
+ * between the numbers.
+ * ---------------------------------------------------------------------------
+ */
+bool           AL_ParseTag(const char **str, const char *tag);
+bool           AL_ParseInt(const char **str, int *out);
+bool           AL_ParseFloat(const char **str, float *out);
+bool           AL_ParseFloats(const char **str, size_t count, char sep, float *out);
 bool           AL_ParseAABB(SDL_RWops *stream, struct aabb *out);
 
+bool           AL_WriteBytes(SDL_RWops *stream, const void *data, size_t size);
+bool           AL_WritePadding(SDL_RWops *stream, size_t size);
+bool           AL_ReadBytes(SDL_RWops *stream, void *out, size_t size);
+
 #endif
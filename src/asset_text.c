@@ -0,0 +1,445 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "asset_load.h"
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <float.h>
+#include <stdint.h>
+
+/* Large enough for a good number of lines, so that the underlying stream is
+ * read in a few big blocks */
+#define TEXT_BLOCK_SIZE (64 * 1024)
+
+/* The buffered reader behind the streams returned by 'AL_OpenText' and 
+ * 'AL_TextStream'. The bytes in [begin, end) of the buffer have been read from 
+ * the source but not yet consumed. A line that runs past the end of the 
+ * buffer is moved to the front before the next block is read, so that every
+ * line can be handed out as a view into the buffer.
+ *
+ *  +--------------------+----------------------+-------------------+
+ *  | consumed lines     | unconsumed bytes     | free space        |
+ *  +--------------------+----------------------+-------------------+
+ *  ^                    ^                      ^                   ^
+ *  buff                 buff + begin           buff + end          buff + TEXT_BLOCK_SIZE
+ */
+struct text_stream{
+    SDL_RWops *src;
+    size_t     begin;
+    size_t     end;
+    /* The number of lines read so far */
+    size_t     line;
+    /* One extra byte for terminating a final line that has no newline */
+    char       buff[TEXT_BLOCK_SIZE + 1];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const double s_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool al_is_blank(char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f');
+}
+
+static bool al_is_digit(char c)
+{
+    return (c >= '0' && c <= '9');
+}
+
+static const char *al_skip_blanks(const char *str)
+{
+    while(al_is_blank(*str))
+        str++;
+    return str;
+}
+
+static size_t al_text_read(SDL_RWops *ctx, void *ptr, size_t size, size_t num)
+{
+    struct text_stream *ts = ctx->hidden.unknown.data1;
+    size_t total = size * num;
+    if(total == 0)
+        return 0;
+
+    size_t buffered = ts->end - ts->begin;
+    size_t from_buff = buffered < total ? buffered : total;
+
+    memcpy(ptr, ts->buff + ts->begin, from_buff);
+    ts->begin += from_buff;
+
+    size_t from_src = 0;
+    if(from_buff < total)
+        from_src = SDL_RWread(ts->src, (char*)ptr + from_buff, 1, total - from_buff);
+
+    return (from_buff + from_src) / size;
+}
+
+static size_t al_text_write(SDL_RWops *ctx, const void *ptr, size_t size, size_t num)
+{
+    return 0;
+}
+
+static Sint64 al_text_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    struct text_stream *ts = ctx->hidden.unknown.data1;
+
+    Sint64 src_pos = SDL_RWtell(ts->src);
+    if(src_pos < 0)
+        return -1;
+
+    Sint64 pos = src_pos - (Sint64)(ts->end - ts->begin);
+    if(whence == RW_SEEK_CUR && offset == 0)
+        return pos;
+
+    if(whence == RW_SEEK_CUR) {
+        offset += pos;
+        whence = RW_SEEK_SET;
+    }
+
+    Sint64 ret = SDL_RWseek(ts->src, offset, whence);
+    if(ret >= 0)
+        ts->begin = ts->end = 0;
+    return ret;
+}
+
+static Sint64 al_text_size(SDL_RWops *ctx)
+{
+    struct text_stream *ts = ctx->hidden.unknown.data1;
+    return SDL_RWsize(ts->src);
+}
+
+static int al_text_close(SDL_RWops *ctx)
+{
+    struct text_stream *ts = ctx->hidden.unknown.data1;
+    int ret = SDL_RWclose(ts->src);
+    free(ts);
+    SDL_FreeRW(ctx);
+    return ret;
+}
+
+static struct text_stream *al_text_stream(SDL_RWops *stream)
+{
+    if(stream->read != al_text_read)
+        return NULL;
+    return stream->hidden.unknown.data1;
+}
+
+/* Moves the unconsumed bytes to the front of the buffer and reads the next 
+ * block after them. Returns false once the source is exhausted. */
+static bool al_text_fill(struct text_stream *ts)
+{
+    size_t left = ts->end - ts->begin;
+    memmove(ts->buff, ts->buff + ts->begin, left);
+    ts->begin = 0;
+    ts->end = left;
+
+    size_t nread = SDL_RWread(ts->src, ts->buff + ts->end, 1, TEXT_BLOCK_SIZE - ts->end);
+    ts->end += nread;
+    return (nread > 0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+SDL_RWops *AL_TextStream(SDL_RWops *src)
+{
+    if(!src)
+        return NULL;
+
+    struct text_stream *ts = malloc(sizeof(struct text_stream));
+    if(!ts)
+        goto fail_alloc;
+
+    SDL_RWops *ret = SDL_AllocRW();
+    if(!ret)
+        goto fail_rwops;
+
+    ts->src = src;
+    ts->begin = ts->end = 0;
+    ts->line = 0;
+
+    ret->type = SDL_RWOPS_UNKNOWN;
+    ret->size = al_text_size;
+    ret->seek = al_text_seek;
+    ret->read = al_text_read;
+    ret->write = al_text_write;
+    ret->close = al_text_close;
+    ret->hidden.unknown.data1 = ts;
+    return ret;
+
+fail_rwops:
+    free(ts);
+fail_alloc:
+    SDL_RWclose(src);
+    return NULL;
+}
+
+SDL_RWops *AL_OpenText(const char *path)
+{
+    /* Opened in binary mode - carriage returns are dropped by the reader */
+    return AL_TextStream(SDL_RWFromFile(path, "rb"));
+}
+
+char *AL_ReadLineView(SDL_RWops *stream)
+{
+    struct text_stream *ts = al_text_stream(stream);
+    if(!ts)
+        return NULL;
+
+    char *line, *nl;
+    size_t scan_from = ts->begin;
+
+    while(!(nl = memchr(ts->buff + scan_from, '\n', ts->end - scan_from))) {
+
+        size_t partial = ts->end - ts->begin;
+        if(partial == TEXT_BLOCK_SIZE)
+            return NULL;
+
+        if(!al_text_fill(ts)) {
+
+            /* The last line doesn't have to end with a newline */
+            if(partial == 0)
+                return NULL;
+            nl = ts->buff + ts->end;
+            break;
+        }
+        scan_from = partial;
+    }
+
+    line = ts->buff + ts->begin;
+    ts->begin = nl - ts->buff + (nl < ts->buff + ts->end);
+    ts->line++;
+
+    if(nl > line && nl[-1] == '\r')
+        nl--;
+    *nl = '\0';
+    return line;
+}
+
+bool AL_ReadLine(SDL_RWops *stream, char *outbuff)
+{
+    if(al_text_stream(stream)) {
+
+        const char *line = AL_ReadLineView(stream);
+        if(!line)
+            return false;
+
+        size_t len = strlen(line);
+        if(len + 2 > MAX_LINE_LEN)
+            return false;
+
+        memcpy(outbuff, line, len);
+        outbuff[len] = '\n';
+        outbuff[len + 1] = '\0';
+        return true;
+    }
+
+    bool done = false;
+    int idx = 0;
+    do {
+         
+        if(!SDL_RWread(stream, outbuff + idx, 1, 1))
+            return false; 
+
+        if(outbuff[idx] == '\n') {
+            outbuff[++idx] = '\0';
+            return true;
+        }
+        
+        idx++; 
+    }while(idx < MAX_LINE_LEN);
+
+    return false;
+}
+
+size_t AL_LineNumber(SDL_RWops *stream)
+{
+    struct text_stream *ts = al_text_stream(stream);
+    return ts ? ts->line : 0;
+}
+
+bool AL_ParseTag(const char **str, const char *tag)
+{
+    const char *curr = al_skip_blanks(*str);
+    size_t len = strlen(tag);
+
+    if(strncmp(curr, tag, len) || !(al_is_blank(curr[len]) || curr[len] == '\0'))
+        return false;
+
+    *str = curr + len;
+    return true;
+}
+
+bool AL_ParseInt(const char **str, int *out)
+{
+    const char *curr = al_skip_blanks(*str);
+    bool neg = false;
+
+    if(*curr == '-' || *curr == '+')
+        neg = (*curr++ == '-');
+
+    if(!al_is_digit(*curr))
+        return false;
+
+    long long val = 0;
+    while(al_is_digit(*curr)) {
+        val = val * 10 + (*curr++ - '0');
+        if(val > (long long)INT_MAX + 1)
+            return false;
+    }
+
+    if(neg)
+        val = -val;
+    if(val > INT_MAX)
+        return false;
+
+    *out = (int)val;
+    *str = curr;
+    return true;
+}
+
+bool AL_ParseFloat(const char **str, float *out)
+{
+    const char *start = al_skip_blanks(*str);
+    const char *curr = start;
+    bool neg = false;
+
+    if(*curr == '-' || *curr == '+')
+        neg = (*curr++ == '-');
+
+    uint64_t mantissa = 0;
+    int num_sig = 0, exp = 0;
+    bool any_digits = false;
+
+    for(; al_is_digit(*curr); curr++) {
+        any_digits = true;
+        if(mantissa == 0 && *curr == '0')
+            continue;
+        mantissa = mantissa * 10 + (*curr - '0');
+        num_sig++;
+    }
+
+    if(*curr == '.') {
+        for(curr++; al_is_digit(*curr); curr++) {
+            any_digits = true;
+            exp--;
+            if(mantissa == 0 && *curr == '0')
+                continue;
+            mantissa = mantissa * 10 + (*curr - '0');
+            num_sig++;
+        }
+    }
+
+    if(*curr == 'e' || *curr == 'E') {
+
+        const char *exp_str = curr + 1;
+        int exp_part;
+        /* 'AL_ParseInt' would skip over whitespace following the 'e' */
+        if(al_is_blank(*exp_str) || !AL_ParseInt(&exp_str, &exp_part))
+            goto slow;
+        if(exp_part < -1000 || exp_part > 1000)
+            goto slow;
+        exp += exp_part;
+        curr = exp_str;
+    }
+
+    /* Anything else (infinities, NaNs, hexadecimal floats, ...) and the numbers 
+     * that can't be converted exactly below go the slow way */
+    if(!any_digits || isalnum((unsigned char)*curr) || *curr == '.')
+        goto slow;
+    if(num_sig > 19 || mantissa > (UINT64_C(1) << 53) || exp < -22 || exp > 22)
+        goto slow;
+
+    /* Both the mantissa and the power of ten are exact as doubles, so this
+     * is the correctly rounded double. Rounding it to a float gives the 
+     * correctly rounded float, unless the double falls exactly halfway 
+     * between two floats. */
+    double val = exp < 0 ? (double)mantissa / s_pow10[-exp] 
+                         : (double)mantissa * s_pow10[exp];
+    if(val != 0.0 && (val < FLT_MIN || val > FLT_MAX))
+        goto slow;
+
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    if((bits & ((UINT64_C(1) << 29) - 1)) == (UINT64_C(1) << 28))
+        goto slow;
+
+    *out = neg ? -(float)val : (float)val;
+    *str = curr;
+    return true;
+
+slow:;
+    char *end;
+    float ret = strtof(start, &end);
+    if(end == start)
+        return false;
+
+    *out = ret;
+    *str = end;
+    return true;
+}
+
+bool AL_ParseFloats(const char **str, size_t count, char sep, float *out)
+{
+    const char *curr = *str;
+
+    for(int i = 0; i < count; i++) {
+
+        if(i > 0 && sep != ' ' && *curr++ != sep)
+            return false;
+        if(!AL_ParseFloat(&curr, &out[i]))
+            return false;
+    }
+
+    *str = curr;
+    return true;
+}
+
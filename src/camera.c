@@ -62,6 +62,8 @@ struct camera {
      * always be within the 'bounds' box */
     bool            bounded;
     struct bound_box bounds;
+
+    struct camera_state state;
 };
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -73,6 +75,13 @@ struct camera {
 
 const unsigned g_sizeof_camera = sizeof(struct camera);
 
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Kept here so that the projection doesn't need a round trip to the driver */
+static float s_aspect_ratio = ((float)CONFIG_RES_X) / CONFIG_RES_Y;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -94,6 +103,17 @@ static void camera_move_within_bounds(struct camera *cam)
     cam->pos.z = MIN(cam->pos.z, cam->bounds.z + cam->bounds.h);
 }
 
+static void camera_update_state(struct camera *cam)
+{
+    struct camera_state *state = &cam->state;
+
+    state->pos = cam->pos;
+    Camera_MakeViewMat(cam, &state->view);
+    Camera_MakeProjMat(cam, &state->proj);
+    PFM_Mat4x4_Mult4x4(&state->proj, &state->view, &state->view_proj);
+    Camera_MakeFrustum(cam, &state->frustum);
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -117,6 +137,7 @@ void Camera_SetPos(struct camera *cam, vec3_t pos)
     cam->pos = pos; 
 
     assert(!cam->bounded || camera_pos_in_bounds(cam));
+    camera_update_state(cam);
 }
 
 void Camera_SetPitchAndYaw(struct camera *cam, float pitch, float yaw)
@@ -134,6 +155,8 @@ void Camera_SetPitchAndYaw(struct camera *cam, float pitch, float yaw)
     vec3_t xz = (vec3_t){cam->front.z, 0.0f, -cam->front.x};
     PFM_Vec3_Cross(&cam->front, &xz, &cam->up);
     PFM_Vec3_Normal(&cam->up, &cam->up);
+
+    camera_update_state(cam);
 }
 
 void Camera_SetSpeed(struct camera *cam, float speed)
@@ -293,21 +316,11 @@ void Camera_ChangeDirection(struct camera *cam, int dx, int dy)
 
 void Camera_TickFinishPerspective(struct camera *cam)
 {
-    mat4x4_t view, proj;
-
-    /* Set the view matrix for the vertex shader */
-    vec3_t target;
-    PFM_Vec3_Add(&cam->pos, &cam->front, &target);
-    PFM_Mat4x4_MakeLookAt(&cam->pos, &target, &cam->up, &view);
-
-    R_GL_SetViewMatAndPos(&view, &cam->pos);
-    
-    /* Set the projection matrix for the vertex shader */
-    GLint viewport[4]; 
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    PFM_Mat4x4_MakePerspective(DEG_TO_RAD(45.0f), ((GLfloat)viewport[2])/viewport[3], CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, &proj);
+    camera_update_state(cam);
 
-    R_GL_SetProj(&proj);
+    /* Set the view and projection matrices for the vertex shader */
+    R_GL_SetViewMatAndPos(&cam->state.view, &cam->state.pos);
+    R_GL_SetProj(&cam->state.proj);
 
     /* Update our last timestamp */
     cam->prev_frame_ts = SDL_GetTicks();
@@ -361,9 +374,41 @@ void Camera_MakeViewMat(const struct camera *cam, mat4x4_t *out)
 
 void Camera_MakeProjMat(const struct camera *cam, mat4x4_t *out)
 {
-    GLint viewport[4]; 
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    PFM_Mat4x4_MakePerspective(CAM_FOV_RAD, ((GLfloat)viewport[2])/viewport[3], 0.1f, CONFIG_DRAWDIST, out);
+    PFM_Mat4x4_MakePerspective(CAM_FOV_RAD, s_aspect_ratio, CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, out);
+}
+
+void Camera_MakeInvViewProjMat(const struct camera *cam, mat4x4_t *out)
+{
+    mat4x4_t view, proj, view_proj;
+
+    Camera_MakeViewMat(cam, &view);
+    Camera_MakeProjMat(cam, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, &view_proj);
+    PFM_Mat4x4_Inverse(&view_proj, out);
+}
+
+vec3_t Camera_Unproject(const mat4x4_t *inv_view_proj, vec2_t screen, float ndc_z)
+{
+    vec4_t clip = (vec4_t){
+        -1.0f + 2.0f * (screen.x / CONFIG_RES_X),
+         1.0f - 2.0f * (screen.y / CONFIG_RES_Y),
+         ndc_z,
+         1.0f
+    };
+
+    vec4_t ret_homo;
+    PFM_Mat4x4_Mult4x1(inv_view_proj, &clip, &ret_homo);
+    return (vec3_t){ret_homo.x/ret_homo.w, ret_homo.y/ret_homo.w, ret_homo.z/ret_homo.w};
+}
+
+void Camera_ScreenRay(const struct camera *cam, vec2_t screen, vec3_t *out_origin, vec3_t *out_dir)
+{
+    mat4x4_t inv_view_proj;
+    Camera_MakeInvViewProjMat(cam, &inv_view_proj);
+
+    *out_origin = Camera_Unproject(&inv_view_proj, screen, -1.0f);
+    PFM_Vec3_Sub(out_origin, &cam->pos, out_dir);
+    PFM_Vec3_Normal(out_dir, out_dir);
 }
 
 /* Useful information about frustrums here:
@@ -372,9 +417,7 @@ void Camera_MakeProjMat(const struct camera *cam, mat4x4_t *out)
  */
 void Camera_MakeFrustum(const struct camera *cam, struct frustum *out)
 {
-    GLint viewport[4]; 
-    glGetIntegerv(GL_VIEWPORT, viewport);
-    const float aspect_ratio = ((float)viewport[2])/viewport[3];
+    const float aspect_ratio = s_aspect_ratio;
 
     const float near_dist = CAM_Z_NEAR_DIST;
     const float far_dist = CONFIG_DRAWDIST;
@@ -496,3 +539,16 @@ void Camera_MakeFrustum(const struct camera *cam, struct frustum *out)
     PFM_Vec3_Cross(&p_to_near_bot_edge, &cam_right, &out->bot.normal);
 }
 
+
+const struct camera_state *Camera_GetState(const struct camera *cam)
+{
+    return &cam->state;
+}
+
+void Camera_SetViewportSize(int width, int height)
+{
+    if(width <= 0 || height <= 0)
+        return;
+    s_aspect_ratio = ((float)width) / height;
+}
+
@@ -37,10 +37,10 @@
 #define CAMERA_H
 
 #include "pf_math.h"
+#include "collision.h"
 #include <stdbool.h>
 
 struct camera;
-struct frustum;
 extern const unsigned g_sizeof_camera;
 
 struct bound_box{
@@ -55,6 +55,18 @@ struct bound_box{
 #define CAM_Z_NEAR_DIST     (0.1f)
 #define CAM_FOV_RAD         (M_PI/4.0f)
 
+/* Everything derived from the camera's position and direction for drawing 
+ * and culling. It is worked out once when the camera is finished ticking for 
+ * the frame (or when it is placed directly) and shared by everything that 
+ * needs it for the rest of the frame. */
+struct camera_state{
+    vec3_t         pos;
+    mat4x4_t       view;
+    mat4x4_t       proj;
+    mat4x4_t       view_proj;
+    struct frustum frustum;
+};
+
 struct camera *Camera_New (void);
 void           Camera_Free(struct camera *cam);
 
@@ -69,6 +81,14 @@ vec3_t         Camera_GetPos       (const struct camera *cam);
 
 void           Camera_MakeViewMat  (const struct camera *cam, mat4x4_t *out);
 void           Camera_MakeProjMat  (const struct camera *cam, mat4x4_t *out);
+/* Takes points in normalized device coordinates back into world space */
+void           Camera_MakeInvViewProjMat(const struct camera *cam, mat4x4_t *out);
+/* Finds the world position of a point on the screen at the depth 'ndc_z', which 
+ * is -1 on the near plane and 1 on the far plane. */
+vec3_t         Camera_Unproject    (const mat4x4_t *inv_view_proj, vec2_t screen, float ndc_z);
+/* The ray from the near plane through a point on the screen, for picking */
+void           Camera_ScreenRay    (const struct camera *cam, vec2_t screen, 
+                                    vec3_t *out_origin, vec3_t *out_dir);
 
 void           Camera_RestrictPosWithBox(struct camera *cam, struct bound_box box);
 void           Camera_UnrestrictPos     (struct camera *cam);
@@ -92,4 +112,12 @@ void           Camera_TickFinishOrthographic(struct camera *cam, vec2_t bot_left
 
 void           Camera_MakeFrustum(const struct camera *cam, struct frustum *out);
 
+/* The state as of the last 'Camera_TickFinishPerspective', 'Camera_SetPos' 
+ * or 'Camera_SetPitchAndYaw' call */
+const struct camera_state *Camera_GetState(const struct camera *cam);
+
+/* The projections are made for a viewport of this size. Must be kept up to
+ * date with the size of the window. */
+void           Camera_SetViewportSize(int width, int height);
+
 #endif
@@ -36,6 +36,14 @@
 #include "collision.h"
 #include <assert.h>
 #include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #define MIN(a, b)     ((a) < (b) ? (a) : (b))
 #define MAX(a, b)     ((a) > (b) ? (a) : (b))
@@ -51,6 +59,59 @@
 
 #define EPSILON (1.0f / 1000000.0f)
 
+/* The batched culling works on as many boxes at a time as fit in a vector 
+ * register */
+#if defined(__AVX__)
+    #define CULL_LANES      8
+    typedef __m256          cull_vec_t;
+    #define CV_LOAD(p)      _mm256_loadu_ps(p)
+    #define CV_SET1(f)      _mm256_set1_ps(f)
+    #define CV_ADD(a, b)    _mm256_add_ps(a, b)
+    #define CV_MUL(a, b)    _mm256_mul_ps(a, b)
+    #define CV_ABS(a)       _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a)
+    #define CV_OR(a, b)     _mm256_or_ps(a, b)
+    #define CV_LT(a, b)     _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+    #define CV_MASK(a)      _mm256_movemask_ps(a)
+    #define CV_ZERO()       _mm256_setzero_ps()
+    #define CV_STORE(p, a)  _mm256_storeu_ps(p, a)
+    #define CV_SUB(a, b)    _mm256_sub_ps(a, b)
+    #define CV_DIV(a, b)    _mm256_div_ps(a, b)
+    #define CV_MIN(a, b)    _mm256_min_ps(a, b)
+    #define CV_MAX(a, b)    _mm256_max_ps(a, b)
+    #define CV_SQRT(a)      _mm256_sqrt_ps(a)
+    #define CV_AND(a, b)    _mm256_and_ps(a, b)
+    #define CV_ANDNOT(a, b) _mm256_andnot_ps(a, b)
+#elif defined(__SSE__)
+    #define CULL_LANES      4
+    typedef __m128          cull_vec_t;
+    #define CV_LOAD(p)      _mm_loadu_ps(p)
+    #define CV_SET1(f)      _mm_set1_ps(f)
+    #define CV_ADD(a, b)    _mm_add_ps(a, b)
+    #define CV_MUL(a, b)    _mm_mul_ps(a, b)
+    #define CV_ABS(a)       _mm_andnot_ps(_mm_set1_ps(-0.0f), a)
+    #define CV_OR(a, b)     _mm_or_ps(a, b)
+    #define CV_LT(a, b)     _mm_cmplt_ps(a, b)
+    #define CV_MASK(a)      _mm_movemask_ps(a)
+    #define CV_ZERO()       _mm_setzero_ps()
+    #define CV_STORE(p, a)  _mm_storeu_ps(p, a)
+    #define CV_SUB(a, b)    _mm_sub_ps(a, b)
+    #define CV_DIV(a, b)    _mm_div_ps(a, b)
+    #define CV_MIN(a, b)    _mm_min_ps(a, b)
+    #define CV_MAX(a, b)    _mm_max_ps(a, b)
+    #define CV_SQRT(a)      _mm_sqrt_ps(a)
+    #define CV_AND(a, b)    _mm_and_ps(a, b)
+    #define CV_ANDNOT(a, b) _mm_andnot_ps(a, b)
+#else
+    #define CULL_LANES      1
+#endif
+
+#if CULL_LANES > 1
+    /* Picks 'a' in the lanes where 'mask' is set and 'b' elsewhere */
+    #define CV_SELECT(mask, a, b) CV_OR(CV_AND(mask, a), CV_ANDNOT(mask, b))
+#endif
+
+#define NUM_FRUSTUM_PLANES (6)
+
 
 struct range{
     float begin, end;
@@ -140,6 +201,102 @@ static float plane_point_signed_distance(const struct plane *plane, vec3_t point
     return PFM_Vec3_Dot(&diff, (vec3_t*)&plane->normal);
 }
 
+/* Writes the frustum planes as (normal, offset) so that the signed distance 
+ * of a point is a single dot product plus the offset */
+static void frustum_plane_eqs(const struct frustum *frustum, float out[NUM_FRUSTUM_PLANES][4])
+{
+    const struct plane *planes[NUM_FRUSTUM_PLANES] = {&frustum->top, &frustum->bot, &frustum->left, 
+                                                      &frustum->right, &frustum->near, &frustum->far};
+
+    for(int i = 0; i < NUM_FRUSTUM_PLANES; i++) {
+        out[i][0] = planes[i]->normal.x;
+        out[i][1] = planes[i]->normal.y;
+        out[i][2] = planes[i]->normal.z;
+        out[i][3] = -PFM_Vec3_Dot((vec3_t*)&planes[i]->normal, (vec3_t*)&planes[i]->point);
+    }
+}
+
+/* The box is outside a plane when even its' farthest corner along the plane normal
+ * is behind it - the corner's distance being the center's plus the sum of the 
+ * projections of the extents */
+static bool obb_soa_outside(float planes[NUM_FRUSTUM_PLANES][4], const struct obb_soa *obbs, size_t i)
+{
+    for(int p = 0; p < NUM_FRUSTUM_PLANES; p++) {
+
+        float dist = planes[p][0] * obbs->center[0][i] 
+                   + planes[p][1] * obbs->center[1][i] 
+                   + planes[p][2] * obbs->center[2][i] + planes[p][3];
+        for(int a = 0; a < 3; a++) {
+            dist += fabsf(planes[p][0] * obbs->extent[a][0][i] 
+                        + planes[p][1] * obbs->extent[a][1][i] 
+                        + planes[p][2] * obbs->extent[a][2][i]);
+        }
+        if(dist < 0.0f)
+            return true;
+    }
+    return false;
+}
+
+static bool aabb_soa_outside(float planes[NUM_FRUSTUM_PLANES][4], const float *const center[3],
+                             const float *const half[3], size_t i)
+{
+    for(int p = 0; p < NUM_FRUSTUM_PLANES; p++) {
+
+        float dist = planes[p][0] * center[0][i] 
+                   + planes[p][1] * center[1][i] 
+                   + planes[p][2] * center[2][i] + planes[p][3]
+                   + fabsf(planes[p][0]) * half[0][i]
+                   + fabsf(planes[p][1]) * half[1][i]
+                   + fabsf(planes[p][2]) * half[2][i];
+        if(dist < 0.0f)
+            return true;
+    }
+    return false;
+}
+
+/* The same slab test as 'C_RayIntersectsOBB'. With the extent 'e' being the 
+ * unit axis scaled by the half length 'h', the projections onto 'e' are all 'h' 
+ * times those onto the axis, so the slab bounds '(dA -+ h) / DA' become 
+ * '(d.e -+ e.e) / D.e'. */
+static bool ray_obb_soa_intersect(vec3_t ray_origin, vec3_t ray_dir, const struct obb_soa *obbs,
+                                  size_t i, float *out_t)
+{
+    float tmin = 0.0f;
+    float tmax = FLT_MAX;
+
+    vec3_t d = (vec3_t){
+        obbs->center[0][i] - ray_origin.x,
+        obbs->center[1][i] - ray_origin.y,
+        obbs->center[2][i] - ray_origin.z,
+    };
+
+    for(int a = 0; a < 3; a++) {
+
+        vec3_t e = (vec3_t){obbs->extent[a][0][i], obbs->extent[a][1][i], obbs->extent[a][2][i]};
+        float De = PFM_Vec3_Dot(&ray_dir, &e);
+        float de = PFM_Vec3_Dot(&d, &e);
+        float ee = PFM_Vec3_Dot(&e, &e);
+
+        if(fabsf(De) < EPSILON * sqrtf(ee)) {
+
+            if(fabsf(de) > ee)
+                return false;
+        }else{
+
+            float t1 = (de - ee) / De;
+            float t2 = (de + ee) / De;
+
+            tmin = MAX(tmin, MIN(t1, t2));
+            tmax = MIN(tmax, MAX(t1, t2));
+            if(tmin > tmax)
+                return false;
+        }
+    }
+
+    *out_t = tmin;
+    return true;
+}
+
 static float arr_min(float *array, size_t size)
 {
     assert(size > 0);
@@ -669,3 +826,248 @@ bool C_LineCircleIntersection(struct line_seg_2d line, vec2_t center_xz, float r
     return true;
 }
 
+void C_LineCirclesIntersect(struct line_seg_2d line, size_t count, const float *center_x, 
+                            const float *center_z, const float *radius, float *out_t, 
+                            uint32_t *out_mask)
+{
+    memset(out_mask, 0, ((count + 31) / 32) * sizeof(uint32_t));
+
+    /* The segment is the same for all of the circles, so the leading 
+     * coefficient of the quadratic only needs to be found once */
+    float dx = line.bx - line.ax;
+    float dz = line.bz - line.az;
+    float A = dx * dx + dz * dz;
+    if(A < EPSILON)
+        return;
+
+    size_t i = 0;
+#if CULL_LANES > 1
+    const cull_vec_t ax = CV_SET1(line.ax), az = CV_SET1(line.az);
+    const cull_vec_t vdx = CV_SET1(dx), vdz = CV_SET1(dz);
+    const cull_vec_t four_a = CV_SET1(4.0f * A), inv_two_a = CV_SET1(1.0f / (2.0f * A));
+    const cull_vec_t zero = CV_ZERO(), one = CV_SET1(1.0f), two = CV_SET1(2.0f);
+
+    for(; i + CULL_LANES <= count; i += CULL_LANES) {
+
+        cull_vec_t fx = CV_SUB(ax, CV_LOAD(center_x + i));
+        cull_vec_t fz = CV_SUB(az, CV_LOAD(center_z + i));
+        cull_vec_t r = CV_LOAD(radius + i);
+
+        cull_vec_t B = CV_MUL(two, CV_ADD(CV_MUL(vdx, fx), CV_MUL(vdz, fz)));
+        cull_vec_t C = CV_SUB(CV_ADD(CV_MUL(fx, fx), CV_MUL(fz, fz)), CV_MUL(r, r));
+        cull_vec_t det = CV_SUB(CV_MUL(B, B), CV_MUL(four_a, C));
+
+        /* The smaller of the roots, which is garbage where there are none */
+        cull_vec_t t = CV_MUL(CV_SUB(CV_SUB(zero, B), CV_SQRT(CV_MAX(det, zero))), inv_two_a);
+
+        cull_vec_t miss = CV_OR(CV_LT(det, zero), CV_OR(CV_LT(t, zero), CV_LT(one, t)));
+        uint32_t hit = ~CV_MASK(miss) & ((1u << CULL_LANES) - 1);
+        out_mask[i / 32] |= hit << (i % 32);
+        CV_STORE(out_t + i, t);
+    }
+#endif
+    for(; i < count; i++) {
+        vec2_t center = (vec2_t){center_x[i], center_z[i]};
+        if(C_LineCircleIntersection(line, center, radius[i], &out_t[i]))
+            out_mask[i / 32] |= (1u << (i % 32));
+    }
+}
+
+void C_FrustumOBBsCull(const struct frustum *frustum, const struct obb_soa *obbs, uint32_t *out_mask)
+{
+    float planes[NUM_FRUSTUM_PLANES][4];
+    frustum_plane_eqs(frustum, planes);
+    memset(out_mask, 0, ((obbs->size + 31) / 32) * sizeof(uint32_t));
+
+    size_t i = 0;
+#if CULL_LANES > 1
+    for(; i + CULL_LANES <= obbs->size; i += CULL_LANES) {
+
+        cull_vec_t outside = CV_ZERO();
+        for(int p = 0; p < NUM_FRUSTUM_PLANES; p++) {
+
+            cull_vec_t nx = CV_SET1(planes[p][0]);
+            cull_vec_t ny = CV_SET1(planes[p][1]);
+            cull_vec_t nz = CV_SET1(planes[p][2]);
+
+            cull_vec_t dist = CV_ADD(CV_SET1(planes[p][3]), 
+                CV_ADD(CV_MUL(nx, CV_LOAD(obbs->center[0] + i)), 
+                CV_ADD(CV_MUL(ny, CV_LOAD(obbs->center[1] + i)), 
+                       CV_MUL(nz, CV_LOAD(obbs->center[2] + i)))));
+
+            for(int a = 0; a < 3; a++) {
+                cull_vec_t proj = CV_ADD(CV_MUL(nx, CV_LOAD(obbs->extent[a][0] + i)), 
+                                  CV_ADD(CV_MUL(ny, CV_LOAD(obbs->extent[a][1] + i)), 
+                                         CV_MUL(nz, CV_LOAD(obbs->extent[a][2] + i))));
+                dist = CV_ADD(dist, CV_ABS(proj));
+            }
+            outside = CV_OR(outside, CV_LT(dist, CV_ZERO()));
+        }
+
+        uint32_t visible = ~CV_MASK(outside) & ((1u << CULL_LANES) - 1);
+        out_mask[i / 32] |= visible << (i % 32);
+    }
+#endif
+    for(; i < obbs->size; i++) {
+        if(!obb_soa_outside(planes, obbs, i))
+            out_mask[i / 32] |= (1u << (i % 32));
+    }
+}
+
+void C_FrustumAABBsCull(const struct frustum *frustum, size_t count, const float *const center[3],
+                        const float *const half[3], uint32_t *out_mask)
+{
+    float planes[NUM_FRUSTUM_PLANES][4];
+    frustum_plane_eqs(frustum, planes);
+    memset(out_mask, 0, ((count + 31) / 32) * sizeof(uint32_t));
+
+    size_t i = 0;
+#if CULL_LANES > 1
+    for(; i + CULL_LANES <= count; i += CULL_LANES) {
+
+        cull_vec_t outside = CV_ZERO();
+        for(int p = 0; p < NUM_FRUSTUM_PLANES; p++) {
+
+            cull_vec_t dist = CV_ADD(CV_SET1(planes[p][3]), 
+                CV_ADD(CV_MUL(CV_SET1(planes[p][0]), CV_LOAD(center[0] + i)), 
+                CV_ADD(CV_MUL(CV_SET1(planes[p][1]), CV_LOAD(center[1] + i)), 
+                       CV_MUL(CV_SET1(planes[p][2]), CV_LOAD(center[2] + i)))));
+
+            dist = CV_ADD(dist, 
+                CV_ADD(CV_MUL(CV_SET1(fabsf(planes[p][0])), CV_LOAD(half[0] + i)), 
+                CV_ADD(CV_MUL(CV_SET1(fabsf(planes[p][1])), CV_LOAD(half[1] + i)), 
+                       CV_MUL(CV_SET1(fabsf(planes[p][2])), CV_LOAD(half[2] + i)))));
+
+            outside = CV_OR(outside, CV_LT(dist, CV_ZERO()));
+        }
+
+        uint32_t visible = ~CV_MASK(outside) & ((1u << CULL_LANES) - 1);
+        out_mask[i / 32] |= visible << (i % 32);
+    }
+#endif
+    for(; i < count; i++) {
+        if(!aabb_soa_outside(planes, center, half, i))
+            out_mask[i / 32] |= (1u << (i % 32));
+    }
+}
+
+void C_RayOBBsIntersect(vec3_t ray_origin, vec3_t ray_dir, const struct obb_soa *obbs, 
+                        float *out_t, uint32_t *out_mask)
+{
+    memset(out_mask, 0, ((obbs->size + 31) / 32) * sizeof(uint32_t));
+
+    size_t i = 0;
+#if CULL_LANES > 1
+    const cull_vec_t dir[3] = {CV_SET1(ray_dir.x), CV_SET1(ray_dir.y), CV_SET1(ray_dir.z)};
+    const cull_vec_t eps = CV_SET1(EPSILON);
+
+    for(; i + CULL_LANES <= obbs->size; i += CULL_LANES) {
+
+        cull_vec_t d[3] = {
+            CV_SUB(CV_LOAD(obbs->center[0] + i), CV_SET1(ray_origin.x)),
+            CV_SUB(CV_LOAD(obbs->center[1] + i), CV_SET1(ray_origin.y)),
+            CV_SUB(CV_LOAD(obbs->center[2] + i), CV_SET1(ray_origin.z)),
+        };
+        cull_vec_t tmin = CV_ZERO();
+        cull_vec_t tmax = CV_SET1(FLT_MAX);
+        cull_vec_t miss = CV_ZERO();
+
+        for(int a = 0; a < 3; a++) {
+
+            cull_vec_t e[3] = {
+                CV_LOAD(obbs->extent[a][0] + i), 
+                CV_LOAD(obbs->extent[a][1] + i), 
+                CV_LOAD(obbs->extent[a][2] + i),
+            };
+            cull_vec_t De = CV_ADD(CV_MUL(dir[0], e[0]), CV_ADD(CV_MUL(dir[1], e[1]), CV_MUL(dir[2], e[2])));
+            cull_vec_t de = CV_ADD(CV_MUL(d[0], e[0]), CV_ADD(CV_MUL(d[1], e[1]), CV_MUL(d[2], e[2])));
+            cull_vec_t ee = CV_ADD(CV_MUL(e[0], e[0]), CV_ADD(CV_MUL(e[1], e[1]), CV_MUL(e[2], e[2])));
+
+            /* The lanes where the ray is parallel to the slabs only hit when the 
+             * origin is between them. The division is garbage there and is 
+             * replaced by an unbounded range. */
+            cull_vec_t parallel = CV_LT(CV_ABS(De), CV_MUL(eps, CV_SQRT(ee)));
+            miss = CV_OR(miss, CV_AND(parallel, CV_LT(ee, CV_ABS(de))));
+
+            cull_vec_t t1 = CV_DIV(CV_SUB(de, ee), De);
+            cull_vec_t t2 = CV_DIV(CV_ADD(de, ee), De);
+
+            tmin = CV_MAX(tmin, CV_SELECT(parallel, CV_SET1(-FLT_MAX), CV_MIN(t1, t2)));
+            tmax = CV_MIN(tmax, CV_SELECT(parallel, CV_SET1(FLT_MAX), CV_MAX(t1, t2)));
+        }
+
+        miss = CV_OR(miss, CV_LT(tmax, tmin));
+        uint32_t hit = ~CV_MASK(miss) & ((1u << CULL_LANES) - 1);
+        out_mask[i / 32] |= hit << (i % 32);
+        CV_STORE(out_t + i, tmin);
+    }
+#endif
+    for(; i < obbs->size; i++) {
+        if(ray_obb_soa_intersect(ray_origin, ray_dir, obbs, i, &out_t[i]))
+            out_mask[i / 32] |= (1u << (i % 32));
+    }
+}
+
+void C_OBBSoA_Init(struct obb_soa *soa)
+{
+    memset(soa, 0, sizeof(*soa));
+}
+
+void C_OBBSoA_Destroy(struct obb_soa *soa)
+{
+    free(soa->center[0]);
+    memset(soa, 0, sizeof(*soa));
+}
+
+bool C_OBBSoA_Resize(struct obb_soa *soa, size_t size)
+{
+    if(size <= soa->capacity) {
+        soa->size = size;
+        return true;
+    }
+
+    size_t new_cap = MAX(size, soa->capacity * 2);
+    /* All 12 arrays are in one block, each 'new_cap' floats long */
+    float *block = malloc(new_cap * 12 * sizeof(float));
+    if(!block)
+        return false;
+
+    float **arrs[12];
+    for(int i = 0; i < 3; i++)
+        arrs[i] = &soa->center[i];
+    for(int i = 0; i < 9; i++)
+        arrs[3 + i] = &soa->extent[i / 3][i % 3];
+
+    float *old_block = soa->center[0];
+    for(int i = 0; i < 12; i++) {
+
+        float *arr = block + i * new_cap;
+        if(soa->size)
+            memcpy(arr, *arrs[i], soa->size * sizeof(float));
+        *arrs[i] = arr;
+    }
+    free(old_block);
+
+    soa->capacity = new_cap;
+    soa->size = size;
+    return true;
+}
+
+void C_OBBSoA_Set(struct obb_soa *soa, size_t idx, const struct obb *obb)
+{
+    assert(idx < soa->size);
+
+    soa->center[0][idx] = obb->center.x;
+    soa->center[1][idx] = obb->center.y;
+    soa->center[2][idx] = obb->center.z;
+
+    /* A flat box would lose the direction of its' axis, which the ray tests 
+     * still need */
+    for(int a = 0; a < 3; a++) {
+        float half = MAX(obb->half_lengths[a], EPSILON);
+        soa->extent[a][0][idx] = obb->axes[a].x * half;
+        soa->extent[a][1][idx] = obb->axes[a].y * half;
+        soa->extent[a][2][idx] = obb->axes[a].z * half;
+    }
+}
+
@@ -38,6 +38,8 @@
 
 #include "pf_math.h"
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 struct aabb{
     float x_min, x_max;
@@ -67,6 +69,16 @@ struct obb{
     vec3_t corners[8];
 };
 
+/* Many OBBs stored component by component, for testing them in batches. 
+ * The arrays all have room for 'capacity' boxes. */
+struct obb_soa{
+    size_t  size, capacity;
+    float  *center[3];
+    /* The box axes scaled by the half lengths along them, indexed by axis 
+     * and then by component */
+    float  *extent[3][3];
+};
+
 enum volume_intersec_type{
     VOLUME_INTERSEC_INSIDE,
     VOLUME_INTERSEC_OUTSIDE,
@@ -89,6 +101,30 @@ enum volume_intersec_type C_FrustumOBBIntersectionFast  (const struct frustum *f
 bool C_FrustumAABBIntersectionExact(const struct frustum *frustum, const struct aabb *aabb);
 bool C_FrustumOBBIntersectionExact(const struct frustum *frustum, const struct obb *obb);
 
+/* Batched versions of the fast tests, which only tell whether a box is outside the 
+ * frustum. Bit 'i' of 'out_mask' is set unless box 'i' is entirely behind one of 
+ * the frustum planes. Unlike 'C_Frustum*IntersectionFast', every plane is always 
+ * tested, so boxes which straddle one plane but are behind another are culled as 
+ * well. 'out_mask' must have room for one bit per box, rounded up to whole words. 
+ * The boxes are tested several at a time with SIMD instructions when the target 
+ * supports them. */
+void C_FrustumOBBsCull (const struct frustum *frustum, const struct obb_soa *obbs, uint32_t *out_mask);
+void C_FrustumAABBsCull(const struct frustum *frustum, size_t count, const float *const center[3],
+                        const float *const half[3], uint32_t *out_mask);
+
+/* Batched version of 'C_RayIntersectsOBB'. Bit 'i' of 'out_mask' is set when the 
+ * ray hits box 'i', in which case 'out_t[i]' is the distance along the ray to the 
+ * hit. 'out_t' must have room for one float per box. */
+void C_RayOBBsIntersect(vec3_t ray_origin, vec3_t ray_dir, const struct obb_soa *obbs, 
+                        float *out_t, uint32_t *out_mask);
+
+void C_OBBSoA_Init   (struct obb_soa *soa);
+void C_OBBSoA_Destroy(struct obb_soa *soa);
+/* Sets the number of boxes, growing the arrays when needed. The boxes that are 
+ * kept are left unchanged. */
+bool C_OBBSoA_Resize (struct obb_soa *soa, size_t size);
+void C_OBBSoA_Set    (struct obb_soa *soa, size_t idx, const struct obb *obb);
+
 /* Note that the following assumes that AB is parallel to CD and BC is parallel to AD
  */
 bool C_PointInsideRect2D(vec2_t point, vec2_t a, vec2_t b, vec2_t c, vec2_t d);
@@ -111,6 +147,12 @@ bool C_BoxPointIntersection(float px, float pz, struct box bounds);
 /* 'out_t' gets set to the value corresponding to the _closest_ intersection in the 
  * case that there is more than one intersection. */
 bool C_LineCircleIntersection(struct line_seg_2d line, vec2_t center_xz, float radius, float *out_t);
+/* Batched version of 'C_LineCircleIntersection' for many circles, given by the X and Z 
+ * coordinates of their centers and their radii. Bit 'i' of 'out_mask' is set when the 
+ * segment hits circle 'i', in which case 'out_t[i]' is set as above. */
+void C_LineCirclesIntersect(struct line_seg_2d line, size_t count, const float *center_x, 
+                            const float *center_z, const float *radius, float *out_t, 
+                            uint32_t *out_mask);
 
 #endif
 
@@ -52,7 +52,96 @@ enum pf_window_flags{
 #define CONFIG_RES_X                1920
 #define CONFIG_RES_Y                1080
 #define CONFIG_BAKED_TILE_TEX_RES   128
+#define CONFIG_TERRAIN_LOD_DIST     600.0f
+/* In the hybrid render mode, the chunks closer to the camera than this are 
+ * blended in realtime, and the ones further than it by more than the margin 
+ * are drawn baked */
+#define CONFIG_TERRAIN_HYBRID_DIST   350.0f
+#define CONFIG_TERRAIN_HYBRID_MARGIN 64.0f
+#define CONFIG_TERRAIN_GREEDY_MESH  true
+#define CONFIG_BAKE_CHUNKS_PER_FRAME 4
+/* Maps with more chunks than this only keep the GPU buffers of the chunks 
+ * around the camera. Up to CONFIG_TERRAIN_RESIDENT_CHUNKS of them are kept, 
+ * and the ones that were needed least recently are freed first. */
+#define CONFIG_TERRAIN_STREAM_MIN_CHUNKS 1024
+#define CONFIG_TERRAIN_RESIDENT_CHUNKS   256
+/* Up to this many more chunks a frame are streamed in ahead of time, for 
+ * where the camera is headed over the next CONFIG_STREAM_PREFETCH_MS */
+#define CONFIG_STREAM_PREFETCH_CHUNKS    8
+#define CONFIG_STREAM_PREFETCH_MS        1000
+/* The most memory taken by the recorded map edits for undo and redo */
+#define CONFIG_MAP_EDIT_HISTORY          (1024 * 1024)
+/* Times per second that the unit blips on the minimap are refreshed, or 0 to
+ * refresh them every frame */
+#define CONFIG_MINIMAP_UNITS_HZ     10
+/* Animated entities further than this from the camera have their pose 
+ * evaluated CONFIG_ANIM_LOD_HZ times a second, and are drawn in the last 
+ * evaluated pose in between */
+#define CONFIG_ANIM_LOD_DIST        300.0f
+#define CONFIG_ANIM_LOD_HZ          12
+/* The most vertices of the animated meshes that are pre-skinned in a frame.
+ * Once they are used up, the rest are skinned by each of the passes. */
+#define CONFIG_PRESKIN_MAX_VERTS    (1024 * 1024)
+/* Static meshes switch to their coarser levels of detail as their share of 
+ * the screen's height, multiplied by CONFIG_MESH_LOD_BIAS, drops below the 
+ * levels' screen sizes. Below CONFIG_IMPOSTOR_SIZE, they are drawn as 
+ * billboards. */
+#define CONFIG_MESH_LOD_BIAS        1.0f
+#define CONFIG_IMPOSTOR_SIZE        0.04f
+/* The most chunks whose region of the minimap is rendered again per frame
+ * after their tiles were edited */
+#define CONFIG_MINIMAP_CHUNKS_PER_FRAME 16
+/* Resolution of the cached shadow map of the static geometry, which is split
+ * up into CONFIG_SHADOW_ATLAS_TILES by CONFIG_SHADOW_ATLAS_TILES tiles that 
+ * are drawn again separately, and of the shadow map of the moving objects */
+#define CONFIG_SHADOW_ATLAS_RES     4096
+#define CONFIG_SHADOW_ATLAS_TILES   8
+#define CONFIG_SHADOW_DYNAMIC_RES   2048
 #define CONFIG_WINDOWFLAGS          PF_WINDOWFLAGS_BORDERLESS_WINDOWED
 #define CONFIG_VSYNC                false
+/* The starting render settings, which may be changed at runtime. Below a 
+ * scale of 1, the scene is drawn at that fraction of the window resolution 
+ * and stretched over the window. With a non-zero target, the scale is 
+ * adjusted (down to the minimum) to keep the GPU time of the scene within it. */
+#define CONFIG_RENDER_SCALE         1.0f
+#define CONFIG_DYNAMIC_RES_TARGET_MS 0.0f
+#define CONFIG_MIN_RENDER_SCALE     0.5f
+/* Frame rate held while the window is in focus, or 0 for no limit. With 
+ * vsync, the buffer swaps pace the frames instead. */
+#define CONFIG_TARGET_FPS           60
+/* Frame rate held while the window is in the background or minimized */
+#define CONFIG_BACKGROUND_FPS       20
+/* Frame rate held after this many seconds without any user input */
+#define CONFIG_IDLE_FPS             30
+#define CONFIG_IDLE_SECS            30
+/* The most 60Hz simulation steps taken in a single frame to catch up with 
+ * real time. Beyond this, the simulation slows down rather than stalling
+ * the frame further. */
+#define CONFIG_MAX_SIM_STEPS        4
+/* Draw each frame on a render thread, while the main thread takes the 
+ * simulation steps for the next one. The 60Hz tick handlers then run 
+ * alongside the drawing - those that load or free assets, or otherwise touch
+ * the renderer, wait for the frame to be drawn first. They must not build UI,
+ * and minimaps or terrain can't be baked from the render event handlers. 
+ * Not used for recording or playing back sessions. */
+#define CONFIG_PIPELINED_RENDER     false
+/* Memory budget (in bytes) for cached navigation flow and LOS fields */
+#define CONFIG_NAV_CACHE_BUDGET     (64 * 1024 * 1024)
+/* Memory (in bytes) that the arena for per-frame temporaries keeps between
+ * frames that use less than this */
+#define CONFIG_FRAME_ARENA_BUDGET   (16 * 1024 * 1024)
+/* Watch the files of the loaded models, textures and shaders, and reload
+ * them when they change on disk. Only meant for development builds. */
+#define CONFIG_HOT_RELOAD           false
+#define CONFIG_HOT_RELOAD_POLL_MS   500
+/* Save the linked shader programs in 'shaders/programs.cache' and load
+ * them from there on later launches, when the driver supports it */
+#define CONFIG_SHADER_CACHE         true
+/* Python garbage collections that are expected to take longer than this 
+ * many milliseconds are put off for a while, in favour of younger ones */
+#define CONFIG_SCRIPT_GC_BUDGET_MS  2.0
+/* The game's script is run from the precompiled bundle next to it, when 
+ * there is one (see 'scripts/compile_scripts.py') */
+#define CONFIG_SCRIPT_BUNDLE        true
 
 #endif
@@ -177,6 +177,12 @@ void Cursor_SetRTSMode(bool on)
 
 bool Cursor_InitAll(const char *basedir)
 {
+#if defined(PF_HEADLESS)
+    /* There is no window for the cursors to be shown in. Setting a NULL
+     * cursor is harmless, so the rest of the API works as it is. */
+    return true;
+#endif
+
     for(int i = 0; i < ARR_SIZE(s_cursors); i++) {
     
         struct cursor_resource *curr = &s_cursors[i];
@@ -35,15 +35,73 @@
 
 #include "entity.h" 
 #include "anim/public/anim.h"
+#include "lib/public/kvec.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The low bits of a UID hold the index of the entity's block and the high
+ * bits hold the generation of the block. */
+#define POOL_INDEX_BITS     (20)
+#define POOL_INDEX_MASK     ((1u << POOL_INDEX_BITS) - 1)
+#define POOL_MAX_BLOCKS     (1u << POOL_INDEX_BITS)
+#define POOL_MAX_GEN        ((1u << (32 - POOL_INDEX_BITS)) - 1)
+#define POOL_CHUNK_BLOCKS   (256)
+#define POOL_BLOCK_ALIGN    (16)
+
+struct block_info{
+    uint16_t gen;
+    bool     live;
+};
 
 /*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
+/* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
+static size_t                   s_block_size;
+/* Blocks are carved out of fixed-size chunks, which are never reallocated */
+static kvec_t(unsigned char*)   s_chunks;
+static kvec_t(struct block_info) s_blocks;
+/* Indices of the free blocks. Used as a stack so that the most recently 
+ * freed (and likely still cached) blocks are reused first. */
+static kvec_t(uint32_t)         s_free;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static struct entity *block_ptr(uint32_t idx)
+{
+    return (struct entity*)(kv_A(s_chunks, idx / POOL_CHUNK_BLOCKS) 
+                          + (idx % POOL_CHUNK_BLOCKS) * s_block_size);
+}
+
+static bool pool_grow(void)
 {
+    if(kv_size(s_blocks) + POOL_CHUNK_BLOCKS > POOL_MAX_BLOCKS)
+        return false;
+
+    unsigned char *chunk = malloc(POOL_CHUNK_BLOCKS * s_block_size);
+    if(!chunk)
+        return false;
+    kv_push(unsigned char*, s_chunks, chunk);
+
+    /* Push the free indices in reverse, so that the lowest ones are handed out first */
+    uint32_t base = kv_size(s_blocks);
+    for(int i = 0; i < POOL_CHUNK_BLOCKS; i++)
+        kv_push(struct block_info, s_blocks, ((struct block_info){1, false}));
+    for(int i = POOL_CHUNK_BLOCKS-1; i >= 0; i--)
+        kv_push(uint32_t, s_free, base + i);
+
+    return true;
+}
+
+static void refresh_model_cache(struct entity *ent)
+{
+    if(!ent->transform_dirty)
+        return;
+
     mat4x4_t trans, scale, rot, tmp;
 
     PFM_Mat4x4_MakeTrans(ent->pos.x, ent->pos.y, ent->pos.z, &trans);
@@ -51,61 +109,36 @@ void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
     PFM_Mat4x4_RotFromQuat(&ent->rotation, &rot);
 
     PFM_Mat4x4_Mult4x4(&scale, &rot, &tmp);
-    PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
-}
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, &ent->model_cache);
 
-uint32_t Entity_NewUID(void)
-{
-    static uint32_t uid = 0;
-    return uid++;
+    ent->transform_dirty = false;
+    ent->obb_cache_aabb = NULL;
 }
 
-void Entity_CurrentOBB(const struct entity *ent, struct obb *out)
+static void make_obb(const struct entity *ent, const struct aabb *aabb, 
+                     const mat4x4_t *model, struct obb *out)
 {
-    const struct aabb *aabb;
-    if(ent->flags & ENTITY_FLAG_ANIMATED)
-        aabb = A_GetCurrPoseAABB(ent);
-    else
-        aabb = &ent->identity_aabb;
-
-    vec4_t identity_verts_homo[8] = {
-        {aabb->x_min, aabb->y_min, aabb->z_min, 1.0f},
-        {aabb->x_min, aabb->y_min, aabb->z_max, 1.0f},
-        {aabb->x_min, aabb->y_max, aabb->z_min, 1.0f},
-        {aabb->x_min, aabb->y_max, aabb->z_max, 1.0f},
-        {aabb->x_max, aabb->y_min, aabb->z_min, 1.0f},
-        {aabb->x_max, aabb->y_min, aabb->z_max, 1.0f},
-        {aabb->x_max, aabb->y_max, aabb->z_min, 1.0f},
-        {aabb->x_max, aabb->y_max, aabb->z_max, 1.0f},
-    };
-
-    vec4_t identity_center_homo = (vec4_t){
-        (aabb->x_min + aabb->x_max) / 2.0f,
-        (aabb->y_min + aabb->y_max) / 2.0f,
-        (aabb->z_min + aabb->z_max) / 2.0f,
-        1.0f
+    vec3_t identity_verts[9] = {
+        {aabb->x_min, aabb->y_min, aabb->z_min},
+        {aabb->x_min, aabb->y_min, aabb->z_max},
+        {aabb->x_min, aabb->y_max, aabb->z_min},
+        {aabb->x_min, aabb->y_max, aabb->z_max},
+        {aabb->x_max, aabb->y_min, aabb->z_min},
+        {aabb->x_max, aabb->y_min, aabb->z_max},
+        {aabb->x_max, aabb->y_max, aabb->z_min},
+        {aabb->x_max, aabb->y_max, aabb->z_max},
+        /* The center goes along with the corners */
+        {(aabb->x_min + aabb->x_max) / 2.0f,
+         (aabb->y_min + aabb->y_max) / 2.0f,
+         (aabb->z_min + aabb->z_max) / 2.0f},
     };
 
-    mat4x4_t model;
-    Entity_ModelMatrix(ent, &model);
-
-    vec4_t obb_verts_homo[8];
-    for(int i = 0; i < 8; i++) {
-        PFM_Mat4x4_Mult4x1(&model, identity_verts_homo + i, obb_verts_homo + i);
-        out->corners[i] = (vec3_t){
-            obb_verts_homo[i].x / obb_verts_homo[i].w,
-            obb_verts_homo[i].y / obb_verts_homo[i].w,
-            obb_verts_homo[i].z / obb_verts_homo[i].w,
-        };
-    }
+    /* The model matrix is affine, so the points need no perspective divide */
+    vec3_t obb_verts[9];
+    PFM_Mat4x4_TransformPoints(model, 9, identity_verts, obb_verts);
+    memcpy(out->corners, obb_verts, sizeof(out->corners));
+    out->center = obb_verts[8];
 
-    vec4_t obb_center_homo;
-    PFM_Mat4x4_Mult4x1(&model, &identity_center_homo, &obb_center_homo);
-    out->center = (vec3_t){
-        obb_center_homo.x / obb_center_homo.w,
-        obb_center_homo.y / obb_center_homo.w,
-        obb_center_homo.z / obb_center_homo.w,
-    };
     out->half_lengths[0] = (aabb->x_max - aabb->x_min) / 2.0f * ent->scale.x;
     out->half_lengths[1] = (aabb->y_max - aabb->y_min) / 2.0f * ent->scale.y;
     out->half_lengths[2] = (aabb->z_max - aabb->z_min) / 2.0f * ent->scale.z;
@@ -120,3 +153,163 @@ void Entity_CurrentOBB(const struct entity *ent, struct obb *out)
     PFM_Vec3_Normal(&axis2, &out->axes[2]);
 }
 
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void Entity_SetPos(struct entity *ent, vec3_t pos)
+{
+    ent->pos = pos;
+    ent->transform_dirty = true;
+}
+
+void Entity_SetRotation(struct entity *ent, quat_t rotation)
+{
+    ent->rotation = rotation;
+    ent->transform_dirty = true;
+}
+
+void Entity_SetScale(struct entity *ent, vec3_t scale)
+{
+    ent->scale = scale;
+    ent->transform_dirty = true;
+}
+
+void Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out)
+{
+    refresh_model_cache((struct entity*)ent);
+    *out = ent->model_cache;
+}
+
+vec3_t Entity_InterpolatedPos(const struct entity *ent, float frac)
+{
+    if(ent->flags & ENTITY_FLAG_STATIC)
+        return ent->pos;
+
+    vec3_t ret, delta;
+    PFM_Vec3_Sub((vec3_t*)&ent->pos, (vec3_t*)&ent->prev_pos, &delta);
+    PFM_Vec3_Scale(&delta, frac, &delta);
+    PFM_Vec3_Add((vec3_t*)&ent->prev_pos, &delta, &ret);
+    return ret;
+}
+
+void Entity_InterpolatedModelMatrix(const struct entity *ent, float frac, mat4x4_t *out)
+{
+    if(ent->flags & ENTITY_FLAG_STATIC) {
+        Entity_ModelMatrix(ent, out);
+        return;
+    }
+
+    mat4x4_t trans, scale, rot, tmp;
+    vec3_t pos = Entity_InterpolatedPos(ent, frac);
+
+    /* Normalized linear interpolation of the rotation, taking the shorter arc. 
+     * The rotation between ticks is small, so this is close enough to a slerp. */
+    quat_t from = ent->prev_rotation, to = ent->rotation, q;
+    float dot = from.x * to.x + from.y * to.y + from.z * to.z + from.w * to.w;
+    float sign = (dot < 0.0f) ? -1.0f : 1.0f;
+    for(int i = 0; i < 4; i++)
+        q.raw[i] = from.raw[i] + (sign * to.raw[i] - from.raw[i]) * frac;
+    PFM_Quat_Normal(&q, &q);
+
+    PFM_Mat4x4_MakeTrans(pos.x, pos.y, pos.z, &trans);
+    PFM_Mat4x4_MakeScale(ent->scale.x, ent->scale.y, ent->scale.z, &scale);
+    PFM_Mat4x4_RotFromQuat(&q, &rot);
+
+    PFM_Mat4x4_Mult4x4(&scale, &rot, &tmp);
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, out);
+}
+
+void Entity_CurrentOBB(const struct entity *ent, struct obb *out)
+{
+    const struct aabb *aabb;
+    if(ent->flags & ENTITY_FLAG_ANIMATED)
+        aabb = A_GetCurrPoseAABB(ent);
+    else
+        aabb = &ent->identity_aabb;
+
+    /* The cache is mutable state of an otherwise read-only entity */
+    struct entity *mut = (struct entity*)ent;
+    refresh_model_cache(mut);
+
+    if(ent->obb_cache_aabb != aabb) {
+        make_obb(ent, aabb, &ent->model_cache, &mut->obb_cache);
+        mut->obb_cache_aabb = aabb;
+    }
+    *out = ent->obb_cache;
+}
+
+bool Entity_PoolInit(size_t extra_bytes)
+{
+    s_block_size = sizeof(struct entity) + extra_bytes;
+    s_block_size = (s_block_size + POOL_BLOCK_ALIGN - 1) / POOL_BLOCK_ALIGN * POOL_BLOCK_ALIGN;
+
+    kv_init(s_chunks);
+    kv_init(s_blocks);
+    kv_init(s_free);
+    return true;
+}
+
+void Entity_PoolShutdown(void)
+{
+    for(int i = 0; i < kv_size(s_chunks); i++)
+        free(kv_A(s_chunks, i));
+
+    kv_destroy(s_chunks);
+    kv_destroy(s_blocks);
+    kv_destroy(s_free);
+}
+
+struct entity *Entity_PoolAlloc(void)
+{
+    if(kv_size(s_free) == 0 && !pool_grow())
+        return NULL;
+
+    uint32_t idx = kv_pop(s_free);
+    struct block_info *info = &kv_A(s_blocks, idx);
+    assert(!info->live);
+    info->live = true;
+
+    struct entity *ret = block_ptr(idx);
+    ret->uid = ((uint32_t)info->gen << POOL_INDEX_BITS) | idx;
+    return ret;
+}
+
+void Entity_PoolFree(struct entity *ent)
+{
+    uint32_t idx = ent->uid & POOL_INDEX_MASK;
+    struct block_info *info = &kv_A(s_blocks, idx);
+    assert(info->live && block_ptr(idx) == ent);
+    info->live = false;
+
+    /* Once the generations of a block run out, it is retired for good, 
+     * rather than letting its' UIDs repeat. */
+    if(info->gen == POOL_MAX_GEN)
+        return;
+
+    ++info->gen;
+    kv_push(uint32_t, s_free, idx);
+}
+
+struct entity *Entity_FromUID(uint32_t uid)
+{
+    uint32_t idx = uid & POOL_INDEX_MASK;
+    if(idx >= kv_size(s_blocks))
+        return NULL;
+
+    const struct block_info *info = &kv_A(s_blocks, idx);
+    if(!info->live || info->gen != (uid >> POOL_INDEX_BITS))
+        return NULL;
+
+    return block_ptr(idx);
+}
+
+uint32_t Entity_PoolIndex(uint32_t uid)
+{
+    return uid & POOL_INDEX_MASK;
+}
+
+size_t Entity_PoolCapacity(void)
+{
+    return kv_size(s_blocks);
+}
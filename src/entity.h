@@ -54,6 +54,11 @@ struct entity{
     vec3_t       pos;
     vec3_t       scale;
     quat_t       rotation;
+    /* The position and rotation as of the previous 30Hz simulation tick. The
+     * rendered transform is interpolated from these towards 'pos' and 'rotation'
+     * so that motion stays smooth at any frame rate. */
+    vec3_t       prev_pos;
+    quat_t       prev_rotation;
     uint32_t     flags;
     void        *render_private;
     void        *anim_private;
@@ -63,10 +68,42 @@ struct entity{
     struct aabb  identity_aabb;
     float        selection_radius;
     float        max_speed; /* units: OpenGL coordinates / second */
+    /* Cache of the world transform and bounds. 'transform_dirty' must be set 
+     * whenever 'pos', 'rotation' or 'scale' is changed, which is taken care of 
+     * by the 'Entity_Set*' functions. The cached OBB is also rebuilt when the 
+     * local AABB it was made from changes, as when the animation advances. */
+    bool               transform_dirty;
+    mat4x4_t           model_cache;
+    struct obb         obb_cache;
+    const struct aabb *obb_cache_aabb;
 };
 
+void     Entity_SetPos(struct entity *ent, vec3_t pos);
+void     Entity_SetRotation(struct entity *ent, quat_t rotation);
+void     Entity_SetScale(struct entity *ent, vec3_t scale);
+
 void     Entity_ModelMatrix(const struct entity *ent, mat4x4_t *out);
-uint32_t Entity_NewUID(void);
+/* 'frac' is in the range [0, 1], 0 giving the previous tick's transform and 1 
+ * giving the current one. Static entities are always at their current transform. */
+void     Entity_InterpolatedModelMatrix(const struct entity *ent, float frac, mat4x4_t *out);
+vec3_t   Entity_InterpolatedPos(const struct entity *ent, float frac);
 void     Entity_CurrentOBB(const struct entity *ent, struct obb *out);
 
+/* Entities are allocated from a pool of fixed-size blocks, which are never moved, 
+ * so pointers to a live entity stay valid. The UID of a pooled entity is a 
+ * generational handle to its' block: UIDs are never handed out twice, and a 
+ * stale UID no longer resolves to an entity. 'extra_bytes' of storage directly 
+ * follow every entity. */
+bool           Entity_PoolInit(size_t extra_bytes);
+void           Entity_PoolShutdown(void);
+/* Only the 'uid' field of the returned entity is initialized. */
+struct entity *Entity_PoolAlloc(void);
+void           Entity_PoolFree(struct entity *ent);
+/* Returns NULL if there is no live entity with this UID. */
+struct entity *Entity_FromUID(uint32_t uid);
+/* The index of the entity's block, in the range [0, Entity_PoolCapacity()). 
+ * Stable for the lifetime of the entity, for keeping per-entity side tables. */
+uint32_t       Entity_PoolIndex(uint32_t uid);
+size_t         Entity_PoolCapacity(void);
+
 #endif
@@ -34,18 +34,34 @@
  */
 
 #include "event.h"
+#include "perf.h"
 #include "lib/public/khash.h"
+#include "lib/public/flat_hash.h"
 #include "lib/public/kvec.h"
+#include "lib/public/small_vec.h"
 #include "lib/public/queue.h"
+#include "lib/public/mpsc_queue.h"
+
+#include <SDL_thread.h>
+#include <SDL_atomic.h>
+#include <SDL_timer.h>
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 
 #define EVENT_QUEUE_SIZE_DEAULT 2048
+/* Must be a power of two */
+#define EVENT_RING_SIZE         1024
+#define ARR_SIZE(a)             (sizeof(a)/sizeof(a[0]))
 
 enum handler_type{
     HANDLER_TYPE_ENGINE,
     HANDLER_TYPE_SCRIPT,
+    /* Left in the place of a handler that was unregistered while its list 
+     * was being dispatched */
+    HANDLER_TYPE_REMOVED,
 };
 
 struct handler_desc{
@@ -55,6 +71,8 @@ struct handler_desc{
         script_opaque_t as_script_callable;
     }handler;
     void *user_arg;
+    /* Profiling zone name - only set for engine handlers */
+    const char *name;
 };
 
 struct event{
@@ -70,15 +88,80 @@ struct event{
  */
 #define GLOBAL_ID (~((uint32_t)0))
 
-typedef kvec_t(struct handler_desc) kvec_handler_desc_t;
-KHASH_MAP_INIT_INT64(handler_desc, kvec_handler_desc_t)
+/* The handler lists of global events are found by indexing a table of pages 
+ * with the event type, covering all of the SDL, engine and script ranges.
+ * Only entity events, and script events past the end of the script range, 
+ * are looked up in the hash table. */
+#define GLOBAL_PAGE_SHIFT   (8)
+#define GLOBAL_PAGE_SIZE    (1 << GLOBAL_PAGE_SHIFT)
+#define GLOBAL_NUM_PAGES    (0x30000 >> GLOBAL_PAGE_SHIFT)
+
+/* Handlers may register and unregister others (or themselves) from inside a
+ * dispatch of the same list. While a list is being dispatched, removed 
+ * handlers are only marked and new ones are appended, so that the indices
+ * being iterated stay valid. The list is compacted when the outermost 
+ * dispatch returns. */
+struct handler_list{
+    svec_t(struct handler_desc, 2) handlers;
+    int                            depth;
+    bool                           dirty;
+};
+
+FLATHASH_MAP_INIT_INT64(handler_desc, struct handler_list*)
+KHASH_MAP_INIT_INT(policy, int)
+
+struct batch_handler{
+    script_opaque_t callable;
+    script_opaque_t user_arg;
+};
+
+/* Script handlers that receive all the events of one type sent to any 
+ * entity, gathered up and delivered once per E_ServiceQueue call. The 
+ * pending arguments are owned script objects. */
+struct entity_batch{
+    kvec_t(struct batch_handler) handlers;
+    kvec_t(uint32_t)             uids;
+    kvec_t(script_opaque_t)      args;
+    /* Handlers unregistered during delivery have their callable cleared */
+    bool                         delivering;
+    bool                         dirty;
+};
+
+KHASH_MAP_INIT_INT(batch, struct entity_batch*)
+
+/* Keyed by the address of the callable, which is retained by the table so 
+ * that the address can't be reused by another object */
+KHASH_MAP_INIT_INT64(profile, struct script_handler_stats)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static khash_t(handler_desc) *s_event_handler_table;
+static const char             s_script_handler_zone[] = "script handler";
+
+static fh_t(handler_desc)   *s_event_handler_table;
+static struct handler_list   *s_global_pages[GLOBAL_NUM_PAGES];
 static queue_t               *s_event_queue;
+static SDL_threadID           s_main_tid;
+/* Only looked up when an event is queued right after one it could be
+ * merged with */
+static khash_t(policy)       *s_policies;
+static khash_t(batch)        *s_batches;
+
+static khash_t(profile)      *s_profile;
+/* Script-generated events held back once the budget has been used up */
+static queue_t               *s_deferred_queue;
+static uint64_t               s_script_budget;
+static uint64_t               s_script_ticks;
+
+/* Events posted from other threads. The ring is drained by the main thread
+ * without taking any locks. Should it ever fill up, the events spill over 
+ * into a locked queue until the main thread has caught up, so that a worker
+ * never has to wait on the main thread to make room. */
+static mpsc_queue_t          *s_async_ring;
+static queue_t               *s_overflow_queue;
+static SDL_SpinLock           s_overflow_lock;
+static SDL_atomic_t           s_overflowed;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
@@ -100,97 +183,451 @@ static uint64_t e_key(uint32_t ent_id, enum eventtype event)
     return (((uint64_t)ent_id) << 32) | (uint64_t)event;
 }
 
-static bool e_register_handler(uint64_t key, struct handler_desc *desc)
+static struct handler_list *e_hashed_list(uint64_t key, bool create)
 {
-    khiter_t k;
-    k = kh_get(handler_desc, s_event_handler_table, key);
+    uint32_t k = fh_get(handler_desc, s_event_handler_table, key);
+    if(k != fh_end(s_event_handler_table))
+        return fh_value(s_event_handler_table, k);
+
+    if(!create)
+        return NULL;
+
+    struct handler_list *list = calloc(1, sizeof(struct handler_list));
+    if(!list)
+        return NULL;
+    sv_init(list->handlers);
+
+    int ret;
+    k = fh_put(handler_desc, s_event_handler_table, key, &ret);
+    if(ret == -1) {
+        free(list);
+        return NULL;
+    }
+    fh_value(s_event_handler_table, k) = list;
+    return list;
+}
 
-    if(k == kh_end(s_event_handler_table)) {
+static struct handler_list *e_list(uint32_t receiver_id, enum eventtype event, bool create)
+{
+    if(receiver_id != GLOBAL_ID || (uint32_t)event >= GLOBAL_NUM_PAGES * GLOBAL_PAGE_SIZE)
+        return e_hashed_list(e_key(receiver_id, event), create);
 
-        kvec_handler_desc_t newv;
-        kv_init(newv);
-        kv_push(struct handler_desc, newv, *desc);
+    struct handler_list **page = &s_global_pages[event >> GLOBAL_PAGE_SHIFT];
+    if(!*page && create)
+        *page = calloc(GLOBAL_PAGE_SIZE, sizeof(struct handler_list));
+    if(!*page)
+        return NULL;
 
-        int ret;
-        k = kh_put(handler_desc, s_event_handler_table, key, &ret);
-        assert(ret == 1);
-        kh_value(s_event_handler_table, k) = newv;
+    return &(*page)[event & (GLOBAL_PAGE_SIZE - 1)];
+}
 
-    }else{
-    
-        kvec_handler_desc_t vec = kh_value(s_event_handler_table, k);
-        kv_push(struct handler_desc, vec, *desc);
-        kh_value(s_event_handler_table, k) = vec;
+static void e_compact(struct handler_list *list)
+{
+    size_t nkept = 0;
+    for(int i = 0; i < sv_size(list->handlers); i++) {
+        if(sv_A(list->handlers, i).type != HANDLER_TYPE_REMOVED)
+            sv_A(list->handlers, nkept++) = sv_A(list->handlers, i);
     }
+    list->handlers.n = nkept;
+    list->dirty = false;
+}
 
+static bool e_register_handler(uint32_t receiver_id, enum eventtype event, 
+                               struct handler_desc *desc)
+{
+    struct handler_list *list = e_list(receiver_id, event, true);
+    if(!list)
+        return false;
+
+    sv_push(struct handler_desc, list->handlers, *desc);
     return true;
 }
 
-static bool e_unregister_handler(uint64_t key, struct handler_desc *desc)
+static bool e_unregister_handler(uint32_t receiver_id, enum eventtype event, 
+                                 struct handler_desc *desc)
 {
-    khiter_t k;
-    k = kh_get(handler_desc, s_event_handler_table, key);
-
-    if(k == kh_end(s_event_handler_table))
+    struct handler_list *list = e_list(receiver_id, event, false);
+    if(!list)
         return false;
 
-    kvec_handler_desc_t vec = kh_value(s_event_handler_table, k);
-
     int idx;
-    kv_indexof(struct handler_desc, vec, *desc, handlers_equal, idx);
+    sv_indexof(struct handler_desc, list->handlers, *desc, handlers_equal, idx);
     if(idx == -1)
         return false;
-    struct handler_desc to_del = kv_A(vec, idx);
+    struct handler_desc *to_del = &sv_A(list->handlers, idx);
 
-    if(to_del.type == HANDLER_TYPE_SCRIPT) {
+    if(to_del->type == HANDLER_TYPE_SCRIPT) {
 
-        S_Release(to_del.handler.as_script_callable);
-        S_Release(to_del.user_arg); 
+        S_Release(to_del->handler.as_script_callable);
+        S_Release(to_del->user_arg); 
     }
 
-    kv_del(struct handler_desc, vec, idx);
-    kh_value(s_event_handler_table, k) = vec;
+    /* Preserve the order that the rest of the handlers are called in */
+    to_del->type = HANDLER_TYPE_REMOVED;
+    list->dirty = true;
+    if(!list->depth)
+        e_compact(list);
 
     return true;
 }
 
+static void e_profile_add(script_opaque_t callable, uint64_t ticks)
+{
+    double ms = ticks * 1000.0 / SDL_GetPerformanceFrequency();
+
+    int ret;
+    khiter_t k = kh_put(profile, s_profile, (uint64_t)(uintptr_t)callable, &ret);
+    if(ret == -1)
+        return;
+
+    struct script_handler_stats *stats = &kh_value(s_profile, k);
+    if(ret != 0) {
+        S_Retain(callable);
+        *stats = (struct script_handler_stats){.callable = callable};
+    }
+
+    stats->calls++;
+    stats->total_ms += ms;
+    if(ms > stats->max_ms)
+        stats->max_ms = ms;
+}
+
+static void e_run_script_handler(script_opaque_t callable, script_opaque_t user_arg, 
+                                 script_opaque_t arg)
+{
+    Perf_Push(s_script_handler_zone);
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    /* The handler may unregister itself and drop the last reference */
+    S_Retain(callable);
+    S_RunEventHandler(callable, user_arg, arg);
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+    s_script_ticks += elapsed;
+    e_profile_add(callable, elapsed);
+    S_Release(callable);
+    Perf_Pop();
+}
+
+static bool e_over_budget(void)
+{
+    return s_script_budget && s_script_ticks > s_script_budget;
+}
+
+static const char *e_event_zone(enum eventtype type)
+{
+    switch(type) {
+    case SDL_WINDOWEVENT:               return "SDL_WINDOWEVENT";
+    case SDL_KEYDOWN:                   return "SDL_KEYDOWN";
+    case SDL_KEYUP:                     return "SDL_KEYUP";
+    case SDL_MOUSEMOTION:               return "SDL_MOUSEMOTION";
+    case SDL_MOUSEBUTTONDOWN:           return "SDL_MOUSEBUTTONDOWN";
+    case SDL_MOUSEBUTTONUP:             return "SDL_MOUSEBUTTONUP";
+    case SDL_MOUSEWHEEL:                return "SDL_MOUSEWHEEL";
+    case EVENT_UPDATE_START:            return "EVENT_UPDATE_START";
+    case EVENT_UPDATE_END:              return "EVENT_UPDATE_END";
+    case EVENT_UPDATE_UI:               return "EVENT_UPDATE_UI";
+    case EVENT_RENDER_3D:               return "EVENT_RENDER_3D";
+    case EVENT_RENDER_UI:               return "EVENT_RENDER_UI";
+    case EVENT_SELECTED_TILE_CHANGED:   return "EVENT_SELECTED_TILE_CHANGED";
+    case EVENT_NEW_GAME:                return "EVENT_NEW_GAME";
+    case EVENT_UNIT_SELECTION_CHANGED:  return "EVENT_UNIT_SELECTION_CHANGED";
+    case EVENT_60HZ_TICK:               return "EVENT_60HZ_TICK";
+    case EVENT_30HZ_TICK:               return "EVENT_30HZ_TICK";
+    case EVENT_10HZ_TICK:               return "EVENT_10HZ_TICK";
+    case EVENT_1HZ_TICK:                return "EVENT_1HZ_TICK";
+    case EVENT_ANIM_FINISHED:           return "EVENT_ANIM_FINISHED";
+    case EVENT_MOTION_START:            return "EVENT_MOTION_START";
+    case EVENT_MOTION_END:              return "EVENT_MOTION_END";
+    case EVENT_ENTER_RANGE:             return "EVENT_ENTER_RANGE";
+    case EVENT_LEAVE_RANGE:             return "EVENT_LEAVE_RANGE";
+    default: break;
+    }
+
+    if(type <= SDL_LASTEVENT)
+        return "SDL event";
+    if(type <= EVENT_ENGINE_LAST)
+        return "engine event";
+    return "script event";
+}
+
+static struct entity_batch *e_batch(enum eventtype event, bool create)
+{
+    khiter_t k = kh_get(batch, s_batches, event);
+    if(k != kh_end(s_batches))
+        return kh_value(s_batches, k);
+
+    if(!create)
+        return NULL;
+
+    struct entity_batch *batch = calloc(1, sizeof(struct entity_batch));
+    if(!batch)
+        return NULL;
+
+    int ret;
+    k = kh_put(batch, s_batches, event, &ret);
+    if(ret == -1) {
+        free(batch);
+        return NULL;
+    }
+    kh_value(s_batches, k) = batch;
+    return batch;
+}
+
+/* Engine event arguments are wrapped at most once per event, the first 
+ * time a script needs them. The wrapped argument is immutable, so it can 
+ * be shared by all the handlers. */
+static script_opaque_t e_script_arg(const struct event *event, script_opaque_t *wrapped)
+{
+    if(event->source == ES_SCRIPT)
+        return event->arg;
+
+    if(!*wrapped)
+        *wrapped = S_WrapEngineEventArg(event->type, event->arg);
+    return *wrapped;
+}
+
+static void e_batch_event(const struct event *event, script_opaque_t *wrapped)
+{
+    struct entity_batch *batch = e_batch(event->type, false);
+    if(!batch || !kv_size(batch->handlers))
+        return;
+
+    script_opaque_t arg = e_script_arg(event, wrapped);
+    S_Retain(arg);
+
+    kv_push(uint32_t, batch->uids, event->receiver_id);
+    kv_push(script_opaque_t, batch->args, arg);
+}
+
+static void e_deliver_batch(struct entity_batch *batch)
+{
+    script_opaque_t list = S_WrapEntityBatch(kv_size(batch->uids), batch->uids.a, batch->args.a);
+    for(int i = 0; i < kv_size(batch->args); i++)
+        S_Release(kv_A(batch->args, i));
+    kv_reset(batch->uids);
+    kv_reset(batch->args);
+
+    /* Handlers registered during the delivery only get the next batch */
+    batch->delivering = true;
+    size_t count = kv_size(batch->handlers);
+    for(int i = 0; i < count; i++) {
+
+        struct batch_handler bh = kv_A(batch->handlers, i);
+        if(!bh.callable)
+            continue;
+
+        e_run_script_handler(bh.callable, bh.user_arg, list);
+    }
+    batch->delivering = false;
+    S_Release(list);
+
+    if(!batch->dirty)
+        return;
+
+    size_t nkept = 0;
+    for(int i = 0; i < kv_size(batch->handlers); i++) {
+        if(kv_A(batch->handlers, i).callable)
+            kv_A(batch->handlers, nkept++) = kv_A(batch->handlers, i);
+    }
+    batch->handlers.n = nkept;
+    batch->dirty = false;
+}
+
+static void e_deliver_batches(void)
+{
+    if(!kh_size(s_batches))
+        return;
+
+    /* Handlers may add batches for other events, so the table is not 
+     * iterated while they run */
+    struct entity_batch *pending[kh_size(s_batches)];
+    size_t npending = 0;
+
+    for(khiter_t k = kh_begin(s_batches); k != kh_end(s_batches); k++) {
+
+        if(!kh_exist(s_batches, k))
+            continue;
+        if(kv_size(kh_value(s_batches, k)->uids))
+            pending[npending++] = kh_value(s_batches, k);
+    }
+
+    for(int i = 0; i < npending; i++)
+        e_deliver_batch(pending[i]);
+}
+
 static void e_handle_event(struct event event)
 {
-    khiter_t k;
-    uint64_t key = e_key(event.receiver_id, event.type);
-    k = kh_get(handler_desc, s_event_handler_table, key);
-    
-    if(k == kh_end(s_event_handler_table))
-        return; 
-    
-    kvec_handler_desc_t vec = kh_value(s_event_handler_table, k);
+    script_opaque_t wrapped = NULL;
+    Perf_CountEvent(event.type);
+
+    if(event.receiver_id != GLOBAL_ID && kh_size(s_batches))
+        e_batch_event(&event, &wrapped);
+
+    struct handler_list *list = e_list(event.receiver_id, event.type, false);
+    if(!list || !sv_size(list->handlers))
+        goto out;
+
+    Perf_Push(e_event_zone(event.type));
+    list->depth++;
 
-    for(int i = 0; i < kv_size(vec); i++) {
+    /* Handlers registered during the dispatch are first called for the 
+     * next event. The list may be reallocated by them, so the entries are
+     * always accessed through it. */
+    size_t count = sv_size(list->handlers);
+    for(int i = 0; i < count; i++) {
     
-        struct handler_desc *elem = &kv_A(vec, i);
+        struct handler_desc elem = sv_A(list->handlers, i);
     
-        if(elem->type == HANDLER_TYPE_ENGINE) {
-            elem->handler.as_function(elem->user_arg, event.arg);
-        }else if(elem->type == HANDLER_TYPE_SCRIPT) {
+        if(elem.type == HANDLER_TYPE_ENGINE) {
 
-            script_opaque_t script_arg = event.source == ES_SCRIPT ? event.arg 
-                : S_WrapEngineEventArg(event.type, event.arg);
+            Perf_Push(elem.name);
+            elem.handler.as_function(elem.user_arg, event.arg);
+            Perf_Pop();
+
+        }else if(elem.type == HANDLER_TYPE_SCRIPT) {
+
+            script_opaque_t script_arg = e_script_arg(&event, &wrapped);
             assert(script_arg);
-            S_RunEventHandler(elem->handler.as_script_callable, elem->user_arg, script_arg);
+            e_run_script_handler(elem.handler.as_script_callable, elem.user_arg, script_arg);
         }
     }
 
+    if(--list->depth == 0 && list->dirty)
+        e_compact(list);
+    Perf_Pop();
+
+out:
+    S_Release(wrapped);
     if(event.source == ES_SCRIPT)
         S_Release(event.arg);
 }
 
+static bool e_sum_deltas(SDL_Event *into, const SDL_Event *from)
+{
+    switch(into->type) {
+    case SDL_MOUSEMOTION:
+        if(into->motion.which != from->motion.which)
+            return false;
+        into->motion.timestamp = from->motion.timestamp;
+        into->motion.state = from->motion.state;
+        into->motion.x = from->motion.x;
+        into->motion.y = from->motion.y;
+        into->motion.xrel += from->motion.xrel;
+        into->motion.yrel += from->motion.yrel;
+        return true;
+    case SDL_MOUSEWHEEL:
+        if(into->wheel.which != from->wheel.which
+        || into->wheel.direction != from->wheel.direction)
+            return false;
+        into->wheel.timestamp = from->wheel.timestamp;
+        into->wheel.x += from->wheel.x;
+        into->wheel.y += from->wheel.y;
+        return true;
+    default: 
+        assert(0);
+        return false;
+    }
+}
+
+/* Returns true if 'event' was merged into 'back' and must not be queued */
+static bool e_coalesce(struct event *back, struct event *event)
+{
+    if(back->type != event->type 
+    || back->receiver_id != event->receiver_id
+    || back->source != event->source)
+        return false;
+
+    khiter_t k = kh_get(policy, s_policies, event->type);
+    if(k == kh_end(s_policies))
+        return false;
+
+    switch(kh_value(s_policies, k)) {
+    case EC_KEEP_LATEST:
+        if(back->source == ES_SCRIPT)
+            S_Release(back->arg);
+        back->arg = event->arg;
+        return true;
+
+    case EC_SUM_DELTAS:
+        if(back->source == ES_SCRIPT)
+            return false;
+        return e_sum_deltas(back->arg, event->arg);
+
+    case EC_DROP_DUPLICATES:
+        if(back->source == ES_SCRIPT) {
+            if(!S_ObjectsEqual(back->arg, event->arg))
+                return false;
+            S_Release(event->arg);
+            return true;
+        }
+        return back->arg == event->arg;
+
+    default:
+        return false;
+    }
+}
+
+static void e_push(struct event *event)
+{
+    if(SDL_ThreadID() == s_main_tid) {
+
+        struct event *back = queue_back(s_event_queue);
+        if(back && e_coalesce(back, event))
+            return;
+
+        queue_push(s_event_queue, event);
+        return;
+    }
+
+    /* Script objects may only be touched by the main thread */
+    assert(event->source == ES_ENGINE);
+
+    /* Once anything has spilled over, later events have to follow it there 
+     * to be delivered in the order they were posted */
+    if(!SDL_AtomicGet(&s_overflowed) && 0 == mpsc_queue_push(s_async_ring, event))
+        return;
+
+    SDL_AtomicLock(&s_overflow_lock);
+    queue_push(s_overflow_queue, event);
+    SDL_AtomicSet(&s_overflowed, 1);
+    SDL_AtomicUnlock(&s_overflow_lock);
+}
+
+static void e_service_async(void)
+{
+    struct event event;
+    while(0 == mpsc_queue_pop(s_async_ring, &event))
+        e_handle_event(event);
+
+    if(!SDL_AtomicGet(&s_overflowed))
+        return;
+
+    /* Drained in batches, so that the producers don't contend for the lock 
+     * with every single pop */
+    struct event batch[64];
+    for(;;) {
+
+        SDL_AtomicLock(&s_overflow_lock);
+        size_t npopped = queue_pop_n(s_overflow_queue, batch, ARR_SIZE(batch));
+        if(!npopped)
+            SDL_AtomicSet(&s_overflowed, 0);
+        SDL_AtomicUnlock(&s_overflow_lock);
+
+        if(!npopped)
+            break;
+        for(size_t i = 0; i < npopped; i++)
+            e_handle_event(batch[i]);
+    }
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 bool E_Init(void)
 {
-    s_event_handler_table = kh_init(handler_desc);
+    s_event_handler_table = fh_init(handler_desc);
     if(!s_event_handler_table)
         goto fail_table;
 
@@ -198,45 +635,191 @@ bool E_Init(void)
     if(!s_event_queue)
         goto fail_queue; 
 
+    s_async_ring = mpsc_queue_init(sizeof(struct event), EVENT_RING_SIZE);
+    if(!s_async_ring)
+        goto fail_ring;
+
+    s_overflow_queue = queue_init(sizeof(struct event), EVENT_RING_SIZE);
+    if(!s_overflow_queue)
+        goto fail_overflow;
+
+    s_policies = kh_init(policy);
+    if(!s_policies)
+        goto fail_policies;
+
+    s_batches = kh_init(batch);
+    if(!s_batches)
+        goto fail_batches;
+
+    s_profile = kh_init(profile);
+    if(!s_profile)
+        goto fail_profile;
+
+    s_deferred_queue = queue_init(sizeof(struct event), EVENT_QUEUE_SIZE_DEAULT);
+    if(!s_deferred_queue)
+        goto fail_deferred;
+
+    s_main_tid = SDL_ThreadID();
+    SDL_AtomicSet(&s_overflowed, 0);
+
+    E_SetCoalescePolicy(SDL_MOUSEMOTION, EC_SUM_DELTAS);
+    E_SetCoalescePolicy(SDL_MOUSEWHEEL, EC_SUM_DELTAS);
     return true;
         
+fail_deferred:
+    kh_destroy(profile, s_profile);
+fail_profile:
+    kh_destroy(batch, s_batches);
+fail_batches:
+    kh_destroy(policy, s_policies);
+fail_policies:
+    queue_free(s_overflow_queue);
+fail_overflow:
+    mpsc_queue_free(s_async_ring);
+fail_ring:
+    queue_free(s_event_queue);
 fail_queue:
-    kh_destroy(handler_desc, s_event_handler_table);
+    fh_destroy(handler_desc, s_event_handler_table);
 fail_table:
     return false;
 }
 
 void E_Shutdown(void)
 {
-    khiter_t k;
-    for (k = kh_begin(s_event_handler_table); k != kh_end(s_event_handler_table); ++k) {
+    for(uint32_t k = fh_begin(s_event_handler_table); k != fh_end(s_event_handler_table); ++k) {
 
-        uint64_t key = kh_key(s_event_handler_table, k);
-    
-        if (kh_exist(s_event_handler_table, k)) {
-        
-            kvec_handler_desc_t vec = kh_value(s_event_handler_table, k);
-            kv_destroy(vec);
-        }
+        if(!fh_exist(s_event_handler_table, k))
+            continue;
+
+        struct handler_list *list = fh_value(s_event_handler_table, k);
+        sv_destroy(list->handlers);
+        free(list);
     }
+    fh_destroy(handler_desc, s_event_handler_table);
 
-    kh_destroy(handler_desc, s_event_handler_table);
+    for(int i = 0; i < GLOBAL_NUM_PAGES; i++) {
+
+        if(!s_global_pages[i])
+            continue;
+
+        for(int j = 0; j < GLOBAL_PAGE_SIZE; j++)
+            sv_destroy(s_global_pages[i][j].handlers);
+        free(s_global_pages[i]);
+        s_global_pages[i] = NULL;
+    }
+
+    /* The interpreter is gone by now, so the script objects are not released */
+    for(khiter_t k = kh_begin(s_batches); k != kh_end(s_batches); k++) {
+
+        if(!kh_exist(s_batches, k))
+            continue;
+
+        struct entity_batch *batch = kh_value(s_batches, k);
+        kv_destroy(batch->handlers);
+        kv_destroy(batch->uids);
+        kv_destroy(batch->args);
+        free(batch);
+    }
+    kh_destroy(batch, s_batches);
+
+    kh_destroy(profile, s_profile);
+    queue_free(s_deferred_queue);
+    kh_destroy(policy, s_policies);
+    queue_free(s_overflow_queue);
+    mpsc_queue_free(s_async_ring);
     queue_free(s_event_queue);
 }
 
+bool E_SetCoalescePolicy(enum eventtype event, enum coalesce_policy policy)
+{
+    if(policy == EC_SUM_DELTAS && event != SDL_MOUSEMOTION && event != SDL_MOUSEWHEEL)
+        return false;
+
+    if(policy == EC_NONE) {
+        khiter_t k = kh_get(policy, s_policies, event);
+        if(k != kh_end(s_policies))
+            kh_del(policy, s_policies, k);
+        return true;
+    }
+
+    int ret;
+    khiter_t k = kh_put(policy, s_policies, event, &ret);
+    if(ret == -1)
+        return false;
+    kh_value(s_policies, k) = policy;
+    return true;
+}
+
+const char *E_EventName(enum eventtype type)
+{
+    return e_event_zone(type);
+}
+
+void E_SetScriptBudget(double ms)
+{
+    s_script_budget = ms > 0.0 ? (uint64_t)(ms / 1000.0 * SDL_GetPerformanceFrequency()) : 0;
+}
+
+size_t E_GetScriptHandlerStats(struct script_handler_stats *out, size_t max)
+{
+    size_t n = 0;
+    for(khiter_t k = kh_begin(s_profile); k != kh_end(s_profile); k++) {
+
+        if(!kh_exist(s_profile, k))
+            continue;
+        if(n < max)
+            out[n] = kh_value(s_profile, k);
+        n++;
+    }
+    return n;
+}
+
+void E_ResetScriptHandlerStats(void)
+{
+    for(khiter_t k = kh_begin(s_profile); k != kh_end(s_profile); k++) {
+
+        if(!kh_exist(s_profile, k))
+            continue;
+        S_Release(kh_value(s_profile, k).callable);
+    }
+    kh_clear(profile, s_profile);
+}
+
 void E_ServiceQueue(void)
 {
+    PERF_ENTER();
+    s_script_ticks = 0;
+
     e_handle_event( (struct event){EVENT_UPDATE_START, NULL, ES_ENGINE, GLOBAL_ID} );
+    e_service_async();
 
+    /* Events held back during the last call go first. Those that have to 
+     * wait again are cycled to the back, which leaves their order as is. */
     struct event event;
+    size_t ndeferred = queue_get_size(s_deferred_queue);
+    for(size_t i = 0; i < ndeferred; i++) {
+
+        queue_pop(s_deferred_queue, &event);
+        if(i > 0 && e_over_budget())
+            queue_push(s_deferred_queue, &event);
+        else
+            e_handle_event(event);
+    }
+
     while(0 == queue_pop(s_event_queue, &event)) {
-    
+
+        if(event.source == ES_SCRIPT && e_over_budget()) {
+            queue_push(s_deferred_queue, &event);
+            continue;
+        }
         e_handle_event(event);
         /* event arg already released */
     }
+    e_deliver_batches();
 
     e_handle_event( (struct event){EVENT_UPDATE_UI,  NULL, ES_ENGINE, GLOBAL_ID} );
     e_handle_event( (struct event){EVENT_UPDATE_END, NULL, ES_ENGINE, GLOBAL_ID} );
+    PERF_RETURN();
 }
 
 /*
@@ -246,17 +829,19 @@ void E_ServiceQueue(void)
 void E_Global_Notify(enum eventtype event, void *event_arg, enum event_source source)
 {
     struct event e = (struct event){event, event_arg, source, GLOBAL_ID};
-    queue_push(s_event_queue, &e);
+    e_push(&e);
 }
 
-bool E_Global_Register(enum eventtype event, handler_t handler, void *user_arg)
+bool E_Global_RegisterNamed(enum eventtype event, handler_t handler, const char *name, 
+                            void *user_arg)
 {
     struct handler_desc hd;
     hd.type = HANDLER_TYPE_ENGINE;
     hd.handler.as_function = handler;
     hd.user_arg = user_arg;
+    hd.name = name;
 
-    return e_register_handler(e_key(GLOBAL_ID, event), &hd);
+    return e_register_handler(GLOBAL_ID, event, &hd);
 }
 
 bool E_Global_Unregister(enum eventtype event, handler_t handler)
@@ -265,7 +850,7 @@ bool E_Global_Unregister(enum eventtype event, handler_t handler)
     hd.type = HANDLER_TYPE_ENGINE;
     hd.handler.as_function = handler;
 
-    return e_unregister_handler(e_key(GLOBAL_ID, event), &hd);
+    return e_unregister_handler(GLOBAL_ID, event, &hd);
 }
 
 bool E_Global_ScriptRegister(enum eventtype event, script_opaque_t handler, script_opaque_t user_arg)
@@ -275,7 +860,7 @@ bool E_Global_ScriptRegister(enum eventtype event, script_opaque_t handler, scri
     hd.handler.as_script_callable = handler;
     hd.user_arg = user_arg;
 
-    return e_register_handler(e_key(GLOBAL_ID, event), &hd);
+    return e_register_handler(GLOBAL_ID, event, &hd);
 }
 
 bool E_Global_ScriptUnregister(enum eventtype event, script_opaque_t handler)
@@ -284,7 +869,7 @@ bool E_Global_ScriptUnregister(enum eventtype event, script_opaque_t handler)
     hd.type = HANDLER_TYPE_SCRIPT;
     hd.handler.as_script_callable = handler;
 
-    return e_unregister_handler(e_key(GLOBAL_ID, event), &hd);
+    return e_unregister_handler(GLOBAL_ID, event, &hd);
 }
 
 void E_Global_NotifyImmediate(enum eventtype event, void *event_arg, enum event_source source)
@@ -297,14 +882,16 @@ void E_Global_NotifyImmediate(enum eventtype event, void *event_arg, enum event_
  * Entity Events
  */
 
-bool E_Entity_Register(enum eventtype event, uint32_t ent_uid, handler_t handler, void *user_arg)
+bool E_Entity_RegisterNamed(enum eventtype event, uint32_t ent_uid, handler_t handler, 
+                            const char *name, void *user_arg)
 {
     struct handler_desc hd;
     hd.type = HANDLER_TYPE_ENGINE;
     hd.handler.as_function = handler;
     hd.user_arg = user_arg;
+    hd.name = name;
 
-    return e_register_handler(e_key(ent_uid, event), &hd);
+    return e_register_handler(ent_uid, event, &hd);
 }
 
 bool E_Entity_Unregister(enum eventtype event, uint32_t ent_uid, handler_t handler)
@@ -313,7 +900,7 @@ bool E_Entity_Unregister(enum eventtype event, uint32_t ent_uid, handler_t handl
     hd.type = HANDLER_TYPE_ENGINE;
     hd.handler.as_function = handler;
 
-    return e_unregister_handler(e_key(ent_uid, event), &hd);
+    return e_unregister_handler(ent_uid, event, &hd);
 }
 
 bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid, 
@@ -324,7 +911,7 @@ bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid,
     hd.handler.as_script_callable = handler;
     hd.user_arg = user_arg;
 
-    return e_register_handler(e_key(ent_uid, event), &hd);
+    return e_register_handler(ent_uid, event, &hd);
 }
 
 bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid, 
@@ -334,13 +921,52 @@ bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid,
     hd.type = HANDLER_TYPE_SCRIPT;
     hd.handler.as_script_callable = handler;
 
-    return e_unregister_handler(e_key(ent_uid, event), &hd);
+    return e_unregister_handler(ent_uid, event, &hd);
+}
+
+bool E_Entity_ScriptRegisterBatch(enum eventtype event, script_opaque_t handler, 
+                                  script_opaque_t user_arg)
+{
+    struct entity_batch *batch = e_batch(event, true);
+    if(!batch)
+        return false;
+
+    struct batch_handler bh = (struct batch_handler){handler, user_arg};
+    kv_push(struct batch_handler, batch->handlers, bh);
+    return true;
+}
+
+bool E_Entity_ScriptUnregisterBatch(enum eventtype event, script_opaque_t handler)
+{
+    struct entity_batch *batch = e_batch(event, false);
+    if(!batch)
+        return false;
+
+    for(int i = 0; i < kv_size(batch->handlers); i++) {
+
+        struct batch_handler *bh = &kv_A(batch->handlers, i);
+        if(!bh->callable || !S_ObjectsEqual(bh->callable, handler))
+            continue;
+
+        S_Release(bh->callable);
+        S_Release(bh->user_arg);
+
+        if(batch->delivering) {
+            bh->callable = NULL;
+            batch->dirty = true;
+        }else{
+            memmove(bh, bh + 1, (kv_size(batch->handlers) - i - 1) * sizeof(*bh));
+            batch->handlers.n--;
+        }
+        return true;
+    }
+    return false;
 }
 
 void E_Entity_Notify(enum eventtype event, uint32_t ent_uid, void *event_arg, 
                      enum event_source source)
 {
     struct event e = (struct event){event, event_arg, source, ent_uid};
-    queue_push(s_event_queue, &e);
+    e_push(&e);
 }
 
@@ -40,6 +40,8 @@
 
 #include <SDL_events.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
 
 
 enum eventtype{
@@ -72,6 +74,10 @@ enum eventtype{
     EVENT_ANIM_FINISHED,
     EVENT_MOTION_START,
     EVENT_MOTION_END,
+    /* Sent to the owner of a proximity trigger, with the UID of the entity 
+     * that came into or went out of its' range as the argument */
+    EVENT_ENTER_RANGE,
+    EVENT_LEAVE_RANGE,
 
     EVENT_ENGINE_LAST = 0x1ffff,
 };
@@ -81,8 +87,34 @@ enum event_source{
     ES_SCRIPT,
 };
 
+/* How a queued event is merged with the one queued right before it, when 
+ * both are of the same type and for the same receiver. Only events from 
+ * the same run are merged, so the order relative to other events is kept. 
+ * Events handled immediately, or posted from other threads, are never 
+ * merged. */
+enum coalesce_policy{
+    EC_NONE,
+    /* The earlier event takes the argument of the later one */
+    EC_KEEP_LATEST,
+    /* The relative motion of the two events is added up, the absolute 
+     * state is taken from the later one. Only for SDL_MOUSEMOTION and 
+     * SDL_MOUSEWHEEL. */
+    EC_SUM_DELTAS,
+    /* The later event is dropped if it has the same argument */
+    EC_DROP_DUPLICATES,
+};
+
 typedef void (*handler_t)(void*, void*);
 
+/* The time spent in a single script handler, over all the events and batches 
+ * it was called with since the stats were last reset */
+struct script_handler_stats{
+    script_opaque_t callable;
+    uint64_t        calls;
+    double          total_ms;
+    double          max_ms;
+};
+
 /*###########################################################################*/
 /* EVENT GENERAL                                                             */
 /*###########################################################################*/
@@ -91,14 +123,48 @@ bool E_Init(void);
 void E_ServiceQueue(void);
 void E_Shutdown(void);
 
+/* Mouse motion and wheel events have their deltas summed by default */
+bool E_SetCoalescePolicy(enum eventtype event, enum coalesce_policy policy);
+
+/* The name of the event type, as shown by the profiler. Types without a name
+ * of their own are named after their range. */
+const char *E_EventName(enum eventtype type);
+
+/* Once the script handlers have run for longer than the budget during an 
+ * E_ServiceQueue call, the script-generated events still in the queue are 
+ * held back until the next call. Their order is kept, and at least one of 
+ * them is handled per call. Engine events are never held back. A budget of 
+ * 0 (the default) disables the limit. */
+void   E_SetScriptBudget(double ms);
+
+/* Writes up to 'max' entries to 'out' and returns the total number of script 
+ * handlers that have been called since the last reset. The callables are 
+ * borrowed references, valid until the next reset. */
+size_t E_GetScriptHandlerStats(struct script_handler_stats *out, size_t max);
+void   E_ResetScriptHandlerStats(void);
+
 /*###########################################################################*/
 /* EVENT GLOBAL                                                              */
 /*###########################################################################*/
 
+/* Queued events are handled by the main thread in E_ServiceQueue. They can
+ * be posted from any thread without taking a lock - the argument must then
+ * stay valid until the event has been handled, and the source must be 
+ * ES_ENGINE. Events from other threads are delivered in the order each 
+ * thread posted them, at the start of the next E_ServiceQueue call. */
 void E_Global_Notify(enum eventtype event, void *event_arg, enum event_source);
 void E_Global_NotifyImmediate(enum eventtype event, void *event_arg, enum event_source);
 
-bool E_Global_Register(enum eventtype event, handler_t handler, void *user_arg);
+/* The handler's name is kept for the per-handler profiling zones. Static 
+ * handlers in different files may share a name, so it is qualified with 
+ * the file name. */
+#define E_HANDLER_NAME(handler) (__FILE__ ":" #handler)
+
+#define E_Global_Register(event, handler, user_arg) \
+    E_Global_RegisterNamed((event), (handler), E_HANDLER_NAME(handler), (user_arg))
+
+bool E_Global_RegisterNamed(enum eventtype event, handler_t handler, const char *name, 
+                            void *user_arg);
 bool E_Global_Unregister(enum eventtype event, handler_t handler);
 
 bool E_Global_ScriptRegister(enum eventtype event, script_opaque_t handler, 
@@ -110,14 +176,25 @@ bool E_Global_ScriptUnregister(enum eventtype event, script_opaque_t handler);
 /* EVENT ENTITY                                                              */
 /*###########################################################################*/
 
-bool E_Entity_Register(enum eventtype event, uint32_t ent_uid, handler_t handler, 
-                       void *user_arg);
+#define E_Entity_Register(event, ent_uid, handler, user_arg) \
+    E_Entity_RegisterNamed((event), (ent_uid), (handler), E_HANDLER_NAME(handler), (user_arg))
+
+bool E_Entity_RegisterNamed(enum eventtype event, uint32_t ent_uid, handler_t handler, 
+                            const char *name, void *user_arg);
 bool E_Entity_Unregister(enum eventtype event, uint32_t ent_uid, handler_t handler);
 
 bool E_Entity_ScriptRegister(enum eventtype event, uint32_t ent_uid, 
                              script_opaque_t handler, script_opaque_t user_arg);
 bool E_Entity_ScriptUnregister(enum eventtype event, uint32_t ent_uid, 
                                script_opaque_t handler);
+/* Batch handlers are called once per E_ServiceQueue call with a list of 
+ * (entity, argument) tuples, holding every event of the type that was sent 
+ * to any entity since the last call. They are called after all the queued 
+ * events have been handled, in addition to any handlers registered with the
+ * entities themselves. */
+bool E_Entity_ScriptRegisterBatch(enum eventtype event, script_opaque_t handler, 
+                                  script_opaque_t user_arg);
+bool E_Entity_ScriptUnregisterBatch(enum eventtype event, script_opaque_t handler);
 void E_Entity_Notify(enum eventtype, uint32_t ent_uid, void *event_arg, enum event_source);
 
 #endif
@@ -0,0 +1,386 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "cull_index.h"
+#include "../entity.h"
+#include "../map/public/tile.h"
+#include "../lib/public/khash.h"
+
+#include <assert.h>
+#include <math.h>
+
+#define BUCKET_X_DIM    (TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE)
+#define BUCKET_Z_DIM    (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE)
+#define LOOSE_BUCKET    (-1)
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+struct bucket{
+    struct aabb     bounds;
+    /* Set when an entity is removed - the bounds are shrunk lazily */
+    bool            dirty;
+    pentity_kvec_t  ents;
+    obb_kvec_t      obbs;
+    /* The same OBBs as 'obbs', laid out for batched culling */
+    struct obb_soa  soa;
+};
+
+/* Where an entity is stored within the index */
+struct idx_pos{
+    int bucket;
+    int idx;
+};
+
+KHASH_MAP_INIT_INT64(bucket, int)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static kvec_t(struct bucket)  s_buckets;
+/* Maps the packed cell coordinates to indices in 's_buckets' */
+static khash_t(bucket)       *s_bucket_table;
+static pentity_kvec_t         s_loose;
+/* Indexed by the entity's pool index. 'idx' is -1 for entities not in the index. */
+static kvec_t(struct idx_pos) s_pos;
+/* Scratch buffers for the queries */
+static kvec_t(uint32_t)       s_mask;
+static obb_kvec_t             s_loose_obbs;
+static struct obb_soa         s_loose_soa;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool indexable(const struct entity *ent)
+{
+    return (ent->flags & ENTITY_FLAG_STATIC) && !(ent->flags & ENTITY_FLAG_ANIMATED);
+}
+
+static struct idx_pos *idx_pos(const struct entity *ent)
+{
+    uint32_t idx = Entity_PoolIndex(ent->uid);
+    while(kv_size(s_pos) <= idx)
+        kv_push(struct idx_pos, s_pos, ((struct idx_pos){LOOSE_BUCKET, -1}));
+    return &kv_A(s_pos, idx);
+}
+
+static void aabb_from_obb(const struct obb *obb, struct aabb *out)
+{
+    *out = (struct aabb){
+        INFINITY, -INFINITY,
+        INFINITY, -INFINITY,
+        INFINITY, -INFINITY,
+    };
+    for(int i = 0; i < 8; i++) {
+        out->x_min = MIN(out->x_min, obb->corners[i].x);
+        out->x_max = MAX(out->x_max, obb->corners[i].x);
+        out->y_min = MIN(out->y_min, obb->corners[i].y);
+        out->y_max = MAX(out->y_max, obb->corners[i].y);
+        out->z_min = MIN(out->z_min, obb->corners[i].z);
+        out->z_max = MAX(out->z_max, obb->corners[i].z);
+    }
+}
+
+static void aabb_union(struct aabb *inout, const struct aabb *other)
+{
+    inout->x_min = MIN(inout->x_min, other->x_min);
+    inout->x_max = MAX(inout->x_max, other->x_max);
+    inout->y_min = MIN(inout->y_min, other->y_min);
+    inout->y_max = MAX(inout->y_max, other->y_max);
+    inout->z_min = MIN(inout->z_min, other->z_min);
+    inout->z_max = MAX(inout->z_max, other->z_max);
+}
+
+static void bucket_recompute_bounds(struct bucket *bucket)
+{
+    bucket->bounds = (struct aabb){
+        INFINITY, -INFINITY,
+        INFINITY, -INFINITY,
+        INFINITY, -INFINITY,
+    };
+    for(int i = 0; i < kv_size(bucket->obbs); i++) {
+        struct aabb curr; 
+        aabb_from_obb(&kv_A(bucket->obbs, i), &curr);
+        aabb_union(&bucket->bounds, &curr);
+    }
+    bucket->dirty = false;
+}
+
+/* Returns a bitmask of the boxes which may intersect the frustum. It is valid 
+ * until the next call. */
+static const uint32_t *cull_obbs(const struct frustum *frustum, const struct obb_soa *soa)
+{
+    size_t words = (soa->size + 31) / 32;
+    if(kv_max(s_mask) < words + 1)
+        kv_resize(uint32_t, s_mask, words + 1);
+    C_FrustumOBBsCull(frustum, soa, s_mask.a);
+    return s_mask.a;
+}
+
+/* Returns the index of the bucket for the cell containing the entity's position, 
+ * creating it if necessary. */
+static int bucket_for_ent(const struct entity *ent)
+{
+    int32_t cx = floorf(ent->pos.x / BUCKET_X_DIM);
+    int32_t cz = floorf(ent->pos.z / BUCKET_Z_DIM);
+    khint64_t key = ((khint64_t)(uint32_t)cx << 32) | (uint32_t)cz;
+
+    khiter_t k = kh_get(bucket, s_bucket_table, key);
+    if(k != kh_end(s_bucket_table))
+        return kh_value(s_bucket_table, k);
+
+    int ret;
+    k = kh_put(bucket, s_bucket_table, key, &ret);
+    assert(ret != -1);
+
+    struct bucket new_bucket = (struct bucket){.dirty = true};
+    kv_init(new_bucket.ents);
+    kv_init(new_bucket.obbs);
+    C_OBBSoA_Init(&new_bucket.soa);
+    kv_push(struct bucket, s_buckets, new_bucket);
+
+    kh_value(s_bucket_table, k) = kv_size(s_buckets) - 1;
+    return kv_size(s_buckets) - 1;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_CullIdx_Init(void)
+{
+    s_bucket_table = kh_init(bucket);
+    if(!s_bucket_table)
+        return false;
+
+    kv_init(s_buckets);
+    kv_init(s_loose);
+    kv_init(s_pos);
+    kv_init(s_mask);
+    kv_init(s_loose_obbs);
+    C_OBBSoA_Init(&s_loose_soa);
+    return true;
+}
+
+void G_CullIdx_Shutdown(void)
+{
+    G_CullIdx_Clear();
+
+    kv_destroy(s_buckets);
+    kv_destroy(s_loose);
+    kv_destroy(s_pos);
+    kv_destroy(s_mask);
+    kv_destroy(s_loose_obbs);
+    C_OBBSoA_Destroy(&s_loose_soa);
+    kh_destroy(bucket, s_bucket_table);
+}
+
+void G_CullIdx_Clear(void)
+{
+    for(int i = 0; i < kv_size(s_buckets); i++) {
+        kv_destroy(kv_A(s_buckets, i).ents);
+        kv_destroy(kv_A(s_buckets, i).obbs);
+        C_OBBSoA_Destroy(&kv_A(s_buckets, i).soa);
+    }
+
+    kv_reset(s_buckets);
+    kh_clear(bucket, s_bucket_table);
+    kv_reset(s_loose);
+    kv_reset(s_pos);
+}
+
+void G_CullIdx_Add(struct entity *ent)
+{
+    struct idx_pos *pos = idx_pos(ent);
+    assert(pos->idx < 0);
+
+    if(!indexable(ent)) {
+        *pos = (struct idx_pos){LOOSE_BUCKET, kv_size(s_loose)};
+        kv_push(struct entity*, s_loose, ent);
+        return;
+    }
+
+    int bidx = bucket_for_ent(ent);
+    struct bucket *bucket = &kv_A(s_buckets, bidx);
+
+    struct obb obb;
+    struct aabb bounds;
+    Entity_CurrentOBB(ent, &obb);
+    aabb_from_obb(&obb, &bounds);
+
+    size_t idx = kv_size(bucket->ents);
+    if(!C_OBBSoA_Resize(&bucket->soa, idx + 1)) {
+        /* Fall back to testing the entity on its' own */
+        *pos = (struct idx_pos){LOOSE_BUCKET, kv_size(s_loose)};
+        kv_push(struct entity*, s_loose, ent);
+        return;
+    }
+    C_OBBSoA_Set(&bucket->soa, idx, &obb);
+
+    *pos = (struct idx_pos){bidx, idx};
+    kv_push(struct entity*, bucket->ents, ent);
+    kv_push(struct obb, bucket->obbs, obb);
+
+    if(bucket->dirty)
+        bucket_recompute_bounds(bucket);
+    else
+        aabb_union(&bucket->bounds, &bounds);
+}
+
+void G_CullIdx_Remove(struct entity *ent)
+{
+    struct idx_pos *pos = idx_pos(ent);
+    assert(pos->idx >= 0);
+
+    pentity_kvec_t *ents;
+    obb_kvec_t *obbs = NULL;
+    struct obb_soa *soa = NULL;
+
+    if(pos->bucket == LOOSE_BUCKET) {
+        ents = &s_loose;
+    }else{
+        struct bucket *bucket = &kv_A(s_buckets, pos->bucket);
+        bucket->dirty = true;
+        ents = &bucket->ents;
+        obbs = &bucket->obbs;
+        soa = &bucket->soa;
+    }
+
+    /* Move the last entry into the hole */
+    struct entity *last = kv_pop(*ents);
+    struct obb last_obb;
+    if(obbs)
+        last_obb = kv_pop(*obbs);
+
+    if(pos->idx < kv_size(*ents)) {
+        kv_A(*ents, pos->idx) = last;
+        if(obbs) {
+            kv_A(*obbs, pos->idx) = last_obb;
+            C_OBBSoA_Set(soa, pos->idx, &last_obb);
+        }
+        idx_pos(last)->idx = pos->idx;
+    }
+    if(soa)
+        C_OBBSoA_Resize(soa, kv_size(*ents));
+    pos->idx = -1;
+}
+
+void G_CullIdx_Update(struct entity *ent)
+{
+    struct idx_pos *pos = idx_pos(ent);
+    if(pos->idx < 0 || pos->bucket == LOOSE_BUCKET)
+        return;
+
+    G_CullIdx_Remove(ent);
+    G_CullIdx_Add(ent);
+}
+
+void G_CullIdx_QueryFrustum(const struct frustum *frustum, pentity_kvec_t *out_ents, 
+                            obb_kvec_t *out_obbs, vis_range_kvec_t *out_ranges)
+{
+    for(int i = 0; i < kv_size(s_buckets); i++) {
+
+        struct bucket *bucket = &kv_A(s_buckets, i);
+        if(kv_size(bucket->ents) == 0)
+            continue;
+
+        if(bucket->dirty)
+            bucket_recompute_bounds(bucket);
+
+        /* The exact test is more expensive, but it is only done once per bucket 
+         * and it rejects the buckets just outside the corners of the frustum 
+         * which the fast test lets through. */
+        if(!C_FrustumAABBIntersectionExact(frustum, &bucket->bounds))
+            continue;
+
+        const uint32_t *mask = cull_obbs(frustum, &bucket->soa);
+        size_t begin = kv_size(*out_ents);
+
+        for(int j = 0; j < kv_size(bucket->ents); j++) {
+
+            if(!(mask[j / 32] & (1u << (j % 32))))
+                continue;
+
+            kv_push(struct entity*, *out_ents, kv_A(bucket->ents, j));
+            kv_push(struct obb, *out_obbs, kv_A(bucket->obbs, j));
+        }
+
+        if(kv_size(*out_ents) > begin) {
+            struct vis_range range = (struct vis_range){bucket->bounds, true, begin, kv_size(*out_ents)};
+            kv_push(struct vis_range, *out_ranges, range);
+        }
+    }
+
+    /* The loose entities' bounds may have changed since the last query, so their 
+     * OBBs are gathered anew */
+    size_t nloose = kv_size(s_loose);
+    if(kv_max(s_loose_obbs) < nloose)
+        kv_resize(struct obb, s_loose_obbs, nloose);
+    kv_size(s_loose_obbs) = nloose;
+
+    const uint32_t *mask = NULL;
+    if(C_OBBSoA_Resize(&s_loose_soa, nloose)) {
+
+        for(int i = 0; i < nloose; i++) {
+            Entity_CurrentOBB(kv_A(s_loose, i), &kv_A(s_loose_obbs, i));
+            C_OBBSoA_Set(&s_loose_soa, i, &kv_A(s_loose_obbs, i));
+        }
+        mask = cull_obbs(frustum, &s_loose_soa);
+    }else{
+        for(int i = 0; i < nloose; i++)
+            Entity_CurrentOBB(kv_A(s_loose, i), &kv_A(s_loose_obbs, i));
+    }
+
+    size_t begin = kv_size(*out_ents);
+    for(int i = 0; i < nloose; i++) {
+
+        const struct obb *obb = &kv_A(s_loose_obbs, i);
+        bool visible = mask ? (mask[i / 32] & (1u << (i % 32)))
+                            : (C_FrustumOBBIntersectionFast(frustum, obb) != VOLUME_INTERSEC_OUTSIDE);
+        if(!visible)
+            continue;
+
+        kv_push(struct entity*, *out_ents, kv_A(s_loose, i));
+        kv_push(struct obb, *out_obbs, *obb);
+    }
+
+    if(kv_size(*out_ents) > begin) {
+        struct vis_range range = (struct vis_range){.bounded = false, .begin = begin, .end = kv_size(*out_ents)};
+        kv_push(struct vis_range, *out_ranges, range);
+    }
+}
+
@@ -0,0 +1,92 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef CULL_INDEX_H
+#define CULL_INDEX_H
+
+#include "public/game.h"
+#include "../collision.h"
+#include "../lib/public/kvec.h"
+
+#include <stdbool.h>
+
+/* An index over all the active entities for frustum culling and picking. 
+ *
+ * Entities which are static and not animated never change their bounds, so 
+ * they are bucketed by position into chunk-sized cells with their OBBs cached. 
+ * Whole buckets are discarded with a single exact test against the bucket's 
+ * bounds. All other entities are kept in a single 'loose' list. Within a 
+ * bucket or the loose list, the OBBs are tested in batches.
+ */
+
+typedef kvec_t(struct obb) obb_kvec_t;
+
+/* A run of entries [begin, end) of the query results. The entries of a bounded 
+ * run all lie within 'bounds', so that later tests against the results can 
+ * skip the whole run at once. */
+struct vis_range{
+    struct aabb bounds;
+    bool        bounded;
+    size_t      begin, end;
+};
+
+typedef kvec_t(struct vis_range) vis_range_kvec_t;
+
+bool G_CullIdx_Init(void);
+void G_CullIdx_Shutdown(void);
+void G_CullIdx_Clear(void);
+
+void G_CullIdx_Add(struct entity *ent);
+void G_CullIdx_Remove(struct entity *ent);
+
+/* ------------------------------------------------------------------------
+ * Must be called after the position, rotation or scale of an indexed entity
+ * is changed from outside of the simulation. Has no effect on entities which 
+ * are not in the index.
+ * ------------------------------------------------------------------------
+ */
+void G_CullIdx_Update(struct entity *ent);
+
+/* ------------------------------------------------------------------------
+ * Appends the entities which may intersect the frustum, along with their 
+ * current OBBs, to 'out_ents' and 'out_obbs'. The runs of the results which 
+ * came from a single bucket are appended to 'out_ranges'.
+ * ------------------------------------------------------------------------
+ */
+void G_CullIdx_QueryFrustum(const struct frustum *frustum, pentity_kvec_t *out_ents, 
+                            obb_kvec_t *out_obbs, vis_range_kvec_t *out_ranges);
+
+#endif
+
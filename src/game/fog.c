@@ -0,0 +1,573 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "fog.h"
+#include "../render/public/render.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../entity.h"
+#include "../perf.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+
+#define UNEXPLORED_TEXEL    (0)
+#define EXPLORED_TEXEL      (110)
+#define VISIBLE_TEXEL       (255)
+#define MAX_RADIUS_TILES    (64)
+/* Height above the terrain of the eyes of the sources, and of whatever they
+ * are looking at */
+#define EYE_HEIGHT          (2.0f)
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+typedef kvec_t(uint32_t) cell_kvec_t;
+
+struct fog_source{
+    uint32_t         uid;
+    float            radius;
+    /* The tile and the range in tiles that the vision was last stamped at. 
+     * A range of -1 forces the vision to be stamped again. */
+    int              r, c;
+    int              radius_tiles;
+    /* The cells whose count the vision is holding up */
+    cell_kvec_t      cells;
+};
+
+KHASH_MAP_INIT_INT(fog_src, int)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const struct map        *s_map;
+static vec3_t                   s_map_pos;
+static int                      s_rows, s_cols;
+
+static bool                     s_enabled;
+static bool                     s_height_los;
+/* The number of sources seeing each tile, and the brightness of each tile 
+ * as it's uploaded to the fog texture. Any tile that isn't unexplored has 
+ * been seen at some point. */
+static uint16_t                *s_counts;
+static uint8_t                 *s_texels;
+/* Terrain height at the center of each tile, only kept for the height test */
+static float                   *s_heights;
+/* The rows [begin, end) have changed since the last upload */
+static int                      s_dirty_begin, s_dirty_end;
+
+static kvec_t(struct fog_source) s_sources;
+static khash_t(fog_src)        *s_source_idx;
+/* The old cells of a source being stamped again */
+static cell_kvec_t              s_old_cells;
+
+/* For each range, the half-width in tiles of each row of the circle of tiles
+ * within it, from the top row to the bottom. Made when first needed. */
+static int                     *s_stamps[MAX_RADIUS_TILES + 1];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The '+ radius' rounds out the circle, so that small circles don't come out
+ * as diamonds */
+static const int *g_fog_circle(int radius)
+{
+    if(s_stamps[radius])
+        return s_stamps[radius];
+
+    int *hw = malloc((2 * radius + 1) * sizeof(int));
+    if(!hw)
+        return NULL;
+
+    for(int dr = -radius; dr <= radius; dr++)
+        hw[dr + radius] = (int)sqrtf((float)(radius * radius + radius - dr * dr));
+
+    s_stamps[radius] = hw;
+    return hw;
+}
+
+static int g_fog_radius_tiles(float radius)
+{
+    int ret = (int)ceilf(radius / X_COORDS_PER_TILE);
+    return MIN(MAX(ret, 0), MAX_RADIUS_TILES);
+}
+
+static bool g_fog_tile(vec2_t xz, int *out_r, int *out_c)
+{
+    int c = (int)floorf((s_map_pos.x - xz.x) / X_COORDS_PER_TILE);
+    int r = (int)floorf((xz.y - s_map_pos.z) / Z_COORDS_PER_TILE);
+
+    if(r < 0 || r >= s_rows || c < 0 || c >= s_cols)
+        return false;
+
+    *out_r = r;
+    *out_c = c;
+    return true;
+}
+
+static void g_fog_mark_dirty(int row)
+{
+    s_dirty_begin = MIN(s_dirty_begin, row);
+    s_dirty_end = MAX(s_dirty_end, row + 1);
+}
+
+static bool g_fog_sample_heights(void)
+{
+    s_heights = malloc((size_t)s_rows * s_cols * sizeof(float));
+    if(!s_heights)
+        return false;
+
+    vec2_t centers[s_cols];
+    for(int r = 0; r < s_rows; r++) {
+
+        for(int c = 0; c < s_cols; c++) {
+            centers[c] = (vec2_t){
+                s_map_pos.x - (c + 0.5f) * X_COORDS_PER_TILE,
+                s_map_pos.z + (r + 0.5f) * Z_COORDS_PER_TILE
+            };
+        }
+        M_HeightAtPoints(s_map, centers, s_heights + (size_t)r * s_cols, s_cols);
+    }
+    return true;
+}
+
+/* The line of sight is blocked by any tile in between that rises above the 
+ * line from the eyes at one end to the other. The navigation layer's line of
+ * sight test is about passability, so it can't be used for this. */
+static bool g_fog_los(int r0, int c0, int r1, int c1)
+{
+    int dr = r1 - r0, dc = c1 - c0;
+    int steps = MAX(abs(dr), abs(dc));
+
+    float h0 = s_heights[r0 * s_cols + c0] + EYE_HEIGHT;
+    float h1 = s_heights[r1 * s_cols + c1] + EYE_HEIGHT;
+
+    for(int i = 1; i < steps; i++) {
+
+        float t = (float)i / steps;
+        int r = r0 + (int)roundf(dr * t);
+        int c = c0 + (int)roundf(dc * t);
+
+        if(s_heights[r * s_cols + c] > h0 + (h1 - h0) * t)
+            return false;
+    }
+    return true;
+}
+
+static void g_fog_release_cells(const uint32_t *cells, size_t count)
+{
+    for(int i = 0; i < count; i++) {
+
+        uint32_t idx = cells[i];
+        if(--s_counts[idx] == 0) {
+            s_texels[idx] = EXPLORED_TEXEL;
+            g_fog_mark_dirty(idx / s_cols);
+        }
+    }
+}
+
+static void g_fog_unstamp(struct fog_source *src)
+{
+    g_fog_release_cells(src->cells.a, kv_size(src->cells));
+    kv_reset(src->cells);
+    src->radius_tiles = -1;
+}
+
+static void g_fog_stamp(struct fog_source *src, int r, int c, int radius)
+{
+    const int *hw = g_fog_circle(radius);
+    if(!hw) {
+        src->radius_tiles = -1;
+        return;
+    }
+
+    for(int dr = -radius; dr <= radius; dr++) {
+
+        int row = r + dr;
+        if(row < 0 || row >= s_rows)
+            continue;
+
+        int c_lo = MAX(c - hw[dr + radius], 0);
+        int c_hi = MIN(c + hw[dr + radius], s_cols - 1);
+
+        for(int col = c_lo; col <= c_hi; col++) {
+
+            if(s_height_los && !g_fog_los(r, c, row, col))
+                continue;
+
+            uint32_t idx = row * s_cols + col;
+            if(s_counts[idx]++ == 0) {
+                s_texels[idx] = VISIBLE_TEXEL;
+                g_fog_mark_dirty(row);
+            }
+            kv_push(uint32_t, src->cells, idx);
+        }
+    }
+
+    src->r = r;
+    src->c = c;
+    src->radius_tiles = radius;
+}
+
+/* The new cells are counted before the old ones are released, so that the 
+ * cells seen from both places don't go dark in between */
+static void g_fog_update_source(struct fog_source *src, const struct entity *ent)
+{
+    int r, c;
+    if(!g_fog_tile((vec2_t){ent->pos.x, ent->pos.z}, &r, &c)) {
+        g_fog_unstamp(src);
+        return;
+    }
+
+    int radius = g_fog_radius_tiles(src->radius);
+    if(r == src->r && c == src->c && radius == src->radius_tiles)
+        return;
+
+    /* Swap the buffers rather than copying the cells over */
+    cell_kvec_t tmp = src->cells;
+    src->cells = s_old_cells;
+    s_old_cells = tmp;
+    kv_reset(src->cells);
+
+    g_fog_stamp(src, r, c, radius);
+    g_fog_release_cells(s_old_cells.a, kv_size(s_old_cells));
+}
+
+static void g_fog_del_source(int idx)
+{
+    struct fog_source *src = &kv_A(s_sources, idx);
+    if(s_enabled)
+        g_fog_unstamp(src);
+
+    khiter_t k = kh_get(fog_src, s_source_idx, src->uid);
+    kh_del(fog_src, s_source_idx, k);
+    kv_destroy(src->cells);
+
+    struct fog_source last = kv_pop(s_sources);
+    if(idx == kv_size(s_sources))
+        return;
+
+    kv_A(s_sources, idx) = last;
+    k = kh_get(fog_src, s_source_idx, last.uid);
+    kh_value(s_source_idx, k) = idx;
+}
+
+static bool g_fog_shown(const struct entity *ent)
+{
+    int r, c;
+    if(!g_fog_tile((vec2_t){ent->pos.x, ent->pos.z}, &r, &c))
+        return false;
+
+    uint8_t texel = s_texels[r * s_cols + c];
+    if(ent->flags & ENTITY_FLAG_STATIC)
+        return (texel != UNEXPLORED_TEXEL);
+    return (texel == VISIBLE_TEXEL);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Fog_Init(const struct map *map)
+{
+    s_source_idx = kh_init(fog_src);
+    if(!s_source_idx)
+        return false;
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    s_map = map;
+    s_map_pos = M_GetPos(map);
+    s_rows = res.chunk_h * res.tile_h;
+    s_cols = res.chunk_w * res.tile_w;
+
+    kv_init(s_sources);
+    kv_init(s_old_cells);
+    return true;
+}
+
+void G_Fog_Shutdown(void)
+{
+    if(!s_map)
+        return;
+
+    G_Fog_Disable();
+
+    for(int i = 0; i < kv_size(s_sources); i++)
+        kv_destroy(kv_A(s_sources, i).cells);
+
+    kv_destroy(s_sources);
+    kv_destroy(s_old_cells);
+    kh_destroy(fog_src, s_source_idx);
+
+    for(int i = 0; i <= MAX_RADIUS_TILES; i++) {
+        free(s_stamps[i]);
+        s_stamps[i] = NULL;
+    }
+    s_map = NULL;
+}
+
+void G_Fog_RemoveEntity(const struct entity *ent)
+{
+    if(!s_map)
+        return;
+
+    khiter_t k = kh_get(fog_src, s_source_idx, ent->uid);
+    if(k != kh_end(s_source_idx))
+        g_fog_del_source(kh_value(s_source_idx, k));
+}
+
+void G_Fog_Update(void)
+{
+    if(!s_enabled)
+        return;
+
+    PERF_ENTER();
+
+    for(int i = 0; i < kv_size(s_sources);) {
+
+        struct fog_source *src = &kv_A(s_sources, i);
+        const struct entity *ent = Entity_FromUID(src->uid);
+        if(!ent) {
+            g_fog_del_source(i);
+            continue;
+        }
+
+        g_fog_update_source(src, ent);
+        i++;
+    }
+    PERF_RETURN();
+}
+
+void G_Fog_Cull(pentity_kvec_t *ents, obb_kvec_t *obbs, vis_range_kvec_t *ranges)
+{
+    if(!s_enabled)
+        return;
+
+    /* The number of entities kept before each index */
+    size_t count = kv_size(*ents);
+    size_t kept_before[count + 1];
+    size_t kept = 0;
+
+    for(int i = 0; i < count; i++) {
+
+        kept_before[i] = kept;
+        if(!g_fog_shown(kv_A(*ents, i)))
+            continue;
+
+        kv_A(*ents, kept) = kv_A(*ents, i);
+        kv_A(*obbs, kept) = kv_A(*obbs, i);
+        kept++;
+    }
+    kept_before[count] = kept;
+    kv_size(*ents) = kept;
+    kv_size(*obbs) = kept;
+
+    for(int i = 0; i < kv_size(*ranges); i++) {
+
+        struct vis_range *range = &kv_A(*ranges, i);
+        range->begin = kept_before[range->begin];
+        range->end = kept_before[range->end];
+    }
+}
+
+void G_Fog_Render(void)
+{
+    if(!s_enabled || s_dirty_begin >= s_dirty_end)
+        return;
+
+    R_GL_FogUpload(s_texels, s_cols, s_dirty_begin, s_dirty_end);
+    s_dirty_begin = s_rows;
+    s_dirty_end = 0;
+}
+
+bool G_Fog_Enable(void)
+{
+    if(!s_map)
+        return false;
+    if(s_enabled)
+        return true;
+
+    size_t ncells = (size_t)s_rows * s_cols;
+    s_counts = calloc(ncells, sizeof(uint16_t));
+    if(!s_counts)
+        goto fail_counts;
+
+    s_texels = calloc(ncells, sizeof(uint8_t));
+    if(!s_texels)
+        goto fail_texels;
+
+    if(s_height_los && !g_fog_sample_heights())
+        goto fail_heights;
+
+    /* The vision of all the sources gets stamped on the next update */
+    for(int i = 0; i < kv_size(s_sources); i++)
+        kv_A(s_sources, i).radius_tiles = -1;
+
+    s_enabled = true;
+    s_dirty_begin = 0;
+    s_dirty_end = s_rows;
+
+    R_GL_FogEnable(s_cols, s_rows, (vec2_t){s_map_pos.x, s_map_pos.z}, 
+        (vec2_t){-s_cols * X_COORDS_PER_TILE, s_rows * Z_COORDS_PER_TILE});
+    return true;
+
+fail_heights:
+    free(s_texels);
+    s_texels = NULL;
+fail_texels:
+    free(s_counts);
+    s_counts = NULL;
+fail_counts:
+    return false;
+}
+
+void G_Fog_Disable(void)
+{
+    if(!s_enabled)
+        return;
+
+    for(int i = 0; i < kv_size(s_sources); i++)
+        kv_reset(kv_A(s_sources, i).cells);
+
+    free(s_counts);
+    free(s_texels);
+    free(s_heights);
+    s_counts = NULL;
+    s_texels = NULL;
+    s_heights = NULL;
+
+    s_enabled = false;
+    R_GL_FogDisable();
+}
+
+bool G_Fog_Enabled(void)
+{
+    return s_enabled;
+}
+
+bool G_Fog_SetHeightLOS(bool on)
+{
+    if(on == s_height_los)
+        return true;
+
+    if(s_enabled && on && !g_fog_sample_heights())
+        return false;
+
+    if(!on) {
+        free(s_heights);
+        s_heights = NULL;
+    }
+    s_height_los = on;
+
+    for(int i = 0; i < kv_size(s_sources); i++)
+        kv_A(s_sources, i).radius_tiles = -1;
+    return true;
+}
+
+bool G_Fog_SetVision(const struct entity *ent, float radius)
+{
+    if(!s_map)
+        return false;
+
+    khiter_t k = kh_get(fog_src, s_source_idx, ent->uid);
+    if(radius <= 0.0f) {
+        if(k != kh_end(s_source_idx))
+            g_fog_del_source(kh_value(s_source_idx, k));
+        return true;
+    }
+
+    if(k != kh_end(s_source_idx)) {
+        kv_A(s_sources, kh_value(s_source_idx, k)).radius = radius;
+        return true;
+    }
+
+    int status;
+    k = kh_put(fog_src, s_source_idx, ent->uid, &status);
+    if(status == -1)
+        return false;
+
+    struct fog_source src = (struct fog_source){
+        .uid = ent->uid,
+        .radius = radius,
+        .r = -1, .c = -1,
+        .radius_tiles = -1,
+    };
+    kv_init(src.cells);
+
+    kh_value(s_source_idx, k) = kv_size(s_sources);
+    kv_push(struct fog_source, s_sources, src);
+    return true;
+}
+
+float G_Fog_GetVision(const struct entity *ent)
+{
+    if(!s_map)
+        return 0.0f;
+
+    khiter_t k = kh_get(fog_src, s_source_idx, ent->uid);
+    if(k == kh_end(s_source_idx))
+        return 0.0f;
+    return kv_A(s_sources, kh_value(s_source_idx, k)).radius;
+}
+
+bool G_Fog_Visible(vec2_t xz)
+{
+    int r, c;
+    if(!s_enabled)
+        return true;
+    if(!g_fog_tile(xz, &r, &c))
+        return false;
+    return (s_counts[r * s_cols + c] > 0);
+}
+
+bool G_Fog_Explored(vec2_t xz)
+{
+    int r, c;
+    if(!s_enabled)
+        return true;
+    if(!g_fog_tile(xz, &r, &c))
+        return false;
+    return (s_texels[r * s_cols + c] != UNEXPLORED_TEXEL);
+}
+
@@ -0,0 +1,78 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef FOG_H
+#define FOG_H
+
+#include "public/game.h"
+#include "cull_index.h"
+
+#include <stdbool.h>
+
+struct map;
+struct entity;
+
+/* The fog covers the map at the resolution of its' tiles. The map must 
+ * already be in its' final position. */
+bool G_Fog_Init(const struct map *map);
+/* Turns the fog off and forgets all the vision sources */
+void G_Fog_Shutdown(void);
+void G_Fog_RemoveEntity(const struct entity *ent);
+
+/* ------------------------------------------------------------------------
+ * Re-stamps the vision of the sources which have moved to another tile, or
+ * whose range has changed, since the last update.
+ * ------------------------------------------------------------------------
+ */
+void G_Fog_Update(void);
+
+/* ------------------------------------------------------------------------
+ * Drops the entities hidden by the fog from the results of a visibility 
+ * query, keeping the order and fixing up the ranges. Dynamic entities are 
+ * hidden outside of the currently visible tiles, and static ones on tiles 
+ * which have never been seen.
+ * ------------------------------------------------------------------------
+ */
+void G_Fog_Cull(pentity_kvec_t *ents, obb_kvec_t *obbs, vis_range_kvec_t *ranges);
+
+/* ------------------------------------------------------------------------
+ * Uploads the rows of the grid changed since the last frame.
+ * ------------------------------------------------------------------------
+ */
+void G_Fog_Render(void);
+
+#endif
+
@@ -39,6 +39,13 @@
 #include "timer_events.h"
 #include "movement.h"
 #include "game_private.h"
+#include "cull_index.h"
+#include "spatial.h"
+#include "fog.h"
+#include "proximity.h"
+#include "overlay.h"
+#include "light.h"
+#include "shadow.h"
 #include "../render/public/render.h"
 #include "../anim/public/anim.h"
 #include "../map/public/map.h"
@@ -49,8 +56,13 @@
 #include "../event.h"
 #include "../config.h"
 #include "../collision.h"
+#include "../perf.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #include <assert.h> 
+#include <math.h>
+#include <stdlib.h>
 
 
 #define CAM_HEIGHT          175.0f
@@ -59,6 +71,14 @@
 
 #define ACTIVE_CAM          (s_gs.cameras[s_gs.active_cam_idx])
 #define DEFAULT_SEL_COLOR   (vec3_t){0.95f, 0.95f, 0.95f}
+/* Colors of the minimap blips of the selected entities, the vision sources 
+ * of the fog of war and all the others */
+#define BLIP_SEL_COLOR      (vec4_t){1.0f, 1.0f, 1.0f, 1.0f}
+#define BLIP_OWN_COLOR      (vec4_t){0.20f, 0.85f, 0.20f, 1.0f}
+#define BLIP_OTHER_COLOR    (vec4_t){0.90f, 0.15f, 0.15f, 1.0f}
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
 
 /* By default, the minimap is in the bottom left corner with 10 px padding. */
 #define DEFAULT_MINIMAP_POS (vec2_t) { \
@@ -78,6 +98,140 @@ static struct gamestate s_gs;
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static struct set_pos *g_set_pos(const struct entity *ent)
+{
+    uint32_t idx = Entity_PoolIndex(ent->uid);
+    while(kv_size(s_gs.set_pos) <= idx)
+        kv_push(struct set_pos, s_gs.set_pos, ((struct set_pos){-1, -1}));
+    return &kv_A(s_gs.set_pos, idx);
+}
+
+static int g_compare_uids(const void *a, const void *b)
+{
+    uint32_t uid_a = *(const uint32_t*)a;
+    uint32_t uid_b = *(const uint32_t*)b;
+    return (uid_a > uid_b) - (uid_a < uid_b);
+}
+
+/* Poses the entity in the cheapest way that still looks right from as far 
+ * as it is from the camera. 'sel_uids' holds the UIDs of the selected 
+ * entities in sorted order, which are always posed in full. */
+static void g_animate(const struct entity *ent, vec3_t cam_pos, 
+                      const uint32_t *sel_uids, size_t num_selected)
+{
+    vec3_t delta;
+    PFM_Vec3_Sub(&ent->pos, &cam_pos, &delta);
+    float dist_sq = PFM_Vec3_Dot(&delta, &delta);
+
+    bool crowd = (s_gs.crowd_anim_dist > 0.0f) 
+              && (dist_sq >= s_gs.crowd_anim_dist * s_gs.crowd_anim_dist);
+    bool lod = (s_gs.anim_lod_dist > 0.0f) && (s_gs.anim_lod_hz > 0)
+            && (dist_sq >= s_gs.anim_lod_dist * s_gs.anim_lod_dist);
+
+    if((crowd || lod) && bsearch(&ent->uid, sel_uids, num_selected, sizeof(uint32_t), g_compare_uids))
+        crowd = lod = false;
+
+    if(crowd && A_UpdateBaked(ent))
+        return;
+
+    if(lod)
+        A_UpdateThrottled(ent, s_gs.anim_lod_hz);
+    else
+        A_Update(ent);
+}
+
+/* The version of the entity's mesh to draw, for the share of the screen's 
+ * height that its' bounding sphere covers. Animated meshes are always drawn
+ * in full. */
+static const void *g_mesh_lod(const struct entity *ent, const struct obb *obb, vec3_t cam_pos)
+{
+    if(ent->flags & ENTITY_FLAG_ANIMATED)
+        return ent->render_private;
+
+    vec3_t delta;
+    PFM_Vec3_Sub(&obb->center, &cam_pos, &delta);
+    float dist = PFM_Vec3_Len(&delta);
+
+    vec3_t half = (vec3_t){obb->half_lengths[0], obb->half_lengths[1], obb->half_lengths[2]};
+    float radius = PFM_Vec3_Len(&half);
+    if(dist <= radius)
+        return ent->render_private;
+
+    float size = s_gs.lod_bias * radius / (dist * tanf(CAM_FOV_RAD / 2.0f));
+    return R_GL_SelectLOD(ent->render_private, size, s_gs.impostor_size);
+}
+
+/* The static entities are only drawn by the GPU culling when it can draw
+ * their mesh */
+static bool g_gpu_culled(const struct entity *ent)
+{
+    return s_gs.gpu_culling
+        && (ent->flags & ENTITY_FLAG_STATIC)
+        && !(ent->flags & ENTITY_FLAG_ANIMATED)
+        && R_GL_GPUCullEligible(ent->render_private);
+}
+
+/* Submits the shadows of the moving entities which the light sees, but which
+ * weren't drawn this frame because they are off the screen or behind the 
+ * terrain. Their shadows may still fall onto what is seen. 'drawn_uids' are
+ * the sorted UIDs of the ones which already cast their shadows. */
+static void g_submit_hidden_casters(const uint32_t *drawn_uids, size_t num_drawn, float frac, 
+                                    vec3_t cam_pos, const uint32_t *sel_uids, size_t num_selected)
+{
+    struct frustum light;
+    if(!R_GL_ShadowLightFrustum(&light))
+        return;
+
+    kv_reset(s_gs.casters);
+    kv_reset(s_gs.caster_obbs);
+    kv_reset(s_gs.caster_ranges);
+    G_CullIdx_QueryFrustum(&light, (pentity_kvec_t*)&s_gs.casters, (obb_kvec_t*)&s_gs.caster_obbs, 
+                           &s_gs.caster_ranges);
+    G_Fog_Cull((pentity_kvec_t*)&s_gs.casters, (obb_kvec_t*)&s_gs.caster_obbs, &s_gs.caster_ranges);
+
+    for(int i = 0; i < kv_size(s_gs.casters); i++) {
+
+        struct entity *curr = kv_A(s_gs.casters, i);
+        if(G_Shadow_Cached(curr))
+            continue;
+        if(bsearch(&curr->uid, drawn_uids, num_drawn, sizeof(uint32_t), g_compare_uids))
+            continue;
+
+        if(curr->flags & ENTITY_FLAG_ANIMATED)
+            g_animate(curr, cam_pos, sel_uids, num_selected);
+
+        mat4x4_t model;
+        Entity_InterpolatedModelMatrix(curr, frac, &model);
+        R_GL_ShadowSubmit(curr->render_private, &model);
+    }
+}
+
+static void g_gpu_cull_add(const struct entity *ent)
+{
+    mat4x4_t model;
+    struct obb obb;
+    Entity_ModelMatrix(ent, &model);
+    Entity_CurrentOBB(ent, &obb);
+    R_GL_GPUCullAdd(ent->uid, ent->render_private, &model, &obb);
+}
+
+static pentity_kvec_t *g_kind_set(const struct entity *ent)
+{
+    return (ent->flags & ENTITY_FLAG_STATIC) ? &s_gs.statics : &s_gs.dynamic;
+}
+
+/* Removes the element at 'idx' by moving the last element of the set into 
+ * its' place. Returns the moved entity, or NULL if 'idx' was the last one. */
+static struct entity *g_set_del(pentity_kvec_t *set, int idx)
+{
+    struct entity *last = kv_pop(*set);
+    if(idx == kv_size(*set))
+        return NULL;
+
+    kv_A(*set, idx) = last;
+    return last;
+}
+
 static void g_reset_camera(struct camera *cam)
 {
     Camera_SetPitchAndYaw(cam, -(90.0f - CAM_TILT_UP_DEGREES), 90.0f + 45.0f);
@@ -88,23 +242,37 @@ static void g_reset(void)
 {
     G_Sel_Clear();
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(s_gs.active, key, curr, {
-        AL_EntityFree(curr);
-    });
+    R_GL_GPUCullClear();
+    for(int i = 0; i < kv_size(s_gs.active); i++)
+        AL_EntityFree(kv_A(s_gs.active, i));
 
-    kh_clear(entity, s_gs.active);
-    kh_clear(entity, s_gs.dynamic);
+    kv_reset(s_gs.active);
+    kv_reset(s_gs.dynamic);
+    kv_reset(s_gs.statics);
+    kv_reset(s_gs.set_pos);
     kv_reset(s_gs.visible);
     kv_reset(s_gs.visible_obbs);
+    kv_reset(s_gs.visible_ranges);
+    kv_reset(s_gs.casters);
+    kv_reset(s_gs.caster_obbs);
+    kv_reset(s_gs.caster_ranges);
+    s_gs.minimap_units_next = 0;
+    G_CullIdx_Clear();
+    G_Spatial_Invalidate();
+    G_Overlay_Reset();
+    G_Light_Clear();
+    R_GL_OcclusionReset();
 
     if(s_gs.map) {
+        G_Fog_Shutdown();
+        G_Prox_Shutdown();
+        G_Shadow_Shutdown();
         M_Raycast_Uninstall();
         M_FreeMinimap(s_gs.map);
         AL_MapFree(s_gs.map);
         G_Move_Shutdown();
         s_gs.map = NULL;
+        s_gs.map_generation++;
     }
 
     for(int i = 0; i < NUM_CAMERAS; i++)
@@ -128,6 +296,52 @@ static bool g_init_cameras(void)
     }
 }
 
+/* The dynamic entities that can be seen through the fog of war get a blip, and 
+ * the selected ones get another one drawn over it */
+static void g_update_minimap_units(void)
+{
+    uint32_t now = SDL_GetTicks();
+    if(!s_gs.map || !SDL_TICKS_PASSED(now, s_gs.minimap_units_next))
+        return;
+
+    if(s_gs.minimap_units_hz > 0)
+        s_gs.minimap_units_next = now + 1000 / s_gs.minimap_units_hz;
+
+    const pentity_kvec_t *selected = G_Sel_Get();
+    size_t max_blips = kv_size(s_gs.dynamic) + kv_size(*selected);
+
+    vec2_t *xz = arena_alloc(MEM_FrameArena(), max_blips * sizeof(vec2_t) + 1);
+    vec4_t *colors = arena_alloc(MEM_FrameArena(), max_blips * sizeof(vec4_t) + 1);
+    if(!xz || !colors)
+        return;
+
+    size_t num_blips = 0;
+    for(int i = 0; i < kv_size(s_gs.dynamic); i++) {
+
+        const struct entity *curr = kv_A(s_gs.dynamic, i);
+        vec2_t pos = (vec2_t){curr->pos.x, curr->pos.z};
+        if(!G_Fog_Visible(pos))
+            continue;
+
+        xz[num_blips] = pos;
+        colors[num_blips] = G_Fog_GetVision(curr) > 0.0f ? BLIP_OWN_COLOR : BLIP_OTHER_COLOR;
+        num_blips++;
+    }
+
+    for(int i = 0; i < kv_size(*selected); i++) {
+
+        const struct entity *curr = kv_A(*selected, i);
+        if(curr->flags & ENTITY_FLAG_STATIC)
+            continue;
+
+        xz[num_blips] = (vec2_t){curr->pos.x, curr->pos.z};
+        colors[num_blips] = BLIP_SEL_COLOR;
+        num_blips++;
+    }
+
+    R_GL_MinimapSetUnits(s_gs.map, xz, colors, num_blips);
+}
+
 static void g_init_map(void)
 {
     M_CenterAtOrigin(s_gs.map);
@@ -135,6 +349,23 @@ static void g_init_map(void)
     M_Raycast_Install(s_gs.map, ACTIVE_CAM);
     M_InitMinimap(s_gs.map, DEFAULT_MINIMAP_POS);
     G_Move_Init(s_gs.map);
+    G_Prox_Init();
+    G_Fog_Init(s_gs.map);
+    G_Shadow_Init(s_gs.map);
+}
+
+/* Chunks queued up for baking are processed a few at a time. This happens at the 
+ * very start of the tick, before the active camera sets up the view for the frame. 
+ * The chunks are streamed in first, so that the ones coming into view can be baked. */
+static void g_on_update_start(void *unused1, void *unused2)
+{
+    if(s_gs.map) {
+        M_NavSetPathFocus(ACTIVE_CAM);
+        M_StreamStep(s_gs.map, ACTIVE_CAM);
+        M_HybridStep(s_gs.map, ACTIVE_CAM);
+        M_BakeStep(s_gs.map);
+        M_MinimapStep(s_gs.map);
+    }
 }
 
 /*****************************************************************************/
@@ -145,14 +376,28 @@ bool G_Init(void)
 {
     kv_init(s_gs.visible);
     kv_init(s_gs.visible_obbs);
-
-    s_gs.active = kh_init(entity);
-    if(!s_gs.active)
-        goto fail_active;
-
-    s_gs.dynamic = kh_init(entity);
-    if(!s_gs.dynamic)
-        goto fail_dynamic;
+    kv_init(s_gs.visible_ranges);
+    kv_init(s_gs.casters);
+    kv_init(s_gs.caster_obbs);
+    kv_init(s_gs.caster_ranges);
+    kv_init(s_gs.active);
+    kv_init(s_gs.dynamic);
+    kv_init(s_gs.statics);
+    kv_init(s_gs.set_pos);
+    s_gs.minimap_units_hz = CONFIG_MINIMAP_UNITS_HZ;
+    s_gs.anim_lod_dist = CONFIG_ANIM_LOD_DIST;
+    s_gs.anim_lod_hz = CONFIG_ANIM_LOD_HZ;
+    s_gs.lod_bias = CONFIG_MESH_LOD_BIAS;
+    s_gs.impostor_size = CONFIG_IMPOSTOR_SIZE;
+
+    if(!G_CullIdx_Init())
+        goto fail_cull_idx;
+
+    if(!G_Overlay_Init())
+        goto fail_overlay;
+
+    if(!G_Light_Init())
+        goto fail_light;
 
     if(g_init_cameras())
         goto fail_cams; 
@@ -161,14 +406,21 @@ bool G_Init(void)
     G_Sel_Init();
     G_Sel_Enable();
     G_Timer_Init();
+    E_Global_Register(EVENT_UPDATE_START, g_on_update_start, NULL);
 
     return true;
 
 fail_cams:
-    kh_destroy(entity, s_gs.dynamic);
-fail_dynamic:
-    kh_destroy(entity, s_gs.active);
-fail_active:
+    G_Light_Shutdown();
+fail_light:
+    G_Overlay_Shutdown();
+fail_overlay:
+    G_CullIdx_Shutdown();
+fail_cull_idx:
+    kv_destroy(s_gs.set_pos);
+    kv_destroy(s_gs.statics);
+    kv_destroy(s_gs.dynamic);
+    kv_destroy(s_gs.active);
     return false;
 }
 
@@ -227,21 +479,173 @@ bool G_MapHeightAtPoint(vec2_t xz, float *out_height)
     return true;
 }
 
+bool G_MapRaycast(vec3_t origin, vec3_t dir, vec3_t *out_pos)
+{
+    assert(s_gs.map);
+
+    struct map_hit hit;
+    if(!M_Raycast(s_gs.map, origin, dir, &hit))
+        return false;
+
+    *out_pos = hit.pos;
+    return true;
+}
+
+void G_MapHeightsAtPoints(const vec2_t *xz, float *out_heights, size_t n)
+{
+    assert(s_gs.map);
+
+    size_t i = 0;
+    while(i < n) {
+
+        /* Batch up runs of points that are inside the map */
+        size_t begin = i;
+        while(i < n && M_PointInsideMap(s_gs.map, xz[i]))
+            i++;
+        M_HeightAtPoints(s_gs.map, xz + begin, out_heights + begin, i - begin);
+
+        for(; i < n && !M_PointInsideMap(s_gs.map, xz[i]); i++)
+            out_heights[i] = NAN;
+    }
+}
+
+const struct tile *G_MapChunkTiles(int chunk_r, int chunk_c)
+{
+    assert(s_gs.map);
+    return M_ChunkTiles(s_gs.map, chunk_r, chunk_c);
+}
+
+const struct tile_heights *G_MapHeightfield(int *out_rows, int *out_cols)
+{
+    assert(s_gs.map);
+
+    struct map_resolution res;
+    M_GetResolution(s_gs.map, &res);
+    *out_rows = res.chunk_h * res.tile_h;
+    *out_cols = res.chunk_w * res.tile_w;
+    return M_Heightfield(s_gs.map);
+}
+
+uint32_t G_MapGeneration(void)
+{
+    return s_gs.map_generation;
+}
+
+bool G_MapStreamStats(struct map_stream_stats *out)
+{
+    if(!s_gs.map)
+        return false;
+
+    M_GetStreamStats(s_gs.map, out);
+    return true;
+}
+
+bool G_MapResolution(struct map_resolution *out)
+{
+    if(!s_gs.map)
+        return false;
+
+    M_GetResolution(s_gs.map, out);
+    return true;
+}
+
+bool G_MapEditBegin(void)
+{
+    return s_gs.map && M_EditBegin(s_gs.map);
+}
+
+bool G_MapEditEnd(void)
+{
+    return s_gs.map && M_EditEnd(s_gs.map);
+}
+
+bool G_MapEditUndo(size_t *out_num_chunks, size_t out_chunks[])
+{
+    return s_gs.map && M_EditUndo(s_gs.map, out_num_chunks, out_chunks);
+}
+
+bool G_MapEditRedo(size_t *out_num_chunks, size_t out_chunks[])
+{
+    return s_gs.map && M_EditRedo(s_gs.map, out_num_chunks, out_chunks);
+}
+
+bool G_MapEditClear(void)
+{
+    if(!s_gs.map)
+        return false;
+
+    M_EditClear(s_gs.map);
+    return true;
+}
+
+bool G_MapEditStats(struct map_edit_stats *out)
+{
+    if(!s_gs.map)
+        return false;
+
+    M_GetEditStats(s_gs.map, out);
+    return true;
+}
+
+void G_GetStats(struct game_stats *out)
+{
+    out->entities = kv_size(s_gs.active);
+    out->dynamic = kv_size(s_gs.dynamic);
+    out->visible = kv_size(s_gs.visible);
+    out->flocks = G_Move_NumFlocks();
+}
+
+void G_NavPathsExist(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                     float radius, bool out[])
+{
+    assert(s_gs.map);
+    M_NavPathsExist(s_gs.map, N_LayerForRadius(radius), n, xz_srcs, xz_dests, out);
+}
+
+void G_NavPathCosts(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                    float radius, float out[])
+{
+    assert(s_gs.map);
+    M_NavPathCosts(s_gs.map, N_LayerForRadius(radius), n, xz_srcs, xz_dests, out);
+}
+
+void G_NavPositionsPathable(size_t n, const vec2_t xz_positions[], float radius, bool out[])
+{
+    assert(s_gs.map);
+    M_NavPositionsPathable(s_gs.map, N_LayerForRadius(radius), n, xz_positions, out);
+}
+
+void G_NavRaycasts(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                   float radius, bool out_hit[], vec2_t out_pos[])
+{
+    assert(s_gs.map);
+    M_NavRaycasts(s_gs.map, N_LayerForRadius(radius), n, xz_srcs, xz_dests, out_hit, out_pos);
+}
+
 void G_MakeStaticObjsImpassable(void)
 {
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(s_gs.active, key, curr, {
+    struct obb *obbs = malloc((kv_size(s_gs.statics) + 1) * sizeof(struct obb));
+    size_t num_obbs = 0;
 
-        if(((ENTITY_FLAG_COLLISION | ENTITY_FLAG_STATIC) & curr->flags) 
-         != (ENTITY_FLAG_COLLISION | ENTITY_FLAG_STATIC))
+    for(int i = 0; i < kv_size(s_gs.statics); i++) {
+
+        const struct entity *curr = kv_A(s_gs.statics, i);
+        if(!(curr->flags & ENTITY_FLAG_COLLISION))
             continue;
 
         struct obb obb;
         Entity_CurrentOBB(curr, &obb);
-        M_NavCutoutStaticObject(s_gs.map, &obb);
-    });
+        if(obbs)
+            obbs[num_obbs++] = obb;
+        else
+            M_NavCutoutStaticObject(s_gs.map, &obb);
+    }
+
+    /* All of the objects are cut out in one pass, after which the portals of
+     * the chunks they touched are rebuilt once */
+    M_NavCutoutStaticObjects(s_gs.map, num_obbs, obbs);
     M_NavUpdatePortals(s_gs.map);
+    free(obbs);
 }
 
 bool G_UpdateMinimapChunk(int chunk_r, int chunk_c)
@@ -270,114 +674,414 @@ void G_Shutdown(void)
 {
     g_reset();
 
+    E_Global_Unregister(EVENT_UPDATE_START, g_on_update_start);
     G_Timer_Shutdown();
     G_Sel_Shutdown();
 
     for(int i = 0; i < NUM_CAMERAS; i++)
         Camera_Free(s_gs.cameras[i]);
 
-    kh_destroy(entity, s_gs.active);
-    kh_destroy(entity, s_gs.dynamic);
+    kv_destroy(s_gs.active);
+    kv_destroy(s_gs.dynamic);
+    kv_destroy(s_gs.statics);
+    kv_destroy(s_gs.set_pos);
     kv_destroy(s_gs.visible);
     kv_destroy(s_gs.visible_obbs);
+    kv_destroy(s_gs.visible_ranges);
+    kv_destroy(s_gs.casters);
+    kv_destroy(s_gs.caster_obbs);
+    kv_destroy(s_gs.caster_ranges);
+    G_Light_Shutdown();
+    G_Overlay_Shutdown();
+    G_CullIdx_Shutdown();
 }
 
 void G_Update(void)
 {
+    PERF_ENTER();
+
+    /* Upload the tile edits made since the last frame in one go */
+    if(s_gs.map)
+        M_AL_FlushTileUpdates(s_gs.map);
+
+    G_Fog_Update();
+
     /* Build the set of currently visible entities. Note that there may be some false positives due to 
        using the fast frustum cull. */
     kv_reset(s_gs.visible);
     kv_reset(s_gs.visible_obbs);
+    kv_reset(s_gs.visible_ranges);
 
-    struct frustum frust;
-    Camera_MakeFrustum(ACTIVE_CAM, &frust);
-
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(s_gs.active, key, curr, {
-
-        struct obb obb;
-        Entity_CurrentOBB(curr, &obb);
-
-        if(C_FrustumOBBIntersectionFast(&frust, &obb) != VOLUME_INTERSEC_OUTSIDE) {
-            kv_push(struct entity *, s_gs.visible, curr);
-            kv_push(struct obb, s_gs.visible_obbs, obb);
-        }
-    });
+    const struct frustum *frust = &Camera_GetState(ACTIVE_CAM)->frustum;
+    G_CullIdx_QueryFrustum(frust, (pentity_kvec_t*)&s_gs.visible, (obb_kvec_t*)&s_gs.visible_obbs, 
+                           &s_gs.visible_ranges);
+    G_Fog_Cull((pentity_kvec_t*)&s_gs.visible, (obb_kvec_t*)&s_gs.visible_obbs, &s_gs.visible_ranges);
 
     /* Next, update the set of currently selected entities. */
-    G_Sel_Update(ACTIVE_CAM, (const pentity_kvec_t*)&s_gs.visible, (obb_kvec_t*)&s_gs.visible_obbs);
+    G_Sel_Update(ACTIVE_CAM, (const pentity_kvec_t*)&s_gs.visible, (obb_kvec_t*)&s_gs.visible_obbs,
+                 &s_gs.visible_ranges);
+    PERF_RETURN();
 }
 
-void G_Render(void)
+void G_Render(float step_frac)
 {
+    PERF_ENTER();
+
+    float frac = G_Timer_TickFraction(step_frac);
+
+    R_Queue_Begin(Camera_GetPos(ACTIVE_CAM));
+    G_Fog_Render();
+    G_Shadow_Render((const pentity_kvec_t*)&s_gs.statics);
+    G_Light_Render(ACTIVE_CAM);
+    R_GL_SceneBegin();
+
+    /* The selection circles and the highlighted tiles are composited onto 
+     * the terrain as it is drawn */
+    /* The per-entity arrays are sized by the number of entities in view, so 
+     * they are taken from the frame arena rather than the stack */
+    struct mem_arena *frame = MEM_FrameArena();
+    const pentity_kvec_t *selected = G_Sel_Get();
+    size_t num_selected = kv_size(*selected);
+    vec2_t *sel_xz = arena_alloc(frame, (num_selected + 1) * sizeof(vec2_t));
+    float *sel_radii = arena_alloc(frame, (num_selected + 1) * sizeof(float));
+
+    if(sel_xz && sel_radii) {
+
+        for(int i = 0; i < num_selected; i++) {
+
+            struct entity *curr = kv_A(*selected, i);
+            vec3_t pos = Entity_InterpolatedPos(curr, frac);
+            sel_xz[i] = (vec2_t){pos.x, pos.z};
+            sel_radii[i] = curr->selection_radius;
+        }
+        R_GL_DrawSelectionCircles(sel_xz, sel_radii, num_selected, 0.4f, DEFAULT_SEL_COLOR);
+    }
+    M_Raycast_SubmitDecals();
+
+    /* The terrain is drawn first, on its own, so that it can be timed apart 
+     * from the entities. It is also then the only thing in the depth buffer 
+     * when the entities' bounding boxes are tested against it. */
+    R_GL_PassBegin(GPU_PASS_TERRAIN);
+    R_GL_DecalsBegin();
     if(s_gs.map){
-        M_RenderVisibleMap(s_gs.map, ACTIVE_CAM);
+        M_RenderVisibleMap(s_gs.map, ACTIVE_CAM, s_gs.depth_prepass, s_gs.heightfield_terrain);
+    }
+    R_Queue_Flush();
+    R_GL_DecalsEnd();
+    R_GL_PassEnd(GPU_PASS_TERRAIN);
+
+    R_GL_PassBegin(GPU_PASS_ENTITIES);
+    R_Queue_Begin(Camera_GetPos(ACTIVE_CAM));
+
+    if(s_gs.gpu_culling)
+        R_GL_GPUCullDraw(s_gs.lod_bias, s_gs.impostor_size, s_gs.occlusion_culling && s_gs.map);
+
+    size_t num_visible = kv_size(s_gs.visible);
+    bool *unoccluded = arena_alloc(frame, (num_visible + 1) * sizeof(bool));
+    bool *picked = arena_alloc(frame, (num_visible + 1) * sizeof(bool));
+    uint32_t *sel_uids = arena_alloc(frame, (num_selected + 1) * sizeof(uint32_t));
+    uint32_t *drawn_uids = arena_alloc(frame, (num_visible + 1) * sizeof(uint32_t));
+    bool picking = false;
+    if(!unoccluded || !picked || !sel_uids || !drawn_uids)
+        goto entities_done;
+
+    for(int i = 0; i < num_visible; i++)
+        unoccluded[i] = true;
+
+    int *tested = NULL;
+    uint32_t *uids = NULL;
+    if(s_gs.occlusion_culling && s_gs.map) {
+        tested = arena_alloc(frame, (num_visible + 1) * sizeof(int));
+        uids = arena_alloc(frame, (num_visible + 1) * sizeof(uint32_t));
+    }
+
+    if(tested && uids) {
+
+        /* The entities drawn by the GPU culling are tested on the GPU */
+        size_t num_tested = 0;
+
+        for(int i = 0; i < num_visible; i++) {
+            struct entity *curr = kv_A(s_gs.visible, i);
+            if(g_gpu_culled(curr))
+                continue;
+            tested[num_tested] = i;
+            uids[num_tested++] = curr->uid;
+        }
+
+        struct obb *obbs = s_gs.visible_obbs.a;
+        if(num_tested < num_visible) {
+            obbs = arena_alloc(frame, num_tested * sizeof(struct obb) + 1);
+            for(int i = 0; obbs && i < num_tested; i++)
+                obbs[i] = kv_A(s_gs.visible_obbs, tested[i]);
+        }
+
+        bool *visible = arena_alloc(frame, (num_tested + 1) * sizeof(bool));
+        if(obbs && visible) {
+            R_GL_OcclusionTest(uids, obbs, num_tested, Camera_GetPos(ACTIVE_CAM), visible);
+            for(int i = 0; i < num_tested; i++)
+                unoccluded[tested[i]] = visible[i];
+        }
     }
 
-    for(int i = 0; i < kv_size(s_gs.visible); i++) {
+    picking = G_Sel_PickBegin(ACTIVE_CAM, (const pentity_kvec_t*)&s_gs.visible, 
+                              &s_gs.visible_ranges, picked);
+    size_t num_drawn = 0;
+
+    for(int i = 0; i < num_selected; i++)
+        sel_uids[i] = kv_A(*selected, i)->uid;
+    qsort(sel_uids, num_selected, sizeof(uint32_t), g_compare_uids);
+    vec3_t cam_pos = Camera_GetPos(ACTIVE_CAM);
+
+    /* Entities are queued up to be sorted by render state and instanced. 
+     * Animated ones get their pose appended to the frame's joint palette first,
+     * unless they are far enough to be posed from their baked clips, or to 
+     * keep their last pose. Static ones are drawn at the level of detail for
+     * their size on the screen. The ones not in the cached shadow map cast 
+     * their shadows in that pose, with their full mesh. The entities drawn 
+     * by the GPU culling only need to cast their shadows. */
+    for(int i = 0; i < num_visible; i++) {
     
         struct entity *curr = kv_A(s_gs.visible, i);
+        if(!unoccluded[i])
+            continue;
 
-        if(curr->flags & ENTITY_FLAG_ANIMATED)
-            A_Update(curr);
+        if(g_gpu_culled(curr)) {
+            if(!G_Shadow_Cached(curr) || (picking && picked[i])) {
+                mat4x4_t model;
+                Entity_ModelMatrix(curr, &model);
+                if(!G_Shadow_Cached(curr)) {
+                    R_GL_ShadowSubmit(curr->render_private, &model);
+                    drawn_uids[num_drawn++] = curr->uid;
+                }
+                if(picking && picked[i])
+                    R_GL_PickingSubmit(curr->render_private, &model, curr->uid);
+            }
+            continue;
+        }
 
         mat4x4_t model;
-        Entity_ModelMatrix(curr, &model);
-        R_GL_Draw(curr->render_private, &model);
-    }
+        Entity_InterpolatedModelMatrix(curr, frac, &model);
 
-    const pentity_kvec_t *selected = G_Sel_Get();
-    for(int i = 0; i < kv_size(*selected); i++) {
+        if(curr->flags & ENTITY_FLAG_ANIMATED)
+            g_animate(curr, cam_pos, sel_uids, num_selected);
+
+        /* The full mesh is drawn for picking, in the pose that it's drawn in */
+        if(picking && picked[i])
+            R_GL_PickingSubmit(curr->render_private, &model, curr->uid);
 
-        struct entity *curr = kv_A(*selected, i);
-        R_GL_DrawSelectionCircle((vec2_t){curr->pos.x, curr->pos.z}, curr->selection_radius, 0.4f, DEFAULT_SEL_COLOR, s_gs.map);
+        const void *lod = g_mesh_lod(curr, &kv_A(s_gs.visible_obbs, i), cam_pos);
+        R_Queue_Submit(RENDER_PASS_OPAQUE, lod, &model);
+        if(!G_Shadow_Cached(curr)) {
+            R_GL_ShadowSubmit(curr->render_private, &model);
+            drawn_uids[num_drawn++] = curr->uid;
+        }
     }
 
-    E_Global_NotifyImmediate(EVENT_RENDER_3D, NULL, ES_ENGINE);
+    if(G_Shadows_Enabled()) {
+        qsort(drawn_uids, num_drawn, sizeof(uint32_t), g_compare_uids);
+        g_submit_hidden_casters(drawn_uids, num_drawn, frac, cam_pos, sel_uids, num_selected);
+    }
 
-    /* Render the minimap/HUD last. Screenspace rendering clobbers the view/projection uniforms. */
+entities_done:
+    /* With pre-skinning on, each of the poses submitted above is skinned 
+     * once here, for all of the passes */
+    R_GL_PreskinFlush();
+    R_Queue_Flush();
+    if(picking)
+        R_GL_PickingFlush();
+    R_GL_ShadowFlush();
+    R_GL_PassEnd(GPU_PASS_ENTITIES);
+
+    R_GL_PassBegin(GPU_PASS_OVERLAYS);
+    R_GL_EffectsDraw();
+    E_Global_NotifyImmediate(EVENT_RENDER_3D, NULL, ES_ENGINE);
+    R_GL_DebugFlush();
+    R_GL_PassEnd(GPU_PASS_OVERLAYS);
+    R_GL_SceneEnd();
+
+    /* The unit overlays are drawn at the full resolution, over the fog */
+    R_GL_PassBegin(GPU_PASS_OVERLAYS);
+    G_Overlay_Render((const pentity_kvec_t*)&s_gs.visible, frac);
+    R_GL_PassEnd(GPU_PASS_OVERLAYS);
+
+    /* Render the minimap/HUD last, at the full resolution */
+    R_GL_PassBegin(GPU_PASS_MINIMAP);
+    g_update_minimap_units();
     M_RenderMinimap(s_gs.map, ACTIVE_CAM);
+    R_GL_PassEnd(GPU_PASS_MINIMAP);
     E_Global_NotifyImmediate(EVENT_RENDER_UI, NULL, ES_ENGINE);
+    PERF_RETURN();
 }
 
-bool G_AddEntity(struct entity *ent)
+void G_SetMinimapUnitRate(int hz)
+{
+    s_gs.minimap_units_hz = hz > 0 ? hz : 0;
+    s_gs.minimap_units_next = 0;
+}
+
+void G_SetCrowdAnimDistance(float dist)
+{
+    s_gs.crowd_anim_dist = dist > 0.0f ? dist : 0.0f;
+}
+
+void G_SetAnimLOD(float dist, int hz)
 {
-    int ret;
-    khiter_t k;
+    s_gs.anim_lod_dist = dist > 0.0f ? dist : 0.0f;
+    s_gs.anim_lod_hz = hz > 0 ? hz : 0;
+}
+
+void G_SetMeshLOD(float bias, float impostor_size)
+{
+    s_gs.lod_bias = bias > 0.0f ? bias : 0.0f;
+    s_gs.impostor_size = impostor_size > 0.0f ? impostor_size : 0.0f;
+}
 
-    k = kh_put(entity, s_gs.active, ent->uid, &ret);
-    if(ret == -1 || ret == 0)
+void G_SetOcclusionCulling(bool on)
+{
+    if(s_gs.occlusion_culling && !on)
+        R_GL_OcclusionReset();
+    s_gs.occlusion_culling = on;
+}
+
+bool G_SetGPUCulling(bool on)
+{
+    if(on && !R_GL_GPUCullSupported())
         return false;
-    kh_value(s_gs.active, k) = ent;
+    if(on == s_gs.gpu_culling)
+        return true;
 
-    if(ent->flags & ENTITY_FLAG_STATIC)
+    s_gs.gpu_culling = on;
+    if(!on) {
+        R_GL_GPUCullClear();
         return true;
+    }
+
+    for(int i = 0; i < kv_size(s_gs.statics); i++) {
+        struct entity *curr = kv_A(s_gs.statics, i);
+        if(g_gpu_culled(curr))
+            g_gpu_cull_add(curr);
+    }
+    return true;
+}
+
+void G_SetDepthPrepass(bool on)
+{
+    s_gs.depth_prepass = on;
+}
+
+void G_SetHeightfieldTerrain(bool on)
+{
+    s_gs.heightfield_terrain = on;
+}
+
+bool G_AddEntity(struct entity *ent)
+{
+    assert(Entity_FromUID(ent->uid) == ent);
+
+    struct set_pos *pos = g_set_pos(ent);
+    if(pos->active >= 0)
+        return false;
 
-    k = kh_put(entity, s_gs.dynamic, ent->uid, &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(s_gs.dynamic, k) = ent;
+    pentity_kvec_t *kind = g_kind_set(ent);
+    pos->active = kv_size(s_gs.active);
+    pos->kind = kv_size(*kind);
+    kv_push(struct entity*, s_gs.active, ent);
+    kv_push(struct entity*, *kind, ent);
+    G_CullIdx_Add(ent);
+    G_Spatial_Invalidate();
+    G_Shadow_Invalidate(ent);
+    if(g_gpu_culled(ent))
+        g_gpu_cull_add(ent);
 
     return true;
 }
 
 bool G_RemoveEntity(struct entity *ent)
 {
-    khiter_t k = kh_get(entity, s_gs.active, ent->uid);
-    if(k == kh_end(s_gs.active))
+    assert(Entity_FromUID(ent->uid) == ent);
+
+    struct set_pos *pos = g_set_pos(ent);
+    if(pos->active < 0)
         return false;
-    kh_del(entity, s_gs.active, k);
+
+    struct entity *moved;
+    if((moved = g_set_del(&s_gs.active, pos->active)))
+        g_set_pos(moved)->active = pos->active;
+    if((moved = g_set_del(g_kind_set(ent), pos->kind)))
+        g_set_pos(moved)->kind = pos->kind;
+    *pos = (struct set_pos){-1, -1};
+    G_CullIdx_Remove(ent);
+    G_Spatial_Invalidate();
+    G_Move_RemoveEntity(ent);
+    if(s_gs.gpu_culling)
+        R_GL_GPUCullRemove(ent->uid);
+    G_Fog_RemoveEntity(ent);
+    G_Prox_RemoveEntity(ent);
+    G_Overlay_Remove(ent);
+    G_Shadow_Invalidate(ent);
 
     if(ent->flags & ENTITY_FLAG_SELECTABLE)
         G_Sel_Remove(ent);
 
-    if(!(ent->flags & ENTITY_FLAG_STATIC)) {
-        k = kh_get(entity, s_gs.dynamic, ent->uid);
-        assert(k != kh_end(s_gs.dynamic));
-        kh_del(entity, s_gs.dynamic, k);
+    return true;
+}
+
+void G_UpdateEntityBounds(struct entity *ent)
+{
+    G_CullIdx_Update(ent);
+    G_Spatial_Invalidate();
+    if(g_gpu_culled(ent) && g_set_pos(ent)->active >= 0)
+        g_gpu_cull_add(ent);
+    /* Where the entity was before is not known */
+    if(G_Shadow_Cached(ent))
+        G_Shadow_Invalidate(NULL);
+}
+
+size_t G_EntitiesInCircle(vec2_t xz_center, float radius, pentity_kvec_t *out)
+{
+    G_Spatial_Refresh(&s_gs.dynamic);
+    G_Spatial_QueryCircle(xz_center, radius, out);
+
+    size_t n = 0;
+    for(int i = 0; i < kv_size(*out); i++) {
+
+        struct entity *curr = kv_A(*out, i);
+        vec2_t delta = (vec2_t){curr->pos.x - xz_center.raw[0], curr->pos.z - xz_center.raw[1]};
+        if(PFM_Vec2_Dot(&delta, &delta) <= radius * radius)
+            kv_A(*out, n++) = curr;
     }
+    out->n = n;
+    return n;
+}
 
-    return true;
+size_t G_EntitiesInRect(vec2_t xz_min, vec2_t xz_max, pentity_kvec_t *out)
+{
+    G_Spatial_Refresh(&s_gs.dynamic);
+    G_Spatial_QueryRect(xz_min, xz_max, out);
+
+    float x0 = MIN(xz_min.raw[0], xz_max.raw[0]), x1 = MAX(xz_min.raw[0], xz_max.raw[0]);
+    float z0 = MIN(xz_min.raw[1], xz_max.raw[1]), z1 = MAX(xz_min.raw[1], xz_max.raw[1]);
+
+    size_t n = 0;
+    for(int i = 0; i < kv_size(*out); i++) {
+
+        struct entity *curr = kv_A(*out, i);
+        if(curr->pos.x >= x0 && curr->pos.x <= x1 && curr->pos.z >= z0 && curr->pos.z <= z1)
+            kv_A(*out, n++) = curr;
+    }
+    out->n = n;
+    return n;
+}
+
+struct entity *G_NearestEntity(vec2_t xz_point, float max_dist, entity_pred_t pred, void *arg)
+{
+    G_Spatial_Refresh(&s_gs.dynamic);
+    return G_Spatial_QueryNearest(xz_point, max_dist, pred, arg);
+}
+
+const pentity_kvec_t *G_ActiveEntities(void)
+{
+    return &s_gs.active;
 }
 
 bool G_ActivateCamera(int idx, enum cam_mode mode)
@@ -406,8 +1110,51 @@ bool G_UpdateTile(const struct tile_desc *desc, const struct tile *tile)
     return M_AL_UpdateTile(s_gs.map, desc, tile);
 }
 
-const khash_t(entity) *G_GetDynamicEntsSet(void)
+bool G_UpdateTiles(size_t num_tiles, const struct tile_desc descs[], const struct tile tiles[])
+{
+    return M_AL_UpdateTiles(s_gs.map, num_tiles, descs, tiles);
+}
+
+bool G_UpdateTileRegion(const struct tile_desc *origin, int rows, int cols, 
+                        size_t num_tiles, const struct tile tiles[])
+{
+    return M_AL_UpdateTileRegion(s_gs.map, origin, rows, cols, num_tiles, tiles);
+}
+
+bool G_SaveMap(const char *path)
+{
+    if(!s_gs.map)
+        return false;
+    return M_AL_SaveMap(s_gs.map, path);
+}
+
+const pentity_kvec_t *G_GetDynamicEnts(void)
+{
+    return &s_gs.dynamic;
+}
+
+const pentity_kvec_t *G_GetVisibleEnts(void)
+{
+    return (const pentity_kvec_t*)&s_gs.visible;
+}
+
+vec3_t G_GetActiveCameraPos(void)
+{
+    return Camera_GetPos(ACTIVE_CAM);
+}
+
+struct camera *G_GetActiveCamera(void)
+{
+    return ACTIVE_CAM;
+}
+
+const pentity_kvec_t *G_GetActiveEnts(void)
+{
+    return &s_gs.active;
+}
+
+struct map *G_GetMap(void)
 {
-    return s_gs.dynamic;
+    return s_gs.map;
 }
 
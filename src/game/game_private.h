@@ -38,7 +38,12 @@
 
 #include "gamestate.h"
 
-const khash_t(entity) *G_GetDynamicEntsSet(void);
+const pentity_kvec_t  *G_GetActiveEnts(void);
+const pentity_kvec_t  *G_GetDynamicEnts(void);
+const pentity_kvec_t  *G_GetVisibleEnts(void);
+vec3_t                 G_GetActiveCameraPos(void);
+struct camera         *G_GetActiveCamera(void);
+struct map            *G_GetMap(void);
 
 #endif
 
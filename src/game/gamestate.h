@@ -37,19 +37,32 @@
 #define GAMESTATE_H
 
 #include "public/game.h"
+#include "cull_index.h"
 #include "../lib/public/kvec.h"
 
 #define NUM_CAMERAS 2
 
+/* Where an entity is stored within the entity sets of the gamestate, or -1 */
+struct set_pos{
+    int active;
+    /* Index within 'dynamic' or 'statics', depending on the entity's flags */
+    int kind;
+};
+
 struct gamestate{
     struct map             *map;
+    /*-------------------------------------------------------------------------
+     * Incremented every time the map is freed.
+     *-------------------------------------------------------------------------
+     */
+    uint32_t                map_generation;
     int                     active_cam_idx;
     struct camera          *cameras[NUM_CAMERAS];
     /*-------------------------------------------------------------------------
      * The set of all game entities currently taking part in the game simulation.
      *-------------------------------------------------------------------------
      */
-    khash_t(entity)        *active;
+    pentity_kvec_t          active;
     /*-------------------------------------------------------------------------
      * The set of entities potentially visible by the active camera.
      *-------------------------------------------------------------------------
@@ -60,12 +73,91 @@ struct gamestate{
      *-------------------------------------------------------------------------
      */
     kvec_t(struct obb)      visible_obbs;
+    /*-------------------------------------------------------------------------
+     * The runs of the visible set which came from a single index bucket.
+     *-------------------------------------------------------------------------
+     */
+    vis_range_kvec_t        visible_ranges;
+    /*-------------------------------------------------------------------------
+     * Scratch buffers for the entities within the light's view, which cast 
+     * their shadows into the dynamic shadow layer even when off the screen.
+     *-------------------------------------------------------------------------
+     */
+    kvec_t(struct entity*)  casters;
+    kvec_t(struct obb)      caster_obbs;
+    vis_range_kvec_t        caster_ranges;
+    /*-------------------------------------------------------------------------
+     * If true, visible entities hidden behind the terrain are not animated 
+     * or drawn.
+     *-------------------------------------------------------------------------
+     */
+    bool                    occlusion_culling;
+    /*-------------------------------------------------------------------------
+     * If true, the static entities which aren't animated are kept in the 
+     * GPU's buffers, and are culled and drawn by the GPU.
+     *-------------------------------------------------------------------------
+     */
+    bool                    gpu_culling;
+    /*-------------------------------------------------------------------------
+     * If true, the depth of the batched terrain is drawn before it is shaded,
+     * so that each of its' pixels is only shaded once.
+     *-------------------------------------------------------------------------
+     */
+    bool                    depth_prepass;
+    /*-------------------------------------------------------------------------
+     * If true, the batched terrain is drawn from a texture holding the heights
+     * and materials of its' tiles, rather than from a copy of its' meshes.
+     *-------------------------------------------------------------------------
+     */
+    bool                    heightfield_terrain;
+    /*-------------------------------------------------------------------------
+     * The animated entities further than this from the camera, and not 
+     * selected, are posed from their baked clips. 0 if none are.
+     *-------------------------------------------------------------------------
+     */
+    float                   crowd_anim_dist;
+    /*-------------------------------------------------------------------------
+     * The animated entities further than this from the camera, and not 
+     * selected, have their pose evaluated 'anim_lod_hz' times a second. 0 
+     * for either turns it off.
+     *-------------------------------------------------------------------------
+     */
+    float                   anim_lod_dist;
+    int                     anim_lod_hz;
+    /*-------------------------------------------------------------------------
+     * The share of the screen's height that the static meshes are taken to 
+     * cover is multiplied by 'lod_bias' for picking their level of detail. 
+     * Below 'impostor_size', they are drawn as billboards.
+     *-------------------------------------------------------------------------
+     */
+    float                   lod_bias;
+    float                   impostor_size;
     /*-------------------------------------------------------------------------
      * Up-to-date set of all non-static entities. (Subset of 'active' set). 
      * Used for collision avoidance force computations.
      *-------------------------------------------------------------------------
      */
-    khash_t(entity)        *dynamic;
+    pentity_kvec_t          dynamic;
+    /*-------------------------------------------------------------------------
+     * The static entities. (The rest of the 'active' set).
+     *-------------------------------------------------------------------------
+     */
+    pentity_kvec_t          statics;
+    /*-------------------------------------------------------------------------
+     * The positions of the entities within the above sets, indexed by the 
+     * entity's pool index. The sets are kept dense for iteration, with removal
+     * swapping the last element into the hole.
+     *-------------------------------------------------------------------------
+     */
+    kvec_t(struct set_pos)  set_pos;
+    /*-------------------------------------------------------------------------
+     * The unit blips on the minimap are refreshed this many times a second 
+     * (every frame if 0), with the next refresh due at 'minimap_units_next'
+     * in SDL ticks.
+     *-------------------------------------------------------------------------
+     */
+    int                     minimap_units_hz;
+    uint32_t                minimap_units_next;
 };
 
 #endif
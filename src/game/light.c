@@ -0,0 +1,134 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "light.h"
+#include "../render/public/render.h"
+#include "../perf.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+
+
+KHASH_MAP_INIT_INT(light, struct point_light)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static khash_t(light)             *s_lights;
+static int                         s_next_id = 1;
+/* Rebuilt every frame */
+static kvec_t(struct point_light)  s_frame_lights;
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Light_Init(void)
+{
+    s_lights = kh_init(light);
+    if(!s_lights)
+        return false;
+
+    kv_init(s_frame_lights);
+    return true;
+}
+
+void G_Light_Shutdown(void)
+{
+    kh_destroy(light, s_lights);
+    kv_destroy(s_frame_lights);
+}
+
+void G_Light_Clear(void)
+{
+    kh_clear(light, s_lights);
+}
+
+void G_Light_Render(const struct camera *cam)
+{
+    PERF_ENTER();
+    kv_reset(s_frame_lights);
+
+    struct point_light curr;
+    kh_foreach_value(s_lights, curr, {
+        kv_push(struct point_light, s_frame_lights, curr);
+    });
+
+    /* Called even with no lights, so that last frame's are cleared */
+    R_GL_SetPointLights(s_frame_lights.a, kv_size(s_frame_lights), cam);
+    PERF_RETURN();
+}
+
+int G_Lights_Add(vec3_t pos, vec3_t color, float radius)
+{
+    if(radius <= 0.0f)
+        return -1;
+
+    int status;
+    int id = s_next_id;
+    khiter_t k = kh_put(light, s_lights, id, &status);
+    if(status == -1)
+        return -1;
+
+    s_next_id++;
+    kh_value(s_lights, k) = (struct point_light){
+        .pos = pos,
+        .radius = radius,
+        .color = color
+    };
+    return id;
+}
+
+bool G_Lights_Remove(int id)
+{
+    khiter_t k = kh_get(light, s_lights, id);
+    if(k == kh_end(s_lights))
+        return false;
+
+    kh_del(light, s_lights, k);
+    return true;
+}
+
+bool G_Lights_SetPos(int id, vec3_t pos)
+{
+    khiter_t k = kh_get(light, s_lights, id);
+    if(k == kh_end(s_lights))
+        return false;
+
+    kh_value(s_lights, k).pos = pos;
+    return true;
+}
+
@@ -35,6 +35,7 @@
 
 #include "movement.h"
 #include "game_private.h"
+#include "spatial.h"
 #include "public/game.h"
 #include "../config.h"
 #include "../camera.h"
@@ -42,50 +43,177 @@
 #include "../event.h"
 #include "../entity.h"
 #include "../collision.h"
+#include "../parallel.h"
+#include "../perf.h"
+#include "../net.h"
 #include "../script/public/script.h"
 #include "../render/public/render.h"
 #include "../map/public/map.h"
 #include "../lib/public/kvec.h"
-#include "../anim/public/anim.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 
 
 /* For the purpose of movement simulation, all entities have the same mass,
  * meaning they are accelerate the same amount when applied equal forces. */
 #define ENTITY_MASS (1.0f)
+/* Longest waypoint path taken at once */
+#define WAYPOINT_MAX_POINTS (32)
 #define EPSILON     (1.0f/1024)
 #define MAX_FORCE   (0.2f)
 #define SIGNUM(x)   (((x) > 0) - ((x) < 0))
 
 #define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
 
 enum arrival_state{
+    /* Entity is holding its' position while the path to the flock's 
+     * destination is being computed in the background. */
+    STATE_WAITING,
     /* Entity is moving towards the flock's destination point */
     STATE_MOVING,
     /* Entity is in proximity of the flock's destination point, 
      * it is looking for a good point to stop. */
     STATE_SETTLING,
     /* Entity is considered to have arrived and no longer moving. */
-    STATE_ARRIVED
+    STATE_ARRIVED,
+    NUM_ARRIVAL_STATES
 };
 
+/* The movement state is kept as a structure of arrays, indexed by a dense 
+ * per-entity movement slot, so that the steering loops stream over contiguous 
+ * memory. Slots are handed out the first time an entity is given a move order. */
 struct movestate{
-    vec2_t             velocity;
-    enum arrival_state state;
+    size_t              size, capacity;
+    struct entity     **ent;
+    /* The UIDs of the entities, which remain readable after an entity was 
+     * freed without being removed from the game first */
+    uint32_t           *uid;
+    /* Copies of the entity fields read by the steering behaviours, gathered 
+     * at the start of every tick. 'pos' is kept in sync as the entity moves. */
+    vec2_t             *pos;
+    float              *radius;
+    float              *max_speed;
+    vec2_t             *velocity;
+    enum arrival_state *state;
     /* After an obstacle is detected and a collision force is applied, 
      * it decays linearly over a fixed number of ticks.*/
-    vec2_t             avoid_force;
-    unsigned           avoid_ticks_left;
+    vec2_t             *avoid_force;
+    unsigned           *avoid_ticks_left;
+    /* The outstanding path request, valid in the 'STATE_WAITING' state */
+    path_ticket_t      *ticket;
+    /* Index of the entity's source position within the request */
+    size_t             *src_idx;
+    /* Set while the entity is registered as a navigation blocker at 'block_pos',
+     * with the radius it had at the time */
+    bool               *blocking;
+    vec2_t             *block_pos;
+    float              *block_radius;
+    /* Scratch state of the steering pass. The forces of all the entities are
+     * computed before any of the results are committed. */
+    vec2_t             *arrive;
+    vec2_t             *next_velocity;
+    vec2_t             *col_avoid;
+    /* Set for the entities which are on-screen and close to the camera */
+    bool               *in_view;
+    /* The avoidance mode of the flock the entity was last ordered to move with */
+    enum move_avoidance *avoidance;
+    /* Index of the entity's flock in 's_flocks', or -1 if it is in none */
+    int                *flock;
 };
 
-KHASH_MAP_INIT_INT(state, struct movestate)
+KHASH_MAP_INIT_INT(slot, uint32_t)
+
+/* A waypoint path followed by a member of a small flock */
+struct move_path{
+    size_t                   count;
+    /* Index of the point being headed for */
+    size_t                   next;
+    /* Set if the path was cut short and must be requested again from its' 
+     * last point */
+    bool                     partial;
+    vec2_t                   points[WAYPOINT_MAX_POINTS];
+};
 
 struct flock{
-    khash_t(entity) *ents;
-    vec2_t           target_xz; 
-    dest_id_t        dest_id;
+    khash_t(entity)         *ents;
+    vec2_t                   target_xz; 
+    dest_id_t                dest_id;
+    /* All the entities in a flock use the same navigation layer */
+    enum nav_layer           layer;
+    /* Path requests which have not yet been serviced. */
+    kvec_t(path_ticket_t)    tickets;
+    /* The number of members in each arrival state */
+    size_t                   num_in_state[NUM_ARRIVAL_STATES];
+    enum move_avoidance      avoidance;
+    /* The movement tick on which the move order was given */
+    unsigned long            start_tick;
+    /* Set for small flocks, of which every member follows a waypoint path 
+     * instead of the flow fields. The path is at the member's 'src_idx'. */
+    bool                     use_waypoints;
+    kvec_t(struct move_path) paths;
+};
+
+/* A half-plane of permitted velocities - those to the left of the line 
+ * through 'point' along the unit vector 'dir'. */
+struct orca_line{
+    vec2_t point;
+    vec2_t dir;
+};
+
+enum steer_lod{
+    /* All the steering behaviours are evaluated every tick */
+    LOD_FULL,
+    /* Only the 'arrive' and separation forces are evaluated */
+    LOD_REDUCED,
+    /* The steering forces are not evaluated - the entity keeps its' velocity */
+    LOD_COAST,
+};
+
+/* A move order to be carried out at the start of a given tick. The entities 
+ * are kept by UID as they may be removed in the meantime. */
+struct move_order{
+    unsigned long        tick;
+    vec2_t               target_xz;
+    enum move_avoidance  avoidance;
+    kvec_t(uint32_t)     uids;
+};
+
+/* An entity of a flock, to be steered on this tick */
+struct steer_work{
+    int                 slot;
+    struct flock       *flock;
+    enum steer_lod      lod;
+};
+
+/* The records of 'G_Move_SaveState', which are only read back by the same 
+ * build. The entities are referred to by UID. */
+struct slot_rec{
+    uint32_t            uid;
+    uint32_t            state;
+    vec2_t              velocity;
+    vec2_t              avoid_force;
+    uint32_t            avoid_ticks_left;
+    uint32_t            blocking;
+};
+
+struct flock_rec{
+    vec2_t              target_xz;
+    uint32_t            layer;
+    uint32_t            avoidance;
+    uint64_t            start_tick;
+    uint32_t            num_members;
+    uint32_t            pad;
+};
+
+struct order_rec{
+    uint64_t            tick;
+    vec2_t              target_xz;
+    uint32_t            avoidance;
+    uint32_t            num_uids;
 };
 
 /* Parameters controlling steering/flocking behaviours */
@@ -108,24 +236,84 @@ struct flock{
 #define COLLISION_MAX_SEE_AHEAD         (15.0f)
 #define COLLISION_AVOID_MAX_TICKS       (25.0f)
 
+/* Entities following waypoint paths move on to the next point once within 
+ * this distance of the current one. Every WAYPOINT_CHECK_INTERVAL ticks, they 
+ * check whether they can see past it, or have lost sight of it. */
+#define WAYPOINT_REACHED_DIST           (4.0f)
+#define WAYPOINT_CHECK_INTERVAL         (15)
+
+/* Number of entities steered by a single task of the worker pool */
+#define STEER_BATCH_SIZE                (32)
+
+/* Entities which are off-screen or further than this from the camera are 
+ * only steered once every LOD_REDUCED_INTERVAL ticks, coasting in between. */
+#define LOD_FULL_DIST                   (400.0f)
+#define LOD_REDUCED_INTERVAL            (4)
+
+/* The velocities chosen by ORCA are free of collisions for this many ticks. 
+ * This must cover the ticks an entity coasts at reduced detail. */
+#define ORCA_TIME_HORIZON               (45.0f)
+/* Only the nearest few entities within this distance of the entity's 
+ * edge are avoided */
+#define ORCA_NEIGHBOUR_DIST             (20.0f)
+#define ORCA_MAX_NEIGHBOURS             (16)
+
+/* The member tables and ticket buffers of up to this many destroyed flocks 
+ * are kept for reuse. Tables grown past the bucket limit by a large flock 
+ * are freed instead of holding on to the memory. */
+#define FLOCK_POOL_SIZE                 (32)
+#define FLOCK_POOL_MAX_BUCKETS          (1024)
+/* The move marker is a ring of arrows converging on the clicked point */
+#define MARKER_NUM_ARROWS               (8)
+#define MARKER_RADIUS                   (5.0f)
+#define MARKER_LIFETIME                 (0.8f)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-kvec_t(struct entity*)  s_move_markers;
 kvec_t(struct flock)    s_flocks;
-khash_t(state)         *s_entity_state_table;
+/* Destroyed flocks, of which only the cleared 'ents', 'tickets' and 'paths' are used */
+static struct flock     s_flock_pool[FLOCK_POOL_SIZE];
+static size_t           s_flock_pool_size;
+/* Maps the UIDs of the entities already pathed for a new flock to their index */
+static khash_t(slot)   *s_pathed_ents;
+static struct movestate s_move;
+/* Maps entity UIDs to their slot in 's_move' */
+khash_t(slot)          *s_slot_table;
 const struct map       *s_map;
+/* Scratch buffer for the results of spatial queries made on the main thread */
+static pentity_kvec_t   s_neighbours;
+static kvec_t(struct steer_work) s_steer_work;
+/* A buffer for the spatial queries of each steering batch, kept from tick to 
+ * tick so that the batches don't allocate one every time */
+static kvec_t(pentity_kvec_t)    s_steer_neighbours;
+/* New positions of the entities in 's_steer_work', and the map heights there */
+static kvec_t(vec2_t)   s_commit_xz;
+static kvec_t(float)    s_commit_height;
+static unsigned long    s_tick_count;
+static enum move_avoidance s_avoidance = MOVE_AVOID_FORCES;
+/* Flocks of up to this many entities follow waypoint paths, as building the 
+ * flow fields only pays off for larger groups */
+static int              s_waypoint_group = 4;
+/* In deterministic mode, the outcome of every tick depends only on the state 
+ * at the start of the tick and the move orders given for it: there is no 
+ * level of detail based on the camera, no dependence on the timing of the 
+ * path threads and the entities are updated in a fixed order. */
+static bool             s_deterministic;
+/* Orders which have not yet been carried out, in the order they were given */
+static kvec_t(struct move_order) s_orders;
+/* Hash of the movement state at the end of the last tick */
+static uint32_t         s_checksum;
+/* The steering times are added to from the worker threads */
+static SDL_SpinLock     s_stats_lock;
+static struct move_avoid_stats s_stats[MOVE_AVOID_MAX];
+static uint64_t         s_steer_ticks[MOVE_AVOID_MAX];
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool entities_equal(struct entity **a, struct entity **b)
-{
-    return (0 == memcmp(*a, *b, sizeof(struct entity)));
-}
-
 static void vec2_truncate(vec2_t *inout, float max_len)
 {
     if(PFM_Vec2_Len(inout) > max_len) {
@@ -135,185 +323,764 @@ static void vec2_truncate(vec2_t *inout, float max_len)
     }
 }
 
-static void on_marker_anim_finish(void *user, void *event)
+/* Takes the member table and the ticket and path buffers of a pooled flock, if there is one */
+static bool flock_init(struct flock *flock)
+{
+    if(s_flock_pool_size > 0) {
+        const struct flock *pooled = &s_flock_pool[--s_flock_pool_size];
+        flock->ents = pooled->ents;
+        flock->tickets = pooled->tickets;
+        flock->paths = pooled->paths;
+        return true;
+    }
+
+    kv_init(flock->tickets);
+    kv_init(flock->paths);
+    flock->ents = kh_init(entity);
+    return (flock->ents != NULL);
+}
+
+static void flock_destroy(struct flock *flock)
+{
+    for(int i = 0; i < kv_size(flock->tickets); i++)
+        M_NavReleasePath(kv_A(flock->tickets, i));
+
+    if(s_flock_pool_size < FLOCK_POOL_SIZE
+    && kh_n_buckets(flock->ents) <= FLOCK_POOL_MAX_BUCKETS) {
+
+        kh_clear(entity, flock->ents);
+        kv_reset(flock->tickets);
+        kv_reset(flock->paths);
+        s_flock_pool[s_flock_pool_size++] = *flock;
+        return;
+    }
+
+    kv_destroy(flock->tickets);
+    kv_destroy(flock->paths);
+    kh_destroy(entity, flock->ents);
+}
+
+static void flock_pool_clear(void)
+{
+    for(int i = 0; i < s_flock_pool_size; i++) {
+        kv_destroy(s_flock_pool[i].tickets);
+        kv_destroy(s_flock_pool[i].paths);
+        kh_destroy(entity, s_flock_pool[i].ents);
+    }
+    s_flock_pool_size = 0;
+}
+
+static bool movestate_reserve(size_t capacity)
+{
+    if(capacity <= s_move.capacity)
+        return true;
+
+#define GROW(_field)                                                                \
+    do{                                                                             \
+        void *new = realloc(s_move._field, capacity * sizeof(*s_move._field));       \
+        if(!new)                                                                    \
+            return false;                                                           \
+        s_move._field = new;                                                        \
+    }while(0)
+
+    /* On failure, the arrays which were already grown are left larger than
+     * 'capacity' - this is harmless. */
+    GROW(ent);
+    GROW(uid);
+    GROW(pos);
+    GROW(radius);
+    GROW(max_speed);
+    GROW(velocity);
+    GROW(state);
+    GROW(avoid_force);
+    GROW(avoid_ticks_left);
+    GROW(ticket);
+    GROW(src_idx);
+    GROW(blocking);
+    GROW(block_pos);
+    GROW(block_radius);
+    GROW(arrive);
+    GROW(next_velocity);
+    GROW(col_avoid);
+    GROW(in_view);
+    GROW(avoidance);
+    GROW(flock);
+#undef GROW
+
+    s_move.capacity = capacity;
+    return true;
+}
+
+static void movestate_destroy(void)
+{
+    free(s_move.ent);
+    free(s_move.uid);
+    free(s_move.pos);
+    free(s_move.radius);
+    free(s_move.max_speed);
+    free(s_move.velocity);
+    free(s_move.state);
+    free(s_move.avoid_force);
+    free(s_move.avoid_ticks_left);
+    free(s_move.ticket);
+    free(s_move.src_idx);
+    free(s_move.blocking);
+    free(s_move.block_pos);
+    free(s_move.block_radius);
+    free(s_move.arrive);
+    free(s_move.next_velocity);
+    free(s_move.col_avoid);
+    free(s_move.in_view);
+    free(s_move.avoidance);
+    free(s_move.flock);
+    memset(&s_move, 0, sizeof(s_move));
+}
+
+/* Returns the movement slot of the entity, or -1 if it has never been moved. */
+static int slot_get(uint32_t uid)
+{
+    khiter_t k = kh_get(slot, s_slot_table, uid);
+    if(k == kh_end(s_slot_table))
+        return -1;
+    return kh_value(s_slot_table, k);
+}
+
+static int slot_add(struct entity *ent)
+{
+    assert(slot_get(ent->uid) < 0);
+
+    if(s_move.size == s_move.capacity
+    && !movestate_reserve(s_move.capacity ? s_move.capacity * 2 : 64))
+        return -1;
+
+    int ret;
+    khiter_t k = kh_put(slot, s_slot_table, ent->uid, &ret);
+    if(ret == -1)
+        return -1;
+
+    int slot = s_move.size++;
+    kh_value(s_slot_table, k) = slot;
+
+    s_move.ent[slot] = ent;
+    s_move.uid[slot] = ent->uid;
+    s_move.pos[slot] = (vec2_t){ent->pos.x, ent->pos.z};
+    s_move.radius[slot] = ent->selection_radius;
+    s_move.max_speed[slot] = ent->max_speed;
+    s_move.velocity[slot] = (vec2_t){0.0f};
+    s_move.state[slot] = STATE_ARRIVED;
+    s_move.avoid_force[slot] = (vec2_t){0.0f};
+    s_move.avoid_ticks_left[slot] = 0;
+    s_move.ticket[slot] = NULL_PATH_TICKET;
+    s_move.src_idx[slot] = 0;
+    s_move.blocking[slot] = false;
+    s_move.block_pos[slot] = (vec2_t){0.0f};
+    s_move.block_radius[slot] = 0.0f;
+    s_move.arrive[slot] = (vec2_t){0.0f};
+    s_move.next_velocity[slot] = (vec2_t){0.0f};
+    s_move.col_avoid[slot] = (vec2_t){0.0f};
+    s_move.in_view[slot] = false;
+    s_move.avoidance[slot] = MOVE_AVOID_FORCES;
+    s_move.flock[slot] = -1;
+    return slot;
+}
+
+/* Gives back the slot of a removed entity. The last slot is moved into its' 
+ * place, so that the live slots stay contiguous. */
+static void slot_del(int slot, uint32_t uid)
+{
+    khiter_t k = kh_get(slot, s_slot_table, uid);
+    assert(k != kh_end(s_slot_table));
+    kh_del(slot, s_slot_table, k);
+
+    int last = --s_move.size;
+    if(slot == last)
+        return;
+
+#define MOVE(_field) s_move._field[slot] = s_move._field[last]
+
+    MOVE(ent);
+    MOVE(uid);
+    MOVE(pos);
+    MOVE(radius);
+    MOVE(max_speed);
+    MOVE(velocity);
+    MOVE(state);
+    MOVE(avoid_force);
+    MOVE(avoid_ticks_left);
+    MOVE(ticket);
+    MOVE(src_idx);
+    MOVE(blocking);
+    MOVE(block_pos);
+    MOVE(block_radius);
+    MOVE(arrive);
+    MOVE(next_velocity);
+    MOVE(col_avoid);
+    MOVE(in_view);
+    MOVE(avoidance);
+    MOVE(flock);
+#undef MOVE
+
+    k = kh_get(slot, s_slot_table, s_move.uid[slot]);
+    assert(k != kh_end(s_slot_table));
+    kh_value(s_slot_table, k) = slot;
+}
+
+/* Points the members of the flock at 'idx' in 's_flocks' back at it */
+static void flock_index_members(int idx)
+{
+    struct entity *curr;
+    kh_foreach_value(kv_A(s_flocks, idx).ents, curr, {
+        int slot = slot_get(curr->uid);
+        assert(slot >= 0);
+        s_move.flock[slot] = idx;
+    });
+}
+
+/* Destroys the flock at 'idx' in 's_flocks'. The last flock takes its' place,
+ * so its' members are pointed at the new index. */
+static void flocks_delete(int idx)
+{
+    struct flock *flock = &kv_A(s_flocks, idx);
+
+    struct entity *curr;
+    kh_foreach_value(flock->ents, curr, {
+        int slot = slot_get(curr->uid);
+        assert(slot >= 0);
+        s_move.flock[slot] = -1;
+    });
+
+    flock_destroy(flock);
+    kv_del(struct flock, s_flocks, idx);
+    if(idx < kv_size(s_flocks))
+        flock_index_members(idx);
+}
+
+/* Refresh the copies of the entity fields used for steering */
+static void slot_gather(int slot)
+{
+    const struct entity *ent = s_move.ent[slot];
+    s_move.pos[slot] = (vec2_t){ent->pos.x, ent->pos.z};
+    s_move.radius[slot] = ent->selection_radius;
+    s_move.max_speed[slot] = ent->max_speed;
+}
+
+/* Entities holding their position are registered as blockers in the navigation 
+ * data, so that the paths of other entities are routed around them instead of 
+ * relying on the collision avoidance to get past. */
+static void entity_block(int slot)
+{
+    if(s_move.blocking[slot])
+        return;
+
+    slot_gather(slot);
+    s_move.blocking[slot] = true;
+    s_move.block_pos[slot] = s_move.pos[slot];
+    s_move.block_radius[slot] = s_move.radius[slot];
+    M_NavBlockersIncref(s_map, s_move.block_pos[slot], s_move.block_radius[slot]);
+}
+
+static void entity_unblock(int slot)
+{
+    if(!s_move.blocking[slot])
+        return;
+
+    s_move.blocking[slot] = false;
+    M_NavBlockersDecref(s_map, s_move.block_pos[slot], s_move.block_radius[slot]);
+}
+
+static void entity_stop(int slot)
 {
-    int idx;
-    struct entity *ent = user;
-    assert(ent);
+    s_move.state[slot] = STATE_ARRIVED;
+    s_move.velocity[slot] = (vec2_t){0.0f};
+    s_move.avoid_force[slot] = (vec2_t){0.0f};
+    s_move.avoid_ticks_left[slot] = 0;
+    s_move.ticket[slot] = NULL_PATH_TICKET;
+    s_move.src_idx[slot] = 0;
+    entity_block(slot);
+}
 
-    kv_indexof(struct entity*, s_move_markers, ent, entities_equal, idx);
-    assert(idx != -1);
-    kv_del(struct entity*, s_move_markers, idx);
+/* State changes of the flock members must go through here, so that the
+ * flock's per-state counts are kept up to date. */
+static void flock_set_state(struct flock *flock, int slot, enum arrival_state state)
+{
+    assert(flock->num_in_state[s_move.state[slot]] > 0);
+    --flock->num_in_state[s_move.state[slot]];
+    ++flock->num_in_state[state];
+    s_move.state[slot] = state;
+}
 
-    E_Entity_Unregister(EVENT_ANIM_FINISHED, ent->uid, on_marker_anim_finish);
-    AL_EntityFree(ent);
+static void flock_stop_member(struct flock *flock, int slot)
+{
+    flock_set_state(flock, slot, STATE_ARRIVED);
+    entity_stop(slot);
 }
 
-static bool adjacent_to_any_in_set(const struct entity *ent, const struct entity **set,
-                                   size_t set_size)
+/* Returns the index of the first adjacent entity in the set, or -1 if there is none. 
+ * 'set' maps the UIDs of the entities in the set to their index. Only the entities 
+ * near 'ent' in the spatial grid are looked up in it. */
+static int adjacent_to_any_in_set(const struct entity *ent, const khash_t(slot) *set)
 {
     vec2_t ent_xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
+    G_Spatial_QueryCircle(ent_xz_pos, ent->selection_radius + ADJACENCY_SEP_DIST, &s_neighbours);
+
+    int ret = -1;
+    for(int i = 0; i < kv_size(s_neighbours); i++) {
 
-    for(int i = 0; i < set_size; i++) {
+        const struct entity *curr = kv_A(s_neighbours, i);
+        khiter_t k = kh_get(slot, set, curr->uid);
+        if(k == kh_end(set))
+            continue;
+
+        /* The query results are in no particular order */
+        int idx = kh_value(set, k);
+        if(ret >= 0 && idx > ret)
+            continue;
 
-        vec2_t curr_xz_pos = (vec2_t){set[i]->pos.x, set[i]->pos.z};
+        vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
         vec2_t diff;
         PFM_Vec2_Sub(&ent_xz_pos, &curr_xz_pos, &diff);
 
-        if(PFM_Vec2_Len(&diff) <= ent->selection_radius + set[i]->selection_radius + ADJACENCY_SEP_DIST)
-            return true;  
+        if(PFM_Vec2_Len(&diff) <= ent->selection_radius + curr->selection_radius + ADJACENCY_SEP_DIST)
+            ret = idx;
     }
+    return ret;
+}
 
-    return false;
+/* Entities are routed on the navigation layer which keeps them clear of any obstacles 
+ * that they would not fit past. */
+static enum nav_layer layer_for_ent(const struct entity *ent)
+{
+    return N_LayerForRadius(ent->selection_radius);
 }
 
-static bool make_flock_from_selection(const pentity_kvec_t *sel, vec2_t target_xz)
+/* Takes the entity at 'slot' out of its' flock, if it is in one */
+static void flock_remove_member(int slot, uint32_t uid)
+{
+    if(s_move.flock[slot] < 0)
+        return;
+
+    int idx = s_move.flock[slot];
+    struct flock *curr_flock = &kv_A(s_flocks, idx);
+    khiter_t k = kh_get(entity, curr_flock->ents, uid);
+    assert(k != kh_end(curr_flock->ents));
+
+    --curr_flock->num_in_state[s_move.state[slot]];
+    kh_del(entity, curr_flock->ents, k);
+    s_move.flock[slot] = -1;
+
+    /* Remove the flock once it has become empty */
+    if(kh_size(curr_flock->ents) == 0)
+        flocks_delete(idx);
+}
+
+static void remove_from_flocks(const pentity_kvec_t *sel)
 {
-    /* First remove the entities in the selection from any active flocks */
     for(int i = 0; i < kv_size(*sel); i++) {
 
         const struct entity *curr_ent = kv_A(*sel, i);
         if(curr_ent->flags & ENTITY_FLAG_STATIC || curr_ent->max_speed == 0.0f)
             continue;
-        /* Remove any flocks which may have become empty. Iterate vector in backwards order 
-         * so that we can delete while iterating, since the last element in the vector takes
-         * the place of the deleted one. */
-        for(int j = kv_size(s_flocks)-1; j >= 0; j--) {
 
-            khiter_t k;
-            struct flock *curr_flock = &kv_A(s_flocks, j);
-            if((k = kh_get(entity, curr_flock->ents, curr_ent->uid)) != kh_end(curr_flock->ents))
-                kh_del(entity, curr_flock->ents, k);
+        int slot = slot_get(curr_ent->uid);
+        if(slot < 0)
+            continue;
+        flock_remove_member(slot, curr_ent->uid);
+    }
+}
+
+/* Request a new waypoint path from 'xz_src' to the flock's target. The 
+ * path is left untouched if there is none. */
+static bool waypoint_request(struct flock *flock, struct move_path *path, vec2_t xz_src)
+{
+    dest_id_t id;
+    size_t count = M_NavRequestWaypoints(s_map, xz_src, flock->target_xz, flock->layer, 
+                                         WAYPOINT_MAX_POINTS, path->points, &id);
+    if(count == 0)
+        return false;
 
-            if(kh_size(curr_flock->ents) == 0) {
-                kh_destroy(entity, curr_flock->ents);
-                kv_del(struct flock, s_flocks, j);
-            }
+    vec2_t last = path->points[count - 1];
+    path->count = count;
+    path->next = 0;
+    path->partial = (last.raw[0] != flock->target_xz.raw[0] || last.raw[1] != flock->target_xz.raw[1]);
+    flock->dest_id = id;
+    return true;
+}
+
+/* Moves the entity at 'slot' along its' waypoint path. Every few ticks, the 
+ * entity looks past the point it is heading for, in case it has already got 
+ * around the corner, and makes sure that it hasn't been pushed out of sight 
+ * of it. In that case, the path is requested again. */
+static void waypoint_advance(int slot, struct flock *flock)
+{
+    struct move_path *path = &kv_A(flock->paths, s_move.src_idx[slot]);
+    vec2_t pos_xz = s_move.pos[slot];
+    float reach = MAX(WAYPOINT_REACHED_DIST, s_move.radius[slot]);
+
+    while(path->next + 1 < path->count) {
+
+        vec2_t diff;
+        PFM_Vec2_Sub(&path->points[path->next], &pos_xz, &diff);
+        if(PFM_Vec2_Len(&diff) > reach)
+            break;
+        path->next++;
+    }
+
+    bool at_end = (path->next + 1 == path->count);
+    if(at_end && path->partial) {
+
+        vec2_t diff;
+        PFM_Vec2_Sub(&path->points[path->next], &pos_xz, &diff);
+        if(PFM_Vec2_Len(&diff) > reach)
+            return;
+
+        if(!waypoint_request(flock, path, pos_xz)) {
+            flock_stop_member(flock, slot);
+            E_Entity_Notify(EVENT_MOTION_END, s_move.ent[slot]->uid, NULL, ES_ENGINE);
         }
+        return;
+    }
+
+    if((s_tick_count + slot) % WAYPOINT_CHECK_INTERVAL)
+        return;
+
+    vec2_t srcs[2] = {pos_xz, pos_xz};
+    vec2_t dests[2] = {path->points[path->next], path->points[MIN(path->next + 1, path->count - 1)]};
+    bool hit[2];
+    vec2_t hit_pos[2];
+    M_NavRaycasts(s_map, flock->layer, at_end ? 1 : 2, srcs, dests, hit, hit_pos);
+
+    if(!at_end && !hit[1]) {
+        path->next++;
+        return;
     }
-    
+    if(hit[0])
+        waypoint_request(flock, path, pos_xz);
+}
+
+/* Small flocks skip the flow fields: every member gets a waypoint path of its' 
+ * own right away and starts moving. The members for which there is no path 
+ * are stopped. */
+static bool make_waypoint_flock(const pentity_kvec_t *sel, vec2_t target_xz, enum nav_layer layer,
+                                enum move_avoidance avoidance)
+{
     struct flock new_flock = (struct flock) {
-        .ents = kh_init(entity),
         .target_xz = target_xz,
+        .layer = layer,
+        .avoidance = avoidance,
+        .start_tick = s_tick_count,
+        .use_waypoints = true,
     };
+    if(!flock_init(&new_flock))
+        return false;
+
+    khiter_t k;
+    for(int i = 0; i < kv_size(*sel); i++) {
+
+        int ret, slot;
+        struct entity *curr_ent = kv_A(*sel, i);
+
+        if(curr_ent->flags & ENTITY_FLAG_STATIC || curr_ent->max_speed == 0.0f)
+            continue;
+        if(layer_for_ent(curr_ent) != layer)
+            continue;
+
+        struct move_path path;
+        if(!waypoint_request(&new_flock, &path, (vec2_t){curr_ent->pos.x, curr_ent->pos.z})) {
+
+            if((slot = slot_get(curr_ent->uid)) >= 0) {
+                s_move.ent[slot] = curr_ent;
+                entity_stop(slot);
+                E_Entity_Notify(EVENT_MOTION_END, curr_ent->uid, NULL, ES_ENGINE);
+            }
+            continue;
+        }
+
+        if((slot = slot_get(curr_ent->uid)) < 0) {
+            if((slot = slot_add(curr_ent)) < 0)
+                continue;
+        }else{
+            s_move.ent[slot] = curr_ent;
+            entity_unblock(slot);
+        }
+
+        k = kh_put(entity, new_flock.ents, curr_ent->uid, &ret);
+        assert(ret != -1 && ret != 0);
+        kh_value(new_flock.ents, k) = curr_ent;
+
+        if(s_move.state[slot] == STATE_ARRIVED)
+            E_Entity_Notify(EVENT_MOTION_START, curr_ent->uid, NULL, ES_ENGINE);
+        s_move.state[slot] = STATE_MOVING;
+        ++new_flock.num_in_state[STATE_MOVING];
+        s_move.ticket[slot] = NULL_PATH_TICKET;
+        s_move.src_idx[slot] = kv_size(new_flock.paths);
+        s_move.avoidance[slot] = new_flock.avoidance;
+        kv_push(struct move_path, new_flock.paths, path);
+    }
+
+    if(kh_size(new_flock.ents) > 0) {
+        kv_push(struct flock, s_flocks, new_flock);
+        flock_index_members(kv_size(s_flocks) - 1);
+        return true;
+    }else{
+        flock_destroy(&new_flock);
+        return false;
+    }
+}
 
-    if(!new_flock.ents)
+static bool make_layer_flock(const pentity_kvec_t *sel, vec2_t target_xz, enum nav_layer layer,
+                             enum move_avoidance avoidance)
+{
+    struct flock new_flock = (struct flock) {
+        .target_xz = target_xz,
+        .layer = layer,
+        .avoidance = avoidance,
+        .start_tick = s_tick_count,
+    };
+    if(!flock_init(&new_flock))
         return false;
 
-    /* Don't request a new path (flow field) for an entity that is adjacent to
-     * another entity for which a path has already been requested. This allows 
-     * saving pathfinding cycles, especially for large flocks. */
-    const struct entity *pathed_ents[kv_size(*sel)];
+    /* Don't add a new source to the path request for an entity that is adjacent 
+     * to another entity which is already pathing. This allows saving pathfinding 
+     * cycles, especially for large flocks. The adjacent entity will share the 
+     * source of its' neighbour. */
+    kh_clear(slot, s_pathed_ents);
+    size_t pathed_srcs[kv_size(*sel)];
     size_t num_pathed_ents = 0;
-    khiter_t k;
+
+    vec2_t srcs[kv_size(*sel)];
+    int src_idx[kv_size(*sel)];
+    size_t num_srcs = 0;
 
     for(int i = 0; i < kv_size(*sel); i++) {
 
-        int ret;
         const struct entity *curr_ent = kv_A(*sel, i);
+        src_idx[i] = -1;
 
         if(curr_ent->flags & ENTITY_FLAG_STATIC || curr_ent->max_speed == 0.0f)
             continue;
+        if(layer_for_ent(curr_ent) != layer)
+            continue;
 
-        dest_id_t id;
-        if(adjacent_to_any_in_set(curr_ent, pathed_ents, num_pathed_ents)
-        || M_NavRequestPath(s_map, (vec2_t){curr_ent->pos.x, curr_ent->pos.z}, target_xz, &id)) {
+        int adj_idx = adjacent_to_any_in_set(curr_ent, s_pathed_ents);
+        if(adj_idx >= 0) {
+            src_idx[i] = pathed_srcs[adj_idx];
+        }else{
+            src_idx[i] = num_srcs;
+            srcs[num_srcs++] = (vec2_t){curr_ent->pos.x, curr_ent->pos.z};
+        }
+
+        int ret;
+        khiter_t k = kh_put(slot, s_pathed_ents, curr_ent->uid, &ret);
+        if(ret == -1)
+            continue;
+
+        pathed_srcs[num_pathed_ents] = src_idx[i];
+        kh_value(s_pathed_ents, k) = num_pathed_ents++;
+    }
+
+    /* All the sources share a single request, so that the work common to 
+     * their paths is only done once. */
+    path_ticket_t ticket = NULL_PATH_TICKET;
+    if(num_srcs > 0) {
 
-            pathed_ents[num_pathed_ents++] = curr_ent;
+        dest_id_t id;
+        ticket = M_NavRequestPathsAsync(s_map, num_srcs, srcs, target_xz, layer, &id);
+        if(ticket != NULL_PATH_TICKET) {
             new_flock.dest_id = id;
+            kv_push(path_ticket_t, new_flock.tickets, ticket);
+        }
+    }
 
-            k = kh_put(entity, new_flock.ents, curr_ent->uid, &ret);
-            assert(ret != -1 && ret != 0);
-            kh_value(new_flock.ents, k) = (struct entity*)curr_ent;
+    khiter_t k;
+    for(int i = 0; i < kv_size(*sel); i++) {
+
+        int ret, slot;
+        struct entity *curr_ent = kv_A(*sel, i);
+
+        if(layer_for_ent(curr_ent) != layer)
+            continue;
+        if(src_idx[i] < 0)
+            continue;
+
+        if(ticket != NULL_PATH_TICKET) {
 
             /* When entities are moved from one flock to another, they keep their existing velocity. 
              * Otherwise, entities start out with a velocity of 0. */
-            if((k = kh_get(state, s_entity_state_table, curr_ent->uid)) == kh_end(s_entity_state_table)) {
-
-                k = kh_put(state, s_entity_state_table, curr_ent->uid, &ret);
-                assert(ret != -1 && ret != 0);
-                kh_value(s_entity_state_table, k) = (struct movestate){ 
-                    .velocity = {0.0f}, 
-                    .state = STATE_MOVING,
-                    .avoid_ticks_left = 0,
-                    .avoid_force = (vec2_t){0.0f},
-                };
-                E_Entity_Notify(EVENT_MOTION_START, curr_ent->uid, NULL, ES_ENGINE);
+            if((slot = slot_get(curr_ent->uid)) < 0) {
+                if((slot = slot_add(curr_ent)) < 0)
+                    continue;
+            }else{
+                s_move.ent[slot] = curr_ent;
+                entity_unblock(slot);
+            }
 
-            }else {
+            k = kh_put(entity, new_flock.ents, curr_ent->uid, &ret);
+            assert(ret != -1 && ret != 0);
+            kh_value(new_flock.ents, k) = curr_ent;
 
-                if(kh_value(s_entity_state_table, k).state == STATE_ARRIVED)
-                    E_Entity_Notify(EVENT_MOTION_START, curr_ent->uid, NULL, ES_ENGINE);
-                kh_value(s_entity_state_table, k).state = STATE_MOVING;
-            }
+            if(s_move.state[slot] == STATE_ARRIVED)
+                E_Entity_Notify(EVENT_MOTION_START, curr_ent->uid, NULL, ES_ENGINE);
+            s_move.state[slot] = STATE_WAITING;
+            ++new_flock.num_in_state[STATE_WAITING];
+            s_move.ticket[slot] = ticket;
+            s_move.src_idx[slot] = src_idx[i];
+            s_move.avoidance[slot] = new_flock.avoidance;
 
-        }else if((k = kh_get(state, s_entity_state_table, curr_ent->uid)) != kh_end(s_entity_state_table)){
+        }else if((slot = slot_get(curr_ent->uid)) >= 0){
 
-            kh_value(s_entity_state_table, k) = (struct movestate) {
-                .state = STATE_ARRIVED,
-                .velocity = (vec2_t){0.0f}
-            };
+            s_move.ent[slot] = curr_ent;
+            entity_stop(slot);
             E_Entity_Notify(EVENT_MOTION_END, curr_ent->uid, NULL, ES_ENGINE);
         }
     }
 
     if(kh_size(new_flock.ents) > 0) {
         kv_push(struct flock, s_flocks, new_flock);
+        flock_index_members(kv_size(s_flocks) - 1);
         return true;
     }else{
-        kh_destroy(entity, new_flock.ents);
+        flock_destroy(&new_flock);
         return false;
     }
 }
 
-size_t adjacent_flock_members(const struct entity *ent, const struct flock *flock, 
-                              struct entity *out[])
+static bool make_flock_from_selection(const pentity_kvec_t *sel, vec2_t target_xz, 
+                                      enum move_avoidance avoidance)
 {
-    vec2_t ent_xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
-    size_t ret = 0;
+    /* First remove the entities in the selection from any active flocks */
+    remove_from_flocks(sel);
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(flock->ents, key, curr, {
+    /* The adjacency of the selected entities is found with the spatial grid */
+    G_Spatial_Refresh(G_GetDynamicEnts());
 
-        if(curr == ent)
+    /* Entities of different sizes can't share the same flow fields, so a 
+     * separate flock is made for every layer used by the selection */
+    size_t used[NAV_LAYER_MAX] = {0};
+    for(int i = 0; i < kv_size(*sel); i++)
+        used[layer_for_ent(kv_A(*sel, i))]++;
+
+    bool ret = false;
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        if(!used[i])
+            continue;
+        if(used[i] <= (size_t)s_waypoint_group)
+            ret |= make_waypoint_flock(sel, target_xz, i, avoidance);
+        else
+            ret |= make_layer_flock(sel, target_xz, i, avoidance);
+    }
+    return ret;
+}
+
+static bool flock_contains(const struct flock *flock, const struct entity *ent)
+{
+    khiter_t k = kh_get(entity, flock->ents, ent->uid);
+    return (k != kh_end(flock->ents));
+}
+
+/* Check on the outstanding path requests of the flock. Entities whose path has 
+ * become ready start moving. Entities for which a path could not be found are
+ * stopped. */
+static void flock_poll_paths(struct flock *flock)
+{
+    for(int i = kv_size(flock->tickets)-1; i >= 0; i--) {
+
+        path_ticket_t ticket = kv_A(flock->tickets, i);
+        enum path_status status = M_NavPollPath(ticket);
+        if(status == PATH_PENDING)
+            continue;
+
+        uint32_t key;
+        struct entity *curr;
+        kh_foreach(flock->ents, key, curr, {
+
+            int slot = slot_get(curr->uid);
+            assert(slot >= 0);
+
+            if(s_move.state[slot] != STATE_WAITING || s_move.ticket[slot] != ticket)
+                continue;
+
+            if(status == PATH_READY && M_NavPathFound(ticket, s_move.src_idx[slot])) {
+                flock_set_state(flock, slot, STATE_MOVING);
+                s_move.ticket[slot] = NULL_PATH_TICKET;
+            }else{
+                flock_stop_member(flock, slot);
+                E_Entity_Notify(EVENT_MOTION_END, curr->uid, NULL, ES_ENGINE);
+            }
+        });
+
+        M_NavReleasePath(ticket);
+        kv_del(path_ticket_t, flock->tickets, i);
+    }
+}
+
+/* Returns true if any member of the flock which is adjacent to the entity at 
+ * 'slot' has arrived or is settling. */
+static bool adjacent_to_settled_member(int slot, const struct flock *flock, 
+                                       pentity_kvec_t *neighbours)
+{
+    const struct entity *ent = s_move.ent[slot];
+    vec2_t ent_xz_pos = s_move.pos[slot];
+
+    G_Spatial_QueryCircle(ent_xz_pos, s_move.radius[slot] + ADJACENCY_SEP_DIST, neighbours);
+    for(int i = 0; i < kv_size(*neighbours); i++) {
+
+        struct entity *curr = kv_A(*neighbours, i);
+        if(curr == ent || !flock_contains(flock, curr))
             continue;
 
         vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
         vec2_t diff;
         PFM_Vec2_Sub(&ent_xz_pos, &curr_xz_pos, &diff);
 
-        if(PFM_Vec2_Len(&diff) <= ent->selection_radius + curr->selection_radius + ADJACENCY_SEP_DIST)
-            out[ret++] = curr;  
-    });
-    return ret;
+        if(PFM_Vec2_Len(&diff) > s_move.radius[slot] + curr->selection_radius + ADJACENCY_SEP_DIST)
+            continue;
+
+        int curr_slot = slot_get(curr->uid);
+        assert(curr_slot >= 0);
+        if(s_move.state[curr_slot] == STATE_ARRIVED
+        || s_move.state[curr_slot] == STATE_SETTLING)
+            return true;
+    }
+    return false;
 }
 
-static const struct entity *most_threatening_obstacle(const struct entity *ent, struct line_seg_2d ahead, 
-                                                      const struct flock *flock)
+static const struct entity *most_threatening_obstacle(int slot, struct line_seg_2d ahead, 
+                                                      const struct flock *flock,
+                                                      pentity_kvec_t *neighbours)
 {
-    const khash_t(entity) *dynamic = G_GetDynamicEntsSet();
     float min_t = INFINITY;
     const struct entity *ret = NULL;
+    float radius = s_move.radius[slot];
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(dynamic, key, curr, {
+    size_t n = G_Spatial_QuerySegment(ahead, radius, neighbours);
+    if(0 == n)
+        return NULL;
+
+    float center_x[n], center_z[n], radii[n], t[n];
+    uint32_t hit[(n + 31) / 32];
+
+    for(int i = 0; i < n; i++) {
+
+        const struct entity *curr = kv_A(*neighbours, i);
+        center_x[i] = curr->pos.x;
+        center_z[i] = curr->pos.z;
+        radii[i] = curr->selection_radius + radius;
+    }
+    C_LineCirclesIntersect(ahead, n, center_x, center_z, radii, t, hit);
 
-        khiter_t k = kh_get(entity, flock->ents, curr->uid);
-        if(kh_exist(flock->ents, k))
+    /* Only the entities in the way are looked up in the flock */
+    for(int i = 0; i < n; i++) {
+
+        if(!(hit[i / 32] & (1u << (i % 32))) || t[i] >= min_t)
             continue;
 
-        float t;
-        vec2_t xz_center = (vec2_t){curr->pos.x, curr->pos.z};
-        if(C_LineCircleIntersection(ahead, xz_center, curr->selection_radius + ent->selection_radius, &t)){
+        struct entity *curr = kv_A(*neighbours, i);
+        if(flock_contains(flock, curr))
+            continue;
 
-            if(t < min_t) {
-                min_t = t;
-                ret = curr;
-            }
-        }
-    });
+        min_t = t[i];
+        ret = curr;
+    }
 
     assert(min_t < INFINITY ? (NULL != ret) : (NULL == ret));
     return ret;
@@ -321,22 +1088,26 @@ static const struct entity *most_threatening_obstacle(const struct entity *ent,
 
 static void move_marker_add(vec3_t pos)
 {
-    extern const char *g_basepath;
-    char path[256];
-    strcpy(path, g_basepath);
-    strcat(path, "assets/models/arrow");
-
-    struct entity *ent = AL_EntityFromPFObj(path, "arrow-green.pfobj", "__move_marker__");
-    assert(ent);
-
-    ent->pos = pos;
-    ent->scale = (vec3_t){2.0f, 2.0f, 2.0f};
-    E_Entity_Register(EVENT_ANIM_FINISHED, ent->uid, on_marker_anim_finish, ent);
-
-    A_InitCtx(ent, "Converge", 48);
-    A_SetActiveClip(ent, "Converge", ANIM_MODE_ONCE, 48);
-
-    kv_push(struct entity*, s_move_markers, ent);
+    /* The arrows start out on a circle around the point and reach it just as 
+     * they fade out */
+    struct particle arrows[MARKER_NUM_ARROWS];
+    for(int i = 0; i < MARKER_NUM_ARROWS; i++) {
+
+        float angle = (2.0f * M_PI * i) / MARKER_NUM_ARROWS;
+        vec2_t dir = (vec2_t){cos(angle), sin(angle)};
+
+        arrows[i] = (struct particle){
+            .pos      = (vec3_t){pos.x + dir.x * MARKER_RADIUS, pos.y + 0.1f, 
+                                 pos.z + dir.y * MARKER_RADIUS},
+            .lifetime = MARKER_LIFETIME,
+            .velocity = (vec3_t){-dir.x * MARKER_RADIUS / MARKER_LIFETIME, 0.0f,
+                                 -dir.y * MARKER_RADIUS / MARKER_LIFETIME},
+            .gravity  = 0.0f,
+            .color    = (vec4_t){0.0f, 1.0f, 0.0f, 0.9f},
+            .size     = (vec2_t){2.5f, 1.5f},
+        };
+    }
+    R_GL_EffectEmit(EFFECT_MOVE_MARKER, arrows, MARKER_NUM_ARROWS);
 }
 
 static void on_mousedown(void *user, void *event)
@@ -360,27 +1131,18 @@ static void on_mousedown(void *user, void *event)
     if(kv_size(*sel) > 0) {
 
         move_marker_add(mouse_coord);
-        make_flock_from_selection(sel, (vec2_t){mouse_coord.x, mouse_coord.z});
+        if(Net_Active())
+            Net_QueueMove(sel, (vec2_t){mouse_coord.x, mouse_coord.z});
+        else if(s_deterministic)
+            G_Move_Order(sel, (vec2_t){mouse_coord.x, mouse_coord.z}, s_tick_count);
+        else
+            make_flock_from_selection(sel, (vec2_t){mouse_coord.x, mouse_coord.z}, s_avoidance);
     }
 }
 
-static void on_render_3d(void *user, void *event)
+static quat_t dir_quat_from_velocity(vec2_t velocity)
 {
-    for(int i = 0; i < kv_size(s_move_markers); i++) {
-
-        const struct entity *curr = kv_A(s_move_markers, i);
-        if(curr->flags & ENTITY_FLAG_ANIMATED)
-            A_Update(curr);
-
-        mat4x4_t model;
-        Entity_ModelMatrix(curr, &model);
-        R_GL_Draw(curr->render_private, &model);
-    }
-}
-
-static quat_t dir_quat_from_velocity(vec2_t velocity)
-{
-    assert(PFM_Vec2_Len(&velocity) > EPSILON);
+    assert(PFM_Vec2_Len(&velocity) > EPSILON);
 
     float angle_rad = atan2(velocity.raw[1], velocity.raw[0]) - M_PI/2.0f;
     return (quat_t) {
@@ -393,20 +1155,16 @@ static quat_t dir_quat_from_velocity(vec2_t velocity)
 
 /* Seek behaviour makes the entity target and approach a particular destination point.
  */
-static vec2_t seek_force(const struct entity *ent, const struct flock *flock, int tick_res)
+static vec2_t seek_force(int slot, const struct flock *flock, int tick_res)
 {
     vec2_t ret, desired_velocity;
-    vec2_t pos_xz = (vec2_t){ent->pos.x, ent->pos.z};
+    vec2_t pos_xz = s_move.pos[slot];
 
     PFM_Vec2_Sub((vec2_t*)&flock->target_xz, &pos_xz, &desired_velocity);
     PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
-    PFM_Vec2_Scale(&desired_velocity, ent->max_speed / tick_res, &desired_velocity);
-
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    assert(k != kh_end(s_entity_state_table));
-    vec2_t velocity = kh_value(s_entity_state_table, k).velocity;
+    PFM_Vec2_Scale(&desired_velocity, s_move.max_speed[slot] / tick_res, &desired_velocity);
 
-    PFM_Vec2_Sub(&desired_velocity, &velocity, &ret);
+    PFM_Vec2_Sub(&desired_velocity, &s_move.velocity[slot], &ret);
     return ret;
 }
 
@@ -414,63 +1172,69 @@ static vec2_t seek_force(const struct entity *ent, const struct flock *flock, in
  * within a threshold radius of the destination point.
  * 
  * When not within line of sight of the destination, this will steer the entity along the 
- * flow field.
+ * flow field, or towards the next point of its' waypoint path.
  */
-static vec2_t arrive_force(const struct entity *ent, const struct flock *flock, int tick_res)
+static vec2_t arrive_force(int slot, const struct flock *flock, int tick_res)
 {
     vec2_t ret, desired_velocity;
-    vec2_t pos_xz = (vec2_t){ent->pos.x, ent->pos.z};
+    vec2_t pos_xz = s_move.pos[slot];
+    vec2_t target_xz = flock->target_xz;
+    bool slow_down = true;
     float distance;
 
-    if(M_NavHasDestLOS(s_map, flock->dest_id, pos_xz)) {
+    if(flock->use_waypoints) {
+        const struct move_path *path = &kv_A(flock->paths, s_move.src_idx[slot]);
+        target_xz = path->points[path->next];
+        slow_down = (path->next + 1 == path->count) && !path->partial;
+    }
 
-        PFM_Vec2_Sub((vec2_t*)&flock->target_xz, &pos_xz, &desired_velocity);
+    if(flock->use_waypoints || M_NavHasDestLOS(s_map, flock->dest_id, pos_xz)) {
+
+        PFM_Vec2_Sub(&target_xz, &pos_xz, &desired_velocity);
         distance = PFM_Vec2_Len(&desired_velocity);
         PFM_Vec2_Normal(&desired_velocity, &desired_velocity);
-        PFM_Vec2_Scale(&desired_velocity, ent->max_speed / tick_res, &desired_velocity);
+        PFM_Vec2_Scale(&desired_velocity, s_move.max_speed[slot] / tick_res, &desired_velocity);
 
-        if(distance < ARRIVE_SLOWING_RADIUS) {
+        if(slow_down && distance < ARRIVE_SLOWING_RADIUS) {
             PFM_Vec2_Scale(&desired_velocity, distance / ARRIVE_SLOWING_RADIUS, &desired_velocity);
         }
     }else{
 
         desired_velocity = M_NavDesiredVelocity(s_map, flock->dest_id, pos_xz, flock->target_xz);
-        PFM_Vec2_Scale(&desired_velocity, ent->max_speed / tick_res, &desired_velocity);
+        PFM_Vec2_Scale(&desired_velocity, s_move.max_speed[slot] / tick_res, &desired_velocity);
     }
 
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    assert(k != kh_end(s_entity_state_table));
-    vec2_t velocity = kh_value(s_entity_state_table, k).velocity;
-
-    PFM_Vec2_Sub(&desired_velocity, &velocity, &ret);
+    PFM_Vec2_Sub(&desired_velocity, &s_move.velocity[slot], &ret);
     vec2_truncate(&ret, MAX_FORCE);
     return ret;
 }
 
 /* Alignment is a behaviour that causes a particular agent to line up with agents close by.
  */
-static vec2_t alignment_force(const struct entity *ent, const struct flock *flock, int tick_res)
+static vec2_t alignment_force(int slot, const struct flock *flock, int tick_res,
+                              pentity_kvec_t *neighbours)
 {
     vec2_t ret = (vec2_t){0.0f};
     size_t neighbour_count = 0;
+    const struct entity *ent = s_move.ent[slot];
+    vec2_t ent_xz_pos = s_move.pos[slot];
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(flock->ents, key, curr, {
+    G_Spatial_QueryCircle(ent_xz_pos, ALIGN_NEIGHBOUR_RADIUS, neighbours);
+    for(int i = 0; i < kv_size(*neighbours); i++) {
 
-        if(curr == ent)
+        struct entity *curr = kv_A(*neighbours, i);
+        if(curr == ent || !flock_contains(flock, curr))
             continue;
 
         vec2_t diff;
-        vec2_t ent_xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
         vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
 
         PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
         if(PFM_Vec2_Len(&diff) < ALIGN_NEIGHBOUR_RADIUS) {
 
-            khiter_t k = kh_get(state, s_entity_state_table, curr->uid);
-            assert(kh_exist(s_entity_state_table, k));
-            vec2_t velocity = kh_value(s_entity_state_table, k).velocity;
+            int curr_slot = slot_get(curr->uid);
+            assert(curr_slot >= 0);
+            vec2_t velocity = s_move.velocity[curr_slot];
 
             if(PFM_Vec2_Len(&velocity) < EPSILON)
                 continue; 
@@ -478,80 +1242,76 @@ static vec2_t alignment_force(const struct entity *ent, const struct flock *floc
             PFM_Vec2_Add(&ret, &velocity, &ret);
             neighbour_count++;
         }
-    });
+    }
 
     if(0 == neighbour_count)
         return (vec2_t){0.0f};
 
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    assert(kh_exist(s_entity_state_table, k));
-    vec2_t velocity = kh_value(s_entity_state_table, k).velocity;
-
     PFM_Vec2_Scale(&ret, 1.0f / neighbour_count, &ret);
-    PFM_Vec2_Sub(&ret, &velocity, &ret);
+    PFM_Vec2_Sub(&ret, &s_move.velocity[slot], &ret);
     vec2_truncate(&ret, MAX_FORCE);
     return ret;
 }
 
 /* Cohesion is a behaviour that causes agents to steer towards the center of mass of nearby agents.
  */
-static vec2_t cohesion_force(const struct entity *ent, const struct flock *flock, int tick_res)
+static vec2_t cohesion_force(int slot, const struct flock *flock, int tick_res,
+                             pentity_kvec_t *neighbours)
 {
     vec2_t COM = (vec2_t){0.0f};
     size_t neighbour_count = 0;
+    const struct entity *ent = s_move.ent[slot];
+    vec2_t ent_xz_pos = s_move.pos[slot];
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(flock->ents, key, curr, {
+    G_Spatial_QueryCircle(ent_xz_pos, COHESION_NEIGHBOUR_RADIUS, neighbours);
+    for(int i = 0; i < kv_size(*neighbours); i++) {
 
-        if(curr == ent)
+        struct entity *curr = kv_A(*neighbours, i);
+        if(curr == ent || !flock_contains(flock, curr))
             continue;
 
         vec2_t diff;
-        vec2_t ent_xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
         vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
 
         PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
         if(PFM_Vec2_Len(&diff) < COHESION_NEIGHBOUR_RADIUS) {
 
-            vec2_t xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
-            PFM_Vec2_Add(&COM, &xz_pos, &COM);
+            PFM_Vec2_Add(&COM, &curr_xz_pos, &COM);
             neighbour_count++;
         }
-    });
+    }
 
     if(0 == neighbour_count)
         return (vec2_t){0.0f};
 
-    vec2_t xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
     PFM_Vec2_Scale(&COM, 1.0f / neighbour_count, &COM);
 
     vec2_t ret;
-    PFM_Vec2_Sub(&COM, &xz_pos, &ret);
+    PFM_Vec2_Sub(&COM, &ent_xz_pos, &ret);
     vec2_truncate(&ret, MAX_FORCE);
     return ret;
 }
 
 /* Separation is a behaviour that causes agents to steer away from nearby agents.
  */
-static vec2_t separation_force(const struct entity *ent, const struct flock *flock, int tick_res,
-                               float buffer_dist)
+static vec2_t separation_force(int slot, const struct flock *flock, int tick_res,
+                               float buffer_dist, pentity_kvec_t *neighbours)
 {
-    const float NEIGHBOUR_RADIUS = ent->selection_radius + buffer_dist;
+    const float NEIGHBOUR_RADIUS = s_move.radius[slot] + buffer_dist;
 
     vec2_t ret = (vec2_t){0.0f};
     size_t neighbour_count = 0;
-    const khash_t(entity) *dynamic = G_GetDynamicEntsSet();
+    const struct entity *ent = s_move.ent[slot];
+    vec2_t ent_xz_pos = s_move.pos[slot];
 
-    uint32_t key;
-    struct entity *curr;
-    kh_foreach(dynamic, key, curr, {
+    G_Spatial_QueryCircle(ent_xz_pos, NEIGHBOUR_RADIUS, neighbours);
+    for(int i = 0; i < kv_size(*neighbours); i++) {
 
+        struct entity *curr = kv_A(*neighbours, i);
         if(curr == ent)
             continue;
 
         vec2_t diff;
-        vec2_t ent_xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
         vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
 
         PFM_Vec2_Sub(&curr_xz_pos, &ent_xz_pos, &diff);
@@ -562,7 +1322,7 @@ static vec2_t separation_force(const struct entity *ent, const struct flock *flo
             PFM_Vec2_Add(&ret, &diff, &ret);
             neighbour_count++;
         }
-    });
+    }
 
     if(0 == neighbour_count)
         return (vec2_t){0.0f};
@@ -574,27 +1334,28 @@ static vec2_t separation_force(const struct entity *ent, const struct flock *flo
 
 /* Collision avoidance is a behaviour that causes agents to steer around obstacles in front of them.
  */
-static vec2_t collision_avoidance_force(const struct entity *ent, const struct flock *flock, int tick_res)
+static vec2_t collision_avoidance_force(int slot, const struct flock *flock, int tick_res,
+                                        pentity_kvec_t *neighbours)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    assert(kh_exist(s_entity_state_table, k));
-    vec2_t velocity = kh_value(s_entity_state_table, k).velocity;
+    vec2_t velocity = s_move.velocity[slot];
+    vec2_t pos_xz = s_move.pos[slot];
+    float radius = s_move.radius[slot];
 
     if(PFM_Vec2_Len(&velocity) < EPSILON)
         return (vec2_t){0.0f};
 
     vec2_t line;
     PFM_Vec2_Normal(&velocity, &line);
-    PFM_Vec2_Scale(&line, ent->selection_radius + COLLISION_MAX_SEE_AHEAD, &line);
+    PFM_Vec2_Scale(&line, radius + COLLISION_MAX_SEE_AHEAD, &line);
 
     struct line_seg_2d ahead = {
-        .ax = ent->pos.x,
-        .az = ent->pos.z,
-        .bx = ent->pos.x + line.raw[0],
-        .bz = ent->pos.z + line.raw[1]
+        .ax = pos_xz.raw[0],
+        .az = pos_xz.raw[1],
+        .bx = pos_xz.raw[0] + line.raw[0],
+        .bz = pos_xz.raw[1] + line.raw[1]
     };
 
-    const struct entity *threat = most_threatening_obstacle(ent, ahead, flock);
+    const struct entity *threat = most_threatening_obstacle(slot, ahead, flock, neighbours);
     if(!threat)
         return (vec2_t){0.0f};
 
@@ -607,8 +1368,8 @@ static vec2_t collision_avoidance_force(const struct entity *ent, const struct f
     /* Return a rightward avoidance force which is scaled depending on how 
      * sharply the entity must turn. */
     vec2_t right_off = right_dir;
-    assert(threat->selection_radius > 0.0f && ent->selection_radius > 0.0f);
-    float collision_dist = ent->selection_radius + threat->selection_radius;
+    assert(threat->selection_radius > 0.0f && radius > 0.0f);
+    float collision_dist = radius + threat->selection_radius;
     PFM_Vec2_Scale(&right_off, collision_dist, &right_off);
 
     vec2_t diff;
@@ -623,30 +1384,32 @@ static vec2_t collision_avoidance_force(const struct entity *ent, const struct f
     return right_dir;
 }
 
-static vec2_t total_steering_force(const struct entity *ent, const struct flock *flock, int tick_res,
-                                   vec2_t *out_col_avoid_force)
+/* Called on worker threads. The 'arrive' force, which needs the navigation
+ * data, must have already been computed on the main thread. */
+static vec2_t total_steering_force(int slot, const struct flock *flock, int tick_res, enum steer_lod lod,
+                                   pentity_kvec_t *neighbours, vec2_t *out_col_avoid_force)
 {
-    khiter_t k = kh_get(state, s_entity_state_table, ent->uid);
-    assert(kh_exist(s_entity_state_table, k));
-    enum arrival_state state = kh_value(s_entity_state_table, k).state;
-
-    vec2_t arrive = arrive_force(ent, flock, tick_res);
-    vec2_t cohesion = cohesion_force(ent, flock, tick_res);
-    vec2_t alignment = alignment_force(ent, flock, tick_res);
-    vec2_t collision_avoid = collision_avoidance_force(ent, flock, tick_res);
+    enum arrival_state state = s_move.state[slot];
+    bool full = (lod == LOD_FULL);
+
+    /* At reduced detail, the entity just follows the flow field while keeping 
+     * its' distance from its' neighbours. */
+    vec2_t arrive = s_move.arrive[slot];
+    vec2_t cohesion = full ? cohesion_force(slot, flock, tick_res, neighbours) : (vec2_t){0.0f};
+    vec2_t alignment = full ? alignment_force(slot, flock, tick_res, neighbours) : (vec2_t){0.0f};
+    vec2_t collision_avoid = full ? collision_avoidance_force(slot, flock, tick_res, neighbours) : (vec2_t){0.0f};
     *out_col_avoid_force = collision_avoid;
 
-    unsigned ca_ticks_left = kh_value(s_entity_state_table, k).avoid_ticks_left > 0
-                           ? (kh_value(s_entity_state_table, k).avoid_ticks_left - 1)
+    unsigned ca_ticks_left = s_move.avoid_ticks_left[slot] > 0
+                           ? (s_move.avoid_ticks_left[slot] - 1)
                            : COLLISION_AVOID_MAX_TICKS;
-    collision_avoid = kh_value(s_entity_state_table, k).avoid_ticks_left > 0
-                    ? kh_value(s_entity_state_table, k).avoid_force
+    collision_avoid = (full && s_move.avoid_ticks_left[slot] > 0)
+                    ? s_move.avoid_force[slot]
                     : collision_avoid;
 
     /* When we get pushed onto an impassable tile, increase the proportion of the
      * 'arrive' force, which will steer us back towards the nearest passable tile.*/
-    vec2_t xz_pos = (vec2_t){ent->pos.x, ent->pos.z};
-    if(!M_NavPositionPathable(s_map, xz_pos)) {
+    if(!M_NavPositionPathable(s_map, flock->layer, s_move.pos[slot])) {
         PFM_Vec2_Scale(&arrive, 3.0f, &arrive);
         PFM_Vec2_Scale(&alignment, 0.0f, &alignment);
     }
@@ -654,7 +1417,7 @@ static vec2_t total_steering_force(const struct entity *ent, const struct flock
     vec2_t ret = (vec2_t){0.0f};
     switch(state) {
     case STATE_MOVING: {
-        vec2_t separation = separation_force(ent, flock, tick_res, MOVE_SEPARATION_BUFFER_DIST);
+        vec2_t separation = separation_force(slot, flock, tick_res, MOVE_SEPARATION_BUFFER_DIST, neighbours);
 
         PFM_Vec2_Scale(&collision_avoid, MOVE_COL_AVOID_FORCE_SCALE,  &collision_avoid);
         PFM_Vec2_Scale(&separation,      MOVE_SEPARATION_FORCE_SCALE, &separation);
@@ -673,13 +1436,25 @@ static vec2_t total_steering_force(const struct entity *ent, const struct flock
         break;
     }
     case STATE_SETTLING: {
-        vec2_t separation = separation_force(ent, flock, tick_res, SETTLE_SEPARATION_BUFFER_DIST);
+        vec2_t separation = separation_force(slot, flock, tick_res, SETTLE_SEPARATION_BUFFER_DIST, neighbours);
 
         PFM_Vec2_Scale(&separation, SETTLE_SEPARATION_FORCE_SCALE, &separation);
         PFM_Vec2_Add(&ret, &separation, &ret);
 
         break;
     }
+    case STATE_WAITING: {
+        /* Hold position: brake to a stop while keeping clear of neighbours */
+        vec2_t separation = separation_force(slot, flock, tick_res, MOVE_SEPARATION_BUFFER_DIST, neighbours);
+        vec2_t brake = s_move.velocity[slot];
+
+        PFM_Vec2_Scale(&brake, -1.0f, &brake);
+        PFM_Vec2_Scale(&separation, MOVE_SEPARATION_FORCE_SCALE, &separation);
+        PFM_Vec2_Add(&ret, &brake, &ret);
+        PFM_Vec2_Add(&ret, &separation, &ret);
+
+        break;
+    }
     case STATE_ARRIVED:
         break;
     default: assert(0);
@@ -689,136 +1464,828 @@ static vec2_t total_steering_force(const struct entity *ent, const struct flock
     return ret;
 }
 
+static float vec2_det(vec2_t a, vec2_t b)
+{
+    return a.raw[0] * b.raw[1] - a.raw[1] * b.raw[0];
+}
+
+/* The signed distance by which 'vel' lies to the right of the line, i.e. 
+ * outside of its' half-plane. */
+static float orca_violation(const struct orca_line *line, vec2_t vel)
+{
+    vec2_t diff;
+    PFM_Vec2_Sub(&line->point, &vel, &diff);
+    return vec2_det(line->dir, diff);
+}
+
+/* Finds the best velocity on line 'idx' which satisfies all the lines before 
+ * it and is no faster than 'max_speed'. When 'dir_opt' is set, 'opt' is a 
+ * unit direction to go as far as possible in. Otherwise, the result is the 
+ * closest point to 'opt'. Returns false if there is no such velocity. */
+static bool orca_lp1(const struct orca_line *lines, size_t idx, float max_speed, 
+                     vec2_t opt, bool dir_opt, vec2_t *out)
+{
+    const struct orca_line *line = &lines[idx];
+    float dot = PFM_Vec2_Dot((vec2_t*)&line->point, (vec2_t*)&line->dir);
+    float discr = dot * dot + max_speed * max_speed 
+                - PFM_Vec2_Dot((vec2_t*)&line->point, (vec2_t*)&line->point);
+    if(discr < 0.0f)
+        return false;
+
+    float sqrt_discr = sqrtf(discr);
+    float t_left = -dot - sqrt_discr;
+    float t_right = -dot + sqrt_discr;
+
+    for(int i = 0; i < idx; i++) {
+
+        vec2_t diff;
+        PFM_Vec2_Sub((vec2_t*)&line->point, (vec2_t*)&lines[i].point, &diff);
+        float denom = vec2_det(line->dir, lines[i].dir);
+        float numer = vec2_det(lines[i].dir, diff);
+
+        /* The lines are parallel */
+        if(fabsf(denom) <= EPSILON) {
+            if(numer < 0.0f)
+                return false;
+            continue;
+        }
+
+        float t = numer / denom;
+        if(denom >= 0.0f)
+            t_right = MIN(t_right, t);
+        else
+            t_left = MAX(t_left, t);
+
+        if(t_left > t_right)
+            return false;
+    }
+
+    float t;
+    if(dir_opt) {
+        t = PFM_Vec2_Dot(&opt, (vec2_t*)&line->dir) > 0.0f ? t_right : t_left;
+    }else{
+        vec2_t diff;
+        PFM_Vec2_Sub(&opt, (vec2_t*)&line->point, &diff);
+        t = PFM_Vec2_Dot((vec2_t*)&line->dir, &diff);
+        t = MAX(t_left, MIN(t, t_right));
+    }
+
+    vec2_t along;
+    PFM_Vec2_Scale((vec2_t*)&line->dir, t, &along);
+    PFM_Vec2_Add((vec2_t*)&line->point, &along, out);
+    return true;
+}
+
+/* Finds the velocity closest to 'opt' (or furthest along it, for 'dir_opt') 
+ * which satisfies all the lines and is no faster than 'max_speed'. Returns 
+ * the index of the line which could not be satisfied, or 'count' on success. 
+ * On failure, 'out' is left satisfying all the lines before it. */
+static size_t orca_lp2(const struct orca_line *lines, size_t count, float max_speed, 
+                       vec2_t opt, bool dir_opt, vec2_t *out)
+{
+    if(dir_opt) {
+        PFM_Vec2_Scale(&opt, max_speed, out);
+    }else{
+        *out = opt;
+        vec2_truncate(out, max_speed);
+    }
+
+    for(int i = 0; i < count; i++) {
+
+        if(orca_violation(&lines[i], *out) <= 0.0f)
+            continue;
+
+        vec2_t prev = *out;
+        if(!orca_lp1(lines, i, max_speed, opt, dir_opt, out)) {
+            *out = prev;
+            return i;
+        }
+    }
+    return count;
+}
+
+/* When the constraints can't all be met, pick the velocity which violates 
+ * the lines from 'begin' onwards by the least amount. */
+static void orca_lp3(const struct orca_line *lines, size_t count, size_t begin, 
+                     float max_speed, vec2_t *out)
+{
+    float dist = 0.0f;
+
+    for(int i = begin; i < count; i++) {
+
+        if(orca_violation(&lines[i], *out) <= dist)
+            continue;
+
+        /* Constrain the velocity to move away from line 'i' at least as fast 
+         * as from each of the lines before it */
+        struct orca_line proj[i];
+        size_t num_proj = 0;
+
+        for(int j = 0; j < i; j++) {
+
+            struct orca_line line;
+            float det = vec2_det(lines[i].dir, lines[j].dir);
+
+            if(fabsf(det) <= EPSILON) {
+
+                /* The lines point the same way - 'j' is already covered by 'i' */
+                if(PFM_Vec2_Dot((vec2_t*)&lines[i].dir, (vec2_t*)&lines[j].dir) > 0.0f)
+                    continue;
+                PFM_Vec2_Add((vec2_t*)&lines[i].point, (vec2_t*)&lines[j].point, &line.point);
+                PFM_Vec2_Scale(&line.point, 0.5f, &line.point);
+            }else{
+
+                vec2_t diff, along;
+                PFM_Vec2_Sub((vec2_t*)&lines[i].point, (vec2_t*)&lines[j].point, &diff);
+                PFM_Vec2_Scale((vec2_t*)&lines[i].dir, vec2_det(lines[j].dir, diff) / det, &along);
+                PFM_Vec2_Add((vec2_t*)&lines[i].point, &along, &line.point);
+            }
+
+            PFM_Vec2_Sub((vec2_t*)&lines[j].dir, (vec2_t*)&lines[i].dir, &line.dir);
+            PFM_Vec2_Normal(&line.dir, &line.dir);
+            proj[num_proj++] = line;
+        }
+
+        vec2_t prev = *out;
+        vec2_t away = (vec2_t){-lines[i].dir.raw[1], lines[i].dir.raw[0]};
+        if(orca_lp2(proj, num_proj, max_speed, away, true, out) < num_proj) {
+            /* This can only happen due to floating point error - keep the 
+             * current result */
+            *out = prev;
+        }
+        dist = orca_violation(&lines[i], *out);
+    }
+}
+
+/* The half-plane of the entity's velocities which keep it clear of 'other' 
+ * for the time horizon. 'share' is the fraction of the avoidance the entity 
+ * takes on itself: half when the other entity is avoiding it in turn. */
+static struct orca_line orca_line_for(int slot, vec2_t other_pos, vec2_t other_vel,
+                                      float other_radius, float share)
+{
+    const float inv_horizon = 1.0f / ORCA_TIME_HORIZON;
+    vec2_t velocity = s_move.velocity[slot];
+
+    vec2_t rel_pos, rel_vel;
+    PFM_Vec2_Sub(&other_pos, &s_move.pos[slot], &rel_pos);
+    PFM_Vec2_Sub(&velocity, &other_vel, &rel_vel);
+
+    float dist_sq = PFM_Vec2_Dot(&rel_pos, &rel_pos);
+    float comb_radius = s_move.radius[slot] + other_radius;
+    float comb_radius_sq = comb_radius * comb_radius;
+
+    struct orca_line ret;
+    vec2_t u, w, scaled;
+
+    if(dist_sq > comb_radius_sq) {
+
+        /* 'w' is the relative velocity as seen from the center of the cutoff 
+         * circle of the truncated velocity obstacle */
+        PFM_Vec2_Scale(&rel_pos, inv_horizon, &scaled);
+        PFM_Vec2_Sub(&rel_vel, &scaled, &w);
+        float w_len_sq = PFM_Vec2_Dot(&w, &w);
+        float dot1 = PFM_Vec2_Dot(&w, &rel_pos);
+
+        if(dot1 < 0.0f && dot1 * dot1 > comb_radius_sq * w_len_sq) {
+
+            /* Project on the cutoff circle */
+            float w_len = sqrtf(w_len_sq);
+            vec2_t unit_w;
+            PFM_Vec2_Scale(&w, 1.0f / w_len, &unit_w);
+
+            ret.dir = (vec2_t){unit_w.raw[1], -unit_w.raw[0]};
+            PFM_Vec2_Scale(&unit_w, comb_radius * inv_horizon - w_len, &u);
+        }else{
+
+            /* Project on the nearer of the legs */
+            float leg = sqrtf(dist_sq - comb_radius_sq);
+            float x = rel_pos.raw[0], z = rel_pos.raw[1];
+
+            if(vec2_det(rel_pos, w) > 0.0f) {
+                ret.dir = (vec2_t){x * leg - z * comb_radius, x * comb_radius + z * leg};
+            }else{
+                ret.dir = (vec2_t){-(x * leg + z * comb_radius), -(-x * comb_radius + z * leg)};
+            }
+            PFM_Vec2_Scale(&ret.dir, 1.0f / dist_sq, &ret.dir);
+
+            PFM_Vec2_Scale(&ret.dir, PFM_Vec2_Dot(&rel_vel, &ret.dir), &u);
+            PFM_Vec2_Sub(&u, &rel_vel, &u);
+        }
+    }else{
+
+        /* Already overlapping - get apart within a single tick */
+        PFM_Vec2_Sub(&rel_vel, &rel_pos, &w);
+        float w_len = PFM_Vec2_Len(&w);
+        vec2_t unit_w = (vec2_t){1.0f, 0.0f};
+        if(w_len > EPSILON) {
+            PFM_Vec2_Scale(&w, 1.0f / w_len, &unit_w);
+        }
+
+        ret.dir = (vec2_t){unit_w.raw[1], -unit_w.raw[0]};
+        PFM_Vec2_Scale(&unit_w, comb_radius - w_len, &u);
+    }
+
+    PFM_Vec2_Scale(&u, share, &u);
+    PFM_Vec2_Add(&velocity, &u, &ret.point);
+    return ret;
+}
+
+/* Called on worker threads. Returns the velocity closest to 'pref_velocity' 
+ * which won't lead to a collision with any of the entity's nearest neighbours 
+ * within the time horizon, or the least colliding one when the entity is 
+ * boxed in. */
+static vec2_t orca_velocity(int slot, vec2_t pref_velocity, float max_speed, 
+                            pentity_kvec_t *neighbours)
+{
+    const struct entity *ent = s_move.ent[slot];
+    vec2_t pos = s_move.pos[slot];
+    float range = s_move.radius[slot] + ORCA_NEIGHBOUR_DIST;
+
+    /* Keep the nearest neighbours, sorted by distance */
+    const struct entity *nearest[ORCA_MAX_NEIGHBOURS];
+    float nearest_dist[ORCA_MAX_NEIGHBOURS];
+    size_t num_nearest = 0;
+
+    G_Spatial_QueryCircle(pos, range, neighbours);
+    for(int i = 0; i < kv_size(*neighbours); i++) {
+
+        const struct entity *curr = kv_A(*neighbours, i);
+        if(curr == ent)
+            continue;
+
+        vec2_t diff;
+        vec2_t curr_xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
+        PFM_Vec2_Sub(&curr_xz_pos, &pos, &diff);
+
+        float dist = PFM_Vec2_Len(&diff) - curr->selection_radius;
+        if(dist >= range)
+            continue;
+        if(num_nearest == ORCA_MAX_NEIGHBOURS && dist >= nearest_dist[num_nearest-1])
+            continue;
+
+        int j = MIN(num_nearest, ORCA_MAX_NEIGHBOURS - 1);
+        for(; j > 0 && nearest_dist[j-1] > dist; j--) {
+            nearest[j] = nearest[j-1];
+            nearest_dist[j] = nearest_dist[j-1];
+        }
+        nearest[j] = curr;
+        nearest_dist[j] = dist;
+        num_nearest = MIN(num_nearest + 1, ORCA_MAX_NEIGHBOURS);
+    }
+
+    struct orca_line lines[ORCA_MAX_NEIGHBOURS];
+    for(int i = 0; i < num_nearest; i++) {
+
+        const struct entity *curr = nearest[i];
+        int curr_slot = slot_get(curr->uid);
+
+        /* Entities which are not being steered with ORCA are not counted on 
+         * to get out of the way */
+        vec2_t curr_velocity = (vec2_t){0.0f};
+        float share = 1.0f;
+        if(curr_slot >= 0) {
+
+            curr_velocity = s_move.velocity[curr_slot];
+            if(s_move.avoidance[curr_slot] == MOVE_AVOID_ORCA
+            && (s_move.state[curr_slot] == STATE_MOVING || s_move.state[curr_slot] == STATE_SETTLING))
+                share = 0.5f;
+        }
+
+        lines[i] = orca_line_for(slot, (vec2_t){curr->pos.x, curr->pos.z}, curr_velocity, 
+                                 curr->selection_radius, share);
+    }
+
+    vec2_t ret;
+    size_t failed = orca_lp2(lines, num_nearest, max_speed, pref_velocity, false, &ret);
+    if(failed < num_nearest) {
+        orca_lp3(lines, num_nearest, failed, max_speed, &ret);
+    }
+    return ret;
+}
+
+/* Called on worker threads. ORCA replaces the separation and collision 
+ * avoidance forces: the entity heads for its' preferred velocity and the 
+ * solver keeps it clear of its' neighbours. */
+static vec2_t orca_steer(int slot, const struct flock *flock, int tick_res, enum steer_lod lod,
+                         pentity_kvec_t *neighbours)
+{
+    vec2_t velocity = s_move.velocity[slot];
+    vec2_t pref_velocity = (vec2_t){0.0f};
+
+    if(s_move.state[slot] == STATE_MOVING) {
+
+        vec2_t arrive = s_move.arrive[slot];
+        if(!M_NavPositionPathable(s_map, flock->layer, s_move.pos[slot])) {
+            PFM_Vec2_Scale(&arrive, 3.0f, &arrive);
+        }
+
+        /* Make up for the ticks skipped while coasting */
+        if(lod == LOD_REDUCED) {
+            PFM_Vec2_Scale(&arrive, LOD_REDUCED_INTERVAL, &arrive);
+        }
+        PFM_Vec2_Add(&velocity, &arrive, &pref_velocity);
+    }
+
+    return orca_velocity(slot, pref_velocity, s_move.max_speed[slot] / tick_res, neighbours);
+}
+
+/* Computes the new velocities of a batch of entities. This only reads the shared
+ * movement state, so that the batches can be run in parallel. */
+static void steer_task(void *arg, size_t idx)
+{
+    const int *tick_res = arg;
+    size_t begin = idx * STEER_BATCH_SIZE;
+    size_t end = MIN(begin + STEER_BATCH_SIZE, kv_size(s_steer_work));
+
+    pentity_kvec_t *neighbours = &kv_A(s_steer_neighbours, idx);
+
+    uint64_t updates[MOVE_AVOID_MAX] = {0};
+    uint64_t ticks[MOVE_AVOID_MAX] = {0};
+
+    for(size_t i = begin; i < end; i++) {
+
+        int slot = kv_A(s_steer_work, i).slot;
+        const struct flock *flock = kv_A(s_steer_work, i).flock;
+        enum steer_lod lod = kv_A(s_steer_work, i).lod;
+
+        if(lod == LOD_COAST) {
+            s_move.next_velocity[slot] = s_move.velocity[slot];
+            s_move.col_avoid[slot] = (vec2_t){0.0f};
+            continue;
+        }
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        updates[flock->avoidance]++;
+
+        if(flock->avoidance == MOVE_AVOID_ORCA) {
+
+            s_move.next_velocity[slot] = orca_steer(slot, flock, *tick_res, lod, neighbours);
+            s_move.col_avoid[slot] = (vec2_t){0.0f};
+            ticks[flock->avoidance] += SDL_GetPerformanceCounter() - start;
+            continue;
+        }
+
+        vec2_t steer_accel, new_velocity; 
+        vec2_t steer_force = total_steering_force(slot, flock, *tick_res, lod, neighbours, 
+                                                  &s_move.col_avoid[slot]);
+        PFM_Vec2_Scale(&steer_force, 1.0f / ENTITY_MASS, &steer_accel);
+
+        /* Make up for the ticks skipped while coasting */
+        if(lod == LOD_REDUCED) {
+            PFM_Vec2_Scale(&steer_accel, LOD_REDUCED_INTERVAL, &steer_accel);
+        }
+
+        PFM_Vec2_Add(&s_move.velocity[slot], &steer_accel, &new_velocity);
+        vec2_truncate(&new_velocity, s_move.max_speed[slot] / *tick_res);
+        s_move.next_velocity[slot] = new_velocity;
+        ticks[flock->avoidance] += SDL_GetPerformanceCounter() - start;
+    }
+
+    SDL_AtomicLock(&s_stats_lock);
+    for(int i = 0; i < MOVE_AVOID_MAX; i++) {
+        s_stats[i].steer_updates += updates[i];
+        s_steer_ticks[i] += ticks[i];
+    }
+    SDL_AtomicUnlock(&s_stats_lock);
+}
+
+/* Moves the entity to its' new position and updates its' arrival state. 
+ * Must be called on the main thread. */
+static void steer_commit(int slot, struct flock *flock, vec2_t new_xz_pos, float height)
+{
+    struct entity *curr = s_move.ent[slot];
+    vec2_t new_velocity = s_move.next_velocity[slot];
+    vec2_t col_avoid_force = s_move.col_avoid[slot];
+
+    /******************************************************************
+     * Update position and rotation
+     *****************************************************************/
+    s_move.pos[slot] = new_xz_pos;
+    Entity_SetPos(curr, (vec3_t){new_xz_pos.raw[0], height, new_xz_pos.raw[1]});
+
+    if(PFM_Vec2_Len(&new_velocity) > EPSILON) {
+        Entity_SetRotation(curr, dir_quat_from_velocity(new_velocity));
+    }
+
+    /******************************************************************
+     * Update state of entity
+     *****************************************************************/
+    s_move.velocity[slot] = new_velocity;
+
+    if(s_move.avoid_ticks_left[slot] > 0) {
+        --s_move.avoid_ticks_left[slot];
+    }
+
+    if(PFM_Vec2_Len(&col_avoid_force) > 0.0f) {
+        s_move.avoid_ticks_left[slot] = COLLISION_AVOID_MAX_TICKS;
+        s_move.avoid_force[slot] = col_avoid_force;
+    }
+
+    switch(s_move.state[slot]) {
+    case STATE_MOVING: {
+
+        vec2_t diff_to_target;
+        PFM_Vec2_Sub((vec2_t*)&flock->target_xz, &s_move.pos[slot], &diff_to_target);
+        if(PFM_Vec2_Len(&diff_to_target) < ARRIVE_THRESHOLD_DIST){
+
+            flock_stop_member(flock, slot);
+            E_Entity_Notify(EVENT_MOTION_END, curr->uid, NULL, ES_ENGINE);
+            break;
+        }
+
+        /* Only look at the neighbours once some members have come to a stop */
+        if(flock->num_in_state[STATE_ARRIVED] + flock->num_in_state[STATE_SETTLING] == 0)
+            break;
+
+        if(adjacent_to_settled_member(slot, flock, &s_neighbours)) {
+            flock_set_state(flock, slot, STATE_SETTLING);
+        }
+        break;
+    }
+    case STATE_SETTLING: {
+
+        if(PFM_Vec2_Len(&new_velocity) < SETTLE_STOP_TOLERANCE * s_move.max_speed[slot])  {
+
+            flock_stop_member(flock, slot);
+            E_Entity_Notify(EVENT_MOTION_END, curr->uid, NULL, ES_ENGINE);
+        }
+        break;
+    }
+    case STATE_WAITING:
+    case STATE_ARRIVED: 
+        break;
+    default: 
+        assert(0);
+    }
+}
+
+/* Carry out the orders which are due, in the order they were given */
+static void carry_out_orders(void)
+{
+    pentity_kvec_t ents;
+    kv_init(ents);
+
+    size_t nkept = 0;
+    for(int i = 0; i < kv_size(s_orders); i++) {
+
+        struct move_order *curr = &kv_A(s_orders, i);
+        if(curr->tick > s_tick_count) {
+            kv_A(s_orders, nkept++) = *curr;
+            continue;
+        }
+
+        kv_reset(ents);
+        for(int j = 0; j < kv_size(curr->uids); j++) {
+
+            struct entity *ent = Entity_FromUID(kv_A(curr->uids, j));
+            if(ent)
+                kv_push(struct entity*, ents, ent);
+        }
+
+        if(kv_size(ents) > 0)
+            make_flock_from_selection(&ents, curr->target_xz, curr->avoidance);
+        kv_destroy(curr->uids);
+    }
+    kv_size(s_orders) = nkept;
+    kv_destroy(ents);
+}
+
+static int compare_work_by_uid(const void *a, const void *b)
+{
+    uint32_t uid_a = s_move.ent[((const struct steer_work*)a)->slot]->uid;
+    uint32_t uid_b = s_move.ent[((const struct steer_work*)b)->slot]->uid;
+    return (uid_a > uid_b) - (uid_a < uid_b);
+}
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Hashes the parts of the movement state which carry over from one tick to 
+ * the next. The floats are hashed bit for bit. Slots of entities which were 
+ * freed are skipped. */
+static uint32_t movestate_checksum(void)
+{
+    uint32_t ret = 2166136261u;
+    uint32_t tick = s_tick_count;
+    ret = fnv1a(ret, &tick, sizeof(tick));
+
+    for(int i = 0; i < s_move.size; i++) {
+
+        uint32_t uid = s_move.uid[i];
+        if(Entity_FromUID(uid) != s_move.ent[i])
+            continue;
+        int32_t state = s_move.state[i];
+
+        ret = fnv1a(ret, &uid, sizeof(uid));
+        ret = fnv1a(ret, &s_move.pos[i], sizeof(s_move.pos[i]));
+        ret = fnv1a(ret, &s_move.velocity[i], sizeof(s_move.velocity[i]));
+        ret = fnv1a(ret, &state, sizeof(state));
+    }
+    return ret;
+}
+
 static void on_30hz_tick(void *user, void *event)
 {
     const int TICK_RES = 30;
 
+    carry_out_orders();
+
+    /* Pick up the blockers added and removed in the last tick */
+    M_NavUpdateBlockers(s_map);
+
+    /* Bucket the entities by position for the neighbourhood queries of the 
+     * steering behaviours. */
+    G_Spatial_Rebuild(G_GetDynamicEnts(), 1.0f / TICK_RES);
+
     /* Iterate vector backwards so we can delete entries while iterating. */
     for(int i = kv_size(s_flocks)-1; i >= 0; i--) {
 
-        uint32_t key;
-        struct entity *curr;
+        struct flock *flock = &kv_A(s_flocks, i);
 
         /******************************************************************
-         * First, decide if we can disband this flock
+         * First, pick up any paths that have finished computing
          *****************************************************************/
-        bool disband = true;
-        kh_foreach(kv_A(s_flocks, i).ents, key, curr, {
-
-            khiter_t k = kh_get(state, s_entity_state_table, curr->uid);
-            assert(kh_exist(s_entity_state_table, k));
-            if(kh_value(s_entity_state_table, k).state != STATE_ARRIVED) {
-                disband = false;
-                break;
-            }
-        });
+        flock_poll_paths(flock);
 
-        if(disband) {
-            kh_destroy(entity, kv_A(s_flocks, i).ents);
-            kv_del(struct flock, s_flocks, i);
-            continue;
+        /******************************************************************
+         * Next, decide if we can disband this flock
+         *****************************************************************/
+        if(flock->num_in_state[STATE_ARRIVED] == kh_size(flock->ents)) {
+
+            SDL_AtomicLock(&s_stats_lock);
+            s_stats[flock->avoidance].flocks_arrived++;
+            s_stats[flock->avoidance].arrival_ms += (s_tick_count - flock->start_tick) * 1000 / TICK_RES;
+            SDL_AtomicUnlock(&s_stats_lock);
+
+            flocks_delete(i);
         }
+    }
 
-        kh_foreach(kv_A(s_flocks, i).ents, key, curr, {
-        
-            /******************************************************************
-             * Compute acceleration 
-             *****************************************************************/
-            vec2_t col_avoid_force;
-            vec2_t steer_accel, new_velocity; 
+    /******************************************************************
+     * Find the entities which must be steered at full detail. The 
+     * visible set is the one from the last rendered frame.
+     *****************************************************************/
+    memset(s_move.in_view, 0, s_move.size * sizeof(*s_move.in_view));
 
-            vec2_t steer_force = total_steering_force(curr, &kv_A(s_flocks, i), TICK_RES, &col_avoid_force);
-            PFM_Vec2_Scale(&steer_force, 1.0f / ENTITY_MASS, &steer_accel);
+    /* What is on-screen differs between the players */
+    const pentity_kvec_t *visible = s_deterministic ? &(pentity_kvec_t){0} : G_GetVisibleEnts();
+    vec3_t cam_pos = G_GetActiveCameraPos();
 
-            /******************************************************************
-             * Compute new velocity
-             *****************************************************************/
-            khiter_t k = kh_get(state, s_entity_state_table, curr->uid);
-            assert(kh_exist(s_entity_state_table, k));
-            vec2_t old_velocity = kh_value(s_entity_state_table, k).velocity; 
+    for(int i = 0; i < kv_size(*visible); i++) {
 
-            PFM_Vec2_Add(&old_velocity, &steer_accel, &new_velocity);
-            vec2_truncate(&new_velocity, curr->max_speed / TICK_RES);
+        const struct entity *curr = kv_A(*visible, i);
+        int slot = slot_get(curr->uid);
+        if(slot < 0)
+            continue;
 
-            /******************************************************************
-             * Update position and rotation
-             *****************************************************************/
-            vec2_t xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
-            vec2_t new_xz_pos;
-            PFM_Vec2_Add(&xz_pos, &new_velocity, &new_xz_pos);
-            new_xz_pos = M_ClampedMapCoordinate(s_map, new_xz_pos);
-            curr->pos = (vec3_t){new_xz_pos.raw[0], M_HeightAtPoint(s_map, new_xz_pos), new_xz_pos.raw[1]};
+        vec3_t diff;
+        PFM_Vec3_Sub((vec3_t*)&curr->pos, &cam_pos, &diff);
+        s_move.in_view[slot] = (PFM_Vec3_Len(&diff) <= LOD_FULL_DIST);
+    }
 
-            if(PFM_Vec2_Len(&new_velocity) > EPSILON) {
-                curr->rotation = dir_quat_from_velocity(new_velocity);
-            }
+    /******************************************************************
+     * Gather the entities to be steered. The 'arrive' force samples 
+     * the navigation data, which is not safe to touch from multiple 
+     * threads, so it is computed up front.
+     *****************************************************************/
+    ++s_tick_count;
+    kv_reset(s_steer_work);
+    for(int i = 0; i < kv_size(s_flocks); i++) {
+
+        uint32_t key;
+        struct entity *curr;
+        struct flock *flock = &kv_A(s_flocks, i);
+        size_t begin = kv_size(s_steer_work);
 
-            /******************************************************************
-             * Update state of entity
-             *****************************************************************/
-            kh_value(s_entity_state_table, k).velocity = new_velocity;
+        kh_foreach(flock->ents, key, curr, {
 
-            if(kh_value(s_entity_state_table, k).avoid_ticks_left > 0) {
-                --kh_value(s_entity_state_table, k).avoid_ticks_left;
-            }
+            int slot = slot_get(curr->uid);
+            assert(slot >= 0);
+            slot_gather(slot);
+
+            /* Stagger the steering ticks of the reduced detail entities */
+            enum steer_lod lod = (s_deterministic || s_move.in_view[slot])     ? LOD_FULL
+                               : ((s_tick_count + slot) % LOD_REDUCED_INTERVAL) ? LOD_COAST
+                               : LOD_REDUCED;
+
+            struct steer_work work = (struct steer_work){slot, flock, lod};
+            kv_push(struct steer_work, s_steer_work, work);
+        });
+
+        /* The order of the hash table depends on its' history. Sampling the
+         * navigation data may request fields, so it must be done in a fixed 
+         * order as well. */
+        if(s_deterministic) {
+            qsort(&kv_A(s_steer_work, begin), kv_size(s_steer_work) - begin, 
+                sizeof(struct steer_work), compare_work_by_uid);
+        }
+
+        for(int j = begin; j < kv_size(s_steer_work); j++) {
+
+            int slot = kv_A(s_steer_work, j).slot;
 
-            if(PFM_Vec2_Len(&col_avoid_force) > 0.0f) {
-                kh_value(s_entity_state_table, k).avoid_ticks_left = COLLISION_AVOID_MAX_TICKS;
-                kh_value(s_entity_state_table, k).avoid_force = col_avoid_force;
+            if(flock->use_waypoints
+            && (s_move.state[slot] == STATE_MOVING || s_move.state[slot] == STATE_SETTLING))
+                waypoint_advance(slot, flock);
+
+            /* The flow fields may not be available yet while waiting for a path */
+            if(kv_A(s_steer_work, j).lod != LOD_COAST) {
+                s_move.arrive[slot] = (s_move.state[slot] == STATE_WAITING) 
+                                    ? (vec2_t){0.0f} 
+                                    : arrive_force(slot, flock, TICK_RES);
             }
+        }
+    }
 
-            switch(kh_value(s_entity_state_table, k).state) {
-            case STATE_MOVING: {
+    /******************************************************************
+     * Compute the new velocities of all the entities from the state at
+     * the start of the tick. 
+     *****************************************************************/
+    size_t num_batches = (kv_size(s_steer_work) + STEER_BATCH_SIZE - 1) / STEER_BATCH_SIZE;
+    while(kv_size(s_steer_neighbours) < num_batches) {
+        pentity_kvec_t neighbours;
+        kv_init(neighbours);
+        kv_push(pentity_kvec_t, s_steer_neighbours, neighbours);
+    }
+    Perf_Push("steering");
+    PL_For(num_batches, steer_task, (void*)&TICK_RES);
+    Perf_Pop();
+
+    /******************************************************************
+     * Find where the entities end up, sampling the map height at all 
+     * the new positions in a single batch.
+     *****************************************************************/
+    Perf_Push("steering commit");
+    size_t num_work = kv_size(s_steer_work);
+    if(kv_max(s_commit_xz) < num_work) {
+        kv_resize(vec2_t, s_commit_xz, num_work);
+        kv_resize(float, s_commit_height, num_work);
+    }
 
-                vec2_t diff_to_target;
-                vec2_t xz_pos = (vec2_t){curr->pos.x, curr->pos.z};
-                PFM_Vec2_Sub(&kv_A(s_flocks, i).target_xz, &xz_pos, &diff_to_target);
-                if(PFM_Vec2_Len(&diff_to_target) < ARRIVE_THRESHOLD_DIST){
+    for(int i = 0; i < num_work; i++) {
 
-                    kh_value(s_entity_state_table, k) = (struct movestate) {
-                        .state = STATE_ARRIVED,
-                        .velocity = (vec2_t){0.0f}
-                    };
-                    E_Entity_Notify(EVENT_MOTION_END, curr->uid, NULL, ES_ENGINE);
-                }
+        int slot = kv_A(s_steer_work, i).slot;
+        vec2_t new_xz_pos;
+        PFM_Vec2_Add(&s_move.pos[slot], &s_move.next_velocity[slot], &new_xz_pos);
+        kv_A(s_commit_xz, i) = M_ClampedMapCoordinate(s_map, new_xz_pos);
+    }
+    M_HeightAtPoints(s_map, s_commit_xz.a, s_commit_height.a, num_work);
 
-                struct entity *adjacent[kh_size(kv_A(s_flocks, i).ents)]; 
-                size_t num_adj = adjacent_flock_members(curr, &kv_A(s_flocks, i), adjacent);
+    /******************************************************************
+     * Finally, move the entities and send out the notifications
+     *****************************************************************/
+    for(int i = 0; i < num_work; i++) {
 
-                for(int j = 0; j < num_adj; j++) {
+        steer_commit(kv_A(s_steer_work, i).slot, kv_A(s_steer_work, i).flock, 
+            kv_A(s_commit_xz, i), kv_A(s_commit_height, i));
+    }
+    Perf_Pop();
 
-                    khiter_t l = kh_get(state, s_entity_state_table, adjacent[j]->uid);
-                    assert(kh_exist(s_entity_state_table, l));
+    if(s_deterministic)
+        s_checksum = movestate_checksum();
+}
 
-                    if(kh_value(s_entity_state_table, l).state == STATE_ARRIVED
-                    || kh_value(s_entity_state_table, l).state == STATE_SETTLING) {
+/* The slot of the entity if it is still alive. Slots are given back when their 
+ * entity is removed from the game, but an entity may also be freed without 
+ * having been removed first. */
+static int live_slot_get(uint32_t uid)
+{
+    int slot = slot_get(uid);
+    if(slot < 0 || Entity_FromUID(uid) != s_move.ent[slot])
+        return -1;
+    return slot;
+}
 
-                        kh_value(s_entity_state_table, k).state = STATE_SETTLING;
-                        break;
-                    }
-                }
-                break;
-            }
-            case STATE_SETTLING: {
+static bool write_uids(SDL_RWops *out, const khash_t(entity) *ents, uint32_t count)
+{
+    uint32_t uids[count + 1];
+    uint32_t n = 0;
 
-                if(PFM_Vec2_Len(&new_velocity) < SETTLE_STOP_TOLERANCE * curr->max_speed)  {
+    uint32_t key;
+    struct entity *curr;
+    kh_foreach(ents, key, curr, {
+        if(live_slot_get(key) >= 0)
+            uids[n++] = key;
+    });
+    (void)curr;
 
-                    kh_value(s_entity_state_table, k) = (struct movestate) {
-                        .state = STATE_ARRIVED,
-                        .velocity = (vec2_t){0.0f}
-                    };
-                    E_Entity_Notify(EVENT_MOTION_END, curr->uid, NULL, ES_ENGINE);
-                }
-                break;
-            }
-            case STATE_ARRIVED: 
-                break;
-            default: 
-                assert(0);
+    assert(n == count);
+    return AL_WriteBytes(out, uids, n * sizeof(uint32_t));
+}
+
+static uint32_t live_members(const struct flock *flock)
+{
+    uint32_t ret = 0;
+    uint32_t key;
+    struct entity *curr;
+    kh_foreach(flock->ents, key, curr, {
+        if(live_slot_get(key) >= 0)
+            ++ret;
+    });
+    (void)curr;
+    return ret;
+}
+
+/* Drop all the flocks and orders, leaving every entity stopped where it is 
+ * and not blocking */
+static void movestate_clear(void)
+{
+    for(int i = 0; i < kv_size(s_flocks); i++)
+        flock_destroy(&kv_A(s_flocks, i));
+    kv_reset(s_flocks);
+
+    for(int i = 0; i < kv_size(s_orders); i++)
+        kv_destroy(kv_A(s_orders, i).uids);
+    kv_reset(s_orders);
+
+    for(int slot = 0; slot < s_move.size; slot++) {
+
+        entity_unblock(slot);
+        s_move.state[slot] = STATE_ARRIVED;
+        s_move.velocity[slot] = (vec2_t){0.0f};
+        s_move.avoid_force[slot] = (vec2_t){0.0f};
+        s_move.avoid_ticks_left[slot] = 0;
+        s_move.ticket[slot] = NULL_PATH_TICKET;
+        s_move.src_idx[slot] = 0;
+        s_move.flock[slot] = -1;
+    }
+}
+
+/* Make a flock of the live members out of the ones given. The members which 
+ * were on their way request their paths again, as the path requests are not 
+ * saved, and wait for them before moving on. */
+static void flock_restore(const struct flock_rec *rec, const uint32_t *uids)
+{
+    struct flock new_flock = (struct flock) {
+        .target_xz = rec->target_xz,
+        .layer = rec->layer,
+        .avoidance = rec->avoidance,
+        .start_tick = rec->start_tick,
+    };
+    if(!flock_init(&new_flock))
+        return;
+
+    vec2_t srcs[rec->num_members + 1];
+    size_t num_srcs = 0;
+
+    for(int i = 0; i < rec->num_members; i++) {
+
+        int slot = live_slot_get(uids[i]);
+        if(slot < 0)
+            continue;
+
+        int ret;
+        khiter_t k = kh_put(entity, new_flock.ents, uids[i], &ret);
+        if(ret == -1)
+            continue;
+        kh_value(new_flock.ents, k) = s_move.ent[slot];
+
+        if(s_move.state[slot] != STATE_ARRIVED) {
+            s_move.src_idx[slot] = num_srcs;
+            srcs[num_srcs++] = s_move.pos[slot];
+        }
+    }
+
+    path_ticket_t ticket = NULL_PATH_TICKET;
+    if(num_srcs > 0) {
+
+        dest_id_t id;
+        ticket = M_NavRequestPathsAsync(s_map, num_srcs, srcs, rec->target_xz, rec->layer, &id);
+        if(ticket != NULL_PATH_TICKET) {
+            new_flock.dest_id = id;
+            kv_push(path_ticket_t, new_flock.tickets, ticket);
+        }
+    }
+
+    struct entity *curr;
+    kh_foreach_value(new_flock.ents, curr, {
+
+        int slot = slot_get(curr->uid);
+        if(s_move.state[slot] != STATE_ARRIVED) {
+            if(ticket != NULL_PATH_TICKET) {
+                s_move.state[slot] = STATE_WAITING;
+                s_move.ticket[slot] = ticket;
+            }else{
+                entity_stop(slot);
             }
+        }
+        s_move.avoidance[slot] = new_flock.avoidance;
+        ++new_flock.num_in_state[s_move.state[slot]];
+    });
 
-        });
+    if(kh_size(new_flock.ents) == 0) {
+        flock_destroy(&new_flock);
+        return;
     }
+    kv_push(struct flock, s_flocks, new_flock);
+    flock_index_members(kv_size(s_flocks) - 1);
 }
 
 /*****************************************************************************/
@@ -828,16 +2295,38 @@ static void on_30hz_tick(void *user, void *event)
 bool G_Move_Init(const struct map *map)
 {
     assert(map);
-    if(NULL == (s_entity_state_table = kh_init(state)))
+    if(NULL == (s_slot_table = kh_init(slot)))
         return false;
-    kv_init(s_move_markers);
+    if(NULL == (s_pathed_ents = kh_init(slot)))
+        goto fail_pathed;
+    memset(&s_move, 0, sizeof(s_move));
     kv_init(s_flocks);
+    kv_init(s_neighbours);
+    kv_init(s_steer_work);
+    kv_init(s_steer_neighbours);
+    kv_init(s_commit_xz);
+    kv_init(s_commit_height);
+    kv_init(s_orders);
+    if(!G_Spatial_Init())
+        goto fail_spatial;
+
     E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mousedown, NULL);
-    E_Global_Register(EVENT_RENDER_3D, on_render_3d, NULL);
     E_Global_Register(EVENT_30HZ_TICK, on_30hz_tick, NULL);
 
     s_map = map;
     return true;
+
+fail_spatial:
+    kv_destroy(s_orders);
+    kv_destroy(s_commit_height);
+    kv_destroy(s_commit_xz);
+    kv_destroy(s_steer_neighbours);
+    kv_destroy(s_steer_work);
+    kv_destroy(s_neighbours);
+    kh_destroy(slot, s_pathed_ents);
+fail_pathed:
+    kh_destroy(slot, s_slot_table);
+    return false;
 }
 
 void G_Move_Shutdown(void)
@@ -845,15 +2334,306 @@ void G_Move_Shutdown(void)
     s_map = NULL;
 
     E_Global_Unregister(EVENT_30HZ_TICK, on_30hz_tick);
-    E_Global_Unregister(EVENT_RENDER_3D, on_render_3d);
     E_Global_Unregister(SDL_MOUSEBUTTONDOWN, on_mousedown);
 
-    for(int i = 0; i < kv_size(s_move_markers); i++) {
-        E_Entity_Unregister(EVENT_ANIM_FINISHED, kv_A(s_move_markers, i)->uid, on_marker_anim_finish);
-        AL_EntityFree(kv_A(s_move_markers, i));
-    }
-    kv_destroy(s_move_markers);
+    for(int i = 0; i < kv_size(s_flocks); i++)
+        flock_destroy(&kv_A(s_flocks, i));
     kv_destroy(s_flocks);
-    kh_destroy(state, s_entity_state_table);
+    flock_pool_clear();
+
+    G_Spatial_Shutdown();
+    for(int i = 0; i < kv_size(s_orders); i++)
+        kv_destroy(kv_A(s_orders, i).uids);
+    kv_destroy(s_orders);
+    kv_destroy(s_commit_height);
+    kv_destroy(s_commit_xz);
+    for(int i = 0; i < kv_size(s_steer_neighbours); i++)
+        kv_destroy(kv_A(s_steer_neighbours, i));
+    kv_destroy(s_steer_neighbours);
+    kv_destroy(s_steer_work);
+    kv_destroy(s_neighbours);
+    movestate_destroy();
+    kh_destroy(slot, s_pathed_ents);
+    kh_destroy(slot, s_slot_table);
+}
+
+void G_Move_RemoveEntity(const struct entity *ent)
+{
+    if(!s_map)
+        return;
+
+    int slot = slot_get(ent->uid);
+    if(slot < 0)
+        return;
+
+    flock_remove_member(slot, ent->uid);
+    entity_unblock(slot);
+    slot_del(slot, ent->uid);
+}
+
+void G_Move_SetAvoidance(enum move_avoidance mode)
+{
+    assert(mode >= 0 && mode < MOVE_AVOID_MAX);
+    s_avoidance = mode;
+}
+
+void G_Move_SetWaypointGroup(int max_size)
+{
+    s_waypoint_group = MAX(max_size, 0);
+}
+
+void G_Move_GetAvoidanceStats(enum move_avoidance mode, struct move_avoid_stats *out)
+{
+    assert(mode >= 0 && mode < MOVE_AVOID_MAX);
+
+    SDL_AtomicLock(&s_stats_lock);
+    *out = s_stats[mode];
+    uint64_t ticks = s_steer_ticks[mode];
+    SDL_AtomicUnlock(&s_stats_lock);
+
+    /* Split the conversion to not overflow on long running sessions */
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    out->steer_us = (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+void G_Move_SetDeterministic(bool on)
+{
+    s_deterministic = on;
+    M_NavSetDeterministic(on);
+}
+
+bool G_Move_Order(const pentity_kvec_t *ents, vec2_t target_xz, uint32_t tick)
+{
+    struct move_order order = (struct move_order){
+        .tick = tick,
+        .target_xz = target_xz,
+        .avoidance = s_avoidance,
+    };
+    if(kv_size(*ents) == 0)
+        return true;
+
+    kv_init(order.uids);
+    if(!kv_resize(uint32_t, order.uids, kv_size(*ents)))
+        return false;
+
+    for(int i = 0; i < kv_size(*ents); i++)
+        kv_push(uint32_t, order.uids, kv_A(*ents, i)->uid);
+
+    kv_push(struct move_order, s_orders, order);
+    return true;
+}
+
+bool G_Move_SaveState(SDL_RWops *out)
+{
+    uint32_t tick = s_tick_count;
+    if(!AL_WriteBytes(out, &tick, sizeof(tick))
+    || !AL_WriteBytes(out, &s_checksum, sizeof(s_checksum)))
+        return false;
+
+    uint32_t uid;
+    uint32_t slot;
+    uint32_t num_slots = 0;
+    kh_foreach(s_slot_table, uid, slot, {
+        if(live_slot_get(uid) >= 0)
+            ++num_slots;
+    });
+    if(!AL_WriteBytes(out, &num_slots, sizeof(num_slots)))
+        return false;
+
+    kh_foreach(s_slot_table, uid, slot, {
+
+        if(live_slot_get(uid) < 0)
+            continue;
+
+        struct slot_rec rec = (struct slot_rec){
+            .uid              = uid,
+            .state            = s_move.state[slot],
+            .velocity         = s_move.velocity[slot],
+            .avoid_force      = s_move.avoid_force[slot],
+            .avoid_ticks_left = s_move.avoid_ticks_left[slot],
+            .blocking         = s_move.blocking[slot],
+        };
+        if(!AL_WriteBytes(out, &rec, sizeof(rec)))
+            return false;
+    });
+
+    uint32_t num_flocks = kv_size(s_flocks);
+    if(!AL_WriteBytes(out, &num_flocks, sizeof(num_flocks)))
+        return false;
+
+    for(int i = 0; i < kv_size(s_flocks); i++) {
+
+        const struct flock *flock = &kv_A(s_flocks, i);
+        struct flock_rec rec = (struct flock_rec){
+            .target_xz   = flock->target_xz,
+            .layer       = flock->layer,
+            .avoidance   = flock->avoidance,
+            .start_tick  = flock->start_tick,
+            .num_members = live_members(flock),
+        };
+        if(!AL_WriteBytes(out, &rec, sizeof(rec))
+        || !write_uids(out, flock->ents, rec.num_members))
+            return false;
+    }
+
+    uint32_t num_orders = kv_size(s_orders);
+    if(!AL_WriteBytes(out, &num_orders, sizeof(num_orders)))
+        return false;
+
+    for(int i = 0; i < kv_size(s_orders); i++) {
+
+        const struct move_order *order = &kv_A(s_orders, i);
+        struct order_rec rec = (struct order_rec){
+            .tick      = order->tick,
+            .target_xz = order->target_xz,
+            .avoidance = order->avoidance,
+            .num_uids  = kv_size(order->uids),
+        };
+        if(!AL_WriteBytes(out, &rec, sizeof(rec))
+        || !AL_WriteBytes(out, order->uids.a, rec.num_uids * sizeof(uint32_t)))
+            return false;
+    }
+    return true;
+}
+
+bool G_Move_LoadState(SDL_RWops *in)
+{
+    bool ret = false;
+    uint32_t tick, checksum, num_slots, num_flocks, num_orders;
+    struct slot_rec *slots = NULL;
+    struct flock_rec *flocks = NULL;
+    struct order_rec *orders = NULL;
+    kvec_t(uint32_t) uids;
+    kv_init(uids);
+
+    /* Everything is read in before any of the state is touched, so that a 
+     * damaged snapshot leaves the movement as it was */
+    if(!AL_ReadBytes(in, &tick, sizeof(tick))
+    || !AL_ReadBytes(in, &checksum, sizeof(checksum))
+    || !AL_ReadBytes(in, &num_slots, sizeof(num_slots))
+    || num_slots > Entity_PoolCapacity())
+        goto out;
+
+    if(!(slots = malloc(num_slots * sizeof(*slots) + 1))
+    || !AL_ReadBytes(in, slots, num_slots * sizeof(*slots)))
+        goto out;
+
+    if(!AL_ReadBytes(in, &num_flocks, sizeof(num_flocks)) 
+    || num_flocks > num_slots)
+        goto out;
+
+    if(!(flocks = malloc(num_flocks * sizeof(*flocks) + 1)))
+        goto out;
+
+    for(int i = 0; i < num_flocks; i++) {
+
+        if(!AL_ReadBytes(in, &flocks[i], sizeof(flocks[i]))
+        || flocks[i].num_members > num_slots
+        || flocks[i].layer >= NAV_LAYER_MAX
+        || flocks[i].avoidance >= MOVE_AVOID_MAX
+        || !kv_resize(uint32_t, uids, kv_size(uids) + flocks[i].num_members + 1)
+        || !AL_ReadBytes(in, uids.a + kv_size(uids), flocks[i].num_members * sizeof(uint32_t)))
+            goto out;
+        kv_size(uids) += flocks[i].num_members;
+    }
+
+    if(!AL_ReadBytes(in, &num_orders, sizeof(num_orders))
+    || !(orders = malloc(num_orders * sizeof(*orders) + 1)))
+        goto out;
+
+    size_t orders_begin = kv_size(uids);
+    for(int i = 0; i < num_orders; i++) {
+
+        if(!AL_ReadBytes(in, &orders[i], sizeof(orders[i]))
+        || orders[i].avoidance >= MOVE_AVOID_MAX
+        || orders[i].num_uids > Entity_PoolCapacity()
+        || !kv_resize(uint32_t, uids, kv_size(uids) + orders[i].num_uids + 1)
+        || !AL_ReadBytes(in, uids.a + kv_size(uids), orders[i].num_uids * sizeof(uint32_t)))
+            goto out;
+        kv_size(uids) += orders[i].num_uids;
+    }
+
+    for(int i = 0; i < num_slots; i++) {
+        if(slots[i].state >= NUM_ARRIVAL_STATES)
+            goto out;
+    }
+
+    movestate_clear();
+    s_tick_count = tick;
+    s_checksum = checksum;
+
+    for(int i = 0; i < num_slots; i++) {
+
+        struct entity *ent = Entity_FromUID(slots[i].uid);
+        if(!ent)
+            continue;
+
+        int slot = slot_get(ent->uid);
+        if(slot < 0 && (slot = slot_add(ent)) < 0)
+            continue;
+
+        s_move.ent[slot] = ent;
+        slot_gather(slot);
+        s_move.state[slot] = slots[i].state;
+        s_move.velocity[slot] = slots[i].velocity;
+        s_move.avoid_force[slot] = slots[i].avoid_force;
+        s_move.avoid_ticks_left[slot] = slots[i].avoid_ticks_left;
+        if(slots[i].blocking)
+            entity_block(slot);
+    }
+
+    /* The entities left out of the flocks can't be on their way anywhere */
+    const uint32_t *curr_uids = uids.a;
+    for(int i = 0; i < num_flocks; i++) {
+        flock_restore(&flocks[i], curr_uids);
+        curr_uids += flocks[i].num_members;
+    }
+
+    for(int slot = 0; slot < s_move.size; slot++) {
+        if(s_move.flock[slot] < 0 && s_move.state[slot] != STATE_ARRIVED)
+            entity_stop(slot);
+    }
+
+    curr_uids = uids.a + orders_begin;
+    for(int i = 0; i < num_orders; i++) {
+
+        struct move_order order = (struct move_order){
+            .tick = orders[i].tick,
+            .target_xz = orders[i].target_xz,
+            .avoidance = orders[i].avoidance,
+        };
+        kv_init(order.uids);
+        if(kv_resize(uint32_t, order.uids, orders[i].num_uids + 1)) {
+            memcpy(order.uids.a, curr_uids, orders[i].num_uids * sizeof(uint32_t));
+            kv_size(order.uids) = orders[i].num_uids;
+            kv_push(struct move_order, s_orders, order);
+        }
+        curr_uids += orders[i].num_uids;
+    }
+
+    G_Spatial_Invalidate();
+    ret = true;
+
+out:
+    kv_destroy(uids);
+    free(orders);
+    free(flocks);
+    free(slots);
+    return ret;
+}
+
+size_t G_Move_NumFlocks(void)
+{
+    return kv_size(s_flocks);
+}
+
+uint32_t G_Move_Tick(void)
+{
+    return s_tick_count;
+}
+
+uint32_t G_Move_Checksum(void)
+{
+    return s_checksum;
 }
 
@@ -37,11 +37,25 @@
 #define MOVEMENT_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <SDL.h>
 
 struct map;
+struct entity;
 
-bool G_Move_Init(const struct map *map);
-void G_Move_Shutdown(void);
+bool   G_Move_Init(const struct map *map);
+void   G_Move_Shutdown(void);
+size_t G_Move_NumFlocks(void);
+/* Drops the entity from its' flock and gives back its' movement slot */
+void   G_Move_RemoveEntity(const struct entity *ent);
+
+/* The movement state of the live entities, their flocks and the orders not
+ * yet carried out, for game snapshots. Loading the state drops all of the 
+ * current flocks and orders. Members of a flock which were on their way 
+ * request their paths again and carry on once they are found. The entities
+ * must have been put back where they were beforehand. */
+bool G_Move_SaveState(SDL_RWops *out);
+bool G_Move_LoadState(SDL_RWops *in);
 
 #endif
 
@@ -0,0 +1,133 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "overlay.h"
+#include "../render/public/render.h"
+#include "../entity.h"
+#include "../perf.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi)    (MAX(MIN((a), (hi)), (lo)))
+
+KHASH_MAP_INIT_INT(overlay, struct unit_overlay)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static khash_t(overlay)           *s_overlays;
+/* Rebuilt every frame */
+static kvec_t(struct overlay_bar)  s_bars;
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Overlay_Init(void)
+{
+    s_overlays = kh_init(overlay);
+    if(!s_overlays)
+        return false;
+
+    kv_init(s_bars);
+    return true;
+}
+
+void G_Overlay_Shutdown(void)
+{
+    kh_destroy(overlay, s_overlays);
+    kv_destroy(s_bars);
+}
+
+void G_Overlay_Reset(void)
+{
+    kh_clear(overlay, s_overlays);
+}
+
+void G_Overlay_Render(const pentity_kvec_t *visible, float frac)
+{
+    if(!kh_size(s_overlays))
+        return;
+
+    PERF_ENTER();
+    kv_reset(s_bars);
+
+    for(int i = 0; i < kv_size(*visible); i++) {
+
+        const struct entity *curr = kv_A(*visible, i);
+        khiter_t k = kh_get(overlay, s_overlays, curr->uid);
+        if(k == kh_end(s_overlays))
+            continue;
+
+        const struct unit_overlay *ov = &kh_value(s_overlays, k);
+        vec3_t pos = Entity_InterpolatedPos(curr, frac);
+        pos.y += (ov->height >= 0.0f) ? ov->height : curr->identity_aabb.y_max * curr->scale.y;
+
+        kv_push(struct overlay_bar, s_bars, ((struct overlay_bar){
+            .pos = pos,
+            .fill = CLAMP(ov->fill, 0.0f, 1.0f),
+            .fg_color = ov->fg_color,
+            .bg_color = ov->bg_color,
+            .size = ov->size
+        }));
+    }
+
+    R_GL_DrawOverlays(s_bars.a, kv_size(s_bars));
+    PERF_RETURN();
+}
+
+bool G_Overlay_Set(const struct entity *ent, const struct unit_overlay *overlay)
+{
+    int status;
+    khiter_t k = kh_put(overlay, s_overlays, ent->uid, &status);
+    if(status == -1)
+        return false;
+
+    kh_value(s_overlays, k) = *overlay;
+    return true;
+}
+
+void G_Overlay_Remove(const struct entity *ent)
+{
+    khiter_t k = kh_get(overlay, s_overlays, ent->uid);
+    if(k != kh_end(s_overlays))
+        kh_del(overlay, s_overlays, k);
+}
+
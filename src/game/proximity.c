@@ -0,0 +1,400 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+#include "proximity.h"
+#include "game_private.h"
+#include "spatial.h"
+#include "../entity.h"
+#include "../event.h"
+#include "../perf.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+
+/* The moved entities are noted down in cells of this size, which is the 
+ * same as the cells of the spatial grid */
+#define CELL_SIZE           (16.0f)
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+typedef kvec_t(uint32_t) uid_kvec_t;
+
+struct prox_trigger{
+    uint32_t   uid;
+    float      radius;
+    uint32_t   filter;
+    /* The owner's position when the trigger was last tested */
+    float      x, z;
+    /* Forces the trigger to be tested at the next tick */
+    bool       stale;
+    /* The entities within range as of the last test, sorted by UID */
+    uid_kvec_t inside;
+};
+
+/* The position of each dynamic entity as of the last tick, indexed by the 
+ * entity's pool index */
+struct tracked_pos{
+    uint32_t   uid;
+    bool       valid;
+    float      x, z;
+};
+
+KHASH_MAP_INIT_INT(prox_trig, int)
+KHASH_SET_INIT_INT64(cell)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                         s_inited;
+static kvec_t(struct prox_trigger)  s_triggers;
+static khash_t(prox_trig)          *s_trigger_idx;
+
+static kvec_t(struct tracked_pos)   s_tracked;
+/* The cells that an entity moved into, out of or within since the last tick */
+static khash_t(cell)               *s_dirty;
+
+/* Scratch buffers for testing a trigger */
+static pentity_kvec_t               s_found;
+static uid_kvec_t                   s_now_inside;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int cell_coord(float x)
+{
+    return (int)floorf(x / CELL_SIZE);
+}
+
+static uint64_t cell_key(int r, int c)
+{
+    return ((uint64_t)(uint32_t)r << 32) | (uint32_t)c;
+}
+
+static void mark_dirty(float x, float z)
+{
+    int status;
+    kh_put(cell, s_dirty, cell_key(cell_coord(z), cell_coord(x)), &status);
+}
+
+static int compare_uids(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t*)a, ub = *(const uint32_t*)b;
+    return (ua > ub) - (ua < ub);
+}
+
+static void prox_del_trigger(int idx)
+{
+    struct prox_trigger *trig = &kv_A(s_triggers, idx);
+    khiter_t k = kh_get(prox_trig, s_trigger_idx, trig->uid);
+    assert(k != kh_end(s_trigger_idx));
+    kh_del(prox_trig, s_trigger_idx, k);
+    kv_destroy(trig->inside);
+
+    /* Swap the last trigger into the hole */
+    size_t last = kv_size(s_triggers) - 1;
+    if(idx != last) {
+        kv_A(s_triggers, idx) = kv_A(s_triggers, last);
+        k = kh_get(prox_trig, s_trigger_idx, kv_A(s_triggers, idx).uid);
+        assert(k != kh_end(s_trigger_idx));
+        kh_value(s_trigger_idx, k) = idx;
+    }
+    kv_size(s_triggers)--;
+}
+
+/* Notes down the cells of the entities which have moved, or have been added
+ * since the last tick */
+static bool prox_track_moves(void)
+{
+    size_t cap = Entity_PoolCapacity();
+    if(kv_size(s_tracked) < cap) {
+        size_t old = kv_size(s_tracked);
+        if(!kv_resize(struct tracked_pos, s_tracked, cap))
+            return false;
+        for(size_t i = old; i < cap; i++)
+            kv_A(s_tracked, i) = (struct tracked_pos){0};
+        kv_size(s_tracked) = cap;
+    }
+
+    const pentity_kvec_t *dynamic = G_GetDynamicEnts();
+    for(int i = 0; i < kv_size(*dynamic); i++) {
+
+        const struct entity *curr = kv_A(*dynamic, i);
+        struct tracked_pos *pos = &kv_A(s_tracked, Entity_PoolIndex(curr->uid));
+
+        if(pos->valid && pos->uid == curr->uid && pos->x == curr->pos.x && pos->z == curr->pos.z)
+            continue;
+
+        if(pos->valid)
+            mark_dirty(pos->x, pos->z);
+        mark_dirty(curr->pos.x, curr->pos.z);
+        *pos = (struct tracked_pos){curr->uid, true, curr->pos.x, curr->pos.z};
+    }
+    return true;
+}
+
+static bool prox_range_dirty(const struct prox_trigger *trig, float x, float z)
+{
+    if(kh_size(s_dirty) == 0)
+        return false;
+
+    int c0 = cell_coord(x - trig->radius), c1 = cell_coord(x + trig->radius);
+    int r0 = cell_coord(z - trig->radius), r1 = cell_coord(z + trig->radius);
+
+    /* Look up whichever there are fewer of: the cells in range, or the 
+     * dirty cells */
+    if((uint64_t)(c1 - c0 + 1) * (r1 - r0 + 1) <= kh_size(s_dirty)) {
+
+        for(int r = r0; r <= r1; r++) {
+            for(int c = c0; c <= c1; c++) {
+                if(kh_get(cell, s_dirty, cell_key(r, c)) != kh_end(s_dirty))
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    for(khiter_t k = kh_begin(s_dirty); k != kh_end(s_dirty); k++) {
+
+        if(!kh_exist(s_dirty, k))
+            continue;
+        uint64_t key = kh_key(s_dirty, k);
+        int r = (int32_t)(key >> 32), c = (int32_t)(key & 0xffffffff);
+        if(r >= r0 && r <= r1 && c >= c0 && c <= c1)
+            return true;
+    }
+    return false;
+}
+
+/* The events of a trigger are sent in the order of the other entities' 
+ * UIDs, so that they are the same from run to run */
+static void prox_test_trigger(struct prox_trigger *trig, const struct entity *owner)
+{
+    vec2_t center = (vec2_t){owner->pos.x, owner->pos.z};
+    G_Spatial_QueryCircle(center, trig->radius, &s_found);
+
+    kv_reset(s_now_inside);
+    for(int i = 0; i < kv_size(s_found); i++) {
+
+        const struct entity *curr = kv_A(s_found, i);
+        if(curr == owner || (curr->flags & trig->filter) != trig->filter)
+            continue;
+
+        float dx = curr->pos.x - center.x, dz = curr->pos.z - center.y;
+        if(dx * dx + dz * dz > trig->radius * trig->radius)
+            continue;
+        kv_push(uint32_t, s_now_inside, curr->uid);
+    }
+    qsort(s_now_inside.a, kv_size(s_now_inside), sizeof(uint32_t), compare_uids);
+
+    int i = 0, j = 0;
+    while(i < kv_size(trig->inside) || j < kv_size(s_now_inside)) {
+
+        uint32_t was = i < kv_size(trig->inside) ? kv_A(trig->inside, i) : UINT32_MAX;
+        uint32_t is = j < kv_size(s_now_inside) ? kv_A(s_now_inside, j) : UINT32_MAX;
+
+        if(was == is) {
+            i++, j++;
+        }else if(was < is) {
+            E_Entity_Notify(EVENT_LEAVE_RANGE, trig->uid, (void*)(uintptr_t)was, ES_ENGINE);
+            i++;
+        }else {
+            E_Entity_Notify(EVENT_ENTER_RANGE, trig->uid, (void*)(uintptr_t)is, ES_ENGINE);
+            j++;
+        }
+    }
+
+    kv_reset(trig->inside);
+    for(int k = 0; k < kv_size(s_now_inside); k++)
+        kv_push(uint32_t, trig->inside, kv_A(s_now_inside, k));
+
+    trig->x = owner->pos.x;
+    trig->z = owner->pos.z;
+    trig->stale = false;
+}
+
+/* Runs after the movement tick, which is registered for first */
+static void on_30hz_tick(void *user, void *event)
+{
+    if(kv_size(s_triggers) == 0)
+        return;
+
+    PERF_ENTER();
+
+    if(!prox_track_moves())
+        PERF_RETURN();
+    G_Spatial_Refresh(G_GetDynamicEnts());
+
+    for(int i = 0; i < kv_size(s_triggers);) {
+
+        struct prox_trigger *trig = &kv_A(s_triggers, i);
+        const struct entity *owner = Entity_FromUID(trig->uid);
+        if(!owner) {
+            prox_del_trigger(i);
+            continue;
+        }
+
+        if(trig->stale 
+        || owner->pos.x != trig->x || owner->pos.z != trig->z
+        || prox_range_dirty(trig, owner->pos.x, owner->pos.z)) {
+            prox_test_trigger(trig, owner);
+        }
+        i++;
+    }
+
+    kh_clear(cell, s_dirty);
+    PERF_RETURN();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Prox_Init(void)
+{
+    if(NULL == (s_trigger_idx = kh_init(prox_trig)))
+        goto fail_trigger_idx;
+    if(NULL == (s_dirty = kh_init(cell)))
+        goto fail_dirty;
+
+    kv_init(s_triggers);
+    kv_init(s_tracked);
+    kv_init(s_found);
+    kv_init(s_now_inside);
+
+    E_Global_Register(EVENT_30HZ_TICK, on_30hz_tick, NULL);
+    s_inited = true;
+    return true;
+
+fail_dirty:
+    kh_destroy(prox_trig, s_trigger_idx);
+fail_trigger_idx:
+    return false;
+}
+
+void G_Prox_Shutdown(void)
+{
+    if(!s_inited)
+        return;
+
+    E_Global_Unregister(EVENT_30HZ_TICK, on_30hz_tick);
+
+    for(int i = 0; i < kv_size(s_triggers); i++)
+        kv_destroy(kv_A(s_triggers, i).inside);
+    kv_destroy(s_triggers);
+    kv_destroy(s_tracked);
+    kv_destroy(s_found);
+    kv_destroy(s_now_inside);
+    kh_destroy(cell, s_dirty);
+    kh_destroy(prox_trig, s_trigger_idx);
+    s_inited = false;
+}
+
+void G_Prox_RemoveEntity(const struct entity *ent)
+{
+    if(!s_inited)
+        return;
+
+    khiter_t k = kh_get(prox_trig, s_trigger_idx, ent->uid);
+    if(k != kh_end(s_trigger_idx))
+        prox_del_trigger(kh_value(s_trigger_idx, k));
+
+    /* The entities in range of it find out that it has left on the next tick */
+    uint32_t idx = Entity_PoolIndex(ent->uid);
+    if(idx < kv_size(s_tracked) && kv_A(s_tracked, idx).valid && kv_A(s_tracked, idx).uid == ent->uid) {
+        mark_dirty(kv_A(s_tracked, idx).x, kv_A(s_tracked, idx).z);
+        kv_A(s_tracked, idx).valid = false;
+    }
+}
+
+bool G_Prox_SetTrigger(const struct entity *ent, float radius, uint32_t filter)
+{
+    if(!s_inited)
+        return false;
+
+    khiter_t k = kh_get(prox_trig, s_trigger_idx, ent->uid);
+    if(radius <= 0.0f) {
+        if(k != kh_end(s_trigger_idx))
+            prox_del_trigger(kh_value(s_trigger_idx, k));
+        return true;
+    }
+
+    if(k != kh_end(s_trigger_idx)) {
+        struct prox_trigger *trig = &kv_A(s_triggers, kh_value(s_trigger_idx, k));
+        trig->radius = radius;
+        trig->filter = filter;
+        trig->stale = true;
+        return true;
+    }
+
+    int status;
+    k = kh_put(prox_trig, s_trigger_idx, ent->uid, &status);
+    if(status == -1)
+        return false;
+
+    struct prox_trigger trig = (struct prox_trigger){
+        .uid = ent->uid,
+        .radius = radius,
+        .filter = filter,
+        .stale = true,
+    };
+    kv_init(trig.inside);
+
+    kh_value(s_trigger_idx, k) = kv_size(s_triggers);
+    kv_push(struct prox_trigger, s_triggers, trig);
+    return true;
+}
+
+float G_Prox_GetTrigger(const struct entity *ent, uint32_t *out_filter)
+{
+    if(!s_inited)
+        return 0.0f;
+
+    khiter_t k = kh_get(prox_trig, s_trigger_idx, ent->uid);
+    if(k == kh_end(s_trigger_idx))
+        return 0.0f;
+
+    const struct prox_trigger *trig = &kv_A(s_triggers, kh_value(s_trigger_idx, k));
+    if(out_filter)
+        *out_filter = trig->filter;
+    return trig->radius;
+}
+
@@ -54,8 +54,19 @@ enum cam_mode{
 };
 
 typedef kvec_t(struct entity*) pentity_kvec_t;
+typedef bool (*entity_pred_t)(const struct entity *ent, void *arg);
 KHASH_DECLARE(entity, khint32_t, struct entity*)
 
+struct game_stats{
+    /* The entities taking part in the simulation, and those of them that 
+     * are not static */
+    size_t entities;
+    size_t dynamic;
+    /* The potentially visible set of the last frame */
+    size_t visible;
+    size_t flocks;
+};
+
 /*###########################################################################*/
 /* GAME GENERAL                                                              */
 /*###########################################################################*/
@@ -66,17 +77,106 @@ bool G_NewGameWithMapString(const char *mapstr);
 void G_Shutdown(void);
 
 void G_Update(void);
-void G_Render(void);
+/* 'step_frac' is the fraction of a simulation step which has elapsed since 
+ * the last one was taken, used for interpolating the entities' motion. */
+void G_Render(float step_frac);
 
 void G_SetMapRenderMode(enum chunk_render_mode mode);
 void G_SetMinimapPos(float x, float y);
+/* Times per second that the unit blips on the minimap are refreshed, or 0 
+ * to refresh them every frame */
+void G_SetMinimapUnitRate(int hz);
 bool G_MouseOverMinimap(void);
 bool G_MapHeightAtPoint(vec2_t xz, float *out_height);
+/* Writes the first point where the ray hits the map surface to 'out_pos'.
+ * Returns false if it misses. */
+bool G_MapRaycast(vec3_t origin, vec3_t dir, vec3_t *out_pos);
+/* Points outside the map bounds get a height of NAN */
+void G_MapHeightsAtPoints(const vec2_t *xz, float *out_heights, size_t n);
+/* The tiles of a chunk of the current map, or NULL if there is no such chunk */
+const struct tile *G_MapChunkTiles(int chunk_r, int chunk_c);
+/* The current map's heightfield, with the map's size in tiles written to 
+ * 'out_rows' and 'out_cols'. NULL if the map has none. */
+const struct tile_heights *G_MapHeightfield(int *out_rows, int *out_cols);
+/* Changes whenever the current map is freed, so that pointers into the map 
+ * can be told apart from ones into its' replacement */
+uint32_t G_MapGeneration(void);
+/* Chunk streaming counters of the current map. Returns false if there is no map. */
+bool     G_MapStreamStats(struct map_stream_stats *out);
+bool     G_MapResolution(struct map_resolution *out);
+/* Recording, undoing and redoing of tile edits - see 'M_EditBegin'. All of
+ * them return false when there is no map. */
+bool     G_MapEditBegin(void);
+bool     G_MapEditEnd(void);
+bool     G_MapEditUndo(size_t *out_num_chunks, size_t out_chunks[]);
+bool     G_MapEditRedo(size_t *out_num_chunks, size_t out_chunks[]);
+bool     G_MapEditClear(void);
+bool     G_MapEditStats(struct map_edit_stats *out);
+void     G_GetStats(struct game_stats *out);
+/* Batched navigation queries for units of the given selection radius. Points
+ * outside of the map are never pathable. Path costs are INFINITY when there 
+ * is no path, and 'out_pos[i]' is only written for the rays that hit. */
+void G_NavPathsExist(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                     float radius, bool out[]);
+void G_NavPathCosts(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                    float radius, float out[]);
+void G_NavPositionsPathable(size_t n, const vec2_t xz_positions[], float radius, bool out[]);
+void G_NavRaycasts(size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                   float radius, bool out_hit[], vec2_t out_pos[]);
 
 void G_MakeStaticObjsImpassable(void);
 
+/* Skip animating and drawing the entities hidden behind the terrain. The 
+ * occlusion test results lag behind by a frame. */
+void G_SetOcclusionCulling(bool on);
+
+/* Hand the culling and drawing of the static entities over to the GPU, which
+ * spares the CPU any per-entity work for them. They are then only tested 
+ * against the terrain when occlusion culling is on as well. Returns false if
+ * the hardware doesn't support it. */
+bool G_SetGPUCulling(bool on);
+
+/* Draw the depth of the terrain ahead of shading it. This trades a cheap 
+ * extra pass over the terrain's vertices for shading each of its' pixels 
+ * only once, which pays off when the hills hide much of the terrain. */
+void G_SetDepthPrepass(bool on);
+
+/* Draw the batched terrain from a texture of the tiles' heights and materials,
+ * expanded into triangles by the vertex shader. The batch then needs no copy
+ * of the chunks' meshes in video memory. */
+void G_SetHeightfieldTerrain(bool on);
+
+/* Pose the animated entities further than 'dist' from the camera from their
+ * clips baked into the renderer, which takes no copying of their matrices. 
+ * The selected entities and the clips played once are always posed as usual.
+ * 0 turns it off. */
+void G_SetCrowdAnimDistance(float dist);
+
+/* Evaluate the poses of the animated entities further than 'dist' from the 
+ * camera only 'hz' times a second. The selected entities are always updated
+ * every frame. 0 for either turns it off. */
+void G_SetAnimLOD(float dist, int hz);
+
+/* The share of the screen's height that the static meshes cover is multiplied
+ * by 'bias' for picking their levels of detail - lower values switch to the
+ * coarser ones sooner. Meshes covering less than 'impostor_size' of it are 
+ * drawn as billboards. 0 for 'impostor_size' turns the billboards off. */
+void G_SetMeshLOD(float bias, float impostor_size);
+
 bool G_AddEntity(struct entity *ent);
 bool G_RemoveEntity(struct entity *ent);
+/* Must be called when an entity is placed, rotated or scaled from outside of 
+ * the simulation, so that the visibility index picks up its' new bounds. */
+void G_UpdateEntityBounds(struct entity *ent);
+
+/* Neighbourhood queries over the dynamic entities, answered from the movement 
+ * spatial grid. Entities are tested by their position alone. 'out' is reset 
+ * before the query. */
+size_t         G_EntitiesInCircle(vec2_t xz_center, float radius, pentity_kvec_t *out);
+size_t         G_EntitiesInRect(vec2_t xz_min, vec2_t xz_max, pentity_kvec_t *out);
+struct entity *G_NearestEntity(vec2_t xz_point, float max_dist, entity_pred_t pred, void *arg);
+/* Every entity that has been added to the game, in no particular order */
+const pentity_kvec_t *G_ActiveEntities(void);
 
 bool G_ActivateCamera(int idx, enum cam_mode mode);
 void G_MoveActiveCamera(vec2_t xz_ground_pos);
@@ -84,6 +184,138 @@ void G_MoveActiveCamera(vec2_t xz_ground_pos);
 bool G_UpdateMinimapChunk(int chunk_r, int chunk_c);
 bool G_UpdateChunkMats(int chunk_r, int chunk_c, const char *mats_string);
 bool G_UpdateTile(const struct tile_desc *desc, const struct tile *tile);
+bool G_UpdateTiles(size_t num_tiles, const struct tile_desc descs[], const struct tile tiles[]);
+bool G_UpdateTileRegion(const struct tile_desc *origin, int rows, int cols, 
+                        size_t num_tiles, const struct tile tiles[]);
+bool G_SaveMap(const char *path);
+
+/*###########################################################################*/
+/* GAME MOVEMENT                                                             */
+/*###########################################################################*/
+
+enum move_avoidance{
+    /* Steer around other entities with a weighted mix of separation and 
+     * look-ahead collision avoidance forces */
+    MOVE_AVOID_FORCES,
+    /* Pick the velocity closest to the preferred one which is collision-free 
+     * over a short time horizon (Optimal Reciprocal Collision Avoidance) */
+    MOVE_AVOID_ORCA,
+    MOVE_AVOID_MAX
+};
+
+/* Totals for the flocks using one of the avoidance modes, since startup */
+struct move_avoid_stats{
+    /* Flocks of which all the members have arrived, and the total time from 
+     * the move order to the last member coming to a stop */
+    uint64_t flocks_arrived;
+    uint64_t arrival_ms;
+    /* Steering updates of individual entities, and the total time spent */
+    uint64_t steer_updates;
+    uint64_t steer_us;
+};
+
+/* The avoidance mode used by the flocks made from subsequent move orders. 
+ * Flocks which are already moving keep their mode. */
+void                  G_Move_SetAvoidance(enum move_avoidance mode);
+void                  G_Move_GetAvoidanceStats(enum move_avoidance mode, struct move_avoid_stats *out);
+/* Move orders for up to 'max_size' entities (of a single size) have every 
+ * entity follow a waypoint path of its' own instead of building the flow 
+ * fields for the group. 0 always uses the flow fields. */
+void                  G_Move_SetWaypointGroup(int max_size);
+
+/* In deterministic mode, the movement of the entities depends only on the 
+ * state of the simulation and the move orders given, so that peers running 
+ * the same orders in lockstep stay in sync. The level of detail based on 
+ * the camera is turned off and path requests are waited on. Right-click 
+ * move orders are scheduled through 'G_Move_Order' for the next tick. */
+void                  G_Move_SetDeterministic(bool on);
+/* Schedule a move order to be carried out at the start of movement tick 
+ * number 'tick', or of the next tick if it has already been run. Orders for
+ * the same tick are carried out in the order they were given. */
+bool                  G_Move_Order(const pentity_kvec_t *ents, vec2_t target_xz, uint32_t tick);
+/* The number of movement ticks run so far */
+uint32_t              G_Move_Tick(void);
+/* A hash of the movement state at the end of the last tick, for checking 
+ * that peers are in sync. Only kept up to date in deterministic mode. */
+uint32_t              G_Move_Checksum(void);
+
+/*###########################################################################*/
+/* GAME FOG OF WAR                                                           */
+/*###########################################################################*/
+
+/* The map is covered by a grid of tiles that are either unexplored, explored
+ * or currently seen by one of the vision sources. Other entities are only 
+ * drawn on the tiles being seen, and static ones on any explored tile. The 
+ * fog is turned off whenever a new map is loaded. */
+bool                  G_Fog_Enable(void);
+void                  G_Fog_Disable(void);
+bool                  G_Fog_Enabled(void);
+/* When on, tiles are only seen if the terrain doesn't rise above the line 
+ * of sight to them. The heights are sampled when the test is turned on. */
+bool                  G_Fog_SetHeightLOS(bool on);
+/* Make the entity see the tiles within 'radius', or stop it seeing anything
+ * with a radius of 0. The vision follows the entity as it moves. */
+bool                  G_Fog_SetVision(const struct entity *ent, float radius);
+float                 G_Fog_GetVision(const struct entity *ent);
+/* Both are true everywhere while the fog is off */
+bool                  G_Fog_Visible(vec2_t xz);
+bool                  G_Fog_Explored(vec2_t xz);
+
+/*###########################################################################*/
+/* GAME PROXIMITY TRIGGERS                                                   */
+/*###########################################################################*/
+
+/* The owner of a trigger is sent an EVENT_ENTER_RANGE when a dynamic entity
+ * with all of the 'filter' flags comes within 'radius' of it, and an 
+ * EVENT_LEAVE_RANGE when one goes out of range again. The ranges are checked
+ * at the end of every movement tick. An entity has at most one trigger, and
+ * a radius of 0 removes it. The triggers are forgotten when a new map is 
+ * loaded. */
+bool                  G_Prox_SetTrigger(const struct entity *ent, float radius, uint32_t filter);
+/* Returns 0 if the entity has no trigger */
+float                 G_Prox_GetTrigger(const struct entity *ent, uint32_t *out_filter);
+
+/*###########################################################################*/
+/* GAME SHADOWS                                                              */
+/*###########################################################################*/
+
+/* The terrain and the entities cast shadows from the light over the whole 
+ * map. The shadows of the static entities and of the terrain are cached and
+ * only drawn again where they change. Turned off when a new map is loaded. */
+bool                  G_Shadows_Enable(void);
+void                  G_Shadows_Disable(void);
+bool                  G_Shadows_Enabled(void);
+
+/*###########################################################################*/
+/* GAME UNIT OVERLAYS                                                        */
+/*###########################################################################*/
+
+/* A bar drawn over the entity whenever the entity itself is drawn, such as a
+ * health bar. The part up to 'fill' (0 to 1) is in 'fg_color' and the rest 
+ * in 'bg_color'. 'size' is in pixels. The bar is 'height' above the entity's
+ * position, or at the top of its bounds if 'height' is negative. */
+struct unit_overlay{
+    float  fill;
+    vec4_t fg_color;
+    vec4_t bg_color;
+    vec2_t size;
+    float  height;
+};
+
+/* Replaces the entity's overlay, if it already has one */
+bool                  G_Overlay_Set(const struct entity *ent, const struct unit_overlay *overlay);
+void                  G_Overlay_Remove(const struct entity *ent);
+
+/*###########################################################################*/
+/* GAME LIGHTS                                                               */
+/*###########################################################################*/
+
+/* Adds a point light, which lights everything within 'radius' of 'pos'. 
+ * Returns an ID for the light, or -1 on failure. */
+int                   G_Lights_Add(vec3_t pos, vec3_t color, float radius);
+/* Both return false if there is no light with the ID */
+bool                  G_Lights_Remove(int id);
+bool                  G_Lights_SetPos(int id, vec3_t pos);
 
 /*###########################################################################*/
 /* GAME SELECTION                                                            */
@@ -96,6 +328,76 @@ void                  G_Sel_Clear(void);
 void                  G_Sel_Add(struct entity *ent);
 void                  G_Sel_Remove(struct entity *ent);
 const pentity_kvec_t *G_Sel_Get(void);
+/* The closest selectable entity under the mouse cursor, or NULL. This is 
+ * picked once per frame, when the set of visible entities is rebuilt. */
+struct entity        *G_Sel_EntityUnderCursor(void);
+/* Pick the entities from their IDs, drawn into a small target around the 
+ * cursor or the selection box and read back a frame later, falling back to 
+ * testing their bounding boxes when the IDs don't cover the spot */
+void                  G_Sel_SetGPUPicking(bool on);
+
+/*###########################################################################*/
+/* GAME TIMERS                                                               */
+/*###########################################################################*/
+
+typedef void (*timer_fn_t)(void *arg);
+
+/* Calls 'fn' from the first 60Hz simulation step at least 'seconds' from now, 
+ * and no earlier than the next step. Timers due on the same step are called in
+ * the order they were added. Returns an ID for cancelling the timer, or 0 on 
+ * failure. Pending timers cost nothing until they are due. */
+uint32_t              G_Timer_After(float seconds, timer_fn_t fn, void *arg);
+/* Returns false if the timer has already fired or been cancelled */
+bool                  G_Timer_Cancel(uint32_t id);
+
+/*###########################################################################*/
+/* GAME SCATTER                                                              */
+/*###########################################################################*/
+
+enum scatter_tiles{
+    SCATTER_TILES_ANY,
+    SCATTER_TILES_PATHABLE,
+    SCATTER_TILES_UNPATHABLE,
+};
+
+struct scatter_desc{
+    /* The XZ rectangle to place the props in, clipped to the map bounds */
+    vec2_t             xz_min, xz_max;
+    /* Expected number of props per tile, before the candidate positions 
+     * are thinned out by the other constraints */
+    float              density;
+    uint32_t           seed;
+    enum scatter_tiles tiles;
+    /* No two of the props are placed closer than this, or 0 */
+    float              min_spacing;
+    float              min_scale, max_scale;
+    bool               random_yaw;
+    /* Cut the props out of the navigation data */
+    bool               collision;
+};
+
+/* Places static props of the PFOBJ model (a path relative to the base path, 
+ * as in scenes) over the map surface, without making a script object for 
+ * each. The same seed always gives the same placement. The props are owned 
+ * by the game and freed with the map. Returns false if the model could not 
+ * be loaded, in which case 'out_placed' holds the number of props placed 
+ * before failing. */
+bool                  G_Scatter_Static(const char *pfobj_path, const struct scatter_desc *desc, 
+                                       size_t *out_placed);
+
+/*###########################################################################*/
+/* GAME SNAPSHOTS                                                            */
+/*###########################################################################*/
+
+/* Quick-save of the running game: the placement, animation and movement of 
+ * the entities in the game, the selection, the camera and the tiles changed 
+ * since the map was loaded. Loading puts the entities which are still alive 
+ * back in place by UID, and takes the ones added since out of the game; it
+ * does not bring back entities which have since been freed. A snapshot can 
+ * only be loaded by the same build, over the same map. Files which don't 
+ * match are turned down without changing anything. */
+bool                  G_Snapshot_Save(const char *path);
+bool                  G_Snapshot_Load(const char *path);
 
 #endif
 
@@ -0,0 +1,269 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/game.h"
+#include "game_private.h"
+#include "../entity.h"
+#include "../asset_load.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define TILE_AREA           ((float)(X_COORDS_PER_TILE * Z_COORDS_PER_TILE))
+
+/* The cells are small enough for a cell to hold no more than one point */
+KHASH_MAP_INIT_INT64(cell, vec2_t)
+
+typedef kvec_t(vec2_t) vec2_kvec_t;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* xorshift32 - the placement only depends on the seed */
+static uint32_t scatter_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (*state = x);
+}
+
+static float scatter_randf(uint32_t *state)
+{
+    return (scatter_rand(state) >> 8) / (float)(1 << 24);
+}
+
+static uint64_t scatter_cell_key(int cx, int cz)
+{
+    return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz;
+}
+
+static bool scatter_spaced(khash_t(cell) *cells, float cell_size, float spacing, vec2_t xz)
+{
+    int cx = floor(xz.x / cell_size);
+    int cz = floor(xz.y / cell_size);
+
+    for(int dx = -2; dx <= 2; dx++) {
+    for(int dz = -2; dz <= 2; dz++) {
+
+        khiter_t k = kh_get(cell, cells, scatter_cell_key(cx + dx, cz + dz));
+        if(k == kh_end(cells))
+            continue;
+
+        vec2_t other = kh_value(cells, k);
+        float ddx = other.x - xz.x, ddz = other.y - xz.y;
+        if(ddx * ddx + ddz * ddz < spacing * spacing)
+            return false;
+    }}
+    return true;
+}
+
+static bool scatter_tile_ok(const struct map *map, enum scatter_tiles tiles, vec2_t xz)
+{
+    switch(tiles) {
+    case SCATTER_TILES_PATHABLE:   return M_NavPositionPathable(map, NAV_LAYER_GROUND_1X1, xz);
+    case SCATTER_TILES_UNPATHABLE: return !M_NavPositionPathable(map, NAV_LAYER_GROUND_1X1, xz);
+    default:                       return true;
+    }
+}
+
+/* Picks the positions for the props, before any of them is created */
+static bool scatter_positions(const struct map *map, const struct scatter_desc *desc, 
+                              vec2_kvec_t *out)
+{
+    struct aabb bounds;
+    M_GetBounds(map, &bounds);
+
+    float x_min = MAX(desc->xz_min.x, bounds.x_min), x_max = MIN(desc->xz_max.x, bounds.x_max);
+    float z_min = MAX(desc->xz_min.y, bounds.z_min), z_max = MIN(desc->xz_max.y, bounds.z_max);
+    if(x_min >= x_max || z_min >= z_max)
+        return true;
+
+    uint32_t state = desc->seed ? desc->seed : 1;
+    float expected = desc->density * (x_max - x_min) * (z_max - z_min) / TILE_AREA;
+    size_t num_candidates = expected;
+    if(scatter_randf(&state) < expected - num_candidates)
+        num_candidates++;
+
+    khash_t(cell) *cells = NULL;
+    float cell_size = desc->min_spacing / sqrtf(2.0f);
+    if(desc->min_spacing > 0.0f && !(cells = kh_init(cell)))
+        return false;
+
+    for(size_t i = 0; i < num_candidates; i++) {
+
+        vec2_t xz = (vec2_t){
+            x_min + scatter_randf(&state) * (x_max - x_min),
+            z_min + scatter_randf(&state) * (z_max - z_min),
+        };
+        if(!M_PointInsideMap(map, xz) || !scatter_tile_ok(map, desc->tiles, xz))
+            continue;
+
+        if(cells) {
+            if(!scatter_spaced(cells, cell_size, desc->min_spacing, xz))
+                continue;
+
+            int ret;
+            khiter_t k = kh_put(cell, cells, 
+                scatter_cell_key(floor(xz.x / cell_size), floor(xz.y / cell_size)), &ret);
+            if(ret == -1) {
+                kh_destroy(cell, cells);
+                return false;
+            }
+            kh_value(cells, k) = xz;
+        }
+        kv_push(vec2_t, *out, xz);
+    }
+
+    if(cells)
+        kh_destroy(cell, cells);
+    return true;
+}
+
+/* The path is relative to the base path and also names the PFOBJ file, as 
+ * for the entities in scenes */
+static bool scatter_split_path(const char *path, char (*out_dir)[512], 
+                               const char **out_file, char (*out_name)[32])
+{
+    extern const char *g_basepath;
+
+    const char *slash = strrchr(path, '/');
+    if(!slash || slash == path)
+        return false;
+
+    size_t dir_len = slash - path;
+    if(strlen(g_basepath) + dir_len >= sizeof(*out_dir))
+        return false;
+
+    strcpy(*out_dir, g_basepath);
+    strncat(*out_dir, path, dir_len);
+    *out_file = slash + 1;
+
+    /* The props are named after their model */
+    size_t name_len = strcspn(*out_file, ".");
+    name_len = MIN(name_len, sizeof(*out_name) - 1);
+    memcpy(*out_name, *out_file, name_len);
+    (*out_name)[name_len] = '\0';
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Scatter_Static(const char *pfobj_path, const struct scatter_desc *desc, size_t *out_placed)
+{
+    const struct map *map = G_GetMap();
+    *out_placed = 0;
+
+    if(!map || desc->density < 0.0f || desc->min_scale > desc->max_scale)
+        return false;
+
+    char dir[512], name[32];
+    const char *file;
+    if(!scatter_split_path(pfobj_path, &dir, &file, &name))
+        return false;
+
+    bool ret = false;
+    vec2_kvec_t xz;
+    kv_init(xz);
+    float *heights = NULL;
+    struct obb *obbs = NULL;
+
+    if(!scatter_positions(map, desc, &xz))
+        goto out;
+
+    heights = malloc((kv_size(xz) + 1) * sizeof(float));
+    obbs = malloc((kv_size(xz) + 1) * sizeof(struct obb));
+    if(!heights || !obbs)
+        goto out;
+    M_HeightAtPoints(map, xz.a, heights, kv_size(xz));
+
+    /* Seeded apart from the positions, so that changing the scale or the 
+     * rotation doesn't move the props around */
+    uint32_t state = (desc->seed ^ 0x9e3779b9) ? (desc->seed ^ 0x9e3779b9) : 1;
+
+    for(int i = 0; i < kv_size(xz); i++) {
+
+        struct entity *ent = AL_EntityFromPFObj(dir, file, name);
+        if(!ent)
+            goto out;
+
+        float scale = desc->min_scale + scatter_randf(&state) * (desc->max_scale - desc->min_scale);
+        float yaw = desc->random_yaw ? scatter_randf(&state) * 2.0f * M_PI : 0.0f;
+
+        ent->flags |= ENTITY_FLAG_STATIC;
+        if(desc->collision)
+            ent->flags |= ENTITY_FLAG_COLLISION;
+        ent->pos = (vec3_t){kv_A(xz, i).x, heights[i], kv_A(xz, i).y};
+        ent->scale = (vec3_t){scale, scale, scale};
+        ent->rotation = (quat_t){0.0f, sinf(yaw / 2.0f), 0.0f, cosf(yaw / 2.0f)};
+        ent->prev_pos = ent->pos;
+        ent->prev_rotation = ent->rotation;
+        ent->transform_dirty = true;
+
+        /* The game owns the entity from here on, and frees it along with 
+         * the map */
+        G_AddEntity(ent);
+        ++*out_placed;
+
+        if(desc->collision)
+            Entity_CurrentOBB(ent, &obbs[*out_placed - 1]);
+    }
+    ret = true;
+
+out:
+    /* The props are cut out in one pass, and the portals updated once */
+    if(desc->collision && *out_placed) {
+        M_NavCutoutStaticObjects(map, *out_placed, obbs);
+        M_NavUpdatePortals(map);
+    }
+    free(obbs);
+    free(heights);
+    kv_destroy(xz);
+    return ret;
+}
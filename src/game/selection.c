@@ -43,8 +43,10 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 
 #include <SDL.h>
 
@@ -79,6 +81,27 @@ static struct selection_ctx{
 
 pentity_kvec_t s_selected;
 
+/* The selectable boxes of the runs which weren't skipped, packed for testing 
+ * in batches, along with the index of each box in the visible set */
+static struct obb_soa          s_soa;
+static kvec_t(int)             s_soa_idx;
+static kvec_t(uint32_t)        s_mask;
+static kvec_t(float)           s_t;
+
+/* The selectable entity under the cursor, picked once per frame when the 
+ * visible set is rebuilt. Hover queries and click selection at the same 
+ * spot share the result. */
+static struct{
+    vec2_t         coord;
+    struct entity *ent;
+}s_pick;
+
+/* When on, the entities are also picked from the IDs drawn around the cursor 
+ * or into the selection box in the last frame, and the boxes are only tested 
+ * when that doesn't cover the spot. */
+static bool                    s_gpu_picking;
+static kvec_t(uint32_t)        s_pick_ids;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -128,33 +151,12 @@ static void on_render(void *user, void *event)
     R_GL_DrawBox2D(s_ctx.mouse_down_coord, signed_size, (vec3_t){0.0f, 1.0f, 0.0f}, 2.0f);
 }
 
-static vec3_t sel_unproject_mouse_coords(struct camera *cam, vec2_t mouse_coords, float ndc_z)
-{
-    vec3_t ndc = (vec3_t){-1.0f + 2.0*(mouse_coords.raw[0]/CONFIG_RES_X),
-                           1.0f - 2.0*(mouse_coords.raw[1]/CONFIG_RES_Y),
-                           ndc_z};
-    vec4_t clip = (vec4_t){ndc.x, ndc.y, ndc.z, 1.0f};
-
-    mat4x4_t view_proj_inverse; 
-    mat4x4_t view, proj, tmp;
-
-    Camera_MakeViewMat(cam, &view);
-    Camera_MakeProjMat(cam, &proj);
-    PFM_Mat4x4_Mult4x4(&proj, &view, &tmp);
-    PFM_Mat4x4_Inverse(&tmp, &view_proj_inverse); 
-
-    vec4_t ret_homo;
-    PFM_Mat4x4_Mult4x1(&view_proj_inverse, &clip, &ret_homo);
-    return (vec3_t){ret_homo.x/ret_homo.w, ret_homo.y/ret_homo.w, ret_homo.z/ret_homo.w};
-}
-
 static void sel_make_frustum(struct camera *cam, vec2_t mouse_down, vec2_t mouse_up, struct frustum *out)
 {
-    struct frustum cam_frust;
-    Camera_MakeFrustum(cam, &cam_frust);
+    const struct frustum *cam_frust = &Camera_GetState(cam)->frustum;
 
-    out->near = cam_frust.near;
-    out->far = cam_frust.far;
+    out->near = cam_frust->near;
+    out->far = cam_frust->far;
 
     vec2_t corners[4] = {
         (vec2_t){MIN(mouse_down.x, mouse_up.x), MIN(mouse_down.y, mouse_up.y)},
@@ -163,15 +165,18 @@ static void sel_make_frustum(struct camera *cam, vec2_t mouse_down, vec2_t mouse
         (vec2_t){MAX(mouse_down.x, mouse_up.x), MAX(mouse_down.y, mouse_up.y)},
     };
 
-    out->ntl = sel_unproject_mouse_coords(cam, corners[0], -1.0f);
-    out->nbl = sel_unproject_mouse_coords(cam, corners[1], -1.0f);
-    out->ntr = sel_unproject_mouse_coords(cam, corners[2], -1.0f);
-    out->nbr = sel_unproject_mouse_coords(cam, corners[3], -1.0f);
+    mat4x4_t inv_view_proj;
+    Camera_MakeInvViewProjMat(cam, &inv_view_proj);
 
-    out->ftl = sel_unproject_mouse_coords(cam, corners[0], 1.0f);
-    out->fbl = sel_unproject_mouse_coords(cam, corners[1], 1.0f);
-    out->ftr = sel_unproject_mouse_coords(cam, corners[2], 1.0f);
-    out->fbr = sel_unproject_mouse_coords(cam, corners[3], 1.0f);
+    out->ntl = Camera_Unproject(&inv_view_proj, corners[0], -1.0f);
+    out->nbl = Camera_Unproject(&inv_view_proj, corners[1], -1.0f);
+    out->ntr = Camera_Unproject(&inv_view_proj, corners[2], -1.0f);
+    out->nbr = Camera_Unproject(&inv_view_proj, corners[3], -1.0f);
+
+    out->ftl = Camera_Unproject(&inv_view_proj, corners[0], 1.0f);
+    out->fbl = Camera_Unproject(&inv_view_proj, corners[1], 1.0f);
+    out->ftr = Camera_Unproject(&inv_view_proj, corners[2], 1.0f);
+    out->fbr = Camera_Unproject(&inv_view_proj, corners[3], 1.0f);
 
     vec3_t tl_dir, bl_dir, tr_dir, br_dir;
     PFM_Vec3_Sub(&out->ftl, &out->ntl, &tl_dir);
@@ -207,6 +212,158 @@ static void sel_make_frustum(struct camera *cam, vec2_t mouse_down, vec2_t mouse
     PFM_Vec3_Normal(&out->left.normal, &out->left.normal);
 }
 
+static bool sel_pack_range(const pentity_kvec_t *visible, const obb_kvec_t *visible_obbs,
+                           const struct vis_range *range)
+{
+    for(int i = range->begin; i < range->end; i++) {
+
+        if(!(kv_A(*visible, i)->flags & ENTITY_FLAG_SELECTABLE))
+            continue;
+
+        size_t idx = s_soa.size;
+        if(!C_OBBSoA_Resize(&s_soa, idx + 1))
+            return false;
+        C_OBBSoA_Set(&s_soa, idx, &kv_A(*visible_obbs, i));
+        kv_push(int, s_soa_idx, i);
+    }
+    return true;
+}
+
+/* Makes room for the results of testing the packed boxes */
+static void sel_reserve_results(void)
+{
+    if(kv_max(s_mask) < (s_soa.size + 31) / 32)
+        kv_resize(uint32_t, s_mask, (s_soa.size + 31) / 32);
+    if(kv_max(s_t) < s_soa.size)
+        kv_resize(float, s_t, s_soa.size);
+}
+
+static bool sel_packed_bit(size_t i)
+{
+    return s_mask.a[i / 32] & (1u << (i % 32));
+}
+
+static struct entity *sel_pick(struct camera *cam, vec2_t coord, const pentity_kvec_t *visible, 
+                                const obb_kvec_t *visible_obbs, const vis_range_kvec_t *visible_ranges)
+{
+    vec3_t ray_origin, ray_dir;
+    Camera_ScreenRay(cam, coord, &ray_origin, &ray_dir);
+
+    C_OBBSoA_Resize(&s_soa, 0);
+    kv_reset(s_soa_idx);
+
+    for(int r = 0; r < kv_size(*visible_ranges); r++) {
+
+        /* Skip the runs which the ray misses */
+        const struct vis_range *range = &kv_A(*visible_ranges, r);
+        float range_t;
+        if(range->bounded && !C_RayIntersectsAABB(ray_origin, ray_dir, range->bounds, &range_t))
+            continue;
+
+        if(!sel_pack_range(visible, visible_obbs, range))
+            return NULL;
+    }
+
+    if(!s_soa.size)
+        return NULL;
+
+    sel_reserve_results();
+    C_RayOBBsIntersect(ray_origin, ray_dir, &s_soa, s_t.a, s_mask.a);
+
+    float t_min = FLT_MAX;
+    int nearest = -1;
+    for(int i = 0; i < s_soa.size; i++) {
+
+        if(sel_packed_bit(i) && s_t.a[i] < t_min) {
+            t_min = s_t.a[i];
+            nearest = kv_A(s_soa_idx, i);
+        }
+    }
+
+    return (nearest >= 0) ? kv_A(*visible, nearest) : NULL;
+}
+
+/* The pixels covered by the box with the two corners, both included */
+static void sel_box_rect(vec2_t a, vec2_t b, vec2_t *out_corner, vec2_t *out_size)
+{
+    *out_corner = (vec2_t){MIN(a.x, b.x), MIN(a.y, b.y)};
+    *out_size = (vec2_t){fabsf(a.x - b.x) + 1.0f, fabsf(a.y - b.y) + 1.0f};
+}
+
+static struct entity *sel_gpu_entity(uint32_t id)
+{
+    if(id == PICK_NONE)
+        return NULL;
+
+    /* The entity may have gone since the IDs were drawn */
+    struct entity *ent = Entity_FromUID(id);
+    if(!ent || !(ent->flags & ENTITY_FLAG_SELECTABLE))
+        return NULL;
+    return ent;
+}
+
+/* Returns false if the pixel is outside of the picked rectangle */
+static bool sel_gpu_at(const struct pick_result *res, vec2_t coord, struct entity **out)
+{
+    float dx = coord.x - res->corner.x;
+    float dy = coord.y - res->corner.y;
+    if(dx < 0.0f || dy < 0.0f || dx >= res->size.x || dy >= res->size.y)
+        return false;
+
+    int col = dx * res->width / res->size.x;
+    int row = dy * res->height / res->size.y;
+    *out = sel_gpu_entity(res->ids[row * res->width + col]);
+    return true;
+}
+
+static int compare_uids(const void *a, const void *b)
+{
+    uint32_t uid_a = *(const uint32_t*)a;
+    uint32_t uid_b = *(const uint32_t*)b;
+    return (uid_a > uid_b) - (uid_a < uid_b);
+}
+
+/* Selects every entity seen in the box, if the IDs were drawn for exactly 
+ * that box. Returns false if they weren't. */
+static bool sel_gpu_box(const struct pick_result *res, vec2_t mouse_down, vec2_t mouse_up, 
+                        bool *inout_empty)
+{
+    vec2_t corner, size;
+    sel_box_rect(mouse_down, mouse_up, &corner, &size);
+    if(memcmp(&corner, &res->corner, sizeof(vec2_t)) || memcmp(&size, &res->size, sizeof(vec2_t)))
+        return false;
+
+    /* Neighbouring pixels mostly repeat the same ID */
+    kv_reset(s_pick_ids);
+    uint32_t last = PICK_NONE;
+    for(int i = 0; i < res->width * res->height; i++) {
+
+        uint32_t id = res->ids[i];
+        if(id == PICK_NONE || id == last)
+            continue;
+        last = id;
+        kv_push(uint32_t, s_pick_ids, id);
+    }
+    qsort(s_pick_ids.a, kv_size(s_pick_ids), sizeof(uint32_t), compare_uids);
+
+    for(int i = 0; i < kv_size(s_pick_ids); i++) {
+
+        if(i > 0 && kv_A(s_pick_ids, i) == kv_A(s_pick_ids, i - 1))
+            continue;
+
+        struct entity *ent = sel_gpu_entity(kv_A(s_pick_ids, i));
+        if(!ent)
+            continue;
+
+        if(*inout_empty) {
+            kv_reset(s_selected);
+            *inout_empty = false;
+        }
+        kv_push(struct entity*, s_selected, ent);
+    }
+    return true;
+}
+
 static bool pentities_equal(struct entity *const *a, struct entity *const *b)
 {
     return ((*a) == (*b));
@@ -219,11 +376,22 @@ static bool pentities_equal(struct entity *const *a, struct entity *const *b)
 bool G_Sel_Init(void)
 {
     kv_init(s_selected);
+    C_OBBSoA_Init(&s_soa);
+    kv_init(s_soa_idx);
+    kv_init(s_mask);
+    kv_init(s_t);
+    kv_init(s_pick_ids);
+    return true;
 }
 
 void G_Sel_Shutdown(void)
 {
     G_Sel_Disable();
+    kv_destroy(s_pick_ids);
+    kv_destroy(s_t);
+    kv_destroy(s_mask);
+    kv_destroy(s_soa_idx);
+    C_OBBSoA_Destroy(&s_soa);
     kv_destroy(s_selected);
 }
 
@@ -253,70 +421,95 @@ void G_Sel_Disable(void)
 
 /* Note that the selection is only changed if there is at least one entity in the new selection. Otherwise
  * (ex. if the player is left-clicking on an empty part of the map), the previous selection is kept. */
-bool G_Sel_Update(struct camera *cam, const pentity_kvec_t *visible, const obb_kvec_t *visible_obbs)
+bool G_Sel_Update(struct camera *cam, const pentity_kvec_t *visible, const obb_kvec_t *visible_obbs,
+                  const vis_range_kvec_t *visible_ranges)
 {
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    struct pick_result res;
+    bool gpu = s_gpu_picking && R_GL_PickingResult(&res);
+
+    s_pick.coord = (vec2_t){mouse_x, mouse_y};
+    if(!gpu || !sel_gpu_at(&res, s_pick.coord, &s_pick.ent))
+        s_pick.ent = sel_pick(cam, s_pick.coord, visible, visible_obbs, visible_ranges);
+
     if(s_ctx.state != STATE_MOUSE_SEL_RELEASED)
         return false;
     s_ctx.state = STATE_MOUSE_SEL_UP;
 
     bool sel_empty = true;
-    if(s_ctx.mouse_down_coord.x == s_ctx.mouse_up_coord.x && s_ctx.mouse_down_coord.y && s_ctx.mouse_up_coord.y) {
+    if(s_ctx.mouse_down_coord.x == s_ctx.mouse_up_coord.x && s_ctx.mouse_down_coord.y == s_ctx.mouse_up_coord.y) {
 
         /* Case 1: The mouse is pressed and released in the same spot, meaning we can use a single ray
          * to test against the OBBs 
          *
          * The behaviour is that only a single entity can be selected with a 'click' action, even if multiple
-         * OBBs intersect with the mouse ray. We pick the one with the closest intersection point.
+         * OBBs intersect with the mouse ray. We pick the one with the closest intersection point. The
+         * cursor has usually not moved since the button was released, in which case this frame's pick 
+         * is the answer. Otherwise, the IDs drawn last frame are used when they cover the spot.
          */
-        vec3_t ray_origin = sel_unproject_mouse_coords(cam, s_ctx.mouse_up_coord, -1.0f);
-        vec3_t ray_dir;
-
-        vec3_t cam_pos = Camera_GetPos(cam);
-        PFM_Vec3_Sub(&ray_origin, &cam_pos, &ray_dir);
-        PFM_Vec3_Normal(&ray_dir, &ray_dir);
-
-        float t_min = FLT_MAX;
-        for(int i = 0; i < kv_size(*visible_obbs); i++) {
-
-            if(!(kv_A(*visible, i)->flags & ENTITY_FLAG_SELECTABLE))
-                continue;
-        
-            float t;
-            if(C_RayIntersectsOBB(ray_origin, ray_dir, kv_A(*visible_obbs, i), &t)) {
-
-                sel_empty = false;
-                if(t < t_min) {
-                    t_min = t;
-                    kv_reset(s_selected);                
-                    kv_push(struct entity*, s_selected, kv_A(*visible, i));
-                }
-            }
+        struct entity *ent = s_pick.ent;
+        if((s_ctx.mouse_up_coord.x != s_pick.coord.x || s_ctx.mouse_up_coord.y != s_pick.coord.y)
+        && (!gpu || !sel_gpu_at(&res, s_ctx.mouse_up_coord, &ent)))
+            ent = sel_pick(cam, s_ctx.mouse_up_coord, visible, visible_obbs, visible_ranges);
+
+        if(ent) {
+            sel_empty = false;
+            kv_reset(s_selected);                
+            kv_push(struct entity*, s_selected, ent);
         }
 
         return false;
     
+    }else if(gpu && sel_gpu_box(&res, s_ctx.mouse_down_coord, s_ctx.mouse_up_coord, &sel_empty)) {
+
+        /* Case 2: The mouse is pressed and released in different spots, and the IDs of the entities 
+         * seen in the selection box were drawn for it in the last frame. Only the entities with some 
+         * of their pixels in the box are selected. */
+
     }else{
 
-        /* Case 2: The mouse is pressed and released in different spots, meaning the OBBs must be tested against
-         * a frustum that is defined by the selection box.*/
+        /* Case 3: The mouse is pressed and released in different spots, meaning the OBBs must be tested against
+         * a frustum that is defined by the selection box. The boxes are first culled against the planes of 
+         * the frustum in batches, leaving only the few near the selection for the exact test. */
         struct frustum frust;
         sel_make_frustum(cam, s_ctx.mouse_down_coord, s_ctx.mouse_up_coord, &frust);
 
-        for(int i = 0; i < kv_size(*visible_obbs); i++) {
+        C_OBBSoA_Resize(&s_soa, 0);
+        kv_reset(s_soa_idx);
+
+        for(int r = 0; r < kv_size(*visible_ranges); r++) {
 
-            if(!(kv_A(*visible, i)->flags & ENTITY_FLAG_SELECTABLE))
+            const struct vis_range *range = &kv_A(*visible_ranges, r);
+            if(range->bounded && !C_FrustumAABBIntersectionExact(&frust, &range->bounds))
                 continue;
 
-            if(C_FrustumOBBIntersectionExact(&frust, &kv_A(*visible_obbs, i))) {
+            if(!sel_pack_range(visible, visible_obbs, range))
+                return false;
+        }
+
+        if(!s_soa.size)
+            return false;
+
+        sel_reserve_results();
+        C_FrustumOBBsCull(&frust, &s_soa, s_mask.a);
+
+        for(int i = 0; i < s_soa.size; i++) {
+
+            if(!sel_packed_bit(i))
+                continue;
+
+            int idx = kv_A(s_soa_idx, i);
+            if(C_FrustumOBBIntersectionExact(&frust, &kv_A(*visible_obbs, idx))) {
 
                 if(sel_empty) {
                     kv_reset(s_selected);
                     sel_empty = false;
                 }
-                kv_push(struct entity*, s_selected, kv_A(*visible, i));
+                kv_push(struct entity*, s_selected, kv_A(*visible, idx));
             }
         }
-        
     }
 
     if(!sel_empty) {
@@ -332,6 +525,7 @@ void G_Sel_Clear(void)
     bool installed = s_ctx.installed;
     memset(&s_ctx, 0, sizeof(s_ctx));
     s_ctx.installed = installed;
+    s_pick.ent = NULL;
 
     kv_reset(s_selected);
 }
@@ -351,6 +545,9 @@ void G_Sel_Remove(struct entity *ent)
 {
     assert(ent->flags & ENTITY_FLAG_SELECTABLE);
 
+    if(s_pick.ent == ent)
+        s_pick.ent = NULL;
+
     int idx;
     kv_indexof(struct entity*, s_selected, ent, pentities_equal, idx);
     if(idx != -1) {
@@ -363,3 +560,51 @@ const pentity_kvec_t *G_Sel_Get(void)
     return &s_selected;
 }
 
+struct entity *G_Sel_EntityUnderCursor(void)
+{
+    return s_pick.ent;
+}
+
+bool G_Sel_PickBegin(struct camera *cam, const pentity_kvec_t *visible, 
+                     const vis_range_kvec_t *visible_ranges, bool *out_pick)
+{
+    if(!s_gpu_picking || !s_ctx.installed)
+        return false;
+
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    /* The selection box while it's being dragged, and otherwise the pixel 
+     * under the cursor */
+    vec2_t mouse = (vec2_t){mouse_x, mouse_y};
+    vec2_t corner, size;
+    sel_box_rect(mouse, s_ctx.state == STATE_MOUSE_SEL_DOWN ? s_ctx.mouse_down_coord : mouse, 
+        &corner, &size);
+
+    struct frustum frust;
+    sel_make_frustum(cam, corner, (vec2_t){corner.x + size.x, corner.y + size.y}, &frust);
+
+    for(int i = 0; i < kv_size(*visible); i++)
+        out_pick[i] = false;
+
+    for(int r = 0; r < kv_size(*visible_ranges); r++) {
+
+        const struct vis_range *range = &kv_A(*visible_ranges, r);
+        if(range->bounded && !C_FrustumAABBIntersectionExact(&frust, &range->bounds))
+            continue;
+
+        for(int i = range->begin; i < range->end; i++)
+            out_pick[i] = !!(kv_A(*visible, i)->flags & ENTITY_FLAG_SELECTABLE);
+    }
+
+    R_GL_PickingBegin(corner, size);
+    return true;
+}
+
+void G_Sel_SetGPUPicking(bool on)
+{
+    if(s_gpu_picking && !on)
+        R_GL_PickingReset();
+    s_gpu_picking = on;
+}
+
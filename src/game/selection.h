@@ -37,6 +37,7 @@
 #define SELECTION_H
 
 #include "public/game.h"
+#include "cull_index.h"
 #include "../lib/public/kvec.h"
 #include "../entity.h"
 
@@ -45,10 +46,15 @@
 struct obb;
 struct camera;
 
-typedef kvec_t(struct obb) obb_kvec_t;
-
 bool G_Sel_Init(void);
 void G_Sel_Shutdown(void);
-bool G_Sel_Update(struct camera *cam, const pentity_kvec_t *visible, const obb_kvec_t *visible_obbs);
+/* 'visible_ranges' partition the visible set into runs, so that the runs 
+ * which can't contain the selection are skipped. */
+bool G_Sel_Update(struct camera *cam, const pentity_kvec_t *visible, const obb_kvec_t *visible_obbs,
+                  const vis_range_kvec_t *visible_ranges);
+/* Starts the frame's GPU picking pass, if it's on, and sets 'out_pick' for the
+ * visible entities to submit to it. Returns false if there is no pass. */
+bool G_Sel_PickBegin(struct camera *cam, const pentity_kvec_t *visible, 
+                     const vis_range_kvec_t *visible_ranges, bool *out_pick);
 
 #endif
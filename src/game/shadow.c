@@ -0,0 +1,185 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "shadow.h"
+#include "../render/public/render.h"
+#include "../map/public/map.h"
+#include "../entity.h"
+#include "../collision.h"
+#include "../perf.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <float.h>
+
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const struct map *s_map;
+static bool              s_enabled;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void g_shadow_ent_bounds(const struct entity *ent, struct aabb *out)
+{
+    struct obb obb;
+    Entity_CurrentOBB(ent, &obb);
+
+    *out = (struct aabb){
+        FLT_MAX, -FLT_MAX,
+        FLT_MAX, -FLT_MAX,
+        FLT_MAX, -FLT_MAX,
+    };
+    for(int i = 0; i < 8; i++) {
+        out->x_min = MIN(out->x_min, obb.corners[i].x);
+        out->x_max = MAX(out->x_max, obb.corners[i].x);
+        out->y_min = MIN(out->y_min, obb.corners[i].y);
+        out->y_max = MAX(out->y_max, obb.corners[i].y);
+        out->z_min = MIN(out->z_min, obb.corners[i].z);
+        out->z_max = MAX(out->z_max, obb.corners[i].z);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void G_Shadow_Init(const struct map *map)
+{
+    s_map = map;
+    s_enabled = false;
+}
+
+void G_Shadow_Shutdown(void)
+{
+    if(!s_map)
+        return;
+
+    G_Shadows_Disable();
+    s_map = NULL;
+}
+
+bool G_Shadows_Enable(void)
+{
+    if(!s_map)
+        return false;
+    if(s_enabled)
+        return true;
+
+    struct aabb bounds;
+    M_GetBounds(s_map, &bounds);
+    R_GL_ShadowsEnable(&bounds);
+
+    s_enabled = true;
+    return true;
+}
+
+void G_Shadows_Disable(void)
+{
+    if(!s_enabled)
+        return;
+
+    R_GL_ShadowsDisable();
+    s_enabled = false;
+}
+
+bool G_Shadows_Enabled(void)
+{
+    return s_enabled;
+}
+
+bool G_Shadow_Cached(const struct entity *ent)
+{
+    return (ent->flags & ENTITY_FLAG_STATIC) && !(ent->flags & ENTITY_FLAG_ANIMATED);
+}
+
+void G_Shadow_Invalidate(const struct entity *ent)
+{
+    if(!s_enabled)
+        return;
+
+    if(!ent) {
+        R_GL_ShadowInvalidate(NULL);
+        return;
+    }
+
+    if(!G_Shadow_Cached(ent))
+        return;
+
+    struct aabb bounds;
+    g_shadow_ent_bounds(ent, &bounds);
+    R_GL_ShadowInvalidate(&bounds);
+}
+
+void G_Shadow_Render(const pentity_kvec_t *statics)
+{
+    if(!s_enabled || !R_GL_ShadowStaticDirty())
+        return;
+
+    PERF_ENTER();
+
+    struct map_resolution res;
+    M_GetResolution(s_map, &res);
+
+    size_t max_casters = res.chunk_w * res.chunk_h + kv_size(*statics);
+    struct shadow_caster *casters = arena_alloc(MEM_FrameArena(), max_casters * sizeof(*casters));
+    if(!casters)
+        PERF_RETURN();
+
+    size_t ncasters = M_GetShadowCasters(s_map, casters);
+    for(int i = 0; i < kv_size(*statics); i++) {
+
+        const struct entity *curr = kv_A(*statics, i);
+        if(!G_Shadow_Cached(curr))
+            continue;
+
+        struct shadow_caster *caster = &casters[ncasters++];
+        caster->render_private = curr->render_private;
+        Entity_ModelMatrix(curr, &caster->model);
+        g_shadow_ent_bounds(curr, &caster->bounds);
+    }
+
+    R_GL_ShadowDrawStatic(casters, ncasters);
+    PERF_RETURN();
+}
+
@@ -0,0 +1,76 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "public/game.h"
+
+#include <stdbool.h>
+
+struct map;
+struct entity;
+
+/* The shadows cover the whole of the map, which must already be in its' 
+ * final position */
+void G_Shadow_Init(const struct map *map);
+/* Turns the shadows off */
+void G_Shadow_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * The entity's shadow in the cached shadow map is to be drawn again, where
+ * it was or where it is now. Only static entities are cached - the others 
+ * are drawn every frame anyway. A NULL entity invalidates all of it.
+ * ------------------------------------------------------------------------
+ */
+void G_Shadow_Invalidate(const struct entity *ent);
+
+/* ------------------------------------------------------------------------
+ * Whether the entity is drawn to the cached shadow map, rather than every 
+ * frame.
+ * ------------------------------------------------------------------------
+ */
+bool G_Shadow_Cached(const struct entity *ent);
+
+/* ------------------------------------------------------------------------
+ * Draws the invalidated parts of the cached shadow map from the terrain and
+ * the static entities. Nothing is drawn when it is all still valid.
+ * ------------------------------------------------------------------------
+ */
+void G_Shadow_Render(const pentity_kvec_t *statics);
+
+#endif
+
@@ -0,0 +1,346 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "public/game.h"
+#include "game_private.h"
+#include "movement.h"
+#include "../entity.h"
+#include "../camera.h"
+#include "../asset_load.h"
+#include "../anim/public/anim.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../lib/public/file_replace.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#define PFSNAP_MAGIC    (0x4e534650) /* 'PFSN' */
+/* Must be bumped whenever the layout of the records, or of the engine 
+ * structures stored in them, changes */
+#define PFSNAP_VERSION  (1)
+
+/* Snapshots are only read back by the same build of the engine within the 
+ * same session, so everything is stored as it is laid out in memory:
+ *
+ *  +---------------------------------+
+ *  | struct snap_header              |
+ *  +---------------------------------+
+ *  | struct ent_rec[num_ents]        |
+ *  +---------------------------------+
+ *  | uint32_t selected[num_selected] |
+ *  +---------------------------------+
+ *  | tile deltas                     | (M_AL_WriteTileDeltas)
+ *  +---------------------------------+
+ *  | movement state                  | (G_Move_SaveState)
+ *  +---------------------------------+
+ */
+struct snap_header{
+    uint32_t magic;
+    uint32_t version;
+    /* Of the whole file, so that a snapshot cut short is turned down before 
+     * any of it is applied */
+    uint64_t size;
+    int32_t  chunk_w, chunk_h;
+    uint32_t num_ents;
+    uint32_t num_selected;
+    vec3_t   cam_pos;
+    float    cam_pitch;
+    float    cam_yaw;
+};
+
+struct ent_rec{
+    uint32_t          uid;
+    uint32_t          flags;
+    vec3_t            pos;
+    vec3_t            scale;
+    quat_t            rotation;
+    vec3_t            prev_pos;
+    quat_t            prev_rotation;
+    float             selection_radius;
+    float             max_speed;
+    uint32_t          has_anim;
+    struct anim_state anim;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool snap_write(SDL_RWops *out)
+{
+    const struct map *map = G_GetMap();
+    const struct camera *cam = G_GetActiveCamera();
+    const pentity_kvec_t *active = G_GetActiveEnts();
+    const pentity_kvec_t *selected = G_Sel_Get();
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    struct snap_header hdr = (struct snap_header){
+        .magic        = PFSNAP_MAGIC,
+        .version      = PFSNAP_VERSION,
+        .size         = 0,
+        .chunk_w      = res.chunk_w,
+        .chunk_h      = res.chunk_h,
+        .num_ents     = kv_size(*active),
+        .num_selected = kv_size(*selected),
+        .cam_pos      = Camera_GetPos(cam),
+        .cam_pitch    = Camera_GetPitch(cam),
+        .cam_yaw      = Camera_GetYaw(cam),
+    };
+    if(!AL_WriteBytes(out, &hdr, sizeof(hdr)))
+        return false;
+
+    for(int i = 0; i < kv_size(*active); i++) {
+
+        const struct entity *ent = kv_A(*active, i);
+        struct ent_rec rec = (struct ent_rec){
+            .uid              = ent->uid,
+            .flags            = ent->flags,
+            .pos              = ent->pos,
+            .scale            = ent->scale,
+            .rotation         = ent->rotation,
+            .prev_pos         = ent->prev_pos,
+            .prev_rotation    = ent->prev_rotation,
+            .selection_radius = ent->selection_radius,
+            .max_speed        = ent->max_speed,
+            .has_anim         = !!(ent->flags & ENTITY_FLAG_ANIMATED),
+        };
+        if(rec.has_anim)
+            A_GetState(ent, &rec.anim);
+
+        if(!AL_WriteBytes(out, &rec, sizeof(rec)))
+            return false;
+    }
+
+    for(int i = 0; i < kv_size(*selected); i++) {
+
+        uint32_t uid = kv_A(*selected, i)->uid;
+        if(!AL_WriteBytes(out, &uid, sizeof(uid)))
+            return false;
+    }
+
+    if(!M_AL_WriteTileDeltas(map, out)
+    || !G_Move_SaveState(out))
+        return false;
+
+    /* Only now is the size known */
+    Sint64 size = SDL_RWtell(out);
+    if(size < (Sint64)sizeof(hdr))
+        return false;
+    hdr.size = size;
+
+    return (SDL_RWseek(out, offsetof(struct snap_header, size), RW_SEEK_SET) >= 0)
+        && AL_WriteBytes(out, &hdr.size, sizeof(hdr.size));
+}
+
+static void snap_restore_ent(struct entity *ent, const struct ent_rec *rec)
+{
+    /* Moving between the static and dynamic sets takes adding it anew */
+    if((ent->flags ^ rec->flags) & ENTITY_FLAG_STATIC)
+        G_RemoveEntity(ent);
+
+    /* Whether the entity is animated goes with its' model */
+    ent->flags = (rec->flags & ~ENTITY_FLAG_ANIMATED) | (ent->flags & ENTITY_FLAG_ANIMATED);
+    ent->selection_radius = rec->selection_radius;
+    ent->max_speed = rec->max_speed;
+
+    Entity_SetPos(ent, rec->pos);
+    Entity_SetScale(ent, rec->scale);
+    Entity_SetRotation(ent, rec->rotation);
+    ent->prev_pos = rec->prev_pos;
+    ent->prev_rotation = rec->prev_rotation;
+
+    if(rec->has_anim && (ent->flags & ENTITY_FLAG_ANIMATED))
+        A_SetState(ent, &rec->anim);
+
+    if(!G_AddEntity(ent))
+        G_UpdateEntityBounds(ent);
+}
+
+static bool snap_apply(SDL_RWops *in, const struct snap_header *hdr)
+{
+    bool ret = false;
+    struct ent_rec *recs = malloc(hdr->num_ents * sizeof(struct ent_rec) + 1);
+    uint32_t *selected = malloc(hdr->num_selected * sizeof(uint32_t) + 1);
+    bool *keep = calloc(Entity_PoolCapacity() + 1, sizeof(bool));
+    pentity_kvec_t drop;
+    kv_init(drop);
+
+    if(!recs || !selected || !keep)
+        goto out;
+
+    if(!AL_ReadBytes(in, recs, hdr->num_ents * sizeof(struct ent_rec))
+    || !AL_ReadBytes(in, selected, hdr->num_selected * sizeof(uint32_t)))
+        goto out;
+
+    /* The tiles go first, so that the paths requested again by the movement
+     * are searched over the restored map */
+    if(!M_AL_ReadTileDeltas(G_GetMap(), in))
+        goto out;
+
+    for(int i = 0; i < hdr->num_ents; i++) {
+        if(Entity_FromUID(recs[i].uid))
+            keep[Entity_PoolIndex(recs[i].uid)] = true;
+    }
+
+    /* Entities added since the snapshot was taken are taken out of the game,
+     * but are left to their owners to free */
+    const pentity_kvec_t *active = G_GetActiveEnts();
+    for(int i = 0; i < kv_size(*active); i++) {
+
+        struct entity *curr = kv_A(*active, i);
+        if(!keep[Entity_PoolIndex(curr->uid)])
+            kv_push(struct entity*, drop, curr);
+    }
+    for(int i = 0; i < kv_size(drop); i++)
+        G_RemoveEntity(kv_A(drop, i));
+
+    /* Entities freed since can't be brought back without their scripts, 
+     * and are left out */
+    for(int i = 0; i < hdr->num_ents; i++) {
+
+        struct entity *ent = Entity_FromUID(recs[i].uid);
+        if(ent)
+            snap_restore_ent(ent, &recs[i]);
+    }
+
+    if(!G_Move_LoadState(in))
+        goto out;
+
+    G_Sel_Clear();
+    for(int i = 0; i < hdr->num_selected; i++) {
+
+        struct entity *ent = Entity_FromUID(selected[i]);
+        if(ent && keep[Entity_PoolIndex(ent->uid)] && (ent->flags & ENTITY_FLAG_SELECTABLE))
+            G_Sel_Add(ent);
+    }
+
+    struct camera *cam = G_GetActiveCamera();
+    Camera_SetPos(cam, hdr->cam_pos);
+    Camera_SetPitchAndYaw(cam, hdr->cam_pitch, hdr->cam_yaw);
+    ret = true;
+
+out:
+    kv_destroy(drop);
+    free(keep);
+    free(selected);
+    free(recs);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Snapshot_Save(const char *path)
+{
+    if(!G_GetMap())
+        return false;
+
+    char tmp_path[strlen(path) + sizeof(".tmp")];
+    sprintf(tmp_path, "%s.tmp", path);
+
+    SDL_RWops *out = SDL_RWFromFile(tmp_path, "wb");
+    if(!out)
+        return false;
+
+    bool ret = snap_write(out);
+    ret = (0 == SDL_RWclose(out)) && ret;
+
+    /* A snapshot only replaces the last one once it's been fully written */
+    return file_replace(path, tmp_path, ret);
+}
+
+bool G_Snapshot_Load(const char *path)
+{
+    struct map *map = G_GetMap();
+    if(!map)
+        return false;
+
+    bool ret = false;
+    char *buff = NULL;
+    SDL_RWops *in = NULL;
+
+    SDL_RWops *file = SDL_RWFromFile(path, "rb");
+    if(!file)
+        return false;
+
+    Sint64 size = SDL_RWsize(file);
+    if(size < (Sint64)sizeof(struct snap_header))
+        goto out_file;
+
+    buff = malloc(size);
+    if(!buff)
+        goto out_file;
+
+    if(!AL_ReadBytes(file, buff, size))
+        goto out_buff;
+
+    struct snap_header hdr;
+    memcpy(&hdr, buff, sizeof(hdr));
+
+    struct map_resolution res;
+    M_GetResolution(map, &res);
+
+    if(hdr.magic != PFSNAP_MAGIC
+    || hdr.version != PFSNAP_VERSION
+    || hdr.size != (uint64_t)size
+    || hdr.chunk_w != res.chunk_w
+    || hdr.chunk_h != res.chunk_h
+    || hdr.num_ents > (size - sizeof(hdr)) / sizeof(struct ent_rec)
+    || hdr.num_selected > hdr.num_ents)
+        goto out_buff;
+
+    in = SDL_RWFromConstMem(buff + sizeof(hdr), size - sizeof(hdr));
+    if(!in)
+        goto out_buff;
+
+    ret = snap_apply(in, &hdr);
+    SDL_RWclose(in);
+
+out_buff:
+    free(buff);
+out_file:
+    SDL_RWclose(file);
+    return ret;
+}
@@ -0,0 +1,337 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "spatial.h"
+#include "../entity.h"
+#include "../lib/public/kvec.h"
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+/* Chosen to be on the order of the steering neighbourhood radii, so that a 
+ * typical query touches a 3x3 block of cells. */
+#define CELL_SIZE   (16.0f)
+/* When the entities are spread out over a very large area, the cells are 
+ * made coarser to keep the bucket array bounded. */
+#define MAX_CELLS   (256 * 256)
+
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi) (MAX((lo), MIN((a), (hi))))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The entities, sorted by cell index. The entities of cell 'i' are in the 
+ * range [s_cell_start[i], s_cell_start[i+1]) */
+static pentity_kvec_t   s_ents;
+static kvec_t(size_t)   s_cell_start;
+/* Scratch buffers for the counting sort */
+static kvec_t(size_t)   s_fill;
+static kvec_t(int)      s_ent_cell;
+static pentity_kvec_t   s_unsorted;
+/* Scratch buffer for the nearest-neighbour search */
+static pentity_kvec_t   s_nearest;
+
+static float            s_min_x, s_min_z;
+static float            s_cell_size;
+static int              s_rows, s_cols;
+/* Extra distance by which all queries are expanded: the largest selection 
+ * radius plus the furthest any entity can travel after the grid is built. */
+static float            s_pad;
+static float            s_step_dt;
+static bool             s_dirty;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int cell_col(float x)
+{
+    return CLAMP((int)((x - s_min_x) / s_cell_size), 0, s_cols - 1);
+}
+
+static int cell_row(float z)
+{
+    return CLAMP((int)((z - s_min_z) / s_cell_size), 0, s_rows - 1);
+}
+
+static void push_cell(int r, int c, pentity_kvec_t *out)
+{
+    int idx = r * s_cols + c;
+    for(size_t i = kv_A(s_cell_start, idx); i < kv_A(s_cell_start, idx + 1); i++)
+        kv_push(struct entity*, *out, kv_A(s_ents, i));
+}
+
+static float seg_dist_sq(struct line_seg_2d seg, float px, float pz)
+{
+    float dx = seg.bx - seg.ax, dz = seg.bz - seg.az;
+    float len_sq = dx * dx + dz * dz;
+    float t = (len_sq > 0.0f) ? ((px - seg.ax) * dx + (pz - seg.az) * dz) / len_sq : 0.0f;
+    t = CLAMP(t, 0.0f, 1.0f);
+
+    float ex = seg.ax + t * dx - px, ez = seg.az + t * dz - pz;
+    return ex * ex + ez * ez;
+}
+
+static size_t query_box(float x0, float z0, float x1, float z1, pentity_kvec_t *out)
+{
+    kv_reset(*out);
+    if(0 == kv_size(s_ents))
+        return 0;
+
+    x0 -= s_pad; z0 -= s_pad;
+    x1 += s_pad; z1 += s_pad;
+
+    if(x1 < s_min_x || z1 < s_min_z)
+        return 0;
+    if(x0 > s_min_x + s_cols * s_cell_size || z0 > s_min_z + s_rows * s_cell_size)
+        return 0;
+
+    int c0 = cell_col(x0), c1 = cell_col(x1);
+    int r0 = cell_row(z0), r1 = cell_row(z1);
+
+    for(int r = r0; r <= r1; r++) {
+        for(int c = c0; c <= c1; c++) {
+            push_cell(r, c, out);
+        }
+    }
+    return kv_size(*out);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool G_Spatial_Init(void)
+{
+    kv_init(s_ents);
+    kv_init(s_cell_start);
+    kv_init(s_fill);
+    kv_init(s_ent_cell);
+    kv_init(s_unsorted);
+    kv_init(s_nearest);
+    s_rows = s_cols = 0;
+    s_step_dt = 0.0f;
+    s_dirty = true;
+    return true;
+}
+
+void G_Spatial_Shutdown(void)
+{
+    kv_destroy(s_nearest);
+    kv_destroy(s_unsorted);
+    kv_destroy(s_ent_cell);
+    kv_destroy(s_fill);
+    kv_destroy(s_cell_start);
+    kv_destroy(s_ents);
+}
+
+void G_Spatial_Rebuild(const pentity_kvec_t *ents, float step_dt)
+{
+    kv_reset(s_ents);
+    kv_reset(s_ent_cell);
+    kv_reset(s_unsorted);
+    s_rows = s_cols = 0;
+    s_step_dt = step_dt;
+    s_dirty = false;
+
+    if(0 == kv_size(*ents))
+        return;
+
+    /* First pass: find the extents of the grid */
+    float min_x = INFINITY, min_z = INFINITY;
+    float max_x = -INFINITY, max_z = -INFINITY;
+    float max_radius = 0.0f, max_speed = 0.0f;
+
+    for(int i = 0; i < kv_size(*ents); i++) {
+
+        const struct entity *curr = kv_A(*ents, i);
+        min_x = MIN(min_x, curr->pos.x);
+        min_z = MIN(min_z, curr->pos.z);
+        max_x = MAX(max_x, curr->pos.x);
+        max_z = MAX(max_z, curr->pos.z);
+        max_radius = MAX(max_radius, curr->selection_radius);
+        max_speed = MAX(max_speed, curr->max_speed);
+    }
+
+    s_min_x = min_x;
+    s_min_z = min_z;
+    s_pad = max_radius + max_speed * step_dt;
+    s_cell_size = CELL_SIZE;
+
+    do{
+        s_cols = (int)((max_x - min_x) / s_cell_size) + 1;
+        s_rows = (int)((max_z - min_z) / s_cell_size) + 1;
+        if((size_t)s_rows * s_cols > MAX_CELLS)
+            s_cell_size *= 2.0f;
+    }while((size_t)s_rows * s_cols > MAX_CELLS);
+
+    size_t ncells = s_rows * s_cols;
+    if(kv_max(s_cell_start) < ncells + 1) {
+        kv_resize(size_t, s_cell_start, ncells + 1);
+        kv_resize(size_t, s_fill, ncells);
+    }
+    memset(s_cell_start.a, 0, (ncells + 1) * sizeof(size_t));
+
+    /* Second pass: count the entities falling into each cell */
+    for(int i = 0; i < kv_size(*ents); i++) {
+
+        struct entity *curr = kv_A(*ents, i);
+        int idx = cell_row(curr->pos.z) * s_cols + cell_col(curr->pos.x);
+        kv_push(int, s_ent_cell, idx);
+        kv_push(struct entity*, s_unsorted, curr);
+        kv_A(s_cell_start, idx + 1)++;
+    }
+
+    for(size_t i = 0; i < ncells; i++) {
+        kv_A(s_cell_start, i + 1) += kv_A(s_cell_start, i);
+        kv_A(s_fill, i) = kv_A(s_cell_start, i);
+    }
+
+    /* Finally, scatter the entities into their cells' ranges */
+    size_t nents = kv_size(s_unsorted);
+    if(kv_max(s_ents) < nents)
+        kv_resize(struct entity*, s_ents, nents);
+    s_ents.n = nents;
+
+    for(size_t i = 0; i < nents; i++) {
+        int idx = kv_A(s_ent_cell, i);
+        kv_A(s_ents, kv_A(s_fill, idx)++) = kv_A(s_unsorted, i);
+    }
+    assert(kv_A(s_cell_start, ncells) == nents);
+}
+
+void G_Spatial_Invalidate(void)
+{
+    s_dirty = true;
+}
+
+void G_Spatial_Refresh(const pentity_kvec_t *ents)
+{
+    if(s_dirty)
+        G_Spatial_Rebuild(ents, s_step_dt);
+}
+
+size_t G_Spatial_QueryCircle(vec2_t center_xz, float radius, pentity_kvec_t *out)
+{
+    return query_box(center_xz.raw[0] - radius, center_xz.raw[1] - radius,
+                     center_xz.raw[0] + radius, center_xz.raw[1] + radius, out);
+}
+
+size_t G_Spatial_QuerySegment(struct line_seg_2d seg, float radius, pentity_kvec_t *out)
+{
+    kv_reset(*out);
+    if(0 == kv_size(s_ents))
+        return 0;
+
+    float reach = radius + s_pad;
+    float x0 = MIN(seg.ax, seg.bx) - reach, z0 = MIN(seg.az, seg.bz) - reach;
+    float x1 = MAX(seg.ax, seg.bx) + reach, z1 = MAX(seg.az, seg.bz) + reach;
+
+    if(x1 < s_min_x || z1 < s_min_z)
+        return 0;
+    if(x0 > s_min_x + s_cols * s_cell_size || z0 > s_min_z + s_rows * s_cell_size)
+        return 0;
+
+    int c0 = cell_col(x0), c1 = cell_col(x1);
+    int r0 = cell_row(z0), r1 = cell_row(z1);
+
+    /* A diagonal segment's bounding box is mostly empty space. The entities 
+     * were inside of their cells when the grid was built, so the cells whose 
+     * centers are further from the segment than the reach plus half of the 
+     * cell diagonal can't hold any matches. */
+    float cell_reach = reach + s_cell_size * (float)M_SQRT1_2;
+    for(int r = r0; r <= r1; r++) {
+        for(int c = c0; c <= c1; c++) {
+
+            float cx = s_min_x + (c + 0.5f) * s_cell_size;
+            float cz = s_min_z + (r + 0.5f) * s_cell_size;
+            if(seg_dist_sq(seg, cx, cz) > cell_reach * cell_reach)
+                continue;
+            push_cell(r, c, out);
+        }
+    }
+    return kv_size(*out);
+}
+
+size_t G_Spatial_QueryRect(vec2_t min_xz, vec2_t max_xz, pentity_kvec_t *out)
+{
+    return query_box(MIN(min_xz.raw[0], max_xz.raw[0]), MIN(min_xz.raw[1], max_xz.raw[1]),
+                     MAX(min_xz.raw[0], max_xz.raw[0]), MAX(min_xz.raw[1], max_xz.raw[1]), out);
+}
+
+struct entity *G_Spatial_QueryNearest(vec2_t center_xz, float max_dist, 
+                                      entity_pred_t pred, void *arg)
+{
+    if(0 == kv_size(s_ents))
+        return NULL;
+
+    /* Search boxes of doubling size until one holds a match that is no 
+     * further than the box's half-width: since the boxes are padded by the
+     * distance that entities may have moved since the grid was built, no 
+     * entity outside of the box can then be any closer. */
+    float radius = MIN(s_cell_size, max_dist);
+    while(true) {
+
+        size_t n = G_Spatial_QueryCircle(center_xz, radius, &s_nearest);
+        struct entity *best = NULL;
+        float best_dist = INFINITY;
+
+        for(size_t i = 0; i < n; i++) {
+
+            struct entity *curr = kv_A(s_nearest, i);
+            float dx = curr->pos.x - center_xz.raw[0];
+            float dz = curr->pos.z - center_xz.raw[1];
+            float dist = sqrtf(dx * dx + dz * dz);
+
+            if(dist >= best_dist || dist > max_dist)
+                continue;
+            if(pred && !pred(curr, arg))
+                continue;
+            best = curr;
+            best_dist = dist;
+        }
+
+        if(best && best_dist <= radius)
+            return best;
+        if(radius >= max_dist || n == kv_size(s_ents))
+            return best;
+        radius = MIN(radius * 2.0f, max_dist);
+    }
+}
+
@@ -0,0 +1,117 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include "public/game.h"
+#include "../pf_math.h"
+#include "../collision.h"
+
+#include <stdbool.h>
+
+/* A uniform grid over the XZ plane, bucketing the dynamic entities by position
+ * so that neighbourhood queries touch only the cells near the query shape 
+ * rather than every entity. The grid is rebuilt from scratch once per movement 
+ * tick. Entities are free to move during the tick: the queries are padded by the 
+ * furthest distance any entity can travel in 'step_dt' seconds. 
+ *
+ * Queries return a superset of the entities within the query shape - the caller 
+ * is responsible for performing the exact distance or intersection test. The
+ * returned entities may extend the query shape by the largest selection radius 
+ * in the grid, so that tests against 'curr->selection_radius' are not missed.
+ *
+ * Adding, removing or teleporting an entity leaves the grid stale until it is
+ * next rebuilt. Queries made outside of the movement tick must first bring the
+ * grid up to date with 'G_Spatial_Refresh'.
+ */
+
+bool   G_Spatial_Init(void);
+void   G_Spatial_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Re-bucket all the entities in the set according to their current positions. 
+ * ------------------------------------------------------------------------
+ */
+void   G_Spatial_Rebuild(const pentity_kvec_t *ents, float step_dt);
+
+/* ------------------------------------------------------------------------
+ * Mark the grid as no longer reflecting the entity set or its positions.
+ * ------------------------------------------------------------------------
+ */
+void   G_Spatial_Invalidate(void);
+
+/* ------------------------------------------------------------------------
+ * Rebuild the grid from 'ents' if it has been invalidated since the last 
+ * rebuild, using the 'step_dt' of the last rebuild.
+ * ------------------------------------------------------------------------
+ */
+void   G_Spatial_Refresh(const pentity_kvec_t *ents);
+
+/* ------------------------------------------------------------------------
+ * Append to 'out' the entities which may lie within 'radius' of 'center_xz'.
+ * 'out' is reset before the query. Returns the number of entities found.
+ * ------------------------------------------------------------------------
+ */
+size_t G_Spatial_QueryCircle(vec2_t center_xz, float radius, pentity_kvec_t *out);
+
+/* ------------------------------------------------------------------------
+ * Append to 'out' the entities which may lie within 'radius' of any point 
+ * on the line segment. 'out' is reset before the query. Returns the number 
+ * of entities found.
+ * ------------------------------------------------------------------------
+ */
+size_t G_Spatial_QuerySegment(struct line_seg_2d seg, float radius, pentity_kvec_t *out);
+
+/* ------------------------------------------------------------------------
+ * Append to 'out' the entities which may lie within the axis-aligned 
+ * rectangle spanned by 'min_xz' and 'max_xz'. 'out' is reset before the 
+ * query. Returns the number of entities found.
+ * ------------------------------------------------------------------------
+ */
+size_t G_Spatial_QueryRect(vec2_t min_xz, vec2_t max_xz, pentity_kvec_t *out);
+
+/* ------------------------------------------------------------------------
+ * Returns the entity whose position is closest to 'center_xz' and no further 
+ * than 'max_dist' from it, or NULL if there is none. Unlike the other queries, 
+ * the result is exact. Entities for which 'pred' (if not NULL) returns false 
+ * are skipped.
+ * ------------------------------------------------------------------------
+ */
+struct entity *G_Spatial_QueryNearest(vec2_t center_xz, float max_dist, 
+                                      entity_pred_t pred, void *arg);
+
+#endif
+
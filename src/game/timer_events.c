@@ -34,66 +34,115 @@
  */
 
 #include "timer_events.h"
+#include "game_private.h"
 #include "../event.h"
+#include "../entity.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
 
-#include <math.h>
 #include <assert.h>
-#include <SDL.h>
+#include <math.h>
+#include <string.h>
+
+#define TICK_HZ     (60)
+/* Must be a power of two. Timers further out than this many ticks are passed 
+ * over by their slot until their turn comes. */
+#define WHEEL_SLOTS (256)
+
+struct timer{
+    uint32_t            id;
+    unsigned long long  due;
+    timer_fn_t          fn;
+    void               *arg;
+};
 
-#define TIMER_INTERVAL  (1000.0f/60.0f)
+typedef kvec_t(struct timer) timer_kvec_t;
+
+/* Maps the ID of a pending timer to the tick it is due on, and so its slot */
+KHASH_MAP_INIT_INT(timer, unsigned long long)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static unsigned long long s_num_60hz_ticks;
-static SDL_TimerID        s_60hz_timer;
+
+static timer_kvec_t        s_wheel[WHEEL_SLOTS];
+static khash_t(timer)     *s_timer_table;
+static uint32_t            s_next_timer_id;
+/* The timers being called on the current tick. Ones cancelled by an earlier 
+ * timer of the same tick have their 'fn' cleared. */
+static timer_kvec_t        s_firing;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* Timer callback gets called from another thread. In the callback, push 
- * a user event (threadsafe) with the code '0' and handle the 'EVENT_60HZ_TICK' 
- * event in the main thread.
- */
-static uint32_t timer_callback(uint32_t interval, void *param)
+/* Remember where the entities were before the tick moves them, for 
+ * interpolating the rendered transforms. */
+static void snapshot_transforms(void)
 {
-    static double s_error = 0.0f;
-    s_error += (TIMER_INTERVAL - interval);
-
-    double intpart, fracpart;
-    fracpart = modf(s_error, &intpart);
-
-    s_error -= intpart;
-    interval = ((int)TIMER_INTERVAL) + intpart;
-
-    SDL_Event event = (SDL_Event) {
-        .type = SDL_USEREVENT,
-        .user = (SDL_UserEvent) {
-            .type = SDL_USEREVENT,
-            .code = 0,
-            .data1 = NULL,
-            .data2 = NULL,
-        },
-    };
+    const pentity_kvec_t *dynamic = G_GetDynamicEnts();
+    for(int i = 0; i < kv_size(*dynamic); i++) {
 
-    SDL_PushEvent(&event);
-    return interval;
+        struct entity *curr = kv_A(*dynamic, i);
+        curr->prev_pos = curr->pos;
+        curr->prev_rotation = curr->rotation;
+    }
 }
 
+static void fire_timers(void)
+{
+    timer_kvec_t *slot = &s_wheel[s_num_60hz_ticks & (WHEEL_SLOTS - 1)];
+    if(!kv_size(*slot))
+        return;
+
+    /* Timers added by the callbacks are always due on a later tick */
+    kv_reset(s_firing);
+    size_t nkept = 0;
+    for(int i = 0; i < kv_size(*slot); i++) {
+
+        struct timer curr = kv_A(*slot, i);
+        if(curr.due > s_num_60hz_ticks)
+            kv_A(*slot, nkept++) = curr;
+        else
+            kv_push(struct timer, s_firing, curr);
+    }
+    slot->n = nkept;
+
+    for(int i = 0; i < kv_size(s_firing); i++) {
+
+        struct timer curr = kv_A(s_firing, i);
+        if(!curr.fn)
+            continue;
+
+        khiter_t k = kh_get(timer, s_timer_table, curr.id);
+        assert(k != kh_end(s_timer_table));
+        kh_del(timer, s_timer_table, k);
+        curr.fn(curr.arg);
+    }
+    kv_reset(s_firing);
+}
+
+/* The 60Hz tick is the base simulation step, driven by the fixed-step loop in 
+ * 'main.c'. The lower-frequency ticks are derived from it and handled right 
+ * away, so that a step runs to completion before the next one is taken. */
 static void timer_60hz_handler(void *unused1, void *unused2)
 {
     s_num_60hz_ticks++;
 
-    if(s_num_60hz_ticks % 2 == 0)
-        E_Global_Notify(EVENT_30HZ_TICK, NULL, ES_ENGINE);
+    if(s_num_60hz_ticks % 2 == 0) {
+        snapshot_transforms();
+        E_Global_NotifyImmediate(EVENT_30HZ_TICK, NULL, ES_ENGINE);
+    }
 
     if(s_num_60hz_ticks % 6 == 0)
-        E_Global_Notify(EVENT_10HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_10HZ_TICK, NULL, ES_ENGINE);
 
     if(s_num_60hz_ticks % 60 == 0)
-        E_Global_Notify(EVENT_1HZ_TICK, NULL, ES_ENGINE);
+        E_Global_NotifyImmediate(EVENT_1HZ_TICK, NULL, ES_ENGINE);
+
+    fire_timers();
 }
 
 /*****************************************************************************/
@@ -102,17 +151,92 @@ static void timer_60hz_handler(void *unused1, void *unused2)
 
 bool G_Timer_Init(void)
 {
-    s_60hz_timer = SDL_AddTimer(TIMER_INTERVAL, timer_callback, NULL);
-    if(0 == s_60hz_timer)
+    s_num_60hz_ticks = 0;
+    s_next_timer_id = 0;
+
+    s_timer_table = kh_init(timer);
+    if(!s_timer_table)
         return false;
 
-    E_Global_Register(EVENT_60HZ_TICK, timer_60hz_handler, NULL);
-    return true;
+    for(int i = 0; i < WHEEL_SLOTS; i++)
+        kv_init(s_wheel[i]);
+    kv_init(s_firing);
+
+    return E_Global_Register(EVENT_60HZ_TICK, timer_60hz_handler, NULL);
 }
 
 void G_Timer_Shutdown(void)
 {
     E_Global_Unregister(EVENT_60HZ_TICK, timer_60hz_handler);
-    SDL_RemoveTimer(s_60hz_timer);
+
+    /* The owners of the pending timers' arguments are expected to have 
+     * cancelled them by now */
+    kv_destroy(s_firing);
+    for(int i = 0; i < WHEEL_SLOTS; i++)
+        kv_destroy(s_wheel[i]);
+    kh_destroy(timer, s_timer_table);
+}
+
+uint32_t G_Timer_After(float seconds, timer_fn_t fn, void *arg)
+{
+    float ticks = ceilf(seconds * TICK_HZ);
+    unsigned long long delay = ticks >= 1.0f ? (unsigned long long)ticks : 1;
+
+    /* 0 is never handed out */
+    if(++s_next_timer_id == 0)
+        ++s_next_timer_id;
+
+    struct timer timer = (struct timer){
+        .id = s_next_timer_id,
+        .due = s_num_60hz_ticks + delay,
+        .fn = fn,
+        .arg = arg
+    };
+
+    int ret;
+    khiter_t k = kh_put(timer, s_timer_table, timer.id, &ret);
+    if(ret == -1)
+        return 0;
+    kh_value(s_timer_table, k) = timer.due;
+
+    kv_push(struct timer, s_wheel[timer.due & (WHEEL_SLOTS - 1)], timer);
+    return timer.id;
+}
+
+bool G_Timer_Cancel(uint32_t id)
+{
+    khiter_t k = kh_get(timer, s_timer_table, id);
+    if(k == kh_end(s_timer_table))
+        return false;
+
+    unsigned long long due = kh_value(s_timer_table, k);
+    kh_del(timer, s_timer_table, k);
+
+    if(due == s_num_60hz_ticks) {
+        for(int i = 0; i < kv_size(s_firing); i++) {
+            if(kv_A(s_firing, i).id == id) {
+                kv_A(s_firing, i).fn = NULL;
+                return true;
+            }
+        }
+    }
+
+    timer_kvec_t *slot = &s_wheel[due & (WHEEL_SLOTS - 1)];
+    for(int i = 0; i < kv_size(*slot); i++) {
+        if(kv_A(*slot, i).id == id) {
+            memmove(&kv_A(*slot, i), &kv_A(*slot, i + 1), (kv_size(*slot) - i - 1) * sizeof(struct timer));
+            slot->n--;
+            return true;
+        }
+    }
+
+    assert(0);
+    return false;
+}
+
+float G_Timer_TickFraction(float step_frac)
+{
+    /* The 30Hz tick happens on every even step */
+    return ((s_num_60hz_ticks % 2) + step_frac) / 2.0f;
 }
 
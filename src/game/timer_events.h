@@ -39,8 +39,15 @@
 #include <stdbool.h>
 
 
-bool G_Timer_Init(void);
-void G_Timer_Shutdown(void);
+bool  G_Timer_Init(void);
+void  G_Timer_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Given how far along the current 60Hz simulation step the frame is, 
+ * returns how far along the current 30Hz movement tick it is, in [0, 1).
+ * ------------------------------------------------------------------------
+ */
+float G_Timer_TickFraction(float step_frac);
 
 #endif
 
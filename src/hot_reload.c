@@ -0,0 +1,340 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "hot_reload.h"
+#include "config.h"
+#include "lib/public/kvec.h"
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+
+struct hr_watch{
+    uint32_t   id;
+    char      *path;
+    hr_load_t  load;
+    hr_apply_t apply;
+    hr_free_t  free;
+    void      *user;
+    /* The state of the file the last time it was looked at */
+    time_t     mtime;
+    int64_t    size;
+    /* Set when the file was seen changing on the last poll */
+    bool       changed;
+};
+
+struct hr_result{
+    uint32_t   id;
+    hr_free_t  free;
+    void      *data;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                      s_running = false;
+static SDL_Thread               *s_thread;
+static uint32_t                  s_next_id;
+
+/* 's_lock' protects all the state below it. */
+static SDL_mutex                *s_lock;
+/* Signalled when the watcher thread should exit. */
+static SDL_cond                 *s_quit_cond;
+/* Signalled when the watcher thread is done loading a file. */
+static SDL_cond                 *s_load_cond;
+static bool                      s_quit;
+static kvec_t(struct hr_watch)   s_watches;
+/* Loaded changes waiting for 'HR_Update' */
+static kvec_t(struct hr_result)  s_results;
+/* The 'user' of the file being loaded, if any */
+static void                     *s_loading_user;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool hr_stat(const char *path, time_t *out_mtime, int64_t *out_size)
+{
+    struct stat st;
+    if(stat(path, &st))
+        return false;
+
+    *out_mtime = st.st_mtime;
+    *out_size = st.st_size;
+    return true;
+}
+
+static struct hr_watch *hr_find(uint32_t id)
+{
+    for(int i = 0; i < kv_size(s_watches); i++) {
+        if(kv_A(s_watches, i).id == id)
+            return &kv_A(s_watches, i);
+    }
+    return NULL;
+}
+
+/* Returns the index of the first watch, at or after 'start', whose file is 
+ * to be loaded, or a negative value if there is none. Must be called with 
+ * the lock held. */
+static int hr_next_changed(int start)
+{
+    for(int i = start; i < kv_size(s_watches); i++) {
+
+        struct hr_watch *watch = &kv_A(s_watches, i);
+        time_t mtime;
+        int64_t size;
+
+        /* The file may be in the middle of being replaced */
+        if(!hr_stat(watch->path, &mtime, &size))
+            continue;
+
+        if(mtime != watch->mtime || size != watch->size) {
+            watch->mtime = mtime;
+            watch->size = size;
+            watch->changed = true;
+            continue;
+        }
+
+        if(watch->changed) {
+            watch->changed = false;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int hr_watcher(void *unused)
+{
+    (void)unused;
+    SDL_LockMutex(s_lock);
+
+    while(!s_quit) {
+
+        SDL_CondWaitTimeout(s_quit_cond, s_lock, CONFIG_HOT_RELOAD_POLL_MS);
+
+        int idx = 0;
+        while(!s_quit && (idx = hr_next_changed(idx)) >= 0) {
+
+            /* The watch may be removed while the lock isn't held, but its'
+             * 'user' stays valid until the load is done */
+            struct hr_watch watch = kv_A(s_watches, idx);
+            char path[512];
+            snprintf(path, sizeof(path), "%s", watch.path);
+            s_loading_user = watch.user;
+            SDL_UnlockMutex(s_lock);
+
+            void *data = watch.load(watch.user, path);
+            if(!data)
+                fprintf(stderr, "Failed to reload '%s'.\n", path);
+
+            SDL_LockMutex(s_lock);
+            s_loading_user = NULL;
+            SDL_CondBroadcast(s_load_cond);
+
+            if(data) {
+                struct hr_result result = (struct hr_result){watch.id, watch.free, data};
+                kv_push(struct hr_result, s_results, result);
+            }
+
+            /* Pick up where the scan left off, even if watches were removed */
+            struct hr_watch *curr = hr_find(watch.id);
+            idx = curr ? (curr - s_watches.a) + 1 : idx;
+        }
+    }
+
+    SDL_UnlockMutex(s_lock);
+    return 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool HR_Init(void)
+{
+    if(!CONFIG_HOT_RELOAD)
+        return true;
+
+    if(NULL == (s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(NULL == (s_quit_cond = SDL_CreateCond()))
+        goto fail_quit_cond;
+    if(NULL == (s_load_cond = SDL_CreateCond()))
+        goto fail_load_cond;
+
+    kv_init(s_watches);
+    kv_init(s_results);
+    s_quit = false;
+    s_loading_user = NULL;
+
+    s_thread = SDL_CreateThread(hr_watcher, "hot_reload", NULL);
+    if(!s_thread)
+        goto fail_thread;
+
+    s_running = true;
+    return true;
+
+fail_thread:
+    kv_destroy(s_results);
+    kv_destroy(s_watches);
+    SDL_DestroyCond(s_load_cond);
+fail_load_cond:
+    SDL_DestroyCond(s_quit_cond);
+fail_quit_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    return false;
+}
+
+void HR_Shutdown(void)
+{
+    if(!s_running)
+        return;
+
+    SDL_LockMutex(s_lock);
+    s_quit = true;
+    SDL_CondSignal(s_quit_cond);
+    SDL_UnlockMutex(s_lock);
+    SDL_WaitThread(s_thread, NULL);
+
+    for(int i = 0; i < kv_size(s_results); i++) {
+        kv_A(s_results, i).free(kv_A(s_results, i).data);
+    }
+    for(int i = 0; i < kv_size(s_watches); i++) {
+        free(kv_A(s_watches, i).path);
+    }
+
+    kv_destroy(s_results);
+    kv_destroy(s_watches);
+    SDL_DestroyCond(s_load_cond);
+    SDL_DestroyCond(s_quit_cond);
+    SDL_DestroyMutex(s_lock);
+    s_running = false;
+}
+
+void HR_Watch(const char *path, hr_load_t load, hr_apply_t apply, hr_free_t free, 
+              void *user)
+{
+    if(!s_running)
+        return;
+
+    struct hr_watch watch = (struct hr_watch){
+        .path    = malloc(strlen(path) + 1),
+        .load    = load,
+        .apply   = apply,
+        .free    = free,
+        .user    = user,
+        .mtime   = 0,
+        .size    = -1,
+        .changed = false,
+    };
+    if(!watch.path)
+        return;
+    strcpy(watch.path, path);
+
+    /* Only changes from here on are picked up */
+    hr_stat(path, &watch.mtime, &watch.size);
+
+    SDL_LockMutex(s_lock);
+    watch.id = s_next_id++;
+    kv_push(struct hr_watch, s_watches, watch);
+    SDL_UnlockMutex(s_lock);
+}
+
+void HR_Unwatch(void *user)
+{
+    if(!s_running)
+        return;
+
+    SDL_LockMutex(s_lock);
+    while(s_loading_user == user)
+        SDL_CondWait(s_load_cond, s_lock);
+
+    for(int i = kv_size(s_watches) - 1; i >= 0; i--) {
+
+        if(kv_A(s_watches, i).user != user)
+            continue;
+
+        free(kv_A(s_watches, i).path);
+        kv_A(s_watches, i) = kv_A(s_watches, kv_size(s_watches) - 1);
+        kv_pop(s_watches);
+    }
+    SDL_UnlockMutex(s_lock);
+}
+
+void HR_Update(void)
+{
+    if(!s_running)
+        return;
+
+    while(true) {
+
+        /* The lock isn't held while the changes are applied, so that 
+         * 'apply' may add and remove watches. Only the main thread removes 
+         * watches, so a watch that's found stays until the change is 
+         * applied. */
+        SDL_LockMutex(s_lock);
+        if(!kv_size(s_results)) {
+            SDL_UnlockMutex(s_lock);
+            break;
+        }
+
+        struct hr_result result = kv_pop(s_results);
+        struct hr_watch *watch = hr_find(result.id);
+        hr_apply_t apply = watch ? watch->apply : NULL;
+        void *user = watch ? watch->user : NULL;
+        char path[512];
+        snprintf(path, sizeof(path), "%s", watch ? watch->path : "");
+        SDL_UnlockMutex(s_lock);
+
+        if(!apply) {
+            result.free(result.data);
+            continue;
+        }
+
+        if(apply(user, result.data))
+            printf("Reloaded '%s'.\n", path);
+        else
+            fprintf(stderr, "Failed to apply the changes to '%s'.\n", path);
+    }
+}
+
@@ -0,0 +1,86 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include <stdbool.h>
+
+/* Runs on the watcher thread once the file has changed, and returns what is 
+ * to be passed to the 'apply' callback, or NULL if the file couldn't be 
+ * loaded. It is tried again the next time the file changes. */
+typedef void *(*hr_load_t)(void *user, const char *path);
+/* Runs on the main thread and takes ownership of 'data'. Returns false if 
+ * the change could not be applied. */
+typedef bool  (*hr_apply_t)(void *user, void *data);
+/* Frees the loaded data when it can no longer be applied */
+typedef void  (*hr_free_t)(void *data);
+
+/* ------------------------------------------------------------------------
+ * Start up the thread watching the files of the loaded assets, when 
+ * CONFIG_HOT_RELOAD is set. Otherwise, all the other calls do nothing.
+ * ------------------------------------------------------------------------
+ */
+bool HR_Init(void);
+void HR_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Watch the file at 'path' for changes. The file is considered changed 
+ * when its' modification time or size differs from the last time it was 
+ * looked at, and stays the same for a whole polling period - so that it 
+ * isn't read while it is still being written. 'load' is then called on the
+ * watcher thread, followed by 'apply' from 'HR_Update'. The same 'user' 
+ * may be given for any number of files.
+ * ------------------------------------------------------------------------
+ */
+void HR_Watch(const char *path, hr_load_t load, hr_apply_t apply, hr_free_t free, 
+              void *user);
+
+/* ------------------------------------------------------------------------
+ * Stop watching all the files added with 'user'. Changes that were loaded
+ * but not yet applied are dropped.
+ * ------------------------------------------------------------------------
+ */
+void HR_Unwatch(void *user);
+
+/* ------------------------------------------------------------------------
+ * Apply the changes loaded since the last call. Must be called from the 
+ * main thread, which owns the GL context.
+ * ------------------------------------------------------------------------
+ */
+void HR_Update(void);
+
+#endif
+
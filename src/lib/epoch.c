@@ -0,0 +1,178 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "./public/epoch.h"
+#include "./public/kvec.h"
+
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* The global epoch is advanced every time a version is retired. A reader 
+ * stores the epoch it entered in into its' slot, and a version retired in 
+ * epoch E can only have been seen by the readers which entered in E or 
+ * before. Once every slot is idle or holds a later epoch, it is freed. The 
+ * epochs are free-running counters that are allowed to wrap, so they are 
+ * only ever compared by their difference.
+ */
+
+#define EPOCH_IDLE (0)
+
+struct retired{
+    void     *ptr;
+    void    (*free_fn)(void *ptr);
+    unsigned  epoch;
+};
+
+struct epoch{
+    SDL_atomic_t            global;
+    size_t                  num_slots;
+    SDL_atomic_t           *slots;
+    /* Only touched by the writer */
+    kvec_t(struct retired)  retired;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int epoch_diff(unsigned a, unsigned b)
+{
+    return (int)(a - b);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+epoch_t *epoch_init(size_t num_slots)
+{
+    epoch_t *ret = malloc(sizeof(epoch_t));
+    if(!ret)
+        goto fail_alloc;
+
+    ret->slots = malloc(num_slots * sizeof(SDL_atomic_t));
+    if(!ret->slots)
+        goto fail_slots;
+
+    for(size_t i = 0; i < num_slots; i++)
+        SDL_AtomicSet(&ret->slots[i], EPOCH_IDLE);
+
+    ret->num_slots = num_slots;
+    SDL_AtomicSet(&ret->global, EPOCH_IDLE + 1);
+    kv_init(ret->retired);
+    return ret;
+
+fail_slots:
+    free(ret);
+fail_alloc:
+    return NULL;
+}
+
+void epoch_free(epoch_t *epoch)
+{
+    for(size_t i = 0; i < epoch->num_slots; i++)
+        assert(SDL_AtomicGet(&epoch->slots[i]) == EPOCH_IDLE);
+
+    for(size_t i = 0; i < kv_size(epoch->retired); i++) {
+        struct retired *curr = &kv_A(epoch->retired, i);
+        curr->free_fn(curr->ptr);
+    }
+
+    kv_destroy(epoch->retired);
+    free(epoch->slots);
+    free(epoch);
+}
+
+void epoch_enter(epoch_t *epoch, size_t slot)
+{
+    assert(slot < epoch->num_slots);
+    assert(SDL_AtomicGet(&epoch->slots[slot]) == EPOCH_IDLE);
+
+    /* Setting the slot is a full barrier, so the writer either sees the 
+     * slot taken, or has already made the old version unreachable by the 
+     * reads that follow */
+    SDL_AtomicSet(&epoch->slots[slot], SDL_AtomicGet(&epoch->global));
+}
+
+void epoch_exit(epoch_t *epoch, size_t slot)
+{
+    assert(slot < epoch->num_slots);
+    SDL_AtomicSet(&epoch->slots[slot], EPOCH_IDLE);
+}
+
+void epoch_retire(epoch_t *epoch, void *ptr, void (*free_fn)(void *ptr))
+{
+    struct retired ret = (struct retired){
+        .ptr     = ptr,
+        .free_fn = free_fn,
+        .epoch   = SDL_AtomicGet(&epoch->global),
+    };
+    kv_push(struct retired, epoch->retired, ret);
+
+    /* Skip over the value reserved for idle slots when wrapping around */
+    if(SDL_AtomicAdd(&epoch->global, 1) + 1 == EPOCH_IDLE)
+        SDL_AtomicAdd(&epoch->global, 1);
+}
+
+size_t epoch_reclaim(epoch_t *epoch)
+{
+    if(kv_size(epoch->retired) == 0)
+        return 0;
+
+    /* The oldest epoch that a reader may still be in */
+    unsigned oldest = SDL_AtomicGet(&epoch->global);
+    for(size_t i = 0; i < epoch->num_slots; i++) {
+
+        unsigned curr = SDL_AtomicGet(&epoch->slots[i]);
+        if(curr != EPOCH_IDLE && epoch_diff(curr, oldest) < 0)
+            oldest = curr;
+    }
+
+    size_t left = 0;
+    for(size_t i = 0; i < kv_size(epoch->retired); i++) {
+
+        struct retired curr = kv_A(epoch->retired, i);
+        if(epoch_diff(curr.epoch, oldest) < 0) {
+            curr.free_fn(curr.ptr);
+        }else{
+            kv_A(epoch->retired, left++) = curr;
+        }
+    }
+    kv_size(epoch->retired) = left;
+    return left;
+}
+
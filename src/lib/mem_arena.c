@@ -0,0 +1,178 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "./public/mem_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ALIGN_UP(x)  (((x) + (ARENA_ALIGN - 1)) & ~((size_t)ARENA_ALIGN - 1))
+#define MAX(a, b)    ((a) > (b) ? (a) : (b))
+/* The block header is padded so that the data after it stays aligned */
+#define HEADER_SIZE  ALIGN_UP(sizeof(struct arena_block))
+#define BLOCK_DATA(b) ((char*)(b) + HEADER_SIZE)
+
+struct arena_block{
+    struct arena_block *next;
+    size_t              size;
+    size_t              used;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The new block is linked in right after 'prev', ahead of any blocks that 
+ * are kept from earlier use. */
+static struct arena_block *arena_new_block(struct mem_arena *arena, 
+                                           struct arena_block *prev, size_t size)
+{
+    size_t block_size = MAX(arena->block_size, size);
+    struct arena_block *ret = malloc(HEADER_SIZE + block_size);
+    if(!ret)
+        return NULL;
+
+    ret->size = block_size;
+    ret->used = 0;
+
+    if(prev) {
+        ret->next = prev->next;
+        prev->next = ret;
+    }else{
+        ret->next = arena->head;
+        arena->head = ret;
+    }
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void arena_init(struct mem_arena *arena, size_t block_size)
+{
+    arena->head = NULL;
+    arena->curr = NULL;
+    arena->block_size = ALIGN_UP(block_size);
+}
+
+void arena_destroy(struct mem_arena *arena)
+{
+    struct arena_block *curr = arena->head;
+    while(curr) {
+        struct arena_block *next = curr->next;
+        free(curr);
+        curr = next;
+    }
+    arena->head = NULL;
+    arena->curr = NULL;
+}
+
+void *arena_alloc(struct mem_arena *arena, size_t size)
+{
+    size = ALIGN_UP(size);
+    struct arena_block *block = arena->curr;
+
+    if(!block || block->size - block->used < size) {
+
+        /* Move on to the next of the kept blocks when the allocation fits 
+         * into it, otherwise put a new one in front of it */
+        struct arena_block *next = block ? block->next : arena->head;
+        if(next && next->size >= size) {
+            next->used = 0;
+            block = next;
+        }else if(!(block = arena_new_block(arena, block, size))) {
+            return NULL;
+        }
+        arena->curr = block;
+    }
+
+    void *ret = BLOCK_DATA(block) + block->used;
+    block->used += size;
+    return ret;
+}
+
+void *arena_calloc(struct mem_arena *arena, size_t num, size_t size)
+{
+    if(size && num > SIZE_MAX / size)
+        return NULL;
+
+    void *ret = arena_alloc(arena, num * size);
+    if(ret)
+        memset(ret, 0, num * size);
+    return ret;
+}
+
+void arena_reset(struct mem_arena *arena)
+{
+    arena->curr = NULL;
+}
+
+struct arena_mark arena_mark(const struct mem_arena *arena)
+{
+    return (struct arena_mark){
+        .block = arena->curr,
+        .used  = arena->curr ? arena->curr->used : 0
+    };
+}
+
+void arena_rewind(struct mem_arena *arena, struct arena_mark mark)
+{
+    arena->curr = mark.block;
+    if(mark.block)
+        mark.block->used = mark.used;
+}
+
+/* The blocks up to and including the current one are the ones in use */
+size_t arena_used(const struct mem_arena *arena)
+{
+    if(!arena->curr)
+        return 0;
+
+    size_t ret = 0;
+    for(const struct arena_block *curr = arena->head; curr != arena->curr; curr = curr->next)
+        ret += curr->used;
+    return ret + arena->curr->used;
+}
+
+size_t arena_capacity(const struct mem_arena *arena)
+{
+    size_t ret = 0;
+    for(const struct arena_block *curr = arena->head; curr; curr = curr->next)
+        ret += curr->size;
+    return ret;
+}
+
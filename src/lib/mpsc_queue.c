@@ -0,0 +1,155 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "./public/mpsc_queue.h"
+
+#include <SDL_atomic.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* Every slot carries a sequence number which tells whose turn it is to 
+ * touch it. A slot at position 'pos' is free for the producer that claims 
+ * 'pos' when its sequence number equals 'pos', and holds an entry ready to
+ * be popped when it equals 'pos + 1'. Popping the entry hands the slot on 
+ * to the producer of the next lap around the ring. The positions are free-
+ * running counters that are allowed to wrap, so they are only ever compared
+ * by their difference.
+ */
+
+struct mpsc_queue{
+    size_t        entry_size;
+    unsigned      mask;
+    /* The next position to be claimed by a producer */
+    SDL_atomic_t  tail;
+    /* The next position to be popped. Only touched by the consumer. */
+    unsigned      head;
+    SDL_atomic_t *seq;
+    char         *mem;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int mpsc_diff(int seq, unsigned pos)
+{
+    return (int)((unsigned)seq - pos);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+mpsc_queue_t *mpsc_queue_init(size_t entry_size, size_t capacity)
+{
+    assert(capacity && (capacity & (capacity - 1)) == 0);
+
+    mpsc_queue_t *ret = malloc(sizeof(mpsc_queue_t));
+    if(!ret)
+        goto fail_alloc;
+
+    ret->seq = malloc(capacity * sizeof(SDL_atomic_t));
+    if(!ret->seq)
+        goto fail_seq;
+
+    ret->mem = malloc(capacity * entry_size);
+    if(!ret->mem)
+        goto fail_mem;
+
+    for(unsigned i = 0; i < capacity; i++)
+        SDL_AtomicSet(&ret->seq[i], i);
+
+    ret->entry_size = entry_size;
+    ret->mask = capacity - 1;
+    ret->head = 0;
+    SDL_AtomicSet(&ret->tail, 0);
+    return ret;
+
+fail_mem:
+    free(ret->seq);
+fail_seq:
+    free(ret);
+fail_alloc:
+    return NULL;
+}
+
+void mpsc_queue_free(mpsc_queue_t *queue)
+{
+    free(queue->mem);
+    free(queue->seq);
+    free(queue);
+}
+
+int mpsc_queue_push(mpsc_queue_t *queue, const void *entry)
+{
+    for(;;) {
+
+        unsigned pos = SDL_AtomicGet(&queue->tail);
+        SDL_atomic_t *seq = &queue->seq[pos & queue->mask];
+        int diff = mpsc_diff(SDL_AtomicGet(seq), pos);
+
+        /* The consumer hasn't popped the entry from the last lap yet */
+        if(diff < 0)
+            return -1;
+
+        /* Another producer got to the slot first - try the next one */
+        if(diff > 0 || !SDL_AtomicCAS(&queue->tail, pos, pos + 1))
+            continue;
+
+        memcpy(queue->mem + (pos & queue->mask) * queue->entry_size, entry, queue->entry_size);
+        /* Publishing the sequence number is a full barrier, so the consumer
+         * can't observe it before the entry has been written */
+        SDL_AtomicSet(seq, pos + 1);
+        return 0;
+    }
+}
+
+int mpsc_queue_pop(mpsc_queue_t *queue, void *out)
+{
+    unsigned pos = queue->head;
+    SDL_atomic_t *seq = &queue->seq[pos & queue->mask];
+
+    /* Empty, or the producer that claimed the slot is still writing it */
+    if(mpsc_diff(SDL_AtomicGet(seq), pos + 1) < 0)
+        return -1;
+
+    memcpy(out, queue->mem + (pos & queue->mask) * queue->entry_size, queue->entry_size);
+    SDL_AtomicSet(seq, pos + queue->mask + 1);
+    queue->head = pos + 1;
+    return 0;
+}
+
@@ -0,0 +1,66 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+
+/* Epoch-based reclamation, for data that worker threads read without taking
+ * any locks while a single writer thread publishes new versions of it. A 
+ * reader brackets its' reads with 'epoch_enter' and 'epoch_exit', using a 
+ * slot that no other thread uses at the same time. The writer swaps in the 
+ * new version and hands the old one to 'epoch_retire'. The old version is 
+ * freed by a later 'epoch_reclaim' once none of the readers that could have 
+ * seen it are still reading.
+ */
+
+typedef struct epoch epoch_t;
+
+epoch_t *epoch_init(size_t num_slots);
+/* Frees all the retired versions. There must be no readers left. */
+void     epoch_free(epoch_t *epoch);
+/* Safe to call from any thread */
+void     epoch_enter(epoch_t *epoch, size_t slot);
+void     epoch_exit(epoch_t *epoch, size_t slot);
+/* Must only be called from the writer thread, after the version is no longer
+ * reachable by new readers */
+void     epoch_retire(epoch_t *epoch, void *ptr, void (*free_fn)(void *ptr));
+/* Must only be called from the writer thread. Returns the number of retired 
+ * versions which are still waiting to be freed. */
+size_t   epoch_reclaim(epoch_t *epoch);
+
+#endif
+
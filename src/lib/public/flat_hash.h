@@ -0,0 +1,321 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef FLAT_HASH_H
+#define FLAT_HASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* An open-addressing hash map with the keys and values stored inline, in the
+ * style of the 'Swiss table'. Every slot has a control byte which is either 
+ * EMPTY, DELETED or the low 7 bits of the hash of the key in it. The slots 
+ * are split into aligned groups of 16, and a lookup probes whole groups at a 
+ * time: the 16 control bytes are compared against the 7 bits of the key's 
+ * hash with a single SSE2 compare, so only the few slots that match have 
+ * their keys compared. A lookup stops at the first group with an EMPTY slot.
+ *
+ * The interface mirrors khash: 'fh_get' and 'fh_put' return the index of a 
+ * slot, which stays valid until the next 'fh_put' or 'fh_resize'. Unlike in 
+ * khash, deleting while iterating is allowed. The table is grown once it is 
+ * 7/8ths full, counting the slots of deleted entries.
+ *
+ * The hash function must return 64 well-mixed bits. 'fh_int_hash_func' and 
+ * 'fh_int64_hash_func' do that for integer keys.
+ */
+
+#define FH_GROUP_SIZE   (16)
+#define FH_EMPTY        ((int8_t)-128)
+#define FH_DELETED      ((int8_t)-2)
+
+static inline uint64_t fh_mix64(uint64_t x)
+{
+    x ^= x >> 32;
+    x *= 0x9e3779b97f4a7c15ull;
+    x ^= x >> 29;
+    return x;
+}
+
+#define fh_int_hash_func(key)       fh_mix64((uint32_t)(key))
+#define fh_int64_hash_func(key)     fh_mix64((uint64_t)(key))
+#define fh_int_hash_equal(a, b)     ((a) == (b))
+
+/* Bit 'i' of the results is set when slot 'i' of the group matches */
+#if defined(__SSE2__)
+
+static inline uint32_t fh_group_match(const int8_t *ctrl, int8_t h2)
+{
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+/* EMPTY and DELETED are the only control bytes with the high bit set */
+static inline uint32_t fh_group_match_free(const int8_t *ctrl)
+{
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(group);
+}
+
+#else
+
+static inline uint32_t fh_group_match(const int8_t *ctrl, int8_t h2)
+{
+    uint32_t ret = 0;
+    for(int i = 0; i < FH_GROUP_SIZE; i++)
+        ret |= (uint32_t)(ctrl[i] == h2) << i;
+    return ret;
+}
+
+static inline uint32_t fh_group_match_free(const int8_t *ctrl)
+{
+    uint32_t ret = 0;
+    for(int i = 0; i < FH_GROUP_SIZE; i++)
+        ret |= (uint32_t)(ctrl[i] < 0) << i;
+    return ret;
+}
+
+#endif
+
+static inline uint32_t fh_max_load(uint32_t n_buckets)
+{
+    return n_buckets - n_buckets / 8;
+}
+
+/* The index of the first free slot on the key's probe sequence. The groups 
+ * are visited in triangular order, which covers all of them when their 
+ * number is a power of 2. */
+static inline uint32_t fh_find_free(const int8_t *ctrl, uint32_t n_buckets, uint64_t hash)
+{
+    uint32_t group_mask = n_buckets / FH_GROUP_SIZE - 1;
+    uint32_t group = (uint32_t)(hash >> 7) & group_mask;
+
+    for(uint32_t step = 1;; step++) {
+
+        uint32_t match = fh_group_match_free(ctrl + group * FH_GROUP_SIZE);
+        if(match)
+            return group * FH_GROUP_SIZE + __builtin_ctz(match);
+        group = (group + step) & group_mask;
+    }
+}
+
+#define __FLATHASH_TYPE(name, fhkey_t, fhval_t)                                     \
+    typedef struct fh_##name##_s{                                                   \
+        uint32_t  n_buckets, size, growth_left;                                     \
+        int8_t   *ctrl;                                                             \
+        fhkey_t  *keys;                                                             \
+        fhval_t  *vals;                                                             \
+    }fh_##name##_t;
+
+#define __FLATHASH_IMPL(name, SCOPE, fhkey_t, fhval_t, __hash_func, __hash_equal)  \
+    SCOPE fh_##name##_t *fh_init_##name(void)                                       \
+    {                                                                               \
+        return calloc(1, sizeof(fh_##name##_t));                                    \
+    }                                                                               \
+    SCOPE void fh_destroy_##name(fh_##name##_t *h)                                  \
+    {                                                                               \
+        if(!h)                                                                      \
+            return;                                                                 \
+        free(h->ctrl);                                                              \
+        free(h);                                                                    \
+    }                                                                               \
+    SCOPE void fh_clear_##name(fh_##name##_t *h)                                    \
+    {                                                                               \
+        if(!h || !h->ctrl)                                                          \
+            return;                                                                 \
+        memset(h->ctrl, FH_EMPTY, h->n_buckets);                                    \
+        h->size = 0;                                                                \
+        h->growth_left = fh_max_load(h->n_buckets);                                 \
+    }                                                                               \
+    SCOPE uint32_t fh_get_##name(const fh_##name##_t *h, fhkey_t key)              \
+    {                                                                               \
+        if(!h->n_buckets)                                                           \
+            return 0;                                                               \
+        uint64_t hash = __hash_func(key);                                           \
+        int8_t h2 = (int8_t)(hash & 0x7f);                                          \
+        uint32_t group_mask = h->n_buckets / FH_GROUP_SIZE - 1;                     \
+        uint32_t group = (uint32_t)(hash >> 7) & group_mask;                        \
+                                                                                    \
+        for(uint32_t step = 1; step <= group_mask + 1; step++) {                    \
+            const int8_t *ctrl = h->ctrl + group * FH_GROUP_SIZE;                   \
+            uint32_t match = fh_group_match(ctrl, h2);                              \
+            while(match) {                                                          \
+                uint32_t x = group * FH_GROUP_SIZE + __builtin_ctz(match);          \
+                if(__hash_equal(h->keys[x], key))                                   \
+                    return x;                                                       \
+                match &= match - 1;                                                 \
+            }                                                                       \
+            if(fh_group_match(ctrl, FH_EMPTY))                                      \
+                break;                                                              \
+            group = (group + step) & group_mask;                                    \
+        }                                                                           \
+        return h->n_buckets;                                                        \
+    }                                                                               \
+    /* All the slots are allocated in a single block: the control bytes, then   \
+     * the keys and then the values. Each part is a multiple of 16 bytes. */    \
+    SCOPE int fh_rehash_##name(fh_##name##_t *h, uint32_t new_n_buckets)            \
+    {                                                                               \
+        size_t ctrl_size = new_n_buckets;                                           \
+        size_t keys_size = new_n_buckets * sizeof(fhkey_t);                         \
+        int8_t *new_ctrl = malloc(ctrl_size + keys_size + new_n_buckets * sizeof(fhval_t)); \
+        if(!new_ctrl)                                                               \
+            return -1;                                                              \
+        fhkey_t *new_keys = (fhkey_t*)(new_ctrl + ctrl_size);                       \
+        fhval_t *new_vals = (fhval_t*)((char*)new_keys + keys_size);                \
+        memset(new_ctrl, FH_EMPTY, new_n_buckets);                                  \
+                                                                                    \
+        for(uint32_t i = 0; i < h->n_buckets; i++) {                                \
+            if(h->ctrl[i] < 0)                                                      \
+                continue;                                                           \
+            uint64_t hash = __hash_func(h->keys[i]);                                \
+            uint32_t x = fh_find_free(new_ctrl, new_n_buckets, hash);               \
+            new_ctrl[x] = (int8_t)(hash & 0x7f);                                    \
+            new_keys[x] = h->keys[i];                                               \
+            new_vals[x] = h->vals[i];                                               \
+        }                                                                           \
+                                                                                    \
+        free(h->ctrl);                                                              \
+        h->ctrl = new_ctrl;                                                         \
+        h->keys = new_keys;                                                         \
+        h->vals = new_vals;                                                         \
+        h->n_buckets = new_n_buckets;                                               \
+        h->growth_left = fh_max_load(new_n_buckets) - h->size;                      \
+        return 0;                                                                   \
+    }                                                                               \
+    /* Makes room for at least 'size' entries. Returns -1 on failure. */           \
+    SCOPE int fh_resize_##name(fh_##name##_t *h, uint32_t size)                     \
+    {                                                                               \
+        uint32_t n_buckets = FH_GROUP_SIZE;                                         \
+        while(fh_max_load(n_buckets) < size)                                        \
+            n_buckets *= 2;                                                         \
+        if(n_buckets <= h->n_buckets)                                               \
+            return 0;                                                               \
+        return fh_rehash_##name(h, n_buckets);                                      \
+    }                                                                               \
+    /* 'ret' is set to 1 if the key was added, 0 if it was already present and   \
+     * -1 if the table could not grow */                                        \
+    SCOPE uint32_t fh_put_##name(fh_##name##_t *h, fhkey_t key, int *ret)           \
+    {                                                                               \
+        uint32_t x = fh_get_##name(h, key);                                         \
+        if(x != h->n_buckets) {                                                     \
+            *ret = 0;                                                               \
+            return x;                                                               \
+        }                                                                           \
+        if(h->growth_left == 0) {                                                   \
+            /* When the deleted entries take up much of the table, it is rehashed \
+             * at the same size to reclaim their slots */                         \
+            uint32_t new_n_buckets = h->n_buckets                                   \
+                ? (h->size < fh_max_load(h->n_buckets) / 2 ? h->n_buckets : h->n_buckets * 2) \
+                : FH_GROUP_SIZE;                                                    \
+            if(fh_rehash_##name(h, new_n_buckets) < 0) {                            \
+                *ret = -1;                                                          \
+                return h->n_buckets;                                                \
+            }                                                                       \
+        }                                                                           \
+        uint64_t hash = __hash_func(key);                                           \
+        x = fh_find_free(h->ctrl, h->n_buckets, hash);                              \
+        if(h->ctrl[x] == FH_EMPTY)                                                  \
+            h->growth_left--;                                                       \
+        h->ctrl[x] = (int8_t)(hash & 0x7f);                                         \
+        h->keys[x] = key;                                                           \
+        h->size++;                                                                  \
+        *ret = 1;                                                                   \
+        return x;                                                                   \
+    }                                                                               \
+    /* A slot can be made EMPTY again if its' group has another EMPTY slot, as    \
+     * no lookup could have gone past the group then */                         \
+    SCOPE void fh_del_##name(fh_##name##_t *h, uint32_t x)                          \
+    {                                                                               \
+        if(x >= h->n_buckets || h->ctrl[x] < 0)                                     \
+            return;                                                                 \
+        const int8_t *group = h->ctrl + (x & ~(uint32_t)(FH_GROUP_SIZE - 1));       \
+        if(fh_group_match(group, FH_EMPTY)) {                                       \
+            h->ctrl[x] = FH_EMPTY;                                                  \
+            h->growth_left++;                                                       \
+        }else{                                                                      \
+            h->ctrl[x] = FH_DELETED;                                                \
+        }                                                                           \
+        h->size--;                                                                  \
+    }
+
+#define FLATHASH_INIT(name, fhkey_t, fhval_t, __hash_func, __hash_equal)           \
+    __FLATHASH_TYPE(name, fhkey_t, fhval_t)                                         \
+    __FLATHASH_IMPL(name, static inline __attribute__((unused)), fhkey_t, fhval_t, __hash_func, __hash_equal)
+
+#define FLATHASH_MAP_INIT_INT(name, fhval_t)                                        \
+    FLATHASH_INIT(name, uint32_t, fhval_t, fh_int_hash_func, fh_int_hash_equal)
+
+#define FLATHASH_MAP_INIT_INT64(name, fhval_t)                                      \
+    FLATHASH_INIT(name, uint64_t, fhval_t, fh_int64_hash_func, fh_int_hash_equal)
+
+#define fh_t(name)                  fh_##name##_t
+#define fh_init(name)               fh_init_##name()
+#define fh_destroy(name, h)         fh_destroy_##name(h)
+#define fh_clear(name, h)           fh_clear_##name(h)
+#define fh_resize(name, h, s)       fh_resize_##name(h, s)
+#define fh_put(name, h, k, r)       fh_put_##name(h, k, r)
+#define fh_get(name, h, k)          fh_get_##name(h, k)
+#define fh_del(name, h, k)          fh_del_##name(h, k)
+
+#define fh_exist(h, x)              ((h)->ctrl[x] >= 0)
+#define fh_key(h, x)                ((h)->keys[x])
+#define fh_val(h, x)                ((h)->vals[x])
+#define fh_value(h, x)              ((h)->vals[x])
+#define fh_begin(h)                 ((uint32_t)0)
+#define fh_end(h)                   ((h)->n_buckets)
+#define fh_size(h)                  ((h)->size)
+
+#define fh_foreach(h, kvar, vvar, code)                                             \
+    for(uint32_t __i = fh_begin(h); __i != fh_end(h); ++__i) {                      \
+        if(!fh_exist(h, __i)) continue;                                             \
+        (kvar) = fh_key(h, __i);                                                    \
+        (vvar) = fh_val(h, __i);                                                    \
+        code;                                                                       \
+    }
+
+#define fh_foreach_value(h, vvar, code)                                             \
+    for(uint32_t __i = fh_begin(h); __i != fh_end(h); ++__i) {                      \
+        if(!fh_exist(h, __i)) continue;                                             \
+        (vvar) = fh_val(h, __i);                                                    \
+        code;                                                                       \
+    }
+
+#endif
+
@@ -0,0 +1,83 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef MEM_ARENA_H
+#define MEM_ARENA_H
+
+#include <stddef.h>
+
+/* A bump allocator for short-lived temporaries. Memory is taken from a chain 
+ * of large blocks and is never freed piece by piece - the whole arena is 
+ * reset at once, or rewound to an earlier mark. The blocks are kept around 
+ * after a reset, so an arena that is reused for the same work stops calling
+ * 'malloc' altogether once it has grown to fit. An arena must not be shared
+ * between threads.
+ */
+
+struct arena_block;
+
+struct mem_arena{
+    struct arena_block *head;
+    /* The block that allocations are currently made from */
+    struct arena_block *curr;
+    size_t              block_size;
+};
+
+struct arena_mark{
+    struct arena_block *block;
+    size_t              used;
+};
+
+/* All allocations are aligned to this many bytes */
+#define ARENA_ALIGN (16)
+
+void              arena_init   (struct mem_arena *arena, size_t block_size);
+void              arena_destroy(struct mem_arena *arena);
+void             *arena_alloc  (struct mem_arena *arena, size_t size);
+void             *arena_calloc (struct mem_arena *arena, size_t num, size_t size);
+void              arena_reset  (struct mem_arena *arena);
+
+/* Everything allocated after the mark is taken is given back by rewinding to
+ * it. Marks must be rewound to in the reverse order that they were taken. */
+struct arena_mark arena_mark   (const struct mem_arena *arena);
+void              arena_rewind (struct mem_arena *arena, struct arena_mark mark);
+
+/* The number of bytes allocated since the last reset */
+size_t            arena_used    (const struct mem_arena *arena);
+/* The total size of the blocks owned by the arena */
+size_t            arena_capacity(const struct mem_arena *arena);
+
+#endif
+
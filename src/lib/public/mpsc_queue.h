@@ -0,0 +1,59 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stddef.h>
+
+/* A bounded, lock-free queue that any number of threads can push to and a 
+ * single thread pops from. All the memory is allocated up front, so a push 
+ * never allocates - it fails instead when the queue is full. The capacity
+ * must be a power of two.
+ */
+
+typedef struct mpsc_queue mpsc_queue_t;
+
+mpsc_queue_t *mpsc_queue_init(size_t entry_size, size_t capacity);
+void          mpsc_queue_free(mpsc_queue_t *queue);
+/* Returns 0 on success and -1 when the queue is full. Safe to call from 
+ * any thread. */
+int           mpsc_queue_push(mpsc_queue_t *queue, const void *entry);
+/* Returns 0 on success and -1 when the queue is empty. Must only be called
+ * from the consuming thread. */
+int           mpsc_queue_pop(mpsc_queue_t *queue, void *out);
+
+#endif
+
@@ -16,11 +16,19 @@
 #include <SDL.h>
 #include <SDL_opengl.h>
 
-NK_API struct nk_context*   nk_sdl_init(SDL_Window *win);
+/* Four vertices per quad, in the order of the corners around it */
+struct nk_sdl_vertex {
+    float position[2];
+    float uv[2];
+    nk_byte col[4];
+};
+
+NK_API struct nk_context*   nk_sdl_init(SDL_Window *win, const struct nk_allocator *alloc);
 NK_API void                 nk_sdl_font_stash_begin(struct nk_font_atlas **atlas);
 NK_API void                 nk_sdl_font_stash_end(void);
 NK_API int                  nk_sdl_handle_event(SDL_Event *evt);
 NK_API void                 nk_sdl_render(enum nk_anti_aliasing , int max_vertex_buffer, int max_element_buffer);
+NK_API void                 nk_sdl_render_quads(const struct nk_sdl_vertex *verts, int num_quads, int changed);
 NK_API void                 nk_sdl_shutdown(void);
 NK_API void                 nk_sdl_device_destroy(void);
 NK_API void                 nk_sdl_device_create(void);
@@ -38,6 +46,15 @@ NK_API void                 nk_sdl_device_create(void);
 
 #include <string.h>
 
+/* The most draw commands of a frame that are kept to be replayed */
+#define NK_SDL_MAX_DRAWS 256
+
+struct nk_sdl_draw {
+    GLuint tex;
+    struct nk_rect clip;
+    unsigned int elem_count;
+};
+
 struct nk_sdl_device {
     struct nk_buffer cmds;
     struct nk_draw_null_texture null;
@@ -51,12 +68,18 @@ struct nk_sdl_device {
     GLint uniform_tex;
     GLint uniform_proj;
     GLuint font_tex;
-};
-
-struct nk_sdl_vertex {
-    float position[2];
-    float uv[2];
-    nk_byte col[4];
+    /* The draw commands of the last converted frame and the commands they
+     * were converted from, so that an unchanged frame can be drawn again 
+     * from the buffers without converting it. 'num_draws' is -1 when the
+     * frame can't be replayed. */
+    struct nk_sdl_draw draws[NK_SDL_MAX_DRAWS];
+    int num_draws;
+    void *last_cmds;
+    nk_size last_cmds_size, last_cmds_cap;
+    /* Quads drawn with the font texture outside of the context */
+    GLuint quad_vbo, quad_vao, quad_ebo;
+    int quad_cap;
+    int num_quads;
 };
 
 static struct nk_sdl {
@@ -64,8 +87,41 @@ static struct nk_sdl {
     struct nk_sdl_device ogl;
     struct nk_context ctx;
     struct nk_font_atlas atlas;
+    struct nk_allocator alloc;
 } sdl;
 
+#if defined(PF_HEADLESS)
+
+/* Without a GL context, the frames are laid out and then thrown away. The 
+ * font atlas is still baked, since the layout needs the glyph metrics. */
+NK_API void
+nk_sdl_device_create(void)
+{
+}
+
+NK_INTERN void
+nk_sdl_device_upload_atlas(const void *image, int width, int height)
+{
+}
+
+NK_API void
+nk_sdl_device_destroy(void)
+{
+}
+
+NK_API void
+nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_buffer)
+{
+    nk_clear(&sdl.ctx);
+}
+
+NK_API void
+nk_sdl_render_quads(const struct nk_sdl_vertex *verts, int num_quads, int changed)
+{
+}
+
+#else
+
 #ifdef __APPLE__
   #define NK_SHADER_VERSION "#version 150\n"
 #else
@@ -100,7 +156,7 @@ nk_sdl_device_create(void)
         "}\n";
 
     struct nk_sdl_device *dev = &sdl.ogl;
-    nk_buffer_init_default(&dev->cmds);
+    nk_buffer_init(&dev->cmds, &sdl.alloc, NK_BUFFER_DEFAULT_INITIAL_SIZE);
     dev->prog = glCreateProgram();
     dev->vert_shdr = glCreateShader(GL_VERTEX_SHADER);
     dev->frag_shdr = glCreateShader(GL_FRAGMENT_SHADER);
@@ -148,6 +204,37 @@ nk_sdl_device_create(void)
         glVertexAttribPointer((GLuint)dev->attrib_col, 4, GL_UNSIGNED_BYTE, GL_TRUE, vs, (void*)vc);
     }
 
+    {
+        /* quad buffer setup */
+        GLsizei vs = sizeof(struct nk_sdl_vertex);
+        size_t vp = offsetof(struct nk_sdl_vertex, position);
+        size_t vt = offsetof(struct nk_sdl_vertex, uv);
+        size_t vc = offsetof(struct nk_sdl_vertex, col);
+
+        glGenBuffers(1, &dev->quad_vbo);
+        glGenBuffers(1, &dev->quad_ebo);
+        glGenVertexArrays(1, &dev->quad_vao);
+
+        glBindVertexArray(dev->quad_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, dev->quad_vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->quad_ebo);
+
+        glEnableVertexAttribArray((GLuint)dev->attrib_pos);
+        glEnableVertexAttribArray((GLuint)dev->attrib_uv);
+        glEnableVertexAttribArray((GLuint)dev->attrib_col);
+
+        glVertexAttribPointer((GLuint)dev->attrib_pos, 2, GL_FLOAT, GL_FALSE, vs, (void*)vp);
+        glVertexAttribPointer((GLuint)dev->attrib_uv, 2, GL_FLOAT, GL_FALSE, vs, (void*)vt);
+        glVertexAttribPointer((GLuint)dev->attrib_col, 4, GL_UNSIGNED_BYTE, GL_TRUE, vs, (void*)vc);
+    }
+
+    dev->num_draws = -1;
+    dev->last_cmds = NULL;
+    dev->last_cmds_size = 0;
+    dev->last_cmds_cap = 0;
+    dev->quad_cap = 0;
+    dev->num_quads = 0;
+
     glBindTexture(GL_TEXTURE_2D, 0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
@@ -178,16 +265,21 @@ nk_sdl_device_destroy(void)
     glDeleteTextures(1, &dev->font_tex);
     glDeleteBuffers(1, &dev->vbo);
     glDeleteBuffers(1, &dev->ebo);
+    glDeleteVertexArrays(1, &dev->vao);
+    glDeleteBuffers(1, &dev->quad_vbo);
+    glDeleteBuffers(1, &dev->quad_ebo);
+    glDeleteVertexArrays(1, &dev->quad_vao);
+    if (dev->last_cmds)
+        sdl.alloc.free(sdl.alloc.userdata, dev->last_cmds);
     nk_buffer_free(&dev->cmds);
 }
 
-NK_API void
-nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_buffer)
+NK_INTERN void
+nk_sdl_begin_state(int *out_height, struct nk_vec2 *out_scale)
 {
     struct nk_sdl_device *dev = &sdl.ogl;
     int width, height;
     int display_width, display_height;
-    struct nk_vec2 scale;
     GLfloat ortho[4][4] = {
         {2.0f, 0.0f, 0.0f, 0.0f},
         {0.0f,-2.0f, 0.0f, 0.0f},
@@ -199,8 +291,9 @@ nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_b
     ortho[0][0] /= (GLfloat)width;
     ortho[1][1] /= (GLfloat)height;
 
-    scale.x = (float)display_width/(float)width;
-    scale.y = (float)display_height/(float)height;
+    *out_height = height;
+    out_scale->x = (float)display_width/(float)width;
+    out_scale->y = (float)display_height/(float)height;
 
     /* setup global state */
     glViewport(0,0,display_width,display_height);
@@ -216,7 +309,88 @@ nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_b
     glUseProgram(dev->prog);
     glUniform1i(dev->uniform_tex, 0);
     glUniformMatrix4fv(dev->uniform_proj, 1, GL_FALSE, &ortho[0][0]);
-    {
+}
+
+NK_INTERN void
+nk_sdl_end_state(void)
+{
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+NK_INTERN void
+nk_sdl_draw(const struct nk_sdl_draw *draw, int height, struct nk_vec2 scale, 
+            const nk_draw_index *offset)
+{
+    glBindTexture(GL_TEXTURE_2D, draw->tex);
+    glScissor((GLint)(draw->clip.x * scale.x),
+        (GLint)((height - (GLint)(draw->clip.y + draw->clip.h)) * scale.y),
+        (GLint)(draw->clip.w * scale.x),
+        (GLint)(draw->clip.h * scale.y));
+    glDrawElements(GL_TRIANGLES, (GLsizei)draw->elem_count, GL_UNSIGNED_SHORT, offset);
+}
+
+/* The commands are compared after the context is built, as building links 
+ * up the windows' commands in the order they are drawn */
+NK_INTERN int
+nk_sdl_cmds_unchanged(void)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    nk__begin(&sdl.ctx);
+    return dev->num_draws >= 0
+        && dev->last_cmds_size == sdl.ctx.memory.allocated
+        && memcmp(dev->last_cmds, sdl.ctx.memory.memory.ptr, dev->last_cmds_size) == 0;
+}
+
+NK_INTERN void
+nk_sdl_save_cmds(void)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    nk_size size = sdl.ctx.memory.allocated;
+
+    if (size > dev->last_cmds_cap || !dev->last_cmds) {
+        nk_size cap = NK_MAX(size, dev->last_cmds_cap * 2);
+        if (dev->last_cmds)
+            sdl.alloc.free(sdl.alloc.userdata, dev->last_cmds);
+        dev->last_cmds = sdl.alloc.alloc(sdl.alloc.userdata, NULL, cap ? cap : 1);
+        dev->last_cmds_cap = dev->last_cmds ? cap : 0;
+    }
+    if (!dev->last_cmds) {
+        dev->num_draws = -1;
+        dev->last_cmds_size = 0;
+        return;
+    }
+    memcpy(dev->last_cmds, sdl.ctx.memory.memory.ptr, size);
+    dev->last_cmds_size = size;
+}
+
+NK_API void
+nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_buffer)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    int height;
+    struct nk_vec2 scale;
+
+    nk_sdl_begin_state(&height, &scale);
+    glBindVertexArray(dev->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, dev->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
+
+    if (nk_sdl_cmds_unchanged()) {
+
+        /* the buffers still hold the vertices of the same commands */
+        const nk_draw_index *offset = NULL;
+        int i;
+        for (i = 0; i < dev->num_draws; i++) {
+            nk_sdl_draw(&dev->draws[i], height, scale, offset);
+            offset += dev->draws[i].elem_count;
+        }
+
+    } else {
         /* convert from command queue into draw list and draw to screen */
         const struct nk_draw_command *cmd;
         void *vertices, *elements;
@@ -224,10 +398,6 @@ nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_b
         struct nk_buffer vbuf, ebuf;
 
         /* allocate vertex and element buffer */
-        glBindVertexArray(dev->vao);
-        glBindBuffer(GL_ARRAY_BUFFER, dev->vbo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->ebo);
-
         glBufferData(GL_ARRAY_BUFFER, max_vertex_buffer, NULL, GL_STREAM_DRAW);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, max_element_buffer, NULL, GL_STREAM_DRAW);
 
@@ -263,28 +433,87 @@ nk_sdl_render(enum nk_anti_aliasing AA, int max_vertex_buffer, int max_element_b
         glUnmapBuffer(GL_ARRAY_BUFFER);
         glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
 
-        /* iterate over and execute each draw command */
+        /* iterate over and execute each draw command, keeping them around
+         * in case the next frame is the same */
+        dev->num_draws = 0;
         nk_draw_foreach(cmd, &sdl.ctx, &dev->cmds) {
+            struct nk_sdl_draw draw;
             if (!cmd->elem_count) continue;
-            glBindTexture(GL_TEXTURE_2D, (GLuint)cmd->texture.id);
-            glScissor((GLint)(cmd->clip_rect.x * scale.x),
-                (GLint)((height - (GLint)(cmd->clip_rect.y + cmd->clip_rect.h)) * scale.y),
-                (GLint)(cmd->clip_rect.w * scale.x),
-                (GLint)(cmd->clip_rect.h * scale.y));
-            glDrawElements(GL_TRIANGLES, (GLsizei)cmd->elem_count, GL_UNSIGNED_SHORT, offset);
+            draw.tex = (GLuint)cmd->texture.id;
+            draw.clip = cmd->clip_rect;
+            draw.elem_count = cmd->elem_count;
+            nk_sdl_draw(&draw, height, scale, offset);
             offset += cmd->elem_count;
+
+            if (dev->num_draws >= 0 && dev->num_draws < NK_SDL_MAX_DRAWS)
+                dev->draws[dev->num_draws++] = draw;
+            else dev->num_draws = -1;
         }
-        nk_clear(&sdl.ctx);
+        if (dev->num_draws >= 0)
+            nk_sdl_save_cmds();
     }
 
-    glUseProgram(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    nk_clear(&sdl.ctx);
+    /* the vertex and element buffers only live on this stack */
+    sdl.ctx.draw_list.vertices = NULL;
+    sdl.ctx.draw_list.elements = NULL;
+
+    nk_sdl_end_state();
+}
+
+/* Draws the quads with the font texture, in the order they're given. The 
+ * vertices are only uploaded when 'changed' is set - otherwise the ones 
+ * from the last call are drawn again and 'verts' is ignored. */
+NK_API void
+nk_sdl_render_quads(const struct nk_sdl_vertex *verts, int num_quads, int changed)
+{
+    struct nk_sdl_device *dev = &sdl.ogl;
+    int height;
+    struct nk_vec2 scale;
+
+    glBindVertexArray(dev->quad_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, dev->quad_vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, dev->quad_ebo);
+
+    if (changed) {
+        if (num_quads > dev->quad_cap && dev->quad_cap < 65536 / 4) {
+            /* the indices are the same for any set of quads */
+            int cap = NK_MAX(num_quads, dev->quad_cap * 2);
+            nk_draw_index *indices = (nk_draw_index*)sdl.alloc.alloc(sdl.alloc.userdata, 
+                NULL, (nk_size)cap * 6 * sizeof(nk_draw_index));
+            int i;
+            if (!indices) {
+                glBindVertexArray(0);
+                return;
+            }
+            /* the quads must be reachable with 16-bit indices */
+            cap = NK_MIN(cap, 65536 / 4);
+            for (i = 0; i < cap; i++) {
+                nk_draw_index base = (nk_draw_index)(i * 4);
+                nk_draw_index *idx = indices + i * 6;
+                idx[0] = base; idx[1] = base + 1; idx[2] = base + 2;
+                idx[3] = base; idx[4] = base + 2; idx[5] = base + 3;
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, cap * 6 * sizeof(nk_draw_index), indices, GL_STATIC_DRAW);
+            sdl.alloc.free(sdl.alloc.userdata, indices);
+            dev->quad_cap = cap;
+        }
+        dev->num_quads = NK_MIN(num_quads, dev->quad_cap);
+        glBufferData(GL_ARRAY_BUFFER, dev->num_quads * 4 * sizeof(struct nk_sdl_vertex), verts, GL_STATIC_DRAW);
+    }
+
+    if (dev->num_quads) {
+        nk_sdl_begin_state(&height, &scale);
+        glDisable(GL_SCISSOR_TEST);
+        glBindTexture(GL_TEXTURE_2D, dev->font_tex);
+        glDrawElements(GL_TRIANGLES, dev->num_quads * 6, GL_UNSIGNED_SHORT, NULL);
+        nk_sdl_end_state();
+    }
     glBindVertexArray(0);
-    glDisable(GL_BLEND);
-    glDisable(GL_SCISSOR_TEST);
 }
 
+#endif
+
 static void
 nk_sdl_clipbard_paste(nk_handle usr, struct nk_text_edit *edit)
 {
@@ -308,10 +537,11 @@ nk_sdl_clipbard_copy(nk_handle usr, const char *text, int len)
 }
 
 NK_API struct nk_context*
-nk_sdl_init(SDL_Window *win)
+nk_sdl_init(SDL_Window *win, const struct nk_allocator *alloc)
 {
     sdl.win = win;
-    nk_init_default(&sdl.ctx, 0);
+    sdl.alloc = *alloc;
+    nk_init(&sdl.ctx, &sdl.alloc, 0);
     sdl.ctx.clip.copy = nk_sdl_clipbard_copy;
     sdl.ctx.clip.paste = nk_sdl_clipbard_paste;
     sdl.ctx.clip.userdata = nk_handle_ptr(0);
@@ -322,7 +552,7 @@ nk_sdl_init(SDL_Window *win)
 NK_API void
 nk_sdl_font_stash_begin(struct nk_font_atlas **atlas)
 {
-    nk_font_atlas_init_default(&sdl.atlas);
+    nk_font_atlas_init(&sdl.atlas, &sdl.alloc);
     nk_font_atlas_begin(&sdl.atlas);
     *atlas = &sdl.atlas;
 }
@@ -36,6 +36,8 @@
 #ifndef PQUEUE_H
 #define PQUEUE_H
 
+#include "mem_arena.h"
+
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -72,6 +74,7 @@
                                                                                                 \
     scope void pq_##name##_init    (pq(name) *pqueue);                                          \
     scope void pq_##name##_destroy (pq(name) *pqueue);                                          \
+    scope void pq_##name##_clear   (pq(name) *pqueue);                                          \
     scope bool pq_##name##_push    (pq(name) *pqueue, float in_prio, type in);                  \
     scope bool pq_##name##_pop     (pq(name) *pqueue, type *out);                               \
     scope bool pq_##name##_contains(pq(name) *pqueue, type t);
@@ -92,6 +95,11 @@
         free(pqueue->nodes);                                                                    \
     }                                                                                           \
                                                                                                 \
+    scope void pq_##name##_clear(pq(name) *pqueue)                                              \
+    {                                                                                           \
+        pqueue->size = 0;                                                                       \
+    }                                                                                           \
+                                                                                                \
     scope bool pq_##name##_push(pq(name) *pqueue, float in_prio, type in)                       \
     {                                                                                           \
         if(pqueue->size + 1 >= pqueue->capacity) {                                              \
@@ -151,12 +159,189 @@
                                                                                                 \
     scope bool pq_##name##_contains(pq(name) *pqueue, type t)                                   \
     {                                                                                           \
-        for(int i = 0; i < pqueue->size; i++) {                                                 \
+        for(int i = 1; i <= pqueue->size; i++) {                                                \
             if(0 == memcmp(&pqueue->nodes[i].data, &t, sizeof(t)))                              \
                 return true;                                                                    \
         }                                                                                       \
         return false;                                                                           \
     }                                                                                           \
 
+/***********************************************************************************************/
+/* INDEXED PRIORITY QUEUE                                                                      */
+/*                                                                                             */
+/* A binary heap for elements which map to a dense integer key in the range [0, num_keys), as  */
+/* given by the 'keyfunc' argument. Every key can be present in the queue at most once. The    */
+/* position of each key in the heap is tracked, giving O(1) membership tests and allowing the  */
+/* priority of a queued element to be lowered in O(log n) ("decrease-key").                    */
+/***********************************************************************************************/
+
+#define PQUEUE_INDEXED_TYPE(name, type)                                                         \
+                                                                                                \
+    typedef struct pqi_##name##_node_s {                                                        \
+        float priority;                                                                         \
+        type data;                                                                              \
+    } pqi_##name##_node_t;                                                                      \
+                                                                                                \
+    typedef struct pqi_##name##_s {                                                             \
+        pqi_##name##_node_t *nodes;                                                             \
+        /* Heap index for every key, or 0 if the key is not in the queue */                     \
+        int *pos;                                                                               \
+        size_t num_keys;                                                                        \
+        size_t size;                                                                            \
+    } pqi_##name##_t;                                                                           \
+
+/***********************************************************************************************/
+
+#define pqi(name)                                                                               \
+    pqi_##name##_t
+
+/***********************************************************************************************/
+
+#define pqi_size(pqueue)                                                                        \
+    ((pqueue)->size)
+
+/***********************************************************************************************/
+
+#define PQUEUE_INDEXED_PROTOTYPES(scope, name, type)                                            \
+                                                                                                \
+    scope bool pqi_##name##_init    (pqi(name) *pqueue, size_t num_keys);                       \
+    scope bool pqi_##name##_init_arena(pqi(name) *pqueue, size_t num_keys,                      \
+                                       struct mem_arena *arena);                                \
+    scope void pqi_##name##_destroy (pqi(name) *pqueue);                                        \
+    scope void pqi_##name##_clear   (pqi(name) *pqueue);                                        \
+    scope bool pqi_##name##_push    (pqi(name) *pqueue, float in_prio, type in);                \
+    scope bool pqi_##name##_pop     (pqi(name) *pqueue, type *out);                             \
+    scope bool pqi_##name##_contains(pqi(name) *pqueue, type t);
+
+/***********************************************************************************************/
+
+#define PQUEUE_INDEXED_IMPL(scope, name, type, keyfunc)                                         \
+                                                                                                \
+    static inline void pqi_##name##_place(pqi(name) *pqueue, int idx,                           \
+                                          pqi_##name##_node_t node)                             \
+    {                                                                                           \
+        pqueue->nodes[idx] = node;                                                              \
+        pqueue->pos[keyfunc(node.data)] = idx;                                                  \
+    }                                                                                           \
+                                                                                                \
+    static inline void pqi_##name##_sift_up(pqi(name) *pqueue, int curr_idx,                    \
+                                            pqi_##name##_node_t node)                           \
+    {                                                                                           \
+        int parent_idx = curr_idx / 2;                                                          \
+        while(curr_idx > 1 && pqueue->nodes[parent_idx].priority > node.priority) {             \
+            pqi_##name##_place(pqueue, curr_idx, pqueue->nodes[parent_idx]);                    \
+            curr_idx = parent_idx;                                                              \
+            parent_idx = parent_idx / 2;                                                        \
+        }                                                                                       \
+        pqi_##name##_place(pqueue, curr_idx, node);                                             \
+    }                                                                                           \
+                                                                                                \
+    scope bool pqi_##name##_init(pqi(name) *pqueue, size_t num_keys)                            \
+    {                                                                                           \
+        pqueue->nodes = malloc((num_keys + 1) * sizeof(pqi_##name##_node_t));                   \
+        pqueue->pos = calloc(num_keys, sizeof(int));                                            \
+        pqueue->num_keys = num_keys;                                                            \
+        pqueue->size = 0;                                                                       \
+        if(!pqueue->nodes || !pqueue->pos) {                                                    \
+            free(pqueue->nodes);                                                                \
+            free(pqueue->pos);                                                                  \
+            return false;                                                                       \
+        }                                                                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    /* The queue's memory is taken from the arena and goes away with it, so the queue must not  \
+     * be destroyed */                                                                          \
+    scope bool pqi_##name##_init_arena(pqi(name) *pqueue, size_t num_keys,                      \
+                                       struct mem_arena *arena)                                 \
+    {                                                                                           \
+        pqueue->nodes = arena_alloc(arena, (num_keys + 1) * sizeof(pqi_##name##_node_t));       \
+        pqueue->pos = arena_calloc(arena, num_keys, sizeof(int));                               \
+        pqueue->num_keys = num_keys;                                                            \
+        pqueue->size = 0;                                                                       \
+        return (pqueue->nodes && pqueue->pos);                                                  \
+    }                                                                                           \
+                                                                                                \
+    scope void pqi_##name##_destroy(pqi(name) *pqueue)                                          \
+    {                                                                                           \
+        free(pqueue->nodes);                                                                    \
+        free(pqueue->pos);                                                                      \
+    }                                                                                           \
+                                                                                                \
+    scope void pqi_##name##_clear(pqi(name) *pqueue)                                            \
+    {                                                                                           \
+        for(int i = 1; i <= pqueue->size; i++)                                                  \
+            pqueue->pos[keyfunc(pqueue->nodes[i].data)] = 0;                                    \
+        pqueue->size = 0;                                                                       \
+    }                                                                                           \
+                                                                                                \
+    /* Insert the element, or lower its' priority if it is already queued with a higher one */  \
+    scope bool pqi_##name##_push(pqi(name) *pqueue, float in_prio, type in)                     \
+    {                                                                                           \
+        size_t key = keyfunc(in);                                                               \
+        if(key >= pqueue->num_keys)                                                             \
+            return false;                                                                       \
+                                                                                                \
+        pqi_##name##_node_t node = (pqi_##name##_node_t){in_prio, in};                          \
+        int curr_idx = pqueue->pos[key];                                                        \
+        if(curr_idx) {                                                                          \
+            if(pqueue->nodes[curr_idx].priority <= in_prio)                                     \
+                return true;                                                                    \
+            pqi_##name##_sift_up(pqueue, curr_idx, node);                                       \
+            return true;                                                                        \
+        }                                                                                       \
+                                                                                                \
+        pqueue->size++;                                                                         \
+        pqi_##name##_sift_up(pqueue, pqueue->size, node);                                       \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool pqi_##name##_pop(pqi(name) *pqueue, type *out)                                   \
+    {                                                                                           \
+        if(pqueue->size == 0)                                                                   \
+            return false;                                                                       \
+                                                                                                \
+        *out = pqueue->nodes[1].data;                                                           \
+        pqueue->pos[keyfunc(*out)] = 0;                                                         \
+                                                                                                \
+        pqi_##name##_node_t last = pqueue->nodes[pqueue->size--];                               \
+        if(pqueue->size == 0)                                                                   \
+            return true;                                                                        \
+                                                                                                \
+        int curr_idx = 1;                                                                       \
+        while(true) {                                                                           \
+                                                                                                \
+            int target_idx = curr_idx;                                                          \
+            float target_prio = last.priority;                                                  \
+            int left_child_idx = curr_idx * 2;                                                  \
+            int right_child_idx = left_child_idx + 1;                                           \
+                                                                                                \
+            if(left_child_idx <= pqueue->size                                                   \
+            && pqueue->nodes[left_child_idx].priority < target_prio) {                          \
+                target_idx = left_child_idx;                                                    \
+                target_prio = pqueue->nodes[left_child_idx].priority;                           \
+            }                                                                                   \
+                                                                                                \
+            if(right_child_idx <= pqueue->size                                                  \
+            && pqueue->nodes[right_child_idx].priority < target_prio) {                         \
+                target_idx = right_child_idx;                                                   \
+            }                                                                                   \
+                                                                                                \
+            if(target_idx == curr_idx)                                                          \
+                break;                                                                          \
+                                                                                                \
+            pqi_##name##_place(pqueue, curr_idx, pqueue->nodes[target_idx]);                    \
+            curr_idx = target_idx;                                                              \
+        }                                                                                       \
+        pqi_##name##_place(pqueue, curr_idx, last);                                             \
+        return true;                                                                            \
+    }                                                                                           \
+                                                                                                \
+    scope bool pqi_##name##_contains(pqi(name) *pqueue, type t)                                 \
+    {                                                                                           \
+        size_t key = keyfunc(t);                                                                \
+        return (key < pqueue->num_keys) && (pqueue->pos[key] != 0);                             \
+    }                                                                                           \
+
 #endif
 
@@ -38,13 +38,27 @@
 
 #include <stddef.h>
 
+/* A FIFO ring buffer. The capacity is rounded up to a power of two. Pushes
+ * only allocate when the queue has to grow, which doubles the buffer in 
+ * place. A bounded queue never grows - pushing to it fails when it is full.
+ */
+
 typedef struct queue queue_t;
 
 queue_t *queue_init(size_t entry_size, int init_capacity);
+queue_t *queue_init_bounded(size_t entry_size, int capacity);
 queue_t *queue_copy(const queue_t *queue);
 void     queue_free(queue_t *queue);
+/* Returns 0 on success and -1 if the queue could not grow to fit the entry */
 int      queue_push(queue_t *queue, void *entry);
+/* Either all 'n' entries are pushed or, on failure, none of them are */
+int      queue_push_n(queue_t *queue, const void *entries, size_t n);
+/* Returns 0 on success and -1 if the queue is empty */
 int      queue_pop(queue_t *queue, void *out);
+/* Pops up to 'max' entries into 'out' and returns how many were popped */
+size_t   queue_pop_n(queue_t *queue, void *out, size_t max);
 size_t   queue_get_size(queue_t *queue);
+/* The most recently pushed entry, or NULL if the queue is empty */
+void    *queue_back(queue_t *queue);
 
 #endif
@@ -0,0 +1,113 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef SMALL_VEC_H
+#define SMALL_VEC_H
+
+#include <stdlib.h>
+#include <string.h>
+
+/* A kvec-like vector which holds up to 'N' elements inline, only spilling 
+ * them to the heap once it outgrows that. The inline elements and the heap
+ * pointer share storage, so the vector is no bigger than its' inline buffer
+ * plus two counts, and it holds no pointers into itself - it can be copied 
+ * or moved with memcpy while it is still inline. 'sv_A' has to check which 
+ * storage is in use, so pointers from 'sv_data' must not be held across a 
+ * push. A zero-initialized vector is a valid empty one, as with kvec, and 
+ * running out of memory is not handled either.
+ *
+ *  svec_t(int, 4) array;
+ *  sv_init(array);
+ *  sv_push(int, array, 10); // no allocation until the 5th push
+ *  sv_destroy(array);
+ */
+
+#define svec_t(type, N)     struct { size_t n, m; union { type buf[N]; type *heap; } u; }
+#define sv_inline_cap(v)    (sizeof((v).u.buf) / sizeof((v).u.buf[0]))
+/* 'm' is the heap capacity, or 0 while the elements are inline */
+#define sv_spilled(v)       ((v).m != 0)
+#define sv_data(v)          (sv_spilled(v) ? (v).u.heap : (v).u.buf)
+
+#define sv_init(v)          ((v).n = (v).m = 0)
+#define sv_destroy(v)       do { if(sv_spilled(v)) free((v).u.heap); }while(0)
+#define sv_A(v, i)          (sv_data(v)[(i)])
+#define sv_pop(v)           (sv_data(v)[--(v).n])
+#define sv_size(v)          ((v).n)
+#define sv_max(v)           (sv_spilled(v) ? (v).m : sv_inline_cap(v))
+#define sv_reset(v)         do {(v).n = 0;}while(0)
+
+/* The inline elements are copied out before the heap pointer overwrites them */
+#define sv_grow(type, v)                                                    \
+    do {                                                                    \
+        if(sv_spilled(v)) {                                                 \
+            (v).m <<= 1;                                                    \
+            (v).u.heap = (type*)realloc((v).u.heap, sizeof(type) * (v).m);  \
+        }else{                                                              \
+            (v).m = sv_inline_cap(v) << 1;                                  \
+            type *__heap = (type*)malloc(sizeof(type) * (v).m);             \
+            memcpy(__heap, (v).u.buf, sizeof(type) * (v).n);                \
+            (v).u.heap = __heap;                                            \
+        }                                                                   \
+    }while(0)
+
+#define sv_push(type, v, x)                                                 \
+    do {                                                                    \
+        if((v).n == sv_max(v))                                              \
+            sv_grow(type, v);                                               \
+        sv_data(v)[(v).n++] = (x);                                          \
+    }while(0)
+
+/* Will move the last element in the vector to take the place of the deleted one.
+ */
+#define sv_del(type, v, i)                                                  \
+    ( (i) >= 0 && (i) < (v).n                                               \
+    ? (sv_data(v)[(i)] = sv_data(v)[--(v).n], 0)                            \
+    : (-1) )
+
+#define sv_indexof(type, v, x, comparator, out)                             \
+    do {                                                                    \
+        int ret = -1;                                                       \
+        for(int i = 0; i < (v).n; i++) {                                    \
+            if(comparator(&sv_data(v)[i], &(x)) != 0) {                     \
+                ret = i;                                                    \
+                break;                                                      \
+            }                                                               \
+        }                                                                   \
+        (out) = ret;                                                        \
+    }while(0)
+
+#endif
+
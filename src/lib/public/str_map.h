@@ -0,0 +1,112 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef STR_MAP_H
+#define STR_MAP_H
+
+#include "khash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* A string-keyed khash map which keeps its' own copies of the keys. A key 
+ * is copied when it is first put into the map and freed when its' entry is
+ * deleted, so the caller's string may be freed or moved right after the put,
+ * and nothing has to be patched up when the table grows. The entries are 
+ * otherwise accessed with the usual 'kh_get', 'kh_key', 'kh_value', etc.
+ * Entries must only be added and removed with 'strmap_put' and 'strmap_del',
+ * and the map must be freed with 'strmap_destroy'.
+ */
+
+#define __STRMAP_PROTOTYPES(name)                                                   \
+    extern khint_t strmap_put_##name(kh_##name##_t *h, const char *key, int *ret);  \
+    extern void strmap_del_##name(kh_##name##_t *h, khint_t x);                     \
+    extern void strmap_destroy_##name(kh_##name##_t *h);
+
+#define __STRMAP_IMPL(name, SCOPE, khval_t)                                         \
+    __KHASH_IMPL(name, SCOPE, kh_cstr_t, khval_t, 1, kh_str_hash_func, kh_str_hash_equal) \
+    SCOPE khint_t strmap_put_##name(kh_##name##_t *h, const char *key, int *ret)    \
+    {                                                                               \
+        khint_t x = kh_put_##name(h, key, ret);                                     \
+        if(*ret <= 0)                                                               \
+            return x;                                                               \
+        char *copy = malloc(strlen(key) + 1);                                       \
+        if(!copy) {                                                                 \
+            kh_del_##name(h, x);                                                    \
+            *ret = -1;                                                              \
+            return kh_end(h);                                                       \
+        }                                                                           \
+        strcpy(copy, key);                                                          \
+        kh_key(h, x) = copy;                                                        \
+        return x;                                                                   \
+    }                                                                               \
+    SCOPE void strmap_del_##name(kh_##name##_t *h, khint_t x)                       \
+    {                                                                               \
+        if(x == kh_end(h) || !kh_exist(h, x))                                       \
+            return;                                                                 \
+        free((char*)kh_key(h, x));                                                  \
+        kh_del_##name(h, x);                                                        \
+    }                                                                               \
+    SCOPE void strmap_destroy_##name(kh_##name##_t *h)                              \
+    {                                                                               \
+        if(!h)                                                                      \
+            return;                                                                 \
+        for(khint_t x = kh_begin(h); x != kh_end(h); x++) {                         \
+            if(kh_exist(h, x))                                                      \
+                free((char*)kh_key(h, x));                                          \
+        }                                                                           \
+        kh_destroy_##name(h);                                                       \
+    }
+
+/* For maps shared between translation units: STRMAP_DECLARE goes in the 
+ * header and STRMAP_IMPL in exactly one source file */
+#define STRMAP_DECLARE(name, khval_t)                                               \
+    KHASH_DECLARE(name, kh_cstr_t, khval_t)                                         \
+    __STRMAP_PROTOTYPES(name)
+
+#define STRMAP_IMPL(name, khval_t)                                                  \
+    __STRMAP_IMPL(name, , khval_t)
+
+#define STRMAP_INIT(name, khval_t)                                                  \
+    __KHASH_TYPE(name, kh_cstr_t, khval_t)                                          \
+    __STRMAP_IMPL(name, static kh_inline klib_unused, khval_t)
+
+#define strmap_put(name, h, k, r)   strmap_put_##name(h, k, r)
+#define strmap_del(name, h, k)      strmap_del_##name(h, k)
+#define strmap_destroy(name, h)     strmap_destroy_##name(h)
+
+#endif
+
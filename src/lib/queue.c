@@ -37,105 +37,146 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <assert.h>
+#include <stdbool.h>
 
-#define QUEUE_BYTES(q) ((q)->entry_size * (q)->capacity)
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+/* The capacity is always a power of two, so that the slot of the i'th 
+ * entry from the head is found by masking instead of a wraparound test. 
+ * The entries are the 'size' slots from 'head', wrapping around the end 
+ * of the buffer. */
 struct queue {
     size_t entry_size;
-    int capacity;
+    size_t mask;
+    size_t head;
     size_t size;
-    char *head;
-    char *tail;
-    char *mem;
+    bool   bounded;
+    char  *mem;
 };
 
-static int queue_resize(queue_t *queue, unsigned new_cap)
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t queue_capacity(const queue_t *queue)
+{
+    return queue->mask + 1;
+}
+
+static char *queue_slot(const queue_t *queue, size_t i)
 {
-    void *ret;
-    ptrdiff_t offhead, offtail;
-    offhead = queue->head - queue->mem;
-    offtail = queue->tail - queue->mem;
-
-    if(ret = realloc(queue->mem, queue->entry_size * new_cap)){
-        queue->mem = ret;
-        queue->head = queue->mem + offhead;
-        queue->tail = queue->mem + offtail;
-    }else{
+    return queue->mem + ((queue->head + i) & queue->mask) * queue->entry_size;
+}
+
+static size_t next_pow2(size_t n)
+{
+    size_t ret = 1;
+    while(ret < n)
+        ret <<= 1;
+    return ret;
+}
+
+/* Grow the buffer in place to the next power of two that fits 'min_cap' entries.
+ * If the entries wrap around the end of the old buffer, whichever of the two 
+ * runs is shorter is moved so that they are contiguous (modulo the new 
+ * capacity) again:
+ *
+ *   +-------+------+-------+              +-------+------+-------+-------------+
+ *   | run B |      | run A |   realloc    |       |      | run A | run B |     |
+ *   +-------+------+-------+   ------->   +-------+------+-------+-------------+
+ *                  ^head                                 ^head
+ *   or:
+ *                                         +-------+------+-------------+-------+
+ *                                         | run B |      |             | run A |
+ *                                         +-------+------+-------------+-------+
+ *                                                                      ^head
+ */
+static int queue_grow(queue_t *queue, size_t min_cap)
+{
+    if(queue->bounded)
         return -1;
-    }
-    queue->capacity = new_cap;
-
-    if(queue->head > queue->tail){
-        /*                       */
-        /* +-----+ <--mem    ^   */
-        /* |     |          top  */
-        /* |     |           |   */
-        /* +-----+ <--tail   |   */
-        /* +-----+           v   */
-        /* |     |               */
-        /* |     |               */
-        /* +-----+ <--head   ^   */
-        /* +-----+           |   */
-        /* |     |          bot  */
-        /* +-----+           v   */
-        /* | new |               */
-        /*                       */
-
-        assert(queue->tail >= queue->mem);
-        assert(queue->head >= queue->mem);
-        ptrdiff_t top = queue->tail + queue->entry_size - queue->mem;
-        ptrdiff_t bot = queue->mem + QUEUE_BYTES(queue) - queue->head;
-
-        char tmp[top];
-        memcpy(tmp, queue->mem, top);
-        memmove(queue->mem, queue->head, bot);
-        memcpy(queue->mem + bot, tmp, top);
-
-        queue->head = queue->mem;
-        queue->tail = queue->mem + bot;
+
+    size_t old_cap = queue_capacity(queue);
+    size_t new_cap = next_pow2(min_cap);
+    if(new_cap <= old_cap)
+        return 0;
+
+    char *mem = realloc(queue->mem, new_cap * queue->entry_size);
+    if(!mem)
+        return -1;
+    queue->mem = mem;
+
+    if(queue->head + queue->size > old_cap) {
+
+        size_t run_a = old_cap - queue->head;
+        size_t run_b = queue->size - run_a;
+
+        if(run_b <= run_a) {
+            memcpy(mem + old_cap * queue->entry_size, mem, run_b * queue->entry_size);
+        }else{
+            size_t new_head = new_cap - run_a;
+            memmove(mem + new_head * queue->entry_size, 
+                mem + queue->head * queue->entry_size, run_a * queue->entry_size);
+            queue->head = new_head;
+        }
     }
 
+    queue->mask = new_cap - 1;
     return 0;
 }
 
-queue_t *queue_init(size_t entry_size, int init_capacity)
+static queue_t *queue_create(size_t entry_size, int init_capacity, bool bounded)
 {
     queue_t *ret = malloc(sizeof(queue_t)); 
-    if(ret){
-        ret->mem = malloc(entry_size * init_capacity);
-        if(!ret->mem){
-            free(ret);
-            return NULL;
-        }
-        ret->entry_size = entry_size;
-        ret->capacity = init_capacity;
-        ret->head = ret->mem;
-        ret->tail = ret->mem - entry_size;
-        ret->size = 0;
+    if(!ret)
+        return NULL;
+
+    size_t capacity = next_pow2(init_capacity > 0 ? init_capacity : 1);
+    ret->mem = malloc(entry_size * capacity);
+    if(!ret->mem){
+        free(ret);
+        return NULL;
     }
+    ret->entry_size = entry_size;
+    ret->mask = capacity - 1;
+    ret->head = 0;
+    ret->size = 0;
+    ret->bounded = bounded;
     return ret;
 }
 
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+queue_t *queue_init(size_t entry_size, int init_capacity)
+{
+    return queue_create(entry_size, init_capacity, false);
+}
+
+queue_t *queue_init_bounded(size_t entry_size, int capacity)
+{
+    return queue_create(entry_size, capacity, true);
+}
+
 queue_t *queue_copy(const queue_t *queue)
 {
     queue_t *ret = malloc(sizeof(queue_t)); 
     if(!ret)
         return NULL;
 
-    ret->mem = malloc(queue->entry_size * queue->capacity);
+    ret->mem = malloc(queue->entry_size * queue_capacity(queue));
     if(!ret->mem){
         free(ret);
         return NULL;
     }
-    memcpy(ret->mem, queue->mem, queue->entry_size * queue->capacity);
+    memcpy(ret->mem, queue->mem, queue->entry_size * queue_capacity(queue));
     
-    ret->size = queue->size; 
-    ret->capacity = queue->capacity;
     ret->entry_size = queue->entry_size;
-    ret->head = ret->mem + (queue->head - queue->mem);
-    ret->tail = ret->mem + (queue->tail- queue->mem);
-
+    ret->mask = queue->mask;
+    ret->head = queue->head;
+    ret->size = queue->size; 
+    ret->bounded = queue->bounded;
     return ret;
 }
 
@@ -147,37 +188,45 @@ void queue_free(queue_t *queue)
 
 int queue_push(queue_t *queue, void *entry)
 {
-    if(queue->size == queue->capacity) {
-        if(queue_resize(queue, queue->capacity * 2))
+    return queue_push_n(queue, entry, 1);
+}
+
+int queue_push_n(queue_t *queue, const void *entries, size_t n)
+{
+    if(queue->size + n > queue_capacity(queue)) {
+        if(queue_grow(queue, queue->size + n))
             return -1;
     }
 
-    queue->tail += queue->entry_size;
-    /* Wrap around back to top */
-    if(queue->tail >= queue->mem + QUEUE_BYTES(queue)) {
-        queue->tail = queue->mem;    
-    }
+    /* The free slots are at most two runs: up to the end of the buffer, 
+     * then from its' start */
+    size_t tail = (queue->head + queue->size) & queue->mask;
+    size_t first = MIN(n, queue_capacity(queue) - tail);
 
-    assert(queue->tail >= queue->mem && queue->tail < queue->mem + QUEUE_BYTES(queue));
-    memcpy(queue->tail, entry, queue->entry_size);
-    queue->size++;
+    memcpy(queue->mem + tail * queue->entry_size, entries, first * queue->entry_size);
+    memcpy(queue->mem, (const char*)entries + first * queue->entry_size, 
+        (n - first) * queue->entry_size);
+
+    queue->size += n;
     return 0;
 }
 
 int queue_pop(queue_t *queue, void *out)
 {
-    if(queue->size == 0)
-        return -1;
+    return queue_pop_n(queue, out, 1) ? 0 : -1;
+}
 
-    assert(queue->head>= queue->mem && queue->head < queue->mem + QUEUE_BYTES(queue));
-    memcpy(out, queue->head, queue->entry_size);
-    queue->head += queue->entry_size;
-    /*Wrap around back to top */
-    if(queue->head >= queue->mem + QUEUE_BYTES(queue)) {
-        queue->head = queue->mem;
-    }
-    queue->size--;
-    return 0;
+size_t queue_pop_n(queue_t *queue, void *out, size_t max)
+{
+    size_t n = MIN(max, queue->size);
+    size_t first = MIN(n, queue_capacity(queue) - queue->head);
+
+    memcpy(out, queue->mem + queue->head * queue->entry_size, first * queue->entry_size);
+    memcpy((char*)out + first * queue->entry_size, queue->mem, (n - first) * queue->entry_size);
+
+    queue->head = (queue->head + n) & queue->mask;
+    queue->size -= n;
+    return n;
 }
 
 size_t queue_get_size(queue_t *queue)
@@ -185,3 +234,10 @@ size_t queue_get_size(queue_t *queue)
     return queue->size;
 }
 
+void *queue_back(queue_t *queue)
+{
+    if(queue->size == 0)
+        return NULL;
+    return queue_slot(queue, queue->size - 1);
+}
+
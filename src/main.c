@@ -35,14 +35,25 @@
 
 #include "asset_load.h"
 #include "config.h"
+#include "camera.h"
 #include "cursor.h"
 #include "render/public/render.h"
+#include "anim/public/anim.h"
 #include "lib/public/stb_image.h"
 #include "lib/public/kvec.h"
 #include "script/public/script.h"
 #include "game/public/game.h"
 #include "navigation/public/nav.h"
 #include "event.h"
+#include "hot_reload.h"
+#include "telemetry.h"
+#include "mem.h"
+#include "parallel.h"
+#include "pace.h"
+#include "perf.h"
+#include "replay.h"
+#include "net.h"
+#include "plugin.h"
 #include "ui.h"
 
 #include <GL/glew.h>
@@ -52,6 +63,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 #if defined(_WIN32)
     #include <windows.h>
@@ -62,6 +74,10 @@
 #define PF_VER_MINOR 24
 #define PF_VER_PATCH 0
 
+/* Length of the base simulation step, from which all the timer events are derived */
+#define SIM_STEP_MS  (1000.0 / 60.0)
+#define MAX_PLUGINS  (8)
+
 /*****************************************************************************/
 /* GLOBAL VARIABLES                                                          */
 /*****************************************************************************/
@@ -79,6 +95,9 @@ static SDL_Window         *s_window;
 static SDL_GLContext       s_context;
 
 static bool                s_quit = false; 
+/* Whether the frames are drawn on the render thread, while the main thread
+ * takes the next simulation steps */
+static bool                s_pipelined = false;
 static kvec_t(SDL_Event)   s_prev_tick_events;
 
 static struct nk_context  *s_nk_ctx;
@@ -87,20 +106,32 @@ static struct nk_context  *s_nk_ctx;
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void process_sdl_events(void)
+/* During playback, the live input is dropped and the recorded events of the 
+ * frame are handled instead. */
+static void process_sdl_events(const SDL_Event *replayed, size_t num_replayed)
 {
+    PERF_ENTER();
     UI_InputBegin(s_nk_ctx);
 
     kv_reset(s_prev_tick_events);
     SDL_Event event;    
    
     while(SDL_PollEvent(&event)) {
+        if(!Replay_Playing())
+            kv_push(SDL_Event, s_prev_tick_events, event);
+    }
 
-        UI_HandleEvent(&event);
+    for(int i = 0; i < num_replayed; i++)
+        kv_push(SDL_Event, s_prev_tick_events, replayed[i]);
+
+    /* The queued events point into the buffer, so they are only queued once 
+     * it is done growing */
+    for(int i = 0; i < kv_size(s_prev_tick_events); i++) {
 
-        kv_push(SDL_Event, s_prev_tick_events, event);
-        E_Global_Notify(event.type, &kv_A(s_prev_tick_events, kv_size(s_prev_tick_events)-1), 
-            ES_ENGINE);
+        event = kv_A(s_prev_tick_events, i);
+        UI_HandleEvent(&event);
+        Pace_HandleEvent(&event);
+        E_Global_Notify(event.type, &kv_A(s_prev_tick_events, i), ES_ENGINE);
 
         switch(event.type) {
 
@@ -108,7 +139,10 @@ static void process_sdl_events(void)
 
             switch(event.window.event) {
             case SDL_WINDOWEVENT_RESIZED:
+#if !defined(PF_HEADLESS)
                 glViewport(0, 0, event.window.data1, event.window.data2);
+#endif
+                Camera_SetViewportSize(event.window.data1, event.window.data2);
                 break;
             }
             break;
@@ -120,15 +154,11 @@ static void process_sdl_events(void)
             }
             break;
 
-        case SDL_USEREVENT:
-            switch(event.user.code) {
-            case 0: E_Global_Notify(EVENT_60HZ_TICK, NULL, ES_ENGINE); break;
-            }
-            break;
         }
     }
 
     UI_InputEnd(s_nk_ctx);
+    PERF_RETURN();
 }
 
 static void on_user_quit(void *user, void *event)
@@ -139,45 +169,106 @@ static void on_user_quit(void *user, void *event)
     s_quit = true;
 }
 
+#if defined(PF_HEADLESS)
+
+/* There is nothing to draw to, so the frame's UI is just dropped */
+static void render(float step_frac)
+{
+    UI_Discard();
+}
+
+#else
+
 static void gl_set_globals(void)
 {
     glEnable(GL_DEPTH_TEST);
 }
 
-static void render(void)
+static void render_clear(const void *unused)
 {
-    SDL_GL_MakeCurrent(s_window, s_context); 
-
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
     /* Restore OpenGL global state after it's been clobbered by nuklear */
     gl_set_globals(); 
+}
 
-    G_Render();
+static void render_swap(const void *unused)
+{
+    SDL_GL_SwapWindow(s_window);
+}
+
+static void render(float step_frac)
+{
+    PERF_ENTER();
+    R_Thread_BeginFrame();
+
+    R_Thread_Push(render_clear, NULL, 0);
+    R_GL_BeginFrame();
+    A_TickClock();
+    G_Render(step_frac);
+
+    R_GL_PassBegin(GPU_PASS_UI);
     UI_Render();
+    R_GL_PassEnd(GPU_PASS_UI);
+    R_Thread_Push(render_swap, NULL, 0);
 
-    SDL_GL_SwapWindow(s_window);
+    R_Thread_SubmitFrame();
+    PERF_RETURN();
 }
 
-static bool engine_init(char **argv)
+#endif
+
+/* Returns the number of fixed steps needed for the simulation to catch up 
+ * with real time, leaving the remainder in 'accum_ms' */
+static int sim_steps_due(double *accum_ms, uint64_t *last_step_ts)
 {
-    bool result = true;
+    uint64_t curr_step_ts = SDL_GetPerformanceCounter();
+    *accum_ms += (curr_step_ts - *last_step_ts) * 1000.0 / SDL_GetPerformanceFrequency();
+    *last_step_ts = curr_step_ts;
+
+    int num_steps = 0;
+    while(*accum_ms >= SIM_STEP_MS && num_steps < CONFIG_MAX_SIM_STEPS) {
+        *accum_ms -= SIM_STEP_MS;
+        num_steps++;
+    }
 
-    kv_init(s_prev_tick_events);
-    if(!kv_resize(SDL_Event, s_prev_tick_events, 256))
-        return false;
+    /* When we are too far behind, drop the backlog rather than having 
+     * it grow further. */
+    if(*accum_ms >= SIM_STEP_MS)
+        *accum_ms = fmod(*accum_ms, SIM_STEP_MS);
 
-    /* ----------------------------------- */
-    /* SDL Initialization                  */
-    /* ----------------------------------- */
-    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
-        result = false;
-        goto fail_sdl;
+    return num_steps;
+}
+
+/* Returns the number of steps taken, which is fewer than asked for when a
+ * lockstep session is waiting on its' peers */
+static int sim_steps_run(int num_steps)
+{
+    for(int i = 0; i < num_steps; i++) {
+
+        if(!Net_StepBegin())
+            return i;
+        E_Global_NotifyImmediate(EVENT_60HZ_TICK, NULL, ES_ENGINE);
     }
+    return num_steps;
+}
 
+/* A hidden window is never drawn to, but there is still a GL context for 
+ * loading the assets. The headless build has neither, and only needs SDL for
+ * its' timers and events. */
+static bool window_init(bool hidden)
+{
+#if defined(PF_HEADLESS)
+    return (SDL_Init(SDL_INIT_TIMER | SDL_INIT_EVENTS) == 0);
+#else
+    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0)
+        return false;
+
+    /* A 4.3 context is asked for first, for the compute shaders of the GPU
+     * culling. Everything else only needs 3.3. */
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
     SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
 
@@ -194,10 +285,15 @@ static bool engine_init(char **argv)
         SDL_WINDOWPOS_UNDEFINED,
         CONFIG_RES_X, 
         CONFIG_RES_Y, 
-        SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN | CONFIG_WINDOWFLAGS);
+        SDL_WINDOW_OPENGL | (hidden ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN) | CONFIG_WINDOWFLAGS);
 
     s_context = SDL_GL_CreateContext(s_window); 
-    SDL_GL_SetSwapInterval(CONFIG_VSYNC ? 1 : 0); 
+    if(!s_context) {
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        s_context = SDL_GL_CreateContext(s_window); 
+    }
+    SDL_GL_SetSwapInterval((CONFIG_VSYNC && !hidden) ? 1 : 0); 
 
     /* ----------------------------------- */
     /* GLEW initialization                 */
@@ -211,78 +307,171 @@ static bool engine_init(char **argv)
 
     glViewport(0, 0, CONFIG_RES_X, CONFIG_RES_Y);
     glProvokingVertex(GL_FIRST_VERTEX_CONVENTION); 
+    return true;
+
+fail_glew:
+    SDL_GL_DeleteContext(s_context);
+    SDL_DestroyWindow(s_window);
+    SDL_Quit();
+    return false;
+#endif
+}
+
+static bool engine_init(char **argv, bool headless)
+{
+    bool result = true;
+
+    kv_init(s_prev_tick_events);
+    if(!kv_resize(SDL_Event, s_prev_tick_events, 256))
+        return false;
+
+    /* ----------------------------------- */
+    /* SDL Initialization                  */
+    /* ----------------------------------- */
+    Perf_StartupPush("SDL and GL setup", NULL);
+    if(!window_init(headless)) {
+        result = false;
+        goto fail_sdl;
+    }
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* stb_image initialization            */
     /* ----------------------------------- */
     stbi_set_flip_vertically_on_load(true);
 
+    /* ----------------------------------- */
+    /* Memory arenas initialization        */
+    /* ----------------------------------- */
+    Perf_StartupPush("MEM_Init", NULL);
+    if(!MEM_Init())
+        goto fail_mem;
+    Perf_StartupPop();
+
+    /* ----------------------------------- */
+    /* Hot reloading initialization        */
+    /* ----------------------------------- */
+    Perf_StartupPush("HR_Init", NULL);
+    if(!HR_Init())
+        goto fail_hr;
+    Perf_StartupPop();
+
     /* ----------------------------------- */
     /* Asset Loading initialization        */
     /* ----------------------------------- */
+    Perf_StartupPush("AL_Init", NULL);
     if(!AL_Init())
         goto fail_al;
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* Cursor initialization               */
     /* ----------------------------------- */
+    Perf_StartupPush("Cursor_InitAll", NULL);
     if(!Cursor_InitAll(argv[1]))
         goto fail_cursor;
+    Perf_StartupPop();
     Cursor_SetActive(CURSOR_POINTER);
 
     /* ----------------------------------- */
     /* Rendering subsystem initialization  */
     /* ----------------------------------- */
+    Perf_StartupPush("R_Init", NULL);
     if(!R_Init(argv[1]))
         goto fail_render;
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* Event subsystem intialization       */
     /* ----------------------------------- */
+    Perf_StartupPush("E_Init", NULL);
     if(!E_Init())
         goto fail_event;
+    Perf_StartupPop();
     Cursor_SetRTSMode(true);
     E_Global_Register(SDL_QUIT, on_user_quit, NULL);
 
     /* ----------------------------------- */
     /* nuklear initialization              */
     /* ----------------------------------- */
+    Perf_StartupPush("UI_Init", NULL);
     if( !(s_nk_ctx = UI_Init(argv[1], s_window)) ) 
         goto fail_nuklear;
+    Perf_StartupPop();
+
+    /* ----------------------------------- */
+    /* Profiler initialization             */
+    /*  * depends on Event subsystem       */
+    /* ----------------------------------- */
+    Perf_StartupPush("Perf_Init", NULL);
+    if(!Perf_Init(s_nk_ctx))
+        goto fail_perf;
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* Scripting subsystem initialization  */
     /* ----------------------------------- */
+    Perf_StartupPush("S_Init", NULL);
     if(!S_Init(argv[0], argv[1], s_nk_ctx))
         goto fail_script;
+    Perf_StartupPop();
+
+    /* ----------------------------------- */
+    /* Worker pool initialization          */
+    /* ----------------------------------- */
+    Perf_StartupPush("PL_Init", NULL);
+    if(!PL_Init())
+        goto fail_parallel;
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* Game state initialization           */
     /*  * depends on Event subsystem       */
     /* -----------------------------------*/
+    Perf_StartupPush("G_Init", NULL);
     if(!G_Init())
         goto fail_game;
+    Perf_StartupPop();
 
     /* ----------------------------------- */
     /* Navigation subsystem initialization */
     /* ----------------------------------- */
+    Perf_StartupPush("N_Init", NULL);
     if(!N_Init())
         goto fail_nav;
+    Perf_StartupPop();
+
+    /* ----------------------------------- */
+    /* Plugin subsystem initialization     */
+    /*  * depends on Event subsystem       */
+    /* ----------------------------------- */
+    if(!Plugin_Init())
+        goto fail_plugin;
 
     return true;
 
+fail_plugin:
+    N_Shutdown();
 fail_nav:
     G_Shutdown();
 fail_game:
+    PL_Shutdown();
+fail_parallel:
 fail_script:
+    Perf_Shutdown();
+fail_perf:
 fail_nuklear:
 fail_event:
+    R_Shutdown();
 fail_render:
     Cursor_FreeAll();
 fail_cursor:
     UI_Shutdown();
 fail_al:
-fail_glew:
+    HR_Shutdown();
+fail_hr:
+    MEM_Shutdown();
+fail_mem:
     SDL_GL_DeleteContext(s_context);
     SDL_DestroyWindow(s_window);
     SDL_Quit();
@@ -292,6 +481,11 @@ fail_sdl:
 
 static void engine_shutdown(void)
 {
+    R_Thread_Stop();
+    Net_Stop();
+    /* The plugins may still have handlers registered for the events that 
+     * get sent during the shutdown of the other subsystems */
+    Plugin_Shutdown();
     N_Shutdown();
     S_Shutdown();
 
@@ -301,10 +495,15 @@ static void engine_shutdown(void)
      * 'G_' API to remove them from the world.
      */
     G_Shutdown(); 
+    PL_Shutdown();
     Cursor_FreeAll();
     AL_Shutdown();
+    Perf_Shutdown();
     UI_Shutdown();
     E_Shutdown();
+    R_Shutdown();
+    HR_Shutdown();
+    MEM_Shutdown();
 
     kv_destroy(s_prev_tick_events);
 
@@ -342,35 +541,187 @@ int main(int argc, char **argv)
 
     int ret = EXIT_SUCCESS;
 
-    if(argc != 3) {
-        printf("Usage: %s [base directory path (which contains 'assets' and 'shaders' folders)] [script path]\n", argv[0]);
+    /* Everything from here on until the first frame is drawn is traced */
+    Perf_StartupBegin();
+
+    const char *record_path = NULL, *replay_path = NULL, *startup_trace_path = NULL;
+    const char *telemetry_path = NULL;
+    const char *plugin_paths[MAX_PLUGINS];
+    int num_plugins = 0;
+    bool max_speed = false;
+    bool args_ok = (argc >= 3 && argc % 2 == 1);
+
+    for(int i = 3; args_ok && i + 1 < argc; i += 2) {
+
+        if(0 == strcmp(argv[i], "--record"))
+            record_path = argv[i + 1];
+        else if(0 == strcmp(argv[i], "--replay"))
+            replay_path = argv[i + 1];
+        else if(0 == strcmp(argv[i], "--startup-trace"))
+            startup_trace_path = argv[i + 1];
+        else if(0 == strcmp(argv[i], "--telemetry"))
+            telemetry_path = argv[i + 1];
+        else if(0 == strcmp(argv[i], "--plugin") && num_plugins < MAX_PLUGINS)
+            plugin_paths[num_plugins++] = argv[i + 1];
+        else if(0 == strcmp(argv[i], "--sim-speed") && 0 == strcmp(argv[i + 1], "max"))
+            max_speed = true;
+        else if(0 == strcmp(argv[i], "--sim-speed") && 0 == strcmp(argv[i + 1], "realtime"))
+            max_speed = false;
+        else
+            args_ok = false;
+    }
+
+    bool record = (record_path != NULL);
+    bool replay = (replay_path != NULL);
+
+    if(!args_ok || (record && replay)) {
+        printf("Usage: %s [base directory path (which contains 'assets' and 'shaders' folders)] [script path] "
+            "[--record|--replay recording path] [--startup-trace trace path] [--telemetry CSV path] "
+            "[--plugin shared library path]... [--sim-speed realtime|max]\n", argv[0]);
         ret = EXIT_FAILURE;
         goto fail_args;
     }
 
     g_basepath = argv[1];
 
-    if(!engine_init(argv)) {
+    Perf_StartupPush("engine_init", NULL);
+    bool init = engine_init(argv, replay);
+    Perf_StartupPop();
+
+    if(!init) {
         ret = EXIT_FAILURE; 
         goto fail_init;
     }
 
+    /* The recording starts before the script is run, as the script may 
+     * already register for input events. */
+    if((record && !Replay_StartRecording(record_path))
+    || (replay && !Replay_StartPlayback(replay_path))) {
+        ret = EXIT_FAILURE;
+        goto fail_replay;
+    }
+
+    if(telemetry_path && !Telemetry_Start(telemetry_path)) {
+        ret = EXIT_FAILURE;
+        goto fail_telemetry;
+    }
+
+    /* The plugins are loaded before the script is run, so that the script 
+     * can already make use of the events and components they provide */
+    for(int i = 0; i < num_plugins; i++) {
+        if(!Plugin_Load(plugin_paths[i])) {
+            ret = EXIT_FAILURE;
+            goto fail_plugin;
+        }
+    }
+
+    Perf_StartupPush("S_RunFile", NULL);
     S_RunFile(argv[2]);
+    Perf_StartupPop();
+
+    /* Recordings keep the steps in the same place in the frame as playback. 
+     * Without the render thread, the frames are just drawn in place. */
+    if(CONFIG_PIPELINED_RENDER && !record && !replay && !max_speed)
+        s_pipelined = R_Thread_Start(s_window, s_context);
+
+    /* Played back sessions run as fast as possible */
+    Pace_SetEnabled(!replay && !max_speed);
 
     uint32_t last_ts = SDL_GetTicks();
+    uint64_t last_step_ts = SDL_GetPerformanceCounter();
+    double accum_ms = 0.0;
+    bool first_frame = true;
+    Perf_StartupPush("first frame", NULL);
+
     while(!s_quit) {
 
-        process_sdl_events();
+        const SDL_Event *replayed = NULL;
+        size_t num_replayed = 0;
+        int replay_steps = 0;
+
+        /* The events may be handled with GL calls and UI updates, which have
+         * to wait for the last frame to be drawn */
+        S_AI_WindowOpen();
+        R_Thread_Claim();
+        S_AI_WindowClose();
+
+        if(Replay_Playing() && !Replay_NextFrame(&replayed, &num_replayed, &replay_steps))
+            break;
+
+        process_sdl_events(replayed, num_replayed);
         E_ServiceQueue();
-        G_Update();
-        render();
+        PL_RunMainJobs();
+        HR_Update();
+        Net_Update();
+
+        int num_steps = 0;
+        if(Replay_Playing()) {
+
+            /* Take the same steps as the recorded frame, as fast as possible */
+            for(; num_steps < replay_steps; num_steps++) {
+
+                uint64_t begin = SDL_GetPerformanceCounter();
+                E_Global_NotifyImmediate(EVENT_60HZ_TICK, NULL, ES_ENGINE);
+                Replay_LogStep(SDL_GetPerformanceCounter() - begin);
+            }
+
+            uint64_t begin = SDL_GetPerformanceCounter();
+            G_Update();
+            Replay_LogUpdate(SDL_GetPerformanceCounter() - begin);
+            UI_Discard();
+
+        }else if(max_speed) {
+
+            /* A single step every frame, without waiting for real time to 
+             * catch up with the simulation */
+            num_steps = sim_steps_run(1);
+            G_Update();
+            render(0.0f);
+
+        }else if(s_pipelined) {
+
+            /* The frame is drawn in the state left by the last frame's steps,
+             * while the steps for the next one are taken */
+            num_steps = sim_steps_due(&accum_ms, &last_step_ts);
+            G_Update();
+            render(accum_ms / SIM_STEP_MS);
+            num_steps = sim_steps_run(num_steps);
+
+        }else{
+
+            /* Advance the simulation in fixed steps to catch up with real time */
+            num_steps = sim_steps_due(&accum_ms, &last_step_ts);
+            num_steps = sim_steps_run(num_steps);
+            G_Update();
+            render(accum_ms / SIM_STEP_MS);
+        }
+
+        Replay_RecordFrame(s_prev_tick_events.a, kv_size(s_prev_tick_events), num_steps);
+        S_AI_WindowOpen();
+        Pace_FrameEnd();
+        S_AI_WindowClose();
 
         uint32_t curr_time = SDL_GetTicks();
         g_last_frame_ms = curr_time - last_ts;
         last_ts = curr_time;
+        Perf_FrameEnd();
+        Telemetry_FrameEnd();
+        MEM_FrameEnd();
+
+        if(first_frame) {
+            Perf_StartupPop();
+            Perf_StartupEnd(startup_trace_path);
+            first_frame = false;
+        }
 
     }
 
+fail_plugin:
+    Telemetry_Stop();
+fail_telemetry:
+    Replay_StopPlayback();
+    Replay_StopRecording();
+fail_replay:
     engine_shutdown();
 fail_init:
 fail_args:
@@ -40,22 +40,575 @@
 #include "pfchunk.h"
 #include "../camera.h"
 #include "../collision.h"
+#include "../perf.h"
+#include "../config.h"
+#include "../parallel.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <assert.h>
 
 #include <SDL.h>
 
 #define MIN(a, b)           ((a) < (b) ? (a) : (b))
 #define MAX(a, b)           ((a) > (b) ? (a) : (b))
-
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+#define HEIGHT_BATCH_SIZE   (64)
+/* The vertices of this many chunks are built at a time when streaming */
+#define STREAM_BATCH        (16)
+/* The camera's path is predicted at this many points in time, evenly spread
+ * over CONFIG_STREAM_PREFETCH_MS */
+#define PREFETCH_STEPS      (4)
+/* The camera moving further than this many chunks in one frame has jumped
+ * there, and its' velocity is not carried on with */
+#define PREFETCH_JUMP_CHUNKS (2.0f)
+/* A click on the minimap could come at any time, so the chunks around the
+ * spot under the cursor are given a fixed time until they are seen */
+#define PREFETCH_HOVER_MS   (CONFIG_STREAM_PREFETCH_MS / 2)
+/* Weight of the latest frame's motion in the camera's velocity */
+#define PREFETCH_SMOOTHING  (0.5f)
+
+struct chunk_dist{
+    float  dist;
+    size_t idx;
+};
+
+struct chunk_age{
+    uint32_t last_used;
+    size_t   idx;
+};
+
+struct stream_batch{
+    const struct map *map;
+    const size_t     *chunks;
+    char             *verts;
+};
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void m_aabb_for_chunk(const struct map *map, struct chunkpos p, struct aabb *out)
+/* 'r' and 'c' are tile coordinates relative to the top left corner of the map */
+static float m_tile_height(const struct map *map, int r, int c, float frac_w, float frac_h)
+{
+    if(map->heightfield) {
+
+        const struct tile_heights *hf = &map->heightfield[r * (map->width * TILES_PER_CHUNK_WIDTH) + c];
+        switch(hf->kind) {
+        case TILE_HEIGHT_FLAT: 
+            return hf->nw;
+        case TILE_HEIGHT_RAMP: 
+            return PFM_BilinearInterp(hf->nw, hf->sw, hf->ne, hf->se, 
+                0.0f, 1.0f, 0.0f, 1.0f, frac_w, frac_h);
+        default: 
+            break;
+        }
+    }
+
+    const struct pfchunk *chunk = &map->chunks[(r / TILES_PER_CHUNK_HEIGHT) * map->width 
+                                               + (c / TILES_PER_CHUNK_WIDTH)];
+    const struct tile *tile = &chunk->tiles[(r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                                            + (c % TILES_PER_CHUNK_WIDTH)];
+    return M_Tile_HeightAtPos(tile, frac_w, frac_h);
+}
+
+/* Fills in the subtree for the chunk range in preorder, starting at index '*inout_count'. 
+ * Returns the index of the subtree root. */
+static int m_cull_tree_build(const struct map *map, struct chunk_cull_node *nodes, size_t *inout_count,
+                             int r_min, int c_min, int r_max, int c_max)
+{
+    int idx = (*inout_count)++;
+    struct chunk_cull_node *node = &nodes[idx];
+
+    node->r_min = r_min;
+    node->c_min = c_min;
+    node->r_max = r_max;
+    node->c_max = c_max;
+
+    if(r_max - r_min == 1 && c_max - c_min == 1) {
+
+        M_AABBForChunk(map, (struct chunkpos){r_min, c_min}, &node->box);
+        for(int i = 0; i < 4; i++)
+            node->children[i] = -1;
+        return idx;
+    }
+
+    int r_mid = (r_min + r_max) / 2;
+    int c_mid = (c_min + c_max) / 2;
+    const int ranges[4][4] = {
+        {r_min, c_min, r_mid, c_mid},
+        {r_min, c_mid, r_mid, c_max},
+        {r_mid, c_min, r_max, c_mid},
+        {r_mid, c_mid, r_max, c_max},
+    };
+
+    bool first = true;
+    for(int i = 0; i < 4; i++) {
+
+        /* Ranges that are one chunk wide or high only split in the other dimension */
+        if(ranges[i][0] == ranges[i][2] || ranges[i][1] == ranges[i][3]) {
+            nodes[idx].children[i] = -1;
+            continue;
+        }
+
+        int child = m_cull_tree_build(map, nodes, inout_count, 
+            ranges[i][0], ranges[i][1], ranges[i][2], ranges[i][3]);
+        nodes[idx].children[i] = child;
+
+        const struct aabb *cbox = &nodes[child].box;
+        struct aabb *box = &nodes[idx].box;
+
+        if(first) {
+            *box = *cbox;
+            first = false;
+            continue;
+        }
+        box->x_min = MIN(box->x_min, cbox->x_min);
+        box->x_max = MAX(box->x_max, cbox->x_max);
+        box->y_min = MIN(box->y_min, cbox->y_min);
+        box->y_max = MAX(box->y_max, cbox->y_max);
+        box->z_min = MIN(box->z_min, cbox->z_min);
+        box->z_max = MAX(box->z_max, cbox->z_max);
+    }
+    return idx;
+}
+
+/* Appends the indices of the visible chunks under the node, which is known to 
+ * intersect the frustum, to 'out'. A box that doesn't intersect the frustum 
+ * can't have any children that do, so whole subtrees are skipped after a 
+ * single test.
+ *
+ * Due to the nature of the the map (perfect grid), the fast and greedy frustrum 
+ * intersection test will yield too many false positives. As each chunk mesh has 
+ * a high vertex count, this is undesirable. It is absolutely worth it to do the 
+ * precise frustrum intersection test. With it, the map rendering performance
+ * scales great for large maps. The fast test is still done first, for all the 
+ * children at once, as it cheaply rejects most of the boxes that are outside. */
+static void m_cull_tree_visit(const struct map *map, const struct frustum *frustum, 
+                              int idx, size_t *out, size_t *inout_count)
+{
+    const struct chunk_cull_node *node = &map->cull_tree[idx];
+
+    if(node->r_max - node->r_min == 1 && node->c_max - node->c_min == 1) {
+        out[(*inout_count)++] = node->r_min * map->width + node->c_min;
+        return;
+    }
+
+    float center[3][4], half[3][4];
+    int children[4];
+    int nchildren = 0;
+
+    for(int i = 0; i < 4; i++) {
+
+        if(node->children[i] < 0)
+            continue;
+
+        const struct aabb *box = &map->cull_tree[node->children[i]].box;
+        center[0][nchildren] = (box->x_min + box->x_max) / 2.0f;
+        center[1][nchildren] = (box->y_min + box->y_max) / 2.0f;
+        center[2][nchildren] = (box->z_min + box->z_max) / 2.0f;
+        half[0][nchildren] = (box->x_max - box->x_min) / 2.0f;
+        half[1][nchildren] = (box->y_max - box->y_min) / 2.0f;
+        half[2][nchildren] = (box->z_max - box->z_min) / 2.0f;
+        children[nchildren++] = node->children[i];
+    }
+
+    uint32_t mask;
+    C_FrustumAABBsCull(frustum, nchildren, (const float *const[3]){center[0], center[1], center[2]},
+        (const float *const[3]){half[0], half[1], half[2]}, &mask);
+
+    for(int i = 0; i < nchildren; i++) {
+
+        if(!(mask & (1u << i)))
+            continue;
+        if(!C_FrustumAABBIntersectionExact(frustum, &map->cull_tree[children[i]].box))
+            continue;
+        m_cull_tree_visit(map, frustum, children[i], out, inout_count);
+    }
+}
+
+/* Writes the row-major indices of the chunks intersecting the frustum to 'out',
+ * which must have room for all the chunks of the map. Returns the count. */
+static size_t m_frustum_chunks(const struct map *map, const struct frustum *frustum, size_t *out)
+{
+    size_t ret = 0;
+    if(map->cull_tree) {
+        if(C_FrustumAABBIntersectionExact(frustum, &map->cull_tree[0].box))
+            m_cull_tree_visit(map, frustum, 0, out, &ret);
+        return ret;
+    }
+
+    const size_t nchunks = map->width * map->height;
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return 0;
+    struct arena_mark mark = arena_mark(arena);
+
+    float *soa = arena_alloc(arena, 6 * nchunks * sizeof(float));
+    uint32_t *mask = arena_alloc(arena, (nchunks + 31) / 32 * sizeof(uint32_t));
+    struct aabb *chunk_aabbs = arena_alloc(arena, nchunks * sizeof(struct aabb));
+    if(!soa || !mask || !chunk_aabbs) {
+        arena_rewind(arena, mark);
+        return 0;
+    }
+    float *center[3] = {soa + 0 * nchunks, soa + 1 * nchunks, soa + 2 * nchunks};
+    float *half[3]   = {soa + 3 * nchunks, soa + 4 * nchunks, soa + 5 * nchunks};
+
+    for(int i = 0; i < nchunks; i++) {
+
+        const struct aabb *box = &chunk_aabbs[i];
+        M_AABBForChunk(map, (struct chunkpos) {i / map->width, i % map->width}, &chunk_aabbs[i]);
+
+        center[0][i] = (box->x_min + box->x_max) / 2.0f;
+        center[1][i] = (box->y_min + box->y_max) / 2.0f;
+        center[2][i] = (box->z_min + box->z_max) / 2.0f;
+        half[0][i] = (box->x_max - box->x_min) / 2.0f;
+        half[1][i] = (box->y_max - box->y_min) / 2.0f;
+        half[2][i] = (box->z_max - box->z_min) / 2.0f;
+    }
+
+    C_FrustumAABBsCull(frustum, nchunks, (const float *const[3]){center[0], center[1], center[2]},
+        (const float *const[3]){half[0], half[1], half[2]}, mask);
+
+    for(int i = 0; i < nchunks; i++) {
+
+        if(!(mask[i / 32] & (1u << (i % 32))))
+            continue;
+        if(C_FrustumAABBIntersectionExact(frustum, &chunk_aabbs[i]))
+            out[ret++] = i;
+    }
+
+    arena_rewind(arena, mark);
+    return ret;
+}
+
+static size_t m_visible_chunks(const struct map *map, const struct camera *cam, size_t *out)
+{
+    return m_frustum_chunks(map, &Camera_GetState(cam)->frustum, out);
+}
+
+/* Distance from 'pos' to the closest point of the box - zero when inside it */
+static float m_dist_to_aabb(const struct aabb *box, vec3_t pos)
+{
+    float dx = MAX(MAX(box->x_min - pos.x, 0.0f), pos.x - box->x_max);
+    float dy = MAX(MAX(box->y_min - pos.y, 0.0f), pos.y - box->y_max);
+    float dz = MAX(MAX(box->z_min - pos.z, 0.0f), pos.z - box->z_max);
+    return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+static int m_compare_chunk_dists(const void *a, const void *b)
+{
+    float da = ((const struct chunk_dist*)a)->dist;
+    float db = ((const struct chunk_dist*)b)->dist;
+    return (da > db) - (da < db);
+}
+
+/* Nearer chunks are drawn first, so that more of the fragments hidden 
+ * behind them fail the early depth test */
+static void m_sort_front_to_back(const struct map *map, vec3_t cam_pos, size_t *chunks, size_t count)
+{
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    /* Left unsorted - the order is only an optimization */
+    struct chunk_dist *dists = arena_alloc(arena, count * sizeof(struct chunk_dist));
+    if(!dists) {
+        arena_rewind(arena, mark);
+        return;
+    }
+
+    for(int i = 0; i < count; i++) {
+
+        struct aabb box;
+        M_AABBForChunk(map, (struct chunkpos) {chunks[i] / map->width, chunks[i] % map->width}, &box);
+        dists[i] = (struct chunk_dist){m_dist_to_aabb(&box, cam_pos), chunks[i]};
+    }
+
+    qsort(dists, count, sizeof(struct chunk_dist), m_compare_chunk_dists);
+    for(int i = 0; i < count; i++)
+        chunks[i] = dists[i].idx;
+
+    arena_rewind(arena, mark);
+}
+
+/* Renders the top-down texture of the chunk - the first step of baking it */
+static void *m_bake_begin(struct map *map, int chunk_r, int chunk_c)
+{
+    struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
+
+    ssize_t x_offset = -(chunk_c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
+    ssize_t z_offset =  (chunk_r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
+    vec3_t chunk_pos = (vec3_t) {map->pos.x + x_offset, map->pos.y, map->pos.z + z_offset};
+
+    mat4x4_t chunk_model;
+    PFM_Mat4x4_MakeTrans(chunk_pos.x, chunk_pos.y, chunk_pos.z, &chunk_model);
+
+    vec3_t chunk_center = (vec3_t) {
+        chunk_pos.x - (TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE)/2.0f,
+        chunk_pos.y,
+        chunk_pos.z + (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE)/2.0f
+    };
+
+    char cache_path[sizeof(map->cache_path) + 32];
+    snprintf(cache_path, sizeof(cache_path), "%s.%d.%d.pfbake", map->cache_path, chunk_r, chunk_c);
+
+    return R_GL_TileBakeBegin(chunk->render_private_tiles, chunk_center, &chunk_model,
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk->tiles, chunk_r, chunk_c,
+        strlen(map->cache_path) ? cache_path : NULL);
+}
+
+static void m_bake_build_task(void *arg, size_t idx)
+{
+    void **bakes = arg;
+    if(bakes[idx])
+        R_GL_TileBakeBuild(bakes[idx]);
+}
+
+/* Uploads the baked meshes and switches the chunk over to them. On failure, the 
+ * chunk is left in its current mode, or blended if it was drawn baked. */
+static void m_bake_finish(struct map *map, size_t idx, void *bake)
+{
+    struct pfchunk *chunk = &map->chunks[idx];
+    chunk->bake_failed = true;
+    if(!bake)
+        return;
+
+    /* The baked texture is named after the chunk, so the old one must go first */
+    M_DropBake(map, idx);
+    if(chunk->mode == CHUNK_RENDER_MODE_PREBAKED)
+        chunk->mode = CHUNK_RENDER_MODE_REALTIME_BLEND;
+
+    void *lod;
+    void *baked = R_GL_TileBakeFinish(bake, &lod);
+    if(!baked)
+        return;
+
+    chunk->bake_failed = false;
+    chunk->render_private_prebaked = baked;
+    chunk->render_private_lod = lod;
+    chunk->mode = CHUNK_RENDER_MODE_PREBAKED;
+}
+
+static void m_stream_build_task(void *arg, size_t idx)
+{
+    struct stream_batch *batch = arg;
+    const struct pfchunk *chunk = &batch->map->chunks[batch->chunks[idx]];
+
+    size_t verts_size = R_AL_ChunkVertsSize(TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT);
+    R_AL_ChunkVertsFromTiles(chunk->tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 
+        batch->verts + idx * verts_size);
+}
+
+static int m_compare_chunk_ages(const void *a, const void *b)
+{
+    uint32_t aa = ((const struct chunk_age*)a)->last_used;
+    uint32_t ab = ((const struct chunk_age*)b)->last_used;
+    return (aa > ab) - (aa < ab);
+}
+
+/* Frees the least recently used chunks until the budget is met again. The 
+ * chunks needed in the current frame are never evicted, so a camera that 
+ * sees more chunks than the budget only leaves it exceeded. */
+static void m_stream_evict(struct map *map)
+{
+    if(map->num_resident <= CONFIG_TERRAIN_RESIDENT_CHUNKS)
+        return;
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    struct chunk_age *ages = arena_alloc(arena, map->num_resident * sizeof(struct chunk_age));
+    if(!ages) {
+        arena_rewind(arena, mark);
+        return;
+    }
+    size_t num_ages = 0;
+
+    for(int i = 0; i < map->width * map->height; i++) {
+
+        const struct pfchunk *chunk = &map->chunks[i];
+        if(!chunk->resident || chunk->last_used == map->stream_frame)
+            continue;
+        ages[num_ages++] = (struct chunk_age){chunk->last_used, i};
+    }
+
+    qsort(ages, num_ages, sizeof(struct chunk_age), m_compare_chunk_ages);
+    for(int i = 0; i < num_ages && map->num_resident > CONFIG_TERRAIN_RESIDENT_CHUNKS; i++)
+        M_StreamOut(map, ages[i].idx);
+
+    arena_rewind(arena, mark);
+}
+
+static void m_frustum_translate(const struct frustum *in, vec3_t offset, struct frustum *out)
+{
+    *out = *in;
+
+    struct plane *planes[] = {&out->near, &out->far, &out->top, &out->bot, &out->left, &out->right};
+    for(int i = 0; i < ARR_SIZE(planes); i++)
+        PFM_Vec3_Add(&planes[i]->point, &offset, &planes[i]->point);
+
+    vec3_t *corners[] = {
+        &out->ntl, &out->ntr, &out->nbl, &out->nbr,
+        &out->ftl, &out->ftr, &out->fbl, &out->fbr
+    };
+    for(int i = 0; i < ARR_SIZE(corners); i++)
+        PFM_Vec3_Add(corners[i], &offset, corners[i]);
+}
+
+/* Follows the camera's motion from one frame to the next. A jump, such as
+ * from a click on the minimap, leaves the camera at rest. */
+static void m_prefetch_track(struct map *map, vec3_t pos)
+{
+    uint32_t now = SDL_GetTicks();
+    const float chunk_len = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+
+    if(map->prefetch.have_pos && now > map->prefetch.last_ticks) {
+
+        vec3_t delta;
+        PFM_Vec3_Sub(&pos, &map->prefetch.last_pos, &delta);
+
+        if(PFM_Vec3_Len(&delta) > PREFETCH_JUMP_CHUNKS * chunk_len) {
+            map->prefetch.velocity = (vec3_t){0.0f, 0.0f, 0.0f};
+        }else{
+            float dt = (now - map->prefetch.last_ticks) / 1000.0f;
+            vec3_t curr, prev;
+            PFM_Vec3_Scale(&delta, PREFETCH_SMOOTHING / dt, &curr);
+            PFM_Vec3_Scale(&map->prefetch.velocity, 1.0f - PREFETCH_SMOOTHING, &prev);
+            PFM_Vec3_Add(&curr, &prev, &map->prefetch.velocity);
+        }
+    }
+
+    map->prefetch.have_pos = true;
+    map->prefetch.last_pos = pos;
+    map->prefetch.last_ticks = now;
+}
+
+/* Adds the chunks which the camera would see if it was moved by 'offset',
+ * and which are neither needed nor predicted yet, as seen in 'eta' seconds.
+ * 'scratch' must have room for all the chunks of the map. */
+static size_t m_prefetch_add(struct map *map, const struct frustum *frustum, vec3_t offset,
+                             float eta, size_t *scratch, struct chunk_dist *out)
+{
+    struct frustum moved;
+    m_frustum_translate(frustum, offset, &moved);
+    size_t count = m_frustum_chunks(map, &moved, scratch);
+
+    size_t ret = 0;
+    for(int i = 0; i < count; i++) {
+
+        struct pfchunk *chunk = &map->chunks[scratch[i]];
+        if(chunk->last_used == map->stream_frame)
+            continue;
+
+        /* Marking them as used also keeps them from being evicted */
+        chunk->last_used = map->stream_frame;
+        out[ret++] = (struct chunk_dist){eta, scratch[i]};
+    }
+    return ret;
+}
+
+/* Streams in the chunks that the camera is about to see, the soonest first,
+ * within the per-frame and the residency budgets. 'scratch' must have room
+ * for all the chunks of the map. */
+static void m_prefetch(struct map *map, const struct camera *cam, size_t num_needed, size_t *scratch)
+{
+    const size_t nchunks = map->width * map->height;
+    const struct frustum *frustum = &Camera_GetState(cam)->frustum;
+    const float chunk_len = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    vec3_t pos = Camera_GetPos(cam);
+
+    m_prefetch_track(map, pos);
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    struct chunk_dist *cands = arena_alloc(arena, nchunks * sizeof(struct chunk_dist));
+    if(!cands) {
+        arena_rewind(arena, mark);
+        return;
+    }
+    size_t num_cands = 0;
+
+    /* Changes in the camera's height move its' frustum the same way as
+     * panning does, so the zoom is followed along with the rest */
+    for(int i = 1; i <= PREFETCH_STEPS; i++) {
+
+        float eta = (CONFIG_STREAM_PREFETCH_MS / 1000.0f) * i / PREFETCH_STEPS;
+        vec3_t offset;
+        PFM_Vec3_Scale(&map->prefetch.velocity, eta, &offset);
+        if(PFM_Vec3_Len(&offset) < chunk_len / 2.0f)
+            continue;
+        num_cands += m_prefetch_add(map, frustum, offset, eta, scratch, cands + num_cands);
+    }
+
+    /* The camera is moved so that its' ray hits the ground at the target */
+    vec2_t target;
+    if(M_MinimapCursorTarget(map, &target)) {
+
+        float offset_mag = cos(DEG_TO_RAD(Camera_GetPitch(cam))) * Camera_GetHeight(cam);
+        vec2_t ground = (vec2_t){
+            pos.x + cos(DEG_TO_RAD(Camera_GetYaw(cam))) * offset_mag,
+            pos.z - sin(DEG_TO_RAD(Camera_GetYaw(cam))) * offset_mag
+        };
+        vec3_t offset = (vec3_t){target.x - ground.x, 0.0f, target.y - ground.y};
+        num_cands += m_prefetch_add(map, frustum, offset, PREFETCH_HOVER_MS / 1000.0f,
+            scratch, cands + num_cands);
+    }
+
+    qsort(cands, num_cands, sizeof(struct chunk_dist), m_compare_chunk_dists);
+
+    /* The predicted chunks are baked after the ones in view */
+    for(int i = 0; i < num_cands; i++)
+        map->prefetch.order[map->prefetch.num_order++] = cands[i].idx;
+
+    size_t num_todo = 0;
+    for(int i = 0; i < num_cands && num_todo < CONFIG_STREAM_PREFETCH_CHUNKS; i++) {
+
+        if(num_needed + num_todo >= CONFIG_TERRAIN_RESIDENT_CHUNKS)
+            break;
+        if(map->chunks[cands[i].idx].resident)
+            continue;
+        scratch[num_todo++] = cands[i].idx;
+    }
+
+    M_StreamIn(map, scratch, num_todo);
+    for(int i = 0; i < num_todo; i++) {
+
+        struct pfchunk *chunk = &map->chunks[scratch[i]];
+        if(!chunk->resident)
+            continue;
+        chunk->prefetched = true;
+        map->prefetch.stats.prefetched++;
+    }
+
+    arena_rewind(arena, mark);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *out)
+{
+    ssize_t x_offset = -(p.c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
+    ssize_t z_offset =  (p.r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
+    vec3_t chunk_pos = (vec3_t) {map->pos.x + x_offset, map->pos.y, map->pos.z + z_offset};
+   
+    PFM_Mat4x4_MakeTrans(chunk_pos.x, chunk_pos.y, chunk_pos.z, out);
+}
+
+void M_AABBForChunk(const struct map *map, struct chunkpos p, struct aabb *out)
 {
     size_t chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
     size_t chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
@@ -78,19 +631,6 @@ static void m_aabb_for_chunk(const struct map *map, struct chunkpos p, struct aa
     assert(out->z_max >= out->z_min);
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
-
-void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *out)
-{
-    ssize_t x_offset = -(p.c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
-    ssize_t z_offset =  (p.r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
-    vec3_t chunk_pos = (vec3_t) {map->pos.x + x_offset, map->pos.y, map->pos.z + z_offset};
-   
-    PFM_Mat4x4_MakeTrans(chunk_pos.x, chunk_pos.y, chunk_pos.z, out);
-}
-
 void M_RenderEntireMap(const struct map *map)
 {
     for(int r = 0; r < map->height; r++) {
@@ -98,9 +638,12 @@ void M_RenderEntireMap(const struct map *map)
         
             mat4x4_t chunk_model;
             const struct pfchunk *chunk = &map->chunks[r * map->width + c];
+            if(!chunk->resident)
+                continue;
+
             void *render_private = 
-                (chunk->mode == CHUNK_RENDER_MODE_REALTIME_BLEND) ? chunk->render_private_tiles
-                                                                  : chunk->render_private_prebaked;
+                (chunk->mode == CHUNK_RENDER_MODE_PREBAKED) ? chunk->render_private_prebaked
+                                                            : chunk->render_private_tiles;
 
             M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
             R_GL_Draw(render_private, &chunk_model);
@@ -108,56 +651,119 @@ void M_RenderEntireMap(const struct map *map)
     }
 }
 
-void M_RenderVisibleMap(const struct map *map, const struct camera *cam)
+void M_RenderVisibleMap(const struct map *map, const struct camera *cam, bool depth_prepass,
+                        bool heightfield)
 {
-    struct frustum frustum;
-    Camera_MakeFrustum(cam, &frustum);
+    vec3_t cam_pos = Camera_GetPos(cam);
+    const size_t nchunks = map->width * map->height;
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t *lists = arena_alloc(arena, 4 * nchunks * sizeof(size_t));
+    if(!lists) {
+        arena_rewind(arena, mark);
+        return;
+    }
 
-    for(int r = 0; r < map->height; r++) {
-        for(int c = 0; c < map->width; c++) {
+    size_t *visible = lists;
+    size_t num_visible = m_visible_chunks(map, cam, visible);
+    m_sort_front_to_back(map, cam_pos, visible, num_visible);
 
-            struct aabb chunk_aabb;
-            m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
-
-            /* Due to the nature of the the map (perfect grid), the fast and greedy frustrum 
-             * intersection test will yield too many false positives. As each chunk mesh has 
-             * a high vertex count, this is undesirable. It is absolutely worth it to do the 
-             * precise frustrum intersection test. With it, the map rendering performance
-             * scales great for large maps. */
-            if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
-                continue;
+    size_t *batched = lists + nchunks;
+    size_t num_batched = 0;
+    size_t *splatted = lists + 2 * nchunks;
+    size_t num_splatted = 0;
+    size_t *prepassed = lists + 3 * nchunks;
+    size_t num_prepassed = 0;
 
-            mat4x4_t chunk_model;
-            const struct pfchunk *chunk = &map->chunks[r * map->width + c];
-            void *render_private = 
-                (chunk->mode == CHUNK_RENDER_MODE_REALTIME_BLEND) ? chunk->render_private_tiles
-                                                                  : chunk->render_private_prebaked;
+    for(int i = 0; i < num_visible; i++) {
 
-            M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
-            R_GL_Draw(render_private, &chunk_model);
+        int r = visible[i] / map->width;
+        int c = visible[i] % map->width;
+
+        mat4x4_t chunk_model;
+        const struct pfchunk *chunk = &map->chunks[visible[i]];
+
+        /* Only when the chunk couldn't be streamed in */
+        if(!chunk->resident)
+            continue;
+
+        if(chunk->mode == CHUNK_RENDER_MODE_REALTIME_BLEND && map->terrain_batch) {
+            batched[num_batched++] = visible[i];
+            prepassed[num_prepassed++] = visible[i];
+            continue;
+        }
+
+        if(chunk->mode == CHUNK_RENDER_MODE_REALTIME_SPLAT && map->terrain_batch) {
+            splatted[num_splatted++] = visible[i];
+            prepassed[num_prepassed++] = visible[i];
+            continue;
         }
+
+        void *render_private = 
+            (chunk->mode == CHUNK_RENDER_MODE_PREBAKED) ? chunk->render_private_prebaked
+                                                        : chunk->render_private_tiles;
+
+        if(chunk->mode == CHUNK_RENDER_MODE_PREBAKED && chunk->render_private_lod) {
+
+            struct aabb chunk_aabb;
+            M_AABBForChunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+
+            if(m_dist_to_aabb(&chunk_aabb, cam_pos) > CONFIG_TERRAIN_LOD_DIST)
+                render_private = chunk->render_private_lod;
+        }
+
+        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+        R_Queue_Submit(RENDER_PASS_OPAQUE, render_private, &chunk_model);
     }
+
+    /* The batched chunks are drawn right away, with a single call per mode, 
+     * ahead of everything in the queue */
+    mat4x4_t map_model;
+    PFM_Mat4x4_MakeTrans(map->pos.x, map->pos.y, map->pos.z, &map_model);
+
+    depth_prepass = depth_prepass && num_prepassed;
+    if(depth_prepass)
+        R_GL_TerrainBatchDrawDepth(map->terrain_batch, prepassed, num_prepassed, &map_model, heightfield);
+
+    if(num_batched)
+        R_GL_TerrainBatchDraw(map->terrain_batch, batched, num_batched, &map_model, 
+            false, depth_prepass, heightfield);
+    if(num_splatted)
+        R_GL_TerrainBatchDraw(map->terrain_batch, splatted, num_splatted, &map_model, 
+            true, depth_prepass, heightfield);
+
+    arena_rewind(arena, mark);
 }
 
-void M_RenderVisiblePathableLayer(const struct map *map, const struct camera *cam)
+void M_RenderVisiblePathableLayer(const struct map *map, const struct camera *cam,
+                                  enum nav_layer layer)
 {
-    struct frustum frustum;
-    Camera_MakeFrustum(cam, &frustum);
-
-    for(int r = 0; r < map->height; r++) {
-        for(int c = 0; c < map->width; c++) {
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t *visible = arena_alloc(arena, map->width * map->height * sizeof(size_t));
+    if(!visible) {
+        arena_rewind(arena, mark);
+        return;
+    }
+    size_t num_visible = m_visible_chunks(map, cam, visible);
 
-            struct aabb chunk_aabb;
-            m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+    for(int i = 0; i < num_visible; i++) {
 
-            if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
-                continue;
+        int r = visible[i] / map->width;
+        int c = visible[i] % map->width;
 
-            mat4x4_t chunk_model;
-            M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
-            N_RenderPathableChunk(map->nav_private, &chunk_model, map, r, c); 
-        }
+        mat4x4_t chunk_model;
+        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+        N_RenderPathableChunk(map->nav_private, &chunk_model, map, r, c, layer); 
     }
+    arena_rewind(arena, mark);
 }
 
 void M_CenterAtOrigin(struct map *map)
@@ -166,6 +772,8 @@ void M_CenterAtOrigin(struct map *map)
     size_t height = map->height * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
 
     map->pos = (vec3_t) {(width / 2.0f), 0.0f, -(height / 2.0f)};
+    /* The culling tree holds world-space bounds */
+    M_BuildCullTree(map);
 }
 
 void M_RestrictRTSCamToMap(const struct map *map, struct camera *cam)
@@ -199,38 +807,146 @@ void M_SetChunkRenderMode(struct map *map, int chunk_r, int chunk_c, enum chunk_
     assert(chunk_r >= 0 && chunk_r < map->height);
     assert(chunk_c >= 0 && chunk_r < map->width);
 
+    assert(mode != CHUNK_RENDER_MODE_HYBRID);
+
     struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
-    chunk->mode = mode;
+    chunk->bake_pending = false;
 
-    if(mode == CHUNK_RENDER_MODE_PREBAKED) {
-        
-        ssize_t x_offset = -(chunk_c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
-        ssize_t z_offset =  (chunk_r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
-        vec3_t chunk_pos = (vec3_t) {map->pos.x + x_offset, map->pos.y, map->pos.z + z_offset};
+    if(mode != CHUNK_RENDER_MODE_PREBAKED || chunk->render_private_prebaked) {
+        chunk->mode = mode;
+        return;
+    }
 
-        mat4x4_t chunk_model;
-        PFM_Mat4x4_MakeTrans(chunk_pos.x, chunk_pos.y, chunk_pos.z, &chunk_model);
+    /* There is nothing to bake from until the chunk is streamed in */
+    if(!chunk->resident) {
+        chunk->bake_pending = true;
+        return;
+    }
 
-        vec3_t chunk_center = (vec3_t) {
-            chunk_pos.x - (TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE)/2.0f,
-            chunk_pos.y,
-            chunk_pos.z + (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE)/2.0f
-        };
+    /* The bake's memory is given back right away, so that baking many chunks
+     * in the same frame doesn't pile it up */
+    struct mem_arena *arena = MEM_FrameArena();
+    struct arena_mark mark = arena_mark(arena);
 
-        chunk->render_private_prebaked = R_GL_TileBakeChunk(chunk->render_private_tiles, chunk_center, &chunk_model,
-            TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk->tiles, chunk_r, chunk_c);
-    }
+    void *bake = m_bake_begin(map, chunk_r, chunk_c);
+    if(bake)
+        R_GL_TileBakeBuild(bake);
+    m_bake_finish(map, chunk_r * map->width + chunk_c, bake);
+
+    arena_rewind(arena, mark);
 }
 
 void M_SetMapRenderMode(struct map *map, enum chunk_render_mode mode)
 {
     assert(map);
 
+    map->hybrid = (mode == CHUNK_RENDER_MODE_HYBRID);
+    if(map->hybrid) {
+        /* Nothing is baked until it is needed */
+        for(int i = 0; i < map->width * map->height; i++)
+            map->chunks[i].bake_pending = false;
+        return;
+    }
+
     for(int r = 0; r < map->height; r++) {
         for(int c = 0; c < map->width; c++) {
-           M_SetChunkRenderMode(map, r, c, mode); 
+
+            struct pfchunk *chunk = &map->chunks[r * map->width + c];
+            if(mode == CHUNK_RENDER_MODE_PREBAKED && !chunk->render_private_prebaked) {
+                chunk->bake_pending = true;
+                continue;
+            }
+            M_SetChunkRenderMode(map, r, c, mode); 
+        }
+    }
+}
+
+void M_HybridStep(struct map *map, const struct camera *cam)
+{
+    if(!map->hybrid)
+        return;
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t *visible = arena_alloc(arena, map->width * map->height * sizeof(size_t));
+    if(!visible) {
+        arena_rewind(arena, mark);
+        return;
+    }
+
+    vec3_t cam_pos = Camera_GetPos(cam);
+    size_t num_visible = m_visible_chunks(map, cam, visible);
+
+    for(int i = 0; i < num_visible; i++) {
+
+        struct pfchunk *chunk = &map->chunks[visible[i]];
+        if(!chunk->resident)
+            continue;
+
+        struct aabb chunk_aabb;
+        M_AABBForChunk(map, (struct chunkpos) {visible[i] / map->width, visible[i] % map->width}, 
+            &chunk_aabb);
+        float dist = m_dist_to_aabb(&chunk_aabb, cam_pos);
+
+        if(dist < CONFIG_TERRAIN_HYBRID_DIST) {
+
+            /* The baked meshes are kept for when the chunk is far again */
+            chunk->bake_pending = false;
+            if(chunk->mode == CHUNK_RENDER_MODE_PREBAKED)
+                chunk->mode = CHUNK_RENDER_MODE_REALTIME_BLEND;
+
+        }else if(dist > CONFIG_TERRAIN_HYBRID_DIST + CONFIG_TERRAIN_HYBRID_MARGIN
+              && chunk->mode != CHUNK_RENDER_MODE_PREBAKED) {
+
+            if(chunk->render_private_prebaked)
+                chunk->mode = CHUNK_RENDER_MODE_PREBAKED;
+            else if(!chunk->bake_failed)
+                chunk->bake_pending = true;
         }
     }
+    arena_rewind(arena, mark);
+}
+
+void M_BakeStep(struct map *map)
+{
+    void *bakes[CONFIG_BAKE_CHUNKS_PER_FRAME];
+    size_t chunks[CONFIG_BAKE_CHUNKS_PER_FRAME];
+    size_t num_bakes = 0;
+
+    /* On streamed maps, the chunks in view and then the ones about to come
+     * into view go first, ahead of the rest in row-major order */
+    const size_t num_order = map->prefetch.order ? map->prefetch.num_order : 0;
+    const size_t nchunks = map->width * map->height;
+
+    for(int i = 0; i < num_order + nchunks && num_bakes < CONFIG_BAKE_CHUNKS_PER_FRAME; i++) {
+
+        size_t idx = (i < num_order) ? map->prefetch.order[i] : i - num_order;
+        struct pfchunk *chunk = &map->chunks[idx];
+        if(!chunk->bake_pending || !chunk->resident)
+            continue;
+
+        chunk->bake_pending = false;
+        chunks[num_bakes] = idx;
+        bakes[num_bakes] = m_bake_begin(map, idx / map->width, idx % map->width);
+        num_bakes++;
+    }
+
+    if(!num_bakes)
+        return;
+
+    PERF_ENTER();
+
+    /* The top-down textures have been rendered - the meshes can now be built 
+     * on the CPU without touching GL */
+    PL_For(num_bakes, m_bake_build_task, bakes);
+
+    for(int i = 0; i < num_bakes; i++)
+        m_bake_finish(map, chunks[i], bakes[i]);
+
+    PERF_RETURN();
 }
 
 vec2_t M_WorldCoordsToNormMapCoords(const struct map *map, vec2_t xz)
@@ -245,6 +961,55 @@ vec2_t M_WorldCoordsToNormMapCoords(const struct map *map, vec2_t xz)
     };
 }
 
+void M_GetResolution(const struct map *map, struct map_resolution *out)
+{
+    *out = (struct map_resolution){
+        map->width, map->height,
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
+    };
+}
+
+vec3_t M_GetPos(const struct map *map)
+{
+    return map->pos;
+}
+
+void M_GetBounds(const struct map *map, struct aabb *out)
+{
+    struct aabb first, last;
+    M_AABBForChunk(map, (struct chunkpos){0, 0}, &first);
+    M_AABBForChunk(map, (struct chunkpos){map->height - 1, map->width - 1}, &last);
+
+    out->x_min = last.x_min;
+    out->x_max = first.x_max;
+    out->y_min = first.y_min;
+    out->y_max = first.y_max;
+    out->z_min = first.z_min;
+    out->z_max = last.z_max;
+}
+
+size_t M_GetShadowCasters(const struct map *map, struct shadow_caster *out)
+{
+    size_t ret = 0;
+    for(int r = 0; r < map->height; r++) {
+        for(int c = 0; c < map->width; c++) {
+
+            const struct pfchunk *chunk = &map->chunks[r * map->width + c];
+            const void *render_private = 
+                (chunk->mode == CHUNK_RENDER_MODE_PREBAKED) ? chunk->render_private_prebaked
+                                                            : chunk->render_private_tiles;
+            if(!render_private || !chunk->resident)
+                continue;
+
+            struct shadow_caster *curr = &out[ret++];
+            curr->render_private = render_private;
+            M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &curr->model);
+            M_AABBForChunk(map, (struct chunkpos) {r, c}, &curr->bounds);
+        }
+    }
+    return ret;
+}
+
 bool M_PointInsideMap(const struct map *map, vec2_t xz)
 {
     float width  = map->width  * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE;
@@ -270,35 +1035,332 @@ vec2_t M_ClampedMapCoordinate(const struct map *map, vec2_t xz)
 
 float M_HeightAtPoint(const struct map *map, vec2_t xz)
 {
-    assert(M_PointInsideMap(map, xz));
+    float ret;
+    M_HeightAtPoints(map, &xz, &ret, 1);
+    return ret;
+}
 
-    float x = xz.raw[0];
-    float z = xz.raw[1];
+void M_HeightAtPoints(const struct map *map, const vec2_t *xz, float *out, size_t n)
+{
+    const int rows = map->height * TILES_PER_CHUNK_HEIGHT;
+    const int cols = map->width  * TILES_PER_CHUNK_WIDTH;
 
-    int chunk_r, chunk_c;
-    chunk_r =  (z - map->pos.z) / (TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
-    chunk_c = -(x - map->pos.x) / (TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
-    assert(chunk_r >= 0 && chunk_r < map->height);
-    assert(chunk_c >= 0 && chunk_c < map->width);
+    int   tile_r[HEIGHT_BATCH_SIZE], tile_c[HEIGHT_BATCH_SIZE];
+    float frac_w[HEIGHT_BATCH_SIZE], frac_h[HEIGHT_BATCH_SIZE];
 
-    float chunk_off_r = fmod(z - map->pos.z, TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE);
-    float chunk_off_c = fmod(-(x - map->pos.x), TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE);
-    assert(chunk_off_r >= 0 && chunk_off_c >= 0);
+    for(size_t base = 0; base < n; base += HEIGHT_BATCH_SIZE) {
 
-    int tile_r, tile_c;    
-    tile_r = chunk_off_r / Z_COORDS_PER_TILE;
-    tile_c = chunk_off_c / X_COORDS_PER_TILE;
-    assert(tile_r >= 0 && tile_r < TILES_PER_CHUNK_HEIGHT);
-    assert(tile_c >= 0 && tile_c < TILES_PER_CHUNK_WIDTH);
-    
-    float tile_frac_width, tile_frac_height;
-    tile_frac_width =  fmod(chunk_off_c, X_COORDS_PER_TILE) / X_COORDS_PER_TILE;
-    tile_frac_height = fmod(chunk_off_r, Z_COORDS_PER_TILE) / Z_COORDS_PER_TILE;
-    assert(tile_frac_width >= 0.0f && tile_frac_width <= 1.0f);
-    assert(tile_frac_height >= 0.0f && tile_frac_height <= 1.0f);
+        const size_t batch = MIN(n - base, HEIGHT_BATCH_SIZE);
+
+        /* Find the map-wide tile coordinates of the points. This loop is 
+         * straight-line arithmetic so the compiler is free to vectorize it. */
+        for(size_t i = 0; i < batch; i++) {
+
+            assert(M_PointInsideMap(map, xz[base + i]));
+
+            float r = (xz[base + i].raw[1] - map->pos.z) / Z_COORDS_PER_TILE;
+            float c = (map->pos.x - xz[base + i].raw[0]) / X_COORDS_PER_TILE;
+
+            /* Points on the bottom and left map edges belong to the last tile */
+            tile_r[i] = MIN((int)r, rows - 1);
+            tile_c[i] = MIN((int)c, cols - 1);
+            frac_h[i] = r - tile_r[i];
+            frac_w[i] = c - tile_c[i];
+        }
+
+        for(size_t i = 0; i < batch; i++) {
+
+            assert(tile_r[i] >= 0 && tile_r[i] < rows);
+            assert(tile_c[i] >= 0 && tile_c[i] < cols);
+            out[base + i] = m_tile_height(map, tile_r[i], tile_c[i], frac_w[i], frac_h[i]);
+        }
+    }
+}
+
+const struct tile *M_ChunkTiles(const struct map *map, int chunk_r, int chunk_c)
+{
+    if(chunk_r < 0 || chunk_r >= map->height || chunk_c < 0 || chunk_c >= map->width)
+        return NULL;
+    return map->chunks[chunk_r * map->width + chunk_c].tiles;
+}
+
+const struct tile_heights *M_Heightfield(const struct map *map)
+{
+    return map->heightfield;
+}
+
+bool M_BuildHeightfield(struct map *map)
+{
+    const size_t num_tiles = map->width * TILES_PER_CHUNK_WIDTH 
+                           * map->height * TILES_PER_CHUNK_HEIGHT;
+
+    MEM_Free(map->heightfield);
+    map->heightfield = MEM_Malloc(MEM_TAG_MAP, num_tiles * sizeof(struct tile_heights));
+
+    /* The chunk bounds are still needed without the heightfield */
+    for(int chunk_r = 0; chunk_r < map->height; chunk_r++) {
+    for(int chunk_c = 0; chunk_c < map->width; chunk_c++) {
+        map->chunks[chunk_r * map->width + chunk_c].max_height = 0.0f;
+        for(int tile_r = 0; tile_r < TILES_PER_CHUNK_HEIGHT; tile_r++) {
+        for(int tile_c = 0; tile_c < TILES_PER_CHUNK_WIDTH; tile_c++) {
+            M_UpdateHeightfieldTile(map, chunk_r, chunk_c, tile_r, tile_c);
+        }}
+    }}
+    return (map->heightfield != NULL);
+}
+
+void M_UpdateHeightfieldTile(struct map *map, int chunk_r, int chunk_c, int tile_r, int tile_c)
+{
+    struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
+    const struct tile *tile = &chunk->tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
+
+    int top = tile->base_height + (tile->type == TILETYPE_FLAT ? 0 : tile->ramp_height);
+    chunk->max_height = MAX(chunk->max_height, top * Y_COORDS_PER_TILE);
+
+    if(!map->heightfield)
+        return;
+
+    int r = chunk_r * TILES_PER_CHUNK_HEIGHT + tile_r;
+    int c = chunk_c * TILES_PER_CHUNK_WIDTH  + tile_c;
+    struct tile_heights *hf = &map->heightfield[r * (map->width * TILES_PER_CHUNK_WIDTH) + c];
+
+    if(tile->type == TILETYPE_FLAT)
+        hf->kind = TILE_HEIGHT_FLAT;
+    else if(TILETYPE_IS_RAMP(tile->type))
+        hf->kind = TILE_HEIGHT_RAMP;
+    else
+        hf->kind = TILE_HEIGHT_EXACT;
+
+    hf->nw = M_Tile_NWHeight(tile) * Y_COORDS_PER_TILE;
+    hf->ne = M_Tile_NEHeight(tile) * Y_COORDS_PER_TILE;
+    hf->sw = M_Tile_SWHeight(tile) * Y_COORDS_PER_TILE;
+    hf->se = M_Tile_SEHeight(tile) * Y_COORDS_PER_TILE;
+}
+
+bool M_BuildTerrainBatch(struct map *map)
+{
+    if(map->terrain_batch) {
+        R_GL_TerrainBatchFree(map->terrain_batch);
+        map->terrain_batch = NULL;
+    }
+
+    /* The batch may hold a copy of every chunk's mesh, which is exactly what 
+     * streamed maps can't afford */
+    if(map->streamed)
+        return false;
+
+    const size_t nchunks = map->width * map->height;
+    void **chunk_rprivates = malloc(nchunks * sizeof(void*));
+    const struct tile **chunk_tiles = malloc(nchunks * sizeof(struct tile*));
+    vec3_t *chunk_offsets = malloc(nchunks * sizeof(vec3_t));
+    if(!chunk_rprivates || !chunk_tiles || !chunk_offsets)
+        goto out;
+
+    for(int r = 0; r < map->height; r++) {
+        for(int c = 0; c < map->width; c++) {
+
+            chunk_rprivates[r * map->width + c] = map->chunks[r * map->width + c].render_private_tiles;
+            chunk_tiles[r * map->width + c] = map->chunks[r * map->width + c].tiles;
+            chunk_offsets[r * map->width + c] = (vec3_t){
+                -(c * TILES_PER_CHUNK_WIDTH  * X_COORDS_PER_TILE), 
+                0.0f, 
+                 (r * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE)
+            };
+        }
+    }
+
+    map->terrain_batch = R_GL_TerrainBatchNew(chunk_rprivates, chunk_tiles, chunk_offsets, 
+                                              map->width, nchunks);
+out:
+    free(chunk_rprivates);
+    free(chunk_tiles);
+    free(chunk_offsets);
+    return (map->terrain_batch != NULL);
+}
+
+bool M_BuildCullTree(struct map *map)
+{
+    MEM_Free(map->cull_tree);
+
+    /* Every inner node has at least 2 children, so there are fewer inner 
+     * nodes than there are chunks */
+    size_t max_nodes = 2 * map->width * map->height - 1;
+    map->cull_tree = MEM_Malloc(MEM_TAG_MAP, max_nodes * sizeof(struct chunk_cull_node));
+    if(!map->cull_tree)
+        return false;
+
+    size_t num_nodes = 0;
+    m_cull_tree_build(map, map->cull_tree, &num_nodes, 0, 0, map->height, map->width);
+    assert(num_nodes <= max_nodes);
+    return true;
+}
+
+bool M_StreamIn(struct map *map, const size_t *chunks, size_t count)
+{
+    size_t *todo = malloc(count * sizeof(size_t));
+    if(!todo)
+        return false;
+    size_t num_todo = 0;
+
+    for(int i = 0; i < count; i++) {
+        if(!map->chunks[chunks[i]].resident)
+            todo[num_todo++] = chunks[i];
+    }
+
+    if(!num_todo) {
+        free(todo);
+        return true;
+    }
+
+    size_t verts_size = R_AL_ChunkVertsSize(TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT);
+    char *verts = malloc(MIN(num_todo, STREAM_BATCH) * verts_size);
+    if(!verts) {
+        free(todo);
+        return false;
+    }
+
+    /* Like when loading the map, the vertices are built on the pool threads 
+     * and only uploaded by the calling thread */
+    for(size_t first = 0; first < num_todo; first += STREAM_BATCH) {
+
+        size_t n = MIN(num_todo - first, STREAM_BATCH);
+        struct stream_batch batch = (struct stream_batch){map, todo + first, verts};
+        PL_For(n, m_stream_build_task, &batch);
+
+        for(int i = 0; i < n; i++) {
+
+            struct pfchunk *chunk = &map->chunks[todo[first + i]];
+            R_AL_InitChunkMesh(chunk->render_private_tiles, verts + i * verts_size, 
+                TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT);
+            chunk->resident = true;
+            map->num_resident++;
+        }
+    }
+
+    free(verts);
+    free(todo);
+    return true;
+}
+
+void M_StreamOut(struct map *map, size_t chunk_idx)
+{
+    struct pfchunk *chunk = &map->chunks[chunk_idx];
+    if(!chunk->resident)
+        return;
+
+    M_DropBake(map, chunk_idx);
+
+    /* It is baked again, normally from the bake cache, once it is back */
+    if(chunk->mode == CHUNK_RENDER_MODE_PREBAKED) {
+        chunk->mode = CHUNK_RENDER_MODE_REALTIME_BLEND;
+        chunk->bake_pending = true;
+    }
+
+    if(chunk->prefetched) {
+        chunk->prefetched = false;
+        map->prefetch.stats.wasted++;
+    }
+
+    R_AL_FreeChunkMesh(chunk->render_private_tiles);
+    chunk->resident = false;
+    map->num_resident--;
+}
+
+void M_DropBake(struct map *map, size_t chunk_idx)
+{
+    struct pfchunk *chunk = &map->chunks[chunk_idx];
+    if(!chunk->render_private_prebaked)
+        return;
+
+    R_GL_TileBakeFree(chunk->render_private_prebaked, chunk->render_private_lod,
+        chunk_idx / map->width, chunk_idx % map->width);
+    chunk->render_private_prebaked = NULL;
+    chunk->render_private_lod = NULL;
+}
+
+void M_StreamStep(struct map *map, const struct camera *cam)
+{
+    if(!map->streamed)
+        return;
+
+    PERF_ENTER();
+    map->stream_frame++;
+
+    const size_t nchunks = map->width * map->height;
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        PERF_RETURN();
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t *visible = arena_alloc(arena, 2 * nchunks * sizeof(size_t));
+    if(!visible) {
+        arena_rewind(arena, mark);
+        PERF_RETURN();
+    }
+    size_t num_visible = m_visible_chunks(map, cam, visible);
+    map->prefetch.num_order = 0;
+
+    for(int i = 0; i < num_visible; i++) {
+
+        struct pfchunk *chunk = &map->chunks[visible[i]];
+        if(chunk->last_visible + 1 != map->stream_frame) {
+
+            /* It has just come into view */
+            if(chunk->resident) {
+                map->prefetch.stats.hits++;
+                map->prefetch.stats.prefetch_hits += chunk->prefetched;
+            }else{
+                map->prefetch.stats.late_loads++;
+            }
+            map->prefetch.stats.late_bakes += chunk->bake_pending;
+        }
+
+        chunk->last_visible = map->stream_frame;
+        chunk->prefetched = false;
+        if(map->prefetch.order)
+            map->prefetch.order[map->prefetch.num_order++] = visible[i];
+    }
+
+    /* The chunks next to the ones in view are streamed in too, so that 
+     * they are ready by the time the camera pans over to them */
+    size_t *needed = visible + nchunks;
+    size_t num_needed = 0;
+
+    for(int i = 0; i < num_visible; i++) {
+
+        int r = visible[i] / map->width;
+        int c = visible[i] % map->width;
+
+        for(int dr = -1; dr <= 1; dr++) {
+        for(int dc = -1; dc <= 1; dc++) {
+
+            if(r + dr < 0 || r + dr >= map->height || c + dc < 0 || c + dc >= map->width)
+                continue;
+
+            size_t idx = (r + dr) * map->width + (c + dc);
+            if(map->chunks[idx].last_used == map->stream_frame)
+                continue;
 
-    const struct tile *tile = &map->chunks[chunk_r * map->width + chunk_c].tiles[tile_r * TILES_PER_CHUNK_WIDTH + tile_c];
-    return M_Tile_HeightAtPos(tile, tile_frac_width, tile_frac_height);
+            map->chunks[idx].last_used = map->stream_frame;
+            needed[num_needed++] = idx;
+        }}
+    }
+
+    M_StreamIn(map, needed, num_needed);
+
+    /* The list of the chunks in view is done with, and is reused */
+    if(map->prefetch.order)
+        m_prefetch(map, cam, num_needed, visible);
+    m_stream_evict(map);
+
+    arena_rewind(arena, mark);
+    PERF_RETURN();
+}
+
+void M_GetStreamStats(const struct map *map, struct map_stream_stats *out)
+{
+    *out = map->prefetch.stats;
+    out->resident = map->streamed ? map->num_resident : 0;
 }
 
 void M_NavCutoutStaticObject(const struct map *map, const struct obb *obb)
@@ -306,37 +1368,120 @@ void M_NavCutoutStaticObject(const struct map *map, const struct obb *obb)
     N_CutoutStaticObject(map->nav_private, map->pos, obb);
 }
 
+void M_NavCutoutStaticObjects(const struct map *map, size_t count, const struct obb *obbs)
+{
+    N_CutoutStaticObjects(map->nav_private, map->pos, count, obbs);
+}
+
 void M_NavUpdatePortals(const struct map *map)
 {
     N_UpdatePortals(map->nav_private);
 }
 
+void M_NavBlockersIncref(const struct map *map, vec2_t xz_pos, float radius)
+{
+    N_BlockersIncref(map->nav_private, map->pos, xz_pos, radius);
+}
+
+void M_NavBlockersDecref(const struct map *map, vec2_t xz_pos, float radius)
+{
+    N_BlockersDecref(map->nav_private, map->pos, xz_pos, radius);
+}
+
+void M_NavUpdateBlockers(const struct map *map)
+{
+    N_UpdateBlockers(map->nav_private);
+}
+
 bool M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
-                      dest_id_t *out_dest_id)
+                      enum nav_layer layer, dest_id_t *out_dest_id)
 {
-    return N_RequestPath(map->nav_private, xz_src, xz_dest, map->pos, out_dest_id);
+    PERF_ENTER();
+    Perf_CountPathRequests(1);
+    bool ret = N_RequestPath(map->nav_private, xz_src, xz_dest, map->pos, layer, out_dest_id);
+    PERF_RETURN(ret);
 }
 
-void M_NavRenderVisiblePathFlowField(const struct map *map, const struct camera *cam, dest_id_t id)
+path_ticket_t M_NavRequestPathAsync(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
+                                    enum nav_layer layer, dest_id_t *out_dest_id)
 {
-    struct frustum frustum;
-    Camera_MakeFrustum(cam, &frustum);
+    Perf_CountPathRequests(1);
+    return N_RequestPathAsync(map->nav_private, xz_src, xz_dest, map->pos, layer, out_dest_id);
+}
 
-    for(int r = 0; r < map->height; r++) {
-        for(int c = 0; c < map->width; c++) {
+path_ticket_t M_NavRequestPathsAsync(const struct map *map, size_t num_srcs, 
+                                     const vec2_t xz_srcs[], vec2_t xz_dest, 
+                                     enum nav_layer layer, dest_id_t *out_dest_id)
+{
+    PERF_ENTER();
+    Perf_CountPathRequests(num_srcs);
+    path_ticket_t ret = N_RequestPathsAsync(map->nav_private, num_srcs, xz_srcs, xz_dest, 
+                                            map->pos, layer, out_dest_id);
+    PERF_RETURN(ret);
+}
 
-            struct aabb chunk_aabb;
-            m_aabb_for_chunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+size_t M_NavRequestWaypoints(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
+                             enum nav_layer layer, size_t maxout, vec2_t out[], 
+                             dest_id_t *out_dest_id)
+{
+    PERF_ENTER();
+    Perf_CountPathRequests(1);
+    size_t ret = N_RequestWaypoints(map->nav_private, xz_src, xz_dest, map->pos, layer, 
+                                    maxout, out, out_dest_id);
+    PERF_RETURN(ret);
+}
 
-            if(!C_FrustumAABBIntersectionExact(&frustum, &chunk_aabb))
-                continue;
+enum path_status M_NavPollPath(path_ticket_t ticket)
+{
+    return N_PollPath(ticket);
+}
 
-            mat4x4_t chunk_model;
-            M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
-            N_RenderPathFlowField(map->nav_private, map, &chunk_model, r, c, id); 
-            N_RenderLOSField(map->nav_private, map, &chunk_model, r, c, id);
-        }
+bool M_NavPathFound(path_ticket_t ticket, size_t src_idx)
+{
+    return N_PathFound(ticket, src_idx);
+}
+
+void M_NavReleasePath(path_ticket_t ticket)
+{
+    N_ReleasePath(ticket);
+}
+
+void M_NavSetDeterministic(bool on)
+{
+    N_SetDeterministic(on);
+}
+
+void M_NavSetPathFocus(const struct camera *cam)
+{
+    vec3_t pos = Camera_GetPos(cam);
+    N_SetPathFocus((vec2_t){pos.x, pos.z});
+}
+
+void M_NavRenderVisiblePathFlowField(const struct map *map, const struct camera *cam, dest_id_t id)
+{
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t *visible = arena_alloc(arena, map->width * map->height * sizeof(size_t));
+    if(!visible) {
+        arena_rewind(arena, mark);
+        return;
+    }
+    size_t num_visible = m_visible_chunks(map, cam, visible);
+
+    for(int i = 0; i < num_visible; i++) {
+
+        int r = visible[i] / map->width;
+        int c = visible[i] % map->width;
+
+        mat4x4_t chunk_model;
+        M_ModelMatrixForChunk(map, (struct chunkpos) {r, c}, &chunk_model);
+        N_RenderPathFlowField(map->nav_private, map, &chunk_model, r, c, id); 
+        N_RenderLOSField(map->nav_private, map, &chunk_model, r, c, id);
     }
+    arena_rewind(arena, mark);
 }
 
 vec2_t M_NavDesiredVelocity(const struct map *map, dest_id_t id, vec2_t curr_pos, vec2_t xz_dest)
@@ -349,8 +1494,33 @@ bool M_NavHasDestLOS(const struct map *map, dest_id_t id, vec2_t curr_pos)
     return N_HasDestLOS(id, curr_pos, map->nav_private, map->pos);
 }
 
-bool M_NavPositionPathable(const struct map *map, vec2_t xz_pos)
+bool M_NavPositionPathable(const struct map *map, enum nav_layer layer, vec2_t xz_pos)
+{
+    return N_PositionPathable(xz_pos, layer, map->nav_private, map->pos);
+}
+
+void M_NavPathsExist(const struct map *map, enum nav_layer layer, size_t n, 
+                     const vec2_t xz_srcs[], const vec2_t xz_dests[], bool out[])
+{
+    N_PathsExist(map->nav_private, n, xz_srcs, xz_dests, map->pos, layer, out);
+}
+
+void M_NavPathCosts(const struct map *map, enum nav_layer layer, size_t n, 
+                    const vec2_t xz_srcs[], const vec2_t xz_dests[], float out[])
+{
+    N_PathCosts(map->nav_private, n, xz_srcs, xz_dests, map->pos, layer, out);
+}
+
+void M_NavPositionsPathable(const struct map *map, enum nav_layer layer, size_t n,
+                            const vec2_t xz_positions[], bool out[])
+{
+    N_PositionsPathable(map->nav_private, n, xz_positions, map->pos, layer, out);
+}
+
+void M_NavRaycasts(const struct map *map, enum nav_layer layer, size_t n, 
+                   const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                   bool out_hit[], vec2_t out_pos[])
 {
-    return N_PositionPathable(xz_pos, map->nav_private, map->pos);
+    N_Raycasts(map->nav_private, n, xz_srcs, xz_dests, map->pos, layer, out_hit, out_pos);
 }
 
@@ -38,15 +38,82 @@
 #include "../asset_load.h"
 #include "../render/public/render.h"
 #include "../navigation/public/nav.h"
+#include "../parallel.h"
+#include "../mem.h"
+#include "../config.h"
 #include "map_private.h"
+#include "../lib/public/file_replace.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #ifndef __USE_POSIX
     #define __USE_POSIX /* strtok_r */
 #endif
 #include <string.h>
 
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define PFMAPB_MAGIC    (0x424d4650) /* 'PFMB' */
+#define PFMAPB_VERSION  (2)
+/* The version of the PFMAP text written by 'M_AL_SaveMap' */
+#define PFMAP_VERSION   (1.0f)
+/* Every tile is 6 characters, followed by a space or the end of the row */
+#define TILES_TEXT_SIZE (TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH * 7)
+/* The vertices of this many chunks are built at a time, bounding the memory
+ * held by the vertices that are waiting to be uploaded */
+#define CHUNK_BATCH     (16)
+
+#define CHUNK_TILES     (TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT)
+
+/* The header of a binary PFMAP file, followed by the table of chunks. As with
+ * the other caches, everything is stored in the native byte order. */
+struct pfmapb_header{
+    uint32_t magic;
+    uint32_t version;
+    float    text_version;
+    uint32_t num_rows;
+    uint32_t num_cols;
+    uint32_t tiles_width;
+    uint32_t tiles_height;
+    uint32_t num_mats;
+    /* The materials are stored in the format private to the renderer */
+    uint32_t mats_size;
+    uint32_t pad;
+};
+
+struct pfmapb_chunk{
+    uint64_t offset;
+    uint64_t size;
+};
+
+/* Every field of a tile fits in one digit of the text format */
+struct bin_tile{
+    uint8_t type;
+    uint8_t pathable;
+    uint8_t base_height;
+    uint8_t ramp_height;
+    uint8_t top_mat_idx;
+    uint8_t sides_mat_idx;
+};
+
+/* Where the data of a chunk is loaded from. 'bin_tiles' is NULL when the 
+ * tiles have already been parsed into the chunk. */
+struct chunk_src{
+    const struct bin_tile *bin_tiles;
+    const void            *mats;
+};
+
+struct chunk_batch{
+    struct map             *map;
+    const struct chunk_src *srcs;
+    size_t                  first;
+    char                   *verts;
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -74,9 +141,9 @@ fail:
 
 static bool m_al_read_row(SDL_RWops *stream, struct tile *out)
 {
-    char line[MAX_LINE_LEN];
+    char *line;
 
-    READ_LINE(stream, line, fail); 
+    READ_LINE_VIEW(stream, line, fail); 
 
     char *string = line;
     char *saveptr;
@@ -117,69 +184,592 @@ fail:
     return false;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
- 
-bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
-                            SDL_RWops *stream, void *outmap)
+static void m_al_free_chunks(struct map *map)
 {
-    struct map *map = outmap;
-    char line[MAX_LINE_LEN];
+    if(!map->chunks)
+        return;
+
+    for(int i = 0; i < map->width * map->height; i++) {
+        MEM_Free(map->chunks[i].render_private_tiles);
+        MEM_Free(map->chunks[i].pristine);
+    }
+    MEM_Free(map->chunks);
+    map->chunks = NULL;
+}
 
+/* Every chunk gets an allocation of its' own, holding the render private 
+ * buffer followed by the tiles, so that no single allocation grows with 
+ * the size of the map beyond the array of chunk headers */
+static bool m_al_init_header(struct map *map, const struct pfmap_hdr *header, 
+                             const char *cachepath)
+{
     map->width = header->num_cols;
     map->height = header->num_rows;
     map->pos = (vec3_t) {0.0f, 0.0f, 0.0f};
+    map->heightfield = NULL;
+    map->cache_path[0] = '\0';
+
+    if(cachepath && strlen(cachepath) < sizeof(map->cache_path))
+        strcpy(map->cache_path, cachepath);
+    else if(cachepath)
+        fprintf(stderr, "The map path '%s' is too long - its' caches will not be used.\n", cachepath);
 
     size_t num_chunks = header->num_rows * header->num_cols;
+    map->streamed = (num_chunks > CONFIG_TERRAIN_STREAM_MIN_CHUNKS);
+    map->num_resident = map->streamed ? 0 : num_chunks;
+    map->stream_frame = 0;
+    memset(&map->prefetch, 0, sizeof(map->prefetch));
+    memset(&map->edits, 0, sizeof(map->edits));
+    map->hybrid = false;
 
-    char *unused_base = (char*)(map + 1);
-    unused_base += num_chunks * sizeof(struct pfchunk);
+    map->chunks = MEM_Calloc(MEM_TAG_MAP, num_chunks, sizeof(struct pfchunk));
+    if(!map->chunks)
+        return false;
+
+    /* Without it, the chunks are only streamed in once they are needed */
+    if(map->streamed)
+        map->prefetch.order = MEM_Malloc(MEM_TAG_MAP, num_chunks * sizeof(size_t));
+
+    size_t priv_size = R_AL_PrivBuffSizeForChunk(
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, MATERIALS_PER_CHUNK);
 
     for(int i = 0; i < num_chunks; i++) {
 
-        map->chunks[i].render_private_tiles = (void*)unused_base;
+        char *base = MEM_Malloc(MEM_TAG_MAP, priv_size + CHUNK_TILES * sizeof(struct tile));
+        if(!base) {
+            m_al_free_chunks(map);
+            return false;
+        }
+
+        map->chunks[i].render_private_tiles = base;
+        map->chunks[i].tiles = (struct tile*)(base + priv_size);
         map->chunks[i].render_private_prebaked = NULL;
+        map->chunks[i].render_private_lod = NULL;
+        map->chunks[i].bake_pending = false;
+        map->chunks[i].bake_failed = false;
+        map->chunks[i].minimap_dirty = false;
+        map->chunks[i].dirty = false;
+        map->chunks[i].pristine = NULL;
+        map->chunks[i].edit_before = NULL;
         map->chunks[i].mode = CHUNK_RENDER_MODE_REALTIME_BLEND;
+        map->chunks[i].resident = !map->streamed;
+        map->chunks[i].last_used = 0;
+    }
+    return true;
+}
 
-        if(!m_al_read_pfchunk(stream, map->chunks + i))
-            return false;
+static void m_al_build_chunk(void *arg, size_t idx)
+{
+    struct chunk_batch *batch = arg;
+    struct pfchunk *chunk = &batch->map->chunks[batch->first + idx];
+    const struct chunk_src *src = &batch->srcs[batch->first + idx];
+
+    if(src->bin_tiles) {
+
+        for(int i = 0; i < CHUNK_TILES; i++) {
+
+            const struct bin_tile *btile = &src->bin_tiles[i];
+            struct tile *tile = &chunk->tiles[i];
+
+            memset(tile, 0, sizeof(struct tile));
+            tile->type          = btile->type;
+            tile->pathable      = btile->pathable;
+            tile->base_height   = btile->base_height;
+            tile->ramp_height   = btile->ramp_height;
+            tile->top_mat_idx   = btile->top_mat_idx;
+            tile->sides_mat_idx = btile->sides_mat_idx;
+        }
+    }
+
+    if(!batch->verts)
+        return;
+
+    size_t verts_size = R_AL_ChunkVertsSize(TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT);
+    R_AL_ChunkVertsFromTiles(chunk->tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 
+        batch->verts + idx * verts_size);
+}
 
-        size_t renderbuff_sz = R_AL_PrivBuffSizeForChunk(
-                               TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, MATERIALS_PER_CHUNK);
-        unused_base += renderbuff_sz;
+/* The tiles are decoded and the vertices built on the pool threads, a batch 
+ * of chunks at a time. Only the uploads are left to the calling thread. The
+ * meshes of streamed maps are left to 'M_StreamStep'. */
+static bool m_al_init_chunks(struct map *map, const char *basedir, const struct chunk_src *srcs)
+{
+    size_t num_chunks = map->width * map->height;
+    size_t verts_size = R_AL_ChunkVertsSize(TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT);
 
-        if(!R_AL_InitPrivFromTilesAndMats(stream, MATERIALS_PER_CHUNK, 
-                                          map->chunks[i].tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT,
-                                          map->chunks[i].render_private_tiles, basedir)) {
+    char *verts = NULL;
+    if(!map->streamed) {
+        verts = malloc(MIN(num_chunks, CHUNK_BATCH) * verts_size);
+        if(!verts)
             return false;
+    }
+
+    size_t num_init = 0;
+    for(size_t first = 0; first < num_chunks; first += CHUNK_BATCH) {
+
+        size_t count = MIN(num_chunks - first, CHUNK_BATCH);
+        struct chunk_batch batch = (struct chunk_batch){map, srcs, first, verts};
+        PL_For(count, m_al_build_chunk, &batch);
+
+        for(int i = 0; i < count; i++) {
+
+            struct pfchunk *chunk = &map->chunks[first + i];
+            if(!R_AL_InitPrivFromChunk(srcs[first + i].mats, MATERIALS_PER_CHUNK, 
+                                       verts ? verts + i * verts_size : NULL, 
+                                       TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT,
+                                       chunk->render_private_tiles, basedir))
+                goto fail;
+            num_init++;
         }
     }
 
-    const struct tile *chunk_tiles[map->width * map->height];
+    free(verts);
+    return true;
+
+fail:
+    /* The caller may go on to load the map another way, so the chunks that 
+     * were set up don't keep their textures and buffers */
+    for(int i = 0; i < num_init; i++)
+        R_AL_FreeChunkPriv(map->chunks[i].render_private_tiles);
+    free(verts);
+    return false;
+}
+
+static bool m_al_init_finish(struct map *map)
+{
+    char navpath_buff[sizeof(map->cache_path) + sizeof(".pfnav")];
+    const char *navpath = NULL;
+    if(map->cache_path[0]) {
+
+        sprintf(navpath_buff, "%s.pfnav", map->cache_path);
+        navpath = navpath_buff;
+    }
+
+    /* The heightfield is only an acceleration structure - carry on without it */
+    M_BuildHeightfield(map);
+
+    /* Without the batch, the chunks are drawn one by one */
+    map->terrain_batch = NULL;
+    M_BuildTerrainBatch(map);
+
+    /* Without the tree, every chunk is tested for visibility */
+    map->cull_tree = NULL;
+    M_BuildCullTree(map);
+
+    const struct tile **chunk_tiles = malloc(map->width * map->height * sizeof(chunk_tiles[0]));
+    if(!chunk_tiles)
+        return false;
+
     for(int r = 0; r < map->height; r++) {
         for(int c = 0; c < map->width; c++) {
             chunk_tiles[r * map->width + c] = map->chunks[r * map->width + c].tiles;
         }
     }
+    map->nav_private = NULL;
+    if(navpath) {
+        map->nav_private = N_LoadForMapData(map->width, map->height, 
+            TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles, navpath);
+    }
+    if(map->nav_private) {
+        free(chunk_tiles);
+        return true;
+    }
+
     map->nav_private = N_BuildForMapData(map->width, map->height, 
         TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_tiles);
-    if(!map->nav_private)
+    if(!map->nav_private) {
+        free(chunk_tiles);
         return false;
+    }
 
+    /* Failing to write the cache only means it will be rebuilt next time */
+    if(navpath) {
+        N_SaveForMapData(map->nav_private, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, 
+            chunk_tiles, navpath);
+    }
+
+    free(chunk_tiles);
     return true;
 }
 
-size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
+static size_t m_al_chunk_mats_offset(void)
+{
+    return BIN_ALIGN_UP(CHUNK_TILES * sizeof(struct bin_tile));
+}
+
+static size_t m_al_chunk_size(void)
+{
+    return m_al_chunk_mats_offset() + R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK);
+}
+
+/*
+ * Binary PFMAP file layout:
+ *
+ *  +---------------------------------+ <-- base
+ *  | struct pfmapb_header[1]         |
+ *  +---------------------------------+
+ *  | struct pfmapb_chunk[num_chunks] |
+ *  +---------------------------------+ <-- base + chunks[0].offset (aligned)
+ *  | struct bin_tile[CHUNK_TILES]    |
+ *  +---------------------------------+ <-- (aligned)
+ *  | chunk materials                 |
+ *  +---------------------------------+ <-- base + chunks[1].offset (aligned)
+ *  | ...                             |
+ *  +---------------------------------+
+ *
+ * Each chunk can be found and decoded on its' own.
+ */
+
+static bool m_al_write_binary(const struct pfmap_hdr *header, const struct map *map, 
+                              const char *mats, SDL_RWops *out)
+{
+    size_t num_chunks = map->width * map->height;
+    size_t mats_size = R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK);
+    size_t table_end = sizeof(struct pfmapb_header) + num_chunks * sizeof(struct pfmapb_chunk);
+
+    struct pfmapb_header bhdr = (struct pfmapb_header){
+        .magic        = PFMAPB_MAGIC,
+        .version      = PFMAPB_VERSION,
+        .text_version = header->version,
+        .num_rows     = header->num_rows,
+        .num_cols     = header->num_cols,
+        .tiles_width  = TILES_PER_CHUNK_WIDTH,
+        .tiles_height = TILES_PER_CHUNK_HEIGHT,
+        .num_mats     = MATERIALS_PER_CHUNK,
+        .mats_size    = mats_size,
+    };
+    if(!AL_WriteBytes(out, &bhdr, sizeof(bhdr)))
+        return false;
+
+    for(int i = 0; i < num_chunks; i++) {
+
+        struct pfmapb_chunk entry = (struct pfmapb_chunk){
+            .offset = BIN_ALIGN_UP(table_end) + i * BIN_ALIGN_UP(m_al_chunk_size()),
+            .size   = m_al_chunk_size(),
+        };
+        if(!AL_WriteBytes(out, &entry, sizeof(entry)))
+            return false;
+    }
+    if(!AL_WritePadding(out, BIN_ALIGN_UP(table_end) - table_end))
+        return false;
+
+    for(int i = 0; i < num_chunks; i++) {
+
+        struct bin_tile btiles[CHUNK_TILES];
+        for(int j = 0; j < CHUNK_TILES; j++) {
+
+            const struct tile *tile = &map->chunks[i].tiles[j];
+            btiles[j] = (struct bin_tile){
+                .type          = tile->type,
+                .pathable      = tile->pathable,
+                .base_height   = tile->base_height,
+                .ramp_height   = tile->ramp_height,
+                .top_mat_idx   = tile->top_mat_idx,
+                .sides_mat_idx = tile->sides_mat_idx,
+            };
+        }
+
+        if(!AL_WriteBytes(out, btiles, sizeof(btiles))
+        || !AL_WritePadding(out, m_al_chunk_mats_offset() - sizeof(btiles))
+        || !AL_WriteBytes(out, mats + i * mats_size, mats_size)
+        || !AL_WritePadding(out, BIN_ALIGN_UP(m_al_chunk_size()) - m_al_chunk_size()))
+            return false;
+    }
+    return true;
+}
+
+static bool m_al_save_binary(const struct pfmap_hdr *header, const struct map *map, 
+                             const char *mats, const char *prefix)
+{
+    char bin_path[sizeof(map->cache_path) + sizeof(".pfmapb")];
+    char tmp_path[sizeof(bin_path) + sizeof(".tmp")];
+    if(strlen(prefix) >= sizeof(map->cache_path))
+        return false;
+    sprintf(bin_path, "%s.pfmapb", prefix);
+    sprintf(tmp_path, "%s.tmp", bin_path);
+
+    SDL_RWops *out = SDL_RWFromFile(tmp_path, "wb");
+    if(!out)
+        return false;
+
+    bool ret = m_al_write_binary(header, map, mats, out);
+    ret = (0 == SDL_RWclose(out)) && ret;
+    return file_replace(bin_path, tmp_path, ret);
+}
+
+/* The current materials of all the chunks, in the same layout as when they 
+ * are parsed during loading */
+static char *m_al_current_mats(const struct map *map)
+{
+    size_t num_chunks = map->width * map->height;
+    size_t mats_size = R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK);
+
+    char *ret = malloc(num_chunks * mats_size);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < num_chunks; i++) {
+        R_AL_ChunkMatsFromPriv(map->chunks[i].render_private_tiles, MATERIALS_PER_CHUNK, 
+            ret + i * mats_size);
+    }
+    return ret;
+}
+
+static void m_al_format_tiles(const struct pfchunk *chunk, char *out)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+
+            const struct tile *tile = &chunk->tiles[r * TILES_PER_CHUNK_WIDTH + c];
+            assert(tile->type >= 0 && tile->type < 16);
+
+            *out++ = hex[tile->type & 0xf];
+            *out++ = (char) (tile->pathable)      + '0';
+            *out++ = (char) (tile->base_height)   + '0';
+            *out++ = (char) (tile->top_mat_idx)   + '0';
+            *out++ = (char) (tile->sides_mat_idx) + '0';
+            *out++ = (char) (tile->ramp_height)   + '0';
+            *out++ = (c == TILES_PER_CHUNK_WIDTH - 1) ? '\n' : ' ';
+        }
+    }
+}
+
+/* Format the whole PFMAP text into a single buffer, which is NUL-terminated 
+ * and must be freed by the caller */
+static char *m_al_format_text(const struct pfmap_hdr *header, const struct map *map, 
+                              const char *mats, size_t *out_len)
+{
+    size_t num_chunks = map->width * map->height;
+    size_t mats_size = R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK);
+
+    char hdr_str[128];
+    int hdr_len = snprintf(hdr_str, sizeof(hdr_str), "version %.1f\nnum_rows %u\nnum_cols %u\n",
+        header->version, header->num_rows, header->num_cols);
+    assert(hdr_len > 0 && hdr_len < sizeof(hdr_str));
+
+    size_t len = hdr_len;
+    for(int i = 0; i < num_chunks; i++) {
+        len += TILES_TEXT_SIZE;
+        len += R_AL_ChunkMatsToText(mats + i * mats_size, MATERIALS_PER_CHUNK, NULL, 0);
+    }
+
+    char *ret = malloc(len + 1);
+    if(!ret)
+        return NULL;
+
+    char *curr = ret;
+    memcpy(curr, hdr_str, hdr_len);
+    curr += hdr_len;
+
+    for(int i = 0; i < num_chunks; i++) {
+
+        m_al_format_tiles(&map->chunks[i], curr);
+        curr += TILES_TEXT_SIZE;
+        curr += R_AL_ChunkMatsToText(mats + i * mats_size, MATERIALS_PER_CHUNK, 
+            curr, len + 1 - (curr - ret));
+    }
+    assert(curr == ret + len);
+
+    *out_len = len;
+    return ret;
+}
+
+static bool m_al_save_text(const char *text, size_t len, const char *path)
+{
+    char tmp_path[strlen(path) + sizeof(".tmp")];
+    sprintf(tmp_path, "%s.tmp", path);
+
+    SDL_RWops *out = SDL_RWFromFile(tmp_path, "wb");
+    if(!out)
+        return false;
+
+    bool ret = AL_WriteBytes(out, text, len);
+    ret = (0 == SDL_RWclose(out)) && ret;
+    return file_replace(path, tmp_path, ret);
+}
+
+static bool m_al_desc_valid(const struct map *map, const struct tile_desc *desc)
+{
+    return (desc->chunk_r >= 0 && desc->chunk_r < map->height)
+        && (desc->chunk_c >= 0 && desc->chunk_c < map->width)
+        && (desc->tile_r  >= 0 && desc->tile_r  < TILES_PER_CHUNK_HEIGHT)
+        && (desc->tile_c  >= 0 && desc->tile_c  < TILES_PER_CHUNK_WIDTH);
+}
+
+/* Must succeed before any of the chunk's tiles are changed */
+static bool m_al_keep_pristine(struct pfchunk *chunk)
+{
+    if(chunk->pristine)
+        return true;
+
+    chunk->pristine = MEM_Malloc(MEM_TAG_MAP, CHUNK_TILES * sizeof(struct tile));
+    if(!chunk->pristine)
+        return false;
+    memcpy(chunk->pristine, chunk->tiles, CHUNK_TILES * sizeof(struct tile));
+    return true;
+}
+
+static bool m_al_prepare_chunk(struct map *map, int chunk_r, int chunk_c)
+{
+    size_t idx = chunk_r * map->width + chunk_c;
+    return m_al_keep_pristine(&map->chunks[idx])
+        && M_EditTouchChunk(map, idx);
+}
+
+/* Replace a tile and update the heightfield right away. The meshes are updated 
+ * by 'M_AL_FlushTileUpdates', once for all the tiles of a chunk changed in the 
+ * meantime. */
+static void m_al_set_tile(struct map *map, const struct tile_desc *desc, const struct tile *tile)
+{
+    struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
+    chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = *tile;
+    M_UpdateHeightfieldTile(map, desc->chunk_r, desc->chunk_c, desc->tile_r, desc->tile_c);
+
+    if(!chunk->dirty) {
+        chunk->dirty = true;
+        chunk->dirty_r_min = chunk->dirty_r_max = desc->tile_r;
+        chunk->dirty_c_min = chunk->dirty_c_max = desc->tile_c;
+    }else{
+        chunk->dirty_r_min = MIN(chunk->dirty_r_min, desc->tile_r);
+        chunk->dirty_c_min = MIN(chunk->dirty_c_min, desc->tile_c);
+        chunk->dirty_r_max = MAX(chunk->dirty_r_max, desc->tile_r);
+        chunk->dirty_c_max = MAX(chunk->dirty_c_max, desc->tile_c);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+ 
+bool M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
+                            const char *cachepath, SDL_RWops *stream, void *outmap)
+{
+    struct map *map = outmap;
+    if(!m_al_init_header(map, header, cachepath))
+        return false;
+
+    size_t num_chunks = header->num_rows * header->num_cols;
+    size_t mats_size = R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK);
+
+    char *mats = malloc(num_chunks * mats_size);
+    struct chunk_src *srcs = malloc(num_chunks * sizeof(struct chunk_src));
+    if(!mats || !srcs)
+        goto fail;
+
+    /* The stream can only be parsed in order */
+    for(int i = 0; i < num_chunks; i++) {
+
+        if(!m_al_read_pfchunk(stream, map->chunks + i))
+            goto fail;
+
+        if(!R_AL_ChunkMatsFromStream(stream, MATERIALS_PER_CHUNK, mats + i * mats_size))
+            goto fail;
+
+        srcs[i] = (struct chunk_src){NULL, mats + i * mats_size};
+    }
+
+    if(!m_al_init_chunks(map, basedir, srcs))
+        goto fail;
+
+    /* Failing to write the binary file only means the text will be parsed 
+     * again next time */
+    if(map->cache_path[0])
+        m_al_save_binary(header, map, mats, map->cache_path);
+
+    free(srcs);
+    free(mats);
+
+    if(!m_al_init_finish(map)) {
+        m_al_free_chunks(map);
+        return false;
+    }
+    return true;
+
+fail:
+    free(srcs);
+    free(mats);
+    m_al_free_chunks(map);
+    return false;
+}
+
+bool M_AL_HeaderFromBinary(const void *data, size_t size, struct pfmap_hdr *out)
+{
+    const struct pfmapb_header *bhdr = data;
+    if(size < sizeof(*bhdr)
+    || bhdr->magic != PFMAPB_MAGIC
+    || bhdr->version != PFMAPB_VERSION
+    || bhdr->tiles_width != TILES_PER_CHUNK_WIDTH
+    || bhdr->tiles_height != TILES_PER_CHUNK_HEIGHT
+    || bhdr->num_mats != MATERIALS_PER_CHUNK
+    || bhdr->mats_size != R_AL_ChunkMatsSize(MATERIALS_PER_CHUNK))
+        return false;
+
+    uint64_t num_chunks = (uint64_t)bhdr->num_rows * bhdr->num_cols;
+    if(num_chunks == 0
+    || num_chunks > (size - sizeof(*bhdr)) / sizeof(struct pfmapb_chunk))
+        return false;
+
+    const struct pfmapb_chunk *chunks = (const void*)(bhdr + 1);
+    for(int i = 0; i < num_chunks; i++) {
+
+        if(chunks[i].offset % BIN_SECTION_ALIGN
+        || chunks[i].size < m_al_chunk_size()
+        || chunks[i].offset > size
+        || chunks[i].size > size - chunks[i].offset)
+            return false;
+    }
+
+    out->version = bhdr->text_version;
+    out->num_rows = bhdr->num_rows;
+    out->num_cols = bhdr->num_cols;
+    return true;
+}
+
+bool M_AL_InitMapFromBinary(const struct pfmap_hdr *header, const char *basedir,
+                            const char *cachepath, const void *data, void *outmap)
 {
+    struct map *map = outmap;
+    if(!m_al_init_header(map, header, cachepath))
+        return false;
+
     size_t num_chunks = header->num_rows * header->num_cols;
+    struct chunk_src *srcs = malloc(num_chunks * sizeof(struct chunk_src));
+    if(!srcs) {
+        m_al_free_chunks(map);
+        return false;
+    }
+
+    const char *base = data;
+    const struct pfmapb_chunk *chunks = (const void*)(base + sizeof(struct pfmapb_header));
 
-    return sizeof(struct map) + num_chunks * 
-           (sizeof(struct pfchunk) + R_AL_PrivBuffSizeForChunk(
-                                     TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, MATERIALS_PER_CHUNK));
+    for(int i = 0; i < num_chunks; i++) {
+
+        const char *chunk_base = base + chunks[i].offset;
+        srcs[i] = (struct chunk_src){
+            (const void*)chunk_base, 
+            chunk_base + m_al_chunk_mats_offset()
+        };
+    }
+
+    bool ret = m_al_init_chunks(map, basedir, srcs);
+    free(srcs);
+
+    if(!ret || !m_al_init_finish(map)) {
+        m_al_free_chunks(map);
+        return false;
+    }
+    return true;
 }
 
-bool M_AL_UpdateChunkMats(const struct map *map, int chunk_r, int chunk_c, const char *mats_string)
+size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header)
+{
+    /* The chunks are allocated separately, when the map is initialized */
+    return sizeof(struct map);
+}
+
+bool M_AL_UpdateChunkMats(struct map *map, int chunk_r, int chunk_c, const char *mats_string)
 {
     SDL_RWops *stream;
     const struct pfchunk *chunk = &map->chunks[chunk_r * map->width + chunk_c];
@@ -187,57 +777,314 @@ bool M_AL_UpdateChunkMats(const struct map *map, int chunk_r, int chunk_c, const
     stream = SDL_RWFromConstMem(mats_string, strlen(mats_string));
     bool result = R_AL_UpdateMats(stream, MATERIALS_PER_CHUNK, chunk->render_private_tiles);
     SDL_RWclose(stream);
+
+    /* The set of materials of the map may have changed */
+    M_BuildTerrainBatch(map);
     return result;
 }
 
 bool M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, const struct tile *tile)
 {
-    if(desc->chunk_r >= map->height || desc->chunk_c >= map->width)
+    if(!m_al_desc_valid(map, desc))
+        return false;
+    if(!m_al_prepare_chunk(map, desc->chunk_r, desc->chunk_c))
         return false;
 
-    struct pfchunk *chunk = &map->chunks[desc->chunk_r * map->width + desc->chunk_c];
-    chunk->tiles[desc->tile_r * TILES_PER_CHUNK_WIDTH + desc->tile_c] = *tile;
-    R_GL_TileUpdate(chunk->render_private_tiles, desc->tile_r, desc->tile_c, 
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk->tiles);
+    m_al_set_tile(map, desc, tile);
+    if(map->nav_private)
+        N_InvalidateChunkFields(map->nav_private, desc->chunk_r, desc->chunk_c);
+    return true;
+}
+
+bool M_AL_UpdateTiles(struct map *map, size_t num_tiles, const struct tile_desc descs[],
+                      const struct tile tiles[])
+{
+    for(int i = 0; i < num_tiles; i++) {
+        if(!m_al_desc_valid(map, &descs[i]))
+            return false;
+    }
+
+    bool *touched = calloc(map->width * map->height, sizeof(bool));
+    if(!touched)
+        return false;
+
+    for(int i = 0; i < num_tiles; i++)
+        touched[descs[i].chunk_r * map->width + descs[i].chunk_c] = true;
+
+    for(int i = 0; i < map->width * map->height; i++) {
+        if(touched[i] && !m_al_prepare_chunk(map, i / map->width, i % map->width)) {
+            free(touched);
+            return false;
+        }
+    }
+
+    for(int i = 0; i < num_tiles; i++)
+        m_al_set_tile(map, &descs[i], &tiles[i]);
 
+    for(int i = 0; i < map->width * map->height; i++) {
+        if(touched[i] && map->nav_private)
+            N_InvalidateChunkFields(map->nav_private, i / map->width, i % map->width);
+    }
+
+    free(touched);
     return true;
 }
 
-void M_AL_DumpMap(FILE *stream, const struct map *map)
+bool M_AL_UpdateTileRegion(struct map *map, const struct tile_desc *origin, int rows, int cols,
+                           size_t num_tiles, const struct tile tiles[])
 {
-    for(int i = 0; i < (map->width * map->height); i++) {
+    if(!m_al_desc_valid(map, origin) || rows <= 0 || cols <= 0)
+        return false;
+    if(num_tiles != 1 && num_tiles != (size_t)rows * cols)
+        return false;
 
-        const struct pfchunk *curr = &map->chunks[i];
-    
-        for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
-            for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+    const int r_base = origin->chunk_r * TILES_PER_CHUNK_HEIGHT + origin->tile_r;
+    const int c_base = origin->chunk_c * TILES_PER_CHUNK_WIDTH  + origin->tile_c;
 
-                const struct tile *tile = &curr->tiles[r * TILES_PER_CHUNK_WIDTH + c];
+    if(r_base + rows > map->height * TILES_PER_CHUNK_HEIGHT
+    || c_base + cols > map->width  * TILES_PER_CHUNK_WIDTH)
+        return false;
 
-                char type_hex[2];
-                assert(tile->type >= 0 && tile->type < 16);
-                snprintf(type_hex, sizeof(type_hex), "%1x", tile->type);
+    for(int r = r_base / TILES_PER_CHUNK_HEIGHT; r <= (r_base + rows - 1) / TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = c_base / TILES_PER_CHUNK_WIDTH; c <= (c_base + cols - 1) / TILES_PER_CHUNK_WIDTH; c++) {
+            if(!m_al_prepare_chunk(map, r, c))
+                return false;
+        }
+    }
+
+    for(int r = 0; r < rows; r++) {
+        for(int c = 0; c < cols; c++) {
+
+            struct tile_desc desc = (struct tile_desc){
+                .chunk_r = (r_base + r) / TILES_PER_CHUNK_HEIGHT,
+                .chunk_c = (c_base + c) / TILES_PER_CHUNK_WIDTH,
+                .tile_r  = (r_base + r) % TILES_PER_CHUNK_HEIGHT,
+                .tile_c  = (c_base + c) % TILES_PER_CHUNK_WIDTH,
+            };
+            m_al_set_tile(map, &desc, (num_tiles == 1) ? &tiles[0] : &tiles[r * cols + c]);
+        }
+    }
 
-                fprintf(stream, "%c%c%c%c%c%c", (char) type_hex[0],
-                                                (char) (tile->pathable)      + '0',
-                                                (char) (tile->base_height)   + '0',
-                                                (char) (tile->top_mat_idx)   + '0',
-                                                (char) (tile->sides_mat_idx) + '0',
-                                                (char) (tile->ramp_height)   + '0');
+    if(!map->nav_private)
+        return true;
+
+    for(int r = r_base / TILES_PER_CHUNK_HEIGHT; r <= (r_base + rows - 1) / TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = c_base / TILES_PER_CHUNK_WIDTH; c <= (c_base + cols - 1) / TILES_PER_CHUNK_WIDTH; c++) {
+            N_InvalidateChunkFields(map->nav_private, r, c);
+        }
+    }
+    return true;
+}
+
+void M_AL_FlushTileUpdates(struct map *map)
+{
+    for(int r = 0; r < map->height; r++) {
+        for(int c = 0; c < map->width; c++) {
 
-                if(c != (TILES_PER_CHUNK_WIDTH - 1))
-                    fprintf(stream, " ");
+            struct pfchunk *chunk = &map->chunks[r * map->width + c];
+            if(!chunk->dirty)
+                continue;
+
+            /* A non-resident chunk's mesh is built from the current tiles 
+             * when it is streamed in */
+            if(chunk->resident) {
+                R_GL_TileUpdateRegion(chunk->render_private_tiles, 
+                    chunk->dirty_r_min, chunk->dirty_c_min, chunk->dirty_r_max, chunk->dirty_c_max,
+                    TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk->tiles);
+            }
+
+            if(map->terrain_batch)
+                R_GL_TerrainBatchUpdateChunk(map->terrain_batch, r * map->width + c, chunk->render_private_tiles);
+
+            /* The baked meshes no longer match the tiles. Unless the whole
+             * map is being drawn baked, they are dropped and the chunk is 
+             * blended. In the hybrid mode, it is baked again once it is 
+             * seen from afar. */
+            chunk->bake_failed = false;
+            if(map->hybrid || chunk->mode != CHUNK_RENDER_MODE_PREBAKED) {
+
+                M_DropBake(map, r * map->width + c);
+                if(chunk->mode == CHUNK_RENDER_MODE_PREBAKED)
+                    chunk->mode = CHUNK_RENDER_MODE_REALTIME_BLEND;
             }
-            fprintf(stream, "\n");
+
+            struct aabb chunk_aabb;
+            M_AABBForChunk(map, (struct chunkpos) {r, c}, &chunk_aabb);
+            R_GL_ShadowInvalidate(&chunk_aabb);
+
+            chunk->minimap_dirty = true;
+            chunk->dirty = false;
         }
     }
 }
 
+bool M_AL_DumpMap(FILE *stream, const struct map *map)
+{
+    struct pfmap_hdr header = (struct pfmap_hdr){PFMAP_VERSION, map->height, map->width};
+    char *mats = m_al_current_mats(map);
+    if(!mats)
+        return false;
+
+    size_t len;
+    char *text = m_al_format_text(&header, map, mats, &len);
+    free(mats);
+    if(!text)
+        return false;
+
+    bool ret = (fwrite(text, 1, len, stream) == len);
+    free(text);
+    return ret;
+}
+
+bool M_AL_SaveMap(const struct map *map, const char *path)
+{
+    struct pfmap_hdr header = (struct pfmap_hdr){PFMAP_VERSION, map->height, map->width};
+
+    /* The binary map goes alongside the text, where 'AL_MapFromPFMap' looks 
+     * for it */
+    char prefix[sizeof(map->cache_path)];
+    if(strlen(path) >= sizeof(prefix))
+        return false;
+    strcpy(prefix, path);
+    char *ext = strrchr(prefix, '.');
+    if(ext && !strchr(ext, '/'))
+        *ext = '\0';
+
+    char *mats = m_al_current_mats(map);
+    if(!mats)
+        goto fail_mats;
+
+    size_t len;
+    char *text = m_al_format_text(&header, map, mats, &len);
+    if(!text)
+        goto fail_text;
+
+    /* The text is written first, so that the binary file is never older 
+     * than it and gets used on the next load */
+    if(!m_al_save_text(text, len, path))
+        goto fail_write;
+
+    /* Failing to write the binary file only means the text will be parsed 
+     * next time */
+    m_al_save_binary(&header, map, mats, prefix);
+
+    free(text);
+    free(mats);
+    return true;
+
+fail_write:
+    free(text);
+fail_text:
+    free(mats);
+fail_mats:
+    return false;
+}
+
+bool M_AL_WriteTileDeltas(const struct map *map, SDL_RWops *out)
+{
+    uint32_t num_changed = 0;
+    for(int i = 0; i < map->width * map->height; i++) {
+        if(map->chunks[i].pristine)
+            ++num_changed;
+    }
+    if(!AL_WriteBytes(out, &num_changed, sizeof(num_changed)))
+        return false;
+
+    for(uint32_t i = 0; i < map->width * map->height; i++) {
+
+        const struct pfchunk *chunk = &map->chunks[i];
+        if(!chunk->pristine)
+            continue;
+
+        if(!AL_WriteBytes(out, &i, sizeof(i))
+        || !AL_WriteBytes(out, chunk->tiles, CHUNK_TILES * sizeof(struct tile)))
+            return false;
+    }
+    return true;
+}
+
+bool M_AL_ReadTileDeltas(struct map *map, SDL_RWops *in)
+{
+    const size_t num_chunks = map->width * map->height;
+    bool ret = false;
+
+    uint32_t num_changed;
+    if(!AL_ReadBytes(in, &num_changed, sizeof(num_changed)) || num_changed > num_chunks)
+        return false;
+
+    struct tile (*snap_tiles)[CHUNK_TILES] = malloc(num_changed * sizeof(*snap_tiles) + 1);
+    const struct tile **targets = calloc(num_chunks, sizeof(const struct tile*));
+    struct tile_desc *descs = NULL;
+    struct tile *tiles = NULL;
+    if(!snap_tiles || !targets)
+        goto out;
+
+    /* The chunks changed since they were loaded go back to how they were, 
+     * unless the snapshot has them changed as well */
+    for(int i = 0; i < num_chunks; i++)
+        targets[i] = map->chunks[i].pristine;
+
+    for(int i = 0; i < num_changed; i++) {
+
+        uint32_t idx;
+        if(!AL_ReadBytes(in, &idx, sizeof(idx)) || idx >= num_chunks
+        || !AL_ReadBytes(in, snap_tiles[i], sizeof(snap_tiles[i])))
+            goto out;
+        targets[idx] = snap_tiles[i];
+    }
+
+    size_t num_diff = 0;
+    for(int i = 0; i < num_chunks; i++) {
+        for(int j = 0; targets[i] && j < CHUNK_TILES; j++) {
+            if(memcmp(&targets[i][j], &map->chunks[i].tiles[j], sizeof(struct tile)))
+                ++num_diff;
+        }
+    }
+
+    descs = malloc(num_diff * sizeof(struct tile_desc) + 1);
+    tiles = malloc(num_diff * sizeof(struct tile) + 1);
+    if(!descs || !tiles)
+        goto out;
+
+    size_t n = 0;
+    for(int i = 0; i < num_chunks; i++) {
+        for(int j = 0; targets[i] && j < CHUNK_TILES; j++) {
+
+            if(!memcmp(&targets[i][j], &map->chunks[i].tiles[j], sizeof(struct tile)))
+                continue;
+
+            descs[n] = (struct tile_desc){
+                .chunk_r = i / map->width,
+                .chunk_c = i % map->width,
+                .tile_r  = j / TILES_PER_CHUNK_WIDTH,
+                .tile_c  = j % TILES_PER_CHUNK_WIDTH,
+            };
+            tiles[n++] = targets[i][j];
+        }
+    }
+    assert(n == num_diff);
+    ret = M_AL_UpdateTiles(map, num_diff, descs, tiles);
+
+out:
+    free(tiles);
+    free(descs);
+    free(targets);
+    free(snap_tiles);
+    return ret;
+}
+
 void M_AL_FreePrivate(struct map *map)
 {
     //TODO: Clean up OpenGL buffers
     //TODO: Clean up extra allocations by map
     assert(map->nav_private);
     N_FreePrivate(map->nav_private);
+    MEM_Free(map->heightfield);
+    MEM_Free(map->cull_tree);
+    MEM_Free(map->prefetch.order);
+    M_EditFree(map);
+    if(map->terrain_batch)
+        R_GL_TerrainBatchFree(map->terrain_batch);
+    m_al_free_chunks(map);
 }
 
@@ -0,0 +1,421 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "public/map.h"
+#include "public/tile.h"
+#include "map_private.h"
+#include "pfchunk.h"
+#include "../config.h"
+#include "../mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define CHUNK_TILES     (TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT)
+/* Longest stretch of equal tiles stored as one repeat */
+#define MAX_REPEAT      (UINT8_MAX)
+
+/* An edit is packed as:
+ *
+ *  struct edit_hdr
+ *  for each chunk:
+ *      struct edit_chunk
+ *      for each run of changed tiles:
+ *          struct edit_run
+ *          the tiles from before the edit, as repeats
+ *          the tiles from after the edit, as repeats
+ *
+ * Where a repeat is a count byte followed by the tile it is the count of. 
+ * Brush strokes mostly set many neighbouring tiles to the same value, so 
+ * a run rarely takes more than a few repeats. Everything is stored in the 
+ * native byte order, without padding.
+ */
+struct edit_hdr{
+    uint32_t num_chunks;
+    uint32_t num_tiles;
+};
+
+struct edit_chunk{
+    uint32_t idx;
+    uint32_t num_runs;
+};
+
+struct edit_run{
+    uint16_t start;
+    uint16_t len;
+};
+
+struct edit_buff{
+    unsigned char *data;
+    size_t         size, cap;
+    bool           failed;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void m_edit_put(struct edit_buff *buff, const void *src, size_t size)
+{
+    if(buff->failed)
+        return;
+
+    if(buff->size + size > buff->cap) {
+
+        size_t cap = buff->cap ? buff->cap * 2 : 1024;
+        while(cap < buff->size + size)
+            cap *= 2;
+
+        void *data = buff->data ? MEM_Realloc(buff->data, cap) : MEM_Malloc(MEM_TAG_MAP, cap);
+        if(!data) {
+            buff->failed = true;
+            return;
+        }
+        buff->data = data;
+        buff->cap = cap;
+    }
+
+    memcpy(buff->data + buff->size, src, size);
+    buff->size += size;
+}
+
+static void m_edit_put_repeats(struct edit_buff *buff, const struct tile *tiles, size_t len)
+{
+    size_t i = 0;
+    while(i < len) {
+
+        uint8_t count = 1;
+        while(i + count < len && count < MAX_REPEAT
+        && !memcmp(&tiles[i + count], &tiles[i], sizeof(struct tile)))
+            count++;
+
+        m_edit_put(buff, &count, sizeof(count));
+        m_edit_put(buff, &tiles[i], sizeof(struct tile));
+        i += count;
+    }
+}
+
+/* Reads 'len' tiles stored as repeats into 'out', or skips over them when 
+ * 'out' is NULL */
+static const unsigned char *m_edit_get_repeats(const unsigned char *pos, size_t len, struct tile *out)
+{
+    size_t i = 0;
+    while(i < len) {
+
+        uint8_t count = *pos++;
+        struct tile tile;
+        memcpy(&tile, pos, sizeof(struct tile));
+        pos += sizeof(struct tile);
+
+        assert(count > 0 && i + count <= len);
+        for(int j = 0; out && j < count; j++)
+            out[i + j] = tile;
+        i += count;
+    }
+    return pos;
+}
+
+/* Packs the runs of tiles of the chunk that differ from its' copy from 
+ * before the edit. Returns the number of tiles in them. */
+static size_t m_edit_pack_chunk(struct edit_buff *buff, size_t idx, 
+                                const struct tile *before, const struct tile *after)
+{
+    size_t hdr_offset = buff->size;
+    struct edit_chunk hdr = (struct edit_chunk){idx, 0};
+    m_edit_put(buff, &hdr, sizeof(hdr));
+
+    size_t ret = 0;
+    int i = 0;
+    while(i < CHUNK_TILES) {
+
+        if(!memcmp(&before[i], &after[i], sizeof(struct tile))) {
+            i++;
+            continue;
+        }
+
+        int end = i + 1;
+        while(end < CHUNK_TILES && memcmp(&before[end], &after[end], sizeof(struct tile)))
+            end++;
+
+        struct edit_run run = (struct edit_run){i, end - i};
+        m_edit_put(buff, &run, sizeof(run));
+        m_edit_put_repeats(buff, before + i, run.len);
+        m_edit_put_repeats(buff, after + i, run.len);
+
+        hdr.num_runs++;
+        ret += run.len;
+        i = end;
+    }
+
+    if(!ret) {
+        /* Nothing changed, after all */
+        buff->size = hdr_offset;
+        return 0;
+    }
+
+    if(!buff->failed)
+        memcpy(buff->data + hdr_offset, &hdr, sizeof(hdr));
+    return ret;
+}
+
+static void m_edit_drop(struct map *map, size_t first, size_t count)
+{
+    for(int i = first; i < first + count; i++) {
+        map->edits.bytes -= map->edits.steps[i].size;
+        MEM_Free(map->edits.steps[i].data);
+    }
+
+    memmove(map->edits.steps + first, map->edits.steps + first + count, 
+        (map->edits.num_steps - first - count) * sizeof(struct map_edit));
+    map->edits.num_steps -= count;
+}
+
+static bool m_edit_push(struct map *map, struct map_edit edit)
+{
+    /* Undone edits can't be redone once something else was changed */
+    m_edit_drop(map, map->edits.num_done, map->edits.num_steps - map->edits.num_done);
+
+    if(map->edits.num_steps == map->edits.max_steps) {
+
+        size_t max = map->edits.max_steps ? map->edits.max_steps * 2 : 64;
+        void *steps = map->edits.steps ? MEM_Realloc(map->edits.steps, max * sizeof(struct map_edit))
+                                       : MEM_Malloc(MEM_TAG_MAP, max * sizeof(struct map_edit));
+        if(!steps)
+            return false;
+        map->edits.steps = steps;
+        map->edits.max_steps = max;
+    }
+
+    map->edits.steps[map->edits.num_steps++] = edit;
+    map->edits.num_done = map->edits.num_steps;
+    map->edits.bytes += edit.size;
+
+    /* The newest edit is always kept, whatever its' size */
+    size_t num_old = 0;
+    size_t bytes = map->edits.bytes;
+    while(bytes > CONFIG_MAP_EDIT_HISTORY && num_old < map->edits.num_steps - 1)
+        bytes -= map->edits.steps[num_old++].size;
+
+    m_edit_drop(map, 0, num_old);
+    map->edits.num_done -= num_old;
+    return true;
+}
+
+/* Sets the tiles of the edit to their values from after it, or from before
+ * it when 'redo' is false */
+static bool m_edit_apply(struct map *map, const struct map_edit *edit, bool redo,
+                         size_t *out_num_chunks, size_t out_chunks[])
+{
+    const unsigned char *pos = edit->data;
+    struct edit_hdr hdr;
+    memcpy(&hdr, pos, sizeof(hdr));
+    pos += sizeof(hdr);
+
+    struct tile_desc *descs = malloc(hdr.num_tiles * sizeof(struct tile_desc));
+    struct tile *tiles = malloc(hdr.num_tiles * sizeof(struct tile));
+    if(!descs || !tiles) {
+        free(descs);
+        free(tiles);
+        return false;
+    }
+
+    size_t n = 0;
+    for(int i = 0; i < hdr.num_chunks; i++) {
+
+        struct edit_chunk chunk;
+        memcpy(&chunk, pos, sizeof(chunk));
+        pos += sizeof(chunk);
+        out_chunks[i] = chunk.idx;
+
+        for(int j = 0; j < chunk.num_runs; j++) {
+
+            struct edit_run run;
+            memcpy(&run, pos, sizeof(run));
+            pos += sizeof(run);
+
+            pos = m_edit_get_repeats(pos, run.len, redo ? NULL : tiles + n);
+            pos = m_edit_get_repeats(pos, run.len, redo ? tiles + n : NULL);
+
+            for(int k = run.start; k < run.start + run.len; k++) {
+                descs[n++] = (struct tile_desc){
+                    .chunk_r = chunk.idx / map->width,
+                    .chunk_c = chunk.idx % map->width,
+                    .tile_r  = k / TILES_PER_CHUNK_WIDTH,
+                    .tile_c  = k % TILES_PER_CHUNK_WIDTH,
+                };
+            }
+        }
+    }
+    assert(n == hdr.num_tiles);
+    assert(pos == edit->data + edit->size);
+
+    bool ret = M_AL_UpdateTiles(map, n, descs, tiles);
+    *out_num_chunks = ret ? hdr.num_chunks : 0;
+
+    free(descs);
+    free(tiles);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool M_EditBegin(struct map *map)
+{
+    if(map->edits.recording)
+        return false;
+
+    map->edits.pending = MEM_Malloc(MEM_TAG_MAP, map->width * map->height * sizeof(size_t));
+    if(!map->edits.pending)
+        return false;
+
+    map->edits.num_pending = 0;
+    map->edits.recording = true;
+    return true;
+}
+
+bool M_EditEnd(struct map *map)
+{
+    if(!map->edits.recording)
+        return false;
+
+    struct edit_buff buff = {0};
+    struct edit_hdr hdr = {0};
+    m_edit_put(&buff, &hdr, sizeof(hdr));
+
+    for(int i = 0; i < map->edits.num_pending; i++) {
+
+        struct pfchunk *chunk = &map->chunks[map->edits.pending[i]];
+        size_t num_tiles = m_edit_pack_chunk(&buff, map->edits.pending[i], 
+            chunk->edit_before, chunk->tiles);
+
+        hdr.num_chunks += (num_tiles > 0);
+        hdr.num_tiles += num_tiles;
+
+        MEM_Free(chunk->edit_before);
+        chunk->edit_before = NULL;
+    }
+
+    MEM_Free(map->edits.pending);
+    map->edits.pending = NULL;
+    map->edits.num_pending = 0;
+    map->edits.recording = false;
+
+    if(buff.failed || !hdr.num_tiles)
+        goto fail;
+    memcpy(buff.data, &hdr, sizeof(hdr));
+
+    /* The buffer is grown by doubling, so it is trimmed before it is kept */
+    void *data = MEM_Realloc(buff.data, buff.size);
+    if(data)
+        buff.data = data;
+
+    if(!m_edit_push(map, (struct map_edit){buff.data, buff.size}))
+        goto fail;
+    return true;
+
+fail:
+    MEM_Free(buff.data);
+    return false;
+}
+
+bool M_EditUndo(struct map *map, size_t *out_num_chunks, size_t out_chunks[])
+{
+    if(map->edits.recording || map->edits.num_done == 0)
+        return false;
+
+    if(!m_edit_apply(map, &map->edits.steps[map->edits.num_done - 1], false, 
+        out_num_chunks, out_chunks))
+        return false;
+
+    map->edits.num_done--;
+    return true;
+}
+
+bool M_EditRedo(struct map *map, size_t *out_num_chunks, size_t out_chunks[])
+{
+    if(map->edits.recording || map->edits.num_done == map->edits.num_steps)
+        return false;
+
+    if(!m_edit_apply(map, &map->edits.steps[map->edits.num_done], true, 
+        out_num_chunks, out_chunks))
+        return false;
+
+    map->edits.num_done++;
+    return true;
+}
+
+void M_EditClear(struct map *map)
+{
+    m_edit_drop(map, 0, map->edits.num_steps);
+    map->edits.num_done = 0;
+}
+
+void M_GetEditStats(const struct map *map, struct map_edit_stats *out)
+{
+    out->undo = map->edits.num_done;
+    out->redo = map->edits.num_steps - map->edits.num_done;
+    out->bytes = map->edits.bytes;
+}
+
+bool M_EditTouchChunk(struct map *map, size_t chunk)
+{
+    if(!map->edits.recording || map->chunks[chunk].edit_before)
+        return true;
+
+    struct tile *before = MEM_Malloc(MEM_TAG_MAP, CHUNK_TILES * sizeof(struct tile));
+    if(!before)
+        return false;
+
+    memcpy(before, map->chunks[chunk].tiles, CHUNK_TILES * sizeof(struct tile));
+    map->chunks[chunk].edit_before = before;
+    map->edits.pending[map->edits.num_pending++] = chunk;
+    return true;
+}
+
+void M_EditFree(struct map *map)
+{
+    for(int i = 0; i < map->edits.num_pending; i++) {
+        MEM_Free(map->chunks[map->edits.pending[i]].edit_before);
+        map->chunks[map->edits.pending[i]].edit_before = NULL;
+    }
+    MEM_Free(map->edits.pending);
+    M_EditClear(map);
+    MEM_Free(map->edits.steps);
+    memset(&map->edits, 0, sizeof(map->edits));
+}
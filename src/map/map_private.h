@@ -36,8 +36,23 @@
 #ifndef MAP_PRIVATE_H
 #define MAP_PRIVATE_H
 
+#include "public/map.h"
 #include "pfchunk.h"
 #include "../pf_math.h"
+#include "../collision.h"
+
+#define MAX_PATH_LEN (512)
+
+/* A node of the quadtree over the map chunks, used for frustum culling */
+struct chunk_cull_node{
+    /* Bounds of all the chunks under this node */
+    struct aabb box;
+    /* The range of chunks under this node - the max bounds are exclusive */
+    int r_min, c_min;
+    int r_max, c_max;
+    /* Indices of the child nodes in the tree array - -1 for the missing ones */
+    int children[4];
+};
 
 struct map{
     /* ------------------------------------------------------------------------
@@ -60,12 +75,95 @@ struct map{
      * ------------------------------------------------------------------------
      */
     void *nav_private;
+    /* ------------------------------------------------------------------------
+     * Optional precomputed corner heights for every tile of the map, stored 
+     * in row-major order over the whole map. When NULL, heights are computed 
+     * from the tiles directly.
+     * ------------------------------------------------------------------------
+     */
+    struct tile_heights *heightfield;
+    /* ------------------------------------------------------------------------
+     * Path prefix for the map's cache files, which are named after the map
+     * file. Empty when the map is not backed by a file and nothing should be
+     * cached.
+     * ------------------------------------------------------------------------
+     */
+    char cache_path[MAX_PATH_LEN];
+    /* ------------------------------------------------------------------------
+     * All the chunk meshes in one buffer, for drawing the chunks that are in
+     * 'CHUNK_RENDER_MODE_REALTIME_BLEND' with a single call. NULL if the 
+     * chunks couldn't be batched, in which case they are drawn one by one.
+     * ------------------------------------------------------------------------
+     */
+    void *terrain_batch;
+    /* ------------------------------------------------------------------------
+     * Set for maps that are too large for the GPU buffers of all the chunks 
+     * to be kept at once. Only the chunks around the camera are then made 
+     * resident, by 'M_StreamStep'. 'stream_frame' counts its' calls.
+     * ------------------------------------------------------------------------
+     */
+    bool streamed;
+    size_t num_resident;
+    uint32_t stream_frame;
+    /* ------------------------------------------------------------------------
+     * Set while the map is in 'CHUNK_RENDER_MODE_HYBRID', in which case the
+     * chunks' modes are picked by 'M_HybridStep'.
+     * ------------------------------------------------------------------------
+     */
+    bool hybrid;
+    /* ------------------------------------------------------------------------
+     * The camera's motion, followed by 'M_StreamStep' on streamed maps to 
+     * predict the chunks about to come into view. 'order' holds the chunks 
+     * in view followed by the predicted ones, soonest first, so that they 
+     * are baked ahead of the rest. It has room for all the chunks, and is
+     * NULL when the map isn't streamed.
+     * ------------------------------------------------------------------------
+     */
+    struct{
+        bool     have_pos;
+        vec3_t   last_pos;
+        uint32_t last_ticks;
+        vec3_t   velocity;
+        size_t  *order;
+        size_t   num_order;
+        struct map_stream_stats stats;
+    }prefetch;
+    /* ------------------------------------------------------------------------
+     * Quadtree over the chunks for culling them against the view frustum, 
+     * stored with the root at index 0. NULL if it couldn't be built, in which 
+     * case every chunk is tested.
+     * ------------------------------------------------------------------------
+     */
+    struct chunk_cull_node *cull_tree;
+    /* ------------------------------------------------------------------------
+     * The recorded tile edits, oldest first. The first 'num_done' of them 
+     * are applied to the tiles and the rest have been undone. While an edit
+     * is being recorded, 'pending' holds the indices of the chunks it has 
+     * touched so far.
+     * ------------------------------------------------------------------------
+     */
+    struct{
+        struct map_edit *steps;
+        size_t           num_steps, max_steps;
+        size_t           num_done;
+        size_t           bytes;
+        bool             recording;
+        size_t          *pending;
+        size_t           num_pending;
+    }edits;
     /* ------------------------------------------------------------------------
      * The map chunks stored in row-major order. In total, there must be 
-     * (width * height) number of chunks.
+     * (width * height) number of chunks. Each chunk's tiles and render
+     * private buffer are allocated on their own.
      * ------------------------------------------------------------------------
      */
-    struct pfchunk chunks[];
+    struct pfchunk *chunks;
+};
+
+/* The runs of tiles changed by one edit, packed by 'M_EditEnd' */
+struct map_edit{
+    unsigned char *data;
+    size_t         size;
 };
 
 struct chunkpos{
@@ -73,5 +171,71 @@ struct chunkpos{
 };
 
 void M_ModelMatrixForChunk(const struct map *map, struct chunkpos p, mat4x4_t *out);
+void M_AABBForChunk(const struct map *map, struct chunkpos p, struct aabb *out);
+
+/* ------------------------------------------------------------------------
+ * Allocate and fill the heightfield from the current tiles, and compute 
+ * the chunks' height bounds. On failure, the map is left without a 
+ * heightfield and height queries will use the tiles.
+ * ------------------------------------------------------------------------
+ */
+bool M_BuildHeightfield(struct map *map);
+
+/* ------------------------------------------------------------------------
+ * Refresh the heightfield entry and the chunk height bound for a single 
+ * tile after it was modified.
+ * ------------------------------------------------------------------------
+ */
+void M_UpdateHeightfieldTile(struct map *map, int chunk_r, int chunk_c, int tile_r, int tile_c);
+
+/* ------------------------------------------------------------------------
+ * (Re)create the terrain batch from the chunks' current meshes and 
+ * materials. On failure, the map is left without one.
+ * ------------------------------------------------------------------------
+ */
+bool M_BuildTerrainBatch(struct map *map);
+
+/* ------------------------------------------------------------------------
+ * (Re)create the chunk culling quadtree. Must be called again whenever the 
+ * map is moved. On failure, the map is left without one.
+ * ------------------------------------------------------------------------
+ */
+bool M_BuildCullTree(struct map *map);
+
+/* ------------------------------------------------------------------------
+ * Create the GPU buffers of the non-resident chunks among 'chunks' (row-
+ * major indices), or free those of a resident one. Streamed in chunks are
+ * not marked as used, so they are the first to be evicted again unless 
+ * they are near the camera. Returns false if not all of them were made 
+ * resident.
+ * ------------------------------------------------------------------------
+ */
+bool M_StreamIn(struct map *map, const size_t *chunks, size_t count);
+void M_StreamOut(struct map *map, size_t chunk);
+
+/* ------------------------------------------------------------------------
+ * Frees the baked meshes of a chunk, if it has any. The chunk's mode is 
+ * left for the caller to change.
+ * ------------------------------------------------------------------------
+ */
+void M_DropBake(struct map *map, size_t chunk);
+
+/* ------------------------------------------------------------------------
+ * The worldspace XZ position that a click at the mouse cursor's position 
+ * would move the camera to. Returns false if the cursor isn't over the 
+ * minimap.
+ * ------------------------------------------------------------------------
+ */
+bool M_MinimapCursorTarget(const struct map *map, vec2_t *out_xz);
+
+/* ------------------------------------------------------------------------
+ * Called before a chunk's tiles are first changed by a tile update. While 
+ * an edit is being recorded, it keeps a copy of the tiles for it. No tile 
+ * of the chunk may be changed if it fails. 'M_EditFree' drops the whole 
+ * history when the map is freed.
+ * ------------------------------------------------------------------------
+ */
+bool M_EditTouchChunk(struct map *map, size_t chunk);
+void M_EditFree(struct map *map);
 
 #endif
@@ -39,10 +39,14 @@
 #include "../collision.h"
 #include "../game/public/game.h"
 #include "../event.h"
+#include "../config.h"
 
 #include <SDL.h>
 
 #include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
@@ -152,15 +156,25 @@ bool M_InitMinimap(struct map *map, vec2_t center_pos)
     assert(map);
     map->minimap_center_pos = center_pos;
 
-    void *chunk_rprivates[map->width * map->height];
-    mat4x4_t chunk_model_mats[map->width * map->height];
+    const size_t nchunks = map->width * map->height;
+    void **chunk_rprivates = malloc(nchunks * sizeof(void*));
+    mat4x4_t *chunk_model_mats = malloc(nchunks * sizeof(mat4x4_t));
+    if(!chunk_rprivates || !chunk_model_mats) {
+        free(chunk_rprivates);
+        free(chunk_model_mats);
+        return false;
+    }
+    uint64_t key = BAKE_CACHE_HASH_INIT;
 
     for(int r = 0; r < map->height; r++) {
         for(int c = 0; c < map->width; c++) {
             
             const struct pfchunk *curr = &map->chunks[r * map->width + c];
-            chunk_rprivates[r * map->width + c] = curr->render_private_tiles;
+            chunk_rprivates[r * map->width + c] = curr->resident ? curr->render_private_tiles : NULL;
             M_ModelMatrixForChunk(map, (struct chunkpos){r, c}, chunk_model_mats + (r * map->width + c));
+
+            key = R_GL_TileBakeKey(key, curr->render_private_tiles, curr->tiles, 
+                TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, chunk_model_mats + (r * map->width + c));
         }
     }
     
@@ -170,8 +184,50 @@ bool M_InitMinimap(struct map *map, vec2_t center_pos)
     };
     vec3_t map_center = (vec3_t){ map->pos.x - map_size.raw[0]/2.0f, map->pos.y, map->pos.z + map_size.raw[1]/2.0f };
 
+    char cache_path[sizeof(map->cache_path) + 32];
+    snprintf(cache_path, sizeof(cache_path), "%s.minimap.pfbake", map->cache_path);
+
+    bool partial;
     bool ret = R_GL_MinimapBake(chunk_rprivates, chunk_model_mats, 
-        map->width, map->height, map_center, map_size);
+        map->width, map->height, map_center, map_size, 
+        key, strlen(map->cache_path) ? cache_path : NULL, &partial);
+
+    /* The chunks of streamed maps that weren't resident are drawn in a batch 
+     * at a time, each streamed in just for it. They aren't marked as used, so 
+     * they are evicted again by the next 'M_StreamStep'. */
+    bool filled = true;
+    for(int i = 0; ret && partial && i < map->width * map->height; i += CONFIG_MINIMAP_CHUNKS_PER_FRAME) {
+
+        size_t batch[CONFIG_MINIMAP_CHUNKS_PER_FRAME];
+        void *rprivates[CONFIG_MINIMAP_CHUNKS_PER_FRAME];
+        size_t count = 0;
+
+        for(int j = i; j < map->width * map->height && j < i + CONFIG_MINIMAP_CHUNKS_PER_FRAME; j++) {
+            if(!chunk_rprivates[j])
+                batch[count++] = j;
+        }
+
+        if(!M_StreamIn(map, batch, count)) {
+            filled = false;
+            continue;
+        }
+
+        mat4x4_t models[CONFIG_MINIMAP_CHUNKS_PER_FRAME];
+        for(int j = 0; j < count; j++) {
+            rprivates[j] = map->chunks[batch[j]].render_private_tiles;
+            models[j] = chunk_model_mats[batch[j]];
+        }
+
+        R_GL_MinimapUpdateChunks(rprivates, models, count, map_center, map_size);
+        for(int j = 0; j < count; j++)
+            M_StreamOut(map, batch[j]);
+    }
+
+    if(ret && partial && filled && strlen(map->cache_path))
+        R_GL_MinimapStore(cache_path);
+
+    free(chunk_rprivates);
+    free(chunk_model_mats);
 
     if(ret) {
         E_Global_Register(SDL_MOUSEBUTTONDOWN, on_mouseclick, map);
@@ -180,18 +236,49 @@ bool M_InitMinimap(struct map *map, vec2_t center_pos)
     return ret;
 }
 
-bool M_UpdateMinimapChunk(const struct map *map, int chunk_r, int chunk_c)
+bool M_UpdateMinimapChunk(struct map *map, int chunk_r, int chunk_c)
+{
+    if(chunk_r < 0 || chunk_r >= map->height || chunk_c < 0 || chunk_c >= map->width)
+        return false;
+
+    map->chunks[chunk_r * map->width + chunk_c].minimap_dirty = true;
+    return true;
+}
+
+void M_MinimapStep(struct map *map)
 {
+    void *rprivates[CONFIG_MINIMAP_CHUNKS_PER_FRAME];
+    mat4x4_t models[CONFIG_MINIMAP_CHUNKS_PER_FRAME];
+    size_t count = 0;
+
+    for(int r = 0; r < map->height && count < CONFIG_MINIMAP_CHUNKS_PER_FRAME; r++) {
+        for(int c = 0; c < map->width && count < CONFIG_MINIMAP_CHUNKS_PER_FRAME; c++) {
+
+            struct pfchunk *chunk = &map->chunks[r * map->width + c];
+            if(!chunk->minimap_dirty)
+                continue;
+
+            /* A chunk that can't be streamed in stays queued up */
+            if(!chunk->resident && !M_StreamIn(map, &(size_t){r * map->width + c}, 1))
+                continue;
+
+            chunk->minimap_dirty = false;
+            rprivates[count] = chunk->render_private_tiles;
+            M_ModelMatrixForChunk(map, (struct chunkpos){r, c}, &models[count]);
+            count++;
+        }
+    }
+
+    if(!count)
+        return;
+
     vec2_t map_size = (vec2_t) {
         map->width * TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE, 
         map->height * TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE
     };
     vec3_t map_center = (vec3_t){ map->pos.x - map_size.raw[0]/2.0f, map->pos.y, map->pos.z + map_size.raw[1]/2.0f };
-    mat4x4_t model;
-    M_ModelMatrixForChunk(map, (struct chunkpos){chunk_r, chunk_c}, &model);
 
-    return R_GL_MinimapUpdateChunk(map, map->chunks[chunk_r * map->width + chunk_c].render_private_tiles, &model,
-        map_center, map_size);
+    R_GL_MinimapUpdateChunks(rprivates, models, count, map_center, map_size);
 }
 
 void M_FreeMinimap(struct map *map)
@@ -241,3 +328,14 @@ bool M_MouseOverMinimap(const struct map *map)
     return C_PointInsideRect2D(mouse_pos, a, b, c ,d);
 }
 
+bool M_MinimapCursorTarget(const struct map *map, vec2_t *out_xz)
+{
+    if(!M_MouseOverMinimap(map))
+        return false;
+
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+    *out_xz = m_minimap_mouse_coords_to_world(map, (vec2_t){mouse_x, mouse_y});
+    return true;
+}
+
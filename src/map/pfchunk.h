@@ -41,10 +41,38 @@
 #include "../pf_math.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 
 struct pfchunk{
 
     enum chunk_render_mode mode;
+    /* ------------------------------------------------------------------------
+     * Set when the chunk is waiting to be baked by 'M_BakeStep'. It keeps its
+     * current 'mode' until the bake completes.
+     * ------------------------------------------------------------------------
+     */
+    bool            bake_pending;
+    /* ------------------------------------------------------------------------
+     * Set when the last bake of the chunk failed, so that the hybrid mode 
+     * doesn't keep retrying it. Cleared when the chunk's tiles change.
+     * ------------------------------------------------------------------------
+     */
+    bool            bake_failed;
+    /* ------------------------------------------------------------------------
+     * Set when tiles were modified since the chunk's meshes were last 
+     * updated. The inclusive bounds of the modified tiles are only valid 
+     * while it is set.
+     * ------------------------------------------------------------------------
+     */
+    bool            dirty;
+    int             dirty_r_min, dirty_c_min;
+    int             dirty_r_max, dirty_c_max;
+    /* ------------------------------------------------------------------------
+     * Set when the chunk's region of the minimap is waiting to be rendered 
+     * again by 'M_MinimapStep'.
+     * ------------------------------------------------------------------------
+     */
+    bool            minimap_dirty;
     /* ------------------------------------------------------------------------
      * Initialized and used by the rendering subsystem. Holds the mesh data 
      * and everything the rendering subsystem needs to render this PFChunk.
@@ -55,16 +83,58 @@ struct pfchunk{
      */
     void           *render_private_tiles;
     void           *render_private_prebaked;
+    /* ------------------------------------------------------------------------
+     * Set while the mesh of 'render_private_tiles' and the prebaked contexts
+     * are on the GPU. Only the chunks of streamed maps are ever without them,
+     * in which case they must not be drawn. 'last_used' is the stream frame 
+     * in which the chunk was last needed, for evicting the oldest first.
+     * 'last_visible' is the stream frame in which it was last in view, and 
+     * 'prefetched' is set when it was streamed in before coming into view, 
+     * until it does.
+     * ------------------------------------------------------------------------
+     */
+    bool            resident;
+    uint32_t        last_used;
+    uint32_t        last_visible;
+    bool            prefetched;
+    /* ------------------------------------------------------------------------
+     * Reduced version of the prebaked context, used in place of it when the 
+     * chunk is far from the camera. May be NULL.
+     * ------------------------------------------------------------------------
+     */
+    void           *render_private_lod;
+    /* ------------------------------------------------------------------------
+     * Upper bound of the world-space Y coordinate of the chunk's surface, for
+     * skipping the chunk when raycasting. Tile updates only ever raise it, so
+     * it may be above the actual maximum until the heightfield is rebuilt.
+     * ------------------------------------------------------------------------
+     */
+    float           max_height;
     /* ------------------------------------------------------------------------
      * Worldspace position of the top left corner. 
      * ------------------------------------------------------------------------
      */
     vec3_t          position;
     /* ------------------------------------------------------------------------
-     * Each tiles' attributes, stored in row-major order.
+     * A copy of 'tiles' as they were loaded, made just before the first of 
+     * them is changed. NULL while the chunk is as it was loaded. It is what 
+     * the tile deltas of game snapshots are taken against.
+     * ------------------------------------------------------------------------
+     */
+    struct tile    *pristine;
+    /* ------------------------------------------------------------------------
+     * A copy of 'tiles' from before the edit being recorded first changed 
+     * them. NULL when there is no such edit or it didn't touch the chunk.
+     * ------------------------------------------------------------------------
+     */
+    struct tile    *edit_before;
+    /* ------------------------------------------------------------------------
+     * Each tiles' attributes, stored in row-major order. There are 
+     * (TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH) of them, in the same 
+     * allocation as 'render_private_tiles'.
      * ------------------------------------------------------------------------
      */
-    struct tile     tiles[TILES_PER_CHUNK_HEIGHT * TILES_PER_CHUNK_WIDTH];
+    struct tile    *tiles;
 };
 
 #endif
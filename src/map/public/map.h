@@ -36,6 +36,7 @@
 #ifndef MAP_H
 #define MAP_H
 
+#include "tile.h"
 #include "../../pf_math.h"
 #include "../../navigation/public/nav.h" /* dest_id_t */
 
@@ -56,6 +57,28 @@ struct camera;
 struct tile;
 struct tile_desc;
 struct obb;
+struct aabb;
+struct shadow_caster;
+
+struct map_hit{
+    /* Ray parameter of the hit, in units of the ray direction's length */
+    float            t;
+    vec3_t           pos;
+    struct tile_desc tile;
+};
+
+enum tile_height_kind{
+    TILE_HEIGHT_FLAT,
+    TILE_HEIGHT_RAMP,
+    /* Corner tiles are not bilinear - they must be sampled from the tile */
+    TILE_HEIGHT_EXACT,
+};
+
+struct tile_heights{
+    enum tile_height_kind kind;
+    /* Corner heights, already scaled to world-space Y coordinates */
+    float nw, ne, sw, se;
+};
 
 enum chunk_render_mode{
 
@@ -69,6 +92,19 @@ enum chunk_render_mode{
      * process we also strip away any non-visible tile faces. This makes rendering
      * much faster but it is not suitable for real-time terrain updates.*/
     CHUNK_RENDER_MODE_PREBAKED,
+
+    /* The third option draws the tiles like the first, but the blending 
+     * weights of the chunk's 4 most common materials are precomputed into a
+     * texture. It takes far fewer texture samples per pixel, at the cost of 
+     * any other materials in the chunk blending as the most common one. */
+    CHUNK_RENDER_MODE_REALTIME_SPLAT,
+
+    /* Only for 'M_SetMapRenderMode' - no chunk is ever in this mode itself.
+     * The chunks in view near the camera are drawn like the first option 
+     * and the distant ones like the second. The chunks are baked once they
+     * are first seen from afar, and their baked meshes are kept for when
+     * they are far from the camera again. */
+    CHUNK_RENDER_MODE_HYBRID,
 };
 
 /*###########################################################################*/
@@ -83,18 +119,24 @@ enum chunk_render_mode{
 void   M_RenderEntireMap    (const struct map *map);
 
 /* ------------------------------------------------------------------------
- * Renders the chunks of the map that are currently visible by the specified
- * camera using a frustrum-chunk intersection test.
+ * Submits the chunks of the map that are currently visible by the specified
+ * camera (using a frustrum-chunk intersection test) to the render queue. 
+ * They are drawn at the next 'R_Queue_Flush'. With 'depth_prepass' set, the
+ * depth of the batched chunks is drawn before they are shaded. With 
+ * 'heightfield' set, the batched chunks are drawn from their' tiles by the
+ * vertex shader rather than from copies of their' meshes.
  * ------------------------------------------------------------------------
  */
-void   M_RenderVisibleMap   (const struct map *map, const struct camera *cam);
+void   M_RenderVisibleMap   (const struct map *map, const struct camera *cam, bool depth_prepass,
+                             bool heightfield);
 
 /* ------------------------------------------------------------------------
  * Render a layer over the visible map surface showing which regions are 
- * pathable and which are not.
+ * pathable and which are not for units using the specified navigation layer.
  * ------------------------------------------------------------------------
  */
-void   M_RenderVisiblePathableLayer(const struct map *map, const struct camera *cam);
+void   M_RenderVisiblePathableLayer(const struct map *map, const struct camera *cam,
+                                    enum nav_layer layer);
 
 /* ------------------------------------------------------------------------
  * Centers the map at the worldspace origin.
@@ -131,6 +173,14 @@ void   M_Raycast_Uninstall(void);
  */
 void   M_Raycast_SetHighlightSize(size_t size);
 
+/* ------------------------------------------------------------------------
+ * Adds the highlight of the tiles under the mouse cursor to the decals 
+ * drawn over the terrain. To be called every frame, before the terrain is
+ * rendered.
+ * ------------------------------------------------------------------------
+ */
+void   M_Raycast_SubmitDecals(void);
+
 /* ------------------------------------------------------------------------
  * If returning true, the height of the map under the mouse cursor will be
  * written to 'out'. Otherwise, the mouse cursor is not over the map surface.
@@ -138,21 +188,96 @@ void   M_Raycast_SetHighlightSize(size_t size);
  */
 bool   M_Raycast_IntersecCoordinate(vec3_t *out);
 
+/* ------------------------------------------------------------------------
+ * Finds the first point where the ray hits the map surface, including the 
+ * side faces of raised tiles. The ray is marched over the tiles, skipping 
+ * chunks it passes over entirely, and tested against the exact shape of 
+ * each tile's surface. 'dir' does not have to be normalized. Returns false 
+ * if the ray misses the map.
+ * ------------------------------------------------------------------------
+ */
+bool   M_Raycast(const struct map *map, vec3_t origin, vec3_t dir, struct map_hit *out);
+
 /* ------------------------------------------------------------------------
  * Sets the rendering mode for a particular chunk. In the case that the 
  * mode is 'CHUNK_RENDER_MODE_PREBAKED', the baking will be performed in
- * this call.
+ * this call, unless the chunk's baked meshes are still around.
  * ------------------------------------------------------------------------
  */
 void   M_SetChunkRenderMode(struct map *map, int chunk_r, int chunk_c, 
                             enum chunk_render_mode mode);
 
 /* ------------------------------------------------------------------------
- * Sets the render mode for every chunk in the map.
+ * Sets the render mode for every chunk in the map. Unlike with 
+ * 'M_SetChunkRenderMode', switching to 'CHUNK_RENDER_MODE_PREBAKED' only
+ * queues up the chunks for baking, which is then done a few chunks at a 
+ * time by 'M_BakeStep'. Until its bake completes, a chunk keeps being 
+ * rendered in its previous mode. 'CHUNK_RENDER_MODE_HYBRID' leaves the 
+ * chunks' modes to 'M_HybridStep'.
  * ------------------------------------------------------------------------
  */
 void   M_SetMapRenderMode(struct map *map, enum chunk_render_mode mode);
 
+/* ------------------------------------------------------------------------
+ * In 'CHUNK_RENDER_MODE_HYBRID', switches the chunks in view closer than 
+ * CONFIG_TERRAIN_HYBRID_DIST to the camera over to realtime blending, and
+ * the ones further than that by more than CONFIG_TERRAIN_HYBRID_MARGIN to
+ * their baked meshes, queueing them up for baking if they have none. The 
+ * chunks in between keep their current mode, so that a camera hovering 
+ * around the distance doesn't flip them back and forth. Meant to be called
+ * once per frame, before 'M_BakeStep'.
+ * ------------------------------------------------------------------------
+ */
+void   M_HybridStep(struct map *map, const struct camera *cam);
+
+/* ------------------------------------------------------------------------
+ * Bakes up to CONFIG_BAKE_CHUNKS_PER_FRAME of the chunks queued up by 
+ * 'M_SetMapRenderMode', with the meshes being built in parallel. Meant to 
+ * be called once per frame, before the active camera's view is set, as 
+ * baking renders with its own camera.
+ * ------------------------------------------------------------------------
+ */
+void   M_BakeStep(struct map *map);
+
+/* ------------------------------------------------------------------------
+ * For maps with more than CONFIG_TERRAIN_STREAM_MIN_CHUNKS chunks, creates
+ * the GPU buffers of the chunks in view of the camera and those next to 
+ * them, and frees the least recently needed ones once there are more than
+ * CONFIG_TERRAIN_RESIDENT_CHUNKS. The tiles always stay in memory. Does 
+ * nothing for smaller maps, which keep all their buffers. Meant to be 
+ * called once per frame, before 'M_BakeStep'.
+ * ------------------------------------------------------------------------
+ */
+void   M_StreamStep(struct map *map, const struct camera *cam);
+
+struct map_stream_stats{
+    /* Chunks that came into view with their buffers already resident */
+    uint64_t hits;
+    /* Of those, the ones that were streamed in ahead of time */
+    uint64_t prefetch_hits;
+    /* Chunks that came into view without their buffers, which then had to
+     * be streamed in during the same frame */
+    uint64_t late_loads;
+    /* Chunks that came into view while still waiting to be baked */
+    uint64_t late_bakes;
+    /* Chunks streamed in ahead of time, and the ones of those that were 
+     * freed again without ever coming into view */
+    uint64_t prefetched;
+    uint64_t wasted;
+    size_t   resident;
+};
+
+/* ------------------------------------------------------------------------
+ * On streamed maps, the chunks the camera is predicted to see soon are 
+ * streamed in ahead of time by 'M_StreamStep' too, and baked right after
+ * the ones in view. The prediction follows the camera's motion, including
+ * its' height, and the spot under the cursor when it is over the minimap.
+ * These are the counts since the map was loaded. All zero for maps which
+ * aren't streamed.
+ * ------------------------------------------------------------------------
+ */
+void   M_GetStreamStats(const struct map *map, struct map_stream_stats *out);
+
 /* ------------------------------------------------------------------------
  * Utility function to convert an XZ worldspace coordinate to one in the 
  * range (-1, -1) in the 'top left' corner to (1, 1) in the 'bottom right' 
@@ -165,6 +290,32 @@ void   M_SetMapRenderMode(struct map *map, enum chunk_render_mode mode);
  */
 vec2_t M_WorldCoordsToNormMapCoords(const struct map *map, vec2_t xz);
 
+/* ------------------------------------------------------------------------
+ * The number of chunks of the map and of tiles in each chunk.
+ * ------------------------------------------------------------------------
+ */
+void   M_GetResolution(const struct map *map, struct map_resolution *out);
+
+/* ------------------------------------------------------------------------
+ * The world position of the map's top left corner. The columns of tiles 
+ * go towards -X and the rows towards +Z.
+ * ------------------------------------------------------------------------
+ */
+vec3_t M_GetPos(const struct map *map);
+
+/* ------------------------------------------------------------------------
+ * The world-space box holding all of the map's terrain.
+ * ------------------------------------------------------------------------
+ */
+void   M_GetBounds(const struct map *map, struct aabb *out);
+
+/* ------------------------------------------------------------------------
+ * Writes a shadow caster for each of the map's chunks to 'out', which must 
+ * have room for (width * height) of them. Returns the number written.
+ * ------------------------------------------------------------------------
+ */
+size_t M_GetShadowCasters(const struct map *map, struct shadow_caster *out);
+
 /* ------------------------------------------------------------------------
  * Returns true if the XZ coordinate is within the map bounds.
  * ------------------------------------------------------------------------
@@ -184,6 +335,29 @@ vec2_t M_ClampedMapCoordinate(const struct map *map, vec2_t xz);
  */
 float  M_HeightAtPoint(const struct map *map, vec2_t xz);
 
+/* ------------------------------------------------------------------------
+ * Batched version of 'M_HeightAtPoint', writing the height for each of the
+ * 'n' XZ points to 'out'. All points must be within the map bounds.
+ * ------------------------------------------------------------------------
+ */
+void   M_HeightAtPoints(const struct map *map, const vec2_t *xz, float *out, size_t n);
+
+/* ------------------------------------------------------------------------
+ * The tiles of the chunk, in row-major order. NULL if the chunk is outside 
+ * the map. The tiles are updated in place, and stay valid until the map is 
+ * freed.
+ * ------------------------------------------------------------------------
+ */
+const struct tile         *M_ChunkTiles(const struct map *map, int chunk_r, int chunk_c);
+
+/* ------------------------------------------------------------------------
+ * The heights of every tile of the map, in row-major order over the whole
+ * map (not chunk by chunk). NULL if the heightfield couldn't be built. 
+ * Valid until the map is freed.
+ * ------------------------------------------------------------------------
+ */
+const struct tile_heights *M_Heightfield(const struct map *map);
+
 /* ------------------------------------------------------------------------
  * Make an impassable region in the navigation data, making it not possible 
  * for pathable units to pass through the region underneath the OBB.
@@ -191,6 +365,13 @@ float  M_HeightAtPoint(const struct map *map, vec2_t xz);
  */
 void   M_NavCutoutStaticObject(const struct map *map, const struct obb *obb);
 
+/* ------------------------------------------------------------------------
+ * Batched version of 'M_NavCutoutStaticObject', which is much cheaper for 
+ * many objects at once.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavCutoutStaticObjects(const struct map *map, size_t count, const struct obb *obbs);
+
 /* ------------------------------------------------------------------------
  * Update navigation private data after calls to 'M_NavCutoutStaticObject'.
  * (ex. to remove a path in case it was blocked off by a placed object)
@@ -198,6 +379,22 @@ void   M_NavCutoutStaticObject(const struct map *map, const struct obb *obb);
  */
 void   M_NavUpdatePortals(const struct map *map);
 
+/* ------------------------------------------------------------------------
+ * Mark a circle of the map as (temporarily) occupied, making paths prefer 
+ * going around it. Every incref must be matched with a decref with the 
+ * same arguments once the region is no longer occupied.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavBlockersIncref(const struct map *map, vec2_t xz_pos, float radius);
+void   M_NavBlockersDecref(const struct map *map, vec2_t xz_pos, float radius);
+
+/* ------------------------------------------------------------------------
+ * Update navigation private data after calls to 'M_NavBlockersIncref' and
+ * 'M_NavBlockersDecref'. Meant to be called once per tick.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavUpdateBlockers(const struct map *map);
+
 /* ------------------------------------------------------------------------
  * Makes a path request to the navigation subsystem, causing the required
  * flowfields to be generated and cached. Returns true if a successful path
@@ -205,7 +402,54 @@ void   M_NavUpdatePortals(const struct map *map);
  * ------------------------------------------------------------------------
  */
 bool   M_NavRequestPath(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
-                        dest_id_t *out_dest_id);
+                        enum nav_layer layer, dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Like 'M_NavRequestPath' but the fields are generated in the background.
+ * The returned ticket must be polled with 'M_NavPollPath' until it is no 
+ * longer pending, and then released with 'M_NavReleasePath'.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t    M_NavRequestPathAsync(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
+                                       enum nav_layer layer, dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Request paths from many sources to a single destination, with the work
+ * shared between all the sources. 'M_NavPathFound' reports the outcome for
+ * the individual sources once the ticket is ready.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t    M_NavRequestPathsAsync(const struct map *map, size_t num_srcs, 
+                                        const vec2_t xz_srcs[], vec2_t xz_dest, 
+                                        enum nav_layer layer, dest_id_t *out_dest_id);
+enum path_status M_NavPollPath(path_ticket_t ticket);
+bool             M_NavPathFound(path_ticket_t ticket, size_t src_idx);
+void             M_NavReleasePath(path_ticket_t ticket);
+
+/* ------------------------------------------------------------------------
+ * Get a path for a single unit as a list of points to head for in turn,
+ * without generating any fields. Refer to the 'N_RequestWaypoints' comment
+ * for the details.
+ * ------------------------------------------------------------------------
+ */
+size_t M_NavRequestWaypoints(const struct map *map, vec2_t xz_src, vec2_t xz_dest, 
+                             enum nav_layer layer, size_t maxout, vec2_t out[], 
+                             dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * In deterministic mode, background path requests are always ready the 
+ * first time they are polled, and so are the fields requested on flow
+ * field misses.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavSetDeterministic(bool on);
+
+/* ------------------------------------------------------------------------
+ * Background path requests made near the camera are serviced ahead of the
+ * ones made far away from it. Meant to be called once per frame.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavSetPathFocus(const struct camera *cam);
 
 /* ------------------------------------------------------------------------
  * Render the flow field that will steer entities towards a particular 
@@ -233,10 +477,27 @@ bool   M_NavHasDestLOS(const struct map *map, dest_id_t id, vec2_t curr_pos);
 
 /* ------------------------------------------------------------------------
  * Returns true if the specified positions is pathable (i.e. a unit is 
- * allowed to stand on this region of the map)
+ * allowed to stand on this region of the map) for units using the 
+ * specified navigation layer.
  * ------------------------------------------------------------------------
  */
-bool   M_NavPositionPathable(const struct map *map, vec2_t xz_pos);
+bool   M_NavPositionPathable(const struct map *map, enum nav_layer layer, vec2_t xz_pos);
+
+/* ------------------------------------------------------------------------
+ * Batched navigation queries on the points of the map. Refer to the 
+ * 'N_PathsExist', 'N_PathCosts', 'N_PositionsPathable' and 'N_Raycasts'
+ * comments for the details.
+ * ------------------------------------------------------------------------
+ */
+void   M_NavPathsExist(const struct map *map, enum nav_layer layer, size_t n, 
+                       const vec2_t xz_srcs[], const vec2_t xz_dests[], bool out[]);
+void   M_NavPathCosts(const struct map *map, enum nav_layer layer, size_t n, 
+                      const vec2_t xz_srcs[], const vec2_t xz_dests[], float out[]);
+void   M_NavPositionsPathable(const struct map *map, enum nav_layer layer, size_t n,
+                              const vec2_t xz_positions[], bool out[]);
+void   M_NavRaycasts(const struct map *map, enum nav_layer layer, size_t n, 
+                     const vec2_t xz_srcs[], const vec2_t xz_dests[], 
+                     bool out_hit[], vec2_t out_pos[]);
 
 /*###########################################################################*/
 /* MINIMAP                                                                   */
@@ -249,11 +510,20 @@ bool   M_NavPositionPathable(const struct map *map, vec2_t xz_pos);
 bool   M_InitMinimap     (struct map *map, vec2_t center_pos);
 
 /* ------------------------------------------------------------------------
- * Update a chunk-sized region of the minimap texture with the most 
- * up-to-date vertex data.
+ * Queue up a chunk-sized region of the minimap texture to be updated with 
+ * the most up-to-date vertex data. A chunk is only rendered once however 
+ * many times it's queued up before the update.
  * ------------------------------------------------------------------------
  */
-bool   M_UpdateMinimapChunk(const struct map *map, int chunk_r, int chunk_c);
+bool   M_UpdateMinimapChunk(struct map *map, int chunk_r, int chunk_c);
+
+/* ------------------------------------------------------------------------
+ * Renders up to CONFIG_MINIMAP_CHUNKS_PER_FRAME of the chunks queued up by
+ * 'M_UpdateMinimapChunk' into the minimap texture. Like 'M_BakeStep', it
+ * must be called before the active camera's view is set.
+ * ------------------------------------------------------------------------
+ */
+void   M_MinimapStep(struct map *map);
 
 /* ------------------------------------------------------------------------
  * Frees the resources allocated by 'M_InitMinimap'.
@@ -286,11 +556,30 @@ bool   M_MouseOverMinimap(const struct map *map);
 
 /* ------------------------------------------------------------------------
  * Initialize private map data ('outmap', which is allocated by the calleer) 
- * from PFMAP stream.
+ * from PFMAP stream, which must be a text stream (see 'AL_OpenText').
+ * If 'cachepath' is not NULL, it is the path prefix of the map's cache 
+ * files. The navigation data is read from the PFNAV file '<cachepath>.pfnav'
+ * when it is up to date with the map's tiles. Otherwise, the navigation 
+ * data is built from scratch and then written to the file. Baked chunk and 
+ * minimap textures are cached in '.pfbake' files with the same prefix.
  * ------------------------------------------------------------------------
  */
 bool   M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedir,
-                              SDL_RWops *stream, void *outmap);
+                              const char *cachepath, SDL_RWops *stream, void *outmap);
+
+/* ------------------------------------------------------------------------
+ * After the map has been loaded from the stream, its' tiles and materials 
+ * are also written to the binary PFMAP file '<cachepath>.pfmapb'. It holds
+ * a table with the offset of every chunk, so the chunks are decoded and 
+ * their vertices built in parallel. 'M_AL_HeaderFromBinary' checks that the
+ * contents of the file can be loaded by this build and fills in the header,
+ * after which 'M_AL_InitMapFromBinary' initializes the map from the same 
+ * contents, with the same use of 'cachepath' as 'M_AL_InitMapFromStream'.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_HeaderFromBinary(const void *data, size_t size, struct pfmap_hdr *out);
+bool   M_AL_InitMapFromBinary(const struct pfmap_hdr *header, const char *basedir,
+                              const char *cachepath, const void *data, void *outmap);
 
 /* ------------------------------------------------------------------------
  * Returns the size, in bytes, needed to store the private map data
@@ -300,10 +589,32 @@ bool   M_AL_InitMapFromStream(const struct pfmap_hdr *header, const char *basedi
 size_t M_AL_BuffSizeFromHeader(const struct pfmap_hdr *header);
 
 /* ------------------------------------------------------------------------
- * Writes the map in PFMap format.
+ * Writes the map, with the current tiles and materials of every chunk, in 
+ * PFMap format. The whole text is formatted in memory and written at once.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_DumpMap(FILE *stream, const struct map *map);
+
+/* ------------------------------------------------------------------------
+ * Saves the map as the PFMAP text file at 'path' and also writes the binary
+ * PFMAP file next to it, with the extension of 'path' replaced by '.pfmapb',
+ * so that loading the saved map doesn't have to parse the text. The files 
+ * are only replaced once they have been fully written. Returns false if the
+ * text file could not be written.
  * ------------------------------------------------------------------------
  */
-void   M_AL_DumpMap(FILE *stream, const struct map *map);
+bool   M_AL_SaveMap(const struct map *map, const char *path);
+
+/* ------------------------------------------------------------------------
+ * The tiles of the chunks which were changed since the map was loaded, for 
+ * game snapshots. 'M_AL_ReadTileDeltas' puts back the tiles written by 
+ * 'M_AL_WriteTileDeltas' and restores the chunks changed since then to how 
+ * they were loaded, going through 'M_AL_UpdateTiles' for the tiles that 
+ * differ. The map must have the same dimensions as when they were written.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_WriteTileDeltas(const struct map *map, SDL_RWops *out);
+bool   M_AL_ReadTileDeltas(struct map *map, SDL_RWops *in);
 
 /* ------------------------------------------------------------------------
  * Cleans up resource allocations done during map initialization.
@@ -316,11 +627,83 @@ void   M_AL_FreePrivate(struct map *map);
  * section string.
  * ------------------------------------------------------------------------
  */
-bool   M_AL_UpdateChunkMats(const struct map *map, int chunk_r, int chunk_c, 
+bool   M_AL_UpdateChunkMats(struct map *map, int chunk_r, int chunk_c, 
                             const char *mats_string);
 
+/* ------------------------------------------------------------------------
+ * Replaces a single tile. The tile attributes, heights and navigation data
+ * are updated right away, but the chunk meshes and the minimap only get 
+ * updated by the next 'M_AL_FlushTileUpdates', once for all the tiles of 
+ * a chunk changed in the meantime.
+ * ------------------------------------------------------------------------
+ */
 bool   M_AL_UpdateTile(struct map *map, const struct tile_desc *desc, 
                        const struct tile *tile);
 
+/* ------------------------------------------------------------------------
+ * The same as 'M_AL_UpdateTile' for many tiles at once, with the cached 
+ * navigation fields of every affected chunk invalidated only once. If any
+ * of the descriptors is out of bounds, no tile is updated.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_UpdateTiles(struct map *map, size_t num_tiles, const struct tile_desc descs[],
+                        const struct tile tiles[]);
+
+/* ------------------------------------------------------------------------
+ * Replaces the 'rows' by 'cols' rectangle of tiles with its' top left 
+ * corner at 'origin', which may span several chunks. 'tiles' holds either 
+ * a single tile which the whole rectangle is set to, or 'rows * cols' 
+ * tiles in row-major order. If the rectangle does not fit in the map, no
+ * tile is updated.
+ * ------------------------------------------------------------------------
+ */
+bool   M_AL_UpdateTileRegion(struct map *map, const struct tile_desc *origin, int rows, int cols,
+                             size_t num_tiles, const struct tile tiles[]);
+
+/* ------------------------------------------------------------------------
+ * Brings the meshes and minimap of all the chunks with modified tiles up 
+ * to date. Must be called before the map is next rendered.
+ * ------------------------------------------------------------------------
+ */
+void   M_AL_FlushTileUpdates(struct map *map);
+
+/*###########################################################################*/
+/* MAP EDIT HISTORY                                                          */
+/*###########################################################################*/
+
+struct map_edit_stats{
+    /* The number of edits that can be undone and redone */
+    size_t undo;
+    size_t redo;
+    /* Memory held by the recorded edits */
+    size_t bytes;
+};
+
+/* ------------------------------------------------------------------------
+ * The tile updates made between 'M_EditBegin' and 'M_EditEnd' are recorded
+ * as one edit. Only the runs of tiles that ended up different are kept, 
+ * with their values from before and after the edit. 'M_EditEnd' returns 
+ * false if no tile changed, in which case nothing is recorded. Recording a 
+ * new edit drops the ones that were undone, and the oldest edits are 
+ * dropped once the history takes more than CONFIG_MAP_EDIT_HISTORY bytes.
+ * ------------------------------------------------------------------------
+ */
+bool   M_EditBegin(struct map *map);
+bool   M_EditEnd(struct map *map);
+
+/* ------------------------------------------------------------------------
+ * Puts back the tiles of the last recorded edit, or the last undone one,
+ * through 'M_AL_UpdateTiles'. The row-major indices of the chunks it 
+ * touched are written to 'out_chunks', which must have room for all the
+ * chunks of the map. Returns false if there is no such edit, or while an 
+ * edit is being recorded.
+ * ------------------------------------------------------------------------
+ */
+bool   M_EditUndo(struct map *map, size_t *out_num_chunks, size_t out_chunks[]);
+bool   M_EditRedo(struct map *map, size_t *out_num_chunks, size_t out_chunks[]);
+
+void   M_EditClear(struct map *map);
+void   M_GetEditStats(const struct map *map, struct map_edit_stats *out);
+
 
 #endif
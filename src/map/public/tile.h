@@ -38,6 +38,7 @@
 
 #include "../../collision.h"
 #include <stdbool.h>
+#include <stdint.h>
 
 #define X_COORDS_PER_TILE 8 
 #define Y_COORDS_PER_TILE 4 
@@ -76,22 +77,28 @@ enum blend_mode{
     BLEND_MODE_BLUR,
 };
 
+/* Every field fits in a byte (the map format stores each one in a single 
+ * digit), so a tile is 6 bytes and a whole chunk's tiles are 6K. The tiles 
+ * are scanned by the height queries, the navigation builds and the renderer, 
+ * which touch a quarter of the cache lines that word-sized fields took. */
 struct tile{
-    bool          pathable;    
-    enum tiletype type;
-    int           base_height;
+    /* A byte rather than a 'bool', as scripts may set it to any integer */
+    uint8_t       pathable;
+    /* enum tiletype */
+    uint8_t       type;
+    int8_t        base_height;
     /* ------------------------------------------------------------------------
      * Only valid when 'type' is a ramp or corner tile.
      * ------------------------------------------------------------------------
      */
-    int           ramp_height;
+    int8_t        ramp_height;
     /* ------------------------------------------------------------------------
      * Render-specific tile attributes. Only used for populating private render
      * data.
      * ------------------------------------------------------------------------
      */
-    int           top_mat_idx;
-    int           sides_mat_idx;
+    uint8_t       top_mat_idx;
+    uint8_t       sides_mat_idx;
 };
 
 struct tile_desc{
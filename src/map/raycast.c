@@ -39,7 +39,6 @@
 #include "../event.h"
 #include "../pf_math.h"
 #include "../camera.h"
-#include "../config.h"
 #include "../collision.h"
 
 #include "../render/public/render.h"
@@ -49,11 +48,26 @@
 #include <string.h>
 
 
-#define MAX_CANDIDATE_TILES 256
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
 
-struct ray{
-    vec3_t origin;
-    vec3_t dir;
+#define HIGHLIGHT_WIDTH (0.4f)
+#define HIGHLIGHT_COLOR (vec3_t){1.0f, 0.0f, 0.0f}
+
+/* The tile surfaces are made up of at most two planar triangles. This is the 
+ * diagonal they are split along. */
+enum tile_diag{
+    DIAG_NONE,
+    DIAG_NW_SE,
+    DIAG_NE_SW,
+};
+
+/* Traversal of one axis of a grid, in units of the cell size */
+struct dda_axis{
+    int   cell;
+    int   step;
+    float t_next;
+    float t_delta;
 };
 
 struct rc_ctx{
@@ -78,116 +92,213 @@ static struct rc_ctx s_ctx;
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-struct aabb aabb_for_tile(struct tile_desc desc, const struct map *map)
+/* The cell is clamped to the given range, which takes care of the point
+ * being on the boundary of the range */
+static struct dda_axis rc_dda_axis(float origin, float dir, float t, float cell_size, 
+                                   int min_cell, int max_cell)
 {
-    assert(map);
-    assert(desc.chunk_r >= 0 && desc.chunk_r < map->height);
-    assert(desc.chunk_c >= 0 && desc.chunk_c < map->width);
-    assert(desc.tile_r >= 0  && desc.tile_r < TILES_PER_CHUNK_HEIGHT);
-    assert(desc.tile_c >= 0  && desc.tile_c < TILES_PER_CHUNK_HEIGHT);
-
-    const struct pfchunk *chunk = &map->chunks[desc.chunk_r * map->width + desc.chunk_c];
-    const struct tile *tile = &chunk->tiles[desc.tile_r * TILES_PER_CHUNK_WIDTH + desc.tile_c];
-
-    struct map_resolution res = {
-        map->width, map->height,
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
-    };
-    struct box tile_bounds = M_Tile_Bounds(res, map->pos, desc);
-
-    return (struct aabb) {
-        .x_min = tile_bounds.x - tile_bounds.width,
-        .x_max = tile_bounds.x,
-        .y_min = 0.0f,
-        .y_max = (tile->base_height + (tile->type == TILETYPE_FLAT ? 0.0f : tile->ramp_height)) * Y_COORDS_PER_TILE,
-        .z_min = tile_bounds.z,
-        .z_max = tile_bounds.z + tile_bounds.height,
-    };
+    struct dda_axis ret;
+    ret.cell = (int)floorf((origin + dir * t) / cell_size);
+    ret.cell = MAX(min_cell, MIN(max_cell, ret.cell));
+
+    if(dir > 0.0f) {
+        ret.step = 1;
+        ret.t_next = ((ret.cell + 1) * cell_size - origin) / dir;
+        ret.t_delta = cell_size / dir;
+    }else if(dir < 0.0f) {
+        ret.step = -1;
+        ret.t_next = (ret.cell * cell_size - origin) / dir;
+        ret.t_delta = -cell_size / dir;
+    }else {
+        ret.step = 0;
+        ret.t_next = INFINITY;
+        ret.t_delta = INFINITY;
+    }
+    return ret;
 }
 
-static vec3_t rc_unproject_mouse_coords(void)
+/* Clips the ray to the range [0, size) of a single axis. Returns false if 
+ * the ray is entirely outside it. */
+static bool rc_clip_axis(float origin, float dir, float size, float *inout_min, float *inout_max)
 {
-    int mouse_x, mouse_y;
-    SDL_GetMouseState(&mouse_x, &mouse_y);
+    if(dir == 0.0f)
+        return (origin >= 0.0f && origin <= size);
 
-    vec3_t ndc = (vec3_t){-1.0f + 2.0*((float)mouse_x/CONFIG_RES_X),
-                           1.0f - 2.0*((float)mouse_y/CONFIG_RES_Y),
-                          -1.0f};
-    vec4_t clip = (vec4_t){ndc.x, ndc.y, ndc.z, 1.0f};
+    float t1 = (0.0f - origin) / dir;
+    float t2 = (size - origin) / dir;
 
-    mat4x4_t view_proj_inverse; 
-    mat4x4_t view, proj, tmp;
+    *inout_min = MAX(*inout_min, MIN(t1, t2));
+    *inout_max = MIN(*inout_max, MAX(t1, t2));
+    return (*inout_min <= *inout_max);
+}
 
-    Camera_MakeViewMat(s_ctx.cam, &view);
-    Camera_MakeProjMat(s_ctx.cam, &proj);
-    PFM_Mat4x4_Mult4x4(&proj, &view, &tmp);
-    PFM_Mat4x4_Inverse(&tmp, &view_proj_inverse); 
+static enum tile_diag rc_tile_diag(const struct tile *tile)
+{
+    switch(tile->type) {
+    case TILETYPE_CORNER_CONVEX_NE:
+    case TILETYPE_CORNER_CONCAVE_NE:
+    case TILETYPE_CORNER_CONVEX_SW:
+    case TILETYPE_CORNER_CONCAVE_SW: 
+        return DIAG_NW_SE;
+    case TILETYPE_CORNER_CONVEX_NW:
+    case TILETYPE_CORNER_CONCAVE_NW:
+    case TILETYPE_CORNER_CONVEX_SE:
+    case TILETYPE_CORNER_CONCAVE_SE:
+        return DIAG_NE_SW;
+    default:
+        return DIAG_NONE;
+    }
+}
 
-    vec4_t ret_homo;
-    PFM_Mat4x4_Mult4x1(&view_proj_inverse, &clip, &ret_homo);
-    return (vec3_t){ret_homo.x/ret_homo.w, ret_homo.y/ret_homo.w, ret_homo.z/ret_homo.w};
+/* Signed distance-like value of the tile-local point from the diagonal. The 
+ * triangle with the NE corner (NW-SE split) or the NW corner (NE-SW split) 
+ * is on the non-positive side. */
+static float rc_diag_side(enum tile_diag diag, float u, float v)
+{
+    switch(diag) {
+    case DIAG_NW_SE: return v - u;
+    case DIAG_NE_SW: return u + v - 1.0f;
+    default:         return 0.0f;
+    }
 }
 
-static void rc_find_intersection(void)
+/* The plane of the part of the tile surface on the given side of the 
+ * diagonal, as 'h0 + hu * u + hv * v' over the tile-local coordinates, where 
+ * 'u' increases towards the east edge and 'v' towards the south edge. */
+static void rc_tile_plane(enum tile_diag diag, float side, 
+                          float nw, float ne, float sw, float se, float out[3])
 {
-    vec3_t ray_origin = rc_unproject_mouse_coords();
-    vec3_t ray_dir;
+    if(diag == DIAG_NW_SE && side > 0.0f) {
+        out[0] = nw; out[1] = se - sw; out[2] = sw - nw;
+    }else if(diag == DIAG_NW_SE) {
+        out[0] = nw; out[1] = ne - nw; out[2] = se - ne;
+    }else if(diag == DIAG_NE_SW && side > 0.0f) {
+        out[0] = sw + ne - se; out[1] = se - sw; out[2] = se - ne;
+    }else {
+        out[0] = nw; out[1] = ne - nw; out[2] = sw - nw;
+    }
+}
 
-    vec3_t cam_pos = Camera_GetPos(s_ctx.cam);
-    PFM_Vec3_Sub(&ray_origin, &cam_pos, &ray_dir);
-    PFM_Vec3_Normal(&ray_dir, &ray_dir);
+/* Tests the ray against a single tile over the parameter range [t0, t1], 
+ * within which the ray is over the tile. 'gc' and 'gr' are the map-wide 
+ * tile coordinates of the ray origin and 'dgc' and 'dgr' their rates of 
+ * change. Since the ray was above the terrain surface when it left the 
+ * previous tile, being below the surface at 't0' means it hit a side face. */
+static bool rc_test_tile(const struct map *map, int r, int c, float t0, float t1,
+                         float gc, float gr, float dgc, float dgr, 
+                         float oy, float dy, float *out_t)
+{
+    const struct pfchunk *chunk = &map->chunks[(r / TILES_PER_CHUNK_HEIGHT) * map->width 
+                                               + (c / TILES_PER_CHUNK_WIDTH)];
+    const struct tile *tile = &chunk->tiles[(r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                                            + (c % TILES_PER_CHUNK_WIDTH)];
+    float nw, ne, sw, se;
+
+    if(map->heightfield) {
+        const struct tile_heights *hf = &map->heightfield[r * (map->width * TILES_PER_CHUNK_WIDTH) + c];
+        nw = hf->nw; ne = hf->ne; sw = hf->sw; se = hf->se;
+    }else{
+        nw = M_Tile_NWHeight(tile) * Y_COORDS_PER_TILE;
+        ne = M_Tile_NEHeight(tile) * Y_COORDS_PER_TILE;
+        sw = M_Tile_SWHeight(tile) * Y_COORDS_PER_TILE;
+        se = M_Tile_SEHeight(tile) * Y_COORDS_PER_TILE;
+    }
 
-    s_ctx.tile_active = false;
+    enum tile_diag diag = rc_tile_diag(tile);
+    float u0 = gc + dgc * t0 - c, v0 = gr + dgr * t0 - r;
+    float u1 = gc + dgc * t1 - c, v1 = gr + dgr * t1 - r;
 
-    struct map_resolution res = {
-        s_ctx.map->width, s_ctx.map->height,
-        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
-    };
+    /* Split the range where the ray crosses the diagonal, so that the surface 
+     * under each part is a single plane */
+    float ts[3] = {t0, t1, t1};
+    int nsegs = 1;
 
-    /* Project the ray on the Y=0 plane between the camera position and where the 
-     * ray intersects the Y=0 plane. */
-    float t = fabs(ray_origin.y / ray_dir.y);
-    struct line_seg_2d y_eq_0_seg = {
-        ray_origin.x, 
-        ray_origin.z,
-        ray_origin.x + t * ray_dir.x, 
-        ray_origin.z + t * ray_dir.z,
-    };
+    float side0 = rc_diag_side(diag, u0, v0);
+    float side1 = rc_diag_side(diag, u1, v1);
+    if((side0 < 0.0f && side1 > 0.0f) || (side0 > 0.0f && side1 < 0.0f)) {
+        ts[1] = t0 + (t1 - t0) * (side0 / (side0 - side1));
+        nsegs = 2;
+    }
 
-    struct tile_desc cts[MAX_CANDIDATE_TILES];
-    int len = M_Tile_LineSupercoverTilesSorted(res, s_ctx.map->pos, y_eq_0_seg, cts);
-    assert(len <= MAX_CANDIDATE_TILES);
+    for(int i = 0; i < nsegs; i++) {
 
-    for(int i = 0; i < len; i++) {
-    
-        struct aabb tile_aabb = aabb_for_tile(cts[i], s_ctx.map);
-        float t;
+        float a = ts[i], b = ts[i + 1];
+        float mid = (a + b) / 2.0f;
 
-        /* The first level check is to see if the ray intersects the AABB */
-        if(C_RayIntersectsAABB(ray_origin, ray_dir, tile_aabb, &t)) {
+        float plane[3];
+        rc_tile_plane(diag, rc_diag_side(diag, gc + dgc * mid - c, gr + dgr * mid - r), 
+            nw, ne, sw, se, plane);
 
-            /* If the ray hits the AABB, perform the second level check:
-             * Check if it intersects the exact triangle mesh of the tile. */
-            vec3_t tile_mesh[VERTS_PER_TILE];
-            mat4x4_t model;
+        /* Height of the ray above the plane, which is linear in 't' */
+        float fa = oy + dy * a - (plane[0] + plane[1] * (gc + dgc * a - c) + plane[2] * (gr + dgr * a - r));
+        float fb = oy + dy * b - (plane[0] + plane[1] * (gc + dgc * b - c) + plane[2] * (gr + dgr * b - r));
 
-            const struct pfchunk *chunk = 
-                &s_ctx.map->chunks[cts[i].chunk_r * s_ctx.map->width + cts[i].chunk_c];
-            M_ModelMatrixForChunk(s_ctx.map, (struct chunkpos){cts[i].chunk_r, cts[i].chunk_c}, &model);
+        if(fa <= 0.0f) {
+            *out_t = a;
+            return true;
+        }
+        if(fb <= 0.0f) {
+            *out_t = a + (b - a) * (fa / (fa - fb));
+            return true;
+        }
+    }
+    return false;
+}
 
-            int num_verts = R_GL_TileGetTriMesh(&cts[i], chunk->render_private_tiles, &model, 
-                TILES_PER_CHUNK_WIDTH, tile_mesh);
+/* Marches the ray over the tiles of a single chunk, in the range [t0, t1] */
+static bool rc_march_chunk(const struct map *map, int chunk_r, int chunk_c, float t0, float t1,
+                           float gc, float gr, float dgc, float dgr, float oy, float dy, 
+                           float *out_t, int *out_r, int *out_c)
+{
+    const int r_min = chunk_r * TILES_PER_CHUNK_HEIGHT, r_max = r_min + TILES_PER_CHUNK_HEIGHT - 1;
+    const int c_min = chunk_c * TILES_PER_CHUNK_WIDTH,  c_max = c_min + TILES_PER_CHUNK_WIDTH  - 1;
+
+    struct dda_axis col = rc_dda_axis(gc, dgc, t0, 1.0f, c_min, c_max);
+    struct dda_axis row = rc_dda_axis(gr, dgr, t0, 1.0f, r_min, r_max);
 
-            if(C_RayIntersectsTriMesh(ray_origin, ray_dir, tile_mesh, num_verts, &t)) {
+    float t = t0;
+    while(t <= t1) {
 
-                PFM_Vec3_Scale(&ray_dir, t, &ray_dir);
-                PFM_Vec3_Add(&ray_origin, &ray_dir, &s_ctx.intersec_pos);
+        float t_exit = MIN(t1, MIN(col.t_next, row.t_next));
+        if(rc_test_tile(map, row.cell, col.cell, t, t_exit, gc, gr, dgc, dgr, oy, dy, out_t)) {
+            *out_r = row.cell;
+            *out_c = col.cell;
+            return true;
+        }
 
-                s_ctx.intersec_tile = cts[i]; 
-                s_ctx.tile_active = true;
-                break;
-            }
+        if(t_exit >= t1)
+            break;
+
+        if(col.t_next < row.t_next) {
+            t = col.t_next;
+            col.cell += col.step;
+            col.t_next += col.t_delta;
+        }else{
+            t = row.t_next;
+            row.cell += row.step;
+            row.t_next += row.t_delta;
         }
+
+        if(col.cell < c_min || col.cell > c_max || row.cell < r_min || row.cell > r_max)
+            break;
+    }
+    return false;
+}
+
+static void rc_find_intersection(void)
+{
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    vec3_t ray_origin, ray_dir;
+    Camera_ScreenRay(s_ctx.cam, (vec2_t){mouse_x, mouse_y}, &ray_origin, &ray_dir);
+
+    struct map_hit hit;
+    s_ctx.tile_active = M_Raycast(s_ctx.map, ray_origin, ray_dir, &hit);
+
+    if(s_ctx.tile_active) {
+        s_ctx.intersec_tile = hit.tile;
+        s_ctx.intersec_pos = hit.pos;
     }
 }
 
@@ -213,37 +324,6 @@ static void on_mousemove(void *user, void *event)
     s_initial_active = s_ctx.tile_active;
 }
 
-static void on_render(void *user, void *event)
-{
-    if(!s_ctx.tile_active)
-        return;
-
-    if(s_ctx.highlight_size == 0)
-        return;
-
-    int num_tiles = s_ctx.highlight_size * 2 - 1;
-
-    for(int r = -(num_tiles / 2); r < (num_tiles / 2) + 1; r++) {
-        for(int c = -(num_tiles / 2); c < (num_tiles / 2) + 1; c++) {
-
-            struct map_resolution res = {
-                s_ctx.map->width, s_ctx.map->height,
-                TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
-            };
-
-            struct tile_desc curr = s_ctx.intersec_tile;
-            if(M_Tile_RelativeDesc(res, &curr, r, c)) {
-            
-                const struct pfchunk *chunk = &s_ctx.map->chunks[curr.chunk_r * s_ctx.map->width + curr.chunk_c];
-                mat4x4_t model;
-
-                M_ModelMatrixForChunk(s_ctx.map, (struct chunkpos){curr.chunk_r, curr.chunk_c}, &model);
-                R_GL_TileDrawSelected(&curr, chunk->render_private_tiles, &model, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT); 
-            }
-        }
-    }
-}
-
 static void on_update_start(void *user, void *event)
 {
     s_ctx.valid = false;
@@ -259,7 +339,6 @@ int M_Raycast_Install(struct map *map, struct camera *cam)
     s_ctx.cam = cam;
 
     E_Global_Register(SDL_MOUSEMOTION, on_mousemove, NULL);
-    E_Global_Register(EVENT_RENDER_3D, on_render, NULL);
     E_Global_Register(EVENT_UPDATE_START, on_update_start, NULL);
 
     return 0;
@@ -268,7 +347,6 @@ int M_Raycast_Install(struct map *map, struct camera *cam)
 void M_Raycast_Uninstall(void)
 {
     E_Global_Unregister(SDL_MOUSEMOTION, on_mousemove);
-    E_Global_Unregister(EVENT_RENDER_3D, on_render);
     E_Global_Unregister(EVENT_UPDATE_START, on_update_start);
 
     s_ctx.map = NULL;
@@ -282,6 +360,33 @@ void M_Raycast_SetHighlightSize(size_t size)
     s_ctx.highlight_size = size;
 }
 
+void M_Raycast_SubmitDecals(void)
+{
+    if(!s_ctx.map || s_ctx.highlight_size == 0)
+        return;
+
+    if(!s_ctx.valid) {
+        rc_find_intersection();
+        s_ctx.valid = true;
+    }
+
+    if(!s_ctx.tile_active)
+        return;
+
+    /* The whole square of highlighted tiles is a single decal. The parts of 
+     * it that are off the map have no terrain to be drawn over. */
+    int num_tiles = s_ctx.highlight_size * 2 - 1;
+    struct map_resolution res = {
+        s_ctx.map->width, s_ctx.map->height,
+        TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT
+    };
+    struct box bounds = M_Tile_Bounds(res, s_ctx.map->pos, s_ctx.intersec_tile);
+
+    vec2_t center = (vec2_t){bounds.x - bounds.width / 2.0f, bounds.z + bounds.height / 2.0f};
+    vec2_t half_extents = (vec2_t){num_tiles * bounds.width / 2.0f, num_tiles * bounds.height / 2.0f};
+    R_GL_DecalTiles(center, half_extents, HIGHLIGHT_WIDTH, HIGHLIGHT_COLOR);
+}
+
 bool M_Raycast_IntersecCoordinate(vec3_t *out)
 {
     if(!s_ctx.valid) {
@@ -296,3 +401,92 @@ bool M_Raycast_IntersecCoordinate(vec3_t *out)
     return true;
 }
 
+bool M_Raycast(const struct map *map, vec3_t origin, vec3_t dir, struct map_hit *out)
+{
+    const int rows = map->height * TILES_PER_CHUNK_HEIGHT;
+    const int cols = map->width  * TILES_PER_CHUNK_WIDTH;
+    const float max_height = MAX_HEIGHT_LEVEL * Y_COORDS_PER_TILE;
+    const float EPSILON = (1.0f/1024);
+
+    /* Work in map-wide tile coordinates, where columns increase towards -X 
+     * and rows towards +Z */
+    float gc  = (map->pos.x - origin.x) / X_COORDS_PER_TILE;
+    float gr  = (origin.z - map->pos.z) / Z_COORDS_PER_TILE;
+    float dgc = -dir.x / X_COORDS_PER_TILE;
+    float dgr =  dir.z / Z_COORDS_PER_TILE;
+
+    float t_min = 0.0f, t_max = INFINITY;
+    if(!rc_clip_axis(gc, dgc, cols, &t_min, &t_max)
+    || !rc_clip_axis(gr, dgr, rows, &t_min, &t_max))
+        return false;
+
+    /* The terrain is contained between Y=0 and the maximum height level. The 
+     * ray is let go slightly below Y=0 so that rounding can't make it miss 
+     * the lowest tiles. */
+    if(dir.y > 0.0f) {
+        if(origin.y > max_height)
+            return false;
+        t_max = MIN(t_max, (max_height - origin.y) / dir.y);
+    }else if(dir.y < 0.0f) {
+        t_max = MIN(t_max, (origin.y + EPSILON) / -dir.y);
+    }
+
+    /* A vertical ray only needs to be tested at the one point */
+    if(isinf(t_max))
+        t_max = t_min;
+
+    if(t_min > t_max)
+        return false;
+
+    struct dda_axis col = rc_dda_axis(gc, dgc, t_min, TILES_PER_CHUNK_WIDTH,  0, map->width  - 1);
+    struct dda_axis row = rc_dda_axis(gr, dgr, t_min, TILES_PER_CHUNK_HEIGHT, 0, map->height - 1);
+
+    float t = t_min;
+    while(t <= t_max) {
+
+        float t_exit = MIN(t_max, MIN(col.t_next, row.t_next));
+        const struct pfchunk *chunk = &map->chunks[row.cell * map->width + col.cell];
+
+        /* The ray is a straight line, so it is above every point of the chunk 
+         * if it is above its' highest point at both ends */
+        float y_enter = origin.y + dir.y * t;
+        float y_exit  = origin.y + dir.y * t_exit;
+        float t_hit;
+        int tile_r, tile_c;
+
+        if(MIN(y_enter, y_exit) <= chunk->max_height
+        && rc_march_chunk(map, row.cell, col.cell, t, t_exit, gc, gr, dgc, dgr, 
+                          origin.y, dir.y, &t_hit, &tile_r, &tile_c)) {
+
+            out->t = t_hit;
+            out->pos = (vec3_t){
+                origin.x + dir.x * t_hit,
+                origin.y + dir.y * t_hit,
+                origin.z + dir.z * t_hit,
+            };
+            out->tile = (struct tile_desc){
+                tile_r / TILES_PER_CHUNK_HEIGHT, tile_c / TILES_PER_CHUNK_WIDTH,
+                tile_r % TILES_PER_CHUNK_HEIGHT, tile_c % TILES_PER_CHUNK_WIDTH,
+            };
+            return true;
+        }
+
+        if(t_exit >= t_max)
+            break;
+
+        if(col.t_next < row.t_next) {
+            t = col.t_next;
+            col.cell += col.step;
+            col.t_next += col.t_delta;
+        }else{
+            t = row.t_next;
+            row.cell += row.step;
+            row.t_next += row.t_delta;
+        }
+
+        if(col.cell < 0 || col.cell >= map->width || row.cell < 0 || row.cell >= map->height)
+            break;
+    }
+    return false;
+}
+
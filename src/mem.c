@@ -0,0 +1,276 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "mem.h"
+#include "config.h"
+#include "lib/public/mem_arena.h"
+
+#include <SDL.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+#define FRAME_BLOCK_SIZE    (4 * 1024 * 1024)
+#define SCRATCH_BLOCK_SIZE  (256 * 1024)
+/* The header is padded so that the memory handed out is as well aligned 
+ * as what malloc returns */
+#define HDR_SIZE            (16)
+#define HDR_MAGIC           (0x4d454d54) /* "MEMT" */
+
+/*
+ * Tagged allocation layout:
+ *
+ *  +---------------------------------+ <-- base (from malloc)
+ *  | struct alloc_hdr[1]             |
+ *  | (padding up to HDR_SIZE)        |
+ *  +---------------------------------+ <-- returned to the caller
+ *  | user data[size]                 |
+ *  +---------------------------------+
+ *
+ */
+struct alloc_hdr{
+    uint32_t magic;
+    uint32_t tag;
+    size_t   size;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct mem_arena s_frame_arena;
+static SDL_TLSID        s_scratch_tls = 0;
+
+static SDL_SpinLock     s_stats_lock;
+static struct mem_stats s_stats[MEM_TAG_COUNT];
+
+static const char *s_tag_names[MEM_TAG_COUNT] = {
+    [MEM_TAG_NAV]           = "nav",
+    [MEM_TAG_RENDER]        = "render",
+    [MEM_TAG_ANIM]          = "anim",
+    [MEM_TAG_MAP]           = "map",
+    [MEM_TAG_SCRIPT]        = "script",
+    [MEM_TAG_UI]            = "ui",
+    [MEM_TAG_GL_BUFFERS]    = "gl_buffers",
+    [MEM_TAG_GL_TEXTURES]   = "gl_textures",
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void mem_scratch_free(void *arg)
+{
+    struct mem_arena *arena = arg;
+    arena_destroy(arena);
+    free(arena);
+}
+
+static void mem_count(enum mem_tag tag, size_t size)
+{
+    SDL_AtomicLock(&s_stats_lock);
+    struct mem_stats *stats = &s_stats[tag];
+    stats->live += size;
+    stats->num_allocs++;
+    if(stats->live > stats->peak)
+        stats->peak = stats->live;
+    SDL_AtomicUnlock(&s_stats_lock);
+}
+
+static void mem_uncount(enum mem_tag tag, size_t size)
+{
+    SDL_AtomicLock(&s_stats_lock);
+    struct mem_stats *stats = &s_stats[tag];
+    assert(stats->live >= size && stats->num_allocs > 0);
+    stats->live -= size;
+    stats->num_allocs--;
+    SDL_AtomicUnlock(&s_stats_lock);
+}
+
+static struct alloc_hdr *mem_hdr(void *ptr)
+{
+    struct alloc_hdr *ret = (struct alloc_hdr*)((char*)ptr - HDR_SIZE);
+    assert(ret->magic == HDR_MAGIC);
+    return ret;
+}
+
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool MEM_Init(void)
+{
+    arena_init(&s_frame_arena, FRAME_BLOCK_SIZE);
+    s_scratch_tls = SDL_TLSCreate();
+    return (s_scratch_tls != 0);
+}
+
+void MEM_Shutdown(void)
+{
+    /* Other threads release their own scratch arenas on exit */
+    struct mem_arena *scratch = SDL_TLSGet(s_scratch_tls);
+    if(scratch) {
+        SDL_TLSSet(s_scratch_tls, NULL, NULL);
+        mem_scratch_free(scratch);
+    }
+    arena_destroy(&s_frame_arena);
+}
+
+struct mem_arena *MEM_FrameArena(void)
+{
+    return &s_frame_arena;
+}
+
+void MEM_FrameEnd(void)
+{
+    /* Memory kept from a burst of work, such as chunk baking, is given back
+     * once the frames are light again. The arena grows back to fit the next
+     * time it's needed. */
+    size_t used = arena_used(&s_frame_arena);
+    if(used < CONFIG_FRAME_ARENA_BUDGET && arena_capacity(&s_frame_arena) > CONFIG_FRAME_ARENA_BUDGET) {
+        arena_destroy(&s_frame_arena);
+        return;
+    }
+    arena_reset(&s_frame_arena);
+}
+
+struct mem_arena *MEM_ScratchArena(void)
+{
+    assert(s_scratch_tls);
+    struct mem_arena *ret = SDL_TLSGet(s_scratch_tls);
+    if(ret)
+        return ret;
+
+    if(NULL == (ret = malloc(sizeof(struct mem_arena))))
+        return NULL;
+    arena_init(ret, SCRATCH_BLOCK_SIZE);
+
+    if(0 != SDL_TLSSet(s_scratch_tls, ret, mem_scratch_free)) {
+        mem_scratch_free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+void *MEM_Malloc(enum mem_tag tag, size_t size)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    assert(sizeof(struct alloc_hdr) <= HDR_SIZE);
+
+    if(size > SIZE_MAX - HDR_SIZE)
+        return NULL;
+
+    struct alloc_hdr *hdr = malloc(HDR_SIZE + size);
+    if(!hdr)
+        return NULL;
+
+    hdr->magic = HDR_MAGIC;
+    hdr->tag = tag;
+    hdr->size = size;
+    mem_count(tag, size);
+    return (char*)hdr + HDR_SIZE;
+}
+
+void *MEM_Calloc(enum mem_tag tag, size_t num, size_t size)
+{
+    if(size && num > SIZE_MAX / size)
+        return NULL;
+
+    void *ret = MEM_Malloc(tag, num * size);
+    if(ret)
+        memset(ret, 0, num * size);
+    return ret;
+}
+
+void *MEM_Realloc(void *ptr, size_t size)
+{
+    assert(ptr);
+    if(size > SIZE_MAX - HDR_SIZE)
+        return NULL;
+
+    struct alloc_hdr *hdr = mem_hdr(ptr);
+    enum mem_tag tag = hdr->tag;
+    size_t old_size = hdr->size;
+
+    struct alloc_hdr *ret = realloc(hdr, HDR_SIZE + size);
+    if(!ret)
+        return NULL;
+
+    ret->size = size;
+    mem_uncount(tag, old_size);
+    mem_count(tag, size);
+    return (char*)ret + HDR_SIZE;
+}
+
+void MEM_Free(void *ptr)
+{
+    if(!ptr)
+        return;
+
+    struct alloc_hdr *hdr = mem_hdr(ptr);
+    mem_uncount(hdr->tag, hdr->size);
+    hdr->magic = 0;
+    free(hdr);
+}
+
+void MEM_Track(enum mem_tag tag, size_t size)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    mem_count(tag, size);
+}
+
+void MEM_Untrack(enum mem_tag tag, size_t size)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    mem_uncount(tag, size);
+}
+
+void MEM_GetStats(enum mem_tag tag, struct mem_stats *out)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    SDL_AtomicLock(&s_stats_lock);
+    *out = s_stats[tag];
+    SDL_AtomicUnlock(&s_stats_lock);
+}
+
+const char *MEM_TagName(enum mem_tag tag)
+{
+    assert(tag >= 0 && tag < MEM_TAG_COUNT);
+    return s_tag_names[tag];
+}
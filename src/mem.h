@@ -0,0 +1,125 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct mem_arena;
+
+/* The subsystems that memory use is reported for. The GL tags count the 
+ * sizes of the buffers and textures that were uploaded, rather than any
+ * host memory. */
+enum mem_tag{
+    MEM_TAG_NAV,
+    MEM_TAG_RENDER,
+    MEM_TAG_ANIM,
+    MEM_TAG_MAP,
+    MEM_TAG_SCRIPT,
+    MEM_TAG_UI,
+    MEM_TAG_GL_BUFFERS,
+    MEM_TAG_GL_TEXTURES,
+    MEM_TAG_COUNT
+};
+
+struct mem_stats{
+    /* The bytes currently held */
+    size_t live;
+    /* The most that was ever held at once */
+    size_t peak;
+    /* The number of allocations currently held */
+    size_t num_allocs;
+};
+
+/* ------------------------------------------------------------------------
+ * Must be called from the main thread, before any of the arenas are used.
+ * ------------------------------------------------------------------------
+ */
+bool MEM_Init(void);
+void MEM_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * The arena for temporaries which live until the end of the current frame.
+ * It may only be used from the main thread. Everything allocated from it 
+ * is released at once by 'MEM_FrameEnd'.
+ * ------------------------------------------------------------------------
+ */
+struct mem_arena *MEM_FrameArena(void);
+void              MEM_FrameEnd(void);
+
+/* ------------------------------------------------------------------------
+ * The calling thread's arena for temporaries which don't outlive the scope
+ * that allocated them, such as the working sets of searches and loaders. 
+ * Every use must be bracketed by 'arena_mark' and 'arena_rewind', so that 
+ * the arena is back to where it was once the caller is done. Unlike the 
+ * frame arena, it can be used from any thread and at load time, before 
+ * the first frame. Returns NULL if it could not be created.
+ * ------------------------------------------------------------------------
+ */
+struct mem_arena *MEM_ScratchArena(void);
+
+/* ------------------------------------------------------------------------
+ * Drop-in replacements for malloc, calloc, realloc and free, which count the
+ * memory against the tag. The tag is remembered with the allocation, so 
+ * 'MEM_Free' and 'MEM_Realloc' don't take one. Memory from these must not 
+ * be passed to 'free' and vice versa. Safe to call from any thread, and 
+ * before 'MEM_Init'.
+ * ------------------------------------------------------------------------
+ */
+void *MEM_Malloc(enum mem_tag tag, size_t size);
+void *MEM_Calloc(enum mem_tag tag, size_t num, size_t size);
+void *MEM_Realloc(void *ptr, size_t size);
+void  MEM_Free(void *ptr);
+
+/* ------------------------------------------------------------------------
+ * Count memory that wasn't allocated with the above, such as GL objects,
+ * against the tag. 'MEM_Untrack' must be passed the same size once the 
+ * memory is released.
+ * ------------------------------------------------------------------------
+ */
+void  MEM_Track(enum mem_tag tag, size_t size);
+void  MEM_Untrack(enum mem_tag tag, size_t size);
+
+/* ------------------------------------------------------------------------
+ * The counters of a single tag, and its' name as reported to scripts.
+ * ------------------------------------------------------------------------
+ */
+void        MEM_GetStats(enum mem_tag tag, struct mem_stats *out);
+const char *MEM_TagName(enum mem_tag tag);
+
+#endif
+
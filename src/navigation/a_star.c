@@ -37,23 +37,34 @@
 #include "nav_private.h"
 #include "../lib/public/pqueue.h"
 #include "../lib/public/khash.h"
+#include "../lib/public/mem_arena.h"
+#include "../mem.h"
+
+#include <SDL.h>
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+static inline size_t coord_index(struct coord c)
+{
+    return c.r * FIELD_RES_C + c.c;
+}
+
+PQUEUE_INDEXED_TYPE(coord, struct coord)
+PQUEUE_INDEXED_IMPL(static, coord, struct coord, coord_index)
 
 PQUEUE_TYPE(portal, const struct portal*)
 PQUEUE_IMPL(static, portal, const struct portal*)
 
-KHASH_MAP_INIT_INT64(key_coord, struct coord)
 KHASH_MAP_INIT_INT64(key_portal, const struct portal*)
 KHASH_MAP_INIT_INT64(key_float, float)
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+/* Above this many targets, 'AStar_GridCosts' falls back to a plain Dijkstra search */
+#define MAX_DIRECTED_TARGETS (8)
 #define kh_put_val(name, table, key, val)               \
     do{                                                 \
         int ret;                                        \
@@ -62,13 +73,95 @@ KHASH_MAP_INIT_INT64(key_float, float)
         kh_value(table, k) = val;                       \
     }while(0)
 
+/* Per-thread working set for searches. A cell's 'running_cost' and 
+ * 'came_from' entries are only valid when its' 'visited' stamp matches the
+ * current generation, so the arrays never need to be cleared between calls. 
+ * The portal graph tables are cleared instead, which keeps their buckets, 
+ * so that a search doesn't allocate once they've grown to fit. */
+struct search_scratch{
+    uint32_t    gen;
+    uint32_t    visited     [FIELD_RES_R][FIELD_RES_C];
+    float       running_cost[FIELD_RES_R][FIELD_RES_C];
+    struct coord came_from  [FIELD_RES_R][FIELD_RES_C];
+    /* Holds the open tiles while they are being re-prioritized */
+    struct coord open       [FIELD_RES_R * FIELD_RES_C];
+    /* The cost field being searched, padded with impassable tiles */
+    uint8_t     padded      [PADDED_RES_R * PADDED_RES_C];
+    pqi_coord_t frontier;
+    /* For portal graph searches */
+    pq_portal_t          portal_frontier;
+    khash_t(key_float)  *portal_cost;
+    khash_t(key_portal) *portal_came_from;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static SDL_TLSID s_scratch_tls = 0;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static uint64_t coord_to_key(struct coord c)
+static void search_scratch_free(void *arg)
+{
+    struct search_scratch *scratch = arg;
+    pqi_coord_destroy(&scratch->frontier);
+    pq_portal_destroy(&scratch->portal_frontier);
+    if(scratch->portal_cost)
+        kh_destroy(key_float, scratch->portal_cost);
+    if(scratch->portal_came_from)
+        kh_destroy(key_portal, scratch->portal_came_from);
+    free(scratch);
+}
+
+static struct search_scratch *search_scratch_get(void)
+{
+    assert(s_scratch_tls);
+    struct search_scratch *ret = SDL_TLSGet(s_scratch_tls);
+    if(ret)
+        return ret;
+
+    if(NULL == (ret = malloc(sizeof(struct search_scratch))))
+        return NULL;
+    if(!pqi_coord_init(&ret->frontier, FIELD_RES_R * FIELD_RES_C)) {
+        free(ret);
+        return NULL;
+    }
+    ret->gen = 0;
+    memset(ret->visited, 0, sizeof(ret->visited));
+
+    pq_portal_init(&ret->portal_frontier);
+    ret->portal_cost = kh_init(key_float);
+    ret->portal_came_from = kh_init(key_portal);
+    if(!ret->portal_cost || !ret->portal_came_from) {
+        search_scratch_free(ret);
+        return NULL;
+    }
+
+    if(0 != SDL_TLSSet(s_scratch_tls, ret, search_scratch_free)) {
+        search_scratch_free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+static void search_scratch_begin_portals(struct search_scratch *scratch)
 {
-    return (((uint64_t)c.r) << 32 | ((uint64_t)c.c) & ~((uint32_t)0));
+    pq_portal_clear(&scratch->portal_frontier);
+    kh_clear(key_float, scratch->portal_cost);
+    kh_clear(key_portal, scratch->portal_came_from);
+}
+
+static void search_scratch_begin(struct search_scratch *scratch)
+{
+    pqi_coord_clear(&scratch->frontier);
+    if(++scratch->gen == 0) {
+        /* Stamps from before the wraparound could alias the new generation */
+        memset(scratch->visited, 0, sizeof(scratch->visited));
+        scratch->gen = 1;
+    }
 }
 
 static uint64_t portal_to_key(const struct portal *p)
@@ -81,36 +174,36 @@ static uint64_t portal_to_key(const struct portal *p)
          | (((uint64_t)p->endpoints[1].c & 0xff) <<  0);
 }
 
-static int neighbours_grid(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord coord, 
+/* 'padded' is a cost field padded with impassable tiles (see N_PadCostField) */
+static int neighbours_grid(const uint8_t *padded, struct coord coord, 
                            struct coord *out_neighbours, float *out_costs)
 {
+    static const struct { int r, c; } s_offsets[8] = {
+        {-1, -1}, {-1,  0}, {-1,  1},
+        { 0, -1},           { 0,  1},
+        { 1, -1}, { 1,  0}, { 1,  1},
+    };
+    const uint8_t *center = padded + PADDED_IDX(coord.r, coord.c);
     int ret = 0;
 
-    for(int r = -1; r <= 1; r++) {
-        for(int c = -1; c <= 1; c++) {
+    for(int i = 0; i < ARR_SIZE(s_offsets); i++) {
 
-            int abs_r = coord.r + r;
-            int abs_c = coord.c + c;
+        int r = s_offsets[i].r;
+        int c = s_offsets[i].c;
+        uint8_t cost = center[r * PADDED_RES_C + c];
 
-            if(abs_r < 0 || abs_r >= FIELD_RES_R)
-                continue;
-            if(abs_c < 0 || abs_c >= FIELD_RES_C)
-                continue;
-            if(r == 0 && c == 0)
-                continue;
-            if(cost_field[abs_r][abs_c] == COST_IMPASSABLE)
-                continue;
+        if(cost == COST_IMPASSABLE)
+            continue;
 
-            bool diag = (r == c) || (r == -c);
-            if(diag && cost_field[abs_r][coord.c] == COST_IMPASSABLE 
-                    && cost_field[coord.r][abs_c] == COST_IMPASSABLE)
-                continue;
-            float cost_mult = diag ? sqrt(2) : 1.0f;
+        bool diag = (r != 0) && (c != 0);
+        if(diag && center[r * PADDED_RES_C] == COST_IMPASSABLE 
+                && center[c] == COST_IMPASSABLE)
+            continue;
+        float cost_mult = diag ? sqrt(2) : 1.0f;
 
-            out_neighbours[ret] = (struct coord){abs_r, abs_c};
-            out_costs[ret] = cost_field[abs_r][abs_c] * cost_mult;
-            ret++;
-        }
+        out_neighbours[ret] = (struct coord){coord.r + r, coord.c + c};
+        out_costs[ret] = cost * cost_mult;
+        ret++;
     }
     assert(ret < 9);
     return ret;
@@ -151,245 +244,541 @@ static float heuristic(struct coord a, struct coord b)
     return D * (dx + dy) + (D2 - 2 * D) * MIN(dx, dy);
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+/* Returns true if the tile is in the island, or if it's an impassable tile from 
+ * which a passable neighbour in the island can be stepped onto. */
+static bool tile_reaches_island(const struct nav_chunk *chunk, struct coord tile, uint16_t island)
+{
+    if(island == ISLAND_NONE)
+        return false;
+    if(chunk->islands[tile.r][tile.c] != ISLAND_NONE)
+        return (chunk->islands[tile.r][tile.c] == island);
 
-bool AStar_GridPath(struct coord start, struct coord finish, 
-                    const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
-                    coord_vec_t *out_path, float *out_cost)
+    /* Only passable tiles have an island ID, so it's enough to check that the 
+     * step isn't a diagonal squeezing between two impassable tiles. */
+    for(int r = -1; r <= 1; r++) {
+        for(int c = -1; c <= 1; c++) {
+
+            int abs_r = tile.r + r;
+            int abs_c = tile.c + c;
+
+            if(abs_r < 0 || abs_r >= FIELD_RES_R)
+                continue;
+            if(abs_c < 0 || abs_c >= FIELD_RES_C)
+                continue;
+            if(chunk->islands[abs_r][abs_c] != island)
+                continue;
+
+            bool diag = (r != 0) && (c != 0);
+            if(diag && chunk->cost_base[abs_r][tile.c] == COST_IMPASSABLE
+                    && chunk->cost_base[tile.r][abs_c] == COST_IMPASSABLE)
+                continue;
+            return true;
+        }
+    }
+    return false;
+}
+
+static struct coord portal_global_center(const struct portal *port)
 {
-    pq_coord_t            frontier;
-    khash_t(key_coord) *came_from;
-    khash_t(key_float) *running_cost;
-    
-    pq_coord_init(&frontier);
-    if(NULL == (came_from = kh_init(key_coord)))
-        goto fail_came_from;
-    if(NULL == (running_cost = kh_init(key_float)))
-        goto fail_running_cost;
+    return (struct coord){
+        port->chunk.r * FIELD_RES_R + (port->endpoints[0].r + port->endpoints[1].r) / 2,
+        port->chunk.c * FIELD_RES_C + (port->endpoints[0].c + port->endpoints[1].c) / 2,
+    };
+}
 
-    kh_put_val(key_float, running_cost, coord_to_key(start), 0.0f);
-    pq_coord_push(&frontier, 0.0f, start);
+static bool in_clusters(const struct nav_private *priv, const bool *clusters, 
+                        const struct portal *port)
+{
+    return !clusters || clusters[N_ClusterIdx(priv, port->chunk)];
+}
+
+/* Outside of the 'base' clusters, a portal's neighbours are the other nodes of its' 
+ * cluster, reached through the cluster edges. Only portals which are cluster nodes
+ * can be visited there, since the search can only enter a cluster through one. */
+static int neighbours_cluster_graph(const struct nav_private *priv, const struct portal *portal,
+                                    const struct portal **out_neighbours, float *out_costs)
+{
+    int ret = 0;
+    assert(portal->cluster_node != CLUSTER_NODE_NONE);
 
-    while(pq_size(&frontier) > 0) {
+    const struct nav_cluster *cluster = &priv->clusters[N_ClusterIdx(priv, portal->chunk)];
+    const struct cluster_node *node = &kv_A(cluster->nodes, portal->cluster_node);
 
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
+    for(int i = 0; i < kv_size(node->edges); i++) {
+
+        out_neighbours[ret] = kv_A(cluster->nodes, kv_A(node->edges, i).node).portal;
+        out_costs[ret] = kv_A(node->edges, i).cost;
+        ret++;
+    }
+
+    out_neighbours[ret] = portal->connected;
+    out_costs[ret] = 1;
+    ret++;
+
+    return ret;
+}
+
+static size_t max_neighbours(const struct nav_private *priv, const bool *base, const struct portal *portal)
+{
+    if(in_clusters(priv, base, portal))
+        return MAX_PORTALS_PER_CHUNK;
+
+    const struct nav_cluster *cluster = &priv->clusters[N_ClusterIdx(priv, portal->chunk)];
+    return kv_size(kv_A(cluster->nodes, portal->cluster_node).edges) + 1;
+}
+
+/* Search the portal graph, starting from the nodes already in the frontier. Only 
+ * the portals in the 'region' clusters are visited, and only the portals in the 
+ * 'base' clusters are expanded along their chunk edges - the rest of the clusters 
+ * are crossed in a single step using the cluster graph. A NULL 'region' or 'base' 
+ * stands for all clusters. Stops once 'finish' is reached, if it is not NULL. The
+ * octile distance to 'finish' is used as the heuristic, since every edge costs at 
+ * least as much as the number of tiles it spans. */
+static void portal_search(const struct nav_private *priv, const bool *region, const bool *base,
+                          const struct portal *finish, pq_portal_t *frontier, 
+                          khash_t(key_float) *running_cost, khash_t(key_portal) *came_from,
+                          struct mem_arena *arena)
+{
+    while(pq_size(frontier) > 0) {
 
-        if(0 == memcmp(&curr, &finish, sizeof(struct coord)))
+        const struct portal *curr;
+        pq_portal_pop(frontier, &curr);
+
+        if(curr == finish)
             break;
 
-        struct coord neighbours[8];
-        float neighbour_costs[8];
-        int num_neighbours = neighbours_grid(cost_field, curr, neighbours, neighbour_costs);
+        struct arena_mark mark = arena_mark(arena);
+        size_t max = max_neighbours(priv, base, curr);
+        const struct portal **neighbours = arena_alloc(arena, max * sizeof(const struct portal*));
+        float *neighbour_costs = arena_alloc(arena, max * sizeof(float));
+        if(!neighbours || !neighbour_costs) {
+            arena_rewind(arena, mark);
+            break;
+        }
+
+        int num_neighbours = in_clusters(priv, base, curr) 
+                           ? neighbours_portal_graph(curr, neighbours, neighbour_costs)
+                           : neighbours_cluster_graph(priv, curr, neighbours, neighbour_costs);
+
+        khiter_t k = kh_get(key_float, running_cost, portal_to_key(curr));
+        assert(k != kh_end(running_cost));
+        float curr_cost = kh_value(running_cost, k);
 
         for(int i = 0; i < num_neighbours; i++) {
 
-            struct coord *next = &neighbours[i];
-            khiter_t k = kh_get(key_float, running_cost, coord_to_key(curr));
-            assert(k != kh_end(running_cost));
-            float new_cost = kh_value(running_cost, k) + neighbour_costs[i];
+            const struct portal *next = neighbours[i];
+            if(!in_clusters(priv, region, next))
+                continue;
+
+            float new_cost = curr_cost + neighbour_costs[i];
 
-            if((k = kh_get(key_float, running_cost, coord_to_key(*next))) == kh_end(running_cost)
+            if((k = kh_get(key_float, running_cost, portal_to_key(next))) == kh_end(running_cost)
             || new_cost < kh_value(running_cost, k)) {
 
-                kh_put_val(key_float, running_cost, coord_to_key(*next), new_cost);
-                float priority = new_cost + heuristic(finish, *next);
-                pq_coord_push(&frontier, priority, *next);
-                kh_put_val(key_coord, came_from, coord_to_key(*next), curr);
+                kh_put_val(key_float, running_cost, portal_to_key(next), new_cost);
+                float priority = new_cost;
+                if(finish)
+                    priority += heuristic(portal_global_center(next), portal_global_center(finish));
+                pq_portal_push(frontier, priority, next);
+                if(came_from)
+                    kh_put_val(key_portal, came_from, portal_to_key(next), curr);
             }
         }
+        arena_rewind(arena, mark);
     }
+}
+
+/* Intitialize the frontier with all the portals in the source chunk that are 
+ * reachable from the source tile. */
+static void seed_from_tile(const struct nav_private *priv, struct tile_desc start_tile, 
+                           pq_portal_t *frontier, khash_t(key_float) *running_cost)
+{
+    const struct nav_chunk *chunk = &priv->chunks[start_tile.chunk_r * priv->width + start_tile.chunk_c];
+    coord_vec_t path;
+    sv_init(path);
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(!tile_reaches_island(chunk, (struct coord){start_tile.tile_r, start_tile.tile_c}, port->island))
+            continue;
+
+        struct coord port_center = (struct coord){
+            (port->endpoints[0].r + port->endpoints[1].r) / 2,
+            (port->endpoints[0].c + port->endpoints[1].c) / 2,
+        };
+        float cost;
+        bool found = AStar_GridPath((struct coord){start_tile.tile_r, start_tile.tile_c}, port_center, chunk->cost_base, &path, &cost);
+        if(found){
+
+            kh_put_val(key_float, running_cost, portal_to_key(port), cost);
+            pq_portal_push(frontier, cost, port);
+        }
+    }
+    sv_destroy(path);
+}
+
+/* Run a search from the source tile to 'finish'. On success, the path is written 
+ * to 'out_path' and, if 'out_clusters' is not NULL, every cluster that the path 
+ * passes through is flagged in it. */
+static bool portal_graph_path(struct tile_desc start_tile, const struct portal *finish, 
+                              const struct nav_private *priv, const bool *region, const bool *base,
+                              portal_vec_t *out_path, float *out_cost, bool *out_clusters)
+{
+    struct search_scratch *scratch = search_scratch_get();
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!scratch || !arena)
+        return false;
+
+    search_scratch_begin_portals(scratch);
+    pq_portal_t         *frontier = &scratch->portal_frontier;
+    khash_t(key_portal) *came_from = scratch->portal_came_from;
+    khash_t(key_float)  *running_cost = scratch->portal_cost;
+
+    seed_from_tile(priv, start_tile, frontier, running_cost);
+    portal_search(priv, region, base, finish, frontier, running_cost, came_from, arena);
     
-    if(kh_get(key_coord, came_from, coord_to_key(finish)) == kh_end(came_from))
-        goto fail_find_path;
+    if(kh_get(key_portal, came_from, portal_to_key(finish)) == kh_end(came_from))
+        return false;
 
-    kv_reset(*out_path);
+    sv_reset(*out_path);
 
     /* We have our path at this point. Walk backwards along the path to build a 
      * vector of the nodes along the path. */
-    struct coord curr = finish;
-    while(0 != memcmp(&curr, &start, sizeof(struct coord))) {
+    const struct portal *curr = finish;
+    while(true) {
 
-        kv_push(struct coord, *out_path, curr);
-        khiter_t k = kh_get(key_coord, came_from, coord_to_key(curr));
-        assert(k != kh_end(came_from));
+        sv_push(const struct portal*, *out_path, curr);
+        if(out_clusters)
+            out_clusters[N_ClusterIdx(priv, curr->chunk)] = true;
+
+        khiter_t k = kh_get(key_portal, came_from, portal_to_key(curr));
+        if(k == kh_end(came_from))
+            break;
         curr = kh_value(came_from, k);
     }
-    kv_push(struct coord, *out_path, start);
 
     /* Reverse the path vector */
-    for(int i = 0, j = kv_size(*out_path) - 1; i < j; i++, j--) {
-        struct coord tmp = kv_A(*out_path, i);
-        kv_A(*out_path, i) = kv_A(*out_path, j);
-        kv_A(*out_path, j) = tmp;
+    for(int i = 0, j = sv_size(*out_path) - 1; i < j; i++, j--) {
+        const struct portal *tmp = sv_A(*out_path, i);
+        sv_A(*out_path, i) = sv_A(*out_path, j);
+        sv_A(*out_path, j) = tmp;
     }
 
-    khiter_t k = kh_get(key_float, running_cost, coord_to_key(finish));
+    khiter_t k = kh_get(key_float, running_cost, portal_to_key(finish));
     assert(k != kh_end(running_cost));
     *out_cost = kh_value(running_cost, k);
-
-    pq_coord_destroy(&frontier);
-    kh_destroy(key_float, running_cost);
-    kh_destroy(key_coord, came_from);
     return true;
+}
 
-fail_find_path:
-    pq_coord_destroy(&frontier);
-    kh_destroy(key_float, running_cost);
-fail_running_cost:
-    kh_destroy(key_coord, came_from);
-fail_came_from:
-    return false;
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool AStar_Init(void)
+{
+    s_scratch_tls = SDL_TLSCreate();
+    return (s_scratch_tls != 0);
 }
 
-bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *finish, 
-                           const struct nav_private *priv, 
-                           portal_vec_t *out_path, float *out_cost)
+void AStar_Shutdown(void)
 {
-    pq_portal_t          frontier;
-    khash_t(key_portal) *came_from;
-    khash_t(key_float)  *running_cost;
-    
-    pq_portal_init(&frontier);
-    if(NULL == (came_from = kh_init(key_portal)))
-        goto fail_came_from;
-    if(NULL == (running_cost = kh_init(key_float)))
-        goto fail_running_cost;
+    /* Worker threads release their own scratch on exit */
+    struct search_scratch *scratch = SDL_TLSGet(s_scratch_tls);
+    if(scratch) {
+        SDL_TLSSet(s_scratch_tls, NULL, NULL);
+        search_scratch_free(scratch);
+    }
+}
 
-    const struct nav_chunk *chunk = &priv->chunks[start_tile.chunk_r * priv->width + start_tile.chunk_c];
-    coord_vec_t path;
-    kv_init(path);
+bool AStar_GridPath(struct coord start, struct coord finish, 
+                    const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                    coord_vec_t *out_path, float *out_cost)
+{
+    struct search_scratch *scratch = search_scratch_get();
+    if(!scratch)
+        return false;
 
-    /* Intitialize the frontier with all the portals in the source chunk that are 
-     * reachable from the source tile. */
-    for(int i = 0; i < chunk->num_portals; i++) {
+    search_scratch_begin(scratch);
+    const uint32_t gen = scratch->gen;
+    pqi_coord_t *frontier = &scratch->frontier;
+    N_PadCostField(cost_field, COST_IMPASSABLE, scratch->padded);
 
-        const struct portal *port = &chunk->portals[i];
-        struct coord port_center = (struct coord){
-            (port->endpoints[0].r + port->endpoints[1].r) / 2,
-            (port->endpoints[0].c + port->endpoints[1].c) / 2,
-        };
-        float cost;
-        bool found = AStar_GridPath((struct coord){start_tile.tile_r, start_tile.tile_c}, port_center, chunk->cost_base, &path, &cost);
-		if(found){
-			
-            kh_put_val(key_float, running_cost, portal_to_key(port), cost);
-            pq_portal_push(&frontier, cost, port);
-		}
-    }
-	kv_destroy(path);
+    scratch->visited[start.r][start.c] = gen;
+    scratch->running_cost[start.r][start.c] = 0.0f;
+    scratch->came_from[start.r][start.c] = start;
+    pqi_coord_push(frontier, 0.0f, start);
 
-    while(pq_size(&frontier) > 0) {
+    while(pqi_size(frontier) > 0) {
 
-        const struct portal *curr;
-        pq_portal_pop(&frontier, &curr);
+        struct coord curr;
+        pqi_coord_pop(frontier, &curr);
 
-        if(curr == finish)
+        if(curr.r == finish.r && curr.c == finish.c)
             break;
 
-        const struct portal *neighbours[MAX_PORTALS_PER_CHUNK];
-        float neighbour_costs[MAX_PORTALS_PER_CHUNK];
-        int num_neighbours = neighbours_portal_graph(curr, neighbours, neighbour_costs);
+        struct coord neighbours[8];
+        float neighbour_costs[8];
+        int num_neighbours = neighbours_grid(scratch->padded, curr, neighbours, neighbour_costs);
+
+        assert(scratch->visited[curr.r][curr.c] == gen);
+        float curr_cost = scratch->running_cost[curr.r][curr.c];
 
         for(int i = 0; i < num_neighbours; i++) {
 
-            const struct portal *next = neighbours[i];
-            khiter_t k = kh_get(key_float, running_cost, portal_to_key(curr));
-            assert(k != kh_end(running_cost));
-            float new_cost = kh_value(running_cost, k) + neighbour_costs[i];
+            struct coord next = neighbours[i];
+            float new_cost = curr_cost + neighbour_costs[i];
 
-            if((k = kh_get(key_float, running_cost, portal_to_key(next))) == kh_end(running_cost)
-            || new_cost < kh_value(running_cost, k)) {
+            if(scratch->visited[next.r][next.c] != gen
+            || new_cost < scratch->running_cost[next.r][next.c]) {
 
-                kh_put_val(key_float, running_cost, portal_to_key(next), new_cost);
-                /* No heuristic used - effectively Dijkstra's algorithm */
-                float priority = new_cost;
-                pq_portal_push(&frontier, priority, next);
-                kh_put_val(key_portal, came_from, portal_to_key(next), curr);
+                scratch->visited[next.r][next.c] = gen;
+                scratch->running_cost[next.r][next.c] = new_cost;
+                scratch->came_from[next.r][next.c] = curr;
+
+                float priority = new_cost + heuristic(finish, next);
+                pqi_coord_push(frontier, priority, next);
             }
         }
     }
     
-    if(kh_get(key_portal, came_from, portal_to_key(finish)) == kh_end(came_from))
-        goto fail_find_path;
+    if(scratch->visited[finish.r][finish.c] != gen)
+        return false;
 
-    kv_reset(*out_path);
+    sv_reset(*out_path);
 
     /* We have our path at this point. Walk backwards along the path to build a 
      * vector of the nodes along the path. */
-    const struct portal *curr = finish;
-    while(true) {
+    struct coord curr = finish;
+    while(0 != memcmp(&curr, &start, sizeof(struct coord))) {
 
-        kv_push(const struct portal*, *out_path, curr);
-        khiter_t k = kh_get(key_portal, came_from, portal_to_key(curr));
-        if(k == kh_end(came_from))
-            break;
-        curr = kh_value(came_from, k);
+        sv_push(struct coord, *out_path, curr);
+        assert(scratch->visited[curr.r][curr.c] == gen);
+        curr = scratch->came_from[curr.r][curr.c];
     }
-    //kv_push(const struct portal*, *out_path, start);
+    sv_push(struct coord, *out_path, start);
 
     /* Reverse the path vector */
-    for(int i = 0, j = kv_size(*out_path) - 1; i < j; i++, j--) {
-        const struct portal *tmp = kv_A(*out_path, i);
-        kv_A(*out_path, i) = kv_A(*out_path, j);
-        kv_A(*out_path, j) = tmp;
+    for(int i = 0, j = sv_size(*out_path) - 1; i < j; i++, j--) {
+        struct coord tmp = sv_A(*out_path, i);
+        sv_A(*out_path, i) = sv_A(*out_path, j);
+        sv_A(*out_path, j) = tmp;
     }
 
-    khiter_t k = kh_get(key_float, running_cost, portal_to_key(finish));
-    assert(k != kh_end(running_cost));
-    *out_cost = kh_value(running_cost, k);
-
-    pq_portal_destroy(&frontier);
-    kh_destroy(key_float, running_cost);
-    kh_destroy(key_portal, came_from);
+    *out_cost = scratch->running_cost[finish.r][finish.c];
     return true;
+}
 
-fail_find_path:
-    pq_portal_destroy(&frontier);
-    kh_destroy(key_float, running_cost);
-fail_running_cost:
-    kh_destroy(key_portal, came_from);
-fail_came_from:
-    return false;
+void AStar_GridCosts(struct coord start, const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                     size_t num_targets, const struct coord targets[], float out_costs[])
+{
+    for(int i = 0; i < num_targets; i++)
+        out_costs[i] = INFINITY;
+
+    struct search_scratch *scratch = search_scratch_get();
+    if(!scratch || num_targets == 0)
+        return;
+
+    bool is_target[FIELD_RES_R][FIELD_RES_C];
+    memset(is_target, 0, sizeof(is_target));
+    for(int i = 0; i < num_targets; i++)
+        is_target[targets[i].r][targets[i].c] = true;
+
+    /* Head for the targets one at a time, nearest first */
+    int order[num_targets];
+    for(int i = 0; i < num_targets; i++) {
+
+        int j = i;
+        float dist = heuristic(start, targets[i]);
+        for(; j > 0 && heuristic(start, targets[order[j-1]]) > dist; j--)
+            order[j] = order[j-1];
+        order[j] = i;
+    }
+
+    search_scratch_begin(scratch);
+    const uint32_t gen = scratch->gen;
+    pqi_coord_t *frontier = &scratch->frontier;
+    N_PadCostField(cost_field, COST_IMPASSABLE, scratch->padded);
+
+    scratch->visited[start.r][start.c] = gen;
+    scratch->running_cost[start.r][start.c] = 0.0f;
+    pqi_coord_push(frontier, 0.0f, start);
+
+    /* This is a single A* search, where the goal is switched to the next target 
+     * once the current one is reached. Since the heuristic is consistent for 
+     * every goal, the cost of a tile is final once it is popped, no matter which 
+     * goal the tile was popped for. So the tiles already expanded never need to 
+     * be revisited. Only the priorities of the open tiles need to be updated 
+     * when the goal changes. With many targets, the search will end up covering 
+     * most of the field anyway. Then, it is cheaper to drop the heuristic and 
+     * not have to re-prioritize the open tiles at all. */
+    const bool directed = (num_targets <= MAX_DIRECTED_TARGETS);
+
+    for(int i = 0; i < num_targets; i++) {
+
+        struct coord goal = targets[order[i]];
+        if(!is_target[goal.r][goal.c])
+            continue;
+
+        if(directed) {
+
+            size_t num_open = pqi_size(frontier);
+            for(int j = 0; j < num_open; j++)
+                scratch->open[j] = frontier->nodes[j + 1].data;
+
+            pqi_coord_clear(frontier);
+            for(int j = 0; j < num_open; j++) {
+
+                struct coord curr = scratch->open[j];
+                float priority = scratch->running_cost[curr.r][curr.c] + heuristic(goal, curr);
+                pqi_coord_push(frontier, priority, curr);
+            }
+        }
+
+        while(is_target[goal.r][goal.c] && pqi_size(frontier) > 0) {
+
+            struct coord curr;
+            pqi_coord_pop(frontier, &curr);
+            is_target[curr.r][curr.c] = false;
+
+            struct coord neighbours[8];
+            float neighbour_costs[8];
+            int num_neighbours = neighbours_grid(scratch->padded, curr, neighbours, neighbour_costs);
+
+            assert(scratch->visited[curr.r][curr.c] == gen);
+            float curr_cost = scratch->running_cost[curr.r][curr.c];
+
+            for(int k = 0; k < num_neighbours; k++) {
+
+                struct coord next = neighbours[k];
+                float new_cost = curr_cost + neighbour_costs[k];
+
+                if(scratch->visited[next.r][next.c] != gen
+                || new_cost < scratch->running_cost[next.r][next.c]) {
+
+                    scratch->visited[next.r][next.c] = gen;
+                    scratch->running_cost[next.r][next.c] = new_cost;
+                    float priority = new_cost + (directed ? heuristic(goal, next) : 0.0f);
+                    pqi_coord_push(frontier, priority, next);
+                }
+            }
+        }
+
+        /* The rest of the targets are not reachable */
+        if(is_target[goal.r][goal.c])
+            break;
+    }
+
+    for(int i = 0; i < num_targets; i++) {
+
+        struct coord curr = targets[i];
+        if(!is_target[curr.r][curr.c])
+            out_costs[i] = scratch->running_cost[curr.r][curr.c];
+    }
+}
+
+bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *finish, 
+                           const struct nav_private *priv, 
+                           portal_vec_t *out_path, float *out_cost)
+{
+    size_t src_cluster = N_ClusterIdx(priv, (struct coord){start_tile.chunk_r, start_tile.chunk_c});
+    size_t dst_cluster = N_ClusterIdx(priv, finish->chunk);
+
+    if(!priv->clusters || src_cluster == dst_cluster)
+        return portal_graph_path(start_tile, finish, priv, NULL, NULL, out_path, out_cost, NULL);
+
+    /* First, find the clusters that the path passes through. Only the source and 
+     * destination clusters are searched tile edge by tile edge, while all others 
+     * are crossed using the cluster edges. Then, search for the actual path, visiting 
+     * only the portals in those clusters. Since the cluster edges hold the exact 
+     * costs of crossing the clusters, the path found is still the shortest one. */
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return false;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t num_clusters = priv->cluster_width * priv->cluster_height;
+    bool *base = arena_calloc(arena, num_clusters, sizeof(bool));
+    bool *corridor = arena_calloc(arena, num_clusters, sizeof(bool));
+    bool found = false;
+    if(!base || !corridor)
+        goto out;
+
+    base[src_cluster] = true;
+    base[dst_cluster] = true;
+    corridor[src_cluster] = true;
+
+    portal_vec_t abstract_path;
+    sv_init(abstract_path);
+    float abstract_cost;
+
+    found = portal_graph_path(start_tile, finish, priv, NULL, base, 
+        &abstract_path, &abstract_cost, corridor);
+    sv_destroy(abstract_path);
+    if(!found)
+        goto out;
+
+    found = portal_graph_path(start_tile, finish, priv, corridor, NULL, out_path, out_cost, NULL);
+
+out:
+    arena_rewind(arena, mark);
+    return found;
+}
+
+void AStar_ClusterCosts(const struct portal *start, size_t cluster, const struct nav_private *priv,
+                        size_t num_targets, const struct portal *const targets[], float out_costs[])
+{
+    for(int i = 0; i < num_targets; i++)
+        out_costs[i] = INFINITY;
+
+    struct search_scratch *scratch = search_scratch_get();
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!scratch || !arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    size_t num_clusters = priv->cluster_width * priv->cluster_height;
+    bool *region = arena_calloc(arena, num_clusters, sizeof(bool));
+    if(!region)
+        goto out;
+    region[cluster] = true;
+
+    search_scratch_begin_portals(scratch);
+    pq_portal_t *frontier = &scratch->portal_frontier;
+    khash_t(key_float) *running_cost = scratch->portal_cost;
+
+    kh_put_val(key_float, running_cost, portal_to_key(start), 0.0f);
+    pq_portal_push(frontier, 0.0f, start);
+    portal_search(priv, region, NULL, NULL, frontier, running_cost, NULL, arena);
+
+    for(int i = 0; i < num_targets; i++) {
+
+        khiter_t k = kh_get(key_float, running_cost, portal_to_key(targets[i]));
+        if(k != kh_end(running_cost))
+            out_costs[i] = kh_value(running_cost, k);
+    }
+
+out:
+    arena_rewind(arena, mark);
 }
 
 const struct portal *AStar_ReachablePortal(struct coord start,
                                            const struct nav_chunk *chunk)
 {
-    coord_vec_t path;
-    kv_init(path);
-
     for(int i = 0; i < chunk->num_portals; i++) {
 
         const struct portal *port = &chunk->portals[i];
-        struct coord port_center = (struct coord){
-            (port->endpoints[0].r + port->endpoints[1].r) / 2,
-            (port->endpoints[0].c + port->endpoints[1].c) / 2,
-        };
-        float cost;
-        bool found = AStar_GridPath(start, port_center, chunk->cost_base, &path, &cost);
-		if(found){
-    		kv_destroy(path);
-			return port;
-		}
+        if(tile_reaches_island(chunk, start, port->island))
+            return port;
     }
-
-	kv_destroy(path);
     return NULL;
 }
 
 bool AStar_TilesLinked(struct coord start, struct coord finish,
-                       const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C])
+                       const struct nav_chunk *chunk)
 {
-    coord_vec_t path;
-    kv_init(path);
-
-    float cost;
-    bool ret = AStar_GridPath(start, finish, cost_field, &path, &cost);
-
-    kv_destroy(path);
-    return ret;    
+    if(start.r == finish.r && start.c == finish.c)
+        return true;
+    return tile_reaches_island(chunk, start, chunk->islands[finish.r][finish.c]);
 }
 
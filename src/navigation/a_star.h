@@ -37,6 +37,7 @@
 #define A_STAR_H
 
 #include "../lib/public/kvec.h"
+#include "../lib/public/small_vec.h"
 #include "../map/public/tile.h"
 #include "nav_data.h"
 
@@ -44,8 +45,22 @@
 
 struct nav_private;
 
-typedef kvec_t(struct coord) coord_vec_t;
-typedef kvec_t(const struct portal*) portal_vec_t;
+typedef svec_t(struct coord, 64) coord_vec_t;
+typedef svec_t(const struct portal*, 32) portal_vec_t;
+
+/* ------------------------------------------------------------------------
+ * Set up the per-thread scratch storage used by grid searches. Must be 
+ * called before any other AStar_ function.
+ * ------------------------------------------------------------------------
+ */
+bool AStar_Init(void);
+
+/* ------------------------------------------------------------------------
+ * Free the calling thread's scratch storage. Other threads' storage is 
+ * released when they exit.
+ * ------------------------------------------------------------------------
+ */
+void AStar_Shutdown(void);
 
 /* ------------------------------------------------------------------------
  * Finds the shortest path in a rectangular cost field. Returns true if a 
@@ -57,22 +72,43 @@ bool AStar_GridPath(struct coord start, struct coord finish,
                     const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
                     coord_vec_t *out_path, float *out_cost);
 
+/* ------------------------------------------------------------------------
+ * Computes the costs of the shortest paths from 'start' to each of the 
+ * 'targets' in a rectangular cost field, using a single search. The cost of 
+ * unreachable targets is set to INFINITY.
+ * ------------------------------------------------------------------------
+ */
+void AStar_GridCosts(struct coord start, const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                     size_t num_targets, const struct coord targets[], float out_costs[]);
+
 /* ------------------------------------------------------------------------
  * Finds the shortest path between a tile and a node in a portal graph. Returns 
  * true if a path is found, false otherwise. If returning true, 'out_path' holds 
- * the portal nodes to be traversed, in order.
+ * the portal nodes to be traversed, in order. When the tile and the node are in
+ * different clusters, the clusters that the path passes through are found first 
+ * and only their portals are searched.
  * ------------------------------------------------------------------------
  */
 bool AStar_PortalGraphPath(struct tile_desc start_tile, const struct portal *finish, 
                            const struct nav_private *priv, 
                            portal_vec_t *out_path, float *out_cost);
 
+/* ------------------------------------------------------------------------
+ * Computes the cost of the cheapest path from 'start' to each of the 'targets'
+ * which does not leave the specified cluster. The cost of unreachable targets
+ * is set to INFINITY.
+ * ------------------------------------------------------------------------
+ */
+void AStar_ClusterCosts(const struct portal *start, size_t cluster, const struct nav_private *priv,
+                        size_t num_targets, const struct portal *const targets[], float out_costs[]);
+
 /* ------------------------------------------------------------------------
  * Returns true if there exists a path between 2 tiles in the same chunk.
+ * This is a lookup in the chunk's island field, which must be up to date.
  * ------------------------------------------------------------------------
  */
 bool AStar_TilesLinked(struct coord start, struct coord finish,
-                       const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C]);
+                       const struct nav_chunk *chunk);
 
 /* ------------------------------------------------------------------------
  * Returns a reachable portal in the chunk, NULL if no portal is reachable.
@@ -0,0 +1,190 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "cluster.h"
+#include "nav_private.h"
+#include "a_star.h"
+#include "../parallel.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+
+#define IDX(r, width, c)   ((r) * (width) + (c))
+#define MIN(a, b)          ((a) < (b) ? (a) : (b))
+
+struct update_job{
+    struct nav_private *priv;
+    const bool         *affected;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void cl_clear(struct nav_cluster *cluster)
+{
+    for(int i = 0; i < kv_size(cluster->nodes); i++)
+        kv_destroy(kv_A(cluster->nodes, i).edges);
+    kv_size(cluster->nodes) = 0;
+}
+
+static bool cl_affected(const struct nav_private *priv, const bool *affected, int cr, int cc)
+{
+    for(int r = cr * CLUSTER_DIM; r < MIN((cr + 1) * CLUSTER_DIM, priv->height); r++) {
+        for(int c = cc * CLUSTER_DIM; c < MIN((cc + 1) * CLUSTER_DIM, priv->width); c++) {
+            if(affected[IDX(r, priv->width, c)])
+                return true;
+        }
+    }
+    return false;
+}
+
+static void cl_rebuild(struct nav_private *priv, int cr, int cc)
+{
+    size_t idx = IDX(cr, priv->cluster_width, cc);
+    struct nav_cluster *cluster = &priv->clusters[idx];
+    cl_clear(cluster);
+
+    for(int r = cr * CLUSTER_DIM; r < MIN((cr + 1) * CLUSTER_DIM, priv->height); r++) {
+        for(int c = cc * CLUSTER_DIM; c < MIN((cc + 1) * CLUSTER_DIM, priv->width); c++) {
+
+            struct nav_chunk *chunk = &priv->chunks[IDX(r, priv->width, c)];
+            for(int i = 0; i < chunk->num_portals; i++) {
+
+                struct portal *port = &chunk->portals[i];
+                if(N_ClusterIdx(priv, port->connected->chunk) == idx) {
+                    port->cluster_node = CLUSTER_NODE_NONE;
+                    continue;
+                }
+
+                assert(kv_size(cluster->nodes) < CLUSTER_NODE_NONE);
+                port->cluster_node = kv_size(cluster->nodes);
+
+                struct cluster_node *node = kv_pushp(struct cluster_node, cluster->nodes);
+                node->portal = port;
+                kv_init(node->edges);
+            }
+        }
+    }
+
+    size_t num_nodes = kv_size(cluster->nodes);
+    if(num_nodes == 0)
+        return;
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    const struct portal **targets = arena_alloc(arena, num_nodes * sizeof(const struct portal*));
+    float *costs = arena_alloc(arena, num_nodes * sizeof(float));
+    if(!targets || !costs)
+        goto out;
+
+    for(int i = 0; i < num_nodes; i++)
+        targets[i] = kv_A(cluster->nodes, i).portal;
+
+    for(int i = 0; i < num_nodes; i++) {
+
+        struct cluster_node *node = &kv_A(cluster->nodes, i);
+        AStar_ClusterCosts(node->portal, idx, priv, num_nodes, targets, costs);
+
+        for(int j = 0; j < num_nodes; j++) {
+
+            if(i == j || isinf(costs[j]))
+                continue;
+            kv_push(struct cluster_edge, node->edges, ((struct cluster_edge){j, costs[j]}));
+        }
+    }
+
+out:
+    arena_rewind(arena, mark);
+}
+
+/* A cluster's rebuild only writes to the cluster and the portals inside it, 
+ * and the searches it runs stay within the cluster. So different clusters 
+ * can be rebuilt in parallel. */
+static void cl_update_task(void *arg, size_t idx)
+{
+    const struct update_job *job = arg;
+    int cr = idx / job->priv->cluster_width;
+    int cc = idx % job->priv->cluster_width;
+
+    if(!cl_affected(job->priv, job->affected, cr, cc))
+        return;
+    cl_rebuild(job->priv, cr, cc);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_CL_Init(struct nav_private *priv)
+{
+    priv->cluster_width = (priv->width + CLUSTER_DIM - 1) / CLUSTER_DIM;
+    priv->cluster_height = (priv->height + CLUSTER_DIM - 1) / CLUSTER_DIM;
+
+    size_t num_clusters = priv->cluster_width * priv->cluster_height;
+    priv->clusters = malloc(num_clusters * sizeof(struct nav_cluster));
+    if(!priv->clusters)
+        return false;
+
+    for(int i = 0; i < num_clusters; i++)
+        kv_init(priv->clusters[i].nodes);
+    return true;
+}
+
+void N_CL_Destroy(struct nav_private *priv)
+{
+    size_t num_clusters = priv->cluster_width * priv->cluster_height;
+    for(int i = 0; i < num_clusters; i++) {
+        cl_clear(&priv->clusters[i]);
+        kv_destroy(priv->clusters[i].nodes);
+    }
+    free(priv->clusters);
+    priv->clusters = NULL;
+}
+
+void N_CL_Update(struct nav_private *priv, const bool *affected)
+{
+    struct update_job job = (struct update_job){priv, affected};
+    PL_For(priv->cluster_width * priv->cluster_height, cl_update_task, &job);
+}
+
@@ -36,13 +36,56 @@
 #include "field.h"
 #include "nav_private.h"
 #include "../lib/public/pqueue.h"
+#include "../lib/public/mem_arena.h"
+#include "../mem.h"
 
 #include <string.h>
 #include <assert.h>
 #include <math.h>
 
-PQUEUE_TYPE(coord, struct coord)
-PQUEUE_IMPL(static, coord, struct coord)
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+/* Border of the padded cost fields. No tile has a cost of 0. */
+#define COST_OFF_FIELD  (0)
+/* Set in the IDs of fields integrated on from the field across their target portal */
+#define FF_ID_CHAINED   ((uint64_t)1 << 55)
+#define LOS_ROW_MASK    (~(uint64_t)0 >> (64 - FIELD_RES_C))
+/* All but the first and last column */
+#define LOS_INNER_MASK  (LOS_ROW_MASK & ~(uint64_t)1 & ~((uint64_t)1 << (FIELD_RES_C - 1)))
+
+static inline size_t tile_key(int tile)
+{
+    return tile;
+}
+
+PQUEUE_INDEXED_TYPE(tile, int)
+PQUEUE_INDEXED_IMPL(static, tile, int, tile_key)
+
+/* The step costs of the Dijkstra searches are integers no greater than 
+ * COST_IMPASSABLE - 1. So all the tiles in the frontier are within that 
+ * distance of the nearest one, and cycling through COST_IMPASSABLE buckets 
+ * keyed by distance is enough to always find it. */
+#define NUM_BUCKETS     (COST_IMPASSABLE)
+#define TILE_NONE       (-1)
+#define DIST_NONE       (UINT32_MAX)
+
+/* A bucket queue (Dial's algorithm) of the tiles of a chunk, with O(1) pushes,
+ * decreases and amortized O(1) pops. Every bucket is a doubly-linked list, 
+ * threaded through the per-tile 'next' and 'prev' arrays. A tile's 'dist' is 
+ * DIST_NONE until it is first pushed, and is final once it is popped. */
+struct bucket_queue{
+    size_t   size;
+    uint32_t curr;
+    int16_t  head[NUM_BUCKETS];
+    int16_t  next[FIELD_RES_R * FIELD_RES_C];
+    int16_t  prev[FIELD_RES_R * FIELD_RES_C];
+    uint32_t dist[FIELD_RES_R * FIELD_RES_C];
+};
 
 /*****************************************************************************/
 /* GLOBAL VARIABLES                                                          */
@@ -64,67 +107,84 @@ vec2_t g_flow_dir_lookup[9] = {
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static int neighbours_grid(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], struct coord coord, 
-                           bool only_passable, struct coord *out_neighbours, uint8_t *out_costs)
+static void bq_init(struct bucket_queue *bq)
 {
-    int ret = 0;
+    bq->size = 0;
+    bq->curr = 0;
+    for(int i = 0; i < NUM_BUCKETS; i++)
+        bq->head[i] = TILE_NONE;
+    for(int i = 0; i < FIELD_RES_R * FIELD_RES_C; i++)
+        bq->dist[i] = DIST_NONE;
+}
 
-    for(int r = -1; r <= 1; r++) {
-        for(int c = -1; c <= 1; c++) {
+static void bq_unlink(struct bucket_queue *bq, int tile)
+{
+    int16_t *head = &bq->head[bq->dist[tile] % NUM_BUCKETS];
+    if(bq->prev[tile] != TILE_NONE)
+        bq->next[bq->prev[tile]] = bq->next[tile];
+    else
+        *head = bq->next[tile];
+    if(bq->next[tile] != TILE_NONE)
+        bq->prev[bq->next[tile]] = bq->prev[tile];
+    bq->size--;
+}
 
-            int abs_r = coord.r + r;
-            int abs_c = coord.c + c;
+/* Push a tile which has not been popped yet, or lower the distance of one 
+ * that is already queued. */
+static void bq_push(struct bucket_queue *bq, int tile, uint32_t dist)
+{
+    assert(dist >= bq->curr && dist - bq->curr < NUM_BUCKETS);
+    if(bq->dist[tile] != DIST_NONE)
+        bq_unlink(bq, tile);
+
+    int16_t *head = &bq->head[dist % NUM_BUCKETS];
+    bq->dist[tile] = dist;
+    bq->prev[tile] = TILE_NONE;
+    bq->next[tile] = *head;
+    if(*head != TILE_NONE)
+        bq->prev[*head] = tile;
+    *head = tile;
+    bq->size++;
+}
 
-            if(abs_r < 0 || abs_r >= FIELD_RES_R)
-                continue;
-            if(abs_c < 0 || abs_c >= FIELD_RES_C)
-                continue;
-            if(r == 0 && c == 0)
-                continue;
-            if(only_passable && cost_field[abs_r][abs_c] == COST_IMPASSABLE)
-                continue;
-            if((r == c) || (r == -c)) /* diag */
-                continue;
+static int bq_pop(struct bucket_queue *bq)
+{
+    assert(bq->size > 0);
+    while(bq->head[bq->curr % NUM_BUCKETS] == TILE_NONE)
+        bq->curr++;
 
-            out_neighbours[ret] = (struct coord){abs_r, abs_c};
-            out_costs[ret] = cost_field[abs_r][abs_c];
-            ret++;
-        }
-    }
-    assert(ret < 9);
+    int ret = bq->head[bq->curr % NUM_BUCKETS];
+    bq_unlink(bq, ret);
     return ret;
 }
 
-static int neighbours_grid_LOS(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
-                               const struct LOS_field *los, struct coord coord, 
-                               struct coord *out_neighbours, uint8_t *out_costs)
+/* 'padded' is a cost field padded with COST_OFF_FIELD tiles (see N_PadCostField). 
+ * Only the orthogonal neighbours are returned. */
+static int neighbours_grid(const uint8_t *padded, struct coord coord, bool only_passable, 
+                           struct coord *out_neighbours, uint8_t *out_costs)
 {
+    static const struct { int r, c; } s_offsets[4] = {
+        {-1,  0}, { 0, -1}, { 0,  1}, { 1,  0},
+    };
+    const uint8_t *center = padded + PADDED_IDX(coord.r, coord.c);
     int ret = 0;
 
-    for(int r = -1; r <= 1; r++) {
-        for(int c = -1; c <= 1; c++) {
+    for(int i = 0; i < ARR_SIZE(s_offsets); i++) {
 
-            int abs_r = coord.r + r;
-            int abs_c = coord.c + c;
+        int r = s_offsets[i].r;
+        int c = s_offsets[i].c;
+        uint8_t cost = center[r * PADDED_RES_C + c];
 
-            if(abs_r < 0 || abs_r >= FIELD_RES_R)
-                continue;
-            if(abs_c < 0 || abs_c >= FIELD_RES_C)
-                continue;
-            if(r == 0 && c == 0)
-                continue;
-            if((r == c) || (r == -c)) /* diag */
-                continue;
+        if(cost == COST_OFF_FIELD)
+            continue;
+        if(only_passable && cost == COST_IMPASSABLE)
+            continue;
 
-            if(los->field[abs_r][abs_c].wavefront_blocked)
-                continue;
-
-            out_neighbours[ret] = (struct coord){abs_r, abs_c};
-            out_costs[ret] = cost_field[abs_r][abs_c];
-            ret++;
-        }
+        out_neighbours[ret] = (struct coord){coord.r + r, coord.c + c};
+        out_costs[ret] = cost;
+        ret++;
     }
-    assert(ret < 9);
+    assert(ret < 5);
     return ret;
 }
 
@@ -181,25 +241,35 @@ static enum flow_dir flow_dir(const float integration_field[FIELD_RES_R][FIELD_R
         assert(0);
 }
 
-static bool is_LOS_corner(struct coord cell, const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C])
+/* Build the per-row bitsets of the tiles that the LOS wavefront can cross, and 
+ * of the obstacle tiles which are LOS corners (i.e. obstacles with exactly one 
+ * blocked neighbour along either axis). The wavefront casts a shadow, in the form
+ * of a wavefront blocked line, behind every corner that it reaches. */
+static void los_masks(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                      uint64_t out_passable[FIELD_RES_R], uint64_t out_corners[FIELD_RES_R])
 {
-    if(cell.r > 0 && cell.r < FIELD_RES_R-1) {
+    uint64_t blocked[FIELD_RES_R];
+    for(int r = 0; r < FIELD_RES_R; r++) {
 
-        bool left_blocked  = cost_field[cell.r - 1][cell.c] > 1;
-        bool right_blocked = cost_field[cell.r + 1][cell.c] > 1;
-        if(left_blocked ^ right_blocked)
-            return true;
+        uint64_t row = 0;
+        for(int c = 0; c < FIELD_RES_C; c++)
+            row |= (uint64_t)(cost_field[r][c] > 1) << c;
+        blocked[r] = row;
+        out_passable[r] = ~row & LOS_ROW_MASK;
     }
 
-    if(cell.c > 0 && cell.c < FIELD_RES_C-1) {
+    for(int r = 0; r < FIELD_RES_R; r++) {
 
-        bool top_blocked = cost_field[cell.r][cell.c - 1] > 1;
-        bool bot_blocked = cost_field[cell.r][cell.c + 1] > 1;
-        if(top_blocked ^ bot_blocked)
-            return true;
+        uint64_t corners = ((blocked[r] << 1) ^ (blocked[r] >> 1)) & LOS_INNER_MASK;
+        if(r > 0 && r < FIELD_RES_R-1)
+            corners |= blocked[r - 1] ^ blocked[r + 1];
+        out_corners[r] = corners & blocked[r];
     }
-    
-    return false;
+}
+
+static inline void los_set(uint64_t words[FIELD_RES_R], int r, int c, bool val)
+{
+    words[r] = (words[r] & ~((uint64_t)1 << c)) | ((uint64_t)val << c);
 }
 
 static void create_wavefront_blocked_line(struct tile_desc target, struct tile_desc corner, 
@@ -242,7 +312,7 @@ static void create_wavefront_blocked_line(struct tile_desc target, struct tile_d
     struct coord curr = (struct coord){corner.tile_r, corner.tile_c};
     do {
 
-        out_los->field[curr.r][curr.c].wavefront_blocked = 1;
+        out_los->wavefront_blocked[curr.r] |= (uint64_t)1 << curr.c;
         e2 = 2 * err;
         if(e2 >= dy) {
             err += dy;
@@ -256,18 +326,306 @@ static void create_wavefront_blocked_line(struct tile_desc target, struct tile_d
     }while(curr.r >= 0 && curr.r < FIELD_RES_R && curr.c >= 0 && curr.c < FIELD_RES_C);
 }
 
+/* The base costs, with the costs of the blockers added onto the passable tiles */
+static void blend_blockers(const struct nav_chunk *chunk, uint8_t out[FIELD_RES_R][FIELD_RES_C])
+{
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            unsigned cost = chunk->cost_base[r][c];
+            if(cost != COST_IMPASSABLE) {
+                cost += chunk->blockers[r][c] * COST_PER_BLOCKER;
+                cost = (cost < COST_IMPASSABLE) ? cost : COST_IMPASSABLE - 1;
+            }
+            out[r][c] = cost;
+        }
+    }
+}
+
+/* The costs that the fields are integrated over, with the blockers blended in */
+static void current_costs(const struct nav_chunk *chunk, uint8_t out[FIELD_RES_R][FIELD_RES_C])
+{
+    if(chunk->num_blocked > 0)
+        blend_blockers(chunk, out);
+    else
+        memcpy(out, chunk->cost_base, sizeof(chunk->cost_base));
+}
+
+/* The direction for the tiles of the target, which lead out of the chunk 
+ * when the target is a portal. */
+static enum flow_dir target_dir(struct field_target target)
+{
+    if(target.type != TARGET_PORTAL)
+        return FD_NONE;
+
+    bool up    = target.port->connected->chunk.r < target.port->chunk.r;
+    bool down  = target.port->connected->chunk.r > target.port->chunk.r;
+    bool left  = target.port->connected->chunk.c < target.port->chunk.c;
+    bool right = target.port->connected->chunk.c > target.port->chunk.c;
+    assert(up ^ down ^ left ^ right);
+
+    if(up)
+        return FD_N;
+    else if(down)
+        return FD_S;
+    else if(left)
+        return FD_W;
+    else if(right)
+        return FD_E;
+    assert(0);
+    return FD_NONE;
+}
+
+/* The tile on the other side of the border from a tile of the portal */
+static struct coord across_tile(const struct portal *port, int r, int c)
+{
+    if(port->connected->chunk.r < port->chunk.r)
+        return (struct coord){FIELD_RES_R - 1, c};
+    if(port->connected->chunk.r > port->chunk.r)
+        return (struct coord){0, c};
+    if(port->connected->chunk.c < port->chunk.c)
+        return (struct coord){r, FIELD_RES_C - 1};
+    return (struct coord){r, 0};
+}
+
+/* The distance that a tile of the target portal starts out with. For a chained 
+ * field, this is the distance to the final target through the tile across the 
+ * border. */
+static float target_seed(struct field_target target, const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                         const float next_dist[FIELD_RES_R][FIELD_RES_C], int r, int c)
+{
+    if(!next_dist)
+        return 0.0f;
+
+    struct coord across = across_tile(target.port, r, c);
+    return next_dist[across.r][across.c] + cost_field[r][c];
+}
+
+/* The lowest distance that a tile can be reached with from its' neighbours */
+static uint32_t best_from_neighbours(const uint8_t *padded, const uint16_t *dist, int tile)
+{
+    struct coord neighbours[4];
+    uint8_t neighbour_costs[4];
+    int num_neighbours = neighbours_grid(padded, (struct coord){tile / FIELD_RES_C, tile % FIELD_RES_C}, 
+        true, neighbours, neighbour_costs);
+
+    uint32_t ret = DIST_UNREACHED;
+    for(int i = 0; i < num_neighbours; i++) {
+
+        uint16_t from = dist[neighbours[i].r * FIELD_RES_C + neighbours[i].c];
+        if(from == DIST_UNREACHED)
+            continue;
+        uint32_t total_cost = (uint32_t)from + padded[PADDED_IDX(tile / FIELD_RES_C, tile % FIELD_RES_C)];
+        ret = MIN(ret, total_cost);
+    }
+    return ret;
+}
+
+/* Bring the distances in 'state' up to date with the new costs, starting from the 
+ * tiles whose cost changed, and re-derive the flow directions around every tile 
+ * whose distance was touched. A tile whose cost went up loses its' distance, along 
+ * with every tile that reached the target through it. The lost tiles are then 
+ * re-seeded from the surrounding tiles, and the tiles whose cost went down from 
+ * their neighbours, and a Dijkstra search carries the new distances outwards 
+ * from them. This gives the same distances as integrating from scratch. Returns 
+ * false if the field must be rebuilt instead, in which case 'inout_flow' has not 
+ * been touched. */
+static bool repair_integration(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                               struct ff_integration *state, struct flow_field *inout_flow)
+{
+    enum{
+        TILE_LOST    = (1 << 0),
+        TILE_TOUCHED = (1 << 1),
+        TILE_REDO    = (1 << 2),
+    };
+
+    const uint8_t *old_cost = &state->cost[0][0];
+    const uint8_t *new_cost = &cost_field[0][0];
+    uint16_t *dist = &state->dist[0][0];
+
+    int16_t changed[FIELD_RES_R * FIELD_RES_C];
+    size_t num_changed = 0;
+
+    for(int i = 0; i < FIELD_RES_R * FIELD_RES_C; i++) {
+
+        if(old_cost[i] == new_cost[i])
+            continue;
+        /* The set of tiles that can reach the target may have changed */
+        if(old_cost[i] == COST_IMPASSABLE || new_cost[i] == COST_IMPASSABLE)
+            return false;
+        changed[num_changed++] = i;
+    }
+    if(num_changed == 0)
+        return true;
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return false;
+    struct arena_mark mark = arena_mark(arena);
+    bool ret = false;
+
+    pqi_tile_t frontier;
+    uint8_t *flags = arena_calloc(arena, FIELD_RES_R * FIELD_RES_C, sizeof(uint8_t));
+    int16_t *touched = arena_alloc(arena, FIELD_RES_R * FIELD_RES_C * sizeof(int16_t));
+    size_t num_touched = 0;
+
+    if(!flags || !touched || !pqi_tile_init_arena(&frontier, FIELD_RES_R * FIELD_RES_C, arena))
+        goto out;
+
+    /* Work on a copy of the distances, so that the state is left as it was if 
+     * the repair has to be abandoned. */
+    uint16_t *new_dist = arena_alloc(arena, sizeof(state->dist));
+    if(!new_dist)
+        goto out;
+    memcpy(new_dist, dist, sizeof(state->dist));
+
+    uint8_t padded[PADDED_RES_R * PADDED_RES_C];
+    N_PadCostField(cost_field, COST_OFF_FIELD, padded);
+
+    /* Find the tiles whose shortest path may have gotten longer. The tiles of the 
+     * target and those in other islands are never affected. */
+    for(int i = 0; i < num_changed; i++) {
+
+        int tile = changed[i];
+        if(new_cost[tile] < old_cost[tile] || dist[tile] == 0 || dist[tile] == DIST_UNREACHED)
+            continue;
+        flags[tile] |= TILE_LOST | TILE_TOUCHED;
+        touched[num_touched++] = tile;
+    }
+
+    for(int i = 0; i < num_touched; i++) {
+
+        int tile = touched[i];
+        struct coord neighbours[4];
+        uint8_t neighbour_costs[4];
+        int num_neighbours = neighbours_grid(padded, (struct coord){tile / FIELD_RES_C, tile % FIELD_RES_C}, 
+            true, neighbours, neighbour_costs);
+
+        for(int j = 0; j < num_neighbours; j++) {
+
+            int next = neighbours[j].r * FIELD_RES_C + neighbours[j].c;
+            if(flags[next] & TILE_LOST || dist[next] == 0 || dist[next] == DIST_UNREACHED)
+                continue;
+            if(dist[next] != dist[tile] + old_cost[next])
+                continue;
+            flags[next] |= TILE_LOST | TILE_TOUCHED;
+            touched[num_touched++] = next;
+        }
+    }
+
+    for(int i = 0; i < num_touched; i++)
+        new_dist[touched[i]] = DIST_UNREACHED;
+
+    /* Seed the search from around the lost tiles, and from the cheapened ones */
+    size_t num_lost = num_touched;
+    for(int i = 0; i < num_lost; i++) {
+
+        int tile = touched[i];
+        uint32_t best = best_from_neighbours(padded, new_dist, tile);
+        if(best >= DIST_UNREACHED)
+            continue;
+        new_dist[tile] = best;
+        pqi_tile_push(&frontier, best, tile);
+    }
+
+    for(int i = 0; i < num_changed; i++) {
+
+        int tile = changed[i];
+        if(flags[tile] & TILE_LOST || new_dist[tile] == 0 || new_dist[tile] == DIST_UNREACHED)
+            continue;
+
+        uint32_t best = best_from_neighbours(padded, new_dist, tile);
+        if(best >= new_dist[tile])
+            continue;
+        new_dist[tile] = best;
+        flags[tile] |= TILE_TOUCHED;
+        touched[num_touched++] = tile;
+        pqi_tile_push(&frontier, best, tile);
+    }
+
+    while(pqi_size(&frontier) > 0) {
+
+        int tile;
+        pqi_tile_pop(&frontier, &tile);
+
+        struct coord neighbours[4];
+        uint8_t neighbour_costs[4];
+        int num_neighbours = neighbours_grid(padded, (struct coord){tile / FIELD_RES_C, tile % FIELD_RES_C}, 
+            true, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            int next = neighbours[i].r * FIELD_RES_C + neighbours[i].c;
+            uint32_t total_cost = (uint32_t)new_dist[tile] + neighbour_costs[i];
+            if(total_cost >= new_dist[next])
+                continue;
+            if(total_cost >= DIST_UNREACHED)
+                goto out;
+
+            new_dist[next] = total_cost;
+            pqi_tile_push(&frontier, total_cost, next);
+            if(!(flags[next] & TILE_TOUCHED)) {
+                flags[next] |= TILE_TOUCHED;
+                touched[num_touched++] = next;
+            }
+        }
+    }
+
+    memcpy(dist, new_dist, sizeof(state->dist));
+    memcpy(state->cost, cost_field, sizeof(state->cost));
+
+    /* The direction of a tile depends on the distances of all 8 of its' neighbours */
+    float integration_field[FIELD_RES_R][FIELD_RES_C];
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            uint16_t curr = state->dist[r][c];
+            integration_field[r][c] = (curr == DIST_UNREACHED) ? INFINITY : curr;
+        }
+    }
+
+    for(int i = 0; i < num_touched; i++) {
+
+        int tile_r = touched[i] / FIELD_RES_C;
+        int tile_c = touched[i] % FIELD_RES_C;
+
+        for(int r = MAX(tile_r - 1, 0); r <= MIN(tile_r + 1, FIELD_RES_R - 1); r++) {
+            for(int c = MAX(tile_c - 1, 0); c <= MIN(tile_c + 1, FIELD_RES_C - 1); c++) {
+
+                int tile = r * FIELD_RES_C + c;
+                if(flags[tile] & TILE_REDO)
+                    continue;
+                flags[tile] |= TILE_REDO;
+
+                if(state->dist[r][c] == DIST_UNREACHED || state->dist[r][c] == 0)
+                    continue;
+                N_FlowDirSet(inout_flow, r, c, flow_dir(integration_field, (struct coord){r, c}));
+            }
+        }
+    }
+    ret = true;
+
+out:
+    arena_rewind(arena, mark);
+    return ret;
+}
+
 /* Initialize the flow field to point towards the closest passable tile. This will make the 
  * entities steer towards the nearest pathable tile in case they get pushed slightly off
  * the passable area by another steering force. */
 static void flow_field_prepass(const struct nav_chunk *chunk, struct flow_field *out)
 {
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
 
-    float integration_field[FIELD_RES_R][FIELD_RES_C];
-    for(int r = 0; r < FIELD_RES_R; r++)
-        for(int c = 0; c < FIELD_RES_C; c++)
-            integration_field[r][c] = INFINITY;
+    struct bucket_queue *frontier = arena_alloc(arena, sizeof(struct bucket_queue));
+    if(!frontier)
+        goto out;
+    bq_init(frontier);
+
+    uint8_t padded[PADDED_RES_R * PADDED_RES_C];
+    N_PadCostField(chunk->cost_base, COST_OFF_FIELD, padded);
 
     for(int i = 0; i < chunk->num_portals; i++) {
 
@@ -275,53 +633,204 @@ static void flow_field_prepass(const struct nav_chunk *chunk, struct flow_field
         for(int r = port->endpoints[0].r; r <= port->endpoints[1].r; r++) {
             for(int c = port->endpoints[0].c; c <= port->endpoints[1].c; c++) {
 
-                pq_coord_push(&frontier, 0.0f, (struct coord){r, c});
-                integration_field[r][c] = 0.0f;
+                bq_push(frontier, r * FIELD_RES_C + c, 0);
             }
         }
     }
 
-    /* Build the integration field */
-    while(pq_size(&frontier) > 0) {
+    /* Build the integration field. Stepping onto an impassable tile costs 1 
+     * and onto a passable one is free. */
+    while(frontier->size > 0) {
 
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
+        int idx = bq_pop(frontier);
+        struct coord curr = (struct coord){idx / FIELD_RES_C, idx % FIELD_RES_C};
 
-        struct coord neighbours[8];
-        uint8_t neighbour_costs[8];
-        int num_neighbours = neighbours_grid(chunk->cost_base, curr, false, neighbours, neighbour_costs);
+        struct coord neighbours[4];
+        uint8_t neighbour_costs[4];
+        int num_neighbours = neighbours_grid(padded, curr, false, neighbours, neighbour_costs);
 
         for(int i = 0; i < num_neighbours; i++) {
 
-            float total_cost = integration_field[curr.r][curr.c] + ((neighbour_costs[i] == COST_IMPASSABLE) ? 1 : 0);
-            if(total_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
+            int next = neighbours[i].r * FIELD_RES_C + neighbours[i].c;
+            uint32_t total_cost = frontier->dist[idx] + (neighbour_costs[i] == COST_IMPASSABLE);
+            if(total_cost < frontier->dist[next])
+                bq_push(frontier, next, total_cost);
+        }
+    }
 
-                integration_field[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(&frontier, neighbours[i]))
-                    pq_coord_push(&frontier, total_cost, neighbours[i]);
-            }
+    float integration_field[FIELD_RES_R][FIELD_RES_C];
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            uint32_t dist = frontier->dist[r * FIELD_RES_C + c];
+            integration_field[r][c] = (dist == DIST_NONE) ? INFINITY : dist;
         }
     }
-    pq_coord_destroy(&frontier);
 
     /* Build the flow field */
     for(int r = 0; r < FIELD_RES_R; r++) {
         for(int c = 0; c < FIELD_RES_C; c++) {
             if(chunk->cost_base[r][c] == COST_IMPASSABLE)
-                out->field[r][c].dir_idx = flow_dir(integration_field, (struct coord){r, c});
+                N_FlowDirSet(out, r, c, flow_dir(integration_field, (struct coord){r, c}));
         }
     }
+
+out:
+    arena_rewind(arena, mark);
+}
+
+/* Expand the integration field outwards from all the cells with a cost of 0
+ * (the targets), using a Dijkstra search. The costs are summed as integers, 
+ * which are exact in the float integration field. */
+static void integrate_dijkstra(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                               float integration_field[FIELD_RES_R][FIELD_RES_C])
+{
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    struct bucket_queue *frontier = arena_alloc(arena, sizeof(struct bucket_queue));
+    if(!frontier)
+        goto out;
+    bq_init(frontier);
+
+    uint8_t padded[PADDED_RES_R * PADDED_RES_C];
+    N_PadCostField(cost_field, COST_OFF_FIELD, padded);
+
+    for(int r = 0; r < FIELD_RES_R; r++)
+        for(int c = 0; c < FIELD_RES_C; c++)
+            if(integration_field[r][c] == 0.0f)
+                bq_push(frontier, r * FIELD_RES_C + c, 0);
+
+    while(frontier->size > 0) {
+
+        int idx = bq_pop(frontier);
+        struct coord curr = (struct coord){idx / FIELD_RES_C, idx % FIELD_RES_C};
+
+        struct coord neighbours[4];
+        uint8_t neighbour_costs[4];
+        int num_neighbours = neighbours_grid(padded, curr, true, neighbours, neighbour_costs);
+
+        for(int i = 0; i < num_neighbours; i++) {
+
+            int next = neighbours[i].r * FIELD_RES_C + neighbours[i].c;
+            uint32_t total_cost = frontier->dist[idx] + neighbour_costs[i];
+            if(total_cost < frontier->dist[next])
+                bq_push(frontier, next, total_cost);
+        }
+    }
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            uint32_t dist = frontier->dist[r * FIELD_RES_C + c];
+            if(dist != DIST_NONE)
+                integration_field[r][c] = dist;
+        }
+    }
+
+out:
+    arena_rewind(arena, mark);
+}
+
+/* Relax every cell of 'row' against the cell directly above or below it in 
+ * 'adjacent'. Returns true if any cell was lowered. */
+static bool sweep_row_vertical(float *restrict row, const float *restrict adjacent, 
+                               const float *restrict cost_row)
+{
+#if defined(__SSE__)
+    __m128 changed = _mm_setzero_ps();
+    for(int c = 0; c < FIELD_RES_C; c += 4) {
+
+        __m128 curr = _mm_loadu_ps(row + c);
+        __m128 cand = _mm_add_ps(_mm_loadu_ps(adjacent + c), _mm_loadu_ps(cost_row + c));
+        __m128 lower = _mm_cmplt_ps(cand, curr);
+        changed = _mm_or_ps(changed, lower);
+        _mm_storeu_ps(row + c, _mm_min_ps(curr, cand));
+    }
+    return (_mm_movemask_ps(changed) != 0);
+#else
+    bool changed = false;
+    for(int c = 0; c < FIELD_RES_C; c++) {
+
+        float cand = adjacent[c] + cost_row[c];
+        if(cand < row[c]) {
+            row[c] = cand;
+            changed = true;
+        }
+    }
+    return changed;
+#endif
+}
+
+/* Relax the cells of 'row' against their left and right neighbours. This is 
+ * a running minimum, so it is inherently serial. Returns true if any cell was 
+ * lowered. */
+static bool sweep_row_horizontal(float *restrict row, const float *restrict cost_row)
+{
+    bool changed = false;
+
+    for(int c = 1; c < FIELD_RES_C; c++) {
+
+        float cand = row[c-1] + cost_row[c];
+        if(cand < row[c]) {
+            row[c] = cand;
+            changed = true;
+        }
+    }
+
+    for(int c = FIELD_RES_C-2; c >= 0; c--) {
+
+        float cand = row[c+1] + cost_row[c];
+        if(cand < row[c]) {
+            row[c] = cand;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/* Compute the same integration field as 'integrate_dijkstra' by repeatedly
+ * sweeping the grid downwards and upwards, relaxing every cell against its'
+ * 4-connected neighbours, until nothing changes. On open ground this converges
+ * after a couple of sweeps, with the vertical relaxation done 4 cells at a time.
+ * Convoluted obstacles will require more sweeps. */
+static void integrate_sweep(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C],
+                            float integration_field[FIELD_RES_R][FIELD_RES_C])
+{
+    /* Impassable cells have an infinite entry cost, so relaxing them is a no-op */
+    float costs[FIELD_RES_R][FIELD_RES_C];
+    for(int r = 0; r < FIELD_RES_R; r++)
+        for(int c = 0; c < FIELD_RES_C; c++)
+            costs[r][c] = (cost_field[r][c] == COST_IMPASSABLE) ? INFINITY : cost_field[r][c];
+
+    bool changed;
+    do{
+        changed = false;
+
+        changed |= sweep_row_horizontal(integration_field[0], costs[0]);
+        for(int r = 1; r < FIELD_RES_R; r++) {
+            changed |= sweep_row_vertical(integration_field[r], integration_field[r-1], costs[r]);
+            changed |= sweep_row_horizontal(integration_field[r], costs[r]);
+        }
+
+        for(int r = FIELD_RES_R-2; r >= 0; r--) {
+            changed |= sweep_row_vertical(integration_field[r], integration_field[r+1], costs[r]);
+            changed |= sweep_row_horizontal(integration_field[r], costs[r]);
+        }
+
+    }while(changed);
 }
 
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
-ff_id_t N_FlowField_ID(struct coord chunk, struct field_target target)
+ff_id_t N_FlowField_ID(enum nav_layer layer, struct coord chunk, struct field_target target)
 {
     if(target.type == TARGET_PORTAL) {
 
-        return (((uint64_t)target.type)                 << 48)
+        return (((uint64_t)layer)                       << 56)
+             | (((uint64_t)target.type)                 << 48)
              | (((uint64_t)target.port->endpoints[0].r) << 40)
              | (((uint64_t)target.port->endpoints[0].c) << 32)
              | (((uint64_t)target.port->endpoints[1].r) << 24)
@@ -330,7 +839,8 @@ ff_id_t N_FlowField_ID(struct coord chunk, struct field_target target)
              | (((uint64_t)chunk.c)                     <<  0);
     }else{
 
-        return (((uint64_t)target.type)                 << 48)
+        return (((uint64_t)layer)                       << 56)
+             | (((uint64_t)target.type)                 << 48)
              | (((uint64_t)target.tile.r)               << 24)
              | (((uint64_t)target.tile.c)               << 16)
              | (((uint64_t)chunk.r)                     <<  8)
@@ -338,14 +848,48 @@ ff_id_t N_FlowField_ID(struct coord chunk, struct field_target target)
     }
 }
 
-void N_FlowFieldInit(struct coord chunk_coord, const void *nav_private, struct flow_field *out)
+ff_id_t N_FlowField_ChainedID(enum nav_layer layer, struct coord chunk, struct field_target target)
 {
-    for(int r = 0; r < FIELD_RES_R; r++) {
-        for(int c = 0; c < FIELD_RES_C; c++) {
+    return N_FlowField_ID(layer, chunk, target) | FF_ID_CHAINED;
+}
 
-            out->field[r][c].dir_idx = FD_NONE;
+enum nav_layer N_FlowField_Layer(ff_id_t id)
+{
+    return (id >> 56) & 0xff;
+}
+
+bool N_FlowField_Target(ff_id_t id, const struct nav_chunk *chunk, struct field_target *out)
+{
+    if(((id >> 48) & 0x7f) == TARGET_TILE) {
+
+        out->type = TARGET_TILE;
+        out->tile = (struct coord){(id >> 24) & 0xff, (id >> 16) & 0xff};
+        return true;
+    }
+
+    struct coord endpoints[2] = {
+        {(id >> 40) & 0xff, (id >> 32) & 0xff},
+        {(id >> 24) & 0xff, (id >> 16) & 0xff},
+    };
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(port->endpoints[0].r == endpoints[0].r && port->endpoints[0].c == endpoints[0].c
+        && port->endpoints[1].r == endpoints[1].r && port->endpoints[1].c == endpoints[1].c) {
+
+            out->type = TARGET_PORTAL;
+            out->port = port;
+            return true;
         }
     }
+    return false;
+}
+
+void N_FlowFieldInit(struct coord chunk_coord, const void *nav_private, struct flow_field *out)
+{
+    /* FD_NONE in both nibbles */
+    memset(out->field, 0, sizeof(out->field));
     out->chunk = chunk_coord;
 
     const struct nav_private *priv = nav_private;
@@ -353,11 +897,23 @@ void N_FlowFieldInit(struct coord chunk_coord, const void *nav_private, struct f
     flow_field_prepass(chunk, out);
 }
 
-void N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target, 
-                       struct flow_field *inout_flow)
+static bool on_target(struct field_target target, int r, int c)
 {
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
+    if(target.type == TARGET_TILE)
+        return (r == target.tile.r && c == target.tile.c);
+
+    return (r >= target.port->endpoints[0].r && r <= target.port->endpoints[1].r
+         && c >= target.port->endpoints[0].c && c <= target.port->endpoints[1].c);
+}
+
+static void flow_field_build(const struct nav_chunk *chunk, struct field_target target, 
+                             enum field_integration method, 
+                             const float next_dist[FIELD_RES_R][FIELD_RES_C],
+                             struct ff_integration *out_state, struct flow_field *inout_flow,
+                             float out_dist[FIELD_RES_R][FIELD_RES_C])
+{
+    uint8_t cost_field[FIELD_RES_R][FIELD_RES_C];
+    current_costs(chunk, cost_field);
 
     float integration_field[FIELD_RES_R][FIELD_RES_C];
     for(int r = 0; r < FIELD_RES_R; r++)
@@ -366,18 +922,28 @@ void N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target
 
     switch(target.type) {
     case TARGET_PORTAL: {
-        
+
+        bool any = false;
         for(int r = target.port->endpoints[0].r; r <= target.port->endpoints[1].r; r++) {
             for(int c = target.port->endpoints[0].c; c <= target.port->endpoints[1].c; c++) {
 
-                pq_coord_push(&frontier, 0.0f, (struct coord){r, c});
-                integration_field[r][c] = 0.0f;
+                integration_field[r][c] = target_seed(target, cost_field, next_dist, r, c);
+                any = any || (integration_field[r][c] < INFINITY);
             }
         }
+        /* None of the tiles across the portal reach the final target, so there
+         * is nothing to carry on from */
+        if(next_dist && !any) {
+            flow_field_build(chunk, target, method, NULL, out_state, inout_flow, out_dist);
+            return;
+        }
+        /* The starting distances can be far apart, which the bucket queue of 
+         * the Dijkstra search can't hold. The sweeps take any starting values. */
+        if(next_dist)
+            method = FIELD_INTEGRATE_SWEEP;
         break;
     }
     case TARGET_TILE: {
-        pq_coord_push(&frontier, 0.0f, target.tile);
         integration_field[target.tile.r][target.tile.c] = 0.0f;
         break;
     }
@@ -385,27 +951,11 @@ void N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target
     }
 
     /* Build the integration field */
-    while(pq_size(&frontier) > 0) {
-
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
-
-        struct coord neighbours[8];
-        uint8_t neighbour_costs[8];
-        int num_neighbours = neighbours_grid(chunk->cost_base, curr, true, neighbours, neighbour_costs);
-
-        for(int i = 0; i < num_neighbours; i++) {
-
-            float total_cost = integration_field[curr.r][curr.c] + neighbour_costs[i];
-            if(total_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
-
-                integration_field[neighbours[i].r][neighbours[i].c] = total_cost;
-                if(!pq_coord_contains(&frontier, neighbours[i]))
-                    pq_coord_push(&frontier, total_cost, neighbours[i]);
-            }
-        }
+    switch(method) {
+    case FIELD_INTEGRATE_DIJKSTRA: integrate_dijkstra(cost_field, integration_field); break;
+    case FIELD_INTEGRATE_SWEEP:    integrate_sweep(cost_field, integration_field);    break;
+    default: assert(0);
     }
-    pq_coord_destroy(&frontier);
 
     /* Build the flow field from the integration field. Don't touch any impassable tiles
      * as they may have already been set in the case that a single chunk is divided into
@@ -416,60 +966,97 @@ void N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target
 
             if(integration_field[r][c] == INFINITY)
                 continue;
+            /* A tile of the target which could not be reached any faster from
+             * within the chunk leads straight across the border. */
+            if(on_target(target, r, c)
+            && integration_field[r][c] == target_seed(target, cost_field, next_dist, r, c)) {
+                N_FlowDirSet(inout_flow, r, c, target_dir(target));
+                continue;
+            }
+            N_FlowDirSet(inout_flow, r, c, flow_dir(integration_field, (struct coord){r, c}));
+        }
+    }
 
-            if(integration_field[r][c] == 0.0f) {
+    if(out_dist)
+        memcpy(out_dist, integration_field, sizeof(integration_field));
 
-                if(target.type != TARGET_PORTAL) {
+    if(!out_state)
+        return;
 
-                    inout_flow->field[r][c].dir_idx = FD_NONE;
-                    continue;
-                }
-
-                bool up    = target.port->connected->chunk.r < target.port->chunk.r;
-                bool down  = target.port->connected->chunk.r > target.port->chunk.r;
-                bool left  = target.port->connected->chunk.c < target.port->chunk.c;
-                bool right = target.port->connected->chunk.c > target.port->chunk.c;
-                assert(up ^ down ^ left ^ right);
-
-                if(up)
-                    inout_flow->field[r][c].dir_idx = FD_N;
-                else if(down)
-                    inout_flow->field[r][c].dir_idx = FD_S;
-                else if(left)
-                    inout_flow->field[r][c].dir_idx = FD_W;
-                else if(right)
-                    inout_flow->field[r][c].dir_idx = FD_E;
-                else
-                    assert(0);
+    /* The distances are sums of integer costs, so they are exact in the float field */
+    out_state->valid = true;
+    memcpy(out_state->cost, cost_field, sizeof(out_state->cost));
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            float dist = integration_field[r][c];
+            if(dist == INFINITY) {
+                out_state->dist[r][c] = DIST_UNREACHED;
                 continue;
             }
-
-            inout_flow->field[r][c].dir_idx = flow_dir(integration_field, (struct coord){r, c});
+            if(dist >= DIST_UNREACHED)
+                out_state->valid = false;
+            out_state->dist[r][c] = dist;
         }
     }
 }
 
+void N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target, 
+                       enum field_integration method, struct flow_field *inout_flow)
+{
+    flow_field_build(chunk, target, method, NULL, NULL, inout_flow, NULL);
+}
+
+void N_FlowFieldChain(const struct nav_chunk *chunk, struct field_target target, 
+                      enum field_integration method, 
+                      const float next_dist[FIELD_RES_R][FIELD_RES_C],
+                      struct flow_field *inout_flow, float out_dist[FIELD_RES_R][FIELD_RES_C])
+{
+    assert(!next_dist || target.type == TARGET_PORTAL);
+    flow_field_build(chunk, target, method, next_dist, NULL, inout_flow, out_dist);
+}
+
+void N_FlowFieldRepair(const struct nav_chunk *chunk, struct field_target target, 
+                       enum field_integration method, struct ff_integration *inout_state,
+                       struct flow_field *inout_flow)
+{
+    if(inout_state && inout_state->valid) {
+
+        uint8_t cost_field[FIELD_RES_R][FIELD_RES_C];
+        current_costs(chunk, cost_field);
+        if(repair_integration(cost_field, inout_state, inout_flow))
+            return;
+    }
+    flow_field_build(chunk, target, method, NULL, inout_state, inout_flow, NULL);
+}
+
+
 void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc target,
                       const struct nav_private *priv, vec3_t map_pos, 
                       struct LOS_field *out_los, const struct LOS_field *prev_los)
 {
     out_los->chunk = chunk_coord;
-    memset(out_los->field, 0x00, sizeof(out_los->field));
+    memset(out_los->visible, 0x00, sizeof(out_los->visible));
+    memset(out_los->wavefront_blocked, 0x00, sizeof(out_los->wavefront_blocked));
 
-    pq_coord_t frontier;
-    pq_coord_init(&frontier);
     const struct nav_chunk *chunk = &priv->chunks[chunk_coord.r * priv->width + chunk_coord.c];
 
-    float integration_field[FIELD_RES_R][FIELD_RES_C];
-    for(int r = 0; r < FIELD_RES_R; r++)
-        for(int c = 0; c < FIELD_RES_C; c++)
-            integration_field[r][c] = INFINITY;
+    uint64_t passable[FIELD_RES_R], corners[FIELD_RES_R];
+    los_masks(chunk->cost_base, passable, corners);
+
+    /* The wavefront is expanded one step at a time for all the tiles at the same 
+     * distance from the start, matching the order in which a unit-cost priority 
+     * queue expansion would visit them. */
+    uint64_t frontier[FIELD_RES_R] = {0};
+    uint64_t reached[FIELD_RES_R];
+    /* Corners for which the wavefront blocked line has already been drawn */
+    uint64_t shadowed[FIELD_RES_R] = {0};
 
     /* Case 1: LOS for the destination chunk */
     if(chunk_coord.r == target.chunk_r && chunk_coord.c == target.chunk_c) {
 
-        pq_coord_push(&frontier, 0.0f, (struct coord){target.tile_r, target.tile_c});
-        integration_field[target.tile_r][target.tile_c] = 0.0f;
+        frontier[target.tile_r] = (uint64_t)1 << target.tile_c;
         assert(NULL == prev_los);
 
     /* Case 2: LOS for a chunk other than the destination chunk 
@@ -480,113 +1067,85 @@ void N_LOSFieldCreate(dest_id_t id, struct coord chunk_coord, struct tile_desc t
     }else{
         
         assert(prev_los);
-        if(prev_los->chunk.r < chunk_coord.r) {
-
-            for(int c = 0; c < FIELD_RES_C; c++) {
-
-                out_los->field[0][c] = prev_los->field[FIELD_RES_R-1][c];
-                if(out_los->field[0][c].wavefront_blocked) {
+        int dst_r = -1, dst_c = -1, src_r = -1, src_c = -1;
 
-                    struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, 0, c};
-                    create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[0][c].visible) {
-
-                    pq_coord_push(&frontier, 0.0f, (struct coord){0, c});
-                    integration_field[0][c] = 0.0f;
-                }
-            }
+        if(prev_los->chunk.r < chunk_coord.r) {
+            dst_r = 0;
+            src_r = FIELD_RES_R-1;
         }else if(prev_los->chunk.r > chunk_coord.r) {
-
-            for(int c = 0; c < FIELD_RES_C; c++) {
-
-                out_los->field[FIELD_RES_R-1][c] = prev_los->field[0][c];
-                if(out_los->field[FIELD_RES_R-1][c].wavefront_blocked) {
-
-                    struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, FIELD_RES_R-1, c};
-                    create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[FIELD_RES_R-1][c].visible) {
-
-                    pq_coord_push(&frontier, 0.0f, (struct coord){FIELD_RES_R-1, c});
-                    integration_field[FIELD_RES_R-1][c] = 0.0f;
-                }
-            }
+            dst_r = FIELD_RES_R-1;
+            src_r = 0;
         }else if(prev_los->chunk.c < chunk_coord.c) {
-
-            for(int r = 0; r < FIELD_RES_R; r++) {
-
-                out_los->field[r][0] = prev_los->field[r][FIELD_RES_C-1];
-                if(out_los->field[r][0].wavefront_blocked) {
-
-                    struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, r, 0};
-                    create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[r][0].visible) {
-
-                    pq_coord_push(&frontier, 0.0f, (struct coord){r, 0});
-                    integration_field[r][0] = 0.0f;
-                }
-            }
+            dst_c = 0;
+            src_c = FIELD_RES_C-1;
         }else if(prev_los->chunk.c > chunk_coord.c) {
+            dst_c = FIELD_RES_C-1;
+            src_c = 0;
+        }else{
+            assert(0);
+        }
 
-            for(int r = 0; r < FIELD_RES_R; r++) {
+        int len = (dst_r >= 0) ? FIELD_RES_C : FIELD_RES_R;
+        for(int i = 0; i < len; i++) {
 
-                out_los->field[r][FIELD_RES_C-1] = prev_los->field[r][0];
-                if(out_los->field[r][FIELD_RES_C-1].wavefront_blocked) {
+            int r = (dst_r >= 0) ? dst_r : i, c = (dst_c >= 0) ? dst_c : i;
+            int pr = (src_r >= 0) ? src_r : i, pc = (src_c >= 0) ? src_c : i;
 
-                    struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, r, FIELD_RES_C-1};
-                    create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-                }
-                if(out_los->field[r][FIELD_RES_C-1].visible) {
+            /* Lines drawn from an earlier edge tile may be overwritten by the carried 
+             * over flags of the tiles after it, in the same way the two fields meet 
+             * on either side of the border. */
+            los_set(out_los->visible, r, c, N_LOSVisible(prev_los, pr, pc));
+            los_set(out_los->wavefront_blocked, r, c, N_LOSWavefrontBlocked(prev_los, pr, pc));
 
-                    pq_coord_push(&frontier, 0.0f, (struct coord){r, FIELD_RES_C-1});
-                    integration_field[r][FIELD_RES_C-1] = 0.0f;
-                }
+            if(N_LOSWavefrontBlocked(out_los, r, c)) {
+
+                struct tile_desc src_desc = (struct tile_desc) {chunk_coord.r, chunk_coord.c, r, c};
+                create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
             }
-        }else{
-            assert(0);
+            if(N_LOSVisible(out_los, r, c))
+                frontier[r] |= (uint64_t)1 << c;
         }
     }
+    memcpy(reached, frontier, sizeof(reached));
 
-    while(pq_size(&frontier) > 0) {
+    bool more = true;
+    while(more) {
 
-        struct coord curr;
-        pq_coord_pop(&frontier, &curr);
+        more = false;
+        uint64_t next[FIELD_RES_R];
 
-        struct coord neighbours[8];
-        uint8_t neighbour_costs[8];
-        int num_neighbours = neighbours_grid_LOS(chunk->cost_base, out_los, curr, neighbours, neighbour_costs);
+        for(int r = 0; r < FIELD_RES_R; r++) {
 
-        for(int i = 0; i < num_neighbours; i++) {
+            /* The cardinal neighbours of all the frontier tiles in the row */
+            uint64_t adjacent = (frontier[r] << 1) | (frontier[r] >> 1);
+            if(r > 0)
+                adjacent |= frontier[r - 1];
+            if(r < FIELD_RES_R-1)
+                adjacent |= frontier[r + 1];
+            adjacent &= ~out_los->wavefront_blocked[r];
 
-            int nr = neighbours[i].r, nc = neighbours[i].c;
-            if(neighbour_costs[i] > 1) {
-                
-                if(!is_LOS_corner(neighbours[i], chunk->cost_base))
-                    continue;
+            out_los->visible[r] |= adjacent & passable[r];
+            next[r] = adjacent & passable[r] & ~reached[r];
+            reached[r] |= next[r];
+            more |= !!next[r];
+
+            uint64_t new_corners = adjacent & corners[r] & ~shadowed[r];
+            shadowed[r] |= new_corners;
+            while(new_corners) {
+
+                int c = __builtin_ctzll(new_corners);
+                new_corners &= new_corners - 1;
 
                 struct tile_desc src_desc = (struct tile_desc) {
                     .chunk_r = chunk_coord.r,
                     .chunk_c = chunk_coord.c,
-                    .tile_r = neighbours[i].r,
-                    .tile_c = neighbours[i].c
+                    .tile_r = r,
+                    .tile_c = c
                 };
                 create_wavefront_blocked_line(target, src_desc, priv, map_pos, out_los);
-            }else{
-
-                float new_cost = integration_field[curr.r][curr.c] + 1;
-                out_los->field[nr][nc].visible = 1;
-
-                if(new_cost < integration_field[neighbours[i].r][neighbours[i].c]) {
-
-                    integration_field[nr][nc] = new_cost;
-                    if(!pq_coord_contains(&frontier, neighbours[i]))
-                        pq_coord_push(&frontier, new_cost, neighbours[i]);
-                }
             }
         }
+        memcpy(frontier, next, sizeof(frontier));
     }
-    pq_coord_destroy(&frontier);
 }
 
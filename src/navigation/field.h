@@ -45,19 +45,36 @@
 typedef uint64_t ff_id_t;
 struct nav_private;
 
+#if FIELD_RES_C > 64
+#error "LOS field rows must fit in a 64-bit word"
+#endif
+
+/* The LOS flags are stored as bitsets, with one word per row and the column 
+ * as the bit index. Use N_LOSVisible and N_LOSWavefrontBlocked for access. */
 struct LOS_field{
     struct coord chunk;
-    struct{
-        unsigned int visible : 1;
-        unsigned int wavefront_blocked : 1;
-    }field[FIELD_RES_R][FIELD_RES_C];
+    uint64_t     visible[FIELD_RES_R];
+    uint64_t     wavefront_blocked[FIELD_RES_R];
 };
 
+/* Flow directions are packed as 4-bit 'enum flow_dir' values, two cells per 
+ * byte, with the even column in the low nibble. Use N_FlowDirAt and 
+ * N_FlowDirSet for access. */
 struct flow_field{
     struct coord chunk;
-    struct{
-        unsigned dir_idx : 4;
-    }field[FIELD_RES_R][FIELD_RES_C];
+    uint8_t      field[FIELD_RES_R][FIELD_RES_C / 2];
+};
+
+/* The state that a flow field was last integrated from. Kept alongside a 
+ * flow field, it allows a change to the costs of a few tiles of the chunk 
+ * to be repaired by re-propagating from just those tiles (N_FlowFieldRepair). 
+ * Distances of DIST_UNREACHED are for tiles which cannot reach the target. */
+#define DIST_UNREACHED (UINT16_MAX)
+
+struct ff_integration{
+    bool         valid;
+    uint8_t      cost[FIELD_RES_R][FIELD_RES_C];
+    uint16_t     dist[FIELD_RES_R][FIELD_RES_C];
 };
 
 struct field_target{
@@ -83,11 +100,79 @@ enum flow_dir{
     FD_SE
 };
 
+enum field_integration{
+    /* Priority queue wavefront expansion. Best suited to chunks with many obstacles. */
+    FIELD_INTEGRATE_DIJKSTRA,
+    /* Repeated row-by-row relaxation sweeps. Gives the same result as the above,
+     * but is much faster on open ground. */
+    FIELD_INTEGRATE_SWEEP,
+};
+
 extern vec2_t g_flow_dir_lookup[];
 
-ff_id_t N_FlowField_ID(struct coord chunk, struct field_target target);
+static inline enum flow_dir N_FlowDirAt(const struct flow_field *ff, int r, int c)
+{
+    return (ff->field[r][c / 2] >> ((c & 1) * 4)) & 0xf;
+}
+
+static inline void N_FlowDirSet(struct flow_field *ff, int r, int c, enum flow_dir dir)
+{
+    int shift = (c & 1) * 4;
+    ff->field[r][c / 2] = (ff->field[r][c / 2] & ~(0xf << shift)) | ((dir & 0xf) << shift);
+}
+
+static inline bool N_LOSVisible(const struct LOS_field *lf, int r, int c)
+{
+    return (lf->visible[r] >> c) & 1;
+}
+
+static inline bool N_LOSWavefrontBlocked(const struct LOS_field *lf, int r, int c)
+{
+    return (lf->wavefront_blocked[r] >> c) & 1;
+}
+
+ff_id_t N_FlowField_ID(enum nav_layer layer, struct coord chunk, struct field_target target);
+/* The ID of a field made with 'N_FlowFieldChain' from the field across its' portal */
+ff_id_t N_FlowField_ChainedID(enum nav_layer layer, struct coord chunk, struct field_target target);
+enum nav_layer N_FlowField_Layer(ff_id_t id);
+
+/* ------------------------------------------------------------------------
+ * Recover the target of a flow field from its' ID. Returns false if the 
+ * target portal no longer exists in the chunk.
+ * ------------------------------------------------------------------------
+ */
+bool    N_FlowField_Target(ff_id_t id, const struct nav_chunk *chunk, struct field_target *out);
 void    N_FlowFieldInit(struct coord chunk_coord, const void *nav_private, struct flow_field *out);
 void    N_FlowFieldUpdate(const struct nav_chunk *chunk, struct field_target target, 
+                          enum field_integration method, struct flow_field *inout_flow);
+
+/* ------------------------------------------------------------------------
+ * Like 'N_FlowFieldUpdate', but the integration can be carried on across
+ * chunk borders. If 'next_dist' is not NULL, it must hold the integration 
+ * of the chunk across the target portal, and the tiles of the portal start 
+ * out with the distance to the final target through the tiles across the 
+ * border, instead of 0. The field then leads to wherever along the portal 
+ * is best for the rest of the way, rather than to the nearest part of it. 
+ * If 'out_dist' is not NULL, it receives the integration of this chunk, 
+ * with INFINITY for the tiles that can't reach the target.
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldChain(const struct nav_chunk *chunk, struct field_target target, 
+                         enum field_integration method, 
+                         const float next_dist[FIELD_RES_R][FIELD_RES_C],
+                         struct flow_field *inout_flow, float out_dist[FIELD_RES_R][FIELD_RES_C]);
+
+/* ------------------------------------------------------------------------
+ * Bring a flow field which was built for 'target' up to date with the 
+ * current costs of the chunk. If 'inout_state' is valid, only the tiles 
+ * whose distance to the target may have changed are re-integrated. 
+ * Otherwise, or if the passability of any tile has changed, the field is 
+ * rebuilt as with N_FlowFieldUpdate. In either case, 'inout_state' (which 
+ * may be NULL) is left holding the state for the next repair.
+ * ------------------------------------------------------------------------
+ */
+void    N_FlowFieldRepair(const struct nav_chunk *chunk, struct field_target target, 
+                          enum field_integration method, struct ff_integration *inout_state,
                           struct flow_field *inout_flow);
 
 /* ------------------------------------------------------------------------
@@ -35,75 +35,274 @@
 
 #include "fieldcache.h"
 #include "../lib/public/khash.h"
-#include "../event.h"
+#include "../lib/public/flat_hash.h"
+#include "../config.h"
+#include "../mem.h"
 
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 
-#define EVICTION_NUM_SECS (30)
+enum entry_type{
+    ENTRY_LOS,
+    ENTRY_DEST_FLOW,
+};
+
+/* All cached LOS and dest_flow entries are kept on a single doubly-linked list 
+ * in order of use, with the most recently used entry at the head. */
+struct lru_node{
+    struct lru_node *prev, *next;
+    enum entry_type  type;
+    uint64_t         key;
+    size_t           size;
+};
 
 struct LOS_entry{
-    unsigned int     age;
+    struct lru_node  lru;
     struct LOS_field lf;
 };
 
+/* Flow fields are not on the LRU list. Each one is shared by all the dest_flow 
+ * entries referring to its' ID and is freed when the last of them goes away. 
+ * The integration state is only allocated once the field is first patched, 
+ * since most fields are never patched. */
 struct flow_entry{
-    unsigned int      age;
-    struct flow_field ff;
+    unsigned               refcount;
+    struct flow_field      ff;
+    struct ff_integration *integration;
 };
 
 struct path_entry{
-    unsigned int age;
-    ff_id_t      id;
+    struct lru_node lru;
+    ff_id_t         id;
+    bool            has_next;
+    struct coord    next;
 };
 
-KHASH_MAP_INIT_INT64(los, struct LOS_entry)
-KHASH_MAP_INIT_INT64(flow, struct flow_entry)
-KHASH_MAP_INIT_INT64(dest_flow, struct path_entry)
+FLATHASH_MAP_INIT_INT64(los, struct LOS_entry*)
+FLATHASH_MAP_INIT_INT64(flow, struct flow_entry*)
+FLATHASH_MAP_INIT_INT64(dest_flow, struct path_entry*)
+
+KHASH_SET_INIT_INT64(keyset)
+KHASH_MAP_INIT_INT(index, khash_t(keyset)*)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-khash_t(los)         *s_los_table;
-khash_t(flow)        *s_flow_table;
+fh_t(los)            *s_los_table;
+fh_t(flow)           *s_flow_table;
 /* The dest_flow table maps a (dest_id, chunk coordinate) tuple to a flow field ID,
  * which could be used to retreive the relevant field from the flow table. 
  * The reason for this is that the same flow field chunk can be shared between
  * many different paths. */
-khash_t(dest_flow)   *s_dest_flow_table;
+fh_t(dest_flow)      *s_dest_flow_table;
+
+/* Reverse indices from a chunk coordinate (or destination ID) to the set of 
+ * keys of the above tables with entries for it. These allow evicting only the 
+ * fields affected by a change to a chunk without scanning the whole cache. */
+khash_t(index)       *s_los_chunk_index;
+khash_t(index)       *s_los_dest_index;
+khash_t(index)       *s_dest_flow_chunk_index;
+
+static struct lru_node       *s_lru_head;
+static struct lru_node       *s_lru_tail;
+static struct nav_cache_stats s_stats;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void on_1hz_tick(void *unused1, void *unused2)
+static uint32_t chunk_key(struct coord chunk)
 {
-    for(khiter_t k = kh_begin(s_los_table); k != kh_end(s_los_table); k++) {
-        if(!kh_exist(s_los_table, k))
-            continue;
-        if(--kh_value(s_los_table, k).age == 0)
-            kh_del(los, s_los_table, k);
+    return (((uint32_t)chunk.r) << 16) | (((uint32_t)chunk.c) & 0xffff);
+}
+
+uint64_t key_for_dest_and_chunk(dest_id_t id, struct coord chunk)
+{
+    return ((((uint64_t)id) << 32) | (((uint64_t)chunk.r) << 16) | (((uint64_t)chunk.c) & 0xffff));
+}
+
+static dest_id_t key_dest(uint64_t key)
+{
+    return (dest_id_t)(key >> 32);
+}
+
+static struct coord key_chunk(uint64_t key)
+{
+    return (struct coord){(key >> 16) & 0xffff, key & 0xffff};
+}
+
+static void index_add(khash_t(index) *index, uint32_t idx_key, uint64_t key)
+{
+    int ret;
+    khiter_t k = kh_get(index, index, idx_key);
+
+    if(k == kh_end(index)) {
+
+        khash_t(keyset) *set = kh_init(keyset);
+        if(!set)
+            return;
+        k = kh_put(index, index, idx_key, &ret);
+        assert(ret != -1);
+        kh_value(index, k) = set;
     }
+    kh_put(keyset, kh_value(index, k), key, &ret);
+    assert(ret != -1);
+}
 
-    for(khiter_t k = kh_begin(s_flow_table); k != kh_end(s_flow_table); k++) {
-        if(!kh_exist(s_flow_table, k))
-            continue;
-        if(--kh_value(s_flow_table, k).age == 0)
-            kh_del(flow, s_flow_table, k);
+static void index_remove(khash_t(index) *index, uint32_t idx_key, uint64_t key)
+{
+    khiter_t k = kh_get(index, index, idx_key);
+    if(k == kh_end(index))
+        return;
+
+    khash_t(keyset) *set = kh_value(index, k);
+    khiter_t sk = kh_get(keyset, set, key);
+    if(sk != kh_end(set))
+        kh_del(keyset, set, sk);
+
+    if(kh_size(set) == 0) {
+        kh_destroy(keyset, set);
+        kh_del(index, index, k);
     }
+}
 
-    for(khiter_t k = kh_begin(s_dest_flow_table); k != kh_end(s_dest_flow_table); k++) {
-        if(!kh_exist(s_dest_flow_table, k))
-            continue;
-        if(--kh_value(s_dest_flow_table, k).age == 0)
-            kh_del(dest_flow, s_dest_flow_table, k);
+/* Detach the set of keys for 'idx_key' from the index. The caller owns the set. */
+static khash_t(keyset) *index_take(khash_t(index) *index, uint32_t idx_key)
+{
+    khiter_t k = kh_get(index, index, idx_key);
+    if(k == kh_end(index))
+        return NULL;
+
+    khash_t(keyset) *ret = kh_value(index, k);
+    kh_del(index, index, k);
+    return ret;
+}
+
+static void index_destroy(khash_t(index) *index)
+{
+    khash_t(keyset) *set;
+    kh_foreach_value(index, set, {
+        kh_destroy(keyset, set);
+    });
+    kh_destroy(index, index);
+}
+
+static void lru_unlink(struct lru_node *node)
+{
+    if(node->prev)
+        node->prev->next = node->next;
+    else
+        s_lru_head = node->next;
+
+    if(node->next)
+        node->next->prev = node->prev;
+    else
+        s_lru_tail = node->prev;
+
+    node->prev = node->next = NULL;
+}
+
+static void lru_push_front(struct lru_node *node)
+{
+    node->prev = NULL;
+    node->next = s_lru_head;
+
+    if(s_lru_head)
+        s_lru_head->prev = node;
+    else
+        s_lru_tail = node;
+    s_lru_head = node;
+}
+
+static void lru_touch(struct lru_node *node)
+{
+    if(node == s_lru_head)
+        return;
+    lru_unlink(node);
+    lru_push_front(node);
+}
+
+static void lru_insert(struct lru_node *node, enum entry_type type, uint64_t key, size_t size)
+{
+    node->type = type;
+    node->key = key;
+    node->size = size;
+    lru_push_front(node);
+    s_stats.bytes_resident += size;
+}
+
+static void flow_drop_integration(struct flow_entry *entry)
+{
+    if(!entry->integration)
+        return;
+    assert(s_stats.bytes_resident >= sizeof(struct ff_integration));
+    s_stats.bytes_resident -= sizeof(struct ff_integration);
+    MEM_Free(entry->integration);
+    entry->integration = NULL;
+}
+
+static void flow_release(ff_id_t id)
+{
+    uint32_t k = fh_get(flow, s_flow_table, id);
+    assert(k != fh_end(s_flow_table));
+
+    struct flow_entry *entry = fh_value(s_flow_table, k);
+    assert(entry->refcount > 0);
+    if(--entry->refcount > 0)
+        return;
+
+    fh_del(flow, s_flow_table, k);
+    flow_drop_integration(entry);
+    assert(s_stats.bytes_resident >= sizeof(struct flow_entry));
+    s_stats.bytes_resident -= sizeof(struct flow_entry);
+    MEM_Free(entry);
+}
+
+/* Remove the entry from its' table, the reverse indices and the LRU list, 
+ * and free it. */
+static void entry_free(struct lru_node *node)
+{
+    uint32_t k;
+    uint64_t key = node->key;
+
+    switch(node->type) {
+    case ENTRY_LOS:
+        k = fh_get(los, s_los_table, key);
+        assert(k != fh_end(s_los_table));
+        fh_del(los, s_los_table, k);
+        index_remove(s_los_chunk_index, chunk_key(key_chunk(key)), key);
+        index_remove(s_los_dest_index, key_dest(key), key);
+        break;
+    case ENTRY_DEST_FLOW:
+        k = fh_get(dest_flow, s_dest_flow_table, key);
+        assert(k != fh_end(s_dest_flow_table));
+        flow_release(fh_value(s_dest_flow_table, k)->id);
+        fh_del(dest_flow, s_dest_flow_table, k);
+        index_remove(s_dest_flow_chunk_index, chunk_key(key_chunk(key)), key);
+        break;
+    default: assert(0);
     }
+
+    lru_unlink(node);
+    assert(s_stats.bytes_resident >= node->size);
+    s_stats.bytes_resident -= node->size;
+    MEM_Free(node);
 }
 
-uint64_t key_for_dest_and_chunk(dest_id_t id, struct coord chunk)
+/* Evict least recently used entries until the cache fits in the budget. The 
+ * 'keep' entry is never evicted, so that the most recently inserted entry stays 
+ * resident even when it alone exceeds the budget. */
+static void enforce_budget(const struct lru_node *keep)
 {
-    return ((((uint64_t)id) << 32) | (((uint64_t)chunk.r) << 16) | (((uint64_t)chunk.c) & 0xffff));
+    while(s_stats.bytes_resident > s_stats.bytes_budget 
+       && s_lru_tail && s_lru_tail != keep) {
+
+        entry_free(s_lru_tail);
+        s_stats.evictions++;
+    }
 }
 
 /*****************************************************************************/
@@ -112,119 +311,333 @@ uint64_t key_for_dest_and_chunk(dest_id_t id, struct coord chunk)
 
 bool N_FC_Init(void)
 {
-    s_los_table = kh_init(los);
+    s_los_table = fh_init(los);
     if(!s_los_table)
         goto fail_los;
 
-    s_flow_table = kh_init(flow);
+    s_flow_table = fh_init(flow);
     if(!s_flow_table)
         goto fail_flow;
 
-    s_dest_flow_table = kh_init(dest_flow);
+    s_dest_flow_table = fh_init(dest_flow);
     if(!s_dest_flow_table)
         goto fail_dest_flow;
 
-    E_Global_Register(EVENT_1HZ_TICK, on_1hz_tick, NULL);
+    if(!(s_los_chunk_index = kh_init(index)))
+        goto fail_los_chunk_index;
+    if(!(s_los_dest_index = kh_init(index)))
+        goto fail_los_dest_index;
+    if(!(s_dest_flow_chunk_index = kh_init(index)))
+        goto fail_dest_flow_chunk_index;
+
+    s_lru_head = s_lru_tail = NULL;
+    s_stats = (struct nav_cache_stats){
+        .bytes_budget = CONFIG_NAV_CACHE_BUDGET
+    };
     return true;
 
+fail_dest_flow_chunk_index:
+    kh_destroy(index, s_los_dest_index);
+fail_los_dest_index:
+    kh_destroy(index, s_los_chunk_index);
+fail_los_chunk_index:
+    fh_destroy(dest_flow, s_dest_flow_table);
 fail_dest_flow:
-    kh_destroy(flow, s_flow_table);
+    fh_destroy(flow, s_flow_table);
 fail_flow:
-    kh_destroy(los, s_los_table);
+    fh_destroy(los, s_los_table);
 fail_los:
     return false;
 }
 
 void N_FC_Shutdown(void)
 {
-    E_Global_Unregister(EVENT_1HZ_TICK, on_1hz_tick);
+    while(s_lru_head)
+        entry_free(s_lru_head);
+    assert(fh_size(s_flow_table) == 0);
 
-    kh_destroy(los, s_los_table);
-    kh_destroy(flow, s_flow_table);
-    kh_destroy(dest_flow, s_dest_flow_table);
+    fh_destroy(los, s_los_table);
+    fh_destroy(flow, s_flow_table);
+    fh_destroy(dest_flow, s_dest_flow_table);
+
+    index_destroy(s_los_chunk_index);
+    index_destroy(s_los_dest_index);
+    index_destroy(s_dest_flow_chunk_index);
+}
+
+void N_FC_SetBudget(size_t bytes)
+{
+    s_stats.bytes_budget = bytes;
+    enforce_budget(NULL);
+}
+
+void N_FC_GetStats(struct nav_cache_stats *out)
+{
+    *out = s_stats;
 }
 
 bool N_FC_ContainsLOSField(dest_id_t id, struct coord chunk_coord)
 {
-    khiter_t k = kh_get(los, s_los_table, key_for_dest_and_chunk(id, chunk_coord));
-    if(k == kh_end(s_los_table))
+    uint32_t k = fh_get(los, s_los_table, key_for_dest_and_chunk(id, chunk_coord));
+    if(k == fh_end(s_los_table)) {
+        s_stats.misses++;
         return false;
+    }
 
+    s_stats.hits++;
     return true;
 }
 
 const struct LOS_field *N_FC_LOSFieldAt(dest_id_t id, struct coord chunk_coord)
 {
-    khiter_t k = kh_get(los, s_los_table, key_for_dest_and_chunk(id, chunk_coord));
-    assert(k != kh_end(s_los_table));
+    uint32_t k = fh_get(los, s_los_table, key_for_dest_and_chunk(id, chunk_coord));
+    assert(k != fh_end(s_los_table));
 
-    kh_value(s_los_table, k).age = EVICTION_NUM_SECS;
-    return &kh_value(s_los_table, k).lf;
+    struct LOS_entry *entry = fh_value(s_los_table, k);
+    lru_touch(&entry->lru);
+    return &entry->lf;
 }
 
 void N_FC_SetLOSField(dest_id_t id, struct coord chunk_coord, const struct LOS_field *lf)
 {
     int ret;
-    khiter_t k = kh_put(los, s_los_table, key_for_dest_and_chunk(id, chunk_coord), &ret);
-    assert(ret != -1 && ret != 0);
-    kh_value(s_los_table, k) = (struct LOS_entry){
-        .age = EVICTION_NUM_SECS,
-        .lf = *lf
-    };
+    uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
+    uint32_t k = fh_put(los, s_los_table, key, &ret);
+    assert(ret != -1);
+
+    struct LOS_entry *entry;
+    if(ret == 0) {
+
+        entry = fh_value(s_los_table, k);
+        lru_touch(&entry->lru);
+    }else{
+
+        if(NULL == (entry = MEM_Malloc(MEM_TAG_NAV, sizeof(struct LOS_entry)))) {
+            fh_del(los, s_los_table, k);
+            return;
+        }
+        fh_value(s_los_table, k) = entry;
+        lru_insert(&entry->lru, ENTRY_LOS, key, sizeof(struct LOS_entry));
+        index_add(s_los_chunk_index, chunk_key(chunk_coord), key);
+        index_add(s_los_dest_index, id, key);
+    }
+
+    entry->lf = *lf;
+    enforce_budget(&entry->lru);
 }
 
 bool N_FC_ContainsFlowField(dest_id_t id, struct coord chunk_coord, ff_id_t *out_ffid)
 {
-    khiter_t k;
+    uint32_t k;
 
-    k = kh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
-    if(k == kh_end(s_dest_flow_table))
-        return false;
+    k = fh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
+    if(k == fh_end(s_dest_flow_table))
+        goto miss;
 
-    ff_id_t key = kh_value(s_dest_flow_table, k).id;
-    k = kh_get(flow, s_flow_table, key);
-    if(k == kh_end(s_flow_table))
-        return false;
+    ff_id_t key = fh_value(s_dest_flow_table, k)->id;
+    k = fh_get(flow, s_flow_table, key);
+    if(k == fh_end(s_flow_table))
+        goto miss;
 
+    s_stats.hits++;
     *out_ffid = key;
     return true;
+
+miss:
+    s_stats.misses++;
+    return false;
 }
 
 const struct flow_field *N_FC_FlowFieldAt(dest_id_t id, struct coord chunk_coord)
 {
-    khiter_t k;
+    uint32_t k;
 
-    k = kh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
-    assert(k != kh_end(s_dest_flow_table));
+    k = fh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
+    assert(k != fh_end(s_dest_flow_table));
 
-    ff_id_t key = kh_value(s_dest_flow_table, k).id;
-    kh_value(s_dest_flow_table, k).age = EVICTION_NUM_SECS;
+    struct path_entry *pentry = fh_value(s_dest_flow_table, k);
+    lru_touch(&pentry->lru);
 
-    k = kh_get(flow, s_flow_table, key);
-    assert(k != kh_end(s_flow_table));
-
-    kh_value(s_flow_table, k).age = EVICTION_NUM_SECS;
-    return &kh_value(s_flow_table, k).ff;
+    k = fh_get(flow, s_flow_table, pentry->id);
+    assert(k != fh_end(s_flow_table));
+    return &fh_value(s_flow_table, k)->ff;
 }
 
 void N_FC_SetFlowField(dest_id_t id, struct coord chunk_coord, 
                        ff_id_t field_id, const struct flow_field *ff)
 {
-    khiter_t k;
+    uint32_t k;
     int ret;
 
-    k = kh_put(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord), &ret);
+    /* Share the existing field for this ID, if there is one */
+    k = fh_put(flow, s_flow_table, field_id, &ret);
     assert(ret != -1);
-    kh_value(s_dest_flow_table, k) = (struct path_entry){
-        .age = EVICTION_NUM_SECS,
-        .id = field_id
-    };
 
-    k = kh_put(flow, s_flow_table, field_id, &ret);
+    struct flow_entry *fentry;
+    if(ret == 0) {
+
+        fentry = fh_value(s_flow_table, k);
+        /* The same ID can map to different fields in the rare case of a path 
+         * crossing a chunk more than once. Keep the latest one. */
+        if(0 != memcmp(&fentry->ff, ff, sizeof(struct flow_field))) {
+            fentry->ff = *ff;
+            flow_drop_integration(fentry);
+        }
+    }else{
+
+        if(NULL == (fentry = MEM_Malloc(MEM_TAG_NAV, sizeof(struct flow_entry)))) {
+            fh_del(flow, s_flow_table, k);
+            return;
+        }
+        fh_value(s_flow_table, k) = fentry;
+        fentry->refcount = 0;
+        fentry->ff = *ff;
+        fentry->integration = NULL;
+        s_stats.bytes_resident += sizeof(struct flow_entry);
+    }
+    /* Hold a reference while the dest_flow entry is updated */
+    fentry->refcount++;
+
+    uint64_t key = key_for_dest_and_chunk(id, chunk_coord);
+    k = fh_put(dest_flow, s_dest_flow_table, key, &ret);
     assert(ret != -1);
-    kh_value(s_flow_table, k) = (struct flow_entry){
-        .age = EVICTION_NUM_SECS,
-        .ff = *ff
-    };
+
+    struct path_entry *pentry;
+    if(ret == 0) {
+
+        pentry = fh_value(s_dest_flow_table, k);
+        flow_release(pentry->id);
+        lru_touch(&pentry->lru);
+    }else{
+
+        if(NULL == (pentry = MEM_Malloc(MEM_TAG_NAV, sizeof(struct path_entry)))) {
+            fh_del(dest_flow, s_dest_flow_table, k);
+            flow_release(field_id);
+            return;
+        }
+        fh_value(s_dest_flow_table, k) = pentry;
+        pentry->has_next = false;
+        lru_insert(&pentry->lru, ENTRY_DEST_FLOW, key, sizeof(struct path_entry));
+        index_add(s_dest_flow_chunk_index, chunk_key(chunk_coord), key);
+    }
+    pentry->id = field_id;
+
+    enforce_budget(&pentry->lru);
+}
+
+bool N_FC_FieldsResident(dest_id_t flow_id, dest_id_t los_id, struct coord chunk_coord)
+{
+    uint64_t flow_key = key_for_dest_and_chunk(flow_id, chunk_coord);
+    uint64_t los_key = key_for_dest_and_chunk(los_id, chunk_coord);
+    return (fh_get(dest_flow, s_dest_flow_table, flow_key) != fh_end(s_dest_flow_table))
+        && (fh_get(los, s_los_table, los_key) != fh_end(s_los_table));
+}
+
+bool N_FC_NextChunk(dest_id_t id, struct coord chunk_coord, struct coord *out_next)
+{
+    uint32_t k = fh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
+    if(k == fh_end(s_dest_flow_table))
+        return false;
+
+    const struct path_entry *pentry = fh_value(s_dest_flow_table, k);
+    if(!pentry->has_next)
+        return false;
+
+    *out_next = pentry->next;
+    return true;
+}
+
+void N_FC_SetNextChunk(dest_id_t id, struct coord chunk_coord, struct coord next)
+{
+    uint32_t k = fh_get(dest_flow, s_dest_flow_table, key_for_dest_and_chunk(id, chunk_coord));
+    if(k == fh_end(s_dest_flow_table))
+        return;
+
+    struct path_entry *pentry = fh_value(s_dest_flow_table, k);
+    pentry->has_next = true;
+    pentry->next = next;
+}
+
+void N_FC_InvalidateChunk(struct coord chunk_coord)
+{
+    khash_t(keyset) *set;
+    uint32_t k;
+
+    /* An LOS field is built outwards from the destination chunk, so a change 
+     * to any chunk on the way invalidates all the LOS fields for that destination. */
+    if((set = index_take(s_los_chunk_index, chunk_key(chunk_coord)))) {
+
+        for(khiter_t sk = kh_begin(set); sk != kh_end(set); sk++) {
+            if(!kh_exist(set, sk))
+                continue;
+
+            khash_t(keyset) *dest_set = index_take(s_los_dest_index, key_dest(kh_key(set, sk)));
+            if(!dest_set)
+                continue;
+
+            for(khiter_t dk = kh_begin(dest_set); dk != kh_end(dest_set); dk++) {
+                if(!kh_exist(dest_set, dk))
+                    continue;
+                if((k = fh_get(los, s_los_table, kh_key(dest_set, dk))) != fh_end(s_los_table))
+                    entry_free(&fh_value(s_los_table, k)->lru);
+            }
+            kh_destroy(keyset, dest_set);
+        }
+        kh_destroy(keyset, set);
+    }
+
+    /* The flow fields for the chunk are freed along with the last dest_flow 
+     * entry referring to them. */
+    if((set = index_take(s_dest_flow_chunk_index, chunk_key(chunk_coord)))) {
+
+        for(khiter_t sk = kh_begin(set); sk != kh_end(set); sk++) {
+            if(!kh_exist(set, sk))
+                continue;
+            if((k = fh_get(dest_flow, s_dest_flow_table, kh_key(set, sk))) != fh_end(s_dest_flow_table))
+                entry_free(&fh_value(s_dest_flow_table, k)->lru);
+        }
+        kh_destroy(keyset, set);
+    }
 }
 
+void N_FC_PatchChunkFlowFields(struct coord chunk_coord, ff_patch_func_t patch, void *arg)
+{
+    khiter_t k = kh_get(index, s_dest_flow_chunk_index, chunk_key(chunk_coord));
+    if(k == kh_end(s_dest_flow_chunk_index))
+        return;
+
+    khash_t(keyset) *set = kh_value(s_dest_flow_chunk_index, k);
+    khash_t(keyset) *patched = kh_init(keyset);
+    if(!patched)
+        return;
+
+    /* Many destinations can share the same field */
+    for(khiter_t sk = kh_begin(set); sk != kh_end(set); sk++) {
+        if(!kh_exist(set, sk))
+            continue;
+
+        uint32_t dk = fh_get(dest_flow, s_dest_flow_table, kh_key(set, sk));
+        if(dk == fh_end(s_dest_flow_table))
+            continue;
+
+        ff_id_t id = fh_value(s_dest_flow_table, dk)->id;
+        int ret;
+        kh_put(keyset, patched, id, &ret);
+        if(ret == 0)
+            continue;
+
+        uint32_t fk = fh_get(flow, s_flow_table, id);
+        assert(fk != fh_end(s_flow_table));
+        struct flow_entry *fentry = fh_value(s_flow_table, fk);
+
+        /* Without the state, the field is simply rebuilt */
+        if(!fentry->integration
+        && (fentry->integration = MEM_Malloc(MEM_TAG_NAV, sizeof(struct ff_integration)))) {
+            fentry->integration->valid = false;
+            s_stats.bytes_resident += sizeof(struct ff_integration);
+        }
+        patch(arg, id, &fentry->ff, fentry->integration);
+    }
+
+    kh_destroy(keyset, patched);
+}
@@ -43,6 +43,8 @@
 
 #include <stdbool.h>
 
+typedef void (*ff_patch_func_t)(void *arg, ff_id_t id, struct flow_field *inout, 
+                                struct ff_integration *inout_integration);
 
 /*###########################################################################*/
 /* FC GENERAL                                                                */
@@ -51,6 +53,33 @@
 bool                     N_FC_Init(void);
 void                     N_FC_Shutdown(void);
 
+/* ------------------------------------------------------------------------
+ * Evict all the cached fields which may have been made stale by a change to 
+ * the cost field or portals of the specified chunk.
+ * ------------------------------------------------------------------------
+ */
+void                     N_FC_InvalidateChunk(struct coord chunk_coord);
+
+/* ------------------------------------------------------------------------
+ * Call 'patch' once for every distinct cached flow field of the chunk, 
+ * allowing it to be updated in place. This is for changes which leave the
+ * fields valid, but no longer the best ones. Along with every field, the 
+ * integration state kept for it is passed (see N_FlowFieldRepair), which 
+ * is NULL if it could not be allocated.
+ * ------------------------------------------------------------------------
+ */
+void                     N_FC_PatchChunkFlowFields(struct coord chunk_coord, 
+                                                   ff_patch_func_t patch, void *arg);
+
+/* ------------------------------------------------------------------------
+ * All cached fields share a single least-recently-used list. After every
+ * insertion, the least recently used entries are evicted until the total 
+ * size of all entries fits within the budget.
+ * ------------------------------------------------------------------------
+ */
+void                     N_FC_SetBudget(size_t bytes);
+void                     N_FC_GetStats(struct nav_cache_stats *out);
+
 /*###########################################################################*/
 /* LOS FIELD CACHING                                                         */
 /*###########################################################################*/
@@ -58,9 +87,8 @@ void                     N_FC_Shutdown(void);
 bool                     N_FC_ContainsLOSField(dest_id_t id, struct coord chunk_coord);
 
 /* ------------------------------------------------------------------------
- * Updates the 'age' of the entry, which is used for determining which 
- * entries to evict. Returned pointer should not be stored, as it may become 
- * invalid after eviction.
+ * Marks the entry as most recently used. Returned pointer should not be 
+ * stored, as it may become invalid after eviction.
  * ------------------------------------------------------------------------
  */
 const struct LOS_field  *N_FC_LOSFieldAt(dest_id_t id, struct coord chunk_coord);
@@ -75,14 +103,35 @@ bool                     N_FC_ContainsFlowField(dest_id_t id, struct coord chunk
                                                 ff_id_t *out_ffid);
 
 /* ------------------------------------------------------------------------
- * Updates the 'age' of the entry, which is used for determining which 
- * entries to evict. Returned pointer should not be stored, as it may become 
- * invalid after eviction.
+ * Marks the entry as most recently used. Returned pointer should not be 
+ * stored, as it may become invalid after eviction.
  * ------------------------------------------------------------------------
  */
 const struct flow_field *N_FC_FlowFieldAt(dest_id_t id, struct coord chunk_coord);
 void                     N_FC_SetFlowField(dest_id_t id, struct coord chunk_coord, 
                                            ff_id_t field_id, const struct flow_field *ff);
 
+/* ------------------------------------------------------------------------
+ * Returns true if both the flow field cached under 'flow_id' and the LOS 
+ * field cached under 'los_id' are present for the chunk. The IDs differ 
+ * when the destination shares its' flow fields with its' goal region.
+ * Unlike the other queries, this does not count towards the cache statistics
+ * or mark the entries as used.
+ * ------------------------------------------------------------------------
+ */
+bool                     N_FC_FieldsResident(dest_id_t flow_id, dest_id_t los_id, 
+                                             struct coord chunk_coord);
+
+/* ------------------------------------------------------------------------
+ * Every cached flow field entry can remember the next chunk on the way to 
+ * the destination, allowing the fields further along the path to be fetched 
+ * ahead of time. The hint is dropped along with the entry.
+ * ------------------------------------------------------------------------
+ */
+bool                     N_FC_NextChunk(dest_id_t id, struct coord chunk_coord, 
+                                        struct coord *out_next);
+void                     N_FC_SetNextChunk(dest_id_t id, struct coord chunk_coord, 
+                                           struct coord next);
+
 #endif
 
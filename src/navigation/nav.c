@@ -38,16 +38,30 @@
 #include "a_star.h"
 #include "field.h"
 #include "fieldcache.h"
+#include "path_service.h"
+#include "snapshot.h"
+#include "cluster.h"
+#include "nav_file.h"
 #include "../map/public/tile.h"
 #include "../render/public/render.h"
 #include "../pf_math.h"
 #include "../collision.h"
 #include "../entity.h"
+#include "../event.h"
+#include "../parallel.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/file_replace.h"
 
+#include <SDL.h>
+
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 
 #define IDX(r, width, c)   ((r) * (width) + (c))
@@ -59,44 +73,91 @@
 
 #define EPSILON                  (1.0f / 1024)
 #define MAX_TILES_PER_LINE       (128)
-
-struct row_desc{
-    int chunk_r;
-    int tile_r;
+/* Units this many cells away from a chunk border have the fields for the
+ * chunk on the other side requested ahead of time */
+#define PREFETCH_DIST            (8)
+/* Worldspace dimensions of a single navigation tile */
+#define FIELD_TILE_X_DIM         ((float)TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE / FIELD_RES_C)
+#define FIELD_TILE_Z_DIM         ((float)TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE / FIELD_RES_R)
+/* Set in the IDs of destinations which share their flow fields outside of 
+ * the destination chunk with the rest of their goal region */
+#define DEST_REGION_BIT          (1u << 31)
+/* Number of destinations for which waypoint paths are cached, and the number 
+ * of paths kept for every destination */
+#define WAYPOINT_CACHE_DESTS     (64)
+#define WAYPOINT_CACHE_PATHS     (4)
+
+
+KHASH_MAP_INIT_INT64(ticket, path_ticket_t)
+
+typedef kvec_t(vec2_t) vec2_vec_t;
+
+struct waypoint_path{
+    /* The portal version of the layer the path was found for. The path is 
+     * stale once the impassable tiles of the layer change. */
+    uint32_t        portal_version;
+    /* The points after the source, ending at the destination */
+    vec2_vec_t      points;
 };
 
-struct col_desc{
-    int chunk_c;
-    int tile_c;
+/* The waypoint paths found to a single destination. When full, the oldest 
+ * path is replaced. */
+struct waypoint_entry{
+    size_t               num_paths;
+    size_t               next;
+    struct waypoint_path paths[WAYPOINT_CACHE_PATHS];
 };
 
-#define HIGHER(tile_desc, row_desc) \
-       ((tile_desc).chunk_r < (row_desc).chunk_r) \
-    || ((tile_desc).chunk_r == (row_desc).chunk_r && (tile_desc).tile_r < (row_desc).tile_r)
-
-#define LOWER(tile_desc, row_desc) \
-       ((tile_desc).chunk_r > (row_desc).chunk_r) \
-    || ((tile_desc).chunk_r == (row_desc).chunk_r && (tile_desc).tile_r > (row_desc).tile_r)
-
-#define MORE_LEFT(tile_desc, col_desc) \
-       ((tile_desc).chunk_c < (col_desc).chunk_c) \
-    || ((tile_desc).chunk_c == (col_desc).chunk_c && (tile_desc).tile_c < (col_desc).tile_c)
+KHASH_MAP_INIT_INT(waypoints, struct waypoint_entry)
 
-#define MORE_RIGHT(tile_desc, col_desc) \
-       ((tile_desc).chunk_c > (col_desc).chunk_c) \
-    || ((tile_desc).chunk_c == (col_desc).chunk_c && (tile_desc).tile_c > (col_desc).tile_c)
+struct build_job{
+    struct nav_private *priv;
+    const struct tile **chunk_tiles;
+    size_t              chunk_w;
+    size_t              chunk_h;
+};
 
-#define MIN_ROW(a, b)          HIGHER((a), (b)) ? (a) : (b)
-#define MIN_ROW_4(a, b, c, d)  MIN_ROW(MIN_ROW((a), (b)), MIN_ROW((c), (d)))
+struct link_job{
+    struct nav_private *priv;
+    const bool         *affected;
+};
 
-#define MAX_ROW(a, b)          LOWER((a), (b)) ? (a) : (b)
-#define MAX_ROW_4(a, b, c, d)  MAX_ROW(MAX_ROW((a), (b)), MAX_ROW((c), (d)))
+/* The OBBs are binned by the chunks they may touch, so that every chunk is 
+ * written to by a single task */
+struct cutout_job{
+    struct nav_layers  *layers;
+    vec3_t              map_pos;
+    const struct obb   *obbs;
+    /* The OBBs of chunk 'i' are bins[bin_offsets[i]...bin_offsets[i+1]) */
+    const size_t       *bin_offsets;
+    const uint32_t     *bins;
+};
 
-#define MIN_COL(a, b)          MORE_LEFT((a), (b)) ? (a) : (b)
-#define MIN_COL_4(a, b, c, d)  MIN_COL(MIN_COL((a), (b)), MIN_COL((c), (d)))
+/* The integration of the last flow field built for a path, which the field 
+ * of the chunk before it can be carried on from */
+struct field_chain{
+    /* Maximum number of chunks that an integration is carried on over */
+    int            window;
+    /* Ticks that may be spent on the fields of the path before the fields 
+     * are no longer chained */
+    uint64_t       budget;
+    uint64_t       spent;
+    struct coord   chunk;
+    /* Number of chunks the integration has been carried on over so far, 
+     * or 0 if 'dist' doesn't hold a usable integration */
+    int            depth;
+    float        (*dist)[FIELD_RES_C];
+    float        (*scratch)[FIELD_RES_C];
+};
 
-#define MAX_COL(a, b)          MORE_RIGHT((a), (b)) ? (a) : (b)
-#define MAX_COL_4(a, b, c, d)  MAX_COL(MAX_COL((a), (b)), MAX_COL((c), (d)))
+/* Stages of path computation for which the time spent is tracked */
+enum perf_stage{
+    STAGE_PORTAL_SEARCH,
+    STAGE_FLOW_FIELD,
+    STAGE_LOS_FIELD,
+    STAGE_WAYPOINTS,
+    STAGE_MAX,
+};
 
 enum edge_type{
     EDGE_BOT   = (1 << 0),
@@ -105,10 +166,50 @@ enum edge_type{
     EDGE_TOP   = (1 << 3),
 };
 
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Outstanding background requests made on flow field misses, keyed by 
+ * (dest_id, chunk) */
+static khash_t(ticket) *s_repath_table;
+/* Waypoint paths, keyed by destination ID */
+static khash_t(waypoints) *s_waypoint_cache;
+/* Paths are computed on the path service threads as well, so the counters 
+ * are updated under a lock. Updates are rare compared to the work timed. */
+static SDL_SpinLock     s_perf_lock;
+static uint64_t         s_perf_count[STAGE_MAX];
+static uint64_t         s_perf_ticks[STAGE_MAX];
+/* Number of chunks along the corridor that a flow field integration is 
+ * carried on over, and the time that a single path may spend doing so. 
+ * A window of 0 or 1 builds the field of every chunk on its' own. */
+static int              s_flow_window = 0;
+static float            s_flow_budget_ms = 2.0f;
+/* Side of the square goal regions, in tiles. 0 or 1 if every destination 
+ * tile has its' own fields. */
+static int              s_goal_region = 0;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
+static void n_perf_record(enum perf_stage stage, uint64_t start)
+{
+    uint64_t elapsed = SDL_GetPerformanceCounter() - start;
+
+    SDL_AtomicLock(&s_perf_lock);
+    s_perf_count[stage]++;
+    s_perf_ticks[stage] += elapsed;
+    SDL_AtomicUnlock(&s_perf_lock);
+}
+
+static uint64_t n_ticks_to_us(uint64_t ticks)
+{
+    /* Split the conversion to not overflow on long running sessions */
+    uint64_t freq = SDL_GetPerformanceFrequency();
+    return (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
 static bool n_tile_pathable(const struct tile *tile)
 {
     if(!tile->pathable)
@@ -128,7 +229,30 @@ static void n_set_cost_for_tile(struct nav_chunk *chunk,
     assert(FIELD_RES_R / chunk_h == 2);
     assert(FIELD_RES_C / chunk_w == 2);
 
-    const int (*tile_path_map)[2];
+    /* The tables must outlive the switch statement - a compound literal inside 
+     * the switch would only live until the end of the switch block. */
+    static const int flat_map[2][2] = {
+        {0,0}, 
+        {0,0}
+    };
+    static const int sw_map[2][2] = {
+        {0,0}, 
+        {1,0}
+    };
+    static const int se_map[2][2] = {
+        {0,0}, 
+        {0,1}
+    };
+    static const int nw_map[2][2] = {
+        {1,0}, 
+        {0,0}
+    };
+    static const int ne_map[2][2] = {
+        {0,1}, 
+        {0,0}
+    };
+
+    const int (*tile_path_map)[2] = flat_map;
 
     switch(tile->type) {
     case TILETYPE_FLAT:
@@ -136,34 +260,19 @@ static void n_set_cost_for_tile(struct nav_chunk *chunk,
     case TILETYPE_RAMP_NS:
     case TILETYPE_RAMP_EW:
     case TILETYPE_RAMP_WE:
-        tile_path_map = (int[2][2]){
-            {0,0}, 
-            {0,0}
-        };  break;
+        tile_path_map = flat_map;  break;
     case TILETYPE_CORNER_CONCAVE_SW:
     case TILETYPE_CORNER_CONVEX_NE:
-        tile_path_map = (int[2][2]){
-            {0,0}, 
-            {1,0}
-        };  break;
+        tile_path_map = sw_map;  break;
     case TILETYPE_CORNER_CONCAVE_SE:
     case TILETYPE_CORNER_CONVEX_NW:
-        tile_path_map = (int[2][2]){
-            {0,0}, 
-            {0,1}
-        };  break;
+        tile_path_map = se_map;  break;
     case TILETYPE_CORNER_CONCAVE_NW:
     case TILETYPE_CORNER_CONVEX_SE:
-        tile_path_map = (int[2][2]){
-            {1,0}, 
-            {0,0}
-        };  break;
+        tile_path_map = nw_map;  break;
     case TILETYPE_CORNER_CONCAVE_NE:
     case TILETYPE_CORNER_CONVEX_SW:
-        tile_path_map = (int[2][2]){
-            {0,1}, 
-            {0,0}
-        };  break;
+        tile_path_map = ne_map;  break;
     default: assert(0);
     }
 
@@ -188,29 +297,30 @@ static void n_set_cost_edge(struct nav_chunk *chunk,
     assert(FIELD_RES_R / chunk_h == 2);
     assert(FIELD_RES_C / chunk_w == 2);
 
-    const int (*tile_path_map)[2];
+    static const int bot_map[2][2] = {
+        {1,1}, 
+        {0,0}
+    };
+    static const int top_map[2][2] = {
+        {0,0}, 
+        {1,1}
+    };
+    static const int left_map[2][2] = {
+        {0,1}, 
+        {0,1}
+    };
+    static const int right_map[2][2] = {
+        {1,0}, 
+        {1,0}
+    };
+
+    const int (*tile_path_map)[2] = bot_map;
 
     switch(edge){
-    case EDGE_BOT:
-        tile_path_map = (int[2][2]){
-            {1,1}, 
-            {0,0}
-        };  break;
-    case EDGE_TOP:
-        tile_path_map = (int[2][2]){
-            {0,0}, 
-            {1,1}
-        };  break;
-    case EDGE_LEFT:
-        tile_path_map = (int[2][2]){
-            {0,1}, 
-            {0,1}
-        };  break;
-    case EDGE_RIGHT:
-        tile_path_map = (int[2][2]){
-            {1,0}, 
-            {1,0}
-        };  break;
+    case EDGE_BOT:   tile_path_map = bot_map;   break;
+    case EDGE_TOP:   tile_path_map = top_map;   break;
+    case EDGE_LEFT:  tile_path_map = left_map;  break;
+    case EDGE_RIGHT: tile_path_map = right_map; break;
     }
 
     size_t r_base = tile_r * 2;
@@ -237,49 +347,43 @@ static bool n_cliff_edge(const struct tile *a, const struct tile *b)
 }
 
 static void n_make_cliff_edges(struct nav_private *priv, const struct tile **tiles,
-                               size_t chunk_w, size_t chunk_h)
+                               size_t chunk_w, size_t chunk_h, int r, int c)
 {
-    for(int r = 0; r < priv->height; r++) {
-        for(int c = 0; c < priv->width; c++) {
-            
-            struct nav_chunk *curr_chunk = &priv->chunks[IDX(r, priv->width, c)];
-
-            const struct tile *bot_tiles = (r < priv->height-1)  ? tiles[IDX(r+1, priv->width, c)] : NULL;
-            const struct tile *top_tiles = (r > 0)               ? tiles[IDX(r-1, priv->width, c)] : NULL;
-            const struct tile *right_tiles = (c < priv->width-1) ? tiles[IDX(r, priv->width, c+1)] : NULL;
-            const struct tile *left_tiles = (c > 0)              ? tiles[IDX(r, priv->width, c-1)] : NULL;
-
-            for(int chr = 0; chr < chunk_h; chr++) {
-                for(int chc = 0; chc < chunk_w; chc++) {
-
-                    const struct tile *curr_tile = &tiles[IDX(r, priv->width, c)][IDX(chr, chunk_w, chc)];
-                    const struct tile *bot_tile   = (chr < chunk_h-1) ? curr_tile + chunk_w 
-                                                  : bot_tiles         ? &bot_tiles[IDX(0, chunk_w, chc)]
-                                                  : NULL;
-                    const struct tile *top_tile   = (chr > 0)         ? curr_tile - chunk_w
-                                                  : top_tiles         ? &top_tiles[IDX(chunk_h-1, chunk_w, chc)]
-                                                  : NULL;
-                    const struct tile *left_tile  = (chc > 0)         ? curr_tile - 1 
-                                                  : left_tiles        ? &left_tiles[IDX(chr, chunk_w, chunk_w-1)]
-                                                  : NULL;
-                    const struct tile *right_tile = (chc < chunk_w-1) ? curr_tile + 1 
-                                                  : right_tiles       ? &right_tiles[IDX(chr, chunk_w, 0)]
-                                                  : NULL;
-
-                    if(n_cliff_edge(curr_tile, bot_tile))
-                        n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_BOT);
-
-                    if(n_cliff_edge(curr_tile, top_tile))
-                        n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_TOP);
-
-                    if(n_cliff_edge(curr_tile, left_tile))
-                        n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_LEFT);
-
-                    if(n_cliff_edge(curr_tile, right_tile))
-                        n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_RIGHT);
-                }
-            }
-
+    struct nav_chunk *curr_chunk = &priv->chunks[IDX(r, priv->width, c)];
+
+    const struct tile *bot_tiles = (r < priv->height-1)  ? tiles[IDX(r+1, priv->width, c)] : NULL;
+    const struct tile *top_tiles = (r > 0)               ? tiles[IDX(r-1, priv->width, c)] : NULL;
+    const struct tile *right_tiles = (c < priv->width-1) ? tiles[IDX(r, priv->width, c+1)] : NULL;
+    const struct tile *left_tiles = (c > 0)              ? tiles[IDX(r, priv->width, c-1)] : NULL;
+
+    for(int chr = 0; chr < chunk_h; chr++) {
+        for(int chc = 0; chc < chunk_w; chc++) {
+
+            const struct tile *curr_tile = &tiles[IDX(r, priv->width, c)][IDX(chr, chunk_w, chc)];
+            const struct tile *bot_tile   = (chr < chunk_h-1) ? curr_tile + chunk_w 
+                                          : bot_tiles         ? &bot_tiles[IDX(0, chunk_w, chc)]
+                                          : NULL;
+            const struct tile *top_tile   = (chr > 0)         ? curr_tile - chunk_w
+                                          : top_tiles         ? &top_tiles[IDX(chunk_h-1, chunk_w, chc)]
+                                          : NULL;
+            const struct tile *left_tile  = (chc > 0)         ? curr_tile - 1 
+                                          : left_tiles        ? &left_tiles[IDX(chr, chunk_w, chunk_w-1)]
+                                          : NULL;
+            const struct tile *right_tile = (chc < chunk_w-1) ? curr_tile + 1 
+                                          : right_tiles       ? &right_tiles[IDX(chr, chunk_w, 0)]
+                                          : NULL;
+
+            if(n_cliff_edge(curr_tile, bot_tile))
+                n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_BOT);
+
+            if(n_cliff_edge(curr_tile, top_tile))
+                n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_TOP);
+
+            if(n_cliff_edge(curr_tile, left_tile))
+                n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_LEFT);
+
+            if(n_cliff_edge(curr_tile, right_tile))
+                n_set_cost_edge(curr_chunk, chunk_w, chunk_h, chr, chc, EDGE_RIGHT);
         }
     }
 }
@@ -363,10 +467,44 @@ static void n_link_chunks(struct nav_chunk *a, enum edge_type a_type, struct coo
     }
 }
 
-static void n_create_portals(struct nav_private *priv)
+static bool n_chunk_affected(const struct nav_private *priv, int r, int c)
+{
+    if(priv->chunks[IDX(r, priv->width, c)].dirty)
+        return true;
+
+    return (r > 0               && priv->chunks[IDX(r-1, priv->width, c)].dirty)
+        || (r < priv->height-1  && priv->chunks[IDX(r+1, priv->width, c)].dirty)
+        || (c > 0               && priv->chunks[IDX(r, priv->width, c-1)].dirty)
+        || (c < priv->width-1   && priv->chunks[IDX(r, priv->width, c+1)].dirty);
+}
+
+/* Remove the portals of the chunk which are on an edge shared with a dirty 
+ * chunk. The remaining portals are compacted, with the 'connected' pointers 
+ * of their counterparts in the adjacent chunks patched up. */
+static void n_remove_dirty_portals(struct nav_private *priv, struct nav_chunk *chunk)
 {
-    size_t n_links = 0;
+    size_t num_kept = 0;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        struct portal *port = &chunk->portals[i];
+        const struct nav_chunk *adjacent = &priv->chunks[IDX(port->connected->chunk.r, priv->width, 
+                                                             port->connected->chunk.c)];
+        if(chunk->dirty || adjacent->dirty)
+            continue;
 
+        if(num_kept != i) {
+            chunk->portals[num_kept] = *port;
+            chunk->portals[num_kept].connected->connected = &chunk->portals[num_kept];
+        }
+        num_kept++;
+    }
+    chunk->num_portals = num_kept;
+}
+
+/* Re-create the portals along all edges of dirty chunks */
+static void n_create_portals(struct nav_private *priv)
+{
     for(int r = 0; r < priv->height; r++) {
         for(int c = 0; c < priv->width; c++) {
             
@@ -374,49 +512,215 @@ static void n_create_portals(struct nav_private *priv)
             struct nav_chunk *bot = (r < priv->height-1) ? &priv->chunks[IDX(r+1, priv->width, c)] : NULL;
             struct nav_chunk *right = (c < priv->width-1) ? &priv->chunks[IDX(r, priv->width, c+1)] : NULL;
 
-            if(bot)   n_link_chunks(curr, EDGE_BOT, (struct coord){r, c}, bot, EDGE_TOP, (struct coord){r+1, c});
-            if(right) n_link_chunks(curr, EDGE_RIGHT, (struct coord){r, c}, right, EDGE_LEFT, (struct coord){r, c+1});
-    
-            n_links += (!!bot + !!right);
+            if(bot && (curr->dirty || bot->dirty))
+                n_link_chunks(curr, EDGE_BOT, (struct coord){r, c}, bot, EDGE_TOP, (struct coord){r+1, c});
+            if(right && (curr->dirty || right->dirty))
+                n_link_chunks(curr, EDGE_RIGHT, (struct coord){r, c}, right, EDGE_LEFT, (struct coord){r, c+1});
+        }
+    }
+}
+
+/* Label every set of mutually reachable tiles within the chunk with a distinct 
+ * island ID. Connectivity follows the same rules as the grid A* search: any
+ * passable neighbour can be stepped onto, except when moving diagonally between 
+ * two impassable tiles. */
+static void n_update_islands(struct nav_chunk *chunk)
+{
+    struct coord frontier[FIELD_RES_R * FIELD_RES_C];
+    uint16_t next_island = 0;
+
+    for(int r = 0; r < FIELD_RES_R; r++)
+        for(int c = 0; c < FIELD_RES_C; c++)
+            chunk->islands[r][c] = ISLAND_NONE;
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            if(chunk->cost_base[r][c] == COST_IMPASSABLE)
+                continue;
+            if(chunk->islands[r][c] != ISLAND_NONE)
+                continue;
+
+            size_t head = 0;
+            frontier[head++] = (struct coord){r, c};
+            chunk->islands[r][c] = next_island;
+
+            while(head > 0) {
+
+                struct coord curr = frontier[--head];
+                for(int dr = -1; dr <= 1; dr++) {
+                    for(int dc = -1; dc <= 1; dc++) {
+
+                        int nr = curr.r + dr, nc = curr.c + dc;
+                        if(nr < 0 || nr >= FIELD_RES_R || nc < 0 || nc >= FIELD_RES_C)
+                            continue;
+                        if(chunk->cost_base[nr][nc] == COST_IMPASSABLE)
+                            continue;
+                        if(chunk->islands[nr][nc] != ISLAND_NONE)
+                            continue;
+
+                        bool diag = (dr != 0) && (dc != 0);
+                        if(diag && chunk->cost_base[nr][curr.c] == COST_IMPASSABLE
+                                && chunk->cost_base[curr.r][nc] == COST_IMPASSABLE)
+                            continue;
+
+                        chunk->islands[nr][nc] = next_island;
+                        frontier[head++] = (struct coord){nr, nc};
+                    }
+                }
+            }
+            next_island++;
+            assert(next_island != ISLAND_NONE);
         }
     }
 
-    assert(n_links == (priv->width)*(priv->width-1) + (priv->height)*(priv->height-1));
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        struct portal *port = &chunk->portals[i];
+        struct coord center = (struct coord){
+            (port->endpoints[0].r + port->endpoints[1].r) / 2,
+            (port->endpoints[0].c + port->endpoints[1].c) / 2,
+        };
+        port->island = chunk->islands[center.r][center.c];
+    }
 }
 
-static void n_link_chunk_portals(struct nav_chunk *chunk)
+/* Label every connected component of the portal graph with a distinct ID. 
+ * Must be called after the portals of all chunks have been linked. */
+static void n_update_components(struct nav_private *priv)
 {
-    coord_vec_t path;
-    kv_init(path);
+    kvec_t(struct portal*) frontier;
+    kv_init(frontier);
+    uint32_t next_component = 0;
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+        struct nav_chunk *chunk = &priv->chunks[i];
+        for(int j = 0; j < chunk->num_portals; j++)
+            chunk->portals[j].component = UINT32_MAX;
+    }
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        struct nav_chunk *chunk = &priv->chunks[i];
+        for(int j = 0; j < chunk->num_portals; j++) {
+
+            struct portal *port = &chunk->portals[j];
+            if(port->component != UINT32_MAX)
+                continue;
+
+            port->component = next_component;
+            kv_push(struct portal*, frontier, port);
+
+            while(kv_size(frontier) > 0) {
+
+                struct portal *curr = kv_pop(frontier);
+                for(int k = 0; k <= curr->num_neighbours; k++) {
+
+                    struct portal *next = (k < curr->num_neighbours) ? curr->edges[k].neighbour 
+                                                                     : curr->connected;
+                    if(!next || next->component != UINT32_MAX)
+                        continue;
+
+                    next->component = next_component;
+                    kv_push(struct portal*, frontier, next);
+                }
+            }
+            next_component++;
+        }
+    }
+
+    kv_destroy(frontier);
+}
+
+static struct coord n_portal_center(const struct portal *port)
+{
+    return (struct coord){
+        (port->endpoints[0].r + port->endpoints[1].r) / 2,
+        (port->endpoints[0].c + port->endpoints[1].c) / 2,
+    };
+}
 
+static void n_link_chunk_portals(struct nav_chunk *chunk)
+{
     for(int i = 0; i < chunk->num_portals; i++) {
 
         struct portal *port = &chunk->portals[i];
+        struct portal *candidates[MAX_PORTALS_PER_CHUNK];
+        struct coord targets[MAX_PORTALS_PER_CHUNK];
+        float costs[MAX_PORTALS_PER_CHUNK];
+        size_t num_candidates = 0;
+
         for(int j = 0; j < chunk->num_portals; j++) {
 
             if(i == j)
                 continue;
 
             struct portal *link_candidate = &chunk->portals[j];
-            struct coord a = (struct coord){
-                (port->endpoints[0].r + port->endpoints[1].r) / 2,
-                (port->endpoints[0].c + port->endpoints[1].c) / 2,
-            };
-            struct coord b = (struct coord){
-                (link_candidate->endpoints[0].r + link_candidate->endpoints[1].r) / 2,
-                (link_candidate->endpoints[0].c + link_candidate->endpoints[1].c) / 2,
-            };
+            if(port->island != link_candidate->island)
+                continue;
 
-            float cost;
-            bool has_path = AStar_GridPath(a, b, chunk->cost_base, &path, &cost);
-            if(has_path) {
-                port->edges[port->num_neighbours] = (struct edge){link_candidate, cost};
-                port->num_neighbours++;    
-            }
+            candidates[num_candidates] = link_candidate;
+            targets[num_candidates] = n_portal_center(link_candidate);
+            num_candidates++;
+        }
+
+        if(num_candidates == 0)
+            continue;
+
+        /* A single search from the portal gives the costs to all the others */
+        AStar_GridCosts(n_portal_center(port), chunk->cost_base, num_candidates, targets, costs);
+
+        for(int j = 0; j < num_candidates; j++) {
+
+            if(costs[j] == INFINITY)
+                continue;
+            port->edges[port->num_neighbours] = (struct edge){candidates[j], costs[j]};
+            port->num_neighbours++;    
+        }
+    }
+}
+
+/* Update the islands and portal edges of an affected chunk. This only 
+ * touches the chunk itself, so different chunks can be linked in parallel. */
+static void n_link_task(void *arg, size_t idx)
+{
+    const struct link_job *job = arg;
+    if(!job->affected[idx])
+        return;
+
+    struct nav_chunk *chunk = &job->priv->chunks[idx];
+    for(int i = 0; i < chunk->num_portals; i++)
+        chunk->portals[i].num_neighbours = 0;
+
+    n_update_islands(chunk);
+    n_link_chunk_portals(chunk);
+}
+
+/* Build the base cost field of a chunk from its' tiles. The tiles of the 
+ * adjacent chunks are only read, so different chunks can be built in parallel. */
+static void n_build_task(void *arg, size_t idx)
+{
+    const struct build_job *job = arg;
+    struct nav_private *priv = job->priv;
+    int chunk_r = idx / priv->width;
+    int chunk_c = idx % priv->width;
+
+    struct nav_chunk *curr_chunk = &priv->chunks[idx];
+    const struct tile *curr_tiles = job->chunk_tiles[idx];
+    curr_chunk->num_portals = 0;
+    curr_chunk->dirty = true;
+    memset(curr_chunk->blockers, 0, sizeof(curr_chunk->blockers));
+    curr_chunk->num_blocked = 0;
+
+    for(int tile_r = 0; tile_r < job->chunk_h; tile_r++) {
+        for(int tile_c = 0; tile_c < job->chunk_w; tile_c++) {
+
+            const struct tile *curr_tile = &curr_tiles[tile_r * job->chunk_w + tile_c];
+            n_set_cost_for_tile(curr_chunk, job->chunk_w, job->chunk_h, tile_r, tile_c, curr_tile);
         }
     }
 
-    kv_destroy(path);
+    n_make_cliff_edges(priv, job->chunk_tiles, job->chunk_w, job->chunk_h, chunk_r, chunk_c);
 }
 
 static void n_render_grid_path(struct nav_chunk *chunk, mat4x4_t *chunk_model,
@@ -425,15 +729,24 @@ static void n_render_grid_path(struct nav_chunk *chunk, mat4x4_t *chunk_model,
     const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
     const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
 
-    vec2_t corners_buff[4 * kv_size(*path)];
-    vec3_t colors_buff[kv_size(*path)];
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    vec2_t *corners_buff = arena_alloc(arena, 4 * sv_size(*path) * sizeof(vec2_t));
+    vec3_t *colors_buff = arena_alloc(arena, sv_size(*path) * sizeof(vec3_t));
+    if(!corners_buff || !colors_buff) {
+        arena_rewind(arena, mark);
+        return;
+    }
 
     vec2_t *corners_base = corners_buff;
     vec3_t *colors_base = colors_buff; 
 
-    for(int i = 0, r = kv_A(*path, i).r, c = kv_A(*path, i).c; 
-        i < kv_size(*path); 
-        i++, r = kv_A(*path, i).r, c = kv_A(*path, i).c) {
+    for(int i = 0, r = sv_A(*path, i).r, c = sv_A(*path, i).c; 
+        i < sv_size(*path); 
+        i++, r = sv_A(*path, i).r, c = sv_A(*path, i).c) {
 
         /* Subtract EPSILON to make sure every coordinate is strictly within the map bounds */
         float square_x_len = (1.0f / FIELD_RES_C) * chunk_x_dim - EPSILON;
@@ -449,9 +762,11 @@ static void n_render_grid_path(struct nav_chunk *chunk, mat4x4_t *chunk_model,
         *colors_base++ = (vec3_t){0.0f, 0.0f, 1.0f};
     }
 
-    assert(colors_base == colors_buff + ARR_SIZE(colors_buff));
-    assert(corners_base == corners_buff + ARR_SIZE(corners_buff));
-    R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, kv_size(*path), chunk_model, map);
+    assert(colors_base == colors_buff + sv_size(*path));
+    assert(corners_base == corners_buff + 4 * sv_size(*path));
+    R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, sv_size(*path), chunk_model, map);
+
+    arena_rewind(arena, mark);
 }
 
 static void n_render_portals(const struct nav_chunk *chunk, mat4x4_t *chunk_model,
@@ -499,182 +814,1776 @@ static void n_render_portals(const struct nav_chunk *chunk, mat4x4_t *chunk_mode
     R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, num_tiles, chunk_model, map);
 }
 
-static dest_id_t n_dest_id(struct tile_desc dst_desc)
+static enum field_integration n_integration_method(const struct nav_chunk *chunk)
 {
-    return (((uint32_t)dst_desc.chunk_r & 0xff) << 24)
-         | (((uint32_t)dst_desc.chunk_c & 0xff) << 16)
-         | (((uint32_t)dst_desc.tile_r  & 0xff) <<  8)
-         | (((uint32_t)dst_desc.tile_c  & 0xff) <<  0);
+    /* The sweep converges in a handful of passes over open terrain but needs 
+     * one pass per turn of a winding corridor. Heavily obstructed chunks are 
+     * the ones likely to have such corridors, so fall back to the wavefront 
+     * search for them. */
+    size_t num_blocked = 0;
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+            if(chunk->cost_base[r][c] == COST_IMPASSABLE)
+                num_blocked++;
+        }
+    }
+    return (num_blocked > (FIELD_RES_R * FIELD_RES_C) / 4) ? FIELD_INTEGRATE_DIJKSTRA
+                                                           : FIELD_INTEGRATE_SWEEP;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+static uint64_t n_dest_chunk_key(dest_id_t id, struct coord chunk)
+{
+    return ((((uint64_t)id) << 32) | (((uint64_t)chunk.r) << 16) | (((uint64_t)chunk.c) & 0xffff));
+}
 
-bool N_Init(void)
+/* A destination can only share the fields of its' goal region if all the 
+ * passable tiles of the region are on the same island. Otherwise, the paths
+ * to the region could lead to a part of the chunk it can't be reached from. */
+static bool n_goal_region_shared(const struct nav_private *priv, struct tile_desc dst_desc)
 {
-    if(!N_FC_Init())
+    if(s_goal_region <= 1)
         return false;
 
+    const struct nav_chunk *chunk = &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)];
+    uint16_t island = chunk->islands[dst_desc.tile_r][dst_desc.tile_c];
+    if(island == ISLAND_NONE)
+        return false;
+
+    int base_r = dst_desc.tile_r - (dst_desc.tile_r % s_goal_region);
+    int base_c = dst_desc.tile_c - (dst_desc.tile_c % s_goal_region);
+
+    for(int r = base_r; r < MIN(base_r + s_goal_region, FIELD_RES_R); r++) {
+    for(int c = base_c; c < MIN(base_c + s_goal_region, FIELD_RES_C); c++) {
+        uint16_t curr = chunk->islands[r][c];
+        if(curr != ISLAND_NONE && curr != island)
+            return false;
+    }}
     return true;
 }
 
-void N_Shutdown(void)
+static dest_id_t n_dest_id(const struct nav_private *priv, struct tile_desc dst_desc)
 {
-    N_FC_Shutdown();
+    dest_id_t ret = (((uint32_t)priv->layer      & 0x07) << 28)
+                  | (((uint32_t)dst_desc.chunk_r & 0xff) << 20)
+                  | (((uint32_t)dst_desc.chunk_c & 0xff) << 12)
+                  | (((uint32_t)dst_desc.tile_r  & 0x3f) <<  6)
+                  | (((uint32_t)dst_desc.tile_c  & 0x3f) <<  0);
+
+    if(n_goal_region_shared(priv, dst_desc))
+        ret |= DEST_REGION_BIT;
+    return ret;
 }
 
-void *N_BuildForMapData(size_t w, size_t h, 
-                        size_t chunk_w, size_t chunk_h,
-                        const struct tile **chunk_tiles)
+static enum nav_layer n_dest_layer(dest_id_t id)
 {
-    struct nav_private *ret;
-    size_t alloc_size = sizeof(struct nav_private) + (w * h * sizeof(struct nav_chunk));
-
-    ret = malloc(alloc_size);
-    if(!ret)
-        goto fail_alloc;
+    return (id >> 28) & 0x07;
+}
 
-    ret->width = w;
-    ret->height = h;
+/* The ID under which the flow field for steering from 'chunk' towards the 
+ * destination is cached. The destination chunk always gets a field for the 
+ * exact destination tile. The fields of the other chunks only have to get 
+ * the unit into the destination chunk, so destinations of the same goal 
+ * region share them, along with the next chunk hints. The tile bits are 
+ * rounded down to the corner of the region, which never clashes with the 
+ * ID of a destination in that corner tile, since that only ever maps to 
+ * the fields of the destination chunk itself. */
+static dest_id_t n_flow_key(dest_id_t id, struct coord chunk)
+{
+    if(!(id & DEST_REGION_BIT))
+        return id;
 
-    assert(FIELD_RES_R >= chunk_h && FIELD_RES_R % chunk_h == 0);
-    assert(FIELD_RES_C >= chunk_w && FIELD_RES_C % chunk_w == 0);
+    if(chunk.r == ((id >> 20) & 0xff) && chunk.c == ((id >> 12) & 0xff))
+        return id;
 
-    /* First build the base cost field based on terrain */
-    for(int chunk_r = 0; chunk_r < ret->height; chunk_r++){
-        for(int chunk_c = 0; chunk_c < ret->width; chunk_c++){
+    int region = MAX(s_goal_region, 1);
+    int tile_r = (id >> 6) & 0x3f;
+    int tile_c = (id >> 0) & 0x3f;
+    tile_r -= tile_r % region;
+    tile_c -= tile_c % region;
 
-            struct nav_chunk *curr_chunk = &ret->chunks[IDX(chunk_r, ret->width, chunk_c)];
-            const struct tile *curr_tiles = chunk_tiles[IDX(chunk_r, ret->width, chunk_c)];
-            curr_chunk->num_portals = 0;
+    return (id & ~0xfffu) | ((uint32_t)tile_r << 6) | (uint32_t)tile_c;
+}
 
-            for(int tile_r = 0; tile_r < chunk_h; tile_r++) {
-                for(int tile_c = 0; tile_c < chunk_w; tile_c++) {
+static const struct flow_field *n_path_flow_field(const struct path_result *res, bool use_cache,
+                                                  struct coord chunk, ff_id_t *out_ffid)
+{
+    for(int i = 0; i < kv_size(res->flow); i++) {
 
-                    const struct tile *curr_tile = &curr_tiles[tile_r * chunk_w + tile_c];
-                    n_set_cost_for_tile(curr_chunk, chunk_w, chunk_h, tile_r, tile_c, curr_tile);
-                }
-            }
+        const struct path_flow_result *curr = &kv_A(res->flow, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c) {
+            *out_ffid = curr->ffid;
+            return &curr->ff;
         }
     }
 
-    n_make_cliff_edges(ret, chunk_tiles, chunk_w, chunk_h);
-    N_UpdatePortals(ret);
-    return ret;
+    if(use_cache && N_FC_ContainsFlowField(n_flow_key(res->dest_id, chunk), chunk, out_ffid))
+        return N_FC_FlowFieldAt(n_flow_key(res->dest_id, chunk), chunk);
 
-fail_alloc:
     return NULL;
 }
 
-void N_FreePrivate(void *nav_private)
+static void n_path_set_flow_field(struct path_result *res, struct coord chunk, 
+                                  ff_id_t ffid, const struct flow_field *ff)
 {
-    assert(nav_private);
-    free(nav_private);
+    for(int i = 0; i < kv_size(res->flow); i++) {
+
+        struct path_flow_result *curr = &kv_A(res->flow, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c) {
+            curr->ffid = ffid;
+            curr->ff = *ff;
+            return;
+        }
+    }
+
+    struct path_flow_result *new = kv_pushp(struct path_flow_result, res->flow);
+    new->chunk = chunk;
+    new->ffid = ffid;
+    new->ff = *ff;
 }
 
-void N_RenderPathableChunk(void *nav_private, mat4x4_t *chunk_model,
-                           const struct map *map,
-                           int chunk_r, int chunk_c)
+static const struct LOS_field *n_path_los_field(const struct path_result *res, bool use_cache,
+                                                struct coord chunk)
 {
-    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
-    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    for(int i = 0; i < kv_size(res->los); i++) {
 
-    const struct nav_private *priv = nav_private;
-    assert(chunk_r < priv->height);
-    assert(chunk_c < priv->width);
+        const struct path_los_result *curr = &kv_A(res->los, i);
+        if(curr->chunk.r == chunk.r && curr->chunk.c == chunk.c)
+            return &curr->lf;
+    }
 
-    vec2_t corners_buff[4 * FIELD_RES_R * FIELD_RES_C];
-    vec3_t colors_buff[FIELD_RES_R * FIELD_RES_C];
+    if(use_cache && N_FC_ContainsLOSField(res->dest_id, chunk))
+        return N_FC_LOSFieldAt(res->dest_id, chunk);
 
-    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-    n_render_portals(chunk, chunk_model, map);
+    return NULL;
+}
 
-    vec2_t *corners_base = corners_buff;
-    vec3_t *colors_base = colors_buff; 
+static struct LOS_field *n_path_new_los_field(struct path_result *res, struct coord chunk)
+{
+    struct path_los_result *new = kv_pushp(struct path_los_result, res->los);
+    new->chunk = chunk;
+    return &new->lf;
+}
 
-    for(int r = 0; r < FIELD_RES_R; r++) {
-        for(int c = 0; c < FIELD_RES_C; c++) {
+/* Make a background request for the fields needed to steer towards the destination 
+ * from the specified chunk. At most one request is kept in flight for every (dest, chunk)
+ * pair. Returns true once the request has completed successfully. */
+static bool n_fields_ready(struct nav_private *priv, dest_id_t id, struct coord chunk, 
+                           vec2_t curr_pos, vec2_t xz_dest, vec3_t map_pos)
+{
+    uint64_t key = n_dest_chunk_key(id, chunk);
+    khiter_t k = kh_get(ticket, s_repath_table, key);
 
-            /* Subtract EPSILON to make sure every coordinate is strictly within the map bounds */
-            float square_x_len = (1.0f / FIELD_RES_C) * chunk_x_dim - EPSILON;
-            float square_z_len = (1.0f / FIELD_RES_R) * chunk_z_dim - EPSILON;
-            float square_x = -(((float)c) / FIELD_RES_C) * chunk_x_dim;
-            float square_z =  (((float)r) / FIELD_RES_R) * chunk_z_dim;
+    if(k == kh_end(s_repath_table)) {
 
-            *corners_base++ = (vec2_t){square_x, square_z};
-            *corners_base++ = (vec2_t){square_x, square_z + square_z_len};
-            *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
-            *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
+        path_ticket_t ticket = N_PS_Submit(priv, 1, &curr_pos, xz_dest, map_pos);
+        if(ticket == NULL_PATH_TICKET)
+            return false;
 
-            *colors_base++ = chunk->cost_base[r][c] == COST_IMPASSABLE ? (vec3_t){1.0f, 0.0f, 0.0f}
-                                                                       : (vec3_t){0.0f, 1.0f, 0.0f};
+        int status;
+        k = kh_put(ticket, s_repath_table, key, &status);
+        if(status == -1) {
+            N_ReleasePath(ticket);
+            return false;
         }
+        kh_value(s_repath_table, k) = ticket;
+        return false;
     }
 
-    assert(colors_base == colors_buff + ARR_SIZE(colors_buff));
-    assert(corners_base == corners_buff + ARR_SIZE(corners_buff));
-    R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, FIELD_RES_R * FIELD_RES_C, chunk_model, map);
+    path_ticket_t ticket = kh_value(s_repath_table, k);
+    enum path_status status = N_PollPath(ticket);
+    if(status == PATH_PENDING)
+        return false;
+
+    N_ReleasePath(ticket);
+    kh_del(ticket, s_repath_table, k);
+    return (status == PATH_READY);
 }
 
-void N_RenderPathFlowField(void *nav_private, const struct map *map, 
-                           mat4x4_t *chunk_model, int chunk_r, int chunk_c, 
-                           dest_id_t id)
+static void n_chain_init(struct field_chain *chain, struct mem_arena *arena)
 {
-    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
-    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    chain->window = s_flow_window;
+    chain->budget = s_flow_budget_ms * SDL_GetPerformanceFrequency() / 1000.0f;
+    chain->spent = 0;
+    chain->depth = 0;
+    chain->dist = arena_alloc(arena, sizeof(float[FIELD_RES_R][FIELD_RES_C]));
+    chain->scratch = arena_alloc(arena, sizeof(float[FIELD_RES_R][FIELD_RES_C]));
+
+    if(!chain->dist || !chain->scratch)
+        chain->window = 0;
+}
 
-    const struct nav_private *priv = nav_private;
-    assert(chunk_r < priv->height);
-    assert(chunk_c < priv->width);
+/* Returns true if the field for 'target' can be carried on from the last one 
+ * built, which must be for the chunk across the target portal */
+static bool n_chain_carries(const struct field_chain *chain, struct field_target target)
+{
+    if(chain->window < 2 || chain->depth == 0 || chain->depth >= chain->window)
+        return false;
+    if(target.type != TARGET_PORTAL)
+        return false;
+    if(chain->spent >= chain->budget)
+        return false;
 
-    vec2_t positions_buff[FIELD_RES_R * FIELD_RES_C];
-    vec2_t dirs_buff[FIELD_RES_R * FIELD_RES_C];
+    struct coord next = target.port->connected->chunk;
+    return (next.r == chain->chunk.r && next.c == chain->chunk.c);
+}
 
-    ff_id_t field_id;
-    if(!N_FC_ContainsFlowField(id, (struct coord){chunk_r, chunk_c}, &field_id))
+static void n_chain_build(struct field_chain *chain, const struct nav_chunk *chunk, 
+                          struct coord chunk_coord, struct field_target target, 
+                          bool carry, struct flow_field *inout)
+{
+    if(chain->window < 2) {
+        N_FlowFieldUpdate(chunk, target, n_integration_method(chunk), inout);
         return;
-    const struct flow_field *ff = N_FC_FlowFieldAt(id, (struct coord){chunk_r, chunk_c});
-
-    for(int r = 0; r < FIELD_RES_R; r++) {
-        for(int c = 0; c < FIELD_RES_C; c++) {
+    }
 
-            /* Subtract EPSILON to make sure every coordinate is strictly within the map bounds */
-            float square_x_len = (1.0f / FIELD_RES_C) * chunk_x_dim - EPSILON;
-            float square_z_len = (1.0f / FIELD_RES_R) * chunk_z_dim - EPSILON;
-            float square_x = -(((float)c) / FIELD_RES_C) * chunk_x_dim;
-            float square_z =  (((float)r) / FIELD_RES_R) * chunk_z_dim;
+    uint64_t start = SDL_GetPerformanceCounter();
+    N_FlowFieldChain(chunk, target, n_integration_method(chunk), 
+        carry ? (const float (*)[FIELD_RES_C])chain->dist : NULL, inout, chain->scratch);
 
-            positions_buff[r * FIELD_RES_C + c] = (vec2_t){
-                square_x - square_x_len / 2.0f,
-                square_z + square_z_len / 2.0f
-            };
-            dirs_buff[r * FIELD_RES_C + c] = g_flow_dir_lookup[ff->field[r][c].dir_idx];
-        }
-    }
+    float (*tmp)[FIELD_RES_C] = chain->dist;
+    chain->dist = chain->scratch;
+    chain->scratch = tmp;
 
-    R_GL_DrawFlowField(positions_buff, dirs_buff, FIELD_RES_R * FIELD_RES_C, chunk_model, map);
+    chain->chunk = chunk_coord;
+    chain->depth = carry ? chain->depth + 1 : 1;
+    chain->spent += SDL_GetPerformanceCounter() - start;
 }
 
-void N_RenderLOSField(void *nav_private, const struct map *map, mat4x4_t *chunk_model, 
-                      int chunk_r, int chunk_c, dest_id_t id)
+/* Copy the cached fields for steering from 'chunk' into the result. Returns 
+ * false if there is no cached flow field for the chunk. */
+static bool n_seed_chunk(struct path_result *res, dest_id_t id, struct coord chunk)
 {
-    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
-    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    ff_id_t ffid;
+    dest_id_t key = n_flow_key(id, chunk);
 
-    const struct nav_private *priv = nav_private;
-    assert(chunk_r < priv->height);
-    assert(chunk_c < priv->width);
+    if(!N_FC_ContainsFlowField(key, chunk, &ffid))
+        return false;
+    n_path_set_flow_field(res, chunk, ffid, N_FC_FlowFieldAt(key, chunk));
 
-    vec2_t corners_buff[4 * FIELD_RES_R * FIELD_RES_C];
-    vec3_t colors_buff[FIELD_RES_R * FIELD_RES_C];
-    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+    if(N_FC_ContainsLOSField(id, chunk))
+        *n_path_new_los_field(res, chunk) = *N_FC_LOSFieldAt(id, chunk);
+    return true;
+}
 
-    if(!N_FC_ContainsLOSField(id, (struct coord){chunk_r, chunk_c}))
-        return;
+static bool n_field_steers_from(const struct flow_field *ff, const struct portal *port)
+{
+    int r = (port->endpoints[0].r + port->endpoints[1].r) / 2;
+    int c = (port->endpoints[0].c + port->endpoints[1].c) / 2;
+    return (N_FlowDirAt(ff, r, c) != FD_NONE);
+}
 
-    const struct LOS_field *lf = N_FC_LOSFieldAt(id, (struct coord){chunk_r, chunk_c});
-    assert(lf);
+/* Record the sequence of chunks the portal path passes through. Consecutive 
+ * chunks in the corridor are always adjacent. */
+static void n_path_corridor(struct path_result *res, struct tile_desc src_desc, 
+                            struct tile_desc dst_desc, const portal_vec_t *path)
+{
+    struct coord curr = (struct coord){src_desc.chunk_r, src_desc.chunk_c};
+    kv_push(struct coord, res->corridor, curr);
+
+    for(int i = 0; i < sv_size(*path); i++) {
+
+        struct coord next = sv_A(*path, i)->chunk;
+        if(next.r == curr.r && next.c == curr.c)
+            continue;
+        kv_push(struct coord, res->corridor, next);
+        curr = next;
+    }
+
+    if(curr.r != dst_desc.chunk_r || curr.c != dst_desc.chunk_c)
+        kv_push(struct coord, res->corridor, ((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}));
+}
+
+static bool n_component_reachable(const struct nav_private *priv, struct tile_desc src_desc, 
+                                  uint32_t component)
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)];
+    struct coord src = (struct coord){src_desc.tile_r, src_desc.tile_c};
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(port->component != component)
+            continue;
+
+        struct coord center = (struct coord){
+            (port->endpoints[0].r + port->endpoints[1].r) / 2,
+            (port->endpoints[0].c + port->endpoints[1].c) / 2,
+        };
+        if(AStar_TilesLinked(src, center, chunk))
+            return true;
+    }
+    return false;
+}
+
+static struct tile_desc n_dest_tile(dest_id_t id)
+{
+    return (struct tile_desc){
+        (id >> 20) & 0xff,
+        (id >> 12) & 0xff,
+        (id >>  6) & 0x3f,
+        (id >>  0) & 0x3f,
+    };
+}
+
+static vec2_t n_tile_center(struct map_resolution res, vec3_t map_pos, struct tile_desc desc)
+{
+    struct box bounds = M_Tile_Bounds(res, map_pos, desc);
+    return (vec2_t){
+        bounds.x - bounds.width / 2.0f,
+        bounds.z + bounds.height / 2.0f
+    };
+}
+
+static void n_prefetch_chunk(struct nav_private *priv, dest_id_t id, struct coord chunk, 
+                             vec2_t xz_src, vec2_t xz_dest, vec3_t map_pos)
+{
+    /* A request that is already in flight must be polled until it completes */
+    khiter_t k = kh_get(ticket, s_repath_table, n_dest_chunk_key(id, chunk));
+    if(k == kh_end(s_repath_table) && N_FC_FieldsResident(n_flow_key(id, chunk), id, chunk))
+        return;
+
+    n_fields_ready(priv, id, chunk, xz_src, xz_dest, map_pos);
+}
+
+/* Make sure the fields for the chunks a unit is about to enter are built before 
+ * it gets there, so that crossing into them does not stall on a missing field. 
+ * This is the next chunk of the corridor recorded for the destination, as well 
+ * as the chunk across the nearest border, since units steering directly towards 
+ * a destination in sight may leave the corridor. */
+static void n_prefetch_ahead(struct nav_private *priv, dest_id_t id, struct tile_desc tile, 
+                             vec2_t curr_pos, vec3_t map_pos)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc dst_desc = n_dest_tile(id);
+    vec2_t xz_dest = n_tile_center(res, map_pos, dst_desc);
+
+    struct coord chunk = (struct coord){tile.chunk_r, tile.chunk_c};
+    struct coord next;
+    bool has_next = N_FC_NextChunk(n_flow_key(id, chunk), chunk, &next);
+    if(has_next)
+        n_prefetch_chunk(priv, id, next, curr_pos, xz_dest, map_pos);
+
+    const int dists[4] = {tile.tile_r, FIELD_RES_R - 1 - tile.tile_r, tile.tile_c, FIELD_RES_C - 1 - tile.tile_c};
+    const int drs[4] = {-1, 1, 0, 0};
+    const int dcs[4] = {0, 0, -1, 1};
+
+    int nearest = 0;
+    for(int i = 1; i < ARR_SIZE(dists); i++) {
+        if(dists[i] < dists[nearest])
+            nearest = i;
+    }
+    if(dists[nearest] >= PREFETCH_DIST)
+        return;
+
+    struct tile_desc across = tile;
+    int delta = dists[nearest] + 1;
+    if(!M_Tile_RelativeDesc(res, &across, dcs[nearest] * delta, drs[nearest] * delta))
+        return;
+
+    struct coord across_chunk = (struct coord){across.chunk_r, across.chunk_c};
+    if(has_next && next.r == across_chunk.r && next.c == across_chunk.c)
+        return;
+
+    khiter_t k = kh_get(ticket, s_repath_table, n_dest_chunk_key(id, across_chunk));
+    if(k == kh_end(s_repath_table)) {
+
+        if(N_FC_FieldsResident(n_flow_key(id, across_chunk), id, across_chunk))
+            return;
+
+        /* Don't keep making requests that are bound to fail */
+        const struct portal *dst_port = AStar_ReachablePortal((struct coord){dst_desc.tile_r, dst_desc.tile_c}, 
+            &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)]);
+        if(!dst_port || !n_component_reachable(priv, across, dst_port->component))
+            return;
+    }
+
+    n_fields_ready(priv, id, across_chunk, n_tile_center(res, map_pos, across), xz_dest, map_pos);
+}
+
+/* Until the fields of its' chunk are ready, a unit heads for the centre of the 
+ * portal out of the chunk which looks to be on the way: the one it can reach 
+ * which makes for the shortest straight-line trip to the destination. This is 
+ * only a guess, but it gets the unit going while the path is being computed. */
+static vec2_t n_portal_steer(const struct nav_private *priv, dest_id_t id, struct tile_desc tile,
+                             vec2_t curr_pos, vec2_t xz_dest, vec3_t map_pos)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    const struct nav_chunk *chunk = &priv->chunks[IDX(tile.chunk_r, priv->width, tile.chunk_c)];
+    uint16_t island = chunk->islands[tile.tile_r][tile.tile_c];
+    if(island == ISLAND_NONE)
+        return (vec2_t){0.0f};
+
+    struct tile_desc dst_desc = n_dest_tile(id);
+    const struct nav_chunk *dst_chunk = &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)];
+    struct coord dst_tile = (struct coord){dst_desc.tile_r, dst_desc.tile_c};
+    vec2_t target;
+
+    if(tile.chunk_r == dst_desc.chunk_r && tile.chunk_c == dst_desc.chunk_c
+    && dst_chunk->islands[dst_tile.r][dst_tile.c] == island) {
+
+        target = xz_dest;
+    }else{
+
+        const struct portal *dst_port = AStar_ReachablePortal(dst_tile, dst_chunk);
+        if(!dst_port)
+            return (vec2_t){0.0f};
+
+        float best = INFINITY;
+        for(int i = 0; i < chunk->num_portals; i++) {
+
+            const struct portal *port = &chunk->portals[i];
+            if(port->island != island || port->component != dst_port->component)
+                continue;
+
+            struct tile_desc center = tile;
+            center.tile_r = (port->endpoints[0].r + port->endpoints[1].r) / 2;
+            center.tile_c = (port->endpoints[0].c + port->endpoints[1].c) / 2;
+
+            /* Already there - step across into the next chunk */
+            if(center.tile_r == tile.tile_r && center.tile_c == tile.tile_c && port->connected) {
+                center.chunk_r = port->connected->chunk.r;
+                center.chunk_c = port->connected->chunk.c;
+                center.tile_r = (port->connected->endpoints[0].r + port->connected->endpoints[1].r) / 2;
+                center.tile_c = (port->connected->endpoints[0].c + port->connected->endpoints[1].c) / 2;
+            }
+
+            vec2_t xz_center = n_tile_center(res, map_pos, center);
+            vec2_t to_center, to_dest;
+            PFM_Vec2_Sub(&xz_center, &curr_pos, &to_center);
+            PFM_Vec2_Sub(&xz_dest, &xz_center, &to_dest);
+
+            float dist = PFM_Vec2_Len(&to_center) + PFM_Vec2_Len(&to_dest);
+            if(dist < best) {
+                best = dist;
+                target = xz_center;
+            }
+        }
+        if(best == INFINITY)
+            return (vec2_t){0.0f};
+    }
+
+    vec2_t ret;
+    PFM_Vec2_Sub(&target, &curr_pos, &ret);
+    if(PFM_Vec2_Len(&ret) < EPSILON)
+        return (vec2_t){0.0f};
+
+    PFM_Vec2_Normal(&ret, &ret);
+    return ret;
+}
+
+/* Commit and release the background requests which have completed, including 
+ * the ones made ahead of time that nobody is polling. */
+static void n_on_update_start(void *unused1, void *unused2)
+{
+    N_PS_NewFrame();
+
+    for(khiter_t k = kh_begin(s_repath_table); k != kh_end(s_repath_table); k++) {
+
+        if(!kh_exist(s_repath_table, k))
+            continue;
+
+        path_ticket_t ticket = kh_value(s_repath_table, k);
+        if(N_PollPath(ticket) == PATH_PENDING)
+            continue;
+
+        N_ReleasePath(ticket);
+        kh_del(ticket, s_repath_table, k);
+    }
+}
+
+static void n_clear_repath_table(void)
+{
+    path_ticket_t ticket;
+    kh_foreach_value(s_repath_table, ticket, {
+        N_ReleasePath(ticket);
+    });
+    kh_clear(ticket, s_repath_table);
+}
+
+/* Update the blocker counts of all the tiles with centers inside the blocker's 
+ * circle, as well as the tile under its' center. The counts saturate rather than 
+ * wrap around. A saturated count has lost track of the increments past it, so it 
+ * stays saturated. */
+static void n_apply_blocker_change(struct nav_private *priv, const struct blocker_change *change, 
+                                   bool *inout_touched)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc center;
+    if(!M_Tile_DescForPoint2D(res, change->map_pos, change->xz_pos, &center))
+        return;
+
+    int rad_r = ceil(change->radius / FIELD_TILE_Z_DIM);
+    int rad_c = ceil(change->radius / FIELD_TILE_X_DIM);
+
+    for(int dr = -rad_r; dr <= rad_r; dr++) {
+        for(int dc = -rad_c; dc <= rad_c; dc++) {
+
+            struct tile_desc desc = center;
+            if(!M_Tile_RelativeDesc(res, &desc, dc, dr))
+                continue;
+
+            vec2_t tile_center = n_tile_center(res, change->map_pos, desc);
+            vec2_t xz_pos = change->xz_pos;
+            vec2_t delta;
+            PFM_Vec2_Sub(&tile_center, &xz_pos, &delta);
+            if((dr || dc) && PFM_Vec2_Len(&delta) > change->radius)
+                continue;
+
+            size_t idx = IDX(desc.chunk_r, priv->width, desc.chunk_c);
+            struct nav_chunk *chunk = &priv->chunks[idx];
+            uint8_t *count = &chunk->blockers[desc.tile_r][desc.tile_c];
+
+            if(change->delta > 0) {
+                if(*count == UINT8_MAX)
+                    continue;
+                if((*count)++ == 0)
+                    chunk->num_blocked++;
+            }else{
+                if(*count == 0 || *count == UINT8_MAX)
+                    continue;
+                if(--(*count) == 0)
+                    chunk->num_blocked--;
+            }
+            inout_touched[idx] = true;
+        }
+    }
+}
+
+static void n_patch_flow_field(void *arg, ff_id_t id, struct flow_field *inout, 
+                               struct ff_integration *inout_integration)
+{
+    const struct nav_private *priv = arg;
+    const struct nav_chunk *chunk = &priv->chunks[IDX(inout->chunk.r, priv->width, inout->chunk.c)];
+    struct field_target target;
+
+    /* The fields of all the layers are cached together */
+    if(N_FlowField_Layer(id) != priv->layer)
+        return;
+    if(!N_FlowField_Target(id, chunk, &target))
+        return;
+
+    /* Only the tiles which can reach the target are overwritten, so the 
+     * directions for any other islands merged into the field are kept. The 
+     * first patch of a field rebuilds it, and the later ones only repair the 
+     * tiles around the changed blockers. */
+    N_FlowFieldRepair(chunk, target, n_integration_method(chunk), inout_integration, inout);
+}
+
+static void n_update_portals(struct nav_private *priv)
+{
+    /* Only the dirty chunks and their direct neighbours (which share an edge, and 
+     * so portals, with a dirty chunk) need to be updated. */
+    bool any_dirty = false;
+    for(int i = 0; i < priv->width * priv->height; i++)
+        any_dirty |= priv->chunks[i].dirty;
+
+    if(!any_dirty)
+        return;
+
+    /* The chunks are left dirty, to be updated on the next call */
+    bool *affected = MEM_Malloc(MEM_TAG_NAV, priv->width * priv->height * sizeof(bool));
+    if(!affected)
+        return;
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
+        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
+            affected[IDX(chunk_r, priv->width, chunk_c)] = n_chunk_affected(priv, chunk_r, chunk_c);
+        }
+    }
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
+        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
+            
+            if(!affected[IDX(chunk_r, priv->width, chunk_c)])
+                continue;
+
+            struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+            n_remove_dirty_portals(priv, curr_chunk);
+        }
+    }
+    
+    n_create_portals(priv);
+
+    struct link_job job = (struct link_job){
+        .priv     = priv,
+        .affected = affected,
+    };
+    PL_For(priv->width * priv->height, n_link_task, &job);
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
+        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
+            
+            if(!affected[IDX(chunk_r, priv->width, chunk_c)])
+                continue;
+            N_FC_InvalidateChunk((struct coord){chunk_r, chunk_c});
+        }
+    }
+
+    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
+        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
+            priv->chunks[IDX(chunk_r, priv->width, chunk_c)].dirty = false;
+        }
+    }
+
+    N_CL_Update(priv, affected);
+    n_update_components(priv);
+    MEM_Free(affected);
+
+    priv->version++;
+    priv->portal_version++;
+}
+
+static void n_update_blockers(struct nav_private *priv)
+{
+    if(kv_size(priv->blocker_changes) == 0)
+        return;
+
+    /* The changes are kept around until the next call */
+    bool *touched = MEM_Calloc(MEM_TAG_NAV, priv->height * priv->width, sizeof(bool));
+    if(!touched)
+        return;
+
+    for(int i = 0; i < kv_size(priv->blocker_changes); i++)
+        n_apply_blocker_change(priv, &kv_A(priv->blocker_changes, i), touched);
+    kv_size(priv->blocker_changes) = 0;
+    priv->version++;
+
+    /* The blockers don't change the portals or the reachability of any tiles, so 
+     * there is no need to drop the cached fields. Only the cached flow fields of the 
+     * changed chunks are re-integrated in place. The LOS fields only depend on the 
+     * impassable tiles and are left untouched. */
+    for(int r = 0; r < priv->height; r++) {
+        for(int c = 0; c < priv->width; c++) {
+
+            if(!touched[IDX(r, priv->width, c)])
+                continue;
+            N_FC_PatchChunkFlowFields((struct coord){r, c}, n_patch_flow_field, priv);
+        }
+    }
+    MEM_Free(touched);
+}
+
+/* Chebyshev distance (in tiles) from every tile of the map to the nearest impassable 
+ * tile of the base layer, saturating at UINT8_MAX. This is a two-pass distance 
+ * transform over the whole map, so that obstacles are seen across chunk borders. */
+static void n_clearance_field(const struct nav_private *base, uint8_t *out)
+{
+    const int rows = base->height * FIELD_RES_R;
+    const int cols = base->width * FIELD_RES_C;
+
+    for(int r = 0; r < rows; r++) {
+        for(int c = 0; c < cols; c++) {
+
+            const struct nav_chunk *chunk = &base->chunks[IDX(r / FIELD_RES_R, base->width, c / FIELD_RES_C)];
+            out[IDX(r, cols, c)] = (chunk->cost_base[r % FIELD_RES_R][c % FIELD_RES_C] == COST_IMPASSABLE) 
+                                 ? 0 : UINT8_MAX;
+        }
+    }
+
+    /* Propagate the distances downwards and to the right... */
+    for(int r = 0; r < rows; r++) {
+        for(int c = 0; c < cols; c++) {
+
+            unsigned dist = out[IDX(r, cols, c)];
+            if(r > 0) {
+                if(c > 0)
+                    dist = MIN(dist, out[IDX(r - 1, cols, c - 1)] + 1u);
+                dist = MIN(dist, out[IDX(r - 1, cols, c)] + 1u);
+                if(c < cols - 1)
+                    dist = MIN(dist, out[IDX(r - 1, cols, c + 1)] + 1u);
+            }
+            if(c > 0)
+                dist = MIN(dist, out[IDX(r, cols, c - 1)] + 1u);
+            out[IDX(r, cols, c)] = dist;
+        }
+    }
+
+    /* ...then upwards and to the left */
+    for(int r = rows - 1; r >= 0; r--) {
+        for(int c = cols - 1; c >= 0; c--) {
+
+            unsigned dist = out[IDX(r, cols, c)];
+            if(r < rows - 1) {
+                if(c < cols - 1)
+                    dist = MIN(dist, out[IDX(r + 1, cols, c + 1)] + 1u);
+                dist = MIN(dist, out[IDX(r + 1, cols, c)] + 1u);
+                if(c > 0)
+                    dist = MIN(dist, out[IDX(r + 1, cols, c - 1)] + 1u);
+            }
+            if(c < cols - 1)
+                dist = MIN(dist, out[IDX(r, cols, c + 1)] + 1u);
+            out[IDX(r, cols, c)] = dist;
+        }
+    }
+}
+
+/* Derive the cost field of a layer from the base layer. Tiles closer to an obstacle 
+ * than the layer's clearance become impassable. */
+static void n_make_layer(struct nav_private *priv, const struct nav_private *base, 
+                         const uint8_t *clearance)
+{
+    const int cols = base->width * FIELD_RES_C;
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        struct nav_chunk *chunk = &priv->chunks[i];
+        const struct nav_chunk *base_chunk = &base->chunks[i];
+        int r_base = (i / priv->width) * FIELD_RES_R;
+        int c_base = (i % priv->width) * FIELD_RES_C;
+
+        chunk->num_portals = 0;
+        chunk->dirty = true;
+        memset(chunk->blockers, 0, sizeof(chunk->blockers));
+        chunk->num_blocked = 0;
+
+        for(int r = 0; r < FIELD_RES_R; r++) {
+            for(int c = 0; c < FIELD_RES_C; c++) {
+
+                chunk->cost_base[r][c] = (clearance[IDX(r_base + r, cols, c_base + c)] <= priv->layer) 
+                                       ? COST_IMPASSABLE : base_chunk->cost_base[r][c];
+            }
+        }
+    }
+}
+
+/* Make a tile impassable in every layer. In the higher layers, the tiles around it 
+ * are made impassable as well, matching the way the layers are built. */
+/* The global row and column ranges of the tiles under the OBB's XZ bounds, 
+ * grown by 'margin' tiles on every side, and not clamped to the map */
+static void n_obb_tile_range(const struct obb *obb, vec3_t map_pos, int margin,
+                             int *out_rmin, int *out_rmax, int *out_cmin, int *out_cmax)
+{
+    float x_min = obb->corners[0].x, x_max = obb->corners[0].x;
+    float z_min = obb->corners[0].z, z_max = obb->corners[0].z;
+    for(int i = 1; i < 8; i++) {
+        x_min = MIN(x_min, obb->corners[i].x);
+        x_max = MAX(x_max, obb->corners[i].x);
+        z_min = MIN(z_min, obb->corners[i].z);
+        z_max = MAX(z_max, obb->corners[i].z);
+    }
+
+    /* X increases towards the left, so the columns go the other way */
+    *out_cmin = floorf((map_pos.x - x_max) / FIELD_TILE_X_DIM) - margin;
+    *out_cmax = floorf((map_pos.x - x_min) / FIELD_TILE_X_DIM) + margin;
+    *out_rmin = floorf((z_min - map_pos.z) / FIELD_TILE_Z_DIM) - margin;
+    *out_rmax = floorf((z_max - map_pos.z) / FIELD_TILE_Z_DIM) + margin;
+}
+
+/* Makes the tile impassable, along with the tiles around it in the layers 
+ * for larger units. Only the tiles of the chunk are touched, so that the 
+ * chunks may be cut out in parallel. */
+static void n_cutout_tile_in_chunk(struct nav_layers *layers, int r, int c, 
+                                   int chunk_r, int chunk_c)
+{
+    const int r_base = chunk_r * FIELD_RES_R, c_base = chunk_c * FIELD_RES_C;
+
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+
+        struct nav_private *priv = layers->layers[i];
+        struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+
+        int rmin = MAX(r - i, r_base), rmax = MIN(r + i, r_base + FIELD_RES_R - 1);
+        int cmin = MAX(c - i, c_base), cmax = MIN(c + i, c_base + FIELD_RES_C - 1);
+
+        for(int rr = rmin; rr <= rmax; rr++) {
+            for(int cc = cmin; cc <= cmax; cc++) {
+                chunk->cost_base[rr - r_base][cc - c_base] = COST_IMPASSABLE;
+                chunk->dirty = true;
+            }
+        }
+    }
+}
+
+/* Cuts out the tiles under the bottom face of the OBB: the ones crossed by 
+ * its' outline, and the ones with their centers inside it. Only the tiles 
+ * within reach of the chunk are visited. */
+static void n_cutout_obb_in_chunk(struct nav_layers *layers, vec3_t map_pos, 
+                                  const struct obb *obb, int chunk_r, int chunk_c)
+{
+    struct nav_private *priv = layers->layers[NAV_LAYER_GROUND_1X1];
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+    const int margin = NAV_LAYER_MAX - 1;
+    const int win_rmin = chunk_r * FIELD_RES_R - margin, win_rmax = (chunk_r + 1) * FIELD_RES_R - 1 + margin;
+    const int win_cmin = chunk_c * FIELD_RES_C - margin, win_cmax = (chunk_c + 1) * FIELD_RES_C - 1 + margin;
+
+    /* Corners ordered to make a loop */
+    vec2_t corners[4] = {
+        (vec2_t){obb->corners[0].x, obb->corners[0].z},
+        (vec2_t){obb->corners[1].x, obb->corners[1].z},
+        (vec2_t){obb->corners[5].x, obb->corners[5].z},
+        (vec2_t){obb->corners[4].x, obb->corners[4].z},
+    };
+
+    struct tile_desc descs[MAX_TILES_PER_LINE];
+    for(int i = 0; i < 4; i++) {
+
+        struct line_seg_2d seg = (struct line_seg_2d){
+            corners[i].x, corners[i].y, 
+            corners[(i + 1) % 4].x, corners[(i + 1) % 4].y
+        };
+        size_t num_tiles = M_Tile_LineSupercoverTilesSorted(res, map_pos, seg, descs);
+
+        for(int j = 0; j < num_tiles; j++) {
+
+            int r = descs[j].chunk_r * FIELD_RES_R + descs[j].tile_r;
+            int c = descs[j].chunk_c * FIELD_RES_C + descs[j].tile_c;
+            if(r < win_rmin || r > win_rmax || c < win_cmin || c > win_cmax)
+                continue;
+            n_cutout_tile_in_chunk(layers, r, c, chunk_r, chunk_c);
+        }
+    }
+
+    int rmin, rmax, cmin, cmax;
+    n_obb_tile_range(obb, map_pos, 0, &rmin, &rmax, &cmin, &cmax);
+    rmin = MAX(rmin, MAX(win_rmin, 0));
+    rmax = MIN(rmax, MIN(win_rmax, priv->height * FIELD_RES_R - 1));
+    cmin = MAX(cmin, MAX(win_cmin, 0));
+    cmax = MIN(cmax, MIN(win_cmax, priv->width * FIELD_RES_C - 1));
+
+    for(int r = rmin; r <= rmax; r++) {
+        for(int c = cmin; c <= cmax; c++) {
+
+            vec2_t center = (vec2_t){
+                map_pos.x - (c + 0.5f) * FIELD_TILE_X_DIM,
+                map_pos.z + (r + 0.5f) * FIELD_TILE_Z_DIM,
+            };
+            if(C_PointInsideRect2D(center, corners[0], corners[1], corners[2], corners[3]))
+                n_cutout_tile_in_chunk(layers, r, c, chunk_r, chunk_c);
+        }
+    }
+}
+
+/* The chunks within reach of the OBB, or false if it's outside the map */
+static bool n_obb_chunk_range(const struct nav_private *priv, const struct obb *obb, vec3_t map_pos,
+                              int *out_rmin, int *out_rmax, int *out_cmin, int *out_cmax)
+{
+    int rmin, rmax, cmin, cmax;
+    n_obb_tile_range(obb, map_pos, NAV_LAYER_MAX - 1, &rmin, &rmax, &cmin, &cmax);
+
+    if(rmax < 0 || cmax < 0 
+    || rmin >= (int)priv->height * FIELD_RES_R 
+    || cmin >= (int)priv->width * FIELD_RES_C)
+        return false;
+
+    *out_rmin = MAX(rmin, 0) / FIELD_RES_R;
+    *out_rmax = MIN(rmax, (int)priv->height * FIELD_RES_R - 1) / FIELD_RES_R;
+    *out_cmin = MAX(cmin, 0) / FIELD_RES_C;
+    *out_cmax = MIN(cmax, (int)priv->width * FIELD_RES_C - 1) / FIELD_RES_C;
+    return true;
+}
+
+static void n_cutout_obb_serial(struct nav_layers *layers, vec3_t map_pos, const struct obb *obb)
+{
+    struct nav_private *priv = layers->layers[NAV_LAYER_GROUND_1X1];
+
+    int rmin, rmax, cmin, cmax;
+    if(!n_obb_chunk_range(priv, obb, map_pos, &rmin, &rmax, &cmin, &cmax))
+        return;
+
+    for(int r = rmin; r <= rmax; r++)
+        for(int c = cmin; c <= cmax; c++)
+            n_cutout_obb_in_chunk(layers, map_pos, obb, r, c);
+}
+
+static void n_cutout_task(void *arg, size_t idx)
+{
+    const struct cutout_job *job = arg;
+    struct nav_private *priv = job->layers->layers[NAV_LAYER_GROUND_1X1];
+
+    for(size_t i = job->bin_offsets[idx]; i < job->bin_offsets[idx + 1]; i++) {
+        n_cutout_obb_in_chunk(job->layers, job->map_pos, &job->obbs[job->bins[i]], 
+                              idx / priv->width, idx % priv->width);
+    }
+}
+
+/* Bins the OBBs by the chunks they may touch and cuts out every chunk in a 
+ * task of its' own. Returns false if the bins could not be allocated. */
+static bool n_cutout_binned(struct nav_layers *layers, vec3_t map_pos, 
+                            size_t count, const struct obb *obbs)
+{
+    struct nav_private *priv = layers->layers[NAV_LAYER_GROUND_1X1];
+    const size_t num_chunks = priv->width * priv->height;
+
+    size_t *bin_offsets = calloc(num_chunks + 2, sizeof(size_t));
+    if(!bin_offsets)
+        goto fail_offsets;
+
+    /* Count the entries of every bin, then fill them in */
+    for(uint32_t i = 0; i < count; i++) {
+
+        int rmin, rmax, cmin, cmax;
+        if(!n_obb_chunk_range(priv, &obbs[i], map_pos, &rmin, &rmax, &cmin, &cmax))
+            continue;
+
+        for(int r = rmin; r <= rmax; r++)
+            for(int c = cmin; c <= cmax; c++)
+                bin_offsets[IDX(r, priv->width, c) + 2]++;
+    }
+    for(int i = 0; i < num_chunks; i++)
+        bin_offsets[i + 2] += bin_offsets[i + 1];
+
+    uint32_t *bins = malloc((bin_offsets[num_chunks + 1] + 1) * sizeof(uint32_t));
+    if(!bins)
+        goto fail_bins;
+
+    /* 'bin_offsets[i+1]' is the insertion point of bin 'i' as it is being 
+     * filled in, and ends up as the start of bin 'i+1' */
+    for(uint32_t i = 0; i < count; i++) {
+
+        int rmin, rmax, cmin, cmax;
+        if(!n_obb_chunk_range(priv, &obbs[i], map_pos, &rmin, &rmax, &cmin, &cmax))
+            continue;
+
+        for(int r = rmin; r <= rmax; r++)
+            for(int c = cmin; c <= cmax; c++)
+                bins[bin_offsets[IDX(r, priv->width, c) + 1]++] = i;
+    }
+
+    struct cutout_job job = (struct cutout_job){
+        .layers      = layers,
+        .map_pos     = map_pos,
+        .obbs        = obbs,
+        .bin_offsets = bin_offsets,
+        .bins        = bins,
+    };
+    PL_For(num_chunks, n_cutout_task, &job);
+
+    free(bins);
+    free(bin_offsets);
+    return true;
+
+fail_bins:
+    free(bin_offsets);
+fail_offsets:
+    return false;
+}
+
+static struct nav_private *n_alloc_layer(enum nav_layer layer, size_t w, size_t h)
+{
+    struct nav_private *ret = MEM_Malloc(MEM_TAG_NAV, sizeof(struct nav_private) + (w * h * sizeof(struct nav_chunk)));
+    if(!ret)
+        return NULL;
+
+    ret->layer = layer;
+    ret->width = w;
+    ret->height = h;
+    ret->version = 0;
+    ret->portal_version = 0;
+    ret->snapshot = NULL;
+    kv_init(ret->blocker_changes);
+
+    if(!N_CL_Init(ret)) {
+        MEM_Free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+static void n_free_layer(struct nav_private *priv)
+{
+    N_PS_Discard(priv);
+    N_SN_Drop(priv);
+    kv_destroy(priv->blocker_changes);
+    N_CL_Destroy(priv);
+    MEM_Free(priv);
+}
+
+/* Like 'M_Tile_DescForPoint2D', but returns false for the points outside of 
+ * the field instead of asserting, as the points passed in by scripts may be 
+ * anywhere. */
+static bool n_desc_for_point(const struct nav_private *priv, vec3_t map_pos, 
+                             vec2_t xz, struct tile_desc *out)
+{
+    float c = floorf((map_pos.x - xz.raw[0]) / FIELD_TILE_X_DIM);
+    float r = floorf((xz.raw[1] - map_pos.z) / FIELD_TILE_Z_DIM);
+
+    /* Written so that NaNs fail the test */
+    if(!(c >= 0.0f && c < priv->width * FIELD_RES_C))
+        return false;
+    if(!(r >= 0.0f && r < priv->height * FIELD_RES_R))
+        return false;
+
+    *out = (struct tile_desc){
+        .chunk_r = (int)r / FIELD_RES_R, .chunk_c = (int)c / FIELD_RES_C,
+        .tile_r  = (int)r % FIELD_RES_R, .tile_c  = (int)c % FIELD_RES_C,
+    };
+    return true;
+}
+
+static const struct nav_chunk *n_desc_chunk(const struct nav_private *priv, struct tile_desc desc)
+{
+    return &priv->chunks[IDX(desc.chunk_r, priv->width, desc.chunk_c)];
+}
+
+static uint16_t n_desc_island(const struct nav_private *priv, struct tile_desc desc)
+{
+    return n_desc_chunk(priv, desc)->islands[desc.tile_r][desc.tile_c];
+}
+
+/* All the portals on an island of a chunk are linked to each other, so they 
+ * share the same component. Returns false if no portals lead off the island. */
+static bool n_island_component(const struct nav_chunk *chunk, uint16_t island, 
+                               uint32_t *out)
+{
+    for(int i = 0; i < chunk->num_portals; i++) {
+        if(chunk->portals[i].island == island) {
+            *out = chunk->portals[i].component;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool n_path_exists(const struct nav_private *priv, struct tile_desc src, 
+                          struct tile_desc dst)
+{
+    uint16_t src_island = n_desc_island(priv, src);
+    uint16_t dst_island = n_desc_island(priv, dst);
+    if(src_island == ISLAND_NONE || dst_island == ISLAND_NONE)
+        return false;
+
+    if(src.chunk_r == dst.chunk_r && src.chunk_c == dst.chunk_c
+    && src_island == dst_island)
+        return true;
+
+    uint32_t src_comp, dst_comp;
+    if(!n_island_component(n_desc_chunk(priv, src), src_island, &src_comp))
+        return false;
+    if(!n_island_component(n_desc_chunk(priv, dst), dst_island, &dst_comp))
+        return false;
+    return (src_comp == dst_comp);
+}
+
+/* The cheapest portal to leave the destination's island by, when walking 
+ * backwards from the destination tile. Along with the cost of reaching the 
+ * destination from it, this is the last leg of every path from outside. */
+static const struct portal *n_cheapest_exit(const struct nav_private *priv, 
+                                            struct tile_desc dst, float *out_cost)
+{
+    const struct nav_chunk *chunk = n_desc_chunk(priv, dst);
+    uint16_t island = chunk->islands[dst.tile_r][dst.tile_c];
+
+    const struct portal *candidates[MAX_PORTALS_PER_CHUNK];
+    struct coord centers[MAX_PORTALS_PER_CHUNK];
+    float costs[MAX_PORTALS_PER_CHUNK];
+    size_t num_candidates = 0;
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        if(port->island != island)
+            continue;
+        candidates[num_candidates] = port;
+        centers[num_candidates] = (struct coord){
+            (port->endpoints[0].r + port->endpoints[1].r) / 2,
+            (port->endpoints[0].c + port->endpoints[1].c) / 2,
+        };
+        num_candidates++;
+    }
+
+    if(!num_candidates)
+        return NULL;
+
+    AStar_GridCosts((struct coord){dst.tile_r, dst.tile_c}, chunk->cost_base, 
+        num_candidates, centers, costs);
+
+    const struct portal *ret = NULL;
+    *out_cost = INFINITY;
+    for(int i = 0; i < num_candidates; i++) {
+        if(costs[i] < *out_cost) {
+            *out_cost = costs[i];
+            ret = candidates[i];
+        }
+    }
+    return ret;
+}
+
+static float n_path_cost(const struct nav_private *priv, struct tile_desc src, 
+                         struct tile_desc dst, const struct portal *exit, float exit_cost)
+{
+    if(src.chunk_r == dst.chunk_r && src.chunk_c == dst.chunk_c
+    && n_desc_island(priv, src) == n_desc_island(priv, dst)) {
+
+        coord_vec_t path;
+        sv_init(path);
+        float cost;
+        bool found = AStar_GridPath((struct coord){src.tile_r, src.tile_c},
+            (struct coord){dst.tile_r, dst.tile_c}, n_desc_chunk(priv, src)->cost_base, 
+            &path, &cost);
+        sv_destroy(path);
+        return found ? cost : INFINITY;
+    }
+
+    if(!exit)
+        return INFINITY;
+
+    portal_vec_t path;
+    sv_init(path);
+    float cost;
+    bool found = AStar_PortalGraphPath(src, exit, priv, &path, &cost);
+    sv_destroy(path);
+    return found ? cost + exit_cost : INFINITY;
+}
+
+static bool n_tile_passable(const struct nav_private *priv, int r, int c)
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(r / FIELD_RES_R, priv->width, c / FIELD_RES_C)];
+    return chunk->cost_base[r % FIELD_RES_R][c % FIELD_RES_C] != COST_IMPASSABLE;
+}
+
+/* Walks the navigation tiles along the segment, in order, stopping at the 
+ * first impassable one. The walk is done in the field's (column, row) space, 
+ * where every tile is a unit square. Passing diagonally between two impassable 
+ * tiles counts as a hit, same as for the islands. */
+static bool n_raycast(const struct nav_private *priv, vec3_t map_pos, 
+                      vec2_t xz_src, vec2_t xz_dest, vec2_t *out_pos)
+{
+    const int nrows = priv->height * FIELD_RES_R;
+    const int ncols = priv->width * FIELD_RES_C;
+
+    struct tile_desc src;
+    if(!n_desc_for_point(priv, map_pos, xz_src, &src)) {
+        *out_pos = xz_src;
+        return true;
+    }
+
+    float c0 = (map_pos.x - xz_src.raw[0]) / FIELD_TILE_X_DIM;
+    float r0 = (xz_src.raw[1] - map_pos.z) / FIELD_TILE_Z_DIM;
+    float dc = (map_pos.x - xz_dest.raw[0]) / FIELD_TILE_X_DIM - c0;
+    float dr = (xz_dest.raw[1] - map_pos.z) / FIELD_TILE_Z_DIM - r0;
+
+    int c = src.chunk_c * FIELD_RES_C + src.tile_c;
+    int r = src.chunk_r * FIELD_RES_R + src.tile_r;
+    int c_end = floorf(c0 + dc), r_end = floorf(r0 + dr);
+
+    int step_c = (dc > 0.0f) - (dc < 0.0f);
+    int step_r = (dr > 0.0f) - (dr < 0.0f);
+    /* Fraction of the segment to cross a whole tile, and to reach the next 
+     * tile boundary along each axis */
+    float delta_c = step_c ? fabsf(1.0f / dc) : INFINITY;
+    float delta_r = step_r ? fabsf(1.0f / dr) : INFINITY;
+    float next_c = step_c > 0 ? (c + 1 - c0) * delta_c 
+                 : step_c < 0 ? (c0 - c) * delta_c : INFINITY;
+    float next_r = step_r > 0 ? (r + 1 - r0) * delta_r 
+                 : step_r < 0 ? (r0 - r) * delta_r : INFINITY;
+
+    float t = 0.0f;
+    bool hit = !n_tile_passable(priv, r, c);
+
+    while(!hit && (c != c_end || r != r_end)) {
+
+        if(next_c == next_r) {
+
+            bool side_c = (c + step_c >= 0 && c + step_c < ncols) && n_tile_passable(priv, r, c + step_c);
+            bool side_r = (r + step_r >= 0 && r + step_r < nrows) && n_tile_passable(priv, r + step_r, c);
+            t = next_c;
+            c += step_c;
+            r += step_r;
+            next_c += delta_c;
+            next_r += delta_r;
+            hit = !side_c && !side_r;
+        }else if(next_c < next_r) {
+            t = next_c;
+            c += step_c;
+            next_c += delta_c;
+        }else{
+            t = next_r;
+            r += step_r;
+            next_r += delta_r;
+        }
+
+        if(t > 1.0f)
+            break;
+        if(c < 0 || c >= ncols || r < 0 || r >= nrows || !n_tile_passable(priv, r, c))
+            hit = true;
+    }
+
+    if(hit) {
+        *out_pos = (vec2_t){
+            map_pos.x - (c0 + dc * t) * FIELD_TILE_X_DIM,
+            map_pos.z + (r0 + dr * t) * FIELD_TILE_Z_DIM
+        };
+    }
+    return hit;
+}
+
+static void n_waypoint_entry_clear(struct waypoint_entry *entry)
+{
+    for(int i = 0; i < entry->num_paths; i++)
+        kv_destroy(entry->paths[i].points);
+    entry->num_paths = 0;
+    entry->next = 0;
+}
+
+static void n_clear_waypoint_cache(void)
+{
+    for(khiter_t k = kh_begin(s_waypoint_cache); k != kh_end(s_waypoint_cache); k++) {
+        if(!kh_exist(s_waypoint_cache, k))
+            continue;
+        n_waypoint_entry_clear(&kh_value(s_waypoint_cache, k));
+    }
+    kh_clear(waypoints, s_waypoint_cache);
+}
+
+/* Append the centers of the tiles on the cheapest path between two tiles of 
+ * a chunk, not including the first one. If there is no such path, only the 
+ * center of the last tile is appended. */
+static void n_waypoint_leg(const struct nav_private *priv, vec3_t map_pos, struct coord chunk,
+                           struct coord from, struct coord to, vec2_vec_t *inout)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    coord_vec_t path;
+    sv_init(path);
+    float cost;
+
+    const struct nav_chunk *nchunk = &priv->chunks[IDX(chunk.r, priv->width, chunk.c)];
+    if(!AStar_GridPath(from, to, nchunk->cost_base, &path, &cost)) {
+        struct tile_desc desc = (struct tile_desc){chunk.r, chunk.c, to.r, to.c};
+        kv_push(vec2_t, *inout, n_tile_center(res, map_pos, desc));
+        sv_destroy(path);
+        return;
+    }
+
+    for(int i = 0; i < sv_size(path); i++) {
+        struct coord tile = sv_A(path, i);
+        if(tile.r == from.r && tile.c == from.c)
+            continue;
+        struct tile_desc desc = (struct tile_desc){chunk.r, chunk.c, tile.r, tile.c};
+        kv_push(vec2_t, *inout, n_tile_center(res, map_pos, desc));
+    }
+    sv_destroy(path);
+}
+
+/* Pull the path through the points taut: a point is only kept if the 
+ * straight line from the last kept point to the one following it is 
+ * blocked. The first point is the source and is not output. */
+static void n_waypoint_pull(const struct nav_private *priv, vec3_t map_pos, 
+                            const vec2_vec_t *points, vec2_vec_t *out)
+{
+    size_t anchor = 0;
+    size_t i = 1;
+
+    while(i < kv_size(*points)) {
+
+        vec2_t hit_pos;
+        if(!n_raycast(priv, map_pos, kv_A(*points, anchor), kv_A(*points, i), &hit_pos)) {
+            i++;
+            continue;
+        }
+
+        /* Neighbouring points which aren't in sight of each other (when passing 
+         * diagonally between two obstacles) are both kept */
+        size_t keep = (i - 1 > anchor) ? i - 1 : i;
+        kv_push(vec2_t, *out, kv_A(*points, keep));
+        anchor = keep;
+        i = keep + 1;
+    }
+
+    if(kv_size(*points) > 1 && anchor != kv_size(*points) - 1)
+        kv_push(vec2_t, *out, kv_A(*points, kv_size(*points) - 1));
+}
+
+/* Find a path from the source to the destination through the tiles of the 
+ * chunks on the portal path, and pull it taut. Only the chunks on the portal 
+ * path are searched, so no fields are needed. */
+static bool n_waypoint_path(const struct nav_private *priv, vec3_t map_pos, 
+                            vec2_t xz_src, vec2_t xz_dest, struct tile_desc src_desc, 
+                            struct tile_desc dst_desc, vec2_vec_t *out)
+{
+    if(!n_path_exists(priv, src_desc, dst_desc))
+        return false;
+
+    vec2_t hit_pos;
+    if(!n_raycast(priv, map_pos, xz_src, xz_dest, &hit_pos)) {
+        kv_push(vec2_t, *out, xz_dest);
+        return true;
+    }
+
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    vec2_vec_t points;
+    kv_init(points);
+    kv_push(vec2_t, points, xz_src);
+
+    bool ret = false;
+    struct coord curr_chunk = (struct coord){src_desc.chunk_r, src_desc.chunk_c};
+    struct coord curr_tile = (struct coord){src_desc.tile_r, src_desc.tile_c};
+    struct coord dst_chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+
+    if(curr_chunk.r != dst_chunk.r || curr_chunk.c != dst_chunk.c
+    || n_desc_island(priv, src_desc) != n_desc_island(priv, dst_desc)) {
+
+        float exit_cost, cost;
+        const struct portal *exit = n_cheapest_exit(priv, dst_desc, &exit_cost);
+        if(!exit)
+            goto out;
+
+        portal_vec_t path;
+        sv_init(path);
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        bool found = AStar_PortalGraphPath(src_desc, exit, priv, &path, &cost);
+        n_perf_record(STAGE_PORTAL_SEARCH, start);
+        if(!found) {
+            sv_destroy(path);
+            goto out;
+        }
+
+        /* Consecutive portals are either in the same chunk, or on the two 
+         * sides of a chunk border */
+        for(int i = 0; i < sv_size(path); i++) {
+
+            const struct portal *port = sv_A(path, i);
+            const struct portal *entry = port;
+            if(port->chunk.r != curr_chunk.r || port->chunk.c != curr_chunk.c) {
+                if(port->connected)
+                    entry = port->connected;
+            }
+
+            if(entry->chunk.r == curr_chunk.r && entry->chunk.c == curr_chunk.c)
+                n_waypoint_leg(priv, map_pos, curr_chunk, curr_tile, n_portal_center(entry), &points);
+
+            curr_chunk = port->chunk;
+            curr_tile = n_portal_center(port);
+            if(entry != port) {
+                struct tile_desc desc = (struct tile_desc){curr_chunk.r, curr_chunk.c, curr_tile.r, curr_tile.c};
+                kv_push(vec2_t, points, n_tile_center(res, map_pos, desc));
+            }
+        }
+        sv_destroy(path);
+    }
+
+    n_waypoint_leg(priv, map_pos, curr_chunk, curr_tile, 
+        (struct coord){dst_desc.tile_r, dst_desc.tile_c}, &points);
+    kv_push(vec2_t, points, xz_dest);
+
+    n_waypoint_pull(priv, map_pos, &points, out);
+    ret = (kv_size(*out) > 0);
+
+out:
+    kv_destroy(points);
+    return ret;
+}
+
+/* Look for a cached path to the destination which can be joined from the 
+ * source by heading straight for one of its' points. The point nearest to 
+ * the end of the path which is in sight is joined at, unless the source is 
+ * already past it - closer to the point following it than it is. Doubling 
+ * back to the path would be a detour, so a new path is searched instead. */
+static bool n_waypoint_cached(const struct nav_private *priv, vec3_t map_pos, dest_id_t id, 
+                              vec2_t xz_src, vec2_vec_t *out)
+{
+    khiter_t k = kh_get(waypoints, s_waypoint_cache, id);
+    if(k == kh_end(s_waypoint_cache))
+        return false;
+
+    struct waypoint_entry *entry = &kh_value(s_waypoint_cache, k);
+    for(int i = 0; i < entry->num_paths; i++) {
+
+        const struct waypoint_path *path = &entry->paths[i];
+        if(path->portal_version != priv->portal_version)
+            continue;
+
+        for(int j = kv_size(path->points) - 1; j >= 0; j--) {
+
+            vec2_t hit_pos;
+            if(n_raycast(priv, map_pos, xz_src, kv_A(path->points, j), &hit_pos))
+                continue;
+
+            if(j + 1 < kv_size(path->points)) {
+
+                vec2_t to_src, to_point;
+                PFM_Vec2_Sub(&kv_A(path->points, j + 1), &xz_src, &to_src);
+                PFM_Vec2_Sub(&kv_A(path->points, j + 1), &kv_A(path->points, j), &to_point);
+                if(PFM_Vec2_Len(&to_src) < PFM_Vec2_Len(&to_point))
+                    break;
+            }
+
+            for(int k = j; k < kv_size(path->points); k++)
+                kv_push(vec2_t, *out, kv_A(path->points, k));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void n_waypoint_cache_add(const struct nav_private *priv, dest_id_t id, 
+                                 const vec2_vec_t *points)
+{
+    int ret;
+    khiter_t k = kh_get(waypoints, s_waypoint_cache, id);
+
+    if(k == kh_end(s_waypoint_cache)) {
+
+        if(kh_size(s_waypoint_cache) >= WAYPOINT_CACHE_DESTS)
+            n_clear_waypoint_cache();
+
+        k = kh_put(waypoints, s_waypoint_cache, id, &ret);
+        if(ret == -1)
+            return;
+        kh_value(s_waypoint_cache, k) = (struct waypoint_entry){0};
+    }
+
+    struct waypoint_entry *entry = &kh_value(s_waypoint_cache, k);
+    struct waypoint_path *path = &entry->paths[entry->next];
+    if(entry->next == entry->num_paths) {
+        kv_init(path->points);
+        entry->num_paths++;
+    }
+    entry->next = (entry->next + 1) % WAYPOINT_CACHE_PATHS;
+
+    path->portal_version = priv->portal_version;
+    kv_reset(path->points);
+    for(int i = 0; i < kv_size(*points); i++)
+        kv_push(vec2_t, path->points, kv_A(*points, i));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_Init(void)
+{
+    if(!AStar_Init())
+        goto fail_astar;
+
+    if(!N_FC_Init())
+        goto fail_fc;
+
+    if(!N_PS_Init())
+        goto fail_ps;
+
+    if(NULL == (s_repath_table = kh_init(ticket)))
+        goto fail_repath;
+
+    if(NULL == (s_waypoint_cache = kh_init(waypoints)))
+        goto fail_waypoints;
+
+    E_Global_Register(EVENT_UPDATE_START, n_on_update_start, NULL);
+    return true;
+
+fail_waypoints:
+    kh_destroy(ticket, s_repath_table);
+fail_repath:
+    N_PS_Shutdown();
+fail_ps:
+    N_FC_Shutdown();
+fail_fc:
+    AStar_Shutdown();
+fail_astar:
+    return false;
+}
+
+void N_Shutdown(void)
+{
+    E_Global_Unregister(EVENT_UPDATE_START, n_on_update_start);
+    n_clear_repath_table();
+    kh_destroy(ticket, s_repath_table);
+    s_repath_table = NULL;
+    n_clear_waypoint_cache();
+    kh_destroy(waypoints, s_waypoint_cache);
+    s_waypoint_cache = NULL;
+
+    N_PS_Shutdown();
+    N_FC_Shutdown();
+    AStar_Shutdown();
+}
+
+void *N_BuildForMapData(size_t w, size_t h, 
+                        size_t chunk_w, size_t chunk_h,
+                        const struct tile **chunk_tiles)
+{
+    struct nav_layers *ret;
+    uint8_t *clearance;
+    int num_layers = 0;
+
+    ret = malloc(sizeof(struct nav_layers));
+    if(!ret)
+        goto fail_alloc;
+
+    clearance = malloc(w * FIELD_RES_C * h * FIELD_RES_R);
+    if(!clearance)
+        goto fail_clearance;
+
+    for(; num_layers < NAV_LAYER_MAX; num_layers++) {
+        if(!(ret->layers[num_layers] = n_alloc_layer(num_layers, w, h)))
+            goto fail_layers;
+    }
+
+    assert(FIELD_RES_R >= chunk_h && FIELD_RES_R % chunk_h == 0);
+    assert(FIELD_RES_C >= chunk_w && FIELD_RES_C % chunk_w == 0);
+
+    /* First build the base cost field based on terrain */
+    struct nav_private *base = ret->layers[NAV_LAYER_GROUND_1X1];
+    struct build_job job = (struct build_job){
+        .priv        = base,
+        .chunk_tiles = chunk_tiles,
+        .chunk_w     = chunk_w,
+        .chunk_h     = chunk_h,
+    };
+    PL_For(w * h, n_build_task, &job);
+
+    /* The cost fields of all the other layers are derived from it */
+    n_clearance_field(base, clearance);
+    for(int i = NAV_LAYER_GROUND_1X1 + 1; i < NAV_LAYER_MAX; i++)
+        n_make_layer(ret->layers[i], base, clearance);
+    free(clearance);
+
+    for(int i = 0; i < NAV_LAYER_MAX; i++)
+        n_update_portals(ret->layers[i]);
+    return ret;
+
+fail_layers:
+    while(num_layers-- > 0)
+        n_free_layer(ret->layers[num_layers]);
+    free(clearance);
+fail_clearance:
+    free(ret);
+fail_alloc:
+    return NULL;
+}
+
+void *N_LoadForMapData(size_t w, size_t h, 
+                       size_t chunk_w, size_t chunk_h,
+                       const struct tile **chunk_tiles, const char *path)
+{
+    struct nav_layers *ret;
+    SDL_RWops *stream;
+    int num_layers = 0;
+
+    ret = malloc(sizeof(struct nav_layers));
+    if(!ret)
+        goto fail_alloc;
+
+    stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        goto fail_stream;
+
+    uint64_t hash = N_NF_TilesHash(w, h, chunk_w, chunk_h, chunk_tiles);
+    for(; num_layers < NAV_LAYER_MAX; num_layers++) {
+        if(!(ret->layers[num_layers] = N_NF_Read(stream, w, h, num_layers, hash)))
+            goto fail_read;
+    }
+
+    /* Reject files with anything following the last layer */
+    if(SDL_RWtell(stream) != SDL_RWsize(stream))
+        goto fail_read;
+
+    SDL_RWclose(stream);
+    return ret;
+
+fail_read:
+    while(num_layers-- > 0)
+        n_free_layer(ret->layers[num_layers]);
+    SDL_RWclose(stream);
+fail_stream:
+    free(ret);
+fail_alloc:
+    return NULL;
+}
+
+bool N_SaveForMapData(void *nav_private, size_t chunk_w, size_t chunk_h,
+                      const struct tile **chunk_tiles, const char *path)
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *base = layers->layers[NAV_LAYER_GROUND_1X1];
+    uint64_t hash = N_NF_TilesHash(base->width, base->height, chunk_w, chunk_h, chunk_tiles);
+
+    /* Write to a temporary file first, so that a partially written file 
+     * never replaces a good one */
+    char tmp_path[512];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+        return false;
+
+    SDL_RWops *stream = SDL_RWFromFile(tmp_path, "wb");
+    if(!stream)
+        return false;
+
+    bool ret = true;
+    for(int i = 0; ret && i < NAV_LAYER_MAX; i++)
+        ret = N_NF_Write(layers->layers[i], hash, stream);
+    ret = (0 == SDL_RWclose(stream)) && ret;
+
+    return file_replace(path, tmp_path, ret);
+}
+
+void N_FreePrivate(void *nav_private)
+{
+    assert(nav_private);
+    struct nav_layers *layers = nav_private;
+
+    /* The navigation subsystem may already have been shut down */
+    if(s_repath_table)
+        n_clear_repath_table();
+    /* The destination IDs will be reused by the next map */
+    if(s_waypoint_cache)
+        n_clear_waypoint_cache();
+
+    for(int i = 0; i < NAV_LAYER_MAX; i++)
+        n_free_layer(layers->layers[i]);
+    free(layers);
+}
+
+void N_RenderPathableChunk(void *nav_private, mat4x4_t *chunk_model,
+                           const struct map *map, int chunk_r, int chunk_c,
+                           enum nav_layer layer)
+{
+    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    const struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+    assert(chunk_r < priv->height);
+    assert(chunk_c < priv->width);
+
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+    n_render_portals(chunk, chunk_model, map);
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    vec2_t *corners_buff = arena_alloc(arena, 4 * FIELD_RES_R * FIELD_RES_C * sizeof(vec2_t));
+    vec3_t *colors_buff = arena_alloc(arena, FIELD_RES_R * FIELD_RES_C * sizeof(vec3_t));
+    if(!corners_buff || !colors_buff) {
+        arena_rewind(arena, mark);
+        return;
+    }
+
+    vec2_t *corners_base = corners_buff;
+    vec3_t *colors_base = colors_buff; 
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            /* Subtract EPSILON to make sure every coordinate is strictly within the map bounds */
+            float square_x_len = (1.0f / FIELD_RES_C) * chunk_x_dim - EPSILON;
+            float square_z_len = (1.0f / FIELD_RES_R) * chunk_z_dim - EPSILON;
+            float square_x = -(((float)c) / FIELD_RES_C) * chunk_x_dim;
+            float square_z =  (((float)r) / FIELD_RES_R) * chunk_z_dim;
+
+            *corners_base++ = (vec2_t){square_x, square_z};
+            *corners_base++ = (vec2_t){square_x, square_z + square_z_len};
+            *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
+            *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
+
+            *colors_base++ = chunk->cost_base[r][c] == COST_IMPASSABLE ? (vec3_t){1.0f, 0.0f, 0.0f}
+                                                                       : (vec3_t){0.0f, 1.0f, 0.0f};
+        }
+    }
+
+    assert(colors_base == colors_buff + FIELD_RES_R * FIELD_RES_C);
+    assert(corners_base == corners_buff + 4 * FIELD_RES_R * FIELD_RES_C);
+    R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, FIELD_RES_R * FIELD_RES_C, chunk_model, map);
+
+    arena_rewind(arena, mark);
+}
+
+void N_RenderPathFlowField(void *nav_private, const struct map *map, 
+                           mat4x4_t *chunk_model, int chunk_r, int chunk_c, 
+                           dest_id_t id)
+{
+    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    const struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[n_dest_layer(id)];
+    assert(chunk_r < priv->height);
+    assert(chunk_c < priv->width);
+
+    ff_id_t field_id;
+    struct coord chunk = (struct coord){chunk_r, chunk_c};
+    if(!N_FC_ContainsFlowField(n_flow_key(id, chunk), chunk, &field_id))
+        return;
+    const struct flow_field *ff = N_FC_FlowFieldAt(n_flow_key(id, chunk), chunk);
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    vec2_t *positions_buff = arena_alloc(arena, FIELD_RES_R * FIELD_RES_C * sizeof(vec2_t));
+    vec2_t *dirs_buff = arena_alloc(arena, FIELD_RES_R * FIELD_RES_C * sizeof(vec2_t));
+    if(!positions_buff || !dirs_buff) {
+        arena_rewind(arena, mark);
+        return;
+    }
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+        for(int c = 0; c < FIELD_RES_C; c++) {
+
+            /* Subtract EPSILON to make sure every coordinate is strictly within the map bounds */
+            float square_x_len = (1.0f / FIELD_RES_C) * chunk_x_dim - EPSILON;
+            float square_z_len = (1.0f / FIELD_RES_R) * chunk_z_dim - EPSILON;
+            float square_x = -(((float)c) / FIELD_RES_C) * chunk_x_dim;
+            float square_z =  (((float)r) / FIELD_RES_R) * chunk_z_dim;
+
+            positions_buff[r * FIELD_RES_C + c] = (vec2_t){
+                square_x - square_x_len / 2.0f,
+                square_z + square_z_len / 2.0f
+            };
+            dirs_buff[r * FIELD_RES_C + c] = g_flow_dir_lookup[N_FlowDirAt(ff, r, c)];
+        }
+    }
+
+    R_GL_DrawFlowField(positions_buff, dirs_buff, FIELD_RES_R * FIELD_RES_C, chunk_model, map);
+
+    arena_rewind(arena, mark);
+}
+
+void N_RenderLOSField(void *nav_private, const struct map *map, mat4x4_t *chunk_model, 
+                      int chunk_r, int chunk_c, dest_id_t id)
+{
+    const float chunk_x_dim = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float chunk_z_dim = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+
+    const struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[n_dest_layer(id)];
+    assert(chunk_r < priv->height);
+    assert(chunk_c < priv->width);
+
+    const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
+
+    if(!N_FC_ContainsLOSField(id, (struct coord){chunk_r, chunk_c}))
+        return;
+
+    const struct LOS_field *lf = N_FC_LOSFieldAt(id, (struct coord){chunk_r, chunk_c});
+    assert(lf);
+
+    struct mem_arena *arena = MEM_ScratchArena();
+    if(!arena)
+        return;
+    struct arena_mark mark = arena_mark(arena);
+
+    vec2_t *corners_buff = arena_alloc(arena, 4 * FIELD_RES_R * FIELD_RES_C * sizeof(vec2_t));
+    vec3_t *colors_buff = arena_alloc(arena, FIELD_RES_R * FIELD_RES_C * sizeof(vec3_t));
+    if(!corners_buff || !colors_buff) {
+        arena_rewind(arena, mark);
+        return;
+    }
 
     vec2_t *corners_base = corners_buff;
     vec3_t *colors_base = colors_buff; 
@@ -693,137 +2602,179 @@ void N_RenderLOSField(void *nav_private, const struct map *map, mat4x4_t *chunk_
             *corners_base++ = (vec2_t){square_x - square_x_len, square_z + square_z_len};
             *corners_base++ = (vec2_t){square_x - square_x_len, square_z};
 
-            *colors_base++ = lf->field[r][c].visible ? (vec3_t){1.0f, 1.0f, 0.0f}
+            *colors_base++ = N_LOSVisible(lf, r, c) ? (vec3_t){1.0f, 1.0f, 0.0f}
                                                      : (vec3_t){0.0f, 0.0f, 0.0f};
         }
     }
 
-    assert(colors_base == colors_buff + ARR_SIZE(colors_buff));
-    assert(corners_base == corners_buff + ARR_SIZE(corners_buff));
+    assert(colors_base == colors_buff + FIELD_RES_R * FIELD_RES_C);
+    assert(corners_base == corners_buff + 4 * FIELD_RES_R * FIELD_RES_C);
     R_GL_DrawMapOverlayQuads(corners_buff, colors_buff, FIELD_RES_R * FIELD_RES_C, chunk_model, map);
+
+    arena_rewind(arena, mark);
 }
 
 void N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *obb)
 {
-    struct nav_private *priv = nav_private;
-    struct map_resolution res = {
-        priv->width, priv->height,
-        FIELD_RES_C, FIELD_RES_R
-    };
+    N_CutoutStaticObjects(nav_private, map_pos, 1, obb);
+}
 
-    /* Corners ordered to make a loop */
-    vec3_t bot_corners[4] = {obb->corners[0], obb->corners[1], obb->corners[5], obb->corners[4]};
-    vec2_t bot_corners_2d[4] = {
-        (vec2_t){bot_corners[0].x, bot_corners[0].z},
-        (vec2_t){bot_corners[1].x, bot_corners[1].z},
-        (vec2_t){bot_corners[2].x, bot_corners[2].z},
-        (vec2_t){bot_corners[3].x, bot_corners[3].z},
-    };
-    struct line_seg_2d xz_line_segs[4] = {
-        (struct line_seg_2d){bot_corners[0].x, bot_corners[0].z, bot_corners[1].x, bot_corners[1].z},
-        (struct line_seg_2d){bot_corners[1].x, bot_corners[1].z, bot_corners[2].x, bot_corners[2].z},
-        (struct line_seg_2d){bot_corners[2].x, bot_corners[2].z, bot_corners[3].x, bot_corners[3].z},
-        (struct line_seg_2d){bot_corners[3].x, bot_corners[3].z, bot_corners[0].x, bot_corners[0].z},
-    };
+void N_CutoutStaticObjects(void *nav_private, vec3_t map_pos, size_t count, const struct obb *obbs)
+{
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[NAV_LAYER_GROUND_1X1];
 
-    struct row_desc min_rows[4], max_rows[4];
-    struct col_desc min_cols[4], max_cols[4];
+    if(count == 0)
+        return;
 
-    /* For each line segment of the bottom face of the OBB, find the supercover (set of all tiles which
-     * intersect the line segment) and update their cost. Keep track of the top-most, bottom-most,
-     * left-most and right-most tiles of the outline.
-     */
-    struct tile_desc descs[MAX_TILES_PER_LINE];
-    for(int i = 0; i < ARR_SIZE(xz_line_segs); i++) {
+    if(!n_cutout_binned(layers, map_pos, count, obbs)) {
+        /* Fall back to cutting them out one by one */
+        for(size_t i = 0; i < count; i++)
+            n_cutout_obb_serial(layers, map_pos, &obbs[i]);
+    }
 
-        min_rows[i] = (struct row_desc){0,0};
-        max_rows[i] = (struct row_desc){priv->height-1, FIELD_RES_R-1};
-        min_cols[i] = (struct col_desc){0,0};
-        max_cols[i] = (struct col_desc){priv->width-1, FIELD_RES_C-1};
+    /* Don't wait for N_UpdatePortals to drop the fields of the changed chunks, 
+     * in case any paths are requested in the meantime. */
+    for(int i = 0; i < priv->width * priv->height; i++) {
 
-        size_t num_tiles = M_Tile_LineSupercoverTilesSorted(res, map_pos, xz_line_segs[i], descs);
-        for(int j = 0; j < num_tiles; j++) {
+        bool dirty = false;
+        for(int j = 0; j < NAV_LAYER_MAX; j++)
+            dirty |= layers->layers[j]->chunks[i].dirty;
+        if(dirty)
+            N_FC_InvalidateChunk((struct coord){i / priv->width, i % priv->width});
+    }
 
-            priv->chunks[IDX(descs[j].chunk_r, priv->width, descs[j].chunk_c)]
-                .cost_base[descs[j].tile_r][descs[j].tile_c] = COST_IMPASSABLE;
+    /* The fields of the jobs which ran against the old costs are stale as well */
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        layers->layers[i]->version++;
+        layers->layers[i]->portal_version++;
+    }
+}
 
-            if(HIGHER(descs[j], min_rows[i]))
-                min_rows[i] = (struct row_desc){descs[j].chunk_r, descs[j].tile_r};
+void N_UpdatePortals(void *nav_private)
+{
+    struct nav_layers *layers = nav_private;
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        n_update_portals(layers->layers[i]);
+        N_PS_Publish(layers->layers[i]);
+    }
+}
 
-            if(LOWER(descs[j], max_rows[i]))
-                max_rows[i] = (struct row_desc){descs[j].chunk_r, descs[j].tile_r};
+void N_BlockersIncref(void *nav_private, vec3_t map_pos, vec2_t xz_pos, float radius)
+{
+    struct nav_layers *layers = nav_private;
+    struct blocker_change change = (struct blocker_change){map_pos, xz_pos, radius, 1};
+    for(int i = 0; i < NAV_LAYER_MAX; i++)
+        kv_push(struct blocker_change, layers->layers[i]->blocker_changes, change);
+}
 
-            if(MORE_LEFT(descs[j], max_cols[i]))
-                min_cols[i] = (struct col_desc){descs[j].chunk_c, descs[j].tile_c};
+void N_BlockersDecref(void *nav_private, vec3_t map_pos, vec2_t xz_pos, float radius)
+{
+    struct nav_layers *layers = nav_private;
+    struct blocker_change change = (struct blocker_change){map_pos, xz_pos, radius, -1};
+    for(int i = 0; i < NAV_LAYER_MAX; i++)
+        kv_push(struct blocker_change, layers->layers[i]->blocker_changes, change);
+}
 
-            if(MORE_RIGHT(descs[j], max_cols[i]))
-                max_cols[i] = (struct col_desc){descs[j].chunk_c, descs[j].tile_c};
-        }
+void N_UpdateBlockers(void *nav_private)
+{
+    struct nav_layers *layers = nav_private;
+    for(int i = 0; i < NAV_LAYER_MAX; i++) {
+        n_update_blockers(layers->layers[i]);
+        N_PS_Publish(layers->layers[i]);
     }
+}
 
-    struct row_desc min_row = MIN_ROW_4(min_rows[0], min_rows[1], min_rows[2], min_rows[3]);
-    struct row_desc max_row = MAX_ROW_4(max_rows[0], max_rows[1], max_rows[2], max_rows[3]);
+void N_InvalidateChunkFields(void *nav_private, int chunk_r, int chunk_c)
+{
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[NAV_LAYER_GROUND_1X1];
 
-    struct col_desc min_col = MIN_COL_4(min_cols[0], min_cols[1], min_cols[2], min_cols[3]);
-    struct col_desc max_col = MAX_COL_4(max_cols[0], max_cols[1], max_cols[2], max_cols[3]);
+    assert(chunk_r >= 0 && chunk_r < priv->height);
+    assert(chunk_c >= 0 && chunk_c < priv->width);
 
-    /* Now iterate over the square region of tiles defined by the extrema of the outline 
-     * and check whether the tiles of this box fall within the OBB and should have their
-     * cost updated. 
-     */
-    for(int r = min_row.chunk_r * FIELD_RES_R + min_row.tile_r; 
-            r < max_row.chunk_r * FIELD_RES_R + max_row.tile_r; r++) {
-        for(int c = min_col.chunk_c * FIELD_RES_C + min_col.tile_c; 
-                c < max_col.chunk_c * FIELD_RES_C + max_col.tile_c; c++) {
+    N_FC_InvalidateChunk((struct coord){chunk_r, chunk_c});
+}
 
-            struct tile_desc desc = {
-                .chunk_r = r / FIELD_RES_R,
-                .chunk_c = c / FIELD_RES_C,
-                .tile_r  = r % FIELD_RES_R,
-                .tile_c  = c % FIELD_RES_C,
-            };
-            struct box bounds = M_Tile_Bounds(res, map_pos, desc);
-            vec2_t center = (vec2_t){
-                bounds.x - bounds.width/2.0f,
-                bounds.z + bounds.height/2.0f
-            };
+void N_SetCacheBudget(size_t bytes)
+{
+    N_FC_SetBudget(bytes);
+}
 
-            if(C_PointInsideRect2D(center, bot_corners_2d[0], bot_corners_2d[1], 
-                                               bot_corners_2d[2], bot_corners_2d[3])) {
-                priv->chunks[IDX(desc.chunk_r, priv->width, desc.chunk_c)]
-                    .cost_base[desc.tile_r][desc.tile_c] = COST_IMPASSABLE;
-            }
-        }
-    }
+void N_SetFlowWindow(int chunks, float budget_ms)
+{
+    s_flow_window = MAX(chunks, 0);
+    s_flow_budget_ms = MAX(budget_ms, 0.0f);
 }
 
-void N_UpdatePortals(void *nav_private)
+void N_SetGoalRegion(int tiles)
 {
-    struct nav_private *priv = nav_private;
+    s_goal_region = MIN(MAX(tiles, 0), MIN(FIELD_RES_R, FIELD_RES_C));
+}
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
-        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
-            
-            struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-            curr_chunk->num_portals = 0;
-        }
-    }
-    
-    n_create_portals(priv);
+void N_SetDeterministic(bool on)
+{
+    N_PS_SetSynchronous(on);
+}
 
-    for(int chunk_r = 0; chunk_r < priv->height; chunk_r++){
-        for(int chunk_c = 0; chunk_c < priv->width; chunk_c++){
-            
-            struct nav_chunk *curr_chunk = &priv->chunks[IDX(chunk_r, priv->width, chunk_c)];
-            n_link_chunk_portals(curr_chunk);
-        }
-    }
+void N_SetPathBudget(float ms)
+{
+    N_PS_SetBudget(ms);
 }
 
-bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
-                   vec3_t map_pos, dest_id_t *out_dest_id)
+void N_SetPathFocus(vec2_t xz)
+{
+    N_PS_SetFocus(xz);
+}
+
+void N_GetCacheStats(struct nav_cache_stats *out)
+{
+    N_FC_GetStats(out);
+}
+
+void N_GetPerfStats(struct nav_perf_stats *out)
+{
+    uint64_t count[STAGE_MAX], ticks[STAGE_MAX];
+
+    SDL_AtomicLock(&s_perf_lock);
+    memcpy(count, s_perf_count, sizeof(count));
+    memcpy(ticks, s_perf_ticks, sizeof(ticks));
+    SDL_AtomicUnlock(&s_perf_lock);
+
+    *out = (struct nav_perf_stats){
+        .portal_searches  = count[STAGE_PORTAL_SEARCH],
+        .flow_fields      = count[STAGE_FLOW_FIELD],
+        .los_fields       = count[STAGE_LOS_FIELD],
+        .waypoint_paths   = count[STAGE_WAYPOINTS],
+        .portal_search_us = n_ticks_to_us(ticks[STAGE_PORTAL_SEARCH]),
+        .flow_field_us    = n_ticks_to_us(ticks[STAGE_FLOW_FIELD]),
+        .los_field_us     = n_ticks_to_us(ticks[STAGE_LOS_FIELD]),
+        .waypoint_us      = n_ticks_to_us(ticks[STAGE_WAYPOINTS]),
+    };
+}
+
+void N_PathResultInit(struct path_result *result)
+{
+    result->success = false;
+    result->dest_id = 0;
+    kv_init(result->flow);
+    kv_init(result->los);
+    kv_init(result->corridor);
+}
+
+void N_PathResultDestroy(struct path_result *result)
+{
+    kv_destroy(result->flow);
+    kv_destroy(result->los);
+    kv_destroy(result->corridor);
+    kv_init(result->flow);
+    kv_init(result->los);
+    kv_init(result->corridor);
+}
+
+void N_PathCompute(const struct nav_private *priv, vec2_t xz_src, vec2_t xz_dest, 
+                   vec3_t map_pos, bool use_cache, struct path_result *out)
 {
-    struct nav_private *priv = nav_private;
     struct map_resolution res = {
         priv->width, priv->height,
         FIELD_RES_C, FIELD_RES_R
@@ -837,11 +2788,23 @@ bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest,
     result = M_Tile_DescForPoint2D(res, map_pos, xz_dest, &dst_desc);
     assert(result);
 
-    dest_id_t ret = n_dest_id(dst_desc);
+    dest_id_t ret = n_dest_id(priv, dst_desc);
+    out->dest_id = ret;
+    out->success = false;
+    size_t corridor_base = kv_size(out->corridor);
+
+    struct field_chain chain = {0};
+    struct arena_mark mark;
+    struct mem_arena *arena = (s_flow_window > 1) ? MEM_ScratchArena() : NULL;
+    if(arena) {
+        mark = arena_mark(arena);
+        n_chain_init(&chain, arena);
+    }
 
     /* Generate the flow field for the destination chunk, if necessary */
     ff_id_t id;
-    if(!N_FC_ContainsFlowField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, &id)){
+    struct coord dst_chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+    if(!n_path_flow_field(out, use_cache, dst_chunk, &id)){
 
         struct field_target target = (struct field_target){
             .type = TARGET_TILE,
@@ -850,19 +2813,22 @@ bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest,
 
         const struct nav_chunk *chunk = &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)];
         struct flow_field ff;
-        id = N_FlowField_ID((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, target);
+        id = N_FlowField_ID(priv->layer, dst_chunk, target);
 
-        N_FlowFieldInit((struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, priv, &ff);
-        N_FlowFieldUpdate(chunk, target, &ff);
-        N_FC_SetFlowField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, id, &ff);
+        uint64_t start = SDL_GetPerformanceCounter();
+        N_FlowFieldInit(dst_chunk, priv, &ff);
+        n_chain_build(&chain, chunk, dst_chunk, target, false, &ff);
+        n_perf_record(STAGE_FLOW_FIELD, start);
+        n_path_set_flow_field(out, dst_chunk, id, &ff);
     }
 
     /* Create the LOS field for the destination chunk, if necessary */
-    if(!N_FC_ContainsLOSField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c})) {
+    if(!n_path_los_field(out, use_cache, dst_chunk)) {
 
-        struct LOS_field lf;
-        N_LOSFieldCreate(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, dst_desc, priv, map_pos, &lf, NULL);
-        N_FC_SetLOSField(ret, (struct coord){dst_desc.chunk_r, dst_desc.chunk_c}, &lf);
+        struct LOS_field *lf = n_path_new_los_field(out, dst_chunk);
+        uint64_t start = SDL_GetPerformanceCounter();
+        N_LOSFieldCreate(ret, dst_chunk, dst_desc, priv, map_pos, lf, NULL);
+        n_perf_record(STAGE_LOS_FIELD, start);
     }
 
     /* Source and destination positions are in the same chunk, and a path exists
@@ -870,44 +2836,49 @@ bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest,
     if(src_desc.chunk_r == dst_desc.chunk_r && src_desc.chunk_c == dst_desc.chunk_c
     && AStar_TilesLinked((struct coord){src_desc.tile_r, src_desc.tile_c}, 
                          (struct coord){dst_desc.tile_r, dst_desc.tile_c}, 
-                         priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)].cost_base)) {
+                         &priv->chunks[IDX(src_desc.chunk_r, priv->width, src_desc.chunk_c)])) {
 
-        *out_dest_id = ret;
-        return true;
+        kv_push(struct coord, out->corridor, dst_chunk);
+        out->success = true;
+        goto out;
     }
 
     const struct portal *dst_port;
     dst_port = AStar_ReachablePortal((struct coord){dst_desc.tile_r, dst_desc.tile_c}, 
         &priv->chunks[IDX(dst_desc.chunk_r, priv->width, dst_desc.chunk_c)]);
 
-    if(!dst_port) {
-        return false; 
-    }
+    if(!dst_port)
+        goto out;
+
+    /* Reject the request right away if none of the portals reachable from the 
+     * source tile are in the same component of the portal graph as the destination. */
+    if(!n_component_reachable(priv, src_desc, dst_port->component))
+        goto out;
 
     float cost;
     portal_vec_t path;
-    kv_init(path);
+    sv_init(path);
 
+    uint64_t start = SDL_GetPerformanceCounter();
     bool path_exists = AStar_PortalGraphPath(src_desc, dst_port, priv, &path, &cost);
+    n_perf_record(STAGE_PORTAL_SEARCH, start);
     if(!path_exists) {
-        kv_destroy(path);
-        return false; 
+        sv_destroy(path);
+        goto out;
     }
 
-    struct coord prev_los_coord = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
-
     /* Traverse the portal path _backwards_ and generate the required fields, if they are not already 
-     * cached. Add the results to the fieldcache. */
-    for(int i = kv_size(path)-1; i > 0; i--) {
+     * cached or generated. */
+    for(int i = sv_size(path)-1; i > 0; i--) {
 
-        const struct portal *curr_node = kv_A(path, i - 1);
-        const struct portal *next_hop = kv_A(path, i);
+        const struct portal *curr_node = sv_A(path, i - 1);
+        const struct portal *next_hop = sv_A(path, i);
 
         /* If the very first hop takes us into another chunk, that means that the 'nearest portal'
          * to the source borders the 'next' chunk already. In this case, we must remember to
          * still generate a flow field for the current chunk steering to this portal. */
         if(i == 1 && (next_hop->chunk.r != src_desc.chunk_r || next_hop->chunk.c != src_desc.chunk_c))
-            next_hop = kv_A(path, 0);
+            next_hop = sv_A(path, 0);
 
         if(curr_node->connected == next_hop)
             continue;
@@ -928,59 +2899,369 @@ bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest,
         };
 
         const struct nav_chunk *chunk = &priv->chunks[IDX(chunk_coord.r, priv->width, chunk_coord.c)];
-        ff_id_t new_id = N_FlowField_ID(chunk_coord, target);
+        bool carry = n_chain_carries(&chain, target);
+        ff_id_t new_id = carry ? N_FlowField_ChainedID(priv->layer, chunk_coord, target)
+                               : N_FlowField_ID(priv->layer, chunk_coord, target);
         ff_id_t exist_id;
         struct flow_field ff;
+        const struct flow_field *exist_ff;
 
-        if(N_FC_ContainsFlowField(ret, chunk_coord, &exist_id)) {
+        if((exist_ff = n_path_flow_field(out, use_cache, chunk_coord, &exist_id))) {
+
+            /* There is no integration of this chunk to carry on from */
+            chain.depth = 0;
 
             /* The exact flow field we need has already been made */
             if(new_id == exist_id)
                 continue;
 
+            /* Every field made for this destination (or for its' goal region) 
+             * leads towards it. If the existing one already steers away from
+             * the portal we enter the chunk through, following it is as good 
+             * as re-targeting it to our next hop. This is what lets a path 
+             * reuse the fields cached by an earlier path to a nearby tile. */
+            if(n_field_steers_from(exist_ff, curr_node))
+                continue;
+
             /* This is the edge case when a path to a particular target takes us through
              * the same chunk more than once. This can happen if a chunk is divided into
              * 'islands' by unpathable barriers. */
-            const struct flow_field *exist_ff  = N_FC_FlowFieldAt(ret, chunk_coord);
             memcpy(&ff, exist_ff, sizeof(struct flow_field));
 
-            N_FlowFieldUpdate(chunk, target, &ff);
+            uint64_t start = SDL_GetPerformanceCounter();
+            N_FlowFieldUpdate(chunk, target, n_integration_method(chunk), &ff);
+            n_perf_record(STAGE_FLOW_FIELD, start);
             /* We set the updated flow field for the new (least recently used) key. Since in 
              * this case more than one flowfield ID maps to the same field but we only keep 
              * one of the IDs, it may be possible that the same flowfield will be redundantly 
              * updated at a later time. However, this is largely inconsequential. */
-            N_FC_SetFlowField(ret, chunk_coord, new_id, &ff);
+            n_path_set_flow_field(out, chunk_coord, new_id, &ff);
             continue;
         }
 
+        uint64_t start = SDL_GetPerformanceCounter();
         N_FlowFieldInit(chunk_coord, priv, &ff);
-        N_FlowFieldUpdate(chunk, target, &ff);
-        N_FC_SetFlowField(ret, chunk_coord, new_id, &ff);
+        n_chain_build(&chain, chunk, chunk_coord, target, carry, &ff);
+        n_perf_record(STAGE_FLOW_FIELD, start);
+        n_path_set_flow_field(out, chunk_coord, new_id, &ff);
+    }
 
-        if(!N_FC_ContainsLOSField(ret, chunk_coord)) {
+    n_path_corridor(out, src_desc, dst_desc, &path);
+    sv_destroy(path);
 
-            if((abs(prev_los_coord.r - chunk_coord.r) + abs(prev_los_coord.c - chunk_coord.c)) > 1)
-                continue;
+    /* Each LOS field is built from the field of the chunk following it on the path. 
+     * Walk the corridor backwards from the destination, so that this field is always 
+     * available, and fill in every field that is still missing. */
+    for(int i = kv_size(out->corridor)-2; i >= (int)corridor_base; i--) {
+
+        struct coord chunk_coord = kv_A(out->corridor, i);
+        struct coord prev_coord = kv_A(out->corridor, i + 1);
+
+        if(n_path_los_field(out, use_cache, chunk_coord))
+            continue;
+
+        const struct LOS_field *prev_los = n_path_los_field(out, use_cache, prev_coord);
+        if(!prev_los)
+            continue;
+
+        /* Copy the previous field, as the pointer may be invalidated by growing the results */
+        struct LOS_field prev = *prev_los;
+        struct LOS_field *lf = n_path_new_los_field(out, chunk_coord);
+        uint64_t start = SDL_GetPerformanceCounter();
+        N_LOSFieldCreate(ret, chunk_coord, dst_desc, priv, map_pos, lf, &prev);
+        n_perf_record(STAGE_LOS_FIELD, start);
+    }
+
+    out->success = true;
+
+out:
+    if(arena)
+        arena_rewind(arena, mark);
+}
+
+size_t N_PathComputeSlice(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                          vec2_t xz_dest, vec3_t map_pos, bool use_cache, 
+                          struct path_result *out, bool out_found[], 
+                          size_t first, uint64_t deadline)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    out->success = false;
+    if(num_srcs == 0)
+        return 0;
+
+    /* For every distinct (chunk, island) pair of the sources, the index of 
+     * the first source that was found on it. */
+    struct{
+        struct coord chunk;
+        uint16_t     island;
+        size_t       src_idx;
+    }groups[num_srcs];
+    size_t num_groups = 0;
+
+    int i = 0;
+    for(; i < num_srcs; i++) {
+
+        struct tile_desc src_desc;
+        bool result = M_Tile_DescForPoint2D(res, map_pos, xz_srcs[i], &src_desc);
+        assert(result);
+
+        struct coord chunk = (struct coord){src_desc.chunk_r, src_desc.chunk_c};
+        uint16_t island = priv->chunks[IDX(chunk.r, priv->width, chunk.c)]
+                          .islands[src_desc.tile_r][src_desc.tile_c];
+
+        /* All the tiles of an island are linked, so sources on the same island 
+         * will follow the same path out of the chunk. Impassable tiles are not 
+         * part of any island, so sources on them are always searched on their own. */
+        int j = 0;
+        for(; island != ISLAND_NONE && j < num_groups; j++) {
+            if(groups[j].chunk.r == chunk.r 
+            && groups[j].chunk.c == chunk.c 
+            && groups[j].island == island)
+                break;
+        }
+
+        if(island != ISLAND_NONE && j < num_groups) {
+            if(i >= first)
+                out_found[i] = out_found[groups[j].src_idx];
+            continue;
+        }
+
+        groups[num_groups].chunk = chunk;
+        groups[num_groups].island = island;
+        groups[num_groups].src_idx = i;
+        num_groups++;
+
+        /* The searches of the earlier slices are only replayed for their groups */
+        if(i < first)
+            continue;
 
-            const struct LOS_field *prev_los = N_FC_LOSFieldAt(ret, prev_los_coord);
-            assert(prev_los);
+        N_PathCompute(priv, xz_srcs[i], xz_dest, map_pos, use_cache, out);
+        out_found[i] = out->success;
 
-            struct LOS_field lf;
-            N_LOSFieldCreate(ret, chunk_coord, dst_desc, priv, map_pos, &lf, prev_los);
-            N_FC_SetLOSField(ret, chunk_coord, &lf);
-            prev_los_coord = chunk_coord;
+        if(SDL_GetPerformanceCounter() >= deadline) {
+            i++;
+            break;
         }
     }
-    kv_destroy(path);
 
-    *out_dest_id = ret; 
-    return true;
+    bool any = false;
+    for(int j = 0; j < i; j++)
+        any = any || out_found[j];
+
+    out->success = any;
+    return i;
+}
+
+void N_PathComputeBatch(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                        vec2_t xz_dest, vec3_t map_pos, bool use_cache, 
+                        struct path_result *out, bool out_found[])
+{
+    N_PathComputeSlice(priv, num_srcs, xz_srcs, xz_dest, map_pos, use_cache, 
+        out, out_found, 0, UINT64_MAX);
+}
+
+void N_PathCommit(const struct path_result *result)
+{
+    for(int i = 0; i < kv_size(result->flow); i++) {
+
+        const struct path_flow_result *curr = &kv_A(result->flow, i);
+        N_FC_SetFlowField(n_flow_key(result->dest_id, curr->chunk), curr->chunk, curr->ffid, &curr->ff);
+    }
+
+    for(int i = 0; i < kv_size(result->los); i++) {
+
+        const struct path_los_result *curr = &kv_A(result->los, i);
+        N_FC_SetLOSField(result->dest_id, curr->chunk, &curr->lf);
+    }
+
+    if(kv_size(result->corridor) == 0)
+        return;
+
+    /* Every path in the corridor ends in the destination chunk. Don't link 
+     * the end of one path to the start of the next. */
+    struct coord dst_chunk = kv_A(result->corridor, kv_size(result->corridor) - 1);
+    for(int i = 0; i < (int)kv_size(result->corridor) - 1; i++) {
+
+        struct coord curr = kv_A(result->corridor, i);
+        if(curr.r == dst_chunk.r && curr.c == dst_chunk.c)
+            continue;
+        N_FC_SetNextChunk(n_flow_key(result->dest_id, curr), curr, kv_A(result->corridor, i + 1));
+    }
+}
+
+void N_PathSeed(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                vec2_t xz_dest, vec3_t map_pos, struct path_result *out)
+{
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc dst_desc;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, xz_dest, &dst_desc);
+    assert(result);
+
+    dest_id_t id = n_dest_id(priv, dst_desc);
+    struct coord dst_chunk = (struct coord){dst_desc.chunk_r, dst_desc.chunk_c};
+    out->dest_id = id;
+    n_seed_chunk(out, id, dst_chunk);
+
+    for(int i = 0; i < num_srcs; i++) {
+
+        struct tile_desc src_desc;
+        result = M_Tile_DescForPoint2D(res, map_pos, xz_srcs[i], &src_desc);
+        assert(result);
+
+        /* Follow the next chunk hints from the source chunk for as long as the 
+         * fields are cached. The hints under a shared key may have been left by 
+         * different paths, so the walk is bounded in case they form a loop. */
+        struct coord curr = (struct coord){src_desc.chunk_r, src_desc.chunk_c};
+        for(int j = 0; j < priv->width * priv->height; j++) {
+
+            ff_id_t ffid;
+            if(curr.r == dst_chunk.r && curr.c == dst_chunk.c)
+                break;
+            /* The rest of the way has been seeded for an earlier source */
+            if(n_path_flow_field(out, false, curr, &ffid))
+                break;
+            if(!n_seed_chunk(out, id, curr))
+                break;
+            if(!N_FC_NextChunk(n_flow_key(id, curr), curr, &curr))
+                break;
+        }
+    }
+}
+
+bool N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                   vec3_t map_pos, enum nav_layer layer, dest_id_t *out_dest_id)
+{
+    struct nav_layers *layers = nav_private;
+    struct path_result result;
+    N_PathResultInit(&result);
+
+    N_PathCompute(layers->layers[layer], xz_src, xz_dest, map_pos, true, &result);
+    N_PathCommit(&result);
+
+    bool ret = result.success;
+    if(ret)
+        *out_dest_id = result.dest_id;
+
+    N_PathResultDestroy(&result);
+    return ret;
+}
+
+bool N_RequestPaths(void *nav_private, size_t num_srcs, const vec2_t xz_srcs[], 
+                    vec2_t xz_dest, vec3_t map_pos, enum nav_layer layer, 
+                    dest_id_t *out_dest_id, bool out_found[])
+{
+    struct nav_layers *layers = nav_private;
+    struct path_result result;
+    N_PathResultInit(&result);
+
+    N_PathComputeBatch(layers->layers[layer], num_srcs, xz_srcs, xz_dest, map_pos, true, 
+        &result, out_found);
+    N_PathCommit(&result);
+
+    bool ret = result.success;
+    if(ret)
+        *out_dest_id = result.dest_id;
+
+    N_PathResultDestroy(&result);
+    return ret;
+}
+
+path_ticket_t N_RequestPathAsync(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                                 vec3_t map_pos, enum nav_layer layer, 
+                                 dest_id_t *out_dest_id)
+{
+    return N_RequestPathsAsync(nav_private, 1, &xz_src, xz_dest, map_pos, layer, out_dest_id);
+}
+
+path_ticket_t N_RequestPathsAsync(void *nav_private, size_t num_srcs, const vec2_t xz_srcs[], 
+                                  vec2_t xz_dest, vec3_t map_pos, enum nav_layer layer, 
+                                  dest_id_t *out_dest_id)
+{
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[layer];
+    struct map_resolution res = {
+        priv->width, priv->height,
+        FIELD_RES_C, FIELD_RES_R
+    };
+
+    struct tile_desc dst_desc;
+    bool result = M_Tile_DescForPoint2D(res, map_pos, xz_dest, &dst_desc);
+    assert(result);
+
+    *out_dest_id = n_dest_id(priv, dst_desc);
+    return N_PS_Submit(priv, num_srcs, xz_srcs, xz_dest, map_pos);
+}
+
+size_t N_RequestWaypoints(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                          vec3_t map_pos, enum nav_layer layer, size_t maxout, 
+                          vec2_t out[], dest_id_t *out_dest_id)
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+
+    struct tile_desc src_desc, dst_desc;
+    if(!n_desc_for_point(priv, map_pos, xz_src, &src_desc))
+        return 0;
+    if(!n_desc_for_point(priv, map_pos, xz_dest, &dst_desc))
+        return 0;
+
+    dest_id_t id = n_dest_id(priv, dst_desc);
+    vec2_vec_t points;
+    kv_init(points);
+
+    if(!n_waypoint_cached(priv, map_pos, id, xz_src, &points)) {
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        bool found = n_waypoint_path(priv, map_pos, xz_src, xz_dest, src_desc, dst_desc, &points);
+        n_perf_record(STAGE_WAYPOINTS, start);
+
+        if(!found) {
+            kv_destroy(points);
+            return 0;
+        }
+        n_waypoint_cache_add(priv, id, &points);
+    }
+
+    /* The points of a cached path lead to the destination tile, which may 
+     * have been requested for a different point within it */
+    kv_A(points, kv_size(points) - 1) = xz_dest;
+
+    size_t ret = MIN(kv_size(points), maxout);
+    memcpy(out, points.a, ret * sizeof(vec2_t));
+    kv_destroy(points);
+
+    *out_dest_id = id;
+    return ret;
+}
+
+enum path_status N_PollPath(path_ticket_t ticket)
+{
+    return N_PS_Poll(ticket);
+}
+
+bool N_PathFound(path_ticket_t ticket, size_t src_idx)
+{
+    return N_PS_SourceFound(ticket, src_idx);
+}
+
+void N_ReleasePath(path_ticket_t ticket)
+{
+    N_PS_Release(ticket);
 }
 
 vec2_t N_DesiredVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
                          void *nav_private, vec3_t map_pos)
 {
-    struct nav_private *priv = nav_private;
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[n_dest_layer(id)];
     struct map_resolution res = {
         priv->width, priv->height,
         FIELD_RES_C, FIELD_RES_R
@@ -991,19 +3272,21 @@ vec2_t N_DesiredVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
     assert(result);
 
     ff_id_t ffid;
-    if(!N_FC_ContainsFlowField(id, (struct coord){tile.chunk_r, tile.chunk_c}, &ffid)) {
+    struct coord chunk = (struct coord){tile.chunk_r, tile.chunk_c};
+    dest_id_t key = n_flow_key(id, chunk);
 
-        dest_id_t ret;
-        bool result = N_RequestPath(nav_private, curr_pos, xz_dest, map_pos, &ret);
-        if(!result)
+    if(!N_FC_ContainsFlowField(key, chunk, &ffid)) {
+
+        if(!n_fields_ready(priv, id, chunk, curr_pos, xz_dest, map_pos))
+            return n_portal_steer(priv, id, tile, curr_pos, xz_dest, map_pos);
+        if(!N_FC_ContainsFlowField(key, chunk, &ffid))
             return (vec2_t){0.0f};
-        assert(ret == id);
     }
 
-    const struct flow_field *ff = N_FC_FlowFieldAt(id, (struct coord){tile.chunk_r, tile.chunk_c});
+    const struct flow_field *ff = N_FC_FlowFieldAt(key, chunk);
     assert(ff);
 
-    unsigned dir_idx = ff->field[tile.tile_r][tile.tile_c].dir_idx;
+    unsigned dir_idx = N_FlowDirAt(ff, tile.tile_r, tile.tile_c);
     /* If we get a 'FD_NONE' direction, this can only mean that a field has not been generated 
      * for this tile yet and we are getting the default value to which the flow field is
      * initialized. The only case where a 'FD_NONE' direction is valid is at the 
@@ -1013,23 +3296,24 @@ vec2_t N_DesiredVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
      * barrier.*/
     if(dir_idx == FD_NONE) {
 
-        dest_id_t ret;
-        bool result = N_RequestPath(nav_private, curr_pos, xz_dest, map_pos, &ret);
-        if(!result)
+        if(!n_fields_ready(priv, id, chunk, curr_pos, xz_dest, map_pos))
+            return n_portal_steer(priv, id, tile, curr_pos, xz_dest, map_pos);
+        if(!N_FC_ContainsFlowField(key, chunk, &ffid))
             return (vec2_t){0.0f};
-        assert(ret == id);
     }
 
-    ff = N_FC_FlowFieldAt(id, (struct coord){tile.chunk_r, tile.chunk_c});
+    ff = N_FC_FlowFieldAt(key, chunk);
     assert(ff);
 
-    dir_idx = ff->field[tile.tile_r][tile.tile_c].dir_idx;
+    dir_idx = N_FlowDirAt(ff, tile.tile_r, tile.tile_c);
+    n_prefetch_ahead(priv, id, tile, curr_pos, map_pos);
     return g_flow_dir_lookup[dir_idx];
 }
 
 bool N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t map_pos)
 {
-    struct nav_private *priv = nav_private;
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[n_dest_layer(id)];
     struct map_resolution res = {
         priv->width, priv->height,
         FIELD_RES_C, FIELD_RES_R
@@ -1044,12 +3328,19 @@ bool N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t map_p
 
     const struct LOS_field *lf = N_FC_LOSFieldAt(id, (struct coord){tile.chunk_r, tile.chunk_c});
     assert(lf);
-    return lf->field[tile.tile_r][tile.tile_c].visible;
+    if(!N_LOSVisible(lf, tile.tile_r, tile.tile_c))
+        return false;
+
+    /* Units in sight of the destination don't query the flow fields */
+    n_prefetch_ahead(priv, id, tile, curr_pos, map_pos);
+    return true;
 }
 
-bool N_PositionPathable(vec2_t xz_pos, void *nav_private, vec3_t map_pos)
+bool N_PositionPathable(vec2_t xz_pos, enum nav_layer layer, 
+                        void *nav_private, vec3_t map_pos)
 {
-    struct nav_private *priv = nav_private;
+    struct nav_layers *layers = nav_private;
+    struct nav_private *priv = layers->layers[layer];
     struct map_resolution res = {
         priv->width, priv->height,
         FIELD_RES_C, FIELD_RES_R
@@ -1063,3 +3354,86 @@ bool N_PositionPathable(vec2_t xz_pos, void *nav_private, vec3_t map_pos)
     return chunk->cost_base[tile.tile_r][tile.tile_c] != COST_IMPASSABLE;
 }
 
+void N_PathsExist(void *nav_private, size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[],
+                  vec3_t map_pos, enum nav_layer layer, bool out[])
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+
+    for(size_t i = 0; i < n; i++) {
+
+        struct tile_desc src, dst;
+        out[i] = n_desc_for_point(priv, map_pos, xz_srcs[i], &src)
+              && n_desc_for_point(priv, map_pos, xz_dests[i], &dst)
+              && n_path_exists(priv, src, dst);
+    }
+}
+
+void N_PathCosts(void *nav_private, size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[],
+                 vec3_t map_pos, enum nav_layer layer, float out[])
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+
+    /* Queries to the same destination are usually passed in together. In 
+     * that case, the last leg of the path only has to be found once. */
+    struct tile_desc last_dst = (struct tile_desc){-1, -1, -1, -1};
+    const struct portal *exit = NULL;
+    float exit_cost = INFINITY;
+
+    for(size_t i = 0; i < n; i++) {
+
+        struct tile_desc src, dst;
+        if(!n_desc_for_point(priv, map_pos, xz_srcs[i], &src)
+        || !n_desc_for_point(priv, map_pos, xz_dests[i], &dst)
+        || !n_path_exists(priv, src, dst)) {
+            out[i] = INFINITY;
+            continue;
+        }
+
+        if(dst.chunk_r != last_dst.chunk_r || dst.chunk_c != last_dst.chunk_c
+        || dst.tile_r != last_dst.tile_r || dst.tile_c != last_dst.tile_c) {
+            exit = n_cheapest_exit(priv, dst, &exit_cost);
+            last_dst = dst;
+        }
+        out[i] = n_path_cost(priv, src, dst, exit, exit_cost);
+    }
+}
+
+void N_PositionsPathable(void *nav_private, size_t n, const vec2_t xz_positions[],
+                         vec3_t map_pos, enum nav_layer layer, bool out[])
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+
+    for(size_t i = 0; i < n; i++) {
+
+        struct tile_desc tile;
+        out[i] = n_desc_for_point(priv, map_pos, xz_positions[i], &tile)
+              && n_desc_chunk(priv, tile)->cost_base[tile.tile_r][tile.tile_c] != COST_IMPASSABLE;
+    }
+}
+
+void N_Raycasts(void *nav_private, size_t n, const vec2_t xz_srcs[], const vec2_t xz_dests[],
+                vec3_t map_pos, enum nav_layer layer, bool out_hit[], vec2_t out_pos[])
+{
+    struct nav_layers *layers = nav_private;
+    const struct nav_private *priv = layers->layers[layer];
+
+    for(size_t i = 0; i < n; i++) {
+        out_hit[i] = n_raycast(priv, map_pos, xz_srcs[i], xz_dests[i], &out_pos[i]);
+    }
+}
+
+enum nav_layer N_LayerForRadius(float radius)
+{
+    /* Layer N keeps the unit's center N tiles away from any obstacle, which 
+     * leaves room for N tiles on either side of the center tile. */
+    float overhang = radius - MIN(FIELD_TILE_X_DIM, FIELD_TILE_Z_DIM) / 2.0f;
+    if(overhang <= 0.0f)
+        return NAV_LAYER_GROUND_1X1;
+
+    int clearance = ceil(overhang / MIN(FIELD_TILE_X_DIM, FIELD_TILE_Z_DIM));
+    return MIN(clearance, NAV_LAYER_MAX - 1);
+}
+
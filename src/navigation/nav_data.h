@@ -38,11 +38,25 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 
 #define MAX_PORTALS_PER_CHUNK 64
 #define FIELD_RES_R           64
 #define FIELD_RES_C           64
 #define COST_IMPASSABLE       0xff
+/* Cost added to a passable tile for every blocker covering it */
+#define COST_PER_BLOCKER      8
+#define ISLAND_NONE           0xffff
+#define CLUSTER_NODE_NONE     0xffff
+
+/* The grid searches work on a copy of the cost field with a one-tile border 
+ * around it, so that every tile of the chunk has all 8 neighbours and the 
+ * inner loops need no bounds checks. The padded field is stored row-major, 
+ * and PADDED_IDX maps chunk coordinates into it. */
+#define PADDED_RES_R          (FIELD_RES_R + 2)
+#define PADDED_RES_C          (FIELD_RES_C + 2)
+#define PADDED_IDX(r, c)      (((r) + 1) * PADDED_RES_C + (c) + 1)
 
 struct coord{
     int r, c;
@@ -61,12 +75,49 @@ struct portal{
     size_t         num_neighbours;
     struct edge    edges[MAX_PORTALS_PER_CHUNK-1];
     struct portal *connected;
+    /* ID of the island (set of mutually reachable tiles) within the 
+     * chunk that the portal belongs to. */
+    uint16_t       island;
+    /* ID of the connected component of the whole portal graph that the 
+     * portal belongs to. Portals with different component IDs can never 
+     * be reached from one another. */
+    uint32_t       component;
+    /* Index of the portal among the nodes of its' cluster, or CLUSTER_NODE_NONE
+     * if the portal does not lead into another cluster. */
+    uint16_t       cluster_node;
 };
 
 struct nav_chunk{
     size_t        num_portals; 
     struct portal portals[MAX_PORTALS_PER_CHUNK];
     uint8_t       cost_base[FIELD_RES_R][FIELD_RES_C]; 
+    /* Per-tile island IDs, or ISLAND_NONE for impassable tiles. Two tiles 
+     * in the chunk are linked iff they have the same island ID. */
+    uint16_t      islands[FIELD_RES_R][FIELD_RES_C];
+    /* Set when the cost field has changed since the portals were last built */
+    bool          dirty;
+    /* Number of temporary blockers (such as units holding their position) 
+     * covering every tile. These are blended with the base cost during field 
+     * generation. They only make passable tiles more costly to cross and never 
+     * impassable, so the portals and islands don't depend on them. */
+    uint8_t       blockers[FIELD_RES_R][FIELD_RES_C];
+    /* Number of tiles with a non-zero blocker count */
+    size_t        num_blocked;
 };
 
+static inline void N_PadCostField(const uint8_t cost_field[FIELD_RES_R][FIELD_RES_C], 
+                                  uint8_t border, uint8_t out[PADDED_RES_R * PADDED_RES_C])
+{
+    memset(out, border, PADDED_RES_C);
+    memset(out + (PADDED_RES_R - 1) * PADDED_RES_C, border, PADDED_RES_C);
+
+    for(int r = 0; r < FIELD_RES_R; r++) {
+
+        uint8_t *row = out + PADDED_IDX(r, 0);
+        row[-1] = border;
+        memcpy(row, cost_field[r], FIELD_RES_C);
+        row[FIELD_RES_C] = border;
+    }
+}
+
 #endif
@@ -0,0 +1,479 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "nav_file.h"
+#include "nav_private.h"
+#include "cluster.h"
+#include "../map/public/tile.h"
+#include "../lib/public/kvec.h"
+#include "../mem.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define IDX(r, width, c)   ((r) * (width) + (c))
+#define ARR_SIZE(a)        (sizeof(a)/sizeof(a[0]))
+#define MAX(a, b)          ((a) > (b) ? (a) : (b))
+
+/* Must be bumped whenever the layout of the file or the way the navigation 
+ * data is built from the tiles changes. */
+#define NAV_FILE_VERSION   (3)
+#define FNV_OFFSET_BASIS   (0xcbf29ce484222325ull)
+#define FNV_PRIME          (0x100000001b3ull)
+
+/* Every layer is stored as a header followed by the payload. Every value is stored in the 
+ * native byte order, since the file is just a cache of data which can always 
+ * be rebuilt - a file written on a machine with a different byte order will
+ * fail the magic number check and be ignored. */
+struct nf_header{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t field_res_r, field_res_c;
+    uint32_t max_portals, cluster_dim;
+    uint32_t layer, num_layers;
+    /* The layer's versions, so that the loaded data is identical to the built
+     * data down to them */
+    uint32_t data_version, portal_version;
+    uint64_t tiles_hash;
+    uint64_t payload_size;
+    uint64_t payload_hash;
+};
+
+#define NAV_FILE_MAGIC     (0x564e4650) /* 'PFNV' */
+
+/* Portal pointers are stored as (chunk index, portal index) pairs */
+struct nf_portal{
+    uint8_t  endpoints[4];
+    uint16_t island;
+    uint16_t cluster_node;
+    uint32_t component;
+    uint32_t connected_chunk;
+    uint8_t  connected_idx;
+    uint8_t  num_neighbours;
+    uint8_t  pad[2];
+};
+
+struct nf_edge{
+    uint8_t  neighbour;
+    uint8_t  pad[3];
+    float    cost;
+};
+
+struct nf_node{
+    uint32_t chunk;
+    uint8_t  portal_idx;
+    uint8_t  pad[3];
+    uint32_t num_edges;
+};
+
+struct nf_cluster_edge{
+    uint16_t node;
+    uint8_t  pad[2];
+    float    cost;
+};
+
+typedef kvec_t(uint8_t) buff_t;
+
+struct reader{
+    const uint8_t *cursor;
+    const uint8_t *end;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t nf_hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void nf_put(buff_t *buff, const void *data, size_t size)
+{
+    size_t base = kv_size(*buff);
+    if(base + size > kv_max(*buff))
+        kv_resize(uint8_t, *buff, MAX(base + size, kv_max(*buff) * 2));
+    memcpy(&kv_A(*buff, base), data, size);
+    kv_size(*buff) = base + size;
+}
+
+static bool nf_get(struct reader *reader, void *out, size_t size)
+{
+    if(reader->end - reader->cursor < size)
+        return false;
+    memcpy(out, reader->cursor, size);
+    reader->cursor += size;
+    return true;
+}
+
+static size_t nf_portal_idx(const struct nav_private *priv, const struct portal *port)
+{
+    const struct nav_chunk *chunk = &priv->chunks[IDX(port->chunk.r, priv->width, port->chunk.c)];
+    return port - chunk->portals;
+}
+
+/* Index of the chunk holding the portal slot, found from the address alone, 
+ * since the slot may not have been initialized. */
+static size_t nf_chunk_of(const struct nav_private *priv, const struct portal *port)
+{
+    return ((const char*)port - (const char*)priv->chunks) / sizeof(struct nav_chunk);
+}
+
+static void nf_write_chunk(const struct nav_private *priv, const struct nav_chunk *chunk, buff_t *buff)
+{
+    nf_put(buff, chunk->cost_base, sizeof(chunk->cost_base));
+    nf_put(buff, chunk->islands, sizeof(chunk->islands));
+
+    uint32_t num_portals = chunk->num_portals;
+    nf_put(buff, &num_portals, sizeof(num_portals));
+
+    for(int i = 0; i < chunk->num_portals; i++) {
+
+        const struct portal *port = &chunk->portals[i];
+        struct nf_portal out = (struct nf_portal){
+            .endpoints = {
+                port->endpoints[0].r, port->endpoints[0].c, 
+                port->endpoints[1].r, port->endpoints[1].c
+            },
+            .island          = port->island,
+            .cluster_node    = port->cluster_node,
+            .component       = port->component,
+            .connected_chunk = IDX(port->connected->chunk.r, priv->width, port->connected->chunk.c),
+            .connected_idx   = nf_portal_idx(priv, port->connected),
+            .num_neighbours  = port->num_neighbours,
+        };
+        nf_put(buff, &out, sizeof(out));
+
+        for(int j = 0; j < port->num_neighbours; j++) {
+
+            struct nf_edge edge = (struct nf_edge){
+                .neighbour = port->edges[j].neighbour - chunk->portals,
+                .cost      = port->edges[j].cost,
+            };
+            nf_put(buff, &edge, sizeof(edge));
+        }
+    }
+}
+
+static void nf_write_cluster(const struct nav_private *priv, const struct nav_cluster *cluster, 
+                             buff_t *buff)
+{
+    uint32_t num_nodes = kv_size(cluster->nodes);
+    nf_put(buff, &num_nodes, sizeof(num_nodes));
+
+    for(int i = 0; i < kv_size(cluster->nodes); i++) {
+
+        const struct cluster_node *node = &kv_A(cluster->nodes, i);
+        struct nf_node out = (struct nf_node){
+            .chunk      = IDX(node->portal->chunk.r, priv->width, node->portal->chunk.c),
+            .portal_idx = nf_portal_idx(priv, node->portal),
+            .num_edges  = kv_size(node->edges),
+        };
+        nf_put(buff, &out, sizeof(out));
+
+        for(int j = 0; j < kv_size(node->edges); j++) {
+
+            struct nf_cluster_edge edge = (struct nf_cluster_edge){
+                .node = kv_A(node->edges, j).node,
+                .cost = kv_A(node->edges, j).cost,
+            };
+            nf_put(buff, &edge, sizeof(edge));
+        }
+    }
+}
+
+static bool nf_read_chunk(struct nav_private *priv, int idx, struct reader *reader)
+{
+    struct nav_chunk *chunk = &priv->chunks[idx];
+    uint32_t num_portals;
+
+    if(!nf_get(reader, chunk->cost_base, sizeof(chunk->cost_base)))
+        return false;
+    if(!nf_get(reader, chunk->islands, sizeof(chunk->islands)))
+        return false;
+    if(!nf_get(reader, &num_portals, sizeof(num_portals)))
+        return false;
+    if(num_portals > MAX_PORTALS_PER_CHUNK)
+        return false;
+
+    chunk->num_portals = num_portals;
+    chunk->dirty = false;
+    memset(chunk->blockers, 0, sizeof(chunk->blockers));
+    chunk->num_blocked = 0;
+
+    for(int i = 0; i < num_portals; i++) {
+
+        struct portal *port = &chunk->portals[i];
+        struct nf_portal in;
+
+        if(!nf_get(reader, &in, sizeof(in)))
+            return false;
+        if(in.connected_chunk >= priv->width * priv->height
+        || in.connected_idx >= MAX_PORTALS_PER_CHUNK
+        || in.num_neighbours > ARR_SIZE(port->edges))
+            return false;
+
+        *port = (struct portal){
+            .chunk          = (struct coord){idx / priv->width, idx % priv->width},
+            .endpoints[0]   = (struct coord){in.endpoints[0], in.endpoints[1]},
+            .endpoints[1]   = (struct coord){in.endpoints[2], in.endpoints[3]},
+            .num_neighbours = in.num_neighbours,
+            .connected      = &priv->chunks[in.connected_chunk].portals[in.connected_idx],
+            .island         = in.island,
+            .component      = in.component,
+            .cluster_node   = in.cluster_node,
+        };
+
+        for(int j = 0; j < in.num_neighbours; j++) {
+
+            struct nf_edge edge;
+            if(!nf_get(reader, &edge, sizeof(edge)))
+                return false;
+            if(edge.neighbour >= num_portals)
+                return false;
+            port->edges[j] = (struct edge){&chunk->portals[edge.neighbour], edge.cost};
+        }
+    }
+    return true;
+}
+
+static bool nf_read_cluster(struct nav_private *priv, struct nav_cluster *cluster, 
+                            struct reader *reader)
+{
+    uint32_t num_nodes;
+    if(!nf_get(reader, &num_nodes, sizeof(num_nodes)))
+        return false;
+    if(num_nodes >= CLUSTER_NODE_NONE)
+        return false;
+
+    for(int i = 0; i < num_nodes; i++) {
+
+        struct nf_node in;
+        if(!nf_get(reader, &in, sizeof(in)))
+            return false;
+        if(in.chunk >= priv->width * priv->height
+        || in.portal_idx >= priv->chunks[in.chunk].num_portals
+        || in.num_edges >= num_nodes)
+            return false;
+
+        struct cluster_node *node = kv_pushp(struct cluster_node, cluster->nodes);
+        node->portal = &priv->chunks[in.chunk].portals[in.portal_idx];
+        kv_init(node->edges);
+
+        for(int j = 0; j < in.num_edges; j++) {
+
+            struct nf_cluster_edge edge;
+            if(!nf_get(reader, &edge, sizeof(edge)))
+                return false;
+            if(edge.node >= num_nodes)
+                return false;
+            kv_push(struct cluster_edge, node->edges, ((struct cluster_edge){edge.node, edge.cost}));
+        }
+    }
+    return true;
+}
+
+/* A file that passed the checksum is still checked for consistency, so that 
+ * pointers between the portals are always valid. */
+static bool nf_links_valid(const struct nav_private *priv)
+{
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        const struct nav_chunk *chunk = &priv->chunks[i];
+        for(int j = 0; j < chunk->num_portals; j++) {
+
+            const struct portal *port = &chunk->portals[j];
+            const struct nav_chunk *adjacent = &priv->chunks[nf_chunk_of(priv, port->connected)];
+
+            if(port->connected - adjacent->portals >= adjacent->num_portals)
+                return false;
+            if(port->connected->connected != port)
+                return false;
+        }
+    }
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+uint64_t N_NF_TilesHash(size_t w, size_t h, size_t chunk_w, size_t chunk_h, 
+                        const struct tile **chunk_tiles)
+{
+    uint64_t ret = FNV_OFFSET_BASIS;
+    uint32_t dims[4] = {w, h, chunk_w, chunk_h};
+    ret = nf_hash(ret, dims, sizeof(dims));
+
+    for(int i = 0; i < w * h; i++) {
+        for(int j = 0; j < chunk_w * chunk_h; j++) {
+
+            /* Hash the attributes one by one, as the tile struct has padding */
+            const struct tile *tile = &chunk_tiles[i][j];
+            int32_t attrs[4] = {tile->pathable, tile->type, tile->base_height, tile->ramp_height};
+            ret = nf_hash(ret, attrs, sizeof(attrs));
+        }
+    }
+    return ret;
+}
+
+bool N_NF_Write(const struct nav_private *priv, uint64_t tiles_hash, SDL_RWops *stream)
+{
+    buff_t buff;
+    kv_init(buff);
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+        assert(!priv->chunks[i].dirty);
+        nf_write_chunk(priv, &priv->chunks[i], &buff);
+    }
+
+    for(int i = 0; i < priv->cluster_width * priv->cluster_height; i++)
+        nf_write_cluster(priv, &priv->clusters[i], &buff);
+
+    struct nf_header header = (struct nf_header){
+        .magic          = NAV_FILE_MAGIC,
+        .version        = NAV_FILE_VERSION,
+        .width          = priv->width,
+        .height         = priv->height,
+        .field_res_r    = FIELD_RES_R,
+        .field_res_c    = FIELD_RES_C,
+        .max_portals    = MAX_PORTALS_PER_CHUNK,
+        .cluster_dim    = CLUSTER_DIM,
+        .layer          = priv->layer,
+        .num_layers     = NAV_LAYER_MAX,
+        .data_version   = priv->version,
+        .portal_version = priv->portal_version,
+        .tiles_hash     = tiles_hash,
+        .payload_size   = kv_size(buff),
+        .payload_hash   = nf_hash(FNV_OFFSET_BASIS, buff.a, kv_size(buff)),
+    };
+
+    bool ret = (1 == SDL_RWwrite(stream, &header, sizeof(header), 1))
+            && (1 == SDL_RWwrite(stream, buff.a, kv_size(buff), 1));
+
+    kv_destroy(buff);
+    return ret;
+}
+
+struct nav_private *N_NF_Read(SDL_RWops *stream, size_t w, size_t h, enum nav_layer layer,
+                              uint64_t tiles_hash)
+{
+    struct nf_header header;
+    uint8_t *payload;
+    struct nav_private *ret;
+
+    if(1 != SDL_RWread(stream, &header, sizeof(header), 1))
+        goto fail_header;
+
+    if(header.magic        != NAV_FILE_MAGIC
+    || header.version      != NAV_FILE_VERSION
+    || header.width        != w
+    || header.height       != h
+    || header.field_res_r  != FIELD_RES_R
+    || header.field_res_c  != FIELD_RES_C
+    || header.max_portals  != MAX_PORTALS_PER_CHUNK
+    || header.cluster_dim  != CLUSTER_DIM
+    || header.layer        != layer
+    || header.num_layers   != NAV_LAYER_MAX
+    || header.tiles_hash   != tiles_hash)
+        goto fail_header;
+
+    Sint64 size = SDL_RWsize(stream);
+    Sint64 pos = SDL_RWtell(stream);
+    if(size >= 0 && pos >= 0 && header.payload_size > size - pos)
+        goto fail_header;
+
+    /* The whole payload is read in with a single call and then unpacked */
+    payload = malloc(header.payload_size);
+    if(!payload)
+        goto fail_payload;
+    if(1 != SDL_RWread(stream, payload, header.payload_size, 1))
+        goto fail_read;
+    if(header.payload_hash != nf_hash(FNV_OFFSET_BASIS, payload, header.payload_size))
+        goto fail_read;
+
+    ret = MEM_Malloc(MEM_TAG_NAV, sizeof(struct nav_private) + (w * h * sizeof(struct nav_chunk)));
+    if(!ret)
+        goto fail_alloc;
+
+    ret->layer = layer;
+    ret->width = w;
+    ret->height = h;
+    ret->version = header.data_version;
+    ret->portal_version = header.portal_version;
+    ret->snapshot = NULL;
+    kv_init(ret->blocker_changes);
+
+    if(!N_CL_Init(ret))
+        goto fail_clusters;
+
+    struct reader reader = (struct reader){payload, payload + header.payload_size};
+
+    for(int i = 0; i < w * h; i++) {
+        if(!nf_read_chunk(ret, i, &reader))
+            goto fail_parse;
+    }
+
+    for(int i = 0; i < ret->cluster_width * ret->cluster_height; i++) {
+        if(!nf_read_cluster(ret, &ret->clusters[i], &reader))
+            goto fail_parse;
+    }
+
+    if(reader.cursor != reader.end || !nf_links_valid(ret))
+        goto fail_parse;
+
+    free(payload);
+    return ret;
+
+fail_parse:
+    N_CL_Destroy(ret);
+fail_clusters:
+    MEM_Free(ret);
+fail_alloc:
+fail_read:
+    free(payload);
+fail_payload:
+fail_header:
+    return NULL;
+}
+
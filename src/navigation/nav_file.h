@@ -0,0 +1,79 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef NAV_FILE_H
+#define NAV_FILE_H
+
+#include "public/nav.h"
+
+#include <SDL.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct nav_private;
+struct tile;
+
+/* ------------------------------------------------------------------------
+ * Hash of all the tile attributes which the navigation data is built from.
+ * The navigation data read from a file is only used when the hash stored
+ * in the file matches the one computed for the map.
+ * ------------------------------------------------------------------------
+ */
+uint64_t            N_NF_TilesHash(size_t w, size_t h, size_t chunk_w, size_t chunk_h, 
+                                   const struct tile **chunk_tiles);
+
+/* ------------------------------------------------------------------------
+ * Write the fully built navigation data of a layer (cost fields, islands, 
+ * portals, edges and clusters) to the stream. The layers of a map are 
+ * written one after another to the same stream.
+ * ------------------------------------------------------------------------
+ */
+bool                N_NF_Write(const struct nav_private *priv, uint64_t tiles_hash, 
+                               SDL_RWops *stream);
+
+/* ------------------------------------------------------------------------
+ * Returns newly allocated navigation data read from the stream, or NULL if 
+ * the stream does not hold valid navigation data of the specified layer
+ * for a 'w' by 'h' chunk map with the specified tiles hash. The result is 
+ * freed in the same way as the built layers.
+ * ------------------------------------------------------------------------
+ */
+struct nav_private *N_NF_Read(SDL_RWops *stream, size_t w, size_t h, enum nav_layer layer,
+                              uint64_t tiles_hash);
+
+#endif
+
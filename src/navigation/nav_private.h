@@ -36,12 +36,69 @@
 #ifndef NAV_PRIVATE_H
 #define NAV_PRIVATE_H
 
+#include "public/nav.h"
 #include "nav_data.h"
+#include "../pf_math.h"
+#include "../lib/public/kvec.h"
 #include <stddef.h>
 
+/* Chunks are grouped into square clusters of CLUSTER_DIM by CLUSTER_DIM chunks,
+ * making up a coarser level of the portal graph. The nodes of a cluster are the
+ * portals leading out of it. Each edge holds the cost of the cheapest path between
+ * two nodes which does not leave the cluster. */
+#define CLUSTER_DIM 4
+
+struct cluster_edge{
+    uint16_t node;
+    float    cost;
+};
+
+struct cluster_node{
+    const struct portal *portal;
+    kvec_t(struct cluster_edge) edges;
+};
+
+struct nav_cluster{
+    kvec_t(struct cluster_node) nodes;
+};
+
+struct blocker_change{
+    vec3_t map_pos;
+    vec2_t xz_pos;
+    float  radius;
+    int    delta;
+};
+
+/* The navigation data for a single layer */
 struct nav_private{
-    size_t           width, height;
-    struct nav_chunk chunks[];
+    enum nav_layer      layer;
+    size_t              width, height;
+    size_t              cluster_width, cluster_height;
+    struct nav_cluster *clusters;
+    /* Blockers added or removed since the last call to N_UpdateBlockers */
+    kvec_t(struct blocker_change) blocker_changes;
+    /* Bumped on every change to the data that the paths are computed from */
+    uint32_t            version;
+    /* Bumped on every change to the portals, after which the fields computed
+     * from the earlier portals are stale */
+    uint32_t            portal_version;
+    /* The read-only copy of the layer that the worker threads read (see 
+     * snapshot.h). Only ever swapped by the main thread. */
+    struct nav_private *snapshot;
+    struct nav_chunk    chunks[];
 };
 
+/* The handle to the navigation data of a map. Every layer holds the full
+ * navigation data for entities of one size. In layer N, all tiles within N 
+ * tiles of an impassable tile are themselves impassable, so that an entity 
+ * with a footprint of (2N+1)x(2N+1) tiles can stand on any passable tile. */
+struct nav_layers{
+    struct nav_private *layers[NAV_LAYER_MAX];
+};
+
+static inline size_t N_ClusterIdx(const struct nav_private *priv, struct coord chunk)
+{
+    return (chunk.r / CLUSTER_DIM) * priv->cluster_width + (chunk.c / CLUSTER_DIM);
+}
+
 #endif
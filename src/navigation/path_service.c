@@ -0,0 +1,591 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "path_service.h"
+#include "nav_private.h"
+#include "snapshot.h"
+#include "../pf_math.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/pqueue.h"
+#include "../lib/public/kvec.h"
+
+#include <SDL.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+
+#define MAX_WORKERS         (4)
+/* A job is held back this many milliseconds for every unit of distance 
+ * between the focus point and the nearest of its' sources */
+#define FOCUS_DELAY_PER_DIST (1.0f)
+
+enum job_state{
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_COMMITTED,
+};
+
+struct path_job{
+    path_ticket_t       ticket;
+    enum job_state      state;
+    enum path_status    status;
+    struct nav_private *priv;
+    vec2_t              xz_dest;
+    vec3_t              map_pos;
+    struct path_result  result;
+    size_t              num_srcs;
+    vec2_t             *xz_srcs;
+    /* Parallel to 'xz_srcs' - set by the worker thread */
+    bool               *found;
+    /* The portals of the snapshot that the job ran against */
+    uint32_t            portal_version;
+    /* The index of the source to carry on from in the next slice */
+    size_t              next_src;
+    /* Lower is ran sooner */
+    float               priority;
+    /* Set when the ticket is released while a worker is running the job. 
+     * The worker frees the job once it is done with it. */
+    bool                abandoned;
+};
+
+KHASH_MAP_INIT_INT(job, struct path_job*)
+PQUEUE_TYPE(job, struct path_job*)
+PQUEUE_IMPL(static, job, struct path_job*)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool             s_running = false;
+static bool             s_quit;
+/* When set, polling a ticket waits for its' job to finish, so that the 
+ * outcome doesn't depend on how fast the worker threads are. */
+static bool             s_synchronous = false;
+static int              s_num_workers;
+static SDL_Thread      *s_workers[MAX_WORKERS];
+/* Only touched from the main thread */
+static bool             s_has_focus = false;
+static vec2_t           s_focus;
+static uint32_t         s_start_ms;
+
+/* 's_lock' protects all the state below it. */
+static SDL_mutex       *s_lock;
+/* Signalled when a new job is added to the queue. */
+static SDL_cond        *s_work_cond;
+/* Signalled when a job finishes running. */
+static SDL_cond        *s_done_cond;
+static pq(job)          s_job_queue;
+static khash_t(job)    *s_job_table;
+static path_ticket_t    s_next_ticket = 1;
+/* The time that a worker may spend on jobs per frame, or 0 for no limit */
+static uint64_t         s_budget_ticks = 0;
+/* Incremented at the start of every frame */
+static uint32_t         s_frame = 0;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* Returns true if the worker may start on (another slice of) a job. Must be 
+ * called with the lock held. */
+static bool ps_has_budget(uint32_t *inout_frame, uint64_t *inout_spent)
+{
+    if(s_budget_ticks == 0 || s_synchronous)
+        return true;
+
+    if(*inout_frame != s_frame) {
+        *inout_frame = s_frame;
+        *inout_spent = 0;
+    }
+    return (*inout_spent < s_budget_ticks);
+}
+
+static void ps_free_job(struct path_job *job)
+{
+    if(job->state != JOB_COMMITTED)
+        N_PathResultDestroy(&job->result);
+    free(job);
+}
+
+static int ps_worker(void *arg)
+{
+    size_t slot = (uintptr_t)arg;
+    uint32_t frame = s_frame;
+    uint64_t spent = 0;
+
+    SDL_LockMutex(s_lock);
+    while(true) {
+
+        struct path_job *job;
+        while(!s_quit && (pq_size(&s_job_queue) == 0 || !ps_has_budget(&frame, &spent)))
+            SDL_CondWait(s_work_cond, s_lock);
+
+        if(s_quit)
+            break;
+
+        pq_job_pop(&s_job_queue, &job);
+        assert(job->state == JOB_QUEUED);
+        job->state = JOB_RUNNING;
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        uint64_t deadline = (s_budget_ticks == 0 || s_synchronous) ? UINT64_MAX
+                          : start + (s_budget_ticks - spent);
+        SDL_UnlockMutex(s_lock);
+
+        /* The main thread may be changing the live data in the meantime */
+        const struct nav_private *snap = N_SN_Enter(job->priv, slot);
+        assert(snap);
+
+        if(job->next_src == 0) {
+            job->portal_version = snap->portal_version;
+        }else if(job->portal_version != snap->portal_version) {
+            /* The portals changed since the earlier slices. The job will be
+             * ran again from the start anyway, so don't bother finishing it. */
+            job->next_src = job->num_srcs;
+        }
+
+        if(job->next_src < job->num_srcs) {
+            job->next_src = N_PathComputeSlice(snap, job->num_srcs, job->xz_srcs, job->xz_dest, 
+                job->map_pos, false, &job->result, job->found, job->next_src, deadline);
+        }
+        N_SN_Exit(slot);
+
+        SDL_LockMutex(s_lock);
+        spent += SDL_GetPerformanceCounter() - start;
+
+        if(job->abandoned) {
+            kh_del(job, s_job_table, kh_get(job, s_job_table, job->ticket));
+            ps_free_job(job);
+            SDL_CondBroadcast(s_done_cond);
+            continue;
+        }
+
+        if(job->next_src < job->num_srcs && pq_job_push(&s_job_queue, job->priority, job)) {
+            job->state = JOB_QUEUED;
+        }else{
+            job->next_src = job->num_srcs;
+            job->state = JOB_DONE;
+        }
+        SDL_CondBroadcast(s_done_cond);
+    }
+    SDL_UnlockMutex(s_lock);
+    return 0;
+}
+
+static bool ps_busy(const struct nav_private *priv, bool queued_only)
+{
+    struct path_job *curr;
+    kh_foreach_value(s_job_table, curr, {
+        if(curr->priv == priv && (curr->state == JOB_QUEUED || (!queued_only && curr->state == JOB_RUNNING)))
+            return true;
+    });
+    return false;
+}
+
+static struct path_job *ps_job(path_ticket_t ticket)
+{
+    khiter_t k = kh_get(job, s_job_table, ticket);
+    if(k == kh_end(s_job_table))
+        return NULL;
+    return kh_value(s_job_table, k);
+}
+
+/* Run the job again, against the latest snapshot. Must be called from the
+ * main thread, with the lock held. */
+static bool ps_requeue(struct path_job *job)
+{
+    N_PathResultDestroy(&job->result);
+    N_PathResultInit(&job->result);
+    N_PathSeed(job->priv, job->num_srcs, job->xz_srcs, job->xz_dest, job->map_pos, &job->result);
+    memset(job->found, 0, job->num_srcs * sizeof(bool));
+    job->next_src = 0;
+
+    if(!pq_job_push(&s_job_queue, job->priority, job))
+        return false;
+
+    job->state = JOB_QUEUED;
+    SDL_CondSignal(s_work_cond);
+    return true;
+}
+
+/* Take the queued jobs of 'priv' (or just 'job', if it is set) off the queue. 
+ * The jobs are left in the 'JOB_DONE' state with whatever they have found so 
+ * far. Must be called with the lock held. */
+static void ps_unqueue(const struct nav_private *priv, const struct path_job *job)
+{
+    kvec_t(struct path_job*) keep;
+    kv_init(keep);
+
+    struct path_job *curr;
+    while(pq_job_pop(&s_job_queue, &curr)) {
+
+        if(job ? (curr == job) : (curr->priv == priv)) {
+            curr->state = JOB_DONE;
+            continue;
+        }
+        kv_push(struct path_job*, keep, curr);
+    }
+
+    /* The heap was emptied, so it has room for all of them */
+    for(int i = 0; i < kv_size(keep); i++) {
+        curr = kv_A(keep, i);
+        pq_job_push(&s_job_queue, curr->priority, curr);
+    }
+    kv_destroy(keep);
+}
+
+static float ps_priority(size_t num_srcs, const vec2_t xz_srcs[])
+{
+    float ret = SDL_GetTicks() - s_start_ms;
+    if(!s_has_focus)
+        return ret;
+
+    float min_dist = INFINITY;
+    for(int i = 0; i < num_srcs; i++) {
+
+        vec2_t delta;
+        PFM_Vec2_Sub((vec2_t*)&xz_srcs[i], &s_focus, &delta);
+        float dist = PFM_Vec2_Len(&delta);
+        min_dist = dist < min_dist ? dist : min_dist;
+    }
+    return ret + min_dist * FOCUS_DELAY_PER_DIST;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_PS_Init(void)
+{
+    if(NULL == (s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(NULL == (s_work_cond = SDL_CreateCond()))
+        goto fail_work_cond;
+    if(NULL == (s_done_cond = SDL_CreateCond()))
+        goto fail_done_cond;
+    if(NULL == (s_job_table = kh_init(job)))
+        goto fail_table;
+    pq_job_init(&s_job_queue);
+    if(!N_SN_Init(MAX_WORKERS))
+        goto fail_snapshots;
+
+    /* Leave one core for the main thread */
+    s_num_workers = SDL_GetCPUCount() - 1;
+    s_num_workers = s_num_workers < 1           ? 1 
+                  : s_num_workers > MAX_WORKERS ? MAX_WORKERS 
+                  : s_num_workers;
+    s_quit = false;
+    s_start_ms = SDL_GetTicks();
+
+    for(int i = 0; i < s_num_workers; i++) {
+        s_workers[i] = SDL_CreateThread(ps_worker, "nav_worker", (void*)(uintptr_t)i);
+        if(!s_workers[i]) {
+            s_num_workers = i;
+            break;
+        }
+    }
+    if(s_num_workers == 0)
+        goto fail_threads;
+
+    s_running = true;
+    return true;
+
+fail_threads:
+    N_SN_Shutdown();
+fail_snapshots:
+    pq_job_destroy(&s_job_queue);
+    kh_destroy(job, s_job_table);
+fail_table:
+    SDL_DestroyCond(s_done_cond);
+fail_done_cond:
+    SDL_DestroyCond(s_work_cond);
+fail_work_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    return false;
+}
+
+void N_PS_Shutdown(void)
+{
+    SDL_LockMutex(s_lock);
+    s_quit = true;
+    SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+
+    for(int i = 0; i < s_num_workers; i++)
+        SDL_WaitThread(s_workers[i], NULL);
+
+    struct path_job *curr;
+    kh_foreach_value(s_job_table, curr, {
+        ps_free_job(curr);
+    });
+
+    N_SN_Shutdown();
+    kh_destroy(job, s_job_table);
+    pq_job_destroy(&s_job_queue);
+    SDL_DestroyCond(s_done_cond);
+    SDL_DestroyCond(s_work_cond);
+    SDL_DestroyMutex(s_lock);
+    s_running = false;
+}
+
+path_ticket_t N_PS_Submit(struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                          vec2_t xz_dest, vec3_t map_pos)
+{
+    if(!s_running || num_srcs == 0)
+        return NULL_PATH_TICKET;
+
+    /* There is no consistent copy of the data for the job to read. This 
+     * only happens when a path is requested between the cutting out of 
+     * static objects and the rebuilding of the portals on a fresh map. */
+    if(!N_SN_Publish(priv) && !priv->snapshot)
+        return NULL_PATH_TICKET;
+
+    /* The sources and their results are kept in the same allocation as the job */
+    struct path_job *job = malloc(sizeof(struct path_job) 
+                                + num_srcs * (sizeof(vec2_t) + sizeof(bool)));
+    if(!job)
+        return NULL_PATH_TICKET;
+
+    *job = (struct path_job){
+        .state    = JOB_QUEUED,
+        .status   = PATH_PENDING,
+        .priv     = priv,
+        .xz_dest  = xz_dest,
+        .map_pos  = map_pos,
+        .num_srcs = num_srcs,
+        .xz_srcs  = (vec2_t*)(job + 1),
+        .priority = ps_priority(num_srcs, xz_srcs),
+    };
+    job->found = (bool*)(job->xz_srcs + num_srcs);
+    memcpy(job->xz_srcs, xz_srcs, num_srcs * sizeof(vec2_t));
+    memset(job->found, 0, num_srcs * sizeof(bool));
+    N_PathResultInit(&job->result);
+    N_PathSeed(priv, num_srcs, xz_srcs, xz_dest, map_pos, &job->result);
+
+    SDL_LockMutex(s_lock);
+
+    job->ticket = s_next_ticket++;
+    if(s_next_ticket == NULL_PATH_TICKET)
+        s_next_ticket++;
+
+    int ret;
+    khiter_t k = kh_put(job, s_job_table, job->ticket, &ret);
+    if(ret == -1 || !pq_job_push(&s_job_queue, job->priority, job)) {
+        if(ret != -1)
+            kh_del(job, s_job_table, k);
+        SDL_UnlockMutex(s_lock);
+        ps_free_job(job);
+        return NULL_PATH_TICKET;
+    }
+    kh_value(s_job_table, k) = job;
+
+    SDL_CondSignal(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+
+    return job->ticket;
+}
+
+enum path_status N_PS_Poll(path_ticket_t ticket)
+{
+    if(!s_running)
+        return PATH_FAILED;
+
+    SDL_LockMutex(s_lock);
+    struct path_job *job = ps_job(ticket);
+again:
+    while(s_synchronous && job && (job->state == JOB_QUEUED || job->state == JOB_RUNNING))
+        SDL_CondWait(s_done_cond, s_lock);
+
+    /* The portals changed after the snapshot that the job ran against was 
+     * made, and the fields cached since are built from the new ones. Rather
+     * than mixing the two, the job is ran again once there is a snapshot 
+     * of the new portals. */
+    if(job && job->state == JOB_DONE && job->portal_version != job->priv->portal_version) {
+
+        if(!N_SN_Publish(job->priv) || !ps_requeue(job)) {
+            SDL_UnlockMutex(s_lock);
+            return PATH_PENDING;
+        }
+        goto again;
+    }
+    enum job_state state = job ? job->state : JOB_COMMITTED;
+    SDL_UnlockMutex(s_lock);
+
+    if(!job)
+        return PATH_FAILED;
+
+    switch(state) {
+    case JOB_QUEUED:
+    case JOB_RUNNING:
+        return PATH_PENDING;
+    case JOB_DONE:
+        /* Once a job is done, no worker thread will touch it again */
+        N_PathCommit(&job->result);
+        job->status = job->result.success ? PATH_READY : PATH_FAILED;
+        N_PathResultDestroy(&job->result);
+        job->state = JOB_COMMITTED;
+        /* fallthrough */
+    case JOB_COMMITTED:
+        return job->status;
+    default: 
+        assert(0);
+        return PATH_FAILED;
+    }
+}
+
+bool N_PS_SourceFound(path_ticket_t ticket, size_t src_idx)
+{
+    if(!s_running)
+        return false;
+
+    SDL_LockMutex(s_lock);
+    struct path_job *job = ps_job(ticket);
+    SDL_UnlockMutex(s_lock);
+
+    if(!job || job->state != JOB_COMMITTED || job->status != PATH_READY)
+        return false;
+    if(src_idx >= job->num_srcs)
+        return false;
+    return job->found[src_idx];
+}
+
+void N_PS_Release(path_ticket_t ticket)
+{
+    if(!s_running || ticket == NULL_PATH_TICKET)
+        return;
+
+    SDL_LockMutex(s_lock);
+    struct path_job *job = ps_job(ticket);
+    if(!job) {
+        SDL_UnlockMutex(s_lock);
+        return;
+    }
+
+    /* The job may still be referenced by the queue or a worker. A worker is
+     * left to finish its' slice and free the job itself. */
+    if(job->state == JOB_RUNNING) {
+        job->abandoned = true;
+        SDL_UnlockMutex(s_lock);
+        return;
+    }
+    if(job->state == JOB_QUEUED)
+        ps_unqueue(job->priv, job);
+
+    kh_del(job, s_job_table, kh_get(job, s_job_table, ticket));
+    SDL_UnlockMutex(s_lock);
+
+    ps_free_job(job);
+}
+
+void N_PS_SetSynchronous(bool on)
+{
+    SDL_LockMutex(s_lock);
+    s_synchronous = on;
+    /* Workers which ran out of budget may carry on */
+    SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
+void N_PS_SetBudget(float ms)
+{
+    SDL_LockMutex(s_lock);
+    s_budget_ticks = ms > 0.0f ? ms / 1000.0 * SDL_GetPerformanceFrequency() : 0;
+    SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
+void N_PS_SetFocus(vec2_t xz)
+{
+    s_focus = xz;
+    s_has_focus = true;
+}
+
+void N_PS_NewFrame(void)
+{
+    if(!s_running)
+        return;
+
+    SDL_LockMutex(s_lock);
+    s_frame++;
+    if(s_budget_ticks && pq_size(&s_job_queue))
+        SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
+void N_PS_Publish(struct nav_private *priv)
+{
+    if(!s_running)
+        return;
+
+    /* The jobs submitted later make their own snapshot, so one is only 
+     * made here when there are jobs still waiting to pick it up */
+    SDL_LockMutex(s_lock);
+    bool queued = ps_busy(priv, true);
+    SDL_UnlockMutex(s_lock);
+
+    if(queued)
+        N_SN_Publish(priv);
+    N_SN_Reclaim();
+}
+
+void N_PS_Discard(const struct nav_private *priv)
+{
+    if(!s_running)
+        return;
+
+    SDL_LockMutex(s_lock);
+    while(ps_busy(priv, false)) {
+        ps_unqueue(priv, NULL);
+        if(ps_busy(priv, false))
+            SDL_CondWait(s_done_cond, s_lock);
+    }
+
+    struct path_job *curr;
+    kh_foreach_value(s_job_table, curr, {
+
+        if(curr->priv != priv || curr->state != JOB_DONE)
+            continue;
+
+        N_PathResultDestroy(&curr->result);
+        curr->status = PATH_FAILED;
+        curr->state = JOB_COMMITTED;
+    });
+    SDL_UnlockMutex(s_lock);
+}
+
@@ -0,0 +1,211 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PATH_SERVICE_H
+#define PATH_SERVICE_H
+
+#include "public/nav.h"
+#include "nav_data.h"
+#include "field.h"
+#include "../lib/public/kvec.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct nav_private;
+
+struct path_flow_result{
+    struct coord      chunk;
+    ff_id_t           ffid;
+    struct flow_field ff;
+};
+
+struct path_los_result{
+    struct coord      chunk;
+    struct LOS_field  lf;
+};
+
+/* The set of fields generated for a single path request. The fields are 
+ * built up privately (possibly on a worker thread) and only get added to 
+ * the field cache once the result is committed on the main thread. The 
+ * corridor holds the chunks on the path, in order from the source chunk 
+ * to the destination chunk. When a result is shared by many sources, the 
+ * corridor holds one such run of chunks per path, each ending in the 
+ * destination chunk. */
+struct path_result{
+    bool                                success;
+    dest_id_t                           dest_id;
+    kvec_t(struct path_flow_result)     flow;
+    kvec_t(struct path_los_result)      los;
+    kvec_t(struct coord)                corridor;
+};
+
+/*###########################################################################*/
+/* PATH COMPUTATION (nav.c)                                                  */
+/*###########################################################################*/
+
+/* ------------------------------------------------------------------------
+ * Generate all the fields needed for a path from 'xz_src' to 'xz_dest'. 
+ * If 'use_cache' is false, the field cache is not touched and the call is 
+ * safe to make from a thread other than the main thread, provided that the 
+ * navigation data is not concurrently modified.
+ * ------------------------------------------------------------------------
+ */
+void N_PathCompute(const struct nav_private *priv, vec2_t xz_src, vec2_t xz_dest, 
+                   vec3_t map_pos, bool use_cache, struct path_result *out);
+
+/* ------------------------------------------------------------------------
+ * Like 'N_PathCompute', but for many sources heading to the same destination.
+ * The portal search is only ran once for all the sources on the same island 
+ * of a chunk, and the fields are shared between all the paths. 'out_found' 
+ * is set for every source for which a path exists. 'out->success' is set 
+ * if a path exists for any of the sources.
+ * ------------------------------------------------------------------------
+ */
+void N_PathComputeBatch(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                        vec2_t xz_dest, vec3_t map_pos, bool use_cache, 
+                        struct path_result *out, bool out_found[]);
+
+/* ------------------------------------------------------------------------
+ * A resumable 'N_PathComputeBatch'. The searches are carried out starting
+ * from the source at index 'first', and stop after the first one to end
+ * past 'deadline' (in performance counter ticks). Returns the index of the
+ * source to carry on from in the next slice, or 'num_srcs' once all of them
+ * are done. The same 'out' and 'out_found' must be passed to every slice,
+ * and 'out->success' is only final after the last one.
+ * ------------------------------------------------------------------------
+ */
+size_t N_PathComputeSlice(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[],
+                          vec2_t xz_dest, vec3_t map_pos, bool use_cache,
+                          struct path_result *out, bool out_found[],
+                          size_t first, uint64_t deadline);
+
+/* ------------------------------------------------------------------------
+ * Add the fields of a computed path to the field cache. Must be called 
+ * from the main thread.
+ * ------------------------------------------------------------------------
+ */
+void N_PathCommit(const struct path_result *result);
+
+/* ------------------------------------------------------------------------
+ * Copy the cached fields that a path from the sources to 'xz_dest' may be 
+ * able to reuse into the result: the fields of the destination chunk and 
+ * those along the cached corridors from the source chunks. A following call
+ * to 'N_PathCompute' without the cache then only builds the missing fields.
+ * Must be called from the main thread.
+ * ------------------------------------------------------------------------
+ */
+void N_PathSeed(const struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                vec2_t xz_dest, vec3_t map_pos, struct path_result *out);
+
+void N_PathResultInit(struct path_result *result);
+void N_PathResultDestroy(struct path_result *result);
+
+/*###########################################################################*/
+/* PATH SERVICE                                                              */
+/*###########################################################################*/
+
+bool             N_PS_Init(void);
+void             N_PS_Shutdown(void);
+
+path_ticket_t    N_PS_Submit(struct nav_private *priv, size_t num_srcs, const vec2_t xz_srcs[], 
+                             vec2_t xz_dest, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * The first call to observe that the job has finished commits its' fields
+ * to the field cache. The final status is kept until 'N_PS_Release' is 
+ * called for the ticket.
+ * ------------------------------------------------------------------------
+ */
+enum path_status N_PS_Poll(path_ticket_t ticket);
+
+/* ------------------------------------------------------------------------
+ * Returns true if a path was found for the source at index 'src_idx' of the
+ * job. Only valid once 'N_PS_Poll' has reported 'PATH_READY' for the ticket.
+ * ------------------------------------------------------------------------
+ */
+bool             N_PS_SourceFound(path_ticket_t ticket, size_t src_idx);
+void             N_PS_Release(path_ticket_t ticket);
+
+/* ------------------------------------------------------------------------
+ * In synchronous mode, 'N_PS_Poll' blocks until the job has finished 
+ * instead of reporting it as pending. The jobs still run on the worker 
+ * threads, in parallel with the caller until it polls.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_SetSynchronous(bool on);
+
+/* ------------------------------------------------------------------------
+ * Limit the time that every worker thread spends on jobs in a single frame
+ * to 'ms' milliseconds. A job that is still unfinished when its' worker runs
+ * out of time is put back in the queue and carried on with later. 0 turns 
+ * the limit off. The limit doesn't apply in synchronous mode.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_SetBudget(float ms);
+
+/* ------------------------------------------------------------------------
+ * The queued jobs are ran oldest first, but the jobs with all their sources
+ * far away from the focus point are held back, as if they had been submitted 
+ * later. Must be called from the main thread.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_SetFocus(vec2_t xz);
+
+/* ------------------------------------------------------------------------
+ * Called at the start of every frame, to hand out a new time budget to the
+ * worker threads.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_NewFrame(void);
+
+/* ------------------------------------------------------------------------
+ * The jobs read a snapshot of the navigation data (see snapshot.h), so the 
+ * data may be changed while they run. Once the changes of a tick have been
+ * made, this is called to hand them over to the jobs which haven't started 
+ * yet and to free the snapshots that are no longer read.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_Publish(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Wait for all jobs using the navigation data and drop their results. 
+ * Any outstanding tickets for the data will report 'PATH_FAILED'.
+ * ------------------------------------------------------------------------
+ */
+void             N_PS_Discard(const struct nav_private *priv);
+
+#endif
+
@@ -46,6 +46,50 @@ struct obb;
 struct entity;
 
 typedef uint32_t dest_id_t;
+typedef uint32_t path_ticket_t;
+
+#define NULL_PATH_TICKET ((path_ticket_t)0)
+
+/* Entities of different sizes path on separate layers of the navigation 
+ * data, in which the impassable regions are grown by different amounts 
+ * to keep the entities clear of any obstacles. */
+enum nav_layer{
+    NAV_LAYER_GROUND_1X1,
+    NAV_LAYER_GROUND_3X3,
+    NAV_LAYER_GROUND_5X5,
+    NAV_LAYER_GROUND_7X7,
+    NAV_LAYER_MAX,
+};
+
+enum path_status{
+    PATH_PENDING,
+    PATH_READY,
+    PATH_FAILED,
+};
+
+struct nav_cache_stats{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t   bytes_resident;
+    size_t   bytes_budget;
+};
+
+/* Work done computing paths since startup, including the paths computed 
+ * in the background */
+struct nav_perf_stats{
+    uint64_t portal_searches;
+    uint64_t flow_fields;
+    uint64_t los_fields;
+    /* Waypoint paths searched for (not counting the ones taken from the cache) */
+    uint64_t waypoint_paths;
+    /* Total time spent in each stage, in microseconds. The portal searches 
+     * made for waypoint paths are counted in both. */
+    uint64_t portal_search_us;
+    uint64_t flow_field_us;
+    uint64_t los_field_us;
+    uint64_t waypoint_us;
+};
 
 /*###########################################################################*/
 /* NAV GENERAL                                                               */
@@ -65,9 +109,9 @@ void      N_Shutdown(void);
 
 /* ------------------------------------------------------------------------
  * Return a new navigation context for a map, containing pathability
- * information. 'w' and 'h' are the number of chunk columns/rows per map.
- * 'chunk_tiles' holds pointers to tile arrays for every chunk, in 
- * row-major order.
+ * information for every layer. 'w' and 'h' are the number of chunk 
+ * columns/rows per map. 'chunk_tiles' holds pointers to tile arrays for 
+ * every chunk, in row-major order.
  * ------------------------------------------------------------------------
  */
 void     *N_BuildForMapData(size_t w, size_t h, 
@@ -75,20 +119,38 @@ void     *N_BuildForMapData(size_t w, size_t h,
                             const struct tile **chunk_tiles);
 
 /* ------------------------------------------------------------------------
- * Clean up resources allocated by 'N_BuildForMapData'.
+ * Like 'N_BuildForMapData', but the navigation context is read from a file
+ * previously written with 'N_SaveForMapData'. Returns NULL if the file does 
+ * not exist, is corrupted, or was not built from the same tiles.
+ * ------------------------------------------------------------------------
+ */
+void     *N_LoadForMapData(size_t w, size_t h, 
+                           size_t chunk_w, size_t chunk_h,
+                           const struct tile **chunk_tiles, const char *path);
+
+/* ------------------------------------------------------------------------
+ * Write a navigation context, freshly built from 'chunk_tiles' with 
+ * 'N_BuildForMapData', to a file.
+ * ------------------------------------------------------------------------
+ */
+bool      N_SaveForMapData(void *nav_private, size_t chunk_w, size_t chunk_h,
+                           const struct tile **chunk_tiles, const char *path);
+
+/* ------------------------------------------------------------------------
+ * Clean up resources allocated by 'N_BuildForMapData' or 'N_LoadForMapData'.
  * ------------------------------------------------------------------------
  */
 void      N_FreePrivate(void *nav_private);
 
 /* ------------------------------------------------------------------------
  * Draw a translucent overlay over the map chunk, showing the pathable and 
- * non-pathable regions. 'chunk_x_dim' and 'chunk_z_dim' are the chunk
- * dimensions in OpenGL coordinates.
+ * non-pathable regions of the specified layer. 'chunk_x_dim' and 
+ * 'chunk_z_dim' are the chunk dimensions in OpenGL coordinates.
  * ------------------------------------------------------------------------
  */
 void      N_RenderPathableChunk(void *nav_private, mat4x4_t *chunk_model,
-                                const struct map *map,
-                                int chunk_r, int chunk_c);
+                                const struct map *map, int chunk_r, int chunk_c,
+                                enum nav_layer layer);
 
 /* ------------------------------------------------------------------------
  * Renders a flow field that will steer entities to the destination id for
@@ -111,32 +173,218 @@ void      N_RenderLOSField(void *nav_private, const struct map *map, mat4x4_t *c
 
 /* ------------------------------------------------------------------------
  * Make an impassable region in the cost field, completely covering the 
- * specified OBB.
+ * specified OBB, in every layer. The chunks touched are marked dirty for 
+ * the next call to N_UpdatePortals.
  * ------------------------------------------------------------------------
  */
 void      N_CutoutStaticObject(void *nav_private, vec3_t map_pos, const struct obb *obb);
 
+/* ------------------------------------------------------------------------
+ * Batched version of 'N_CutoutStaticObject'. The OBBs are binned by the 
+ * chunks they cover, and the chunks are cut out in parallel.
+ * ------------------------------------------------------------------------
+ */
+void      N_CutoutStaticObjects(void *nav_private, vec3_t map_pos, size_t count, 
+                                const struct obb *obbs);
+
+/* ------------------------------------------------------------------------
+ * Add or remove a temporary blocker (ex. a unit holding its' position) 
+ * covering a circle on the map. Tiles covered by blockers are more costly 
+ * to cross, but remain passable. The changes are buffered until the next 
+ * call to 'N_UpdateBlockers'. A decref must use the same arguments as the
+ * matching incref.
+ * ------------------------------------------------------------------------
+ */
+void      N_BlockersIncref(void *nav_private, vec3_t map_pos, vec2_t xz_pos, float radius);
+void      N_BlockersDecref(void *nav_private, vec3_t map_pos, vec2_t xz_pos, float radius);
+
+/* ------------------------------------------------------------------------
+ * Apply the buffered blocker changes, unless background path requests are 
+ * still reading the navigation data, in which case they are kept for a
+ * later call. The cached flow fields for the chunks with changed blockers 
+ * are updated in place.
+ * ------------------------------------------------------------------------
+ */
+void      N_UpdateBlockers(void *nav_private);
+
 /* ------------------------------------------------------------------------
  * Update portals and the links between them after there have been 
  * changes to the cost field, as new obstructions could have closed off 
- * paths or removed obstructions could have opened up new ones.
+ * paths or removed obstructions could have opened up new ones. Only the 
+ * dirty chunks and their neighbours are rebuilt, and only their cached 
+ * fields are invalidated.
  * ------------------------------------------------------------------------
  */
 void      N_UpdatePortals(void *nav_private);
 
+/* ------------------------------------------------------------------------
+ * Evict all cached flow and LOS fields which could have been made stale by
+ * a change in the specified chunk.
+ * ------------------------------------------------------------------------
+ */
+void      N_InvalidateChunkFields(void *nav_private, int chunk_r, int chunk_c);
+
+/* ------------------------------------------------------------------------
+ * Set the maximum number of bytes of memory used for caching flow and LOS
+ * fields. Least recently used fields are evicted to stay within the budget.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetCacheBudget(size_t bytes);
+
+/* ------------------------------------------------------------------------
+ * Carry the flow field integration on across the borders of up to 'chunks'
+ * consecutive chunks of a path, as if they were a single field. Units then
+ * cross from one chunk into the next wherever is best for the rest of the 
+ * way, instead of heading for the nearest part of every portal. Once the 
+ * fields of a path have taken 'budget_ms' to build, the remaining ones are 
+ * built on their own. 0 or 1 chunks turns this off (the default). Affects 
+ * the paths requested from now on.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetFlowWindow(int chunks, float budget_ms);
+
+/* ------------------------------------------------------------------------
+ * Group destinations into square goal regions of 'tiles' navigation tiles 
+ * a side. Paths to destinations in the same region share the flow fields 
+ * of all the chunks before the destination chunk, so only the field of the 
+ * destination chunk is built for every destination tile. Regions spanning 
+ * more than one island of their chunk are not shared. 0 or 1 turns this 
+ * off (the default). Affects the paths requested from now on.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetGoalRegion(int tiles);
+
+/* ------------------------------------------------------------------------
+ * In deterministic mode, the background path requests are always ready the
+ * first time they are polled, so that the results seen by the simulation 
+ * don't depend on the timing of the path threads.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetDeterministic(bool on);
+
+/* ------------------------------------------------------------------------
+ * Limit the time that every path thread spends on the background requests
+ * in a single frame to 'ms' milliseconds. The requests which don't fit are
+ * carried on with in the following frames, one group of sources at a time,
+ * so that a flood of orders doesn't take the CPU away from the frame. 0 
+ * turns the limit off (the default). Doesn't apply in deterministic mode.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetPathBudget(float ms);
+
+/* ------------------------------------------------------------------------
+ * The background requests are serviced oldest first, but the ones with all
+ * their sources far away from the focus point (normally, the camera) are 
+ * held back a little, as if they had been made later.
+ * ------------------------------------------------------------------------
+ */
+void      N_SetPathFocus(vec2_t xz);
+
+/* ------------------------------------------------------------------------
+ * Get the field cache hit, miss and eviction counts and its' memory usage.
+ * ------------------------------------------------------------------------
+ */
+void      N_GetCacheStats(struct nav_cache_stats *out);
+
+/* ------------------------------------------------------------------------
+ * Get the number of portal graph searches, flow fields and LOS fields 
+ * computed, and the time spent on each.
+ * ------------------------------------------------------------------------
+ */
+void      N_GetPerfStats(struct nav_perf_stats *out);
+
 /* ------------------------------------------------------------------------
  * Generate the required flowfield and LOS sectors for moving towards the 
- * specified destination.
+ * specified destination on the specified layer.
  * Returns true, if pathing is possible. In that case, 'out_dest_id' will
- * be set to a handle that can be used to query relevant fields.
+ * be set to a handle that can be used to query relevant fields. The handle
+ * is distinct for every layer.
  * ------------------------------------------------------------------------
  */
 bool      N_RequestPath(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
-                        vec3_t map_pos, dest_id_t *out_dest_id);
+                        vec3_t map_pos, enum nav_layer layer, dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Like 'N_RequestPath', but for many sources moving to the same destination.
+ * Sources on the same island of a chunk share a single portal search, and
+ * every field is only generated once for all of the sources. 'out_found'
+ * is set for every source from which pathing is possible. Returns true if
+ * pathing is possible from any of the sources.
+ * ------------------------------------------------------------------------
+ */
+bool      N_RequestPaths(void *nav_private, size_t num_srcs, const vec2_t xz_srcs[], 
+                         vec2_t xz_dest, vec3_t map_pos, enum nav_layer layer, 
+                         dest_id_t *out_dest_id, bool out_found[]);
+
+/* ------------------------------------------------------------------------
+ * A lightweight alternative to 'N_RequestPath' for a single unit. Instead of
+ * generating fields, the tiles of the chunks along the portal path are 
+ * searched and the resulting path is pulled taut, giving a short list of 
+ * points to head for in turn. The last one is 'xz_dest'. Paths are cached 
+ * under the destination's handle and a request from a position in sight of 
+ * a cached path joins it instead of searching again. Returns the number of 
+ * points written to 'out', or 0 if there is no path. If the path has more 
+ * than 'maxout' points, the rest are dropped and the caller must request 
+ * the path again once it reaches the last point it got.
+ * ------------------------------------------------------------------------
+ */
+size_t    N_RequestWaypoints(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                             vec3_t map_pos, enum nav_layer layer, size_t maxout, 
+                             vec2_t out[], dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Queue up a path request to be serviced by a worker thread. The flow and
+ * LOS fields will be generated in the background, and will become 
+ * available only after the returned ticket is polled with 'N_PollPath' 
+ * and reports 'PATH_READY'. 'out_dest_id' is set to the handle of the 
+ * destination right away. Returns 'NULL_PATH_TICKET' on failure.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t N_RequestPathAsync(void *nav_private, vec2_t xz_src, vec2_t xz_dest, 
+                                 vec3_t map_pos, enum nav_layer layer, 
+                                 dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Queue up a batched path request (as in 'N_RequestPaths'), serviced by a 
+ * single worker thread job. The ticket reports 'PATH_READY' if a path was 
+ * found from any of the sources. Use 'N_PathFound' to check the individual
+ * sources after that.
+ * ------------------------------------------------------------------------
+ */
+path_ticket_t N_RequestPathsAsync(void *nav_private, size_t num_srcs, const vec2_t xz_srcs[], 
+                                  vec2_t xz_dest, vec3_t map_pos, enum nav_layer layer, 
+                                  dest_id_t *out_dest_id);
+
+/* ------------------------------------------------------------------------
+ * Returns the status of an asynchronous path request. Once the request is
+ * complete, the generated fields are added to the field cache. The status
+ * remains queryable until the ticket is released with 'N_ReleasePath'.
+ * Must be called from the main thread.
+ * ------------------------------------------------------------------------
+ */
+enum path_status N_PollPath(path_ticket_t ticket);
+
+/* ------------------------------------------------------------------------
+ * Returns true if a path was found from the source at index 'src_idx' of
+ * the request. Only valid once the ticket has reported 'PATH_READY'. The 
+ * source of a single path request has the index 0.
+ * ------------------------------------------------------------------------
+ */
+bool      N_PathFound(path_ticket_t ticket, size_t src_idx);
+
+/* ------------------------------------------------------------------------
+ * Free the resources associated with a path request ticket.
+ * ------------------------------------------------------------------------
+ */
+void      N_ReleasePath(path_ticket_t ticket);
 
 /* ------------------------------------------------------------------------
  * Returns the desired velocity for an entity at 'curr_pos' for it to flow
- * towards a particular destination.
+ * towards a particular destination. If the fields for the current chunk 
+ * are missing, they are requested in the background. Until they are ready,
+ * the entity is steered towards the centre of the portal out of the chunk 
+ * which looks to be on the way. The fields for the chunks the entity is 
+ * about to enter are requested ahead of time, in the same way.
  * ------------------------------------------------------------------------
  */
 vec2_t    N_DesiredVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest, 
@@ -144,16 +392,58 @@ vec2_t    N_DesiredVelocity(dest_id_t id, vec2_t curr_pos, vec2_t xz_dest,
 
 /* ------------------------------------------------------------------------
  * Returns true if the particular destination is in direct line of sight 
- * of the specified position.
+ * of the specified position. As with 'N_DesiredVelocity', the fields for 
+ * the chunks ahead are requested in the background.
  * ------------------------------------------------------------------------
  */
 bool      N_HasDestLOS(dest_id_t id, vec2_t curr_pos, void *nav_private, vec3_t map_pos);
 
 /* ------------------------------------------------------------------------
- * Returns true if the specified XZ position is pathable.
+ * Returns true if the specified XZ position is pathable on the specified
+ * layer.
+ * ------------------------------------------------------------------------
+ */
+bool      N_PositionPathable(vec2_t xz_pos, enum nav_layer layer, 
+                             void *nav_private, vec3_t map_pos);
+
+/* ------------------------------------------------------------------------
+ * Batched queries for the scripts, answered from the islands, the portal
+ * graph and the cost field, without generating any fields. The results
+ * hold as of the last 'N_UpdatePortals' and don't take the blockers into
+ * account. Points outside of the map are never pathable.
+ * ------------------------------------------------------------------------
+ */
+
+/* Sets 'out[i]' if there is a path from 'xz_srcs[i]' to 'xz_dests[i]' */
+void      N_PathsExist(void *nav_private, size_t n, const vec2_t xz_srcs[], 
+                       const vec2_t xz_dests[], vec3_t map_pos, enum nav_layer layer, 
+                       bool out[]);
+
+/* Sets 'out[i]' to the cost of the path from 'xz_srcs[i]' to 'xz_dests[i]',
+ * in cost field units, or INFINITY if there is none. Like the paths taken 
+ * by the units, the path is not guaranteed to be the cheapest one. Sort the 
+ * queries by destination for speed. */
+void      N_PathCosts(void *nav_private, size_t n, const vec2_t xz_srcs[], 
+                      const vec2_t xz_dests[], vec3_t map_pos, enum nav_layer layer, 
+                      float out[]);
+
+void      N_PositionsPathable(void *nav_private, size_t n, const vec2_t xz_positions[],
+                              vec3_t map_pos, enum nav_layer layer, bool out[]);
+
+/* Sets 'out_hit[i]' if the segment from 'xz_srcs[i]' to 'xz_dests[i]' crosses 
+ * an impassable tile or the map edge, and 'out_pos[i]' to the first point where 
+ * it does so. Segments starting outside of the map hit at their start. */
+void      N_Raycasts(void *nav_private, size_t n, const vec2_t xz_srcs[], 
+                     const vec2_t xz_dests[], vec3_t map_pos, enum nav_layer layer, 
+                     bool out_hit[], vec2_t out_pos[]);
+
+/* ------------------------------------------------------------------------
+ * Returns the smallest layer which keeps an entity with the specified 
+ * radius clear of all obstacles. Entities that are too large for any of 
+ * the layers use the last one.
  * ------------------------------------------------------------------------
  */
-bool      N_PositionPathable(vec2_t xz_pos, void *nav_private, vec3_t map_pos);
+enum nav_layer N_LayerForRadius(float radius);
 
 #endif
 
@@ -0,0 +1,192 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "snapshot.h"
+#include "nav_private.h"
+#include "cluster.h"
+#include "../mem.h"
+#include "../lib/public/epoch.h"
+#include "../lib/public/kvec.h"
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define RELOC(ptr, from, to) \
+    ((struct portal*)((char*)(to) + ((const char*)(ptr) - (const char*)(from))))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static epoch_t *s_epoch;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool sn_any_dirty(const struct nav_private *priv)
+{
+    for(int i = 0; i < priv->width * priv->height; i++) {
+        if(priv->chunks[i].dirty)
+            return true;
+    }
+    return false;
+}
+
+static void sn_free(void *ptr)
+{
+    struct nav_private *snap = ptr;
+    N_CL_Destroy(snap);
+    MEM_Free(snap);
+}
+
+/* The portals point at one another and the cluster nodes point at the 
+ * portals, all of which live in the chunks. These are moved over to the 
+ * copy's chunks. */
+static struct nav_private *sn_copy(const struct nav_private *priv)
+{
+    size_t size = sizeof(struct nav_private) + priv->width * priv->height * sizeof(struct nav_chunk);
+    struct nav_private *ret = MEM_Malloc(MEM_TAG_NAV, size);
+    if(!ret)
+        return NULL;
+
+    memcpy(ret, priv, size);
+    ret->snapshot = NULL;
+    kv_init(ret->blocker_changes);
+
+    for(int i = 0; i < priv->width * priv->height; i++) {
+
+        struct nav_chunk *chunk = &ret->chunks[i];
+        for(int j = 0; j < chunk->num_portals; j++) {
+
+            struct portal *port = &chunk->portals[j];
+            if(port->connected)
+                port->connected = RELOC(port->connected, priv, ret);
+            for(int k = 0; k < port->num_neighbours; k++)
+                port->edges[k].neighbour = RELOC(port->edges[k].neighbour, priv, ret);
+        }
+    }
+
+    size_t num_clusters = priv->cluster_width * priv->cluster_height;
+    ret->clusters = malloc(num_clusters * sizeof(struct nav_cluster));
+    if(!ret->clusters) {
+        MEM_Free(ret);
+        return NULL;
+    }
+
+    for(int i = 0; i < num_clusters; i++) {
+
+        const struct nav_cluster *src = &priv->clusters[i];
+        struct nav_cluster *dst = &ret->clusters[i];
+
+        kv_init(dst->nodes);
+        kv_copy(struct cluster_node, dst->nodes, src->nodes);
+
+        for(int j = 0; j < kv_size(dst->nodes); j++) {
+
+            struct cluster_node *node = &kv_A(dst->nodes, j);
+            node->portal = RELOC(node->portal, priv, ret);
+            kv_init(node->edges);
+            kv_copy(struct cluster_edge, node->edges, kv_A(src->nodes, j).edges);
+        }
+    }
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool N_SN_Init(size_t num_readers)
+{
+    s_epoch = epoch_init(num_readers);
+    return (s_epoch != NULL);
+}
+
+void N_SN_Shutdown(void)
+{
+    epoch_free(s_epoch);
+    s_epoch = NULL;
+}
+
+bool N_SN_Publish(struct nav_private *priv)
+{
+    struct nav_private *old = priv->snapshot;
+    if(old && old->version == priv->version)
+        return true;
+
+    if(!s_epoch || sn_any_dirty(priv))
+        return false;
+
+    struct nav_private *snap = sn_copy(priv);
+    if(!snap)
+        return false;
+
+    /* Swapping the pointer is a full barrier, so the readers which pick up
+     * the new snapshot see all of its' contents */
+    SDL_AtomicSetPtr((void**)&priv->snapshot, snap);
+    if(old)
+        epoch_retire(s_epoch, old, sn_free);
+    return true;
+}
+
+void N_SN_Drop(struct nav_private *priv)
+{
+    if(priv->snapshot)
+        sn_free(priv->snapshot);
+    priv->snapshot = NULL;
+}
+
+void N_SN_Reclaim(void)
+{
+    if(s_epoch)
+        epoch_reclaim(s_epoch);
+}
+
+const struct nav_private *N_SN_Enter(const struct nav_private *priv, size_t slot)
+{
+    epoch_enter(s_epoch, slot);
+    return SDL_AtomicGetPtr((void**)&((struct nav_private*)priv)->snapshot);
+}
+
+void N_SN_Exit(size_t slot)
+{
+    epoch_exit(s_epoch, slot);
+}
+
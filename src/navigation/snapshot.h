@@ -0,0 +1,88 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct nav_private;
+
+/* The worker threads don't read the live navigation data, which the main
+ * thread is free to change at any time. They read a snapshot instead: a 
+ * read-only copy of the layer, made on the main thread at a point where the
+ * layer is consistent. A reader picks up the latest snapshot when it starts
+ * and holds on to it without taking any locks until it is done. The replaced
+ * snapshots are freed once none of the readers are holding them. 
+ */
+
+bool N_SN_Init(size_t num_readers);
+void N_SN_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Replace the layer's snapshot with a copy of the live data, if the data 
+ * has changed since the snapshot was made and none of its' chunks are 
+ * waiting for their portals to be rebuilt. Returns true if the snapshot is
+ * up to date with the live data. Must be called from the main thread.
+ * ------------------------------------------------------------------------
+ */
+bool N_SN_Publish(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Free the layer's snapshot right away. None of the readers may be holding
+ * it. Safe to call after 'N_SN_Shutdown'.
+ * ------------------------------------------------------------------------
+ */
+void N_SN_Drop(struct nav_private *priv);
+
+/* ------------------------------------------------------------------------
+ * Free the replaced snapshots which are no longer held by any reader. Must 
+ * be called from the main thread, such as once every tick.
+ * ------------------------------------------------------------------------
+ */
+void N_SN_Reclaim(void);
+
+/* ------------------------------------------------------------------------
+ * Returns the latest snapshot of the layer, which stays valid until the 
+ * matching 'N_SN_Exit', or NULL if the layer has none. Every reader thread 
+ * uses its' own slot, below the 'num_readers' passed to 'N_SN_Init'.
+ * ------------------------------------------------------------------------
+ */
+const struct nav_private *N_SN_Enter(const struct nav_private *priv, size_t slot);
+void                      N_SN_Exit(size_t slot);
+
+#endif
+
@@ -0,0 +1,764 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+/* For 'getaddrinfo' */
+#if !defined(_WIN32)
+    #define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "net.h"
+#include "entity.h"
+#include "event.h"
+#include "lib/public/kvec.h"
+#include "script/public/script.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_WIN32)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    typedef SOCKET net_socket_t;
+    typedef int socklen_t;
+#else
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netdb.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    typedef int net_socket_t;
+    #define INVALID_SOCKET  (-1)
+    #define closesocket     close
+#endif
+
+
+/* Steps in a turn - 6 of the 60Hz steps make for 10 turns a second */
+#define TURN_STEPS          (6)
+#define MAX_PEERS           (7)
+#define MAX_DELAY_TURNS     (16)
+/* Batches kept for each player. The peers can be at most 'delay' turns 
+ * apart, so there are never more than twice the delay in flight. */
+#define RING_TURNS          (64)
+#define MAX_BATCH_SIZE      (16 * 1024)
+/* Packets are filled with batches up to this size, so they are not split 
+ * up on the way. A packet holds at least one batch regardless. */
+#define MAX_PACKET_SIZE     (1200)
+#define RECV_BUFF_SIZE      (64 * 1024)
+#define RESEND_MS           (50)
+
+#define PACKET_MAGIC        (0x544e4650) /* 'PFNT' */
+#define PACKET_VERSION      (1)
+#define PACKET_HEADER_SIZE  (4 + 1 + 1 + 4 + 4 + 1)
+#define BATCH_HEADER_SIZE   (4 + 2)
+
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+typedef kvec_t(unsigned char) kvec_byte_t;
+
+enum cmd_type{
+    CMD_MOVE = 1,
+    CMD_EVENT,
+};
+
+struct batch{
+    /* The turn at which the commands are carried out */
+    uint32_t turn;
+    bool     present;
+    /* The sender's movement checksum at the start of the turn on which the 
+     * batch was sent */
+    uint32_t checksum;
+    kvec_byte_t cmds;
+};
+
+struct peer{
+    int                player;
+    struct sockaddr_in addr;
+    /* All of our batches before this turn were received by the peer */
+    uint32_t           acked;
+    /* All of the peer's batches before this turn were received by us */
+    uint32_t           recvd;
+    struct batch       batches[RING_TURNS];
+};
+
+struct reader{
+    const unsigned char *data;
+    size_t               size;
+    size_t               pos;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                  s_active = false;
+static net_socket_t          s_socket = INVALID_SOCKET;
+static int                   s_player;
+static uint32_t              s_delay;
+
+static struct peer           s_peers[MAX_PEERS];
+static size_t                s_num_peers;
+
+/* Our own batches, kept until all the peers have acknowledged them */
+static struct batch          s_batches[RING_TURNS];
+/* The commands given during the current turn */
+static kvec_byte_t           s_pending;
+/* One past the last of our batches that was sent */
+static uint32_t              s_sent_end;
+
+/* Steps taken since the start of the session */
+static uint64_t              s_step;
+static uint32_t              s_last_send_ms;
+static uint32_t              s_stalled_turn;
+static struct net_stats      s_stats;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The wire format is little endian, with the floats sent bit for bit */
+
+static void put_u8(kvec_byte_t *out, uint8_t val)
+{
+    kv_push(unsigned char, *out, val);
+}
+
+static void put_u16(kvec_byte_t *out, uint16_t val)
+{
+    put_u8(out, val & 0xff);
+    put_u8(out, val >> 8);
+}
+
+static void put_u32(kvec_byte_t *out, uint32_t val)
+{
+    put_u16(out, val & 0xffff);
+    put_u16(out, val >> 16);
+}
+
+static void put_f32(kvec_byte_t *out, float val)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    put_u32(out, bits);
+}
+
+static bool get_bytes(struct reader *in, size_t size, const unsigned char **out)
+{
+    if(in->size - in->pos < size)
+        return false;
+    *out = in->data + in->pos;
+    in->pos += size;
+    return true;
+}
+
+static bool get_u8(struct reader *in, uint8_t *out)
+{
+    const unsigned char *bytes;
+    if(!get_bytes(in, 1, &bytes))
+        return false;
+    *out = bytes[0];
+    return true;
+}
+
+static bool get_u16(struct reader *in, uint16_t *out)
+{
+    const unsigned char *bytes;
+    if(!get_bytes(in, 2, &bytes))
+        return false;
+    *out = bytes[0] | (bytes[1] << 8);
+    return true;
+}
+
+static bool get_u32(struct reader *in, uint32_t *out)
+{
+    const unsigned char *bytes;
+    if(!get_bytes(in, 4, &bytes))
+        return false;
+    *out = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    return true;
+}
+
+static bool get_f32(struct reader *in, float *out)
+{
+    uint32_t bits;
+    if(!get_u32(in, &bits))
+        return false;
+    memcpy(out, &bits, sizeof(*out));
+    return true;
+}
+
+static uint32_t curr_turn(void)
+{
+    return s_step / TURN_STEPS;
+}
+
+static uint32_t min_acked(void)
+{
+    uint32_t ret = s_sent_end;
+    for(int i = 0; i < s_num_peers; i++) {
+        if(s_peers[i].acked < ret)
+            ret = s_peers[i].acked;
+    }
+    return ret;
+}
+
+static void batch_clear(struct batch *batch)
+{
+    batch->present = false;
+    kv_reset(batch->cmds);
+}
+
+static void send_to_peer(struct peer *peer)
+{
+    kvec_byte_t packet;
+    kv_init(packet);
+
+    /* The batches before the delay are empty and are never sent */
+    uint32_t first = peer->acked > s_delay ? peer->acked : s_delay;
+    uint32_t end = first;
+
+    put_u32(&packet, PACKET_MAGIC);
+    put_u8(&packet, PACKET_VERSION);
+    put_u8(&packet, s_player);
+    put_u32(&packet, peer->recvd);
+    put_u32(&packet, first);
+    put_u8(&packet, 0);
+
+    while(end < s_sent_end && end - first < UINT8_MAX) {
+
+        const struct batch *curr = &s_batches[end % RING_TURNS];
+        assert(curr->present && curr->turn == end);
+
+        if(end > first && kv_size(packet) + BATCH_HEADER_SIZE + kv_size(curr->cmds) > MAX_PACKET_SIZE)
+            break;
+
+        put_u32(&packet, curr->checksum);
+        put_u16(&packet, kv_size(curr->cmds));
+        for(int i = 0; i < kv_size(curr->cmds); i++)
+            put_u8(&packet, kv_A(curr->cmds, i));
+        end++;
+    }
+    kv_A(packet, PACKET_HEADER_SIZE - 1) = end - first;
+
+    int sent = sendto(s_socket, (const char*)packet.a, kv_size(packet), 0, 
+        (const struct sockaddr*)&peer->addr, sizeof(peer->addr));
+    if(sent > 0) {
+        s_stats.packets_sent++;
+        s_stats.bytes_sent += sent;
+    }
+    kv_destroy(packet);
+}
+
+static void send_all(void)
+{
+    for(int i = 0; i < s_num_peers; i++)
+        send_to_peer(&s_peers[i]);
+    s_last_send_ms = SDL_GetTicks();
+}
+
+static struct peer *peer_for_player(int player)
+{
+    for(int i = 0; i < s_num_peers; i++) {
+        if(s_peers[i].player == player)
+            return &s_peers[i];
+    }
+    return NULL;
+}
+
+static bool handle_packet(const unsigned char *data, size_t size)
+{
+    struct reader in = (struct reader){data, size, 0};
+    uint32_t magic, ack, first;
+    uint8_t version, player, num_batches;
+
+    if(!get_u32(&in, &magic) || magic != PACKET_MAGIC
+    || !get_u8(&in, &version) || version != PACKET_VERSION
+    || !get_u8(&in, &player)
+    || !get_u32(&in, &ack)
+    || !get_u32(&in, &first)
+    || !get_u8(&in, &num_batches))
+        return false;
+
+    struct peer *peer = peer_for_player(player);
+    if(!peer)
+        return false;
+
+    /* Acknowledgements of batches that were never sent are bogus */
+    if(ack > s_sent_end)
+        return false;
+    if(ack > peer->acked)
+        peer->acked = ack;
+
+    for(uint32_t turn = first; turn < first + num_batches; turn++) {
+
+        uint32_t checksum;
+        uint16_t cmds_size;
+        const unsigned char *cmds;
+
+        if(!get_u32(&in, &checksum)
+        || !get_u16(&in, &cmds_size)
+        || !get_bytes(&in, cmds_size, &cmds))
+            return false;
+
+        /* Batches that are already carried out, or too far ahead to be 
+         * stored without overwriting ones that are not, are skipped */
+        if(turn < peer->recvd || turn >= curr_turn() + RING_TURNS)
+            continue;
+
+        struct batch *batch = &peer->batches[turn % RING_TURNS];
+        if(batch->present && batch->turn == turn)
+            continue;
+
+        kv_reset(batch->cmds);
+        for(int i = 0; i < cmds_size; i++)
+            kv_push(unsigned char, batch->cmds, cmds[i]);
+        batch->turn = turn;
+        batch->checksum = checksum;
+        batch->present = true;
+    }
+
+    while(true) {
+        const struct batch *next = &peer->batches[peer->recvd % RING_TURNS];
+        if(!next->present || next->turn != peer->recvd)
+            break;
+        peer->recvd++;
+    }
+    return true;
+}
+
+static void recv_all(void)
+{
+    static unsigned char buff[RECV_BUFF_SIZE];
+
+    while(true) {
+
+        struct sockaddr_in from;
+        socklen_t fromlen = sizeof(from);
+        int size = recvfrom(s_socket, (char*)buff, sizeof(buff), 0, 
+            (struct sockaddr*)&from, &fromlen);
+        if(size < 0)
+            break;
+
+        s_stats.packets_recvd++;
+        s_stats.bytes_recvd += size;
+        if(!handle_packet(buff, size))
+            s_stats.packets_dropped++;
+    }
+}
+
+static void check_sync(uint32_t turn, const struct batch *ours, int player, const struct batch *theirs)
+{
+    if(s_stats.desync_turn >= 0 || ours->checksum == theirs->checksum)
+        return;
+
+    s_stats.desync_turn = turn - s_delay;
+    s_stats.desync_player = player;
+    fprintf(stderr, "Lockstep desync at turn %u: player %d's movement checksum is %08x (ours is %08x).\n",
+        turn - s_delay, player, theirs->checksum, ours->checksum);
+}
+
+static void carry_out_move(struct reader *in)
+{
+    float x, z;
+    uint16_t num_uids;
+    if(!get_f32(in, &x) || !get_f32(in, &z) || !get_u16(in, &num_uids))
+        goto fail;
+
+    pentity_kvec_t ents;
+    kv_init(ents);
+
+    for(int i = 0; i < num_uids; i++) {
+
+        uint32_t uid;
+        if(!get_u32(in, &uid)) {
+            kv_destroy(ents);
+            goto fail;
+        }
+
+        struct entity *ent = Entity_FromUID(uid);
+        if(ent)
+            kv_push(struct entity*, ents, ent);
+    }
+
+    G_Move_Order(&ents, (vec2_t){x, z}, G_Move_Tick());
+    kv_destroy(ents);
+    return;
+
+fail:
+    in->pos = in->size;
+}
+
+static void carry_out_event(struct reader *in)
+{
+    uint32_t event;
+    uint16_t arg_size;
+    const unsigned char *arg_data;
+
+    if(!get_u32(in, &event) || !get_u16(in, &arg_size) || !get_bytes(in, arg_size, &arg_data)) {
+        in->pos = in->size;
+        return;
+    }
+
+    script_opaque_t arg = S_UnmarshalArg(arg_data, arg_size);
+    if(!arg)
+        return;
+
+    /* The argument is released once the handlers have run */
+    E_Global_NotifyImmediate(event, arg, ES_SCRIPT);
+}
+
+static void carry_out_batch(const struct batch *batch)
+{
+    struct reader in = (struct reader){batch->cmds.a, kv_size(batch->cmds), 0};
+    uint8_t type;
+
+    while(get_u8(&in, &type)) {
+
+        switch(type) {
+        case CMD_MOVE:  carry_out_move(&in);  break;
+        case CMD_EVENT: carry_out_event(&in); break;
+        default: 
+            /* The rest of the batch can't be made sense of */
+            return;
+        }
+    }
+}
+
+/* The commands of all players are carried out in the order of the players' 
+ * numbers, which is the same for every peer */
+static void carry_out_turn(uint32_t turn)
+{
+    if(turn < s_delay)
+        return;
+
+    const struct batch *ours = &s_batches[turn % RING_TURNS];
+    assert(ours->present && ours->turn == turn);
+    bool ours_done = false;
+
+    for(int i = 0; i < s_num_peers; i++) {
+
+        const struct batch *theirs = &s_peers[i].batches[turn % RING_TURNS];
+        assert(theirs->present && theirs->turn == turn);
+        check_sync(turn, ours, s_peers[i].player, theirs);
+
+        if(!ours_done && s_player < s_peers[i].player) {
+            carry_out_batch(ours);
+            ours_done = true;
+        }
+        carry_out_batch(theirs);
+    }
+
+    if(!ours_done)
+        carry_out_batch(ours);
+}
+
+static bool turn_ready(uint32_t turn)
+{
+    if(turn < s_delay)
+        return true;
+
+    for(int i = 0; i < s_num_peers; i++) {
+        if(s_peers[i].recvd <= turn)
+            return false;
+    }
+    return true;
+}
+
+static int compare_peers(const void *a, const void *b)
+{
+    const struct peer *pa = a, *pb = b;
+    return (pa->player > pb->player) - (pa->player < pb->player);
+}
+
+static bool resolve_peer(const struct net_peer *desc, struct sockaddr_in *out)
+{
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+
+    char port[16];
+    snprintf(port, sizeof(port), "%u", desc->port);
+    if(0 != getaddrinfo(desc->host, port, &hints, &res))
+        return false;
+
+    memcpy(out, res->ai_addr, sizeof(*out));
+    freeaddrinfo(res);
+    return true;
+}
+
+static bool socket_open(uint16_t port)
+{
+    s_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if(s_socket == INVALID_SOCKET)
+        return false;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if(0 != bind(s_socket, (const struct sockaddr*)&addr, sizeof(addr)))
+        goto fail;
+
+#if defined(_WIN32)
+    u_long nonblocking = 1;
+    if(0 != ioctlsocket(s_socket, FIONBIO, &nonblocking))
+        goto fail;
+#else
+    int flags = fcntl(s_socket, F_GETFL, 0);
+    if(flags < 0 || 0 != fcntl(s_socket, F_SETFL, flags | O_NONBLOCK))
+        goto fail;
+#endif
+    return true;
+
+fail:
+    closesocket(s_socket);
+    s_socket = INVALID_SOCKET;
+    return false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Net_Start(int player, uint16_t port, size_t num_peers, 
+               const struct net_peer peers[], int delay_turns)
+{
+    if(s_active)
+        return false;
+    if(num_peers == 0 || num_peers > MAX_PEERS)
+        return false;
+    if(delay_turns < 1 || delay_turns > MAX_DELAY_TURNS)
+        return false;
+    if(player < 0 || player > UINT8_MAX)
+        return false;
+
+    for(int i = 0; i < num_peers; i++) {
+
+        if(peers[i].player < 0 || peers[i].player > UINT8_MAX || peers[i].player == player)
+            return false;
+        for(int j = 0; j < i; j++) {
+            if(peers[j].player == peers[i].player)
+                return false;
+        }
+    }
+
+#if defined(_WIN32)
+    WSADATA wsa_data;
+    if(0 != WSAStartup(MAKEWORD(2, 2), &wsa_data))
+        return false;
+#endif
+
+    s_num_peers = num_peers;
+    for(int i = 0; i < num_peers; i++) {
+
+        struct peer *curr = &s_peers[i];
+        curr->player = peers[i].player;
+        curr->acked = delay_turns;
+        curr->recvd = delay_turns;
+
+        for(int j = 0; j < RING_TURNS; j++) {
+            kv_init(curr->batches[j].cmds);
+            curr->batches[j].present = false;
+        }
+
+        if(!resolve_peer(&peers[i], &curr->addr)) {
+            fprintf(stderr, "Unable to resolve the address of player %d (%s).\n", 
+                peers[i].player, peers[i].host);
+            goto fail_peers;
+        }
+    }
+    qsort(s_peers, s_num_peers, sizeof(struct peer), compare_peers);
+
+    if(!socket_open(port))
+        goto fail_peers;
+
+    for(int i = 0; i < RING_TURNS; i++) {
+        kv_init(s_batches[i].cmds);
+        s_batches[i].present = false;
+    }
+    kv_init(s_pending);
+
+    s_player = player;
+    s_delay = delay_turns;
+    s_sent_end = delay_turns;
+    s_step = 0;
+    s_last_send_ms = 0;
+    s_stalled_turn = UINT32_MAX;
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.desync_turn = -1;
+    s_stats.desync_player = -1;
+
+    G_Move_SetDeterministic(true);
+    s_active = true;
+    return true;
+
+fail_peers:
+    for(int i = 0; i < num_peers; i++) {
+        for(int j = 0; j < RING_TURNS; j++)
+            kv_destroy(s_peers[i].batches[j].cmds);
+    }
+    s_num_peers = 0;
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+    return false;
+}
+
+void Net_Stop(void)
+{
+    if(!s_active)
+        return;
+
+    closesocket(s_socket);
+    s_socket = INVALID_SOCKET;
+#if defined(_WIN32)
+    WSACleanup();
+#endif
+
+    for(int i = 0; i < s_num_peers; i++) {
+        for(int j = 0; j < RING_TURNS; j++)
+            kv_destroy(s_peers[i].batches[j].cmds);
+    }
+    s_num_peers = 0;
+
+    for(int i = 0; i < RING_TURNS; i++)
+        kv_destroy(s_batches[i].cmds);
+    kv_destroy(s_pending);
+    s_active = false;
+}
+
+bool Net_Active(void)
+{
+    return s_active;
+}
+
+void Net_Update(void)
+{
+    if(!s_active)
+        return;
+
+    recv_all();
+
+    /* Sent even when there are no batches waiting to be acknowledged, so 
+     * that our acknowledgements keep reaching the peers */
+    if(SDL_GetTicks() - s_last_send_ms >= RESEND_MS)
+        send_all();
+}
+
+bool Net_StepBegin(void)
+{
+    if(!s_active)
+        return true;
+
+    if(s_step % TURN_STEPS) {
+        s_step++;
+        return true;
+    }
+
+    uint32_t turn = curr_turn();
+    uint32_t send_turn = turn + s_delay;
+
+    if(!turn_ready(turn) || send_turn - min_acked() >= RING_TURNS) {
+        if(s_stalled_turn != turn)
+            s_stats.stalled_turns++;
+        s_stalled_turn = turn;
+        return false;
+    }
+
+    struct batch *batch = &s_batches[send_turn % RING_TURNS];
+    batch_clear(batch);
+    for(int i = 0; i < kv_size(s_pending); i++)
+        kv_push(unsigned char, batch->cmds, kv_A(s_pending, i));
+    batch->turn = send_turn;
+    batch->checksum = G_Move_Checksum();
+    batch->present = true;
+    kv_reset(s_pending);
+
+    s_sent_end = send_turn + 1;
+    send_all();
+
+    carry_out_turn(turn);
+    s_step++;
+    s_stats.turn = turn + 1;
+    return true;
+}
+
+bool Net_QueueMove(const pentity_kvec_t *ents, vec2_t target_xz)
+{
+    if(!s_active)
+        return false;
+
+    size_t num_uids = kv_size(*ents);
+    if(num_uids > UINT16_MAX
+    || kv_size(s_pending) + 1 + 4 + 4 + 2 + num_uids * 4 > MAX_BATCH_SIZE)
+        return false;
+
+    put_u8(&s_pending, CMD_MOVE);
+    put_f32(&s_pending, target_xz.x);
+    put_f32(&s_pending, target_xz.y);
+    put_u16(&s_pending, num_uids);
+    for(int i = 0; i < num_uids; i++)
+        put_u32(&s_pending, kv_A(*ents, i)->uid);
+    return true;
+}
+
+bool Net_QueueEvent(int event, const void *arg, size_t arg_size)
+{
+    if(!s_active)
+        return false;
+
+    if(arg_size > UINT16_MAX
+    || kv_size(s_pending) + 1 + 4 + 2 + arg_size > MAX_BATCH_SIZE)
+        return false;
+
+    put_u8(&s_pending, CMD_EVENT);
+    put_u32(&s_pending, event);
+    put_u16(&s_pending, arg_size);
+    for(int i = 0; i < arg_size; i++)
+        put_u8(&s_pending, ((const unsigned char*)arg)[i]);
+    return true;
+}
+
+void Net_GetStats(struct net_stats *out)
+{
+    *out = s_stats;
+}
+
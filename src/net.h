@@ -0,0 +1,126 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+#ifndef NET_H
+#define NET_H
+
+#include "pf_math.h"
+#include "game/public/game.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* ------------------------------------------------------------------------
+ * Lockstep networking. The simulation is split up into turns of a fixed 
+ * number of steps. The commands given by a player during a turn are sent 
+ * to all the peers as a single batch, and are carried out by every peer at
+ * the start of the turn 'delay' turns later. A step is only taken once the
+ * batches of all players for its' turn have arrived, so every peer carries
+ * out the same commands at the same step. Only the commands cross the wire,
+ * along with a checksum of each peer's movement state, which is compared to
+ * catch peers that went out of sync. Relies on deterministic movement.
+ *
+ * The batches are sent over UDP. Every packet repeats all the batches that
+ * the peer has not acknowledged yet, so a lost packet is made up for by the 
+ * next one instead of having to be resent.
+ * ------------------------------------------------------------------------
+ */
+
+struct net_peer{
+    int         player;
+    const char *host;
+    uint16_t    port;
+};
+
+struct net_stats{
+    /* The next turn to be carried out */
+    uint32_t turn;
+    /* Turns that were held back waiting for the peers' batches */
+    uint32_t stalled_turns;
+    uint64_t packets_sent;
+    uint64_t packets_recvd;
+    /* Packets that were malformed or came from unknown players */
+    uint64_t packets_dropped;
+    uint64_t bytes_sent;
+    uint64_t bytes_recvd;
+    /* The first turn at whose start a peer's checksum differed from ours,
+     * and that peer's player, or -1 while all are in sync */
+    int64_t  desync_turn;
+    int      desync_player;
+};
+
+/* ------------------------------------------------------------------------
+ * Binds 'port' and starts the session with the peers. The players are 
+ * numbered by the caller - commands given on the same turn are carried out
+ * in the order of the players' numbers. Must be called by every peer at the
+ * same step, with the same delay, before the first step of the session. 
+ * Switches the movement to deterministic mode.
+ * ------------------------------------------------------------------------
+ */
+bool Net_Start(int player, uint16_t port, size_t num_peers, 
+               const struct net_peer peers[], int delay_turns);
+void Net_Stop(void);
+bool Net_Active(void);
+
+/* ------------------------------------------------------------------------
+ * Receives the peers' packets and sends ours again if they are due. Must 
+ * be called once a frame.
+ * ------------------------------------------------------------------------
+ */
+void Net_Update(void);
+
+/* ------------------------------------------------------------------------
+ * Must be called before each simulation step. Returns false if the step 
+ * can't be taken yet because the peers' batches for the turn have not all
+ * arrived. At the start of a turn, the batch for the turn 'delay' turns 
+ * later is sent and the commands of this turn are carried out.
+ * ------------------------------------------------------------------------
+ */
+bool Net_StepBegin(void);
+
+/* ------------------------------------------------------------------------
+ * Add a command to the batch of the current turn. Return false when the 
+ * batch is full.
+ * ------------------------------------------------------------------------
+ */
+bool Net_QueueMove(const pentity_kvec_t *ents, vec2_t target_xz);
+/* The argument is serialized by the caller, and is handed to 'S_UnmarshalArg'
+ * when the event is raised. */
+bool Net_QueueEvent(int event, const void *arg, size_t arg_size);
+
+void Net_GetStats(struct net_stats *out);
+
+#endif
+
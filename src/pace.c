@@ -0,0 +1,240 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "pace.h"
+#include "config.h"
+#include "perf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Number of frames over which the statistics are computed */
+#define HISTORY_FRAMES  (240)
+/* The sleep is cut short by this much, and the rest of the wait is spun 
+ * out, since the OS may oversleep by about a millisecond */
+#define SPIN_MS         (1.5)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool     s_enabled = true;
+static int      s_target_fps = CONFIG_TARGET_FPS;
+static bool     s_focused = true;
+static bool     s_minimized = false;
+static uint32_t s_last_input_ms;
+
+/* The time at which the next frame is due to end */
+static uint64_t s_deadline;
+static uint64_t s_last_frame_end;
+
+static float    s_frame_ms[HISTORY_FRAMES];
+static float    s_busy_ms[HISTORY_FRAMES];
+static int      s_history_head;
+static int      s_num_frames;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static double ticks_to_ms(uint64_t ticks)
+{
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/* Returns 0 when the frames shouldn't be held back */
+static int pace_curr_fps(void)
+{
+    if(!s_enabled)
+        return 0;
+
+#if defined(PF_HEADLESS)
+    /* There is no window to lose focus, no swap to wait on and no user
+     * whose input would end the idling */
+    return s_target_fps;
+#endif
+
+    if(!s_focused || s_minimized)
+        return CONFIG_BACKGROUND_FPS;
+
+    /* While in focus, the buffer swaps already wait for the display */
+    int ret = CONFIG_VSYNC ? 0 : s_target_fps;
+
+    if(SDL_GetTicks() - s_last_input_ms >= CONFIG_IDLE_SECS * 1000)
+        ret = ret ? MIN(ret, CONFIG_IDLE_FPS) : CONFIG_IDLE_FPS;
+
+    return ret;
+}
+
+static void pace_wait_until(uint64_t deadline)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    if(now >= deadline)
+        return;
+
+    double left_ms = ticks_to_ms(deadline - now);
+    if(left_ms > SPIN_MS)
+        SDL_Delay((uint32_t)(left_ms - SPIN_MS));
+
+    while(SDL_GetPerformanceCounter() < deadline)
+        ;
+}
+
+static float pace_percentile(float *sorted, int count, float pct)
+{
+    int idx = (int)(pct * (count - 1) + 0.5f);
+    return sorted[idx];
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void Pace_SetEnabled(bool on)
+{
+    s_enabled = on;
+    s_deadline = 0;
+}
+
+void Pace_HandleEvent(const SDL_Event *event)
+{
+    switch(event->type) {
+    case SDL_WINDOWEVENT:
+
+        switch(event->window.event) {
+        case SDL_WINDOWEVENT_FOCUS_GAINED:  
+            s_focused = true;    
+            s_last_input_ms = SDL_GetTicks();
+            break;
+        case SDL_WINDOWEVENT_FOCUS_LOST:    s_focused = false;   break;
+        case SDL_WINDOWEVENT_MINIMIZED:     s_minimized = true;  break;
+        case SDL_WINDOWEVENT_RESTORED:      
+        case SDL_WINDOWEVENT_MAXIMIZED:     s_minimized = false; break;
+        }
+        break;
+
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_TEXTINPUT:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEWHEEL:
+        s_last_input_ms = SDL_GetTicks();
+        break;
+    }
+}
+
+void Pace_FrameEnd(void)
+{
+    PERF_ENTER();
+    uint64_t busy_end = SDL_GetPerformanceCounter();
+    uint64_t freq = SDL_GetPerformanceFrequency();
+
+    int fps = pace_curr_fps();
+    if(fps > 0) {
+
+        uint64_t period = freq / fps;
+        /* When a frame overruns by more than a whole period, the schedule is
+         * started over rather than rushing the following frames to catch up */
+        if(s_deadline == 0 || busy_end > s_deadline + period)
+            s_deadline = busy_end;
+        else
+            s_deadline += period;
+
+        pace_wait_until(s_deadline);
+    }else{
+        s_deadline = 0;
+    }
+
+    uint64_t frame_end = SDL_GetPerformanceCounter();
+    if(s_last_frame_end) {
+
+        s_frame_ms[s_history_head] = ticks_to_ms(frame_end - s_last_frame_end);
+        s_busy_ms[s_history_head] = ticks_to_ms(busy_end - s_last_frame_end);
+        s_history_head = (s_history_head + 1) % HISTORY_FRAMES;
+        s_num_frames = MIN(s_num_frames + 1, HISTORY_FRAMES);
+    }
+    s_last_frame_end = frame_end;
+    PERF_RETURN();
+}
+
+void Pace_SetTargetFPS(int fps)
+{
+    s_target_fps = fps > 0 ? fps : 0;
+    s_deadline = 0;
+}
+
+int Pace_GetTargetFPS(void)
+{
+    return s_target_fps;
+}
+
+void Pace_GetStats(struct frame_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->num_frames = s_num_frames;
+    if(!s_num_frames)
+        return;
+
+    /* Until the ring buffer wraps around, the frames are at the front of it */
+    float frame[HISTORY_FRAMES], busy[HISTORY_FRAMES];
+    memcpy(frame, s_frame_ms, s_num_frames * sizeof(float));
+    memcpy(busy, s_busy_ms, s_num_frames * sizeof(float));
+
+    qsort(frame, s_num_frames, sizeof(float), compare_float);
+    qsort(busy, s_num_frames, sizeof(float), compare_float);
+
+    float sum = 0.0f;
+    for(int i = 0; i < s_num_frames; i++)
+        sum += frame[i];
+
+    out->avg_ms = sum / s_num_frames;
+    out->p50_ms = pace_percentile(frame, s_num_frames, 0.50f);
+    out->p99_ms = pace_percentile(frame, s_num_frames, 0.99f);
+    out->max_ms = frame[s_num_frames - 1];
+    out->busy_p50_ms = pace_percentile(busy, s_num_frames, 0.50f);
+    out->busy_p99_ms = pace_percentile(busy, s_num_frames, 0.99f);
+}
+
@@ -0,0 +1,90 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef PACE_H
+#define PACE_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+/* Frame times are measured from the end of one frame to the end of the next. 
+ * The 'busy' times leave out the time spent sleeping to hold the frame rate 
+ * down. */
+struct frame_stats{
+    int   num_frames;
+    float avg_ms;
+    float p50_ms;
+    float p99_ms;
+    float max_ms;
+    float busy_p50_ms;
+    float busy_p99_ms;
+};
+
+/* ------------------------------------------------------------------------
+ * Turn the frame rate limit on or off. It is off for sessions which are 
+ * being played back, so that they run as fast as possible.
+ * ------------------------------------------------------------------------
+ */
+void Pace_SetEnabled(bool on);
+
+/* ------------------------------------------------------------------------
+ * Keeps track of window focus and user input, to lower the frame rate when 
+ * the window is in the background or the user is idle.
+ * ------------------------------------------------------------------------
+ */
+void Pace_HandleEvent(const SDL_Event *event);
+
+/* ------------------------------------------------------------------------
+ * Marks the end of a frame. Records its' timings and then sleeps until the 
+ * next frame is due.
+ * ------------------------------------------------------------------------
+ */
+void Pace_FrameEnd(void);
+
+/* ------------------------------------------------------------------------
+ * The frame rate to hold while the window has focus. 0 means no limit.
+ * ------------------------------------------------------------------------
+ */
+void Pace_SetTargetFPS(int fps);
+int  Pace_GetTargetFPS(void);
+
+/* ------------------------------------------------------------------------
+ * The statistics are computed over the most recent frames.
+ * ------------------------------------------------------------------------
+ */
+void Pace_GetStats(struct frame_stats *out);
+
+#endif
+
@@ -0,0 +1,464 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "parallel.h"
+#include "lib/public/kvec.h"
+
+#include <SDL.h>
+
+#include <assert.h>
+#include <string.h>
+
+
+#define MAX_WORKERS     (PL_MAX_THREADS - 1)
+/* Must be a power of 2 */
+#define DEQUE_SIZE      (1024)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+struct pl_job{
+    pl_job_func_t      func;
+    void              *arg;
+    struct pl_counter *counter;
+};
+
+/* The owning thread pushes and pops jobs at the bottom, while the other 
+ * threads steal the oldest jobs from the top. Deque 0 is shared by all of 
+ * the threads that aren't in the pool. */
+struct pl_deque{
+    SDL_SpinLock  lock;
+    size_t        top, bottom;
+    struct pl_job jobs[DEQUE_SIZE];
+    SDL_atomic_t  jobs_run;
+    SDL_atomic_t  jobs_stolen;
+    SDL_atomic_t  busy_us;
+};
+
+struct pl_for_job{
+    parallel_func_t func;
+    void           *arg;
+    size_t          count;
+    size_t          grain;
+    /* Index of the next call to be claimed by a thread */
+    SDL_atomic_t    next;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                 s_running = false;
+static int                  s_num_workers;
+static SDL_Thread          *s_workers[MAX_WORKERS];
+static SDL_threadID         s_main_tid;
+/* Holds the index of the deque of a pool thread, plus one */
+static SDL_TLSID            s_deque_tls;
+static struct pl_deque      s_deques[PL_MAX_THREADS];
+
+static SDL_SpinLock         s_main_lock;
+static kvec_t(struct pl_job)s_main_jobs;
+
+/* Number of jobs sitting in the deques and in the main-thread queue */
+static SDL_atomic_t         s_num_queued;
+static SDL_atomic_t         s_num_main_queued;
+/* Threads that are about to sleep or are sleeping on 's_cond'. Whoever 
+ * makes new work available checks this after publishing it, while the 
+ * sleepers check for work after incrementing it, so no wakeup is lost. */
+static SDL_atomic_t         s_num_sleeping;
+
+/* 's_lock' protects 's_quit' and is held around waits on 's_cond' */
+static SDL_mutex           *s_lock;
+static SDL_cond            *s_cond;
+static bool                 s_quit;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int pl_self(void)
+{
+    return (int)(intptr_t)SDL_TLSGet(s_deque_tls);
+}
+
+static void pl_wake(bool all)
+{
+    if(SDL_AtomicGet(&s_num_sleeping) == 0)
+        return;
+
+    SDL_LockMutex(s_lock);
+    if(all)
+        SDL_CondBroadcast(s_cond);
+    else
+        SDL_CondSignal(s_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
+static bool pl_push(struct pl_deque *deque, struct pl_job job)
+{
+    bool ret = false;
+    SDL_AtomicLock(&deque->lock);
+    if(deque->bottom - deque->top < DEQUE_SIZE) {
+        deque->jobs[deque->bottom++ & (DEQUE_SIZE - 1)] = job;
+        ret = true;
+    }
+    SDL_AtomicUnlock(&deque->lock);
+    return ret;
+}
+
+static bool pl_pop(struct pl_deque *deque, struct pl_job *out)
+{
+    bool ret = false;
+    SDL_AtomicLock(&deque->lock);
+    if(deque->bottom != deque->top) {
+        *out = deque->jobs[--deque->bottom & (DEQUE_SIZE - 1)];
+        ret = true;
+    }
+    SDL_AtomicUnlock(&deque->lock);
+    return ret;
+}
+
+static bool pl_steal(struct pl_deque *deque, struct pl_job *out)
+{
+    bool ret = false;
+    SDL_AtomicLock(&deque->lock);
+    if(deque->bottom != deque->top) {
+        *out = deque->jobs[deque->top++ & (DEQUE_SIZE - 1)];
+        ret = true;
+    }
+    SDL_AtomicUnlock(&deque->lock);
+    return ret;
+}
+
+static bool pl_pop_main(struct pl_job *out)
+{
+    bool ret = false;
+    SDL_AtomicLock(&s_main_lock);
+    if(kv_size(s_main_jobs)) {
+        /* Main-thread jobs are run in the order they were submitted */
+        *out = kv_A(s_main_jobs, 0);
+        memmove(s_main_jobs.a, s_main_jobs.a + 1, (kv_size(s_main_jobs) - 1) * sizeof(struct pl_job));
+        kv_size(s_main_jobs)--;
+        ret = true;
+    }
+    SDL_AtomicUnlock(&s_main_lock);
+    return ret;
+}
+
+static void pl_run(struct pl_deque *deque, struct pl_job job)
+{
+    uint64_t begin = SDL_GetPerformanceCounter();
+    job.func(job.arg);
+    uint64_t end = SDL_GetPerformanceCounter();
+
+    SDL_AtomicAdd(&deque->busy_us, (end - begin) * 1000000 / SDL_GetPerformanceFrequency());
+    SDL_AtomicIncRef(&deque->jobs_run);
+
+    if(job.counter && SDL_AtomicAdd(&job.counter->pending, -1) == 1)
+        pl_wake(true);
+}
+
+static bool pl_try_run(int self)
+{
+    struct pl_job job;
+
+    if(SDL_ThreadID() == s_main_tid && SDL_AtomicGet(&s_num_main_queued) && pl_pop_main(&job)) {
+        SDL_AtomicAdd(&s_num_main_queued, -1);
+        pl_run(&s_deques[self], job);
+        return true;
+    }
+
+    if(pl_pop(&s_deques[self], &job)) {
+        SDL_AtomicAdd(&s_num_queued, -1);
+        pl_run(&s_deques[self], job);
+        return true;
+    }
+
+    for(int i = 1; i <= s_num_workers; i++) {
+
+        int victim = (self + i) % (s_num_workers + 1);
+        if(pl_steal(&s_deques[victim], &job)) {
+            SDL_AtomicAdd(&s_num_queued, -1);
+            SDL_AtomicIncRef(&s_deques[self].jobs_stolen);
+            pl_run(&s_deques[self], job);
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool pl_has_work(bool main)
+{
+    return SDL_AtomicGet(&s_num_queued) > 0
+        || (main && SDL_AtomicGet(&s_num_main_queued) > 0);
+}
+
+/* Runs jobs until the counter drops to zero. With no counter, runs jobs 
+ * until the pool is shut down. */
+static void pl_help(struct pl_counter *counter)
+{
+    int self = pl_self();
+    bool main = (SDL_ThreadID() == s_main_tid);
+
+    while(true) {
+
+        if(counter && SDL_AtomicGet(&counter->pending) == 0)
+            break;
+
+        if(pl_try_run(self))
+            continue;
+
+        SDL_LockMutex(s_lock);
+        SDL_AtomicIncRef(&s_num_sleeping);
+
+        /* The pool threads only exit once the deques have been drained */
+        bool quit = false;
+        while(!pl_has_work(main) && !(counter && SDL_AtomicGet(&counter->pending) == 0)) {
+
+            if((quit = s_quit && !counter))
+                break;
+            SDL_CondWait(s_cond, s_lock);
+        }
+
+        SDL_AtomicAdd(&s_num_sleeping, -1);
+        SDL_UnlockMutex(s_lock);
+
+        if(quit)
+            break;
+    }
+}
+
+static int pl_worker(void *arg)
+{
+    SDL_TLSSet(s_deque_tls, arg, NULL);
+    pl_help(NULL);
+    return 0;
+}
+
+static void pl_for_job(void *arg)
+{
+    struct pl_for_job *job = arg;
+
+    while(true) {
+
+        size_t begin = SDL_AtomicAdd(&job->next, job->grain);
+        if(begin >= job->count)
+            break;
+
+        size_t end = MIN(begin + job->grain, job->count);
+        for(size_t i = begin; i < end; i++)
+            job->func(job->arg, i);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool PL_Init(void)
+{
+    if(NULL == (s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(NULL == (s_cond = SDL_CreateCond()))
+        goto fail_cond;
+    if(0 == (s_deque_tls = SDL_TLSCreate()))
+        goto fail_tls;
+
+    /* The calling thread also takes part in every job */
+    s_num_workers = SDL_GetCPUCount() - 1;
+    s_num_workers = s_num_workers < 0           ? 0 
+                  : s_num_workers > MAX_WORKERS ? MAX_WORKERS 
+                  : s_num_workers;
+    s_quit = false;
+    s_main_tid = SDL_ThreadID();
+
+    kv_init(s_main_jobs);
+    SDL_AtomicSet(&s_num_queued, 0);
+    SDL_AtomicSet(&s_num_main_queued, 0);
+    SDL_AtomicSet(&s_num_sleeping, 0);
+    for(int i = 0; i < PL_MAX_THREADS; i++) {
+        s_deques[i].top = s_deques[i].bottom = 0;
+    }
+
+    for(int i = 0; i < s_num_workers; i++) {
+        s_workers[i] = SDL_CreateThread(pl_worker, "pf_worker", (void*)(intptr_t)(i + 1));
+        if(!s_workers[i]) {
+            s_num_workers = i;
+            break;
+        }
+    }
+
+    s_running = true;
+    return true;
+
+fail_tls:
+    SDL_DestroyCond(s_cond);
+fail_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    return false;
+}
+
+void PL_Shutdown(void)
+{
+    if(!s_running)
+        return;
+
+    /* The workers run whatever is left in the deques before exiting */
+    PL_RunMainJobs();
+
+    SDL_LockMutex(s_lock);
+    s_quit = true;
+    SDL_CondBroadcast(s_cond);
+    SDL_UnlockMutex(s_lock);
+
+    for(int i = 0; i < s_num_workers; i++)
+        SDL_WaitThread(s_workers[i], NULL);
+
+    kv_destroy(s_main_jobs);
+    SDL_DestroyCond(s_cond);
+    SDL_DestroyMutex(s_lock);
+    s_running = false;
+}
+
+void PL_For(size_t count, parallel_func_t func, void *arg)
+{
+    if(!s_running || s_num_workers == 0 || count <= 1) {
+        for(size_t i = 0; i < count; i++)
+            func(arg, i);
+        return;
+    }
+
+    /* Hand out a few batches per thread, so that the threads which get 
+     * through theirs first can pick up the slack */
+    const int num_threads = s_num_workers + 1;
+    struct pl_for_job job = (struct pl_for_job){
+        .func = func,
+        .arg = arg,
+        .count = count,
+        .grain = count / (num_threads * 4) + 1,
+    };
+    SDL_AtomicSet(&job.next, 0);
+
+    struct pl_counter counter = {0};
+    for(int i = 0; i < MIN(count, s_num_workers); i++)
+        PL_Submit(pl_for_job, &job, &counter);
+
+    pl_for_job(&job);
+    PL_Wait(&counter);
+}
+
+void PL_Submit(pl_job_func_t func, void *arg, struct pl_counter *counter)
+{
+    if(!s_running || s_num_workers == 0) {
+        func(arg);
+        return;
+    }
+
+    struct pl_job job = (struct pl_job){func, arg, counter};
+    if(counter)
+        SDL_AtomicIncRef(&counter->pending);
+
+    struct pl_deque *deque = &s_deques[pl_self()];
+    if(!pl_push(deque, job)) {
+        /* The deque is full - there's plenty for the others to steal */
+        pl_run(deque, job);
+        return;
+    }
+
+    SDL_AtomicIncRef(&s_num_queued);
+    pl_wake(false);
+}
+
+void PL_SubmitMain(pl_job_func_t func, void *arg, struct pl_counter *counter)
+{
+    if(!s_running) {
+        func(arg);
+        return;
+    }
+
+    struct pl_job job = (struct pl_job){func, arg, counter};
+    if(counter)
+        SDL_AtomicIncRef(&counter->pending);
+
+    SDL_AtomicLock(&s_main_lock);
+    kv_push(struct pl_job, s_main_jobs, job);
+    SDL_AtomicUnlock(&s_main_lock);
+
+    SDL_AtomicIncRef(&s_num_main_queued);
+    /* The main thread may be one of many sleepers */
+    pl_wake(true);
+}
+
+void PL_Wait(struct pl_counter *counter)
+{
+    if(s_running)
+        pl_help(counter);
+    assert(PL_Done(counter));
+}
+
+bool PL_Done(struct pl_counter *counter)
+{
+    return (SDL_AtomicGet(&counter->pending) == 0);
+}
+
+void PL_RunMainJobs(void)
+{
+    if(!s_running)
+        return;
+
+    assert(SDL_ThreadID() == s_main_tid);
+    struct pl_job job;
+
+    while(SDL_AtomicGet(&s_num_main_queued) && pl_pop_main(&job)) {
+        SDL_AtomicAdd(&s_num_main_queued, -1);
+        pl_run(&s_deques[0], job);
+    }
+}
+
+void PL_CollectStats(struct pl_stats *out)
+{
+    assert(!s_running || SDL_ThreadID() == s_main_tid);
+    out->num_threads = s_running ? s_num_workers + 1 : 1;
+
+    for(int i = 0; i < out->num_threads; i++) {
+
+        struct pl_deque *deque = &s_deques[i];
+        out->threads[i] = (struct pl_thread_stats){
+            .jobs_run    = SDL_AtomicSet(&deque->jobs_run, 0),
+            .jobs_stolen = SDL_AtomicSet(&deque->jobs_stolen, 0),
+            .busy_us     = SDL_AtomicSet(&deque->busy_us, 0),
+        };
+    }
+}
+
@@ -0,0 +1,129 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <SDL.h>
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* The main thread and up to 7 pool threads */
+#define PL_MAX_THREADS  (8)
+
+typedef void (*parallel_func_t)(void *arg, size_t idx);
+typedef void (*pl_job_func_t)(void *arg);
+
+/* Keeps track of the jobs of a group which haven't completed yet. Must be 
+ * zero-initialized before the first job is submitted with it. */
+struct pl_counter{
+    SDL_atomic_t pending;
+};
+
+/* The counters are accumulated since the last call to 'PL_CollectStats'. 
+ * Entry 0 is the main thread, along with any other thread that isn't in 
+ * the pool. */
+struct pl_thread_stats{
+    unsigned jobs_run;
+    unsigned jobs_stolen;
+    uint32_t busy_us;
+};
+
+struct pl_stats{
+    int                    num_threads;
+    struct pl_thread_stats threads[PL_MAX_THREADS];
+};
+
+/* ------------------------------------------------------------------------
+ * Start up the pool of threads used for splitting up engine work, such 
+ * as navigation data updates and movement steering, across the cores.
+ * ------------------------------------------------------------------------
+ */
+bool PL_Init(void);
+void PL_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Call 'func' for every index in [0, count), with the calls spread out over 
+ * the pool threads and the calling thread. Returns once all of the calls 
+ * have completed. The calls may run in any order and must not depend on 
+ * each other. May be called from within a job.
+ * ------------------------------------------------------------------------
+ */
+void PL_For(size_t count, parallel_func_t func, void *arg);
+
+/* ------------------------------------------------------------------------
+ * Queue up a call of 'func' to be run by any thread of the pool. If 
+ * 'counter' is not NULL, it is incremented now and decremented once the 
+ * call has returned. Jobs submitted from a pool thread are run by that 
+ * thread first, unless others steal them.
+ * ------------------------------------------------------------------------
+ */
+void PL_Submit(pl_job_func_t func, void *arg, struct pl_counter *counter);
+
+/* ------------------------------------------------------------------------
+ * Same as 'PL_Submit', but the job will only ever be run on the main thread, 
+ * from 'PL_RunMainJobs' or from 'PL_Wait'. This is for work which makes GL 
+ * or Python calls.
+ * ------------------------------------------------------------------------
+ */
+void PL_SubmitMain(pl_job_func_t func, void *arg, struct pl_counter *counter);
+
+/* ------------------------------------------------------------------------
+ * Run queued jobs until all of the jobs submitted with 'counter' have 
+ * completed. A pool thread waiting on main-thread jobs is held up until 
+ * the main thread gets to them.
+ * ------------------------------------------------------------------------
+ */
+void PL_Wait(struct pl_counter *counter);
+bool PL_Done(struct pl_counter *counter);
+
+/* ------------------------------------------------------------------------
+ * Run all of the main-thread jobs that have been submitted so far. Called 
+ * once per frame from the main loop.
+ * ------------------------------------------------------------------------
+ */
+void PL_RunMainJobs(void);
+
+/* ------------------------------------------------------------------------
+ * Writes out the counters of every thread and resets them. Must be called 
+ * from the main thread.
+ * ------------------------------------------------------------------------
+ */
+void PL_CollectStats(struct pl_stats *out);
+
+#endif
+
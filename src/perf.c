@@ -0,0 +1,901 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "perf.h"
+#include "event.h"
+#include "config.h"
+#include "mem.h"
+#include "parallel.h"
+#include "render/public/render.h"
+#include "lib/public/khash.h"
+#include "lib/public/kvec.h"
+#include "lib/public/pf_nuklear.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX_DEPTH           (32)
+/* Number of frames over which the overlay timings are averaged */
+#define HISTORY_FRAMES      (120)
+/* Upper bound on the memory used by a single trace capture */
+#define MAX_TRACE_EVENTS    (1 << 20)
+#define MAX_PATH_LEN        (512)
+/* Stages and asset loads recorded between process start and the first frame */
+#define MAX_STARTUP_EVENTS  (2048)
+#define MAX_STARTUP_DETAIL  (96)
+/* Number of the slowest asset loads listed in the startup summary */
+#define STARTUP_TOP_ASSETS  (10)
+/* Number of the most recent frames written out by the spike capture */
+#define SPIKE_FRAMES        (300)
+
+struct zone{
+    const char *name;
+    /* Nesting depth the zone was last entered at, for indenting the overlay */
+    int         depth;
+    uint64_t    frame_ticks;
+    unsigned    frame_calls;
+    /* Ring buffer of the ticks spent in the zone during the recent frames */
+    uint64_t    history[HISTORY_FRAMES];
+    uint64_t    history_sum;
+    unsigned    history_calls[HISTORY_FRAMES];
+    unsigned    history_calls_sum;
+    /* Accumulated since the totals were last reset */
+    uint64_t    total_ticks;
+    uint64_t    total_max_ticks;
+    uint64_t    total_calls;
+};
+
+struct open_zone{
+    int      zone;
+    uint64_t begin;
+};
+
+/* Ring buffers of the job system counters of a single thread */
+struct job_history{
+    uint64_t    busy_us[HISTORY_FRAMES];
+    uint64_t    busy_us_sum;
+    unsigned    jobs[HISTORY_FRAMES];
+    unsigned    jobs_sum;
+    unsigned    stolen[HISTORY_FRAMES];
+    unsigned    stolen_sum;
+};
+
+struct trace_event{
+    const char *name;
+    uint64_t    begin, end;
+};
+
+/* Events with a detail string are asset loads, the rest are stages */
+struct startup_event{
+    const char *name;
+    char        detail[MAX_STARTUP_DETAIL];
+    int         depth;
+    uint64_t    begin, end;
+};
+
+struct spike_zone{
+    int      zone;
+    unsigned calls;
+    uint64_t ticks;
+};
+
+struct spike_count{
+    int      type;
+    unsigned count;
+};
+
+/* What happened over a single frame, kept for the spike capture */
+struct spike_frame{
+    uint64_t                   number;
+    uint64_t                   ticks;
+    unsigned                   path_requests;
+    unsigned                   gc_collections;
+    /* -1 when there were no collections */
+    int                        gc_oldest_gen;
+    double                     gc_ms;
+    kvec_t(struct spike_zone)  zones;
+    kvec_t(struct spike_count) events;
+};
+
+KHASH_MAP_INIT_INT64(zone, int)
+KHASH_MAP_INIT_INT(count, unsigned)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static SDL_threadID               s_main_tid;
+static bool                       s_overlay_enabled = false;
+
+/* Maps the address of a zone name to its' index in 's_zones' */
+static khash_t(zone)             *s_zone_table;
+static kvec_t(struct zone)        s_zones;
+static struct open_zone           s_stack[MAX_DEPTH];
+static int                        s_depth;
+/* Pushes past MAX_DEPTH are not recorded, but must still be balanced */
+static int                        s_overflow;
+
+static int                        s_history_head;
+static uint64_t                   s_frame_begin;
+static uint64_t                   s_frame_history[HISTORY_FRAMES];
+static uint64_t                   s_frame_history_sum;
+static unsigned                   s_total_frames;
+static uint64_t                   s_total_frame_ticks;
+
+static int                        s_num_job_threads;
+static struct job_history         s_job_history[PL_MAX_THREADS];
+
+static kvec_t(struct trace_event) s_trace;
+static int                        s_trace_frames_left;
+static uint64_t                   s_trace_begin;
+static char                       s_trace_path[MAX_PATH_LEN];
+
+static uint64_t                   s_frame_number;
+static double                     s_spike_threshold_ms;
+static char                       s_spike_dir[MAX_PATH_LEN];
+/* The counters of the frame in progress, and the ring buffer of the last 
+ * SPIKE_FRAMES frames */
+static khash_t(count)            *s_spike_events;
+static struct spike_frame         s_spike_curr;
+static struct spike_frame         s_spike_frames[SPIKE_FRAMES];
+static int                        s_spike_head;
+static int                        s_spike_num_frames;
+/* Frames left until a spike is written out again, so that the files don't
+ * overlap, and the spikes which were not written out since the last file */
+static int                        s_spike_cooldown;
+static unsigned                   s_spike_skipped;
+
+/* The startup events are kept in static storage, as tracing begins before 
+ * the memory subsystem is initialized */
+static bool                       s_startup_active;
+static SDL_threadID               s_startup_tid;
+static uint64_t                   s_startup_begin;
+static struct startup_event       s_startup_events[MAX_STARTUP_EVENTS];
+static int                        s_num_startup_events;
+static int                        s_startup_stack[MAX_DEPTH];
+static int                        s_startup_depth;
+static int                        s_startup_overflow;
+static int                        s_startup_dropped;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int perf_zone_idx(const char *name)
+{
+    khiter_t k = kh_get(zone, s_zone_table, (uint64_t)name);
+    if(k != kh_end(s_zone_table))
+        return kh_value(s_zone_table, k);
+
+    struct zone new = (struct zone){ .name = name };
+    kv_push(struct zone, s_zones, new);
+
+    int ret;
+    k = kh_put(zone, s_zone_table, (uint64_t)name, &ret);
+    assert(ret != -1 && ret != 0);
+    kh_value(s_zone_table, k) = kv_size(s_zones) - 1;
+    return kv_size(s_zones) - 1;
+}
+
+/* Zone names may be qualified with a source path, of which only the file name is shown */
+static const char *perf_display_name(const char *name)
+{
+    const char *ret = name;
+    for(const char *c = name; *c; c++) {
+        if(*c == '/' || *c == '\\')
+            ret = c + 1;
+    }
+    return ret;
+}
+
+static double perf_ticks_to_ms(uint64_t ticks)
+{
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void perf_write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for(; *str; str++) {
+        if(*str == '"' || *str == '\\')
+            fputc('\\', file);
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+static void perf_write_trace(void)
+{
+    FILE *file = fopen(s_trace_path, "w");
+    if(!file) {
+        fprintf(stderr, "Could not open '%s' for writing the trace.\n", s_trace_path);
+        return;
+    }
+
+    const double us_per_tick = 1000000.0 / SDL_GetPerformanceFrequency();
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for(int i = 0; i < kv_size(s_trace); i++) {
+
+        const struct trace_event *curr = &kv_A(s_trace, i);
+        fprintf(file, "{\"name\":");
+        perf_write_json_string(file, perf_display_name(curr->name));
+        fprintf(file, ",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            (curr->begin - s_trace_begin) * us_per_tick,
+            (curr->end - curr->begin) * us_per_tick,
+            i == kv_size(s_trace) - 1 ? "" : ",");
+    }
+
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+}
+
+static void perf_write_startup_trace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Could not open '%s' for writing the startup trace.\n", path);
+        return;
+    }
+
+    const double us_per_tick = 1000000.0 / SDL_GetPerformanceFrequency();
+    fprintf(file, "{\"traceEvents\":[\n");
+
+    for(int i = 0; i < s_num_startup_events; i++) {
+
+        const struct startup_event *curr = &s_startup_events[i];
+        fprintf(file, "{\"name\":");
+        perf_write_json_string(file, curr->detail[0] ? curr->detail : curr->name);
+        fprintf(file, ",\"cat\":");
+        perf_write_json_string(file, curr->detail[0] ? perf_display_name(curr->name) : "stage");
+        fprintf(file, ",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+            (curr->begin - s_startup_begin) * us_per_tick,
+            (curr->end - curr->begin) * us_per_tick,
+            i == s_num_startup_events - 1 ? "" : ",");
+    }
+
+    fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+}
+
+static void perf_print_startup_summary(uint64_t end)
+{
+    printf("Startup took %.2f ms:\n", perf_ticks_to_ms(end - s_startup_begin));
+
+    int num_assets = 0;
+    uint64_t asset_ticks = 0;
+    int slowest[STARTUP_TOP_ASSETS];
+    int num_slowest = 0;
+
+    for(int i = 0; i < s_num_startup_events; i++) {
+
+        const struct startup_event *curr = &s_startup_events[i];
+        uint64_t ticks = curr->end - curr->begin;
+
+        if(!curr->detail[0]) {
+            printf("  %*s%-*s %9.2f ms\n", curr->depth * 2, "", 
+                40 - curr->depth * 2, perf_display_name(curr->name), perf_ticks_to_ms(ticks));
+            continue;
+        }
+
+        num_assets++;
+        asset_ticks += ticks;
+
+        /* Insertion into the list of the slowest loads, kept sorted */
+        int j = MIN(num_slowest, STARTUP_TOP_ASSETS - 1);
+        if(j == STARTUP_TOP_ASSETS - 1 && num_slowest == STARTUP_TOP_ASSETS) {
+            const struct startup_event *last = &s_startup_events[slowest[j]];
+            if(ticks <= last->end - last->begin)
+                continue;
+        }
+        for(; j > 0; j--) {
+            const struct startup_event *prev = &s_startup_events[slowest[j - 1]];
+            if(prev->end - prev->begin >= ticks)
+                break;
+            slowest[j] = slowest[j - 1];
+        }
+        slowest[j] = i;
+        num_slowest = MIN(num_slowest + 1, STARTUP_TOP_ASSETS);
+    }
+
+    if(num_assets) {
+        printf("  %d asset loads took %.2f ms, the slowest being:\n", 
+            num_assets, perf_ticks_to_ms(asset_ticks));
+    }
+    for(int i = 0; i < num_slowest; i++) {
+        const struct startup_event *curr = &s_startup_events[slowest[i]];
+        printf("    %9.2f ms  %s\n", perf_ticks_to_ms(curr->end - curr->begin), curr->detail);
+    }
+    if(s_startup_dropped) {
+        printf("  (%d events past the first %d were not recorded)\n", 
+            s_startup_dropped, MAX_STARTUP_EVENTS);
+    }
+    fflush(stdout);
+}
+
+static void perf_spike_reset(void)
+{
+    s_spike_head = 0;
+    s_spike_num_frames = 0;
+    s_spike_cooldown = 0;
+    s_spike_skipped = 0;
+    s_spike_curr.path_requests = 0;
+    s_spike_curr.gc_collections = 0;
+    s_spike_curr.gc_oldest_gen = -1;
+    s_spike_curr.gc_ms = 0.0;
+    kh_clear(count, s_spike_events);
+}
+
+/* Moves the counters of the frame which just ended into the ring buffer, 
+ * and returns true if the frame is a spike which should be written out */
+static bool perf_spike_record(uint64_t ticks)
+{
+    struct spike_frame *frame = &s_spike_frames[s_spike_head];
+    frame->number = s_frame_number;
+    frame->ticks = ticks;
+    frame->path_requests = s_spike_curr.path_requests;
+    frame->gc_collections = s_spike_curr.gc_collections;
+    frame->gc_oldest_gen = s_spike_curr.gc_oldest_gen;
+    frame->gc_ms = s_spike_curr.gc_ms;
+
+    kv_reset(frame->zones);
+    for(int i = 0; i < kv_size(s_zones); i++) {
+
+        const struct zone *curr = &kv_A(s_zones, i);
+        if(!curr->frame_calls)
+            continue;
+        struct spike_zone zone = (struct spike_zone){i, curr->frame_calls, curr->frame_ticks};
+        kv_push(struct spike_zone, frame->zones, zone);
+    }
+
+    kv_reset(frame->events);
+    for(khiter_t k = kh_begin(s_spike_events); k != kh_end(s_spike_events); k++) {
+
+        if(!kh_exist(s_spike_events, k))
+            continue;
+        struct spike_count count = (struct spike_count){kh_key(s_spike_events, k), kh_value(s_spike_events, k)};
+        kv_push(struct spike_count, frame->events, count);
+    }
+    kh_clear(count, s_spike_events);
+
+    s_spike_curr.path_requests = 0;
+    s_spike_curr.gc_collections = 0;
+    s_spike_curr.gc_oldest_gen = -1;
+    s_spike_curr.gc_ms = 0.0;
+
+    s_spike_head = (s_spike_head + 1) % SPIKE_FRAMES;
+    s_spike_num_frames = MIN(s_spike_num_frames + 1, SPIKE_FRAMES);
+
+    bool spike = perf_ticks_to_ms(ticks) > s_spike_threshold_ms;
+    if(s_spike_cooldown > 0) {
+        s_spike_cooldown--;
+        s_spike_skipped += spike;
+        return false;
+    }
+    return spike;
+}
+
+static void perf_write_spike(void)
+{
+    const struct spike_frame *last = &s_spike_frames[(s_spike_head + SPIKE_FRAMES - 1) % SPIKE_FRAMES];
+
+    char path[MAX_PATH_LEN + 64];
+    snprintf(path, sizeof(path), "%s/spike_%llu.json", s_spike_dir, (unsigned long long)last->number);
+
+    FILE *file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Could not open '%s' for writing the spike capture.\n", path);
+        return;
+    }
+
+    fprintf(file, "{\"threshold_ms\":%.3f,\"spike_frame\":%llu,\"spike_ms\":%.3f,\"skipped_spikes\":%u,\"frames\":[\n",
+        s_spike_threshold_ms, (unsigned long long)last->number, perf_ticks_to_ms(last->ticks), s_spike_skipped);
+
+    for(int i = 0; i < s_spike_num_frames; i++) {
+
+        const struct spike_frame *curr = &s_spike_frames[(s_spike_head + SPIKE_FRAMES - s_spike_num_frames + i) % SPIKE_FRAMES];
+        fprintf(file, "{\"frame\":%llu,\"ms\":%.3f,\"path_requests\":%u,"
+            "\"gc\":{\"collections\":%u,\"oldest_generation\":%d,\"ms\":%.3f},\"zones\":[",
+            (unsigned long long)curr->number, perf_ticks_to_ms(curr->ticks), curr->path_requests,
+            curr->gc_collections, curr->gc_oldest_gen, curr->gc_ms);
+
+        for(int j = 0; j < kv_size(curr->zones); j++) {
+
+            const struct spike_zone *zone = &kv_A(curr->zones, j);
+            fprintf(file, "%s{\"name\":", j ? "," : "");
+            perf_write_json_string(file, perf_display_name(kv_A(s_zones, zone->zone).name));
+            fprintf(file, ",\"ms\":%.3f,\"calls\":%u}", perf_ticks_to_ms(zone->ticks), zone->calls);
+        }
+
+        fprintf(file, "],\"events\":[");
+        for(int j = 0; j < kv_size(curr->events); j++) {
+
+            const struct spike_count *count = &kv_A(curr->events, j);
+            fprintf(file, "%s{\"type\":%d,\"name\":", j ? "," : "", count->type);
+            perf_write_json_string(file, E_EventName(count->type));
+            fprintf(file, ",\"count\":%u}", count->count);
+        }
+
+        fprintf(file, "]}%s\n", i == s_spike_num_frames - 1 ? "" : ",");
+    }
+
+    fprintf(file, "]}\n");
+    fclose(file);
+    s_spike_skipped = 0;
+}
+
+static void on_update_ui(void *user, void *event)
+{
+    struct nk_context *ctx = user;
+    if(!s_overlay_enabled)
+        return;
+
+    if(nk_begin(ctx, "Performance", nk_rect(CONFIG_RES_X - 480, 20, 460, 600), 
+       NK_WINDOW_BORDER | NK_WINDOW_MOVABLE | NK_WINDOW_SCALABLE | NK_WINDOW_TITLE)) {
+
+        char buff[64];
+        static const float ratios[] = {0.55f, 0.15f, 0.15f, 0.15f};
+
+        nk_layout_row(ctx, NK_DYNAMIC, 20, 4, ratios);
+        nk_label(ctx, "Zone", NK_TEXT_LEFT);
+        nk_label(ctx, "Avg ms", NK_TEXT_RIGHT);
+        nk_label(ctx, "Max ms", NK_TEXT_RIGHT);
+        nk_label(ctx, "Calls", NK_TEXT_RIGHT);
+
+        uint64_t frame_max = 0;
+        for(int i = 0; i < HISTORY_FRAMES; i++)
+            frame_max = s_frame_history[i] > frame_max ? s_frame_history[i] : frame_max;
+
+        nk_label(ctx, "Frame", NK_TEXT_LEFT);
+        snprintf(buff, sizeof(buff), "%.2f", perf_ticks_to_ms(s_frame_history_sum) / HISTORY_FRAMES);
+        nk_label(ctx, buff, NK_TEXT_RIGHT);
+        snprintf(buff, sizeof(buff), "%.2f", perf_ticks_to_ms(frame_max));
+        nk_label(ctx, buff, NK_TEXT_RIGHT);
+        nk_label(ctx, "", NK_TEXT_RIGHT);
+
+        for(int i = 0; i < kv_size(s_zones); i++) {
+
+            const struct zone *curr = &kv_A(s_zones, i);
+            uint64_t max = 0;
+            for(int j = 0; j < HISTORY_FRAMES; j++)
+                max = curr->history[j] > max ? curr->history[j] : max;
+
+            snprintf(buff, sizeof(buff), "%*s%s", (curr->depth + 1) * 2, "", perf_display_name(curr->name));
+            nk_label(ctx, buff, NK_TEXT_LEFT);
+            snprintf(buff, sizeof(buff), "%.2f", perf_ticks_to_ms(curr->history_sum) / HISTORY_FRAMES);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%.2f", perf_ticks_to_ms(max));
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%.1f", curr->history_calls_sum / (float)HISTORY_FRAMES);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+        }
+
+        nk_layout_row(ctx, NK_DYNAMIC, 20, 4, ratios);
+        nk_label(ctx, "Memory", NK_TEXT_LEFT);
+        nk_label(ctx, "Live MB", NK_TEXT_RIGHT);
+        nk_label(ctx, "Peak MB", NK_TEXT_RIGHT);
+        nk_label(ctx, "Allocs", NK_TEXT_RIGHT);
+
+        for(int i = 0; i < MEM_TAG_COUNT; i++) {
+
+            struct mem_stats stats;
+            MEM_GetStats(i, &stats);
+
+            snprintf(buff, sizeof(buff), "  %s", MEM_TagName(i));
+            nk_label(ctx, buff, NK_TEXT_LEFT);
+            snprintf(buff, sizeof(buff), "%.2f", stats.live / (1024.0 * 1024.0));
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%.2f", stats.peak / (1024.0 * 1024.0));
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%zu", stats.num_allocs);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+        }
+
+        nk_layout_row(ctx, NK_DYNAMIC, 20, 4, ratios);
+        nk_label(ctx, "Jobs", NK_TEXT_LEFT);
+        nk_label(ctx, "Busy ms", NK_TEXT_RIGHT);
+        nk_label(ctx, "Stolen", NK_TEXT_RIGHT);
+        nk_label(ctx, "Jobs", NK_TEXT_RIGHT);
+
+        for(int i = 0; i < s_num_job_threads; i++) {
+
+            const struct job_history *curr = &s_job_history[i];
+            if(i == 0)
+                snprintf(buff, sizeof(buff), "  Main");
+            else
+                snprintf(buff, sizeof(buff), "  Worker %d", i);
+            nk_label(ctx, buff, NK_TEXT_LEFT);
+            snprintf(buff, sizeof(buff), "%.2f", curr->busy_us_sum / 1000.0 / HISTORY_FRAMES);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%.1f", curr->stolen_sum / (float)HISTORY_FRAMES);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%.1f", curr->jobs_sum / (float)HISTORY_FRAMES);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+        }
+
+        struct render_stats rstats;
+        R_GL_GetRenderStats(&rstats);
+
+        nk_layout_row(ctx, NK_DYNAMIC, 20, 4, ratios);
+        nk_label(ctx, "GPU", NK_TEXT_LEFT);
+        nk_label(ctx, "Avg ms", NK_TEXT_RIGHT);
+        nk_label(ctx, "", NK_TEXT_RIGHT);
+        nk_label(ctx, "", NK_TEXT_RIGHT);
+
+        for(int i = 0; i < GPU_PASS_COUNT; i++) {
+
+            snprintf(buff, sizeof(buff), "  %s", R_GL_PassName(i));
+            nk_label(ctx, buff, NK_TEXT_LEFT);
+            snprintf(buff, sizeof(buff), "%.2f", rstats.pass_ms[i]);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+            nk_label(ctx, "", NK_TEXT_RIGHT);
+            nk_label(ctx, "", NK_TEXT_RIGHT);
+        }
+
+        const struct{ const char *name; size_t count; }counts[] = {
+            {"  Draw calls",    rstats.draw_calls},
+            {"  Vertices",      rstats.vertices},
+            {"  Program binds", rstats.program_binds},
+            {"  Texture binds", rstats.texture_binds},
+        };
+
+        for(int i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+
+            nk_label(ctx, counts[i].name, NK_TEXT_LEFT);
+            nk_label(ctx, "", NK_TEXT_RIGHT);
+            nk_label(ctx, "", NK_TEXT_RIGHT);
+            snprintf(buff, sizeof(buff), "%zu", counts[i].count);
+            nk_label(ctx, buff, NK_TEXT_RIGHT);
+        }
+    }
+    nk_end(ctx);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Perf_Init(struct nk_context *ctx)
+{
+    s_zone_table = kh_init(zone);
+    if(!s_zone_table)
+        return false;
+
+    s_spike_events = kh_init(count);
+    if(!s_spike_events) {
+        kh_destroy(zone, s_zone_table);
+        return false;
+    }
+
+    kv_init(s_zones);
+    kv_init(s_trace);
+    for(int i = 0; i < SPIKE_FRAMES; i++) {
+        kv_init(s_spike_frames[i].zones);
+        kv_init(s_spike_frames[i].events);
+    }
+    perf_spike_reset();
+
+    s_main_tid = SDL_ThreadID();
+    s_frame_begin = SDL_GetPerformanceCounter();
+
+    E_Global_Register(EVENT_UPDATE_UI, on_update_ui, ctx);
+    return true;
+}
+
+void Perf_Shutdown(void)
+{
+    E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
+
+    for(int i = 0; i < SPIKE_FRAMES; i++) {
+        kv_destroy(s_spike_frames[i].zones);
+        kv_destroy(s_spike_frames[i].events);
+    }
+    s_spike_threshold_ms = 0.0;
+
+    kv_destroy(s_trace);
+    kv_destroy(s_zones);
+    kh_destroy(count, s_spike_events);
+    kh_destroy(zone, s_zone_table);
+}
+
+void Perf_Push(const char *name)
+{
+    if(SDL_ThreadID() != s_main_tid)
+        return;
+
+    if(s_depth == MAX_DEPTH) {
+        ++s_overflow;
+        return;
+    }
+
+    int idx = perf_zone_idx(name);
+    kv_A(s_zones, idx).depth = s_depth;
+    s_stack[s_depth++] = (struct open_zone){idx, SDL_GetPerformanceCounter()};
+}
+
+void Perf_Pop(void)
+{
+    if(SDL_ThreadID() != s_main_tid)
+        return;
+
+    if(s_overflow) {
+        --s_overflow;
+        return;
+    }
+
+    assert(s_depth > 0);
+    uint64_t end = SDL_GetPerformanceCounter();
+    const struct open_zone *top = &s_stack[--s_depth];
+    struct zone *zone = &kv_A(s_zones, top->zone);
+
+    zone->frame_ticks += end - top->begin;
+    zone->frame_calls++;
+
+    if(s_trace_frames_left > 0 && kv_size(s_trace) < MAX_TRACE_EVENTS) {
+        struct trace_event event = (struct trace_event){zone->name, top->begin, end};
+        kv_push(struct trace_event, s_trace, event);
+    }
+}
+
+void Perf_FrameEnd(void)
+{
+    assert(SDL_ThreadID() == s_main_tid);
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    /* Must be taken before the zone timings of the frame are cleared */
+    bool spike = false;
+    if(s_spike_threshold_ms > 0.0)
+        spike = perf_spike_record(now - s_frame_begin);
+
+    for(int i = 0; i < kv_size(s_zones); i++) {
+
+        struct zone *curr = &kv_A(s_zones, i);
+        curr->history_sum += curr->frame_ticks - curr->history[s_history_head];
+        curr->history[s_history_head] = curr->frame_ticks;
+        curr->history_calls_sum += curr->frame_calls - curr->history_calls[s_history_head];
+        curr->history_calls[s_history_head] = curr->frame_calls;
+        curr->total_ticks += curr->frame_ticks;
+        curr->total_calls += curr->frame_calls;
+        if(curr->frame_ticks > curr->total_max_ticks)
+            curr->total_max_ticks = curr->frame_ticks;
+        curr->frame_ticks = 0;
+        curr->frame_calls = 0;
+    }
+
+    struct pl_stats jobs;
+    PL_CollectStats(&jobs);
+    s_num_job_threads = jobs.num_threads;
+
+    for(int i = 0; i < jobs.num_threads; i++) {
+
+        struct job_history *curr = &s_job_history[i];
+        const struct pl_thread_stats *stats = &jobs.threads[i];
+        curr->busy_us_sum += stats->busy_us - curr->busy_us[s_history_head];
+        curr->busy_us[s_history_head] = stats->busy_us;
+        curr->jobs_sum += stats->jobs_run - curr->jobs[s_history_head];
+        curr->jobs[s_history_head] = stats->jobs_run;
+        curr->stolen_sum += stats->jobs_stolen - curr->stolen[s_history_head];
+        curr->stolen[s_history_head] = stats->jobs_stolen;
+    }
+
+    s_frame_history_sum += (now - s_frame_begin) - s_frame_history[s_history_head];
+    s_frame_history[s_history_head] = now - s_frame_begin;
+    s_total_frame_ticks += now - s_frame_begin;
+    s_total_frames++;
+    s_history_head = (s_history_head + 1) % HISTORY_FRAMES;
+    s_frame_begin = now;
+    s_frame_number++;
+
+    if(spike) {
+        perf_write_spike();
+        s_spike_cooldown = SPIKE_FRAMES;
+        /* Leave the time taken to write the file out of the next frame */
+        s_frame_begin = SDL_GetPerformanceCounter();
+    }
+
+    if(s_trace_frames_left > 0 && --s_trace_frames_left == 0) {
+        perf_write_trace();
+        kv_destroy(s_trace);
+        kv_init(s_trace);
+    }
+}
+
+void Perf_SetOverlayEnabled(bool on)
+{
+    s_overlay_enabled = on;
+}
+
+bool Perf_CaptureTrace(const char *path, int num_frames)
+{
+    if(s_trace_frames_left > 0 || num_frames <= 0)
+        return false;
+    if(strlen(path) >= sizeof(s_trace_path))
+        return false;
+
+    strcpy(s_trace_path, path);
+    s_trace_frames_left = num_frames;
+    s_trace_begin = SDL_GetPerformanceCounter();
+    return true;
+}
+
+size_t Perf_GetTotals(struct perf_zone_totals *out, size_t maxout, struct perf_frame_totals *out_frames)
+{
+    size_t ret = 0;
+    for(int i = 0; i < kv_size(s_zones); i++) {
+
+        const struct zone *curr = &kv_A(s_zones, i);
+        if(!curr->total_calls)
+            continue;
+        if(ret++ >= maxout)
+            continue;
+
+        out[ret - 1] = (struct perf_zone_totals){
+            .name         = perf_display_name(curr->name),
+            .total_ms     = perf_ticks_to_ms(curr->total_ticks),
+            .max_frame_ms = perf_ticks_to_ms(curr->total_max_ticks),
+            .calls        = curr->total_calls
+        };
+    }
+
+    out_frames->num_frames = s_total_frames;
+    out_frames->total_ms = perf_ticks_to_ms(s_total_frame_ticks);
+    return ret;
+}
+
+void Perf_ResetTotals(void)
+{
+    for(int i = 0; i < kv_size(s_zones); i++) {
+
+        struct zone *curr = &kv_A(s_zones, i);
+        curr->total_ticks = 0;
+        curr->total_max_ticks = 0;
+        curr->total_calls = 0;
+    }
+    s_total_frames = 0;
+    s_total_frame_ticks = 0;
+}
+
+bool Perf_SetSpikeCapture(double threshold_ms, const char *dir)
+{
+    if(strlen(dir) >= sizeof(s_spike_dir))
+        return false;
+
+    strcpy(s_spike_dir, dir);
+    s_spike_threshold_ms = threshold_ms > 0.0 ? threshold_ms : 0.0;
+    perf_spike_reset();
+    return true;
+}
+
+void Perf_CountEvent(int type)
+{
+    if(s_spike_threshold_ms == 0.0 || SDL_ThreadID() != s_main_tid)
+        return;
+
+    int ret;
+    khiter_t k = kh_put(count, s_spike_events, type, &ret);
+    if(ret == -1)
+        return;
+    if(ret != 0)
+        kh_value(s_spike_events, k) = 0;
+    kh_value(s_spike_events, k)++;
+}
+
+void Perf_CountPathRequests(size_t num_srcs)
+{
+    if(s_spike_threshold_ms == 0.0 || SDL_ThreadID() != s_main_tid)
+        return;
+    s_spike_curr.path_requests += num_srcs;
+}
+
+void Perf_CountGCPause(int generation, double ms)
+{
+    if(s_spike_threshold_ms == 0.0 || SDL_ThreadID() != s_main_tid)
+        return;
+    s_spike_curr.gc_collections++;
+    s_spike_curr.gc_ms += ms;
+    if(generation > s_spike_curr.gc_oldest_gen)
+        s_spike_curr.gc_oldest_gen = generation;
+}
+
+void Perf_StartupBegin(void)
+{
+    s_startup_active = true;
+    s_startup_tid = SDL_ThreadID();
+    s_startup_begin = SDL_GetPerformanceCounter();
+}
+
+void Perf_StartupPush(const char *name, const char *detail)
+{
+    if(!s_startup_active || SDL_ThreadID() != s_startup_tid)
+        return;
+
+    /* Pushes which are not recorded are always nested inside the recorded 
+     * ones, so they are popped first */
+    if(s_startup_depth == MAX_DEPTH || s_num_startup_events == MAX_STARTUP_EVENTS) {
+        ++s_startup_overflow;
+        ++s_startup_dropped;
+        return;
+    }
+
+    struct startup_event *event = &s_startup_events[s_num_startup_events];
+    event->name = name;
+    event->detail[0] = '\0';
+    if(detail) {
+        strncpy(event->detail, detail, sizeof(event->detail) - 1);
+        event->detail[sizeof(event->detail) - 1] = '\0';
+    }
+    event->depth = s_startup_depth;
+    event->begin = SDL_GetPerformanceCounter();
+    event->end = event->begin;
+    s_startup_stack[s_startup_depth++] = s_num_startup_events++;
+}
+
+void Perf_StartupPop(void)
+{
+    if(!s_startup_active || SDL_ThreadID() != s_startup_tid)
+        return;
+
+    if(s_startup_overflow) {
+        --s_startup_overflow;
+        return;
+    }
+
+    assert(s_startup_depth > 0);
+    int idx = s_startup_stack[--s_startup_depth];
+    s_startup_events[idx].end = SDL_GetPerformanceCounter();
+}
+
+void Perf_StartupEnd(const char *trace_path)
+{
+    if(!s_startup_active)
+        return;
+
+    uint64_t end = SDL_GetPerformanceCounter();
+    /* Close the stages that are still open, such as when the first frame is 
+     * only partly taken */
+    s_startup_overflow = 0;
+    while(s_startup_depth > 0)
+        Perf_StartupPop();
+
+    perf_print_startup_summary(end);
+    if(trace_path)
+        perf_write_startup_trace(trace_path);
+    s_startup_active = false;
+}
@@ -0,0 +1,147 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct nk_context;
+
+struct perf_zone_totals{
+    const char        *name;
+    double             total_ms;
+    /* The most time spent in the zone over a single frame */
+    double             max_frame_ms;
+    unsigned long long calls;
+};
+
+struct perf_frame_totals{
+    unsigned num_frames;
+    double   total_ms;
+};
+
+/* ------------------------------------------------------------------------
+ * Scoped profiling zones. Zones are identified by the address of their name,
+ * so the name must be a string with static storage duration. Only zones 
+ * entered on the main thread are recorded - calls from other threads are 
+ * ignored.
+ * ------------------------------------------------------------------------
+ */
+#define PERF_ENTER()        Perf_Push(__func__)
+#define PERF_RETURN(...)    do{ Perf_Pop(); return __VA_ARGS__; }while(0)
+
+/* ------------------------------------------------------------------------
+ * Must be called from the main thread. The overlay is drawn with the 
+ * provided nuklear context.
+ * ------------------------------------------------------------------------
+ */
+bool Perf_Init(struct nk_context *ctx);
+void Perf_Shutdown(void);
+
+void Perf_Push(const char *name);
+void Perf_Pop(void);
+
+/* ------------------------------------------------------------------------
+ * Marks the end of a frame. Per-frame zone timings are folded into the 
+ * rolling averages shown by the overlay.
+ * ------------------------------------------------------------------------
+ */
+void Perf_FrameEnd(void);
+
+/* ------------------------------------------------------------------------
+ * Show or hide the window with the rolling zone timings.
+ * ------------------------------------------------------------------------
+ */
+void Perf_SetOverlayEnabled(bool on);
+
+/* ------------------------------------------------------------------------
+ * Record every zone entered during the next 'num_frames' frames, and then 
+ * write them to 'path' in the Chrome trace event JSON format (viewable in 
+ * chrome://tracing). Returns false if a trace is already being captured.
+ * ------------------------------------------------------------------------
+ */
+bool Perf_CaptureTrace(const char *path, int num_frames);
+
+/* ------------------------------------------------------------------------
+ * Zone timings accumulated over all the frames since the last call to 
+ * 'Perf_ResetTotals', for benchmark runs which outlast the overlay's 
+ * averaging window. Returns the number of zones entered since then, of 
+ * which up to 'maxout' are written to 'out'. The names are only valid 
+ * until shutdown.
+ * ------------------------------------------------------------------------
+ */
+size_t Perf_GetTotals(struct perf_zone_totals *out, size_t maxout, struct perf_frame_totals *out_frames);
+void   Perf_ResetTotals(void);
+
+/* ------------------------------------------------------------------------
+ * Spike capture. While enabled, the zone timings, the number of events of 
+ * each type handled, the path requests and the script garbage collection 
+ * pauses of the most recent frames are kept in a ring buffer. When a frame
+ * takes longer than 'threshold_ms', the buffer (ending with that frame) is
+ * written to 'dir' as 'spike_<frame>.json'. Spikes within the window of the
+ * last one written are only counted in the next file. A threshold of 0 turns
+ * the capture off. Returns false if the directory name is too long.
+ * ------------------------------------------------------------------------
+ */
+bool Perf_SetSpikeCapture(double threshold_ms, const char *dir);
+
+/* The counters kept for the spike capture. Calls off the main thread are 
+ * ignored. */
+void Perf_CountEvent(int type);
+void Perf_CountPathRequests(size_t num_srcs);
+void Perf_CountGCPause(int generation, double ms);
+
+/* ------------------------------------------------------------------------
+ * Startup tracing, from the start of the process through the first frame.
+ * 'Perf_StartupBegin' starts the clock and must come before any other 
+ * subsystem is initialized. The stages are then marked with matching 
+ * 'Perf_StartupPush' and 'Perf_StartupPop' calls, which may be nested. Asset
+ * loads pass the asset's path as the 'detail' (NULL for stages), which is 
+ * copied. Calls off the thread that began the trace, and calls made after 
+ * 'Perf_StartupEnd', are ignored, so the asset loaders may mark every load.
+ * 'Perf_StartupEnd' prints a summary of the stages and the slowest asset 
+ * loads, and writes the whole trace to 'trace_path' in the Chrome trace 
+ * event format if it is not NULL.
+ * ------------------------------------------------------------------------
+ */
+void Perf_StartupBegin(void);
+void Perf_StartupPush(const char *name, const char *detail);
+void Perf_StartupPop(void);
+void Perf_StartupEnd(const char *trace_path);
+
+#endif
+
@@ -37,143 +37,16 @@
 #include <string.h>
 #include <assert.h>
 
-GLfloat PFM_Vec2_Dot(vec2_t *op1, vec2_t *op2)
-{
-    return op1->x * op2->x + 
-           op1->y * op2->y;
-}
-
-void PFM_Vec2_Add(vec2_t *op1, vec2_t *op2, vec2_t *out)
-{
-    out->x = op1->x + op2->x; 
-    out->y = op1->y + op2->y;
-}
-
-void PFM_Vec2_Sub(vec2_t *op1, vec2_t *op2, vec2_t *out)
-{
-    out->x = op1->x - op2->x;
-    out->y = op1->y - op2->y;
-}
-
-void PFM_Vec2_Scale(vec2_t *op1, GLfloat scale, vec2_t *out)
-{
-    out->x = op1->x * scale;
-    out->y = op1->y * scale;
-}
-
-GLfloat PFM_Vec2_Len(vec2_t *op1)
-{
-    return sqrt(op1->x * op1->x + 
-                op1->y * op1->y);
-}
-
-void PFM_Vec2_Normal(vec2_t *op1,  vec2_t *out)
-{
-    GLfloat len = PFM_Vec2_Len(op1); 
-
-    out->x = op1->x / len;
-    out->y = op1->y / len;
-}
-
 void PFM_Vec2_Dump(vec2_t *vec, FILE *dumpfile)
 {
     fprintf(dumpfile, "(%.4f, %.4f)\n", vec->x, vec->y);
 }
 
-void PFM_Vec3_Cross(vec3_t *a, vec3_t *b, vec3_t *out)
-{
-    out->x =   a->y * b->z - a->z * b->y;
-    out->y = -(a->x * b->z - a->z * b->x);
-    out->z =   a->x * b->y - a->y * b->x;
-}
-
-GLfloat PFM_Vec3_Dot(vec3_t *op1, vec3_t *op2)
-{
-    return op1->x * op2->x +
-           op1->y * op2->y +
-           op1->z * op2->z;
-}
-
-void PFM_Vec3_Add(vec3_t *op1, vec3_t *op2, vec3_t *out)
-{
-    for(int i = 0; i < 3; i++)
-        out->raw[i] = op1->raw[i] + op2->raw[i];
-}
-
-void PFM_Vec3_Sub(vec3_t *op1, vec3_t *op2, vec3_t *out)
-{
-    for(int i = 0; i < 3; i++)
-        out->raw[i] = op1->raw[i] - op2->raw[i];
-}
-
-void PFM_Vec3_Scale(vec3_t *op1, GLfloat scale, vec3_t *out)
-{
-    for(int i = 0; i < 3; i++)
-        out->raw[i] = op1->raw[i] * scale;
-}
-
-GLfloat PFM_Vec3_Len(vec3_t *op1)
-{
-    return sqrt(op1->x * op1->x + 
-                op1->y * op1->y +
-                op1->z * op1->z);
-}
-
-void PFM_Vec3_Normal(vec3_t *op1, vec3_t *out)
-{
-    GLfloat len = PFM_Vec3_Len(op1); 
-
-    for(int i = 0; i < 3; i++)
-        out->raw[i] = op1->raw[i] / len;
-}
-
 void PFM_Vec3_Dump(vec3_t *vec, FILE *dumpfile)
 {
     fprintf(dumpfile, "(%.4f, %.4f, %.4f)\n", vec->x, vec->y, vec->z);
 }
 
-GLfloat PFM_Vec4_Dot(vec4_t *op1,  vec4_t *op2, vec4_t *out)
-{
-    return op1->x * op2->x +
-           op1->y * op2->y +
-           op1->z * op2->z +
-           op1->w * op2->w;
-}
-
-void PFM_Vec4_Add(vec4_t *op1, vec4_t *op2, vec4_t *out)
-{
-    for(int i = 0; i < 4; i++)
-        out->raw[i] = op1->raw[i] + op2->raw[i];
-}
-
-void PFM_Vec4_Sub(vec4_t *op1, vec4_t *op2, vec4_t *out)
-{
-    for(int i = 0; i < 4; i++)
-        out->raw[i] = op1->raw[i] - op2->raw[i];
-}
-
-void PFM_Vec4_Scale(vec4_t *op1, GLfloat scale, vec4_t *out)
-{
-    for(int i = 0; i < 4; i++)
-        out->raw[i] = op1->raw[i] * scale;
-}
-
-GLfloat PFM_Vec4_Len(vec4_t *op1)
-{
-    return sqrt(op1->x * op1->x + 
-                op1->y * op1->y +
-                op1->z * op1->z +
-                op1->w * op1->w);
-}
-
-void PFM_Vec4_Normal(vec4_t *op1, vec4_t *out)
-{
-    GLfloat len = PFM_Vec4_Len(op1); 
-
-    for(int i = 0; i < 4; i++)
-        out->raw[i] = op1->raw[i] / len;
-}
-
 void PFM_Vec4_Dump(vec4_t *vec,  FILE *dumpfile)
 {
     fprintf(dumpfile, "(%.4f, %.4f, %.4f, %.4f)\n", vec->x, vec->y, vec->z, vec->w);
@@ -197,15 +70,6 @@ void PFM_Mat3x3_Mult3x3 (mat3x3_t *op1, mat3x3_t *op2, mat3x3_t *out)
     }
 }
 
-void PFM_Mat3x3_Mult3x1 (mat3x3_t *op1,  vec3_t *op2,  vec3_t *out)
-{
-    for(int r = 0; r < 3; r++) {
-        out->raw[r] = 0.0f;
-        for(int c = 0; c < 3; c++)
-            out->raw[r] += op1->cols[c][r] * op2->raw[c];
-    }
-}
-
 void PFM_Mat3x3_Identity(mat3x3_t *out)
 {
     memset(out, 0, sizeof(mat3x3_t));
@@ -221,32 +85,51 @@ void PFM_Mat4x4_Scale(mat4x4_t *op1, GLfloat scale, mat4x4_t *out)
     }
 }
 
-void PFM_Mat4x4_Mult4x4 (mat4x4_t *op1, mat4x4_t *op2, mat4x4_t *out)
+void PFM_Mat4x4_Identity(mat4x4_t *out)
 {
-    for(int r = 0; r < 4; r++) {
-        for(int c = 0; c < 4; c++) {
-            out->cols[c][r] = 0.0f;
-            for(int k = 0; k < 4; k++)
-                out->cols[c][r] += op1->cols[k][r] * op2->cols[c][k]; 
-        }
-    }
+    memset(out, 0, sizeof(mat4x4_t));
+
+    for(int i = 0; i < 4; i++)
+        out->cols[i][i] = 1;
 }
 
-void PFM_Mat4x4_Mult4x1(mat4x4_t *op1, vec4_t *op2, vec4_t *out)
+void PFM_Mat4x4_Mult4x4N(size_t n, const mat4x4_t *op1, const mat4x4_t *op2, mat4x4_t *out)
 {
-    for(int r = 0; r < 4; r++) {
-        out->raw[r] = 0.0f;
-        for(int c = 0; c < 4; c++)
-            out->raw[r] += op1->cols[c][r] * op2->raw[c];
-    }
+    for(size_t i = 0; i < n; i++)
+        PFM_Mat4x4_Mult4x4(&op1[i], &op2[i], &out[i]);
 }
 
-void PFM_Mat4x4_Identity(mat4x4_t *out)
+void PFM_Mat4x4_TransformPoints(const mat4x4_t *mat, size_t n, const vec3_t *in, vec3_t *out)
 {
-    memset(out, 0, sizeof(mat4x4_t));
+#if defined(__SSE__)
+    __m128 cols[4] = {
+        _mm_loadu_ps(mat->cols[0]), _mm_loadu_ps(mat->cols[1]), 
+        _mm_loadu_ps(mat->cols[2]), _mm_loadu_ps(mat->cols[3]),
+    };
+    for(size_t i = 0; i < n; i++) {
 
-    for(int i = 0; i < 4; i++)
-        out->cols[i][i] = 1;
+        __m128 ret = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cols[0], _mm_set1_ps(in[i].x)), _mm_mul_ps(cols[1], _mm_set1_ps(in[i].y))),
+            _mm_add_ps(_mm_mul_ps(cols[2], _mm_set1_ps(in[i].z)), cols[3]));
+
+        /* A full store would run into the next point */
+        float tmp[4];
+        _mm_storeu_ps(tmp, ret);
+        out[i] = (vec3_t){tmp[0], tmp[1], tmp[2]};
+    }
+#else
+    for(size_t i = 0; i < n; i++) {
+
+        vec3_t ret;
+        for(int r = 0; r < 3; r++) {
+            ret.raw[r] = mat->cols[0][r] * in[i].x 
+                       + mat->cols[1][r] * in[i].y 
+                       + mat->cols[2][r] * in[i].z 
+                       + mat->cols[3][r];
+        }
+        out[i] = ret;
+    }
+#endif
 }
 
 void PFM_Mat4x4_MakeScale(GLfloat s1, GLfloat s2, GLfloat s3, mat4x4_t *out)
@@ -307,17 +190,17 @@ void PFM_Mat4x4_RotFromQuat(const quat_t *quat, mat4x4_t *out)
 {
     PFM_Mat4x4_Identity(out);
 
-    out->cols[0][0]  = 1 - 2*pow(quat->y, 2) - 2*pow(quat->z, 2);
+    out->cols[0][0]  = 1 - 2*quat->y*quat->y - 2*quat->z*quat->z;
     out->cols[1][0] = 2*quat->x*quat->y + 2*quat->w*quat->z;
     out->cols[2][0] = 2*quat->x*quat->z - 2*quat->w*quat->y;
 
     out->cols[0][1] = 2*quat->x*quat->y - 2*quat->w*quat->z;
-    out->cols[1][1] = 1 - 2*pow(quat->x, 2) - 2*pow(quat->z, 2);
+    out->cols[1][1] = 1 - 2*quat->x*quat->x - 2*quat->z*quat->z;
     out->cols[2][1] = 2*quat->y*quat->z + 2*quat->w*quat->x;
 
     out->cols[0][2] = 2*quat->x*quat->z + 2*quat->w*quat->y;
     out->cols[1][2] = 2*quat->y*quat->z - 2*quat->w*quat->x;
-    out->cols[2][2] = 1 - 2*pow(quat->x, 2) - 2*pow(quat->y, 2);
+    out->cols[2][2] = 1 - 2*quat->x*quat->x - 2*quat->y*quat->y;
 }
 
 void PFM_Mat4x4_RotFromEuler(GLfloat deg_x, GLfloat deg_y, GLfloat deg_z, mat4x4_t *out)
@@ -585,28 +468,6 @@ void PFM_Quat_ToEuler(quat_t *q, float *out_roll, float *out_pitch, float *out_y
     *out_yaw = RAD_TO_DEG(atan2(siny, cosy));
 }
 
-void PFM_Quat_MultQuat(quat_t *op1, quat_t *op2, quat_t *out)
-{
-    out->x = ( op1->x * op2->w) + (op1->y * op2->z) - (op1->z * op2->y) + (op1->w * op2->x);
-    out->y = (-op1->x * op2->z) + (op1->y * op2->w) + (op1->z * op2->x) + (op1->w * op2->y);
-    out->z = ( op1->x * op2->y) - (op1->y * op2->x) + (op1->z * op2->w) + (op1->w * op2->z);
-    out->w = (-op1->x * op2->x) - (op1->y * op2->y) - (op1->z * op2->z) + (op1->w * op2->w);
-}
-
-void PFM_Quat_Normal(quat_t *op1, quat_t *out)
-{
-    GLfloat len = sqrt(
-         op1->x * op1->x 
-       + op1->y * op1->y
-       + op1->z * op1->z 
-       + op1->w * op1->w
-    ); 
-    out->x = op1->x / len;
-    out->y = op1->y / len;
-    out->z = op1->z / len;
-    out->w = op1->w / len;
-}
-
 GLfloat PFM_BilinearInterp(GLfloat q11, GLfloat q12, GLfloat q21, GLfloat q22,
                            GLfloat x1,  GLfloat x2,  GLfloat y1,  GLfloat y2,
                            GLfloat x,   GLfloat y)
@@ -45,6 +45,11 @@
     #define __USE_MISC
 #endif
 #include <math.h>    /* M_PI definition    */
+#include <stddef.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 #define DEG_TO_RAD(_deg) ((_deg)*(M_PI/180.0f))
 #define RAD_TO_DEG(_rad) ((_rad)*(180.0f/M_PI))
@@ -98,37 +103,126 @@ typedef union mat4x4{
 /* vec2                                                                      */
 /*****************************************************************************/
 
-GLfloat PFM_Vec2_Dot       (vec2_t *op1, vec2_t *op2);
-void    PFM_Vec2_Add       (vec2_t *op1, vec2_t *op2, vec2_t *out);
-void    PFM_Vec2_Sub       (vec2_t *op1, vec2_t *op2, vec2_t *out);
-void    PFM_Vec2_Scale     (vec2_t *op1, GLfloat scale, vec2_t *out);
-GLfloat PFM_Vec2_Len       (vec2_t *op1);
-void    PFM_Vec2_Normal    (vec2_t *op1,  vec2_t *out);
+static inline GLfloat PFM_Vec2_Dot(const vec2_t *op1, const vec2_t *op2)
+{
+    return op1->x * op2->x + 
+           op1->y * op2->y;
+}
+
+static inline void PFM_Vec2_Add(const vec2_t *op1, const vec2_t *op2, vec2_t *out)
+{
+    *out = (vec2_t){op1->x + op2->x, op1->y + op2->y};
+}
+
+static inline void PFM_Vec2_Sub(const vec2_t *op1, const vec2_t *op2, vec2_t *out)
+{
+    *out = (vec2_t){op1->x - op2->x, op1->y - op2->y};
+}
+
+static inline void PFM_Vec2_Scale(const vec2_t *op1, GLfloat scale, vec2_t *out)
+{
+    *out = (vec2_t){op1->x * scale, op1->y * scale};
+}
+
+static inline GLfloat PFM_Vec2_Len(const vec2_t *op1)
+{
+    return sqrtf(PFM_Vec2_Dot(op1, op1));
+}
+
+static inline void PFM_Vec2_Normal(const vec2_t *op1, vec2_t *out)
+{
+    GLfloat len = PFM_Vec2_Len(op1);
+    *out = (vec2_t){op1->x / len, op1->y / len};
+}
+
 void    PFM_Vec2_Dump(vec2_t *vec, FILE *dumpfile);
 
 /*****************************************************************************/
 /* vec3                                                                      */
 /*****************************************************************************/
 
-void    PFM_Vec3_Cross     (vec3_t *a,   vec3_t *b,   vec3_t *out);
-GLfloat PFM_Vec3_Dot       (vec3_t *op1, vec3_t *op2);
-void    PFM_Vec3_Add       (vec3_t *op1, vec3_t *op2, vec3_t *out);
-void    PFM_Vec3_Sub       (vec3_t *op1, vec3_t *op2, vec3_t *out);
-void    PFM_Vec3_Scale     (vec3_t *op1, GLfloat scale, vec3_t *out);
-GLfloat PFM_Vec3_Len       (vec3_t *op1);
-void    PFM_Vec3_Normal    (vec3_t *op1, vec3_t *out);
+static inline void PFM_Vec3_Cross(const vec3_t *a, const vec3_t *b, vec3_t *out)
+{
+    *out = (vec3_t){
+          a->y * b->z - a->z * b->y,
+        -(a->x * b->z - a->z * b->x),
+          a->x * b->y - a->y * b->x
+    };
+}
+
+static inline GLfloat PFM_Vec3_Dot(const vec3_t *op1, const vec3_t *op2)
+{
+    return op1->x * op2->x +
+           op1->y * op2->y +
+           op1->z * op2->z;
+}
+
+static inline void PFM_Vec3_Add(const vec3_t *op1, const vec3_t *op2, vec3_t *out)
+{
+    *out = (vec3_t){op1->x + op2->x, op1->y + op2->y, op1->z + op2->z};
+}
+
+static inline void PFM_Vec3_Sub(const vec3_t *op1, const vec3_t *op2, vec3_t *out)
+{
+    *out = (vec3_t){op1->x - op2->x, op1->y - op2->y, op1->z - op2->z};
+}
+
+static inline void PFM_Vec3_Scale(const vec3_t *op1, GLfloat scale, vec3_t *out)
+{
+    *out = (vec3_t){op1->x * scale, op1->y * scale, op1->z * scale};
+}
+
+static inline GLfloat PFM_Vec3_Len(const vec3_t *op1)
+{
+    return sqrtf(PFM_Vec3_Dot(op1, op1));
+}
+
+static inline void PFM_Vec3_Normal(const vec3_t *op1, vec3_t *out)
+{
+    GLfloat len = PFM_Vec3_Len(op1);
+    *out = (vec3_t){op1->x / len, op1->y / len, op1->z / len};
+}
+
 void    PFM_Vec3_Dump      (vec3_t *vec, FILE *dumpfile);
 
 /*****************************************************************************/
 /* vec4                                                                      */
 /*****************************************************************************/
 
-GLfloat PFM_Vec4_Dot       (vec4_t *op1, vec4_t *op2, vec4_t *out);
-void    PFM_Vec4_Add       (vec4_t *op1, vec4_t *op2, vec4_t *out);
-void    PFM_Vec4_Sub       (vec4_t *op1, vec4_t *op2, vec4_t *out);
-void    PFM_Vec4_Scale     (vec4_t *op1, GLfloat scale, vec4_t *out);
-GLfloat PFM_Vec4_Len       (vec4_t *op1);
-void    PFM_Vec4_Normal    (vec4_t *op1, vec4_t *out);
+static inline GLfloat PFM_Vec4_Dot(const vec4_t *op1, const vec4_t *op2, vec4_t *out)
+{
+    return op1->x * op2->x +
+           op1->y * op2->y +
+           op1->z * op2->z +
+           op1->w * op2->w;
+}
+
+static inline void PFM_Vec4_Add(const vec4_t *op1, const vec4_t *op2, vec4_t *out)
+{
+    *out = (vec4_t){op1->x + op2->x, op1->y + op2->y, op1->z + op2->z, op1->w + op2->w};
+}
+
+static inline void PFM_Vec4_Sub(const vec4_t *op1, const vec4_t *op2, vec4_t *out)
+{
+    *out = (vec4_t){op1->x - op2->x, op1->y - op2->y, op1->z - op2->z, op1->w - op2->w};
+}
+
+static inline void PFM_Vec4_Scale(const vec4_t *op1, GLfloat scale, vec4_t *out)
+{
+    *out = (vec4_t){op1->x * scale, op1->y * scale, op1->z * scale, op1->w * scale};
+}
+
+static inline GLfloat PFM_Vec4_Len(const vec4_t *op1)
+{
+    return sqrtf(PFM_Vec4_Dot(op1, op1, NULL));
+}
+
+static inline void PFM_Vec4_Normal(const vec4_t *op1, vec4_t *out)
+{
+    GLfloat len = PFM_Vec4_Len(op1);
+    *out = (vec4_t){op1->x / len, op1->y / len, op1->z / len, op1->w / len};
+}
+
 void    PFM_Vec4_Dump      (vec4_t *vec, FILE *dumpfile);
 
 /*****************************************************************************/
@@ -137,18 +231,90 @@ void    PFM_Vec4_Dump      (vec4_t *vec, FILE *dumpfile);
 
 void    PFM_Mat3x3_Scale   (mat3x3_t *op1,  GLfloat scale, mat3x3_t *out);
 void    PFM_Mat3x3_Mult3x3 (mat3x3_t *op1,  mat3x3_t *op2, mat3x3_t *out);
-void    PFM_Mat3x3_Mult3x1 (mat3x3_t *op1,  vec3_t *op2,   vec3_t *out);
 void    PFM_Mat3x3_Identity(mat3x3_t *out);
 
+static inline void PFM_Mat3x3_Mult3x1(const mat3x3_t *op1, const vec3_t *op2, vec3_t *out)
+{
+    vec3_t ret;
+    for(int r = 0; r < 3; r++) {
+        ret.raw[r] = op1->cols[0][r] * op2->raw[0] 
+                   + op1->cols[1][r] * op2->raw[1] 
+                   + op1->cols[2][r] * op2->raw[2];
+    }
+    *out = ret;
+}
+
 /*****************************************************************************/
 /* mat4x4                                                                    */
 /*****************************************************************************/
 
 void    PFM_Mat4x4_Scale   (mat4x4_t *op1, GLfloat scale, mat4x4_t *out);
-void    PFM_Mat4x4_Mult4x4 (mat4x4_t *op1, mat4x4_t *op2, mat4x4_t *out);
-void    PFM_Mat4x4_Mult4x1 (mat4x4_t *op1, vec4_t   *op2, vec4_t   *out);
 void    PFM_Mat4x4_Identity(mat4x4_t *out);
 
+/* The products are small enough to be inlined into the callers. Each column 
+ * of the result is a sum of the columns of 'op1' weighted by the components of 
+ * the matching column of 'op2', which maps directly onto SSE registers. The 
+ * result is only written once all of the inputs have been read, so 'out' may 
+ * be one of the operands. */
+static inline void PFM_Mat4x4_Mult4x4(const mat4x4_t *op1, const mat4x4_t *op2, mat4x4_t *out)
+{
+#if defined(__SSE__)
+    __m128 cols[4] = {
+        _mm_loadu_ps(op1->cols[0]), _mm_loadu_ps(op1->cols[1]), 
+        _mm_loadu_ps(op1->cols[2]), _mm_loadu_ps(op1->cols[3]),
+    };
+    __m128 ret[4];
+    for(int c = 0; c < 4; c++) {
+        ret[c] = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(cols[0], _mm_set1_ps(op2->cols[c][0])), 
+                       _mm_mul_ps(cols[1], _mm_set1_ps(op2->cols[c][1]))),
+            _mm_add_ps(_mm_mul_ps(cols[2], _mm_set1_ps(op2->cols[c][2])), 
+                       _mm_mul_ps(cols[3], _mm_set1_ps(op2->cols[c][3]))));
+    }
+    for(int c = 0; c < 4; c++)
+        _mm_storeu_ps(out->cols[c], ret[c]);
+#else
+    mat4x4_t ret;
+    for(int c = 0; c < 4; c++) {
+        for(int r = 0; r < 4; r++) {
+            ret.cols[c][r] = op1->cols[0][r] * op2->cols[c][0] 
+                           + op1->cols[1][r] * op2->cols[c][1] 
+                           + op1->cols[2][r] * op2->cols[c][2] 
+                           + op1->cols[3][r] * op2->cols[c][3];
+        }
+    }
+    *out = ret;
+#endif
+}
+
+static inline void PFM_Mat4x4_Mult4x1(const mat4x4_t *op1, const vec4_t *op2, vec4_t *out)
+{
+#if defined(__SSE__)
+    __m128 ret = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(op1->cols[0]), _mm_set1_ps(op2->raw[0])), 
+                   _mm_mul_ps(_mm_loadu_ps(op1->cols[1]), _mm_set1_ps(op2->raw[1]))),
+        _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(op1->cols[2]), _mm_set1_ps(op2->raw[2])), 
+                   _mm_mul_ps(_mm_loadu_ps(op1->cols[3]), _mm_set1_ps(op2->raw[3]))));
+    _mm_storeu_ps(out->raw, ret);
+#else
+    vec4_t ret;
+    for(int r = 0; r < 4; r++) {
+        ret.raw[r] = op1->cols[0][r] * op2->raw[0] 
+                   + op1->cols[1][r] * op2->raw[1] 
+                   + op1->cols[2][r] * op2->raw[2] 
+                   + op1->cols[3][r] * op2->raw[3];
+    }
+    *out = ret;
+#endif
+}
+
+/* Batched versions for many matrices or points at once: 'out[i]' is 
+ * 'op1[i] * op2[i]'. */
+void    PFM_Mat4x4_Mult4x4N(size_t n, const mat4x4_t *op1, const mat4x4_t *op2, mat4x4_t *out);
+/* Transforms 'n' points by an affine matrix, which leaves 'w' at 1 so that no 
+ * perspective divide is needed. 'in' and 'out' may be the same array. */
+void    PFM_Mat4x4_TransformPoints(const mat4x4_t *mat, size_t n, const vec3_t *in, vec3_t *out);
+
 void    PFM_Mat4x4_MakeScale   (GLfloat s1, GLfloat s2, GLfloat s3, mat4x4_t *out);
 void    PFM_Mat4x4_MakeTrans   (GLfloat tx, GLfloat ty, GLfloat tz, mat4x4_t *out);
 void    PFM_Mat4x4_MakeRotX    (GLfloat radians, mat4x4_t *out);
@@ -172,8 +338,21 @@ void    PFM_Mat4x4_MakeLookAt     (vec3_t *camera_pos, vec3_t *target_pos,
 
 void    PFM_Quat_FromRotMat(mat4x4_t *mat, quat_t *out);
 void    PFM_Quat_ToEuler   (quat_t *q, float *out_roll, float *out_pitch, float *out_yaw);
-void    PFM_Quat_MultQuat  (quat_t *op1, quat_t *op2, quat_t *out);
-void    PFM_Quat_Normal    (quat_t *op1, quat_t *out);
+
+static inline void PFM_Quat_MultQuat(const quat_t *op1, const quat_t *op2, quat_t *out)
+{
+    *out = (quat_t){
+        ( op1->x * op2->w) + (op1->y * op2->z) - (op1->z * op2->y) + (op1->w * op2->x),
+        (-op1->x * op2->z) + (op1->y * op2->w) + (op1->z * op2->x) + (op1->w * op2->y),
+        ( op1->x * op2->y) - (op1->y * op2->x) + (op1->z * op2->w) + (op1->w * op2->z),
+        (-op1->x * op2->x) - (op1->y * op2->y) - (op1->z * op2->z) + (op1->w * op2->w)
+    };
+}
+
+static inline void PFM_Quat_Normal(const quat_t *op1, quat_t *out)
+{
+    PFM_Vec4_Normal(op1, out);
+}
 
 /*****************************************************************************/
 /* Other                                                                     */
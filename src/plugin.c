@@ -0,0 +1,725 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "plugin.h"
+#include "plugin_api.h"
+#include "entity.h"
+#include "event.h"
+#include "perf.h"
+#include "game/public/game.h"
+#include "lib/public/kvec.h"
+#include "lib/public/khash.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define MAX_NAME_LEN    (32)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+
+/* The plugins pass around points as arrays of floats */
+#define XZ(arr)         ((vec2_t){(arr)[0], (arr)[1]})
+
+KHASH_MAP_INIT_INT(slot, uint32_t)
+
+struct plugin{
+    void               *object;
+    pf_plugin_unload_t  unload;
+};
+
+struct registration{
+    int                 event;
+    bool                entity;
+    uint32_t            uid;
+    pf_handler_t        handler;
+};
+
+struct system{
+    /* The systems are allocated one by one, so that the name keeps its' 
+     * address for the profiler */
+    char                name[MAX_NAME_LEN];
+    int                 order;
+    pf_system_t         fn;
+    void               *user;
+    /* The 's_loading' value when the system was registered */
+    int                 loading;
+};
+
+struct component{
+    char                name[MAX_NAME_LEN];
+    size_t              size;
+    /* Maps an entity UID to its' slot */
+    khash_t(slot)      *slots;
+    /* The UID and data for every slot. Removing a component moves the one 
+     * in the last slot into its' place. */
+    kvec_t(uint32_t)    uids;
+    unsigned char      *data;
+    size_t              capacity;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                             s_initialized = false;
+static kvec_t(struct plugin)            s_plugins;
+static kvec_t(struct registration)      s_registrations;
+static kvec_t(struct system*)           s_systems;
+static kvec_t(struct component)         s_components;
+static uint32_t                         s_tick;
+static bool                             s_in_tick = false;
+/* The number of the plugin being loaded (counting from 1), or 0 */
+static int                              s_loading = 0;
+/* Scratch space for the spatial queries */
+static pentity_kvec_t                   s_query;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static struct component *pl_component(int comp)
+{
+    if(comp < 0 || comp >= kv_size(s_components))
+        return NULL;
+    return &kv_A(s_components, comp);
+}
+
+static void *pl_slot_data(const struct component *cmp, uint32_t slot)
+{
+    return cmp->data + (size_t)slot * cmp->size;
+}
+
+static void pl_remove_slot(struct component *cmp, uint32_t slot)
+{
+    uint32_t uid = kv_A(cmp->uids, slot);
+    kh_del(slot, cmp->slots, kh_get(slot, cmp->slots, uid));
+
+    uint32_t last = kv_size(cmp->uids) - 1;
+    if(slot != last) {
+
+        uint32_t moved = kv_A(cmp->uids, last);
+        kv_A(cmp->uids, slot) = moved;
+        memcpy(pl_slot_data(cmp, slot), pl_slot_data(cmp, last), cmp->size);
+        kh_value(cmp->slots, kh_get(slot, cmp->slots, moved)) = slot;
+    }
+    kv_size(cmp->uids)--;
+}
+
+/* Drop the components of the entities that have been freed */
+static void pl_sweep_components(void)
+{
+    for(int i = 0; i < kv_size(s_components); i++) {
+
+        struct component *cmp = &kv_A(s_components, i);
+        for(int j = kv_size(cmp->uids) - 1; j >= 0; j--) {
+            if(!Entity_FromUID(kv_A(cmp->uids, j)))
+                pl_remove_slot(cmp, j);
+        }
+    }
+}
+
+/* Free the systems which were unregistered, keeping the order of the rest */
+static void pl_compact_systems(void)
+{
+    size_t nkept = 0;
+    for(int i = 0; i < kv_size(s_systems); i++) {
+
+        struct system *sys = kv_A(s_systems, i);
+        if(sys->fn)
+            kv_A(s_systems, nkept++) = sys;
+        else
+            free(sys);
+    }
+    kv_size(s_systems) = nkept;
+}
+
+static void pl_on_30hz_tick(void *unused1, void *unused2)
+{
+    pl_sweep_components();
+
+    /* The systems may be registered and unregistered by the systems 
+     * themselves. This only takes effect from the next tick. */
+    size_t num_systems = kv_size(s_systems);
+    struct system *run[num_systems + 1];
+    for(int i = 0; i < num_systems; i++)
+        run[i] = kv_A(s_systems, i);
+
+    s_in_tick = true;
+    for(int i = 0; i < num_systems; i++) {
+
+        struct system *sys = run[i];
+        if(!sys->fn)
+            continue;
+
+        Perf_Push(sys->name);
+        sys->fn(sys->user, s_tick);
+        Perf_Pop();
+    }
+    s_in_tick = false;
+
+    pl_compact_systems();
+    s_tick++;
+}
+
+static void pl_unregister_from(size_t first)
+{
+    while(kv_size(s_registrations) > first) {
+
+        struct registration reg = kv_pop(s_registrations);
+        if(reg.entity)
+            E_Entity_Unregister(reg.event, reg.uid, (handler_t)reg.handler);
+        else
+            E_Global_Unregister(reg.event, (handler_t)reg.handler);
+    }
+}
+
+static void pl_forget(int event, bool entity, uint32_t uid, pf_handler_t handler)
+{
+    for(int i = 0; i < kv_size(s_registrations); i++) {
+
+        struct registration *curr = &kv_A(s_registrations, i);
+        if(curr->event != event || curr->entity != entity || curr->handler != handler)
+            continue;
+        if(entity && curr->uid != uid)
+            continue;
+
+        *curr = kv_A(s_registrations, kv_size(s_registrations) - 1);
+        kv_size(s_registrations)--;
+        return;
+    }
+}
+
+static void pl_free_systems(void)
+{
+    for(int i = 0; i < kv_size(s_systems); i++)
+        free(kv_A(s_systems, i));
+    kv_reset(s_systems);
+}
+
+static size_t pl_uids_out(const pentity_kvec_t *ents, uint32_t *out, size_t max)
+{
+    size_t n = MIN(kv_size(*ents), max);
+    for(int i = 0; i < n; i++)
+        out[i] = kv_A(*ents, i)->uid;
+    return kv_size(*ents);
+}
+
+/*---------------------------------------------------------------------------*/
+/* The plugin API                                                            */
+/*---------------------------------------------------------------------------*/
+
+static bool api_register_system(const char *name, int order, pf_system_t fn, void *user)
+{
+    struct system *sys = malloc(sizeof(struct system));
+    if(!sys)
+        return false;
+
+    snprintf(sys->name, sizeof(sys->name), "%s", name);
+    sys->order = order;
+    sys->fn = fn;
+    sys->user = user;
+    sys->loading = s_loading;
+    kv_push(struct system*, s_systems, sys);
+
+    /* Keep the systems sorted, with the new one after any of equal order */
+    int i = kv_size(s_systems) - 1;
+    for(; i > 0 && kv_A(s_systems, i - 1)->order > order; i--)
+        kv_A(s_systems, i) = kv_A(s_systems, i - 1);
+    kv_A(s_systems, i) = sys;
+    return true;
+}
+
+static bool api_unregister_system(pf_system_t fn)
+{
+    for(int i = 0; i < kv_size(s_systems); i++) {
+
+        struct system *sys = kv_A(s_systems, i);
+        if(sys->fn != fn)
+            continue;
+
+        /* A running system may be unregistering itself */
+        sys->fn = NULL;
+        if(!s_in_tick)
+            pl_compact_systems();
+        return true;
+    }
+    return false;
+}
+
+static int api_event_id(const char *name)
+{
+    /* The engine events are numbered consecutively, and all the ones past 
+     * the last are reported under a generic name */
+    for(int i = EVENT_UPDATE_START; i <= EVENT_ENGINE_LAST; i++) {
+
+        const char *curr = E_EventName(i);
+        if(!strcmp(curr, name))
+            return i;
+        if(!strcmp(curr, "engine event"))
+            break;
+    }
+    return -1;
+}
+
+static bool api_register_global(int event, pf_handler_t handler, void *user)
+{
+    if(!E_Global_RegisterNamed(event, (handler_t)handler, "plugin handler", user))
+        return false;
+
+    struct registration reg = (struct registration){event, false, 0, handler};
+    kv_push(struct registration, s_registrations, reg);
+    return true;
+}
+
+static bool api_unregister_global(int event, pf_handler_t handler)
+{
+    pl_forget(event, false, 0, handler);
+    return E_Global_Unregister(event, (handler_t)handler);
+}
+
+static bool api_register_entity(int event, uint32_t uid, pf_handler_t handler, void *user)
+{
+    if(!E_Entity_RegisterNamed(event, uid, (handler_t)handler, "plugin handler", user))
+        return false;
+
+    struct registration reg = (struct registration){event, true, uid, handler};
+    kv_push(struct registration, s_registrations, reg);
+    return true;
+}
+
+static bool api_unregister_entity(int event, uint32_t uid, pf_handler_t handler)
+{
+    pl_forget(event, true, uid, handler);
+    return E_Entity_Unregister(event, uid, (handler_t)handler);
+}
+
+static void api_notify_global(int event, void *arg)
+{
+    E_Global_Notify(event, arg, ES_ENGINE);
+}
+
+static void api_notify_entity(int event, uint32_t uid, void *arg)
+{
+    E_Entity_Notify(event, uid, arg, ES_ENGINE);
+}
+
+static int api_find_component(const char *name)
+{
+    for(int i = 0; i < kv_size(s_components); i++) {
+        if(!strncmp(kv_A(s_components, i).name, name, MAX_NAME_LEN - 1))
+            return i;
+    }
+    return -1;
+}
+
+static int api_register_component(const char *name, size_t size)
+{
+    int ret = api_find_component(name);
+    if(ret >= 0)
+        return (kv_A(s_components, ret).size == size) ? ret : -1;
+
+    if(size == 0)
+        return -1;
+
+    struct component cmp = (struct component){ .size = size };
+    snprintf(cmp.name, sizeof(cmp.name), "%s", name);
+    kv_init(cmp.uids);
+
+    if(NULL == (cmp.slots = kh_init(slot)))
+        return -1;
+
+    kv_push(struct component, s_components, cmp);
+    return kv_size(s_components) - 1;
+}
+
+static void *api_get_component(int comp, uint32_t uid)
+{
+    struct component *cmp = pl_component(comp);
+    if(!cmp)
+        return NULL;
+
+    khiter_t k = kh_get(slot, cmp->slots, uid);
+    if(k == kh_end(cmp->slots))
+        return NULL;
+    return pl_slot_data(cmp, kh_value(cmp->slots, k));
+}
+
+static void *api_add_component(int comp, uint32_t uid)
+{
+    struct component *cmp = pl_component(comp);
+    if(!cmp || !Entity_FromUID(uid))
+        return NULL;
+
+    void *ret = api_get_component(comp, uid);
+    if(ret)
+        return ret;
+
+    size_t slot = kv_size(cmp->uids);
+    if(slot == cmp->capacity) {
+
+        size_t new_cap = MAX(cmp->capacity * 2, 16);
+        unsigned char *new_data = realloc(cmp->data, new_cap * cmp->size);
+        if(!new_data)
+            return NULL;
+        cmp->data = new_data;
+        cmp->capacity = new_cap;
+    }
+
+    int status;
+    khiter_t k = kh_put(slot, cmp->slots, uid, &status);
+    if(status == -1)
+        return NULL;
+
+    kh_value(cmp->slots, k) = slot;
+    kv_push(uint32_t, cmp->uids, uid);
+
+    ret = pl_slot_data(cmp, slot);
+    memset(ret, 0, cmp->size);
+    return ret;
+}
+
+static void api_remove_component(int comp, uint32_t uid)
+{
+    struct component *cmp = pl_component(comp);
+    if(!cmp)
+        return;
+
+    khiter_t k = kh_get(slot, cmp->slots, uid);
+    if(k == kh_end(cmp->slots))
+        return;
+    pl_remove_slot(cmp, kh_value(cmp->slots, k));
+}
+
+static size_t api_component_count(int comp)
+{
+    struct component *cmp = pl_component(comp);
+    return cmp ? kv_size(cmp->uids) : 0;
+}
+
+static void *api_component_array(int comp, const uint32_t **out_uids, size_t *out_count)
+{
+    struct component *cmp = pl_component(comp);
+    if(!cmp) {
+        *out_uids = NULL;
+        *out_count = 0;
+        return NULL;
+    }
+
+    *out_uids = cmp->uids.a;
+    *out_count = kv_size(cmp->uids);
+    return cmp->data;
+}
+
+static void api_foreach_component(int comp, pf_component_fn_t fn, void *user)
+{
+    struct component *cmp = pl_component(comp);
+    if(!cmp)
+        return;
+
+    for(int i = 0; i < kv_size(cmp->uids); i++) {
+
+        uint32_t uid = kv_A(cmp->uids, i);
+        if(!Entity_FromUID(uid))
+            continue;
+        fn(user, uid, pl_slot_data(cmp, i));
+    }
+}
+
+static bool api_entity_exists(uint32_t uid)
+{
+    return (Entity_FromUID(uid) != NULL);
+}
+
+static bool api_entity_pos(uint32_t uid, float out_pos[3])
+{
+    const struct entity *ent = Entity_FromUID(uid);
+    if(!ent)
+        return false;
+
+    memcpy(out_pos, ent->pos.raw, sizeof(ent->pos.raw));
+    return true;
+}
+
+static bool api_entity_set_pos(uint32_t uid, const float pos[3])
+{
+    struct entity *ent = Entity_FromUID(uid);
+    if(!ent)
+        return false;
+
+    Entity_SetPos(ent, (vec3_t){pos[0], pos[1], pos[2]});
+    G_UpdateEntityBounds(ent);
+    return true;
+}
+
+static uint32_t api_entity_flags(uint32_t uid)
+{
+    const struct entity *ent = Entity_FromUID(uid);
+    return ent ? ent->flags : 0;
+}
+
+static float api_entity_radius(uint32_t uid)
+{
+    const struct entity *ent = Entity_FromUID(uid);
+    return ent ? ent->selection_radius : 0.0f;
+}
+
+static float api_entity_max_speed(uint32_t uid)
+{
+    const struct entity *ent = Entity_FromUID(uid);
+    return ent ? ent->max_speed : 0.0f;
+}
+
+static bool api_move_order(size_t n, const uint32_t uids[], const float target_xz[2])
+{
+    pentity_kvec_t ents;
+    kv_init(ents);
+
+    for(int i = 0; i < n; i++) {
+
+        struct entity *ent = Entity_FromUID(uids[i]);
+        if(ent)
+            kv_push(struct entity*, ents, ent);
+    }
+
+    /* The tick has always been run already, so the order goes to the next one */
+    bool ret = G_Move_Order(&ents, XZ(target_xz), 0);
+    kv_destroy(ents);
+    return ret;
+}
+
+static size_t api_entities_in_circle(const float xz[2], float radius, uint32_t *out, size_t max)
+{
+    G_EntitiesInCircle(XZ(xz), radius, &s_query);
+    return pl_uids_out(&s_query, out, max);
+}
+
+static size_t api_entities_in_rect(const float xz_min[2], const float xz_max[2], 
+                                   uint32_t *out, size_t max)
+{
+    G_EntitiesInRect(XZ(xz_min), XZ(xz_max), &s_query);
+    return pl_uids_out(&s_query, out, max);
+}
+
+struct pred_ctx{
+    pf_entity_pred_t pred;
+    void            *user;
+};
+
+static bool pl_pred(const struct entity *ent, void *arg)
+{
+    struct pred_ctx *ctx = arg;
+    return ctx->pred(ctx->user, ent->uid);
+}
+
+static bool api_nearest_entity(const float xz[2], float max_dist, pf_entity_pred_t pred, 
+                               void *user, uint32_t *out_uid)
+{
+    struct pred_ctx ctx = (struct pred_ctx){pred, user};
+    const struct entity *ent = G_NearestEntity(XZ(xz), max_dist, pred ? pl_pred : NULL, &ctx);
+    if(!ent)
+        return false;
+
+    *out_uid = ent->uid;
+    return true;
+}
+
+static bool api_map_height(const float xz[2], float *out_height)
+{
+    return G_MapHeightAtPoint(XZ(xz), out_height);
+}
+
+/* The points are laid out just like a 'vec2_t' array */
+static void api_paths_exist(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                            float radius, bool out[])
+{
+    G_NavPathsExist(n, (const vec2_t*)xz_srcs, (const vec2_t*)xz_dests, radius, out);
+}
+
+static void api_path_costs(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                           float radius, float out[])
+{
+    G_NavPathCosts(n, (const vec2_t*)xz_srcs, (const vec2_t*)xz_dests, radius, out);
+}
+
+static void api_positions_pathable(size_t n, const float xz_positions[][2], float radius, 
+                                   bool out[])
+{
+    G_NavPositionsPathable(n, (const vec2_t*)xz_positions, radius, out);
+}
+
+static void api_raycasts(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                         float radius, bool out_hit[], float out_pos[][2])
+{
+    G_NavRaycasts(n, (const vec2_t*)xz_srcs, (const vec2_t*)xz_dests, radius, 
+        out_hit, (vec2_t*)out_pos);
+}
+
+static const struct pf_plugin_api s_api = {
+    .version            = PF_PLUGIN_API_VERSION,
+    .size               = sizeof(struct pf_plugin_api),
+    .register_system    = api_register_system,
+    .unregister_system  = api_unregister_system,
+    .event_id           = api_event_id,
+    .register_global    = api_register_global,
+    .unregister_global  = api_unregister_global,
+    .register_entity    = api_register_entity,
+    .unregister_entity  = api_unregister_entity,
+    .notify_global      = api_notify_global,
+    .notify_entity      = api_notify_entity,
+    .register_component = api_register_component,
+    .find_component     = api_find_component,
+    .add_component      = api_add_component,
+    .get_component      = api_get_component,
+    .remove_component   = api_remove_component,
+    .component_count    = api_component_count,
+    .component_array    = api_component_array,
+    .foreach_component  = api_foreach_component,
+    .entity_exists      = api_entity_exists,
+    .entity_pos         = api_entity_pos,
+    .entity_set_pos     = api_entity_set_pos,
+    .entity_flags       = api_entity_flags,
+    .entity_radius      = api_entity_radius,
+    .entity_max_speed   = api_entity_max_speed,
+    .move_order         = api_move_order,
+    .entities_in_circle = api_entities_in_circle,
+    .entities_in_rect   = api_entities_in_rect,
+    .nearest_entity     = api_nearest_entity,
+    .map_height         = api_map_height,
+    .paths_exist        = api_paths_exist,
+    .path_costs         = api_path_costs,
+    .positions_pathable = api_positions_pathable,
+    .raycasts           = api_raycasts,
+};
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Plugin_Init(void)
+{
+    kv_init(s_plugins);
+    kv_init(s_registrations);
+    kv_init(s_systems);
+    kv_init(s_components);
+    kv_init(s_query);
+    s_tick = 0;
+
+    if(!E_Global_Register(EVENT_30HZ_TICK, pl_on_30hz_tick, NULL))
+        return false;
+
+    s_initialized = true;
+    return true;
+}
+
+void Plugin_Shutdown(void)
+{
+    if(!s_initialized)
+        return;
+
+    for(int i = kv_size(s_plugins) - 1; i >= 0; i--) {
+        if(kv_A(s_plugins, i).unload)
+            kv_A(s_plugins, i).unload();
+    }
+
+    E_Global_Unregister(EVENT_30HZ_TICK, pl_on_30hz_tick);
+    pl_unregister_from(0);
+    pl_free_systems();
+
+    for(int i = 0; i < kv_size(s_plugins); i++)
+        SDL_UnloadObject(kv_A(s_plugins, i).object);
+
+    for(int i = 0; i < kv_size(s_components); i++) {
+
+        struct component *cmp = &kv_A(s_components, i);
+        kh_destroy(slot, cmp->slots);
+        kv_destroy(cmp->uids);
+        free(cmp->data);
+    }
+
+    kv_destroy(s_plugins);
+    kv_destroy(s_registrations);
+    kv_destroy(s_systems);
+    kv_destroy(s_components);
+    kv_destroy(s_query);
+    s_initialized = false;
+}
+
+bool Plugin_Load(const char *path)
+{
+    assert(s_initialized);
+    size_t num_regs = kv_size(s_registrations);
+    s_loading = kv_size(s_plugins) + 1;
+
+    struct plugin plugin;
+    if(NULL == (plugin.object = SDL_LoadObject(path))) {
+        fprintf(stderr, "Failed to load plugin '%s': %s\n", path, SDL_GetError());
+        goto fail_object;
+    }
+
+    pf_plugin_load_t load = (pf_plugin_load_t)SDL_LoadFunction(plugin.object, PF_PLUGIN_LOAD_SYMBOL);
+    plugin.unload = (pf_plugin_unload_t)SDL_LoadFunction(plugin.object, PF_PLUGIN_UNLOAD_SYMBOL);
+
+    if(!load) {
+        fprintf(stderr, "Plugin '%s' doesn't export '%s'.\n", path, PF_PLUGIN_LOAD_SYMBOL);
+        goto fail_load;
+    }
+
+    if(!load(&s_api)) {
+        fprintf(stderr, "Plugin '%s' failed to load.\n", path);
+        goto fail_load;
+    }
+
+    kv_push(struct plugin, s_plugins, plugin);
+    s_loading = 0;
+    return true;
+
+fail_load:
+    pl_unregister_from(num_regs);
+    for(int i = 0; i < kv_size(s_systems); i++) {
+        if(kv_A(s_systems, i)->loading == s_loading)
+            kv_A(s_systems, i)->fn = NULL;
+    }
+    pl_compact_systems();
+    SDL_UnloadObject(plugin.object);
+fail_object:
+    s_loading = 0;
+    return false;
+}
+
@@ -0,0 +1,63 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdbool.h>
+
+/* Native gameplay plugins. See plugin_api.h for the interface that the
+ * plugins themselves are written against. */
+
+/* ------------------------------------------------------------------------
+ * Must be called after the game and navigation subsystems are initialized.
+ * 'Plugin_Shutdown' calls the unload functions of the plugins, removes 
+ * everything that they have left registered and closes the libraries.
+ * ------------------------------------------------------------------------
+ */
+bool Plugin_Init(void);
+void Plugin_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Open the shared library at 'path' and call its' load function. Returns 
+ * false, after printing the reason, if the library couldn't be opened, 
+ * doesn't export the function or the function failed. In that case, the 
+ * handlers and systems that it managed to register are removed again.
+ * ------------------------------------------------------------------------
+ */
+bool Plugin_Load(const char *path);
+
+#endif
+
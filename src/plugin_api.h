@@ -0,0 +1,179 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef PLUGIN_API_H
+#define PLUGIN_API_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* This is the only header a native plugin needs. A plugin is a shared library
+ * given to the engine with '--plugin' on the command line. It is loaded at
+ * startup, after all the engine subsystems are up and before the script is 
+ * ran, by calling its' exported 'pf_plugin_load' function with the table of 
+ * engine functions below. 'pf_plugin_unload', if it is exported, is called 
+ * at shutdown. Any handlers and systems still registered then are removed 
+ * by the engine.
+ *
+ * The table only ever grows: entries are added at the end and bump the 
+ * version, but are never removed or reordered. A plugin built against an 
+ * older version of this header keeps working with newer engines. A plugin
+ * should check 'version' for the entries it needs, and refuse to load by 
+ * returning false if they are missing.
+ *
+ * Entities are referred to by UID. UIDs are never reused, so a stale UID 
+ * simply stops resolving to an entity once it is freed. Positions are in 
+ * world coordinates, and 2D positions are on the XZ plane. Event IDs are the
+ * values of 'enum eventtype' (see event.h), which can also be looked up by 
+ * name. All the functions must be called from the main thread - which is 
+ * the thread that the systems and handlers are called on. */
+
+#define PF_PLUGIN_API_VERSION   (1)
+
+#define PF_PLUGIN_LOAD_SYMBOL   "pf_plugin_load"
+#define PF_PLUGIN_UNLOAD_SYMBOL "pf_plugin_unload"
+
+#if defined(_WIN32)
+    #define PF_PLUGIN_EXPORT __declspec(dllexport)
+#else
+    #define PF_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+/* Called with the 'user' argument it was registered with, and the argument 
+ * the event was sent with. */
+typedef void (*pf_handler_t)(void *user, void *event_arg);
+/* Called once every 30Hz simulation tick. 'tick' counts up from 0. */
+typedef void (*pf_system_t)(void *user, uint32_t tick);
+typedef void (*pf_component_fn_t)(void *user, uint32_t uid, void *data);
+typedef bool (*pf_entity_pred_t)(void *user, uint32_t uid);
+
+struct pf_plugin_api{
+    /* PF_PLUGIN_API_VERSION of the engine, and the size of the table */
+    uint32_t    version;
+    size_t      size;
+
+    /* --------------------------------------------------------------------
+     * Tick systems: run every 30Hz simulation tick, in ascending 'order' 
+     * (in the order they were registered for equal 'order'). The name is 
+     * shown in the profiler.
+     * --------------------------------------------------------------------
+     */
+    bool        (*register_system)(const char *name, int order, pf_system_t fn, void *user);
+    bool        (*unregister_system)(pf_system_t fn);
+
+    /* --------------------------------------------------------------------
+     * Events. Returns -1 if there is no engine event with the name. The 
+     * events sent by a plugin reach the script handlers with 'None' as the 
+     * argument.
+     * --------------------------------------------------------------------
+     */
+    int         (*event_id)(const char *name);
+    bool        (*register_global)(int event, pf_handler_t handler, void *user);
+    bool        (*unregister_global)(int event, pf_handler_t handler);
+    bool        (*register_entity)(int event, uint32_t uid, pf_handler_t handler, void *user);
+    bool        (*unregister_entity)(int event, uint32_t uid, pf_handler_t handler);
+    void        (*notify_global)(int event, void *arg);
+    void        (*notify_entity)(int event, uint32_t uid, void *arg);
+
+    /* --------------------------------------------------------------------
+     * Components: fixed-size blocks of data attached to entities, stored 
+     * packed together for every component type. Registering an existing 
+     * name with the same size returns the same ID, so that plugins can 
+     * share a component. A newly added component is zeroed. The components
+     * of an entity are dropped once it is freed.
+     *
+     * The pointers returned are only valid until the next time a component
+     * of the same type is added or removed. 'component_array' gives all of 
+     * them at once, along with the UIDs they belong to. The arrays may hold
+     * entities freed since the start of the tick.
+     * --------------------------------------------------------------------
+     */
+    int         (*register_component)(const char *name, size_t size);
+    int         (*find_component)(const char *name);
+    void       *(*add_component)(int comp, uint32_t uid);
+    void       *(*get_component)(int comp, uint32_t uid);
+    void        (*remove_component)(int comp, uint32_t uid);
+    size_t      (*component_count)(int comp);
+    void       *(*component_array)(int comp, const uint32_t **out_uids, size_t *out_count);
+    /* No components of the type may be added or removed during the iteration */
+    void        (*foreach_component)(int comp, pf_component_fn_t fn, void *user);
+
+    /* --------------------------------------------------------------------
+     * Entities. The getters return 0 for UIDs that are no longer valid.
+     * A move order is carried out at the start of the next movement tick.
+     * --------------------------------------------------------------------
+     */
+    bool        (*entity_exists)(uint32_t uid);
+    bool        (*entity_pos)(uint32_t uid, float out_pos[3]);
+    bool        (*entity_set_pos)(uint32_t uid, const float pos[3]);
+    uint32_t    (*entity_flags)(uint32_t uid);
+    float       (*entity_radius)(uint32_t uid);
+    float       (*entity_max_speed)(uint32_t uid);
+    bool        (*move_order)(size_t n, const uint32_t uids[], const float target_xz[2]);
+
+    /* --------------------------------------------------------------------
+     * Spatial queries over the moving entities, by position. Up to 'max' 
+     * UIDs are written to 'out', and the total number found is returned.
+     * --------------------------------------------------------------------
+     */
+    size_t      (*entities_in_circle)(const float xz[2], float radius, uint32_t *out, size_t max);
+    size_t      (*entities_in_rect)(const float xz_min[2], const float xz_max[2], 
+                                    uint32_t *out, size_t max);
+    bool        (*nearest_entity)(const float xz[2], float max_dist, pf_entity_pred_t pred, 
+                                  void *user, uint32_t *out_uid);
+
+    /* --------------------------------------------------------------------
+     * Map and navigation queries. 'radius' is the radius of the unit that
+     * would be moving, which picks the navigation layer.
+     * --------------------------------------------------------------------
+     */
+    bool        (*map_height)(const float xz[2], float *out_height);
+    void        (*paths_exist)(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                               float radius, bool out[]);
+    void        (*path_costs)(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                              float radius, float out[]);
+    void        (*positions_pathable)(size_t n, const float xz_positions[][2], float radius, 
+                                      bool out[]);
+    void        (*raycasts)(size_t n, const float xz_srcs[][2], const float xz_dests[][2], 
+                            float radius, bool out_hit[], float out_pos[][2]);
+};
+
+/* The entry points a plugin exports */
+typedef bool (*pf_plugin_load_t)(const struct pf_plugin_api *api);
+typedef void (*pf_plugin_unload_t)(void);
+
+#endif
+
@@ -0,0 +1,386 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "bake_cache.h"
+#include "../lib/public/file_replace.h"
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Must be bumped whenever the layout of the file or the way the textures 
+ * are baked changes. */
+#define BAKE_CACHE_VERSION  (2)
+#define BAKE_CACHE_MAGIC    (0x4b424650) /* 'PFBK' */
+#define FNV_PRIME           (0x100000001b3ull)
+/* Enough for a 32768x32768 base level */
+#define MAX_LEVELS          (16)
+
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+/* As with the navigation data cache, everything is stored in the native byte
+ * order. A file written on a machine with a different byte order will fail 
+ * the magic number check and be re-baked. The payload holds the mip levels,
+ * largest first, each one preceded by its' size as a uint32_t. */
+struct bc_header{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t width, height;
+    uint32_t format;
+    uint32_t num_levels;
+    uint64_t payload_size;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The minification filter is only mipmapped when there are levels to use */
+static void r_bc_set_filter(GLint filter, int num_levels)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
+        num_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : filter);
+}
+
+/* The number of mip levels the bound texture has, counting from the base */
+static int r_bc_num_levels(void)
+{
+    GLint max_level;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &max_level);
+
+    int ret = 0;
+    while(ret < MAX_LEVELS && ret <= max_level) {
+        GLint width;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, ret, GL_TEXTURE_WIDTH, &width);
+        if(!width)
+            break;
+        ret++;
+    }
+    return ret;
+}
+
+/* Reads back one level of the bound texture as tightly packed RGB */
+static void *r_bc_read_rgb(int level, GLint width, GLint height)
+{
+    void *ret = malloc(width * height * 3);
+    if(!ret)
+        return NULL;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, level, GL_RGB, GL_UNSIGNED_BYTE, ret);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    return ret;
+}
+
+/* Creates a DXT1-compressed copy of the first 'num_levels' levels of the 
+ * texture and leaves it bound. The driver does the compression when given a
+ * compressed internal format. */
+static bool r_bc_compressed_copy(GLuint tex, int num_levels, GLuint *out)
+{
+    glGenTextures(1, out);
+
+    for(int i = 0; i < num_levels; i++) {
+
+        GLint width, height;
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH,  &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &height);
+
+        void *pixels = r_bc_read_rgb(i, width, height);
+        if(!pixels)
+            goto fail;
+
+        glBindTexture(GL_TEXTURE_2D, *out);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, width, height, 
+            0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        free(pixels);
+
+        GLint compressed;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED, &compressed);
+        if(!compressed)
+            goto fail;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, num_levels - 1);
+    return true;
+
+fail:
+    glDeleteTextures(1, out);
+    return false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+uint64_t R_BakeCache_Hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+bool R_BakeCache_Supported(void)
+{
+    return GLEW_EXT_texture_compression_s3tc;
+}
+
+bool R_BakeCache_Compress(GLuint *inout_tex, GLint filter)
+{
+    glBindTexture(GL_TEXTURE_2D, *inout_tex);
+    int num_levels = r_bc_num_levels();
+
+    GLuint ret;
+    if(!r_bc_compressed_copy(*inout_tex, num_levels, &ret))
+        return false;
+
+    r_bc_set_filter(filter, num_levels);
+    glDeleteTextures(1, inout_tex);
+    *inout_tex = ret;
+    return true;
+}
+
+void R_BakeCache_Mipmap(GLuint tex, GLint filter)
+{
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    r_bc_set_filter(filter, r_bc_num_levels());
+}
+
+size_t R_BakeCache_GPUSize(GLuint tex)
+{
+    glBindTexture(GL_TEXTURE_2D, tex);
+    int num_levels = r_bc_num_levels();
+
+    size_t ret = 0;
+    for(int i = 0; i < num_levels; i++) {
+
+        GLint compressed, width, height, size;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED, &compressed);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_WIDTH,  &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_HEIGHT, &height);
+
+        if(compressed) {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+            ret += size;
+        }else{
+            ret += (size_t)width * height * 3;
+        }
+    }
+    return ret;
+}
+
+bool R_BakeCache_Store(const char *path, uint64_t key, GLuint tex)
+{
+    if(!R_BakeCache_Supported())
+        return false;
+
+    GLint compressed;
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    int num_levels = r_bc_num_levels();
+
+    /* Compress a temporary copy, leaving the caller's texture as it is */
+    GLuint src = tex;
+    if(!compressed && !r_bc_compressed_copy(tex, num_levels, &src))
+        return false;
+
+    GLint width, height, format;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,  &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+
+    GLint sizes[MAX_LEVELS];
+    size_t payload_size = 0;
+    for(int i = 0; i < num_levels; i++) {
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &sizes[i]);
+        payload_size += sizeof(uint32_t) + sizes[i];
+    }
+
+    unsigned char *payload = malloc(payload_size);
+    if(!payload)
+        goto fail_alloc;
+
+    unsigned char *cursor = payload;
+    for(int i = 0; i < num_levels; i++) {
+
+        uint32_t size = sizes[i];
+        memcpy(cursor, &size, sizeof(size));
+        cursor += sizeof(size);
+        glGetCompressedTexImage(GL_TEXTURE_2D, i, cursor);
+        cursor += size;
+    }
+
+    if(src != tex)
+        glDeleteTextures(1, &src);
+
+    struct bc_header header = (struct bc_header){
+        .magic        = BAKE_CACHE_MAGIC,
+        .version      = BAKE_CACHE_VERSION,
+        .key          = key,
+        .width        = width,
+        .height       = height,
+        .format       = format,
+        .num_levels   = num_levels,
+        .payload_size = payload_size,
+    };
+
+    /* Write to a temporary file first, so that a partially written file 
+     * never replaces a good one */
+    char tmp_path[512];
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= sizeof(tmp_path))
+        goto fail_path;
+
+    SDL_RWops *stream = SDL_RWFromFile(tmp_path, "wb");
+    if(!stream)
+        goto fail_path;
+
+    bool ret = (1 == SDL_RWwrite(stream, &header, sizeof(header), 1))
+            && (1 == SDL_RWwrite(stream, payload, payload_size, 1));
+    ret = (0 == SDL_RWclose(stream)) && ret;
+
+    ret = file_replace(path, tmp_path, ret);
+
+    free(payload);
+    return ret;
+
+fail_path:
+    free(payload);
+    return false;
+
+fail_alloc:
+    if(src != tex)
+        glDeleteTextures(1, &src);
+    return false;
+}
+
+bool R_BakeCache_Load(const char *path, uint64_t key, GLint filter, bool decompress, 
+                      GLuint *out_tex)
+{
+    if(!R_BakeCache_Supported())
+        return false;
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        goto fail_stream;
+
+    struct bc_header header;
+    if(1 != SDL_RWread(stream, &header, sizeof(header), 1))
+        goto fail_read;
+
+    if(header.magic != BAKE_CACHE_MAGIC
+    || header.version != BAKE_CACHE_VERSION
+    || header.key != key
+    || header.num_levels < 1 || header.num_levels > MAX_LEVELS
+    || header.payload_size != SDL_RWsize(stream) - sizeof(header))
+        goto fail_read;
+
+    unsigned char *payload = malloc(header.payload_size);
+    if(!payload)
+        goto fail_read;
+
+    if(1 != SDL_RWread(stream, payload, header.payload_size, 1))
+        goto fail_payload;
+
+    GLuint ret;
+    glGenTextures(1, &ret);
+    glBindTexture(GL_TEXTURE_2D, ret);
+
+    /* Decompressed textures are only rendered to, so they only get the base */
+    int num_levels = decompress ? 1 : header.num_levels;
+    unsigned char *cursor = payload;
+    size_t left = header.payload_size;
+
+    for(int i = 0; i < num_levels; i++) {
+
+        uint32_t size;
+        if(left < sizeof(size))
+            goto fail_upload;
+        memcpy(&size, cursor, sizeof(size));
+        cursor += sizeof(size);
+        left -= sizeof(size);
+        if(left < size)
+            goto fail_upload;
+
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, header.format, 
+            MAX(header.width >> i, 1), MAX(header.height >> i, 1), 0, size, cursor);
+        cursor += size;
+        left -= size;
+    }
+
+    if(glGetError() != GL_NO_ERROR)
+        goto fail_upload;
+
+    if(decompress) {
+
+        /* Let the driver do the decoding */
+        void *pixels = r_bc_read_rgb(0, header.width, header.height);
+        if(!pixels)
+            goto fail_upload;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, header.width, header.height, 
+            0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        free(pixels);
+    }
+
+    r_bc_set_filter(filter, num_levels);
+    free(payload);
+    SDL_RWclose(stream);
+
+    *out_tex = ret;
+    return true;
+
+fail_upload:
+    glDeleteTextures(1, &ret);
+fail_payload:
+    free(payload);
+fail_read:
+    SDL_RWclose(stream);
+fail_stream:
+    return false;
+}
@@ -0,0 +1,107 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef BAKE_CACHE_H
+#define BAKE_CACHE_H
+
+#include <GL/glew.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* ------------------------------------------------------------------------
+ * Baked textures (terrain chunk tops, the minimap) are expensive to render,
+ * so they are kept in an on-disk cache between sessions. Every file holds a 
+ * single texture and its' mip levels, in the S3TC (DXT1) compressed form that
+ * is uploaded to the GPU as-is, along with the key it was made for. A file with a different 
+ * key, or one that fails to load for any other reason, is simply re-baked.
+ * ------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * FNV-1a hash of 'data', continuing from 'hash'. Used to build cache keys.
+ * ------------------------------------------------------------------------
+ */
+uint64_t R_BakeCache_Hash(uint64_t hash, const void *data, size_t size);
+
+/* ------------------------------------------------------------------------
+ * Returns false when the GL implementation can't compress textures, in 
+ * which case nothing is cached.
+ * ------------------------------------------------------------------------
+ */
+bool     R_BakeCache_Supported(void);
+
+/* ------------------------------------------------------------------------
+ * Replaces the RGB texture 'inout_tex' with a compressed copy of it and all
+ * of its' mip levels. The 'filter' is set as the magnification filter, and 
+ * as the minification filter too when there are no mip levels to use.
+ * ------------------------------------------------------------------------
+ */
+bool     R_BakeCache_Compress(GLuint *inout_tex, GLint filter);
+
+/* ------------------------------------------------------------------------
+ * Generates the mip levels of the RGB texture 'tex' from its' base level and
+ * sets it up to be minified with trilinear filtering. 'filter' is set as the
+ * magnification filter.
+ * ------------------------------------------------------------------------
+ */
+void     R_BakeCache_Mipmap(GLuint tex, GLint filter);
+
+/* ------------------------------------------------------------------------
+ * Returns the number of bytes the levels of the texture take up on the GPU,
+ * for the memory stats.
+ * ------------------------------------------------------------------------
+ */
+size_t   R_BakeCache_GPUSize(GLuint tex);
+
+/* ------------------------------------------------------------------------
+ * Writes the texture 'tex' to 'path', tagged with 'key'. An uncompressed 
+ * texture is compressed on the way out and is itself left untouched.
+ * ------------------------------------------------------------------------
+ */
+bool     R_BakeCache_Store(const char *path, uint64_t key, GLuint tex);
+
+/* ------------------------------------------------------------------------
+ * Creates a new texture from the file at 'path', if it was stored with 
+ * 'key'. When 'decompress' is set, the base level is converted back to plain 
+ * RGB so that it can still be rendered to, and the other levels are dropped.
+ * ------------------------------------------------------------------------
+ */
+bool     R_BakeCache_Load(const char *path, uint64_t key, GLint filter, bool decompress, 
+                          GLuint *out_tex);
+
+#endif
+
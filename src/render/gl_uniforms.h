@@ -36,19 +36,47 @@
 #ifndef GL_UNIFORMS_H
 #define GL_UNIFORMS_H
 
-/* Written by camera once per frame */
-#define GL_U_PROJECTION     "projection"
-#define GL_U_VIEW           "view"
-#define GL_U_VIEW_POS       "view_pos"
+/* std140 uniform block shared by all programs. Holds the camera (written 
+ * once per frame) and the global light parameters. Its' members are:
+ *     mat4 view, mat4 projection, vec3 view_pos, 
+ *     vec3 ambient_color, vec3 light_color, vec3 light_pos 
+ */
+#define GL_U_GLOBALS        "globals"
+
+/* Uniform block holding the point lights in view and the lists of the ones 
+ * reaching each cluster of the view frustum. Written once per frame. 
+ */
+#define GL_U_POINT_LIGHTS   "point_lights"
+
+/* Uniform block holding the shapes that are drawn over the terrain, such as 
+ * the selection rings. Written once per frame, and only bound for the 
+ * terrain pass. 
+ */
+#define GL_U_DECALS         "decals"
+
+/* Uniform block holding the materials of all the loaded models, and the 
+ * index of the current object's first material in it. Entries are only 
+ * written when models are loaded or freed. 
+ */
+#define GL_U_MATERIAL_TABLE "material_table"
+#define GL_U_MATERIAL_BASE  "material_base"
 
 /* Written to by render subsystem for every entity */
 #define GL_U_MODEL          "model"
 #define GL_U_COLOR          "color"
 #define GL_U_MATERIALS      "materials"
 
-/* Written by anim subsystem for every entity */
-#define GL_U_INV_BIND_MATS  "anim_inv_bind_mats"
-#define GL_U_CURR_POSE_MATS "anim_curr_pose_mats"
+/* Buffer texture holding the skinning matrices of all animated entities drawn 
+ * in the frame, the offsets of the current entity's two samples in it and the
+ * factor to blend between them by */
+#define GL_U_ANIM_PALETTE       "anim_palette"
+#define GL_U_ANIM_PALETTE_BASES "anim_palette_bases"
+#define GL_U_ANIM_PALETTE_BLEND "anim_palette_blend"
+
+/* Buffer texture holding the skinning matrices of the clips baked for the 
+ * session, and whether the current entity's offsets are in it */
+#define GL_U_ANIM_BAKED         "anim_baked"
+#define GL_U_ANIM_PALETTE_BAKED "anim_palette_baked"
 
 /* 8 texture slots that get set by render subsystem for each entity */
 #define GL_U_TEXTURE0       "texture0"
@@ -68,12 +96,61 @@
 #define GL_U_TEXTURE14      "texture14"
 #define GL_U_TEXTURE15      "texture15"
 
-/* Global light parameters - affect all models */
-#define GL_U_AMBIENT_COLOR  "ambient_color"
-#define GL_U_LIGHT_POS      "light_pos"
-#define GL_U_LIGHT_COLOR    "light_color"
+/* Texture array holding the material textures of the batched terrain, 
+ * one layer per material */
+#define GL_U_TEXTURE_ARRAY  "texture_array"
+
+/* Set for the splat-mapped terrain: the per-chunk material weights and the 
+ * materials they are for, and the worldspace XZ of the map's corner and its' 
+ * size in chunks for finding the chunk of a fragment */
+#define GL_U_SPLAT_WEIGHTS  "splat_weights"
+#define GL_U_SPLAT_MATS     "splat_mats"
+#define GL_U_SPLAT_ORIGIN   "splat_origin"
+#define GL_U_SPLAT_GRID     "splat_grid"
 
 /* Used to toggle lighting in terrain shader */
 #define GL_U_SKIP_LIGHTING  "skip_lighting"
 
+/* Set by the fog of war pass: the world-space origin of the fog texture and
+ * the scale from world units to texture coordinates, and the fraction of 
+ * the scene framebuffer that was drawn to */
+#define GL_U_FOG_RECT       "fog_rect"
+#define GL_U_UV_SCALE       "uv_scale"
+
+/* Set by the scene composite pass, which applies the fog of war and the
+ * shadows when they are enabled. The light's view-projection matrix maps 
+ * world positions to the shadow maps. */
+#define GL_U_FOG_ENABLED        "fog_enabled"
+#define GL_U_SHADOWS_ENABLED    "shadows_enabled"
+#define GL_U_LIGHT_VIEW_PROJ    "light_view_proj"
+
+/* The size of the viewport in pixels, for drawing things sized on screen */
+#define GL_U_VIEWPORT_SIZE  "viewport_size"
+
+/* Used by the effects: the time (in seconds) that the particles' ages are
+ * measured against and the way the particles of the effect are drawn */
+#define GL_U_CURR_TIME      "curr_time"
+#define GL_U_EFFECT_STYLE   "effect_style"
+
+/* Used by the GPU culling: the number of instances to test, the factor from 
+ * the ratio of an instance's radius to its' distance to its' share of the 
+ * screen's height, the share below which impostors are drawn, and whether 
+ * the instances are tested against the Hi-Z pyramid */
+#define GL_U_NUM_INSTANCES  "num_instances"
+#define GL_U_LOD_SCALE      "lod_scale"
+#define GL_U_IMPOSTOR_SIZE  "impostor_size"
+#define GL_U_HIZ_ENABLED    "hiz_enabled"
+
+/* Used when building the Hi-Z pyramid: the size of the depth buffer's region
+ * that the scene was drawn to, and whether the level is reduced from it 
+ * rather than from the level above */
+#define GL_U_SRC_SIZE       "src_size"
+#define GL_U_FIRST_LEVEL    "first_level"
+
+/* Used when drawing the terrain from its' heightfield: the texture array with 
+ * a layer of texels for each chunk and the number of chunks in a row, which 
+ * places the chunk of a layer on the map */
+#define GL_U_HEIGHTFIELD    "heightfield"
+#define GL_U_CHUNKS_WIDE    "chunks_wide"
+
 #endif
@@ -44,6 +44,7 @@ struct material{
     vec3_t         diffuse_clr;
     vec3_t         specular_clr;
     struct texture texture;
+    char           name[32];
     char           texname[32];
 };
 
@@ -0,0 +1,331 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "mesh.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <math.h>
+
+/* Size of the modelled post-transform vertex cache. The scoring works well 
+ * for hardware caches of any size around this. */
+#define CACHE_SIZE          (32)
+#define CACHE_DECAY_POW     (1.5f)
+#define LAST_TRI_SCORE      (0.75f)
+#define VALENCE_BOOST_SCALE (2.0f)
+#define VALENCE_BOOST_POW   (0.5f)
+
+struct opt_vert{
+    int    cache_pos;
+    float  score;
+    /* Triangles using this vertex which have not been emitted yet, 
+     * stored at 'tris[tris_offset ... tris_offset + num_active_tris]' */
+    size_t tris_offset;
+    int    num_active_tris;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint32_t mesh_hash(const void *data, size_t size)
+{
+    /* FNV-1a */
+    const unsigned char *bytes = data;
+    uint32_t ret = 2166136261u;
+    for(size_t i = 0; i < size; i++) {
+        ret ^= bytes[i];
+        ret *= 16777619u;
+    }
+    return ret;
+}
+
+static float mesh_vert_score(const struct opt_vert *vert)
+{
+    if(vert->num_active_tris == 0)
+        return -1.0f;
+
+    float ret = 0.0f;
+    if(vert->cache_pos >= 0) {
+
+        /* The vertices of the last triangle get a fixed score, so that the 
+         * next triangle doesn't simply reuse them in a different order */
+        if(vert->cache_pos < 3) {
+            ret = LAST_TRI_SCORE;
+        }else {
+            float scale = 1.0f / (CACHE_SIZE - 3);
+            ret = powf(1.0f - (vert->cache_pos - 3) * scale, CACHE_DECAY_POW);
+        }
+    }
+
+    /* Favour vertices with few remaining triangles to get rid of lone 
+     * triangles early */
+    ret += VALENCE_BOOST_SCALE * powf(vert->num_active_tris, -VALENCE_BOOST_POW);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+size_t R_Mesh_Weld(void *verts, size_t vert_size, size_t count, GLuint *out_indices)
+{
+    /* Open-addressed table of unique vertex indices, at most half full */
+    size_t table_size = 1;
+    while(table_size < count * 2)
+        table_size <<= 1;
+
+    GLuint *table = malloc(table_size * sizeof(GLuint));
+    if(!table) {
+        for(size_t i = 0; i < count; i++)
+            out_indices[i] = i;
+        return count;
+    }
+    memset(table, 0xff, table_size * sizeof(GLuint));
+
+    unsigned char *base = verts;
+    size_t num_unique = 0;
+
+    for(size_t i = 0; i < count; i++) {
+
+        const unsigned char *curr = base + i * vert_size;
+        size_t slot = mesh_hash(curr, vert_size) & (table_size - 1);
+
+        while(table[slot] != (GLuint)-1
+           && memcmp(base + table[slot] * vert_size, curr, vert_size)) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+
+        if(table[slot] == (GLuint)-1) {
+            /* Unique vertices are compacted towards the front. The slot 
+             * being written to has always been visited already. */
+            memmove(base + num_unique * vert_size, curr, vert_size);
+            table[slot] = num_unique++;
+        }
+        out_indices[i] = table[slot];
+    }
+
+    free(table);
+    return num_unique;
+}
+
+bool R_Mesh_OptimizeTriOrder(GLuint *indices, size_t num_indices, size_t num_verts)
+{
+    assert(num_indices % 3 == 0);
+    size_t num_tris = num_indices / 3;
+
+    struct opt_vert *verts = calloc(num_verts, sizeof(struct opt_vert));
+    GLuint *vert_tris = malloc(num_indices * sizeof(GLuint));
+    float *tri_scores = malloc(num_tris * sizeof(float));
+    bool *tri_added = calloc(num_tris, sizeof(bool));
+    GLuint *out = malloc(num_indices * sizeof(GLuint));
+
+    if(!verts || !vert_tris || !tri_scores || !tri_added || !out)
+        goto fail;
+
+    /* Build the vertex-triangle adjacency */
+    for(size_t i = 0; i < num_indices; i++) {
+        assert(indices[i] < num_verts);
+        verts[indices[i]].num_active_tris++;
+    }
+
+    size_t offset = 0;
+    for(size_t i = 0; i < num_verts; i++) {
+        verts[i].cache_pos = -1;
+        verts[i].tris_offset = offset;
+        offset += verts[i].num_active_tris;
+        verts[i].num_active_tris = 0;
+    }
+
+    for(size_t i = 0; i < num_indices; i++) {
+        struct opt_vert *vert = &verts[indices[i]];
+        vert_tris[vert->tris_offset + vert->num_active_tris++] = i / 3;
+    }
+
+    for(size_t i = 0; i < num_verts; i++)
+        verts[i].score = mesh_vert_score(&verts[i]);
+
+    for(size_t i = 0; i < num_tris; i++) {
+        tri_scores[i] = verts[indices[i*3 + 0]].score 
+                      + verts[indices[i*3 + 1]].score 
+                      + verts[indices[i*3 + 2]].score;
+    }
+
+    /* Holds the cache after the last emitted triangle, plus room for the 
+     * 3 vertices being pushed in */
+    GLuint cache[CACHE_SIZE + 3];
+    int cache_count = 0;
+
+    size_t scan_pos = 0;
+    ptrdiff_t best_tri = -1;
+
+    for(size_t num_out = 0; num_out < num_tris; num_out++) {
+
+        /* When none of the cached vertices have any remaining triangles, 
+         * fall back to the first triangle that hasn't been emitted */
+        if(best_tri < 0) {
+            while(tri_added[scan_pos])
+                scan_pos++;
+            best_tri = scan_pos;
+        }
+
+        const GLuint *tri = &indices[best_tri * 3];
+        memcpy(&out[num_out * 3], tri, 3 * sizeof(GLuint));
+        tri_added[best_tri] = true;
+
+        /* Remove the triangle from its' vertices' active lists */
+        for(int i = 0; i < 3; i++) {
+
+            struct opt_vert *vert = &verts[tri[i]];
+            GLuint *list = &vert_tris[vert->tris_offset];
+
+            for(int j = 0; j < vert->num_active_tris; j++) {
+                if(list[j] == best_tri) {
+                    list[j] = list[--vert->num_active_tris];
+                    break;
+                }
+            }
+        }
+
+        /* Move the triangle's vertices to the front of the LRU cache */
+        GLuint new_cache[CACHE_SIZE + 3];
+        int new_count = 0;
+
+        for(int i = 0; i < 3; i++)
+            new_cache[new_count++] = tri[i];
+
+        for(int i = 0; i < cache_count; i++) {
+            if(cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+                new_cache[new_count++] = cache[i];
+        }
+
+        /* Re-score all vertices that were or are in the cache, then the 
+         * triangles touching them. The best candidate for the next 
+         * triangle is among those. */
+        for(int i = 0; i < new_count; i++) {
+            struct opt_vert *vert = &verts[new_cache[i]];
+            vert->cache_pos = (i < CACHE_SIZE) ? i : -1;
+            vert->score = mesh_vert_score(vert);
+        }
+
+        best_tri = -1;
+        float best_score = -1.0f;
+
+        for(int i = 0; i < new_count; i++) {
+
+            struct opt_vert *vert = &verts[new_cache[i]];
+            const GLuint *list = &vert_tris[vert->tris_offset];
+
+            for(int j = 0; j < vert->num_active_tris; j++) {
+
+                GLuint t = list[j];
+                tri_scores[t] = verts[indices[t*3 + 0]].score 
+                              + verts[indices[t*3 + 1]].score 
+                              + verts[indices[t*3 + 2]].score;
+
+                if(tri_scores[t] > best_score) {
+                    best_score = tri_scores[t];
+                    best_tri = t;
+                }
+            }
+        }
+
+        cache_count = new_count < CACHE_SIZE ? new_count : CACHE_SIZE;
+        memcpy(cache, new_cache, cache_count * sizeof(GLuint));
+    }
+
+    memcpy(indices, out, num_indices * sizeof(GLuint));
+
+    free(out);
+    free(tri_added);
+    free(tri_scores);
+    free(vert_tris);
+    free(verts);
+    return true;
+
+fail:
+    free(out);
+    free(tri_added);
+    free(tri_scores);
+    free(vert_tris);
+    free(verts);
+    return false;
+}
+
+
+bool R_Mesh_BuildIndexed(enum vert_layout layout, const struct vertex *vbuff, size_t count,
+                         struct mesh_data *out)
+{
+    size_t vert_size = R_Vert_Size(layout);
+
+    void *packed = malloc(count * vert_size);
+    GLuint *indices = malloc(count * sizeof(GLuint));
+    if(!packed || !indices)
+        goto fail;
+
+    R_Vert_Pack(layout, vbuff, packed, count); 
+    size_t num_unique = R_Mesh_Weld(packed, vert_size, count, indices);
+    R_Mesh_OptimizeTriOrder(indices, count, num_unique);
+
+    if(num_unique <= UINT16_MAX) {
+
+        /* Narrow the indices in place */
+        GLushort *narrow = (GLushort*)indices;
+        for(size_t i = 0; i < count; i++)
+            narrow[i] = indices[i];
+        out->index_type = GL_UNSIGNED_SHORT;
+    }else{
+        out->index_type = GL_UNSIGNED_INT;
+    }
+
+    out->verts = packed;
+    out->num_verts = num_unique;
+    out->indices = indices;
+    out->num_indices = count;
+    return true;
+
+fail:
+    free(indices);
+    free(packed);
+    return false;
+}
+
+void R_Mesh_FreeData(struct mesh_data *data)
+{
+    free(data->verts);
+    free(data->indices);
+}
@@ -36,14 +36,69 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include "vertex.h"
 #include "../pf_math.h"
 
-struct vertex;
+#include <stddef.h>
+#include <stdbool.h>
 
 struct mesh{
-    unsigned       num_verts;
-    GLuint         VBO;
-    GLuint         VAO;
+    /* The number of vertices in 'VBO' */
+    unsigned         num_verts;
+    /* The format of the vertices in 'VBO' */
+    enum vert_layout layout;
+    GLuint           VBO;
+    GLuint           VAO;
+    /* The triangle list indices into 'VBO', or 0 if the vertices are drawn 
+     * in order. 'index_type' is GL_UNSIGNED_SHORT or GL_UNSIGNED_INT. */
+    GLuint           EBO;
+    unsigned         num_indices;
+    GLenum           index_type;
+    /* Per-instance model matrices for instanced draws, or 0 if the mesh 
+     * cannot be drawn instanced */
+    GLuint           instance_VBO;
+    /* Per-instance joint palette offsets for instanced draws of skinned 
+     * meshes, or 0 for other meshes */
+    GLuint           instance_palette_VBO;
 };
 
+/* The vertex and index buffer contents of a mesh, before they're uploaded */
+struct mesh_data{
+    /* 'num_verts' vertices in the mesh's layout */
+    void            *verts;
+    size_t           num_verts;
+    /* 'num_indices' indices of type 'index_type' */
+    void            *indices;
+    size_t           num_indices;
+    GLenum           index_type;
+};
+
+/* ---------------------------------------------------------------------------
+ * Merge byte-identical vertices. The unique vertices are moved to the front 
+ * of 'verts' and their count returned. 'out_indices' receives, for each of
+ * the 'count' input vertices, the index of its' unique copy.
+ * ---------------------------------------------------------------------------
+ */
+size_t R_Mesh_Weld(void *verts, size_t vert_size, size_t count, GLuint *out_indices);
+
+/* ---------------------------------------------------------------------------
+ * Reorder the triangles of the index buffer for better reuse of the GPU 
+ * post-transform vertex cache (Forsyth's linear-speed algorithm). The vertex
+ * order within each triangle is kept. Returns false, leaving the indices 
+ * untouched, if there is not enough memory.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_Mesh_OptimizeTriOrder(GLuint *indices, size_t num_indices, size_t num_verts);
+
+/* ---------------------------------------------------------------------------
+ * Pack the triangle list into the layout, weld it and build the index buffer,
+ * with the triangles in cache-friendly order. The indices are narrowed to 16
+ * bits when all the vertices can be addressed with them. On success, the 
+ * buffers of 'out' are owned by the caller and freed with 'R_Mesh_FreeData'.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_Mesh_BuildIndexed(enum vert_layout layout, const struct vertex *vbuff, size_t count,
+                           struct mesh_data *out);
+void   R_Mesh_FreeData(struct mesh_data *data);
+
 #endif
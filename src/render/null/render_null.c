@@ -0,0 +1,641 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+/* The renderer of the headless build ('make HEADLESS=1'), which makes no GL 
+ * calls and needs neither a window nor a context. Assets are still parsed by
+ * the shared loading code, so that they are cached and saved the same way, 
+ * but nothing is uploaded and all the drawing is dropped. Queries report 
+ * that everything is visible and that no GPU work was done.
+ */
+
+#include "../public/render.h"
+#include "../render_private.h"
+#include "../render_gl.h"
+#include "../texture.h"
+#include "../vertex.h"
+#include "../mesh.h"
+
+#include <string.h>
+#include <assert.h>
+
+
+#define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char *s_pass_names[] = {
+    [GPU_PASS_TERRAIN]  = "terrain",
+    [GPU_PASS_ENTITIES] = "entities",
+    [GPU_PASS_OVERLAYS] = "overlays",
+    [GPU_PASS_MINIMAP]  = "minimap",
+    [GPU_PASS_UI]       = "ui",
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void null_init_mesh(struct render_private *priv, const char *shader, 
+                           size_t num_verts, size_t num_indices)
+{
+    memset(&priv->mesh, 0, sizeof(priv->mesh));
+    priv->mesh.num_verts = num_verts;
+    priv->mesh.num_indices = num_indices;
+    priv->mesh.layout = R_Vert_LayoutForShader(shader);
+    priv->shader_prog = 0;
+    priv->instanced_shader_prog = 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_Init(const char *base_path)
+{
+    return true;
+}
+
+void R_Shutdown(void)
+{
+}
+
+/* There is no render thread, so the pushed work is done right away, as it 
+ * is when the GL renderer isn't pipelined */
+bool R_Thread_Start(SDL_Window *window, void *context)
+{
+    return false;
+}
+
+void R_Thread_Stop(void)
+{
+}
+
+void R_Thread_Claim(void)
+{
+}
+
+void R_Thread_BeginFrame(void)
+{
+}
+
+void R_Thread_SubmitFrame(void)
+{
+}
+
+bool R_Thread_Recording(void)
+{
+    return false;
+}
+
+void R_Thread_BeginImmediate(void)
+{
+}
+
+void R_Thread_EndImmediate(void)
+{
+}
+
+void R_Thread_Push(void (*func)(const void *arg), const void *arg, size_t size)
+{
+    func(arg);
+}
+
+void R_Queue_Begin(vec3_t view_pos)
+{
+}
+
+void R_Queue_Submit(enum render_pass pass, const void *render_private, const mat4x4_t *model)
+{
+}
+
+void R_Queue_Flush(void)
+{
+}
+
+void R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff)
+{
+    null_init_mesh(priv, shader, priv->mesh.num_verts, 0);
+}
+
+void R_GL_InitPacked(struct render_private *priv, const char *shader, const struct mesh_data *data)
+{
+    null_init_mesh(priv, shader, data->num_verts, data->num_indices);
+}
+
+void R_GL_Free(struct render_private *priv)
+{
+}
+
+/* The terrain vertices are only ever uploaded, so they are not built */
+void R_GL_TileBuildVerts(const struct tile *tiles, int width, int height, void *out)
+{
+}
+
+bool R_Texture_GetForName(const char *name, GLuint *out)
+{
+    *out = 0;
+    return true;
+}
+
+bool R_Texture_Load(const char *basedir, const char *name, GLuint *out)
+{
+    *out = 0;
+    return true;
+}
+
+void R_Texture_Free(const char *name)
+{
+}
+
+bool R_Texture_LoadPacked(const char *basedir, const char *name, struct texture *out)
+{
+    *out = (struct texture){0};
+    return true;
+}
+
+void R_Texture_FreePacked(const char *name)
+{
+}
+
+/* Without any draws, the materials have nowhere to be looked up from */
+bool R_GL_MaterialsAlloc(struct render_private *priv)
+{
+    return true;
+}
+
+void R_GL_MaterialsFree(struct render_private *priv)
+{
+}
+
+void R_GL_MaterialsUpdate(const struct render_private *priv)
+{
+}
+
+/* The vertices only ever existed in the GL buffers, so nothing is dumped */
+void R_AL_DumpPrivate(FILE *stream, void *priv_data)
+{
+}
+
+void R_GL_Draw(const void *render_private, mat4x4_t *model)
+{
+}
+
+void R_GL_DrawInstanced(const void *render_private, const mat4x4_t *models, size_t count)
+{
+}
+
+void R_GL_SetViewMatAndPos(const mat4x4_t *view, const vec3_t *pos)
+{
+}
+
+void R_GL_SetProj(const mat4x4_t *proj)
+{
+}
+
+void R_GL_BeginFrame(void)
+{
+}
+
+void R_GL_SetAnimPose(const mat4x4_t *from_skin_mats, const mat4x4_t *to_skin_mats, 
+                      float blend, size_t count)
+{
+}
+
+/* Baking fails, so that the clips are always posed on the CPU */
+int R_GL_AnimBake(const mat4x4_t *skin_mats, size_t count)
+{
+    return -1;
+}
+
+void R_GL_SetBakedAnimPose(int from, int to, float blend)
+{
+}
+
+void R_GL_SetAmbientLightColor(vec3_t color)
+{
+}
+
+void R_GL_SetLightEmitColor(vec3_t color)
+{
+}
+
+void R_GL_SetLightPos(vec3_t pos)
+{
+}
+
+void R_GL_DebugLine(vec3_t a, vec3_t b, vec4_t color, float width)
+{
+}
+
+void R_GL_DebugPoint(vec3_t pos, vec4_t color, float size)
+{
+}
+
+void R_GL_DebugArrow(vec3_t base, vec3_t tip, vec4_t color, float width)
+{
+}
+
+void R_GL_DebugFlush(void)
+{
+}
+
+void R_GL_DrawSkeleton(const struct entity *ent, const struct skeleton *skel, 
+                       const struct camera *cam)
+{
+}
+
+void R_GL_DrawOrigin(const void *render_private, mat4x4_t *model)
+{
+}
+
+void R_GL_DrawNormals(const void *render_private, mat4x4_t *model, bool anim)
+{
+}
+
+void R_GL_DrawRay(vec3_t origin, vec3_t dir, mat4x4_t *model, vec3_t color, float t)
+{
+}
+
+void R_GL_DrawOBB(const struct entity *ent)
+{
+}
+
+void R_GL_DrawBox2D(vec2_t screen_pos, vec2_t signed_size, vec3_t color, float width)
+{
+}
+
+void R_GL_DumpFramebuffer_PPM(const char *filename, int width, int height)
+{
+}
+
+void R_GL_DrawSelectionCircles(const vec2_t *xz, const float *radii, size_t count, 
+                               float width, vec3_t color)
+{
+}
+
+void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count, mat4x4_t *model, 
+                              const struct map *map)
+{
+}
+
+void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t count,
+                        mat4x4_t *model, const struct map *map)
+{
+}
+
+int R_GL_TileGetTriMesh(const struct tile_desc *in, const struct tile *tiles, 
+                        mat4x4_t *model, int tiles_per_chunk_x, vec3_t out[])
+{
+    return 0;
+}
+
+void R_GL_TileUpdate(void *chunk_rprivate, int r, int c, int tiles_width, int tiles_height, 
+                     const struct tile *tiles)
+{
+}
+
+void R_GL_TileUpdateRegion(void *chunk_rprivate, int r_min, int c_min, int r_max, int c_max,
+                           int tiles_width, int tiles_height, const struct tile *tiles)
+{
+}
+
+/* The chunks are never prebaked, which leaves them in the mode they're in */
+void *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
+                         int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
+                         int chunk_r, int chunk_c, void **out_lod)
+{
+    *out_lod = NULL;
+    return NULL;
+}
+
+void *R_GL_TileBakeBegin(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
+                         int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
+                         int chunk_r, int chunk_c, const char *cache_path)
+{
+    return NULL;
+}
+
+bool R_GL_TileBakeBuild(void *bake)
+{
+    return false;
+}
+
+void *R_GL_TileBakeFinish(void *bake, void **out_lod)
+{
+    *out_lod = NULL;
+    return NULL;
+}
+
+void R_GL_TileBakeFree(void *baked, void *lod, int chunk_r, int chunk_c)
+{
+}
+
+uint64_t R_GL_TileBakeKey(uint64_t seed, const void *chunk_rprivate_tiles, const struct tile *tiles,
+                          int tiles_per_chunk_x, int tiles_per_chunk_z, const mat4x4_t *model)
+{
+    return seed;
+}
+
+void *R_GL_TerrainBatchNew(void **chunk_rprivates, const struct tile **chunk_tiles, 
+                           const vec3_t *chunk_offsets, size_t chunks_wide, size_t num_chunks)
+{
+    return NULL;
+}
+
+bool R_GL_TerrainBatchUpdateChunk(void *batch, size_t idx, const void *chunk_rprivate)
+{
+    return false;
+}
+
+void R_GL_TerrainBatchDraw(void *batch, const size_t *chunk_indices, size_t count, 
+                           const mat4x4_t *model, bool splat, bool prepassed, bool heightfield)
+{
+}
+
+void R_GL_TerrainBatchDrawDepth(void *batch, const size_t *chunk_indices, size_t count, 
+                                const mat4x4_t *model, bool heightfield)
+{
+}
+
+void R_GL_TerrainBatchFree(void *batch)
+{
+}
+
+/* The minimap is 'baked' in full, so that no chunks are streamed in for it */
+bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats, 
+                      size_t chunk_x, size_t chunk_z,
+                      vec3_t map_center, vec2_t map_size,
+                      uint64_t key, const char *cache_path, bool *out_partial)
+{
+    *out_partial = false;
+    return true;
+}
+
+bool R_GL_MinimapStore(const char *cache_path)
+{
+    return false;
+}
+
+bool R_GL_MinimapUpdateChunks(void **chunk_rprivates, mat4x4_t *chunk_models, size_t count,
+                              vec3_t map_center, vec2_t map_size)
+{
+    return true;
+}
+
+void R_GL_MinimapRender(const struct map *map, const struct camera *cam, vec2_t center_pos)
+{
+}
+
+void R_GL_MinimapSetUnits(const struct map *map, const vec2_t *xz, const vec4_t *colors, size_t count)
+{
+}
+
+void R_GL_MinimapFree(void)
+{
+}
+
+void R_GL_OcclusionTest(const uint32_t *ids, const struct obb *obbs, size_t count,
+                        vec3_t view_pos, bool *out_visible)
+{
+    for(int i = 0; i < count; i++)
+        out_visible[i] = true;
+}
+
+void R_GL_OcclusionReset(void)
+{
+}
+
+void R_GL_OcclusionGetStats(struct occlusion_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+void R_GL_PickingBegin(vec2_t corner, vec2_t size)
+{
+}
+
+void R_GL_PickingSubmit(const void *render_private, const mat4x4_t *model, uint32_t id)
+{
+}
+
+void R_GL_PickingFlush(void)
+{
+}
+
+bool R_GL_PickingResult(struct pick_result *out)
+{
+    return false;
+}
+
+void R_GL_PickingReset(void)
+{
+}
+
+bool R_GL_GPUCullSupported(void)
+{
+    return false;
+}
+
+bool R_GL_GPUCullEligible(const void *render_private)
+{
+    return false;
+}
+
+bool R_GL_GPUCullAdd(uint32_t id, const void *render_private, const mat4x4_t *model, 
+                     const struct obb *obb)
+{
+    return false;
+}
+
+void R_GL_GPUCullRemove(uint32_t id)
+{
+}
+
+void R_GL_GPUCullClear(void)
+{
+}
+
+void R_GL_GPUCullDraw(float lod_bias, float impostor_size, bool occlusion)
+{
+}
+
+void R_GL_GPUCullGetStats(struct gpucull_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+void R_GL_SceneBegin(void)
+{
+}
+
+void R_GL_SceneEnd(void)
+{
+}
+
+void R_GL_SetRenderScale(float scale)
+{
+}
+
+void R_GL_SetDynamicResolution(float target_ms, float min_scale)
+{
+}
+
+void R_GL_GetRenderScaleStats(struct render_scale_stats *out)
+{
+    out->scale = 1.0f;
+    out->scene_ms = 0.0f;
+}
+
+void R_GL_FogEnable(int width, int height, vec2_t origin, vec2_t size)
+{
+}
+
+void R_GL_FogDisable(void)
+{
+}
+
+void R_GL_FogUpload(const unsigned char *texels, int width, int row_begin, int row_end)
+{
+}
+
+void R_GL_DrawOverlays(const struct overlay_bar *bars, size_t count)
+{
+}
+
+void R_GL_EffectEmit(enum effect_type type, const struct particle *particles, size_t count)
+{
+}
+
+void R_GL_EffectsDraw(void)
+{
+}
+
+struct impostor *R_GL_ImpostorCreate(const struct render_private *source, const struct aabb *bounds)
+{
+    return NULL;
+}
+
+void R_GL_ImpostorFree(struct impostor *imp)
+{
+}
+
+const void *R_GL_SelectLOD(const void *render_private, float screen_size, float impostor_size)
+{
+    return render_private;
+}
+
+void R_GL_PreskinEnable(bool on)
+{
+}
+
+void R_GL_PreskinFlush(void)
+{
+}
+
+void R_GL_ShadowsEnable(const struct aabb *bounds)
+{
+}
+
+void R_GL_ShadowsDisable(void)
+{
+}
+
+bool R_GL_ShadowLightFrustum(struct frustum *out)
+{
+    return false;
+}
+
+void R_GL_ShadowInvalidate(const struct aabb *region)
+{
+}
+
+bool R_GL_ShadowStaticDirty(void)
+{
+    return false;
+}
+
+void R_GL_ShadowDrawStatic(const struct shadow_caster *casters, size_t count)
+{
+}
+
+void R_GL_ShadowSubmit(const void *render_private, const mat4x4_t *model)
+{
+}
+
+void R_GL_ShadowFlush(void)
+{
+}
+
+void R_GL_SetPointLights(const struct point_light *lights, size_t count, 
+                         const struct camera *cam)
+{
+}
+
+void R_GL_DecalRing(vec2_t xz, float radius, float width, vec3_t color)
+{
+}
+
+void R_GL_DecalTiles(vec2_t xz, vec2_t half_extents, float width, vec3_t color)
+{
+}
+
+void R_GL_DecalsBegin(void)
+{
+}
+
+void R_GL_DecalsEnd(void)
+{
+}
+
+void R_GL_PassBegin(enum gpu_pass pass)
+{
+}
+
+void R_GL_PassEnd(enum gpu_pass pass)
+{
+}
+
+const char *R_GL_PassName(enum gpu_pass pass)
+{
+    assert(pass >= 0 && pass < ARR_SIZE(s_pass_names));
+    return s_pass_names[pass];
+}
+
+void R_GL_GetRenderStats(struct render_stats *out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
@@ -37,8 +37,10 @@
 #define RENDER_H
 
 #include "../../pf_math.h"
+#include "../../collision.h"
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 
@@ -51,12 +53,13 @@ struct tile;
 struct tile_desc;
 struct map;
 struct camera;
+struct obb;
 
 /* Each face is made of 2 independent triangles. The top face is an exception, and is made up of 4 
  * triangles. This is to give each triangle a vertex which lies at the center of the tile in the XZ
  * dimensions.
- * This center vertex will have its' own texture coordinate (used for blending edges between tiles).
- * As well, the center vertex can have its' own normal for potentially "smooth" corner and ramp tiles. 
+ * This center vertex will have its own texture coordinate (used for blending edges between tiles).
+ * As well, the center vertex can have its own normal for potentially "smooth" corner and ramp tiles. 
  */
 #define VERTS_PER_FACE 6
 #define VERTS_PER_TILE ((5 * VERTS_PER_FACE) + (4 * 3))
@@ -72,6 +75,113 @@ struct camera;
  */
 bool   R_Init(const char *base_path);
 
+/* ---------------------------------------------------------------------------
+ * Stops the threads started by 'R_Init'. Must be called while the GL context
+ * is still current.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Shutdown(void);
+
+
+/*###########################################################################*/
+/* RENDER THREAD                                                             */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Hands the GL context over to a new render thread. From then on, a frame is
+ * recorded on the main thread between 'R_Thread_BeginFrame' and 
+ * 'R_Thread_SubmitFrame', and drawn on the render thread while the main 
+ * thread goes on with the next simulation steps. The context is released 
+ * by the calling thread.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_Thread_Start(SDL_Window *window, void *context);
+
+/* ---------------------------------------------------------------------------
+ * Waits for the last frame to be drawn, then joins the render thread and 
+ * makes the context current on the calling thread again.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Thread_Stop(void);
+
+/* ---------------------------------------------------------------------------
+ * Waits for the frame in flight to be drawn and makes the context current on
+ * the main thread. Everything that touches GL objects or the render state 
+ * outside of the recorded commands must call this first. Returns right away
+ * when there is no render thread.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Thread_Claim(void);
+
+/* ---------------------------------------------------------------------------
+ * Marks the start and the end of recording a frame. Submitting hands the 
+ * frame over to the render thread, along with the GL context.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Thread_BeginFrame(void);
+void   R_Thread_SubmitFrame(void);
+
+/* ---------------------------------------------------------------------------
+ * Returns true if the calling thread is recording a frame, and the draws are 
+ * deferred to the render thread.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_Thread_Recording(void);
+
+/* ---------------------------------------------------------------------------
+ * Calls to 'R_Thread_Push' between these are executed right away, even while 
+ * a frame is being recorded. For rendering to textures which are needed 
+ * before the frame is drawn. May be nested.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Thread_BeginImmediate(void);
+void   R_Thread_EndImmediate(void);
+
+/* ---------------------------------------------------------------------------
+ * Adds a call to the frame being recorded. The 'size' bytes at 'arg' are 
+ * copied and passed to 'func' on the render thread. Anything else that 
+ * 'func' reads must not change until the frame is drawn. When not recording,
+ * 'func' is called right away.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Thread_Push(void (*func)(const void *arg), const void *arg, size_t size);
+
+
+/*###########################################################################*/
+/* RENDER QUEUE                                                              */
+/*###########################################################################*/
+
+enum render_pass{
+    /* Drawn first, sorted by state and then front-to-back */
+    RENDER_PASS_OPAQUE,
+    /* Drawn after all opaque objects, sorted back-to-front */
+    RENDER_PASS_TRANSLUCENT,
+    RENDER_PASS_COUNT
+};
+
+/* ---------------------------------------------------------------------------
+ * Discards any previous submissions. 'view_pos' is used for deriving the 
+ * depth of the submitted objects.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Queue_Begin(vec3_t view_pos);
+
+/* ---------------------------------------------------------------------------
+ * Queue up the object for drawing at the next 'R_Queue_Flush'. The object's
+ * render state must not change until then. Animated meshes are drawn in the 
+ * pose last set with 'R_GL_SetAnimPose'.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Queue_Submit(enum render_pass pass, const void *render_private, const mat4x4_t *model);
+
+/* ---------------------------------------------------------------------------
+ * Sorts the submissions by pass, shader, textures, VAO and depth, then draws
+ * them, skipping redundant state changes. Consecutive submissions of the same
+ * object are merged into a single instanced draw where supported.
+ * ---------------------------------------------------------------------------
+ */
+void   R_Queue_Flush(void);
+
 
 /*###########################################################################*/
 /* RENDER OPENGL                                                             */
@@ -84,6 +194,14 @@ bool   R_Init(const char *base_path);
  */
 void   R_GL_Draw(const void *render_private, mat4x4_t *model);
 
+/* ---------------------------------------------------------------------------
+ * Draws 'count' copies of the object, one per model matrix, with a single
+ * instanced draw call. Falls back to separate 'R_GL_Draw' calls for objects 
+ * whose shader has no instanced variant (ex. animated meshes).
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DrawInstanced(const void *render_private, const mat4x4_t *models, size_t count);
+
 /* ---------------------------------------------------------------------------
  * Sets the view matrix for all relevant shader programs. 
  * ---------------------------------------------------------------------------
@@ -97,11 +215,42 @@ void   R_GL_SetViewMatAndPos(const mat4x4_t *view, const vec3_t *pos);
 void   R_GL_SetProj(const mat4x4_t *proj);
 
 /* ---------------------------------------------------------------------------
- * Set OpenGL inverse bind pose and pose matrices uniforms for animation-related 
- * shader programs.
+ * Discards the poses set during the previous frame and starts counting the
+ * render statistics of the new one. Must be called once at the start of 
+ * every frame, before any animated meshes are drawn.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_BeginFrame(void);
+
+/* ---------------------------------------------------------------------------
+ * Appends the skinning matrices (pose * inverse bind pose) of the joints for 
+ * two samples to the frame's joint palette. Animated meshes that are drawn or
+ * submitted to the render queue after this call are skinned with a blend of 
+ * the two samples, up until the next call. A 'blend' of 0 gives the 'from' 
+ * sample and 1 the 'to' sample. If the palette is full, the meshes are drawn 
+ * in their bind pose instead.
+ *
+ * Samples set with the same pointer during a frame share a single copy in 
+ * the palette, so the matrices must not change until the frame ends.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_SetAnimPose(const mat4x4_t *from_skin_mats, const mat4x4_t *to_skin_mats, 
+                        float blend, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Copies the skinning matrices to the baked palette, which keeps them for the
+ * rest of the session. Returns their offset in it, or -1 if it is full.
+ * ---------------------------------------------------------------------------
+ */
+int    R_GL_AnimBake(const mat4x4_t *skin_mats, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Like 'R_GL_SetAnimPose', but for two samples already in the baked palette,
+ * given by the offsets returned from 'R_GL_AnimBake'. Nothing is copied, so 
+ * setting a baked pose costs the same however many entities are drawn in it.
  * ---------------------------------------------------------------------------
  */
-void   R_GL_SetAnimUniforms(mat4x4_t *inv_bind_poses, mat4x4_t *curr_poses, size_t count);
+void   R_GL_SetBakedAnimPose(int from, int to, float blend);
 
 /* ---------------------------------------------------------------------------
  * Set the global ambient color that will impact all models based on their 
@@ -125,13 +274,27 @@ void   R_GL_SetLightEmitColor(vec3_t color);
  */
 void   R_GL_SetLightPos(vec3_t pos);
 
+/* ---------------------------------------------------------------------------
+ * Debug primitives in worldspace. They are accumulated over the frame, by 
+ * type and width (or size), and drawn with a single call by 'R_GL_DebugFlush'.
+ * The skeleton, origin, ray, OBB, overlay quad and flow field views below are
+ * drawn the same way.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DebugLine(vec3_t a, vec3_t b, vec4_t color, float width);
+void   R_GL_DebugPoint(vec3_t pos, vec4_t color, float size);
+void   R_GL_DebugArrow(vec3_t base, vec3_t tip, vec4_t color, float width);
+
+/* ---------------------------------------------------------------------------
+ * Draws the debug primitives accumulated since the last call.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DebugFlush(void);
+
 /* ---------------------------------------------------------------------------
  * Render an entitiy's skeleton which is used for animation. 
  * The camera argument is for deriving the screenspace position of text labels
  * for the joint names. If 'cam' is NULL, the labels won't be rendered.
- *
- * NOTE: This is a low-performance routine that calls malloc/free at every call.
- * It should be used for debugging only.
  * ---------------------------------------------------------------------------
  */
 void   R_GL_DrawSkeleton(const struct entity *ent, const struct skeleton *skel, 
@@ -175,11 +338,13 @@ void   R_GL_DrawBox2D(vec2_t screen_pos, vec2_t signed_size, vec3_t color, float
 void   R_GL_DumpFramebuffer_PPM(const char *filename, int width, int height);
 
 /* ---------------------------------------------------------------------------
- * Render a selection circle over the map surface.
+ * Render a selection circle of the given radius at each of the 'xz' positions
+ * over the map surface. The circles are added as ring decals, so this must be 
+ * called before 'R_GL_DecalsBegin'.
  * ---------------------------------------------------------------------------
  */
-void   R_GL_DrawSelectionCircle(vec2_t xz, float radius, float width, vec3_t color, 
-                                const struct map *map);
+void   R_GL_DrawSelectionCircles(const vec2_t *xz, const float *radii, size_t count, 
+                                 float width, vec3_t color);
 
 /* ---------------------------------------------------------------------------
  * Render an array of translucent quads over the map surface. The quad corners are 
@@ -202,21 +367,16 @@ void   R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t co
 /* RENDER TILES                                                              */
 /*###########################################################################*/
 
-/* ---------------------------------------------------------------------------
- * Draws a colored outline around the tile specified by the descriptor.
- * ---------------------------------------------------------------------------
- */
-void   R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivate, mat4x4_t *model, 
-                             int tiles_per_chunk_x, int tiles_per_chunk_z);
-
 /* ---------------------------------------------------------------------------
  * Will output a trinagle mesh for a particular tile. The output will be an 
  * array of vertices in worldspace coordinates, with 3 consecutive vertices
  * defining a triangle. The return value is the number of vertices written,
- * it will be a multiple of 3.
+ * it will be a multiple of 3. The mesh is generated from the chunk's 'tiles'
+ * on the CPU, so this never touches the GL buffers and is safe to call for
+ * any number of tiles per frame.
  * ---------------------------------------------------------------------------
  */
-int    R_GL_TileGetTriMesh(const struct tile_desc *in, const void *chunk_rprivate, 
+int    R_GL_TileGetTriMesh(const struct tile_desc *in, const struct tile *tiles, 
                            mat4x4_t *model, int tiles_per_chunk_x, vec3_t out[]);
 
 /* ---------------------------------------------------------------------------
@@ -227,15 +387,127 @@ int    R_GL_TileGetTriMesh(const struct tile_desc *in, const void *chunk_rprivat
 void   R_GL_TileUpdate(void *chunk_rprivate, int r, int c, int tiles_width, int tiles_height, 
                        const struct tile *tiles);
 
+/* ---------------------------------------------------------------------------
+ * The same as 'R_GL_TileUpdate' for a rectangle of tiles, with inclusive 
+ * bounds. The chunk's vertex buffer is mapped once per row of tiles and is
+ * only ever written, so this should be preferred for updating many tiles 
+ * at a time.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TileUpdateRegion(void *chunk_rprivate, int r_min, int c_min, int r_max, int c_max,
+                             int tiles_width, int tiles_height, const struct tile *tiles);
+
 /* ---------------------------------------------------------------------------
  * Returns a new render context with a mesh that can be rendered much faster
  * than the original chunk mesh. It will use a single large texture for the 
  * top surface and have all non-visible tile faces removed.
+ *
+ * A second, coarser, context for drawing the chunk at a distance is written
+ * to 'out_lod'. It shares the baked texture and keeps the chunk's outermost 
+ * ring of tiles at full resolution so that it can be drawn next to chunks of
+ * either level without cracks. 'out_lod' is set to NULL if it could not be
+ * created.
  * ---------------------------------------------------------------------------
  */
 void  *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
                           int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
-                          int chunk_r, int chunk_c);
+                          int chunk_r, int chunk_c, void **out_lod);
+
+/* ---------------------------------------------------------------------------
+ * 'R_GL_TileBakeChunk', split up into steps so that the CPU-side mesh 
+ * building can be moved off of the main thread:
+ *
+ *  1. 'R_GL_TileBakeBegin' renders the top-down texture of the chunk and 
+ *     returns a bake context, or NULL on failure. Must be called from the 
+ *     main thread. 'tiles' must not change until the bake is finished.
+ *  2. 'R_GL_TileBakeBuild' builds the meshes on the CPU. It makes no GL 
+ *     calls and may be called from any thread, for different bakes at 
+ *     the same time.
+ *  3. 'R_GL_TileBakeFinish' uploads the meshes. It returns the same as 
+ *     'R_GL_TileBakeChunk' and must be called from the main thread, even
+ *     if the build step failed.
+ *
+ * The bake context and its' buffers are allocated from the frame arena, so
+ * all the steps must be done within the same frame.
+ *
+ * If 'cache_path' is not NULL, the baked texture is loaded from the file at
+ * that path when it was baked from the same inputs, and written to it 
+ * otherwise. Cached textures are stored in a compressed format.
+ * ---------------------------------------------------------------------------
+ */
+void  *R_GL_TileBakeBegin(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
+                          int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
+                          int chunk_r, int chunk_c, const char *cache_path);
+bool   R_GL_TileBakeBuild(void *bake);
+void  *R_GL_TileBakeFinish(void *bake, void **out_lod);
+
+/* ---------------------------------------------------------------------------
+ * Free the contexts returned by 'R_GL_TileBakeFinish' for the chunk, along
+ * with the baked texture. 'lod' may be NULL.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TileBakeFree(void *baked, void *lod, int chunk_r, int chunk_c);
+
+#define BAKE_CACHE_HASH_INIT (0xcbf29ce484222325ull)
+
+/* ---------------------------------------------------------------------------
+ * Mixes everything that goes into the baked texture of a chunk - the tiles,
+ * materials, placement, lighting and bake resolution - into the 'seed' hash.
+ * Used to tell when a cached texture is stale. The first seed of a key should
+ * be 'BAKE_CACHE_HASH_INIT'.
+ * ---------------------------------------------------------------------------
+ */
+uint64_t R_GL_TileBakeKey(uint64_t seed, const void *chunk_rprivate_tiles, const struct tile *tiles,
+                          int tiles_per_chunk_x, int tiles_per_chunk_z, const mat4x4_t *model);
+
+/* ---------------------------------------------------------------------------
+ * Creates a single vertex buffer holding the meshes of all the chunks, so 
+ * that any number of them can be drawn with one call. 'chunk_offsets' holds 
+ * the position of each chunk relative to the map. The textures of all the 
+ * chunks' materials are copied to a texture array, so they must all be of 
+ * the same size, and there can be no more than 16 distinct materials. 
+ * The chunks are in row-major order, 'chunks_wide' to a row. 'chunk_tiles' 
+ * are kept for building the splat layers and the heightfield, and must 
+ * outlive the batch. The vertex buffer is only filled in the first time the
+ * chunks are drawn other than from the heightfield. Returns NULL if the 
+ * chunks can't be batched.
+ * ---------------------------------------------------------------------------
+ */
+void  *R_GL_TerrainBatchNew(void **chunk_rprivates, const struct tile **chunk_tiles, 
+                            const vec3_t *chunk_offsets, size_t chunks_wide, size_t num_chunks);
+
+/* ---------------------------------------------------------------------------
+ * Copies the up-to-date mesh of the chunk at index 'idx' to the batch, and 
+ * rebuilds the splat layers its' tiles blend into and its' layer of the 
+ * heightfield. The chunk's materials must not have changed since the batch 
+ * was created.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_TerrainBatchUpdateChunk(void *batch, size_t idx, const void *chunk_rprivate);
+
+/* ---------------------------------------------------------------------------
+ * Draws the chunks at the given indices with a single call. 'model' places
+ * the map in the world. With 'splat' set, the blended tiles take their 
+ * chunk's 4 most common materials in the proportions precomputed in the
+ * chunk's splat layer, instead of sampling the materials of all the 
+ * adjacent tiles. With 'heightfield' set, the vertices are rebuilt by the
+ * vertex shader from a few texels per tile, over a grid of vertices shared
+ * by all the chunks, instead of being read from the copy of the meshes. 
+ * It looks the same, but skips the side faces hidden by neighbouring tiles.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TerrainBatchDraw(void *batch, const size_t *chunk_indices, size_t count, 
+                             const mat4x4_t *model, bool splat, bool prepassed, bool heightfield);
+
+/* ---------------------------------------------------------------------------
+ * Writes only the depth of the chunks at the given indices, with a single 
+ * call. Drawing them afterwards with 'prepassed' set shades each pixel just
+ * once, as only the fragments at the stored depth pass the test.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_TerrainBatchDrawDepth(void *batch, const size_t *chunk_indices, size_t count, 
+                                  const mat4x4_t *model, bool heightfield);
+void   R_GL_TerrainBatchFree(void *batch);
 
 
 /*###########################################################################*/
@@ -245,19 +517,37 @@ void  *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center,
 /* ---------------------------------------------------------------------------
  * Will create a texture and mesh for the map and store them in a local context
  * for rendering later.
+ *
+ * If 'cache_path' is not NULL, the texture is loaded from the file at that 
+ * path when it was baked with the same 'key', and written to it otherwise. 
+ * The key should be built from the chunks with 'R_GL_TileBakeKey'.
+ *
+ * Chunks without a mesh may be passed in as NULL. They are left out of the
+ * texture, which is then not written to the cache, and 'out_partial' is set.
+ * They can be drawn in afterwards with 'R_GL_MinimapUpdateChunks' and the 
+ * finished texture cached with 'R_GL_MinimapStore'. 
  * ---------------------------------------------------------------------------
  */
 bool  R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats, 
                        size_t chunk_x, size_t chunk_z,
-                       vec3_t map_center, vec2_t map_size);
+                       vec3_t map_center, vec2_t map_size,
+                       uint64_t key, const char *cache_path, bool *out_partial);
+
+/* ---------------------------------------------------------------------------
+ * Write the current minimap texture to the file at 'cache_path', under the
+ * key it was last baked with.
+ * ---------------------------------------------------------------------------
+ */
+bool  R_GL_MinimapStore(const char *cache_path);
 
 /* ---------------------------------------------------------------------------
- * Update a chunk-sized region of the minimap texture with up-to-date mesh 
- * data.
+ * Update the chunk-sized regions of the minimap texture with up-to-date mesh 
+ * data, in a single pass. Each chunk is only drawn within its own region, 
+ * so the rest of the texture is left as it was.
  * ---------------------------------------------------------------------------
  */
-bool  R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate, mat4x4_t *chunk_model, 
-                              vec3_t map_center, vec2_t map_size);
+bool  R_GL_MinimapUpdateChunks(void **chunk_rprivates, mat4x4_t *chunk_models, size_t count,
+                               vec3_t map_center, vec2_t map_size);
 
 /* ---------------------------------------------------------------------------
  * Render the minimap centered at the specified screenscape coordinate.
@@ -268,6 +558,15 @@ bool  R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate, mat4x
  */
 void  R_GL_MinimapRender(const struct map *map, const struct camera *cam, vec2_t center_pos);
 
+/* ---------------------------------------------------------------------------
+ * Replace the unit blips drawn over the minimap with points at the world XZ
+ * positions, in the matching colors. Later points are drawn over earlier 
+ * ones. The blips are kept in a single buffer and drawn with one call every
+ * frame, until they are replaced.
+ * ---------------------------------------------------------------------------
+ */
+void  R_GL_MinimapSetUnits(const struct map *map, const vec2_t *xz, const vec4_t *colors, size_t count);
+
 /* ---------------------------------------------------------------------------
  * Free the memory allocated by 'R_GL_MinimapBake'.
  * ---------------------------------------------------------------------------
@@ -275,23 +574,547 @@ void  R_GL_MinimapRender(const struct map *map, const struct camera *cam, vec2_t
 void  R_GL_MinimapFree(void);
 
 
+/*###########################################################################*/
+/* RENDER OCCLUSION                                                          */
+/*###########################################################################*/
+
+struct occlusion_stats{
+    /* Objects whose visibility was decided by a query result */
+    size_t tested;
+    /* Of those, the ones that were hidden */
+    size_t occluded;
+    /* New queries issued this frame */
+    size_t issued;
+    /* Objects with a query assigned to them */
+    size_t tracked;
+};
+
+/* ---------------------------------------------------------------------------
+ * Tests the bounding boxes of the objects against the current contents of 
+ * the depth buffer, using occlusion queries. 'ids' identify the objects
+ * between frames. The results become available with at least a frame of 
+ * latency, so 'out_visible' is set from the last completed query of each 
+ * object. Objects tested for the first time, and those whose box contains
+ * 'view_pos', are always visible. Should be called once per frame.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_OcclusionTest(const uint32_t *ids, const struct obb *obbs, size_t count,
+                          vec3_t view_pos, bool *out_visible);
+
+/* ---------------------------------------------------------------------------
+ * Forget the results of all the previous tests.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_OcclusionReset(void);
+
+/* ---------------------------------------------------------------------------
+ * The counts for the last call to 'R_GL_OcclusionTest'.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_OcclusionGetStats(struct occlusion_stats *out);
+
+
+/*###########################################################################*/
+/* RENDER PICKING                                                            */
+/*###########################################################################*/
+
+/* The value of the pixels that no object was drawn over */
+#define PICK_NONE   (~(uint32_t)0)
+
+struct pick_result{
+    /* The rectangle of the screen that was picked, in window coordinates */
+    vec2_t          corner;
+    vec2_t          size;
+    /* The IDs of the objects seen in the rectangle, 'width' by 'height' of
+     * them, from the top row down. Large rectangles are picked at a lower
+     * resolution than the screen's. */
+    int             width, height;
+    const uint32_t *ids;
+};
+
+/* ---------------------------------------------------------------------------
+ * Starts a picking pass over the 'size' pixels of the screen from 'corner'
+ * onwards. The objects submitted until 'R_GL_PickingFlush' are drawn with
+ * their IDs in place of their colors into a target the size of the
+ * rectangle, which is then read back without waiting on the GPU.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PickingBegin(vec2_t corner, vec2_t size);
+
+/* ---------------------------------------------------------------------------
+ * Adds the mesh to the picking pass, in the current animation pose. 'id'
+ * must not be 'PICK_NONE'.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PickingSubmit(const void *render_private, const mat4x4_t *model, uint32_t id);
+
+/* ---------------------------------------------------------------------------
+ * Draws the submitted objects and starts the read back of the IDs. Must be
+ * called while the camera's view is set.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PickingFlush(void);
+
+/* ---------------------------------------------------------------------------
+ * Fills in 'out' with the latest pick whose read back has completed, and
+ * returns false if there is none. The results come in a frame or more after
+ * the pass was drawn, and 'out->ids' stays valid until the next call.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_PickingResult(struct pick_result *out);
+
+/* ---------------------------------------------------------------------------
+ * Drop the picks in flight and the latest result.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PickingReset(void);
+
+
+/*###########################################################################*/
+/* RENDER GPU CULLING                                                        */
+/*###########################################################################*/
+
+struct gpucull_stats{
+    /* Instances kept in the GPU's buffers */
+    size_t instances;
+    /* Distinct meshes among them */
+    size_t groups;
+    /* Indirect draws issued for the last frame, one per level of detail of 
+     * every mesh */
+    size_t draws;
+};
+
+/* ---------------------------------------------------------------------------
+ * Whether the instances can be culled and drawn by the GPU, which takes an
+ * OpenGL 4.3 context for the compute shaders and indirect draws.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_GPUCullSupported(void);
+
+/* ---------------------------------------------------------------------------
+ * Whether the object can be drawn by 'R_GL_GPUCullDraw'. Only meshes with
+ * an instanced program and no skinning can be.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_GPUCullEligible(const void *render_private);
+
+/* ---------------------------------------------------------------------------
+ * Keeps the instance of the object with the model matrix and bounds in the
+ * GPU's buffers, to be drawn by every 'R_GL_GPUCullDraw' from then on. 'id'
+ * identifies the instance, and adding it again updates it in place. Only 
+ * the changed instances are uploaded with the next draw, so this is meant 
+ * for objects that rarely move.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_GPUCullAdd(uint32_t id, const void *render_private, const mat4x4_t *model, 
+                       const struct obb *obb);
+void   R_GL_GPUCullRemove(uint32_t id);
+
+/* ---------------------------------------------------------------------------
+ * Forget all the instances. Must be called before the objects that they are
+ * of are freed.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_GPUCullClear(void);
+
+/* ---------------------------------------------------------------------------
+ * Tests all the instances against the view frustum and the fog of war with
+ * a compute shader, and draws those which pass with one indirect draw for
+ * each level of detail of every mesh. The levels are picked the way that 
+ * 'R_GL_SelectLOD' does, from the share of the screen's height that the 
+ * instance covers times 'lod_bias'. With 'occlusion' set, the instances are
+ * also tested against a Hi-Z pyramid of the depth buffer's current contents.
+ * Costs the CPU nothing per instance.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_GPUCullDraw(float lod_bias, float impostor_size, bool occlusion);
+
+/* ---------------------------------------------------------------------------
+ * The counts for the last call to 'R_GL_GPUCullDraw'.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_GPUCullGetStats(struct gpucull_stats *out);
+
+
+/*###########################################################################*/
+/* RENDER PRE-SKINNING                                                       */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * With pre-skinning on, the animated meshes submitted to the render queue, 
+ * the shadows and the picking pass are skinned once per pose, up front, by
+ * 'R_GL_PreskinFlush'. The vertices are captured with transform feedback 
+ * and all the passes then draw them like static ones, so that the cost of
+ * the skinning doesn't grow with the number of passes. The entities sharing
+ * a mesh and a pose share the vertices too. In exchange, the skinned meshes
+ * are no longer drawn instanced.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PreskinEnable(bool on);
+
+/* ---------------------------------------------------------------------------
+ * Skins the meshes submitted since the last call. Must be called after the 
+ * animated meshes are submitted and before any of the passes they were
+ * submitted to are flushed.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PreskinFlush(void);
+
+
+/*###########################################################################*/
+/* RENDER SCALE                                                              */
+/*###########################################################################*/
+
+struct render_scale_stats{
+    /* Fraction of the window resolution that the scene was last drawn at */
+    float scale;
+    /* Running average of the GPU time taken to draw the scene */
+    float scene_ms;
+};
+
+/* ---------------------------------------------------------------------------
+ * Everything drawn between these is the 3D scene. Below a render scale of 
+ * 1, it is drawn to an offscreen framebuffer at the reduced resolution and 
+ * then stretched over the window, before the HUD and UI are drawn on top.
+ * The fog of war is applied to it on the way.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_SceneBegin(void);
+void   R_GL_SceneEnd(void);
+
+/* ---------------------------------------------------------------------------
+ * Draw the scene at a fixed fraction of the window resolution, between 0.25
+ * and 1. Turns off the dynamic resolution.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_SetRenderScale(float scale);
+
+/* ---------------------------------------------------------------------------
+ * Adjust the render scale, down to 'min_scale', to keep the GPU time of the
+ * scene within 'target_ms'. A target of 0 goes back to the fixed scale.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_SetDynamicResolution(float target_ms, float min_scale);
+void   R_GL_GetRenderScaleStats(struct render_scale_stats *out);
+
+/*###########################################################################*/
+/* RENDER FOG OF WAR                                                         */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Darken the scene by a 'width' by 'height' grid of brightness values (0 to
+ * 255) stretched over the map. 'origin' is the world XZ position of the 
+ * grid's first texel's corner and 'size' the world extent of the whole grid,
+ * negative along an axis that the columns or rows go down along. The grid 
+ * is undefined until its' rows are first uploaded. While the fog is on, the 
+ * scene is always drawn to an offscreen framebuffer.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_FogEnable(int width, int height, vec2_t origin, vec2_t size);
+void   R_GL_FogDisable(void);
+
+/* ---------------------------------------------------------------------------
+ * Copies the rows [row_begin, row_end) of the 'width'-wide grid 'texels' to 
+ * the fog texture. 
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_FogUpload(const unsigned char *texels, int width, int row_begin, int row_end);
+
+
+/*###########################################################################*/
+/* RENDER OVERLAYS                                                           */
+/*###########################################################################*/
+
+/* A bar drawn over a point in the world, such as a unit's health bar. The 
+ * part of the bar up to 'fill' (0 to 1) is drawn in 'fg_color' and the rest 
+ * in 'bg_color'. 'size' is in pixels, so the bar keeps the same size on 
+ * screen however far away the point is. */
+struct overlay_bar{
+    vec3_t pos;
+    float  fill;
+    vec4_t fg_color;
+    vec4_t bg_color;
+    vec2_t size;
+};
+
+/* ---------------------------------------------------------------------------
+ * Draws the bars over everything already drawn, in a single instanced draw.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DrawOverlays(const struct overlay_bar *bars, size_t count);
+
+
+/*###########################################################################*/
+/* RENDER EFFECTS                                                            */
+/*###########################################################################*/
+
+enum effect_type{
+    /* Ground-aligned arrows pointing along their velocity */
+    EFFECT_MOVE_MARKER,
+    /* Camera-facing glowing dots */
+    EFFECT_SPARKS,
+    EFFECT_COUNT
+};
+
+/* A particle is only described once, when it is emitted. Its position after 
+ * that is worked out on the GPU from its initial 'velocity' and a downward 
+ * acceleration of 'gravity'. It fades out over its 'lifetime' (in seconds), 
+ * while its size goes from 'size.x' to 'size.y' (in world units). */
+struct particle{
+    vec3_t pos;
+    float  lifetime;
+    vec3_t velocity;
+    float  gravity;
+    vec4_t color;
+    vec2_t size;
+};
+
+/* ---------------------------------------------------------------------------
+ * Adds particles to the effect's fixed-size buffer, taking the place of the 
+ * oldest particles when it is full.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_EffectEmit(enum effect_type type, const struct particle *particles, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Draws the live particles of every effect, blended over the scene, with a
+ * single instanced draw per effect.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_EffectsDraw(void);
+
+
+/*###########################################################################*/
+/* RENDER LEVEL OF DETAIL                                                    */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Returns the version of the mesh to draw when it takes up 'screen_size' of
+ * the screen's height: the coarsest of its' levels of detail that is meant
+ * for that size, or its' impostor billboard once the size falls below 
+ * 'impostor_size'. Returns 'render_private' itself for meshes without 
+ * coarser versions. The returned object is drawn like any other, with the 
+ * model matrix of the original.
+ * ---------------------------------------------------------------------------
+ */
+const void *R_GL_SelectLOD(const void *render_private, float screen_size, float impostor_size);
+
+
+/*###########################################################################*/
+/* RENDER SHADOWS                                                            */
+/*###########################################################################*/
+
+/* An object that casts a shadow, drawn with its own program and the 
+ * bind pose. 'bounds' is its box in world space. */
+struct shadow_caster{
+    const void *render_private;
+    mat4x4_t    model;
+    struct aabb bounds;
+};
+
+/* ---------------------------------------------------------------------------
+ * Shadows are cast from the light set with 'R_GL_SetLightPos' onto the scene,
+ * within the 'bounds' in world space. The light is treated as directional, 
+ * shining from its' position towards the middle of the bounds. The static 
+ * geometry is drawn to a cached shadow map, which is split up into tiles 
+ * that are only drawn again once invalidated. The moving objects are drawn
+ * every frame to a smaller layer of their own. While the shadows are on, the
+ * scene is always drawn to an offscreen framebuffer.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_ShadowsEnable(const struct aabb *bounds);
+void   R_GL_ShadowsDisable(void);
+
+/* ---------------------------------------------------------------------------
+ * The volume seen by the light, in world space. Everything within it casts 
+ * its' shadow onto the scene, whether or not it is seen by the camera. 
+ * Returns false while the shadows are off.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_ShadowLightFrustum(struct frustum *out);
+
+/* ---------------------------------------------------------------------------
+ * The static geometry within 'region' was added, removed or changed. The 
+ * tiles that it is drawn to are drawn again by the next call to 
+ * 'R_GL_ShadowDrawStatic'. A NULL region invalidates all of them.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_ShadowInvalidate(const struct aabb *region);
+
+/* ---------------------------------------------------------------------------
+ * Whether any tiles of the cached shadow map are to be drawn again.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_GL_ShadowStaticDirty(void);
+
+/* ---------------------------------------------------------------------------
+ * Draws the invalidated tiles of the cached shadow map again, from all the 
+ * static geometry. Only the casters overlapping the tiles are drawn.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_ShadowDrawStatic(const struct shadow_caster *casters, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Queue up a moving object to cast a shadow this frame, in the current pose.
+ * The queued objects are drawn to the shadow layer of the moving objects by
+ * 'R_GL_ShadowFlush', which must be called once every frame before the 
+ * scene ends.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_ShadowSubmit(const void *render_private, const mat4x4_t *model);
+void   R_GL_ShadowFlush(void);
+
+
+/*###########################################################################*/
+/* RENDER LIGHTS                                                             */
+/*###########################################################################*/
+
+/* A light shining equally in all directions, which fades out to nothing 
+ * at 'radius' from 'pos'. */
+struct point_light{
+    vec3_t pos;
+    float  radius;
+    vec3_t color;
+};
+
+/* ---------------------------------------------------------------------------
+ * Sets the point lights lighting the scene, in addition to the global light.
+ * The view frustum of 'cam' is split up into clusters, and each cluster gets
+ * the list of lights reaching it, so that the shaders only add up the lights
+ * near the fragment. At most SHADER_MAX_POINT_LIGHTS (64) of the lights in 
+ * view are kept, the closest ones to the camera. Must be called every frame, 
+ * after the camera has moved.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_SetPointLights(const struct point_light *lights, size_t count, 
+                           const struct camera *cam);
+
+
+/*###########################################################################*/
+/* RENDER DECALS                                                             */
+/*###########################################################################*/
+
+/* ---------------------------------------------------------------------------
+ * Add a shape to be drawn over the terrain in the next terrain pass. The 
+ * shapes are given in worldspace XZ and are composited by the terrain shaders
+ * onto the surfaces that face up, so they follow the terrain's height without
+ * any geometry of their own. A ring is drawn 'width' wide inside the circle 
+ * of 'radius' + 'width'. A rect of whole tiles gets each of its' tiles 
+ * outlined, 'width' wide inside the tile's edges. At most SHADER_MAX_DECALS (256) are drawn a frame, and the rest are 
+ * dropped.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DecalRing(vec2_t xz, float radius, float width, vec3_t color);
+void   R_GL_DecalTiles(vec2_t xz, vec2_t half_extents, float width, vec3_t color);
+
+/* ---------------------------------------------------------------------------
+ * Upload the decals added since the last call, and have them drawn by the 
+ * terrain until 'R_GL_DecalsEnd'. To be called around the terrain pass, so
+ * that the terrain rendered to textures is left without them.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_DecalsBegin(void);
+void   R_GL_DecalsEnd(void);
+
+
+/*###########################################################################*/
+/* RENDER STATISTICS                                                         */
+/*###########################################################################*/
+
+enum gpu_pass{
+    GPU_PASS_TERRAIN,
+    GPU_PASS_ENTITIES,
+    GPU_PASS_OVERLAYS,
+    GPU_PASS_MINIMAP,
+    GPU_PASS_UI,
+    GPU_PASS_COUNT
+};
+
+struct render_stats{
+    /* Running averages of the GPU time taken by each of the passes */
+    float  pass_ms[GPU_PASS_COUNT];
+    /* The GL work done for the last frame that was drawn */
+    size_t draw_calls;
+    size_t vertices;
+    size_t program_binds;
+    size_t texture_binds;
+};
+
+/* ---------------------------------------------------------------------------
+ * Everything drawn between these is timed on the GPU as part of the pass. A
+ * pass may be entered more than once in a frame, and the times are added up,
+ * but it may not be entered again before it is left. The results are read 
+ * back a few frames later, so that the queries never stall the pipeline.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PassBegin(enum gpu_pass pass);
+void   R_GL_PassEnd(enum gpu_pass pass);
+
+/* ---------------------------------------------------------------------------
+ * Returns a short lowercase name for the pass.
+ * ---------------------------------------------------------------------------
+ */
+const char *R_GL_PassName(enum gpu_pass pass);
+
+/* ---------------------------------------------------------------------------
+ * The pass times and the draw counts. The counts lag behind by a frame. 
+ * Must be called from the main thread.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_GetRenderStats(struct render_stats *out);
+
+
 /*###########################################################################*/
 /* RENDER ASSET LOADING                                                      */
 /*###########################################################################*/
 
 /* ---------------------------------------------------------------------------
  * Consumes lines of the stream and uses them to populate a new private context
- * for the model. The context is returned in a malloc'd buffer.
+ * for the model. The context is returned in a malloc'd buffer. The stream 
+ * must be a text stream (see 'AL_OpenText').
  * ---------------------------------------------------------------------------
  */
 void  *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header, SDL_RWops *stream);
 
+/* ---------------------------------------------------------------------------
+ * Consumes the same lines as 'R_AL_PrivFromStream' and writes them to 'out'
+ * as the render section of a binary PFOBJ: the vertices already packed and 
+ * indexed, followed by the material descriptors. 
+ * ---------------------------------------------------------------------------
+ */
+bool   R_AL_WriteBinary(const struct pfobj_hdr *header, SDL_RWops *in, SDL_RWops *out);
+
+/* ---------------------------------------------------------------------------
+ * Creates the private context from a render section written by 
+ * 'R_AL_WriteBinary'. The vertex and index buffers are uploaded straight 
+ * from 'data', which only needs to stay valid for the duration of the call.
+ * ---------------------------------------------------------------------------
+ */
+void  *R_AL_PrivFromBinary(const char *base_path, const struct pfobj_hdr *header, 
+                           const void *data, size_t size);
+
 /* ---------------------------------------------------------------------------
  * Dumps private render data in PF Object format.
  * ---------------------------------------------------------------------------
  */
 void   R_AL_DumpPrivate(FILE *stream, void *priv_data);
 
+/* ---------------------------------------------------------------------------
+ * Free the private data returned by 'R_AL_PrivFromStream' or 
+ * 'R_AL_PrivFromBinary', along with its' GL objects and texture references.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_FreePrivate(void *priv_data);
+
+/* ---------------------------------------------------------------------------
+ * Move the mesh and materials of 'src_priv' into 'dst_priv', in place, so 
+ * that everything sharing 'dst_priv' is drawn with them from now on. The old
+ * contents are freed, along with 'src_priv'. Fails (still freeing 'src_priv')
+ * when the number of materials or the vertex layout differ.
+ * ---------------------------------------------------------------------------
+ */
+bool   R_AL_ReplacePrivate(void *dst_priv, void *src_priv);
+
 /* ---------------------------------------------------------------------------
  * Gives size (in bytes) of buffer size required for the render private 
  * buffer for a renderable PFChunk.
@@ -300,17 +1123,55 @@ void   R_AL_DumpPrivate(FILE *stream, void *priv_data);
 size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t num_mats);
 
 /* ---------------------------------------------------------------------------
- * Initialize private render buff for a PFChunk of the map. 
+ * Initialize private render buff for a PFChunk of the map, in steps, so that
+ * the work of many chunks can be spread over the pool threads:
  *
- * This function will build the vertices and their vertices from the data
- * already parsed into the 'tiles'.
- * 
- * Material data is read from a separate stream.
+ *  1. 'R_AL_ChunkMatsFromStream' parses the chunk's materials from a PFMAP 
+ *     material section stream into 'out', which must hold 'R_AL_ChunkMatsSize'
+ *     bytes. The result can be saved and loaded as it is.
+ *  2. 'R_AL_ChunkVertsFromTiles' builds the vertices of the tiles, with the 
+ *     blending information patched in, into 'out', which must hold 
+ *     'R_AL_ChunkVertsSize' bytes. It makes no GL calls.
+ *  3. 'R_AL_InitPrivFromChunk' loads the textures and uploads the vertices.
+ *     It must be called from the main thread. The inputs are only read from.
+ *     When 'verts' is NULL, the chunk is left without a mesh until one is
+ *     uploaded with 'R_AL_InitChunkMesh'.
+ * ---------------------------------------------------------------------------
+ */
+size_t R_AL_ChunkMatsSize(size_t num_mats);
+bool   R_AL_ChunkMatsFromStream(SDL_RWops *mats_stream, size_t num_mats, void *out);
+size_t R_AL_ChunkVertsSize(size_t tiles_width, size_t tiles_height);
+void   R_AL_ChunkVertsFromTiles(const struct tile *tiles, size_t width, size_t height, void *out);
+bool   R_AL_InitPrivFromChunk(const void *mats, size_t num_mats, const void *verts,
+                              size_t width, size_t height, void *priv_buff, const char *basedir);
+
+/* ---------------------------------------------------------------------------
+ * Upload the mesh of an initialized PFChunk from the vertices built by 
+ * 'R_AL_ChunkVertsFromTiles', or free it again. The materials are left as 
+ * they are. This lets the GPU buffers of large maps be created only for the 
+ * chunks that are currently needed. Must be called from the main thread.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_InitChunkMesh(void *priv_buff, const void *verts, size_t width, size_t height);
+void   R_AL_FreeChunkMesh(void *priv_buff);
+
+/* ---------------------------------------------------------------------------
+ * Release the textures and the mesh of a PFChunk initialized with
+ * 'R_AL_InitPrivFromChunk'. The buffer itself stays with the caller.
+ * ---------------------------------------------------------------------------
+ */
+void   R_AL_FreeChunkPriv(void *priv_buff);
+
+/* ---------------------------------------------------------------------------
+ * The reverse of 'R_AL_ChunkMatsFromStream', for saving the map: 
+ * 'R_AL_ChunkMatsFromPriv' copies the current materials of an initialized 
+ * PFChunk into 'out' ('R_AL_ChunkMatsSize' bytes), and 'R_AL_ChunkMatsToText'
+ * formats them as a PFMAP material section. Like 'snprintf', the latter 
+ * returns the full length of the text, even when 'out' is too small for it.
  * ---------------------------------------------------------------------------
  */
-bool   R_AL_InitPrivFromTilesAndMats(SDL_RWops *mats_stream, size_t num_mats, 
-                                     const struct tile *tiles, size_t width, size_t height,
-                                     void *priv_buff, const char *basedir);
+void   R_AL_ChunkMatsFromPriv(const void *priv_buff, size_t num_mats, void *out);
+size_t R_AL_ChunkMatsToText(const void *mats, size_t num_mats, char *out, size_t size);
 
 /* ---------------------------------------------------------------------------
  * Update material data for a particular renderable object, parsed from a 
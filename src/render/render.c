@@ -34,6 +34,7 @@
  */
 
 #include "public/render.h"
+#include "render_gl.h"
 #include "shader.h"
 #include "texture.h"
 
@@ -46,8 +47,63 @@ bool R_Init(const char *base_path)
     R_Texture_Init();
 
     if(!R_Shader_InitAll(base_path))
-        return false;
+        goto fail;
+
+    R_GL_GlobalsInit();
+    R_GL_AnimPaletteInit();
+
+    if(!R_GL_OcclusionInit())
+        goto fail;
+
+    if(!R_GL_PickingInit())
+        goto fail;
+
+    if(!R_GL_StreamInit())
+        goto fail;
+
+    if(!R_GL_SceneInit())
+        goto fail;
+
+    if(!R_GL_FogInit())
+        goto fail;
+
+    if(!R_GL_OverlayInit())
+        goto fail;
+
+    if(!R_GL_EffectsInit())
+        goto fail;
+
+    if(!R_GL_ShadowInit())
+        goto fail;
+
+    if(!R_GL_StatsInit())
+        goto fail;
+
+    if(!R_GL_LightsInit())
+        goto fail;
+
+    if(!R_GL_DecalsInit())
+        goto fail;
+
+    if(!R_GL_MaterialsInit())
+        goto fail;
+
+    if(!R_GL_GPUCullInit())
+        goto fail;
+
+    if(!R_GL_PreskinInit())
+        goto fail;
 
     return true;
+
+fail:
+    R_Texture_Shutdown();
+    return false;
+}
+
+void R_Shutdown(void)
+{
+    R_Queue_Shutdown();
+    R_Texture_Shutdown();
 }
 
@@ -38,12 +38,16 @@
 #include "vertex.h"
 #include "material.h"
 #include "render_gl.h"
+#include "mesh.h"
 
 #include "../asset_load.h"
+#include "../mem.h"
 #include "../map/public/tile.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <math.h>
+#include <stdint.h>
 #define __USE_POSIX
 #include <string.h>
 
@@ -51,6 +55,42 @@
 #define STR(a) #a
 
 #define ARR_SIZE(a) (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)   ((a) > (b) ? (a) : (b))
+
+/* The render section of a binary PFOBJ starts with this header, followed by
+ * the levels of detail and the materials. The offsets of the vertex and index 
+ * data are relative to the start of the section and aligned to 
+ * BIN_SECTION_ALIGN. */
+struct bin_render_hdr{
+    uint32_t    layout;
+    uint32_t    num_materials;
+    uint32_t    num_verts;
+    uint32_t    num_indices;
+    uint32_t    index_type;
+    uint32_t    num_lods;
+    uint64_t    verts_offset;
+    uint64_t    indices_offset;
+    /* The bounds of the vertices, which the impostor is fitted to */
+    struct aabb bounds;
+};
+
+struct bin_lod{
+    float    screen_size;
+    uint32_t num_verts;
+    uint32_t num_indices;
+    uint32_t index_type;
+    uint64_t verts_offset;
+    uint64_t indices_offset;
+};
+
+struct bin_material{
+    GLfloat ambient_intensity;
+    vec3_t  diffuse_clr;
+    vec3_t  specular_clr;
+    char    name[sizeof(((struct material*)0)->name)];
+    char    texname[sizeof(((struct material*)0)->texname)];
+};
 
 
 /*****************************************************************************/
@@ -59,69 +99,112 @@
 
 static bool al_read_vertex(SDL_RWops *stream, struct vertex *out)
 {
-    char line[MAX_LINE_LEN];
+    char *line;
+    const char *curr;
 
-    READ_LINE(stream, line, fail); 
-    if(!sscanf(line, "v %f %f %f", &out->pos.x, &out->pos.y, &out->pos.z))
+    READ_LINE_VIEW(stream, line, fail); 
+    curr = line;
+    if(!AL_ParseTag(&curr, "v") || !AL_ParseFloats(&curr, 3, ' ', out->pos.raw))
         goto fail;
 
-    READ_LINE(stream, line, fail); 
-    if(!sscanf(line, "vt %f %f", &out->uv.x, &out->uv.y))
+    READ_LINE_VIEW(stream, line, fail); 
+    curr = line;
+    if(!AL_ParseTag(&curr, "vt") || !AL_ParseFloats(&curr, 2, ' ', out->uv.raw))
         goto fail;
 
-    READ_LINE(stream, line, fail); 
-    if(!sscanf(line, "vn %f %f %f", &out->normal.x, &out->normal.y, &out->normal.z))
+    READ_LINE_VIEW(stream, line, fail); 
+    curr = line;
+    if(!AL_ParseTag(&curr, "vn") || !AL_ParseFloats(&curr, 3, ' ', out->normal.raw))
         goto fail;
 
-    READ_LINE(stream, line, fail);
-    if(!strstr(line, "vw"))
+    READ_LINE_VIEW(stream, line, fail);
+    curr = line;
+    if(!AL_ParseTag(&curr, "vw"))
         goto fail;
 
-    char *string = line;
-    char *saveptr;
-    int i;
-
     /* Write 0.0 weights by default */
     memset(out->weights, 0, sizeof(out->weights));
     memset(out->joint_indices, 0, sizeof(out->joint_indices));
 
-    /* Consume the first token, the attribute name 'vw' */
-    string = strtok_r(line, " \t", &saveptr);
-    for(i = 0; i < 6; i++) {
+    /* Each weight is a '<joint index>/<weight>' pair. The vertices of static 
+     * meshes have none. */
+    for(int i = 0; i < 6; i++) {
 
-        string = strtok_r(NULL, " \t", &saveptr);
-        if(!string)
+        if(!AL_ParseInt(&curr, &out->joint_indices[i]))
             break;
-
-        if(!sscanf(string, "%d/%f", &out->joint_indices[i], &out->weights[i]))
+        if(*curr++ != '/' || !AL_ParseFloat(&curr, &out->weights[i]))
             goto fail;
     }
 
-    if(i == 0)
+    READ_LINE_VIEW(stream, line, fail); 
+    curr = line;
+    if(!AL_ParseTag(&curr, "vm") || !AL_ParseInt(&curr, &out->material_idx))
         goto fail;
 
-    READ_LINE(stream, line, fail); 
-    if(!sscanf(line, "vm %d", &out->material_idx))
-        goto fail;
+    return true;
 
+fail:
+    return false;
+}
+
+static bool al_read_verts(SDL_RWops *stream, size_t count, struct vertex *out)
+{
+    for(size_t i = 0; i < count; i++) {
+        if(!al_read_vertex(stream, &out[i]))
+            return false;
+    }
     return true;
+}
+
+/* Every level starts with a line holding its' screen size and the number of
+ * vertices that follow */
+static bool al_read_lod_header(SDL_RWops *stream, float *out_size, unsigned *out_verts)
+{
+    char line[MAX_LINE_LEN];
+
+    READ_LINE(stream, line, fail);
+    if(2 != sscanf(line, "lod %f %d", out_size, out_verts))
+        goto fail;
+    return (*out_size > 0.0f && *out_verts > 0);
 
 fail:
     return false;
 }
 
-static bool al_read_material(SDL_RWops *stream, const char *basedir, struct material *out)
+static void al_bounds(const struct vertex *vbuff, size_t count, struct aabb *out)
+{
+    *out = (struct aabb){
+        .x_min = INFINITY, .x_max = -INFINITY,
+        .y_min = INFINITY, .y_max = -INFINITY,
+        .z_min = INFINITY, .z_max = -INFINITY,
+    };
+
+    for(size_t i = 0; i < count; i++) {
+        vec3_t pos = vbuff[i].pos;
+        out->x_min = MIN(out->x_min, pos.x); out->x_max = MAX(out->x_max, pos.x);
+        out->y_min = MIN(out->y_min, pos.y); out->y_max = MAX(out->y_max, pos.y);
+        out->z_min = MIN(out->z_min, pos.z); out->z_max = MAX(out->z_max, pos.z);
+    }
+}
+
+static bool al_parse_material(SDL_RWops *stream, struct material *out)
 {
     char line[MAX_LINE_LEN];
 
-    /* Consume the first line with the name - we don't use it currently */
+    /* The name is only kept so that the material can be written out again */
     READ_LINE(stream, line, fail);
 
     char *saveptr;
     char *mat_name = strtok_r(line, " \t\n", &saveptr);
     mat_name = strtok_r(NULL, " \t\n", &saveptr);
-    if(0 == strcmp(mat_name, "__none__"))
+    if(!mat_name)
+        goto fail;
+    snprintf(out->name, sizeof(out->name), "%s", mat_name);
+
+    if(0 == strcmp(mat_name, "__none__")) {
+        out->texname[0] = '\0';
         return true;
+    }
 
     READ_LINE(stream, line, fail);
     if(!sscanf(line, " ambient %f", &out->ambient_intensity))
@@ -139,36 +222,113 @@ static bool al_read_material(SDL_RWops *stream, const char *basedir, struct mate
     if(!sscanf(line, " texture %" STREVAL(sizeof(out->texname)) "s",  out->texname))
         goto fail;
     out->texname[sizeof(out->texname)-1] = '\0';
-
-    if(!R_Texture_GetForName(out->texname, &out->texture.id)
-    && !R_Texture_Load(basedir, out->texname, &out->texture.id))
-        goto fail;
-
     return true;
 
 fail:
     return false;
 }
 
-void al_patch_vbuff_adjacency_info(GLuint VBO, const struct tile *tiles, size_t width, size_t height)
+static bool al_load_texture(const char *basedir, struct material *out)
 {
-    for(int r = 0; r < height; r++) {
-        for(int c = 0; c < width; c++) {
-            R_GL_TilePatchVertsBlend(VBO, tiles, width, height, r, c);
-        }
+    out->texture.packed = false;
+    out->texture.layer = 0;
+    if(!out->texname[0])
+        return true;
+
+    return R_Texture_GetForName(out->texname, &out->texture.id)
+        || R_Texture_Load(basedir, out->texname, &out->texture.id);
+}
+
+/* The textures of the models are packed into arrays shared between them */
+static bool al_load_packed_texture(const char *basedir, struct material *out)
+{
+    out->texture.id = 0;
+    out->texture.packed = false;
+    out->texture.layer = 0;
+    if(!out->texname[0])
+        return true;
+
+    return R_Texture_LoadPacked(basedir, out->texname, &out->texture);
+}
+
+static void al_free_textures(const struct material *mats, size_t count)
+{
+    for(int i = 0; i < count; i++) {
+
+        if(mats[i].texture.packed)
+            R_Texture_FreePacked(mats[i].texname);
+        else if(mats[i].texname[0])
+            R_Texture_Free(mats[i].texname);
+    }
+}
+
+static bool al_read_material(SDL_RWops *stream, const char *basedir, struct material *out)
+{
+    return al_parse_material(stream, out)
+        && al_load_texture(basedir, out);
+}
+
+static const char *al_shader_for_header(const struct pfobj_hdr *header)
+{
+    return (header->num_as > 0) ? "mesh.animated.textured-phong" 
+                                : "mesh.static.textured-phong";
+}
+
+static size_t al_index_size(GLenum index_type)
+{
+    switch(index_type) {
+    case GL_UNSIGNED_SHORT: return sizeof(GLushort);
+    case GL_UNSIGNED_INT:   return sizeof(GLuint);
+    default:                return 0;
     }
 }
 
-size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
+static size_t al_priv_buffsize(size_t num_materials, size_t num_lods)
 {
     size_t ret = 0;
 
     ret += sizeof(struct render_private);
-    ret += header->num_materials * sizeof(struct material);
+    ret += num_lods * sizeof(struct render_lod);
+    ret += num_materials * sizeof(struct material);
 
     return ret;
 }
 
+/* The levels are added to the private data one by one, as they're uploaded */
+static void al_priv_init(struct render_private *priv, size_t num_materials, size_t max_lods)
+{
+    priv->lods = (void*)(priv + 1);
+    priv->num_lods = 0;
+    priv->materials = (void*)(priv->lods + max_lods);
+    priv->num_materials = num_materials;
+    priv->material_base = -1;
+    priv->impostor = NULL;
+}
+
+static struct render_private *al_priv_add_lod(struct render_private *priv, float screen_size)
+{
+    struct render_lod *lod = &priv->lods[priv->num_lods++];
+    lod->screen_size = screen_size;
+    lod->priv = (struct render_private){
+        .num_materials = priv->num_materials,
+        .materials     = priv->materials,
+        .material_base = priv->material_base,
+    };
+    return &lod->priv;
+}
+
+static bool al_bin_mesh_valid(enum vert_layout layout, size_t size, size_t tables_end, 
+                              uint32_t num_verts, uint32_t num_indices, uint32_t index_type, 
+                              uint64_t verts_offset, uint64_t indices_offset)
+{
+    size_t index_size = al_index_size(index_type);
+    return (index_size != 0)
+        && (verts_offset >= tables_end)
+        && (indices_offset <= size)
+        && (verts_offset + (uint64_t)num_verts * R_Vert_Size(layout) <= indices_offset)
+        && (indices_offset + (uint64_t)num_indices * index_size <= size);
+}
+
 
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
@@ -180,6 +340,8 @@ size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
  *  +---------------------------------+ <-- base
  *  | struct render_private[1]        |
  *  +---------------------------------+
+ *  | struct render_lod[num_lods]     |
+ *  +---------------------------------+
  *  | struct material[num_materials]  |
  *  +---------------------------------+
  *
@@ -187,7 +349,9 @@ size_t al_priv_buffsize_from_header(const struct pfobj_hdr *header)
 
 void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header, SDL_RWops *stream)
 {
-    struct render_private *priv = malloc(al_priv_buffsize_from_header(header));
+    const char *shader = al_shader_for_header(header);
+    struct render_private *priv = MEM_Malloc(MEM_TAG_RENDER, 
+        al_priv_buffsize(header->num_materials, header->num_lods));
     if(!priv)
         goto fail_alloc_priv;
 
@@ -197,43 +361,392 @@ void *R_AL_PrivFromStream(const char *base_path, const struct pfobj_hdr *header,
         goto fail_alloc_vbuff;
 
     priv->mesh.num_verts = header->num_verts;
-    priv->num_materials = header->num_materials;
-    priv->materials = (void*)(priv + 1);
+    al_priv_init(priv, header->num_materials, header->num_lods);
 
-    for(int i = 0; i < header->num_verts; i++) {
-        if(!al_read_vertex(stream, &vbuff[i]))
-            goto fail_parse;
-    }
+    if(!al_read_verts(stream, header->num_verts, vbuff))
+        goto fail_parse;
 
     for(int i = 0; i < header->num_materials; i++) {
 
         priv->materials[i].texture.tunit = GL_TEXTURE0 + i;
-        if(!al_read_material(stream, base_path, &priv->materials[i])) 
+        if(!al_parse_material(stream, &priv->materials[i])
+        || !al_load_packed_texture(base_path, &priv->materials[i])) {
+            al_free_textures(priv->materials, i);
             goto fail_parse;
+        }
     }
 
-    R_GL_Init(priv, (header->num_as > 0) ? "mesh.animated.textured-phong" : "mesh.static.textured-phong", vbuff);
+    struct aabb bounds;
+    al_bounds(vbuff, header->num_verts, &bounds);
+    R_GL_Init(priv, shader, vbuff);
     free(vbuff);
+
+    /* From here on, everything that was set up is freed along with 'priv' */
+    if(!R_GL_MaterialsAlloc(priv))
+        goto fail_lods;
+
+    for(int i = 0; i < header->num_lods; i++) {
+
+        float screen_size;
+        unsigned num_verts;
+        if(!al_read_lod_header(stream, &screen_size, &num_verts))
+            goto fail_lods;
+
+        struct vertex *lod_vbuff = malloc(num_verts * sizeof(struct vertex));
+        if(!lod_vbuff || !al_read_verts(stream, num_verts, lod_vbuff)) {
+            free(lod_vbuff);
+            goto fail_lods;
+        }
+
+        struct render_private *lod = al_priv_add_lod(priv, screen_size);
+        lod->mesh.num_verts = num_verts;
+        R_GL_Init(lod, shader, lod_vbuff);
+        free(lod_vbuff);
+    }
+
+    if(priv->mesh.layout == VERT_LAYOUT_STATIC)
+        priv->impostor = R_GL_ImpostorCreate(priv, &bounds);
     return priv;
 
+fail_lods:
+    R_AL_FreePrivate(priv);
+    return NULL;
 fail_parse:
     free(vbuff);
 fail_alloc_vbuff:
-    free(priv);
+    MEM_Free(priv);
 fail_alloc_priv:
     return NULL;
 }
 
+/*
+ * Binary render section layout:
+ *
+ *  +---------------------------------+ <-- base (aligned)
+ *  | struct bin_render_hdr[1]        |
+ *  +---------------------------------+
+ *  | struct bin_lod[num_lods]        |
+ *  +---------------------------------+
+ *  | struct bin_material             |
+ *  |    [num_materials]              |
+ *  +---------------------------------+ <-- base + verts_offset (aligned)
+ *  | packed vertices[num_verts]      |
+ *  +---------------------------------+ <-- base + indices_offset (aligned)
+ *  | indices[num_indices]            |
+ *  +---------------------------------+ <-- base + lods[0].verts_offset (aligned)
+ *  | ...                             |
+ *  | (the vertices and indices of    |
+ *  |  every level of detail)         |
+ *  +---------------------------------+
+ *
+ */
+
+bool R_AL_WriteBinary(const struct pfobj_hdr *header, SDL_RWops *in, SDL_RWops *out)
+{
+    bool ret = false;
+    /* The base mesh is at index 0, followed by the levels of detail */
+    struct mesh_data data[MAX_LODS + 1] = {0};
+    float screen_sizes[MAX_LODS + 1] = {0};
+    size_t num_meshes = 0;
+
+    struct vertex *vbuff = malloc(header->num_verts * sizeof(struct vertex) + 1);
+    struct bin_material *mats = calloc(header->num_materials + 1, sizeof(struct bin_material));
+    if(!vbuff || !mats)
+        goto fail_alloc;
+
+    if(!al_read_verts(in, header->num_verts, vbuff))
+        goto fail_alloc;
+
+    for(int i = 0; i < header->num_materials; i++) {
+
+        struct material mat = {0};
+        if(!al_parse_material(in, &mat))
+            goto fail_alloc;
+
+        mats[i].ambient_intensity = mat.ambient_intensity;
+        mats[i].diffuse_clr = mat.diffuse_clr;
+        mats[i].specular_clr = mat.specular_clr;
+        memcpy(mats[i].name, mat.name, sizeof(mats[i].name));
+        memcpy(mats[i].texname, mat.texname, sizeof(mats[i].texname));
+    }
+
+    enum vert_layout layout = R_Vert_LayoutForShader(al_shader_for_header(header));
+    struct aabb bounds;
+    al_bounds(vbuff, header->num_verts, &bounds);
+
+    if(!R_Mesh_BuildIndexed(layout, vbuff, header->num_verts, &data[num_meshes++]))
+        goto fail_build;
+
+    for(int i = 0; i < header->num_lods; i++) {
+
+        unsigned num_verts;
+        if(!al_read_lod_header(in, &screen_sizes[num_meshes], &num_verts))
+            goto fail_build;
+
+        struct vertex *lod_vbuff = malloc(num_verts * sizeof(struct vertex));
+        bool ok = lod_vbuff
+               && al_read_verts(in, num_verts, lod_vbuff)
+               && R_Mesh_BuildIndexed(layout, lod_vbuff, num_verts, &data[num_meshes]);
+        free(lod_vbuff);
+        if(!ok)
+            goto fail_build;
+        num_meshes++;
+    }
+
+    size_t mats_end = sizeof(struct bin_render_hdr) 
+                    + header->num_lods * sizeof(struct bin_lod)
+                    + header->num_materials * sizeof(struct bin_material);
+
+    struct bin_lod offsets[MAX_LODS + 1];
+    size_t end = mats_end;
+
+    for(int i = 0; i < num_meshes; i++) {
+
+        size_t verts_size = data[i].num_verts * R_Vert_Size(layout);
+        offsets[i] = (struct bin_lod){
+            .screen_size    = screen_sizes[i],
+            .num_verts      = data[i].num_verts,
+            .num_indices    = data[i].num_indices,
+            .index_type     = data[i].index_type,
+            .verts_offset   = BIN_ALIGN_UP(end),
+            .indices_offset = BIN_ALIGN_UP(BIN_ALIGN_UP(end) + verts_size),
+        };
+        end = offsets[i].indices_offset + data[i].num_indices * al_index_size(data[i].index_type);
+    }
+
+    struct bin_render_hdr hdr = (struct bin_render_hdr){
+        .layout         = layout,
+        .num_materials  = header->num_materials,
+        .num_verts      = offsets[0].num_verts,
+        .num_indices    = offsets[0].num_indices,
+        .index_type     = offsets[0].index_type,
+        .num_lods       = header->num_lods,
+        .verts_offset   = offsets[0].verts_offset,
+        .indices_offset = offsets[0].indices_offset,
+        .bounds         = bounds,
+    };
+
+    ret = AL_WriteBytes(out, &hdr, sizeof(hdr))
+       && AL_WriteBytes(out, offsets + 1, header->num_lods * sizeof(struct bin_lod))
+       && AL_WriteBytes(out, mats, header->num_materials * sizeof(struct bin_material));
+
+    end = mats_end;
+    for(int i = 0; ret && i < num_meshes; i++) {
+
+        size_t verts_size = data[i].num_verts * R_Vert_Size(layout);
+        size_t indices_size = data[i].num_indices * al_index_size(data[i].index_type);
+
+        ret = AL_WritePadding(out, offsets[i].verts_offset - end)
+           && AL_WriteBytes(out, data[i].verts, verts_size)
+           && AL_WritePadding(out, offsets[i].indices_offset - offsets[i].verts_offset - verts_size)
+           && AL_WriteBytes(out, data[i].indices, indices_size);
+        end = offsets[i].indices_offset + indices_size;
+    }
+
+fail_build:
+    for(int i = 0; i < num_meshes; i++)
+        R_Mesh_FreeData(&data[i]);
+fail_alloc:
+    free(mats);
+    free(vbuff);
+    return ret;
+}
+
+void *R_AL_PrivFromBinary(const char *base_path, const struct pfobj_hdr *header, 
+                          const void *data, size_t size)
+{
+    const char *shader = al_shader_for_header(header);
+    const struct bin_render_hdr *hdr = data;
+    if(size < sizeof(*hdr))
+        goto fail_hdr;
+
+    size_t mats_end = sizeof(*hdr) 
+                    + (size_t)hdr->num_lods * sizeof(struct bin_lod)
+                    + (size_t)hdr->num_materials * sizeof(struct bin_material);
+
+    if(hdr->layout != R_Vert_LayoutForShader(shader)
+    || hdr->num_materials != header->num_materials
+    || hdr->num_lods != header->num_lods
+    || mats_end > size
+    || !al_bin_mesh_valid(hdr->layout, size, mats_end, hdr->num_verts, hdr->num_indices,
+                          hdr->index_type, hdr->verts_offset, hdr->indices_offset))
+        goto fail_hdr;
+
+    const struct bin_lod *lods = (const void*)(hdr + 1);
+    for(int i = 0; i < hdr->num_lods; i++) {
+
+        if(!al_bin_mesh_valid(hdr->layout, size, mats_end, lods[i].num_verts, lods[i].num_indices,
+                              lods[i].index_type, lods[i].verts_offset, lods[i].indices_offset))
+            goto fail_hdr;
+    }
+
+    struct render_private *priv = MEM_Malloc(MEM_TAG_RENDER, 
+        al_priv_buffsize(header->num_materials, header->num_lods));
+    if(!priv)
+        goto fail_alloc_priv;
+
+    al_priv_init(priv, header->num_materials, header->num_lods);
+
+    const struct bin_material *mats = (const void*)(lods + hdr->num_lods);
+    for(int i = 0; i < header->num_materials; i++) {
+
+        struct material *mat = &priv->materials[i];
+        mat->texture.tunit = GL_TEXTURE0 + i;
+        mat->ambient_intensity = mats[i].ambient_intensity;
+        mat->diffuse_clr = mats[i].diffuse_clr;
+        mat->specular_clr = mats[i].specular_clr;
+        memcpy(mat->name, mats[i].name, sizeof(mat->name));
+        mat->name[sizeof(mat->name)-1] = '\0';
+        memcpy(mat->texname, mats[i].texname, sizeof(mat->texname));
+        mat->texname[sizeof(mat->texname)-1] = '\0';
+
+        if(!al_load_packed_texture(base_path, mat)) {
+            al_free_textures(priv->materials, i);
+            goto fail_tex;
+        }
+    }
+
+    /* The buffers are only read from */
+    const char *base = data;
+    struct mesh_data mesh = (struct mesh_data){
+        .verts       = (void*)(base + hdr->verts_offset),
+        .num_verts   = hdr->num_verts,
+        .indices     = (void*)(base + hdr->indices_offset),
+        .num_indices = hdr->num_indices,
+        .index_type  = hdr->index_type,
+    };
+    R_GL_InitPacked(priv, shader, &mesh);
+
+    if(!R_GL_MaterialsAlloc(priv)) {
+        R_AL_FreePrivate(priv);
+        return NULL;
+    }
+
+    for(int i = 0; i < hdr->num_lods; i++) {
+
+        struct mesh_data lod_mesh = (struct mesh_data){
+            .verts       = (void*)(base + lods[i].verts_offset),
+            .num_verts   = lods[i].num_verts,
+            .indices     = (void*)(base + lods[i].indices_offset),
+            .num_indices = lods[i].num_indices,
+            .index_type  = lods[i].index_type,
+        };
+        R_GL_InitPacked(al_priv_add_lod(priv, lods[i].screen_size), shader, &lod_mesh);
+    }
+
+    if(priv->mesh.layout == VERT_LAYOUT_STATIC)
+        priv->impostor = R_GL_ImpostorCreate(priv, &hdr->bounds);
+    return priv;
+
+fail_tex:
+    MEM_Free(priv);
+fail_alloc_priv:
+fail_hdr:
+    return NULL;
+}
+
+void R_AL_FreePrivate(void *priv_data)
+{
+    struct render_private *priv = priv_data;
+    R_Thread_Claim();
+
+    al_free_textures(priv->materials, priv->num_materials);
+    R_GL_MaterialsFree(priv);
+    for(int i = 0; i < priv->num_lods; i++) {
+        R_GL_Free(&priv->lods[i].priv);
+    }
+    if(priv->impostor)
+        R_GL_ImpostorFree(priv->impostor);
+    R_GL_Free(priv);
+    MEM_Free(priv);
+}
+
+bool R_AL_ReplacePrivate(void *dst_priv, void *src_priv)
+{
+    struct render_private *dst = dst_priv;
+    struct render_private *src = src_priv;
+    R_Thread_Claim();
+
+    /* The materials and levels of detail are stored right after the private 
+     * data, leaving no room for more of them */
+    if(src->num_materials != dst->num_materials
+    || src->num_lods != dst->num_lods
+    || src->mesh.layout != dst->mesh.layout) {
+        R_AL_FreePrivate(src);
+        return false;
+    }
+
+    /* The old contents end up in 'src', to be freed along with it */
+    struct render_private tmp = *dst;
+    dst->mesh = src->mesh;
+    dst->shader_prog = src->shader_prog;
+    dst->instanced_shader_prog = src->instanced_shader_prog;
+    src->mesh = tmp.mesh;
+
+    for(int i = 0; i < dst->num_materials; i++) {
+
+        struct material mat = dst->materials[i];
+        dst->materials[i] = src->materials[i];
+        src->materials[i] = mat;
+    }
+    /* The entries of 'dst' are written over with its' new materials */
+    R_GL_MaterialsUpdate(dst);
+
+    /* The levels keep pointing to the materials of their' own parent */
+    for(int i = 0; i < dst->num_lods; i++) {
+
+        struct render_lod lod = dst->lods[i];
+        dst->lods[i].screen_size = src->lods[i].screen_size;
+        dst->lods[i].priv.mesh = src->lods[i].priv.mesh;
+        dst->lods[i].priv.shader_prog = src->lods[i].priv.shader_prog;
+        dst->lods[i].priv.instanced_shader_prog = src->lods[i].priv.instanced_shader_prog;
+        src->lods[i].screen_size = lod.screen_size;
+        src->lods[i].priv.mesh = lod.priv.mesh;
+    }
+
+    dst->impostor = src->impostor;
+    src->impostor = tmp.impostor;
+    if(dst->impostor)
+        dst->impostor->source = dst;
+    if(src->impostor)
+        src->impostor->source = src;
+
+    R_AL_FreePrivate(src);
+    return true;
+}
+
+/* The vertices are read back from the GL buffers, which the headless build 
+ * doesn't have */
+#if !defined(PF_HEADLESS)
+
 void R_AL_DumpPrivate(FILE *stream, void *priv_data)
 {
     struct render_private *priv = priv_data;
-    struct vertex *vbuff = glMapNamedBuffer(priv->mesh.VBO, GL_READ_ONLY);
+    const char *vbuff = glMapNamedBuffer(priv->mesh.VBO, GL_READ_ONLY);
     assert(vbuff);
+    size_t vert_size = R_Vert_Size(priv->mesh.layout);
+
+    /* The file format holds the flat triangle list */
+    const void *ibuff = NULL;
+    size_t num_out = priv->mesh.num_verts;
+    if(priv->mesh.EBO) {
+        ibuff = glMapNamedBuffer(priv->mesh.EBO, GL_READ_ONLY);
+        assert(ibuff);
+        num_out = priv->mesh.num_indices;
+    }
 
     /* Write verticies */
-    for(int i = 0; i < priv->mesh.num_verts; i++) {
+    for(int i = 0; i < num_out; i++) {
+
+        size_t idx = i;
+        if(ibuff) {
+            idx = (priv->mesh.index_type == GL_UNSIGNED_SHORT) ? ((const GLushort*)ibuff)[i] 
+                                                               : ((const GLuint*)ibuff)[i];
+        }
 
-        struct vertex *v = &vbuff[i];
+        struct vertex unpacked;
+        struct vertex *v = &unpacked;
+        R_Vert_Unpack(priv->mesh.layout, vbuff + idx * vert_size, v, 1);
 
         fprintf(stream, "v %.6f %.6f %.6f\n", v->pos.x, v->pos.y, v->pos.z); 
         fprintf(stream, "vt %.6f %.6f \n", v->uv.x, v->uv.y); 
@@ -251,6 +764,9 @@ void R_AL_DumpPrivate(FILE *stream, void *priv_data)
         fprintf(stream, "vm %d\n", v->material_idx); 
     }
 
+    if(ibuff) {
+        glUnmapNamedBuffer(priv->mesh.EBO);
+    }
     glUnmapNamedBuffer(priv->mesh.VBO);
 
     /* Write materials */
@@ -258,9 +774,12 @@ void R_AL_DumpPrivate(FILE *stream, void *priv_data)
     
         struct material *m = &priv->materials[i];
 
-        /* We don't keep track of the material names; this isn't strictly necessary */
+        /* Materials built by the engine itself don't have a name */
         char name[32];
-        snprintf(name, sizeof(name), "Material.%d", i + 1);
+        if(m->name[0])
+            snprintf(name, sizeof(name), "%s", m->name);
+        else
+            snprintf(name, sizeof(name), "Material.%d", i + 1);
 
         fprintf(stream, "material %s\n", name);
         fprintf(stream, "\tambient %.6f\n", m->ambient_intensity);
@@ -272,6 +791,8 @@ void R_AL_DumpPrivate(FILE *stream, void *priv_data)
     }
 }
 
+#endif
+
 size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t num_mats)
 {
     size_t ret = 0;
@@ -282,57 +803,177 @@ size_t R_AL_PrivBuffSizeForChunk(size_t tiles_width, size_t tiles_height, size_t
     return ret;
 }
 
-bool R_AL_InitPrivFromTilesAndMats(SDL_RWops *mats_stream, size_t num_mats, 
-                                  const struct tile *tiles, size_t width, size_t height, 
-                                  void *priv_buff, const char *basedir)
+size_t R_AL_ChunkMatsSize(size_t num_mats)
 {
-    size_t num_verts = VERTS_PER_TILE * (width * height);
+    return num_mats * sizeof(struct bin_material);
+}
 
-    struct render_private *priv = priv_buff;
-    char *unused_base = (char*)priv_buff + sizeof(struct render_private);
-    size_t vbuff_sz = num_verts * sizeof(struct vertex);
+bool R_AL_ChunkMatsFromStream(SDL_RWops *mats_stream, size_t num_mats, void *out)
+{
+    struct bin_material *mats = out;
+    memset(mats, 0, num_mats * sizeof(struct bin_material));
 
-    struct vertex *vbuff = malloc(vbuff_sz);
-    if(!vbuff)
-        goto fail_alloc;
+    for(int i = 0; i < num_mats; i++) {
 
-    priv->mesh.num_verts = num_verts;
-    priv->num_materials = num_mats;
-    priv->materials = (void*)unused_base;
+        struct material mat = (struct material){0};
+        if(!al_parse_material(mats_stream, &mat))
+            return false;
+
+        mats[i].ambient_intensity = mat.ambient_intensity;
+        mats[i].diffuse_clr = mat.diffuse_clr;
+        mats[i].specular_clr = mat.specular_clr;
+        memcpy(mats[i].name, mat.name, sizeof(mats[i].name));
+        memcpy(mats[i].texname, mat.texname, sizeof(mats[i].texname));
+    }
+    return true;
+}
 
-    for(int r = 0; r < height; r++) {
-        for(int c = 0; c < width; c++) {
+void R_AL_ChunkMatsFromPriv(const void *priv_buff, size_t num_mats, void *out)
+{
+    const struct render_private *priv = priv_buff;
+    struct bin_material *mats = out;
+    memset(mats, 0, num_mats * sizeof(struct bin_material));
+
+    for(int i = 0; i < num_mats && i < priv->num_materials; i++) {
+
+        const struct material *mat = &priv->materials[i];
+        mats[i].ambient_intensity = mat->ambient_intensity;
+        mats[i].diffuse_clr = mat->diffuse_clr;
+        mats[i].specular_clr = mat->specular_clr;
+        memcpy(mats[i].name, mat->name, sizeof(mats[i].name));
+        memcpy(mats[i].texname, mat->texname, sizeof(mats[i].texname));
+    }
+}
 
-            const struct tile *curr = &tiles[r * width + c];
-            struct vertex *vert_base = &vbuff[ (r * width + c) * VERTS_PER_TILE ];
+size_t R_AL_ChunkMatsToText(const void *mats, size_t num_mats, char *out, size_t size)
+{
+    const struct bin_material *bmats = mats;
+    size_t ret = 0;
+
+    for(int i = 0; i < num_mats; i++) {
 
-            R_GL_TileGetVertices(curr, vert_base, r, c);
+        const struct bin_material *m = &bmats[i];
+        char *dst = out ? out + MIN(ret, size) : NULL;
+        size_t left = out ? size - MIN(ret, size) : 0;
+        int len;
+
+        if(!m->texname[0]) {
+            len = snprintf(dst, left, "material __none__\n");
+        }else{
+            char name[sizeof(m->name) + 1];
+            if(m->name[0])
+                snprintf(name, sizeof(name), "%.*s", (int)sizeof(m->name), m->name);
+            else
+                snprintf(name, sizeof(name), "Material.%d", i + 1);
+
+            len = snprintf(dst, left, 
+                "material %s\n"
+                "\tambient %.6f\n"
+                "\tdiffuse %.6f %.6f %.6f\n"
+                "\tspecular %.6f %.6f %.6f\n"
+                "\ttexture %.*s\n",
+                name,
+                m->ambient_intensity,
+                m->diffuse_clr.x, m->diffuse_clr.y, m->diffuse_clr.z,
+                m->specular_clr.x, m->specular_clr.y, m->specular_clr.z,
+                (int)sizeof(m->texname), m->texname);
         }
+        if(len < 0)
+            return 0;
+        ret += len;
     }
+    return ret;
+}
+
+size_t R_AL_ChunkVertsSize(size_t tiles_width, size_t tiles_height)
+{
+    return VERTS_PER_TILE * (tiles_width * tiles_height) * R_Vert_Size(VERT_LAYOUT_TERRAIN);
+}
+
+void R_AL_ChunkVertsFromTiles(const struct tile *tiles, size_t width, size_t height, void *out)
+{
+    R_GL_TileBuildVerts(tiles, width, height, out);
+}
+
+bool R_AL_InitPrivFromChunk(const void *mats, size_t num_mats, const void *verts,
+                            size_t width, size_t height, void *priv_buff, const char *basedir)
+{
+    struct render_private *priv = priv_buff;
+    char *unused_base = (char*)priv_buff + sizeof(struct render_private);
+
+    priv->num_materials = num_mats;
+    priv->materials = (void*)unused_base;
+    priv->material_base = -1;
+    priv->num_lods = 0;
+    priv->lods = NULL;
+    priv->impostor = NULL;
 
+    const struct bin_material *bmats = mats;
     for(int i = 0; i < num_mats; i++) {
 
-        priv->materials[i].texture.tunit = GL_TEXTURE0 + i;
-        if(!al_read_material(mats_stream, basedir, &priv->materials[i])) 
-            goto fail_parse;
+        struct material *mat = &priv->materials[i];
+        mat->texture.tunit = GL_TEXTURE0 + i;
+        mat->ambient_intensity = bmats[i].ambient_intensity;
+        mat->diffuse_clr = bmats[i].diffuse_clr;
+        mat->specular_clr = bmats[i].specular_clr;
+        memcpy(mat->name, bmats[i].name, sizeof(mat->name));
+        mat->name[sizeof(mat->name)-1] = '\0';
+        memcpy(mat->texname, bmats[i].texname, sizeof(mat->texname));
+        mat->texname[sizeof(mat->texname)-1] = '\0';
+
+        if(!al_load_texture(basedir, mat)) {
+            al_free_textures(priv->materials, i);
+            return false;
+        }
     }
 
-    R_GL_Init(priv, "terrain", vbuff);
-    al_patch_vbuff_adjacency_info(priv->mesh.VBO, tiles, width, height);
+    memset(&priv->mesh, 0, sizeof(priv->mesh));
+    if(!verts) {
+        priv->shader_prog = 0;
+        priv->instanced_shader_prog = 0;
+        return true;
+    }
 
-    free(vbuff);
+    R_AL_InitChunkMesh(priv, verts, width, height);
     return true;
+}
 
-fail_parse:
-    free(vbuff);
-fail_alloc:
-    return false;
+void R_AL_InitChunkMesh(void *priv_buff, const void *verts, size_t width, size_t height)
+{
+    struct render_private *priv = priv_buff;
+    assert(!priv->mesh.VAO);
+
+    struct mesh_data mesh = (struct mesh_data){
+        .verts     = (void*)verts,
+        .num_verts = VERTS_PER_TILE * (width * height),
+    };
+    R_GL_InitPacked(priv, "terrain", &mesh);
+}
+
+void R_AL_FreeChunkMesh(void *priv_buff)
+{
+    struct render_private *priv = priv_buff;
+    if(!priv->mesh.VAO)
+        return;
+
+    R_GL_Free(priv);
+    memset(&priv->mesh, 0, sizeof(priv->mesh));
+}
+
+void R_AL_FreeChunkPriv(void *priv_buff)
+{
+    struct render_private *priv = priv_buff;
+    R_Thread_Claim();
+
+    al_free_textures(priv->materials, priv->num_materials);
+    R_AL_FreeChunkMesh(priv);
 }
 
 bool R_AL_UpdateMats(SDL_RWops *mats_stream, size_t num_mats, void *priv_buff)
 {
     struct render_private *priv = priv_buff;
     extern const char *g_basepath;
+    R_Thread_Claim();
 
     for(int i = 0; i < num_mats; i++) {
 
@@ -40,530 +40,889 @@
 #include "shader.h"
 #include "material.h"
 #include "gl_assert.h"
-#include "gl_uniforms.h"
+#include "bake_cache.h"
+#include "texture.h"
 #include "public/render.h"
 #include "../entity.h"
 #include "../camera.h"
 #include "../config.h"
+#include "../mem.h"
 #include "../anim/public/skeleton.h"
 #include "../anim/public/anim.h"
 #include "../ui.h"
 #include "../map/public/map.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/mem_arena.h"
 
 #include <GL/glew.h>
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <string.h>
 
 
 #define ARR_SIZE(a)                 (sizeof(a)/sizeof(a[0]))
 
+KHASH_MAP_INIT_INT64(palette, GLint)
+
+struct draw_args{
+    const struct render_private *priv;
+    mat4x4_t                     model;
+    struct pose_ref              pose;
+    bool                         normals;
+    bool                         anim;
+};
+
+struct instanced_args{
+    const struct render_private *priv;
+    size_t                       count;
+    /* Followed by 'count' model matrices */
+};
+
+struct globals_args{
+    size_t        offset;
+    size_t        size;
+    unsigned char data[sizeof(mat4x4_t)];
+};
+
+struct dump_args{
+    char filename[256];
+    int  width, height;
+};
+
+struct bake_args{
+    size_t base;
+    size_t count;
+    /* Followed by 'count' skinning matrices */
+};
+
+/* Mirrors the std140 layout of the 'globals' uniform block in the shaders. 
+ * Every vec3 is padded out to 16 bytes. */
+struct globals{
+    mat4x4_t view;
+    mat4x4_t projection;
+    vec4_t   view_pos;
+    vec4_t   ambient_color;
+    vec4_t   light_color;
+    vec4_t   light_pos;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The camera and lighting state for rendering the world */
+static GLuint s_globals_ubo;
+/* Fixed orthographic projection for drawing in screen coordinates */
+static GLuint s_screen_globals_ubo;
+/* The view and projection of the light, for drawing the shadow maps */
+static GLuint s_light_globals_ubo;
+/* CPU-side copy of the lighting state, which is baked into the cached 
+ * terrain textures */
+static struct{
+    vec3_t ambient_color;
+    vec3_t light_color;
+    vec3_t light_pos;
+}s_light;
+
+/* The skinning matrices (pose * inverse bind pose) of every animated entity 
+ * drawn this frame. They are read by the skinned vertex shaders through a 
+ * buffer texture, so that one palette serves all draws and instances. */
+static kvec_t(mat4x4_t) s_palette;
+static GLuint           s_palette_VBO;
+static GLuint           s_palette_tex;
+/* The number of matrices that the buffer can hold and that it currently holds */
+static size_t           s_palette_cap;
+static size_t           s_palette_uploaded;
+/* The number of matrices the buffer texture can address */
+static size_t           s_palette_max;
+static struct pose_ref  s_pose = {{-1, -1}, 0.0f};
+/* Maps the skinning matrices set this frame to their offset in the palette, 
+ * so that all the entities in the same pose share a single copy of it */
+static khash_t(palette) *s_palette_offsets;
+
+/* The skinning matrices of the baked clips, which are kept for the whole 
+ * session. The main thread hands out the offsets and the render thread 
+ * grows the buffer to fit them. */
+static size_t           s_baked_size;
+static GLuint           s_baked_VBO;
+static GLuint           s_baked_tex;
+static size_t           s_baked_cap;
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
 static void r_gl_set_materials(GLuint shader_prog, size_t num_mats, const struct material *mats)
 {
+    assert(num_mats <= SHADER_MAX_MATERIALS);
+
     for(size_t i = 0; i < num_mats; i++) {
     
         const struct material *mat = &mats[i];
-        const size_t nmembers = 3; 
-
-        const struct member_desc{
-            const GLchar *name; 
-            size_t        size;
-            ptrdiff_t     offset;
-        }descs[] = {
-            {"ambient_intensity", 1, offsetof(struct material, ambient_intensity) },
-            {"diffuse_clr",       3, offsetof(struct material, diffuse_clr)       },
-            {"specular_clr",      3, offsetof(struct material, specular_clr)      }
-        };
 
-        for(size_t j = 0; j < nmembers; j++) {
-        
-            char locbuff[64];
-            GLuint loc;
+        glUniform1fv(R_Shader_MaterialLoc(shader_prog, i, MU_AMBIENT_INTENSITY), 1, &mat->ambient_intensity);
+        glUniform3fv(R_Shader_MaterialLoc(shader_prog, i, MU_DIFFUSE_CLR), 1, mat->diffuse_clr.raw);
+        glUniform3fv(R_Shader_MaterialLoc(shader_prog, i, MU_SPECULAR_CLR), 1, mat->specular_clr.raw);
+    }
+}
+
+static void r_gl_set_globals_exec(const void *arg)
+{
+    const struct globals_args *args = arg;
+    glBindBuffer(GL_UNIFORM_BUFFER, s_globals_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, args->offset, args->size, args->data);
+}
+
+/* Recorded like the draws, so that the camera and lights set during a frame
+ * only apply to the draws which follow */
+static void r_gl_set_globals(size_t offset, const void *data, size_t size)
+{
+    struct globals_args args = {.offset = offset, .size = size};
+    assert(size <= sizeof(args.data));
+    memcpy(args.data, data, size);
+    R_Thread_Push(r_gl_set_globals_exec, &args, sizeof(args));
+}
+
+static GLuint r_gl_make_globals_ubo(const struct globals *init)
+{
+    GLuint ret;
+    glGenBuffers(1, &ret);
+    glBindBuffer(GL_UNIFORM_BUFFER, ret);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct globals), init, GL_DYNAMIC_DRAW);
+    return ret;
+}
+
+/* Uploads the vertices, and the indices if there are any, for the VBO and
+ * VAO that are currently bound. */
+static void r_gl_upload_mesh(struct mesh *mesh, const struct mesh_data *data)
+{
+    mesh->num_verts = data->num_verts;
+    glBufferData(GL_ARRAY_BUFFER, data->num_verts * R_Vert_Size(mesh->layout), 
+        data->verts, GL_STATIC_DRAW);
+
+    if(!data->indices)
+        return;
+
+    size_t index_size = (data->index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) 
+                                                                : sizeof(GLuint);
+    glGenBuffers(1, &mesh->EBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->num_indices * index_size, 
+        data->indices, GL_STATIC_DRAW);
+
+    mesh->index_type = data->index_type;
+    mesh->num_indices = data->num_indices;
+}
+
+/* Uploads the deduplicated vertices of the triangle list, along with an 
+ * index buffer, for the VBO and VAO that are currently bound. */
+static bool r_gl_init_indexed(struct mesh *mesh, const struct vertex *vbuff)
+{
+    struct mesh_data data;
+    if(!R_Mesh_BuildIndexed(mesh->layout, vbuff, mesh->num_verts, &data))
+        return false;
+
+    r_gl_upload_mesh(mesh, &data);
+    R_Mesh_FreeData(&data);
+    return true;
+}
+
+/* The size of the vertex and index buffers, as counted in the GPU memory stats */
+static size_t r_gl_mesh_size(const struct mesh *mesh)
+{
+    size_t ret = mesh->num_verts * R_Vert_Size(mesh->layout);
+    if(mesh->EBO) {
+        size_t index_size = (mesh->index_type == GL_UNSIGNED_SHORT) ? sizeof(GLushort) 
+                                                                    : sizeof(GLuint);
+        ret += mesh->num_indices * index_size;
+    }
+    return ret;
+}
+
+/* Creates the VAO and VBO of the mesh and leaves them bound */
+static void r_gl_init_begin(struct render_private *priv, const char *shader)
+{
+    struct mesh *mesh = &priv->mesh;
+    mesh->instance_VBO = 0;
+    mesh->instance_palette_VBO = 0;
+    priv->instanced_shader_prog = 0;
+
+    glGenVertexArrays(1, &mesh->VAO);
+    glBindVertexArray(mesh->VAO);
+
+    mesh->layout = R_Vert_LayoutForShader(shader);
+    mesh->EBO = 0;
+    mesh->num_indices = 0;
+
+    glGenBuffers(1, &mesh->VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+}
+
+/* Sets up the vertex attributes and the per-instance buffers once the 
+ * vertices have been uploaded */
+static void r_gl_init_end(struct render_private *priv, const char *shader)
+{
+    struct mesh *mesh = &priv->mesh;
+    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+    R_Vert_SetAttribs(mesh->layout);
+    MEM_Track(MEM_TAG_GL_BUFFERS, r_gl_mesh_size(mesh));
+
+    if(0 == strcmp("mesh.static.textured-phong", shader)
+    || 0 == strcmp("mesh.static.impostor", shader)) {
 
-            snprintf(locbuff, sizeof(locbuff), "%s[%zu].%s", GL_U_MATERIALS, i, descs[j].name);
-            locbuff[sizeof(locbuff)-1] = '\0';
+        /* Attribute 4-7 - per-instance model matrix, one column per attribute */
+        glGenBuffers(1, &mesh->instance_VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_VBO);
 
-            loc = glGetUniformLocation(shader_prog, locbuff);
-            switch(descs[j].size) {
-            case 1: glUniform1fv(loc, 1, (void*) ((char*)mat + descs[j].offset) ); break;
-            case 3: glUniform3fv(loc, 1, (void*) ((char*)mat + descs[j].offset) ); break;
-            default: assert(0);
-            }
+        for(int i = 0; i < 4; i++) {
+            glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4x4_t), 
+                (void*)(i * sizeof(vec4_t)));
+            glEnableVertexAttribArray(4 + i);
+            glVertexAttribDivisor(4 + i, 1);
+        }
+
+        char instanced[64];
+        snprintf(instanced, sizeof(instanced), "%s.instanced", shader);
+        priv->instanced_shader_prog = R_Shader_GetProgForName(instanced);
+
+    }else if(0 == strcmp("mesh.animated.textured-phong", shader)) {
+
+        /* Attribute 8-11 - per-instance model matrix, one column per attribute */
+        glGenBuffers(1, &mesh->instance_VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_VBO);
 
+        for(int i = 0; i < 4; i++) {
+            glVertexAttribPointer(8 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4x4_t), 
+                (void*)(i * sizeof(vec4_t)));
+            glEnableVertexAttribArray(8 + i);
+            glVertexAttribDivisor(8 + i, 1);
         }
+
+        /* Attribute 12/13 - per-instance joint palette offsets and blend factor */
+        glGenBuffers(1, &mesh->instance_palette_VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_palette_VBO);
+
+        glVertexAttribIPointer(12, 2, GL_INT, sizeof(struct pose_ref), 
+            (void*)offsetof(struct pose_ref, bases));
+        glEnableVertexAttribArray(12);
+        glVertexAttribDivisor(12, 1);
+
+        glVertexAttribPointer(13, 1, GL_FLOAT, GL_FALSE, sizeof(struct pose_ref), 
+            (void*)offsetof(struct pose_ref, blend));
+        glEnableVertexAttribArray(13);
+        glVertexAttribDivisor(13, 1);
+
+        /* Attribute 14 - per-instance choice of the palette */
+        glVertexAttribIPointer(14, 1, GL_INT, sizeof(struct pose_ref), 
+            (void*)offsetof(struct pose_ref, baked));
+        glEnableVertexAttribArray(14);
+        glVertexAttribDivisor(14, 1);
+
+        priv->instanced_shader_prog = R_Shader_GetProgForName("mesh.animated.textured-phong.instanced");
     }
+
+    priv->shader_prog = R_Shader_GetProgForName(shader);
 }
 
-static void r_gl_set_uniform_mat4x4_array(mat4x4_t *data, size_t count, 
-                                          const char *uname, const char *shader_name)
+static GLint r_gl_palette_add(const mat4x4_t *skin_mats, size_t count)
 {
-    GLuint loc, shader_prog;
+    uint64_t key = (uintptr_t)skin_mats;
+    khiter_t k = kh_get(palette, s_palette_offsets, key);
+    if(k != kh_end(s_palette_offsets))
+        return kh_value(s_palette_offsets, k);
+
+    size_t base = kv_size(s_palette);
+    if(base + count > s_palette_max)
+        return -1;
 
-    shader_prog = R_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    for(size_t i = 0; i < count; i++) {
+        kv_push(mat4x4_t, s_palette, skin_mats[i]);
+    }
 
-    loc = glGetUniformLocation(shader_prog, uname);
-    glUniformMatrix4fv(loc, count, GL_FALSE, (void*)data);
+    int ret;
+    k = kh_put(palette, s_palette_offsets, key, &ret);
+    if(ret != -1)
+        kh_value(s_palette_offsets, k) = base;
+
+    return base;
 }
 
-static void r_gl_set_uniform_vec4_array(vec4_t *data, size_t count, 
-                                        const char *uname, const char *shader_name)
+static void r_gl_draw(const struct render_private *priv, const mat4x4_t *model, 
+                      const struct pose_ref *pose)
 {
-    GLuint loc, shader_prog;
+    GLint loc;
+
+    glUseProgram(priv->shader_prog);
+    R_GL_StatsProgramBind();
+
+    loc = R_Shader_UniformLoc(priv->shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
+
+    if(priv->mesh.layout == VERT_LAYOUT_SKINNED) {
+        R_GL_AnimPaletteSync();
+        R_GL_SetPoseUniforms(priv->shader_prog, pose);
+    }
 
-    shader_prog = R_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    R_GL_SetMaterials(priv, priv->shader_prog);
 
-    loc = glGetUniformLocation(shader_prog, uname);
-    glUniform4fv(loc, count, (void*)data);
+    glBindVertexArray(priv->mesh.VAO);
+    R_GL_DrawMesh(&priv->mesh, 1);
 }
 
-static void r_gl_set_view(const mat4x4_t *view, const char *shader_name)
+static void r_gl_draw_normals(const struct render_private *priv, const mat4x4_t *model, 
+                              const struct pose_ref *pose)
 {
-    GLuint loc, shader_prog;
+    bool anim = (pose != NULL);
+    GLuint normals_shader = anim ? R_Shader_GetProgForName("mesh.animated.normals.colored")
+                                 : R_Shader_GetProgForName("mesh.static.normals.colored");
+    assert(normals_shader);
+    glUseProgram(normals_shader);
+    R_GL_StatsProgramBind();
 
-    shader_prog = R_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+    GLuint loc;
+    vec4_t yellow = (vec4_t){1.0f, 1.0f, 0.0f, 1.0f};
+
+    loc = R_Shader_UniformLoc(normals_shader, SU_COLOR);
+    glUniform4fv(loc, 1, yellow.raw);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_VIEW);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, view->raw);
+    loc = R_Shader_UniformLoc(normals_shader, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
+
+    if(anim) {
+        R_GL_AnimPaletteSync();
+        R_GL_SetPoseUniforms(normals_shader, pose);
+    }
+
+    glBindVertexArray(priv->mesh.VAO);
+    R_GL_DrawMesh(&priv->mesh, 1);
 }
 
-static void r_gl_set_proj(const mat4x4_t *proj, const char *shader_name)
+static void r_gl_draw_exec(const void *arg)
 {
-    GLuint loc, shader_prog;
+    const struct draw_args *args = arg;
+
+    if(args->normals)
+        r_gl_draw_normals(args->priv, &args->model, args->anim ? &args->pose : NULL);
+    else
+        r_gl_draw(args->priv, &args->model, &args->pose);
+}
 
-    shader_prog = R_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+static void r_gl_draw_instanced_exec(const void *arg)
+{
+    const struct instanced_args *args = arg;
+    const struct render_private *priv = args->priv;
 
-    loc = glGetUniformLocation(shader_prog, GL_U_PROJECTION);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, proj->raw);
+    glUseProgram(priv->instanced_shader_prog);
+    R_GL_StatsProgramBind();
+    R_GL_SetMaterials(priv, priv->instanced_shader_prog);
+    R_GL_UploadInstances(priv, (const mat4x4_t*)(args + 1), NULL, args->count);
+
+    glBindVertexArray(priv->mesh.VAO);
+    R_GL_DrawMesh(&priv->mesh, args->count);
+}
+
+static void r_gl_begin_frame_exec(const void *unused)
+{
+    /* Orphan the last frame's palette so that the driver doesn't have to wait 
+     * on the draws still using it */
+    glBindBuffer(GL_TEXTURE_BUFFER, s_palette_VBO);
+    glBufferData(GL_TEXTURE_BUFFER, s_palette_cap * sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+    s_palette_uploaded = 0;
+
+    /* Upload some of the textures that finished decoding since the last frame */
+    R_Texture_Update();
+    /* And draw the impostors whose meshes' textures are all in */
+    R_GL_ImpostorsUpdate();
 }
 
-static void r_gl_set_view_pos(const vec3_t *pos, const char *shader_name)
+/* The argument is followed by the matrices */
+static void r_gl_bake_exec(const void *arg)
 {
-    GLuint loc, shader_prog;
+    const struct bake_args *args = arg;
+    size_t end = args->base + args->count;
+
+    if(end > s_baked_cap) {
+
+        /* The buffer is replaced by a larger one, with the clips baked so far
+         * copied over on the GPU */
+        size_t cap = s_baked_cap ? s_baked_cap : 4096;
+        while(cap < end)
+            cap *= 2;
+        cap = cap < s_palette_max ? cap : s_palette_max;
+
+        GLuint VBO;
+        glGenBuffers(1, &VBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, cap * sizeof(mat4x4_t), NULL, GL_STATIC_DRAW);
+
+        if(s_baked_VBO) {
+            glBindBuffer(GL_COPY_READ_BUFFER, s_baked_VBO);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 
+                args->base * sizeof(mat4x4_t));
+            glDeleteBuffers(1, &s_baked_VBO);
+        }
 
-    shader_prog = R_Shader_GetProgForName(shader_name);
-    glUseProgram(shader_prog);
+        s_baked_VBO = VBO;
+        s_baked_cap = cap;
 
-    loc = glGetUniformLocation(shader_prog, GL_U_VIEW_POS);
-    glUniform3fv(loc, 1, pos->raw);
+        glActiveTexture(GL_TEXTURE0 + SHADER_ANIM_BAKED_TUNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, s_baked_tex);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, s_baked_VBO);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, s_baked_VBO);
+    glBufferSubData(GL_TEXTURE_BUFFER, args->base * sizeof(mat4x4_t), 
+        args->count * sizeof(mat4x4_t), args + 1);
+}
+
+static void r_gl_dump_framebuffer_exec(const void *arg)
+{
+    const struct dump_args *args = arg;
+    int width = args->width, height = args->height;
+
+    long img_size = width * height * 3;
+    unsigned char *data = malloc(img_size);
+    if(!data) {
+        return;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, data);
+
+    FILE *file = fopen(args->filename, "wb");
+    if(!file) {
+        free(data); 
+        return;
+    }
+
+    fprintf(file, "P6\n%d %d\n%d\n", width, height, 255);
+    for(int i = 0; i < height; i++) {
+        for(int j = 0; j < width; j++) {
+
+            static unsigned char color[3];
+            color[0] = data[3*i*width + 3*j    ];
+            color[1] = data[3*i*width + 3*j + 1];
+            color[2] = data[3*i*width + 3*j + 2];
+            fwrite(color, 1, 3, file);
+        }
+    }
+
+    fclose(file);
+    free(data);
+}
+
+static vec3_t r_gl_xform(const mat4x4_t *model, vec3_t pos)
+{
+    vec4_t homo = (vec4_t){pos.x, pos.y, pos.z, 1.0f};
+    vec4_t ret;
+    PFM_Mat4x4_Mult4x1(model, &homo, &ret);
+    return (vec3_t){ret.x / ret.w, ret.y / ret.w, ret.z / ret.w};
 }
 
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
+void R_GL_DrawMesh(const struct mesh *mesh, size_t instances)
+{
+    if(mesh->EBO && instances == 1) {
+        glDrawElements(GL_TRIANGLES, mesh->num_indices, mesh->index_type, (void*)0);
+    }else if(mesh->EBO) {
+        glDrawElementsInstanced(GL_TRIANGLES, mesh->num_indices, mesh->index_type, (void*)0, instances);
+    }else if(instances == 1) {
+        glDrawArrays(GL_TRIANGLES, 0, mesh->num_verts);
+    }else{
+        glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->num_verts, instances);
+    }
+    R_GL_StatsDraw((mesh->EBO ? mesh->num_indices : mesh->num_verts) * instances);
+}
+
 void R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff)
 {
+    R_Thread_Claim();
+
     struct mesh *mesh = &priv->mesh;
+    r_gl_init_begin(priv, shader);
 
-    glGenVertexArrays(1, &mesh->VAO);
-    glBindVertexArray(mesh->VAO);
+    /* Terrain is updated and patched in place a tile at a time, relying on 
+     * each tile owning a fixed range of the vertex buffer, so it is not indexed. */
+    if(mesh->layout == VERT_LAYOUT_TERRAIN || !r_gl_init_indexed(mesh, vbuff)) {
 
-    glGenBuffers(1, &mesh->VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
-    glBufferData(GL_ARRAY_BUFFER, mesh->num_verts * sizeof(struct vertex), vbuff, GL_STATIC_DRAW);
-
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, uv));
-    glEnableVertexAttribArray(1);
-
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, normal));
-    glEnableVertexAttribArray(2);
-
-    /* Attribute 3 - material index */
-    glVertexAttribIPointer(3, 1, GL_INT, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, material_idx));
-    glEnableVertexAttribArray(3);
-
-    if(0 == strcmp("mesh.animated.textured-phong", shader)) {
-
-        /* Here, we use 2 attributes to pass in an array of size 6 since we are 
-         * limited to a maximum of 4 components per attribute. */
-
-        /* Attribute 4/5 - joint indices */
-        glVertexAttribPointer(4, 3, GL_INT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, joint_indices));
-        glEnableVertexAttribArray(4);  
-        glVertexAttribPointer(5, 3, GL_INT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, joint_indices) + 3*sizeof(GLint));
-        glEnableVertexAttribArray(6);  
-
-        /* Attribute 6/7 - joint weights */
-        glVertexAttribPointer(6, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, weights));
-        glEnableVertexAttribArray(6);  
-        glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex),
-            (void*)offsetof(struct vertex, weights) + 3*sizeof(GLfloat));
-        glEnableVertexAttribArray(7);  
-
-    }else if(0 == strcmp("terrain", shader)) {
-
-        /* Attribute 4 - tile texture blend mode */
-        glVertexAttribIPointer(4, 1, GL_INT, sizeof(struct vertex), 
-            (void*)offsetof(struct vertex, blend_mode));
-        glEnableVertexAttribArray(4);
-         
-        /* Attribute 5 - adjacent material indices */
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(struct vertex), 
-            (void*)offsetof(struct vertex, adjacent_mat_indices));
-        glEnableVertexAttribArray(5);
+        /* Pack the vertices straight into the buffer's storage */
+        glBufferData(GL_ARRAY_BUFFER, mesh->num_verts * R_Vert_Size(mesh->layout), NULL, GL_STATIC_DRAW);
+
+        void *packed = glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+        assert(packed);
+        R_Vert_Pack(mesh->layout, vbuff, packed, mesh->num_verts);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
     }
 
-    priv->shader_prog = R_Shader_GetProgForName(shader);
+    r_gl_init_end(priv, shader);
 }
 
-void R_GL_Draw(const void *render_private, mat4x4_t *model)
+void R_GL_InitPacked(struct render_private *priv, const char *shader, const struct mesh_data *data)
 {
-    const struct render_private *priv = render_private;
-    GLuint loc;
+    R_Thread_Claim();
 
-    glUseProgram(priv->shader_prog);
+    r_gl_init_begin(priv, shader);
+    r_gl_upload_mesh(&priv->mesh, data);
+    r_gl_init_end(priv, shader);
+}
 
-    loc = glGetUniformLocation(priv->shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
+void R_GL_Free(struct render_private *priv)
+{
+    struct mesh *mesh = &priv->mesh;
+    GLuint buffers[] = {mesh->VBO, mesh->EBO, mesh->instance_VBO, mesh->instance_palette_VBO};
+    R_Thread_Claim();
 
-    r_gl_set_materials(priv->shader_prog, priv->num_materials, priv->materials);
+    /* Deleting the name 0 is silently ignored */
+    glDeleteBuffers(ARR_SIZE(buffers), buffers);
+    glDeleteVertexArrays(1, &mesh->VAO);
+    MEM_Untrack(MEM_TAG_GL_BUFFERS, r_gl_mesh_size(mesh));
+}
+
+void R_GL_SetMaterials(const struct render_private *priv, GLuint shader_prog)
+{
+    if(priv->material_base >= 0) {
+        GLuint bound[SHADER_MAX_TEXTURE_PAGES] = {0};
+        R_GL_MaterialsBind(priv, shader_prog, bound);
+        return;
+    }
+
+    r_gl_set_materials(shader_prog, priv->num_materials, priv->materials);
 
     for(int i = 0; i < priv->num_materials; i++) {
-        R_Texture_GL_Activate(&priv->materials[i].texture, priv->shader_prog);
+        R_Texture_GL_Activate(&priv->materials[i].texture, shader_prog);
     }
+}
 
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+void R_GL_UploadInstances(const struct render_private *priv, const mat4x4_t *models, 
+                          const struct pose_ref *poses, size_t count)
+{
+    assert(priv->mesh.instance_VBO);
+
+    /* Orphan the previous contents so that the driver doesn't have to wait 
+     * on the draws still using them */
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.instance_VBO);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(mat4x4_t), models);
+
+    if(!priv->mesh.instance_palette_VBO)
+        return;
+
+    assert(poses);
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.instance_palette_VBO);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(struct pose_ref), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(struct pose_ref), poses);
 }
 
-void R_GL_SetViewMatAndPos(const mat4x4_t *view, const vec3_t *pos)
+void R_GL_DrawPriv(const struct render_private *priv, const mat4x4_t *model, 
+                  const struct pose_ref *pose)
+{
+    r_gl_draw(priv, model, pose);
+}
+
+void R_GL_Draw(const void *render_private, mat4x4_t *model)
 {
-    const char *shaders[] = {
-        "mesh.static.colored",
-        "mesh.static.colored-per-vert",
-        "mesh.static.textured",
-        "mesh.static.textured-phong",
-        "mesh.static.tile-outline",
-        "mesh.static.normals.colored",
-        "mesh.animated.textured-phong",
-        "mesh.animated.normals.colored",
-        "terrain",
-        "terrain-baked",
+    struct draw_args args = {
+        .priv = render_private,
+        .model = *model,
+        .pose = s_pose,
+        .normals = false
     };
+    R_Thread_Push(r_gl_draw_exec, &args, sizeof(args));
+}
 
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
+void R_GL_DrawInstanced(const void *render_private, const mat4x4_t *models, size_t count)
+{
+    const struct render_private *priv = render_private;
 
-        r_gl_set_view(view, shaders[i]);
-        r_gl_set_view_pos(pos, shaders[i]);
+    /* All the copies share the current pose, so there is nothing to gain 
+     * from drawing skinned meshes instanced here */
+    if(!priv->mesh.instance_VBO || priv->mesh.instance_palette_VBO) {
+        for(int i = 0; i < count; i++)
+            R_GL_Draw(render_private, (mat4x4_t*)&models[i]);
+        return;
     }
+
+    size_t size = sizeof(struct instanced_args) + count * sizeof(mat4x4_t);
+    struct instanced_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(!args)
+        return;
+
+    args->priv = priv;
+    args->count = count;
+    memcpy(args + 1, models, count * sizeof(mat4x4_t));
+    R_Thread_Push(r_gl_draw_instanced_exec, args, size);
+}
+
+void R_GL_GlobalsInit(void)
+{
+    struct globals init = {0};
+    PFM_Mat4x4_Identity(&init.view);
+    PFM_Mat4x4_Identity(&init.projection);
+    s_globals_ubo = r_gl_make_globals_ubo(&init);
+
+    PFM_Mat4x4_MakeOrthographic(0.0f, CONFIG_RES_X, CONFIG_RES_Y, 0.0f, -1.0f, 1.0f, &init.projection);
+    s_screen_globals_ubo = r_gl_make_globals_ubo(&init);
+
+    PFM_Mat4x4_Identity(&init.projection);
+    s_light_globals_ubo = r_gl_make_globals_ubo(&init);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_GLOBALS_BINDING, s_globals_ubo);
+}
+
+void R_GL_BeginScreenspace(void)
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_GLOBALS_BINDING, s_screen_globals_ubo);
+}
+
+void R_GL_EndScreenspace(void)
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_GLOBALS_BINDING, s_globals_ubo);
+}
+
+void R_GL_BeginLightspace(const mat4x4_t *view, const mat4x4_t *proj)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, s_light_globals_ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetof(struct globals, view), sizeof(*view), view);
+    glBufferSubData(GL_UNIFORM_BUFFER, offsetof(struct globals, projection), sizeof(*proj), proj);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_GLOBALS_BINDING, s_light_globals_ubo);
+}
+
+void R_GL_EndLightspace(void)
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_GLOBALS_BINDING, s_globals_ubo);
+}
+
+void R_GL_SetViewMatAndPos(const mat4x4_t *view, const vec3_t *pos)
+{
+    r_gl_set_globals(offsetof(struct globals, view), view, sizeof(*view));
+    r_gl_set_globals(offsetof(struct globals, view_pos), pos, sizeof(*pos));
 }
 
 void R_GL_SetProj(const mat4x4_t *proj)
 {
-    const char *shaders[] = {
-        "mesh.static.colored",
-        "mesh.static.colored-per-vert",
-        "mesh.static.textured",
-        "mesh.static.textured-phong",
-        "mesh.static.tile-outline",
-        "mesh.static.normals.colored",
-        "mesh.animated.textured-phong",
-        "mesh.animated.normals.colored",
-        "terrain",
-        "terrain-baked",
-    };
+    r_gl_set_globals(offsetof(struct globals, projection), proj, sizeof(*proj));
+}
 
-    for(int i = 0; i < ARR_SIZE(shaders); i++)
-        r_gl_set_proj(proj, shaders[i]);
+void R_GL_AnimPaletteInit(void)
+{
+    GLint max_texels;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    /* Each matrix takes up 4 RGBA texels */
+    s_palette_max = max_texels / 4;
+
+    glGenBuffers(1, &s_palette_VBO);
+    glGenTextures(1, &s_palette_tex);
+
+    glBindBuffer(GL_TEXTURE_BUFFER, s_palette_VBO);
+    glActiveTexture(GL_TEXTURE0 + SHADER_ANIM_PALETTE_TUNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, s_palette_tex);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, s_palette_VBO);
+
+    /* The baked palette's buffer is attached once the first clip is baked */
+    glGenTextures(1, &s_baked_tex);
+    glActiveTexture(GL_TEXTURE0 + SHADER_ANIM_BAKED_TUNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, s_baked_tex);
+    glActiveTexture(GL_TEXTURE0);
+
+    s_palette_offsets = kh_init(palette);
 }
 
-void R_GL_SetAnimUniforms(mat4x4_t *inv_bind_poses, mat4x4_t *curr_poses, size_t count)
+struct pose_ref R_GL_AnimPose(void)
 {
-    const char *shaders[] = {
-        "mesh.animated.textured-phong",
-        "mesh.animated.normals.colored",
-    };
+    return s_pose;
+}
 
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
+void R_GL_SetPoseUniforms(GLuint shader_prog, const struct pose_ref *pose)
+{
+    GLint loc = R_Shader_UniformLoc(shader_prog, SU_ANIM_PALETTE_BASES);
+    if(loc >= 0)
+        glUniform2iv(loc, 1, pose->bases);
 
-        r_gl_set_uniform_mat4x4_array(inv_bind_poses, count, GL_U_INV_BIND_MATS, shaders[i]);
-        r_gl_set_uniform_mat4x4_array(curr_poses, count, GL_U_CURR_POSE_MATS, shaders[i]);
-    }
+    loc = R_Shader_UniformLoc(shader_prog, SU_ANIM_PALETTE_BLEND);
+    if(loc >= 0)
+        glUniform1f(loc, pose->blend);
+
+    loc = R_Shader_UniformLoc(shader_prog, SU_ANIM_PALETTE_BAKED);
+    if(loc >= 0)
+        glUniform1i(loc, pose->baked);
 }
 
-void R_GL_SetAmbientLightColor(vec3_t color)
+void R_GL_AnimPaletteSync(void)
 {
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.animated.textured-phong",
-        "terrain",
-        "terrain-baked",
-    };
+    size_t size = kv_size(s_palette);
+    if(s_palette_uploaded == size)
+        return;
 
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-    
-        GLuint loc, shader_prog;
+    glBindBuffer(GL_TEXTURE_BUFFER, s_palette_VBO);
 
-        shader_prog = R_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
+    if(size > s_palette_cap) {
 
-        loc = glGetUniformLocation(shader_prog, GL_U_AMBIENT_COLOR);
-        glUniform3fv(loc, 1, color.raw);
+        /* Re-allocating the storage discards whatever was already uploaded */
+        s_palette_cap = size * 2 < s_palette_max ? size * 2 : s_palette_max;
+        s_palette_uploaded = 0;
+        glBufferData(GL_TEXTURE_BUFFER, s_palette_cap * sizeof(mat4x4_t), NULL, GL_STREAM_DRAW);
     }
+
+    glBufferSubData(GL_TEXTURE_BUFFER, s_palette_uploaded * sizeof(mat4x4_t), 
+        (size - s_palette_uploaded) * sizeof(mat4x4_t), &kv_A(s_palette, s_palette_uploaded));
+    s_palette_uploaded = size;
 }
 
-void R_GL_SetLightEmitColor(vec3_t color)
+void R_GL_BeginFrame(void)
 {
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.animated.textured-phong",
-        "terrain",
-        "terrain-baked",
-    };
-
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
-    
-        GLuint loc, shader_prog;
+    /* The palette is only filled in while recording and read back by the 
+     * recorded draws, and the two never overlap, so it needs no copy */
+    kv_reset(s_palette);
+    kh_clear(palette, s_palette_offsets);
+    s_pose = (struct pose_ref){{-1, -1}, 0.0f};
+    R_GL_PreskinBeginFrame();
+
+    R_GL_StatsBeginFrame();
+    R_Thread_Push(r_gl_begin_frame_exec, NULL, 0);
+}
 
-        shader_prog = R_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
+void R_GL_SetAnimPose(const mat4x4_t *from_skin_mats, const mat4x4_t *to_skin_mats, 
+                      float blend, size_t count)
+{
+    GLint from = r_gl_palette_add(from_skin_mats, count);
+    GLint to = r_gl_palette_add(to_skin_mats, count);
 
-        loc = glGetUniformLocation(shader_prog, GL_U_LIGHT_COLOR);
-        glUniform3fv(loc, 1, color.raw);
+    if(from < 0 || to < 0) {
+        s_pose = (struct pose_ref){{-1, -1}, 0.0f};
+        return;
     }
+    s_pose = (struct pose_ref){{from, to}, blend};
 }
 
-void R_GL_SetLightPos(vec3_t pos)
+int R_GL_AnimBake(const mat4x4_t *skin_mats, size_t count)
 {
-    const char *shaders[] = {
-        "mesh.static.textured-phong",
-        "mesh.animated.textured-phong",
-        "terrain",
-        "terrain-baked",
-    };
+    if(s_baked_size + count > s_palette_max)
+        return -1;
 
-    for(int i = 0; i < ARR_SIZE(shaders); i++) {
+    size_t size = sizeof(struct bake_args) + count * sizeof(mat4x4_t);
+    struct bake_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(!args)
+        return -1;
 
-        GLuint loc, shader_prog;
-    
-        shader_prog = R_Shader_GetProgForName(shaders[i]);
-        glUseProgram(shader_prog);
+    args->base = s_baked_size;
+    args->count = count;
+    memcpy(args + 1, skin_mats, count * sizeof(mat4x4_t));
+    R_Thread_Push(r_gl_bake_exec, args, size);
 
-        loc = glGetUniformLocation(shader_prog, GL_U_LIGHT_POS);
-        glUniform3fv(loc, 1, pos.raw);
-    }
+    s_baked_size += count;
+    return args->base;
+}
+
+void R_GL_SetBakedAnimPose(int from, int to, float blend)
+{
+    s_pose = (struct pose_ref){{from, to}, blend, true};
+}
+
+void R_GL_SetAmbientLightColor(vec3_t color)
+{
+    s_light.ambient_color = color;
+    r_gl_set_globals(offsetof(struct globals, ambient_color), &color, sizeof(color));
+}
+
+void R_GL_SetLightEmitColor(vec3_t color)
+{
+    s_light.light_color = color;
+    r_gl_set_globals(offsetof(struct globals, light_color), &color, sizeof(color));
+}
+
+void R_GL_SetLightPos(vec3_t pos)
+{
+    s_light.light_pos = pos;
+    r_gl_set_globals(offsetof(struct globals, light_pos), &pos, sizeof(pos));
+    R_GL_ShadowSetLight(pos);
+}
+
+uint64_t R_GL_HashLighting(uint64_t hash)
+{
+    hash = R_BakeCache_Hash(hash, s_light.ambient_color.raw, sizeof(s_light.ambient_color.raw));
+    hash = R_BakeCache_Hash(hash, s_light.light_color.raw, sizeof(s_light.light_color.raw));
+    hash = R_BakeCache_Hash(hash, s_light.light_pos.raw, sizeof(s_light.light_pos.raw));
+    return hash;
 }
 
 void R_GL_DrawSkeleton(const struct entity *ent, const struct skeleton *skel, const struct camera *cam)
 {
-    vec3_t *vbuff;
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
     vec4_t green = (vec4_t){0.0f, 1.0f, 0.0f, 1.0f};
 
     mat4x4_t model;
     Entity_ModelMatrix(ent, &model);
 
-    /* Our vbuff looks like this:
-     * +----------------+-------------+--------------+-----
-     * | joint root 0   | joint tip 0 | joint root 1 | ...
-     * +----------------+-------------+--------------+-----
-     */
-    vbuff = calloc(skel->num_joints * 2, sizeof(vec3_t));
+    /* Each joint is a line from its root to its tip, with points at both ends */
+    struct colored_vert *lines = R_GL_DebugReserve(GL_LINES, 1.0f, skel->num_joints * 2);
+    struct colored_vert *points = R_GL_DebugReserve(GL_POINTS, 5.0f, skel->num_joints * 2);
+    if(!lines || !points)
+        return;
 
     for(int i = 0, vbuff_idx = 0; i < skel->num_joints; i++, vbuff_idx +=2) {
 
         struct joint *curr = &skel->joints[i];
-        struct SQT *sqt = &skel->bind_sqts[i];
-
-        vec4_t homo = (vec4_t){0.0f, 0.0f, 0.0f, 1.0f}; 
-        vec4_t result;
 
         mat4x4_t bind_pose;
         PFM_Mat4x4_Inverse(&skel->inv_bind_poses[i], &bind_pose);
 
-        /* The root of the bone in object space */
-        PFM_Mat4x4_Mult4x1(&bind_pose, &homo, &result);
-        vbuff[vbuff_idx] = (vec3_t){result.x, result.y ,result.z};
-    
-        /* The tip of the bone in object space */
-        homo = (vec4_t){curr->tip.x, curr->tip.y, curr->tip.z, 1.0f}; 
-        PFM_Mat4x4_Mult4x1(&bind_pose, &homo, &result);
-        vbuff[vbuff_idx + 1] = (vec3_t){result.x, result.y ,result.z};
+        /* The root and the tip of the bone in object space */
+        vec3_t root = r_gl_xform(&bind_pose, (vec3_t){0.0f, 0.0f, 0.0f});
+        vec3_t tip = r_gl_xform(&bind_pose, curr->tip);
+
+        lines[vbuff_idx] = (struct colored_vert){r_gl_xform(&model, root), green};
+        lines[vbuff_idx + 1] = (struct colored_vert){r_gl_xform(&model, tip), green};
+        points[vbuff_idx] = lines[vbuff_idx];
+        points[vbuff_idx + 1] = lines[vbuff_idx + 1];
 
         /* Lastly, render a label with the joint's name at the root position */
         if(!cam)
             continue;
 
-        mat4x4_t view, proj;
-        Camera_MakeViewMat(cam, &view); 
-        Camera_MakeProjMat(cam, &proj);
+        const struct camera_state *state = Camera_GetState(cam);
 
-        vec4_t root_homo = {vbuff[vbuff_idx].x, vbuff[vbuff_idx].y, vbuff[vbuff_idx].z, 1.0f};
-        vec4_t clip, tmpa, tmpb;
-        PFM_Mat4x4_Mult4x1(&model, &root_homo, &tmpa);
-        PFM_Mat4x4_Mult4x1(&view, &tmpa, &tmpb);
-        PFM_Mat4x4_Mult4x1(&proj, &tmpb, &clip);
+        vec3_t root_ws = lines[vbuff_idx].pos;
+        vec4_t root_homo = {root_ws.x, root_ws.y, root_ws.z, 1.0f};
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1((mat4x4_t*)&state->view_proj, &root_homo, &clip);
         vec3_t ndc = (vec3_t){ clip.x / clip.w, clip.y / clip.w, clip.z / clip.w };
 
         float screen_x = (ndc.x + 1.0f) * CONFIG_RES_X/2.0f;
         float screen_y = CONFIG_RES_Y - ((ndc.y + 1.0f) * CONFIG_RES_Y/2.0f);
         UI_DrawText(curr->name, (struct rect){screen_x, screen_y, 100, 25}, (struct rgba){0, 255, 0, 255});
     }
- 
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, skel->num_joints * sizeof(vec3_t) * 2, vbuff, GL_STATIC_DRAW);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, green.raw);
-
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
-
-    glPointSize(5.0f);
-
-    glDrawArrays(GL_POINTS, 0, skel->num_joints * 2);
-    glDrawArrays(GL_LINES, 0, skel->num_joints * 2);
-
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    free(vbuff);
 }
 
 void R_GL_DrawOrigin(const void *render_private, mat4x4_t *model)
 {
-    vec3_t vbuff[2];
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-
     vec4_t red   = (vec4_t){1.0f, 0.0f, 0.0f, 1.0f};
     vec4_t green = (vec4_t){0.0f, 1.0f, 0.0f, 1.0f};
     vec4_t blue  = (vec4_t){0.0f, 0.0f, 1.0f, 1.0f};
 
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
-
-    /* Set line width */
-    GLfloat old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(3.0f);
-
-    /* Render the 3 axis lines at the origin */
-    vbuff[0] = (vec3_t){0.0f, 0.0f, 0.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-
-    for(int i = 0; i < 3; i++) {
-
-        switch(i) {
-        case 0:
-            vbuff[1] = (vec3_t){1.0f, 0.0f, 0.0f}; 
-            glUniform4fv(loc, 1, red.raw);
-            break;
-        case 1:
-            vbuff[1] = (vec3_t){0.0f, 1.0f, 0.0f}; 
-            glUniform4fv(loc, 1, green.raw);
-            break;
-        case 2:
-            vbuff[1] = (vec3_t){0.0f, 0.0f, 1.0f}; 
-            glUniform4fv(loc, 1, blue.raw);
-            break;
-        }
-    
-        glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-        glDrawArrays(GL_LINES, 0, 2);
-    }
-    glLineWidth(old_width);
-
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    /* The 3 axis lines at the origin */
+    vec3_t origin = r_gl_xform(model, (vec3_t){0.0f, 0.0f, 0.0f});
+    R_GL_DebugLine(origin, r_gl_xform(model, (vec3_t){1.0f, 0.0f, 0.0f}), red,   3.0f);
+    R_GL_DebugLine(origin, r_gl_xform(model, (vec3_t){0.0f, 1.0f, 0.0f}), green, 3.0f);
+    R_GL_DebugLine(origin, r_gl_xform(model, (vec3_t){0.0f, 0.0f, 1.0f}), blue,  3.0f);
 }
 
 void R_GL_DrawRay(vec3_t origin, vec3_t dir, mat4x4_t *model, vec3_t color, float t)
 {
-    vec3_t vbuff[2];
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-
-    vbuff[0] = origin; 
+    vec3_t end;
     PFM_Vec3_Normal(&dir, &dir);
     PFM_Vec3_Scale(&dir, t, &dir);
-    PFM_Vec3_Add(&origin, &dir, &vbuff[1]);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
+    PFM_Vec3_Add(&origin, &dir, &end);
 
     vec4_t color4 = (vec4_t){color.x, color.y, color.z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, color4.raw);
-
-    GLfloat old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(5.0f);
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, 2 * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, 2);
-
-cleanup:
-    glLineWidth(old_width);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    R_GL_DebugLine(r_gl_xform(model, origin), r_gl_xform(model, end), color4, 5.0f);
 }
 
 void R_GL_DrawOBB(const struct entity *ent)
@@ -571,9 +930,6 @@ void R_GL_DrawOBB(const struct entity *ent)
     if(!(ent->flags & ENTITY_FLAG_COLLISION))
         return;
 
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
     vec4_t blue = (vec4_t){0.0f, 0.0f, 1.0f, 1.0f};
 
     const struct aabb *aabb;
@@ -585,7 +941,7 @@ void R_GL_DrawOBB(const struct entity *ent)
     mat4x4_t model;
     Entity_ModelMatrix(ent, &model);
 
-    vec3_t vbuff[24] = {
+    const vec3_t corners[8] = {
         [0] = {aabb->x_min, aabb->y_min, aabb->z_min},
         [1] = {aabb->x_min, aabb->y_min, aabb->z_max},
         [2] = {aabb->x_min, aabb->y_max, aabb->z_min},
@@ -595,58 +951,23 @@ void R_GL_DrawOBB(const struct entity *ent)
         [6] = {aabb->x_max, aabb->y_max, aabb->z_min},
         [7] = {aabb->x_max, aabb->y_max, aabb->z_max},
     };
-    vbuff[8 ] = vbuff[0];
-    vbuff[9 ] = vbuff[2];
-    vbuff[10] = vbuff[1];
-    vbuff[11] = vbuff[3];
-    vbuff[12] = vbuff[4];
-    vbuff[13] = vbuff[6];
-    vbuff[14] = vbuff[5];
-    vbuff[15] = vbuff[7];
-    vbuff[16] = vbuff[0];
-    vbuff[17] = vbuff[4];
-    vbuff[18] = vbuff[1];
-    vbuff[19] = vbuff[5];
-    vbuff[20] = vbuff[2];
-    vbuff[21] = vbuff[6];
-    vbuff[22] = vbuff[3];
-    vbuff[23] = vbuff[7];
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
-
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, blue.raw);
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, ARR_SIZE(vbuff));
-
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    /* The 12 edges, as pairs of corners */
+    const int edges[24] = {
+        0, 1,  2, 3,  4, 5,  6, 7,
+        0, 2,  1, 3,  4, 6,  5, 7,
+        0, 4,  1, 5,  2, 6,  3, 7,
+    };
+
+    struct colored_vert *vbuff = R_GL_DebugReserve(GL_LINES, 1.0f, ARR_SIZE(edges));
+    if(!vbuff)
+        return;
+
+    for(int i = 0; i < ARR_SIZE(edges); i++)
+        vbuff[i] = (struct colored_vert){r_gl_xform(&model, corners[edges[i]]), blue};
 }
 
 void R_GL_DrawBox2D(vec2_t screen_pos, vec2_t signed_size, vec3_t color, float width)
 {
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-
     vec3_t vbuff[4] = {
         (vec3_t){screen_pos.x,                 screen_pos.y,                 0.0f},
         (vec3_t){screen_pos.x + signed_size.x, screen_pos.y,                 0.0f},
@@ -654,187 +975,48 @@ void R_GL_DrawBox2D(vec2_t screen_pos, vec2_t signed_size, vec3_t color, float w
         (vec3_t){screen_pos.x,                 screen_pos.y + signed_size.y, 0.0f},
     };
 
-    /* Set view and projection matrices for rendering in screen coordinates */
-    mat4x4_t ortho;
-    PFM_Mat4x4_MakeOrthographic(0.0f, CONFIG_RES_X, CONFIG_RES_Y, 0.0f, -1.0f, 1.0f, &ortho);
-    R_GL_SetProj(&ortho);
-
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
-    vec3_t dummy_pos = (vec3_t){0.0f};
-    R_GL_SetViewMatAndPos(&identity, &dummy_pos);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
+    struct stream_draw draw = {
+        .shader = "mesh.static.colored",
+        .fmt = STREAM_FMT_POS,
+        .screenspace = true,
+    };
+    PFM_Mat4x4_Identity(&draw.model);
 
     vec4_t color4 = (vec4_t){color.x, color.y, color.z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, color4.raw);
-
-    float old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(width);
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINE_LOOP, 0, ARR_SIZE(vbuff));
-
-    glLineWidth(old_width);
-
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    const struct stream_range range = {GL_LINE_LOOP, 0, ARR_SIZE(vbuff), color4, width, 0.0f};
+    R_GL_StreamDraw(&draw, &range, 1, vbuff, ARR_SIZE(vbuff));
 }
 
 void R_GL_DrawNormals(const void *render_private, mat4x4_t *model, bool anim)
 {
-    const struct render_private *priv = render_private;
-
-
-    GLuint normals_shader = anim ? R_Shader_GetProgForName("mesh.animated.normals.colored")
-                                 : R_Shader_GetProgForName("mesh.static.normals.colored");
-    assert(normals_shader);
-    glUseProgram(normals_shader);
-
-    GLuint loc;
-    vec4_t yellow = (vec4_t){1.0f, 1.0f, 0.0f, 1.0f};
-
-    loc = glGetUniformLocation(normals_shader, GL_U_COLOR);
-    glUniform4fv(loc, 1, yellow.raw);
-
-    loc = glGetUniformLocation(normals_shader, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
-
-    glBindVertexArray(priv->mesh.VAO);
-    glDrawArrays(GL_TRIANGLES, 0, priv->mesh.num_verts);
+    struct draw_args args = {
+        .priv = render_private,
+        .model = *model,
+        .pose = s_pose,
+        .normals = true,
+        .anim = anim
+    };
+    R_Thread_Push(r_gl_draw_exec, &args, sizeof(args));
 }
 
 void R_GL_DumpFramebuffer_PPM(const char *filename, int width, int height)
 {
-    long img_size = width * height * 3;
-    unsigned char *data = malloc(img_size);
-    if(!data) {
-        return;
-    }
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-    FILE *file = fopen(filename, "wb");
-    if(!file) {
-        free(data); 
-        return;
-    }
-
-    fprintf(file, "P6\n%d %d\n%d\n", width, height, 255);
-    for(int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++) {
+    struct dump_args args = {.width = width, .height = height};
+    strncpy(args.filename, filename, sizeof(args.filename));
+    args.filename[sizeof(args.filename)-1] = '\0';
 
-            static unsigned char color[3];
-            color[0] = data[3*i*width + 3*j    ];
-            color[1] = data[3*i*width + 3*j + 1];
-            color[2] = data[3*i*width + 3*j + 2];
-            fwrite(color, 1, 3, file);
-        }
-    }
-
-    fclose(file);
-    free(data);
-}
-
-void R_GL_DrawSelectionCircle(vec2_t xz, float radius, float width, vec3_t color, 
-                              const struct map *map)
-{
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-
-    const int NUM_SAMPLES = 48;
-    vec3_t vbuff[NUM_SAMPLES * 2 + 2];
-
-    for(int i = 0; i < NUM_SAMPLES * 2; i += 2) {
-
-        float theta = (2.0f * M_PI) * ((float)i/NUM_SAMPLES);
-
-        float x_near = xz.raw[0] + radius * cos(theta);
-        float z_near = xz.raw[1] - radius * sin(theta);
-
-        float x_far = xz.raw[0] + (radius + width) * cos(theta);
-        float z_far = xz.raw[1] - (radius + width) * sin(theta);
-    
-        float height_near = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, (vec2_t){x_near, z_near}));
-        float height_far  = M_HeightAtPoint(map, M_ClampedMapCoordinate(map, (vec2_t){x_far,  z_far }));
-
-        vbuff[i]     = (vec3_t){x_near, height_near + 0.0f, z_near};
-        vbuff[i + 1] = (vec3_t){x_far,  height_far + 0.1,   z_far };
-    }
-    vbuff[NUM_SAMPLES * 2]     = vbuff[0];
-    vbuff[NUM_SAMPLES * 2 + 1] = vbuff[1];
-
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
-
-    vec4_t color4 = (vec4_t){color.x, color.y, color.z, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, color4.raw);
-
-    float old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(width);
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(vbuff) * sizeof(vec3_t), vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, ARR_SIZE(vbuff));
-
-    glLineWidth(old_width);
-
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    R_Thread_Push(r_gl_dump_framebuffer_exec, &args, sizeof(args));
 }
 
 void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count, mat4x4_t *model, const struct map *map)
 {
-    struct colored_vert surf_vbuff[count * 4 * 3];
-    struct colored_vert line_vbuff[count * 4 * 2];
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
+    if(!count)
+        return;
 
-    vec2_t *corners_base = xz_corners;
-    struct colored_vert *surf_vbuff_base = surf_vbuff;
-    struct colored_vert *line_vbuff_base = line_vbuff;
+    struct colored_vert *surf_vbuff_base = R_GL_DebugReserve(GL_TRIANGLES, 0.0f, count * 4 * 3);
+    struct colored_vert *line_vbuff_base = R_GL_DebugReserve(GL_LINES, 3.0f, count * 4 * 2);
+    if(!surf_vbuff_base || !line_vbuff_base)
+        return;
 
     for(int i = 0; i < count; i++, xz_corners += 4, colors++) {
 
@@ -852,18 +1034,13 @@ void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count,
         vec3_t verts_3d[5];
 
         for(int i = 0; i < ARR_SIZE(verts); i++) {
-            vec4_t xz_homo = (vec4_t){verts[i].raw[0], 0.0f, verts[i].raw[1], 1.0f};
-            vec4_t ws_xz_homo;
-            PFM_Mat4x4_Mult4x1(model, &xz_homo, &ws_xz_homo);
-            ws_xz_homo.x /= ws_xz_homo.w;
-            ws_xz_homo.z /= ws_xz_homo.w;
-            verts_3d[i] = (vec3_t){
+            vec3_t ws_xz = r_gl_xform(model, (vec3_t){verts[i].raw[0], 0.0f, verts[i].raw[1]});
+            verts_3d[i] = r_gl_xform(model, (vec3_t){
                 verts[i].raw[0], 
-                M_HeightAtPoint(map, (vec2_t){ws_xz_homo.x, ws_xz_homo.z}) + 0.1, 
+                M_HeightAtPoint(map, (vec2_t){ws_xz.x, ws_xz.z}) + 0.1, 
                 verts[i].raw[1]
-            };
+            });
         }
-        verts_3d[5] = verts_3d[1];
 
         vec4_t surf_color = (vec4_t){colors->x, colors->y, colors->z, 0.25};
         vec4_t line_color = (vec4_t){colors->x, colors->y, colors->z, 0.75};
@@ -898,68 +1075,19 @@ void R_GL_DrawMapOverlayQuads(vec2_t *xz_corners, vec3_t *colors, size_t count,
         *line_vbuff_base++ = (struct colored_vert){verts_3d[4], line_color};
         *line_vbuff_base++ = (struct colored_vert){verts_3d[1], line_color};
     }
-    
-    assert(surf_vbuff_base == surf_vbuff + ARR_SIZE(surf_vbuff));
-    assert(line_vbuff_base == line_vbuff + ARR_SIZE(line_vbuff));
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
-        (void*)offsetof(struct colored_vert, pos));
-    glEnableVertexAttribArray(0);  
-
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
-        (void*)offsetof(struct colored_vert, color));
-    glEnableVertexAttribArray(1);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored-per-vert");
-    glUseProgram(shader_prog);
-
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
-
-    vec4_t color4 = (vec4_t){colors[0].x, colors[0].y, colors[0].z, 0.25f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, color4.raw);
-
-    /* Render surface */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(surf_vbuff) * sizeof(struct colored_vert), surf_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_TRIANGLES, 0, ARR_SIZE(surf_vbuff));
-
-    /* Render outline */
-    GLfloat old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(3.0f);
-
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(line_vbuff) * sizeof(struct colored_vert), line_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, ARR_SIZE(line_vbuff));
-    glLineWidth(old_width);
-
-cleanup:
-    glDisable(GL_BLEND);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
 }
 
 void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t count,
                         mat4x4_t *model, const struct map *map)
 {
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-    vec3_t line_vbuff[count * 2];
-    vec3_t point_vbuff[count];
+    vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0f};
+
+    /* A line along each direction, with a point at its base */
+    struct colored_vert *line_vbuff = R_GL_DebugReserve(GL_LINES, 5.0f, count * 2);
+    struct colored_vert *point_vbuff = R_GL_DebugReserve(GL_POINTS, 10.0f, count);
+    if(!line_vbuff || !point_vbuff)
+        return;
 
-    /* Setup line_vbuff */
     for(size_t i = 0, line_vbuff_idx = 0; i < count; i++, line_vbuff_idx += 2) {
 
         vec2_t tip = xz_positions[i];
@@ -967,68 +1095,15 @@ void R_GL_DrawFlowField(vec2_t *xz_positions, vec2_t *xz_directions, size_t coun
         PFM_Vec2_Scale(&to_add, 2.5f, &to_add);
         PFM_Vec2_Add(&tip, &to_add, &tip);
 
-        vec4_t base_homo = (vec4_t){xz_positions[i].raw[0], 0.0f, xz_positions[i].raw[1], 1.0f};
-        vec4_t tip_homo = (vec4_t){tip.raw[0], 0.0f, tip.raw[1], 1.0f};
-
-        vec4_t base_ws_homo, tip_ws_homo;
+        vec3_t base_ws = r_gl_xform(model, (vec3_t){xz_positions[i].raw[0], 0.0f, xz_positions[i].raw[1]});
+        vec3_t tip_ws = r_gl_xform(model, (vec3_t){tip.raw[0], 0.0f, tip.raw[1]});
 
-        PFM_Mat4x4_Mult4x1(model, &base_homo, &base_ws_homo);
-        base_ws_homo.x /= base_ws_homo.w;
-        base_ws_homo.z /= base_ws_homo.w;
+        base_ws.y = M_HeightAtPoint(map, (vec2_t){base_ws.x, base_ws.z}) + 0.3;
+        tip_ws.y = M_HeightAtPoint(map, (vec2_t){tip_ws.x, tip_ws.z}) + 0.3;
 
-        PFM_Mat4x4_Mult4x1(model, &tip_homo, &tip_ws_homo);
-        tip_ws_homo.x /= base_ws_homo.w;
-        tip_ws_homo.z /= base_ws_homo.w;
-
-        line_vbuff[line_vbuff_idx] = (vec3_t){
-            xz_positions[i].raw[0],
-            M_HeightAtPoint(map, (vec2_t){base_ws_homo.x, base_ws_homo.z}) + 0.3, 
-            xz_positions[i].raw[1]
-        };
-        line_vbuff[line_vbuff_idx + 1] = (vec3_t){
-            tip.raw[0],
-            M_HeightAtPoint(map, (vec2_t){tip_ws_homo.x, tip_ws_homo.z}) + 0.3, 
-            tip.raw[1]
-        };
+        line_vbuff[line_vbuff_idx] = (struct colored_vert){base_ws, red};
+        line_vbuff[line_vbuff_idx + 1] = (struct colored_vert){tip_ws, red};
         point_vbuff[i] = line_vbuff[line_vbuff_idx];
     }
-
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
-    glEnableVertexAttribArray(0);  
-
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
-
-    vec4_t red = (vec4_t){1.0f, 0.0f, 0.0f, 1.0f};
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, red.raw);
-
-    GLfloat old_width;
-    glGetFloatv(GL_LINE_WIDTH, &old_width);
-    glLineWidth(5.0f);
-    glPointSize(10.0f);
-
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(line_vbuff) * sizeof(vec3_t), line_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_LINES, 0, ARR_SIZE(line_vbuff));
-
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(point_vbuff) * sizeof(vec3_t), point_vbuff, GL_STATIC_DRAW);
-    glDrawArrays(GL_POINTS, 0, ARR_SIZE(line_vbuff));
-
-cleanup:
-    glLineWidth(old_width);
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
 }
 
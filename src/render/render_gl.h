@@ -38,25 +38,481 @@
 
 #include <GL/glew.h>
 
+#include "../pf_math.h"
+
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+/* The pose of a skinned mesh, as the offsets of two samples in the frame's 
+ * joint palette and the factor to blend between them by. Offsets of -1 mean
+ * the bind pose. When 'baked' is set, the offsets are in the baked palette 
+ * instead. Also the layout of the per-instance pose attributes. */
+struct pose_ref{
+    GLint   bases[2];
+    GLfloat blend;
+    GLint   baked;
+};
+
+/* The vertex formats of the streaming buffer */
+enum stream_fmt{
+    STREAM_FMT_POS,         /* vec3_t */
+    STREAM_FMT_COLORED,     /* struct colored_vert */
+    STREAM_FMT_TERRAIN,     /* struct terrain_vert */
+    STREAM_FMT_MAX
+};
+
+/* The header of a recorded immediate-mode draw. The shader name must outlive
+ * the frame. */
+struct stream_draw{
+    const char     *shader;
+    enum stream_fmt fmt;
+    mat4x4_t        model;
+    bool            blend;
+    bool            screenspace;
+};
+
+/* A run of the draw's vertices, drawn with a single primitive type and color.
+ * Widths and sizes of 0 leave the current ones in place. */
+struct stream_range{
+    GLenum  mode;
+    GLint   first;
+    GLsizei count;
+    vec4_t  color;
+    GLfloat line_width;
+    GLfloat point_size;
+};
+
 
 struct render_private;
 struct vertex;
 struct tile;
+struct mesh;
+struct mesh_data;
+struct impostor;
+struct aabb;
 
 void R_GL_Init(struct render_private *priv, const char *shader, const struct vertex *vbuff);
+
+/* ---------------------------------------------------------------------------
+ * Like 'R_GL_Init', but for vertices that are already in the layout of the 
+ * shader (and indexed, if 'data' has indices). The data is uploaded as it is.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_InitPacked(struct render_private *priv, const char *shader, const struct mesh_data *data);
+
+/* ---------------------------------------------------------------------------
+ * Delete the GL objects created by 'R_GL_Init' or 'R_GL_InitPacked'.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_Free(struct render_private *priv);
 void R_GL_TileGetVertices(const struct tile *tile, struct vertex *out, size_t r, size_t c);
 
 /* ---------------------------------------------------------------------------
- * Patch the vertices for a particular tile to have adjacency information
- * about the neighboring tiles, to be used for smooth blending.
- * Tiles which border tiles with different materials will get blending
- * 'turned on' by setting a vertex attribute.
+ * Issue the draw call for the mesh, whose VAO must be bound, indexed or not.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_DrawMesh(const struct mesh *mesh, size_t instances);
+
+/* ---------------------------------------------------------------------------
+ * Draw the object with its own program on the calling thread, which must own
+ * the GL context. 'pose' is only read for skinned meshes.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_DrawPriv(const struct render_private *priv, const mat4x4_t *model, 
+                  const struct pose_ref *pose);
+
+/* ---------------------------------------------------------------------------
+ * Upload the object's material uniforms and bind its' textures for the 
+ * (already bound) program.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SetMaterials(const struct render_private *priv, GLuint shader_prog);
+
+/* ---------------------------------------------------------------------------
+ * Replace the contents of the object's per-instance model matrix buffer and,
+ * for skinned meshes, the pose buffer. Only valid for objects with an 
+ * instanced shader variant. 'poses' is ignored for other meshes.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_UploadInstances(const struct render_private *priv, const mat4x4_t *models, 
+                          const struct pose_ref *poses, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Creates the uniform buffers backing the 'globals' block of the shaders and
+ * binds the world one. Must be called after the shaders are linked.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_GlobalsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the buffer texture holding the frame's joint palette and binds it 
+ * to 'SHADER_ANIM_PALETTE_TUNIT', and the one holding the baked palette to 
+ * 'SHADER_ANIM_BAKED_TUNIT'.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_AnimPaletteInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the buffers used for drawing the boxes of 'R_GL_OcclusionTest'.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_OcclusionInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the framebuffer and the read back buffers of the picking pass. The
+ * attachments are only allocated once they are first needed.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_PickingInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the ring buffer that the immediate-mode draws stream their vertices
+ * through, along with a VAO for each of the formats.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_StreamInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the offscreen framebuffer that the scene is drawn to at reduced 
+ * render scales or under the fog of war, and the timer queries for the scene's GPU time. The 
+ * attachments are only allocated once they are first needed.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_SceneInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Returns the depth texture of the scene being drawn and the size of its' 
+ * region that the scene is drawn to, or false if the scene is drawn straight
+ * to the window. Only valid when drawing.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_SceneDepth(GLuint *out_tex, GLint *out_w, GLint *out_h);
+
+/* ---------------------------------------------------------------------------
+ * Creates the texture holding the fog of war, which is allocated once the fog 
+ * is enabled.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_FogInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Whether the fog of war is to be applied to the scene being drawn. Only 
+ * valid when drawing.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_FogActive(void);
+
+/* ---------------------------------------------------------------------------
+ * Binds the fog texture to the unit and sets the fog uniforms of the (already
+ * bound) program, for testing world positions against the fog of war.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_FogBind(GLuint shader_prog, int tunit);
+
+/* ---------------------------------------------------------------------------
+ * Draws the scene's color over the currently bound framebuffer, darkened by 
+ * the fog of war and the shadows (whichever are active) at the world position
+ * read back from the scene's depth.
+ * 'uv_scale' is the fraction of the textures that the scene takes up.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_FogComposite(GLuint color_tex, GLuint depth_tex, vec2_t uv_scale);
+
+/* ---------------------------------------------------------------------------
+ * Creates the buffer holding the instances drawn by 'R_GL_DrawOverlays'.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_OverlayInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the particle buffers of the effects drawn by 'R_GL_EffectsDraw'.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_EffectsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the billboard standing in for the static mesh when it is drawn 
+ * small, fitted to the mesh's 'bounds'. Its' atlas holds views of the mesh 
+ * from around its' vertical axis, which are drawn by 'R_GL_ImpostorsUpdate'
+ * once the textures are all loaded. Until then, the impostor isn't used. 
+ * Returns NULL if the impostor couldn't be created.
+ * ---------------------------------------------------------------------------
+ */
+struct impostor *R_GL_ImpostorCreate(const struct render_private *source, const struct aabb *bounds);
+void             R_GL_ImpostorFree(struct impostor *imp);
+
+/* ---------------------------------------------------------------------------
+ * Draws the atlases of a few of the impostors created since the last call. 
+ * Must be called once per frame, outside of any of the passes.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_ImpostorsUpdate(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the framebuffers of the shadow maps, whose textures are allocated
+ * once the shadows are first enabled.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_ShadowInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Points the shadows' light at the middle of the shadowed region from 'pos'.
+ * Everything in the cached shadow map is drawn again when the light moves.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_ShadowSetLight(vec3_t pos);
+
+/* ---------------------------------------------------------------------------
+ * Whether the shadows are to be applied to the scene being drawn. Only valid
+ * when drawing.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_ShadowActive(void);
+
+/* ---------------------------------------------------------------------------
+ * Binds the shadow maps to the texture units 'first_tunit' and the one after,
+ * and sets the shadow uniforms of the (already bound) composite program.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_ShadowBind(GLuint shader_prog, int first_tunit);
+
+/* ---------------------------------------------------------------------------
+ * Creates the timestamp queries for the GPU time of the passes.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_StatsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the uniform buffer of the point lights and attaches it to its' 
+ * binding point. It holds no lights until 'R_GL_SetPointLights' is called.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_LightsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the uniform buffers of the decals and attaches the empty one to 
+ * its' binding point.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_DecalsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the uniform buffer of the material table and attaches it to its' 
+ * binding point.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_MaterialsInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Writes the object's materials to a run of entries in the material table 
+ * and sets its' 'material_base'. The arrays that its' packed textures are in
+ * are given units of their' own. Objects with their' materials in the table 
+ * can be drawn one after another with only the base changing in between, 
+ * as long as their' textures are in the same arrays. Fails if the table is 
+ * full or the textures are spread over too many arrays.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_MaterialsAlloc(struct render_private *priv);
+void R_GL_MaterialsFree(struct render_private *priv);
+
+/* ---------------------------------------------------------------------------
+ * Writes the object's materials to its' entries again, after they changed.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_MaterialsUpdate(const struct render_private *priv);
+
+/* ---------------------------------------------------------------------------
+ * Binds the arrays of the object's textures that aren't already bound to 
+ * their' units according to 'bound' (which holds SHADER_MAX_TEXTURE_PAGES 
+ * names), updating it, and points the (already 
+ * bound) program to the object's entries in the material table.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_MaterialsBind(const struct render_private *priv, GLuint shader_prog, 
+                        GLuint *bound);
+
+/* ---------------------------------------------------------------------------
+ * Creates the buffers of the GPU culling, which is only supported with an
+ * OpenGL 4.3 context. Not being able to use it is not an error.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_GPUCullInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Creates the buffer that the animated meshes are pre-skinned into and the 
+ * VAO for drawing from it. The buffer is sized once it is first used.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_PreskinInit(void);
+
+/* ---------------------------------------------------------------------------
+ * Frees the buffers of the render queue. The render thread must no longer be
+ * running.
+ * ---------------------------------------------------------------------------
+ */
+void R_Queue_Shutdown(void);
+
+/* ---------------------------------------------------------------------------
+ * Whether the GPU culling tested the instances against the scene's depth in
+ * the last frame, which needs the scene to be drawn offscreen. Only valid 
+ * when drawing.
+ * ---------------------------------------------------------------------------
+ */
+bool R_GL_GPUCullWantsDepth(void);
+
+/* ---------------------------------------------------------------------------
+ * Takes the counts of the last frame for 'R_GL_GetRenderStats', and starts
+ * counting and timing the next one. Must be called at the start of every 
+ * frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_StatsBeginFrame(void);
+
+/* ---------------------------------------------------------------------------
+ * Tallies of the GL work done for the frame. To be called right after the 
+ * draw call, or program or texture bind, is made.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_StatsDraw(size_t vertices);
+void R_GL_StatsProgramBind(void);
+void R_GL_StatsTextureBind(void);
+
+/* ---------------------------------------------------------------------------
+ * Copies the vertices into the ring buffer and binds the VAO of the format.
+ * Returns the index of the first vertex to pass to the draw call, or -1 if 
+ * the buffer could not be mapped. Several batches may be uploaded at once and
+ * drawn with offsets from the returned index.
+ * ---------------------------------------------------------------------------
+ */
+GLint R_GL_StreamUpload(enum stream_fmt fmt, const void *verts, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Records the draw of the vertices for the current frame. The ranges are 
+ * relative to the first vertex, and consecutive ranges which share the same
+ * state are merged into a single multi-draw. The vertices and ranges are 
+ * copied, so the caller may release them as soon as this returns.
  * ---------------------------------------------------------------------------
  */
-void R_GL_TilePatchVertsBlend(GLuint VBO, const struct tile *tiles, 
-                              int width, int height, int r, int c);
+void  R_GL_StreamDraw(const struct stream_draw *draw, const struct stream_range *ranges, 
+                      size_t num_ranges, const void *verts, size_t num_verts);
+
+/* ---------------------------------------------------------------------------
+ * Returns space for 'count' worldspace vertices in the frame's debug batch of 
+ * the primitive type and line width (or point size), or NULL if it couldn't be
+ * had. The vertices are drawn on the next 'R_GL_DebugFlush'.
+ * ---------------------------------------------------------------------------
+ */
+struct colored_vert *R_GL_DebugReserve(GLenum mode, GLfloat size, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Returns the pose last set with 'R_GL_SetAnimPose'.
+ * ---------------------------------------------------------------------------
+ */
+struct pose_ref R_GL_AnimPose(void);
+
+/* ---------------------------------------------------------------------------
+ * Sets the pose uniforms of the program, if it has any. The joint palette 
+ * must be synced already.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_SetPoseUniforms(GLuint shader_prog, const struct pose_ref *pose);
+
+/* ---------------------------------------------------------------------------
+ * Uploads the poses appended to the joint palette since the last call. Must
+ * be called before drawing skinned meshes.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_AnimPaletteSync(void);
+
+/* ---------------------------------------------------------------------------
+ * Forget the meshes pre-skinned in the last frame. Must be called at the 
+ * start of every frame.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_PreskinBeginFrame(void);
+
+/* ---------------------------------------------------------------------------
+ * Have the skinned mesh skinned in the pose by the next 'R_GL_PreskinFlush',
+ * unless it already is this frame. Returns the index of its' first vertex in
+ * the buffer of 'R_GL_PreskinVAO', or -1 if the mesh is to be skinned by the
+ * passes themselves: when pre-skinning is off, the mesh isn't skinned, the 
+ * pose is the bind pose or the buffer is full.
+ * ---------------------------------------------------------------------------
+ */
+GLint R_GL_PreskinAdd(const struct render_private *priv, const struct pose_ref *pose);
+
+/* ---------------------------------------------------------------------------
+ * Draws the mesh from its' vertices pre-skinned at 'base', with the VAO of 
+ * 'R_GL_PreskinVAO' and a program for the static layout bound. The index
+ * buffer of the mesh is used as it is.
+ * ---------------------------------------------------------------------------
+ */
+GLuint R_GL_PreskinVAO(void);
+void   R_GL_PreskinDraw(const struct render_private *priv, GLint base);
+
+/* ---------------------------------------------------------------------------
+ * Like 'R_GL_DrawPriv', for meshes that were pre-skinned at 'base'. They are
+ * drawn with the static variant of the skinned program.
+ * ---------------------------------------------------------------------------
+ */
+void   R_GL_PreskinDrawPriv(const struct render_private *priv, const mat4x4_t *model, GLint base);
+
+/* ---------------------------------------------------------------------------
+ * Switch the 'globals' block to a fixed orthographic projection for drawing 
+ * in screen coordinates, and back. The world camera and light state is not 
+ * touched in the meantime.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_BeginScreenspace(void);
+void R_GL_EndScreenspace(void);
+
+/* ---------------------------------------------------------------------------
+ * Like the above, but for drawing from the light's point of view, with the
+ * provided matrices.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_BeginLightspace(const mat4x4_t *view, const mat4x4_t *proj);
+void R_GL_EndLightspace(void);
+
+/* ---------------------------------------------------------------------------
+ * Mixes the current ambient and point light state into the hash, for keying
+ * cached textures that have the lighting baked in.
+ * ---------------------------------------------------------------------------
+ */
+uint64_t R_GL_HashLighting(uint64_t hash);
+
+/* ---------------------------------------------------------------------------
+ * Build the vertices of all the tiles, in the terrain layout, and patch them 
+ * to have adjacency information about the neighboring tiles, to be used for 
+ * smooth blending. Tiles which border tiles with different materials will get
+ * blending 'turned on' by setting a vertex attribute. 'out' must hold
+ * VERTS_PER_TILE vertices for every tile. No GL calls are made, so this may
+ * be called from any thread.
+ * ---------------------------------------------------------------------------
+ */
+void R_GL_TileBuildVerts(const struct tile *tiles, int width, int height, void *out);
+
+/* ---------------------------------------------------------------------------
+ * The description of a tile that the heightfield terrain shaders rebuild its'
+ * vertices from: the heights of the corners and the center of the top face,
+ * the way its' triangles are laid out, and the same adjacency information as
+ * 'R_GL_TileBuildVerts' writes to the provoking vertices of the top face.
+ * No GL calls are made.
+ * ---------------------------------------------------------------------------
+ */
+struct tile_hf_desc{
+    /* In half height levels: NW, NE, SE, SW, center */
+    int   heights[5];
+    bool  left_aligned;
+    int   sides_mat_idx;
+    GLint south_adj[2];
+    GLint north_adj[2];
+    GLint center_mask;
+    GLint middle_mask;
+};
+
+void R_GL_TileGetHeightfield(const struct tile *tiles, int width, int height, int r, int c,
+                             struct tile_hf_desc *out);
 
 #endif
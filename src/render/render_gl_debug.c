@@ -0,0 +1,224 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "vertex.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#define MAX_BATCHES     (16)
+
+/* The primitives of the same type and width/size, in worldspace */
+struct debug_batch{
+    GLenum                      mode;
+    GLfloat                     size;
+    kvec_t(struct colored_vert) verts;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The batches keep their storage from frame to frame, so that once the debug 
+ * views are warmed up, accumulating the primitives does not allocate. */
+static struct debug_batch s_batches[MAX_BATCHES];
+static size_t             s_num_batches;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static struct debug_batch *r_gl_debug_batch(GLenum mode, GLfloat size)
+{
+    for(int i = 0; i < s_num_batches; i++) {
+        if(s_batches[i].mode == mode && s_batches[i].size == size)
+            return &s_batches[i];
+    }
+
+    if(s_num_batches == MAX_BATCHES)
+        return NULL;
+
+    struct debug_batch *ret = &s_batches[s_num_batches++];
+    ret->mode = mode;
+    ret->size = size;
+    kv_reset(ret->verts);
+    return ret;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+struct colored_vert *R_GL_DebugReserve(GLenum mode, GLfloat size, size_t count)
+{
+    struct debug_batch *batch = r_gl_debug_batch(mode, size);
+    if(!batch)
+        return NULL;
+
+    size_t old = kv_size(batch->verts);
+    if(old + count > kv_max(batch->verts)) {
+
+        size_t cap = kv_max(batch->verts) ? kv_max(batch->verts) : 256;
+        while(cap < old + count)
+            cap *= 2;
+
+        struct colored_vert *verts = realloc(batch->verts.a, cap * sizeof(struct colored_vert));
+        if(!verts)
+            return NULL;
+        batch->verts.a = verts;
+        batch->verts.m = cap;
+    }
+
+    batch->verts.n = old + count;
+    return batch->verts.a + old;
+}
+
+void R_GL_DebugLine(vec3_t a, vec3_t b, vec4_t color, float width)
+{
+    struct colored_vert *verts = R_GL_DebugReserve(GL_LINES, width, 2);
+    if(!verts)
+        return;
+
+    verts[0] = (struct colored_vert){a, color};
+    verts[1] = (struct colored_vert){b, color};
+}
+
+void R_GL_DebugPoint(vec3_t pos, vec4_t color, float size)
+{
+    struct colored_vert *verts = R_GL_DebugReserve(GL_POINTS, size, 1);
+    if(!verts)
+        return;
+
+    verts[0] = (struct colored_vert){pos, color};
+}
+
+void R_GL_DebugArrow(vec3_t base, vec3_t tip, vec4_t color, float width)
+{
+    vec3_t dir, side;
+    PFM_Vec3_Sub(&tip, &base, &dir);
+
+    float len = PFM_Vec3_Len(&dir);
+    if(len == 0.0f)
+        return;
+    PFM_Vec3_Scale(&dir, 1.0f / len, &dir);
+
+    /* The head lies in the plane of the shaft and the up axis, unless the 
+     * shaft is vertical itself */
+    vec3_t up = fabs(dir.y) > 0.99f ? (vec3_t){1.0f, 0.0f, 0.0f} : (vec3_t){0.0f, 1.0f, 0.0f};
+    PFM_Vec3_Cross(&dir, &up, &side);
+    PFM_Vec3_Normal(&side, &side);
+
+    float head = len * 0.25f;
+    vec3_t back, left, right;
+    PFM_Vec3_Scale(&dir, -head, &back);
+    PFM_Vec3_Scale(&side, head * 0.5f, &side);
+    PFM_Vec3_Add(&tip, &back, &back);
+    PFM_Vec3_Add(&back, &side, &left);
+    PFM_Vec3_Sub(&back, &side, &right);
+
+    struct colored_vert *verts = R_GL_DebugReserve(GL_LINES, width, 6);
+    if(!verts)
+        return;
+
+    verts[0] = (struct colored_vert){base, color};
+    verts[1] = (struct colored_vert){tip,  color};
+    verts[2] = (struct colored_vert){tip,  color};
+    verts[3] = (struct colored_vert){left, color};
+    verts[4] = (struct colored_vert){tip,  color};
+    verts[5] = (struct colored_vert){right,color};
+}
+
+void R_GL_DebugFlush(void)
+{
+    size_t num_verts = 0;
+    for(int i = 0; i < s_num_batches; i++)
+        num_verts += kv_size(s_batches[i].verts);
+
+    if(!num_verts)
+        goto out;
+
+    struct stream_range ranges[MAX_BATCHES];
+    size_t num_ranges = 0;
+
+    struct colored_vert *vbuff = arena_alloc(MEM_FrameArena(), num_verts * sizeof(struct colored_vert));
+    if(!vbuff)
+        goto out;
+
+    /* The colors come from the vertices */
+    vec4_t color = (vec4_t){1.0f, 1.0f, 1.0f, 1.0f};
+    size_t first = 0;
+
+    for(int i = 0; i < s_num_batches; i++) {
+
+        const struct debug_batch *curr = &s_batches[i];
+        if(!kv_size(curr->verts))
+            continue;
+
+        memcpy(vbuff + first, curr->verts.a, kv_size(curr->verts) * sizeof(struct colored_vert));
+        ranges[num_ranges++] = (struct stream_range){
+            .mode = curr->mode,
+            .first = first,
+            .count = kv_size(curr->verts),
+            .color = color,
+            .line_width = (curr->mode == GL_POINTS) ? 0.0f : curr->size,
+            .point_size = (curr->mode == GL_POINTS) ? curr->size : 0.0f,
+        };
+        first += kv_size(curr->verts);
+    }
+
+    struct stream_draw draw = {
+        .shader = "mesh.static.colored-per-vert",
+        .fmt = STREAM_FMT_COLORED,
+        .blend = true,
+    };
+    PFM_Mat4x4_Identity(&draw.model);
+    R_GL_StreamDraw(&draw, ranges, num_ranges, vbuff, num_verts);
+
+out:
+    for(int i = 0; i < s_num_batches; i++)
+        kv_reset(s_batches[i].verts);
+    s_num_batches = 0;
+}
+
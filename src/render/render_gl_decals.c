@@ -0,0 +1,177 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <float.h>
+
+/* Must match the definitions in the terrain shaders */
+#define DECAL_RING          (0)
+#define DECAL_TILES         (1)
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+/* The std140 layout of the 'decals' block. The shapes are in worldspace XZ:
+ * the center, followed by the outer radius for a ring or the half extents 
+ * for a rect of tiles. The alpha of the color holds the width of the band 
+ * that is drawn inside the shape's edge, or inside the edges of each tile. 
+ * The bounds enclose all the shapes, so that the rest of the terrain can 
+ * skip them. The kinds are read as ivec4s by the shaders. */
+struct decals_block{
+    GLint   count[4];
+    vec4_t  bounds;
+    vec4_t  shapes[SHADER_MAX_DECALS];
+    vec4_t  colors[SHADER_MAX_DECALS];
+    GLint   kinds[SHADER_MAX_DECALS];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint              s_UBO;
+/* Bound outside of the terrain pass, so that the terrain drawn to textures 
+ * (the baked chunk tops and the minimap) is left without decals */
+static GLuint              s_empty_UBO;
+/* The decals added so far in the frame */
+static struct decals_block s_pending;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void r_gl_decals_add(int kind, vec4_t shape, float width, vec3_t color)
+{
+    int idx = s_pending.count[0];
+    if(idx == SHADER_MAX_DECALS)
+        return;
+
+    float ex = shape.z;
+    float ez = (kind == DECAL_RING) ? shape.z : shape.w;
+
+    if(idx == 0) {
+        s_pending.bounds = (vec4_t){FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    }
+    s_pending.bounds.x = MIN(s_pending.bounds.x, shape.x - ex);
+    s_pending.bounds.y = MIN(s_pending.bounds.y, shape.y - ez);
+    s_pending.bounds.z = MAX(s_pending.bounds.z, shape.x + ex);
+    s_pending.bounds.w = MAX(s_pending.bounds.w, shape.y + ez);
+
+    s_pending.shapes[idx] = shape;
+    s_pending.colors[idx] = (vec4_t){color.x, color.y, color.z, width};
+    s_pending.kinds[idx] = kind;
+    s_pending.count[0]++;
+}
+
+static void r_gl_decals_upload_exec(const void *arg)
+{
+    const struct decals_block *block = arg;
+
+    /* The arrays are left as they were when there is nothing to draw */
+    size_t size = block->count[0] ? sizeof(struct decals_block) 
+                                  : offsetof(struct decals_block, shapes);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, size, block);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_DECALS_BINDING, s_UBO);
+}
+
+static void r_gl_decals_unbind_exec(const void *arg)
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_DECALS_BINDING, s_empty_UBO);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_DecalsInit(void)
+{
+    GLint max_size;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_size);
+    if(max_size < sizeof(struct decals_block))
+        return false;
+
+    memset(&s_pending, 0, sizeof(s_pending));
+
+    glGenBuffers(1, &s_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct decals_block), &s_pending, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &s_empty_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_empty_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct decals_block), &s_pending, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_DECALS_BINDING, s_empty_UBO);
+
+    return true;
+}
+
+void R_GL_DecalRing(vec2_t xz, float radius, float width, vec3_t color)
+{
+    r_gl_decals_add(DECAL_RING, (vec4_t){xz.raw[0], xz.raw[1], radius + width, 0.0f}, width, color);
+}
+
+void R_GL_DecalTiles(vec2_t xz, vec2_t half_extents, float width, vec3_t color)
+{
+    r_gl_decals_add(DECAL_TILES, (vec4_t){xz.raw[0], xz.raw[1], half_extents.raw[0], half_extents.raw[1]}, 
+        width, color);
+}
+
+void R_GL_DrawSelectionCircles(const vec2_t *xz, const float *radii, size_t count, 
+                               float width, vec3_t color)
+{
+    for(size_t i = 0; i < count; i++) {
+        R_GL_DecalRing(xz[i], radii[i], width, color);
+    }
+}
+
+void R_GL_DecalsBegin(void)
+{
+    R_Thread_Push(r_gl_decals_upload_exec, &s_pending, sizeof(struct decals_block));
+    s_pending.count[0] = 0;
+}
+
+void R_GL_DecalsEnd(void)
+{
+    R_Thread_Push(r_gl_decals_unbind_exec, NULL, 0);
+}
+
@@ -0,0 +1,266 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+
+/* Must match the styles in the effect shaders */
+enum effect_style{
+    EFFECT_STYLE_ARROW = 0,
+    EFFECT_STYLE_SPARK = 1,
+};
+
+/* The layout of a particle in the buffers. It is only written once, when it 
+ * is emitted - the shaders work out where it is from the time since. */
+struct particle_vert{
+    vec3_t pos;
+    float  lifetime;
+    vec3_t velocity;
+    float  gravity;
+    vec4_t color;
+    vec2_t size;
+    float  spawn_time;
+};
+
+struct effect{
+    enum effect_style style;
+    size_t            capacity;
+    GLuint            VAO, VBO;
+    /* The slot the next particle is written to. The oldest particles are 
+     * overwritten once the buffer is full. */
+    size_t            head;
+    /* When the last of the particles emitted so far dies */
+    float             alive_until;
+};
+
+struct emit_exec_args{
+    int    effect;
+    size_t first;
+    size_t count;
+};
+
+struct draw_exec_args{
+    float  time;
+    int    num_effects;
+    int    effects[EFFECT_COUNT];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static struct effect s_effects[EFFECT_COUNT] = {
+    [EFFECT_MOVE_MARKER] = {.style = EFFECT_STYLE_ARROW, .capacity = 256 },
+    [EFFECT_SPARKS]      = {.style = EFFECT_STYLE_SPARK, .capacity = 4096},
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static float r_gl_effects_now(void)
+{
+    return SDL_GetTicks() / 1000.0f;
+}
+
+/* The argument is followed by the particles */
+static void r_gl_effects_emit_exec(const void *arg)
+{
+    const struct emit_exec_args *args = arg;
+    const struct effect *effect = &s_effects[args->effect];
+
+    glBindBuffer(GL_ARRAY_BUFFER, effect->VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, args->first * sizeof(struct particle_vert), 
+        args->count * sizeof(struct particle_vert), args + 1);
+}
+
+static void r_gl_effects_draw_exec(const void *arg)
+{
+    const struct draw_exec_args *args = arg;
+
+    GLuint shader_prog = R_Shader_GetProgForName("effect");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+    glUniform1f(R_Shader_UniformLoc(shader_prog, SU_CURR_TIME), args->time);
+
+    /* The particles are see-through, so they are tested against the scene 
+     * but don't hide each other */
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+
+    for(int i = 0; i < args->num_effects; i++) {
+
+        const struct effect *effect = &s_effects[args->effects[i]];
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_EFFECT_STYLE), effect->style);
+
+        /* The dead particles are collapsed by the vertex shader */
+        glBindVertexArray(effect->VAO);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, effect->capacity);
+        R_GL_StatsDraw(6 * effect->capacity);
+    }
+
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glBindVertexArray(0);
+}
+
+static void r_gl_effects_push(int idx, const struct particle *particles, size_t count, float now)
+{
+    struct effect *effect = &s_effects[idx];
+
+    size_t argsize = sizeof(struct emit_exec_args) + count * sizeof(struct particle_vert);
+    struct emit_exec_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        return;
+
+    args->effect = idx;
+    args->first = effect->head;
+    args->count = count;
+
+    struct particle_vert *verts = (struct particle_vert*)(args + 1);
+    for(size_t i = 0; i < count; i++) {
+
+        const struct particle *curr = &particles[i];
+        verts[i] = (struct particle_vert){
+            .pos        = curr->pos,
+            .lifetime   = curr->lifetime,
+            .velocity   = curr->velocity,
+            .gravity    = curr->gravity,
+            .color      = curr->color,
+            .size       = curr->size,
+            .spawn_time = now,
+        };
+        effect->alive_until = MAX(effect->alive_until, now + curr->lifetime);
+    }
+
+    effect->head = (effect->head + count) % effect->capacity;
+    R_Thread_Push(r_gl_effects_emit_exec, args, argsize);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_EffectsInit(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_effects); i++) {
+
+        struct effect *effect = &s_effects[i];
+        effect->head = 0;
+        effect->alive_until = 0.0f;
+
+        glGenVertexArrays(1, &effect->VAO);
+        glBindVertexArray(effect->VAO);
+
+        /* The particles start out dead */
+        struct particle_vert *init = calloc(effect->capacity, sizeof(struct particle_vert));
+        if(!init)
+            return false;
+
+        glGenBuffers(1, &effect->VBO);
+        glBindBuffer(GL_ARRAY_BUFFER, effect->VBO);
+        glBufferData(GL_ARRAY_BUFFER, effect->capacity * sizeof(struct particle_vert), 
+            init, GL_DYNAMIC_DRAW);
+        free(init);
+
+        /* Every attribute advances once per particle */
+        const GLsizei stride = sizeof(struct particle_vert);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct particle_vert, pos));
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct particle_vert, velocity));
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct particle_vert, color));
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct particle_vert, size));
+        for(int j = 0; j < 4; j++) {
+            glEnableVertexAttribArray(j);
+            glVertexAttribDivisor(j, 1);
+        }
+
+        if(!effect->VAO || !effect->VBO)
+            return false;
+    }
+
+    glBindVertexArray(0);
+    return true;
+}
+
+void R_GL_EffectEmit(enum effect_type type, const struct particle *particles, size_t count)
+{
+    assert(type >= 0 && type < EFFECT_COUNT);
+    struct effect *effect = &s_effects[type];
+    float now = r_gl_effects_now();
+
+    /* Only the newest particles are kept when there are more than fit */
+    if(count > effect->capacity) {
+        particles += count - effect->capacity;
+        count = effect->capacity;
+    }
+
+    /* The particles wrapping around the end of the buffer are written apart */
+    size_t first = MIN(count, effect->capacity - effect->head);
+    r_gl_effects_push(type, particles, first, now);
+    if(count > first)
+        r_gl_effects_push(type, particles + first, count - first, now);
+}
+
+void R_GL_EffectsDraw(void)
+{
+    struct draw_exec_args args = {.time = r_gl_effects_now()};
+
+    /* The effects with nothing alive are skipped */
+    for(int i = 0; i < ARR_SIZE(s_effects); i++) {
+        if(s_effects[i].alive_until > args.time)
+            args.effects[args.num_effects++] = i;
+    }
+
+    if(!args.num_effects)
+        return;
+    R_Thread_Push(r_gl_effects_draw_exec, &args, sizeof(args));
+}
+
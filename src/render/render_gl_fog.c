@@ -0,0 +1,198 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+
+
+struct fog_enable_args{
+    int    width, height;
+    vec4_t rect;
+};
+
+struct fog_upload_args{
+    int row_begin, row_end;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Only touched when drawing */
+static GLuint  s_fog_tex;
+/* The fullscreen triangle is made up in the vertex shader, but a VAO still
+ * has to be bound for the draw */
+static GLuint  s_empty_VAO;
+static bool    s_active;
+static int     s_width, s_height;
+static vec4_t  s_rect;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void r_gl_fog_enable_exec(const void *arg)
+{
+    const struct fog_enable_args *args = arg;
+
+    glBindTexture(GL_TEXTURE_2D, s_fog_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, args->width, args->height, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    s_active = true;
+    s_width = args->width;
+    s_height = args->height;
+    s_rect = args->rect;
+}
+
+static void r_gl_fog_disable_exec(const void *unused)
+{
+    s_active = false;
+}
+
+/* The argument is followed by the texels of the rows */
+static void r_gl_fog_upload_exec(const void *arg)
+{
+    const struct fog_upload_args *args = arg;
+    if(!s_active)
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, s_fog_tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, args->row_begin, s_width, args->row_end - args->row_begin, 
+        GL_RED, GL_UNSIGNED_BYTE, args + 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_FogInit(void)
+{
+    glGenTextures(1, &s_fog_tex);
+    glGenVertexArrays(1, &s_empty_VAO);
+    return (s_fog_tex && s_empty_VAO);
+}
+
+bool R_GL_FogActive(void)
+{
+    return s_active;
+}
+
+void R_GL_FogBind(GLuint shader_prog, int tunit)
+{
+    glActiveTexture(GL_TEXTURE0 + tunit);
+    glBindTexture(GL_TEXTURE_2D, s_fog_tex);
+    R_GL_StatsTextureBind();
+    glActiveTexture(GL_TEXTURE0);
+
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE0 + tunit), tunit);
+    glUniform4fv(R_Shader_UniformLoc(shader_prog, SU_FOG_RECT), 1, s_rect.raw);
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_FOG_ENABLED), s_active);
+}
+
+void R_GL_FogComposite(GLuint color_tex, GLuint depth_tex, vec2_t uv_scale)
+{
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    GLuint shader_prog = R_Shader_GetProgForName("fog.composite");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    const GLuint textures[] = {color_tex, depth_tex, s_fog_tex};
+    for(int i = 0; i < 3; i++) {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        R_GL_StatsTextureBind();
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE0 + i), i);
+    }
+    glUniform4fv(R_Shader_UniformLoc(shader_prog, SU_FOG_RECT), 1, s_rect.raw);
+    glUniform2fv(R_Shader_UniformLoc(shader_prog, SU_UV_SCALE), 1, uv_scale.raw);
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_FOG_ENABLED), s_active);
+    R_GL_ShadowBind(shader_prog, 3);
+
+    glBindVertexArray(s_empty_VAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    R_GL_StatsDraw(3);
+    glBindVertexArray(0);
+
+    glActiveTexture(GL_TEXTURE0);
+    if(depth_test)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void R_GL_FogEnable(int width, int height, vec2_t origin, vec2_t size)
+{
+    struct fog_enable_args args = (struct fog_enable_args){
+        .width = width,
+        .height = height,
+        .rect = (vec4_t){origin.x, origin.y, 1.0f / size.x, 1.0f / size.y},
+    };
+    R_Thread_Push(r_gl_fog_enable_exec, &args, sizeof(args));
+}
+
+void R_GL_FogDisable(void)
+{
+    R_Thread_Push(r_gl_fog_disable_exec, NULL, 0);
+}
+
+void R_GL_FogUpload(const unsigned char *texels, int width, int row_begin, int row_end)
+{
+    size_t size = (size_t)width * (row_end - row_begin);
+    struct fog_upload_args *args = arena_alloc(MEM_FrameArena(), sizeof(*args) + size);
+    if(!args)
+        return;
+
+    args->row_begin = row_begin;
+    args->row_end = row_end;
+    memcpy(args + 1, texels + (size_t)width * row_begin, size);
+    R_Thread_Push(r_gl_fog_upload_exec, args, sizeof(*args) + size);
+}
+
@@ -0,0 +1,754 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "shader.h"
+#include "vertex.h"
+#include "public/render.h"
+#include "../asset_load.h"
+#include "../collision.h"
+#include "../camera.h"
+#include "../mem.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+#include <SDL.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define CULL_GROUP_SIZE     (64)
+#define HIZ_GROUP_SIZE      (8)
+#define MIN_CAPACITY        (256)
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+/* The layouts of the elements of the compute program's buffers (std430) */
+struct cull_instance{
+    mat4x4_t model;
+    /* The center and radius of the bounding sphere */
+    vec4_t   sphere;
+    GLuint   group;
+    GLuint   pad[3];
+};
+
+/* The instances of a mesh. The levels of detail of the mesh are drawn with
+ * the consecutive commands from 'first_cmd': the mesh itself, each of its' 
+ * coarser levels and finally its' impostor. Each command draws from a run 
+ * of 'capacity' model matrices, starting at 'first_slot' for the first. */
+struct cull_group{
+    GLfloat  screen_sizes[MAX_LODS];
+    GLuint   first_cmd;
+    GLuint   num_lods;
+    /* 1 if the impostor is ready to be drawn, 0 otherwise */
+    GLuint   impostor;
+    GLuint   first_slot;
+    GLuint   capacity;
+    GLuint   pad[3];
+};
+
+/* Laid out as 'DrawElementsIndirectCommand'. For the meshes that aren't 
+ * indexed, it is read as 'DrawArraysIndirectCommand', with the base instance
+ * in place of the base vertex. */
+struct draw_cmd{
+    GLuint   count;
+    GLuint   instance_count;
+    GLuint   first;
+    GLuint   base_vertex;
+    GLuint   base_instance;
+};
+
+/* The meshes are grouped by the object that they are the base level of */
+struct group_state{
+    const struct render_private *priv;
+    size_t                       count;
+    /* For telling when the levels change, as when they're hot reloaded or
+     * when the impostor is baked */
+    uint64_t                     sig;
+};
+
+/* A draw command and the VAO it is drawn with, which sources the model 
+ * matrices from the culling's output */
+struct draw_desc{
+    const struct render_private *priv;
+    GLuint                       VAO;
+};
+
+/* The argument is followed by the 'dirty_end - dirty_begin' changed instances
+ * and, when 'layout' is set, by the 'num_groups' groups, and the 'num_cmds' 
+ * commands and the levels that they draw. */
+struct cull_args{
+    size_t capacity;
+    size_t num_instances;
+    size_t dirty_begin, dirty_end;
+    bool   layout;
+    size_t num_groups;
+    size_t num_cmds;
+    size_t num_slots;
+    float  lod_scale;
+    float  impostor_size;
+    bool   occlusion;
+};
+
+KHASH_MAP_INIT_INT(cull_id, size_t)
+KHASH_MAP_INIT_INT64(cull_group, int)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool                          s_supported;
+
+/* Only touched on the main thread */
+static kvec_t(struct cull_instance)  s_instances;
+static kvec_t(uint32_t)              s_ids;
+static khash_t(cull_id)             *s_index;
+static kvec_t(struct group_state)    s_groups;
+static khash_t(cull_group)          *s_group_index;
+/* The number of instances the GPU's buffer has room for */
+static size_t                        s_capacity;
+/* The range of instances changed since they were last uploaded */
+static size_t                        s_dirty_begin, s_dirty_end;
+static bool                          s_layout_dirty;
+/* The number of commands as of the last layout */
+static size_t                        s_num_cmds;
+static struct gpucull_stats          s_stats;
+
+/* Only touched when drawing */
+static GLuint                        s_inst_buff;
+static GLuint                        s_group_buff;
+static GLuint                        s_template_buff;
+static GLuint                        s_cmd_buff;
+static GLuint                        s_model_buff;
+static size_t                        s_gpu_capacity;
+static kvec_t(struct draw_desc)      s_draws;
+static GLuint                        s_hiz_tex;
+static GLint                         s_hiz_w, s_hiz_h, s_hiz_levels;
+static bool                          s_wants_depth;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static size_t r_gl_cull_num_levels(const struct render_private *priv)
+{
+    return 1 + priv->num_lods + !!priv->impostor;
+}
+
+static const struct render_private *r_gl_cull_level(const struct render_private *priv, size_t level)
+{
+    if(level == 0)
+        return priv;
+    if(level <= priv->num_lods)
+        return &priv->lods[level - 1].priv;
+    return &priv->impostor->priv;
+}
+
+static uint64_t r_gl_cull_mix(uint64_t hash, uint64_t val)
+{
+    hash ^= val + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+static uint64_t r_gl_cull_sig(const struct render_private *priv)
+{
+    uint64_t ret = 0;
+    for(int i = 0; i < r_gl_cull_num_levels(priv); i++) {
+
+        const struct mesh *mesh = &r_gl_cull_level(priv, i)->mesh;
+        ret = r_gl_cull_mix(ret, mesh->VBO);
+        ret = r_gl_cull_mix(ret, mesh->EBO);
+        ret = r_gl_cull_mix(ret, mesh->num_verts);
+        ret = r_gl_cull_mix(ret, mesh->num_indices);
+    }
+    if(priv->impostor)
+        ret = r_gl_cull_mix(ret, SDL_AtomicGet(&priv->impostor->baked));
+    return ret;
+}
+
+static int r_gl_cull_group(const struct render_private *priv)
+{
+    int status;
+    khiter_t k = kh_put(cull_group, s_group_index, (uintptr_t)priv, &status);
+    if(status == -1)
+        return -1;
+    if(status == 0)
+        return kh_value(s_group_index, k);
+
+    kh_value(s_group_index, k) = kv_size(s_groups);
+    kv_push(struct group_state, s_groups, ((struct group_state){priv, 0, r_gl_cull_sig(priv)}));
+    return kh_value(s_group_index, k);
+}
+
+static void r_gl_cull_mark(size_t idx)
+{
+    if(s_dirty_begin >= s_dirty_end) {
+        s_dirty_begin = idx;
+        s_dirty_end = idx + 1;
+        return;
+    }
+    s_dirty_begin = MIN(s_dirty_begin, idx);
+    s_dirty_end = MAX(s_dirty_end, idx + 1);
+}
+
+static size_t r_gl_cull_layout_size(size_t *out_cmds)
+{
+    size_t num_cmds = 0;
+    for(int i = 0; i < kv_size(s_groups); i++) {
+        if(kv_A(s_groups, i).count)
+            num_cmds += r_gl_cull_num_levels(kv_A(s_groups, i).priv);
+    }
+    *out_cmds = num_cmds;
+    return kv_size(s_groups) * sizeof(struct cull_group)
+         + num_cmds * (sizeof(struct draw_cmd) + sizeof(struct draw_desc));
+}
+
+/* Each level of every mesh has room for all of the mesh's instances, since 
+ * any of them may be drawn at any level */
+static size_t r_gl_cull_layout(struct cull_group *groups, struct draw_cmd *cmds, 
+                               struct draw_desc *descs)
+{
+    size_t num_cmds = 0, num_slots = 0;
+
+    for(int i = 0; i < kv_size(s_groups); i++) {
+
+        const struct group_state *gs = &kv_A(s_groups, i);
+        const struct render_private *priv = gs->priv;
+        groups[i] = (struct cull_group){0};
+        if(!gs->count)
+            continue;
+
+        groups[i].first_cmd = num_cmds;
+        groups[i].num_lods = priv->num_lods;
+        groups[i].impostor = priv->impostor && SDL_AtomicGet(&priv->impostor->baked);
+        groups[i].first_slot = num_slots;
+        groups[i].capacity = gs->count;
+
+        for(int j = 0; j < priv->num_lods; j++)
+            groups[i].screen_sizes[j] = priv->lods[j].screen_size;
+
+        for(int j = 0; j < r_gl_cull_num_levels(priv); j++) {
+
+            const struct render_private *level = r_gl_cull_level(priv, j);
+            GLuint base = num_slots + j * gs->count;
+
+            if(level->mesh.EBO) {
+                cmds[num_cmds] = (struct draw_cmd){
+                    .count = level->mesh.num_indices,
+                    .base_instance = base
+                };
+            }else{
+                cmds[num_cmds] = (struct draw_cmd){
+                    .count = level->mesh.num_verts,
+                    .base_vertex = base
+                };
+            }
+            descs[num_cmds] = (struct draw_desc){level, 0};
+            num_cmds++;
+        }
+        num_slots += r_gl_cull_num_levels(priv) * gs->count;
+    }
+    return num_slots;
+}
+
+static GLuint r_gl_cull_make_vao(const struct render_private *priv)
+{
+    GLuint VAO;
+    glGenVertexArrays(1, &VAO);
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+    R_Vert_SetAttribs(priv->mesh.layout);
+    if(priv->mesh.EBO)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, priv->mesh.EBO);
+
+    /* Attribute 4-7 - per-instance model matrix, as in the mesh's own VAO */
+    glBindBuffer(GL_ARRAY_BUFFER, s_model_buff);
+    for(int i = 0; i < 4; i++) {
+        glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4x4_t), 
+            (void*)(i * sizeof(vec4_t)));
+        glEnableVertexAttribArray(4 + i);
+        glVertexAttribDivisor(4 + i, 1);
+    }
+
+    glBindVertexArray(0);
+    return VAO;
+}
+
+static void r_gl_cull_free_draws(void)
+{
+    for(int i = 0; i < kv_size(s_draws); i++)
+        glDeleteVertexArrays(1, &kv_A(s_draws, i).VAO);
+    kv_reset(s_draws);
+}
+
+static void r_gl_cull_relayout(const struct cull_args *args, const struct cull_group *groups, 
+                               const struct draw_cmd *cmds, const struct draw_desc *descs)
+{
+    r_gl_cull_free_draws();
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_group_buff);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, args->num_groups * sizeof(struct cull_group), 
+        groups, GL_DYNAMIC_DRAW);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_template_buff);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, args->num_cmds * sizeof(struct draw_cmd), 
+        cmds, GL_DYNAMIC_DRAW);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_cmd_buff);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, args->num_cmds * sizeof(struct draw_cmd), 
+        NULL, GL_DYNAMIC_COPY);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_model_buff);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, args->num_slots * sizeof(mat4x4_t), 
+        NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    for(int i = 0; i < args->num_cmds; i++) {
+        struct draw_desc desc = descs[i];
+        desc.VAO = r_gl_cull_make_vao(desc.priv);
+        kv_push(struct draw_desc, s_draws, desc);
+    }
+}
+
+/* The pyramid starts at half the size of the scene, and is made again 
+ * whenever that changes */
+static void r_gl_cull_hiz_resize(GLint width, GLint height)
+{
+    glDeleteTextures(1, &s_hiz_tex);
+    s_hiz_w = width;
+    s_hiz_h = height;
+    s_hiz_levels = (GLint)floor(log2(MAX(width, height))) + 1;
+
+    glGenTextures(1, &s_hiz_tex);
+    glBindTexture(GL_TEXTURE_2D, s_hiz_tex);
+    glTexStorage2D(GL_TEXTURE_2D, s_hiz_levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/* Reduces the current contents of the scene's depth buffer to the pyramid, 
+ * one level at a time. Returns false if the scene has no depth texture. */
+static bool r_gl_cull_build_hiz(void)
+{
+    GLuint depth_tex;
+    GLint scene_w, scene_h;
+    if(!R_GL_SceneDepth(&depth_tex, &scene_w, &scene_h))
+        return false;
+
+    GLint width = MAX(1, (scene_w + 1) / 2);
+    GLint height = MAX(1, (scene_h + 1) / 2);
+    if(width != s_hiz_w || height != s_hiz_h)
+        r_gl_cull_hiz_resize(width, height);
+
+    GLuint shader_prog = R_Shader_GetProgForName("cull.hiz");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth_tex);
+    R_GL_StatsTextureBind();
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE0), 0);
+    glUniform2i(R_Shader_UniformLoc(shader_prog, SU_SRC_SIZE), scene_w, scene_h);
+
+    for(int i = 0; i < s_hiz_levels; i++) {
+
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_FIRST_LEVEL), i == 0);
+        glBindImageTexture(0, s_hiz_tex, MAX(i - 1, 0), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, s_hiz_tex, i, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+        GLint level_w = MAX(1, width >> i);
+        GLint level_h = MAX(1, height >> i);
+        glDispatchCompute((level_w + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 
+                          (level_h + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+static void r_gl_cull_dispatch(const struct cull_args *args, bool hiz)
+{
+    GLuint shader_prog = R_Shader_GetProgForName("cull.instances");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    glUniform1ui(R_Shader_UniformLoc(shader_prog, SU_NUM_INSTANCES), args->num_instances);
+    glUniform1f(R_Shader_UniformLoc(shader_prog, SU_LOD_SCALE), args->lod_scale);
+    glUniform1f(R_Shader_UniformLoc(shader_prog, SU_IMPOSTOR_SIZE), args->impostor_size);
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_HIZ_ENABLED), hiz);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, s_hiz_tex);
+    R_GL_StatsTextureBind();
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE0), 0);
+    R_GL_FogBind(shader_prog, 1);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADER_CULL_INSTANCES_BINDING, s_inst_buff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADER_CULL_GROUPS_BINDING, s_group_buff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADER_CULL_COMMANDS_BINDING, s_cmd_buff);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADER_CULL_MODELS_BINDING, s_model_buff);
+
+    glDispatchCompute((args->num_instances + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    /* The commands and the model matrices are next read by the draws, and 
+     * the commands are then overwritten by the next frame's reset */
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 
+                  | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+/* The commands of the levels that no instance was drawn at have a count of 
+ * 0, and cost the GPU next to nothing */
+static void r_gl_cull_draw(void)
+{
+    GLuint prog = 0;
+    const struct material *materials = NULL;
+    GLuint pages[SHADER_MAX_TEXTURE_PAGES] = {0};
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, s_cmd_buff);
+
+    for(int i = 0; i < kv_size(s_draws); i++) {
+
+        const struct draw_desc *desc = &kv_A(s_draws, i);
+        const struct render_private *priv = desc->priv;
+
+        if(prog != priv->instanced_shader_prog) {
+            prog = priv->instanced_shader_prog;
+            glUseProgram(prog);
+            R_GL_StatsProgramBind();
+            materials = NULL;
+        }
+
+        if(materials != priv->materials) {
+            if(priv->material_base >= 0)
+                R_GL_MaterialsBind(priv, prog, pages);
+            else
+                R_GL_SetMaterials(priv, prog);
+            materials = priv->materials;
+        }
+
+        glBindVertexArray(desc->VAO);
+        const void *offset = (void*)(i * sizeof(struct draw_cmd));
+
+        if(priv->mesh.EBO)
+            glDrawElementsIndirect(GL_TRIANGLES, priv->mesh.index_type, offset);
+        else
+            glDrawArraysIndirect(GL_TRIANGLES, offset);
+        /* The number of vertices drawn is only known to the GPU */
+        R_GL_StatsDraw(0);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+static void r_gl_cull_exec(const void *arg)
+{
+    const struct cull_args *args = arg;
+    const struct cull_instance *dirty = (const struct cull_instance*)(args + 1);
+    size_t num_dirty = args->dirty_end - args->dirty_begin;
+
+    s_wants_depth = args->occlusion;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, s_inst_buff);
+    if(args->capacity != s_gpu_capacity) {
+        glBufferData(GL_SHADER_STORAGE_BUFFER, args->capacity * sizeof(struct cull_instance), 
+            NULL, GL_DYNAMIC_DRAW);
+        s_gpu_capacity = args->capacity;
+    }
+    if(num_dirty) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, args->dirty_begin * sizeof(struct cull_instance), 
+            num_dirty * sizeof(struct cull_instance), dirty);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if(args->layout) {
+        const struct cull_group *groups = (const struct cull_group*)(dirty + num_dirty);
+        const struct draw_cmd *cmds = (const struct draw_cmd*)(groups + args->num_groups);
+        const struct draw_desc *descs = (const struct draw_desc*)(cmds + args->num_cmds);
+        r_gl_cull_relayout(args, groups, cmds, descs);
+    }
+
+    if(!args->num_instances || !kv_size(s_draws))
+        return;
+
+    bool hiz = args->occlusion && r_gl_cull_build_hiz();
+
+    /* All the instance counts start from 0 */
+    glBindBuffer(GL_COPY_READ_BUFFER, s_template_buff);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, s_cmd_buff);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, 
+        kv_size(s_draws) * sizeof(struct draw_cmd));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    r_gl_cull_dispatch(args, hiz);
+    r_gl_cull_draw();
+    glActiveTexture(GL_TEXTURE0);
+}
+
+static void r_gl_cull_clear_exec(const void *unused)
+{
+    r_gl_cull_free_draws();
+    s_wants_depth = false;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_GPUCullInit(void)
+{
+    s_index = kh_init(cull_id);
+    s_group_index = kh_init(cull_group);
+    if(!s_index || !s_group_index)
+        return false;
+
+    kv_init(s_instances);
+    kv_init(s_ids);
+    kv_init(s_groups);
+    kv_init(s_draws);
+
+    s_supported = GLEW_VERSION_4_3
+               && R_Shader_GetProgForName("cull.instances") > 0
+               && R_Shader_GetProgForName("cull.hiz") > 0;
+    if(!s_supported)
+        return true;
+
+    GLuint buffers[5];
+    glGenBuffers(5, buffers);
+    s_inst_buff = buffers[0];
+    s_group_buff = buffers[1];
+    s_template_buff = buffers[2];
+    s_cmd_buff = buffers[3];
+    s_model_buff = buffers[4];
+    return true;
+}
+
+bool R_GL_GPUCullWantsDepth(void)
+{
+    return s_wants_depth;
+}
+
+bool R_GL_GPUCullSupported(void)
+{
+    return s_supported;
+}
+
+bool R_GL_GPUCullEligible(const void *render_private)
+{
+    const struct render_private *priv = render_private;
+    return priv->mesh.instance_VBO 
+        && !priv->mesh.instance_palette_VBO 
+        && priv->instanced_shader_prog;
+}
+
+bool R_GL_GPUCullAdd(uint32_t id, const void *render_private, const mat4x4_t *model, 
+                     const struct obb *obb)
+{
+    const struct render_private *priv = render_private;
+    if(!s_supported || !R_GL_GPUCullEligible(priv))
+        return false;
+
+    int group = r_gl_cull_group(priv);
+    if(group < 0)
+        return false;
+
+    vec3_t half = (vec3_t){obb->half_lengths[0], obb->half_lengths[1], obb->half_lengths[2]};
+    struct cull_instance inst = (struct cull_instance){
+        .model = *model,
+        .sphere = (vec4_t){obb->center.x, obb->center.y, obb->center.z, PFM_Vec3_Len(&half)},
+        .group = group
+    };
+
+    int status;
+    khiter_t k = kh_put(cull_id, s_index, id, &status);
+    if(status == -1)
+        return false;
+
+    size_t idx;
+    if(status == 0) {
+
+        idx = kh_value(s_index, k);
+        int prev = kv_A(s_instances, idx).group;
+        if(prev != group) {
+            kv_A(s_groups, prev).count--;
+            kv_A(s_groups, group).count++;
+            s_layout_dirty = true;
+        }
+        kv_A(s_instances, idx) = inst;
+    }else{
+
+        idx = kv_size(s_instances);
+        kh_value(s_index, k) = idx;
+        kv_push(struct cull_instance, s_instances, inst);
+        kv_push(uint32_t, s_ids, id);
+        kv_A(s_groups, group).count++;
+        s_layout_dirty = true;
+    }
+
+    r_gl_cull_mark(idx);
+    return true;
+}
+
+void R_GL_GPUCullRemove(uint32_t id)
+{
+    khiter_t k = kh_get(cull_id, s_index, id);
+    if(k == kh_end(s_index))
+        return;
+
+    size_t idx = kh_value(s_index, k);
+    kh_del(cull_id, s_index, k);
+    kv_A(s_groups, kv_A(s_instances, idx).group).count--;
+    s_layout_dirty = true;
+
+    /* The last instance takes the place of the removed one */
+    struct cull_instance last = kv_pop(s_instances);
+    uint32_t last_id = kv_pop(s_ids);
+    if(idx == kv_size(s_instances))
+        return;
+
+    kv_A(s_instances, idx) = last;
+    kv_A(s_ids, idx) = last_id;
+    kh_value(s_index, kh_get(cull_id, s_index, last_id)) = idx;
+    r_gl_cull_mark(idx);
+}
+
+void R_GL_GPUCullClear(void)
+{
+    if(!s_supported)
+        return;
+
+    kv_reset(s_instances);
+    kv_reset(s_ids);
+    kv_reset(s_groups);
+    kh_clear(cull_id, s_index);
+    kh_clear(cull_group, s_group_index);
+    s_dirty_begin = s_dirty_end = 0;
+    s_layout_dirty = true;
+    s_num_cmds = 0;
+    s_stats = (struct gpucull_stats){0};
+
+    R_Thread_Push(r_gl_cull_clear_exec, NULL, 0);
+}
+
+void R_GL_GPUCullDraw(float lod_bias, float impostor_size, bool occlusion)
+{
+    if(!s_supported)
+        return;
+
+    /* The object of a group that has no instances left may have been freed */
+    size_t num_groups = 0;
+    for(int i = 0; i < kv_size(s_groups); i++) {
+
+        struct group_state *gs = &kv_A(s_groups, i);
+        if(!gs->count)
+            continue;
+        num_groups++;
+
+        uint64_t sig = r_gl_cull_sig(gs->priv);
+        if(sig != gs->sig) {
+            gs->sig = sig;
+            s_layout_dirty = true;
+        }
+    }
+
+    /* The buffer is re-allocated when it grows, which loses its' contents */
+    size_t num_instances = kv_size(s_instances);
+    if(num_instances > s_capacity) {
+        s_capacity = MAX(MIN_CAPACITY, num_instances * 2);
+        s_dirty_begin = 0;
+        s_dirty_end = num_instances;
+    }
+    s_dirty_end = MIN(s_dirty_end, num_instances);
+    s_dirty_begin = MIN(s_dirty_begin, s_dirty_end);
+
+    size_t num_dirty = s_dirty_end - s_dirty_begin;
+    size_t num_cmds = 0;
+    size_t layout_size = s_layout_dirty ? r_gl_cull_layout_size(&num_cmds) : 0;
+    size_t argsize = sizeof(struct cull_args) + num_dirty * sizeof(struct cull_instance) + layout_size;
+
+    struct cull_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        return;
+
+    *args = (struct cull_args){
+        .capacity = s_capacity,
+        .num_instances = num_instances,
+        .dirty_begin = s_dirty_begin,
+        .dirty_end = s_dirty_end,
+        .layout = s_layout_dirty,
+        .num_groups = kv_size(s_groups),
+        .num_cmds = num_cmds,
+        .lod_scale = lod_bias / tanf(CAM_FOV_RAD / 2.0f),
+        .impostor_size = impostor_size,
+        .occlusion = occlusion
+    };
+
+    struct cull_instance *dirty = (struct cull_instance*)(args + 1);
+    memcpy(dirty, s_instances.a + s_dirty_begin, num_dirty * sizeof(struct cull_instance));
+
+    if(s_layout_dirty) {
+        struct cull_group *groups = (struct cull_group*)(dirty + num_dirty);
+        struct draw_cmd *cmds = (struct draw_cmd*)(groups + args->num_groups);
+        struct draw_desc *descs = (struct draw_desc*)(cmds + num_cmds);
+        args->num_slots = r_gl_cull_layout(groups, cmds, descs);
+        s_num_cmds = num_cmds;
+    }
+
+    R_Thread_Push(r_gl_cull_exec, args, argsize);
+    s_dirty_begin = s_dirty_end = 0;
+    s_layout_dirty = false;
+
+    s_stats.instances = num_instances;
+    s_stats.groups = num_groups;
+    s_stats.draws = num_instances ? s_num_cmds : 0;
+}
+
+void R_GL_GPUCullGetStats(struct gpucull_stats *out)
+{
+    *out = s_stats;
+}
+
@@ -0,0 +1,287 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../camera.h"
+#include "../config.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* The grid must match the definitions in the shaders */
+#define CLUSTER_X           (16)
+#define CLUSTER_Y           (9)
+#define CLUSTER_Z           (12)
+#define CLUSTER_CELLS       (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_INDICES     (6144)
+/* The slices get exponentially deeper from here to the draw distance. Closer
+ * than this, everything is in the first slice. */
+#define CLUSTER_NEAR        (10.0f)
+
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi)    (MAX(MIN((a), (hi)), (lo)))
+
+/* The std140 layout of the 'point_lights' block. Each cell holds the offset 
+ * of its' lights in 'indices' in the low 16 bits and their count in the high
+ * 16 bits. The indices are 8 bits each, 4 to an int. Since std140 pads out 
+ * the elements of scalar arrays, the shaders read both lists as uvec4s. */
+struct lights_block{
+    vec4_t  pos_radius[SHADER_MAX_POINT_LIGHTS];
+    vec4_t  colors[SHADER_MAX_POINT_LIGHTS];
+    GLint   dims[4];
+    GLfloat depth[4];
+    GLuint  cells[CLUSTER_CELLS];
+    GLuint  indices[CLUSTER_INDICES / 4];
+};
+
+/* The cells a light touches, as inclusive ranges */
+struct light_bounds{
+    int   x_min, x_max;
+    int   y_min, y_max;
+    int   z_min, z_max;
+    float depth;
+    int   light_idx;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint s_UBO;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int r_gl_lights_slice(float depth)
+{
+    float inv_log = 1.0f / logf(CONFIG_DRAWDIST / CLUSTER_NEAR);
+    float slice = logf(MAX(depth, CLUSTER_NEAR) / CLUSTER_NEAR) * inv_log * CLUSTER_Z;
+    return CLAMP((int)slice, 0, CLUSTER_Z - 1);
+}
+
+static int r_gl_lights_tile(float ndc, int num_tiles)
+{
+    return CLAMP((int)((ndc * 0.5f + 0.5f) * num_tiles), 0, num_tiles - 1);
+}
+
+/* Returns false if the light's sphere is out of view */
+static bool r_gl_lights_bounds(const struct camera_state *state, const struct point_light *light, 
+                               struct light_bounds *out)
+{
+    vec4_t pos = (vec4_t){light->pos.x, light->pos.y, light->pos.z, 1.0f};
+    vec4_t center;
+    PFM_Mat4x4_Mult4x1(&state->view, &pos, &center);
+
+    /* The view looks down -Z */
+    float r = light->radius;
+    float depth_min = -center.z - r;
+    float depth_max = -center.z + r;
+    if(depth_max < CAM_Z_NEAR_DIST || depth_min > CONFIG_DRAWDIST)
+        return false;
+
+    out->z_min = r_gl_lights_slice(depth_min);
+    out->z_max = r_gl_lights_slice(depth_max);
+    out->depth = -center.z;
+
+    /* A sphere reaching behind the near plane may cover any part of the 
+     * screen. Otherwise, the corners of its' box bound it on the screen. */
+    if(depth_min <= CAM_Z_NEAR_DIST) {
+        out->x_min = 0, out->x_max = CLUSTER_X - 1;
+        out->y_min = 0, out->y_max = CLUSTER_Y - 1;
+        return true;
+    }
+
+    float x_min = INFINITY, x_max = -INFINITY;
+    float y_min = INFINITY, y_max = -INFINITY;
+
+    for(int i = 0; i < 8; i++) {
+
+        vec4_t corner = (vec4_t){
+            center.x + ((i & 1) ? r : -r),
+            center.y + ((i & 2) ? r : -r),
+            center.z + ((i & 4) ? r : -r),
+            1.0f
+        };
+        vec4_t clip;
+        PFM_Mat4x4_Mult4x1(&state->proj, &corner, &clip);
+
+        x_min = MIN(x_min, clip.x / clip.w);
+        x_max = MAX(x_max, clip.x / clip.w);
+        y_min = MIN(y_min, clip.y / clip.w);
+        y_max = MAX(y_max, clip.y / clip.w);
+    }
+
+    if(x_max < -1.0f || x_min > 1.0f || y_max < -1.0f || y_min > 1.0f)
+        return false;
+
+    out->x_min = r_gl_lights_tile(x_min, CLUSTER_X);
+    out->x_max = r_gl_lights_tile(x_max, CLUSTER_X);
+    out->y_min = r_gl_lights_tile(y_min, CLUSTER_Y);
+    out->y_max = r_gl_lights_tile(y_max, CLUSTER_Y);
+    return true;
+}
+
+static int r_gl_lights_compare_depth(const void *a, const void *b)
+{
+    float da = ((const struct light_bounds*)a)->depth;
+    float db = ((const struct light_bounds*)b)->depth;
+    return (da > db) - (da < db);
+}
+
+static void r_gl_lights_upload_exec(const void *arg)
+{
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(struct lights_block), arg);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_LightsInit(void)
+{
+    GLint max_size;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_size);
+    if(max_size < sizeof(struct lights_block))
+        return false;
+
+    struct lights_block *init = calloc(1, sizeof(struct lights_block));
+    if(!init)
+        return false;
+
+    glGenBuffers(1, &s_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct lights_block), init, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_LIGHTS_BINDING, s_UBO);
+
+    free(init);
+    return true;
+}
+
+void R_GL_SetPointLights(const struct point_light *lights, size_t count, const struct camera *cam)
+{
+    const struct camera_state *state = Camera_GetState(cam);
+
+    struct lights_block *block = arena_alloc(MEM_FrameArena(), sizeof(struct lights_block));
+    if(!block)
+        return;
+
+    struct light_bounds *bounds = arena_alloc(MEM_FrameArena(), 
+        sizeof(struct light_bounds) * (count + 1));
+    if(!bounds)
+        return;
+
+    size_t num_visible = 0;
+    for(int i = 0; i < count; i++) {
+
+        struct light_bounds *curr = &bounds[num_visible];
+        if(!r_gl_lights_bounds(state, &lights[i], curr))
+            continue;
+        curr->light_idx = i;
+        num_visible++;
+    }
+
+    /* Only the closest lights are kept when there are too many in view */
+    if(num_visible > SHADER_MAX_POINT_LIGHTS) {
+        qsort(bounds, num_visible, sizeof(struct light_bounds), r_gl_lights_compare_depth);
+        num_visible = SHADER_MAX_POINT_LIGHTS;
+    }
+
+    for(int i = 0; i < num_visible; i++) {
+
+        const struct point_light *light = &lights[bounds[i].light_idx];
+        block->pos_radius[i] = (vec4_t){light->pos.x, light->pos.y, light->pos.z, light->radius};
+        block->colors[i] = (vec4_t){light->color.x, light->color.y, light->color.z, 1.0f};
+    }
+
+    block->dims[0] = CLUSTER_X;
+    block->dims[1] = CLUSTER_Y;
+    block->dims[2] = CLUSTER_Z;
+    block->dims[3] = num_visible;
+    block->depth[0] = CLUSTER_NEAR;
+    block->depth[1] = 1.0f / logf(CONFIG_DRAWDIST / CLUSTER_NEAR);
+
+    /* The lights are binned in two passes: the cells' counts are taken first,
+     * so that each one's lights can be written to a contiguous range */
+    static GLuint counts[CLUSTER_CELLS];
+    memset(counts, 0, sizeof(counts));
+
+    for(int i = 0; i < num_visible; i++) {
+        const struct light_bounds *b = &bounds[i];
+        for(int z = b->z_min; z <= b->z_max; z++)
+        for(int y = b->y_min; y <= b->y_max; y++)
+        for(int x = b->x_min; x <= b->x_max; x++)
+            counts[(z * CLUSTER_Y + y) * CLUSTER_X + x]++;
+    }
+
+    /* Cells past the end of the index list are cut short */
+    GLuint offset = 0;
+    for(int i = 0; i < CLUSTER_CELLS; i++) {
+        counts[i] = MIN(counts[i], CLUSTER_INDICES - offset);
+        block->cells[i] = offset;
+        offset += counts[i];
+    }
+
+    memset(block->indices, 0, sizeof(block->indices));
+    for(int i = 0; i < num_visible; i++) {
+        const struct light_bounds *b = &bounds[i];
+        for(int z = b->z_min; z <= b->z_max; z++)
+        for(int y = b->y_min; y <= b->y_max; y++)
+        for(int x = b->x_min; x <= b->x_max; x++) {
+
+            int cell = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+            GLuint written = block->cells[cell] >> 16;
+            if(written == counts[cell])
+                continue;
+
+            GLuint slot = (block->cells[cell] & 0xffff) + written;
+            block->indices[slot / 4] |= (GLuint)i << ((slot % 4) * 8);
+            block->cells[cell] += (1 << 16);
+        }
+    }
+
+    R_Thread_Push(r_gl_lights_upload_exec, block, sizeof(struct lights_block));
+}
+
@@ -0,0 +1,320 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "texture.h"
+#include "shader.h"
+#include "vertex.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+
+#include <GL/glew.h>
+#include <SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+
+/* Must match the number of views in the impostor shaders */
+#define IMPOSTOR_VIEWS  (8)
+/* The resolution of each of the views in the atlas */
+#define IMPOSTOR_RES    (128)
+/* The bakes are spread out over frames, like the texture uploads */
+#define BAKES_PER_FRAME (4)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* The impostors which have yet to be drawn to their' atlas. Only touched by 
+ * the thread holding the GL context. */
+static kvec_t(struct impostor*) s_pending;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The quad is expanded to face the camera in the vertex shader. Its' 
+ * vertices all sit on the vertical axis of the bounds, with the 'u' 
+ * coordinate holding the horizontal offset to expand by and 'v' the 
+ * height in the atlas. */
+static void r_gl_impostor_quad(const struct aabb *bounds, float radius, struct vertex *out)
+{
+    float cx = (bounds->x_min + bounds->x_max) / 2.0f;
+    float cz = (bounds->z_min + bounds->z_max) / 2.0f;
+
+    const struct { float u, v; } corners[6] = {
+        {-1.0f, 0.0f}, { 1.0f, 0.0f}, { 1.0f, 1.0f},
+        {-1.0f, 0.0f}, { 1.0f, 1.0f}, {-1.0f, 1.0f},
+    };
+
+    for(int i = 0; i < 6; i++) {
+
+        float y = corners[i].v ? bounds->y_max : bounds->y_min;
+        out[i] = (struct vertex){
+            .pos = (vec3_t){cx, y, cz},
+            .uv = (vec2_t){corners[i].u * radius, corners[i].v},
+            .normal = (vec3_t){0.0f, 1.0f, 0.0f},
+            .material_idx = 0,
+        };
+    }
+}
+
+/* The horizontal distance of the farthest corner of the bounds from their' 
+ * vertical axis */
+static float r_gl_impostor_radius(const struct aabb *bounds)
+{
+    float dx = (bounds->x_max - bounds->x_min) / 2.0f;
+    float dz = (bounds->z_max - bounds->z_min) / 2.0f;
+    return sqrtf(dx * dx + dz * dz);
+}
+
+/* Draws the source mesh, unlit, from each of the views around its' vertical 
+ * axis into a cell of the atlas */
+static bool r_gl_impostor_bake(struct impostor *imp)
+{
+    const struct aabb *b = &imp->bounds;
+    GLuint shader_prog = R_Shader_GetProgForName("mesh.static.textured-array");
+    if(!shader_prog)
+        return false;
+
+    GLint old_fb, viewport[4];
+    GLfloat clear_color[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fb);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    GLuint fb, depth_rb;
+    glGenFramebuffers(1, &fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+
+    glGenRenderbuffers(1, &depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 
+        IMPOSTOR_RES * IMPOSTOR_VIEWS, IMPOSTOR_RES);
+
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, imp->material.texture.id, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+
+    GLenum draw_buffers[1] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, draw_buffers);
+    bool ret = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    if(!ret)
+        goto out;
+
+    /* The uncovered texels are left transparent, to be discarded */
+    glDisable(GL_BLEND);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    mat4x4_t identity;
+    PFM_Mat4x4_Identity(&identity);
+    GLint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
+    R_GL_SetMaterials(imp->source, shader_prog);
+    glBindVertexArray(imp->source->mesh.VAO);
+
+    float cx = (b->x_min + b->x_max) / 2.0f;
+    float cz = (b->z_min + b->z_max) / 2.0f;
+    float radius = r_gl_impostor_radius(b);
+    /* Far enough out for the whole mesh to be in front of the camera */
+    float dist = radius + MAX(fabsf(b->y_min), fabsf(b->y_max)) + 1.0f;
+
+    for(int i = 0; i < IMPOSTOR_VIEWS; i++) {
+
+        /* Must match the choice of the view in the impostor shaders */
+        float theta = 2.0f * M_PI * i / IMPOSTOR_VIEWS;
+        vec3_t target = (vec3_t){cx, 0.0f, cz};
+        vec3_t eye = (vec3_t){cx + sinf(theta) * dist, 0.0f, cz + cosf(theta) * dist};
+        vec3_t up = (vec3_t){0.0f, 1.0f, 0.0f};
+
+        mat4x4_t view, proj;
+        PFM_Mat4x4_MakeLookAt(&eye, &target, &up, &view);
+        PFM_Mat4x4_MakeOrthographic(-radius, radius, b->y_min, b->y_max, 0.0f, 2.0f * dist, &proj);
+
+        glViewport(i * IMPOSTOR_RES, 0, IMPOSTOR_RES, IMPOSTOR_RES);
+        R_GL_BeginLightspace(&view, &proj);
+        R_GL_DrawMesh(&imp->source->mesh, 1);
+        R_GL_EndLightspace();
+    }
+
+    glBindTexture(GL_TEXTURE_2D, imp->material.texture.id);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+out:
+    glBindFramebuffer(GL_FRAMEBUFFER, old_fb);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+    if(blend)
+        glEnable(GL_BLEND);
+
+    glDeleteRenderbuffers(1, &depth_rb);
+    glDeleteFramebuffers(1, &fb);
+    return ret;
+}
+
+static void r_gl_impostor_unqueue(const struct impostor *imp)
+{
+    for(int i = 0; i < kv_size(s_pending); i++) {
+        if(kv_A(s_pending, i) == imp) {
+            kv_del(struct impostor*, s_pending, i);
+            return;
+        }
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+struct impostor *R_GL_ImpostorCreate(const struct render_private *source, const struct aabb *bounds)
+{
+    R_Thread_Claim();
+
+    float radius = r_gl_impostor_radius(bounds);
+    if(!(radius > 0.0f) || !(bounds->y_max > bounds->y_min))
+        return NULL;
+
+    struct impostor *imp = MEM_Malloc(MEM_TAG_RENDER, sizeof(struct impostor));
+    if(!imp)
+        return NULL;
+
+    imp->source = source;
+    imp->bounds = *bounds;
+    SDL_AtomicSet(&imp->baked, 0);
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, IMPOSTOR_RES * IMPOSTOR_VIEWS, IMPOSTOR_RES, 
+        0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    /* The mip levels stop before the views bleed into one another */
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)log2(IMPOSTOR_RES) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    /* The ambient and diffuse response of the first material stands in for
+     * the whole mesh */
+    struct material *mat = &imp->material;
+    memset(mat, 0, sizeof(*mat));
+    if(source->num_materials > 0) {
+        mat->ambient_intensity = source->materials[0].ambient_intensity;
+        mat->diffuse_clr = source->materials[0].diffuse_clr;
+        mat->specular_clr = source->materials[0].specular_clr;
+    }
+    snprintf(mat->texname, sizeof(mat->texname), "__impostor__.%p", (void*)imp);
+    mat->texture.id = tex;
+    mat->texture.tunit = GL_TEXTURE0;
+
+    if(!R_Texture_AddExisting(mat->texname, tex)) {
+        glDeleteTextures(1, &tex);
+        MEM_Free(imp);
+        return NULL;
+    }
+    R_Texture_SetGPUSize(tex, IMPOSTOR_RES * IMPOSTOR_RES * IMPOSTOR_VIEWS * 4 * 4 / 3);
+
+    struct vertex quad[6];
+    r_gl_impostor_quad(bounds, radius, quad);
+
+    imp->priv = (struct render_private){
+        .mesh.num_verts = ARR_SIZE(quad),
+        .num_materials  = 1,
+        .materials      = &imp->material,
+        .material_base  = -1,
+    };
+    R_GL_Init(&imp->priv, "mesh.static.impostor", quad);
+
+    kv_push(struct impostor*, s_pending, imp);
+    return imp;
+}
+
+void R_GL_ImpostorFree(struct impostor *imp)
+{
+    R_Thread_Claim();
+
+    r_gl_impostor_unqueue(imp);
+    R_Texture_Free(imp->material.texname);
+    R_GL_Free(&imp->priv);
+    MEM_Free(imp);
+}
+
+void R_GL_ImpostorsUpdate(void)
+{
+    /* The views are drawn once the textures of the meshes are all in, rather 
+     * than with their' placeholder texels */
+    if(kv_size(s_pending) == 0 || R_Texture_LoadsPending())
+        return;
+
+    int num_baked = 0;
+    while(kv_size(s_pending) > 0 && num_baked < BAKES_PER_FRAME) {
+
+        struct impostor *imp = kv_pop(s_pending);
+        /* The impostor is left unused if it couldn't be drawn */
+        if(r_gl_impostor_bake(imp))
+            SDL_AtomicSet(&imp->baked, 1);
+        num_baked++;
+    }
+}
+
+const void *R_GL_SelectLOD(const void *render_private, float screen_size, float impostor_size)
+{
+    const struct render_private *priv = render_private;
+
+    if(priv->impostor && screen_size < impostor_size && SDL_AtomicGet(&priv->impostor->baked))
+        return &priv->impostor->priv;
+
+    /* The levels are in order of decreasing screen size */
+    const struct render_private *ret = priv;
+    for(int i = 0; i < priv->num_lods; i++) {
+        if(screen_size > priv->lods[i].screen_size)
+            break;
+        ret = &priv->lods[i].priv;
+    }
+    return ret;
+}
+
@@ -0,0 +1,219 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "shader.h"
+#include "public/render.h"
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+/* The std140 layout of an element of the 'material_table' block. The texture
+ * is the unit of the object's array that holds it in the high 16 bits, and 
+ * its' layer in the low ones, or -1 for none. */
+struct table_entry{
+    vec3_t  diffuse_clr;
+    GLfloat ambient_intensity;
+    vec3_t  specular_clr;
+    GLint   texture;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint s_UBO;
+/* Each model takes a contiguous run of entries, for all of its' materials */
+static bool   s_used[SHADER_MAX_TABLE_MATERIALS];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int r_gl_materials_find(size_t count)
+{
+    for(int base = 0; base + count <= SHADER_MAX_TABLE_MATERIALS; base++) {
+
+        int len = 0;
+        while(len < count && !s_used[base + len])
+            len++;
+
+        if(len == count)
+            return base;
+        base += len;
+    }
+    return -1;
+}
+
+/* Gives each of the arrays that the textures are packed in a unit of its' 
+ * own, in the order they're first used */
+static bool r_gl_materials_assign_units(struct render_private *priv)
+{
+    GLuint pages[SHADER_MAX_TEXTURE_PAGES];
+    int num_pages = 0;
+
+    for(int i = 0; i < priv->num_materials; i++) {
+
+        struct texture *tex = &priv->materials[i].texture;
+        if(!tex->packed)
+            continue;
+
+        int unit = 0;
+        while(unit < num_pages && pages[unit] != tex->id)
+            unit++;
+
+        if(unit == num_pages) {
+            if(num_pages == SHADER_MAX_TEXTURE_PAGES)
+                return false;
+            pages[num_pages++] = tex->id;
+        }
+        tex->tunit = GL_TEXTURE0 + unit;
+    }
+    return true;
+}
+
+static void r_gl_materials_upload(const struct render_private *priv)
+{
+    struct table_entry entries[SHADER_MAX_MATERIALS];
+    assert(priv->num_materials <= SHADER_MAX_MATERIALS);
+
+    for(int i = 0; i < priv->num_materials; i++) {
+
+        const struct material *mat = &priv->materials[i];
+        entries[i] = (struct table_entry){
+            .diffuse_clr       = mat->diffuse_clr,
+            .ambient_intensity = mat->ambient_intensity,
+            .specular_clr      = mat->specular_clr,
+            .texture           = mat->texture.packed 
+                               ? (GLint)((mat->texture.tunit - GL_TEXTURE0) << 16) | mat->texture.layer
+                               : -1,
+        };
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, priv->material_base * sizeof(struct table_entry), 
+        priv->num_materials * sizeof(struct table_entry), entries);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_MaterialsInit(void)
+{
+    GLint max_size;
+    glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_size);
+    if(max_size < sizeof(struct table_entry) * SHADER_MAX_TABLE_MATERIALS)
+        return false;
+
+    memset(s_used, 0, sizeof(s_used));
+
+    glGenBuffers(1, &s_UBO);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_UBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(struct table_entry) * SHADER_MAX_TABLE_MATERIALS, 
+        NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_MATERIALS_BINDING, s_UBO);
+    return true;
+}
+
+bool R_GL_MaterialsAlloc(struct render_private *priv)
+{
+    R_Thread_Claim();
+    assert(priv->material_base < 0);
+
+    if(!r_gl_materials_assign_units(priv)) {
+        fprintf(stderr, "The textures of the model are spread over more than %d arrays\n", 
+            SHADER_MAX_TEXTURE_PAGES);
+        return false;
+    }
+
+    int base = r_gl_materials_find(priv->num_materials);
+    if(base < 0) {
+        fprintf(stderr, "No room left in the material table for %zu materials\n", 
+            priv->num_materials);
+        return false;
+    }
+
+    for(int i = 0; i < priv->num_materials; i++)
+        s_used[base + i] = true;
+
+    priv->material_base = base;
+    r_gl_materials_upload(priv);
+    return true;
+}
+
+void R_GL_MaterialsFree(struct render_private *priv)
+{
+    if(priv->material_base < 0)
+        return;
+
+    R_Thread_Claim();
+    for(int i = 0; i < priv->num_materials; i++)
+        s_used[priv->material_base + i] = false;
+    priv->material_base = -1;
+}
+
+void R_GL_MaterialsUpdate(const struct render_private *priv)
+{
+    if(priv->material_base < 0)
+        return;
+
+    R_Thread_Claim();
+    r_gl_materials_upload(priv);
+}
+
+void R_GL_MaterialsBind(const struct render_private *priv, GLuint shader_prog, 
+                        GLuint *bound)
+{
+    assert(priv->material_base >= 0);
+
+    for(int i = 0; i < priv->num_materials; i++) {
+
+        const struct texture *tex = &priv->materials[i].texture;
+        if(!tex->packed || bound[tex->tunit - GL_TEXTURE0] == tex->id)
+            continue;
+
+        glActiveTexture(tex->tunit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, tex->id);
+        R_GL_StatsTextureBind();
+        bound[tex->tunit - GL_TEXTURE0] = tex->id;
+    }
+
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_MATERIAL_BASE), priv->material_base);
+}
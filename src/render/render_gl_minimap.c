@@ -33,11 +33,12 @@
  *
  */
 
+#include "render_gl.h"
 #include "mesh.h"
 #include "vertex.h"
 #include "texture.h"
 #include "shader.h"
-#include "gl_uniforms.h"
+#include "bake_cache.h"
 #include "public/render.h"
 #include "../map/public/tile.h"
 #include "../camera.h"
@@ -45,6 +46,8 @@
 #include "../config.h"
 #include "../map/public/map.h"
 #include "../collision.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #include <stddef.h>
 #include <stdbool.h>
@@ -53,33 +56,54 @@
 #include <assert.h>
 
 #define MAX(a, b)            ((a) > (b) ? (a) : (b))
+#define MIN(a, b)            ((a) < (b) ? (a) : (b))
 #define ARR_SIZE(a)          (sizeof(a)/sizeof(a[0])) 
 #define MINIMAP_RES          (1024)
 #define MINIMAP_BORDER_CLR   ((vec4_t){65.0f/255.0f, 65.0f/255.0f, 65.0f/255.0f, 1.0f})
 #define MINIMAP_BORDER_WIDTH (3.0f)
+#define MINIMAP_UNIT_PX      (3.0f)
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+struct minimap_render_args{
+    vec2_t center_pos;
+    bool   has_box;
+    vec3_t box[4];
+};
+
+struct minimap_units_args{
+    size_t count;
+};
+
 struct render_minimap_ctx{
     struct texture minimap_texture;
     struct mesh    minimap_mesh;
+    /* The unit blips, as points in the coordinates of the minimap quad */
+    GLuint         units_VAO, units_VBO;
+    size_t         num_units;
+    /* For rendering the updated chunks into the texture */
+    GLuint         update_fb;
+    /* The cache key of the texture, for storing it once it is complete */
+    uint64_t       key;
 }s_ctx;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-void r_gl_draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, const struct map *map)
+/* Writes the outline of the area that the camera sees to 'out', in the coordinates of the 
+ * minimap quad. Returns false if there is nothing to draw. */
+static bool r_gl_cam_frustum_box(const struct camera *cam, const struct map *map, vec3_t out[4])
 {
     /* First, find the 4 points where the camera frustum intersects the ground plane (y=0).
      * If there is no intersection, exit early.*/
     vec3_t tr, tl, br, bl;
 
-    struct frustum cam_frust;
-    Camera_MakeFrustum(cam, &cam_frust);
-    vec3_t cam_pos = Camera_GetPos(cam);
+    const struct camera_state *state = Camera_GetState(cam);
+    struct frustum cam_frust = state->frustum;
+    vec3_t cam_pos = state->pos;
 
     struct plane ground_plane = {
         .point  = {0.0f, 0.0f, 0.0f},
@@ -117,12 +141,12 @@ void r_gl_draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, co
     /* When the bottom part of the frustum doesn't intersect the ground plane,
      * there is nothing to draw. */
     if(!C_RayIntersectsPlane(cam_pos, br_dir, ground_plane, &t))
-        return;
+        return false;
     PFM_Vec3_Scale(&br_dir, t, &br_dir);
     PFM_Vec3_Add(&cam_pos, &br_dir, &br);
 
     if(!C_RayIntersectsPlane(cam_pos, bl_dir, ground_plane, &t))
-        return;
+        return false;
     PFM_Vec3_Scale(&bl_dir, t, &bl_dir);
     PFM_Vec3_Add(&cam_pos, &bl_dir, &bl);
 
@@ -134,64 +158,125 @@ void r_gl_draw_cam_frustum(const struct camera *cam, mat4x4_t *minimap_model, co
     vec2_t norm_br = M_WorldCoordsToNormMapCoords(map, (vec2_t){br.x, br.z});
     vec2_t norm_bl = M_WorldCoordsToNormMapCoords(map, (vec2_t){bl.x, bl.z});
 
-    /* Finally, render the visible box outline. */
-    const struct vertex box_verts[] = {
-        (struct vertex) { .pos = (vec3_t) {norm_tr.raw[0], norm_tr.raw[1], 0.0f} },
-        (struct vertex) { .pos = (vec3_t) {norm_tl.raw[0], norm_tl.raw[1], 0.0f} },
-        (struct vertex) { .pos = (vec3_t) {norm_bl.raw[0], norm_bl.raw[1], 0.0f} },
-        (struct vertex) { .pos = (vec3_t) {norm_br.raw[0], norm_br.raw[1], 0.0f} },
-    };
-
-    GLuint VAO, VBO;
-
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, ARR_SIZE(box_verts) * sizeof(struct vertex), box_verts, GL_STATIC_DRAW);
+    out[0] = (vec3_t) {norm_tr.raw[0], norm_tr.raw[1], 0.0f};
+    out[1] = (vec3_t) {norm_tl.raw[0], norm_tl.raw[1], 0.0f};
+    out[2] = (vec3_t) {norm_bl.raw[0], norm_bl.raw[1], 0.0f};
+    out[3] = (vec3_t) {norm_br.raw[0], norm_br.raw[1], 0.0f};
+    return true;
+}
 
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
+static void r_gl_draw_cam_frustum(const vec3_t box_verts[4], const mat4x4_t *minimap_model)
+{
+    /* Render the visible box outline. */
+    GLint first = R_GL_StreamUpload(STREAM_FMT_POS, box_verts, 4);
+    if(first < 0)
+        return;
 
     GLuint shader_prog = R_Shader_GetProgForName("mesh.static.colored");
     glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
 
-    GLuint loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    GLuint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, minimap_model->raw);
 
     vec4_t black = (vec4_t){0.0f, 0.0f, 0.0f, 1.0f};
     vec4_t white = (vec4_t){1.0f, 1.0f, 1.0f, 1.0f};
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_Shader_UniformLoc(shader_prog, SU_COLOR);
     glUniform4fv(loc, 1, black.raw);
 
-    glDrawArrays(GL_LINE_LOOP, 0, 4);
+    glDrawArrays(GL_LINE_LOOP, first, 4);
+    R_GL_StatsDraw(4);
 
     mat4x4_t one_px_trans, new_model;
     PFM_Mat4x4_MakeTrans(-1.0f, -1.0f, 0.0f, &one_px_trans);
     PFM_Mat4x4_Mult4x4(&one_px_trans, minimap_model, &new_model);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
+    loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
     glUniformMatrix4fv(loc, 1, GL_FALSE, new_model.raw);
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
+    loc = R_Shader_UniformLoc(shader_prog, SU_COLOR);
     glUniform4fv(loc, 1, white.raw);
 
-    glDrawArrays(GL_LINE_LOOP, 0, 4);
+    glDrawArrays(GL_LINE_LOOP, first, 4);
+    R_GL_StatsDraw(4);
+}
 
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+static void r_gl_draw_units(const mat4x4_t *minimap_model)
+{
+    if(!s_ctx.num_units)
+        return;
+
+    GLuint shader_prog = R_Shader_GetProgForName("mesh.static.colored-per-vert");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    GLuint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, minimap_model->raw);
+
+    glPointSize(MINIMAP_UNIT_PX);
+    glBindVertexArray(s_ctx.units_VAO);
+    glDrawArrays(GL_POINTS, 0, s_ctx.num_units);
+    R_GL_StatsDraw(s_ctx.num_units);
+    glPointSize(1.0f);
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+/* The argument is followed by the vertices of the blips */
+static void r_gl_minimap_units_exec(const void *arg)
+{
+    const struct minimap_units_args *args = arg;
+    if(!s_ctx.units_VBO)
+        return;
 
-bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats, 
-                      size_t chunk_x, size_t chunk_z,
-                      vec3_t map_center, vec2_t map_size)
+    /* The old contents are orphaned rather than waited on */
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.units_VBO);
+    glBufferData(GL_ARRAY_BUFFER, args->count * sizeof(struct colored_vert), args + 1, GL_STREAM_DRAW);
+    s_ctx.num_units = args->count;
+}
+
+/* Finds the pixels of the minimap texture whose centers lie within the chunk's 
+ * footprint, as x, y, width, height. The regions of neighbouring chunks meet 
+ * without overlapping. */
+static void r_gl_minimap_chunk_rect(const mat4x4_t *view_proj, const mat4x4_t *chunk_model, GLint out[4])
+{
+    const float width = TILES_PER_CHUNK_WIDTH * X_COORDS_PER_TILE;
+    const float height = TILES_PER_CHUNK_HEIGHT * Z_COORDS_PER_TILE;
+    const vec4_t corners[4] = {
+        {0.0f,   0.0f, 0.0f,   1.0f},
+        {-width, 0.0f, 0.0f,   1.0f},
+        {0.0f,   0.0f, height, 1.0f},
+        {-width, 0.0f, height, 1.0f},
+    };
+
+    float min[2] = {INFINITY, INFINITY}, max[2] = {-INFINITY, -INFINITY};
+    for(int i = 0; i < ARR_SIZE(corners); i++) {
+
+        vec4_t world, clip;
+        PFM_Mat4x4_Mult4x1(chunk_model, &corners[i], &world);
+        PFM_Mat4x4_Mult4x1(view_proj, &world, &clip);
+
+        for(int j = 0; j < 2; j++) {
+            float px = (clip.raw[j] / clip.w * 0.5f + 0.5f) * MINIMAP_RES;
+            min[j] = MIN(min[j], px);
+            max[j] = MAX(max[j], px);
+        }
+    }
+
+    for(int j = 0; j < 2; j++) {
+        GLint lo = MAX(ceilf(min[j] - 0.5f), 0);
+        GLint hi = MIN(ceilf(max[j] - 0.5f), MINIMAP_RES);
+        out[j] = lo;
+        out[j + 2] = hi - lo;
+    }
+}
+
+/* Renders the top-down view of the whole map to a new texture */
+static bool r_gl_minimap_render_tex(void **chunk_rprivates, mat4x4_t *chunk_model_mats, 
+                                    size_t chunk_x, size_t chunk_z,
+                                    vec3_t map_center, vec2_t map_size, GLuint *out_tex)
 {
+    /* The materials' images must be in place before they are rendered into the minimap */
+    R_Texture_FinishLoads();
+
     /* Create a new camera, with orthographic projection, centered 
      * over the map and facing straight down. */
     DECL_CAMERA_STACK(map_cam);
@@ -214,14 +299,14 @@ bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats,
     glGenFramebuffers(1, &fb);
     glBindFramebuffer(GL_FRAMEBUFFER, fb);
 
-    glGenTextures(1, &s_ctx.minimap_texture.id);
-    glBindTexture(GL_TEXTURE_2D, s_ctx.minimap_texture.id);
+    glGenTextures(1, out_tex);
+    glBindTexture(GL_TEXTURE_2D, *out_tex);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, MINIMAP_RES, MINIMAP_RES, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s_ctx.minimap_texture.id, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, *out_tex, 0);
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         goto fail_fb;
 
@@ -232,17 +317,140 @@ bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats,
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     for(int r = 0; r < chunk_z; r++) {
         for(int c = 0; c < chunk_x; c++) {
+            if(!chunk_rprivates[r * chunk_x + c])
+                continue;
             R_GL_Draw(chunk_rprivates[r * chunk_x + c], chunk_model_mats + (r * chunk_x + c)); 
         }
     }
     glViewport(0,0, CONFIG_RES_X, CONFIG_RES_Y);
 
-    s_ctx.minimap_texture.tunit = GL_TEXTURE0;
-    R_Texture_AddExisting("__minimap__", s_ctx.minimap_texture.id);
-
     /* Re-bind the default framebuffer when we're done rendering */
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glDeleteFramebuffers(1, &fb);
+    return true;
+
+fail_fb:
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fb);
+    glDeleteTextures(1, out_tex);
+    return false;
+}
+
+static void r_gl_minimap_render_exec(const void *arg)
+{
+    const struct minimap_render_args *args = arg;
+    vec2_t center_pos = args->center_pos;
+
+    R_GL_BeginScreenspace();
+
+    float horiz_width = MINIMAP_SIZE / cos(M_PI/4.0f);
+
+    mat4x4_t tmp;
+    mat4x4_t tilt, trans, scale, model;
+    PFM_Mat4x4_MakeRotZ(DEG_TO_RAD(-45.0f), &tilt);
+    PFM_Mat4x4_MakeScale(MINIMAP_SIZE/2.0f, MINIMAP_SIZE/2.0f, 1.0f, &scale);
+    PFM_Mat4x4_MakeTrans(center_pos.x, center_pos.y, 0.0f, &trans);
+    PFM_Mat4x4_Mult4x4(&tilt, &scale, &tmp);
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, &model);
+
+    /* We scale up the quad slightly and center it in the same position, then draw it behind 
+     * the minimap to create the minimap border */
+    float scale_fac = (MINIMAP_SIZE + 2*MINIMAP_BORDER_WIDTH)/2.0f;
+    mat4x4_t border_scale, border_model;
+    PFM_Mat4x4_MakeScale(scale_fac, scale_fac, scale_fac, &border_scale);
+    PFM_Mat4x4_Mult4x4(&tilt, &border_scale, &tmp);
+    PFM_Mat4x4_Mult4x4(&trans, &tmp, &border_model);
+
+    GLuint shader_prog;
+    glBindVertexArray(s_ctx.minimap_mesh.VAO);
+
+    glDisable(GL_DEPTH_TEST);
+
+    /* First render a slightly larger colored quad as the border */
+    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    GLuint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, border_model.raw);
+
+    loc = R_Shader_UniformLoc(shader_prog, SU_COLOR);
+    glUniform4fv(loc, 1, MINIMAP_BORDER_CLR.raw);
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    R_GL_StatsDraw(4);
+
+    /* Mask the minimap region in the stencil buffer before drawing the
+     * camera frustum so that it is not drawn outside the minimap region. */
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 1, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+    /* Now draw the minimap texture */
+    shader_prog = R_Shader_GetProgForName("mesh.static.textured");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
+
+    R_Texture_GL_Activate(&s_ctx.minimap_texture, shader_prog);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    R_GL_StatsDraw(4);
+
+    /* The blips can hang over the edges of the map */
+    glStencilFunc(GL_EQUAL, 1, 0xff);
+    r_gl_draw_units(&model);
+
+    /* Draw a box around the visible area*/
+    if(args->has_box) {
+        r_gl_draw_cam_frustum(args->box, &model); 
+    }
+
+    glDisable(GL_STENCIL_TEST);
+    glEnable(GL_DEPTH_TEST);
+    R_GL_EndScreenspace();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats, 
+                      size_t chunk_x, size_t chunk_z,
+                      vec3_t map_center, vec2_t map_size,
+                      uint64_t key, const char *cache_path, bool *out_partial)
+{
+    /* The minimap has to be rendered before the map can be drawn with it */
+    R_Thread_BeginImmediate();
+    *out_partial = false;
+
+    const int res = MINIMAP_RES;
+    key = R_BakeCache_Hash(key, &res, sizeof(res));
+    key = R_BakeCache_Hash(key, map_center.raw, sizeof(map_center.raw));
+    key = R_BakeCache_Hash(key, map_size.raw, sizeof(map_size.raw));
+    s_ctx.key = key;
+
+    /* The texture is kept uncompressed so that 'R_GL_MinimapUpdateChunks' 
+     * can render to it */
+    if(!cache_path 
+    || !R_BakeCache_Load(cache_path, key, GL_LINEAR, true, &s_ctx.minimap_texture.id)) {
+
+        if(!r_gl_minimap_render_tex(chunk_rprivates, chunk_model_mats, chunk_x, chunk_z, 
+                                    map_center, map_size, &s_ctx.minimap_texture.id))
+            goto fail_render;
+
+        for(int i = 0; i < chunk_x * chunk_z; i++) {
+            if(!chunk_rprivates[i])
+                *out_partial = true;
+        }
+
+        if(cache_path && !*out_partial)
+            R_BakeCache_Store(cache_path, key, s_ctx.minimap_texture.id);
+    }
+
+    s_ctx.minimap_texture.tunit = GL_TEXTURE0;
+    R_Texture_AddExisting("__minimap__", s_ctx.minimap_texture.id);
 
     struct vertex map_verts[] = {
         (struct vertex) {
@@ -279,15 +487,43 @@ bool R_GL_MinimapBake(void **chunk_rprivates, mat4x4_t *chunk_model_mats,
         (void*)offsetof(struct vertex, uv));
     glEnableVertexAttribArray(1);
 
+    glGenVertexArrays(1, &s_ctx.units_VAO);
+    glBindVertexArray(s_ctx.units_VAO);
+
+    glGenBuffers(1, &s_ctx.units_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_ctx.units_VBO);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, pos));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+        (void*)offsetof(struct colored_vert, color));
+    glEnableVertexAttribArray(1);
+
+    glBindVertexArray(0);
+    s_ctx.num_units = 0;
+
+    R_Thread_EndImmediate();
     return true;
 
-fail_fb:
+fail_render:
+    R_Thread_EndImmediate();
     return false;
 }
 
-bool R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate, mat4x4_t *chunk_model, 
-                             vec3_t map_center, vec2_t map_size)
+bool R_GL_MinimapUpdateChunks(void **chunk_rprivates, mat4x4_t *chunk_models, size_t count,
+                              vec3_t map_center, vec2_t map_size)
 {
+    /* Nothing to update before the minimap is baked */
+    if(!s_ctx.minimap_texture.id)
+        return false;
+
+    R_Thread_BeginImmediate();
+
+    /* The materials' images must be in place before they are rendered into the minimap */
+    R_Texture_FinishLoads();
+
     /* Create a new camera, with orthographic projection, centered 
      * over the map and facing straight down. */
     DECL_CAMERA_STACK(map_cam);
@@ -304,105 +540,95 @@ bool R_GL_MinimapUpdateChunk(const struct map *map, void *chunk_rprivate, mat4x4
     vec2_t top_right = (vec2_t){  (map_dim/2), -(map_dim/2) };
     Camera_TickFinishOrthographic((struct camera*)map_cam, bot_left, top_right);
 
-    /* Next, create a new framebuffer and texture that we will render our chunk 
-     * top-down view to. Bind the existing minimap texture to it.*/
-    GLuint fb;
-    glGenFramebuffers(1, &fb);
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    mat4x4_t view, proj, view_proj;
+    Camera_MakeViewMat((struct camera*)map_cam, &view);
+    PFM_Mat4x4_MakeOrthographic(bot_left.raw[0], top_right.raw[0], bot_left.raw[1], top_right.raw[1], 
+        CAM_Z_NEAR_DIST, CONFIG_DRAWDIST, &proj);
+    PFM_Mat4x4_Mult4x4(&proj, &view, &view_proj);
 
-    assert(s_ctx.minimap_texture.id > 0);
+    /* The framebuffer is kept around for the next update */
+    if(!s_ctx.update_fb)
+        glGenFramebuffers(1, &s_ctx.update_fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, s_ctx.update_fb);
     glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, s_ctx.minimap_texture.id, 0);
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         goto fail_fb;
 
+    /* Each chunk's region is cleared and drawn again on its own, so that
+     * the rest of the texture is left alone */
     glViewport(0,0, MINIMAP_RES, MINIMAP_RES);
-    R_GL_Draw(chunk_rprivate, chunk_model);
+    glEnable(GL_SCISSOR_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    for(int i = 0; i < count; i++) {
+
+        GLint rect[4];
+        r_gl_minimap_chunk_rect(&view_proj, &chunk_models[i], rect);
+        if(rect[2] <= 0 || rect[3] <= 0)
+            continue;
+
+        glScissor(rect[0], rect[1], rect[2], rect[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        R_GL_Draw(chunk_rprivates[i], &chunk_models[i]);
+    }
+
+    glDisable(GL_SCISSOR_TEST);
     glViewport(0,0, CONFIG_RES_X, CONFIG_RES_Y);
 
     /* Re-bind the default framebuffer when we're done rendering */
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDeleteFramebuffers(1, &fb);
 
+    R_Thread_EndImmediate();
     return true;
 
 fail_fb:
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    R_Thread_EndImmediate();
     return false;
 }
 
-void R_GL_MinimapRender(const struct map *map, const struct camera *cam, vec2_t center_pos)
+bool R_GL_MinimapStore(const char *cache_path)
 {
-    mat4x4_t ortho;
-    PFM_Mat4x4_MakeOrthographic(0.0f, CONFIG_RES_X, CONFIG_RES_Y, 0.0f, -1.0f, 1.0f, &ortho);
-    R_GL_SetProj(&ortho);
-
-    mat4x4_t identity;
-    PFM_Mat4x4_Identity(&identity);
-    vec3_t dummy_pos = (vec3_t){0.0f};
-    R_GL_SetViewMatAndPos(&identity, &dummy_pos);
+    if(!s_ctx.minimap_texture.id)
+        return false;
 
-    float horiz_width = MINIMAP_SIZE / cos(M_PI/4.0f);
-
-    mat4x4_t tmp;
-    mat4x4_t tilt, trans, scale, model;
-    PFM_Mat4x4_MakeRotZ(DEG_TO_RAD(-45.0f), &tilt);
-    PFM_Mat4x4_MakeScale(MINIMAP_SIZE/2.0f, MINIMAP_SIZE/2.0f, 1.0f, &scale);
-    PFM_Mat4x4_MakeTrans(center_pos.x, center_pos.y, 0.0f, &trans);
-    PFM_Mat4x4_Mult4x4(&tilt, &scale, &tmp);
-    PFM_Mat4x4_Mult4x4(&trans, &tmp, &model);
-
-    /* We scale up the quad slightly and center it in the same position, then draw it behind 
-     * the minimap to create the minimap border */
-    float scale_fac = (MINIMAP_SIZE + 2*MINIMAP_BORDER_WIDTH)/2.0f;
-    mat4x4_t border_scale, border_model;
-    PFM_Mat4x4_MakeScale(scale_fac, scale_fac, scale_fac, &border_scale);
-    PFM_Mat4x4_Mult4x4(&tilt, &border_scale, &tmp);
-    PFM_Mat4x4_Mult4x4(&trans, &tmp, &border_model);
-
-    GLuint shader_prog;
-    glBindVertexArray(s_ctx.minimap_mesh.VAO);
-
-    glDisable(GL_DEPTH_TEST);
-
-    /* First render a slightly larger colored quad as the border */
-    shader_prog = R_Shader_GetProgForName("mesh.static.colored");
-    glUseProgram(shader_prog);
-
-    GLuint loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, border_model.raw);
-
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform4fv(loc, 1, MINIMAP_BORDER_CLR.raw);
-
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    R_Thread_Claim();
+    return R_BakeCache_Store(cache_path, s_ctx.key, s_ctx.minimap_texture.id);
+}
 
-    /* Mask the minimap region in the stencil buffer before drawing the
-     * camera frustum so that it is not drawn outside the minimap region. */
-    glEnable(GL_STENCIL_TEST);
-    glStencilFunc(GL_ALWAYS, 1, 0xff);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+void R_GL_MinimapRender(const struct map *map, const struct camera *cam, vec2_t center_pos)
+{
+    /* The camera and map may change by the time the minimap is drawn */
+    struct minimap_render_args args = {.center_pos = center_pos};
+    args.has_box = cam && r_gl_cam_frustum_box(cam, map, args.box);
 
-    /* Now draw the minimap texture */
-    shader_prog = R_Shader_GetProgForName("mesh.static.textured");
-    glUseProgram(shader_prog);
+    R_Thread_Push(r_gl_minimap_render_exec, &args, sizeof(args));
+}
 
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, model.raw);
+void R_GL_MinimapSetUnits(const struct map *map, const vec2_t *xz, const vec4_t *colors, size_t count)
+{
+    size_t argsize = sizeof(struct minimap_units_args) + count * sizeof(struct colored_vert);
+    struct minimap_units_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        return;
 
-    R_Texture_GL_Activate(&s_ctx.minimap_texture, shader_prog);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    args->count = count;
+    struct colored_vert *verts = (struct colored_vert*)(args + 1);
 
-    /* Draw a box around the visible area*/
-    if(cam) {
-        glStencilFunc(GL_EQUAL, 1, 0xff);
-        r_gl_draw_cam_frustum(cam, &model, map); 
+    for(int i = 0; i < count; i++) {
+        vec2_t norm = M_WorldCoordsToNormMapCoords(map, xz[i]);
+        verts[i] = (struct colored_vert){
+            .pos = (vec3_t){norm.x, norm.y, 0.0f},
+            .color = colors[i]
+        };
     }
-
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_DEPTH_TEST);
+    R_Thread_Push(r_gl_minimap_units_exec, args, argsize);
 }
 
 void R_GL_MinimapFree(void)
 {
+    R_Thread_Claim();
+
     assert(s_ctx.minimap_texture.id > 0);
     assert(s_ctx.minimap_mesh.VBO > 0);
     assert(s_ctx.minimap_mesh.VAO > 0);
@@ -410,6 +636,9 @@ void R_GL_MinimapFree(void)
     R_Texture_Free("__minimap__");
     glDeleteBuffers(1, &s_ctx.minimap_mesh.VAO);
     glDeleteBuffers(1, &s_ctx.minimap_mesh.VBO);
+    glDeleteVertexArrays(1, &s_ctx.units_VAO);
+    glDeleteBuffers(1, &s_ctx.units_VBO);
+    glDeleteFramebuffers(1, &s_ctx.update_fb);
     memset(&s_ctx, 0, sizeof(s_ctx));
 }
 
@@ -0,0 +1,351 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../collision.h"
+#include "../camera.h"
+#include "../mem.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#define VERTS_PER_BOX       (36)
+/* Queries of objects that haven't been tested for this many frames are
+ * given back to the pool */
+#define EVICT_AFTER_FRAMES  (120)
+
+/* The state of the occlusion test of a single object. The last completed
+ * query decides whether the object is visible. A new query is only issued
+ * once the previous one has completed, so the results lag behind by at
+ * least one frame. */
+struct occl_query{
+    GLuint   query;
+    bool     pending;
+    bool     visible;
+    uint32_t last_frame;
+};
+
+struct occl_exec_args{
+    size_t count;
+};
+
+KHASH_MAP_INIT_INT(occl, struct occl_query)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static khash_t(occl)           *s_queries;
+static kvec_t(GLuint)           s_free_queries;
+static kvec_t(vec3_t)           s_verts;
+static GLuint                   s_VAO, s_VBO;
+static uint32_t                 s_frame;
+static struct occlusion_stats   s_stats;
+
+/* The corners of 'struct obb' are indexed by the sign of the offset along
+ * each of the axes: bit 2 for the first axis, bit 1 for the second and
+ * bit 0 for the third. */
+static const int s_box_tris[VERTS_PER_BOX] = {
+    0, 1, 3,   0, 3, 2,
+    4, 6, 7,   4, 7, 5,
+    0, 4, 5,   0, 5, 1,
+    2, 3, 7,   2, 7, 6,
+    0, 2, 6,   0, 6, 4,
+    1, 5, 7,   1, 7, 3,
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The box can't be tested when the near plane cuts through it - the clipped
+ * faces would let the object be rejected while the camera is inside it. */
+static bool r_gl_occl_contains_view(const struct obb *obb, vec3_t view_pos)
+{
+    vec3_t delta;
+    PFM_Vec3_Sub(&view_pos, (vec3_t*)&obb->center, &delta);
+
+    for(int i = 0; i < 3; i++) {
+        float dist = PFM_Vec3_Dot(&delta, (vec3_t*)&obb->axes[i]);
+        if(fabs(dist) > obb->half_lengths[i] + CAM_Z_NEAR_DIST * 2.0f)
+            return false;
+    }
+    return true;
+}
+
+static void r_gl_occl_evict_stale(void)
+{
+    for(khiter_t k = kh_begin(s_queries); k != kh_end(s_queries); k++) {
+
+        if(!kh_exist(s_queries, k))
+            continue;
+
+        struct occl_query *oq = &kh_value(s_queries, k);
+        if(s_frame - oq->last_frame < EVICT_AFTER_FRAMES)
+            continue;
+
+        /* A query that is still in flight can be re-used all the same -
+         * beginning it again discards the old result */
+        if(oq->query)
+            kv_push(GLuint, s_free_queries, oq->query);
+        kh_del(occl, s_queries, k);
+    }
+}
+
+static struct occl_query *r_gl_occl_get(uint32_t id)
+{
+    int status;
+    khiter_t k = kh_put(occl, s_queries, id, &status);
+    if(status == -1)
+        return NULL;
+
+    if(status == 0)
+        return &kh_value(s_queries, k);
+
+    /* The query object is generated when the test is first issued, since
+     * this may be running without the GL context */
+    GLuint query = 0;
+    if(kv_size(s_free_queries))
+        query = kv_pop(s_free_queries);
+
+    /* Until the first result comes in, assume the object can be seen */
+    kh_value(s_queries, k) = (struct occl_query){
+        .query = query,
+        .pending = false,
+        .visible = true,
+        .last_frame = s_frame
+    };
+    return &kh_value(s_queries, k);
+}
+
+/* Polls the queries of the tested objects and issues new ones for those 
+ * which don't have one in flight. The argument is followed by the ids of
+ * the objects and then by the triangles of their boxes. */
+static void r_gl_occl_exec(const void *arg)
+{
+    const struct occl_exec_args *args = arg;
+    const uint32_t *ids = (const uint32_t*)(args + 1);
+    const vec3_t *boxes = (const vec3_t*)(ids + args->count);
+
+    GLuint to_issue[args->count + 1];
+    size_t num_issue = 0;
+    kv_reset(s_verts);
+
+    for(int i = 0; i < args->count; i++) {
+
+        khiter_t k = kh_get(occl, s_queries, ids[i]);
+        if(k == kh_end(s_queries))
+            continue;
+        struct occl_query *oq = &kh_value(s_queries, k);
+
+        if(!oq->query)
+            glGenQueries(1, &oq->query);
+
+        if(oq->pending) {
+
+            GLuint avail;
+            glGetQueryObjectuiv(oq->query, GL_QUERY_RESULT_AVAILABLE, &avail);
+            if(avail) {
+                GLuint any_passed;
+                glGetQueryObjectuiv(oq->query, GL_QUERY_RESULT, &any_passed);
+                oq->visible = !!any_passed;
+                oq->pending = false;
+            }
+        }
+
+        if(oq->pending)
+            continue;
+
+        for(int j = 0; j < VERTS_PER_BOX; j++)
+            kv_push(vec3_t, s_verts, boxes[i * VERTS_PER_BOX + j]);
+        to_issue[num_issue++] = oq->query;
+        oq->pending = true;
+    }
+
+    s_stats.issued = num_issue;
+    if(!num_issue)
+        return;
+
+    /* The boxes only need to be tested against what's already in the depth
+     * buffer, and must not leave anything behind. Both sides of the faces
+     * are drawn, so it doesn't matter which way the boxes are wound. */
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    GLboolean cull = glIsEnabled(GL_CULL_FACE);
+    glDisable(GL_CULL_FACE);
+
+    GLuint shader_prog = R_Shader_GetProgForName("mesh.static.colored");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    mat4x4_t identity;
+    PFM_Mat4x4_Identity(&identity);
+    GLuint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, identity.raw);
+
+    glBindVertexArray(s_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+    glBufferData(GL_ARRAY_BUFFER, kv_size(s_verts) * sizeof(vec3_t), s_verts.a, GL_STREAM_DRAW);
+
+    for(int i = 0; i < num_issue; i++) {
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, to_issue[i]);
+        glDrawArrays(GL_TRIANGLES, i * VERTS_PER_BOX, VERTS_PER_BOX);
+        R_GL_StatsDraw(VERTS_PER_BOX);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+
+    glBindVertexArray(0);
+    if(cull)
+        glEnable(GL_CULL_FACE);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_OcclusionInit(void)
+{
+    s_queries = kh_init(occl);
+    if(!s_queries)
+        return false;
+
+    kv_init(s_free_queries);
+    kv_init(s_verts);
+
+    glGenVertexArrays(1, &s_VAO);
+    glBindVertexArray(s_VAO);
+
+    glGenBuffers(1, &s_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindVertexArray(0);
+    return true;
+}
+
+void R_GL_OcclusionReset(void)
+{
+    R_Thread_Claim();
+
+    for(khiter_t k = kh_begin(s_queries); k != kh_end(s_queries); k++) {
+
+        if(!kh_exist(s_queries, k) || !kh_value(s_queries, k).query)
+            continue;
+        kv_push(GLuint, s_free_queries, kh_value(s_queries, k).query);
+    }
+    kh_clear(occl, s_queries);
+    s_stats = (struct occlusion_stats){0};
+}
+
+void R_GL_OcclusionTest(const uint32_t *ids, const struct obb *obbs, size_t count,
+                        vec3_t view_pos, bool *out_visible)
+{
+    s_frame++;
+    s_stats = (struct occlusion_stats){0};
+
+    if(s_frame % EVICT_AFTER_FRAMES == 0)
+        r_gl_occl_evict_stale();
+
+    if(!count)
+        return;
+
+    size_t argsize = sizeof(struct occl_exec_args) 
+                   + count * (sizeof(uint32_t) + VERTS_PER_BOX * sizeof(vec3_t));
+    struct occl_exec_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        goto fail_alloc;
+
+    uint32_t *test_ids = (uint32_t*)(args + 1);
+    vec3_t *test_boxes = (vec3_t*)(test_ids + count);
+    args->count = 0;
+
+    for(int i = 0; i < count; i++) {
+
+        struct occl_query *oq = r_gl_occl_get(ids[i]);
+        if(!oq || r_gl_occl_contains_view(&obbs[i], view_pos))
+            continue;
+        oq->last_frame = s_frame;
+
+        for(int j = 0; j < VERTS_PER_BOX; j++)
+            test_boxes[args->count * VERTS_PER_BOX + j] = obbs[i].corners[s_box_tris[j]];
+        test_ids[args->count++] = ids[i];
+    }
+
+    /* The boxes were laid out for 'count' objects */
+    memmove(test_ids + args->count, test_boxes, args->count * VERTS_PER_BOX * sizeof(vec3_t));
+    argsize = sizeof(struct occl_exec_args) 
+            + args->count * (sizeof(uint32_t) + VERTS_PER_BOX * sizeof(vec3_t));
+
+    /* When drawing is done on the render thread, the queries are only polled
+     * after this returns, so the results lag behind by one more frame */
+    R_Thread_Push(r_gl_occl_exec, args, argsize);
+
+fail_alloc:
+    for(int i = 0; i < count; i++) {
+
+        khiter_t k = kh_get(occl, s_queries, ids[i]);
+        if(k == kh_end(s_queries) || r_gl_occl_contains_view(&obbs[i], view_pos)) {
+            out_visible[i] = true;
+            continue;
+        }
+
+        const struct occl_query *oq = &kh_value(s_queries, k);
+        out_visible[i] = oq->visible;
+        s_stats.tested++;
+        s_stats.occluded += !oq->visible;
+    }
+    s_stats.tracked = kh_size(s_queries);
+}
+
+void R_GL_OcclusionGetStats(struct occlusion_stats *out)
+{
+    /* The number of issued queries is only known once the frame is drawn */
+    R_Thread_Claim();
+    *out = s_stats;
+}
+
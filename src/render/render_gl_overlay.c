@@ -0,0 +1,136 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <stddef.h>
+
+
+struct overlay_exec_args{
+    size_t count;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static GLuint s_VAO, s_VBO;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The argument is followed by the bars */
+static void r_gl_overlay_exec(const void *arg)
+{
+    const struct overlay_exec_args *args = arg;
+
+    glBindVertexArray(s_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+    glBufferData(GL_ARRAY_BUFFER, args->count * sizeof(struct overlay_bar), args + 1, GL_STREAM_DRAW);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    GLuint shader_prog = R_Shader_GetProgForName("overlay");
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+    glUniform2f(R_Shader_UniformLoc(shader_prog, SU_VIEWPORT_SIZE), viewport[2], viewport[3]);
+
+    /* The bars go on top of the scene, and may be see-through */
+    GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, args->count);
+    R_GL_StatsDraw(6 * args->count);
+
+    glDisable(GL_BLEND);
+    if(depth_test)
+        glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_OverlayInit(void)
+{
+    glGenVertexArrays(1, &s_VAO);
+    glBindVertexArray(s_VAO);
+
+    glGenBuffers(1, &s_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+
+    /* Every attribute advances once per bar */
+    const GLsizei stride = sizeof(struct overlay_bar);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct overlay_bar, pos));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct overlay_bar, fg_color));
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct overlay_bar, bg_color));
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(struct overlay_bar, size));
+    for(int i = 0; i < 4; i++) {
+        glEnableVertexAttribArray(i);
+        glVertexAttribDivisor(i, 1);
+    }
+
+    glBindVertexArray(0);
+    return (s_VAO && s_VBO);
+}
+
+void R_GL_DrawOverlays(const struct overlay_bar *bars, size_t count)
+{
+    if(!count)
+        return;
+
+    size_t argsize = sizeof(struct overlay_exec_args) + count * sizeof(struct overlay_bar);
+    struct overlay_exec_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        return;
+
+    args->count = count;
+    memcpy(args + 1, bars, count * sizeof(struct overlay_bar));
+    R_Thread_Push(r_gl_overlay_exec, args, argsize);
+}
+
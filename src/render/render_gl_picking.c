@@ -0,0 +1,399 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "shader.h"
+#include "vertex.h"
+#include "public/render.h"
+#include "../config.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <math.h>
+#include <string.h>
+
+/* Picks of a few frames may be in flight at once, so that the read back 
+ * never has to wait on the GPU */
+#define NUM_READBACKS       (3)
+/* Larger rectangles are picked at a lower resolution */
+#define MAX_PICK_PIXELS     (256 * 1024)
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+
+struct pick_draw{
+    const struct render_private *priv;
+    mat4x4_t                     model;
+    struct pose_ref              pose;
+    /* The first of the pre-skinned vertices, or -1 */
+    GLint                        preskin;
+    uint32_t                     id;
+};
+
+/* The argument of the draw, followed by 'count' draws */
+struct pick_exec_args{
+    vec2_t corner, size;
+    int    width, height;
+    size_t count;
+};
+
+/* The IDs of a pick are copied into the buffer when the pass is drawn, 
+ * and only read once the fence has been passed */
+struct pick_readback{
+    GLuint  pbo;
+    size_t  pbo_size;
+    GLsync  fence;
+    vec2_t  corner, size;
+    int     width, height;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Written on the main thread, while recording */
+static bool                     s_active;
+static vec2_t                   s_corner, s_size;
+static kvec_t(struct pick_draw) s_draws;
+
+/* Only touched when drawing, or after claiming the render thread */
+static GLuint                   s_fbo;
+static GLuint                   s_color_rb, s_depth_rb;
+static GLint                    s_fb_w, s_fb_h;
+static struct pick_readback     s_readbacks[NUM_READBACKS];
+/* The next one to be written, which is also the oldest */
+static int                      s_head;
+
+/* The latest result, only touched on the main thread */
+static kvec_t(uint32_t)         s_ids;
+static struct pick_result       s_result;
+static bool                     s_have_result;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool r_gl_picking_resize(GLint width, GLint height)
+{
+    glBindRenderbuffer(GL_RENDERBUFFER, s_color_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, s_depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, s_color_rb);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, s_depth_rb);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        s_fb_w = s_fb_h = 0;
+        return false;
+    }
+
+    s_fb_w = width;
+    s_fb_h = height;
+    return true;
+}
+
+/* The ID is spread over the 8 bits of each of the channels, which are 
+ * written out exactly when there is no blending */
+static vec4_t r_gl_picking_color(uint32_t id)
+{
+    return (vec4_t){
+        ((id >>  0) & 0xff) / 255.0f,
+        ((id >>  8) & 0xff) / 255.0f,
+        ((id >> 16) & 0xff) / 255.0f,
+        ((id >> 24) & 0xff) / 255.0f,
+    };
+}
+
+static void r_gl_picking_draw(const struct pick_draw *draw, GLuint static_prog, GLuint anim_prog)
+{
+    bool anim = (draw->priv->mesh.layout == VERT_LAYOUT_SKINNED) && (draw->preskin < 0);
+    GLuint shader_prog = anim ? anim_prog : static_prog;
+
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    vec4_t color = r_gl_picking_color(draw->id);
+    GLint loc = R_Shader_UniformLoc(shader_prog, SU_COLOR);
+    glUniform4fv(loc, 1, color.raw);
+
+    loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, draw->model.raw);
+
+    if(anim) {
+        R_GL_AnimPaletteSync();
+        R_GL_SetPoseUniforms(shader_prog, &draw->pose);
+    }
+
+    if(draw->preskin >= 0) {
+        glBindVertexArray(R_GL_PreskinVAO());
+        R_GL_PreskinDraw(draw->priv, draw->preskin);
+        return;
+    }
+
+    glBindVertexArray(draw->priv->mesh.VAO);
+    R_GL_DrawMesh(&draw->priv->mesh, 1);
+}
+
+/* Draws the objects into the picking target and starts copying it to the 
+ * next read back buffer */
+static void r_gl_picking_exec(const void *arg)
+{
+    const struct pick_exec_args *args = arg;
+    const struct pick_draw *draws = (const struct pick_draw*)(args + 1);
+
+    /* A pick that's not been collected by now is stale */
+    struct pick_readback *rb = &s_readbacks[s_head];
+    if(rb->fence) {
+        glDeleteSync(rb->fence);
+        rb->fence = 0;
+    }
+
+    GLuint static_prog = R_Shader_GetProgForName("mesh.static.id");
+    GLuint anim_prog = R_Shader_GetProgForName("mesh.animated.id");
+    if(!static_prog || !anim_prog)
+        return;
+
+    GLint old_fb, viewport[4];
+    GLfloat clear_color[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &old_fb);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+    GLboolean blend = glIsEnabled(GL_BLEND);
+
+    if((s_fb_w < args->width || s_fb_h < args->height) 
+    && !r_gl_picking_resize(MAX(s_fb_w, args->width), MAX(s_fb_h, args->height)))
+        goto out;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glDisable(GL_BLEND);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    /* The whole screen is laid out around the target, so that only the 
+     * rectangle lands in it. The rows of the window go from the top down. */
+    float sx = args->width / args->size.x;
+    float sy = args->height / args->size.y;
+    float bottom = CONFIG_RES_Y - (args->corner.y + args->size.y);
+    glViewport(lroundf(-args->corner.x * sx), lroundf(-bottom * sy), 
+        lroundf(CONFIG_RES_X * sx), lroundf(CONFIG_RES_Y * sy));
+
+    for(int i = 0; i < args->count; i++)
+        r_gl_picking_draw(&draws[i], static_prog, anim_prog);
+    glBindVertexArray(0);
+
+    size_t size = args->width * args->height * sizeof(uint32_t);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    if(rb->pbo_size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+        rb->pbo_size = size;
+    }
+    glReadPixels(0, 0, args->width, args->height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    rb->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    rb->corner = args->corner;
+    rb->size = args->size;
+    rb->width = args->width;
+    rb->height = args->height;
+    s_head = (s_head + 1) % NUM_READBACKS;
+
+out:
+    glBindFramebuffer(GL_FRAMEBUFFER, old_fb);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+    if(blend)
+        glEnable(GL_BLEND);
+}
+
+static void r_gl_picking_collect(struct pick_readback *rb)
+{
+    glDeleteSync(rb->fence);
+    rb->fence = 0;
+
+    size_t npix = rb->width * rb->height;
+    if(kv_max(s_ids) < npix)
+        kv_resize(uint32_t, s_ids, npix);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+    const uint8_t *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 
+        npix * sizeof(uint32_t), GL_MAP_READ_BIT);
+    if(!pixels) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return;
+    }
+
+    /* The rows were read back from the bottom up */
+    for(int r = 0; r < rb->height; r++) {
+
+        const uint8_t *row = pixels + (rb->height - 1 - r) * rb->width * 4;
+        uint32_t *out = s_ids.a + r * rb->width;
+
+        for(int c = 0; c < rb->width; c++) {
+            const uint8_t *p = row + c * 4;
+            out[c] = ((uint32_t)p[0] <<  0) | ((uint32_t)p[1] <<  8) 
+                   | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        }
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    s_result = (struct pick_result){
+        .corner = rb->corner,
+        .size = rb->size,
+        .width = rb->width,
+        .height = rb->height,
+        .ids = s_ids.a
+    };
+    s_have_result = true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_PickingInit(void)
+{
+    kv_init(s_draws);
+    kv_init(s_ids);
+
+    glGenFramebuffers(1, &s_fbo);
+    glGenRenderbuffers(1, &s_color_rb);
+    glGenRenderbuffers(1, &s_depth_rb);
+
+    for(int i = 0; i < NUM_READBACKS; i++) {
+        glGenBuffers(1, &s_readbacks[i].pbo);
+        if(!s_readbacks[i].pbo)
+            return false;
+    }
+    return (s_fbo && s_color_rb && s_depth_rb);
+}
+
+void R_GL_PickingBegin(vec2_t corner, vec2_t size)
+{
+    s_active = (size.x >= 1.0f && size.y >= 1.0f);
+    s_corner = corner;
+    s_size = size;
+    kv_reset(s_draws);
+}
+
+void R_GL_PickingSubmit(const void *render_private, const mat4x4_t *model, uint32_t id)
+{
+    if(!s_active)
+        return;
+
+    struct pose_ref pose = R_GL_AnimPose();
+    struct pick_draw draw = (struct pick_draw){
+        .priv = render_private,
+        .model = *model,
+        .pose = pose,
+        .preskin = R_GL_PreskinAdd(render_private, &pose),
+        .id = id
+    };
+    kv_push(struct pick_draw, s_draws, draw);
+}
+
+void R_GL_PickingFlush(void)
+{
+    if(!s_active)
+        return;
+    s_active = false;
+
+    float scale = 1.0f;
+    if(s_size.x * s_size.y > MAX_PICK_PIXELS)
+        scale = sqrtf(MAX_PICK_PIXELS / (s_size.x * s_size.y));
+
+    size_t count = kv_size(s_draws);
+    size_t argsize = sizeof(struct pick_exec_args) + count * sizeof(struct pick_draw);
+    struct pick_exec_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args)
+        return;
+
+    *args = (struct pick_exec_args){
+        .corner = s_corner,
+        .size = s_size,
+        .width = MAX(1, (int)ceilf(s_size.x * scale)),
+        .height = MAX(1, (int)ceilf(s_size.y * scale)),
+        .count = count
+    };
+    memcpy(args + 1, s_draws.a, count * sizeof(struct pick_draw));
+    R_Thread_Push(r_gl_picking_exec, args, argsize);
+}
+
+bool R_GL_PickingResult(struct pick_result *out)
+{
+    R_Thread_Claim();
+
+    /* Collect the completed picks from the oldest on, leaving the latest 
+     * one as the result */
+    for(int i = 0; i < NUM_READBACKS; i++) {
+
+        struct pick_readback *rb = &s_readbacks[(s_head + i) % NUM_READBACKS];
+        if(!rb->fence)
+            continue;
+
+        GLenum status = glClientWaitSync(rb->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+        r_gl_picking_collect(rb);
+    }
+
+    if(!s_have_result)
+        return false;
+    *out = s_result;
+    return true;
+}
+
+void R_GL_PickingReset(void)
+{
+    R_Thread_Claim();
+
+    for(int i = 0; i < NUM_READBACKS; i++) {
+        if(!s_readbacks[i].fence)
+            continue;
+        glDeleteSync(s_readbacks[i].fence);
+        s_readbacks[i].fence = 0;
+    }
+    s_have_result = false;
+    s_active = false;
+    kv_reset(s_draws);
+}
+
@@ -0,0 +1,313 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "bake_cache.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../config.h"
+#include "../mem.h"
+#include "../lib/public/khash.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+/* The vertices written by the transform feedback of 'mesh.animated.preskin',
+ * in the order of its' varyings */
+struct preskinned_vert{
+    vec3_t  pos;
+    vec2_t  uv;
+    vec3_t  normal;
+    GLint   material_idx;
+};
+
+/* A mesh in a pose, skinned into the vertices from 'base' on */
+struct preskin_job{
+    const struct render_private *priv;
+    struct pose_ref              pose;
+    GLint                        base;
+};
+
+/* Followed by 'count' jobs */
+struct preskin_args{
+    size_t cap;
+    bool   resize;
+    size_t count;
+};
+
+KHASH_MAP_INIT_INT64(preskin, size_t)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Only touched on the main thread */
+static bool                        s_enabled;
+static kvec_t(struct preskin_job)  s_jobs;
+/* Maps the hash of a job's mesh and pose to its' index in 's_jobs', so that 
+ * every pass, and every entity in the same pose, shares the same vertices */
+static khash_t(preskin)           *s_lookup;
+/* The jobs before this one were already handed to the render thread */
+static size_t                      s_flushed;
+static size_t                      s_num_verts;
+/* The number of vertices the buffer holds. It is only resized by the first
+ * flush of a frame, so that the vertices of the frame's earlier flushes are 
+ * never discarded. */
+static size_t                      s_cap;
+static bool                        s_sized;
+
+/* Only touched when drawing */
+static GLuint                      s_VBO;
+static GLuint                      s_VAO;
+static size_t                      s_gl_cap;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint64_t r_gl_preskin_key(const struct render_private *priv, const struct pose_ref *pose)
+{
+    uint64_t key = R_BakeCache_Hash(BAKE_CACHE_HASH_INIT, &priv, sizeof(priv));
+    return R_BakeCache_Hash(key, pose, sizeof(*pose));
+}
+
+static bool r_gl_preskin_reserve(size_t count)
+{
+    if(s_num_verts + count <= s_cap)
+        return true;
+    if(s_sized || s_num_verts + count > CONFIG_PRESKIN_MAX_VERTS)
+        return false;
+
+    size_t cap = s_cap ? s_cap : 16 * 1024;
+    while(cap < s_num_verts + count)
+        cap *= 2;
+    s_cap = cap < CONFIG_PRESKIN_MAX_VERTS ? cap : CONFIG_PRESKIN_MAX_VERTS;
+    return true;
+}
+
+static void r_gl_preskin_exec(const void *arg)
+{
+    const struct preskin_args *args = arg;
+    const struct preskin_job *jobs = (const struct preskin_job*)(args + 1);
+
+    GLuint prog = R_Shader_GetProgForName("mesh.animated.preskin");
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, s_VBO);
+
+    /* Orphan the last frame's vertices so that the driver doesn't have to 
+     * wait on the draws still using them */
+    if(args->resize) {
+        if(s_gl_cap)
+            MEM_Untrack(MEM_TAG_GL_BUFFERS, s_gl_cap * sizeof(struct preskinned_vert));
+        s_gl_cap = args->cap;
+        glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, s_gl_cap * sizeof(struct preskinned_vert), 
+            NULL, GL_STREAM_COPY);
+        MEM_Track(MEM_TAG_GL_BUFFERS, s_gl_cap * sizeof(struct preskinned_vert));
+    }
+
+    R_GL_AnimPaletteSync();
+    glUseProgram(prog);
+    R_GL_StatsProgramBind();
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    for(int i = 0; i < args->count; i++) {
+
+        const struct mesh *mesh = &jobs[i].priv->mesh;
+        assert((jobs[i].base + mesh->num_verts) <= s_gl_cap);
+
+        R_GL_SetPoseUniforms(prog, &jobs[i].pose);
+        glBindVertexArray(mesh->VAO);
+        glBindBufferRange(GL_TRANSFORM_FEEDBACK_BUFFER, 0, s_VBO, 
+            jobs[i].base * sizeof(struct preskinned_vert), 
+            mesh->num_verts * sizeof(struct preskinned_vert));
+
+        /* Every one of the mesh's unique vertices is skinned once, in the 
+         * order of the vertex buffer, so that its' index buffer applies to 
+         * the output as it is */
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, mesh->num_verts);
+        glEndTransformFeedback();
+        R_GL_StatsDraw(mesh->num_verts);
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_PreskinInit(void)
+{
+    glGenBuffers(1, &s_VBO);
+    glGenVertexArrays(1, &s_VAO);
+
+    glBindVertexArray(s_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+
+    /* The attributes of the static layout, at full precision */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct preskinned_vert), 
+        (void*)offsetof(struct preskinned_vert, pos));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct preskinned_vert), 
+        (void*)offsetof(struct preskinned_vert, uv));
+    glEnableVertexAttribArray(1);
+
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct preskinned_vert), 
+        (void*)offsetof(struct preskinned_vert, normal));
+    glEnableVertexAttribArray(2);
+
+    glVertexAttribIPointer(3, 1, GL_INT, sizeof(struct preskinned_vert), 
+        (void*)offsetof(struct preskinned_vert, material_idx));
+    glEnableVertexAttribArray(3);
+
+    glBindVertexArray(0);
+
+    s_lookup = kh_init(preskin);
+    return (s_lookup != NULL);
+}
+
+void R_GL_PreskinEnable(bool on)
+{
+    s_enabled = on;
+}
+
+void R_GL_PreskinBeginFrame(void)
+{
+    kv_reset(s_jobs);
+    kh_clear(preskin, s_lookup);
+    s_flushed = 0;
+    s_num_verts = 0;
+    s_sized = false;
+}
+
+GLint R_GL_PreskinAdd(const struct render_private *priv, const struct pose_ref *pose)
+{
+    if(!s_enabled || priv->mesh.layout != VERT_LAYOUT_SKINNED || pose->bases[0] < 0)
+        return -1;
+
+    uint64_t key = r_gl_preskin_key(priv, pose);
+    khiter_t k = kh_get(preskin, s_lookup, key);
+    if(k != kh_end(s_lookup)) {
+
+        const struct preskin_job *job = &kv_A(s_jobs, kh_value(s_lookup, k));
+        if(job->priv == priv && 0 == memcmp(&job->pose, pose, sizeof(*pose)))
+            return job->base;
+    }
+
+    if(!r_gl_preskin_reserve(priv->mesh.num_verts))
+        return -1;
+
+    struct preskin_job job = (struct preskin_job){
+        .priv = priv,
+        .pose = *pose,
+        .base = s_num_verts,
+    };
+    kv_push(struct preskin_job, s_jobs, job);
+    s_num_verts += priv->mesh.num_verts;
+
+    /* On a collision, the first job keeps the entry */
+    int ret;
+    k = kh_put(preskin, s_lookup, key, &ret);
+    if(ret > 0)
+        kh_value(s_lookup, k) = kv_size(s_jobs) - 1;
+
+    return job.base;
+}
+
+void R_GL_PreskinFlush(void)
+{
+    size_t count = kv_size(s_jobs) - s_flushed;
+    if(!count)
+        return;
+
+    size_t size = sizeof(struct preskin_args) + count * sizeof(struct preskin_job);
+    struct preskin_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(!args)
+        return;
+
+    *args = (struct preskin_args){
+        .cap = s_cap,
+        .resize = !s_sized,
+        .count = count
+    };
+    memcpy(args + 1, &kv_A(s_jobs, s_flushed), count * sizeof(struct preskin_job));
+    R_Thread_Push(r_gl_preskin_exec, args, size);
+
+    s_flushed = kv_size(s_jobs);
+    s_sized = true;
+}
+
+GLuint R_GL_PreskinVAO(void)
+{
+    return s_VAO;
+}
+
+void R_GL_PreskinDraw(const struct render_private *priv, GLint base)
+{
+    const struct mesh *mesh = &priv->mesh;
+
+    if(mesh->EBO) {
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+        glDrawElementsBaseVertex(GL_TRIANGLES, mesh->num_indices, mesh->index_type, (void*)0, base);
+    }else{
+        glDrawArrays(GL_TRIANGLES, base, mesh->num_verts);
+    }
+    R_GL_StatsDraw(mesh->EBO ? mesh->num_indices : mesh->num_verts);
+}
+
+void R_GL_PreskinDrawPriv(const struct render_private *priv, const mat4x4_t *model, GLint base)
+{
+    GLuint prog = R_Shader_GetProgForName("mesh.static.textured-phong");
+
+    glUseProgram(prog);
+    R_GL_StatsProgramBind();
+
+    GLint loc = R_Shader_UniformLoc(prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, model->raw);
+
+    R_GL_SetMaterials(priv, prog);
+    glBindVertexArray(s_VAO);
+    R_GL_PreskinDraw(priv, base);
+}
+
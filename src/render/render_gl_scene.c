@@ -0,0 +1,304 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "public/render.h"
+#include "../config.h"
+
+#include <GL/glew.h>
+
+#include <math.h>
+
+
+/* Number of frames that the timer queries are given to complete */
+#define NUM_TIMERS          (3)
+/* Frames to measure at the current scale before changing it again */
+#define ADJUST_FRAMES       (30)
+/* The scale is changed in steps of this size, and by at most 2 at a time */
+#define SCALE_STEP          (0.05f)
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+#define MAX(a, b)           ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi)    (MAX(MIN((a), (hi)), (lo)))
+
+/* Passed along to the render thread with every frame */
+struct scene_settings{
+    float scale;
+    /* 0 when the scale isn't adjusted automatically */
+    float target_ms;
+    float min_scale;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Written on the main thread */
+static struct scene_settings s_settings = {
+    CONFIG_RENDER_SCALE, 
+    CONFIG_DYNAMIC_RES_TARGET_MS, 
+    CONFIG_MIN_RENDER_SCALE
+};
+
+/* Everything below is only touched when drawing */
+static GLuint       s_fbo;
+static GLuint       s_color_tex;
+/* A texture rather than a renderbuffer, so that the fog of war can read it */
+static GLuint       s_depth_tex;
+/* Size of the framebuffer attachments */
+static GLint        s_fb_w, s_fb_h;
+/* Size of the window viewport and of the scaled one within the framebuffer */
+static GLint        s_win_w, s_win_h;
+static GLint        s_scene_w, s_scene_h;
+/* Whether the current frame's scene is drawn to the framebuffer */
+static bool         s_offscreen;
+
+static GLuint       s_timers[NUM_TIMERS];
+static bool         s_timer_issued[NUM_TIMERS];
+static bool         s_timing;
+static int          s_timer_head;
+
+static float        s_dyn_scale = 1.0f;
+static float        s_curr_scale = 1.0f;
+/* Running average of the GPU time of the scene at the current scale */
+static float        s_scene_ms;
+static int          s_frames_measured;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool r_gl_scene_resize(GLint width, GLint height)
+{
+    glBindTexture(GL_TEXTURE_2D, s_color_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindTexture(GL_TEXTURE_2D, s_depth_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, 
+        GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, s_color_tex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, s_depth_tex, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if(status != GL_FRAMEBUFFER_COMPLETE) {
+        s_fb_w = s_fb_h = 0;
+        return false;
+    }
+
+    s_fb_w = width;
+    s_fb_h = height;
+    return true;
+}
+
+/* The fill cost of the scene goes with the number of pixels, so the scale 
+ * that should hit the target is estimated from the square root of the 
+ * ratio of the times */
+static void r_gl_scene_adjust(const struct scene_settings *settings)
+{
+    if(settings->target_ms <= 0.0f || s_frames_measured < ADJUST_FRAMES)
+        return;
+
+    /* Aim a bit under the target, so that it's not missed every other frame */
+    const float aim_ms = settings->target_ms * 0.9f;
+    if(s_scene_ms <= settings->target_ms && s_scene_ms >= settings->target_ms * 0.75f)
+        return;
+
+    float want = s_dyn_scale * sqrtf(aim_ms / MAX(s_scene_ms, 0.01f));
+    want = CLAMP(want, s_dyn_scale - 2 * SCALE_STEP, s_dyn_scale + 2 * SCALE_STEP);
+    want = roundf(want / SCALE_STEP) * SCALE_STEP;
+    want = CLAMP(want, settings->min_scale, 1.0f);
+
+    if(want != s_dyn_scale) {
+        s_dyn_scale = want;
+        s_frames_measured = 0;
+    }
+}
+
+static void r_gl_scene_poll_timers(void)
+{
+    for(int i = 0; i < NUM_TIMERS; i++) {
+
+        if(!s_timer_issued[i])
+            continue;
+
+        GLuint avail;
+        glGetQueryObjectuiv(s_timers[i], GL_QUERY_RESULT_AVAILABLE, &avail);
+        if(!avail)
+            continue;
+
+        GLuint64 ns;
+        glGetQueryObjectui64v(s_timers[i], GL_QUERY_RESULT, &ns);
+        s_timer_issued[i] = false;
+
+        float ms = ns / 1000000.0f;
+        s_scene_ms = s_frames_measured ? s_scene_ms * 0.9f + ms * 0.1f : ms;
+        s_frames_measured++;
+    }
+}
+
+static void r_gl_scene_begin_exec(const void *arg)
+{
+    const struct scene_settings *settings = arg;
+
+    r_gl_scene_poll_timers();
+    r_gl_scene_adjust(settings);
+
+    float scale = settings->target_ms > 0.0f ? s_dyn_scale : settings->scale;
+    if(scale != s_curr_scale)
+        s_frames_measured = 0;
+    s_curr_scale = scale;
+
+    /* A timer that's still in flight is left to complete, and this frame 
+     * goes unmeasured */
+    s_timing = !s_timer_issued[s_timer_head];
+    if(s_timing)
+        glBeginQuery(GL_TIME_ELAPSED, s_timers[s_timer_head]);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    s_win_w = viewport[2];
+    s_win_h = viewport[3];
+
+    /* The fog of war and the shadows are applied when the scene is copied 
+     * to the window. The GPU culling reads back the depth of the terrain. */
+    s_offscreen = (scale < 1.0f) || R_GL_FogActive() || R_GL_ShadowActive() 
+               || R_GL_GPUCullWantsDepth();
+    if(!s_offscreen)
+        return;
+
+    if((s_fb_w != s_win_w || s_fb_h != s_win_h) && !r_gl_scene_resize(s_win_w, s_win_h)) {
+        s_offscreen = false;
+        return;
+    }
+
+    s_scene_w = MAX(1, (GLint)(s_win_w * scale));
+    s_scene_h = MAX(1, (GLint)(s_win_h * scale));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s_fbo);
+    glViewport(0, 0, s_scene_w, s_scene_h);
+    glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
+
+static void r_gl_scene_end_exec(const void *unused)
+{
+    if(s_offscreen && (R_GL_FogActive() || R_GL_ShadowActive())) {
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, s_win_w, s_win_h);
+        vec2_t uv_scale = (vec2_t){(float)s_scene_w / s_fb_w, (float)s_scene_h / s_fb_h};
+        R_GL_FogComposite(s_color_tex, s_depth_tex, uv_scale);
+
+    }else if(s_offscreen) {
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, s_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, s_scene_w, s_scene_h, 0, 0, s_win_w, s_win_h, 
+            GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, s_win_w, s_win_h);
+    }
+
+    if(s_timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+        s_timer_issued[s_timer_head] = true;
+        s_timer_head = (s_timer_head + 1) % NUM_TIMERS;
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_SceneInit(void)
+{
+    glGenFramebuffers(1, &s_fbo);
+    glGenTextures(1, &s_color_tex);
+    glGenTextures(1, &s_depth_tex);
+    glGenQueries(NUM_TIMERS, s_timers);
+    return (s_fbo && s_color_tex && s_depth_tex);
+}
+
+bool R_GL_SceneDepth(GLuint *out_tex, GLint *out_w, GLint *out_h)
+{
+    if(!s_offscreen)
+        return false;
+
+    *out_tex = s_depth_tex;
+    *out_w = s_scene_w;
+    *out_h = s_scene_h;
+    return true;
+}
+
+void R_GL_SceneBegin(void)
+{
+    R_Thread_Push(r_gl_scene_begin_exec, &s_settings, sizeof(s_settings));
+}
+
+void R_GL_SceneEnd(void)
+{
+    R_Thread_Push(r_gl_scene_end_exec, NULL, 0);
+}
+
+void R_GL_SetRenderScale(float scale)
+{
+    s_settings.scale = CLAMP(scale, 0.25f, 1.0f);
+    s_settings.target_ms = 0.0f;
+}
+
+void R_GL_SetDynamicResolution(float target_ms, float min_scale)
+{
+    s_settings.target_ms = MAX(target_ms, 0.0f);
+    s_settings.min_scale = CLAMP(min_scale, 0.25f, 1.0f);
+}
+
+void R_GL_GetRenderScaleStats(struct render_scale_stats *out)
+{
+    /* The scale is decided when the frame is drawn */
+    R_Thread_Claim();
+    *out = (struct render_scale_stats){
+        .scale = s_curr_scale,
+        .scene_ms = s_scene_ms,
+    };
+}
+
@@ -0,0 +1,555 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../config.h"
+#include "../collision.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+
+#define NUM_TILES       (CONFIG_SHADOW_ATLAS_TILES * CONFIG_SHADOW_ATLAS_TILES)
+#define TILE_RES        (CONFIG_SHADOW_ATLAS_RES / CONFIG_SHADOW_ATLAS_TILES)
+
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+#define MAX(a, b)       ((a) > (b) ? (a) : (b))
+#define CLAMP(a, lo, hi) (MIN(MAX((a), (lo)), (hi)))
+
+struct light_mats{
+    mat4x4_t view;
+    mat4x4_t proj;
+};
+
+struct shadow_cmd{
+    const struct render_private *priv;
+    mat4x4_t                     model;
+    struct pose_ref              pose;
+    /* The first of the pre-skinned vertices, or -1 */
+    GLint                        preskin;
+};
+
+/* Both are followed by 'count' commands */
+struct static_draw_args{
+    struct light_mats light;
+    int               tile;
+    size_t            count;
+};
+
+struct dynamic_draw_args{
+    struct light_mats light;
+    size_t            count;
+};
+
+struct saved_state{
+    GLint     fbo;
+    GLint     viewport[4];
+    GLboolean cull;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Only touched on the main thread */
+static bool                      s_enabled;
+static struct aabb               s_bounds;
+static vec3_t                    s_light_pos;
+static struct light_mats         s_light;
+static mat4x4_t                  s_light_vp;
+/* The box that the light's projection covers, in world space */
+static struct frustum            s_light_frustum;
+static bool                      s_dirty[NUM_TILES];
+static kvec_t(struct shadow_cmd) s_dynamic;
+
+/* Only touched when drawing */
+static GLuint                    s_atlas_tex, s_atlas_fbo;
+static GLuint                    s_dynamic_tex, s_dynamic_fbo;
+static bool                      s_allocated;
+static bool                      s_active;
+static mat4x4_t                  s_view_proj;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* The frustum of an orthographic projection is a box, 'radius' across on 
+ * either side of the light's direction. The normals point inwards. */
+static void r_gl_shadow_make_frustum(vec3_t nc, vec3_t fc, vec3_t dir, vec3_t right, 
+                                     vec3_t up, float radius, struct frustum *out)
+{
+    vec3_t r, u, tmp;
+    PFM_Vec3_Scale(&right, radius, &r);
+    PFM_Vec3_Scale(&up, radius, &u);
+
+    PFM_Vec3_Add(&fc, &u, &tmp);
+    PFM_Vec3_Sub(&tmp, &r, &out->ftl);
+    PFM_Vec3_Add(&tmp, &r, &out->ftr);
+    PFM_Vec3_Sub(&fc, &u, &tmp);
+    PFM_Vec3_Sub(&tmp, &r, &out->fbl);
+    PFM_Vec3_Add(&tmp, &r, &out->fbr);
+
+    PFM_Vec3_Add(&nc, &u, &tmp);
+    PFM_Vec3_Sub(&tmp, &r, &out->ntl);
+    PFM_Vec3_Add(&tmp, &r, &out->ntr);
+    PFM_Vec3_Sub(&nc, &u, &tmp);
+    PFM_Vec3_Sub(&tmp, &r, &out->nbl);
+    PFM_Vec3_Add(&tmp, &r, &out->nbr);
+
+    vec3_t neg_dir, neg_right, neg_up;
+    PFM_Vec3_Scale(&dir, -1.0f, &neg_dir);
+    PFM_Vec3_Scale(&right, -1.0f, &neg_right);
+    PFM_Vec3_Scale(&up, -1.0f, &neg_up);
+
+    out->near = (struct plane){nc, dir};
+    out->far = (struct plane){fc, neg_dir};
+    out->right = (struct plane){out->ntr, neg_right};
+    out->left = (struct plane){out->ntl, right};
+    out->top = (struct plane){out->ntl, neg_up};
+    out->bot = (struct plane){out->nbl, up};
+}
+
+static void r_gl_shadow_update_light(void)
+{
+    vec3_t center = (vec3_t){
+        (s_bounds.x_min + s_bounds.x_max) / 2.0f,
+        (s_bounds.y_min + s_bounds.y_max) / 2.0f,
+        (s_bounds.z_min + s_bounds.z_max) / 2.0f,
+    };
+    vec3_t half = (vec3_t){
+        (s_bounds.x_max - s_bounds.x_min) / 2.0f,
+        (s_bounds.y_max - s_bounds.y_min) / 2.0f,
+        (s_bounds.z_max - s_bounds.z_min) / 2.0f,
+    };
+    float radius = MAX(PFM_Vec3_Len(&half), 1.0f);
+
+    vec3_t dir;
+    PFM_Vec3_Sub(&center, &s_light_pos, &dir);
+    if(PFM_Vec3_Len(&dir) < 1e-3f)
+        dir = (vec3_t){0.0f, -1.0f, 0.0f};
+    PFM_Vec3_Normal(&dir, &dir);
+
+    /* 'PFM_Mat4x4_MakeLookAt' takes the up direction as it is, so it must be
+     * made perpendicular to the light */
+    vec3_t axis = fabs(dir.y) < 0.99f ? (vec3_t){0.0f, 1.0f, 0.0f} : (vec3_t){0.0f, 0.0f, 1.0f};
+    vec3_t right, up;
+    PFM_Vec3_Cross(&dir, &axis, &right);
+    PFM_Vec3_Normal(&right, &right);
+    PFM_Vec3_Cross(&right, &dir, &up);
+
+    /* The whole of the bounds lies within 'radius' of its' middle */
+    vec3_t eye, offset;
+    PFM_Vec3_Scale(&dir, -2.0f * radius, &offset);
+    PFM_Vec3_Add(&center, &offset, &eye);
+
+    PFM_Mat4x4_MakeLookAt(&eye, &center, &up, &s_light.view);
+    PFM_Mat4x4_MakeOrthographic(-radius, radius, -radius, radius, radius, 3.0f * radius, &s_light.proj);
+    PFM_Mat4x4_Mult4x4(&s_light.proj, &s_light.view, &s_light_vp);
+
+    vec3_t nc, fc;
+    PFM_Vec3_Scale(&dir, -radius, &offset);
+    PFM_Vec3_Add(&center, &offset, &nc);
+    PFM_Vec3_Scale(&dir, radius, &offset);
+    PFM_Vec3_Add(&center, &offset, &fc);
+    r_gl_shadow_make_frustum(nc, fc, dir, right, up, radius, &s_light_frustum);
+}
+
+/* Finds the tiles covered by the box, as seen from the light. Returns false
+ * when it is not seen at all. */
+static bool r_gl_shadow_tile_range(const struct aabb *box, int *out_min_x, int *out_min_y,
+                                   int *out_max_x, int *out_max_y)
+{
+    float min_x = FLT_MAX, min_y = FLT_MAX;
+    float max_x = -FLT_MAX, max_y = -FLT_MAX;
+
+    for(int i = 0; i < 8; i++) {
+        vec4_t corner = (vec4_t){
+            (i & 1) ? box->x_max : box->x_min,
+            (i & 2) ? box->y_max : box->y_min,
+            (i & 4) ? box->z_max : box->z_min,
+            1.0f
+        };
+        vec4_t ndc;
+        PFM_Mat4x4_Mult4x1(&s_light_vp, &corner, &ndc);
+        min_x = MIN(min_x, ndc.x);
+        max_x = MAX(max_x, ndc.x);
+        min_y = MIN(min_y, ndc.y);
+        max_y = MAX(max_y, ndc.y);
+    }
+
+    if(max_x < -1.0f || min_x > 1.0f || max_y < -1.0f || min_y > 1.0f)
+        return false;
+
+    const int n = CONFIG_SHADOW_ATLAS_TILES;
+    *out_min_x = CLAMP((int)floorf((min_x + 1.0f) / 2.0f * n), 0, n - 1);
+    *out_min_y = CLAMP((int)floorf((min_y + 1.0f) / 2.0f * n), 0, n - 1);
+    *out_max_x = CLAMP((int)floorf((max_x + 1.0f) / 2.0f * n), 0, n - 1);
+    *out_max_y = CLAMP((int)floorf((max_y + 1.0f) / 2.0f * n), 0, n - 1);
+    return true;
+}
+
+static bool r_gl_shadow_overlaps_tile(const struct aabb *box, int tile)
+{
+    int min_x, min_y, max_x, max_y;
+    if(!r_gl_shadow_tile_range(box, &min_x, &min_y, &max_x, &max_y))
+        return false;
+
+    int tx = tile % CONFIG_SHADOW_ATLAS_TILES;
+    int ty = tile / CONFIG_SHADOW_ATLAS_TILES;
+    return (tx >= min_x && tx <= max_x && ty >= min_y && ty <= max_y);
+}
+
+static bool r_gl_shadow_alloc(GLuint tex, GLuint fbo, GLsizei res)
+{
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, res, res, 0, 
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return (status == GL_FRAMEBUFFER_COMPLETE);
+}
+
+static void r_gl_shadow_enable_exec(const void *arg)
+{
+    const struct light_mats *light = arg;
+
+    if(!s_allocated) {
+        s_allocated = r_gl_shadow_alloc(s_atlas_tex, s_atlas_fbo, CONFIG_SHADOW_ATLAS_RES)
+                   && r_gl_shadow_alloc(s_dynamic_tex, s_dynamic_fbo, CONFIG_SHADOW_DYNAMIC_RES);
+    }
+    s_active = s_allocated;
+    PFM_Mat4x4_Mult4x4(&light->proj, &light->view, &s_view_proj);
+}
+
+static void r_gl_shadow_disable_exec(const void *unused)
+{
+    s_active = false;
+}
+
+static void r_gl_shadow_begin(GLuint fbo, const struct light_mats *light, struct saved_state *out)
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &out->fbo);
+    glGetIntegerv(GL_VIEWPORT, out->viewport);
+    out->cull = glIsEnabled(GL_CULL_FACE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    /* The light's view may be mirrored relative to the camera's, so both 
+     * sides of the faces are drawn */
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+
+    R_GL_BeginLightspace(&light->view, &light->proj);
+    PFM_Mat4x4_Mult4x4(&light->proj, &light->view, &s_view_proj);
+}
+
+static void r_gl_shadow_end(const struct saved_state *saved)
+{
+    R_GL_EndLightspace();
+
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    if(saved->cull)
+        glEnable(GL_CULL_FACE);
+    glBindFramebuffer(GL_FRAMEBUFFER, saved->fbo);
+    glViewport(saved->viewport[0], saved->viewport[1], saved->viewport[2], saved->viewport[3]);
+}
+
+static void r_gl_shadow_draw_cmds(const struct shadow_cmd *cmds, size_t count)
+{
+    for(int i = 0; i < count; i++) {
+        if(cmds[i].preskin >= 0)
+            R_GL_PreskinDrawPriv(cmds[i].priv, &cmds[i].model, cmds[i].preskin);
+        else
+            R_GL_DrawPriv(cmds[i].priv, &cmds[i].model, &cmds[i].pose);
+    }
+}
+
+static void r_gl_shadow_static_exec(const void *arg)
+{
+    const struct static_draw_args *args = arg;
+    if(!s_active)
+        return;
+
+    int tx = args->tile % CONFIG_SHADOW_ATLAS_TILES;
+    int ty = args->tile / CONFIG_SHADOW_ATLAS_TILES;
+
+    struct saved_state saved;
+    r_gl_shadow_begin(s_atlas_fbo, &args->light, &saved);
+
+    /* The tile is a part of the same projection as the whole atlas, cut out 
+     * with the scissor */
+    glViewport(0, 0, CONFIG_SHADOW_ATLAS_RES, CONFIG_SHADOW_ATLAS_RES);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(tx * TILE_RES, ty * TILE_RES, TILE_RES, TILE_RES);
+    glClear(GL_DEPTH_BUFFER_BIT);
+
+    r_gl_shadow_draw_cmds((const struct shadow_cmd*)(args + 1), args->count);
+
+    glDisable(GL_SCISSOR_TEST);
+    r_gl_shadow_end(&saved);
+}
+
+static void r_gl_shadow_dynamic_exec(const void *arg)
+{
+    const struct dynamic_draw_args *args = arg;
+    if(!s_active)
+        return;
+
+    struct saved_state saved;
+    r_gl_shadow_begin(s_dynamic_fbo, &args->light, &saved);
+
+    glViewport(0, 0, CONFIG_SHADOW_DYNAMIC_RES, CONFIG_SHADOW_DYNAMIC_RES);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    r_gl_shadow_draw_cmds((const struct shadow_cmd*)(args + 1), args->count);
+
+    r_gl_shadow_end(&saved);
+}
+
+static void r_gl_shadow_set_all_dirty(bool dirty)
+{
+    for(int i = 0; i < NUM_TILES; i++)
+        s_dirty[i] = dirty;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_ShadowInit(void)
+{
+    glGenTextures(1, &s_atlas_tex);
+    glGenTextures(1, &s_dynamic_tex);
+    glGenFramebuffers(1, &s_atlas_fbo);
+    glGenFramebuffers(1, &s_dynamic_fbo);
+    kv_init(s_dynamic);
+    return (s_atlas_tex && s_dynamic_tex && s_atlas_fbo && s_dynamic_fbo);
+}
+
+void R_GL_ShadowSetLight(vec3_t pos)
+{
+    if(0 == memcmp(&pos, &s_light_pos, sizeof(pos)))
+        return;
+
+    s_light_pos = pos;
+    if(!s_enabled)
+        return;
+
+    r_gl_shadow_update_light();
+    r_gl_shadow_set_all_dirty(true);
+}
+
+bool R_GL_ShadowActive(void)
+{
+    return s_active;
+}
+
+void R_GL_ShadowBind(GLuint shader_prog, int first_tunit)
+{
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_SHADOWS_ENABLED), s_active);
+    glUniformMatrix4fv(R_Shader_UniformLoc(shader_prog, SU_LIGHT_VIEW_PROJ), 1, GL_FALSE, s_view_proj.raw);
+
+    /* The shadow samplers are bound even when unused, so that they don't 
+     * alias a unit holding a different kind of texture */
+    const GLuint textures[] = {s_atlas_tex, s_dynamic_tex};
+    for(int i = 0; i < 2; i++) {
+        glActiveTexture(GL_TEXTURE0 + first_tunit + i);
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        R_GL_StatsTextureBind();
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE0 + first_tunit + i), first_tunit + i);
+    }
+}
+
+void R_GL_ShadowsEnable(const struct aabb *bounds)
+{
+    s_enabled = true;
+    s_bounds = *bounds;
+    r_gl_shadow_update_light();
+    r_gl_shadow_set_all_dirty(true);
+    kv_reset(s_dynamic);
+
+    R_Thread_Push(r_gl_shadow_enable_exec, &s_light, sizeof(s_light));
+}
+
+void R_GL_ShadowsDisable(void)
+{
+    s_enabled = false;
+    r_gl_shadow_set_all_dirty(false);
+    kv_reset(s_dynamic);
+
+    R_Thread_Push(r_gl_shadow_disable_exec, NULL, 0);
+}
+
+bool R_GL_ShadowLightFrustum(struct frustum *out)
+{
+    if(!s_enabled)
+        return false;
+    *out = s_light_frustum;
+    return true;
+}
+
+void R_GL_ShadowInvalidate(const struct aabb *region)
+{
+    if(!s_enabled)
+        return;
+
+    if(!region) {
+        r_gl_shadow_set_all_dirty(true);
+        return;
+    }
+
+    int min_x, min_y, max_x, max_y;
+    if(!r_gl_shadow_tile_range(region, &min_x, &min_y, &max_x, &max_y))
+        return;
+
+    for(int ty = min_y; ty <= max_y; ty++) {
+    for(int tx = min_x; tx <= max_x; tx++) {
+        s_dirty[ty * CONFIG_SHADOW_ATLAS_TILES + tx] = true;
+    }}
+}
+
+bool R_GL_ShadowStaticDirty(void)
+{
+    if(!s_enabled)
+        return false;
+
+    for(int i = 0; i < NUM_TILES; i++) {
+        if(s_dirty[i])
+            return true;
+    }
+    return false;
+}
+
+void R_GL_ShadowDrawStatic(const struct shadow_caster *casters, size_t count)
+{
+    if(!s_enabled)
+        return;
+
+    for(int tile = 0; tile < NUM_TILES; tile++) {
+
+        if(!s_dirty[tile])
+            continue;
+
+        size_t ntile = 0;
+        for(int i = 0; i < count; i++) {
+            if(r_gl_shadow_overlaps_tile(&casters[i].bounds, tile))
+                ntile++;
+        }
+
+        size_t size = sizeof(struct static_draw_args) + ntile * sizeof(struct shadow_cmd);
+        struct static_draw_args *args = arena_alloc(MEM_FrameArena(), size);
+        if(!args)
+            continue; /* Left to be drawn on a later frame */
+
+        args->light = s_light;
+        args->tile = tile;
+        args->count = ntile;
+
+        struct shadow_cmd *cmds = (struct shadow_cmd*)(args + 1);
+        size_t idx = 0;
+        for(int i = 0; i < count; i++) {
+            if(!r_gl_shadow_overlaps_tile(&casters[i].bounds, tile))
+                continue;
+            cmds[idx++] = (struct shadow_cmd){
+                .priv = casters[i].render_private,
+                .model = casters[i].model,
+                .pose = (struct pose_ref){{-1, -1}, 0.0f},
+                .preskin = -1,
+            };
+        }
+
+        R_Thread_Push(r_gl_shadow_static_exec, args, size);
+        s_dirty[tile] = false;
+    }
+}
+
+void R_GL_ShadowSubmit(const void *render_private, const mat4x4_t *model)
+{
+    if(!s_enabled)
+        return;
+
+    struct pose_ref pose = R_GL_AnimPose();
+    struct shadow_cmd cmd = (struct shadow_cmd){
+        .priv = render_private,
+        .model = *model,
+        .pose = pose,
+        .preskin = R_GL_PreskinAdd(render_private, &pose),
+    };
+    kv_push(struct shadow_cmd, s_dynamic, cmd);
+}
+
+void R_GL_ShadowFlush(void)
+{
+    if(!s_enabled)
+        return;
+
+    size_t count = kv_size(s_dynamic);
+    size_t size = sizeof(struct dynamic_draw_args) + count * sizeof(struct shadow_cmd);
+    struct dynamic_draw_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(!args) {
+        kv_reset(s_dynamic);
+        return;
+    }
+
+    args->light = s_light;
+    args->count = count;
+    memcpy(args + 1, s_dynamic.a, count * sizeof(struct shadow_cmd));
+    kv_reset(s_dynamic);
+
+    R_Thread_Push(r_gl_shadow_dynamic_exec, args, size);
+}
+
@@ -0,0 +1,269 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+
+#include "render_gl.h"
+#include "public/render.h"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <assert.h>
+
+
+/* Number of frames that the timer queries are given to complete */
+#define NUM_FRAMES          (3)
+/* Upper bound on the number of times the passes can be entered in a frame */
+#define MAX_INTERVALS       (32)
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+/* The timestamps taken at the start and end of every pass entered during a
+ * frame. Timestamps rather than GL_TIME_ELAPSED queries are used, so that 
+ * the passes can be timed within the scene, which already has an elapsed 
+ * time query running for the dynamic resolution. */
+struct frame_timers{
+    GLuint        queries[MAX_INTERVALS][2];
+    enum gpu_pass passes[MAX_INTERVALS];
+    int           num_intervals;
+    bool          issued;
+};
+
+struct pass_args{
+    enum gpu_pass pass;
+    bool          begin;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Only read on the main thread, when the render thread is idle */
+static struct render_stats  s_published;
+
+/* Everything below is only touched when drawing */
+static struct frame_timers  s_frames[NUM_FRAMES];
+static int                  s_head;
+/* Whether the passes of the current frame are timed */
+static bool                 s_timing;
+/* Index of the interval of the frame that each pass is in, or -1 */
+static int                  s_open[GPU_PASS_COUNT];
+
+static float                s_pass_ms[GPU_PASS_COUNT];
+static bool                 s_measured;
+static size_t               s_draw_calls;
+static size_t               s_vertices;
+static size_t               s_program_binds;
+static size_t               s_texture_binds;
+
+static const char *s_pass_names[] = {
+    [GPU_PASS_TERRAIN]  = "terrain",
+    [GPU_PASS_ENTITIES] = "entities",
+    [GPU_PASS_OVERLAYS] = "overlays",
+    [GPU_PASS_MINIMAP]  = "minimap",
+    [GPU_PASS_UI]       = "ui",
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void r_gl_stats_reset_open(void)
+{
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        s_open[i] = -1;
+}
+
+/* Timestamps complete in the order they are issued, so the frame's results
+ * are in once its last one is */
+static bool r_gl_stats_poll_frame(struct frame_timers *frame)
+{
+    assert(frame->issued && frame->num_intervals > 0);
+
+    GLuint avail;
+    glGetQueryObjectuiv(frame->queries[frame->num_intervals - 1][1], GL_QUERY_RESULT_AVAILABLE, &avail);
+    if(!avail)
+        return false;
+
+    float ms[GPU_PASS_COUNT] = {0};
+    for(int i = 0; i < frame->num_intervals; i++) {
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(frame->queries[i][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame->queries[i][1], GL_QUERY_RESULT, &end);
+        ms[frame->passes[i]] += (end - begin) / 1000000.0f;
+    }
+
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        s_pass_ms[i] = s_measured ? s_pass_ms[i] * 0.9f + ms[i] * 0.1f : ms[i];
+    s_measured = true;
+
+    frame->issued = false;
+    return true;
+}
+
+static void r_gl_stats_frame_exec(const void *unused)
+{
+    struct frame_timers *curr = &s_frames[s_head];
+
+    /* A frame with a pass left open can't be measured, since the end of it
+     * is not known */
+    bool closed = true;
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        closed = closed && (s_open[i] == -1);
+
+    if(s_timing && closed && curr->num_intervals > 0) {
+        curr->issued = true;
+        s_head = (s_head + 1) % NUM_FRAMES;
+    }
+
+    for(int i = 0; i < NUM_FRAMES; i++) {
+        int idx = (s_head + i) % NUM_FRAMES;
+        if(s_frames[idx].issued)
+            r_gl_stats_poll_frame(&s_frames[idx]);
+    }
+
+    /* A frame that is still in flight is left to complete, and this frame 
+     * goes unmeasured */
+    curr = &s_frames[s_head];
+    s_timing = !curr->issued;
+    if(s_timing)
+        curr->num_intervals = 0;
+    r_gl_stats_reset_open();
+}
+
+static void r_gl_stats_pass_exec(const void *arg)
+{
+    const struct pass_args *args = arg;
+    struct frame_timers *curr = &s_frames[s_head];
+
+    if(!s_timing)
+        return;
+
+    if(args->begin) {
+
+        if(s_open[args->pass] != -1 || curr->num_intervals == MAX_INTERVALS)
+            return;
+
+        int idx = curr->num_intervals++;
+        curr->passes[idx] = args->pass;
+        glQueryCounter(curr->queries[idx][0], GL_TIMESTAMP);
+        s_open[args->pass] = idx;
+
+    }else{
+
+        int idx = s_open[args->pass];
+        if(idx == -1)
+            return;
+
+        glQueryCounter(curr->queries[idx][1], GL_TIMESTAMP);
+        s_open[args->pass] = -1;
+    }
+}
+
+static void r_gl_stats_pass(enum gpu_pass pass, bool begin)
+{
+    assert(pass >= 0 && pass < GPU_PASS_COUNT);
+    struct pass_args args = (struct pass_args){pass, begin};
+    R_Thread_Push(r_gl_stats_pass_exec, &args, sizeof(args));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_StatsInit(void)
+{
+    for(int i = 0; i < NUM_FRAMES; i++)
+        glGenQueries(MAX_INTERVALS * 2, &s_frames[i].queries[0][0]);
+
+    r_gl_stats_reset_open();
+    return (s_frames[NUM_FRAMES - 1].queries[MAX_INTERVALS - 1][1] != 0);
+}
+
+void R_GL_StatsBeginFrame(void)
+{
+    /* The render thread is idle at the start of the frame, so the counts of
+     * the last frame can be taken without a lock */
+    R_Thread_Claim();
+
+    s_published = (struct render_stats){
+        .draw_calls = s_draw_calls,
+        .vertices = s_vertices,
+        .program_binds = s_program_binds,
+        .texture_binds = s_texture_binds,
+    };
+    memcpy(s_published.pass_ms, s_pass_ms, sizeof(s_pass_ms));
+    s_draw_calls = s_vertices = s_program_binds = s_texture_binds = 0;
+
+    R_Thread_Push(r_gl_stats_frame_exec, NULL, 0);
+}
+
+void R_GL_StatsDraw(size_t vertices)
+{
+    s_draw_calls++;
+    s_vertices += vertices;
+}
+
+void R_GL_StatsProgramBind(void)
+{
+    s_program_binds++;
+}
+
+void R_GL_StatsTextureBind(void)
+{
+    s_texture_binds++;
+}
+
+void R_GL_PassBegin(enum gpu_pass pass)
+{
+    r_gl_stats_pass(pass, true);
+}
+
+void R_GL_PassEnd(enum gpu_pass pass)
+{
+    r_gl_stats_pass(pass, false);
+}
+
+const char *R_GL_PassName(enum gpu_pass pass)
+{
+    assert(pass >= 0 && pass < ARR_SIZE(s_pass_names));
+    return s_pass_names[pass];
+}
+
+void R_GL_GetRenderStats(struct render_stats *out)
+{
+    *out = s_published;
+}
+
@@ -0,0 +1,276 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "vertex.h"
+#include "shader.h"
+#include "public/render.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+/* The ring is grown if a single upload doesn't fit in it */
+#define STREAM_INIT_SIZE    (4 * 1024 * 1024)
+
+/* The ranges and then the vertices follow right after the header */
+struct stream_cmd{
+    struct stream_draw draw;
+    size_t             num_ranges;
+    size_t             num_verts;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* All formats share the one buffer. Every upload is written to a range that
+ * hasn't been used since the buffer storage was last orphaned, so the writes
+ * never have to wait on the draws still in flight. Once the ring is full, the
+ * storage is orphaned and the writes start over from the beginning. */
+static GLuint  s_VBO;
+static GLuint  s_VAOs[STREAM_FMT_MAX];
+static size_t  s_strides[STREAM_FMT_MAX];
+static size_t  s_capacity;
+static size_t  s_head;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void r_gl_stream_set_attribs(enum stream_fmt fmt)
+{
+    switch(fmt) {
+    case STREAM_FMT_POS:
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3_t), (void*)0);
+        glEnableVertexAttribArray(0);
+        break;
+
+    case STREAM_FMT_COLORED:
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+            (void*)offsetof(struct colored_vert, pos));
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(struct colored_vert), 
+            (void*)offsetof(struct colored_vert, color));
+        glEnableVertexAttribArray(1);
+        break;
+
+    case STREAM_FMT_TERRAIN:
+
+        R_Vert_SetAttribs(VERT_LAYOUT_TERRAIN);
+        break;
+
+    default: assert(0);
+    }
+}
+
+static bool r_gl_stream_same_state(const struct stream_range *a, const struct stream_range *b)
+{
+    return a->mode == b->mode
+        && a->line_width == b->line_width
+        && a->point_size == b->point_size
+        && !memcmp(a->color.raw, b->color.raw, sizeof(a->color.raw));
+}
+
+static void r_gl_stream_draw_exec(const void *arg)
+{
+    const struct stream_cmd *cmd = arg;
+    const struct stream_range *ranges = (const struct stream_range*)(cmd + 1);
+    const void *verts = ranges + cmd->num_ranges;
+
+    if(!cmd->num_ranges)
+        return;
+
+    GLint first = R_GL_StreamUpload(cmd->draw.fmt, verts, cmd->num_verts);
+    if(first < 0)
+        return;
+
+    if(cmd->draw.screenspace)
+        R_GL_BeginScreenspace();
+
+    if(cmd->draw.blend) {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    GLuint shader_prog = R_Shader_GetProgForName(cmd->draw.shader);
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+
+    GLint loc = R_Shader_UniformLoc(shader_prog, SU_MODEL);
+    glUniformMatrix4fv(loc, 1, GL_FALSE, cmd->draw.model.raw);
+    GLint color_loc = R_Shader_UniformLoc(shader_prog, SU_COLOR);
+
+    GLfloat old_width;
+    glGetFloatv(GL_LINE_WIDTH, &old_width);
+
+    GLint firsts[cmd->num_ranges];
+    GLsizei counts[cmd->num_ranges];
+
+    for(size_t i = 0; i < cmd->num_ranges;) {
+
+        const struct stream_range *run = &ranges[i];
+        size_t n = 0;
+        do{
+            firsts[n] = first + ranges[i].first;
+            counts[n] = ranges[i].count;
+            n++, i++;
+        }while(i < cmd->num_ranges && r_gl_stream_same_state(run, &ranges[i]));
+
+        glUniform4fv(color_loc, 1, run->color.raw);
+        if(run->line_width > 0.0f)
+            glLineWidth(run->line_width);
+        if(run->point_size > 0.0f)
+            glPointSize(run->point_size);
+
+        if(n == 1)
+            glDrawArrays(run->mode, firsts[0], counts[0]);
+        else
+            glMultiDrawArrays(run->mode, firsts, counts, n);
+
+        size_t run_verts = 0;
+        for(size_t j = 0; j < n; j++)
+            run_verts += counts[j];
+        R_GL_StatsDraw(run_verts);
+    }
+
+    glLineWidth(old_width);
+
+    if(cmd->draw.blend)
+        glDisable(GL_BLEND);
+    if(cmd->draw.screenspace)
+        R_GL_EndScreenspace();
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_GL_StreamInit(void)
+{
+    s_strides[STREAM_FMT_POS] = sizeof(vec3_t);
+    s_strides[STREAM_FMT_COLORED] = sizeof(struct colored_vert);
+    s_strides[STREAM_FMT_TERRAIN] = R_Vert_Size(VERT_LAYOUT_TERRAIN);
+
+    glGenBuffers(1, &s_VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+    glBufferData(GL_ARRAY_BUFFER, STREAM_INIT_SIZE, NULL, GL_STREAM_DRAW);
+    if(glGetError() != GL_NO_ERROR)
+        goto fail_buff;
+
+    s_capacity = STREAM_INIT_SIZE;
+    s_head = 0;
+
+    glGenVertexArrays(STREAM_FMT_MAX, s_VAOs);
+    for(int i = 0; i < STREAM_FMT_MAX; i++) {
+    
+        glBindVertexArray(s_VAOs[i]);
+        glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+        r_gl_stream_set_attribs(i);
+    }
+
+    glBindVertexArray(0);
+    return true;
+
+fail_buff:
+    glDeleteBuffers(1, &s_VBO);
+    return false;
+}
+
+GLint R_GL_StreamUpload(enum stream_fmt fmt, const void *verts, size_t count)
+{
+    assert(fmt >= 0 && fmt < STREAM_FMT_MAX);
+
+    glBindVertexArray(s_VAOs[fmt]);
+    glBindBuffer(GL_ARRAY_BUFFER, s_VBO);
+
+    if(!count)
+        return 0;
+
+    /* The draws address the vertices by index, so the upload has to start 
+     * on a multiple of the format's stride */
+    size_t stride = s_strides[fmt];
+    size_t size = count * stride;
+    size_t offset = ((s_head + stride - 1) / stride) * stride;
+
+    if(offset + size > s_capacity) {
+
+        while(size > s_capacity)
+            s_capacity *= 2;
+        glBufferData(GL_ARRAY_BUFFER, s_capacity, NULL, GL_STREAM_DRAW);
+        offset = 0;
+    }
+
+    void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, 
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if(!dst)
+        return -1;
+
+    memcpy(dst, verts, size);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    s_head = offset + size;
+    return offset / stride;
+}
+
+void R_GL_StreamDraw(const struct stream_draw *draw, const struct stream_range *ranges, 
+                     size_t num_ranges, const void *verts, size_t num_verts)
+{
+    assert(draw->fmt >= 0 && draw->fmt < STREAM_FMT_MAX);
+
+    size_t ranges_size = num_ranges * sizeof(struct stream_range);
+    size_t verts_size = num_verts * s_strides[draw->fmt];
+    size_t size = sizeof(struct stream_cmd) + ranges_size + verts_size;
+
+    struct stream_cmd *cmd = arena_alloc(MEM_FrameArena(), size);
+    if(!cmd)
+        return;
+
+    cmd->draw = *draw;
+    cmd->num_ranges = num_ranges;
+    cmd->num_verts = num_verts;
+    memcpy(cmd + 1, ranges, ranges_size);
+    memcpy((unsigned char*)(cmd + 1) + ranges_size, verts, verts_size);
+
+    R_Thread_Push(r_gl_stream_draw_exec, cmd, size);
+}
+
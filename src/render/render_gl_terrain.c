@@ -0,0 +1,966 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "render_gl.h"
+#include "render_private.h"
+#include "mesh.h"
+#include "vertex.h"
+#include "shader.h"
+#include "texture.h"
+#include "material.h"
+#include "public/render.h"
+#include "../map/public/map.h"
+#include "../map/public/tile.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
+#include "../lib/public/kvec.h"
+
+#include <GL/glew.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/* The adjacency data of the terrain vertices packs material indices in 4 bits */
+#define MAX_BATCH_MATERIALS (16)
+/* The resolution of the splat layers */
+#define SPLAT_TEXELS_PER_TILE (4)
+#define SPLAT_WIDTH           (TILES_PER_CHUNK_WIDTH  * SPLAT_TEXELS_PER_TILE)
+#define SPLAT_HEIGHT          (TILES_PER_CHUNK_HEIGHT * SPLAT_TEXELS_PER_TILE)
+
+/* The heightfield has 2 texels per tile: the heights and materials of its'
+ * top face, then the adjacency information of the provoking vertices */
+#define HF_TEXELS_PER_TILE    (2)
+#define HF_WIDTH              (TILES_PER_CHUNK_WIDTH * HF_TEXELS_PER_TILE)
+/* The shared grid holds the 12 vertices of the top face of every tile of a 
+ * chunk, followed by the 6 of a single side face. The layout of its' values 
+ * and of the side face instances must match vertex_terrain-heightfield.glsl */
+#define HF_TOP_VERTS          (12)
+#define HF_SIDE_VERTS         (6)
+#define HF_GRID_TOP_VERTS     (TILES_PER_CHUNK_WIDTH * TILES_PER_CHUNK_HEIGHT * HF_TOP_VERTS)
+#define HF_GRID_VERT(r, c, slot) ((GLuint)(slot) | ((GLuint)(c) << 4) | ((GLuint)(r) << 9))
+#define HF_GRID_SIDE          (1u << 14)
+#define HF_SIDE(chunk, r, c, face) \
+    ((GLuint)(face) | ((GLuint)(c) << 2) | ((GLuint)(r) << 7) | ((GLuint)(chunk) << 12))
+/* Past the units of the material and splat textures */
+#define HF_TUNIT              (3)
+
+#define ARR_SIZE(a)           (sizeof(a)/sizeof(a[0]))
+#define MIN(a, b)             ((a) < (b) ? (a) : (b))
+#define MAX(a, b)             ((a) > (b) ? (a) : (b))
+
+enum hf_face{
+    HF_FACE_FRONT,
+    HF_FACE_BACK,
+    HF_FACE_LEFT,
+    HF_FACE_RIGHT,
+};
+
+/* All the chunks of the map in a single vertex buffer, in map space, so that
+ * any set of them can be drawn with a single call. The chunks' own material 
+ * indices are translated to indices into a table of all the distinct 
+ * materials of the map, whose textures are the layers of a texture array. */
+struct terrain_batch{
+    /* The copy of the chunks' meshes is only made the first time they're 
+     * drawn from it, so that it takes no memory while the heightfield is 
+     * drawn instead */
+    GLuint           VAO;
+    GLuint           VBO;
+    size_t           VBO_size;
+    bool             copy_failed;
+    const void     **chunk_rprivates;
+    GLuint           shader_prog;
+    GLuint           tex_array;
+    size_t           num_materials;
+    struct material  materials[MAX_BATCH_MATERIALS];
+    size_t           num_chunks;
+    /* The range of each chunk's vertices in 'VBO' */
+    GLint           *firsts;
+    GLsizei         *counts;
+    vec3_t          *offsets;
+    /* The index in 'materials' of each of the chunk's materials */
+    GLubyte        (*mat_remap)[MATERIALS_PER_CHUNK];
+    /* For the splat mode, each chunk's 4 most common top materials and a 
+     * layer with their weights across the chunk. They are derived from the
+     * tiles, which the map keeps up to date in place. */
+    size_t           chunks_wide;
+    const struct tile **tiles;
+    GLuint           splat_prog;
+    GLuint           splat_weights;
+    GLuint           splat_mats;
+    /* Writes only the depth, for the prepass */
+    GLuint           depth_prog;
+    /* For drawing the chunks straight from their' tiles: a layer per chunk 
+     * of 'HF_WIDTH' by 'TILES_PER_CHUNK_HEIGHT' texels, from which the 
+     * vertex shader rebuilds the tiles' vertices over a grid shared by all
+     * the chunks. The side faces are drawn from each chunk's list of the
+     * ones that can be seen. */
+    GLuint           hf_tex;
+    GLuint           hf_VAO;
+    GLuint           hf_grid;
+    GLuint           hf_instances;
+    kvec_t(GLuint)  *hf_sides;
+    GLuint           hf_prog;
+    GLuint           hf_splat_prog;
+    GLuint           hf_depth_prog;
+    /* Whether any of the chunk's tiles is blended into its' neighbours. The 
+     * ones which aren't are drawn with the variants of the programs that 
+     * leave the blending out. */
+    bool            *blended;
+    GLuint           noblend_prog;
+    GLuint           hf_noblend_prog;
+};
+
+/* Followed by the first vertex and then the vertex count of every range or,
+ * for the heightfield, by the index of every chunk and then the side faces 
+ * of all of them */
+struct batch_draw_args{
+    const struct terrain_batch *batch;
+    mat4x4_t                    model;
+    bool                        splat;
+    bool                        prepassed;
+    bool                        heightfield;
+    bool                        noblend;
+    size_t                      count;
+    size_t                      num_sides;
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool r_gl_terrain_mat_equal(const struct material *a, const struct material *b)
+{
+    return (0 == strcmp(a->texname, b->texname))
+        && a->ambient_intensity == b->ambient_intensity
+        && 0 == memcmp(a->diffuse_clr.raw, b->diffuse_clr.raw, sizeof(a->diffuse_clr.raw))
+        && 0 == memcmp(a->specular_clr.raw, b->specular_clr.raw, sizeof(a->specular_clr.raw));
+}
+
+/* Returns the index of the material in the batch's table, adding it if 
+ * necessary, or -1 if the table is full */
+static int r_gl_terrain_mat_idx(struct terrain_batch *batch, const struct material *mat)
+{
+    for(int i = 0; i < batch->num_materials; i++) {
+        if(r_gl_terrain_mat_equal(&batch->materials[i], mat))
+            return i;
+    }
+
+    if(batch->num_materials == MAX_BATCH_MATERIALS)
+        return -1;
+
+    batch->materials[batch->num_materials] = *mat;
+    return batch->num_materials++;
+}
+
+static GLint r_gl_terrain_remap_packed(const GLubyte remap[], GLint packed)
+{
+    GLuint ret = 0;
+    for(int i = 0; i < 8; i++) {
+        GLuint idx = (((GLuint)packed) >> (i * 4)) & 0xf;
+        ret |= (GLuint)(idx < MATERIALS_PER_CHUNK ? remap[idx] : 0) << (i * 4);
+    }
+    return (GLint)ret;
+}
+
+/* Reads back the chunk's vertices and writes them to its' range of the batch, 
+ * moved to map space and with the material indices translated */
+static bool r_gl_terrain_copy_chunk(struct terrain_batch *batch, size_t idx, 
+                                    const struct render_private *priv)
+{
+    assert(priv->mesh.layout == VERT_LAYOUT_TERRAIN);
+    assert(priv->mesh.num_verts == batch->counts[idx]);
+
+    const GLubyte *remap = batch->mat_remap[idx];
+    vec3_t offset = batch->offsets[idx];
+    size_t size = priv->mesh.num_verts * sizeof(struct terrain_vert);
+
+    struct terrain_vert *verts = malloc(size);
+    if(!verts)
+        return false;
+
+    glBindBuffer(GL_ARRAY_BUFFER, priv->mesh.VBO);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, size, verts);
+
+    for(int i = 0; i < priv->mesh.num_verts; i++) {
+
+        struct terrain_vert *curr = &verts[i];
+        PFM_Vec3_Add(&curr->pos, &offset, &curr->pos);
+
+        curr->material_idx = curr->material_idx < MATERIALS_PER_CHUNK ? remap[curr->material_idx] : 0;
+        for(int j = 0; j < 4; j++) {
+            curr->adjacent_mat_indices[j] = r_gl_terrain_remap_packed(remap, curr->adjacent_mat_indices[j]);
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch->VBO);
+    glBufferSubData(GL_ARRAY_BUFFER, batch->firsts[idx] * sizeof(struct terrain_vert), size, verts);
+
+    free(verts);
+    return true;
+}
+
+/* The batch's index of the top material of the tile at (r, c) relative to 
+ * chunk 'idx'. The coordinates may run into the neighbouring chunks, and are
+ * clamped to the edges of the map. */
+static int r_gl_terrain_top_mat(const struct terrain_batch *batch, size_t idx, int r, int c)
+{
+    int chunks_high = batch->num_chunks / batch->chunks_wide;
+    int abs_r = (idx / batch->chunks_wide) * TILES_PER_CHUNK_HEIGHT + r;
+    int abs_c = (idx % batch->chunks_wide) * TILES_PER_CHUNK_WIDTH + c;
+
+    abs_r = MAX(0, MIN(abs_r, chunks_high * TILES_PER_CHUNK_HEIGHT - 1));
+    abs_c = MAX(0, MIN(abs_c, (int)batch->chunks_wide * TILES_PER_CHUNK_WIDTH - 1));
+
+    size_t chunk = (abs_r / TILES_PER_CHUNK_HEIGHT) * batch->chunks_wide + (abs_c / TILES_PER_CHUNK_WIDTH);
+    const struct tile *tile = &batch->tiles[chunk][(abs_r % TILES_PER_CHUNK_HEIGHT) * TILES_PER_CHUNK_WIDTH 
+                                                  + (abs_c % TILES_PER_CHUNK_WIDTH)];
+
+    int mat = tile->top_mat_idx;
+    return (mat >= 0 && mat < MATERIALS_PER_CHUNK) ? batch->mat_remap[chunk][mat] : 0;
+}
+
+/* Writes the chunk's 4 most common top materials and its' layer of weights.
+ * Each texel gets the materials of the tile-sized area centered on it, so 
+ * that the materials fade into one another over the half tile on either side
+ * of an edge, as with the blurred blending. A material past the chunk's 4 
+ * counts as the most common one. */
+static bool r_gl_terrain_build_splat(struct terrain_batch *batch, size_t idx)
+{
+    int counts[MAX_BATCH_MATERIALS] = {0};
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+            counts[r_gl_terrain_top_mat(batch, idx, r, c)]++;
+        }
+    }
+
+    GLubyte mats[4];
+    int slots[MAX_BATCH_MATERIALS] = {0};
+
+    for(int i = 0; i < 4; i++) {
+
+        int best = 0;
+        for(int j = 1; j < MAX_BATCH_MATERIALS; j++) {
+            if(counts[j] > counts[best])
+                best = j;
+        }
+        mats[i] = best;
+        slots[best] = i;
+        counts[best] = -1;
+    }
+
+    GLubyte (*texels)[4] = malloc(SPLAT_WIDTH * SPLAT_HEIGHT * sizeof(*texels));
+    if(!texels)
+        return false;
+
+    for(int tr = 0; tr < SPLAT_HEIGHT; tr++) {
+        for(int tc = 0; tc < SPLAT_WIDTH; tc++) {
+
+            /* The corner of the area, in tiles */
+            float y = (tr + 0.5f) / SPLAT_TEXELS_PER_TILE - 0.5f;
+            float x = (tc + 0.5f) / SPLAT_TEXELS_PER_TILE - 0.5f;
+            int r0 = floorf(y), c0 = floorf(x);
+            float fy = y - r0, fx = x - c0;
+
+            float weights[4] = {0.0f};
+            weights[slots[r_gl_terrain_top_mat(batch, idx, r0,     c0    )]] += (1.0f - fy) * (1.0f - fx);
+            weights[slots[r_gl_terrain_top_mat(batch, idx, r0,     c0 + 1)]] += (1.0f - fy) * fx;
+            weights[slots[r_gl_terrain_top_mat(batch, idx, r0 + 1, c0    )]] += fy * (1.0f - fx);
+            weights[slots[r_gl_terrain_top_mat(batch, idx, r0 + 1, c0 + 1)]] += fy * fx;
+
+            for(int i = 0; i < 4; i++)
+                texels[tr * SPLAT_WIDTH + tc][i] = weights[i] * 255.0f + 0.5f;
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->splat_weights);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, idx, SPLAT_WIDTH, SPLAT_HEIGHT, 1, 
+        GL_RGBA, GL_UNSIGNED_BYTE, texels);
+
+    glBindTexture(GL_TEXTURE_2D, batch->splat_mats);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, idx, 0, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, mats);
+
+    free(texels);
+    return true;
+}
+
+static bool r_gl_terrain_init_splat(struct terrain_batch *batch)
+{
+    glGenTextures(1, &batch->splat_weights);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->splat_weights);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, SPLAT_WIDTH, SPLAT_HEIGHT, batch->num_chunks, 0, 
+        GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    R_Texture_SetGPUSize(batch->splat_weights, SPLAT_WIDTH * SPLAT_HEIGHT * 4 * batch->num_chunks);
+
+    glGenTextures(1, &batch->splat_mats);
+    glBindTexture(GL_TEXTURE_2D, batch->splat_mats);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8UI, batch->num_chunks, 1, 0, 
+        GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    R_Texture_SetGPUSize(batch->splat_mats, 4 * batch->num_chunks);
+
+    if(glGetError() != GL_NO_ERROR)
+        return false;
+
+    for(int i = 0; i < batch->num_chunks; i++) {
+        if(!r_gl_terrain_build_splat(batch, i))
+            return false;
+    }
+    return true;
+}
+
+static void r_gl_terrain_free_splat(struct terrain_batch *batch)
+{
+    if(batch->splat_weights)
+        R_Texture_FreeArray(batch->splat_weights);
+    if(batch->splat_mats)
+        R_Texture_FreeArray(batch->splat_mats);
+}
+
+/* A tile's top face is drawn without blending when all the triangles around
+ * its' corners have the same material */
+static bool r_gl_terrain_hf_blended(const struct tile_hf_desc *desc)
+{
+    GLint mask = desc->south_adj[0];
+    return ((GLuint)mask != (mask & 0xf) * 0x11111111u)
+        || desc->south_adj[1] != mask
+        || desc->north_adj[0] != mask
+        || desc->north_adj[1] != mask;
+}
+
+static GLuint r_gl_terrain_remap_mat(const GLubyte remap[], int idx)
+{
+    return (idx >= 0 && idx < MATERIALS_PER_CHUNK) ? remap[idx] : 0;
+}
+
+/* Writes the chunk's layer of the heightfield and rebuilds its' list of the 
+ * side faces which aren't hidden behind a neighbouring tile */
+static bool r_gl_terrain_build_hf(struct terrain_batch *batch, size_t idx)
+{
+    const struct tile *tiles = batch->tiles[idx];
+    const GLubyte *remap = batch->mat_remap[idx];
+
+    GLuint (*texels)[4] = malloc(HF_WIDTH * TILES_PER_CHUNK_HEIGHT * sizeof(*texels));
+    if(!texels)
+        return false;
+
+    kv_reset(batch->hf_sides[idx]);
+    batch->blended[idx] = false;
+
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+
+            struct tile_hf_desc desc;
+            R_GL_TileGetHeightfield(tiles, TILES_PER_CHUNK_WIDTH, TILES_PER_CHUNK_HEIGHT, r, c, &desc);
+            batch->blended[idx] |= r_gl_terrain_hf_blended(&desc);
+
+            GLuint *geom = texels[r * HF_WIDTH + c * HF_TEXELS_PER_TILE];
+            GLuint *adj = texels[r * HF_WIDTH + c * HF_TEXELS_PER_TILE + 1];
+
+            /* The heights are signed 16-bit values */
+            geom[0] = ((GLuint)desc.heights[0] & 0xffff) | ((GLuint)desc.heights[1] << 16);
+            geom[1] = ((GLuint)desc.heights[2] & 0xffff) | ((GLuint)desc.heights[3] << 16);
+            geom[2] = ((GLuint)desc.heights[4] & 0xffff)
+                    | (((GLuint)r_gl_terrain_remap_packed(remap, desc.middle_mask) & 0xff) << 16)
+                    | ((GLuint)desc.left_aligned << 24)
+                    | (r_gl_terrain_remap_mat(remap, desc.sides_mat_idx) << 28);
+            geom[3] = r_gl_terrain_remap_packed(remap, desc.center_mask);
+
+            adj[0] = r_gl_terrain_remap_packed(remap, desc.south_adj[0]);
+            adj[1] = r_gl_terrain_remap_packed(remap, desc.south_adj[1]);
+            adj[2] = r_gl_terrain_remap_packed(remap, desc.north_adj[0]);
+            adj[3] = r_gl_terrain_remap_packed(remap, desc.north_adj[1]);
+
+            if(M_Tile_FrontFaceVisible(tiles, r, c))
+                kv_push(GLuint, batch->hf_sides[idx], HF_SIDE(idx, r, c, HF_FACE_FRONT));
+            if(M_Tile_BackFaceVisible(tiles, r, c))
+                kv_push(GLuint, batch->hf_sides[idx], HF_SIDE(idx, r, c, HF_FACE_BACK));
+            if(M_Tile_LeftFaceVisible(tiles, r, c))
+                kv_push(GLuint, batch->hf_sides[idx], HF_SIDE(idx, r, c, HF_FACE_LEFT));
+            if(M_Tile_RightFaceVisible(tiles, r, c))
+                kv_push(GLuint, batch->hf_sides[idx], HF_SIDE(idx, r, c, HF_FACE_RIGHT));
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->hf_tex);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, idx, HF_WIDTH, TILES_PER_CHUNK_HEIGHT, 1, 
+        GL_RGBA_INTEGER, GL_UNSIGNED_INT, texels);
+
+    free(texels);
+    return true;
+}
+
+static bool r_gl_terrain_init_hf(struct terrain_batch *batch)
+{
+    batch->hf_sides = calloc(batch->num_chunks, sizeof(*batch->hf_sides));
+    batch->blended = calloc(batch->num_chunks, sizeof(*batch->blended));
+    if(!batch->hf_sides || !batch->blended)
+        return false;
+
+    for(int i = 0; i < batch->num_chunks; i++)
+        kv_init(batch->hf_sides[i]);
+
+    const size_t grid_size = (HF_GRID_TOP_VERTS + HF_SIDE_VERTS) * sizeof(GLuint);
+    GLuint *grid = malloc(grid_size);
+    if(!grid)
+        return false;
+
+    for(int r = 0; r < TILES_PER_CHUNK_HEIGHT; r++) {
+        for(int c = 0; c < TILES_PER_CHUNK_WIDTH; c++) {
+            for(int i = 0; i < HF_TOP_VERTS; i++) {
+                grid[(r * TILES_PER_CHUNK_WIDTH + c) * HF_TOP_VERTS + i] = HF_GRID_VERT(r, c, i);
+            }
+        }
+    }
+    for(int i = 0; i < HF_SIDE_VERTS; i++) {
+        grid[HF_GRID_TOP_VERTS + i] = HF_GRID_SIDE | i;
+    }
+
+    glGenVertexArrays(1, &batch->hf_VAO);
+    glBindVertexArray(batch->hf_VAO);
+
+    /* Attribute 0 - the tile and the vertex of its' face */
+    glGenBuffers(1, &batch->hf_grid);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->hf_grid);
+    glBufferData(GL_ARRAY_BUFFER, grid_size, grid, GL_STATIC_DRAW);
+    MEM_Track(MEM_TAG_GL_BUFFERS, grid_size);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glEnableVertexAttribArray(0);
+    free(grid);
+
+    /* Attribute 1 - per-instance chunk or side face, pointed at when drawing */
+    glGenBuffers(1, &batch->hf_instances);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->hf_instances);
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+
+    glGenTextures(1, &batch->hf_tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->hf_tex);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32UI, HF_WIDTH, TILES_PER_CHUNK_HEIGHT, batch->num_chunks, 0, 
+        GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    R_Texture_SetGPUSize(batch->hf_tex, HF_WIDTH * TILES_PER_CHUNK_HEIGHT * 16 * batch->num_chunks);
+
+    if(glGetError() != GL_NO_ERROR)
+        return false;
+
+    for(int i = 0; i < batch->num_chunks; i++) {
+        if(!r_gl_terrain_build_hf(batch, i))
+            return false;
+    }
+    return true;
+}
+
+static void r_gl_terrain_free_hf(struct terrain_batch *batch)
+{
+    if(batch->hf_sides) {
+        for(int i = 0; i < batch->num_chunks; i++)
+            kv_destroy(batch->hf_sides[i]);
+        free(batch->hf_sides);
+    }
+    free(batch->blended);
+    if(batch->hf_tex)
+        R_Texture_FreeArray(batch->hf_tex);
+    if(batch->hf_grid)
+        MEM_Untrack(MEM_TAG_GL_BUFFERS, (HF_GRID_TOP_VERTS + HF_SIDE_VERTS) * sizeof(GLuint));
+
+    GLuint buffers[] = {batch->hf_grid, batch->hf_instances};
+    glDeleteBuffers(ARR_SIZE(buffers), buffers);
+    glDeleteVertexArrays(1, &batch->hf_VAO);
+}
+
+/* Makes the batch's copy of the chunks' meshes, leaving the batch without
+ * one if it can't be made */
+static bool r_gl_terrain_init_copy(struct terrain_batch *batch)
+{
+    size_t num_verts = 0;
+    for(int i = 0; i < batch->num_chunks; i++)
+        num_verts += batch->counts[i];
+
+    glGenVertexArrays(1, &batch->VAO);
+    glBindVertexArray(batch->VAO);
+
+    glGenBuffers(1, &batch->VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->VBO);
+    batch->VBO_size = num_verts * sizeof(struct terrain_vert);
+    glBufferData(GL_ARRAY_BUFFER, batch->VBO_size, NULL, GL_STATIC_DRAW);
+    MEM_Track(MEM_TAG_GL_BUFFERS, batch->VBO_size);
+    R_Vert_SetAttribs(VERT_LAYOUT_TERRAIN);
+
+    for(int i = 0; i < batch->num_chunks; i++) {
+        if(!r_gl_terrain_copy_chunk(batch, i, batch->chunk_rprivates[i]))
+            goto fail;
+    }
+    return true;
+
+fail:
+    glDeleteVertexArrays(1, &batch->VAO);
+    glDeleteBuffers(1, &batch->VBO);
+    MEM_Untrack(MEM_TAG_GL_BUFFERS, batch->VBO_size);
+    batch->VAO = 0;
+    batch->VBO = 0;
+    batch->VBO_size = 0;
+    return false;
+}
+
+/* Draws the tops of the chunks and then their' side faces from the grid. 
+ * 'instances' holds the chunks' indices followed by the side faces. Returns
+ * the number of vertices drawn. */
+static size_t r_gl_terrain_hf_submit(const struct terrain_batch *batch, const GLuint *instances, 
+                                     size_t num_chunks, size_t num_sides)
+{
+    size_t size = (num_chunks + num_sides) * sizeof(GLuint);
+
+    glBindVertexArray(batch->hf_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, batch->hf_instances);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, size, instances);
+
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)0);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, HF_GRID_TOP_VERTS, num_chunks);
+
+    if(num_sides) {
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void*)(num_chunks * sizeof(GLuint)));
+        glDrawArraysInstanced(GL_TRIANGLES, HF_GRID_TOP_VERTS, HF_SIDE_VERTS, num_sides);
+    }
+    return num_chunks * HF_GRID_TOP_VERTS + num_sides * HF_SIDE_VERTS;
+}
+
+static void r_gl_terrain_hf_bind(const struct terrain_batch *batch, GLuint shader_prog)
+{
+    glActiveTexture(GL_TEXTURE0 + HF_TUNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->hf_tex);
+    R_GL_StatsTextureBind();
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_HEIGHTFIELD), HF_TUNIT);
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_CHUNKS_WIDE), batch->chunks_wide);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+static void r_gl_terrain_draw_exec(const void *arg)
+{
+    const struct batch_draw_args *args = arg;
+    const struct terrain_batch *batch = args->batch;
+    const GLint *firsts = (const GLint*)(args + 1);
+    const GLsizei *counts = (const GLsizei*)(firsts + args->count);
+    GLuint shader_prog = args->heightfield ? (args->splat ? batch->hf_splat_prog 
+                                            : args->noblend ? batch->hf_noblend_prog : batch->hf_prog)
+                                           : (args->splat ? batch->splat_prog 
+                                            : args->noblend ? batch->noblend_prog : batch->shader_prog);
+
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+    glUniformMatrix4fv(R_Shader_UniformLoc(shader_prog, SU_MODEL), 1, GL_FALSE, args->model.raw);
+
+    for(int i = 0; i < batch->num_materials; i++) {
+    
+        const struct material *mat = &batch->materials[i];
+        glUniform1fv(R_Shader_MaterialLoc(shader_prog, i, MU_AMBIENT_INTENSITY), 1, &mat->ambient_intensity);
+        glUniform3fv(R_Shader_MaterialLoc(shader_prog, i, MU_DIFFUSE_CLR), 1, mat->diffuse_clr.raw);
+        glUniform3fv(R_Shader_MaterialLoc(shader_prog, i, MU_SPECULAR_CLR), 1, mat->specular_clr.raw);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, batch->tex_array);
+    R_GL_StatsTextureBind();
+    glUniform1i(R_Shader_UniformLoc(shader_prog, SU_TEXTURE_ARRAY), 0);
+
+    if(args->splat) {
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, batch->splat_weights);
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_SPLAT_WEIGHTS), 1);
+
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, batch->splat_mats);
+        glUniform1i(R_Shader_UniformLoc(shader_prog, SU_SPLAT_MATS), 2);
+        R_GL_StatsTextureBind();
+        R_GL_StatsTextureBind();
+
+        GLfloat origin[2] = {args->model.cols[3][0], args->model.cols[3][2]};
+        GLint grid[2] = {batch->chunks_wide, batch->num_chunks / batch->chunks_wide};
+        glUniform2fv(R_Shader_UniformLoc(shader_prog, SU_SPLAT_ORIGIN), 1, origin);
+        glUniform2iv(R_Shader_UniformLoc(shader_prog, SU_SPLAT_GRID), 1, grid);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    /* The depth buffer already holds the nearest surface, so only the 
+     * fragments matching it are shaded */
+    if(args->prepassed) {
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+
+    size_t verts = 0;
+    if(args->heightfield) {
+
+        r_gl_terrain_hf_bind(batch, shader_prog);
+        verts = r_gl_terrain_hf_submit(batch, (const GLuint*)(args + 1), args->count, args->num_sides);
+    }else{
+
+        glBindVertexArray(batch->VAO);
+        glMultiDrawArrays(GL_TRIANGLES, firsts, counts, args->count);
+        for(int i = 0; i < args->count; i++)
+            verts += counts[i];
+    }
+
+    if(args->prepassed) {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+    }
+    R_GL_StatsDraw(verts);
+}
+
+static void r_gl_terrain_depth_exec(const void *arg)
+{
+    const struct batch_draw_args *args = arg;
+    const struct terrain_batch *batch = args->batch;
+    const GLint *firsts = (const GLint*)(args + 1);
+    const GLsizei *counts = (const GLsizei*)(firsts + args->count);
+    GLuint shader_prog = args->heightfield ? batch->hf_depth_prog : batch->depth_prog;
+
+    glUseProgram(shader_prog);
+    R_GL_StatsProgramBind();
+    glUniformMatrix4fv(R_Shader_UniformLoc(shader_prog, SU_MODEL), 1, GL_FALSE, args->model.raw);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    size_t verts = 0;
+    if(args->heightfield) {
+
+        r_gl_terrain_hf_bind(batch, shader_prog);
+        verts = r_gl_terrain_hf_submit(batch, (const GLuint*)(args + 1), args->count, args->num_sides);
+    }else{
+
+        glBindVertexArray(batch->VAO);
+        glMultiDrawArrays(GL_TRIANGLES, firsts, counts, args->count);
+        for(int i = 0; i < args->count; i++)
+            verts += counts[i];
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    R_GL_StatsDraw(verts);
+}
+
+static struct batch_draw_args *r_gl_terrain_hf_args(const struct terrain_batch *batch, 
+                                                    const size_t *chunk_indices, size_t count, 
+                                                    size_t *out_size)
+{
+    size_t num_sides = 0;
+    for(int i = 0; i < count; i++) {
+        assert(chunk_indices[i] < batch->num_chunks);
+        num_sides += kv_size(batch->hf_sides[chunk_indices[i]]);
+    }
+
+    size_t size = sizeof(struct batch_draw_args) + (count + num_sides) * sizeof(GLuint);
+    struct batch_draw_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(!args)
+        return NULL;
+
+    GLuint *chunks = (GLuint*)(args + 1);
+    GLuint *sides = chunks + count;
+
+    for(int i = 0; i < count; i++) {
+
+        size_t chunk_sides = kv_size(batch->hf_sides[chunk_indices[i]]);
+        chunks[i] = chunk_indices[i];
+        memcpy(sides, batch->hf_sides[chunk_indices[i]].a, chunk_sides * sizeof(GLuint));
+        sides += chunk_sides;
+    }
+
+    args->num_sides = num_sides;
+    *out_size = size;
+    return args;
+}
+
+static struct batch_draw_args *r_gl_terrain_draw_args(struct terrain_batch *batch, 
+                                                      const size_t *chunk_indices, size_t count, 
+                                                      const mat4x4_t *model, bool heightfield,
+                                                      size_t *out_size)
+{
+    /* Drawn from the heightfield after all if the copy can't be made */
+    if(!heightfield && !batch->VBO && !batch->copy_failed) {
+        R_Thread_Claim();
+        batch->copy_failed = !r_gl_terrain_init_copy(batch);
+    }
+    heightfield = heightfield || batch->copy_failed;
+
+    struct batch_draw_args *args;
+    size_t size;
+
+    if(heightfield) {
+        args = r_gl_terrain_hf_args(batch, chunk_indices, count, &size);
+        if(!args)
+            return NULL;
+    }else{
+
+        size = sizeof(struct batch_draw_args) + count * (sizeof(GLint) + sizeof(GLsizei));
+        args = arena_alloc(MEM_FrameArena(), size);
+        if(!args)
+            return NULL;
+
+        GLint *firsts = (GLint*)(args + 1);
+        GLsizei *counts = (GLsizei*)(firsts + count);
+
+        for(int i = 0; i < count; i++) {
+            assert(chunk_indices[i] < batch->num_chunks);
+            firsts[i] = batch->firsts[chunk_indices[i]];
+            counts[i] = batch->counts[chunk_indices[i]];
+        }
+        args->num_sides = 0;
+    }
+
+    args->batch = batch;
+    args->model = *model;
+    args->splat = false;
+    args->prepassed = false;
+    args->heightfield = heightfield;
+    args->noblend = false;
+    args->count = count;
+    *out_size = size;
+    return args;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void *R_GL_TerrainBatchNew(void **chunk_rprivates, const struct tile **chunk_tiles, 
+                           const vec3_t *chunk_offsets, size_t chunks_wide, size_t num_chunks)
+{
+    assert(chunks_wide > 0 && num_chunks % chunks_wide == 0);
+
+    R_Thread_Claim();
+
+    struct terrain_batch *batch = calloc(1, sizeof(struct terrain_batch));
+    if(!batch)
+        goto fail_alloc;
+
+    batch->num_chunks = num_chunks;
+    batch->chunks_wide = chunks_wide;
+    batch->firsts = malloc(num_chunks * sizeof(GLint));
+    batch->counts = malloc(num_chunks * sizeof(GLsizei));
+    batch->offsets = malloc(num_chunks * sizeof(vec3_t));
+    batch->mat_remap = calloc(num_chunks, sizeof(*batch->mat_remap));
+    batch->tiles = malloc(num_chunks * sizeof(*batch->tiles));
+    batch->chunk_rprivates = malloc(num_chunks * sizeof(*batch->chunk_rprivates));
+    if(!batch->firsts || !batch->counts || !batch->offsets || !batch->mat_remap || !batch->tiles
+    || !batch->chunk_rprivates)
+        goto fail_alloc_chunks;
+    memcpy(batch->tiles, chunk_tiles, num_chunks * sizeof(*batch->tiles));
+    memcpy(batch->chunk_rprivates, chunk_rprivates, num_chunks * sizeof(*batch->chunk_rprivates));
+
+    size_t num_verts = 0;
+    for(int i = 0; i < num_chunks; i++) {
+
+        const struct render_private *priv = chunk_rprivates[i];
+        assert(priv->num_materials <= MATERIALS_PER_CHUNK);
+
+        for(int j = 0; j < priv->num_materials; j++) {
+
+            int idx = r_gl_terrain_mat_idx(batch, &priv->materials[j]);
+            if(idx < 0)
+                goto fail_alloc_chunks;
+            batch->mat_remap[i][j] = idx;
+        }
+
+        batch->firsts[i] = num_verts;
+        batch->counts[i] = priv->mesh.num_verts;
+        batch->offsets[i] = chunk_offsets[i];
+        num_verts += priv->mesh.num_verts;
+    }
+
+    GLuint textures[MAX_BATCH_MATERIALS];
+    for(int i = 0; i < batch->num_materials; i++) {
+        textures[i] = batch->materials[i].texture.id;
+    }
+
+    if(!batch->num_materials
+    || !R_Texture_MakeArray(textures, batch->num_materials, &batch->tex_array))
+        goto fail_alloc_chunks;
+
+    if(!r_gl_terrain_init_splat(batch))
+        goto fail_splat;
+
+    if(!r_gl_terrain_init_hf(batch))
+        goto fail_hf;
+
+    batch->shader_prog = R_Shader_GetProgForName("terrain.array");
+    batch->noblend_prog = R_Shader_GetProgForName("terrain.array.noblend");
+    batch->splat_prog = R_Shader_GetProgForName("terrain.splat");
+    batch->depth_prog = R_Shader_GetProgForName("terrain.depth");
+    batch->hf_prog = R_Shader_GetProgForName("terrain.heightfield");
+    batch->hf_noblend_prog = R_Shader_GetProgForName("terrain.heightfield.noblend");
+    batch->hf_splat_prog = R_Shader_GetProgForName("terrain.heightfield.splat");
+    batch->hf_depth_prog = R_Shader_GetProgForName("terrain.heightfield.depth");
+    return batch;
+
+fail_hf:
+    r_gl_terrain_free_hf(batch);
+fail_splat:
+    r_gl_terrain_free_splat(batch);
+    R_Texture_FreeArray(batch->tex_array);
+fail_alloc_chunks:
+    free(batch->firsts);
+    free(batch->counts);
+    free(batch->offsets);
+    free(batch->mat_remap);
+    free(batch->tiles);
+    free(batch->chunk_rprivates);
+    free(batch);
+fail_alloc:
+    return NULL;
+}
+
+bool R_GL_TerrainBatchUpdateChunk(void *batch_ctx, size_t idx, const void *chunk_rprivate)
+{
+    struct terrain_batch *batch = batch_ctx;
+    assert(idx < batch->num_chunks);
+    R_Thread_Claim();
+
+    if(batch->VBO && !r_gl_terrain_copy_chunk(batch, idx, chunk_rprivate))
+        return false;
+
+    batch->chunk_rprivates[idx] = chunk_rprivate;
+    if(!r_gl_terrain_build_hf(batch, idx))
+        return false;
+
+    /* The tiles along the chunk's edges are also blended into the layers of
+     * the chunks around it */
+    int chunks_high = batch->num_chunks / batch->chunks_wide;
+    int chunk_r = idx / batch->chunks_wide;
+    int chunk_c = idx % batch->chunks_wide;
+
+    for(int r = MAX(0, chunk_r - 1); r <= MIN(chunks_high - 1, chunk_r + 1); r++) {
+        for(int c = MAX(0, chunk_c - 1); c <= MIN((int)batch->chunks_wide - 1, chunk_c + 1); c++) {
+            if(!r_gl_terrain_build_splat(batch, r * batch->chunks_wide + c))
+                return false;
+        }
+    }
+    return true;
+}
+
+void R_GL_TerrainBatchDraw(void *batch_ctx, const size_t *chunk_indices, size_t count, 
+                           const mat4x4_t *model, bool splat, bool prepassed, bool heightfield)
+{
+    struct terrain_batch *batch = batch_ctx;
+
+    /* The splat layers already hold the blending, so only the other modes 
+     * split the chunks between the programs */
+    size_t num_blended = count;
+    size_t *sorted = NULL;
+
+    if(!splat) {
+
+        sorted = arena_alloc(MEM_FrameArena(), count * sizeof(size_t));
+        if(!sorted)
+            return;
+
+        size_t num_flat = 0;
+        num_blended = 0;
+        for(int i = 0; i < count; i++) {
+            assert(chunk_indices[i] < batch->num_chunks);
+            if(!batch->blended[chunk_indices[i]])
+                sorted[num_flat++] = chunk_indices[i];
+        }
+        for(int i = 0; i < count; i++) {
+            if(batch->blended[chunk_indices[i]])
+                sorted[num_flat + num_blended++] = chunk_indices[i];
+        }
+        chunk_indices = sorted;
+    }
+
+    for(int noblend = 0; noblend < 2; noblend++) {
+
+        const size_t *chunks = noblend ? chunk_indices : chunk_indices + (count - num_blended);
+        size_t num_chunks = noblend ? (count - num_blended) : num_blended;
+        if(!num_chunks)
+            continue;
+
+        size_t size;
+        struct batch_draw_args *args = r_gl_terrain_draw_args(batch, chunks, num_chunks, model, 
+                                                              heightfield, &size);
+        if(!args)
+            return;
+
+        args->splat = splat;
+        args->prepassed = prepassed;
+        args->noblend = noblend;
+        R_Thread_Push(r_gl_terrain_draw_exec, args, size);
+    }
+}
+
+void R_GL_TerrainBatchDrawDepth(void *batch_ctx, const size_t *chunk_indices, size_t count, 
+                                const mat4x4_t *model, bool heightfield)
+{
+    size_t size;
+    struct batch_draw_args *args = r_gl_terrain_draw_args(batch_ctx, chunk_indices, count, model, 
+                                                          heightfield, &size);
+    if(!args)
+        return;
+
+    R_Thread_Push(r_gl_terrain_depth_exec, args, size);
+}
+
+void R_GL_TerrainBatchFree(void *batch_ctx)
+{
+    struct terrain_batch *batch = batch_ctx;
+    R_Thread_Claim();
+
+    if(batch->VBO) {
+        glDeleteVertexArrays(1, &batch->VAO);
+        glDeleteBuffers(1, &batch->VBO);
+        MEM_Untrack(MEM_TAG_GL_BUFFERS, batch->VBO_size);
+    }
+    R_Texture_FreeArray(batch->tex_array);
+    r_gl_terrain_free_splat(batch);
+    r_gl_terrain_free_hf(batch);
+
+    free(batch->firsts);
+    free(batch->counts);
+    free(batch->offsets);
+    free(batch->mat_remap);
+    free(batch->tiles);
+    free(batch->chunk_rprivates);
+    free(batch);
+}
+
@@ -40,13 +40,16 @@
 #include "shader.h"
 #include "material.h"
 #include "gl_assert.h"
-#include "gl_uniforms.h"
+#include "bake_cache.h"
+#include "texture.h"
 #include "public/render.h"
 #include "../map/public/tile.h"
 #include "../map/public/map.h"
 #include "../collision.h"
 #include "../camera.h"
 #include "../config.h"
+#include "../mem.h"
+#include "../lib/public/mem_arena.h"
 
 #include <GL/glew.h>
 
@@ -60,6 +63,9 @@
 
 #define MAG(x, y)                   sqrt(pow(x,2) + pow(y,2))
 
+#define MIN(a, b)                   ((a) < (b) ? (a) : (b))
+#define MAX(a, b)                   ((a) > (b) ? (a) : (b))
+
 #define VEC3_EQUAL(a, b)            (0 == memcmp((a).raw, (b).raw, sizeof((a).raw)))
 
 #define INDICES_MASK_8(a, b)        (uint8_t)( (((a) & 0xf) << 4) | ((b) & 0xf) )
@@ -77,6 +83,36 @@ struct face{
     struct vertex nw, ne, se, sw; 
 };
 
+/* Order of the faces of a tile in the vertex buffer written by 'R_GL_TileGetVertices' */
+enum tile_face{
+    TILE_FACE_BOT = 0,
+    TILE_FACE_FRONT,
+    TILE_FACE_BACK,
+    TILE_FACE_LEFT,
+    TILE_FACE_RIGHT,
+    TILE_FACE_TOP,
+};
+
+/* State carried between the steps of baking a single chunk */
+struct tile_bake{
+    const struct render_private *og_priv;
+    const struct tile           *tiles;
+    int                          tiles_per_chunk_x, tiles_per_chunk_z;
+    int                          chunk_r, chunk_c;
+    GLuint                       rendered_tex;
+    /* Indices of the original chunk's materials used by the side faces. The 
+     * baked top texture goes in the slot after the last of them. */
+    int                          side_mats_set[MATERIALS_PER_CHUNK];
+    int                          num_side_mats;
+    /* Allocated by 'R_GL_TileBakeBegin' and filled in by 'R_GL_TileBakeBuild' */
+    struct vertex               *vbuff;
+    size_t                       num_verts;
+    struct vertex               *lod_vbuff;
+    size_t                       lod_num_verts;
+    /* Tiles whose top face has already been emitted as part of a larger quad */
+    bool                        *merged;
+};
+
 struct tile_adj_info{
     const struct tile *tile;
     uint8_t middle_mask, top_left_mask, top_right_mask, bot_left_mask, bot_right_mask;
@@ -318,7 +354,7 @@ static void r_gl_tile_mat_indices(struct tile_adj_info *inout, bool *out_top_tri
     }
 }
 
-enum blend_mode r_gl_blendmode_for_provoking_vert(const struct vertex *vert)
+enum blend_mode r_gl_blendmode_for_provoking_vert(const struct terrain_vert *vert)
 {
     if(SAME_INDICES_32(vert->adjacent_mat_indices[0])
     && SAME_INDICES_32(vert->adjacent_mat_indices[1])
@@ -349,90 +385,478 @@ static int arr_indexof(int *array, size_t size, int elem)
     return -1;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+static bool r_gl_tile_face_visible(const struct tile *tiles, int r, int c, int face)
+{
+    switch(face) {
+    case TILE_FACE_FRONT: return M_Tile_FrontFaceVisible(tiles, r, c);
+    case TILE_FACE_BACK:  return M_Tile_BackFaceVisible (tiles, r, c);
+    case TILE_FACE_LEFT:  return M_Tile_LeftFaceVisible (tiles, r, c);
+    case TILE_FACE_RIGHT: return M_Tile_RightFaceVisible(tiles, r, c);
+    default: assert(0); return false;
+    }
+}
 
-void R_GL_TileDrawSelected(const struct tile_desc *in, const void *chunk_rprivate, mat4x4_t *model, 
-                           int tiles_per_chunk_x, int tiles_per_chunk_z)
+/* Copies a side face of a tile into 'out', remapping the material to its' index
+ * in the baked chunk's material list. Returns the number of vertices written. */
+static int r_gl_tile_baked_side(const struct vertex *tile_vbuff, int face, int *side_mats_set, 
+                                int num_side_mats, struct vertex *out)
 {
-    struct vertex vbuff[VERTS_PER_TILE];
-    vec3_t red = (vec3_t){1.0f, 0.0f, 0.0f};
-    GLint VAO, VBO;
-    GLint shader_prog;
-    GLuint loc;
-
-    const struct render_private *priv = chunk_rprivate;
-    size_t offset = (in->tile_r * tiles_per_chunk_x + in->tile_c) * VERTS_PER_TILE * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-
-    const struct vertex *vert_base = glMapNamedBufferRange(priv->mesh.VBO, offset, length, GL_MAP_READ_BIT);
-    assert(vert_base);
-    memcpy(vbuff, vert_base, sizeof(vbuff));
-    glUnmapNamedBuffer(priv->mesh.VBO);
-
-    /* Additionally, scale the tile selection mesh slightly around its' center. This is so that 
-     * it is slightly larger than the actual tile underneath and can be rendered on top of it. */
-    const float SCALE_FACTOR = 1.025f;
-    mat4x4_t final_model;
-    mat4x4_t scale, trans, trans_inv, tmp1, tmp2;
-    PFM_Mat4x4_MakeScale(SCALE_FACTOR, SCALE_FACTOR, SCALE_FACTOR, &scale);
-
-    vec3_t center = (vec3_t){
-        ( 0.0f - (in->tile_c* X_COORDS_PER_TILE) - X_COORDS_PER_TILE/2.0f ), 
-        (-1.0f * Y_COORDS_PER_TILE + Y_COORDS_PER_TILE/2.0f), 
-        ( 0.0f + (in->tile_r* Z_COORDS_PER_TILE) + Z_COORDS_PER_TILE/2.0f),
+    memcpy(out, tile_vbuff + (VERTS_PER_FACE * face), sizeof(struct vertex) * VERTS_PER_FACE); 
+    for(int i = 0; i < VERTS_PER_FACE; i++) {
+        out[i].material_idx = arr_indexof(side_mats_set, num_side_mats, out[i].material_idx);
+        assert(out[i].material_idx >= 0);
+    }
+    return VERTS_PER_FACE;
+}
+
+/* Writes the 2-triangle top face of a tile, sampling the baked chunk texture. 
+ * Returns the number of vertices written. */
+static int r_gl_tile_baked_top(const struct tile *tile, const struct vertex *tile_vbuff, int r, int c,
+                               int tiles_per_chunk_x, int tiles_per_chunk_z, int top_mat_idx,
+                               struct vertex *out)
+{
+    struct vertex sw = tile_vbuff[(VERTS_PER_FACE * 5) + 0];
+    struct vertex se = tile_vbuff[(VERTS_PER_FACE * 5) + 1];
+    struct vertex nw = tile_vbuff[(VERTS_PER_FACE * 5) + 6];
+    struct vertex ne = tile_vbuff[(VERTS_PER_FACE * 5) + 7];
+
+    /* Patch the UV coordinates of the top face */
+    float u_frac = (1.0f / tiles_per_chunk_x);
+    float v_frac = (1.0f / tiles_per_chunk_z);
+
+    sw.material_idx = top_mat_idx;
+    se.material_idx = top_mat_idx;
+    nw.material_idx = top_mat_idx;
+    ne.material_idx = top_mat_idx;
+
+    sw.uv = (vec2_t){ c    * u_frac, (r+1) * v_frac};
+    se.uv = (vec2_t){(c+1) * u_frac, (r+1) * v_frac};
+    nw.uv = (vec2_t){ c    * u_frac, r     * v_frac};
+    ne.uv = (vec2_t){(c+1) * u_frac, r     * v_frac};
+
+    vec3_t top_tri_normals[2];
+    bool   top_tri_left_aligned;
+    r_gl_tile_top_normals(tile, top_tri_normals, &top_tri_left_aligned);
+
+    /*
+     * CONFIG 1 (left-aligned)   CONFIG 2
+     * (nw)      (ne)            (nw)      (ne)
+     * +---------+               +---------+
+     * |       / |               | \       |
+     * |     /   |               |   \     |
+     * |   /     |               |     \   |
+     * | /       |               |       \ |
+     * +---------+               +---------+
+     * (sw)      (se)            (sw)      (se)
+     */
+
+    out[0] = sw;
+    out[1] = se;
+    out[3] = nw;
+    out[4] = ne;
+
+    if(top_tri_left_aligned) {
+        out[2] = ne;
+        out[5] = sw;
+    }else {
+        out[2] = nw; 
+        out[5] = se;
+    }
+
+    for(int i = 0; i < 3; i++)
+        out[i].normal = top_tri_normals[0];
+
+    for(int i = 3; i < 6; i++)
+        out[i].normal = top_tri_normals[1];
+
+    return 6;
+}
+
+static bool r_gl_tile_flat(const struct tile *tile)
+{
+    int height = M_Tile_NWHeight(tile);
+    return (M_Tile_NEHeight(tile) == height)
+        && (M_Tile_SWHeight(tile) == height)
+        && (M_Tile_SEHeight(tile) == height);
+}
+
+/* The outermost ring of tiles is never merged, so that the vertices along the 
+ * chunk's edges exactly match those of the adjacent chunks, regardless of which 
+ * mesh they are drawn with. */
+static bool r_gl_tile_interior(int r, int c, int tiles_per_chunk_x, int tiles_per_chunk_z)
+{
+    return (r > 0 && r < tiles_per_chunk_z-1)
+        && (c > 0 && c < tiles_per_chunk_x-1);
+}
+
+/* Greedily grows a rectangle of flat interior tiles at the same height, starting at 
+ * (r, c) and extending first along the row, then down the columns. When 'match_mat'
+ * is set, the tiles must also share the same 'top_mat_idx'. The covered tiles are 
+ * flagged in 'merged'. The rectangle is written out as a single quad sampling the 
+ * baked texture. */
+static int r_gl_tile_greedy_top(const struct tile *tiles, int r, int c, int tiles_per_chunk_x, 
+                                int tiles_per_chunk_z, bool match_mat, int top_mat_idx, 
+                                bool *merged, struct vertex *out)
+{
+    const struct tile *first = &tiles[r * tiles_per_chunk_x + c];
+    int height = M_Tile_NWHeight(first);
+
+#define JOINS(_r, _c) \
+    (   r_gl_tile_interior((_r), (_c), tiles_per_chunk_x, tiles_per_chunk_z) \
+     && !merged[(_r) * tiles_per_chunk_x + (_c)] \
+     && r_gl_tile_flat(&tiles[(_r) * tiles_per_chunk_x + (_c)]) \
+     && M_Tile_NWHeight(&tiles[(_r) * tiles_per_chunk_x + (_c)]) == height \
+     && (!match_mat || tiles[(_r) * tiles_per_chunk_x + (_c)].top_mat_idx == first->top_mat_idx) )
+
+    int c_end = c;
+    while(c_end + 1 < tiles_per_chunk_x && JOINS(r, c_end + 1))
+        c_end++;
+
+    int r_end = r;
+    while(r_end + 1 < tiles_per_chunk_z) {
+
+        bool row_joins = true;
+        for(int i = c; i <= c_end; i++) {
+            if(!JOINS(r_end + 1, i)) {
+                row_joins = false;
+                break;
+            }
+        }
+        if(!row_joins)
+            break;
+        r_end++;
+    }
+
+#undef JOINS
+
+    for(int i = r; i <= r_end; i++) {
+        for(int j = c; j <= c_end; j++) {
+            merged[i * tiles_per_chunk_x + j] = true;
+        }
+    }
+
+    float u_frac = (1.0f / tiles_per_chunk_x);
+    float v_frac = (1.0f / tiles_per_chunk_z);
+    float y = height * Y_COORDS_PER_TILE;
+
+    struct vertex sw = (struct vertex) {
+        .pos    = (vec3_t) { 0.0f - (c * X_COORDS_PER_TILE), y, 0.0f + ((r_end+1) * Z_COORDS_PER_TILE) },
+        .uv     = (vec2_t) { c * u_frac, (r_end+1) * v_frac },
+        .normal = (vec3_t) { 0.0f, 1.0f, 0.0f },
+        .material_idx = top_mat_idx,
+    };
+    struct vertex se = (struct vertex) {
+        .pos    = (vec3_t) { 0.0f - ((c_end+1) * X_COORDS_PER_TILE), y, 0.0f + ((r_end+1) * Z_COORDS_PER_TILE) },
+        .uv     = (vec2_t) { (c_end+1) * u_frac, (r_end+1) * v_frac },
+        .normal = (vec3_t) { 0.0f, 1.0f, 0.0f },
+        .material_idx = top_mat_idx,
     };
-    PFM_Mat4x4_MakeTrans(-center.x, -center.y, -center.z, &trans);
-    PFM_Mat4x4_MakeTrans( center.x,  center.y,  center.z, &trans_inv);
+    struct vertex nw = (struct vertex) {
+        .pos    = (vec3_t) { 0.0f - (c * X_COORDS_PER_TILE), y, 0.0f + (r * Z_COORDS_PER_TILE) },
+        .uv     = (vec2_t) { c * u_frac, r * v_frac },
+        .normal = (vec3_t) { 0.0f, 1.0f, 0.0f },
+        .material_idx = top_mat_idx,
+    };
+    struct vertex ne = (struct vertex) {
+        .pos    = (vec3_t) { 0.0f - ((c_end+1) * X_COORDS_PER_TILE), y, 0.0f + (r * Z_COORDS_PER_TILE) },
+        .uv     = (vec2_t) { (c_end+1) * u_frac, r * v_frac },
+        .normal = (vec3_t) { 0.0f, 1.0f, 0.0f },
+        .material_idx = top_mat_idx,
+    };
+
+    /* Same winding as a left-aligned flat tile */
+    out[0] = sw;
+    out[1] = se;
+    out[2] = ne;
+    out[3] = nw;
+    out[4] = ne;
+    out[5] = sw;
+
+    return 6;
+}
+
+/* Merges a run of visible side faces with a common material and a level top edge 
+ * into a single quad, with the texture repeating once per tile. Front and back faces 
+ * run along the row, left and right faces along the column. */
+static int r_gl_tile_lod_side(const struct tile *tiles, int r, int c, int face, int tiles_per_chunk_x,
+                              int tiles_per_chunk_z, int *side_mats_set, int num_side_mats, 
+                              bool *merged, struct vertex *out)
+{
+    const int dr = (face == TILE_FACE_LEFT || face == TILE_FACE_RIGHT) ? 1 : 0;
+    const int dc = 1 - dr;
+
+    struct vertex first_vbuff[VERTS_PER_TILE], last_vbuff[VERTS_PER_TILE];
+    R_GL_TileGetVertices(&tiles[r * tiles_per_chunk_x + c], first_vbuff, r, c);
+    memcpy(last_vbuff, first_vbuff, sizeof(first_vbuff));
+
+    const struct vertex *first_face = first_vbuff + (VERTS_PER_FACE * face);
+    const float top_y = first_face[0].pos.y;
+    int len = 1;
+    merged[r * tiles_per_chunk_x + c] = true;
+
+    if(r_gl_tile_interior(r, c, tiles_per_chunk_x, tiles_per_chunk_z)
+    && first_face[1].pos.y == top_y) {
+
+        int nr = r + dr, nc = c + dc;
+        while(r_gl_tile_interior(nr, nc, tiles_per_chunk_x, tiles_per_chunk_z)
+           && r_gl_tile_face_visible(tiles, nr, nc, face)) {
+
+            const struct tile *next = &tiles[nr * tiles_per_chunk_x + nc];
+            if(next->sides_mat_idx != tiles[r * tiles_per_chunk_x + c].sides_mat_idx)
+                break;
+
+            struct vertex next_vbuff[VERTS_PER_TILE];
+            R_GL_TileGetVertices(next, next_vbuff, nr, nc);
+            const struct vertex *next_face = next_vbuff + (VERTS_PER_FACE * face);
+
+            if(next_face[0].pos.y != top_y || next_face[1].pos.y != top_y)
+                break;
+
+            memcpy(last_vbuff, next_vbuff, sizeof(next_vbuff));
+            merged[nr * tiles_per_chunk_x + nc] = true;
+            len++;
+            nr += dr; 
+            nc += dc;
+        }
+    }
+
+    /* The 'nw' and 'sw' vertices (0, 2, 4) lie on the edge of the face closest to the 
+     * first tile of the run, except for left faces, which are wound the other way. */
+    const struct vertex *start = (face == TILE_FACE_LEFT) ? last_vbuff : first_vbuff;
+    const struct vertex *end   = (face == TILE_FACE_LEFT) ? first_vbuff : last_vbuff;
+
+    for(int i = 0; i < VERTS_PER_FACE; i++) {
+        const struct vertex *src = (i % 2 == 0) ? start : end;
+        out[i] = src[VERTS_PER_FACE * face + i];
+        if(i % 2)
+            out[i].uv.x = len;
+        out[i].material_idx = arr_indexof(side_mats_set, num_side_mats, out[i].material_idx);
+        assert(out[i].material_idx >= 0);
+    }
+    return VERTS_PER_FACE;
+}
+
+/* Builds the full-resolution baked mesh: every tile's top face sampling the baked 
+ * texture, along with its visible side faces. Returns the number of vertices written. */
+static size_t r_gl_tile_build_baked(struct tile_bake *bake, bool *merged, struct vertex *out)
+{
+    const struct tile *tiles = bake->tiles;
+    const int tiles_per_chunk_x = bake->tiles_per_chunk_x;
+    const int tiles_per_chunk_z = bake->tiles_per_chunk_z;
+    const int top_mat_idx = bake->num_side_mats;
+    struct vertex *vbuff_curr = out;
+
+    for(int r = 0; r < tiles_per_chunk_z; r++) {
+        for(int c = 0; c < tiles_per_chunk_x; c++) {
+            
+            const struct tile *curr_tile = &tiles[r * tiles_per_chunk_x + c];
+
+            struct vertex curr_tile_vbuff[VERTS_PER_TILE];
+            R_GL_TileGetVertices(curr_tile, curr_tile_vbuff, r, c);
+
+            /* Order of faces for each tile in the vbuff_curr: bot, front, back, left, right, top.
+             * Recall that the top face has double the number of triangles and vertices. */
+
+            for(int face = TILE_FACE_FRONT; face <= TILE_FACE_RIGHT; face++) {
+
+                if(!r_gl_tile_face_visible(tiles, r, c, face))
+                    continue;
+
+                vbuff_curr += r_gl_tile_baked_side(curr_tile_vbuff, face, bake->side_mats_set, 
+                    bake->num_side_mats, vbuff_curr);
+            }
+
+            if(merged[r * tiles_per_chunk_x + c])
+                continue;
+
+            /* With greedy meshing, flat plateaus of a single material collapse into a 
+             * few large quads. As with the LOD mesh, the outer ring of tiles is left 
+             * alone so that the chunk edges still line up with the neighbours. */
+            if(CONFIG_TERRAIN_GREEDY_MESH
+            && r_gl_tile_interior(r, c, tiles_per_chunk_x, tiles_per_chunk_z) 
+            && r_gl_tile_flat(curr_tile)) {
+                vbuff_curr += r_gl_tile_greedy_top(tiles, r, c, tiles_per_chunk_x, tiles_per_chunk_z,
+                    true, top_mat_idx, merged, vbuff_curr);
+            }else{
+                vbuff_curr += r_gl_tile_baked_top(curr_tile, curr_tile_vbuff, r, c, 
+                    tiles_per_chunk_x, tiles_per_chunk_z, top_mat_idx, vbuff_curr);
+            }
+        }
+    }
 
-    PFM_Mat4x4_Mult4x4(&scale, &trans, &tmp1);
-    PFM_Mat4x4_Mult4x4(&trans_inv, &tmp1, &tmp2);
-    PFM_Mat4x4_Mult4x4(model, &tmp2, &final_model);
+    return vbuff_curr - out;
+}
+
+/* Builds a reduced mesh of the baked chunk for drawing it at a distance. Flat regions 
+ * are collapsed into larger quads and runs of side faces are merged. No vertex is moved 
+ * off the full-resolution surface, so the silhouette is unchanged. Returns the number
+ * of vertices written. */
+static size_t r_gl_tile_build_lod(struct tile_bake *bake, bool *merged, struct vertex *out)
+{
+    const struct tile *tiles = bake->tiles;
+    const int tiles_per_chunk_x = bake->tiles_per_chunk_x;
+    const int tiles_per_chunk_z = bake->tiles_per_chunk_z;
+    const int num_tiles = tiles_per_chunk_x * tiles_per_chunk_z;
+    const int top_mat_idx = bake->num_side_mats;
+    struct vertex *vbuff_curr = out;
 
-    /* OpenGL setup */
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    for(int r = 0; r < tiles_per_chunk_z; r++) {
+        for(int c = 0; c < tiles_per_chunk_x; c++) {
 
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            const struct tile *curr_tile = &tiles[r * tiles_per_chunk_x + c];
+            if(merged[r * tiles_per_chunk_x + c])
+                continue;
 
-    /* Attribute 0 - position */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), (void*)0);
-    glEnableVertexAttribArray(0);
+            if(r_gl_tile_interior(r, c, tiles_per_chunk_x, tiles_per_chunk_z) && r_gl_tile_flat(curr_tile)) {
+                vbuff_curr += r_gl_tile_greedy_top(tiles, r, c, tiles_per_chunk_x, tiles_per_chunk_z, 
+                    false, top_mat_idx, merged, vbuff_curr);
+                continue;
+            }
 
-    /* Attribute 1 - texture coordinates */
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, uv));
-    glEnableVertexAttribArray(1);
+            struct vertex curr_tile_vbuff[VERTS_PER_TILE];
+            R_GL_TileGetVertices(curr_tile, curr_tile_vbuff, r, c);
+            vbuff_curr += r_gl_tile_baked_top(curr_tile, curr_tile_vbuff, r, c, 
+                tiles_per_chunk_x, tiles_per_chunk_z, top_mat_idx, vbuff_curr);
+        }
+    }
+
+    for(int face = TILE_FACE_FRONT; face <= TILE_FACE_RIGHT; face++) {
+
+        memset(merged, 0, num_tiles * sizeof(bool));
+
+        for(int r = 0; r < tiles_per_chunk_z; r++) {
+            for(int c = 0; c < tiles_per_chunk_x; c++) {
+
+                if(merged[r * tiles_per_chunk_x + c])
+                    continue;
+                if(!r_gl_tile_face_visible(tiles, r, c, face))
+                    continue;
+
+                vbuff_curr += r_gl_tile_lod_side(tiles, r, c, face, tiles_per_chunk_x, tiles_per_chunk_z,
+                    bake->side_mats_set, bake->num_side_mats, merged, vbuff_curr);
+            }
+        }
+    }
+
+    return vbuff_curr - out;
+}
+
+/* Creates a render context for one of the baked meshes. The side materials are taken 
+ * from the original chunk and the last material slot holds the baked top texture. */
+static struct render_private *r_gl_tile_baked_priv(const struct tile_bake *bake, 
+                                                   const struct vertex *vbuff, size_t num_verts)
+{
+    const int top_mat_idx = bake->num_side_mats;
+
+    /*
+     * Recall: render private buff layout:
+     *
+     *  +---------------------------------+ <-- base
+     *  | struct render_private[1]        |
+     *  +---------------------------------+
+     *  | struct material[num_materials]  |
+     *  +---------------------------------+
+     */
 
-    /* Attribute 2 - normal */
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct vertex), 
-        (void*)offsetof(struct vertex, normal));
-    glEnableVertexAttribArray(2);
+    struct render_private *ret = MEM_Malloc(MEM_TAG_RENDER, sizeof(struct render_private)
+                                      + (bake->num_side_mats + 1) * sizeof(struct material));
+    if(!ret)
+        return NULL;
+
+    ret->mesh.num_verts = num_verts;
+    ret->materials = (void*)(ret + 1);
+    ret->num_materials = bake->num_side_mats + 1;
+    ret->material_base = -1;
+    ret->num_lods = 0;
+    ret->lods = NULL;
+    ret->impostor = NULL;
+
+    for(int i = 0; i < bake->num_side_mats; i++) {
+        ret->materials[i] = bake->og_priv->materials[bake->side_mats_set[i]];
+        ret->materials[i].texture.tunit = GL_TEXTURE0 + i;
+    }
+
+    memset(&ret->materials[top_mat_idx], 0, sizeof(struct material));
+    ret->materials[top_mat_idx].texture.id = bake->rendered_tex;
+    ret->materials[top_mat_idx].texture.tunit = GL_TEXTURE0 + top_mat_idx;
+
+    R_GL_Init(ret, "terrain-baked", vbuff);
+    return ret;
+}
+
+/* Renders the chunk from straight above into a new texture, written to 'out_tex' */
+static bool r_gl_tile_render_top(const struct render_private *og_priv, vec3_t chunk_center, mat4x4_t *model,
+                                 int tiles_per_chunk_x, int tiles_per_chunk_z, GLuint *out_tex)
+{
+    glUseProgram(og_priv->shader_prog);
+
+    /* Create a new camera, with orthographic projection, centered 
+     * over the chunk and facing straight down. */
+    DECL_CAMERA_STACK(chunk_cam);
+    memset(&chunk_cam, 0, g_sizeof_camera);
+
+    vec3_t offset = (vec3_t){0.0f, 200.0f, 0.0f};
+    PFM_Vec3_Add(&chunk_center, &offset, &chunk_center);
+
+    Camera_SetPos((struct camera*)chunk_cam, chunk_center);
+    Camera_SetPitchAndYaw((struct camera*)chunk_cam, -90.0f, 90.0f);
+
+    vec2_t bot_left  = (vec2_t){-(X_COORDS_PER_TILE * tiles_per_chunk_x/2),  (Z_COORDS_PER_TILE * tiles_per_chunk_z/2)};
+    vec2_t top_right = (vec2_t){ (X_COORDS_PER_TILE * tiles_per_chunk_x/2), -(Z_COORDS_PER_TILE * tiles_per_chunk_z/2)};
+    Camera_TickFinishOrthographic((struct camera*)chunk_cam, bot_left, top_right);
+
+    /* Next, create a new framebuffer and texture that we will render our chunk 
+     * top-down view to. */
+    GLuint fb;
+    glGenFramebuffers(1, &fb);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+
+    glGenTextures(1, out_tex);
+
+    glBindTexture(GL_TEXTURE_2D, *out_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_x, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_z, 
+        0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, *out_tex, 0);
+
+    GLenum draw_buffers[1] = {GL_COLOR_ATTACHMENT0};
+    glDrawBuffers(1, draw_buffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        goto fail_fb;
 
-    shader_prog = R_Shader_GetProgForName("mesh.static.tile-outline");
-    glUseProgram(shader_prog);
+    /* The bake may be done in the middle of a frame, so put back the viewport 
+     * that the rest of the frame is using. */
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
 
-    /* Set uniforms */
-    loc = glGetUniformLocation(shader_prog, GL_U_MODEL);
-    glUniformMatrix4fv(loc, 1, GL_FALSE, final_model.raw);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb);
+    glViewport(0,0, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_x, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_z);
 
-    loc = glGetUniformLocation(shader_prog, GL_U_COLOR);
-    glUniform3fv(loc, 1, red.raw);
+    /* Render the chunk top-down view to the texture. */
+    R_GL_Draw(og_priv, model);
 
-    /* buffer & render */
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vbuff), vbuff, GL_STATIC_DRAW);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, VERTS_PER_TILE);
+    /* Re-bind the default framebuffer when we're done rendering */
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fb);
+    return true;
 
-cleanup:
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+fail_fb:
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fb);
+    glDeleteTextures(1, out_tex); 
+    return false;
 }
 
-void R_GL_TilePatchVertsBlend(GLuint VBO, const struct tile *tiles, int width, int height, int r, int c)
+/* Computes the adjacency information of the tile at (r, c): the materials
+ * surrounding the corners and edges of its' top face, which its' vertices 
+ * are blended between */
+static void r_gl_tile_blend(const struct tile *tiles, int width, int height, int r, int c,
+                            struct tile_hf_desc *out)
 {
     const struct tile *curr_tile  = &tiles[r * width + c];
     const struct tile *top_tile   = (r > 0)          ? &tiles[(r - 1) * width + c] : NULL;
@@ -512,12 +936,7 @@ void R_GL_TilePatchVertsBlend(GLuint VBO, const struct tile *tiles, int width, i
                                            : INDICES_MASK_8(curr.left_center_idx, left.right_center_idx);
     }
 
-    /* Now, update all 4 triangles of the top face 
-     *
-     * Since 'adjacent_mat_indices' is a flat attribute, we only need to set 
-     * it for the provoking vertex of each triangle.
-     *
-     * The first two 'adjacency_mat_indices' elements hold the 8 surrounding materials for 
+    /* The first two 'adjacency_mat_indices' elements hold the 8 surrounding materials for 
      * the triangle's two non-central vertices. If the vertex is surrounded by only
      * 2 different materials, for example, then the weighting of each of these 
      * materials at the vertex is determened by the number of occurences of the 
@@ -527,52 +946,149 @@ void R_GL_TilePatchVertsBlend(GLuint VBO, const struct tile *tiles, int width, i
      * The next element holds the materials at the midpoints of the edges of this tile and 
      * the last one holds the materials for the middle_mask of the tile.
      */
-    size_t offset = VERTS_PER_TILE * (r * width + c) * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-
-    struct vertex *tile_verts_base = glMapNamedBufferRange(VBO, offset, length, GL_MAP_WRITE_BIT);
-    assert(tile_verts_base);
-    struct vertex *south_provoking = tile_verts_base + (5 * VERTS_PER_FACE);
-    struct vertex *north_provoking = tile_verts_base + (5 * VERTS_PER_FACE) + 2*3;
-    struct vertex *west_provoking  = tile_verts_base + (5 * VERTS_PER_FACE) + (top_tri_left_aligned ?  3*3 : 3*1);
-    struct vertex *east_provoking  = tile_verts_base + (5 * VERTS_PER_FACE) + (top_tri_left_aligned ?  3*1 : 3*3);
+    out->left_aligned = top_tri_left_aligned;
 
-    south_provoking->adjacent_mat_indices[0] = 
+    out->south_adj[0] = 
         INDICES_MASK_32(bot.top_left_mask, bot_left.top_right_mask, left.bot_right_mask, curr.bot_left_mask);
-    south_provoking->adjacent_mat_indices[1] = 
+    out->south_adj[1] = 
         INDICES_MASK_32(bot_right.top_left_mask, bot.top_right_mask, curr.bot_right_mask, right.bot_left_mask);
-    south_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(south_provoking);
 
-    north_provoking->adjacent_mat_indices[0] = 
+    out->north_adj[0] = 
         INDICES_MASK_32(curr.top_left_mask, left.top_right_mask, top_left.bot_right_mask, top.bot_left_mask);
-    north_provoking->adjacent_mat_indices[1] = 
+    out->north_adj[1] = 
         INDICES_MASK_32(right.top_left_mask, curr.top_right_mask, top.bot_right_mask, top_right.bot_left_mask);
-    north_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(north_provoking);
-
-    west_provoking->adjacent_mat_indices[0] = south_provoking->adjacent_mat_indices[0];
-    west_provoking->adjacent_mat_indices[1] = north_provoking->adjacent_mat_indices[0];
-    west_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(west_provoking);
-
-    east_provoking->adjacent_mat_indices[0] = south_provoking->adjacent_mat_indices[1];
-    east_provoking->adjacent_mat_indices[1] = north_provoking->adjacent_mat_indices[1];
-    east_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(east_provoking);
 
-    GLint adj_center_mask = INDICES_MASK_32(
+    out->center_mask = INDICES_MASK_32(
         INDICES_MASK_8(curr.top_center_idx,     top.bot_center_idx),
         INDICES_MASK_8(curr.right_center_idx,   right.left_center_idx),
         INDICES_MASK_8(curr.bot_center_idx,     bot.top_center_idx),
         INDICES_MASK_8(curr.left_center_idx,    left.right_center_idx)
     );
+    out->middle_mask = curr.middle_mask;
+}
 
-    struct vertex *provoking[] = {south_provoking, north_provoking, west_provoking, east_provoking};
+/* Writes the adjacency information of the tile at (r, c) to its' vertices, 
+ * which start at 'tile_verts_base' */
+static void r_gl_tile_patch_blend(struct terrain_vert *tile_verts_base, const struct tile *tiles, 
+                                  int width, int height, int r, int c)
+{
+    struct tile_hf_desc blend;
+    r_gl_tile_blend(tiles, width, height, r, c, &blend);
+
+    /* Now, update all 4 triangles of the top face. Since 'adjacent_mat_indices' 
+     * is a flat attribute, we only need to set it for the provoking vertex of 
+     * each triangle. */
+    struct terrain_vert *south_provoking = tile_verts_base + (5 * VERTS_PER_FACE);
+    struct terrain_vert *north_provoking = tile_verts_base + (5 * VERTS_PER_FACE) + 2*3;
+    struct terrain_vert *west_provoking  = tile_verts_base + (5 * VERTS_PER_FACE) + (blend.left_aligned ?  3*3 : 3*1);
+    struct terrain_vert *east_provoking  = tile_verts_base + (5 * VERTS_PER_FACE) + (blend.left_aligned ?  3*1 : 3*3);
+
+    south_provoking->adjacent_mat_indices[0] = blend.south_adj[0];
+    south_provoking->adjacent_mat_indices[1] = blend.south_adj[1];
+    south_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(south_provoking);
+
+    north_provoking->adjacent_mat_indices[0] = blend.north_adj[0];
+    north_provoking->adjacent_mat_indices[1] = blend.north_adj[1];
+    north_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(north_provoking);
+
+    west_provoking->adjacent_mat_indices[0] = blend.south_adj[0];
+    west_provoking->adjacent_mat_indices[1] = blend.north_adj[0];
+    west_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(west_provoking);
+
+    east_provoking->adjacent_mat_indices[0] = blend.south_adj[1];
+    east_provoking->adjacent_mat_indices[1] = blend.north_adj[1];
+    east_provoking->blend_mode = r_gl_blendmode_for_provoking_vert(east_provoking);
+
+    struct terrain_vert *provoking[] = {south_provoking, north_provoking, west_provoking, east_provoking};
     for(int i = 0; i < ARR_SIZE(provoking); i++) {
 
-        provoking[i]->adjacent_mat_indices[2] = adj_center_mask;
-        provoking[i]->adjacent_mat_indices[3] = curr.middle_mask;
+        provoking[i]->adjacent_mat_indices[2] = blend.center_mask;
+        provoking[i]->adjacent_mat_indices[3] = blend.middle_mask;
     }
+}
+
+/* Rebuilds the vertices of the tiles in the rectangle and the ring of tiles 
+ * around them, whose blending depends on the rebuilt tiles. The bounds are 
+ * inclusive. Every tile that is written is generated from scratch, so the 
+ * buffer never has to be read back. */
+static void r_gl_tile_update_region(GLuint VBO, const struct tile *tiles, int width, int height,
+                                    int r_min, int c_min, int r_max, int c_max)
+{
+    int patch_r_min = MAX(r_min - 1, 0);
+    int patch_c_min = MAX(c_min - 1, 0);
+    int patch_r_max = MIN(r_max + 1, height - 1);
+    int patch_c_max = MIN(c_max + 1, width - 1);
+
+    /* Tiles are stored in row-major order, so each row of the rectangle is 
+     * a contiguous range of the buffer */
+    size_t row_len = patch_c_max - patch_c_min + 1;
+    size_t length = VERTS_PER_TILE * row_len * sizeof(struct terrain_vert);
+
+    for(int r = patch_r_min; r <= patch_r_max; r++) {
 
-    glFlushMappedNamedBufferRange(VBO, offset, length);
-    glUnmapNamedBuffer(VBO);
+        size_t first = r * width + patch_c_min;
+        size_t offset = VERTS_PER_TILE * first * sizeof(struct terrain_vert);
+
+        struct terrain_vert *verts_base = glMapNamedBufferRange(VBO, offset, length, 
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        assert(verts_base);
+
+        for(int c = patch_c_min; c <= patch_c_max; c++) {
+
+            struct terrain_vert *tile_verts = verts_base + VERTS_PER_TILE * (c - patch_c_min);
+            struct vertex vbuff[VERTS_PER_TILE];
+
+            R_GL_TileGetVertices(&tiles[r * width + c], vbuff, r, c);
+            R_Vert_Pack(VERT_LAYOUT_TERRAIN, vbuff, tile_verts, VERTS_PER_TILE);
+            r_gl_tile_patch_blend(tile_verts, tiles, width, height, r, c);
+        }
+
+        glUnmapNamedBuffer(VBO);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_GL_TileBuildVerts(const struct tile *tiles, int width, int height, void *out)
+{
+    struct terrain_vert *verts_base = out;
+
+    for(int r = 0; r < height; r++) {
+        for(int c = 0; c < width; c++) {
+
+            struct vertex vbuff[VERTS_PER_TILE];
+            R_GL_TileGetVertices(&tiles[r * width + c], vbuff, r, c);
+            R_Vert_Pack(VERT_LAYOUT_TERRAIN, vbuff, 
+                verts_base + VERTS_PER_TILE * (r * width + c), VERTS_PER_TILE);
+        }
+    }
+
+    /* All the tiles must be in place before any of them can be blended */
+    for(int r = 0; r < height; r++) {
+        for(int c = 0; c < width; c++) {
+
+            r_gl_tile_patch_blend(verts_base + VERTS_PER_TILE * (r * width + c), 
+                tiles, width, height, r, c);
+        }
+    }
+}
+
+void R_GL_TileGetHeightfield(const struct tile *tiles, int width, int height, int r, int c,
+                             struct tile_hf_desc *out)
+{
+    const struct tile *tile = &tiles[r * width + c];
+    r_gl_tile_blend(tiles, width, height, r, c, out);
+
+    out->heights[0] = M_Tile_NWHeight(tile) * 2;
+    out->heights[1] = M_Tile_NEHeight(tile) * 2;
+    out->heights[2] = M_Tile_SEHeight(tile) * 2;
+    out->heights[3] = M_Tile_SWHeight(tile) * 2;
+    out->heights[4] = TILETYPE_IS_RAMP(tile->type)          ? (tile->base_height * 2 + tile->ramp_height)
+                    : TILETYPE_IS_CORNER_CONVEX(tile->type) ? (tile->base_height + tile->ramp_height) * 2
+                    : (tile->base_height * 2);
+    out->sides_mat_idx = tile->sides_mat_idx;
 }
 
 void R_GL_TileGetVertices(const struct tile *tile, struct vertex *out, size_t r, size_t c)
@@ -879,20 +1395,17 @@ void R_GL_TileGetVertices(const struct tile *tile, struct vertex *out, size_t r,
 
 }
 
-int R_GL_TileGetTriMesh(const struct tile_desc *in, const void *chunk_rprivate, 
+int R_GL_TileGetTriMesh(const struct tile_desc *in, const struct tile *tiles, 
                         mat4x4_t *model, int tiles_per_chunk_x, vec3_t out[])
 {
-    const struct render_private *priv = chunk_rprivate;
-
-    size_t offset = (in->tile_r * tiles_per_chunk_x + in->tile_c) * VERTS_PER_TILE * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-    const struct vertex *vert_base = glMapNamedBufferRange(priv->mesh.VBO, offset, length, GL_MAP_READ_BIT);
-    assert(vert_base);
+    struct vertex vbuff[VERTS_PER_TILE];
+    R_GL_TileGetVertices(&tiles[in->tile_r * tiles_per_chunk_x + in->tile_c], vbuff, 
+        in->tile_r, in->tile_c);
     int i = 0;
 
     for(; i < VERTS_PER_TILE; i++) {
     
-        vec4_t pos_homo = (vec4_t){vert_base[i].pos.x, vert_base[i].pos.y, vert_base[i].pos.z, 1.0f};
+        vec4_t pos_homo = (vec4_t){vbuff[i].pos.x, vbuff[i].pos.y, vbuff[i].pos.z, 1.0f};
         vec4_t ws_pos_homo;
         PFM_Mat4x4_Mult4x1(model, &pos_homo, &ws_pos_homo);
         
@@ -903,43 +1416,65 @@ int R_GL_TileGetTriMesh(const struct tile_desc *in, const void *chunk_rprivate,
         };
     }
 
-    glUnmapNamedBuffer(priv->mesh.VBO);
     assert(i % 3 == 0);
     return i;
 }
 
 void R_GL_TileUpdate(void *chunk_rprivate, int r, int c, int tiles_width, int tiles_height, 
                      const struct tile *tiles)
+{
+    R_GL_TileUpdateRegion(chunk_rprivate, r, c, r, c, tiles_width, tiles_height, tiles);
+}
+
+void R_GL_TileUpdateRegion(void *chunk_rprivate, int r_min, int c_min, int r_max, int c_max,
+                           int tiles_width, int tiles_height, const struct tile *tiles)
 {
     struct render_private *priv = chunk_rprivate;
-    const struct tile *tile = &tiles[r * tiles_width + c];
+    assert(priv->mesh.layout == VERT_LAYOUT_TERRAIN);
+    assert(r_min >= 0 && r_max < tiles_height && r_min <= r_max);
+    assert(c_min >= 0 && c_max < tiles_width  && c_min <= c_max);
 
-    size_t offset = (r * tiles_width + c) * VERTS_PER_TILE * sizeof(struct vertex);
-    size_t length = VERTS_PER_TILE * sizeof(struct vertex);
-    struct vertex *vert_base = glMapNamedBufferRange(priv->mesh.VBO, offset, length, GL_MAP_WRITE_BIT);
-    assert(vert_base);
-    
-    R_GL_TileGetVertices(tile, vert_base, r, c);
+    R_Thread_Claim();
+    r_gl_tile_update_region(priv->mesh.VBO, tiles, tiles_width, tiles_height, 
+        r_min, c_min, r_max, c_max);
+}
 
-    glFlushMappedNamedBufferRange(priv->mesh.VBO, offset, length);
-    glUnmapNamedBuffer(priv->mesh.VBO);
+uint64_t R_GL_TileBakeKey(uint64_t seed, const void *chunk_rprivate_tiles, const struct tile *tiles,
+                          int tiles_per_chunk_x, int tiles_per_chunk_z, const mat4x4_t *model)
+{
+    const struct render_private *priv = chunk_rprivate_tiles;
+    const int dims[3] = {CONFIG_BAKED_TILE_TEX_RES, tiles_per_chunk_x, tiles_per_chunk_z};
 
-    for(int r_curr = r - 1; r_curr < r + 2; r_curr++){
-        for(int c_curr = c - 1; c_curr < c + 2; c_curr++) {
-        
-            if(r_curr < 0 || r_curr >= tiles_height)
-                continue;
-            if(c_curr < 0 || c_curr >= tiles_width)
-                continue;
+    uint64_t hash = R_BakeCache_Hash(seed, dims, sizeof(dims));
+    hash = R_BakeCache_Hash(hash, model->raw, sizeof(model->raw));
+    hash = R_GL_HashLighting(hash);
 
-            R_GL_TilePatchVertsBlend(priv->mesh.VBO, tiles, tiles_width, tiles_height, r_curr, c_curr);
-        }
+    /* Hash field by field - the padding bytes of the structs are undefined */
+    for(int i = 0; i < tiles_per_chunk_x * tiles_per_chunk_z; i++) {
+    
+        const struct tile *tile = &tiles[i];
+        const int fields[5] = {
+            tile->type, tile->base_height, tile->ramp_height, 
+            tile->top_mat_idx, tile->sides_mat_idx
+        };
+        hash = R_BakeCache_Hash(hash, fields, sizeof(fields));
+    }
+
+    for(size_t i = 0; i < priv->num_materials; i++) {
+    
+        const struct material *mat = &priv->materials[i];
+        hash = R_BakeCache_Hash(hash, mat->texname, strlen(mat->texname));
+        hash = R_BakeCache_Hash(hash, &mat->ambient_intensity, sizeof(mat->ambient_intensity));
+        hash = R_BakeCache_Hash(hash, mat->diffuse_clr.raw, sizeof(mat->diffuse_clr.raw));
+        hash = R_BakeCache_Hash(hash, mat->specular_clr.raw, sizeof(mat->specular_clr.raw));
     }
+
+    return hash;
 }
 
-void *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
+void *R_GL_TileBakeBegin(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
                          int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
-                         int chunk_r, int chunk_c)
+                         int chunk_r, int chunk_c, const char *cache_path)
 {
     /* Note that we already include the phong lighting information in the pre-baked chunk. This
      * means that the pre-baked terrain cannot change lighting in real-time. It is possible 
@@ -949,243 +1484,156 @@ void *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center,
      * entire top surface.*/
 
     const struct render_private *og_priv = chunk_rprivate_tiles;
-    glUseProgram(og_priv->shader_prog);
-
-    /* Create a new camera, with orthographic projection, centered 
-     * over the chunk and facing straight down. */
-    DECL_CAMERA_STACK(chunk_cam);
-    memset(&chunk_cam, 0, g_sizeof_camera);
-
-    vec3_t offset = (vec3_t){0.0f, 200.0f, 0.0f};
-    PFM_Vec3_Add(&chunk_center, &offset, &chunk_center);
-
-    Camera_SetPos((struct camera*)chunk_cam, chunk_center);
-    Camera_SetPitchAndYaw((struct camera*)chunk_cam, -90.0f, 90.0f);
-
-    vec2_t bot_left  = (vec2_t){-(X_COORDS_PER_TILE * tiles_per_chunk_x/2),  (Z_COORDS_PER_TILE * tiles_per_chunk_z/2)};
-    vec2_t top_right = (vec2_t){ (X_COORDS_PER_TILE * tiles_per_chunk_x/2), -(Z_COORDS_PER_TILE * tiles_per_chunk_z/2)};
-    Camera_TickFinishOrthographic((struct camera*)chunk_cam, bot_left, top_right);
-
-    /* Next, create a new framebuffer and texture that we will render our chunk 
-     * top-down view to. */
-    GLuint fb;
-    glGenFramebuffers(1, &fb);
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-
-    GLuint rendered_tex;
-    glGenTextures(1, &rendered_tex);
-
-    glBindTexture(GL_TEXTURE_2D, rendered_tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_x, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_z, 
-        0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rendered_tex, 0);
-
-    GLenum draw_buffers[1] = {GL_COLOR_ATTACHMENT0};
-    glDrawBuffers(1, draw_buffers);
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        goto fail_fb;
-
-    glBindFramebuffer(GL_FRAMEBUFFER, fb);
-    glViewport(0,0, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_x, CONFIG_BAKED_TILE_TEX_RES * tiles_per_chunk_x);
-
-    /* Render the chunk top-down view to the texture. */
-    R_GL_Draw(chunk_rprivate_tiles, model);
-
-    /* Re-bind the default framebuffer when we're done rendering */
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDeleteFramebuffers(1, &fb);
-
-    /* Now construct our new 'fast' render context. We have some unused memory at the 
-     * end of the buffer but this is not a concern. */
-    size_t max_buff_sz = sizeof(struct render_private)
-                       + MATERIALS_PER_CHUNK * sizeof(struct material);
-    struct render_private *ret = malloc(max_buff_sz);
-    if(!ret)
-        goto fail_alloc_ret;
-
-    /*
-     * Recall: render private buff layout:
-     *
-     *  +---------------------------------+ <-- base
-     *  | struct render_private[1]        |
-     *  +---------------------------------+
-     *  | struct material[num_materials]  |
-     *  +---------------------------------+
-     */
-
-    struct vertex *vbuff = malloc(og_priv->mesh.num_verts * sizeof(struct vertex));
-    if(!vbuff)
-        goto fail_alloc_vbuff;
-    struct vertex *vbuff_curr = vbuff;
+    const int num_tiles = tiles_per_chunk_x * tiles_per_chunk_z;
+
+    /* Everything the bake needs lives until the end of the frame. Neither mesh 
+     * can have more vertices than the original chunk. The LOD mesh is only an 
+     * optimization - the chunk is still drawable without it. */
+    struct mem_arena *arena = MEM_FrameArena();
+    struct tile_bake *bake = arena_calloc(arena, 1, sizeof(struct tile_bake));
+    if(!bake)
+        goto fail_alloc_bake;
+
+    bake->vbuff = arena_alloc(arena, num_tiles * VERTS_PER_TILE * sizeof(struct vertex));
+    bake->merged = arena_alloc(arena, num_tiles * sizeof(bool));
+    if(!bake->vbuff || !bake->merged)
+        goto fail_alloc_bake;
+    bake->lod_vbuff = arena_alloc(arena, num_tiles * VERTS_PER_TILE * sizeof(struct vertex));
+
+    bake->og_priv = og_priv;
+    bake->tiles = tiles;
+    bake->tiles_per_chunk_x = tiles_per_chunk_x;
+    bake->tiles_per_chunk_z = tiles_per_chunk_z;
+    bake->chunk_r = chunk_r;
+    bake->chunk_c = chunk_c;
 
     /* First pass over the tiles - figure out which materials we need to keep */
-    int side_mats_set[MATERIALS_PER_CHUNK];
-    int num_side_mats = 0;
-
     for(int r = 0; r < tiles_per_chunk_z; r++) {
         for(int c = 0; c < tiles_per_chunk_x; c++) {
 
             const struct tile *curr_tile = &tiles[r * tiles_per_chunk_x + c];    
 
-            if(!arr_contains(side_mats_set, num_side_mats, curr_tile->sides_mat_idx)) {
-                side_mats_set[num_side_mats++] = curr_tile->sides_mat_idx;
+            if(!arr_contains(bake->side_mats_set, bake->num_side_mats, curr_tile->sides_mat_idx)) {
+                bake->side_mats_set[bake->num_side_mats++] = curr_tile->sides_mat_idx;
 
                 /* We need at least one free material slot for the baked top face texture. */
-                if(num_side_mats > (MATERIALS_PER_CHUNK-1))
+                if(bake->num_side_mats > (MATERIALS_PER_CHUNK-1))
                     goto fail_side_mats_count;
             }
         }
     }
 
-    int top_mat_idx = num_side_mats;
-    assert(top_mat_idx >= 0 && top_mat_idx < MATERIALS_PER_CHUNK);
-
-    /* Second pass over the tiles - fill the vbuff_curr and patch UV coordinates */
-    int num_verts = 0;
+    R_Thread_Claim();
 
-    for(int r = 0; r < tiles_per_chunk_z; r++) {
-        for(int c = 0; c < tiles_per_chunk_x; c++) {
-            
-            const struct tile *curr_tile = &tiles[r * tiles_per_chunk_x + c];
+    uint64_t key = 0;
+    if(cache_path) {
+        key = R_GL_TileBakeKey(BAKE_CACHE_HASH_INIT, chunk_rprivate_tiles, tiles, 
+            tiles_per_chunk_x, tiles_per_chunk_z, model);
+        if(R_BakeCache_Load(cache_path, key, GL_NEAREST, false, &bake->rendered_tex))
+            return bake;
+    }
 
-            struct vertex curr_tile_vbuff[VERTS_PER_TILE];
-            R_GL_TileGetVertices(curr_tile, curr_tile_vbuff, r, c);
+    /* The materials' images must be in place before they are baked in */
+    R_Texture_FinishLoads();
+
+    /* The bake may be done while a frame is being recorded, but it has to be 
+     * rendered before the texture is used */
+    R_Thread_BeginImmediate();
+    bool rendered = r_gl_tile_render_top(og_priv, chunk_center, model, tiles_per_chunk_x, 
+        tiles_per_chunk_z, &bake->rendered_tex);
+    R_Thread_EndImmediate();
+    if(!rendered)
+        goto fail_render;
+
+    /* A distant chunk only samples the smaller levels, and the compressed 
+     * texture is a sixth of the size of the uncompressed one. Keep the 
+     * uncompressed texture if compressing fails. */
+    R_BakeCache_Mipmap(bake->rendered_tex, GL_NEAREST);
+    if(R_BakeCache_Supported()
+    && R_BakeCache_Compress(&bake->rendered_tex, GL_NEAREST) && cache_path) {
+        R_BakeCache_Store(cache_path, key, bake->rendered_tex);
+    }
 
-            /* Order of faces for each tile in the vbuff_curr: bot, front, back, left, right, top.
-             * Recall that the top face has double the number of triangles and vertices. */
+    return bake;
 
-            if(M_Tile_FrontFaceVisible(tiles, r, c)) {
-                memcpy(vbuff_curr, curr_tile_vbuff + (VERTS_PER_FACE * 1), sizeof(struct vertex) * VERTS_PER_FACE); 
-                for(int i = 0; i < VERTS_PER_FACE; i++) {
-                    vbuff_curr[i].material_idx = arr_indexof(side_mats_set, num_side_mats, vbuff_curr[i].material_idx);
-                    assert(vbuff_curr[i].material_idx >= 0);
-                }
-                num_verts += VERTS_PER_FACE; 
-                vbuff_curr += VERTS_PER_FACE;
-            }
+fail_render:
+fail_side_mats_count:
+fail_alloc_bake:
+    return NULL;
+}
 
-            if(M_Tile_BackFaceVisible(tiles, r, c)) {
-                memcpy(vbuff_curr, curr_tile_vbuff + (VERTS_PER_FACE * 2), sizeof(struct vertex) * VERTS_PER_FACE); 
-                for(int i = 0; i < VERTS_PER_FACE; i++) {
-                    vbuff_curr[i].material_idx = arr_indexof(side_mats_set, num_side_mats, vbuff_curr[i].material_idx);
-                    assert(vbuff_curr[i].material_idx >= 0);
-                }
-                num_verts += VERTS_PER_FACE; 
-                vbuff_curr += VERTS_PER_FACE;
-            }
+bool R_GL_TileBakeBuild(void *bake_ctx)
+{
+    struct tile_bake *bake = bake_ctx;
+    const int num_tiles = bake->tiles_per_chunk_x * bake->tiles_per_chunk_z;
 
-            if(M_Tile_LeftFaceVisible(tiles, r, c)) {
-                memcpy(vbuff_curr, curr_tile_vbuff + (VERTS_PER_FACE * 3), sizeof(struct vertex) * VERTS_PER_FACE); 
-                for(int i = 0; i < VERTS_PER_FACE; i++) {
-                    vbuff_curr[i].material_idx = arr_indexof(side_mats_set, num_side_mats, vbuff_curr[i].material_idx);
-                    assert(vbuff_curr[i].material_idx >= 0);
-                }
-                num_verts += VERTS_PER_FACE; 
-                vbuff_curr += VERTS_PER_FACE;
-            }
+    memset(bake->merged, 0, num_tiles * sizeof(bool));
+    bake->num_verts = r_gl_tile_build_baked(bake, bake->merged, bake->vbuff);
 
-            if(M_Tile_RightFaceVisible(tiles, r, c)) {
-                memcpy(vbuff_curr, curr_tile_vbuff + (VERTS_PER_FACE * 4), sizeof(struct vertex) * VERTS_PER_FACE); 
-                for(int i = 0; i < VERTS_PER_FACE; i++) {
-                    vbuff_curr[i].material_idx = arr_indexof(side_mats_set, num_side_mats, vbuff_curr[i].material_idx);
-                    assert(vbuff_curr[i].material_idx >= 0);
-                }
-                num_verts += VERTS_PER_FACE; 
-                vbuff_curr += VERTS_PER_FACE;
-            }
+    if(bake->lod_vbuff) {
+        memset(bake->merged, 0, num_tiles * sizeof(bool));
+        bake->lod_num_verts = r_gl_tile_build_lod(bake, bake->merged, bake->lod_vbuff);
+    }
+    return true;
+}
 
-            struct vertex sw = curr_tile_vbuff[(VERTS_PER_FACE * 5) + 0];
-            struct vertex se = curr_tile_vbuff[(VERTS_PER_FACE * 5) + 1];
-            struct vertex nw = curr_tile_vbuff[(VERTS_PER_FACE * 5) + 6];
-            struct vertex ne = curr_tile_vbuff[(VERTS_PER_FACE * 5) + 7];
-
-            /* Patch the UV coordinates of the top face */
-            float u_frac = (1.0f / tiles_per_chunk_x);
-            float v_frac = (1.0f / tiles_per_chunk_z);
-
-            sw.material_idx = top_mat_idx;
-            se.material_idx = top_mat_idx;
-            nw.material_idx = top_mat_idx;
-            ne.material_idx = top_mat_idx;
-
-            sw.uv = (vec2_t){ c    * u_frac, (r+1) * v_frac};
-            se.uv = (vec2_t){(c+1) * u_frac, (r+1) * v_frac};
-            nw.uv = (vec2_t){ c    * u_frac, r     * v_frac};
-            ne.uv = (vec2_t){(c+1) * u_frac, r     * v_frac};
-
-            vec3_t top_tri_normals[2];
-            bool   top_tri_left_aligned;
-            r_gl_tile_top_normals(curr_tile, top_tri_normals, &top_tri_left_aligned);
-
-            /*
-             * CONFIG 1 (left-aligned)   CONFIG 2
-             * (nw)      (ne)            (nw)      (ne)
-             * +---------+               +---------+
-             * |       / |               | \       |
-             * |     /   |               |   \     |
-             * |   /     |               |     \   |
-             * | /       |               |       \ |
-             * +---------+               +---------+
-             * (sw)      (se)            (sw)      (se)
-             */
-
-            vbuff_curr[0] = sw;
-            vbuff_curr[1] = se;
-            vbuff_curr[3] = nw;
-            vbuff_curr[4] = ne;
-
-            if(top_tri_left_aligned) {
-                vbuff_curr[2] = ne;
-                vbuff_curr[5] = sw;
-            }else {
-                vbuff_curr[2] = nw; 
-                vbuff_curr[5] = se;
-            }
+void *R_GL_TileBakeFinish(void *bake_ctx, void **out_lod)
+{
+    struct tile_bake *bake = bake_ctx;
+    struct render_private *ret = NULL;
+    *out_lod = NULL;
+    R_Thread_Claim();
 
-            for(int i = 0; i < 3; i++)
-                vbuff_curr[i].normal = top_tri_normals[0];
+    ret = r_gl_tile_baked_priv(bake, bake->vbuff, bake->num_verts);
+    if(!ret)
+        goto done;
 
-            for(int i = 3; i < 6; i++)
-                vbuff_curr[i].normal = top_tri_normals[1];
+    char texname[32];
+    snprintf(texname, sizeof(texname), "__baked_chunk__.%d.%d", bake->chunk_r, bake->chunk_c);
+    texname[sizeof(texname)-1] = '\0';
+    R_Texture_AddExisting(texname, bake->rendered_tex);
+    R_Texture_SetGPUSize(bake->rendered_tex, R_BakeCache_GPUSize(bake->rendered_tex));
 
-            num_verts += 6;
-            vbuff_curr += 6;
-        }
-    }
+    if(bake->lod_vbuff)
+        *out_lod = r_gl_tile_baked_priv(bake, bake->lod_vbuff, bake->lod_num_verts);
 
-    ret->mesh.num_verts = num_verts;
-    ret->materials = (void*)(ret + 1);
-    ret->num_materials = num_side_mats + 1;
+done:
+    if(!ret)
+        glDeleteTextures(1, &bake->rendered_tex); 
+    return ret;
+}
 
-    for(int i = 0; i < num_side_mats; i++) {
-        ret->materials[i] = og_priv->materials[side_mats_set[i]];
-        ret->materials[i].texture.tunit = GL_TEXTURE0 + i;
-    }
+void R_GL_TileBakeFree(void *baked, void *lod, int chunk_r, int chunk_c)
+{
+    R_Thread_Claim();
 
+    /* The side materials are copies of the chunk's own and hold no references 
+     * of their own - only the baked texture belongs to the contexts */
     char texname[32];
     snprintf(texname, sizeof(texname), "__baked_chunk__.%d.%d", chunk_r, chunk_c);
     texname[sizeof(texname)-1] = '\0';
-    R_Texture_AddExisting(texname, rendered_tex);
+    R_Texture_Free(texname);
 
-    ret->materials[top_mat_idx].texture.id = rendered_tex;
-    ret->materials[top_mat_idx].texture.tunit = GL_TEXTURE0 + top_mat_idx;
+    if(lod) {
+        R_GL_Free(lod);
+        MEM_Free(lod);
+    }
+    R_GL_Free(baked);
+    MEM_Free(baked);
+}
 
-    glDeleteFramebuffers(1, &fb);
-    R_GL_Init(ret, "terrain-baked", vbuff);
-    free(vbuff);
-    return ret;
+void *R_GL_TileBakeChunk(const void *chunk_rprivate_tiles, vec3_t chunk_center, mat4x4_t *model,
+                         int tiles_per_chunk_x, int tiles_per_chunk_z, const struct tile *tiles,
+                         int chunk_r, int chunk_c, void **out_lod)
+{
+    *out_lod = NULL;
 
-fail_side_mats_count:
-    free(vbuff);
-fail_alloc_vbuff:
-    free(ret);
-fail_alloc_ret:
-    glDeleteTextures(1, &rendered_tex); 
-fail_fb:
-    return NULL;
+    void *bake = R_GL_TileBakeBegin(chunk_rprivate_tiles, chunk_center, model, 
+        tiles_per_chunk_x, tiles_per_chunk_z, tiles, chunk_r, chunk_c, NULL);
+    if(!bake)
+        return NULL;
+
+    R_GL_TileBakeBuild(bake);
+    return R_GL_TileBakeFinish(bake, out_lod);
 }
 
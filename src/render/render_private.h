@@ -37,12 +37,51 @@
 #define RENDER_PRIVATE_H
 
 #include "mesh.h"
+#include "material.h"
+#include "../collision.h"
+
+#include <SDL.h>
+
+struct render_lod;
+struct impostor;
 
 struct render_private{
-    struct mesh      mesh;
-    size_t           num_materials;
-    struct material *materials;
-    GLuint           shader_prog;
+    struct mesh        mesh;
+    size_t             num_materials;
+    struct material   *materials;
+    GLuint             shader_prog;
+    /* Variant of 'shader_prog' taking the model matrix as an instance attribute */
+    GLuint             instanced_shader_prog;
+    /* The index of the first material in the material table, or -1 if the 
+     * materials are set as uniforms of the program instead */
+    int                material_base;
+    /* Coarser versions of the mesh, from the most to the least detailed. 
+     * They share the materials of the mesh and have no levels of their own. */
+    size_t             num_lods;
+    struct render_lod *lods;
+    /* Drawn in place of the coarsest level once it covers very little of the
+     * screen, or NULL */
+    struct impostor   *impostor;
+};
+
+struct render_lod{
+    /* The level is used once the object's projected size falls below this
+     * fraction of the viewport's height */
+    float                 screen_size;
+    struct render_private priv;
+};
+
+/* The mesh rendered from a number of directions around its' vertical axis, 
+ * drawn as a billboard showing the view closest to the camera's. It is only
+ * baked once there are no more textures waiting to be uploaded. */
+struct impostor{
+    struct render_private        priv;
+    /* The atlas of views is the material's texture */
+    struct material              material;
+    /* The mesh the views are rendered from */
+    const struct render_private *source;
+    struct aabb                  bounds;
+    SDL_atomic_t                 baked;
 };
 
 #endif
@@ -0,0 +1,252 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "public/render.h"
+#include "render_gl.h"
+#include "render_private.h"
+#include "material.h"
+#include "shader.h"
+#include "render_queue_key.h"
+#include "../config.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <GL/glew.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+struct render_cmd{
+    uint64_t                     key;
+    const struct render_private *priv;
+    mat4x4_t                     model;
+    /* The object's pose in the joint palette, for skinned meshes */
+    struct pose_ref              pose;
+    /* The first of its' pre-skinned vertices, or -1 if it's skinned here */
+    GLint                        preskin;
+};
+
+/* The sorted commands of a flush follow right after */
+struct flush_args{
+    size_t count;
+};
+
+/* The GL state last set by the queue, for skipping redundant changes */
+struct queue_state{
+    GLuint                 prog;
+    const struct material *materials;
+    GLuint                 VAO;
+    /* The texture arrays bound for the objects with their' materials in the
+     * material table */
+    GLuint                 pages[SHADER_MAX_TEXTURE_PAGES];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static vec3_t                     s_view_pos;
+static kvec_t(struct render_cmd)  s_cmds;
+/* Scratch buffers for the per-instance attributes of an instanced run */
+static kvec_t(mat4x4_t)           s_models;
+static kvec_t(struct pose_ref)    s_poses;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static uint16_t rq_depth(const mat4x4_t *model)
+{
+    vec3_t pos = (vec3_t){model->cols[3][0], model->cols[3][1], model->cols[3][2]};
+    vec3_t delta;
+    PFM_Vec3_Sub(&pos, &s_view_pos, &delta);
+
+    float norm = PFM_Vec3_Len(&delta) / CONFIG_DRAWDIST;
+    norm = norm < 0.0f ? 0.0f : norm > 1.0f ? 1.0f : norm;
+    return (uint16_t)(norm * UINT16_MAX);
+}
+
+static uint64_t rq_key(enum render_pass pass, const struct render_private *priv, uint16_t depth)
+{
+    GLuint tex = priv->num_materials ? priv->materials[0].texture.id : 0;
+    return R_Queue_Key(pass, pass == RENDER_PASS_TRANSLUCENT, priv->shader_prog, 
+                       tex, priv->mesh.VAO, depth);
+}
+
+static int rq_compare_cmds(const void *a, const void *b)
+{
+    uint64_t ka = ((const struct render_cmd*)a)->key;
+    uint64_t kb = ((const struct render_cmd*)b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static void rq_bind(struct queue_state *state, const struct render_private *priv, 
+                    GLuint prog, GLuint VAO)
+{
+    if(state->prog != prog) {
+        glUseProgram(prog);
+        R_GL_StatsProgramBind();
+        state->prog = prog;
+        state->materials = NULL;
+    }
+
+    /* Objects whose textures are in the same arrays only differ by where 
+     * their' materials are in the table */
+    if(state->materials != priv->materials) {
+        if(priv->material_base >= 0)
+            R_GL_MaterialsBind(priv, prog, state->pages);
+        else
+            R_GL_SetMaterials(priv, prog);
+        state->materials = priv->materials;
+    }
+
+    if(state->VAO != VAO) {
+        glBindVertexArray(VAO);
+        state->VAO = VAO;
+    }
+}
+
+static void rq_flush_exec(const void *arg)
+{
+    const struct flush_args *args = arg;
+    const struct render_cmd *cmds = (const struct render_cmd*)(args + 1);
+
+    /* Immediate draws may have changed the state since the last flush */
+    struct queue_state state = {0};
+    R_GL_AnimPaletteSync();
+
+    for(int begin = 0, end; begin < args->count; begin = end) {
+
+        const struct render_private *priv = cmds[begin].priv;
+        bool preskinned = (cmds[begin].preskin >= 0);
+        for(end = begin + 1; end < args->count && cmds[end].priv == priv
+            && (cmds[end].preskin >= 0) == preskinned; end++)
+            ;
+
+        /* Every entity has vertices of its' own, so they are drawn one by one
+         * with the program of the static layout */
+        if(preskinned) {
+
+            GLuint prog = R_Shader_GetProgForName("mesh.static.textured-phong");
+            rq_bind(&state, priv, prog, R_GL_PreskinVAO());
+            GLint loc = R_Shader_UniformLoc(prog, SU_MODEL);
+
+            for(int i = begin; i < end; i++) {
+                glUniformMatrix4fv(loc, 1, GL_FALSE, cmds[i].model.raw);
+                R_GL_PreskinDraw(priv, cmds[i].preskin);
+            }
+            continue;
+        }
+
+        if(priv->mesh.instance_VBO && end - begin > 1) {
+
+            kv_reset(s_models);
+            kv_reset(s_poses);
+            for(int i = begin; i < end; i++) {
+                kv_push(mat4x4_t, s_models, cmds[i].model);
+                kv_push(struct pose_ref, s_poses, cmds[i].pose);
+            }
+
+            rq_bind(&state, priv, priv->instanced_shader_prog, priv->mesh.VAO);
+            R_GL_UploadInstances(priv, s_models.a, s_poses.a, kv_size(s_models));
+            R_GL_DrawMesh(&priv->mesh, end - begin);
+            continue;
+        }
+
+        rq_bind(&state, priv, priv->shader_prog, priv->mesh.VAO);
+        GLint loc = R_Shader_UniformLoc(priv->shader_prog, SU_MODEL);
+        bool skinned = (priv->mesh.layout == VERT_LAYOUT_SKINNED);
+
+        for(int i = begin; i < end; i++) {
+            glUniformMatrix4fv(loc, 1, GL_FALSE, cmds[i].model.raw);
+            if(skinned)
+                R_GL_SetPoseUniforms(priv->shader_prog, &cmds[i].pose);
+            R_GL_DrawMesh(&priv->mesh, 1);
+        }
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void R_Queue_Begin(vec3_t view_pos)
+{
+    s_view_pos = view_pos;
+    kv_reset(s_cmds);
+}
+
+void R_Queue_Submit(enum render_pass pass, const void *render_private, const mat4x4_t *model)
+{
+    assert(pass >= 0 && pass < RENDER_PASS_COUNT);
+    const struct render_private *priv = render_private;
+    struct pose_ref pose = R_GL_AnimPose();
+
+    struct render_cmd cmd = (struct render_cmd){
+        .key = rq_key(pass, priv, rq_depth(model)),
+        .priv = priv,
+        .model = *model,
+        .pose = pose,
+        .preskin = R_GL_PreskinAdd(priv, &pose),
+    };
+    kv_push(struct render_cmd, s_cmds, cmd);
+}
+
+void R_Queue_Flush(void)
+{
+    qsort(s_cmds.a, kv_size(s_cmds), sizeof(struct render_cmd), rq_compare_cmds);
+
+    size_t size = sizeof(struct flush_args) + kv_size(s_cmds) * sizeof(struct render_cmd);
+    struct flush_args *args = arena_alloc(MEM_FrameArena(), size);
+    if(args) {
+        args->count = kv_size(s_cmds);
+        memcpy(args + 1, s_cmds.a, kv_size(s_cmds) * sizeof(struct render_cmd));
+        R_Thread_Push(rq_flush_exec, args, size);
+    }
+
+    kv_reset(s_cmds);
+}
+
+void R_Queue_Shutdown(void)
+{
+    kv_destroy(s_cmds);
+    kv_destroy(s_models);
+    kv_destroy(s_poses);
+}
+
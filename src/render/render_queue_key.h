@@ -0,0 +1,75 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef RENDER_QUEUE_KEY_H
+#define RENDER_QUEUE_KEY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Sort key layout, from the most significant bit:
+ *     pass (4) | shader (8) | textures (16) | VAO (20) | depth (16)
+ * For translucent objects, the top 8 bits of the inverted depth take the 
+ * place of the shader field so that they are drawn back-to-front, coarsely 
+ * ahead of the texture and VAO and exactly within each of them. The GL names 
+ * are truncated to fit - collisions only make the grouping less effective, 
+ * since the actual state is compared when the commands are executed. The
+ * texture is the first material's, which for packed textures is the array
+ * they are in, so that the objects sharing arrays are drawn together. */
+#define KEY_PASS_SHIFT      (60)
+#define KEY_SHADER_SHIFT    (52)
+#define KEY_TEXTURE_SHIFT   (36)
+#define KEY_VAO_SHIFT       (16)
+#define KEY_DEPTH_SHIFT     (0)
+
+#define KEY_FIELD(val, bits, shift) ((((uint64_t)(val)) & ((1ull << (bits)) - 1)) << (shift))
+
+static inline uint64_t R_Queue_Key(unsigned pass, bool translucent, uint32_t shader, 
+                                   uint32_t tex, uint32_t VAO, uint16_t depth)
+{
+    uint64_t ret = KEY_FIELD(pass, 4, KEY_PASS_SHIFT)
+                 | KEY_FIELD(tex, 16, KEY_TEXTURE_SHIFT)
+                 | KEY_FIELD(VAO, 20, KEY_VAO_SHIFT);
+
+    if(translucent)
+        return ret | KEY_FIELD((UINT16_MAX - depth) >> 8, 8, KEY_SHADER_SHIFT) 
+                   | KEY_FIELD(UINT16_MAX - depth, 16, KEY_DEPTH_SHIFT);
+
+    return ret | KEY_FIELD(shader, 8, KEY_SHADER_SHIFT) 
+               | KEY_FIELD(depth, 16, KEY_DEPTH_SHIFT);
+}
+
+#endif
+
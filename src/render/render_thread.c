@@ -0,0 +1,275 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "public/render.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/mem_arena.h"
+
+#include <SDL.h>
+
+#include <string.h>
+#include <assert.h>
+
+#define CMD_ARENA_BLOCK     (256 * 1024)
+
+struct frame_cmd{
+    void      (*func)(const void *arg);
+    const void *arg;
+};
+
+/* The commands of a single frame, along with the copies of their arguments */
+struct frame{
+    kvec_t(struct frame_cmd) cmds;
+    struct mem_arena         args;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static SDL_Window    *s_window;
+static SDL_GLContext  s_context;
+static SDL_Thread    *s_thread;
+static SDL_threadID   s_main_tid;
+static SDL_threadID   s_render_tid;
+
+/* The main thread records a frame into one of these while the render thread
+ * draws the other. The two never touch the same one at the same time: the
+ * recording only starts once the last frame has been drawn. */
+static struct frame   s_frames[2];
+static int            s_record_idx;
+static bool           s_recording;
+/* The nesting depth of 'R_Thread_BeginImmediate' */
+static int            s_immediate;
+
+/* Protects 's_busy' and 's_quit' */
+static SDL_mutex     *s_lock;
+static SDL_cond      *s_cond;
+static bool           s_busy;
+static bool           s_quit;
+/* Only accessed by the main thread */
+static bool           s_main_current;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void rt_frame_exec(struct frame *frame)
+{
+    for(int i = 0; i < kv_size(frame->cmds); i++)
+        kv_A(frame->cmds, i).func(kv_A(frame->cmds, i).arg);
+
+    kv_reset(frame->cmds);
+    arena_reset(&frame->args);
+}
+
+static int rt_thread_func(void *unused)
+{
+    SDL_LockMutex(s_lock);
+    while(true) {
+
+        while(!s_busy && !s_quit)
+            SDL_CondWait(s_cond, s_lock);
+        if(s_quit)
+            break;
+        SDL_UnlockMutex(s_lock);
+
+        SDL_GL_MakeCurrent(s_window, s_context);
+        rt_frame_exec(&s_frames[!s_record_idx]);
+        SDL_GL_MakeCurrent(s_window, NULL);
+
+        SDL_LockMutex(s_lock);
+        s_busy = false;
+        SDL_CondBroadcast(s_cond);
+    }
+    SDL_UnlockMutex(s_lock);
+    return 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool R_Thread_Start(SDL_Window *window, void *context)
+{
+    assert(!s_thread);
+
+    s_window = window;
+    s_context = context;
+    s_main_tid = SDL_ThreadID();
+
+    for(int i = 0; i < 2; i++) {
+        kv_init(s_frames[i].cmds);
+        arena_init(&s_frames[i].args, CMD_ARENA_BLOCK);
+    }
+
+    if(!(s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(!(s_cond = SDL_CreateCond()))
+        goto fail_cond;
+
+    s_busy = false;
+    s_quit = false;
+    s_recording = false;
+
+    /* The context can only be current on one thread at a time */
+    SDL_GL_MakeCurrent(window, NULL);
+    s_main_current = false;
+
+    if(!(s_thread = SDL_CreateThread(rt_thread_func, "render", NULL)))
+        goto fail_thread;
+    s_render_tid = SDL_GetThreadID(s_thread);
+
+    return true;
+
+fail_thread:
+    SDL_GL_MakeCurrent(window, context);
+    SDL_DestroyCond(s_cond);
+fail_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    for(int i = 0; i < 2; i++) {
+        kv_destroy(s_frames[i].cmds);
+        arena_destroy(&s_frames[i].args);
+    }
+    return false;
+}
+
+void R_Thread_Stop(void)
+{
+    if(!s_thread)
+        return;
+
+    SDL_LockMutex(s_lock);
+    while(s_busy)
+        SDL_CondWait(s_cond, s_lock);
+    s_quit = true;
+    SDL_CondBroadcast(s_cond);
+    SDL_UnlockMutex(s_lock);
+
+    SDL_WaitThread(s_thread, NULL);
+    s_thread = NULL;
+
+    if(!s_main_current)
+        SDL_GL_MakeCurrent(s_window, s_context);
+
+    SDL_DestroyCond(s_cond);
+    SDL_DestroyMutex(s_lock);
+    for(int i = 0; i < 2; i++) {
+        kv_destroy(s_frames[i].cmds);
+        arena_destroy(&s_frames[i].args);
+    }
+}
+
+void R_Thread_Claim(void)
+{
+    if(!s_thread || SDL_ThreadID() == s_render_tid)
+        return;
+    assert(SDL_ThreadID() == s_main_tid);
+
+    SDL_LockMutex(s_lock);
+    while(s_busy)
+        SDL_CondWait(s_cond, s_lock);
+    SDL_UnlockMutex(s_lock);
+
+    if(!s_main_current) {
+        SDL_GL_MakeCurrent(s_window, s_context);
+        s_main_current = true;
+    }
+}
+
+bool R_Thread_Recording(void)
+{
+    return s_recording && !s_immediate && SDL_ThreadID() == s_main_tid;
+}
+
+void R_Thread_BeginImmediate(void)
+{
+    R_Thread_Claim();
+    s_immediate++;
+}
+
+void R_Thread_EndImmediate(void)
+{
+    assert(s_immediate > 0);
+    s_immediate--;
+}
+
+void R_Thread_BeginFrame(void)
+{
+    R_Thread_Claim();
+    s_recording = (s_thread != NULL);
+}
+
+void R_Thread_Push(void (*func)(const void *arg), const void *arg, size_t size)
+{
+    if(!R_Thread_Recording()) {
+        R_Thread_Claim();
+        func(arg);
+        return;
+    }
+
+    struct frame *frame = &s_frames[s_record_idx];
+    void *copy = NULL;
+
+    if(size) {
+        copy = arena_alloc(&frame->args, size);
+        if(!copy)
+            return;
+        memcpy(copy, arg, size);
+    }
+    kv_push(struct frame_cmd, frame->cmds, ((struct frame_cmd){func, copy}));
+}
+
+void R_Thread_SubmitFrame(void)
+{
+    if(!s_thread)
+        return;
+    assert(s_recording);
+
+    if(s_main_current) {
+        SDL_GL_MakeCurrent(s_window, NULL);
+        s_main_current = false;
+    }
+
+    SDL_LockMutex(s_lock);
+    assert(!s_busy);
+    s_record_idx = !s_record_idx;
+    s_recording = false;
+    s_busy = true;
+    SDL_CondBroadcast(s_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
@@ -34,9 +34,14 @@
  */
 
 #include "shader.h"
+#include "gl_uniforms.h"
+#include "../hot_reload.h"
+#include "../config.h"
+#include "../lib/public/file_replace.h"
 
 #include <SDL.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
@@ -51,6 +56,22 @@
         strcat(buff, file);         \
     }while(0)
 
+#define SHADER_CACHE_FILE    "shaders/programs.cache"
+#define SHADER_CACHE_MAGIC   (0x43534650) /* 'PFSC' */
+#define SHADER_CACHE_VERSION (1)
+#define FNV_OFFSET_BASIS     (0xcbf29ce484222325ull)
+#define FNV_PRIME            (0x100000001b3ull)
+
+
+/* The number of stages a program may have */
+#define SHADER_STAGES        (4)
+
+/* The sources of the vertex, geometry, fragment and compute stages of a 
+ * program, read from disk for hot reloading. Compute programs have no other 
+ * stages, and the geometry stage may be NULL for the rest. */
+struct shader_src{
+    char *text[SHADER_STAGES];
+};
 
 struct shader_resource{
     GLint       prog_id;
@@ -58,12 +79,70 @@ struct shader_resource{
     const char *vertex_path;
     const char *geo_path;
     const char *frag_path;
+    /* Programs with a compute stage are only made when the context is 
+     * OpenGL 4.3 or later, and are otherwise left as 0 */
+    const char *comp_path;
+    /* Lines added to the start of every stage, after the '#version' line, to
+     * specialize the shared sources into a variant of their' program. A 
+     * variant is otherwise a program like any other, with its' own name and
+     * its' own entry in the binary cache. May be NULL. */
+    const char *defines;
+    /* The outputs of the last stage that are captured with transform 
+     * feedback, interleaved into a single buffer. NULL-terminated, or NULL 
+     * for programs that aren't drawn with it. */
+    const char *const *varyings;
+    /* Filled in once the program is linked */
+    GLint       uniforms[SU_COUNT];
+    GLint       materials[SHADER_MAX_MATERIALS][MU_COUNT];
+};
+
+/* The layout of the program binary cache file:
+ *
+ *  +---------------------------+
+ *  | struct shader_cache_hdr   |
+ *  +---------------------------+
+ *  | struct shader_cache_entry | <-- repeated 'num_entries' times
+ *  | binary ('size' bytes)     |
+ *  +---------------------------+
+ *
+ * A binary can only be loaded by the driver that produced it, so the whole
+ * file is discarded when the vendor, renderer or version strings change. 
+ * Each entry is matched to its' program by name and is only used when the
+ * program's sources hash to the same value as when the binary was saved.
+ */
+struct shader_cache_hdr{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t driver_hash;
+    uint32_t num_entries;
+    uint32_t pad;
+};
+
+struct shader_cache_entry{
+    uint64_t name_hash;
+    uint64_t src_hash;
+    uint32_t format;
+    uint32_t size;
+};
+
+/* The binary of a linked program, either read from the cache file or
+ * retrieved from the driver */
+struct shader_binary{
+    uint64_t src_hash;
+    GLenum   format;
+    GLsizei  size;
+    void    *data;
 };
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
+/* The layout of 'struct preskinned_vert' */
+static const char *const s_preskin_varyings[] = {
+    "out_pos", "out_uv", "out_normal", "out_material_idx", NULL
+};
+
 /* Shader 'prog_id' will be initialized by R_Shader_InitAll */
 static struct shader_resource s_shaders[] = {
     {
@@ -80,6 +159,13 @@ static struct shader_resource s_shaders[] = {
         .geo_path    = NULL,
         .frag_path   = "shaders/fragment_textured.glsl"
     },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.textured-array",
+        .vertex_path = "shaders/vertex_static.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_textured-array.glsl"
+    },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "mesh.static.textured-phong",
@@ -89,10 +175,24 @@ static struct shader_resource s_shaders[] = {
     },
     {
         .prog_id     = (intptr_t)NULL,
-        .name        = "mesh.static.tile-outline",
-        .vertex_path = "shaders/vertex_static.glsl",
+        .name        = "mesh.static.textured-phong.instanced",
+        .vertex_path = "shaders/vertex_static_instanced.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_textured-phong.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.impostor",
+        .vertex_path = "shaders/vertex_impostor.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_impostor.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.impostor.instanced",
+        .vertex_path = "shaders/vertex_impostor_instanced.glsl",
         .geo_path    = NULL,
-        .frag_path   = "shaders/fragment_tile-outline.glsl"
+        .frag_path   = "shaders/fragment_impostor.glsl"
     },
     {
         .prog_id     = (intptr_t)NULL,
@@ -101,6 +201,22 @@ static struct shader_resource s_shaders[] = {
         .geo_path    = NULL,
         .frag_path   = "shaders/fragment_textured-phong.glsl"
     },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.textured-phong.instanced",
+        .vertex_path = "shaders/vertex_skinned_instanced.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_textured-phong.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.preskin",
+        .vertex_path = "shaders/vertex_skinned.glsl",
+        .geo_path    = NULL,
+        .frag_path   = NULL,
+        .defines     = "#define PRESKIN\n",
+        .varyings    = s_preskin_varyings
+    },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "mesh.static.normals.colored",
@@ -115,6 +231,20 @@ static struct shader_resource s_shaders[] = {
         .geo_path    = "shaders/geometry_normals.glsl",
         .frag_path   = "shaders/fragment_colored.glsl"
     },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.static.id",
+        .vertex_path = "shaders/vertex_static.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_colored.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "mesh.animated.id",
+        .vertex_path = "shaders/vertex_skinned.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_colored.glsl"
+    },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "terrain",
@@ -122,6 +252,64 @@ static struct shader_resource s_shaders[] = {
         .geo_path    = NULL,
         .frag_path   = "shaders/fragment_terrain.glsl"
     },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.array",
+        .vertex_path = "shaders/vertex_terrain.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-array.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.array.noblend",
+        .vertex_path = "shaders/vertex_terrain.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-array.glsl",
+        .defines     = "#define NO_BLEND\n"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.splat",
+        .vertex_path = "shaders/vertex_terrain.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-splat.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.depth",
+        .vertex_path = "shaders/vertex_terrain.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_depth.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.heightfield",
+        .vertex_path = "shaders/vertex_terrain-heightfield.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-array.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.heightfield.noblend",
+        .vertex_path = "shaders/vertex_terrain-heightfield.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-array.glsl",
+        .defines     = "#define NO_BLEND\n"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.heightfield.splat",
+        .vertex_path = "shaders/vertex_terrain-heightfield.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_terrain-splat.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "terrain.heightfield.depth",
+        .vertex_path = "shaders/vertex_terrain-heightfield.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_depth.glsl"
+    },
     {
         .prog_id     = (intptr_t)NULL,
         .name        = "terrain-baked",
@@ -135,9 +323,106 @@ static struct shader_resource s_shaders[] = {
         .vertex_path = "shaders/vertex_colored.glsl",
         .geo_path    = NULL,
         .frag_path   = "shaders/fragment_colored-per-vert.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "fog.composite",
+        .vertex_path = "shaders/vertex_fullscreen.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_fog.glsl"
+    },
+    {
+        .prog_id     = (intptr_t)NULL,
+        .name        = "overlay",
+        .vertex_path = "shaders/vertex_overlay.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_overlay.glsl"
+    },
+    {
+        .name        = "effect",
+        .vertex_path = "shaders/vertex_effect.glsl",
+        .geo_path    = NULL,
+        .frag_path   = "shaders/fragment_effect.glsl"
+    },
+    {
+        .name        = "cull.hiz",
+        .comp_path   = "shaders/compute_hiz.glsl"
+    },
+    {
+        .name        = "cull.instances",
+        .comp_path   = "shaders/compute_cull.glsl"
     }
 };
 
+/* The directory that the shader paths are relative to */
+static char s_base_path[512];
+
+/* Only used while the programs are being initialized */
+static bool                 s_cache_enabled;
+static struct shader_binary s_binaries[ARR_SIZE(s_shaders)];
+
+static const GLenum s_stage_types[SHADER_STAGES] = {
+    GL_VERTEX_SHADER, 
+    GL_GEOMETRY_SHADER, 
+    GL_FRAGMENT_SHADER,
+    GL_COMPUTE_SHADER
+};
+
+static const char *s_uniform_names[SU_COUNT] = {
+    [SU_MODEL]              = GL_U_MODEL,
+    [SU_COLOR]              = GL_U_COLOR,
+    [SU_ANIM_PALETTE]       = GL_U_ANIM_PALETTE,
+    [SU_ANIM_PALETTE_BASES] = GL_U_ANIM_PALETTE_BASES,
+    [SU_ANIM_PALETTE_BLEND] = GL_U_ANIM_PALETTE_BLEND,
+    [SU_ANIM_BAKED]         = GL_U_ANIM_BAKED,
+    [SU_ANIM_PALETTE_BAKED] = GL_U_ANIM_PALETTE_BAKED,
+    [SU_TEXTURE0 + 0]       = GL_U_TEXTURE0,
+    [SU_TEXTURE0 + 1]       = GL_U_TEXTURE1,
+    [SU_TEXTURE0 + 2]       = GL_U_TEXTURE2,
+    [SU_TEXTURE0 + 3]       = GL_U_TEXTURE3,
+    [SU_TEXTURE0 + 4]       = GL_U_TEXTURE4,
+    [SU_TEXTURE0 + 5]       = GL_U_TEXTURE5,
+    [SU_TEXTURE0 + 6]       = GL_U_TEXTURE6,
+    [SU_TEXTURE0 + 7]       = GL_U_TEXTURE7,
+    [SU_TEXTURE0 + 8]       = GL_U_TEXTURE8,
+    [SU_TEXTURE0 + 9]       = GL_U_TEXTURE9,
+    [SU_TEXTURE0 + 10]      = GL_U_TEXTURE10,
+    [SU_TEXTURE0 + 11]      = GL_U_TEXTURE11,
+    [SU_TEXTURE0 + 12]      = GL_U_TEXTURE12,
+    [SU_TEXTURE0 + 13]      = GL_U_TEXTURE13,
+    [SU_TEXTURE0 + 14]      = GL_U_TEXTURE14,
+    [SU_TEXTURE0 + 15]      = GL_U_TEXTURE15,
+    [SU_SKIP_LIGHTING]      = GL_U_SKIP_LIGHTING,
+    [SU_TEXTURE_ARRAY]      = GL_U_TEXTURE_ARRAY,
+    [SU_SPLAT_WEIGHTS]      = GL_U_SPLAT_WEIGHTS,
+    [SU_SPLAT_MATS]         = GL_U_SPLAT_MATS,
+    [SU_SPLAT_ORIGIN]       = GL_U_SPLAT_ORIGIN,
+    [SU_SPLAT_GRID]         = GL_U_SPLAT_GRID,
+    [SU_FOG_RECT]           = GL_U_FOG_RECT,
+    [SU_UV_SCALE]           = GL_U_UV_SCALE,
+    [SU_VIEWPORT_SIZE]      = GL_U_VIEWPORT_SIZE,
+    [SU_FOG_ENABLED]        = GL_U_FOG_ENABLED,
+    [SU_SHADOWS_ENABLED]    = GL_U_SHADOWS_ENABLED,
+    [SU_LIGHT_VIEW_PROJ]    = GL_U_LIGHT_VIEW_PROJ,
+    [SU_CURR_TIME]          = GL_U_CURR_TIME,
+    [SU_EFFECT_STYLE]       = GL_U_EFFECT_STYLE,
+    [SU_MATERIAL_BASE]      = GL_U_MATERIAL_BASE,
+    [SU_NUM_INSTANCES]      = GL_U_NUM_INSTANCES,
+    [SU_LOD_SCALE]          = GL_U_LOD_SCALE,
+    [SU_IMPOSTOR_SIZE]      = GL_U_IMPOSTOR_SIZE,
+    [SU_HIZ_ENABLED]        = GL_U_HIZ_ENABLED,
+    [SU_SRC_SIZE]           = GL_U_SRC_SIZE,
+    [SU_FIRST_LEVEL]        = GL_U_FIRST_LEVEL,
+    [SU_HEIGHTFIELD]        = GL_U_HEIGHTFIELD,
+    [SU_CHUNKS_WIDE]        = GL_U_CHUNKS_WIDE,
+};
+
+static const char *s_material_member_names[MU_COUNT] = {
+    [MU_AMBIENT_INTENSITY]  = "ambient_intensity",
+    [MU_DIFFUSE_CLR]        = "diffuse_clr",
+    [MU_SPECULAR_CLR]       = "specular_clr",
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -177,6 +462,31 @@ const char *shader_text_load(const char *path)
     return ret;
 }
 
+/* Returns a new string with the defines inserted on the line following the 
+ * '#version' directive, which must come before anything but comments. The 
+ * line numbers in the compiler's messages are then off by the number of lines
+ * of defines. The text is returned as it is when it has no such directive. */
+static char *shader_add_defines(char *text, const char *defines)
+{
+    char *version = strstr(text, "#version");
+    char *line_end = version ? strchr(version, '\n') : NULL;
+    if(!line_end)
+        return text;
+
+    size_t prefix_len = line_end - text + 1;
+    char *ret = malloc(strlen(text) + strlen(defines) + 1);
+    if(!ret)
+        return NULL;
+
+    memcpy(ret, text, prefix_len);
+    ret[prefix_len] = '\0';
+    strcat(ret, defines);
+    strcat(ret, text + prefix_len);
+
+    free(text);
+    return ret;
+}
+
 static bool shader_init(const char *text, GLuint *out, GLint type)
 {
     char info[512];
@@ -197,40 +507,158 @@ static bool shader_init(const char *text, GLuint *out, GLint type)
     return true;
 }
 
-static bool shader_load_and_init(const char *path, GLint *out, GLint type)
+static void shader_src_free(void *data)
 {
-    const char *text = shader_text_load(path);
-    if(!text) {
-        fprintf(stderr, "Could not load shader at: %s\n", path);
-        goto fail;
+    struct shader_src *src = data;
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        free(src->text[i]);
     }
-    
-    if(!shader_init(text, out, type)){
-        fprintf(stderr, "Could not compile shader at: %s\n", path);
-        goto fail;
+    free(src);
+}
+
+static struct shader_src *shader_src_load(const struct shader_resource *res)
+{
+    const char *paths[SHADER_STAGES] = {res->vertex_path, res->geo_path, res->frag_path, res->comp_path};
+
+    struct shader_src *src = calloc(1, sizeof(struct shader_src));
+    if(!src)
+        return NULL;
+
+    for(int i = 0; i < SHADER_STAGES; i++) {
+
+        if(!paths[i])
+            continue;
+
+        char full_path[512];
+        MAKE_PATH(full_path, s_base_path, paths[i]);
+        src->text[i] = (char*)shader_text_load(full_path);
+        if(src->text[i] && res->defines) {
+            char *specialized = shader_add_defines(src->text[i], res->defines);
+            if(!specialized)
+                free(src->text[i]);
+            src->text[i] = specialized;
+        }
+        if(!src->text[i]) {
+            fprintf(stderr, "Could not load shader at: %s\n", full_path);
+            shader_src_free(src);
+            return NULL;
+        }
     }
+    return src;
+}
+
+/* The stages that were created are written to 'out' even on failure, for 
+ * the caller to delete */
+static bool shader_compile_stages(const struct shader_resource *res, 
+                                  const struct shader_src *src, GLuint out[SHADER_STAGES])
+{
+    const char *paths[SHADER_STAGES] = {res->vertex_path, res->geo_path, res->frag_path, res->comp_path};
+
+    for(int i = 0; i < SHADER_STAGES; i++) {
 
-    free((char*)text);
+        out[i] = 0;
+        if(!src->text[i])
+            continue;
+
+        if(!shader_init(src->text[i], &out[i], s_stage_types[i])) {
+            fprintf(stderr, "Could not compile shader at: %s%s\n", s_base_path, paths[i]);
+            return false;
+        }
+    }
     return true;
+}
+
+static void shader_cache_uniforms(struct shader_resource *res)
+{
+    /* GLSL 3.30 has no 'binding' layout qualifier so the block gets attached 
+     * to its' binding point here. Programs that don't reference any of the 
+     * globals have no active block. */
+    GLuint globals_idx = glGetUniformBlockIndex(res->prog_id, GL_U_GLOBALS);
+    if(globals_idx != GL_INVALID_INDEX) {
+        glUniformBlockBinding(res->prog_id, globals_idx, SHADER_GLOBALS_BINDING);
+    }
+
+    GLuint lights_idx = glGetUniformBlockIndex(res->prog_id, GL_U_POINT_LIGHTS);
+    if(lights_idx != GL_INVALID_INDEX) {
+        glUniformBlockBinding(res->prog_id, lights_idx, SHADER_LIGHTS_BINDING);
+    }
 
-fail:
-    free((char*)text);
-    return false;
+    GLuint decals_idx = glGetUniformBlockIndex(res->prog_id, GL_U_DECALS);
+    if(decals_idx != GL_INVALID_INDEX) {
+        glUniformBlockBinding(res->prog_id, decals_idx, SHADER_DECALS_BINDING);
+    }
+
+    GLuint table_idx = glGetUniformBlockIndex(res->prog_id, GL_U_MATERIAL_TABLE);
+    if(table_idx != GL_INVALID_INDEX) {
+        glUniformBlockBinding(res->prog_id, table_idx, SHADER_MATERIALS_BINDING);
+    }
+
+    for(int i = 0; i < SU_COUNT; i++) {
+        res->uniforms[i] = glGetUniformLocation(res->prog_id, s_uniform_names[i]);
+    }
+
+    /* The palette samplers never change units, so they are only set once */
+    if(res->uniforms[SU_ANIM_PALETTE] >= 0 || res->uniforms[SU_ANIM_BAKED] >= 0) {
+        glUseProgram(res->prog_id);
+        glUniform1i(res->uniforms[SU_ANIM_PALETTE], SHADER_ANIM_PALETTE_TUNIT);
+        glUniform1i(res->uniforms[SU_ANIM_BAKED], SHADER_ANIM_BAKED_TUNIT);
+    }
+
+    /* As are the samplers of the texture arrays the materials are packed in */
+    if(table_idx != GL_INVALID_INDEX) {
+        glUseProgram(res->prog_id);
+        for(int i = 0; i < SHADER_MAX_TEXTURE_PAGES; i++)
+            glUniform1i(res->uniforms[SU_TEXTURE0 + i], i);
+    }
+
+    for(int i = 0; i < SHADER_MAX_MATERIALS; i++) {
+        for(int j = 0; j < MU_COUNT; j++) {
+
+            char locbuff[64];
+            snprintf(locbuff, sizeof(locbuff), "%s[%d].%s", GL_U_MATERIALS, i, s_material_member_names[j]);
+            res->materials[i][j] = glGetUniformLocation(res->prog_id, locbuff);
+        }
+    }
+}
+
+static const struct shader_resource *shader_for_prog(GLuint prog)
+{
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+        if(s_shaders[i].prog_id == prog)
+            return &s_shaders[i];
+    }
+    return NULL;
 }
 
-static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader, const GLuint frag_shader, GLint *out)
+/* Must be done before every link of the program to take effect */
+static void shader_set_varyings(const struct shader_resource *res, GLuint prog)
+{
+    if(!res->varyings)
+        return;
+
+    GLsizei count = 0;
+    while(res->varyings[count])
+        count++;
+    glTransformFeedbackVaryings(prog, count, (const GLchar**)res->varyings, GL_INTERLEAVED_ATTRIBS);
+}
+
+/* The stages which are 0 are left out */
+static bool shader_make_prog(const struct shader_resource *res, 
+                             const GLuint stages[SHADER_STAGES], GLint *out)
 {
     char info[512];
     GLint success;
 
     *out = glCreateProgram();
-    glAttachShader(*out, vertex_shader);
-
-    if(geo_shader) {
-        glAttachShader(*out, geo_shader); 
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        if(stages[i])
+            glAttachShader(*out, stages[i]);
     }
 
-    glAttachShader(*out, frag_shader);
+    if(s_cache_enabled) {
+        glProgramParameteri(*out, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    shader_set_varyings(res, *out);
     glLinkProgram(*out);
 
     glGetProgramiv(*out, GL_LINK_STATUS, &success);
@@ -244,56 +672,352 @@ static bool shader_make_prog(const GLuint vertex_shader, const GLuint geo_shader
     return true;
 }
 
+static bool shader_prog_from_src(const struct shader_resource *res, 
+                                 const struct shader_src *src, GLint *out)
+{
+    GLuint stages[SHADER_STAGES] = {0};
+    bool ret = shader_compile_stages(res, src, stages)
+            && shader_make_prog(res, stages, out);
+
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        if(stages[i])
+            glDeleteShader(stages[i]);
+    }
+    return ret;
+}
+
+static uint64_t shader_hash(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* The terminators are hashed too, so that moving text from one string to 
+ * the next changes the result. A NULL string hashes like an empty one. */
+static uint64_t shader_hash_str(uint64_t hash, const char *str)
+{
+    if(!str)
+        str = "";
+    return shader_hash(hash, str, strlen(str) + 1);
+}
+
+static uint64_t shader_src_hash(const struct shader_src *src)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        hash = shader_hash_str(hash, src->text[i]);
+    }
+    return hash;
+}
+
+static uint64_t shader_driver_hash(void)
+{
+    const GLenum strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for(int i = 0; i < ARR_SIZE(strings); i++) {
+        hash = shader_hash_str(hash, (const char*)glGetString(strings[i]));
+    }
+    return hash;
+}
+
+/* Program binaries are core in OpenGL 4.1 and are otherwise exposed by the
+ * ARB_get_program_binary extension. A driver can support the extension 
+ * while not offering any binary formats. */
+static bool shader_cache_supported(void)
+{
+    if(!CONFIG_SHADER_CACHE || !GLEW_ARB_get_program_binary)
+        return false;
+
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    return (num_formats > 0);
+}
+
+static int shader_idx_for_name_hash(uint64_t name_hash)
+{
+    for(int i = 0; i < ARR_SIZE(s_shaders); i++) {
+        if(shader_hash_str(FNV_OFFSET_BASIS, s_shaders[i].name) == name_hash)
+            return i;
+    }
+    return -1;
+}
+
+static void shader_cache_free(void)
+{
+    for(int i = 0; i < ARR_SIZE(s_binaries); i++) {
+        free(s_binaries[i].data);
+        s_binaries[i] = (struct shader_binary){0};
+    }
+}
+
+/* A missing or stale cache file is not an error - all the programs just 
+ * get compiled from source */
+static void shader_cache_load(uint64_t driver_hash)
+{
+    char path[512];
+    MAKE_PATH(path, s_base_path, SHADER_CACHE_FILE);
+
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        return;
+
+    struct shader_cache_hdr hdr;
+    if(1 != SDL_RWread(stream, &hdr, sizeof(hdr), 1)
+    || hdr.magic != SHADER_CACHE_MAGIC
+    || hdr.version != SHADER_CACHE_VERSION
+    || hdr.driver_hash != driver_hash)
+        goto out;
+
+    for(int i = 0; i < hdr.num_entries; i++) {
+
+        struct shader_cache_entry entry;
+        if(1 != SDL_RWread(stream, &entry, sizeof(entry), 1) || entry.size == 0)
+            goto out;
+
+        void *data = malloc(entry.size);
+        if(!data || 1 != SDL_RWread(stream, data, entry.size, 1)) {
+            free(data);
+            goto out;
+        }
+
+        int idx = shader_idx_for_name_hash(entry.name_hash);
+        if(idx < 0 || s_binaries[idx].data) {
+            free(data);
+            continue;
+        }
+
+        s_binaries[idx] = (struct shader_binary){
+            .src_hash = entry.src_hash,
+            .format   = entry.format,
+            .size     = entry.size,
+            .data     = data
+        };
+    }
+
+out:
+    SDL_RWclose(stream);
+}
+
+/* Write to a temporary file first, so that a partially written file never 
+ * replaces a good one */
+static bool shader_cache_save(uint64_t driver_hash)
+{
+    char path[512];
+    char tmp_path[sizeof(path) + sizeof(".tmp")];
+    MAKE_PATH(path, s_base_path, SHADER_CACHE_FILE);
+    sprintf(tmp_path, "%s.tmp", path);
+
+    SDL_RWops *stream = SDL_RWFromFile(tmp_path, "wb");
+    if(!stream)
+        return false;
+
+    struct shader_cache_hdr hdr = {
+        .magic       = SHADER_CACHE_MAGIC,
+        .version     = SHADER_CACHE_VERSION,
+        .driver_hash = driver_hash,
+    };
+    for(int i = 0; i < ARR_SIZE(s_binaries); i++) {
+        hdr.num_entries += !!s_binaries[i].data;
+    }
+
+    bool ret = (1 == SDL_RWwrite(stream, &hdr, sizeof(hdr), 1));
+    for(int i = 0; ret && i < ARR_SIZE(s_binaries); i++) {
+
+        const struct shader_binary *bin = &s_binaries[i];
+        if(!bin->data)
+            continue;
+
+        struct shader_cache_entry entry = {
+            .name_hash = shader_hash_str(FNV_OFFSET_BASIS, s_shaders[i].name),
+            .src_hash  = bin->src_hash,
+            .format    = bin->format,
+            .size      = bin->size
+        };
+        ret = (1 == SDL_RWwrite(stream, &entry, sizeof(entry), 1))
+           && (1 == SDL_RWwrite(stream, bin->data, bin->size, 1));
+    }
+    ret = (0 == SDL_RWclose(stream)) && ret;
+
+    return file_replace(path, tmp_path, ret);
+}
+
+/* The driver may still refuse a binary that matches, for example after
+ * an update that didn't change any of the strings */
+static bool shader_prog_from_binary(const struct shader_binary *bin, uint64_t src_hash, GLint *out)
+{
+    if(!bin->data || bin->src_hash != src_hash)
+        return false;
+
+    GLint success;
+    GLuint prog = glCreateProgram();
+    glProgramBinary(prog, bin->format, bin->data, bin->size);
+
+    glGetProgramiv(prog, GL_LINK_STATUS, &success);
+    if(!success) {
+        glDeleteProgram(prog);
+        return false;
+    }
+
+    *out = prog;
+    return true;
+}
+
+static bool shader_binary_retrieve(GLuint prog, uint64_t src_hash, struct shader_binary *out)
+{
+    GLint size = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &size);
+    if(size <= 0)
+        return false;
+
+    void *data = malloc(size);
+    if(!data)
+        return false;
+
+    GLenum format;
+    GLsizei length = 0;
+    glGetProgramBinary(prog, size, &length, &format, data);
+    if(length <= 0) {
+        free(data);
+        return false;
+    }
+
+    free(out->data);
+    *out = (struct shader_binary){
+        .src_hash = src_hash,
+        .format   = format,
+        .size     = length,
+        .data     = data
+    };
+    return true;
+}
+
+/* Runs on the hot reloading thread. All the stages are read again, whichever
+ * of the files changed. */
+static void *shader_hr_load(void *user, const char *path)
+{
+    return shader_src_load(user);
+}
+
+/* The program object is re-linked with the new stages, so that everything 
+ * holding on to its' name picks up the change. The stages are first linked
+ * into a program of their own, which leaves the one in use untouched when
+ * they fail to compile or link. */
+static bool shader_hr_apply(void *user, void *data)
+{
+    struct shader_resource *res = user;
+    struct shader_src *src = data;
+    GLuint stages[SHADER_STAGES] = {0};
+    GLint test_prog = 0;
+    bool ret = false;
+
+    if(!shader_compile_stages(res, src, stages))
+        goto out;
+
+    if(!shader_make_prog(res, stages, &test_prog))
+        goto out;
+
+    GLuint attached[SHADER_STAGES];
+    GLsizei num_attached;
+    glGetAttachedShaders(res->prog_id, SHADER_STAGES, &num_attached, attached);
+    for(int i = 0; i < num_attached; i++) {
+        glDetachShader(res->prog_id, attached[i]);
+    }
+
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        if(stages[i])
+            glAttachShader(res->prog_id, stages[i]);
+    }
+    shader_set_varyings(res, res->prog_id);
+    glLinkProgram(res->prog_id);
+    shader_cache_uniforms(res);
+    ret = true;
+
+out:
+    if(test_prog)
+        glDeleteProgram(test_prog);
+    for(int i = 0; i < SHADER_STAGES; i++) {
+        if(stages[i])
+            glDeleteShader(stages[i]);
+    }
+    shader_src_free(src);
+    return ret;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
 
 bool R_Shader_InitAll(const char *base_path)
 {
+    assert(strlen(base_path) < sizeof(s_base_path));
+    strcpy(s_base_path, base_path);
+
+    bool ret = false, cache_dirty = false;
+    uint64_t driver_hash = 0;
+
+    s_cache_enabled = shader_cache_supported();
+    if(s_cache_enabled) {
+        driver_hash = shader_driver_hash();
+        shader_cache_load(driver_hash);
+    }
+
     for(int i = 0; i < ARR_SIZE(s_shaders); i++){
 
         struct shader_resource *res = &s_shaders[i];
-        GLuint vertex, geometry = 0, fragment;
-        char path[512];
-    
-        MAKE_PATH(path, base_path, res->vertex_path);
-        if(!shader_load_and_init(path, &vertex, GL_VERTEX_SHADER)) {
-            fprintf(stderr, "Failed to load and init vertex shader.\n");
-            return false;
-        }
+        if(res->comp_path && !GLEW_VERSION_4_3)
+            continue;
 
-        if(res->geo_path)
-            MAKE_PATH(path, base_path, res->geo_path);
-        if(res->geo_path && !shader_load_and_init(path, &geometry, GL_GEOMETRY_SHADER)) {
-            fprintf(stderr, "Failed to load and init geometry shader.\n");
-            return false;
+        /* The sources are read even when there is a binary, to tell if it
+         * is stale. Reading them costs little next to compiling them. */
+        struct shader_src *src = shader_src_load(res);
+        if(!src) {
+            fprintf(stderr, "Failed to load the sources of shader program '%s'.\n", res->name);
+            goto out;
         }
-        assert(!res->geo_path || geometry > 0);
+        uint64_t src_hash = shader_src_hash(src);
 
-        MAKE_PATH(path, base_path, res->frag_path);
-        if(!shader_load_and_init(path, &fragment, GL_FRAGMENT_SHADER)) {
-            fprintf(stderr, "Failed to load and init fragment shader.\n");
-            return false;
-        }
+        if(!s_cache_enabled || !shader_prog_from_binary(&s_binaries[i], src_hash, &res->prog_id)) {
 
-        if(!shader_make_prog(vertex, geometry, fragment, &res->prog_id)) {
+            if(!shader_prog_from_src(res, src, &res->prog_id)) {
 
-            glDeleteShader(vertex);
-            if(geometry)
-                glDeleteShader(geometry);
-            glDeleteShader(fragment);
-            fprintf(stderr, "Failed to make shader program %d of %d.\n",
-                i + 1, (int)ARR_SIZE(s_shaders));
-            return false;
+                fprintf(stderr, "Failed to make shader program %d of %d.\n",
+                    i + 1, (int)ARR_SIZE(s_shaders));
+                shader_src_free(src);
+                goto out;
+            }
+
+            if(s_cache_enabled)
+                cache_dirty |= shader_binary_retrieve(res->prog_id, src_hash, &s_binaries[i]);
         }
+        shader_src_free(src);
 
-        glDeleteShader(vertex);
-        if(geometry)
-            glDeleteShader(geometry);
-        glDeleteShader(fragment);
+        shader_cache_uniforms(res);
+
+        const char *paths[SHADER_STAGES] = {res->vertex_path, res->geo_path, res->frag_path, res->comp_path};
+        for(int j = 0; j < SHADER_STAGES; j++) {
+
+            if(!paths[j])
+                continue;
+
+            char path[512];
+            MAKE_PATH(path, base_path, paths[j]);
+            HR_Watch(path, shader_hr_load, shader_hr_apply, shader_src_free, res);
+        }
     }
 
-    return true;
+    if(cache_dirty && !shader_cache_save(driver_hash))
+        fprintf(stderr, "Failed to save the shader program cache.\n");
+    ret = true;
+
+out:
+    shader_cache_free();
+    s_cache_enabled = false;
+    return ret;
 }
 
 
@@ -309,4 +1033,34 @@ GLint R_Shader_GetProgForName(const char *name)
     
     return -1;
 }
-    
+
+GLint R_Shader_UniformLoc(GLuint prog, enum shader_uniform uniform)
+{
+    assert(uniform >= 0 && uniform < SU_COUNT);
+
+    const struct shader_resource *res = shader_for_prog(prog);
+    assert(res);
+    return res->uniforms[uniform];
+}
+
+GLint R_Shader_MaterialLoc(GLuint prog, int mat_idx, enum material_uniform member)
+{
+    assert(mat_idx >= 0 && mat_idx < SHADER_MAX_MATERIALS);
+    assert(member >= 0 && member < MU_COUNT);
+
+    const struct shader_resource *res = shader_for_prog(prog);
+    assert(res);
+    return res->materials[mat_idx][member];
+}
+
+size_t R_Shader_NumProgs(void)
+{
+    return ARR_SIZE(s_shaders);
+}
+
+GLuint R_Shader_ProgAt(size_t idx)
+{
+    assert(idx < ARR_SIZE(s_shaders));
+    return s_shaders[idx].prog_id;
+}
+
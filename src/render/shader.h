@@ -40,7 +40,101 @@
 
 #include <stdbool.h>
 
-bool  R_Shader_InitAll(const char *base_path);
-GLint R_Shader_GetProgForName(const char *name);
+/* The maximum number of elements of the 'materials' uniform array */
+#define SHADER_MAX_MATERIALS      (16)
+/* The uniform buffer binding point of the 'globals' block of every program */
+#define SHADER_GLOBALS_BINDING    (0)
+/* The uniform buffer binding point of the 'point_lights' block */
+#define SHADER_LIGHTS_BINDING     (1)
+/* The most point lights that can light the scene at once */
+#define SHADER_MAX_POINT_LIGHTS   (64)
+/* The uniform buffer binding point of the 'decals' block */
+#define SHADER_DECALS_BINDING     (2)
+/* The most decals that can be drawn over the terrain in a frame */
+#define SHADER_MAX_DECALS         (256)
+/* The uniform buffer binding point of the 'material_table' block */
+#define SHADER_MATERIALS_BINDING  (3)
+/* The number of entries in the 'material_table' block */
+#define SHADER_MAX_TABLE_MATERIALS (512)
+/* The most texture arrays that the materials of an object can have their' 
+ * textures packed in. They are bound to the units from 0 on. */
+#define SHADER_MAX_TEXTURE_PAGES  (4)
+/* The shader storage buffer binding points of the GPU culling's instances,
+ * groups of instances sharing a mesh, indirect draw commands and the model
+ * matrices of the instances which passed, for the compute programs which 
+ * name them in their' 'binding' layout qualifiers */
+#define SHADER_CULL_INSTANCES_BINDING (0)
+#define SHADER_CULL_GROUPS_BINDING    (1)
+#define SHADER_CULL_COMMANDS_BINDING  (2)
+#define SHADER_CULL_MODELS_BINDING    (3)
+/* The texture unit the joint palette buffer texture stays bound to. It is 
+ * past the units used for materials. */
+#define SHADER_ANIM_PALETTE_TUNIT (16)
+/* The texture unit the baked joint palette buffer texture stays bound to */
+#define SHADER_ANIM_BAKED_TUNIT   (17)
+
+/* Uniforms whose locations are looked up once when the programs are linked. 
+ * The names are defined in 'gl_uniforms.h'. */
+enum shader_uniform{
+    SU_MODEL,
+    SU_COLOR,
+    SU_ANIM_PALETTE,
+    SU_ANIM_PALETTE_BASES,
+    SU_ANIM_PALETTE_BLEND,
+    SU_ANIM_BAKED,
+    SU_ANIM_PALETTE_BAKED,
+    SU_TEXTURE0,
+    SU_TEXTURE15 = SU_TEXTURE0 + 15,
+    SU_SKIP_LIGHTING,
+    SU_TEXTURE_ARRAY,
+    SU_SPLAT_WEIGHTS,
+    SU_SPLAT_MATS,
+    SU_SPLAT_ORIGIN,
+    SU_SPLAT_GRID,
+    SU_FOG_RECT,
+    SU_UV_SCALE,
+    SU_VIEWPORT_SIZE,
+    SU_FOG_ENABLED,
+    SU_SHADOWS_ENABLED,
+    SU_LIGHT_VIEW_PROJ,
+    SU_CURR_TIME,
+    SU_EFFECT_STYLE,
+    SU_MATERIAL_BASE,
+    SU_NUM_INSTANCES,
+    SU_LOD_SCALE,
+    SU_IMPOSTOR_SIZE,
+    SU_HIZ_ENABLED,
+    SU_SRC_SIZE,
+    SU_FIRST_LEVEL,
+    SU_HEIGHTFIELD,
+    SU_CHUNKS_WIDE,
+    SU_COUNT
+};
+
+/* Members of each element of the 'materials' uniform array */
+enum material_uniform{
+    MU_AMBIENT_INTENSITY,
+    MU_DIFFUSE_CLR,
+    MU_SPECULAR_CLR,
+    MU_COUNT
+};
+
+bool   R_Shader_InitAll(const char *base_path);
+GLint  R_Shader_GetProgForName(const char *name);
+
+/* ------------------------------------------------------------------------
+ * Returns the cached location of the uniform in the program, or -1 if the 
+ * program does not have it. Setting a uniform at location -1 is a no-op.
+ * ------------------------------------------------------------------------
+ */
+GLint  R_Shader_UniformLoc(GLuint prog, enum shader_uniform uniform);
+GLint  R_Shader_MaterialLoc(GLuint prog, int mat_idx, enum material_uniform member);
+
+/* ------------------------------------------------------------------------
+ * For iterating over all the linked programs.
+ * ------------------------------------------------------------------------
+ */
+size_t R_Shader_NumProgs(void);
+GLuint R_Shader_ProgAt(size_t idx);
 
 #endif
@@ -34,46 +34,942 @@
  */
 
 #include "texture.h"
-#include "gl_uniforms.h"
+#include "shader.h"
+#include "render_gl.h"
+#include "public/render.h"
+#include "../hot_reload.h"
+#include "../mem.h"
 #include "../lib/public/stb_image.h"
+#include "../lib/public/queue.h"
+#include "../lib/public/kvec.h"
+#include "../lib/public/khash.h"
 
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
 #define MAX_NUM_TEXTURE  2048
 #define MAX_TEX_NAME_LEN 32
+#define MAX_MIP_LEVELS   16
+#define MAX_WORKERS      (2)
+/* Past this many pending jobs, images are decoded on the loading thread */
+#define MAX_QUEUED_JOBS  (64)
+/* Decoded images are uploaded over the following frames, with at most this 
+ * many bytes per frame - but always at least one image */
+#define UPLOAD_BUDGET    (8 * 1024 * 1024)
+/* The arrays that the packed images go in are sized to hold about this many 
+ * bytes, and at most this many layers */
+#define PAGE_BUDGET      (32 * 1024 * 1024)
+#define MAX_PAGE_LAYERS  (64)
+
+#define DDS_MAGIC        0x20534444 /* "DDS " */
+#define DDS_HEADER_SIZE  (128)
+#define DDPF_FOURCC      (0x4)
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
 
+#define MIN(a, b)        ((a) < (b) ? (a) : (b))
+#define MAX(a, b)        ((a) > (b) ? (a) : (b))
+
+/* A GL_TEXTURE_2D_ARRAY holding the packed images that have the same size, 
+ * format and number of mip levels, one per layer */
+struct tex_page{
+    GLuint   tex;
+    bool     compressed;
+    GLenum   internal_format;
+    int      width, height;
+    int      num_levels;
+    int      num_layers;
+    /* Bit 'i' is set while layer 'i' is taken */
+    uint64_t used;
+};
 
 struct texture_resource{
     char                     name[MAX_TEX_NAME_LEN];
     GLint                    texture_id;
+    /* The number of references taken with 'R_Texture_Load', 
+     * 'R_Texture_GetForName' and 'R_Texture_AddExisting' */
+    int                      refcount;
     struct texture_resource *next_free;
     struct texture_resource *prev_free;
     bool                     free;
+    /* For the packed textures, the array that the image is in */
+    struct tex_page         *page;
+    int                      layer;
 };
 
+/* A decoded image, ready to be uploaded. Compressed images hold the whole 
+ * mip chain, uncompressed ones only the base level. */
+struct tex_image{
+    bool           compressed;
+    GLenum         internal_format;
+    /* The pixel format of the data, for uncompressed images */
+    GLenum         format;
+    int            width, height;
+    int            num_levels;
+    size_t         level_offsets[MAX_MIP_LEVELS];
+    size_t         level_sizes[MAX_MIP_LEVELS];
+    size_t         size;
+    unsigned char *data;
+    /* Whether 'data' must be released with 'stbi_image_free' */
+    bool           stbi_owned;
+};
+
+enum job_state{
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+};
+
+struct tex_job{
+    GLuint           tex;
+    /* For packed textures, the array and layer that the image goes in. 
+     * 'tex' is the array's. */
+    struct tex_page *page;
+    int              layer;
+    char             path[512];
+    /* The file to decode instead, when 'path' can't be. May be empty. */
+    char             fallback[512];
+    enum job_state   state;
+    /* Set when the texture is freed before the image is uploaded */
+    bool             cancelled;
+    /* Set by the worker thread */
+    bool             ok;
+    struct tex_image img;
+};
+
+/* Maps the names of the textures to their indices in 's_tex_resources'. The 
+ * keys point to the names stored in the resources themselves. */
+KHASH_MAP_INIT_STR(tex_name, int)
+/* The GPU memory that is counted for each texture, by GL name */
+KHASH_MAP_INIT_INT(tex_size, size_t)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 static struct texture_resource  s_tex_resources[MAX_NUM_TEXTURE];
 static struct texture_resource *s_free_head = &s_tex_resources[0];
+static khash_t(tex_name)       *s_name_table;
+/* The packed textures are looked up apart from the rest, as the same image 
+ * may be loaded both ways */
+static khash_t(tex_name)       *s_packed_table;
+static khash_t(tex_size)       *s_size_table;
+static kvec_t(struct tex_page*) s_pages;
 
+/* When the workers couldn't be started, images are decoded and uploaded 
+ * right away */
+static bool                     s_running = false;
+static bool                     s_quit;
+static int                      s_num_workers;
+static SDL_Thread              *s_workers[MAX_WORKERS];
+/* The jobs that haven't been uploaded yet, in the order they were submitted. 
+ * Only touched by the main thread. */
+static kvec_t(struct tex_job*)  s_jobs;
+static GLuint                   s_pbo;
+
+/* 's_lock' protects the job queue and the 'state' of all the jobs. */
+static SDL_mutex               *s_lock;
+/* Signalled when a new job is added to the queue. */
+static SDL_cond                *s_work_cond;
+/* Signalled when a job finishes running. */
+static SDL_cond                *s_done_cond;
+static queue_t                 *s_job_queue;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool r_texture_gl_init(const char *path, GLuint *out)
+static uint32_t r_texture_read_u32(const unsigned char *data)
 {
-    GLuint ret;
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) 
+         | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/* Reverses the order of the first 'rows' rows of a DXT block */
+static void r_texture_flip_dxt_block(unsigned char *block, GLenum format, int rows)
+{
+    unsigned char *color = block;
+
+    if(format == GL_COMPRESSED_RGBA_S3TC_DXT3_EXT) {
+
+        /* 4 bits of explicit alpha per texel - 2 bytes per row */
+        for(int i = 0; i < rows / 2; i++) {
+            unsigned char tmp[2];
+            memcpy(tmp, block + i * 2, 2);
+            memcpy(block + i * 2, block + (rows - 1 - i) * 2, 2);
+            memcpy(block + (rows - 1 - i) * 2, tmp, 2);
+        }
+        color = block + 8;
+
+    }else if(format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) {
+
+        /* 2 alpha endpoints followed by 3-bit indices - 12 bits per row */
+        uint64_t bits = 0;
+        for(int i = 0; i < 6; i++)
+            bits |= (uint64_t)block[2 + i] << (i * 8);
+
+        uint64_t flipped = bits;
+        for(int i = 0; i < rows; i++) {
+            uint64_t row = (bits >> (i * 12)) & 0xfff;
+            flipped &= ~((uint64_t)0xfff << ((rows - 1 - i) * 12));
+            flipped |= row << ((rows - 1 - i) * 12);
+        }
+        for(int i = 0; i < 6; i++)
+            block[2 + i] = (flipped >> (i * 8)) & 0xff;
+        color = block + 8;
+    }
+
+    /* 2 color endpoints followed by 2-bit indices - 1 byte per row */
+    for(int i = 0; i < rows / 2; i++) {
+        unsigned char tmp = color[4 + i];
+        color[4 + i] = color[4 + rows - 1 - i];
+        color[4 + rows - 1 - i] = tmp;
+    }
+}
+
+/* Images are flipped on load to have the first row at the bottom, the way 
+ * OpenGL expects it. The rows of a compressed image can't be moved one by one, 
+ * so the rows of blocks are swapped and then the rows inside each block. */
+static void r_texture_flip_dxt_level(unsigned char *data, GLenum format, int width, int height)
+{
+    size_t block_size = (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    size_t row_size = blocks_x * block_size;
+
+    unsigned char tmp[row_size];
+    for(int i = 0; i < blocks_y / 2; i++) {
+        unsigned char *a = data + i * row_size;
+        unsigned char *b = data + (blocks_y - 1 - i) * row_size;
+        memcpy(tmp, a, row_size);
+        memcpy(a, b, row_size);
+        memcpy(b, tmp, row_size);
+    }
+
+    /* Only levels less than 4 texels high have partially filled blocks */
+    int rows = height < 4 ? height : 4;
+    for(int i = 0; i < blocks_x * blocks_y; i++)
+        r_texture_flip_dxt_block(data + i * block_size, format, rows);
+}
+
+static size_t r_texture_block_size(GLenum format)
+{
+    return (format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT) ? 8 : 16;
+}
+
+/* The size of one layer of a mip level of the image */
+static size_t r_texture_level_size(bool compressed, GLenum format, int width, int height)
+{
+    if(compressed)
+        return ((width + 3) / 4) * ((height + 3) / 4) * r_texture_block_size(format);
+    return (size_t)width * height * 4;
+}
+
+static int r_texture_num_levels(int width, int height)
+{
+    int ret = 1;
+    while((width > 1 || height > 1) && ret < MAX_MIP_LEVELS) {
+        width  = width  > 1 ? width  / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        ret++;
+    }
+    return ret;
+}
+
+/* Reads the format and size of the image from the header of a DDS file, and
+ * works out where each of its' levels is in the file */
+static bool r_texture_dds_layout(const unsigned char *hdr, size_t file_size, struct tex_image *out)
+{
+    if(r_texture_read_u32(hdr) != DDS_MAGIC || r_texture_read_u32(hdr + 4) != 124)
+        return false;
+
+    int height = r_texture_read_u32(hdr + 12);
+    int width = r_texture_read_u32(hdr + 16);
+    int num_levels = r_texture_read_u32(hdr + 28);
+    uint32_t pf_flags = r_texture_read_u32(hdr + 80);
+    uint32_t fourcc = r_texture_read_u32(hdr + 84);
+
+    if(width <= 0 || height <= 0 || !(pf_flags & DDPF_FOURCC))
+        return false;
+
+    switch(fourcc) {
+    case FOURCC('D', 'X', 'T', '1'): out->internal_format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;  break;
+    case FOURCC('D', 'X', 'T', '3'): out->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; break;
+    case FOURCC('D', 'X', 'T', '5'): out->internal_format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+    default: return false;
+    }
+
+    if(num_levels < 1)
+        num_levels = 1;
+    if(num_levels > MAX_MIP_LEVELS)
+        num_levels = MAX_MIP_LEVELS;
+
+    size_t offset = DDS_HEADER_SIZE;
+    int level_width = width, level_height = height;
+
+    for(int i = 0; i < num_levels; i++) {
+
+        size_t size = r_texture_level_size(true, out->internal_format, level_width, level_height);
+        if(offset + size > file_size)
+            return false;
+
+        /* Rows can't be moved between blocks, so only the levels whose rows
+         * all line up with the blocks can be flipped. The rest are dropped. */
+        if(level_height > 4 && level_height % 4) {
+            if(i == 0)
+                return false;
+            num_levels = i;
+            break;
+        }
+
+        out->level_offsets[i] = offset;
+        out->level_sizes[i] = size;
+        offset += size;
+
+        if(level_width == 1 && level_height == 1) {
+            num_levels = i + 1;
+            break;
+        }
+        level_width  = level_width  > 1 ? level_width  / 2 : 1;
+        level_height = level_height > 1 ? level_height / 2 : 1;
+    }
+
+    out->compressed = true;
+    out->width = width;
+    out->height = height;
+    out->num_levels = num_levels;
+    out->size = offset;
+    return true;
+}
+
+/* Reads a DDS file holding a DXT1, DXT3 or DXT5 compressed image, along with 
+ * any mip levels stored with it */
+static bool r_texture_read_dds(const char *path, struct tex_image *out)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        goto fail_open;
+
+    if(0 != fseek(file, 0, SEEK_END))
+        goto fail_read;
+    long file_size = ftell(file);
+    if(file_size < DDS_HEADER_SIZE || 0 != fseek(file, 0, SEEK_SET))
+        goto fail_read;
+
+    unsigned char *data = malloc(file_size);
+    if(!data)
+        goto fail_read;
+    if(1 != fread(data, file_size, 1, file))
+        goto fail_parse;
+
+    if(!r_texture_dds_layout(data, file_size, out))
+        goto fail_parse;
+
+    int level_width = out->width, level_height = out->height;
+    for(int i = 0; i < out->num_levels; i++) {
+
+        r_texture_flip_dxt_level(data + out->level_offsets[i], out->internal_format, 
+            level_width, level_height);
+        level_width  = level_width  > 1 ? level_width  / 2 : 1;
+        level_height = level_height > 1 ? level_height / 2 : 1;
+    }
+
+    out->data = data;
+    out->stbi_owned = false;
+
+    fclose(file);
+    return true;
+
+fail_parse:
+    free(data);
+fail_read:
+    fclose(file);
+fail_open:
+    return false;
+}
+
+/* Reads the size and format that the image will have once it's decoded, 
+ * without decoding it. Uncompressed images are described the way they are 
+ * stored in the arrays - as RGBA with the full mip chain. */
+static bool r_texture_probe(const char *path, struct tex_image *out)
+{
+    size_t len = strlen(path);
+    if(len > 4 && !strcmp(path + len - 4, ".dds")) {
+
+        FILE *file = fopen(path, "rb");
+        if(!file)
+            return false;
+
+        unsigned char hdr[DDS_HEADER_SIZE];
+        bool ret = (0 == fseek(file, 0, SEEK_END));
+        long file_size = ftell(file);
+        ret = ret && (file_size >= DDS_HEADER_SIZE)
+                  && (0 == fseek(file, 0, SEEK_SET))
+                  && (1 == fread(hdr, sizeof(hdr), 1, file))
+                  && r_texture_dds_layout(hdr, file_size, out);
+        fclose(file);
+        return ret;
+    }
+
     int width, height, nr_channels;
-    unsigned char *data;
-    
-    data = stbi_load(path, &width, &height, &nr_channels, 0);
+    if(!stbi_info(path, &width, &height, &nr_channels))
+        return false;
+    if(nr_channels != 3 && nr_channels != 4)
+        return false;
+
+    out->compressed = false;
+    out->internal_format = GL_RGBA8;
+    out->format = GL_RGBA;
+    out->width = width;
+    out->height = height;
+    out->num_levels = r_texture_num_levels(width, height);
+    out->size = (size_t)width * height * 4;
+    return true;
+}
+
+static bool r_texture_decode(const char *path, struct tex_image *out)
+{
+    size_t len = strlen(path);
+    if(len > 4 && !strcmp(path + len - 4, ".dds"))
+        return r_texture_read_dds(path, out);
+
+    int width, height, nr_channels;
+    unsigned char *data = stbi_load(path, &width, &height, &nr_channels, 0);
     if(!data)
-        goto fail_load;
+        return false;
+
+    if(nr_channels != 3 && nr_channels != 4) {
+        stbi_image_free(data);
+        return false;
+    }
+
+    out->compressed = false;
+    out->format = (nr_channels == 3) ? GL_RGB : GL_RGBA;
+    out->internal_format = out->format;
+    out->width = width;
+    out->height = height;
+    out->num_levels = 1;
+    out->level_offsets[0] = 0;
+    out->level_sizes[0] = width * height * nr_channels;
+    out->size = out->level_sizes[0];
+    out->data = data;
+    out->stbi_owned = true;
+    return true;
+}
+
+static void r_texture_decode_job(struct tex_job *job)
+{
+    job->ok = r_texture_decode(job->path, &job->img);
+    if(!job->ok && strlen(job->fallback))
+        job->ok = r_texture_decode(job->fallback, &job->img);
+}
+
+static void r_texture_image_free(struct tex_image *img)
+{
+    if(img->stbi_owned)
+        stbi_image_free(img->data);
+    else
+        free(img->data);
+    img->data = NULL;
+}
+
+static void r_texture_set_size(GLuint tex, size_t bytes)
+{
+    int status;
+    khiter_t k = kh_put(tex_size, s_size_table, tex, &status);
+    if(status == -1)
+        return;
+
+    if(status == 0)
+        MEM_Untrack(MEM_TAG_GL_TEXTURES, kh_value(s_size_table, k));
+    kh_value(s_size_table, k) = bytes;
+    MEM_Track(MEM_TAG_GL_TEXTURES, bytes);
+}
+
+static void r_texture_delete(GLuint tex)
+{
+    khiter_t k = kh_get(tex_size, s_size_table, tex);
+    if(k != kh_end(s_size_table)) {
+        MEM_Untrack(MEM_TAG_GL_TEXTURES, kh_value(s_size_table, k));
+        kh_del(tex_size, s_size_table, k);
+    }
+    glDeleteTextures(1, &tex);
+}
+
+/* The image is staged in a pixel buffer, so that the driver can copy it to the 
+ * texture asynchronously. Returns the base that the offsets of the levels are
+ * relative to in the upload calls, which must follow. */
+static const unsigned char *r_texture_stage(const struct tex_image *img)
+{
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, s_pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, img->size, NULL, GL_STREAM_DRAW);
+
+    const unsigned char *base = NULL;
+    void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, img->size, 
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+
+    if(staging) {
+        memcpy(staging, img->data, img->size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }else{
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        base = img->data;
+    }
+    return base;
+}
+
+static void r_texture_upload(GLuint tex, const struct tex_image *img)
+{
+    const unsigned char *base = r_texture_stage(img);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if(img->compressed) {
+
+        int width = img->width, height = img->height;
+        for(int i = 0; i < img->num_levels; i++) {
+
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, img->internal_format, width, height, 0, 
+                img->level_sizes[i], base + img->level_offsets[i]);
+            width  = width  > 1 ? width  / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img->num_levels - 1);
+        r_texture_set_size(tex, img->size);
+
+    }else{
+
+        glTexImage2D(GL_TEXTURE_2D, 0, img->internal_format, img->width, img->height, 0, 
+            img->format, GL_UNSIGNED_BYTE, base);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        /* A reloaded texture may have been compressed before */
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+        /* The mip chain adds another third */
+        r_texture_set_size(tex, img->size + img->size / 3);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+static bool r_texture_page_fits(const struct tex_page *page, const struct tex_image *img)
+{
+    if(img->compressed != page->compressed
+    || img->width != page->width 
+    || img->height != page->height)
+        return false;
+
+    return !img->compressed 
+        || (img->internal_format == page->internal_format && img->num_levels >= page->num_levels);
+}
+
+static void r_texture_upload_layer(const struct tex_page *page, int layer, const struct tex_image *img)
+{
+    assert(r_texture_page_fits(page, img));
+    const unsigned char *base = r_texture_stage(img);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, page->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if(img->compressed) {
+
+        int width = img->width, height = img->height;
+        for(int i = 0; i < page->num_levels; i++) {
+
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, i, 0, 0, layer, width, height, 1,
+                img->internal_format, img->level_sizes[i], base + img->level_offsets[i]);
+            width  = width  > 1 ? width  / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+
+    }else{
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, img->width, img->height, 1, 
+            img->format, GL_UNSIGNED_BYTE, base);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/* Until the image is uploaded, the base level of the layer is grey */
+static void r_texture_page_clear(const struct tex_page *page, int layer)
+{
+    size_t size = r_texture_level_size(page->compressed, page->internal_format, 
+        page->width, page->height);
+    unsigned char *data = malloc(size);
+    if(!data)
+        return;
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, page->tex);
+
+    if(page->compressed) {
+
+        /* Opaque alpha, followed by a color block with both endpoints grey */
+        const unsigned char alpha[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+        const unsigned char color[8] = {0x10, 0x84, 0x10, 0x84, 0x00, 0x00, 0x00, 0x00};
+        size_t block_size = r_texture_block_size(page->internal_format);
+
+        for(size_t i = 0; i < size; i += block_size) {
+            if(block_size == 16)
+                memcpy(data + i, alpha, sizeof(alpha));
+            memcpy(data + i + block_size - sizeof(color), color, sizeof(color));
+        }
+        glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, page->width, page->height, 1,
+            page->internal_format, size, data);
+
+    }else{
+
+        for(size_t i = 0; i < size; i += 4)
+            memcpy(data + i, (unsigned char[4]){128, 128, 128, 255}, 4);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, page->width, page->height, 1, 
+            GL_RGBA, GL_UNSIGNED_BYTE, data);
+    }
+    free(data);
+}
+
+static struct tex_page *r_texture_page_new(const struct tex_image *desc)
+{
+    struct tex_page *page = malloc(sizeof(struct tex_page));
+    if(!page)
+        return NULL;
+
+    size_t base_size = r_texture_level_size(desc->compressed, desc->internal_format, 
+        desc->width, desc->height);
+
+    *page = (struct tex_page){
+        .compressed      = desc->compressed,
+        .internal_format = desc->internal_format,
+        .width           = desc->width,
+        .height          = desc->height,
+        .num_levels      = desc->num_levels,
+        .num_layers      = MAX(1, MIN(PAGE_BUDGET / base_size, MAX_PAGE_LAYERS)),
+        .used            = 0,
+    };
+
+    glActiveTexture(GL_TEXTURE1);
+    glGenTextures(1, &page->tex);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, page->tex);
+
+    size_t total = 0;
+    int width = page->width, height = page->height;
+
+    for(int i = 0; i < page->num_levels; i++) {
+
+        size_t size = r_texture_level_size(page->compressed, page->internal_format, width, height) 
+                    * page->num_layers;
+        if(page->compressed) {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, page->internal_format, 
+                width, height, page->num_layers, 0, size, NULL);
+        }else{
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, width, height, page->num_layers, 0, 
+                GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        total += size;
+        width  = width  > 1 ? width  / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, page->num_levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    r_texture_set_size(page->tex, total);
+    kv_push(struct tex_page*, s_pages, page);
+    return page;
+}
+
+/* Takes a free layer of an array holding images like the one described, 
+ * adding a new array when they are all full */
+static struct tex_page *r_texture_page_alloc(const struct tex_image *desc, int *out_layer)
+{
+    for(int i = 0; i < kv_size(s_pages); i++) {
+
+        struct tex_page *page = kv_A(s_pages, i);
+        if(page->compressed != desc->compressed
+        || page->internal_format != desc->internal_format
+        || page->width != desc->width
+        || page->height != desc->height
+        || page->num_levels != desc->num_levels)
+            continue;
+
+        for(int j = 0; j < page->num_layers; j++) {
+            if(!(page->used & (1ull << j))) {
+                page->used |= (1ull << j);
+                *out_layer = j;
+                return page;
+            }
+        }
+    }
+
+    struct tex_page *page = r_texture_page_new(desc);
+    if(!page)
+        return NULL;
+
+    page->used = 1;
+    *out_layer = 0;
+    return page;
+}
+
+/* Keeps the image that is still on its' way from being uploaded */
+static void r_texture_cancel_jobs(GLuint tex, int layer)
+{
+    for(int i = 0; i < kv_size(s_jobs); i++) {
+
+        struct tex_job *job = kv_A(s_jobs, i);
+        if(job->tex == tex && job->layer == layer)
+            job->cancelled = true;
+    }
+}
+
+static void r_texture_page_release(struct tex_page *page, int layer)
+{
+    r_texture_cancel_jobs(page->tex, layer);
+    page->used &= ~(1ull << layer);
+    if(page->used)
+        return;
+
+    for(int i = 0; i < kv_size(s_pages); i++) {
+        if(kv_A(s_pages, i) == page) {
+            kv_del(struct tex_page*, s_pages, i);
+            break;
+        }
+    }
+    r_texture_delete(page->tex);
+    free(page);
+}
+
+static struct texture_resource *r_texture_alloc(khash_t(tex_name) *table, const char *name, GLuint id)
+{
+    /* A texture added under a name that's already taken replaces the old 
+     * one in its' slot, which keeps the references to the name */
+    khiter_t k = kh_get(tex_name, table, name);
+    if(k != kh_end(table)) {
+
+        struct texture_resource *old = &s_tex_resources[kh_value(table, k)];
+        HR_Unwatch(old);
+
+        if(old->page) {
+            r_texture_page_release(old->page, old->layer);
+        }else if(old->texture_id != id) {
+            r_texture_cancel_jobs(old->texture_id, 0);
+            r_texture_delete(old->texture_id);
+        }
+
+        old->texture_id = id;
+        old->refcount++;
+        old->page = NULL;
+        old->layer = 0;
+        return old;
+    }
+
+    if(!s_free_head)
+        return NULL;
+
+    struct texture_resource *alloc = s_free_head;
+    s_free_head = alloc->next_free;
+    if(s_free_head)
+        s_free_head->prev_free = NULL;
+
+    assert( strlen(name) < MAX_TEX_NAME_LEN );
+    strcpy(alloc->name, name);
+    alloc->texture_id = id;
+    alloc->refcount = 1;
+    alloc->free = false;
+    alloc->page = NULL;
+    alloc->layer = 0;
 
+    int status;
+    k = kh_put(tex_name, table, alloc->name, &status);
+    if(status == -1) {
+        alloc->free = true;
+        alloc->next_free = s_free_head;
+        s_free_head = alloc;
+        return NULL;
+    }
+
+    kh_value(table, k) = alloc - s_tex_resources;
+    return alloc;
+}
+
+static struct texture_resource *r_texture_find(khash_t(tex_name) *table, const char *name)
+{
+    khiter_t k = kh_get(tex_name, table, name);
+    if(k == kh_end(table))
+        return NULL;
+    return &s_tex_resources[kh_value(table, k)];
+}
+
+/* Returns the resource to the free list, once its' texture is deleted */
+static void r_texture_release(khash_t(tex_name) *table, struct texture_resource *res)
+{
+    kh_del(tex_name, table, kh_get(tex_name, table, res->name));
+    res->name[0] = '\0';
+    res->free = true;
+
+    struct texture_resource *tmp = s_free_head;
+    s_free_head = res;
+    s_free_head->next_free = tmp;
+    s_free_head->prev_free = NULL;
+    if(tmp)
+        tmp->prev_free = s_free_head;
+}
+
+static int r_texture_worker(void *unused)
+{
+    SDL_LockMutex(s_lock);
+    while(true) {
+
+        struct tex_job *job;
+        while(!s_quit && queue_pop(s_job_queue, &job) != 0)
+            SDL_CondWait(s_work_cond, s_lock);
+
+        if(s_quit)
+            break;
+
+        assert(job->state == JOB_QUEUED);
+        job->state = JOB_RUNNING;
+        SDL_UnlockMutex(s_lock);
+
+        r_texture_decode_job(job);
+
+        SDL_LockMutex(s_lock);
+        job->state = JOB_DONE;
+        SDL_CondBroadcast(s_done_cond);
+    }
+    SDL_UnlockMutex(s_lock);
+    return 0;
+}
+
+/* Uploads the finished jobs in submission order, until 'budget' bytes have 
+ * been uploaded. If 'wait' is set, blocks until all the jobs are done and 
+ * uploads them all. */
+static void r_texture_service(size_t budget, bool wait)
+{
+    size_t uploaded = 0;
+    size_t num_left = 0;
+
+    for(int i = 0; i < kv_size(s_jobs); i++) {
+
+        struct tex_job *job = kv_A(s_jobs, i);
+
+        SDL_LockMutex(s_lock);
+        while(wait && job->state != JOB_DONE)
+            SDL_CondWait(s_done_cond, s_lock);
+        bool done = (job->state == JOB_DONE);
+        SDL_UnlockMutex(s_lock);
+
+        if(!done || (uploaded >= budget && !wait)) {
+            kv_A(s_jobs, num_left++) = job;
+            continue;
+        }
+
+        if(job->ok && !job->cancelled && job->page && !r_texture_page_fits(job->page, &job->img)) {
+            fprintf(stderr, "Texture does not match its' array: %s\n", job->path);
+        }else if(job->ok && !job->cancelled) {
+            if(job->page)
+                r_texture_upload_layer(job->page, job->layer, &job->img);
+            else
+                r_texture_upload(job->tex, &job->img);
+            uploaded += job->img.size;
+        }else if(!job->ok) {
+            fprintf(stderr, "Failed to decode texture: %s\n", job->path);
+        }
+
+        if(job->ok)
+            r_texture_image_free(&job->img);
+        free(job);
+    }
+    kv_size(s_jobs) = num_left;
+}
+
+static bool r_texture_exists(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file)
+        return false;
+    fclose(file);
+    return true;
+}
+
+/* Picks the file to load the texture from, preferring a precompressed '.dds' 
+ * file with the same name when the GPU supports it. In that case, 'path' 
+ * itself is written to 'out_fallback', or an empty string otherwise. */
+static bool r_texture_resolve(const char *path, char *out, char *out_fallback, size_t out_size)
+{
+    if(!strlen(path) || strlen(path) >= out_size)
+        return false;
+
+    const char *ext = strrchr(path, '.');
+    size_t stem_len = ext ? ext - path : strlen(path);
+    bool exists = r_texture_exists(path);
+    out_fallback[0] = '\0';
+
+    if(GLEW_EXT_texture_compression_s3tc && stem_len + sizeof(".dds") <= out_size) {
+
+        memcpy(out, path, stem_len);
+        strcpy(out + stem_len, ".dds");
+        if(r_texture_exists(out)) {
+            if(exists && strcmp(out, path))
+                strcpy(out_fallback, path);
+            return true;
+        }
+    }
+
+    strcpy(out, path);
+    return exists;
+}
+
+static void r_texture_submit(struct tex_job *job)
+{
+    kv_push(struct tex_job*, s_jobs, job);
+
+    SDL_LockMutex(s_lock);
+    bool queued = (queue_push(s_job_queue, &job) == 0);
+    if(queued)
+        SDL_CondSignal(s_work_cond);
+    SDL_UnlockMutex(s_lock);
+
+    /* Fall back to decoding the image on this thread */
+    if(!queued) {
+        r_texture_decode_job(job);
+        job->state = JOB_DONE;
+    }
+}
+
+/* The file that the image is read from is written to 'out_path', which must
+ * hold 512 characters */
+static bool r_texture_gl_init(const char *path, GLuint *out, char *out_path)
+{
+    struct tex_job *job = malloc(sizeof(struct tex_job));
+    if(!job)
+        return false;
+
+    *job = (struct tex_job){ .state = JOB_QUEUED };
+    if(!r_texture_resolve(path, job->path, job->fallback, sizeof(job->path)))
+        goto fail;
+    strcpy(out_path, job->path);
+
+    /* Without the workers, the image is decoded right away */
+    if(!s_running) {
+        r_texture_decode_job(job);
+        if(!job->ok)
+            goto fail;
+    }
+
+    GLuint ret;
     glActiveTexture(GL_TEXTURE1);
     glGenTextures(1, &ret);
     glBindTexture(GL_TEXTURE_2D, ret);
@@ -83,24 +979,201 @@ static bool r_texture_gl_init(const char *path, GLuint *out)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
-    if(nr_channels != 3 && nr_channels != 4)
-        goto fail_format;
+    if(!s_running) {
+        r_texture_upload(ret, &job->img);
+        r_texture_image_free(&job->img);
+        free(job);
+        *out = ret;
+        return true;
+    }
+
+    /* Until the image is uploaded, the texture is a single grey texel */
+    const unsigned char placeholder[4] = {128, 128, 128, 255};
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+    r_texture_set_size(ret, sizeof(placeholder));
 
-    GLint format = (nr_channels == 3) ? GL_RGB :
-                                        GL_RGBA;
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    job->tex = ret;
+    r_texture_submit(job);
 
-    stbi_image_free(data);
     *out = ret;
     return true;
 
-fail_format:
-    stbi_image_free(data);
-fail_load:
+fail:
+    free(job);
     return false;
 }
 
+/* The array and layer are picked from the size and format in the file's 
+ * header, so that the image can still be decoded on the workers */
+static bool r_texture_gl_init_packed(const char *path, struct tex_page **out_page, 
+                                     int *out_layer, char *out_path)
+{
+    struct tex_job *job = malloc(sizeof(struct tex_job));
+    if(!job)
+        return false;
+
+    *job = (struct tex_job){ .state = JOB_QUEUED };
+    if(!r_texture_resolve(path, job->path, job->fallback, sizeof(job->path)))
+        goto fail;
+
+    /* The fallback is decoded in place of a file that can't be read, rather
+     * than risk it not fitting the layer */
+    struct tex_image desc;
+    if(!r_texture_probe(job->path, &desc)) {
+        if(!strlen(job->fallback) || !r_texture_probe(job->fallback, &desc))
+            goto fail;
+        strcpy(job->path, job->fallback);
+    }
+    job->fallback[0] = '\0';
+    strcpy(out_path, job->path);
+
+    int layer;
+    struct tex_page *page = r_texture_page_alloc(&desc, &layer);
+    if(!page)
+        goto fail;
+
+    job->tex = page->tex;
+    job->page = page;
+    job->layer = layer;
+    *out_page = page;
+    *out_layer = layer;
+
+    if(!s_running) {
+
+        r_texture_decode_job(job);
+        if(job->ok && r_texture_page_fits(page, &job->img)) {
+            r_texture_upload_layer(page, layer, &job->img);
+        }else{
+            fprintf(stderr, "Failed to decode texture: %s\n", job->path);
+            r_texture_page_clear(page, layer);
+        }
+
+        if(job->ok)
+            r_texture_image_free(&job->img);
+        free(job);
+        return true;
+    }
+
+    r_texture_page_clear(page, layer);
+    r_texture_submit(job);
+    return true;
+
+fail:
+    free(job);
+    return false;
+}
+
+/* The texture is looked for next to the model first, and then with the map
+ * textures. Both paths must hold 512 characters. */
+static void r_texture_paths(const char *basedir, const char *name, char *out, char *out_maps)
+{
+    if(basedir) {
+    
+        assert( strlen(basedir) + strlen(name) < 512 );
+
+        strcpy(out, basedir);
+        strcat(out, "/");
+        strcat(out, name);
+    }else{
+        out[0] = '\0';
+    }
+
+    extern const char *g_basepath;
+    strcpy(out_maps, g_basepath);
+    strcat(out_maps, "assets/map_textures/");
+    strcat(out_maps, name);
+}
+
+static void r_texture_hr_free(void *data)
+{
+    r_texture_image_free(data);
+    free(data);
+}
+
+/* Runs on the hot reloading thread */
+static void *r_texture_hr_load(void *user, const char *path)
+{
+    (void)user;
+
+    struct tex_image *img = malloc(sizeof(struct tex_image));
+    if(!img)
+        return NULL;
+
+    if(!r_texture_decode(path, img)) {
+        free(img);
+        return NULL;
+    }
+    return img;
+}
+
+/* The image is uploaded to the same texture object, so everything that 
+ * references the texture picks up the change */
+static bool r_texture_hr_apply(void *user, void *data)
+{
+    struct texture_resource *res = user;
+
+    /* The image of the first load must not be uploaded over the new one */
+    r_texture_cancel_jobs(res->texture_id, res->layer);
+
+    /* The other layers of the array are left as they are */
+    bool ret = true;
+    if(!res->page) {
+        r_texture_upload(res->texture_id, data);
+    }else if(r_texture_page_fits(res->page, data)) {
+        r_texture_upload_layer(res->page, res->layer, data);
+    }else{
+        fprintf(stderr, "Reloaded texture does not match its' array: %s\n", res->name);
+        ret = false;
+    }
+
+    r_texture_hr_free(data);
+    return ret;
+}
+
+static void r_texture_init_workers(void)
+{
+    if(NULL == (s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(NULL == (s_work_cond = SDL_CreateCond()))
+        goto fail_work_cond;
+    if(NULL == (s_done_cond = SDL_CreateCond()))
+        goto fail_done_cond;
+    if(NULL == (s_job_queue = queue_init_bounded(sizeof(struct tex_job*), MAX_QUEUED_JOBS)))
+        goto fail_queue;
+
+    s_num_workers = SDL_GetCPUCount() - 1;
+    s_num_workers = s_num_workers < 1           ? 1 
+                  : s_num_workers > MAX_WORKERS ? MAX_WORKERS 
+                  : s_num_workers;
+    s_quit = false;
+
+    for(int i = 0; i < s_num_workers; i++) {
+        s_workers[i] = SDL_CreateThread(r_texture_worker, "tex_worker", NULL);
+        if(!s_workers[i]) {
+            s_num_workers = i;
+            break;
+        }
+    }
+    if(s_num_workers == 0)
+        goto fail_threads;
+
+    glGenBuffers(1, &s_pbo);
+    kv_init(s_jobs);
+    s_running = true;
+    return;
+
+fail_threads:
+    queue_free(s_job_queue);
+fail_queue:
+    SDL_DestroyCond(s_done_cond);
+fail_done_cond:
+    SDL_DestroyCond(s_work_cond);
+fail_work_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    return;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -122,137 +1195,255 @@ void R_Texture_Init(void)
             next->prev_free = res;
         }
     }
+
+    s_name_table = kh_init(tex_name);
+    s_packed_table = kh_init(tex_name);
+    s_size_table = kh_init(tex_size);
+    kv_init(s_pages);
+    r_texture_init_workers();
 }
 
-bool R_Texture_GetForName(const char *name, GLuint *out)
+void R_Texture_Shutdown(void)
 {
-    for(int i = 0; i < MAX_NUM_TEXTURE; i++) {
+    if(!s_running)
+        return;
 
-        struct texture_resource *curr = &s_tex_resources[i];
+    SDL_LockMutex(s_lock);
+    s_quit = true;
+    SDL_CondBroadcast(s_work_cond);
+    SDL_UnlockMutex(s_lock);
 
-        if(!strcmp(name, curr->name) && !curr->free) {
-            *out = curr->texture_id;
-            return true;
-        }
+    for(int i = 0; i < s_num_workers; i++)
+        SDL_WaitThread(s_workers[i], NULL);
+
+    for(int i = 0; i < kv_size(s_jobs); i++) {
+
+        struct tex_job *job = kv_A(s_jobs, i);
+        if(job->state == JOB_DONE && job->ok)
+            r_texture_image_free(&job->img);
+        free(job);
     }
 
-    return false;
+    kv_destroy(s_jobs);
+    glDeleteBuffers(1, &s_pbo);
+    queue_free(s_job_queue);
+    SDL_DestroyCond(s_done_cond);
+    SDL_DestroyCond(s_work_cond);
+    SDL_DestroyMutex(s_lock);
+    s_running = false;
 }
 
-bool R_Texture_Load(const char *basedir, const char *name, GLuint *out)
+void R_Texture_Update(void)
 {
-    if(!s_free_head)
-        return false;
+    if(s_running)
+        r_texture_service(UPLOAD_BUDGET, false);
+}
 
-    struct texture_resource *alloc = s_free_head;
-    alloc->free = false;
+void R_Texture_FinishLoads(void)
+{
+    R_Thread_Claim();
+    if(s_running)
+        r_texture_service(0, true);
+}
 
-    s_free_head = alloc->next_free;
-    if(s_free_head)
-        s_free_head->prev_free = NULL;
+bool R_Texture_LoadsPending(void)
+{
+    return (kv_size(s_jobs) > 0);
+}
 
-    assert( strlen(name) < MAX_TEX_NAME_LEN );
-    strcpy(alloc->name, name);
+bool R_Texture_GetForName(const char *name, GLuint *out)
+{
+    R_Thread_Claim();
 
-    char texture_path[512], texture_path_maps[512];
+    struct texture_resource *res = r_texture_find(s_name_table, name);
+    if(!res)
+        return false;
 
-    if(basedir) {
-    
-        assert( strlen(basedir) + strlen(name) < sizeof(texture_path) );
+    res->refcount++;
+    *out = res->texture_id;
+    return true;
+}
 
-        strcpy(texture_path, basedir);
-        strcat(texture_path, "/");
-        strcat(texture_path, name);
-    }else{
-        texture_path[0] = '\0';
-    }
+bool R_Texture_Load(const char *basedir, const char *name, GLuint *out)
+{
+    R_Thread_Claim();
 
-    extern const char *g_basepath;
-    strcpy(texture_path_maps, g_basepath);
-    strcat(texture_path_maps, "assets/map_textures/");
-    strcat(texture_path_maps, name);
+    if(!s_free_head)
+        return false;
+
+    char texture_path[512], texture_path_maps[512];
+    r_texture_paths(basedir, name, texture_path, texture_path_maps);
 
     GLuint ret;
-    if(!r_texture_gl_init(texture_path, &ret)
-    && !r_texture_gl_init(texture_path_maps, &ret))
+    char file_path[512];
+    if(!r_texture_gl_init(texture_path, &ret, file_path)
+    && !r_texture_gl_init(texture_path_maps, &ret, file_path))
         goto fail;
 
-    alloc->texture_id = ret;
-    *out = ret;
+    struct texture_resource *res = r_texture_alloc(s_name_table, name, ret);
+    if(!res)
+        goto fail_alloc;
 
+    HR_Watch(file_path, r_texture_hr_load, r_texture_hr_apply, r_texture_hr_free, res);
+    *out = ret;
     return true;
 
+fail_alloc:
+    r_texture_delete(ret);
 fail:
     return false;
 }
 
 bool R_Texture_AddExisting(const char *name, GLuint id)
 {
-    if(!s_free_head)
-        return false;
+    R_Thread_Claim();
+    return (r_texture_alloc(s_name_table, name, id) != NULL);
+}
 
-    struct texture_resource *alloc = s_free_head;
-    alloc->free = false;
+void R_Texture_Free(const char *name)
+{
+    R_Thread_Claim();
 
-    s_free_head = alloc->next_free;
-    if(s_free_head)
-        s_free_head->prev_free = NULL;
+    struct texture_resource *curr = r_texture_find(s_name_table, name);
+    if(!curr || --curr->refcount > 0)
+        return;
 
-    assert( strlen(name) < MAX_TEX_NAME_LEN );
-    strcpy(alloc->name, name);
+    HR_Unwatch(curr);
 
-    alloc->texture_id = id;
-    return true;
+    /* The image may still be on its' way */
+    r_texture_cancel_jobs(curr->texture_id, 0);
+    r_texture_delete(curr->texture_id);
+    r_texture_release(s_name_table, curr);
 }
 
-void R_Texture_Free(const char *name)
+bool R_Texture_LoadPacked(const char *basedir, const char *name, struct texture *out)
 {
-    for(int i = 0; i < MAX_NUM_TEXTURE - 1; i++) {
+    R_Thread_Claim();
 
-        struct texture_resource *curr = &s_tex_resources[i];
+    struct texture_resource *res = r_texture_find(s_packed_table, name);
+    if(res) {
+        res->refcount++;
+        goto out;
+    }
 
-        if(!strcmp(name, curr->name) && !curr->free) {
+    if(!s_free_head)
+        return false;
 
-            glDeleteTextures(1, &curr->texture_id);
-            curr->free = true;
+    char texture_path[512], texture_path_maps[512];
+    r_texture_paths(basedir, name, texture_path, texture_path_maps);
 
-            struct texture_resource *tmp = s_free_head;
-            s_free_head = curr;
-            s_free_head->next_free = tmp;
-            if(tmp)
-                tmp->prev_free = s_free_head;
-            break;
-        }
+    struct tex_page *page;
+    int layer;
+    char file_path[512];
+    if(!r_texture_gl_init_packed(texture_path, &page, &layer, file_path)
+    && !r_texture_gl_init_packed(texture_path_maps, &page, &layer, file_path))
+        return false;
+
+    res = r_texture_alloc(s_packed_table, name, page->tex);
+    if(!res) {
+        r_texture_page_release(page, layer);
+        return false;
     }
+    res->page = page;
+    res->layer = layer;
+    HR_Watch(file_path, r_texture_hr_load, r_texture_hr_apply, r_texture_hr_free, res);
+
+out:
+    out->id = res->texture_id;
+    out->packed = true;
+    out->layer = res->layer;
+    return true;
+}
+
+void R_Texture_FreePacked(const char *name)
+{
+    R_Thread_Claim();
+
+    struct texture_resource *curr = r_texture_find(s_packed_table, name);
+    if(!curr || --curr->refcount > 0)
+        return;
+
+    HR_Unwatch(curr);
+    r_texture_page_release(curr->page, curr->layer);
+    r_texture_release(s_packed_table, curr);
 }
 
 void R_Texture_GL_Activate(const struct texture *text, GLuint shader_prog)
 {
     GLuint sampler_loc;
 
-    switch(text->tunit) {
-    case GL_TEXTURE0: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE0); break;
-    case GL_TEXTURE1: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE1); break;
-    case GL_TEXTURE2: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE2); break;
-    case GL_TEXTURE3: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE3); break;
-    case GL_TEXTURE4: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE4); break;
-    case GL_TEXTURE5: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE5); break;
-    case GL_TEXTURE6: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE6); break;
-    case GL_TEXTURE7: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE7); break;
-    case GL_TEXTURE8: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE8); break;
-    case GL_TEXTURE9: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE9); break;
-    case GL_TEXTURE10: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE10); break;
-    case GL_TEXTURE11: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE11); break;
-    case GL_TEXTURE12: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE12); break;
-    case GL_TEXTURE13: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE13); break;
-    case GL_TEXTURE14: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE14); break;
-    case GL_TEXTURE15: sampler_loc = glGetUniformLocation(shader_prog, GL_U_TEXTURE15); break;
-
-    default: assert(0);
-    }
+    assert(text->tunit >= GL_TEXTURE0 && text->tunit <= GL_TEXTURE15);
+    sampler_loc = R_Shader_UniformLoc(shader_prog, SU_TEXTURE0 + (text->tunit - GL_TEXTURE0));
 
     glActiveTexture(text->tunit);
-    glBindTexture(GL_TEXTURE_2D, text->id);
+    glBindTexture(text->packed ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D, text->id);
+    R_GL_StatsTextureBind();
     glUniform1i(sampler_loc, text->tunit - GL_TEXTURE0);
 }
 
+bool R_Texture_MakeArray(const GLuint *textures, size_t count, GLuint *out)
+{
+    /* The layers are copied from the textures' current contents */
+    R_Texture_FinishLoads();
+
+    GLint width, height;
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,  &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+    /* The layers of an array all have the same size */
+    for(int i = 1; i < count; i++) {
+
+        GLint layer_width, layer_height;
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,  &layer_width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &layer_height);
+
+        if(layer_width != width || layer_height != height)
+            goto fail;
+    }
+
+    unsigned char *data = malloc(width * height * 4);
+    if(!data)
+        goto fail;
+
+    GLuint ret;
+    glGenTextures(1, &ret);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, ret);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, count, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    for(int i = 0; i < count; i++) {
+
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    }
+    free(data);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    r_texture_set_size(ret, (size_t)width * height * 4 * count);
+    glActiveTexture(GL_TEXTURE0);
+    *out = ret;
+    return true;
+
+fail:
+    glActiveTexture(GL_TEXTURE0);
+    return false;
+}
+
+void R_Texture_FreeArray(GLuint tex)
+{
+    R_Thread_Claim();
+    r_texture_delete(tex);
+}
+
+void R_Texture_SetGPUSize(GLuint tex, size_t bytes)
+{
+    R_Thread_Claim();
+    r_texture_set_size(tex, bytes);
+}
@@ -37,18 +37,85 @@
 #define TEXTURE_H
 
 #include <GL/glew.h>
+#include <stddef.h>
 #include <stdbool.h>
 
 struct texture{
     GLuint id;
     GLuint tunit;
+    /* Set for the textures loaded with 'R_Texture_LoadPacked', in which case 
+     * 'id' is a GL_TEXTURE_2D_ARRAY and the image is at 'layer' */
+    bool   packed;
+    GLint  layer;
 };
 
 void R_Texture_Init(void);
+void R_Texture_Shutdown(void);
+
+/* ------------------------------------------------------------------------
+ * Textures are looked up by name and reference counted. Every successful 
+ * call to 'R_Texture_GetForName', 'R_Texture_Load' or 'R_Texture_AddExisting' 
+ * takes a reference, which is dropped with 'R_Texture_Free'. The texture is
+ * deleted along with its' last reference. Adding a texture under a name
+ * that is already taken makes the name refer to the new texture.
+ * ------------------------------------------------------------------------
+ */
 bool R_Texture_GetForName(const char *name, GLuint *out);
 bool R_Texture_Load(const char *basedir, const char *name, GLuint *out);
 bool R_Texture_AddExisting(const char *name, GLuint id);
 void R_Texture_Free(const char *name);
 void R_Texture_GL_Activate(const struct texture *text, GLuint shader_prog);
 
+/* ------------------------------------------------------------------------
+ * Loads the image into a layer of a GL_TEXTURE_2D_ARRAY shared with the 
+ * other packed images of the same size and format, so that the objects 
+ * using them can be drawn without binding different textures in between. 
+ * The packed textures are looked up and counted separately from the rest, 
+ * and the reference is dropped with 'R_Texture_FreePacked'. The texture
+ * unit is left for the caller to set.
+ * ------------------------------------------------------------------------
+ */
+bool R_Texture_LoadPacked(const char *basedir, const char *name, struct texture *out);
+void R_Texture_FreePacked(const char *name);
+
+/* ------------------------------------------------------------------------
+ * Images are decoded on worker threads after 'R_Texture_Load' returns, and
+ * the texture holds a single grey texel until its' image is uploaded. Where
+ * it exists and is supported, a '.dds' file with the same name holding a 
+ * DXT-compressed image and its' mip levels is loaded instead of the named 
+ * file.
+ *
+ * 'R_Texture_Update' uploads the decoded images, a few megabytes' worth at
+ * a time. It should be called once per frame. 'R_Texture_FinishLoads' 
+ * waits for all the pending images and uploads them. It must be called 
+ * before reading back or rendering with the textures' final contents.
+ * ------------------------------------------------------------------------
+ */
+void R_Texture_Update(void);
+void R_Texture_FinishLoads(void);
+
+/* ------------------------------------------------------------------------
+ * Whether any of the loaded images have yet to be uploaded.
+ * ------------------------------------------------------------------------
+ */
+bool R_Texture_LoadsPending(void);
+
+/* ------------------------------------------------------------------------
+ * Copies the textures into the layers of a new GL_TEXTURE_2D_ARRAY, in
+ * order. Fails if the textures are not all of the same size. The array is
+ * deleted with 'R_Texture_FreeArray'.
+ * ------------------------------------------------------------------------
+ */
+bool R_Texture_MakeArray(const GLuint *textures, size_t count, GLuint *out);
+void R_Texture_FreeArray(GLuint tex);
+
+/* ------------------------------------------------------------------------
+ * Sets the size that the texture is counted with in the GPU memory stats
+ * (see 'MEM_GetStats'). Textures that are loaded or made here are counted
+ * already - this is for the ones that are rendered to and then handed to
+ * 'R_Texture_AddExisting'. The count is dropped once the texture is deleted.
+ * ------------------------------------------------------------------------
+ */
+void R_Texture_SetGPUSize(GLuint tex, size_t bytes);
+
 #endif
@@ -0,0 +1,267 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "vertex.h"
+
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/* The members shared by all the layouts */
+#define PACK_COMMON(in, out)                                        \
+    do{                                                             \
+        (out)->pos = (in)->pos;                                     \
+        (out)->uv = (in)->uv;                                       \
+        (out)->normal = vert_pack_normal((in)->normal);             \
+        (out)->material_idx = vert_clamp_ubyte((in)->material_idx); \
+    }while(0)
+
+#define UNPACK_COMMON(in, out)                                      \
+    do{                                                             \
+        memset((out), 0, sizeof(*(out)));                           \
+        (out)->pos = (in)->pos;                                     \
+        (out)->uv = (in)->uv;                                       \
+        (out)->normal = vert_unpack_normal((in)->normal);           \
+        (out)->material_idx = (in)->material_idx;                   \
+    }while(0)
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static GLubyte vert_clamp_ubyte(GLint val)
+{
+    assert(val >= 0 && val <= UINT8_MAX);
+    return val < 0 ? 0 : val > UINT8_MAX ? UINT8_MAX : val;
+}
+
+static GLuint vert_pack_snorm10(float val)
+{
+    val = val < -1.0f ? -1.0f : val > 1.0f ? 1.0f : val;
+    return ((GLuint)(GLint)roundf(val * 511.0f)) & 0x3ff;
+}
+
+static float vert_unpack_snorm10(GLuint bits)
+{
+    /* Sign-extend the 10-bit value */
+    GLint val = (GLint)(bits << 22) >> 22;
+    float ret = val / 511.0f;
+    return ret < -1.0f ? -1.0f : ret;
+}
+
+static GLuint vert_pack_normal(vec3_t normal)
+{
+    return (vert_pack_snorm10(normal.x) <<  0)
+         | (vert_pack_snorm10(normal.y) << 10)
+         | (vert_pack_snorm10(normal.z) << 20);
+}
+
+static vec3_t vert_unpack_normal(GLuint packed)
+{
+    return (vec3_t){
+        vert_unpack_snorm10((packed >>  0) & 0x3ff),
+        vert_unpack_snorm10((packed >> 10) & 0x3ff),
+        vert_unpack_snorm10((packed >> 20) & 0x3ff),
+    };
+}
+
+static GLushort vert_pack_unorm16(float val)
+{
+    val = val < 0.0f ? 0.0f : val > 1.0f ? 1.0f : val;
+    return (GLushort)(val * UINT16_MAX + 0.5f);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+enum vert_layout R_Vert_LayoutForShader(const char *shader)
+{
+    if(0 == strcmp("mesh.animated.textured-phong", shader))
+        return VERT_LAYOUT_SKINNED;
+    if(0 == strcmp("terrain", shader))
+        return VERT_LAYOUT_TERRAIN;
+    return VERT_LAYOUT_STATIC;
+}
+
+size_t R_Vert_Size(enum vert_layout layout)
+{
+    switch(layout) {
+    case VERT_LAYOUT_STATIC:  return sizeof(struct static_vert);
+    case VERT_LAYOUT_SKINNED: return sizeof(struct skinned_vert);
+    case VERT_LAYOUT_TERRAIN: return sizeof(struct terrain_vert);
+    default: assert(0); return 0;
+    }
+}
+
+void R_Vert_Pack(enum vert_layout layout, const struct vertex *in, void *out, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+
+        const struct vertex *src = &in[i];
+        switch(layout) {
+        case VERT_LAYOUT_STATIC: {
+
+            struct static_vert *dst = (struct static_vert*)out + i;
+            memset(dst, 0, sizeof(*dst));
+            PACK_COMMON(src, dst);
+            break;
+        }
+        case VERT_LAYOUT_SKINNED: {
+
+            struct skinned_vert *dst = (struct skinned_vert*)out + i;
+            memset(dst, 0, sizeof(*dst));
+            PACK_COMMON(src, dst);
+            for(int j = 0; j < 6; j++) {
+                dst->joint_indices[j] = vert_clamp_ubyte(src->joint_indices[j]);
+                dst->weights[j] = vert_pack_unorm16(src->weights[j]);
+            }
+            break;
+        }
+        case VERT_LAYOUT_TERRAIN: {
+
+            struct terrain_vert *dst = (struct terrain_vert*)out + i;
+            memset(dst, 0, sizeof(*dst));
+            PACK_COMMON(src, dst);
+            dst->blend_mode = vert_clamp_ubyte(src->blend_mode);
+            memcpy(dst->adjacent_mat_indices, src->adjacent_mat_indices, sizeof(dst->adjacent_mat_indices));
+            break;
+        }
+        default: assert(0);
+        }
+    }
+}
+
+void R_Vert_Unpack(enum vert_layout layout, const void *in, struct vertex *out, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+
+        struct vertex *dst = &out[i];
+        switch(layout) {
+        case VERT_LAYOUT_STATIC: {
+
+            const struct static_vert *src = (const struct static_vert*)in + i;
+            UNPACK_COMMON(src, dst);
+            break;
+        }
+        case VERT_LAYOUT_SKINNED: {
+
+            const struct skinned_vert *src = (const struct skinned_vert*)in + i;
+            UNPACK_COMMON(src, dst);
+            for(int j = 0; j < 6; j++) {
+                dst->joint_indices[j] = src->joint_indices[j];
+                dst->weights[j] = src->weights[j] / (float)UINT16_MAX;
+            }
+            break;
+        }
+        case VERT_LAYOUT_TERRAIN: {
+
+            const struct terrain_vert *src = (const struct terrain_vert*)in + i;
+            UNPACK_COMMON(src, dst);
+            dst->blend_mode = src->blend_mode;
+            memcpy(dst->adjacent_mat_indices, src->adjacent_mat_indices, sizeof(dst->adjacent_mat_indices));
+            break;
+        }
+        default: assert(0);
+        }
+    }
+}
+
+/* The headless build links no GL, and has no vertex arrays to set up */
+#if !defined(PF_HEADLESS)
+
+void R_Vert_SetAttribs(enum vert_layout layout)
+{
+    GLsizei stride = R_Vert_Size(layout);
+
+    assert(offsetof(struct skinned_vert, material_idx) == offsetof(struct static_vert, material_idx));
+    assert(offsetof(struct terrain_vert, material_idx) == offsetof(struct static_vert, material_idx));
+
+    /* Attribute 0 - position */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
+    glEnableVertexAttribArray(0);
+
+    /* Attribute 1 - texture coordinates */
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, 
+        (void*)offsetof(struct static_vert, uv));
+    glEnableVertexAttribArray(1);
+
+    /* Attribute 2 - normal */
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, 
+        (void*)offsetof(struct static_vert, normal));
+    glEnableVertexAttribArray(2);
+
+    /* Attribute 3 - material index */
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, stride, 
+        (void*)offsetof(struct static_vert, material_idx));
+    glEnableVertexAttribArray(3);
+
+    if(layout == VERT_LAYOUT_SKINNED) {
+
+        /* Here, we use 2 attributes to pass in an array of size 6 since we are 
+         * limited to a maximum of 4 components per attribute. */
+
+        /* Attribute 4/5 - joint indices */
+        glVertexAttribPointer(4, 3, GL_UNSIGNED_BYTE, GL_FALSE, stride,
+            (void*)offsetof(struct skinned_vert, joint_indices));
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(5, 3, GL_UNSIGNED_BYTE, GL_FALSE, stride,
+            (void*)(offsetof(struct skinned_vert, joint_indices) + 3*sizeof(GLubyte)));
+        glEnableVertexAttribArray(5);
+
+        /* Attribute 6/7 - weights */
+        glVertexAttribPointer(6, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+            (void*)offsetof(struct skinned_vert, weights));
+        glEnableVertexAttribArray(6);
+        glVertexAttribPointer(7, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+            (void*)(offsetof(struct skinned_vert, weights) + 3*sizeof(GLushort)));
+        glEnableVertexAttribArray(7);
+
+    }else if(layout == VERT_LAYOUT_TERRAIN) {
+
+        /* Attribute 4 - tile texture blend mode */
+        glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, stride, 
+            (void*)offsetof(struct terrain_vert, blend_mode));
+        glEnableVertexAttribArray(4);
+         
+        /* Attribute 5 - adjacent material indices */
+        glVertexAttribIPointer(5, 4, GL_INT, stride, 
+            (void*)offsetof(struct terrain_vert, adjacent_mat_indices));
+        glEnableVertexAttribArray(5);
+    }
+}
+
+#endif
+
@@ -36,8 +36,13 @@
 #ifndef VERTEX_H
 #define VERTEX_H
 
+#include "../pf_math.h"
+
 #include <GL/glew.h>
+#include <stddef.h>
 
+/* The unpacked vertex, used by the asset loading and tile mesh generation code. 
+ * Vertex buffers hold one of the compact layouts below instead. */
 struct vertex{
     vec3_t  pos;
     vec2_t  uv;
@@ -55,4 +60,69 @@ struct colored_vert{
     vec4_t color;
 };
 
+enum vert_layout{
+    VERT_LAYOUT_STATIC,
+    VERT_LAYOUT_SKINNED,
+    VERT_LAYOUT_TERRAIN,
+};
+
+/* All the layouts share the same leading members, so a buffer of any layout 
+ * can be drawn with a static shader given the right stride. UVs are kept as
+ * full floats since they are not bound to [0, 1] and need sub-texel precision.
+ * Normals are signed normalized GL_INT_2_10_10_10_REV. */
+
+struct static_vert{
+    vec3_t   pos;
+    vec2_t   uv;
+    GLuint   normal;
+    GLubyte  material_idx;
+    GLubyte  pad[3];
+};
+
+struct skinned_vert{
+    vec3_t   pos;
+    vec2_t   uv;
+    GLuint   normal;
+    GLubyte  material_idx;
+    GLubyte  pad[3];
+    GLubyte  joint_indices[6];
+    GLubyte  pad2[2];
+    /* Unsigned normalized */
+    GLushort weights[6];
+};
+
+struct terrain_vert{
+    vec3_t   pos;
+    vec2_t   uv;
+    GLuint   normal;
+    GLubyte  material_idx;
+    GLubyte  blend_mode;
+    GLubyte  pad[2];
+    /* Bitfields of 4-bit material indices */
+    GLint    adjacent_mat_indices[4];
+};
+
+/* ---------------------------------------------------------------------------
+ * The layout of the vertex buffers for meshes drawn with the shader program.
+ * ---------------------------------------------------------------------------
+ */
+enum vert_layout R_Vert_LayoutForShader(const char *shader);
+size_t           R_Vert_Size(enum vert_layout layout);
+
+/* ---------------------------------------------------------------------------
+ * Convert between unpacked vertices and the compact layout. Attributes 
+ * that the layout doesn't have are dropped when packing and zeroed when 
+ * unpacking.
+ * ---------------------------------------------------------------------------
+ */
+void             R_Vert_Pack(enum vert_layout layout, const struct vertex *in, void *out, size_t count);
+void             R_Vert_Unpack(enum vert_layout layout, const void *in, struct vertex *out, size_t count);
+
+/* ---------------------------------------------------------------------------
+ * Set up and enable the vertex attributes of the layout for the currently 
+ * bound VAO and GL_ARRAY_BUFFER.
+ * ---------------------------------------------------------------------------
+ */
+void             R_Vert_SetAttribs(enum vert_layout layout);
+
 #endif
@@ -0,0 +1,287 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#include "replay.h"
+#include "lib/public/kvec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define REPLAY_MAGIC    "PFRP"
+#define REPLAY_VERSION  (1)
+#define MAX_PATH_LEN    (512)
+
+/* The raw event structures are written out, so a recording can only be 
+ * played back by a build with the same layout of 'SDL_Event'. */
+struct replay_header{
+    char     magic[4];
+    uint32_t version;
+    uint32_t event_size;
+};
+
+struct frame_header{
+    uint32_t num_steps;
+    uint32_t num_events;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static FILE                  *s_record_file;
+
+static FILE                  *s_play_file;
+static char                   s_play_path[MAX_PATH_LEN];
+static kvec_t(SDL_Event)      s_play_events;
+static kvec_t(uint64_t)       s_step_ticks;
+static kvec_t(uint64_t)       s_update_ticks;
+static uint64_t               s_play_begin;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool replay_is_input(const SDL_Event *event)
+{
+    switch(event->type) {
+    case SDL_QUIT:
+    case SDL_WINDOWEVENT:
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_TEXTEDITING:
+    case SDL_TEXTINPUT:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEWHEEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int compare_ticks(const void *a, const void *b)
+{
+    uint64_t ta = *(const uint64_t*)a;
+    uint64_t tb = *(const uint64_t*)b;
+    return (ta > tb) - (ta < tb);
+}
+
+static double ticks_to_ms(uint64_t ticks)
+{
+    return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+/* Sorts the timings in place */
+static void replay_print_timings(const char *name, uint64_t *ticks, size_t count)
+{
+    if(count == 0)
+        return;
+
+    qsort(ticks, count, sizeof(uint64_t), compare_ticks);
+
+    uint64_t sum = 0;
+    for(int i = 0; i < count; i++)
+        sum += ticks[i];
+
+    printf("  %-6s (ms): mean %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f\n", name,
+        ticks_to_ms(sum) / count,
+        ticks_to_ms(ticks[count / 2]),
+        ticks_to_ms(ticks[(count * 95) / 100]),
+        ticks_to_ms(ticks[(count * 99) / 100]),
+        ticks_to_ms(ticks[count - 1]));
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Replay_StartRecording(const char *path)
+{
+    if(s_record_file || s_play_file)
+        return false;
+
+    s_record_file = fopen(path, "wb");
+    if(!s_record_file) {
+        fprintf(stderr, "Could not open '%s' for writing the recording.\n", path);
+        return false;
+    }
+
+    struct replay_header header = (struct replay_header){
+        .magic = REPLAY_MAGIC,
+        .version = REPLAY_VERSION,
+        .event_size = sizeof(SDL_Event)
+    };
+    if(1 != fwrite(&header, sizeof(header), 1, s_record_file)) {
+        Replay_StopRecording();
+        return false;
+    }
+    return true;
+}
+
+void Replay_StopRecording(void)
+{
+    if(!s_record_file)
+        return;
+
+    fclose(s_record_file);
+    s_record_file = NULL;
+}
+
+bool Replay_Recording(void)
+{
+    return (s_record_file != NULL);
+}
+
+void Replay_RecordFrame(const SDL_Event *events, size_t num_events, int num_steps)
+{
+    if(!s_record_file)
+        return;
+
+    struct frame_header header = (struct frame_header){ .num_steps = num_steps };
+    for(int i = 0; i < num_events; i++)
+        header.num_events += replay_is_input(&events[i]);
+
+    bool ok = (1 == fwrite(&header, sizeof(header), 1, s_record_file));
+    for(int i = 0; ok && i < num_events; i++) {
+
+        if(!replay_is_input(&events[i]))
+            continue;
+        ok = (1 == fwrite(&events[i], sizeof(SDL_Event), 1, s_record_file));
+    }
+
+    if(!ok) {
+        fprintf(stderr, "Failed to write the recording - stopping.\n");
+        Replay_StopRecording();
+    }
+}
+
+bool Replay_StartPlayback(const char *path)
+{
+    if(s_record_file || s_play_file)
+        return false;
+
+    s_play_file = fopen(path, "rb");
+    if(!s_play_file) {
+        fprintf(stderr, "Could not open the recording '%s'.\n", path);
+        return false;
+    }
+
+    struct replay_header header;
+    if(1 != fread(&header, sizeof(header), 1, s_play_file)
+    || memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic))
+    || header.version != REPLAY_VERSION
+    || header.event_size != sizeof(SDL_Event)) {
+
+        fprintf(stderr, "'%s' is not a recording made by this build.\n", path);
+        fclose(s_play_file);
+        s_play_file = NULL;
+        return false;
+    }
+
+    strncpy(s_play_path, path, sizeof(s_play_path));
+    s_play_path[sizeof(s_play_path)-1] = '\0';
+
+    kv_init(s_play_events);
+    kv_init(s_step_ticks);
+    kv_init(s_update_ticks);
+    s_play_begin = SDL_GetPerformanceCounter();
+    return true;
+}
+
+void Replay_StopPlayback(void)
+{
+    if(!s_play_file)
+        return;
+
+    uint64_t elapsed = SDL_GetPerformanceCounter() - s_play_begin;
+    printf("Replay of '%s': %zu frames, %zu simulation steps in %.3f s\n", s_play_path,
+        kv_size(s_update_ticks), kv_size(s_step_ticks), ticks_to_ms(elapsed) / 1000.0);
+    replay_print_timings("step", s_step_ticks.a, kv_size(s_step_ticks));
+    replay_print_timings("update", s_update_ticks.a, kv_size(s_update_ticks));
+    fflush(stdout);
+
+    kv_destroy(s_update_ticks);
+    kv_destroy(s_step_ticks);
+    kv_destroy(s_play_events);
+    fclose(s_play_file);
+    s_play_file = NULL;
+}
+
+bool Replay_Playing(void)
+{
+    return (s_play_file != NULL);
+}
+
+bool Replay_NextFrame(const SDL_Event **out_events, size_t *out_num_events, int *out_num_steps)
+{
+    assert(s_play_file);
+
+    struct frame_header header;
+    if(1 != fread(&header, sizeof(header), 1, s_play_file))
+        return false;
+
+    kv_reset(s_play_events);
+    if(header.num_events > 0) {
+
+        if(kv_max(s_play_events) < header.num_events
+        && !kv_resize(SDL_Event, s_play_events, header.num_events))
+            return false;
+
+        if(header.num_events != fread(s_play_events.a, sizeof(SDL_Event), header.num_events, s_play_file))
+            return false;
+        kv_size(s_play_events) = header.num_events;
+    }
+
+    *out_events = s_play_events.a;
+    *out_num_events = kv_size(s_play_events);
+    *out_num_steps = header.num_steps;
+    return true;
+}
+
+void Replay_LogStep(uint64_t ticks)
+{
+    kv_push(uint64_t, s_step_ticks, ticks);
+}
+
+void Replay_LogUpdate(uint64_t ticks)
+{
+    kv_push(uint64_t, s_update_ticks, ticks);
+}
+
@@ -0,0 +1,91 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <SDL.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A session is recorded as a sequence of frames: the input events handled at 
+ * the start of each frame and the number of simulation steps taken after them. 
+ * Playing the frames back drives the simulation through the same inputs and 
+ * steps, without rendering and as fast as possible. Only the input events are 
+ * recorded - the scripts are run again during playback and raise their own 
+ * events the same way. The recordings are only meant to be played back by the 
+ * same build of the engine. */
+
+/* ------------------------------------------------------------------------
+ * Start writing the frames passed to 'Replay_RecordFrame' to 'path'.
+ * ------------------------------------------------------------------------
+ */
+bool Replay_StartRecording(const char *path);
+void Replay_StopRecording(void);
+bool Replay_Recording(void);
+
+/* ------------------------------------------------------------------------
+ * Events which are not user input are skipped.
+ * ------------------------------------------------------------------------
+ */
+void Replay_RecordFrame(const SDL_Event *events, size_t num_events, int num_steps);
+
+/* ------------------------------------------------------------------------
+ * Playback only reads the recording. The per-step and per-frame timings are
+ * printed to stdout when it is stopped.
+ * ------------------------------------------------------------------------
+ */
+bool Replay_StartPlayback(const char *path);
+void Replay_StopPlayback(void);
+bool Replay_Playing(void);
+
+/* ------------------------------------------------------------------------
+ * Get the next recorded frame. The events stay valid until the next call. 
+ * Returns false once the end of the recording is reached.
+ * ------------------------------------------------------------------------
+ */
+bool Replay_NextFrame(const SDL_Event **out_events, size_t *out_num_events, int *out_num_steps);
+
+/* ------------------------------------------------------------------------
+ * Add the time, in performance counter ticks, taken by a simulation step or 
+ * by the per-frame update to the playback timings.
+ * ------------------------------------------------------------------------
+ */
+void Replay_LogStep(uint64_t ticks);
+void Replay_LogUpdate(uint64_t ticks);
+
+#endif
+
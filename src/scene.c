@@ -35,33 +35,140 @@
 
 #include "scene.h"
 #include "asset_load.h"
+#include "entity.h"
+#include "event.h"
+#include "game/public/game.h"
 #include "script/public/script.h"
+#include "lib/public/file_replace.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <SDL.h>
 #include <assert.h>
+#include <sys/stat.h>
+
+
+#define ARR_SIZE(a)         (sizeof(a)/sizeof(a[0]))
+
+#define PFSCENEB_MAGIC      (0x42534650) /* 'PFSB' */
+#define PFSCENEB_VERSION    (1)
+
+#define SCENE_PROP_POS      (1 << 0)
+#define SCENE_PROP_SCALE    (1 << 1)
+#define SCENE_PROP_ROT      (1 << 2)
+#define SCENE_PROP_RADIUS   (1 << 3)
+
+/* The entity flags which may be set from the scene attributes */
+#define SCENE_PROP_FLAGS    (ENTITY_FLAG_STATIC | ENTITY_FLAG_COLLISION | ENTITY_FLAG_SELECTABLE)
+
+struct scene_ent{
+    char            name[128];
+    char            path[256];
+    khash_t(attr)  *attr_table;
+    kvec_attr_t     constructor_args;
+};
+
+/* A static entity without a script class, which is created straight from 
+ * the binary scene without going through the scripting layer. Only the 
+ * attributes present in the scene (as given by 'has' and 'flags_mask') are 
+ * set, the rest keep the defaults of a new entity. */
+struct scene_prop{
+    char     name[32];
+    uint32_t has;
+    uint32_t flags_mask;
+    uint32_t flags;
+    vec3_t   pos;
+    vec3_t   scale;
+    quat_t   rotation;
+    float    selection_radius;
+};
+
+/* A PFOBJ file and the number of props which use it. The props of each 
+ * model follow those of the previous one. */
+struct scene_model{
+    char     path[256];
+    uint32_t num_props;
+};
+
+struct scene_data{
+    /* The entities which are created by the scripting layer */
+    struct scene_ent   *ents;
+    size_t              num_ents;
+    struct scene_model *models;
+    size_t              num_models;
+    struct scene_prop  *props;
+    size_t              num_props;
+};
+
+/*  +-----------------------------------------+
+ *  | struct pfsceneb_header[1]               |
+ *  +-----------------------------------------+
+ *  | struct scene_model[num_models]          |
+ *  +-----------------------------------------+
+ *  | struct scene_prop[num_props]            |
+ *  +-----------------------------------------+
+ *  | for each of the num_ents entities:      |
+ *  |   struct pfsceneb_ent[1]                |
+ *  |   struct attr[num_atts]                 |
+ *  |   struct attr[num_args]                 |
+ *  +-----------------------------------------+
+ */
+struct pfsceneb_header{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_models;
+    uint32_t num_props;
+    uint32_t num_ents;
+};
+
+struct pfsceneb_ent{
+    char     name[128];
+    char     path[256];
+    uint32_t num_atts;
+    uint32_t num_args;
+};
+
+STRMAP_IMPL(attr, struct attr)
+
+/* The directory and file name of each PFOBJ file the scene uses */
+struct scene_files{
+    char        (*dirs)[512];
+    const char  **dir_ptrs;
+    const char  **name_ptrs;
+    size_t        count;
+};
+
+struct scene_load{
+    char                path[512];
+    scene_done_t        on_done;
+    void               *arg;
+    SDL_Thread         *thread;
+    /* Set by the loader thread once it is done with the job */
+    SDL_atomic_t        done;
+    bool                ok;
+    struct scene_data   data;
+    struct scene_files  files;
+    struct al_preload  *preload;
+};
 
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
 
-__KHASH_IMPL(attr, extern, kh_cstr_t, struct attr, 1, kh_str_hash_func, kh_str_hash_equal)
+/* Only touched by the main thread */
+static kvec_t(struct scene_load*) s_loads;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-/* A copy of the key string is stored in the 'struct attr' itself. Make the key (string pointer)
- * be a pointer to that buffer in order to avoid allocating/storing the key strings separately. 
- * All keys must be patched in case rehashing took place. */
-static void kh_update_str_keys(khash_t(attr) *table)
-{
-    for(khiter_t k = kh_begin(table); k != kh_end(table); k++) {
-        if(!kh_exist(table, k)) continue;
-        kh_key(table, k) = kh_value(table, k).key;
-    }
-}
-
 bool scene_parse_att(SDL_RWops *stream, struct attr *out, bool anon)
 {
     char line[256];
+    /* The attributes are written out to binary scenes as they are */
+    memset(out, 0, sizeof(*out));
     READ_LINE(stream, line, fail);
     char *saveptr;
     char *token;
@@ -87,17 +194,15 @@ bool scene_parse_att(SDL_RWops *stream, struct attr *out, bool anon)
     }else if(!strcmp(token, "quat")) {
 
         out->type = TYPE_QUAT;
-        token = token + strlen(token) + 1;
-        if(!sscanf(token, "%f %f %f %f", 
-            &out->val.as_quat.x, &out->val.as_quat.y, &out->val.as_quat.z, &out->val.as_quat.w))
+        const char *curr = token + strlen(token) + 1;
+        if(!AL_ParseFloats(&curr, 4, ' ', out->val.as_quat.raw))
             goto fail;
 
     }else if(!strcmp(token, "vec3")) {
 
         out->type = TYPE_VEC3;
-        token = token + strlen(token) + 1;
-        if(!sscanf(token, "%f %f %f", 
-            &out->val.as_vec3.x, &out->val.as_vec3.y, &out->val.as_vec3.z))
+        const char *curr = token + strlen(token) + 1;
+        if(!AL_ParseFloats(&curr, 3, ' ', out->val.as_vec3.raw))
             goto fail;
 
     }else if(!strcmp(token, "bool")) {
@@ -114,15 +219,15 @@ bool scene_parse_att(SDL_RWops *stream, struct attr *out, bool anon)
     }else if(!strcmp(token, "float")) {
 
         out->type = TYPE_FLOAT;
-        token = strtok_r(NULL, " \t", &saveptr);
-        if(!sscanf(token, "%f", &out->val.as_float))
+        const char *curr = strtok_r(NULL, " \t", &saveptr);
+        if(!curr || !AL_ParseFloat(&curr, &out->val.as_float))
             goto fail;
 
     }else if(!strcmp(token, "int")) {
 
         out->type = TYPE_INT;
-        token = strtok_r(NULL, " \t", &saveptr);
-        if(!sscanf(token, "%d", &out->val.as_int))
+        const char *curr = strtok_r(NULL, " \t", &saveptr);
+        if(!curr || !AL_ParseInt(&curr, &out->val.as_int))
             goto fail;
 
     }else {
@@ -135,22 +240,18 @@ fail:
     return false;
 }
 
-bool scene_load_entity(SDL_RWops *stream)
+static bool scene_parse_entity(SDL_RWops *stream, struct scene_ent *out)
 {
     char line[256];
-    char name[128];
-    char path[256];
     size_t num_atts;
 
-    khash_t(attr) *attr_table = kh_init(attr);
-    if(!attr_table)
+    out->attr_table = kh_init(attr);
+    if(!out->attr_table)
         goto fail_alloc;
-
-    kvec_attr_t constructor_args;
-    kv_init(constructor_args);
+    kv_init(out->constructor_args);
 
     READ_LINE(stream, line, fail_parse);
-    if(!sscanf(line, "entity %s %s %lu", name, path, &num_atts))
+    if(!sscanf(line, "entity %127s %255s %lu", out->name, out->path, &num_atts))
         goto fail_parse;
 
     for(int i = 0; i < num_atts; i++) {
@@ -159,10 +260,11 @@ bool scene_load_entity(SDL_RWops *stream)
             goto fail_parse;
 
         int ret;
-        khiter_t k = kh_put(attr, attr_table, attr.key, &ret);
-        assert(ret != -1 && ret != 0);
-        kh_value(attr_table, k) = attr;
-        kh_update_str_keys(attr_table);
+        khiter_t k = strmap_put(attr, out->attr_table, attr.key, &ret);
+        if(ret == -1)
+            goto fail_parse;
+        assert(ret != 0);
+        kh_value(out->attr_table, k) = attr;
 
         if(!strcmp(attr.key, "constructor_arguments")) {
 
@@ -170,41 +272,111 @@ bool scene_load_entity(SDL_RWops *stream)
             struct attr const_arg;
             
             for(int j = 0; j < num_args; j++) {
-                if(!scene_parse_att(stream, &const_arg, true)) {
-                    kv_destroy(constructor_args);
+                if(!scene_parse_att(stream, &const_arg, true))
                     goto fail_parse;
-                }
-                kv_push(struct attr, constructor_args, const_arg);
+                kv_push(struct attr, out->constructor_args, const_arg);
             }
         }
     }
 
-    if(!S_Entity_ObjFromAtts(path, name, attr_table, &constructor_args))
-        goto fail_init;
-    
-    kh_destroy(attr, attr_table);
-    kv_destroy(constructor_args);
     return true;
 
-fail_init:
-    kv_destroy(constructor_args);
 fail_parse:
-    kh_destroy(attr, attr_table);
+    kv_destroy(out->constructor_args);
+    strmap_destroy(attr, out->attr_table);
 fail_alloc:
     return false;
 }
 
-/*****************************************************************************/
-/* EXTERN FUNCTIONS                                                          */
-/*****************************************************************************/
+static void scene_ent_destroy(struct scene_ent *ent)
+{
+    kv_destroy(ent->constructor_args);
+    strmap_destroy(attr, ent->attr_table);
+}
 
-bool Scene_Load(const char *path)
+/* The entity paths in the scene are relative to the base path and also name 
+ * the PFOBJ file. Split them the same way the script constructors do. */
+static bool scene_split_path(const char *path, char (*out_dir)[512], const char **out_name)
+{
+    extern const char *g_basepath;
+
+    const char *slash = strrchr(path, '/');
+    if(!slash || slash == path)
+        return false;
+
+    size_t dir_len = slash - path;
+    if(strlen(g_basepath) + dir_len >= sizeof(*out_dir))
+        return false;
+
+    strcpy(*out_dir, g_basepath);
+    strncat(*out_dir, path, dir_len);
+    *out_name = slash + 1;
+    return true;
+}
+
+static void scene_files_add(struct scene_files *files, const char *path)
+{
+    if(!scene_split_path(path, &files->dirs[files->count], &files->name_ptrs[files->count]))
+        return;
+    files->dir_ptrs[files->count] = files->dirs[files->count];
+    files->count++;
+}
+
+/* The PFOBJ files the scene uses, so that they can be loaded before any of 
+ * the entities are created */
+static bool scene_files_init(const struct scene_data *data, struct scene_files *out)
+{
+    size_t count = data->num_ents + data->num_models;
+    out->dirs = malloc((count + 1) * sizeof(*out->dirs));
+    out->dir_ptrs = malloc((count + 1) * sizeof(*out->dir_ptrs));
+    out->name_ptrs = malloc((count + 1) * sizeof(*out->name_ptrs));
+    out->count = 0;
+
+    if(!out->dirs || !out->dir_ptrs || !out->name_ptrs) {
+        free(out->name_ptrs);
+        free(out->dir_ptrs);
+        free(out->dirs);
+        return false;
+    }
+
+    for(int i = 0; i < data->num_ents; i++)
+        scene_files_add(out, data->ents[i].path);
+    for(int i = 0; i < data->num_models; i++)
+        scene_files_add(out, data->models[i].path);
+    return true;
+}
+
+static void scene_files_destroy(struct scene_files *files)
+{
+    free(files->name_ptrs);
+    free(files->dir_ptrs);
+    free(files->dirs);
+}
+
+static void scene_ents_free(struct scene_ent *ents, size_t count)
+{
+    for(int i = 0; i < count; i++)
+        scene_ent_destroy(&ents[i]);
+    free(ents);
+}
+
+static void scene_data_free(struct scene_data *data)
+{
+    scene_ents_free(data->ents, data->num_ents);
+    free(data->models);
+    free(data->props);
+}
+
+/* Parses all the entities up front so that the files they use can be loaded
+ * before any of them is created. Does not touch any engine state, so it may 
+ * be called from any thread. */
+static bool scene_parse(const char *path, struct scene_ent **out_ents, size_t *out_count)
 {
     SDL_RWops *stream;
-    char line[128];
+    char line[MAX_LINE_LEN];
     size_t num_ents;
 
-    stream = SDL_RWFromFile(path, "r");
+    stream = AL_OpenText(path);
     if(!stream)
         goto fail_stream;
     
@@ -212,17 +384,576 @@ bool Scene_Load(const char *path)
     if(!sscanf(line, "num_entities %lu", &num_ents))
         goto fail_parse;
 
-    for(int i = 0; i < num_ents; i++) {
-        if(!scene_load_entity(stream))
-            goto fail_parse;
+    struct scene_ent *ents = malloc((num_ents + 1) * sizeof(struct scene_ent));
+    if(!ents)
+        goto fail_parse;
+
+    size_t num_parsed = 0;
+    for(; num_parsed < num_ents; num_parsed++) {
+        if(!scene_parse_entity(stream, &ents[num_parsed])) {
+            fprintf(stderr, "%s:%zu: Failed to parse entity.\n", path, AL_LineNumber(stream));
+            goto fail_ents;
+        }
     }
 
     SDL_RWclose(stream);
+    *out_ents = ents;
+    *out_count = num_ents;
     return true;
     
+fail_ents:
+    scene_ents_free(ents, num_parsed);
 fail_parse:
     SDL_RWclose(stream);
 fail_stream:
     return false;
 }
 
+/* The binary scene is named after the PFSCENE file, with the extension 
+ * replaced */
+static bool scene_binary_path(const char *path, char *out, size_t size)
+{
+    if(strlen(path) + sizeof(".pfsceneb") > size)
+        return false;
+
+    strcpy(out, path);
+    char *ext = strrchr(out, '.');
+    if(ext && !strchr(ext, '/'))
+        *ext = '\0';
+    strcat(out, ".pfsceneb");
+    return true;
+}
+
+/* The binary file is out of date when the text file has been modified since
+ * it was written. It's fine for only the binary file to be present. */
+static bool scene_binary_up_to_date(const char *path, const char *bin_path)
+{
+    struct stat text_stat, bin_stat;
+    if(stat(bin_path, &bin_stat))
+        return false;
+    if(stat(path, &text_stat))
+        return true;
+    return (bin_stat.st_mtime >= text_stat.st_mtime);
+}
+
+static const struct attr *scene_att(const struct scene_ent *ent, const char *key)
+{
+    khiter_t k = kh_get(attr, ent->attr_table, key);
+    if(k == kh_end(ent->attr_table))
+        return NULL;
+    return &kh_value(ent->attr_table, k);
+}
+
+/* Entities which would be made into a plain, static 'pf.Entity' are created
+ * straight from the binary scene. Anything the scripting layer would treat 
+ * differently keeps going through it. */
+static bool scene_prop_from_ent(const struct scene_ent *ent, struct scene_prop *out)
+{
+    const struct attr *att;
+    memset(out, 0, sizeof(*out));
+
+    if(scene_att(ent, "class"))
+        return false;
+    if(strlen(ent->name) >= sizeof(out->name))
+        return false;
+    strcpy(out->name, ent->name);
+
+    const struct{
+        const char *key;
+        uint32_t    flag;
+    }flag_atts[] = {
+        {"static",      ENTITY_FLAG_STATIC     },
+        {"collision",   ENTITY_FLAG_COLLISION  },
+        {"selectable",  ENTITY_FLAG_SELECTABLE },
+    };
+
+    for(int i = 0; i < ARR_SIZE(flag_atts); i++) {
+
+        if(!(att = scene_att(ent, flag_atts[i].key)))
+            continue;
+        if(att->type != TYPE_BOOL)
+            return false;
+        out->flags_mask |= flag_atts[i].flag;
+        if(att->val.as_bool)
+            out->flags |= flag_atts[i].flag;
+    }
+
+    if(!(out->flags & ENTITY_FLAG_STATIC))
+        return false;
+    if(!(att = scene_att(ent, "animated")) || att->type != TYPE_BOOL || att->val.as_bool)
+        return false;
+
+    if((att = scene_att(ent, "position"))) {
+        if(att->type != TYPE_VEC3)
+            return false;
+        out->has |= SCENE_PROP_POS;
+        out->pos = att->val.as_vec3;
+    }
+    if((att = scene_att(ent, "scale"))) {
+        if(att->type != TYPE_VEC3)
+            return false;
+        out->has |= SCENE_PROP_SCALE;
+        out->scale = att->val.as_vec3;
+    }
+    if((att = scene_att(ent, "rotation"))) {
+        if(att->type != TYPE_QUAT)
+            return false;
+        out->has |= SCENE_PROP_ROT;
+        out->rotation = att->val.as_quat;
+    }
+    if((att = scene_att(ent, "selection_radius"))) {
+        if(att->type != TYPE_FLOAT)
+            return false;
+        out->has |= SCENE_PROP_RADIUS;
+        out->selection_radius = att->val.as_float;
+    }
+    return true;
+}
+
+static int scene_compare_paths(const void *a, const void *b)
+{
+    const struct scene_ent *const *ea = a, *const *eb = b;
+    int ret = strcmp((*ea)->path, (*eb)->path);
+    if(ret)
+        return ret;
+    return (*ea < *eb) ? -1 : (*ea > *eb);
+}
+
+static bool scene_write_binary(const struct scene_ent *ents, size_t num_ents, SDL_RWops *out)
+{
+    bool ret = false;
+    struct pfsceneb_header hdr = (struct pfsceneb_header){
+        .magic   = PFSCENEB_MAGIC,
+        .version = PFSCENEB_VERSION,
+    };
+
+    /* Group the props by the model they use */
+    const struct scene_ent **sorted = malloc((num_ents + 1) * sizeof(*sorted));
+    struct scene_prop *props = malloc((num_ents + 1) * sizeof(*props));
+    struct scene_model *models = calloc(num_ents + 1, sizeof(*models));
+    bool *is_prop = calloc(num_ents + 1, sizeof(*is_prop));
+    if(!sorted || !props || !models || !is_prop)
+        goto out;
+
+    size_t num_sorted = 0;
+    for(int i = 0; i < num_ents; i++) {
+
+        struct scene_prop prop;
+        if(strlen(ents[i].path) >= sizeof(models[0].path) 
+        || !scene_prop_from_ent(&ents[i], &prop))
+            continue;
+        is_prop[i] = true;
+        sorted[num_sorted++] = &ents[i];
+    }
+    qsort(sorted, num_sorted, sizeof(*sorted), scene_compare_paths);
+
+    for(int i = 0; i < num_sorted; i++) {
+
+        if(i == 0 || strcmp(sorted[i]->path, sorted[i-1]->path)) {
+            strcpy(models[hdr.num_models].path, sorted[i]->path);
+            hdr.num_models++;
+        }
+        models[hdr.num_models - 1].num_props++;
+        scene_prop_from_ent(sorted[i], &props[hdr.num_props++]);
+    }
+    hdr.num_ents = num_ents - num_sorted;
+
+    if(!AL_WriteBytes(out, &hdr, sizeof(hdr))
+    || !AL_WriteBytes(out, models, hdr.num_models * sizeof(*models))
+    || !AL_WriteBytes(out, props, hdr.num_props * sizeof(*props)))
+        goto out;
+
+    for(int i = 0; i < num_ents; i++) {
+
+        if(is_prop[i])
+            continue;
+
+        struct pfsceneb_ent bent = {0};
+        strcpy(bent.name, ents[i].name);
+        strcpy(bent.path, ents[i].path);
+        bent.num_atts = kh_size(ents[i].attr_table);
+        bent.num_args = kv_size(ents[i].constructor_args);
+
+        if(!AL_WriteBytes(out, &bent, sizeof(bent)))
+            goto out;
+
+        const char *key;
+        struct attr att;
+        bool written = true;
+        kh_foreach(ents[i].attr_table, key, att, {
+            written = written && AL_WriteBytes(out, &att, sizeof(att));
+        });
+        (void)key;
+
+        if(!written || !AL_WriteBytes(out, ents[i].constructor_args.a, 
+                                      bent.num_args * sizeof(struct attr)))
+            goto out;
+    }
+    ret = true;
+
+out:
+    free(is_prop);
+    free(models);
+    free(props);
+    free(sorted);
+    return ret;
+}
+
+static bool scene_read_att(SDL_RWops *stream, struct attr *out)
+{
+    if(!AL_ReadBytes(stream, out, sizeof(*out)))
+        return false;
+    out->key[sizeof(out->key)-1] = '\0';
+    if(out->type == TYPE_STRING)
+        out->val.as_string[sizeof(out->val.as_string)-1] = '\0';
+    return (out->type >= TYPE_STRING && out->type <= TYPE_BOOL);
+}
+
+static bool scene_read_ent(SDL_RWops *stream, struct scene_ent *out)
+{
+    struct pfsceneb_ent bent;
+    if(!AL_ReadBytes(stream, &bent, sizeof(bent)))
+        goto fail_alloc;
+
+    memcpy(out->name, bent.name, sizeof(out->name));
+    memcpy(out->path, bent.path, sizeof(out->path));
+    out->name[sizeof(out->name)-1] = '\0';
+    out->path[sizeof(out->path)-1] = '\0';
+
+    out->attr_table = kh_init(attr);
+    if(!out->attr_table)
+        goto fail_alloc;
+    kv_init(out->constructor_args);
+
+    for(int i = 0; i < bent.num_atts; i++) {
+
+        struct attr attr;
+        if(!scene_read_att(stream, &attr))
+            goto fail_read;
+
+        int ret;
+        khiter_t k = strmap_put(attr, out->attr_table, attr.key, &ret);
+        if(ret == -1)
+            goto fail_read;
+        kh_value(out->attr_table, k) = attr;
+    }
+
+    for(int i = 0; i < bent.num_args; i++) {
+
+        struct attr attr;
+        if(!scene_read_att(stream, &attr))
+            goto fail_read;
+        kv_push(struct attr, out->constructor_args, attr);
+    }
+    return true;
+
+fail_read:
+    kv_destroy(out->constructor_args);
+    strmap_destroy(attr, out->attr_table);
+fail_alloc:
+    return false;
+}
+
+/* Reads the whole scene in one pass. Like 'scene_parse', it does not touch 
+ * any engine state. */
+static bool scene_read_binary(const char *path, struct scene_data *out)
+{
+    SDL_RWops *stream = SDL_RWFromFile(path, "rb");
+    if(!stream)
+        goto fail_stream;
+
+    struct pfsceneb_header hdr;
+    if(!AL_ReadBytes(stream, &hdr, sizeof(hdr))
+    || hdr.magic != PFSCENEB_MAGIC
+    || hdr.version != PFSCENEB_VERSION)
+        goto fail_hdr;
+
+    /* Every record takes up some of the file, which bounds the counts 
+     * before anything is allocated for them */
+    Sint64 size = SDL_RWsize(stream);
+    if(size < 0
+    || hdr.num_models > size / sizeof(struct scene_model)
+    || hdr.num_props > size / sizeof(struct scene_prop)
+    || hdr.num_ents > size / sizeof(struct pfsceneb_ent))
+        goto fail_hdr;
+
+    *out = (struct scene_data){0};
+    out->models = malloc((hdr.num_models + 1) * sizeof(struct scene_model));
+    out->props = malloc((hdr.num_props + 1) * sizeof(struct scene_prop));
+    out->ents = malloc((hdr.num_ents + 1) * sizeof(struct scene_ent));
+    if(!out->models || !out->props || !out->ents)
+        goto fail_data;
+
+    if(!AL_ReadBytes(stream, out->models, hdr.num_models * sizeof(struct scene_model))
+    || !AL_ReadBytes(stream, out->props, hdr.num_props * sizeof(struct scene_prop)))
+        goto fail_data;
+    out->num_models = hdr.num_models;
+    out->num_props = hdr.num_props;
+
+    size_t total_props = 0;
+    for(int i = 0; i < out->num_models; i++) {
+        out->models[i].path[sizeof(out->models[i].path)-1] = '\0';
+        total_props += out->models[i].num_props;
+    }
+    for(int i = 0; i < out->num_props; i++)
+        out->props[i].name[sizeof(out->props[i].name)-1] = '\0';
+    if(total_props != out->num_props)
+        goto fail_data;
+
+    for(; out->num_ents < hdr.num_ents; out->num_ents++) {
+        if(!scene_read_ent(stream, &out->ents[out->num_ents]))
+            goto fail_data;
+    }
+
+    SDL_RWclose(stream);
+    return true;
+
+fail_data:
+    scene_data_free(out);
+fail_hdr:
+    SDL_RWclose(stream);
+fail_stream:
+    return false;
+}
+
+/* Uses the binary scene when it is up to date, and falls back to parsing 
+ * the text file when it is rejected */
+static bool scene_read(const char *path, struct scene_data *out)
+{
+    char bin_path[512 + sizeof(".pfsceneb")];
+    if(scene_binary_path(path, bin_path, sizeof(bin_path))
+    && scene_binary_up_to_date(path, bin_path)
+    && scene_read_binary(bin_path, out))
+        return true;
+
+    *out = (struct scene_data){0};
+    return scene_parse(path, &out->ents, &out->num_ents);
+}
+
+static bool scene_create_props(const struct scene_data *data)
+{
+    const struct scene_prop *prop = data->props;
+
+    for(int i = 0; i < data->num_models; i++) {
+
+        char dir[512];
+        const char *name;
+        if(!scene_split_path(data->models[i].path, &dir, &name))
+            return false;
+
+        for(int j = 0; j < data->models[i].num_props; j++, prop++) {
+
+            struct entity *ent = AL_EntityFromPFObj(dir, name, prop->name);
+            if(!ent)
+                return false;
+
+            ent->flags = (ent->flags & ~prop->flags_mask) | prop->flags;
+            if(prop->has & SCENE_PROP_POS) {
+                ent->pos = prop->pos;
+                ent->prev_pos = prop->pos;
+            }
+            if(prop->has & SCENE_PROP_SCALE)
+                ent->scale = prop->scale;
+            if(prop->has & SCENE_PROP_ROT) {
+                ent->rotation = prop->rotation;
+                ent->prev_rotation = prop->rotation;
+            }
+            if(prop->has & SCENE_PROP_RADIUS)
+                ent->selection_radius = prop->selection_radius;
+            ent->transform_dirty = true;
+
+            /* The game owns the entity from here on */
+            G_AddEntity(ent);
+        }
+    }
+    return true;
+}
+
+static bool scene_create(const struct scene_data *data)
+{
+    for(int i = 0; i < data->num_ents; i++) {
+        const struct scene_ent *ent = &data->ents[i];
+        if(!S_Entity_ObjFromAtts(ent->path, ent->name, ent->attr_table, &ent->constructor_args))
+            return false;
+    }
+    return scene_create_props(data);
+}
+
+static int scene_loader(void *arg)
+{
+    struct scene_load *load = arg;
+
+    load->ok = scene_read(load->path, &load->data);
+    if(!load->ok)
+        goto out;
+
+    load->ok = scene_files_init(&load->data, &load->files);
+    if(!load->ok) {
+        scene_data_free(&load->data);
+        goto out;
+    }
+
+    /* Failing to preload is not an error - the files are then loaded as 
+     * the entities are created */
+    load->preload = AL_PreloadRead(load->files.count, load->files.dir_ptrs, load->files.name_ptrs);
+
+out:
+    SDL_AtomicSet(&load->done, 1);
+    return 0;
+}
+
+static void scene_load_free(struct scene_load *load)
+{
+    SDL_WaitThread(load->thread, NULL);
+    if(load->ok) {
+        if(load->preload)
+            AL_PreloadFree(load->preload);
+        scene_files_destroy(&load->files);
+        scene_data_free(&load->data);
+    }
+    free(load);
+}
+
+static void scene_on_update_start(void *user, void *event)
+{
+    /* The callbacks may start new loads, so the finished ones are taken off
+     * the list before any of them is called */
+    struct scene_load *finished[kv_size(s_loads)];
+    size_t num_finished = 0, num_kept = 0;
+
+    for(int i = 0; i < kv_size(s_loads); i++) {
+
+        struct scene_load *curr = kv_A(s_loads, i);
+        if(SDL_AtomicGet(&curr->done))
+            finished[num_finished++] = curr;
+        else
+            kv_A(s_loads, num_kept++) = curr;
+    }
+    s_loads.n = num_kept;
+
+    if(!kv_size(s_loads))
+        E_Global_Unregister(EVENT_UPDATE_START, scene_on_update_start);
+
+    for(int i = 0; i < num_finished; i++) {
+
+        struct scene_load *curr = finished[i];
+        bool ok = curr->ok;
+
+        if(ok) {
+            if(curr->preload)
+                AL_PreloadCommit(curr->preload);
+            curr->preload = NULL;
+            ok = scene_create(&curr->data);
+        }
+
+        curr->on_done(curr->arg, ok ? SCENE_LOAD_OK : SCENE_LOAD_FAILED);
+        scene_load_free(curr);
+    }
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Scene_Load(const char *path)
+{
+    struct scene_data data;
+    struct scene_files files;
+
+    if(!scene_read(path, &data))
+        goto fail_parse;
+
+    if(scene_files_init(&data, &files)) {
+        AL_PreloadPFObjs(files.count, files.dir_ptrs, files.name_ptrs);
+        scene_files_destroy(&files);
+    }
+
+    if(!scene_create(&data))
+        goto fail_create;
+
+    scene_data_free(&data);
+    return true;
+
+fail_create:
+    scene_data_free(&data);
+fail_parse:
+    return false;
+}
+
+bool Scene_Compile(const char *path)
+{
+    char bin_path[512 + sizeof(".pfsceneb")];
+    char tmp_path[sizeof(bin_path) + sizeof(".tmp")];
+    if(!scene_binary_path(path, bin_path, sizeof(bin_path)))
+        goto fail_path;
+    sprintf(tmp_path, "%s.tmp", bin_path);
+
+    struct scene_ent *ents;
+    size_t num_ents;
+    if(!scene_parse(path, &ents, &num_ents))
+        goto fail_path;
+
+    /* Write to a temporary file first, so that a partially written file 
+     * never replaces a good one */
+    SDL_RWops *out = SDL_RWFromFile(tmp_path, "wb");
+    if(!out)
+        goto fail_out;
+
+    bool ret = scene_write_binary(ents, num_ents, out);
+    ret = (0 == SDL_RWclose(out)) && ret;
+    scene_ents_free(ents, num_ents);
+
+    return file_replace(bin_path, tmp_path, ret);
+
+fail_out:
+    scene_ents_free(ents, num_ents);
+fail_path:
+    return false;
+}
+
+bool Scene_LoadAsync(const char *path, scene_done_t on_done, void *arg)
+{
+    struct scene_load *load = calloc(1, sizeof(struct scene_load));
+    if(!load)
+        goto fail_alloc;
+
+    if(strlen(path) >= sizeof(load->path))
+        goto fail_path;
+
+    strcpy(load->path, path);
+    load->on_done = on_done;
+    load->arg = arg;
+    SDL_AtomicSet(&load->done, 0);
+
+    if(!kv_size(s_loads) && !E_Global_Register(EVENT_UPDATE_START, scene_on_update_start, NULL))
+        goto fail_path;
+
+    kv_push(struct scene_load*, s_loads, load);
+    load->thread = SDL_CreateThread(scene_loader, "scene_loader", load);
+    if(!load->thread) {
+        /* Parse it on this thread instead, and finish it off as usual */
+        scene_loader(load);
+    }
+    return true;
+
+fail_path:
+    free(load);
+fail_alloc:
+    return false;
+}
+
+void Scene_CancelLoads(void)
+{
+    for(int i = 0; i < kv_size(s_loads); i++) {
+
+        struct scene_load *curr = kv_A(s_loads, i);
+        curr->on_done(curr->arg, SCENE_LOAD_CANCELLED);
+        scene_load_free(curr);
+    }
+
+    if(kv_size(s_loads))
+        E_Global_Unregister(EVENT_UPDATE_START, scene_on_update_start);
+    kv_destroy(s_loads);
+    kv_init(s_loads);
+}
+
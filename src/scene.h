@@ -42,6 +42,7 @@
     #define __USE_POSIX /* strtok_r */
 #endif
 #include "lib/public/khash.h"
+#include "lib/public/str_map.h"
 
 #include <stdbool.h>
 
@@ -65,10 +66,45 @@ struct attr{
     }val;
 };
 
-KHASH_DECLARE(attr, kh_cstr_t, struct attr)
+STRMAP_DECLARE(attr, struct attr)
 typedef kvec_t(struct attr) kvec_attr_t;
 
+enum scene_load_status{
+    SCENE_LOAD_OK,
+    SCENE_LOAD_FAILED,
+    /* The load was dropped by 'Scene_CancelLoads' and no entities were created */
+    SCENE_LOAD_CANCELLED,
+};
+
+typedef void (*scene_done_t)(void *arg, enum scene_load_status status);
+
 bool Scene_Load(const char *path);
 
+/* ------------------------------------------------------------------------
+ * Parses the scene file and reads the PFOBJ files it uses on a loader 
+ * thread. The entities are created at the start of a later frame, on the 
+ * main thread, after which 'on_done' is called. Returns false if the load
+ * could not be started, in which case 'on_done' is never called.
+ * ------------------------------------------------------------------------
+ */
+bool Scene_LoadAsync(const char *path, scene_done_t on_done, void *arg);
+
+/* ------------------------------------------------------------------------
+ * Waits for the loader threads to finish and drops their results, calling 
+ * 'on_done' with SCENE_LOAD_CANCELLED for each.
+ * ------------------------------------------------------------------------
+ */
+void Scene_CancelLoads(void);
+
+/* ------------------------------------------------------------------------
+ * Writes the binary variant of the PFSCENE file alongside it, with the 
+ * '.pfsceneb' extension. Scenes are loaded from the binary file whenever 
+ * it is not older than the text file. Static entities without a script 
+ * class are grouped by model in the binary file, and are then created 
+ * without going through the scripting layer. 
+ * ------------------------------------------------------------------------
+ */
+bool Scene_Compile(const char *path);
+
 #endif
 
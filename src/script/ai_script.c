@@ -0,0 +1,472 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "ai_script.h"
+#include "public/script.h"
+#include "../game/public/game.h"
+#include "../entity.h"
+#include "../event.h"
+#include "../mem.h"
+#include "../lib/public/kvec.h"
+#include "tile_script.h"
+
+#include <SDL.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+
+
+/* A queued call. Both references are owned. */
+struct ai_cmd{
+    PyObject *callable;
+    PyObject *args;
+};
+
+typedef kvec_t(struct ai_cmd) cmd_kvec_t;
+
+/* One entity of the snapshot, laid out as 's_record_format' says */
+struct ai_record{
+    uint32_t uid;
+    float    x, y, z;
+    uint32_t flags;
+    float    radius;
+    float    max_speed;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const char          *s_record_format = 
+    "T{I:uid:f:x:f:y:f:z:I:flags:f:radius:f:max_speed:}";
+
+/* Everything below that is not guarded by 's_lock' is only touched with the 
+ * interpreter lock held. 's_snapshot' is guarded by both: it is non-NULL for 
+ * as long as the worker has a snapshot to process. */
+static SDL_Thread          *s_thread;
+static SDL_mutex           *s_lock;
+static SDL_cond            *s_cond;
+static SDL_atomic_t         s_window_open;
+static bool                 s_quit;
+static PyObject            *s_snapshot;
+static uint32_t             s_snapshot_tick;
+
+static PyInterpreterState  *s_interp;
+static PyThreadState       *s_main_ts;
+static PyObject            *s_handlers;
+static uint32_t             s_tick;
+/* The commands are swapped into 's_applying' to be applied, so that the 
+ * commands queued up by other commands wait for the next tick */
+static cmd_kvec_t           s_commands;
+static cmd_kvec_t           s_applying;
+/* An exception raised by a handler, to be reported on the main thread */
+static PyObject            *s_err_type, *s_err_value, *s_err_tb;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+/* Called on the worker without the interpreter lock. Waits for the window to 
+ * open (and for a snapshot to be handed over, if 'need_work' is set) and then 
+ * takes the lock. Returns false, still without the lock, once the engine is 
+ * shutting down. */
+static bool ai_acquire(PyThreadState *ts, bool need_work)
+{
+    for(;;) {
+
+        SDL_LockMutex(s_lock);
+        while(!s_quit && !(SDL_AtomicGet(&s_window_open) && (!need_work || s_snapshot)))
+            SDL_CondWait(s_cond, s_lock);
+        bool quit = s_quit;
+        SDL_UnlockMutex(s_lock);
+
+        if(quit)
+            return false;
+
+        PyEval_RestoreThread(ts);
+        /* The window may have closed while the lock was being waited on */
+        if(SDL_AtomicGet(&s_window_open))
+            return true;
+        PyEval_SaveThread();
+    }
+}
+
+/* Installed as the worker's tracing function, so that it is run on every 
+ * call, return and new line in the handlers, including every pass through a 
+ * loop which makes no calls. The worker gives back the interpreter lock here 
+ * as soon as the main thread needs it. */
+static int ai_on_trace(PyObject *obj, struct _frame *frame, int what, PyObject *arg)
+{
+    if(SDL_AtomicGet(&s_window_open))
+        return 0;
+
+    PyThreadState *ts = PyEval_SaveThread();
+    if(ai_acquire(ts, false))
+        return 0;
+
+    /* Unwind the handler, so that the worker can exit */
+    PyEval_RestoreThread(ts);
+    PyErr_SetString(PyExc_SystemExit, "The engine is shutting down.");
+    return -1;
+}
+
+static bool ai_quitting(void)
+{
+    SDL_LockMutex(s_lock);
+    bool ret = s_quit;
+    SDL_UnlockMutex(s_lock);
+    return ret;
+}
+
+/* Runs every handler on the snapshot. The handlers are copied first, as they
+ * may be unregistered from the main thread in the meantime. */
+static void ai_run(PyObject *snapshot, uint32_t tick)
+{
+    PyObject *handlers = PyList_GetSlice(s_handlers, 0, PyList_GET_SIZE(s_handlers));
+    if(!handlers)
+        goto fail;
+
+    for(int i = 0; i < PyList_GET_SIZE(handlers); i++) {
+
+        PyObject *ret = PyObject_CallFunction(PyList_GET_ITEM(handlers, i), "OI", snapshot, tick);
+        if(!ret) {
+            Py_DECREF(handlers);
+            goto fail;
+        }
+        Py_DECREF(ret);
+    }
+    Py_DECREF(handlers);
+    return;
+
+fail:
+    if(ai_quitting() || s_err_type) {
+        PyErr_Clear();
+        return;
+    }
+    PyErr_Fetch(&s_err_type, &s_err_value, &s_err_tb);
+}
+
+static int ai_thread_main(void *unused)
+{
+    PyThreadState *ts = PyThreadState_New(s_interp);
+
+    while(ai_acquire(ts, true)) {
+
+        PyEval_SetTrace(ai_on_trace, NULL);
+
+        PyObject *snapshot = s_snapshot;
+        Py_INCREF(snapshot);
+        ai_run(snapshot, s_snapshot_tick);
+        Py_DECREF(snapshot);
+
+        SDL_LockMutex(s_lock);
+        Py_CLEAR(s_snapshot);
+        SDL_UnlockMutex(s_lock);
+
+        PyEval_SaveThread();
+    }
+
+    /* The main thread lets go of the lock while waiting for the worker */
+    PyEval_RestoreThread(ts);
+    PyErr_Clear();
+    PyThreadState_Clear(ts);
+    PyThreadState_DeleteCurrent();
+    return 0;
+}
+
+static PyObject *ai_take_snapshot(void)
+{
+    const pentity_kvec_t *ents = G_ActiveEntities();
+    size_t count = kv_size(*ents);
+
+    struct ai_record *records = MEM_Malloc(MEM_TAG_SCRIPT, count * sizeof(struct ai_record) + 1);
+    if(!records)
+        return PyErr_NoMemory();
+
+    for(int i = 0; i < count; i++) {
+
+        const struct entity *ent = kv_A(*ents, i);
+        records[i] = (struct ai_record){
+            .uid = ent->uid,
+            .x = ent->pos.x,
+            .y = ent->pos.y,
+            .z = ent->pos.z,
+            .flags = ent->flags,
+            .radius = ent->selection_radius,
+            .max_speed = ent->max_speed,
+        };
+    }
+    return S_Tile_RecordBuffer(records, s_record_format, sizeof(struct ai_record), count);
+}
+
+static void ai_apply_commands(void)
+{
+    assert(kv_size(s_applying) == 0);
+    cmd_kvec_t tmp = s_applying;
+    s_applying = s_commands;
+    s_commands = tmp;
+
+    for(int i = 0; i < kv_size(s_applying); i++) {
+
+        struct ai_cmd cmd = kv_A(s_applying, i);
+        PyObject *ret = PyObject_CallObject(cmd.callable, cmd.args);
+        Py_DECREF(cmd.callable);
+        Py_DECREF(cmd.args);
+
+        Py_XDECREF(ret);
+        if(!ret) {
+            PyErr_Print();
+            exit(EXIT_FAILURE);
+        }
+    }
+    kv_reset(s_applying);
+}
+
+static void ai_on_tick(void *user, void *event)
+{
+    s_tick++;
+
+    if(s_err_type) {
+        PyErr_Restore(s_err_type, s_err_value, s_err_tb);
+        PyErr_Print();
+        exit(EXIT_FAILURE);
+    }
+
+    ai_apply_commands();
+
+    /* The worker is still busy with the last snapshot */
+    if(s_snapshot || PyList_GET_SIZE(s_handlers) == 0)
+        return;
+
+    PyObject *snapshot = ai_take_snapshot();
+    if(!snapshot) {
+        PyErr_Print();
+        exit(EXIT_FAILURE);
+    }
+
+    SDL_LockMutex(s_lock);
+    s_snapshot = snapshot;
+    s_snapshot_tick = s_tick;
+    SDL_CondBroadcast(s_cond);
+    SDL_UnlockMutex(s_lock);
+}
+
+static bool ai_start(void)
+{
+    PyEval_InitThreads();
+    s_interp = PyThreadState_Get()->interp;
+
+    /* Otherwise, the interpreter would hand the lock between the threads 
+     * every so many instructions, and the worker would get to run in the 
+     * middle of the main thread's scripts */
+    PyObject *sys = PyImport_ImportModule("sys");
+    if(!sys)
+        return false;
+    PyObject *ret = PyObject_CallMethod(sys, "setcheckinterval", "i", INT_MAX);
+    Py_DECREF(sys);
+    if(!ret)
+        return false;
+    Py_DECREF(ret);
+
+    if(!E_Global_Register(EVENT_60HZ_TICK, ai_on_tick, NULL)) {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    s_thread = SDL_CreateThread(ai_thread_main, "ai_worker", NULL);
+    if(!s_thread) {
+        E_Global_Unregister(EVENT_60HZ_TICK, ai_on_tick);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start the AI thread.");
+        return false;
+    }
+    return true;
+}
+
+static void ai_clear_commands(void)
+{
+    for(int i = 0; i < kv_size(s_commands); i++) {
+        Py_DECREF(kv_A(s_commands, i).callable);
+        Py_DECREF(kv_A(s_commands, i).args);
+    }
+    kv_reset(s_commands);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_AI_Init(void)
+{
+    s_thread = NULL;
+    s_quit = false;
+    s_snapshot = NULL;
+    s_main_ts = NULL;
+    s_tick = 0;
+    SDL_AtomicSet(&s_window_open, 0);
+    kv_init(s_commands);
+    kv_init(s_applying);
+
+    if(!(s_lock = SDL_CreateMutex()))
+        goto fail_lock;
+    if(!(s_cond = SDL_CreateCond()))
+        goto fail_cond;
+    if(!(s_handlers = PyList_New(0)))
+        goto fail_handlers;
+    return true;
+
+fail_handlers:
+    SDL_DestroyCond(s_cond);
+fail_cond:
+    SDL_DestroyMutex(s_lock);
+fail_lock:
+    return false;
+}
+
+void S_AI_Shutdown(void)
+{
+    if(s_thread) {
+
+        E_Global_Unregister(EVENT_60HZ_TICK, ai_on_tick);
+
+        SDL_LockMutex(s_lock);
+        s_quit = true;
+        SDL_CondBroadcast(s_cond);
+        SDL_UnlockMutex(s_lock);
+
+        Py_BEGIN_ALLOW_THREADS
+        SDL_WaitThread(s_thread, NULL);
+        Py_END_ALLOW_THREADS
+    }
+
+    ai_clear_commands();
+    kv_destroy(s_commands);
+    kv_destroy(s_applying);
+    Py_CLEAR(s_snapshot);
+    Py_CLEAR(s_handlers);
+    Py_CLEAR(s_err_type);
+    Py_CLEAR(s_err_value);
+    Py_CLEAR(s_err_tb);
+    SDL_DestroyCond(s_cond);
+    SDL_DestroyMutex(s_lock);
+}
+
+void S_AI_WindowOpen(void)
+{
+    assert(!s_main_ts);
+    /* Nothing for the worker to do until the next tick */
+    if(!s_thread || !s_snapshot)
+        return;
+
+    SDL_LockMutex(s_lock);
+    SDL_AtomicSet(&s_window_open, 1);
+    SDL_CondBroadcast(s_cond);
+    SDL_UnlockMutex(s_lock);
+
+    s_main_ts = PyEval_SaveThread();
+}
+
+void S_AI_WindowClose(void)
+{
+    if(!s_main_ts)
+        return;
+
+    SDL_AtomicSet(&s_window_open, 0);
+    PyEval_RestoreThread(s_main_ts);
+    s_main_ts = NULL;
+}
+
+PyObject *S_AI_Register(PyObject *args)
+{
+    PyObject *callable;
+
+    if(!PyArg_ParseTuple(args, "O", &callable) || !PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a callable.");
+        return NULL;
+    }
+
+    int contains = PySequence_Contains(s_handlers, callable);
+    if(contains < 0)
+        return NULL;
+    if(contains)
+        Py_RETURN_NONE;
+
+    if(!s_thread && !ai_start())
+        return NULL;
+
+    if(PyList_Append(s_handlers, callable) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyObject *S_AI_Unregister(PyObject *args)
+{
+    PyObject *callable;
+
+    if(!PyArg_ParseTuple(args, "O", &callable)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a callable.");
+        return NULL;
+    }
+
+    Py_ssize_t idx = PySequence_Index(s_handlers, callable);
+    if(idx < 0) {
+        PyErr_Clear();
+        Py_RETURN_FALSE;
+    }
+
+    if(PySequence_DelItem(s_handlers, idx) < 0)
+        return NULL;
+    Py_RETURN_TRUE;
+}
+
+PyObject *S_AI_Command(PyObject *args)
+{
+    if(PyTuple_GET_SIZE(args) < 1 || !PyCallable_Check(PyTuple_GET_ITEM(args, 0))) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a callable, followed by the "
+            "arguments to call it with.");
+        return NULL;
+    }
+
+    PyObject *call_args = PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args));
+    if(!call_args)
+        return NULL;
+
+    PyObject *callable = PyTuple_GET_ITEM(args, 0);
+    Py_INCREF(callable);
+    kv_push(struct ai_cmd, s_commands, ((struct ai_cmd){callable, call_args}));
+    Py_RETURN_NONE;
+}
+
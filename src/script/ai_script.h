@@ -0,0 +1,71 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef AI_SCRIPT_H
+#define AI_SCRIPT_H
+
+#include <Python.h> /* Must be first */
+
+#include <stdbool.h>
+
+/* Threaded AI handlers run on a worker thread of their own, against a 
+ * read-only snapshot of the entities taken at a simulation tick. They act 
+ * on the game through a command buffer, which is applied on the main thread
+ * at the next tick. A new snapshot is only handed out once the handlers 
+ * are done with the last one, so slow AI makes decisions less often rather 
+ * than holding up the simulation.
+ *
+ * The worker only holds the interpreter lock while the main thread is 
+ * blocked outside of Python, inside the windows of 'S_AI_WindowOpen' (see 
+ * 'public/script.h'). It checks the window on every call and return in the 
+ * handlers, and gives the lock back as soon as the window closes. The main 
+ * thread never waits on the handlers to finish. */
+
+bool      S_AI_Init(void);
+void      S_AI_Shutdown(void);
+
+/* Arguments: (callable). The callable is invoked on the worker thread with
+ * the snapshot and the number of the tick it was taken at, counted from the 
+ * registration of the first handler. */
+PyObject *S_AI_Register(PyObject *args);
+/* Arguments: (callable). Returns True if the callable had been registered. */
+PyObject *S_AI_Unregister(PyObject *args);
+
+/* Arguments: (callable, *args). Queues up a call to be made on the main 
+ * thread at the next simulation tick. */
+PyObject *S_AI_Command(PyObject *args);
+
+#endif
+
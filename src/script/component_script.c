@@ -0,0 +1,571 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "component_script.h"
+#include "entity_script.h"
+#include "../entity.h"
+#include "../pf_math.h"
+#include "../lib/public/kvec.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX_NAME_LEN    (32)
+#define ARR_SIZE(a)     (sizeof(a)/sizeof(a[0]))
+
+union comp_val{
+    float    as_float;
+    int32_t  as_int;
+    vec2_t   as_vec2;
+    uint32_t as_uid; /* 0 for no entity */
+};
+
+struct component{
+    char                name[MAX_NAME_LEN];
+    enum component_type type;
+    union comp_val      dflt;
+    size_t              size;
+    /* One value per entity pool block */
+    unsigned char      *data;
+    /* Referenced by the descriptor on pf.Entity */
+    PyGetSetDef         def;
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static const size_t             s_type_sizes[] = {
+    [COMPONENT_FLOAT]   = sizeof(float),
+    [COMPONENT_INT]     = sizeof(int32_t),
+    [COMPONENT_VEC2]    = sizeof(vec2_t),
+    [COMPONENT_ENTITY]  = sizeof(uint32_t),
+};
+
+static kvec_t(struct component*) s_components;
+/* The UID of the entity that the values of every block belong to, or 0 if 
+ * they haven't been set for any entity yet */
+static uint32_t                 *s_owners;
+static size_t                    s_capacity;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void s_fill_default(struct component *comp, size_t begin, size_t end)
+{
+    for(size_t i = begin; i < end; i++)
+        memcpy(comp->data + i * comp->size, &comp->dflt, comp->size);
+}
+
+static bool s_grow(size_t capacity)
+{
+    if(capacity <= s_capacity)
+        return true;
+
+    uint32_t *owners = realloc(s_owners, capacity * sizeof(uint32_t));
+    if(!owners)
+        return false;
+    s_owners = owners;
+
+    for(int i = 0; i < kv_size(s_components); i++) {
+
+        struct component *comp = kv_A(s_components, i);
+        unsigned char *data = realloc(comp->data, capacity * comp->size);
+        if(!data)
+            return false;
+        comp->data = data;
+        s_fill_default(comp, s_capacity, capacity);
+    }
+
+    memset(s_owners + s_capacity, 0, (capacity - s_capacity) * sizeof(uint32_t));
+    s_capacity = capacity;
+    return true;
+}
+
+/* Returns NULL if the storage couldn't be grown to hold the entity's block */
+static void *s_value(struct component *comp, uint32_t uid)
+{
+    uint32_t idx = Entity_PoolIndex(uid);
+    if(idx >= s_capacity && !s_grow(Entity_PoolCapacity()))
+        return NULL;
+    assert(idx < s_capacity);
+
+    /* The block has been freed and handed out again since it was last used */
+    if(s_owners[idx] != uid) {
+
+        for(int i = 0; i < kv_size(s_components); i++) {
+            struct component *curr = kv_A(s_components, i);
+            memcpy(curr->data + idx * curr->size, &curr->dflt, curr->size);
+        }
+        s_owners[idx] = uid;
+    }
+    return comp->data + idx * comp->size;
+}
+
+static struct component *s_find(const char *name)
+{
+    for(int i = 0; i < kv_size(s_components); i++) {
+        if(0 == strcmp(kv_A(s_components, i)->name, name))
+            return kv_A(s_components, i);
+    }
+    PyErr_Format(PyExc_KeyError, "No component named '%s' has been declared.", name);
+    return NULL;
+}
+
+static PyObject *s_to_py(const struct component *comp, const void *val)
+{
+    const union comp_val *cv = val;
+
+    switch(comp->type) {
+    case COMPONENT_FLOAT:  return PyFloat_FromDouble(cv->as_float);
+    case COMPONENT_INT:    return PyInt_FromLong(cv->as_int);
+    case COMPONENT_VEC2:   return Py_BuildValue("(ff)", cv->as_vec2.x, cv->as_vec2.y);
+    case COMPONENT_ENTITY: {
+        /* A stale UID no longer has an object */
+        PyObject *ret = cv->as_uid ? S_Entity_ObjForUID(cv->as_uid) : NULL;
+        if(!ret)
+            ret = Py_None;
+        Py_INCREF(ret);
+        return ret;
+    }
+    default: assert(0);
+    }
+    Py_RETURN_NONE;
+}
+
+static bool s_from_py(const struct component *comp, PyObject *obj, union comp_val *out)
+{
+    switch(comp->type) {
+    case COMPONENT_FLOAT:
+        out->as_float = PyFloat_AsDouble(obj);
+        break;
+    case COMPONENT_INT:
+        out->as_int = PyInt_AsLong(obj);
+        break;
+    case COMPONENT_VEC2: {
+        PyObject *seq = PySequence_Check(obj) && PySequence_Size(obj) == 2 ? PySequence_Tuple(obj) : NULL;
+        bool ok = seq && PyArg_ParseTuple(seq, "ff", &out->as_vec2.x, &out->as_vec2.y);
+        Py_XDECREF(seq);
+        if(!ok) {
+            PyErr_Format(PyExc_TypeError, "Component '%s' must be set to an (X, Z) pair.", comp->name);
+            return false;
+        }
+        return true;
+    }
+    case COMPONENT_ENTITY: {
+        if(obj == Py_None) {
+            out->as_uid = 0;
+            return true;
+        }
+        struct entity *ent = S_Entity_ForObj(obj);
+        if(!ent) {
+            PyErr_Format(PyExc_TypeError, "Component '%s' must be set to an entity or None.", comp->name);
+            return false;
+        }
+        out->as_uid = ent->uid;
+        return true;
+    }
+    default: assert(0);
+    }
+
+    if(PyErr_Occurred()) {
+        PyErr_Format(PyExc_TypeError, "Component '%s' must be set to a number.", comp->name);
+        return false;
+    }
+    return true;
+}
+
+static PyObject *s_getter(PyObject *self, void *closure)
+{
+    struct entity *ent = S_Entity_ForObj(self);
+    assert(ent);
+
+    void *val = s_value(closure, ent->uid);
+    if(!val)
+        return PyErr_NoMemory();
+    return s_to_py(closure, val);
+}
+
+/* Deleting the attribute sets it back to the default */
+static int s_setter(PyObject *self, PyObject *value, void *closure)
+{
+    struct component *comp = closure;
+    struct entity *ent = S_Entity_ForObj(self);
+    assert(ent);
+
+    union comp_val parsed = comp->dflt;
+    if(value && !s_from_py(comp, value, &parsed))
+        return -1;
+
+    void *val = s_value(comp, ent->uid);
+    if(!val) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memcpy(val, &parsed, comp->size);
+    return 0;
+}
+
+/* Returns a new reference to a fast sequence holding only entities */
+static PyObject *s_entity_seq(PyObject *entities)
+{
+    PyObject *seq = PySequence_Fast(entities, "Expecting a sequence of entities.");
+    if(!seq)
+        return NULL;
+
+    for(int i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+        if(!S_Entity_ForObj(PySequence_Fast_GET_ITEM(seq, i))) {
+            PyErr_SetString(PyExc_TypeError, "Expecting a sequence of entities.");
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+    return seq;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_Component_Init(void)
+{
+    kv_init(s_components);
+    s_owners = NULL;
+    s_capacity = 0;
+    return true;
+}
+
+void S_Component_Shutdown(void)
+{
+    for(int i = 0; i < kv_size(s_components); i++) {
+
+        struct component *comp = kv_A(s_components, i);
+        S_Entity_RemoveGetSet(comp->name);
+        free(comp->data);
+        free(comp);
+    }
+    kv_destroy(s_components);
+    free(s_owners);
+}
+
+PyObject *S_Component_Declare(PyObject *args)
+{
+    const char *name;
+    int type;
+    PyObject *dflt = NULL;
+
+    if(!PyArg_ParseTuple(args, "si|O", &name, &type, &dflt)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string, a component type and an optional default.");
+        return NULL;
+    }
+
+    if(type < 0 || type >= ARR_SIZE(s_type_sizes)) {
+        PyErr_SetString(PyExc_ValueError, "Invalid component type.");
+        return NULL;
+    }
+
+    if(strlen(name) >= MAX_NAME_LEN) {
+        PyErr_Format(PyExc_ValueError, "Component names must be under %d characters long.", MAX_NAME_LEN);
+        return NULL;
+    }
+
+    struct component *comp = NULL;
+    for(int i = 0; i < kv_size(s_components); i++) {
+        if(0 == strcmp(kv_A(s_components, i)->name, name))
+            comp = kv_A(s_components, i);
+    }
+
+    if(comp) {
+
+        if(comp->type != type) {
+            PyErr_Format(PyExc_ValueError, "Component '%s' was already declared with a different type.", name);
+            return NULL;
+        }
+        union comp_val parsed = {0};
+        if(dflt && !s_from_py(comp, dflt, &parsed))
+            return NULL;
+        comp->dflt = parsed;
+        Py_RETURN_NONE;
+    }
+
+    comp = calloc(1, sizeof(struct component));
+    if(!comp)
+        return PyErr_NoMemory();
+
+    strcpy(comp->name, name);
+    comp->type = type;
+    comp->size = s_type_sizes[type];
+    if(dflt && !s_from_py(comp, dflt, &comp->dflt))
+        goto fail;
+
+    if(s_capacity) {
+        comp->data = malloc(s_capacity * comp->size);
+        if(!comp->data) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        s_fill_default(comp, 0, s_capacity);
+    }
+
+    comp->def = (PyGetSetDef){
+        comp->name, s_getter, s_setter, 
+        "Component declared with 'pf.declare_component'.", comp
+    };
+    if(!S_Entity_AddGetSet(&comp->def))
+        goto fail;
+
+    kv_push(struct component*, s_components, comp);
+    Py_RETURN_NONE;
+
+fail:
+    free(comp->data);
+    free(comp);
+    return NULL;
+}
+
+PyObject *S_Component_GetMany(PyObject *args)
+{
+    const char *name;
+    PyObject *entities, *out = NULL;
+
+    if(!PyArg_ParseTuple(args, "sO|O", &name, &entities, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string, a sequence of entities and an optional buffer.");
+        return NULL;
+    }
+
+    struct component *comp = s_find(name);
+    if(!comp)
+        return NULL;
+
+    PyObject *seq = s_entity_seq(entities);
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    PyObject *ret = NULL;
+
+    if(out) {
+
+        void *buff;
+        Py_ssize_t size;
+        if(0 != PyObject_AsWriteBuffer(out, &buff, &size))
+            goto out;
+
+        if(size < count * comp->size) {
+            PyErr_Format(PyExc_ValueError, "The buffer must hold %d bytes for every entity.", (int)comp->size);
+            goto out;
+        }
+
+        for(int i = 0; i < count; i++) {
+
+            void *val = s_value(comp, S_Entity_ForObj(items[i])->uid);
+            if(!val) {
+                PyErr_NoMemory();
+                goto out;
+            }
+            memcpy((unsigned char*)buff + i * comp->size, val, comp->size);
+        }
+
+        Py_INCREF(out);
+        ret = out;
+        goto out;
+    }
+
+    ret = PyList_New(count);
+    if(!ret)
+        goto out;
+
+    for(int i = 0; i < count; i++) {
+
+        void *val = s_value(comp, S_Entity_ForObj(items[i])->uid);
+        PyObject *obj = val ? s_to_py(comp, val) : PyErr_NoMemory();
+        if(!obj) {
+            Py_CLEAR(ret);
+            goto out;
+        }
+        PyList_SET_ITEM(ret, i, obj); /* steals reference */
+    }
+
+out:
+    Py_DECREF(seq);
+    return ret;
+}
+
+PyObject *S_Component_SetMany(PyObject *args)
+{
+    const char *name;
+    PyObject *entities, *values;
+
+    if(!PyArg_ParseTuple(args, "sOO", &name, &entities, &values)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string, a sequence of entities and their values.");
+        return NULL;
+    }
+
+    struct component *comp = s_find(name);
+    if(!comp)
+        return NULL;
+
+    PyObject *seq = s_entity_seq(entities);
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    PyObject *ret = NULL;
+
+    /* Grow the storage up front, so that nothing is set on an error */
+    if(!s_grow(Entity_PoolCapacity())) {
+        PyErr_NoMemory();
+        goto out_seq;
+    }
+
+    /* Either a buffer of raw values, or a sequence of objects */
+    if(!PyList_Check(values) && !PyTuple_Check(values) 
+    && PyObject_CheckReadBuffer(values)) {
+
+        const void *buff;
+        Py_ssize_t size;
+        if(0 != PyObject_AsReadBuffer(values, &buff, &size))
+            goto out_seq;
+
+        if(size != count * comp->size) {
+            PyErr_Format(PyExc_ValueError, "The buffer must hold %d bytes for every entity.", (int)comp->size);
+            goto out_seq;
+        }
+
+        for(int i = 0; i < count; i++) {
+            void *val = s_value(comp, S_Entity_ForObj(items[i])->uid);
+            memcpy(val, (const unsigned char*)buff + i * comp->size, comp->size);
+        }
+        ret = Py_None;
+        goto out_seq;
+    }
+
+    PyObject *vals = PySequence_Fast(values, "Third argument must be a sequence of values.");
+    if(!vals)
+        goto out_seq;
+
+    if(PySequence_Fast_GET_SIZE(vals) != count) {
+        PyErr_SetString(PyExc_ValueError, "There must be one value for every entity.");
+        goto out_vals;
+    }
+
+    union comp_val *parsed = malloc(count * sizeof(union comp_val));
+    if(!parsed && count) {
+        PyErr_NoMemory();
+        goto out_vals;
+    }
+
+    for(int i = 0; i < count; i++) {
+        if(!s_from_py(comp, PySequence_Fast_GET_ITEM(vals, i), &parsed[i]))
+            goto out_parsed;
+    }
+
+    for(int i = 0; i < count; i++) {
+        void *val = s_value(comp, S_Entity_ForObj(items[i])->uid);
+        memcpy(val, &parsed[i], comp->size);
+    }
+    ret = Py_None;
+
+out_parsed:
+    free(parsed);
+out_vals:
+    Py_DECREF(vals);
+out_seq:
+    Py_DECREF(seq);
+    Py_XINCREF(ret);
+    return ret;
+}
+
+PyObject *S_Component_Filter(PyObject *args)
+{
+    PyObject *entities;
+    const char *name;
+    double min, max;
+
+    if(!PyArg_ParseTuple(args, "Osdd", &entities, &name, &min, &max)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of entities, a string and two numbers.");
+        return NULL;
+    }
+
+    struct component *comp = s_find(name);
+    if(!comp)
+        return NULL;
+
+    if(comp->type != COMPONENT_FLOAT && comp->type != COMPONENT_INT) {
+        PyErr_Format(PyExc_TypeError, "Component '%s' isn't a number.", name);
+        return NULL;
+    }
+
+    PyObject *seq = s_entity_seq(entities);
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    PyObject *ret = NULL;
+
+    if(!s_grow(Entity_PoolCapacity())) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    ret = PyTuple_New(count);
+    if(!ret)
+        goto out;
+
+    Py_ssize_t n = 0;
+    for(int i = 0; i < count; i++) {
+
+        const union comp_val *val = s_value(comp, S_Entity_ForObj(items[i])->uid);
+        double v = (comp->type == COMPONENT_FLOAT) ? val->as_float : val->as_int;
+        if(v < min || v > max)
+            continue;
+
+        Py_INCREF(items[i]);
+        PyTuple_SET_ITEM(ret, n++, items[i]);
+    }
+
+    if(n < count && _PyTuple_Resize(&ret, n) < 0)
+        ret = NULL;
+
+out:
+    Py_DECREF(seq);
+    return ret;
+}
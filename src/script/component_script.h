@@ -0,0 +1,79 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef COMPONENT_SCRIPT_H
+#define COMPONENT_SCRIPT_H
+
+#include <Python.h> /* Must be first */
+
+#include <stdbool.h>
+
+/* Typed per-entity values declared by the scripts. Each component is a single 
+ * column of values, kept in a dense array indexed by the entity's pool block 
+ * (see 'Entity_PoolIndex'), and shows up as an attribute of every pf.Entity. 
+ * Reading or writing it through the attribute doesn't go through the instance 
+ * dictionary and doesn't keep a Python object per entity. A block that has 
+ * been handed to a new entity has its' values reset to the defaults when they 
+ * are next accessed. */
+
+enum component_type{
+    COMPONENT_FLOAT,
+    COMPONENT_INT,
+    COMPONENT_VEC2,
+    COMPONENT_ENTITY,
+};
+
+bool      S_Component_Init(void);
+/* Must be called before the interpreter is finalized */
+void      S_Component_Shutdown(void);
+
+/* Arguments: (name, type[, default]). Declaring a component again with the 
+ * same type is allowed, and only updates the default. */
+PyObject *S_Component_Declare(PyObject *args);
+
+/* Arguments: (name, entities[, buffer]). Returns a list with the value of 
+ * every entity, or fills the buffer with the raw values (4 bytes per entity, 
+ * or 8 bytes for a COMPONENT_VEC2) and returns it. */
+PyObject *S_Component_GetMany(PyObject *args);
+
+/* Arguments: (name, entities, values). The values are a sequence or a buffer 
+ * laid out as above. */
+PyObject *S_Component_SetMany(PyObject *args);
+
+/* Arguments: (entities, name, min, max). Returns a tuple of the entities whose
+ * value of a COMPONENT_FLOAT or COMPONENT_INT lies in the range [min, max]. */
+PyObject *S_Component_Filter(PyObject *args);
+
+#endif
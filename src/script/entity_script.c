@@ -35,6 +35,7 @@
 
 #include <Python.h> /* must be first */
 #include "entity_script.h" 
+#include "vec_script.h"
 #include "../entity.h"
 #include "../event.h"
 #include "../asset_load.h"
@@ -43,6 +44,7 @@
 #include "../lib/public/khash.h"
 
 #include <assert.h>
+#include <string.h>
 
 typedef struct {
     PyObject_HEAD
@@ -68,18 +70,26 @@ static int       PyEntity_set_selectable(PyEntityObject *self, PyObject *value,
 static PyObject *PyEntity_get_selection_radius(PyEntityObject *self, void *closure);
 static int       PyEntity_set_selection_radius(PyEntityObject *self, PyObject *value, void *closure);
 static PyObject *PyEntity_get_pfobj_path(PyEntityObject *self, void *closure);
+static PyObject *PyEntity_get_uid(PyEntityObject *self, void *closure);
 static PyObject *PyEntity_get_speed(PyEntityObject *self, void *closure);
 static int       PyEntity_set_speed(PyEntityObject *self, PyObject *value, void *closure);
+static PyObject *PyEntity_get_vision_range(PyEntityObject *self, void *closure);
+static int       PyEntity_set_vision_range(PyEntityObject *self, PyObject *value, void *closure);
 static PyObject *PyEntity_activate(PyEntityObject *self);
 static PyObject *PyEntity_deactivate(PyEntityObject *self);
 static PyObject *PyEntity_register(PyEntityObject *self, PyObject *args);
 static PyObject *PyEntity_unregister(PyEntityObject *self, PyObject *args);
 static PyObject *PyEntity_notify(PyEntityObject *self, PyObject *args);
 static PyObject *PyEntity_select(PyEntityObject *self);
+static PyObject *PyEntity_copy_pos(PyEntityObject *self, PyObject *out);
+static PyObject *PyEntity_copy_scale(PyEntityObject *self, PyObject *out);
+static PyObject *PyEntity_copy_rotation(PyEntityObject *self, PyObject *out);
 static PyObject *PyEntity_deselect(PyEntityObject *self);
+static PyObject *PyEntity_set_proximity_trigger(PyEntityObject *self, PyObject *args);
 
 static int       PyAnimEntity_init(PyAnimEntityObject *self, PyObject *args, PyObject *kwds);
 static PyObject *PyAnimEntity_play_anim(PyAnimEntityObject *self, PyObject *args);
+static PyObject *PyAnimEntity_clip_id(PyAnimEntityObject *self, PyObject *args);
 
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
@@ -119,6 +129,25 @@ static PyMethodDef PyEntity_methods[] = {
     (PyCFunction)PyEntity_deselect, METH_NOARGS,
     "Removes the entity from the current unit selection, if it is selected."},
 
+    {"copy_pos", 
+    (PyCFunction)PyEntity_copy_pos, METH_O,
+    "Copy the position into the given pf.Vec3 without allocating a new one."},
+
+    {"copy_scale", 
+    (PyCFunction)PyEntity_copy_scale, METH_O,
+    "Copy the scaling factors into the given pf.Vec3 without allocating a new one."},
+
+    {"copy_rotation", 
+    (PyCFunction)PyEntity_copy_rotation, METH_O,
+    "Copy the rotation into the given pf.Quat without allocating a new one."},
+
+    {"set_proximity_trigger", 
+    (PyCFunction)PyEntity_set_proximity_trigger, METH_VARARGS,
+    "Takes a radius and optional entity flags (pf.ENTITY_FLAG_*) that other entities must all "
+    "have. The entity is then sent an EVENT_ENTER_RANGE when a moving entity comes within the "
+    "radius of it and an EVENT_LEAVE_RANGE when one goes out of it, with the other entity as the "
+    "argument. A radius of 0 removes the trigger. Can only be set while a map is loaded."},
+
     {NULL}  /* Sentinel */
 };
 
@@ -129,15 +158,18 @@ static PyGetSetDef PyEntity_getset[] = {
     NULL},
     {"pos",
     (getter)PyEntity_get_pos, (setter)PyEntity_set_pos,
-    "The XYZ position in worldspace coordinates.",
+    "The XYZ position in worldspace coordinates, as a pf.Vec3. Can be set from a pf.Vec3 "
+    "or any sequence of 3 numbers.",
     NULL},
     {"scale",
     (getter)PyEntity_get_scale, (setter)PyEntity_set_scale,
-    "The XYZ scaling factors.",
+    "The XYZ scaling factors, as a pf.Vec3. Can be set from a pf.Vec3 or any sequence of 3 "
+    "numbers.",
     NULL},
     {"rotation",
     (getter)PyEntity_get_rotation, (setter)PyEntity_set_rotation,
-    "XYZW quaternion for rotaion about local origin.",
+    "XYZW quaternion for rotaion about local origin, as a pf.Quat. Can be set from a pf.Quat "
+    "or any sequence of 4 numbers.",
     NULL},
     {"selectable",
     (getter)PyEntity_get_selectable, (setter)PyEntity_set_selectable,
@@ -151,17 +183,31 @@ static PyGetSetDef PyEntity_getset[] = {
     (getter)PyEntity_get_pfobj_path, NULL,
     "The relative path of the PFOBJ file used to instantiate the entity. Readonly.",
     NULL},
+    {"uid",
+    (getter)PyEntity_get_uid, NULL,
+    "The unique integer ID of the entity. Readonly.",
+    NULL},
     {"speed",
     (getter)PyEntity_get_speed, (setter)PyEntity_set_speed,
     "Entity's movement speed (in OpenGL coordinates per second).",
     NULL},
+    {"vision_range",
+    (getter)PyEntity_get_vision_range, (setter)PyEntity_set_vision_range,
+    "Radius (in OpenGL coordinates) within which the entity clears the fog of war. 0 for entities "
+    "which don't see anything. Can only be set while a map is loaded.",
+    NULL},
     {NULL}  /* Sentinel */
 };
 
 static PyMethodDef PyAnimEntity_methods[] = {
     {"play_anim", 
     (PyCFunction)PyAnimEntity_play_anim, METH_VARARGS,
-    "Play the animation clip with the specified name." },
+    "Play the animation clip with the specified name or handle (returned by 'clip_id')." },
+
+    {"clip_id", 
+    (PyCFunction)PyAnimEntity_clip_id, METH_VARARGS,
+    "Returns the integer handle of the animation clip with the specified name. Playing "
+    "a clip by its handle skips the lookup by name." },
     {NULL}  /* Sentinel */
 };
 
@@ -303,100 +349,60 @@ static int PyEntity_set_name(PyEntityObject *self, PyObject *value, void *closur
     return 0;
 }
 
+/* Setting the position from a script places the entity, rather 
+ * than moving it, so don't interpolate from the old position. */
+static void s_entity_place(struct entity *ent, vec3_t pos)
+{
+    Entity_SetPos(ent, pos);
+    ent->prev_pos = pos;
+    G_UpdateEntityBounds(ent);
+}
+
 static PyObject *PyEntity_get_pos(PyEntityObject *self, void *closure)
 {
-    return Py_BuildValue("[f,f,f]", self->ent->pos.x, self->ent->pos.y, self->ent->pos.z);
+    return S_Vec3_New(&self->ent->pos);
 }
 
 static int PyEntity_set_pos(PyEntityObject *self, PyObject *value, void *closure)
 {
-    if(!PyList_Check(value)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a list.");
+    vec3_t pos;
+    if(!S_Vec3_Get(value, &pos))
         return -1;
-    }
-    
-    Py_ssize_t len = PyList_Size(value);
-    if(len != 3) {
-        PyErr_SetString(PyExc_TypeError, "Argument must have a size of 3."); 
-        return -1;
-    }
-
-    for(int i = 0; i < len; i++) {
-
-        PyObject *item = PyList_GetItem(value, i);
-        if(!PyFloat_Check(item)) {
-            PyErr_SetString(PyExc_TypeError, "List items must be floats.");
-            return -1;
-        }
-
-        self->ent->pos.raw[i] = PyFloat_AsDouble(item);
-    }
 
+    s_entity_place(self->ent, pos);
     return 0;
 }
 
 static PyObject *PyEntity_get_scale(PyEntityObject *self, void *closure)
 {
-    return Py_BuildValue("[f,f,f]", self->ent->scale.x, self->ent->scale.y, self->ent->scale.z);
+    return S_Vec3_New(&self->ent->scale);
 }
 
 static int PyEntity_set_scale(PyEntityObject *self, PyObject *value, void *closure)
 {
-    if(!PyList_Check(value)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a list.");
+    vec3_t scale;
+    if(!S_Vec3_Get(value, &scale))
         return -1;
-    }
-    
-    Py_ssize_t len = PyList_Size(value);
-    if(len != 3) {
-        PyErr_SetString(PyExc_TypeError, "Argument must have a size of 3."); 
-        return -1;
-    }
-
-    for(int i = 0; i < len; i++) {
-
-        PyObject *item = PyList_GetItem(value, i);
-        if(!PyFloat_Check(item)) {
-            PyErr_SetString(PyExc_TypeError, "List items must be floats.");
-            return -1;
-        }
-
-        self->ent->scale.raw[i] = PyFloat_AsDouble(item);
-    }
 
+    Entity_SetScale(self->ent, scale);
+    G_UpdateEntityBounds(self->ent);
     return 0;
 }
 
 static PyObject *PyEntity_get_rotation(PyEntityObject *self, void *closure)
 {
-    return Py_BuildValue("[f,f,f,f]", self->ent->rotation.x, self->ent->rotation.y, 
-        self->ent->rotation.z, self->ent->rotation.w);
+    return S_Quat_New(&self->ent->rotation);
 }
 
 static int PyEntity_set_rotation(PyEntityObject *self, PyObject *value, void *closure)
 {
-    if(!PyList_Check(value)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a list.");
+    quat_t rot;
+    if(!S_Quat_Get(value, &rot))
         return -1;
-    }
-    
-    Py_ssize_t len = PyList_Size(value);
-    if(len != 4) {
-        PyErr_SetString(PyExc_TypeError, "Argument must have a size of 4."); 
-        return -1;
-    }
-
-    for(int i = 0; i < len; i++) {
-
-        PyObject *item = PyList_GetItem(value, i);
-        if(!PyFloat_Check(item)) {
-            PyErr_SetString(PyExc_TypeError, "List items must be floats.");
-            return -1;
-        }
-
-        self->ent->rotation.raw[i] = PyFloat_AsDouble(item);
-    }
 
+    Entity_SetRotation(self->ent, rot);
+    self->ent->prev_rotation = self->ent->rotation;
+    G_UpdateEntityBounds(self->ent);
     return 0;
 }
 
@@ -438,6 +444,11 @@ static PyObject *PyEntity_get_pfobj_path(PyEntityObject *self, void *closure)
     return PyString_FromString(buff); 
 }
 
+static PyObject *PyEntity_get_uid(PyEntityObject *self, void *closure)
+{
+    return PyInt_FromLong(self->ent->uid);
+}
+
 static PyObject *PyEntity_get_speed(PyEntityObject *self, void *closure)
 {
     return PyFloat_FromDouble(self->ent->max_speed);
@@ -454,6 +465,25 @@ static int PyEntity_set_speed(PyEntityObject *self, PyObject *value, void *closu
     return 0;
 }
 
+static PyObject *PyEntity_get_vision_range(PyEntityObject *self, void *closure)
+{
+    return Py_BuildValue("f", G_Fog_GetVision(self->ent));
+}
+
+static int PyEntity_set_vision_range(PyEntityObject *self, PyObject *value, void *closure)
+{
+    if(!PyFloat_Check(value)) {
+        PyErr_SetString(PyExc_TypeError, "Vision range attribute must be a float.");
+        return -1;
+    }
+
+    if(!G_Fog_SetVision(self->ent, PyFloat_AS_DOUBLE(value))) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not set the vision range.");
+        return -1;
+    }
+    return 0;
+}
+
 static int PyEntity_set_selection_radius(PyEntityObject *self, PyObject *value, void *closure)
 {
     if(!PyFloat_Check(value)) {
@@ -551,6 +581,44 @@ static PyObject *PyEntity_deselect(PyEntityObject *self)
     Py_RETURN_NONE;
 }
 
+static PyObject *PyEntity_set_proximity_trigger(PyEntityObject *self, PyObject *args)
+{
+    float radius;
+    unsigned int filter = 0;
+
+    if(!PyArg_ParseTuple(args, "f|I", &radius, &filter)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a float and an optional integer.");
+        return NULL;
+    }
+
+    if(!G_Prox_SetTrigger(self->ent, radius, filter)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not set the proximity trigger.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyEntity_copy_pos(PyEntityObject *self, PyObject *out)
+{
+    if(!S_Vec3_Set(out, &self->ent->pos))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyEntity_copy_scale(PyEntityObject *self, PyObject *out)
+{
+    if(!S_Vec3_Set(out, &self->ent->scale))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyEntity_copy_rotation(PyEntityObject *self, PyObject *out)
+{
+    if(!S_Quat_Set(out, &self->ent->rotation))
+        return NULL;
+    Py_RETURN_NONE;
+}
+
 static int PyAnimEntity_init(PyAnimEntityObject *self, PyObject *args, PyObject *kwds)
 {
     const char *dirpath, *filename, *name, *clipname;
@@ -568,6 +636,25 @@ static int PyAnimEntity_init(PyAnimEntityObject *self, PyObject *args, PyObject
 }
 
 static PyObject *PyAnimEntity_play_anim(PyAnimEntityObject *self, PyObject *args)
+{
+    PyObject *clip;
+    if(!PyArg_ParseTuple(args, "O", &clip)
+    || !(PyInt_Check(clip) || PyString_Check(clip))) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string or an integer clip handle.");
+        return NULL;
+    }
+
+    int id = PyInt_Check(clip) ? PyInt_AS_LONG(clip)
+                               : A_ClipID(self->super.ent, PyString_AS_STRING(clip));
+
+    if(!A_SetActiveClipID(self->super.ent, id, ANIM_MODE_LOOP, 24)) {
+        PyErr_SetString(PyExc_ValueError, "The entity has no such animation clip.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyAnimEntity_clip_id(PyAnimEntityObject *self, PyObject *args)
 {
     const char *clipname;
     if(!PyArg_ParseTuple(args, "s", &clipname)) {
@@ -575,8 +662,12 @@ static PyObject *PyAnimEntity_play_anim(PyAnimEntityObject *self, PyObject *args
         return NULL;
     }
 
-    A_SetActiveClip(self->super.ent, clipname, ANIM_MODE_LOOP, 24);
-    Py_RETURN_NONE;
+    int id = A_ClipID(self->super.ent, clipname);
+    if(id < 0) {
+        PyErr_SetString(PyExc_ValueError, "The entity has no animation clip with that name.");
+        return NULL;
+    }
+    return PyInt_FromLong(id);
 }
 
 static PyObject *s_obj_from_attr(const struct attr *attr)
@@ -721,6 +812,44 @@ PyObject *S_Entity_ObjForUID(uint32_t uid)
     return kh_value(s_uid_pyobj_table, k);
 }
 
+struct entity *S_Entity_ForObj(PyObject *obj)
+{
+    if(!PyObject_TypeCheck(obj, &PyEntity_type))
+        return NULL;
+    return ((PyEntityObject*)obj)->ent;
+}
+
+bool S_Entity_AddGetSet(PyGetSetDef *def)
+{
+    PyObject *dict = PyEntity_type.tp_dict;
+    if(PyDict_GetItemString(dict, def->name)) {
+        PyErr_Format(PyExc_ValueError, "pf.Entity already has an attribute named '%s'.", def->name);
+        return false;
+    }
+
+    PyObject *descr = PyDescr_NewGetSet(&PyEntity_type, def);
+    if(!descr)
+        return false;
+
+    int ret = PyDict_SetItemString(dict, def->name, descr);
+    Py_DECREF(descr);
+    if(ret < 0)
+        return false;
+
+    /* Drop the cached lookups of this type and its' subclasses */
+    PyType_Modified(&PyEntity_type);
+    return true;
+}
+
+void S_Entity_RemoveGetSet(const char *name)
+{
+    if(PyDict_DelItemString(PyEntity_type.tp_dict, name) < 0) {
+        PyErr_Clear();
+        return;
+    }
+    PyType_Modified(&PyEntity_type);
+}
+
 script_opaque_t S_Entity_ObjFromAtts(const char *path, const char *name,
                                      const khash_t(attr) *attr_table, 
                                      const kvec_attr_t *construct_args)
@@ -805,3 +934,135 @@ PyObject *S_Entity_GetAllList(void)
     return ret;
 }
 
+PyObject *S_Entity_GetPositions(PyObject *entities, PyObject *out)
+{
+    PyObject *seq = PySequence_Fast(entities, "First argument must be a sequence of entities.");
+    if(!seq)
+        return NULL;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    PyObject *ret = NULL;
+
+    for(int i = 0; i < count; i++) {
+        if(!PyObject_TypeCheck(items[i], &PyEntity_type)) {
+            PyErr_SetString(PyExc_TypeError, "First argument must be a sequence of entities.");
+            goto out;
+        }
+    }
+
+    if(out) {
+
+        /* Any writable buffer of floats, such as an array.array('f') */
+        void *buff;
+        Py_ssize_t size;
+        if(0 != PyObject_AsWriteBuffer(out, &buff, &size))
+            goto out;
+
+        if(size < count * 3 * sizeof(float)) {
+            PyErr_SetString(PyExc_ValueError, "The buffer must hold 3 floats for every entity.");
+            goto out;
+        }
+
+        float *floats = buff;
+        for(int i = 0; i < count; i++)
+            memcpy(floats + i * 3, ((PyEntityObject*)items[i])->ent->pos.raw, 3 * sizeof(float));
+
+        Py_INCREF(out);
+        ret = out;
+        goto out;
+    }
+
+    ret = PyList_New(count);
+    if(!ret)
+        goto out;
+
+    for(int i = 0; i < count; i++) {
+
+        PyObject *pos = S_Vec3_New(&((PyEntityObject*)items[i])->ent->pos);
+        if(!pos) {
+            Py_CLEAR(ret);
+            goto out;
+        }
+        PyList_SET_ITEM(ret, i, pos); /* steals reference */
+    }
+
+out:
+    Py_DECREF(seq);
+    return ret;
+}
+
+bool S_Entity_SetPositions(PyObject *entities, PyObject *positions)
+{
+    bool ret = false;
+    PyObject *ents = PySequence_Fast(entities, "First argument must be a sequence of entities.");
+    if(!ents)
+        return false;
+
+    Py_ssize_t count = PySequence_Fast_GET_SIZE(ents);
+    PyObject **items = PySequence_Fast_ITEMS(ents);
+
+    for(int i = 0; i < count; i++) {
+        if(!PyObject_TypeCheck(items[i], &PyEntity_type)) {
+            PyErr_SetString(PyExc_TypeError, "First argument must be a sequence of entities.");
+            goto out_ents;
+        }
+    }
+
+    /* Either a flat buffer of floats, or a sequence of vectors */
+    if(!PyList_Check(positions) && !PyTuple_Check(positions) 
+    && PyObject_CheckReadBuffer(positions)) {
+
+        const void *buff;
+        Py_ssize_t size;
+        if(0 != PyObject_AsReadBuffer(positions, &buff, &size))
+            goto out_ents;
+
+        if(size != count * 3 * sizeof(float)) {
+            PyErr_SetString(PyExc_ValueError, "The buffer must hold 3 floats for every entity.");
+            goto out_ents;
+        }
+
+        const float *floats = buff;
+        for(int i = 0; i < count; i++) {
+            vec3_t pos = (vec3_t){floats[i*3 + 0], floats[i*3 + 1], floats[i*3 + 2]};
+            s_entity_place(((PyEntityObject*)items[i])->ent, pos);
+        }
+        ret = true;
+        goto out_ents;
+    }
+
+    PyObject *vecs = PySequence_Fast(positions, "Second argument must be a sequence of vectors.");
+    if(!vecs)
+        goto out_ents;
+
+    if(PySequence_Fast_GET_SIZE(vecs) != count) {
+        PyErr_SetString(PyExc_ValueError, "There must be one position for every entity.");
+        goto out_vecs;
+    }
+
+    /* Parse everything first, so that nothing is moved on an error */
+    vec3_t *parsed = malloc(count * sizeof(vec3_t));
+    if(!parsed && count) {
+        PyErr_NoMemory();
+        goto out_vecs;
+    }
+
+    for(int i = 0; i < count; i++) {
+        if(!S_Vec3_Get(PySequence_Fast_GET_ITEM(vecs, i), &parsed[i]))
+            goto out_parsed;
+    }
+
+    for(int i = 0; i < count; i++)
+        s_entity_place(((PyEntityObject*)items[i])->ent, parsed[i]);
+    ret = true;
+
+out_parsed:
+    free(parsed);
+out_vecs:
+    Py_DECREF(vecs);
+out_ents:
+    Py_DECREF(ents);
+    return ret;
+}
+
@@ -43,8 +43,24 @@ bool      S_Entity_Init(void);
 void      S_Entity_Shutdown(void);
 void      S_Entity_PyRegister(PyObject *module);
 PyObject *S_Entity_ObjForUID(uint32_t uid);
+/* Returns NULL if 'obj' is not an entity object */
+struct entity *S_Entity_ForObj(PyObject *obj);
+/* Add a data descriptor to pf.Entity, which is then found ahead of the instance 
+ * dictionary of every entity object, including those of subclasses. Fails with
+ * a Python exception if pf.Entity already has an attribute with the name. The 
+ * definition must outlive the descriptor. */
+bool      S_Entity_AddGetSet(PyGetSetDef *def);
+void      S_Entity_RemoveGetSet(const char *name);
 /* Returned list has a stolen reference to each object */
 PyObject *S_Entity_GetAllList(void);
 
+/* Bulk position access for a sequence of entities. With an 'out' buffer, 
+ * 3 floats per entity are written into it and it is returned. Otherwise a 
+ * new list of pf.Vec3 objects is returned. Positions can be set from a 
+ * sequence of vectors or from a flat buffer of 3 floats per entity. A Python 
+ * exception is set on failure. */
+PyObject *S_Entity_GetPositions(PyObject *entities, PyObject *out);
+bool      S_Entity_SetPositions(PyObject *entities, PyObject *positions);
+
 #endif
 
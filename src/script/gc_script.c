@@ -0,0 +1,173 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "gc_script.h"
+#include "../event.h"
+#include "../config.h"
+#include "../perf.h"
+
+#include <SDL.h>
+
+#define NUM_GENS        (3)
+/* A generation is collected regardless of the budget once it is this many 
+ * times over its threshold */
+#define MAX_OVERDUE     (4)
+/* Weight of the newest pause in the running estimate of a generation's */
+#define PAUSE_WEIGHT    (0.25)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static PyObject            *s_gc_module;
+static long                 s_thresholds[NUM_GENS];
+static double               s_budget_ms = CONFIG_SCRIPT_GC_BUDGET_MS;
+static struct gc_gen_stats  s_stats[NUM_GENS];
+static double               s_expected_ms[NUM_GENS];
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool s_gc_get_ints(const char *method, long out[NUM_GENS])
+{
+    PyObject *ret = PyObject_CallMethod(s_gc_module, (char*)method, NULL);
+    if(!ret)
+        return false;
+
+    bool ok = PyArg_ParseTuple(ret, "lll", &out[0], &out[1], &out[2]);
+    Py_DECREF(ret);
+    return ok;
+}
+
+static int s_gc_pick_gen(void)
+{
+    long counts[NUM_GENS];
+    if(!s_gc_get_ints("get_count", counts)) {
+        PyErr_Clear();
+        return -1;
+    }
+
+    /* Same as the interpreter: the oldest generation over its threshold */
+    int gen = NUM_GENS - 1;
+    while(gen >= 0 && counts[gen] <= s_thresholds[gen])
+        gen--;
+
+    while(gen > 0 
+       && s_budget_ms > 0.0
+       && s_stats[gen].collections > 0
+       && s_expected_ms[gen] > s_budget_ms
+       && counts[gen] <= s_thresholds[gen] * MAX_OVERDUE)
+        gen--;
+
+    return gen;
+}
+
+static void s_gc_on_update_end(void *user, void *event)
+{
+    int gen = s_gc_pick_gen();
+    if(gen < 0)
+        return;
+
+    uint64_t start = SDL_GetPerformanceCounter();
+    PyObject *ret = PyObject_CallMethod(s_gc_module, "collect", "i", gen);
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+    if(!ret) {
+        PyErr_Print();
+        return;
+    }
+    Py_DECREF(ret);
+
+    struct gc_gen_stats *stats = &s_stats[gen];
+    s_expected_ms[gen] = stats->collections ? (s_expected_ms[gen] * (1.0 - PAUSE_WEIGHT) + ms * PAUSE_WEIGHT) 
+                                            : ms;
+    stats->collections++;
+    stats->last_ms = ms;
+    Perf_CountGCPause(gen, ms);
+    stats->total_ms += ms;
+    if(ms > stats->max_ms)
+        stats->max_ms = ms;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_GC_Init(void)
+{
+    s_gc_module = PyImport_ImportModule("gc");
+    if(!s_gc_module)
+        goto fail_import;
+
+    if(!s_gc_get_ints("get_threshold", s_thresholds))
+        goto fail_call;
+
+    PyObject *ret = PyObject_CallMethod(s_gc_module, "disable", NULL);
+    if(!ret)
+        goto fail_call;
+    Py_DECREF(ret);
+
+    if(!E_Global_Register(EVENT_UPDATE_END, s_gc_on_update_end, NULL))
+        goto fail_register;
+
+    return true;
+
+fail_register:
+    Py_XDECREF(PyObject_CallMethod(s_gc_module, "enable", NULL));
+fail_call:
+    Py_CLEAR(s_gc_module);
+fail_import:
+    PyErr_Print();
+    return false;
+}
+
+void S_GC_Shutdown(void)
+{
+    E_Global_Unregister(EVENT_UPDATE_END, s_gc_on_update_end);
+    Py_CLEAR(s_gc_module);
+}
+
+void S_GC_SetBudget(double ms)
+{
+    s_budget_ms = ms > 0.0 ? ms : 0.0;
+}
+
+void S_GC_GetStats(struct gc_gen_stats out[3])
+{
+    for(int i = 0; i < NUM_GENS; i++)
+        out[i] = s_stats[i];
+}
+
@@ -0,0 +1,67 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef GC_SCRIPT_H
+#define GC_SCRIPT_H
+
+#include <Python.h> /* Must be first */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Python's automatic cyclic garbage collection is turned off, as it would 
+ * otherwise run in the middle of whatever script happened to trip the 
+ * allocation thresholds. Instead, a collection is made at the end of each 
+ * frame's event servicing when the thresholds have been crossed. The oldest
+ * generation that is due is collected, unless its last pauses suggest that
+ * it would overrun the budget, in which case a younger one is collected 
+ * instead. A collection can only be put off for so long. */
+
+struct gc_gen_stats{
+    uint64_t collections;
+    double   last_ms;
+    double   max_ms;
+    double   total_ms;
+};
+
+bool      S_GC_Init(void);
+void      S_GC_Shutdown(void);
+
+/* A budget of 0 lets every collection run as soon as it is due */
+void      S_GC_SetBudget(double ms);
+void      S_GC_GetStats(struct gc_gen_stats out[3]);
+
+#endif
+
@@ -40,6 +40,7 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* 'Handle' type to let the rest of the engine hold on to scripting objects 
  * without needing to include Python.h */
@@ -62,8 +63,19 @@ void            S_RunEventHandler(script_opaque_t callable, script_opaque_t user
 /* Decrement reference count for Python objects. 
  * No-op in the case of a NULL-pointer passed in */
 void            S_Release(script_opaque_t obj);
+void            S_Retain(script_opaque_t obj);
+/* Returns a new reference to an immutable object, so a single one can be 
+ * passed to all the handlers of an event. Arguments that can only take on
+ * a few values are shared between events. */
 script_opaque_t S_WrapEngineEventArg(enum eventtype e, void *arg);
+/* Returns a new list of (entity, arg) tuples. Entities that no longer have 
+ * a script object are left out. */
+script_opaque_t S_WrapEntityBatch(size_t count, const uint32_t uids[], 
+                                  const script_opaque_t args[]);
 bool            S_ObjectsEqual(script_opaque_t a, script_opaque_t b);
+/* Returns a new reference to the object serialized with Python's 'marshal' 
+ * format, or NULL if the data does not hold a valid one */
+script_opaque_t S_UnmarshalArg(const void *data, size_t size);
 
 /*###########################################################################*/
 /* SCRIPT UI                                                                 */
@@ -71,6 +83,17 @@ bool            S_ObjectsEqual(script_opaque_t a, script_opaque_t b);
 
 bool S_UI_MouseOverWindow(int mouse_x, int mouse_y);
 
+/*###########################################################################*/
+/* SCRIPT AI                                                                 */
+/*###########################################################################*/
+
+/* Brackets a stretch of the main loop that does not run any scripts, such as
+ * waiting for the next frame. The threaded AI handlers run only inside these 
+ * windows. Closing the window waits until the AI thread reaches its next call
+ * or return. These are no-ops while there is no work for the AI thread. */
+void S_AI_WindowOpen(void);
+void S_AI_WindowClose(void);
+
 /*###########################################################################*/
 /* SCRIPT ENTITY                                                             */
 /*###########################################################################*/
@@ -0,0 +1,285 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "sched_script.h"
+#include "../game/public/game.h"
+#include "../lib/public/khash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* A pending delayed call ('args' is the tuple of arguments) or a sleeping 
+ * coroutine ('args' is NULL). Both references are owned. */
+struct sched_entry{
+    PyObject *obj;
+    PyObject *args;
+    uint32_t  timer;
+};
+
+KHASH_MAP_INIT_INT(sched, struct sched_entry)
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+/* Keyed by the handle given out to the script. The timers are passed the 
+ * handle rather than the entry, so that nothing dangles once an entry has 
+ * been cancelled. */
+static khash_t(sched) *s_entries;
+static uint32_t        s_next_handle;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static void s_on_timer(void *arg);
+
+static uint32_t s_new_handle(void)
+{
+    /* 0 is never handed out */
+    if(++s_next_handle == 0)
+        ++s_next_handle;
+    return s_next_handle;
+}
+
+static bool s_schedule(uint32_t handle, float seconds)
+{
+    khiter_t k = kh_get(sched, s_entries, handle);
+    assert(k != kh_end(s_entries));
+
+    uint32_t timer = G_Timer_After(seconds, s_on_timer, (void*)(uintptr_t)handle);
+    if(!timer)
+        return false;
+
+    kh_value(s_entries, k).timer = timer;
+    return true;
+}
+
+static void s_drop(uint32_t handle)
+{
+    khiter_t k = kh_get(sched, s_entries, handle);
+    if(k == kh_end(s_entries))
+        return;
+
+    struct sched_entry entry = kh_value(s_entries, k);
+    kh_del(sched, s_entries, k);
+
+    Py_DECREF(entry.obj);
+    Py_XDECREF(entry.args);
+}
+
+/* Runs the coroutine up to its next 'yield' and puts it back to sleep. The 
+ * entry is dropped once the generator is exhausted. */
+static bool s_resume(uint32_t handle, PyObject *gen)
+{
+    /* The coroutine may cancel itself while it runs */
+    Py_INCREF(gen);
+    PyObject *ret = PyIter_Next(gen);
+    Py_DECREF(gen);
+
+    if(!ret) {
+        s_drop(handle);
+        return !PyErr_Occurred();
+    }
+
+    float seconds = 0.0f;
+    if(ret != Py_None) {
+        seconds = PyFloat_AsDouble(ret);
+        if(PyErr_Occurred()) {
+            PyErr_SetString(PyExc_TypeError, "Coroutines must yield a number of seconds or None.");
+            Py_DECREF(ret);
+            s_drop(handle);
+            return false;
+        }
+    }
+    Py_DECREF(ret);
+
+    if(kh_get(sched, s_entries, handle) == kh_end(s_entries))
+        return true;
+
+    if(!s_schedule(handle, seconds)) {
+        s_drop(handle);
+        PyErr_NoMemory();
+        return false;
+    }
+    return true;
+}
+
+static void s_on_timer(void *arg)
+{
+    uint32_t handle = (uintptr_t)arg;
+    khiter_t k = kh_get(sched, s_entries, handle);
+    assert(k != kh_end(s_entries));
+    struct sched_entry entry = kh_value(s_entries, k);
+
+    if(!entry.args) {
+        kh_value(s_entries, k).timer = 0;
+        if(!s_resume(handle, entry.obj)) {
+            PyErr_Print();
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    /* Delayed calls happen once, so the entry is handed over to the call */
+    kh_del(sched, s_entries, k);
+    PyObject *ret = PyObject_CallObject(entry.obj, entry.args);
+    Py_DECREF(entry.obj);
+    Py_DECREF(entry.args);
+
+    Py_XDECREF(ret);
+    if(!ret) {
+        PyErr_Print();
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Takes over the reference to 'args' on success */
+static bool s_add(PyObject *obj, PyObject *args, uint32_t *out_handle)
+{
+    uint32_t handle = s_new_handle();
+
+    int ret;
+    khiter_t k = kh_put(sched, s_entries, handle, &ret);
+    if(ret == -1) {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    Py_INCREF(obj);
+    kh_value(s_entries, k) = (struct sched_entry){obj, args, 0};
+    *out_handle = handle;
+    return true;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool S_Sched_Init(void)
+{
+    s_next_handle = 0;
+    s_entries = kh_init(sched);
+    return (s_entries != NULL);
+}
+
+void S_Sched_Shutdown(void)
+{
+    for(khiter_t k = kh_begin(s_entries); k != kh_end(s_entries); k++) {
+
+        if(!kh_exist(s_entries, k))
+            continue;
+
+        struct sched_entry *entry = &kh_value(s_entries, k);
+        if(entry->timer)
+            G_Timer_Cancel(entry->timer);
+        Py_DECREF(entry->obj);
+        Py_XDECREF(entry->args);
+    }
+    kh_destroy(sched, s_entries);
+}
+
+PyObject *S_Sched_CallLater(PyObject *args)
+{
+    if(PyTuple_GET_SIZE(args) < 2
+    || !PyNumber_Check(PyTuple_GET_ITEM(args, 0))
+    || !PyCallable_Check(PyTuple_GET_ITEM(args, 1))) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a float and a callable, followed "
+            "by the arguments to call it with.");
+        return NULL;
+    }
+
+    float seconds = PyFloat_AsDouble(PyTuple_GET_ITEM(args, 0));
+    PyObject *callable = PyTuple_GET_ITEM(args, 1);
+    if(PyErr_Occurred())
+        return NULL;
+
+    PyObject *call_args = PyTuple_GetSlice(args, 2, PyTuple_GET_SIZE(args));
+    if(!call_args)
+        return NULL;
+
+    uint32_t handle;
+    if(!s_add(callable, call_args, &handle)) {
+        Py_DECREF(call_args);
+        return NULL;
+    }
+
+    if(!s_schedule(handle, seconds)) {
+        s_drop(handle);
+        return PyErr_NoMemory();
+    }
+    return PyInt_FromLong(handle);
+}
+
+PyObject *S_Sched_StartCoroutine(PyObject *args)
+{
+    PyObject *gen;
+
+    if(!PyArg_ParseTuple(args, "O", &gen) || !PyGen_Check(gen)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a generator.");
+        return NULL;
+    }
+
+    uint32_t handle;
+    if(!s_add(gen, NULL, &handle))
+        return NULL;
+
+    if(!s_resume(handle, gen))
+        return NULL;
+    return PyInt_FromLong(handle);
+}
+
+PyObject *S_Sched_Cancel(PyObject *args)
+{
+    unsigned int handle;
+
+    if(!PyArg_ParseTuple(args, "I", &handle)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a handle returned by 'call_later' "
+            "or 'start_coroutine'.");
+        return NULL;
+    }
+
+    khiter_t k = kh_get(sched, s_entries, handle);
+    if(k == kh_end(s_entries))
+        Py_RETURN_FALSE;
+
+    /* A coroutine cancelling itself is running, not waiting on a timer */
+    if(kh_value(s_entries, k).timer)
+        G_Timer_Cancel(kh_value(s_entries, k).timer);
+    s_drop(handle);
+    Py_RETURN_TRUE;
+}
+
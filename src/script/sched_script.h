@@ -0,0 +1,65 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef SCHED_SCRIPT_H
+#define SCHED_SCRIPT_H
+
+#include <Python.h> /* Must be first */
+
+#include <stdbool.h>
+
+/* Delayed calls and generator-based coroutines, driven by the engine's timers 
+ * so that a script waiting on one costs nothing until it is resumed. All the
+ * pending calls are dropped by S_Sched_Shutdown. */
+
+bool      S_Sched_Init(void);
+void      S_Sched_Shutdown(void);
+
+/* Arguments: (seconds, callable, *args). Returns a handle for cancelling 
+ * the call. */
+PyObject *S_Sched_CallLater(PyObject *args);
+
+/* Arguments: (generator). The generator is advanced up to its first 'yield'
+ * right away. It then yields the number of seconds to sleep for before it 
+ * is resumed, or None to be resumed on the next simulation step. Returns a 
+ * handle for cancelling the coroutine. */
+PyObject *S_Sched_StartCoroutine(PyObject *args);
+
+/* Arguments: (handle). Returns True if the call or coroutine was still 
+ * pending. */
+PyObject *S_Sched_Cancel(PyObject *args);
+
+#endif
+
@@ -34,8 +34,14 @@
  */
 
 #include <Python.h> /* Must be included first */
+#include <marshal.h>
 
 #include "entity_script.h"
+#include "vec_script.h"
+#include "sched_script.h"
+#include "ai_script.h"
+#include "component_script.h"
+#include "gc_script.h"
 #include "ui_script.h"
 #include "tile_script.h"
 #include "script_constants.h"
@@ -45,13 +51,22 @@
 #include "../render/public/render.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
+#include "../navigation/public/nav.h"
 #include "../event.h"
 #include "../config.h"
 #include "../scene.h"
+#include "../perf.h"
+#include "../telemetry.h"
+#include "../pace.h"
+#include "../mem.h"
+#include "../asset_load.h"
+#include "../net.h"
 
 #include <SDL.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 
 static PyObject *PyPf_new_game(PyObject *self, PyObject *args);
@@ -60,11 +75,37 @@ static PyObject *PyPf_set_map_render_mode(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_ambient_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_color(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args);
+static PyObject *PyPf_add_point_light(PyObject *self, PyObject *args);
+static PyObject *PyPf_remove_point_light(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_point_light_pos(PyObject *self, PyObject *args);
+static PyObject *PyPf_emit_sparks(PyObject *self, PyObject *args);
 static PyObject *PyPf_load_scene(PyObject *self, PyObject *args);
+static PyObject *PyPf_load_scene_async(PyObject *self, PyObject *args);
+static PyObject *PyPf_convert_pfobj(PyObject *self, PyObject *args);
+static PyObject *PyPf_compile_scene(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_register_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args);
 static PyObject *PyPf_global_event(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_event_coalescing(PyObject *self, PyObject *args);
+static PyObject *PyPf_register_entity_batch_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_unregister_entity_batch_handler(PyObject *self, PyObject *args);
+static PyObject *PyPf_call_later(PyObject *self, PyObject *args);
+static PyObject *PyPf_start_coroutine(PyObject *self, PyObject *args);
+static PyObject *PyPf_cancel_scheduled(PyObject *self, PyObject *args);
+static PyObject *PyPf_register_threaded_ai(PyObject *self, PyObject *args);
+static PyObject *PyPf_unregister_threaded_ai(PyObject *self, PyObject *args);
+static PyObject *PyPf_ai_command(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_positions(PyObject *self, PyObject *args);
+static PyObject *PyPf_entities_in_circle(PyObject *self, PyObject *args);
+static PyObject *PyPf_entities_in_rect(PyObject *self, PyObject *args);
+static PyObject *PyPf_nearest_entity(PyObject *self, PyObject *args);
+static PyObject *PyPf_entity_for_uid(PyObject *self, PyObject *args);
+static PyObject *PyPf_declare_component(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_components(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_components(PyObject *self, PyObject *args);
+static PyObject *PyPf_filter_entities(PyObject *self, PyObject *args);
 
 static PyObject *PyPf_activate_camera(PyObject *self, PyObject *args);
 static PyObject *PyPf_prev_frame_ms(PyObject *self);
@@ -77,14 +118,105 @@ static PyObject *PyPf_enable_unit_selection(PyObject *self);
 static PyObject *PyPf_disable_unit_selection(PyObject *self);
 static PyObject *PyPf_clear_unit_selection(PyObject *self);
 static PyObject *PyPf_get_unit_selection(PyObject *self);
+static PyObject *PyPf_get_entity_under_cursor(PyObject *self);
+static PyObject *PyPf_enable_gpu_picking(PyObject *self);
+static PyObject *PyPf_disable_gpu_picking(PyObject *self);
 
 static PyObject *PyPf_update_chunk_materials(PyObject *self, PyObject *args);
 static PyObject *PyPf_update_tile(PyObject *self, PyObject *args);
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args);
+static PyObject *PyPf_update_tile_region(PyObject *self, PyObject *args);
+static PyObject *PyPf_begin_map_edit(PyObject *self);
+static PyObject *PyPf_end_map_edit(PyObject *self);
+static PyObject *PyPf_undo_map_edit(PyObject *self);
+static PyObject *PyPf_redo_map_edit(PyObject *self);
+static PyObject *PyPf_clear_map_edits(PyObject *self);
+static PyObject *PyPf_map_edit_stats(PyObject *self);
+static PyObject *PyPf_save_map(PyObject *self, PyObject *args);
+static PyObject *PyPf_scatter_static(PyObject *self, PyObject *args);
+static PyObject *PyPf_save_snapshot(PyObject *self, PyObject *args);
+static PyObject *PyPf_load_snapshot(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args);
 static PyObject *PyPf_set_minimap_position(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_minimap_unit_rate(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_crowd_anim_distance(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_anim_lod(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_mesh_lod(PyObject *self, PyObject *args);
 static PyObject *PyPf_mouse_over_minimap(PyObject *self);
 static PyObject *PyPf_map_height_at_point(PyObject *self, PyObject *args);
+static PyObject *PyPf_map_heights_at_points(PyObject *self, PyObject *args);
+static PyObject *PyPf_map_chunk_tiles(PyObject *self, PyObject *args);
+static PyObject *PyPf_map_heightfield(PyObject *self);
 static PyObject *PyPf_map_pos_under_cursor(PyObject *self);
+static PyObject *PyPf_map_raycast(PyObject *self, PyObject *args);
+static PyObject *PyPf_map_stream_stats(PyObject *self);
+
+static PyObject *PyPf_nav_cache_stats(PyObject *self);
+static PyObject *PyPf_set_nav_cache_budget(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_nav_goal_region(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_nav_path_budget(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_nav_flow_window(PyObject *self, PyObject *args);
+static PyObject *PyPf_path_exists(PyObject *self, PyObject *args);
+static PyObject *PyPf_path_cost(PyObject *self, PyObject *args);
+static PyObject *PyPf_pathable(PyObject *self, PyObject *args);
+static PyObject *PyPf_nav_raycast(PyObject *self, PyObject *args);
+
+static PyObject *PyPf_set_move_avoidance(PyObject *self, PyObject *args);
+static PyObject *PyPf_set_move_waypoint_group(PyObject *self, PyObject *args);
+static PyObject *PyPf_move_avoidance_stats(PyObject *self, PyObject *args);
+static PyObject *PyPf_enable_deterministic_movement(PyObject *self);
+static PyObject *PyPf_disable_deterministic_movement(PyObject *self);
+static PyObject *PyPf_move_order(PyObject *self, PyObject *args);
+static PyObject *PyPf_movement_checksum(PyObject *self);
+static PyObject *PyPf_net_start(PyObject *self, PyObject *args);
+static PyObject *PyPf_net_stop(PyObject *self);
+static PyObject *PyPf_net_move_order(PyObject *self, PyObject *args);
+static PyObject *PyPf_net_global_event(PyObject *self, PyObject *args);
+static PyObject *PyPf_net_stats(PyObject *self);
+
+static PyObject *PyPf_enable_occlusion_culling(PyObject *self);
+static PyObject *PyPf_disable_occlusion_culling(PyObject *self);
+static PyObject *PyPf_occlusion_cull_stats(PyObject *self);
+static PyObject *PyPf_enable_gpu_culling(PyObject *self);
+static PyObject *PyPf_disable_gpu_culling(PyObject *self);
+static PyObject *PyPf_gpu_cull_stats(PyObject *self);
+static PyObject *PyPf_enable_depth_prepass(PyObject *self);
+static PyObject *PyPf_disable_depth_prepass(PyObject *self);
+static PyObject *PyPf_enable_heightfield_terrain(PyObject *self);
+static PyObject *PyPf_disable_heightfield_terrain(PyObject *self);
+static PyObject *PyPf_enable_preskinning(PyObject *self);
+static PyObject *PyPf_disable_preskinning(PyObject *self);
+static PyObject *PyPf_enable_fog_of_war(PyObject *self);
+static PyObject *PyPf_disable_fog_of_war(PyObject *self);
+static PyObject *PyPf_set_fog_height_los(PyObject *self, PyObject *args);
+static PyObject *PyPf_enable_shadows(PyObject *self);
+static PyObject *PyPf_disable_shadows(PyObject *self);
+static PyObject *PyPf_set_unit_overlay(PyObject *self, PyObject *args);
+static PyObject *PyPf_clear_unit_overlay(PyObject *self, PyObject *args);
+
+static PyObject *PyPf_set_render_scale(PyObject *self, PyObject *args);
+static PyObject *PyPf_enable_dynamic_resolution(PyObject *self, PyObject *args);
+static PyObject *PyPf_disable_dynamic_resolution(PyObject *self);
+static PyObject *PyPf_render_scale_stats(PyObject *self);
+static PyObject *PyPf_render_stats(PyObject *self);
+
+static PyObject *PyPf_enable_perf_overlay(PyObject *self);
+static PyObject *PyPf_disable_perf_overlay(PyObject *self);
+static PyObject *PyPf_capture_perf_trace(PyObject *self, PyObject *args);
+static PyObject *PyPf_perf_totals(PyObject *self);
+static PyObject *PyPf_reset_perf_totals(PyObject *self);
+static PyObject *PyPf_set_spike_capture(PyObject *self, PyObject *args);
+static PyObject *PyPf_start_telemetry(PyObject *self, PyObject *args);
+static PyObject *PyPf_stop_telemetry(PyObject *self);
+static PyObject *PyPf_memory_stats(PyObject *self);
+static PyObject *PyPf_script_profile(PyObject *self);
+static PyObject *PyPf_reset_script_profile(PyObject *self);
+static PyObject *PyPf_set_script_budget(PyObject *self, PyObject *args);
+static PyObject *PyPf_gc_stats(PyObject *self);
+static PyObject *PyPf_set_gc_budget(PyObject *self, PyObject *args);
+static PyObject *PyPf_frame_time_stats(PyObject *self);
+static PyObject *PyPf_set_frame_rate_limit(PyObject *self, PyObject *args);
+static PyObject *PyPf_get_frame_rate_limit(PyObject *self);
 
 static PyObject *PyPf_multiply_quaternions(PyObject *self, PyObject *args);
 
@@ -121,10 +253,52 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_set_emit_light_pos, METH_VARARGS,
     "Sets the position (in XYZ worldspace coordinates)"},
 
+    {"add_point_light", 
+    (PyCFunction)PyPf_add_point_light, METH_VARARGS,
+    "Adds a point light at a position (in XYZ worldspace coordinates), with a color (specified "
+    "as an RGB multiplier) and a radius past which it has no effect. Returns the light's ID."},
+
+    {"remove_point_light", 
+    (PyCFunction)PyPf_remove_point_light, METH_VARARGS,
+    "Removes the point light with the ID returned by 'add_point_light'."},
+
+    {"set_point_light_pos", 
+    (PyCFunction)PyPf_set_point_light_pos, METH_VARARGS,
+    "Moves the point light with the ID returned by 'add_point_light' to a new position."},
+
+    {"emit_sparks", 
+    (PyCFunction)PyPf_emit_sparks, METH_VARARGS,
+    "Shows a burst of sparks of an (R, G, B, A) color flying out of a position (in XYZ worldspace "
+    "coordinates) and falling back down. Optionally takes the number of sparks (default 16), "
+    "their speed (default 10.0) and how long they last in seconds (default 0.6)."},
+
     {"load_scene", 
     (PyCFunction)PyPf_load_scene, METH_VARARGS,
     "Import list of entities from a PFSCENE file (specified as a path string)."},
 
+    {"load_scene_async", 
+    (PyCFunction)PyPf_load_scene_async, METH_VARARGS,
+    "Import the entities of a PFSCENE file without stalling the game. The file and the models "
+    "it uses are read on a loader thread, and the entities are created at the start of a later "
+    "frame. Takes the path, a callable and a user argument. The callable is then called with the "
+    "user argument and the list of all entities (as returned by 'load_scene'), or None if the "
+    "scene could not be loaded."},
+
+    {"convert_pfobj", 
+    (PyCFunction)PyPf_convert_pfobj, METH_VARARGS,
+    "Write the binary variant of a PFOBJ file (specified as a directory relative to the base "
+    "directory, and a filename, as for 'pf.Entity') alongside "
+    "it, with the '.pfobjb' extension. Entities are loaded from the binary file whenever it is "
+    "newer than the PFOBJ file. Returns False if the file could not be converted."},
+
+    {"compile_scene", 
+    (PyCFunction)PyPf_compile_scene, METH_VARARGS,
+    "Write the binary variant of a PFSCENE file (specified as a path string) alongside it, with "
+    "the '.pfsceneb' extension. Scenes are loaded from the binary file whenever it is not older "
+    "than the PFSCENE file. Static entities without a 'class' attribute are then created without "
+    "a script object, and are not returned by 'load_scene'. Returns False if the file could not "
+    "be compiled."},
+
     {"register_event_handler", 
     (PyCFunction)PyPf_register_event_handler, METH_VARARGS,
     "Adds a script event handler to be called when the specified global event occurs."},
@@ -137,6 +311,109 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_global_event, METH_VARARGS,
     "Broadcast a global event so all handlers can get invoked."},
 
+    {"set_event_coalescing", 
+    (PyCFunction)PyPf_set_event_coalescing, METH_VARARGS,
+    "Set how an event of the specified type is merged with the one queued right before it, "
+    "when both are for the same receiver. The policy is one of EC_NONE, EC_KEEP_LATEST, "
+    "EC_SUM_DELTAS (only for SDL_MOUSEMOTION and SDL_MOUSEWHEEL) and EC_DROP_DUPLICATES. "
+    "Mouse motion and wheel events have their deltas summed by default."},
+
+    {"register_entity_batch_handler", 
+    (PyCFunction)PyPf_register_entity_batch_handler, METH_VARARGS,
+    "Adds a script event handler to be called once per frame with all the events of the "
+    "specified type that were sent to any entity. The handler is called with the user argument "
+    "and a list of (entity, event argument) tuples, and only when the list is not empty."},
+
+    {"unregister_entity_batch_handler", 
+    (PyCFunction)PyPf_unregister_entity_batch_handler, METH_VARARGS,
+    "Removes a script event handler added by 'register_entity_batch_handler'."},
+
+    {"call_later", 
+    (PyCFunction)PyPf_call_later, METH_VARARGS,
+    "Calls the callable with any extra arguments after the given number of seconds of game time. "
+    "Returns a handle which can be passed to 'cancel_scheduled'."},
+
+    {"start_coroutine", 
+    (PyCFunction)PyPf_start_coroutine, METH_VARARGS,
+    "Runs a generator as a coroutine. It is advanced up to its first 'yield' right away. Each "
+    "'yield' then gives the number of seconds to sleep for, or None to be resumed on the next "
+    "simulation step. Returns a handle which can be passed to 'cancel_scheduled'."},
+
+    {"cancel_scheduled", 
+    (PyCFunction)PyPf_cancel_scheduled, METH_VARARGS,
+    "Cancels a call or coroutine started with 'call_later' or 'start_coroutine'. Returns "
+    "True if it was still pending."},
+
+    {"register_threaded_ai", 
+    (PyCFunction)PyPf_register_threaded_ai, METH_VARARGS,
+    "Runs the callable on the AI thread, with a read-only pf.MapBuffer snapshot of the entities "
+    "and the number of the tick it was taken at. The snapshot's records have the fields 'uid', "
+    "'x', 'y', 'z', 'flags', 'radius' and 'max_speed'. A new snapshot is taken once all the "
+    "threaded handlers are done with the last one. The handlers must act on the game through "
+    "'ai_command' only."},
+
+    {"unregister_threaded_ai", 
+    (PyCFunction)PyPf_unregister_threaded_ai, METH_VARARGS,
+    "Removes a handler added by 'register_threaded_ai'. Returns True if it had been registered."},
+
+    {"ai_command", 
+    (PyCFunction)PyPf_ai_command, METH_VARARGS,
+    "Queues up a call of the callable with any extra arguments, to be made on the main thread "
+    "at the next simulation tick. This is how the threaded AI handlers issue orders."},
+
+    {"get_positions", 
+    (PyCFunction)PyPf_get_positions, METH_VARARGS,
+    "Get the positions of a sequence of entities as a list of pf.Vec3. When a writable buffer "
+    "of floats (ex: array.array('f')) is passed as the second argument, 3 floats per entity "
+    "are written into it instead, and it is returned."},
+
+    {"set_positions", 
+    (PyCFunction)PyPf_set_positions, METH_VARARGS,
+    "Place a sequence of entities at the given positions, which are either a sequence of "
+    "vectors or a buffer of 3 floats per entity (ex: array.array('f'))."},
+
+    {"entities_in_circle", 
+    (PyCFunction)PyPf_entities_in_circle, METH_VARARGS,
+    "Returns a tuple of the movable entities whose position lies within the given radius of "
+    "an (X, Z) point."},
+
+    {"entities_in_rect", 
+    (PyCFunction)PyPf_entities_in_rect, METH_VARARGS,
+    "Returns a tuple of the movable entities whose position lies within the rectangle spanned by "
+    "two (X, Z) corners."},
+
+    {"nearest_entity", 
+    (PyCFunction)PyPf_nearest_entity, METH_VARARGS,
+    "Returns the movable entity closest to an (X, Z) point, or None. Takes an optional maximum "
+    "distance and an optional entity to leave out of the search."},
+
+    {"entity_for_uid", 
+    (PyCFunction)PyPf_entity_for_uid, METH_VARARGS,
+    "Returns the entity with the given 'uid', or None if there is no such entity."},
+
+    {"declare_component", 
+    (PyCFunction)PyPf_declare_component, METH_VARARGS,
+    "Takes a name, a type (pf.COMPONENT_FLOAT, pf.COMPONENT_INT, pf.COMPONENT_VEC2 or "
+    "pf.COMPONENT_ENTITY) and an optional default value. Every entity then gets an attribute "
+    "with that name, whose values are stored by the engine rather than in the entity's "
+    "dictionary."},
+
+    {"get_components", 
+    (PyCFunction)PyPf_get_components, METH_VARARGS,
+    "Get the values of a component for a sequence of entities as a list. When a writable "
+    "buffer (ex: array.array('f') or array.array('i')) is passed as the third argument, the "
+    "raw values are written into it instead, and it is returned."},
+
+    {"set_components", 
+    (PyCFunction)PyPf_set_components, METH_VARARGS,
+    "Set the values of a component for a sequence of entities, from a sequence of values or "
+    "from a buffer of raw values."},
+
+    {"filter_entities", 
+    (PyCFunction)PyPf_filter_entities, METH_VARARGS,
+    "Takes a sequence of entities, the name of a numeric component and a minimum and maximum "
+    "value. Returns a tuple of the entities whose value lies in the range."},
+
     {"activate_camera", 
     (PyCFunction)PyPf_activate_camera, METH_VARARGS,
     "Set the camera specified by the index to be the active camera, meaning the scene is "
@@ -181,6 +458,21 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_get_unit_selection, METH_NOARGS,
     "Returns a list of objects currently selected by the player."},
 
+    {"get_entity_under_cursor", 
+    (PyCFunction)PyPf_get_entity_under_cursor, METH_NOARGS,
+    "Returns the closest selectable object under the mouse cursor, or None. This is updated once "
+    "per frame."},
+
+    {"enable_gpu_picking", 
+    (PyCFunction)PyPf_enable_gpu_picking, METH_NOARGS,
+    "Pick the entities under the cursor and in the selection box from their IDs, drawn into a small "
+    "target and read back a frame later. The bounding boxes are still tested when the IDs don't "
+    "cover the spot."},
+
+    {"disable_gpu_picking", 
+    (PyCFunction)PyPf_disable_gpu_picking, METH_NOARGS,
+    "Go back to picking the entities by testing their bounding boxes (the default)."},
+
     {"update_chunk_materials", 
     (PyCFunction)PyPf_update_chunk_materials, METH_VARARGS,
     "Update the material list for a particular chunk. Expects a tuple of chunk coordinates "
@@ -190,6 +482,66 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_update_tile, METH_VARARGS,
     "Update the map tile at the specified coordinates to the new value."},
 
+    {"update_tiles", 
+    (PyCFunction)PyPf_update_tiles, METH_VARARGS,
+    "Update many map tiles at once. Expects a list of ((chunk_r, chunk_c), (tile_r, tile_c), pf.Tile) "
+    "tuples. Much cheaper than calling 'update_tile' for every tile of a large edit."},
+
+    {"update_tile_region", 
+    (PyCFunction)PyPf_update_tile_region, METH_VARARGS,
+    "Update a rectangle of map tiles, which may span several chunks. Expects the chunk and tile "
+    "coordinates of its' top left corner, a (rows, cols) tuple for its' size and either a single "
+    "pf.Tile to set every tile to or a list of rows * cols pf.Tile objects in row-major order."},
+
+    {"begin_map_edit", 
+    (PyCFunction)PyPf_begin_map_edit, METH_NOARGS,
+    "Start recording the tile updates as one edit, which can later be undone with 'undo_map_edit'. "
+    "Returns False if an edit is already being recorded."},
+
+    {"end_map_edit", 
+    (PyCFunction)PyPf_end_map_edit, METH_NOARGS,
+    "Finish recording the edit started by 'begin_map_edit'. Returns False if no tile ended up "
+    "changed, in which case nothing is recorded."},
+
+    {"undo_map_edit", 
+    (PyCFunction)PyPf_undo_map_edit, METH_NOARGS,
+    "Put back the tiles changed by the last recorded edit. Returns a list of the (row, column) "
+    "coordinates of the chunks it touched, or None if there is nothing to undo."},
+
+    {"redo_map_edit", 
+    (PyCFunction)PyPf_redo_map_edit, METH_NOARGS,
+    "Apply the last undone edit again. Returns a list of the (row, column) coordinates of the "
+    "chunks it touched, or None if there is nothing to redo."},
+
+    {"clear_map_edits", 
+    (PyCFunction)PyPf_clear_map_edits, METH_NOARGS,
+    "Forget all the recorded map edits."},
+
+    {"map_edit_stats", 
+    (PyCFunction)PyPf_map_edit_stats, METH_NOARGS,
+    "Returns a dictionary with the number of edits that can be undone ('undo') and redone "
+    "('redo'), along with the memory taken by the edit history ('bytes')."},
+
+    {"save_map", 
+    (PyCFunction)PyPf_save_map, METH_VARARGS,
+    "Save the current map, with all the changes made to its' tiles and materials, as a PFMAP file "
+    "at the specified path. The binary PFMAP file is written alongside it."},
+
+    {"scatter_static", 
+    (PyCFunction)PyPf_scatter_static, METH_VARARGS,
+    "Place static props of a PFOBJ model (a path relative to the base directory) over the map, "
+    "without making a pf.Entity for each. Takes the path, the ((x_min, z_min), (x_max, z_max)) "
+    "region, the expected number of props per tile, a seed and an optional dictionary of "
+    "constraints. Returns the number of props placed."},
+
+    {"save_snapshot", 
+    (PyCFunction)PyPf_save_snapshot, METH_VARARGS,
+    "Quick-save the state of the running game to the specified path."},
+
+    {"load_snapshot", 
+    (PyCFunction)PyPf_load_snapshot, METH_VARARGS,
+    "Put the running game back to the state saved by 'save_snapshot' at the specified path."},
+
     {"set_map_highlight_size", 
     (PyCFunction)PyPf_set_map_highlight_size, METH_VARARGS,
     "Determines how many tiles around the currently hovered tile are highlighted. (0 = none, "
@@ -199,6 +551,30 @@ static PyMethodDef pf_module_methods[] = {
     (PyCFunction)PyPf_set_minimap_position, METH_VARARGS,
     "Set the center position of the minimap in screen coordinates."},
 
+    {"set_anim_lod", 
+    (PyCFunction)PyPf_set_anim_lod, METH_VARARGS,
+    "Takes a distance and a rate in Hz. The poses of the animated entities further than the "
+    "distance from the camera are only evaluated that many times a second, and held in "
+    "between. The selected entities are always updated every frame. 0 for either turns it off."},
+
+    {"set_mesh_lod", 
+    (PyCFunction)PyPf_set_mesh_lod, METH_VARARGS,
+    "Takes a bias and a screen size. The share of the screen's height that the static meshes "
+    "cover is multiplied by the bias for picking their level of detail. Meshes covering less "
+    "than the screen size are drawn as billboards. 0 for the size turns the billboards off."},
+
+    {"set_crowd_anim_distance", 
+    (PyCFunction)PyPf_set_crowd_anim_distance, METH_VARARGS,
+    "Pose the animated entities further than the given distance from the camera from their "
+    "animation clips baked into a texture, so that they take no copying of joint matrices. "
+    "The selected entities and the clips played once are always posed as usual. 0 (the "
+    "default) turns it off."},
+
+    {"set_minimap_unit_rate", 
+    (PyCFunction)PyPf_set_minimap_unit_rate, METH_VARARGS,
+    "Set how many times a second the unit blips on the minimap are refreshed. 0 refreshes them "
+    "every frame."},
+
     {"mouse_over_minimap",
     (PyCFunction)PyPf_mouse_over_minimap, METH_NOARGS,
     "Returns true if the mouse cursor is over the minimap, false otherwise."},
@@ -208,11 +584,383 @@ static PyMethodDef pf_module_methods[] = {
     "Returns the Y-dimension map height at the specified XZ coordinate. Returns None if the "
     "specified coordinate is outside the map bounds."},
 
+    {"map_heights_at_points",
+    (PyCFunction)PyPf_map_heights_at_points, METH_VARARGS,
+    "Takes a list of (X, Z) tuples and returns a list of the Y-dimension map heights at those "
+    "coordinates. Coordinates outside the map bounds have a height of None. Also takes a buffer "
+    "of float32 (X, Z) pairs, such as an (N, 2) numpy array, in which case a pf.MapBuffer of N "
+    "float32 heights is returned, with NaN for the coordinates outside the map bounds."},
+
+    {"map_chunk_tiles",
+    (PyCFunction)PyPf_map_chunk_tiles, METH_VARARGS,
+    "Returns a read-only pf.MapBuffer over the tiles of the chunk at the (row, column) "
+    "coordinates, without copying them. It holds 32x32 records in row-major order, with the "
+    "same fields as pf.Tile."},
+
+    {"map_heightfield",
+    (PyCFunction)PyPf_map_heightfield, METH_NOARGS,
+    "Returns a read-only pf.MapBuffer over the heights of every tile of the map, in row-major "
+    "order over the whole map. Each record holds the 'kind' of the tile (0 for flat, 1 for a "
+    "ramp, 2 for a corner) and the world-space heights of its' 'nw', 'ne', 'sw' and 'se' "
+    "corners. Returns None if the map has no heightfield."},
+
     {"map_pos_under_cursor",
     (PyCFunction)PyPf_map_pos_under_cursor, METH_NOARGS,
     "Returns the XYZ coordinate of the point of the map underneath the cursor. Returns 'None' if "
     "the cursor is not over the map."},
 
+    {"map_raycast",
+    (PyCFunction)PyPf_map_raycast, METH_VARARGS,
+    "Takes a ray origin and direction as (X, Y, Z) tuples and returns the XYZ coordinate of the "
+    "first point where the ray hits the map surface. Returns 'None' if it misses the map."},
+
+    {"map_stream_stats",
+    (PyCFunction)PyPf_map_stream_stats, METH_NOARGS,
+    "Returns a dictionary with the chunk streaming counters of the current map: the chunks that "
+    "were resident on coming into view ('hits'), the ones of those that had been prefetched "
+    "('prefetch_hits'), the ones that had to be loaded on the spot ('late_loads') or were not "
+    "baked yet ('late_bakes'), the chunks prefetched ('prefetched') and the ones evicted without "
+    "being seen ('wasted'), along with the number of chunks currently resident ('resident'). "
+    "Returns None if there is no map."},
+
+    {"nav_cache_stats",
+    (PyCFunction)PyPf_nav_cache_stats, METH_NOARGS,
+    "Returns a dictionary with the 'hits', 'misses' and 'evictions' counts of the navigation field "
+    "cache, along with the number of bytes currently resident ('bytes') and the memory budget ('budget')."},
+
+    {"set_nav_cache_budget",
+    (PyCFunction)PyPf_set_nav_cache_budget, METH_VARARGS,
+    "Set the maximum number of bytes used for caching navigation fields. Least recently used "
+    "fields are evicted to stay within the budget."},
+
+    {"set_nav_flow_window",
+    (PyCFunction)PyPf_set_nav_flow_window, METH_VARARGS,
+    "Takes a number of chunks and an optional time budget in milliseconds (default 2.0). The flow "
+    "field integration of a path is carried on across up to that many consecutive chunks, until "
+    "the fields of the path have taken the budget to build. 0 turns this off."},
+
+    {"set_nav_goal_region",
+    (PyCFunction)PyPf_set_nav_goal_region, METH_VARARGS,
+    "Group move destinations into square regions of the given number of navigation tiles a side. "
+    "Paths to destinations in the same region share all their flow fields outside of the "
+    "destination chunk. 0 turns the sharing off."},
+
+    {"set_nav_path_budget",
+    (PyCFunction)PyPf_set_nav_path_budget, METH_VARARGS,
+    "Limit the time that every path thread spends on path requests in a single frame to the "
+    "given number of milliseconds. The rest of the work is carried on with in the following "
+    "frames. 0 turns the limit off."},
+
+    {"path_exists",
+    (PyCFunction)PyPf_path_exists, METH_VARARGS,
+    "Takes a source and a destination, each either an (X, Z) tuple or a list of them, and an "
+    "optional unit selection radius. Returns True if a unit of that radius could walk from the "
+    "source to the destination. A single point is paired up with every point of a list, in which "
+    "case a list of results is returned."},
+
+    {"path_cost",
+    (PyCFunction)PyPf_path_cost, METH_VARARGS,
+    "Like 'path_exists', but returns the cost of the path, in cost field units, or None if there "
+    "is no path. The cost is that of the path the units would take, which is not necessarily "
+    "the cheapest one."},
+
+    {"pathable",
+    (PyCFunction)PyPf_pathable, METH_VARARGS,
+    "Takes an (X, Z) tuple or a list of them, and an optional unit selection radius. Returns True "
+    "for the points where a unit of that radius is allowed to stand."},
+
+    {"nav_raycast",
+    (PyCFunction)PyPf_nav_raycast, METH_VARARGS,
+    "Takes the start and end points of segments, as for 'path_exists'. Returns the (X, Z) coordinate "
+    "of the first point where the segment runs into an impassable tile or the map edge, or None if "
+    "the way is clear."},
+
+    {"set_move_avoidance",
+    (PyCFunction)PyPf_set_move_avoidance, METH_VARARGS,
+    "Set how the entities steer around each other, for the move orders given from now on: "
+    "either with steering forces (MOVE_AVOID_FORCES, the default) or by picking collision-free "
+    "velocities (MOVE_AVOID_ORCA). Entities which are already moving keep their mode."},
+
+    {"set_move_waypoint_group",
+    (PyCFunction)PyPf_set_move_waypoint_group, METH_VARARGS,
+    "Move orders for up to this many entities (of the same size) have every entity follow a "
+    "waypoint path of its' own, rather than building the flow fields for the whole group. 0 "
+    "always uses the flow fields. The default is 4."},
+
+    {"move_avoidance_stats",
+    (PyCFunction)PyPf_move_avoidance_stats, METH_VARARGS,
+    "Returns a dictionary with the totals since startup for the move orders using the given "
+    "avoidance mode: the number of orders fully carried out ('flocks_arrived'), the time from the "
+    "order to the last entity stopping ('arrival_ms'), the number of per-entity steering updates "
+    "('steer_updates') and the time spent on them ('steer_us')."},
+
+    {"enable_deterministic_movement",
+    (PyCFunction)PyPf_enable_deterministic_movement, METH_NOARGS,
+    "Make the movement of the entities depend only on the move orders given, for running the "
+    "simulation in lockstep with other peers. Turns off the camera-based level of detail, waits "
+    "on path requests and schedules right-click orders for the next movement tick."},
+
+    {"disable_deterministic_movement",
+    (PyCFunction)PyPf_disable_deterministic_movement, METH_NOARGS,
+    "Go back to the default movement simulation, which favours performance over determinism."},
+
+    {"move_order",
+    (PyCFunction)PyPf_move_order, METH_VARARGS,
+    "Takes a sequence of entities, an (X, Z) target position and the number of the movement tick "
+    "at the start of which the entities are to be ordered to move. Orders for past ticks are carried "
+    "out at the start of the next one."},
+
+    {"movement_checksum",
+    (PyCFunction)PyPf_movement_checksum, METH_NOARGS,
+    "Returns a tuple of the number of movement ticks run so far and a hash of the movement state at "
+    "the end of the last one. The hash is only kept up to date in deterministic mode."},
+
+    {"net_start",
+    (PyCFunction)PyPf_net_start, METH_VARARGS,
+    "Starts a lockstep session. Takes the number of the local player, the UDP port to bind, a list "
+    "of (player, host, port) tuples for the peers and the number of turns (of 100 ms) after which "
+    "the commands are carried out. Every peer must call it at the same point, before the simulation "
+    "takes any steps. Switches the movement to deterministic mode. Returns True on success."},
+
+    {"net_stop",
+    (PyCFunction)PyPf_net_stop, METH_NOARGS,
+    "Ends the lockstep session, if there is one."},
+
+    {"net_move_order",
+    (PyCFunction)PyPf_net_move_order, METH_VARARGS,
+    "Takes a sequence of entities and an (X, Z) target position. The order is sent to all the peers "
+    "of the lockstep session and carried out by every one of them on the same turn. Returns False "
+    "if the batch of the current turn is full. Without a session, the order is carried out at the "
+    "start of the next movement tick."},
+
+    {"net_global_event",
+    (PyCFunction)PyPf_net_global_event, METH_VARARGS,
+    "The same as 'global_event', but the event is raised by every peer of the lockstep session on "
+    "the same turn. The argument must be supported by the 'marshal' module. Returns False if the "
+    "batch of the current turn is full. Without a session, the event is raised locally."},
+
+    {"net_stats",
+    (PyCFunction)PyPf_net_stats, METH_NOARGS,
+    "Returns a dictionary with the next 'turn' of the lockstep session, the 'stalled_turns' that "
+    "waited on the peers, the 'packets_sent', 'packets_recvd', 'packets_dropped', 'bytes_sent' and "
+    "'bytes_recvd', and the first turn that was found to be out of sync ('desync_turn') along with "
+    "the player that was ('desync_player'), both of which are -1 while the peers are in sync."},
+
+    {"enable_occlusion_culling",
+    (PyCFunction)PyPf_enable_occlusion_culling, METH_NOARGS,
+    "Stop animating and drawing the entities which are hidden behind the terrain. Whether an "
+    "entity is hidden is decided with a frame of latency."},
+
+    {"disable_occlusion_culling",
+    (PyCFunction)PyPf_disable_occlusion_culling, METH_NOARGS,
+    "Animate and draw all the entities within the camera's view, whether they are hidden or not."},
+
+    {"occlusion_cull_stats",
+    (PyCFunction)PyPf_occlusion_cull_stats, METH_NOARGS,
+    "Returns a dictionary with the number of entities whose visibility was 'tested' in the last "
+    "frame, how many of them were 'occluded', the number of queries 'issued' and the number of "
+    "entities being 'tracked'. All counts are zero while occlusion culling is disabled."},
+
+    {"enable_gpu_culling",
+    (PyCFunction)PyPf_enable_gpu_culling, METH_NOARGS,
+    "Keep the static entities which aren't animated in the GPU's buffers, where they are culled "
+    "and picked a level of detail by a compute shader and drawn with indirect draws. With "
+    "occlusion culling on as well, they are also tested against the depth of the terrain. "
+    "Returns False if the hardware lacks OpenGL 4.3, in which case nothing changes."},
+
+    {"disable_gpu_culling",
+    (PyCFunction)PyPf_disable_gpu_culling, METH_NOARGS,
+    "Go back to culling and drawing all the entities on the CPU (the default)."},
+
+    {"gpu_cull_stats",
+    (PyCFunction)PyPf_gpu_cull_stats, METH_NOARGS,
+    "Returns a dictionary with the number of 'instances' kept in the GPU's buffers, the number of "
+    "distinct meshes ('groups') among them, and the number of indirect 'draws' issued for them "
+    "in the last frame."},
+
+    {"enable_depth_prepass",
+    (PyCFunction)PyPf_enable_depth_prepass, METH_NOARGS,
+    "Draw the depth of the terrain before shading it, so that the terrain hidden behind hills "
+    "is not shaded. Its' cost shows up in the 'terrain' GPU time of 'render_stats'."},
+
+    {"disable_depth_prepass",
+    (PyCFunction)PyPf_disable_depth_prepass, METH_NOARGS,
+    "Shade the terrain in a single pass (the default)."},
+
+    {"enable_heightfield_terrain",
+    (PyCFunction)PyPf_enable_heightfield_terrain, METH_NOARGS,
+    "Draw the terrain from a texture of the tiles' heights and materials, which takes a fraction "
+    "of the video memory of the terrain's meshes. The side faces hidden by neighbouring tiles "
+    "are skipped."},
+
+    {"disable_heightfield_terrain",
+    (PyCFunction)PyPf_disable_heightfield_terrain, METH_NOARGS,
+    "Go back to drawing the terrain from a copy of its' meshes (the default)."},
+
+    {"enable_preskinning",
+    (PyCFunction)PyPf_enable_preskinning, METH_NOARGS,
+    "Skin the animated entities once a frame, up front, into a buffer that the main pass, the "
+    "shadows and the picking all draw from like static meshes. Entities sharing a mesh and a "
+    "pose share the skinned vertices. Pays off once the entities are drawn by several passes, "
+    "at the cost of no longer drawing them instanced."},
+
+    {"disable_preskinning",
+    (PyCFunction)PyPf_disable_preskinning, METH_NOARGS,
+    "Skin the animated entities in every pass that draws them (the default)."},
+
+    {"enable_fog_of_war",
+    (PyCFunction)PyPf_enable_fog_of_war, METH_NOARGS,
+    "Cover the map in fog, which is cleared around the entities with a 'vision_range'. Other "
+    "entities are only drawn where they can currently be seen, and static ones anywhere that "
+    "has been explored. The fog is lifted when a new map is loaded."},
+
+    {"disable_fog_of_war",
+    (PyCFunction)PyPf_disable_fog_of_war, METH_NOARGS,
+    "Lift the fog of war, forgetting which parts of the map have been explored."},
+
+    {"set_fog_height_los",
+    (PyCFunction)PyPf_set_fog_height_los, METH_VARARGS,
+    "Takes a boolean. When True, entities can't see past terrain which rises above their line of "
+    "sight. The heights of the terrain are sampled at the time this is turned on."},
+
+    {"enable_shadows",
+    (PyCFunction)PyPf_enable_shadows, METH_NOARGS,
+    "Make the terrain and the entities cast shadows from the light. The shadows are turned off "
+    "when a new map is loaded."},
+
+    {"disable_shadows",
+    (PyCFunction)PyPf_disable_shadows, METH_NOARGS,
+    "Stop drawing the shadows."},
+
+    {"set_unit_overlay",
+    (PyCFunction)PyPf_set_unit_overlay, METH_VARARGS,
+    "Draw a bar, such as a health bar, over an entity whenever it is drawn. Takes the entity, "
+    "the filled fraction of the bar (0.0 to 1.0) and optionally the (R, G, B, A) colors of the "
+    "filled and empty parts, the (width, height) of the bar in pixels and its height above the "
+    "entity's position. By default, the bar is placed at the top of the entity's bounds. Calling "
+    "this again replaces the entity's bar."},
+
+    {"clear_unit_overlay",
+    (PyCFunction)PyPf_clear_unit_overlay, METH_VARARGS,
+    "Stop drawing the bar set with 'set_unit_overlay' over the entity."},
+
+    {"set_render_scale",
+    (PyCFunction)PyPf_set_render_scale, METH_VARARGS,
+    "Draw the 3D scene at the specified fraction (between 0.25 and 1.0) of the window resolution "
+    "and stretch it over the window. The HUD and UI are still drawn at the full resolution. "
+    "Turns off the dynamic resolution."},
+
+    {"enable_dynamic_resolution",
+    (PyCFunction)PyPf_enable_dynamic_resolution, METH_VARARGS,
+    "Adjust the render scale to keep the GPU time of the 3D scene within the specified number of "
+    "milliseconds. The scale is not lowered below the optional minimum (default 0.5)."},
+
+    {"disable_dynamic_resolution",
+    (PyCFunction)PyPf_disable_dynamic_resolution, METH_NOARGS,
+    "Go back to the render scale last set with 'set_render_scale'."},
+
+    {"render_scale_stats",
+    (PyCFunction)PyPf_render_scale_stats, METH_NOARGS,
+    "Returns a dictionary with the render 'scale' that the last frame was drawn at and the "
+    "running average of the GPU time of the 3D scene ('scene_ms')."},
+
+    {"render_stats",
+    (PyCFunction)PyPf_render_stats, METH_NOARGS,
+    "Returns a dictionary with the number of 'draw_calls', 'vertices', 'program_binds' and "
+    "'texture_binds' of the last frame, and 'gpu_ms' - a dictionary of the running averages "
+    "of the GPU time of the render passes, keyed by the name of the pass."},
+
+    {"enable_perf_overlay",
+    (PyCFunction)PyPf_enable_perf_overlay, METH_NOARGS,
+    "Show a window with the rolling average timings of the engine's profiling zones."},
+
+    {"disable_perf_overlay",
+    (PyCFunction)PyPf_disable_perf_overlay, METH_NOARGS,
+    "Hide the window shown by 'enable_perf_overlay'."},
+
+    {"capture_perf_trace",
+    (PyCFunction)PyPf_capture_perf_trace, METH_VARARGS,
+    "Record the profiling zones of the specified number of upcoming frames (default 300) and write "
+    "them to the specified path in the Chrome trace event format. Returns False if a capture is "
+    "already in progress."},
+
+    {"perf_totals",
+    (PyCFunction)PyPf_perf_totals, METH_NOARGS,
+    "Returns a dictionary with the number of 'frames' since the totals were last reset, the "
+    "'frame_ms' spent on them and 'zones' - a dictionary keyed by the name of the profiling zone, "
+    "with the 'total_ms' spent in the zone, the most time spent in it over a single frame ('max_ms') "
+    "and the number of 'calls'."},
+
+    {"reset_perf_totals",
+    (PyCFunction)PyPf_reset_perf_totals, METH_NOARGS,
+    "Clears the times gathered for 'perf_totals'."},
+
+    {"set_spike_capture",
+    (PyCFunction)PyPf_set_spike_capture, METH_VARARGS,
+    "Takes a threshold in milliseconds and an optional directory. The profiles of the last 300 "
+    "frames are written to the directory whenever a frame takes longer than the threshold. A "
+    "threshold of 0 turns it off."},
+
+    {"start_telemetry",
+    (PyCFunction)PyPf_start_telemetry, METH_VARARGS,
+    "Append a row of frame time, entity, cache, memory and GPU statistics to the CSV file at the "
+    "specified path every second. Returns False if the telemetry is already running or the file "
+    "could not be created."},
+
+    {"stop_telemetry",
+    (PyCFunction)PyPf_stop_telemetry, METH_NOARGS,
+    "Finish writing the telemetry started by 'start_telemetry'."},
+
+    {"memory_stats",
+    (PyCFunction)PyPf_memory_stats, METH_NOARGS,
+    "Returns a dictionary mapping the names of the engine's subsystems ('nav', 'render', 'anim', "
+    "'map', 'script', 'ui') to dictionaries with the 'live' and 'peak' bytes of memory they hold "
+    "and the number of live allocations ('allocs'). The 'gl_buffers' and 'gl_textures' entries count "
+    "the GPU memory of the uploaded buffers and textures instead. Memory held by the Python "
+    "interpreter itself is not included."},
+
+    {"script_profile",
+    (PyCFunction)PyPf_script_profile, METH_NOARGS,
+    "Returns a list of (handler, calls, total_ms, max_ms) tuples for every script event handler "
+    "called since the profile was last reset, with the most expensive handlers first."},
+
+    {"reset_script_profile",
+    (PyCFunction)PyPf_reset_script_profile, METH_NOARGS,
+    "Clears the times gathered for 'script_profile'."},
+
+    {"set_script_budget",
+    (PyCFunction)PyPf_set_script_budget, METH_VARARGS,
+    "Sets the number of milliseconds per frame that script event handlers may run for before the "
+    "remaining script-generated events are held back to the next frame. 0 disables the budget."},
+
+    {"gc_stats",
+    (PyCFunction)PyPf_gc_stats, METH_NOARGS,
+    "Returns a list with a dictionary for each of the 3 generations of the Python garbage "
+    "collector, holding the number of 'collections' made by the engine and the 'last_ms', "
+    "'max_ms' and 'total_ms' pause times. Automatic collection is disabled - the engine "
+    "collects once per frame, after the events have been handled."},
+
+    {"set_gc_budget",
+    (PyCFunction)PyPf_set_gc_budget, METH_VARARGS,
+    "Sets the number of milliseconds that a garbage collection may be expected to pause for. "
+    "Older generations whose collections take longer are put off for a while in favour of "
+    "younger ones. 0 disables the budget."},
+
+    {"frame_time_stats",
+    (PyCFunction)PyPf_frame_time_stats, METH_NOARGS,
+    "Returns a dictionary with the 'avg_ms', 'p50_ms', 'p99_ms' and 'max_ms' frame times over "
+    "the recent frames, along with the 'busy_p50_ms' and 'busy_p99_ms' times spent on the frames "
+    "before sleeping to hold the frame rate, and the number of frames ('frames') they cover."},
+
+    {"set_frame_rate_limit",
+    (PyCFunction)PyPf_set_frame_rate_limit, METH_VARARGS,
+    "Sets the frame rate held while the window is in focus. 0 removes the limit. The frame rate "
+    "is lowered further while the window is in the background or the user is idle."},
+
+    {"get_frame_rate_limit",
+    (PyCFunction)PyPf_get_frame_rate_limit, METH_NOARGS,
+    "Returns the frame rate held while the window is in focus, or 0 if there is no limit."},
+
     {"multiply_quaternions",
     (PyCFunction)PyPf_multiply_quaternions, METH_VARARGS,
     "Returns the normalized result of multiplying 2 quaternions (specified as a list of 4 floats - XYZW order)."},
@@ -220,64 +968,15 @@ static PyMethodDef pf_module_methods[] = {
     {NULL}  /* Sentinel */
 };
 
+/* Engine event arguments that only take on a few values, built the first 
+ * time they are needed */
+static PyObject *s_key_args[SDL_NUM_SCANCODES];
+static PyObject *s_button_args[UINT8_MAX + 1][2];
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static bool s_vec3_from_pylist_arg(PyObject *list, vec3_t *out)
-{
-    if(!PyList_Check(list)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a list.");
-        return false;
-    }
-    
-    Py_ssize_t len = PyList_Size(list);
-    if(len != 3) {
-        PyErr_SetString(PyExc_TypeError, "Argument must have a size of 3."); 
-        return false;
-    }
-
-    for(int i = 0; i < len; i++) {
-
-        PyObject *item = PyList_GetItem(list, i);
-        if(!PyFloat_Check(item)) {
-            PyErr_SetString(PyExc_TypeError, "List items must be floats.");
-            return false;
-        }
-
-        out->raw[i] = PyFloat_AsDouble(item);
-    }
-
-    return true;
-}
-
-static bool s_quat_from_pylist_arg(PyObject *list, quat_t *out)
-{
-    if(!PyList_Check(list)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must be a list.");
-        return false;
-    }
-    
-    Py_ssize_t len = PyList_Size(list);
-    if(len != 4) {
-        PyErr_SetString(PyExc_TypeError, "Argument must have a size of 4."); 
-        return false;
-    }
-
-    for(int i = 0; i < len; i++) {
-
-        PyObject *item = PyList_GetItem(list, i);
-        if(!PyFloat_Check(item)) {
-            PyErr_SetString(PyExc_TypeError, "List items must be floats.");
-            return false;
-        }
-
-        out->raw[i] = PyFloat_AsDouble(item);
-    }
-
-    return true;
-}
-
 static PyObject *PyPf_new_game(PyObject *self, PyObject *args)
 {
     const char *dir, *pfmap;
@@ -322,7 +1021,7 @@ static PyObject *PyPf_set_ambient_light_color(PyObject *self, PyObject *args)
     if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list))
         return NULL;
 
-    if(!s_vec3_from_pylist_arg(list, &color))
+    if(!S_Vec3_Get(list, &color))
         return NULL;
 
     R_GL_SetAmbientLightColor(color);
@@ -337,7 +1036,7 @@ static PyObject *PyPf_set_emit_light_color(PyObject *self, PyObject *args)
     if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list))
         return NULL;
 
-    if(!s_vec3_from_pylist_arg(list, &color))
+    if(!S_Vec3_Get(list, &color))
         return NULL;
 
     R_GL_SetLightEmitColor(color);
@@ -360,6 +1059,87 @@ static PyObject *PyPf_load_scene(PyObject *self, PyObject *args)
     return S_Entity_GetAllList();
 }
 
+static void s_on_scene_loaded(void *arg, enum scene_load_status status)
+{
+    PyObject *pair = arg;
+    if(status == SCENE_LOAD_CANCELLED) {
+        Py_DECREF(pair);
+        return;
+    }
+
+    PyObject *result;
+    if(status == SCENE_LOAD_OK) {
+        G_MakeStaticObjsImpassable();
+        result = S_Entity_GetAllList();
+    }else{
+        result = Py_None;
+        Py_INCREF(result);
+    }
+
+    S_RunEventHandler(PyTuple_GET_ITEM(pair, 0), PyTuple_GET_ITEM(pair, 1), result);
+    Py_DECREF(result);
+    Py_DECREF(pair);
+}
+
+static PyObject *PyPf_load_scene_async(PyObject *self, PyObject *args)
+{
+    const char *path; 
+    PyObject *callable, *user_arg;
+
+    if(!PyArg_ParseTuple(args, "sOO", &path, &callable, &user_arg) || !PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string, a callable and an object.");
+        return NULL;
+    }
+
+    PyObject *pair = PyTuple_Pack(2, callable, user_arg);
+    if(!pair)
+        return NULL;
+
+    if(!Scene_LoadAsync(path, s_on_scene_loaded, pair)) {
+        Py_DECREF(pair);
+        PyErr_SetString(PyExc_RuntimeError, "Could not start loading the scene.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_convert_pfobj(PyObject *self, PyObject *args)
+{
+    const char *dir, *pfobj;
+    if(!PyArg_ParseTuple(args, "ss", &dir, &pfobj)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two strings.");
+        return NULL;
+    }
+
+    extern const char *g_basepath;
+    char path[512];
+    if(strlen(g_basepath) + strlen(dir) >= sizeof(path)) {
+        PyErr_SetString(PyExc_RuntimeError, "The directory path is too long.");
+        return NULL;
+    }
+    strcpy(path, g_basepath);
+    strcat(path, dir);
+
+    if(AL_ConvertPFObj(path, pfobj))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_compile_scene(PyObject *self, PyObject *args)
+{
+    const char *path;
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(Scene_Compile(path))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
 static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args)
 {
     PyObject *list;
@@ -368,13 +1148,128 @@ static PyObject *PyPf_set_emit_light_pos(PyObject *self, PyObject *args)
     if(!PyArg_ParseTuple(args, "O!", &PyList_Type, &list))
         return NULL;
 
-    if(!s_vec3_from_pylist_arg(list, &pos))
+    if(!S_Vec3_Get(list, &pos))
         return NULL;
 
     R_GL_SetLightPos(pos);
     Py_RETURN_NONE;
 }
 
+static PyObject *PyPf_add_point_light(PyObject *self, PyObject *args)
+{
+    PyObject *pos_list, *color_list;
+    vec3_t pos, color;
+    float radius;
+
+    if(!PyArg_ParseTuple(args, "O!O!f", &PyList_Type, &pos_list, &PyList_Type, &color_list, &radius))
+        return NULL;
+
+    if(!S_Vec3_Get(pos_list, &pos) || !S_Vec3_Get(color_list, &color))
+        return NULL;
+
+    if(radius <= 0.0f) {
+        PyErr_SetString(PyExc_ValueError, "The radius must be positive.");
+        return NULL;
+    }
+
+    int id = G_Lights_Add(pos, color, radius);
+    if(id < 0) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not add the point light.");
+        return NULL;
+    }
+    return Py_BuildValue("i", id);
+}
+
+static PyObject *PyPf_remove_point_light(PyObject *self, PyObject *args)
+{
+    int id;
+
+    if(!PyArg_ParseTuple(args, "i", &id))
+        return NULL;
+
+    if(!G_Lights_Remove(id)) {
+        PyErr_SetString(PyExc_KeyError, "There is no point light with the ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_point_light_pos(PyObject *self, PyObject *args)
+{
+    int id;
+    PyObject *list;
+    vec3_t pos;
+
+    if(!PyArg_ParseTuple(args, "iO!", &id, &PyList_Type, &list))
+        return NULL;
+
+    if(!S_Vec3_Get(list, &pos))
+        return NULL;
+
+    if(!G_Lights_SetPos(id, pos)) {
+        PyErr_SetString(PyExc_KeyError, "There is no point light with the ID.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_emit_sparks(PyObject *self, PyObject *args)
+{
+    PyObject *pos_list;
+    vec3_t pos;
+    int rgba[4];
+    int count = 16;
+    float speed = 10.0f, lifetime = 0.6f;
+
+    if(!PyArg_ParseTuple(args, "O!(iiii)|iff", &PyList_Type, &pos_list, 
+        &rgba[0], &rgba[1], &rgba[2], &rgba[3], &count, &speed, &lifetime)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a list, an (R, G, B, A) tuple and "
+            "optionally an integer and two floats.");
+        return NULL;
+    }
+
+    if(!S_Vec3_Get(pos_list, &pos))
+        return NULL;
+
+    vec4_t color;
+    for(int i = 0; i < 4; i++)
+        color.raw[i] = rgba[i] / 255.0f;
+
+    if(count <= 0 || count > 1024 || lifetime <= 0.0f) {
+        PyErr_SetString(PyExc_ValueError, "The count must be between 1 and 1024 and the lifetime positive.");
+        return NULL;
+    }
+
+    struct particle *sparks = malloc(count * sizeof(struct particle));
+    if(!sparks)
+        return PyErr_NoMemory();
+
+    /* The sparks are spread evenly over the upper half of a sphere by 
+     * stepping around it by the golden angle, with the speed varying a 
+     * little between neighbours */
+    const float golden_angle = M_PI * (3.0f - sqrtf(5.0f));
+    for(int i = 0; i < count; i++) {
+
+        float y = 1.0f - (i + 0.5f) / count;
+        float r = sqrtf(1.0f - y * y);
+        float angle = golden_angle * i;
+        float curr_speed = speed * (0.75f + 0.25f * ((i * 7) % 4) / 3.0f);
+
+        sparks[i] = (struct particle){
+            .pos      = pos,
+            .lifetime = lifetime,
+            .velocity = (vec3_t){cosf(angle) * r * curr_speed, y * curr_speed, sinf(angle) * r * curr_speed},
+            .gravity  = 2.0f * speed / lifetime,
+            .color    = color,
+            .size     = (vec2_t){0.6f, 0.2f},
+        };
+    }
+
+    R_GL_EffectEmit(EFFECT_SPARKS, sparks, count);
+    free(sparks);
+    Py_RETURN_NONE;
+}
+
 static PyObject *PyPf_register_event_handler(PyObject *self, PyObject *args)
 {
     enum eventtype event;
@@ -417,208 +1312,2086 @@ static PyObject *PyPf_unregister_event_handler(PyObject *self, PyObject *args)
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_global_event(PyObject *self, PyObject *args)
+static PyObject *PyPf_register_entity_batch_handler(PyObject *self, PyObject *args)
 {
     enum eventtype event;
-    PyObject *arg;
+    PyObject *callable, *user_arg;
 
-    if(!PyArg_ParseTuple(args, "iO", &event, &arg)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
+    if(!PyArg_ParseTuple(args, "iOO", &event, &callable, &user_arg)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and two objects.");
         return NULL;
     }
 
-    Py_INCREF(arg);
+    if(!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Second argument must be callable.");
+        return NULL;
+    }
 
-    E_Global_Notify(event, arg, ES_SCRIPT);
+    if(!E_Entity_ScriptRegisterBatch(event, callable, user_arg)) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not register the handler.");
+        return NULL;
+    }
+
+    Py_INCREF(callable);
+    Py_INCREF(user_arg);
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_activate_camera(PyObject *self, PyObject *args)
+static PyObject *PyPf_unregister_entity_batch_handler(PyObject *self, PyObject *args)
 {
-    int idx;
-    enum cam_mode mode;
+    enum eventtype event;
+    PyObject *callable;
 
-    if(!PyArg_ParseTuple(args, "ii", &idx, &mode)) {
-        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of two integers.");
+    if(!PyArg_ParseTuple(args, "iO", &event, &callable)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
         return NULL;
     }
 
-    G_ActivateCamera(idx, mode);
+    if(!PyCallable_Check(callable)) {
+        PyErr_SetString(PyExc_TypeError, "Second argument must be callable.");
+        return NULL;
+    }
+
+    E_Entity_ScriptUnregisterBatch(event, callable);
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_prev_frame_ms(PyObject *self)
+static PyObject *PyPf_call_later(PyObject *self, PyObject *args)
 {
-    extern unsigned g_last_frame_ms;
-    return Py_BuildValue("i", g_last_frame_ms);
+    return S_Sched_CallLater(args);
 }
 
-static PyObject *PyPf_get_resolution(PyObject *self)
+static PyObject *PyPf_start_coroutine(PyObject *self, PyObject *args)
 {
-    return Py_BuildValue("(i, i)", CONFIG_RES_X, CONFIG_RES_Y);
+    return S_Sched_StartCoroutine(args);
 }
 
-static PyObject *PyPf_get_basedir(PyObject *self)
+static PyObject *PyPf_cancel_scheduled(PyObject *self, PyObject *args)
 {
-    extern const char *g_basepath;
-    return Py_BuildValue("s", g_basepath);
+    return S_Sched_Cancel(args);
 }
 
-static PyObject *PyPf_get_mouse_pos(PyObject *self)
+static PyObject *PyPf_register_threaded_ai(PyObject *self, PyObject *args)
 {
-    int mouse_x, mouse_y;
-    SDL_GetMouseState(&mouse_x, &mouse_y);
-    return Py_BuildValue("(i, i)", mouse_x, mouse_y);
+    return S_AI_Register(args);
 }
 
-static PyObject *PyPf_mouse_over_ui(PyObject *self)
+static PyObject *PyPf_unregister_threaded_ai(PyObject *self, PyObject *args)
 {
-    int mouse_x, mouse_y;
-    SDL_GetMouseState(&mouse_x, &mouse_y);
-
-    if(S_UI_MouseOverWindow(mouse_x, mouse_y))
-        Py_RETURN_TRUE;
-    else
-        Py_RETURN_NONE;
+    return S_AI_Unregister(args);
 }
 
-static PyObject *PyPf_enable_unit_selection(PyObject *self)
+static PyObject *PyPf_ai_command(PyObject *self, PyObject *args)
 {
-    G_Sel_Enable();
-    Py_RETURN_NONE;
+    return S_AI_Command(args);
 }
 
-static PyObject *PyPf_disable_unit_selection(PyObject *self)
+static PyObject *PyPf_get_positions(PyObject *self, PyObject *args)
 {
-    G_Sel_Disable();
-    Py_RETURN_NONE;
+    PyObject *entities, *out = NULL;
+
+    if(!PyArg_ParseTuple(args, "O|O", &entities, &out)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of entities and an optional buffer.");
+        return NULL;
+    }
+
+    return S_Entity_GetPositions(entities, out);
 }
 
-static PyObject *PyPf_clear_unit_selection(PyObject *self)
+static PyObject *PyPf_set_positions(PyObject *self, PyObject *args)
 {
-    G_Sel_Clear();
+    PyObject *entities, *positions;
+
+    if(!PyArg_ParseTuple(args, "OO", &entities, &positions)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of entities and their positions.");
+        return NULL;
+    }
+
+    if(!S_Entity_SetPositions(entities, positions))
+        return NULL;
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_get_unit_selection(PyObject *self)
+static PyObject *s_tuple_from_ents(const pentity_kvec_t *ents)
 {
-    const pentity_kvec_t *sel = G_Sel_Get();
-
-    PyObject *ret = PyList_New(0);
+    PyObject *ret = PyTuple_New(kv_size(*ents));
     if(!ret)
         return NULL;
 
-    for(int i = 0; i < kv_size(*sel); i++) {
-        PyObject *ent =  S_Entity_ObjForUID(kv_A(*sel, i)->uid);
-        if(ent) {
-            PyList_Append(ret, ent);
-        }
+    /* Entities not created from a script have no object to return */
+    Py_ssize_t n = 0;
+    for(int i = 0; i < kv_size(*ents); i++) {
+
+        PyObject *ent = S_Entity_ObjForUID(kv_A(*ents, i)->uid);
+        if(!ent)
+            continue;
+        Py_INCREF(ent);
+        PyTuple_SET_ITEM(ret, n++, ent);
     }
 
+    if(n < kv_size(*ents) && _PyTuple_Resize(&ret, n) < 0)
+        return NULL;
     return ret;
 }
 
-static PyObject *PyPf_update_chunk_materials(PyObject *self, PyObject *args)
+static bool s_nearest_pred(const struct entity *ent, void *arg)
 {
-    int chunk_r, chunk_c;
-    const char *mats_str;
+    PyObject *obj = S_Entity_ObjForUID(ent->uid);
+    return obj && obj != arg;
+}
 
-    if(!PyArg_ParseTuple(args, "(ii)s", &chunk_r, &chunk_c, &mats_str)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be a tuple of two integers and a string.");
+static PyObject *PyPf_entities_in_circle(PyObject *self, PyObject *args)
+{
+    float x, z, radius;
+
+    if(!PyArg_ParseTuple(args, "(ff)f", &x, &z, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an (X, Z) tuple and a float.");
         return NULL;
     }
 
-    bool result = G_UpdateChunkMats(chunk_r, chunk_c, mats_str);
-    if(!result)
-        return NULL;
-    else
-        Py_RETURN_NONE;
+    pentity_kvec_t ents;
+    kv_init(ents);
+    G_EntitiesInCircle((vec2_t){x, z}, radius, &ents);
+
+    PyObject *ret = s_tuple_from_ents(&ents);
+    kv_destroy(ents);
+    return ret;
 }
 
-static PyObject *PyPf_update_tile(PyObject *self, PyObject *args)
+static PyObject *PyPf_entities_in_rect(PyObject *self, PyObject *args)
 {
-    struct tile_desc desc;
-    PyObject *tile_obj;
-    const struct tile *tile;
+    float x0, z0, x1, z1;
 
-    if(!PyArg_ParseTuple(args, "(ii)(ii)O", &desc.chunk_r, &desc.chunk_c, &desc.tile_r, &desc.tile_c, &tile_obj)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be two tuples of two integers and a pf.Tile object.");
+    if(!PyArg_ParseTuple(args, "(ff)(ff)", &x0, &z0, &x1, &z1)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two (X, Z) tuples.");
         return NULL;
     }
 
-    if(NULL == (tile = S_Tile_GetTile(tile_obj))) {
-        PyErr_SetString(PyExc_TypeError, "Last argument must be of type pf.Tile.");
-        return NULL;
-    }
+    pentity_kvec_t ents;
+    kv_init(ents);
+    G_EntitiesInRect((vec2_t){x0, z0}, (vec2_t){x1, z1}, &ents);
 
+    PyObject *ret = s_tuple_from_ents(&ents);
+    kv_destroy(ents);
+    return ret;
+}
+
+static PyObject *PyPf_nearest_entity(PyObject *self, PyObject *args)
+{
+    float x, z, max_dist = INFINITY;
+    PyObject *exclude = NULL;
+
+    if(!PyArg_ParseTuple(args, "(ff)|fO", &x, &z, &max_dist, &exclude)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an (X, Z) tuple, an optional float "
+            "and an optional entity.");
+        return NULL;
+    }
+
+    struct entity *ent = G_NearestEntity((vec2_t){x, z}, max_dist, s_nearest_pred, exclude);
+    if(!ent)
+        Py_RETURN_NONE;
+
+    PyObject *ret = S_Entity_ObjForUID(ent->uid);
+    Py_INCREF(ret);
+    return ret;
+}
+
+static PyObject *PyPf_entity_for_uid(PyObject *self, PyObject *args)
+{
+    unsigned int uid;
+
+    if(!PyArg_ParseTuple(args, "I", &uid)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer UID.");
+        return NULL;
+    }
+
+    PyObject *ret = S_Entity_ObjForUID(uid);
+    if(!ret)
+        Py_RETURN_NONE;
+    Py_INCREF(ret);
+    return ret;
+}
+
+static PyObject *PyPf_declare_component(PyObject *self, PyObject *args)
+{
+    return S_Component_Declare(args);
+}
+
+static PyObject *PyPf_get_components(PyObject *self, PyObject *args)
+{
+    return S_Component_GetMany(args);
+}
+
+static PyObject *PyPf_set_components(PyObject *self, PyObject *args)
+{
+    return S_Component_SetMany(args);
+}
+
+static PyObject *PyPf_filter_entities(PyObject *self, PyObject *args)
+{
+    return S_Component_Filter(args);
+}
+
+static PyObject *PyPf_global_event(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *arg;
+
+    if(!PyArg_ParseTuple(args, "iO", &event, &arg)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
+        return NULL;
+    }
+
+    Py_INCREF(arg);
+
+    E_Global_Notify(event, arg, ES_SCRIPT);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_event_coalescing(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    enum coalesce_policy policy;
+
+    if(!PyArg_ParseTuple(args, "ii", &event, &policy)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two integers (event and policy).");
+        return NULL;
+    }
+
+    if(policy < EC_NONE || policy > EC_DROP_DUPLICATES) {
+        PyErr_SetString(PyExc_ValueError, "Invalid coalescing policy.");
+        return NULL;
+    }
+
+    if(!E_SetCoalescePolicy(event, policy)) {
+        PyErr_SetString(PyExc_ValueError, "The policy cannot be used for this event type.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_activate_camera(PyObject *self, PyObject *args)
+{
+    int idx;
+    enum cam_mode mode;
+
+    if(!PyArg_ParseTuple(args, "ii", &idx, &mode)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of two integers.");
+        return NULL;
+    }
+
+    G_ActivateCamera(idx, mode);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_prev_frame_ms(PyObject *self)
+{
+    extern unsigned g_last_frame_ms;
+    return Py_BuildValue("i", g_last_frame_ms);
+}
+
+static PyObject *PyPf_get_resolution(PyObject *self)
+{
+    return Py_BuildValue("(i, i)", CONFIG_RES_X, CONFIG_RES_Y);
+}
+
+static PyObject *PyPf_get_basedir(PyObject *self)
+{
+    extern const char *g_basepath;
+    return Py_BuildValue("s", g_basepath);
+}
+
+static PyObject *PyPf_get_mouse_pos(PyObject *self)
+{
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+    return Py_BuildValue("(i, i)", mouse_x, mouse_y);
+}
+
+static PyObject *PyPf_mouse_over_ui(PyObject *self)
+{
+    int mouse_x, mouse_y;
+    SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    if(S_UI_MouseOverWindow(mouse_x, mouse_y))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_unit_selection(PyObject *self)
+{
+    G_Sel_Enable();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_unit_selection(PyObject *self)
+{
+    G_Sel_Disable();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_clear_unit_selection(PyObject *self)
+{
+    G_Sel_Clear();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_get_unit_selection(PyObject *self)
+{
+    const pentity_kvec_t *sel = G_Sel_Get();
+
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < kv_size(*sel); i++) {
+        PyObject *ent =  S_Entity_ObjForUID(kv_A(*sel, i)->uid);
+        if(ent) {
+            PyList_Append(ret, ent);
+        }
+    }
+
+    return ret;
+}
+
+static PyObject *PyPf_get_entity_under_cursor(PyObject *self)
+{
+    struct entity *ent = G_Sel_EntityUnderCursor();
+    if(!ent)
+        Py_RETURN_NONE;
+
+    PyObject *ret = S_Entity_ObjForUID(ent->uid);
+    if(!ret)
+        Py_RETURN_NONE;
+
+    Py_INCREF(ret);
+    return ret;
+}
+
+static PyObject *PyPf_enable_gpu_picking(PyObject *self)
+{
+    G_Sel_SetGPUPicking(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_gpu_picking(PyObject *self)
+{
+    G_Sel_SetGPUPicking(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_update_chunk_materials(PyObject *self, PyObject *args)
+{
+    int chunk_r, chunk_c;
+    const char *mats_str;
+
+    if(!PyArg_ParseTuple(args, "(ii)s", &chunk_r, &chunk_c, &mats_str)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a tuple of two integers and a string.");
+        return NULL;
+    }
+
+    bool result = G_UpdateChunkMats(chunk_r, chunk_c, mats_str);
+    if(!result)
+        return NULL;
+    else
+        Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_update_tile(PyObject *self, PyObject *args)
+{
+    struct tile_desc desc;
+    PyObject *tile_obj;
+    const struct tile *tile;
+
+    if(!PyArg_ParseTuple(args, "(ii)(ii)O", &desc.chunk_r, &desc.chunk_c, &desc.tile_r, &desc.tile_c, &tile_obj)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two tuples of two integers and a pf.Tile object.");
+        return NULL;
+    }
+
+    if(NULL == (tile = S_Tile_GetTile(tile_obj))) {
+        PyErr_SetString(PyExc_TypeError, "Last argument must be of type pf.Tile.");
+        return NULL;
+    }
+
+    /* The minimap is refreshed along with the chunk meshes, before the next frame */
     if(!G_UpdateTile(&desc, tile))
         return NULL;
 
-    if(!G_UpdateMinimapChunk(desc.chunk_r, desc.chunk_c))
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_update_tiles(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+
+    if(!PyArg_ParseTuple(args, "O", &list) || !PyList_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of (chunk coords, tile coords, pf.Tile) tuples.");
+        return NULL;
+    }
+
+    Py_ssize_t len = PyList_Size(list);
+    struct tile_desc *descs = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(struct tile_desc) + 1);
+    struct tile *tiles = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(struct tile) + 1);
+    PyObject *ret = NULL;
+
+    if(!descs || !tiles) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < len; i++) {
+
+        PyObject *item = PyList_GetItem(list, i);
+        PyObject *tile_obj;
+        const struct tile *tile;
+
+        if(!PyTuple_Check(item) 
+        || !PyArg_ParseTuple(item, "(ii)(ii)O", &descs[i].chunk_r, &descs[i].chunk_c, 
+                             &descs[i].tile_r, &descs[i].tile_c, &tile_obj)
+        || NULL == (tile = S_Tile_GetTile(tile_obj))) {
+            PyErr_SetString(PyExc_TypeError, "List items must be tuples of two tuples of two integers and a pf.Tile object.");
+            goto fail;
+        }
+        tiles[i] = *tile;
+    }
+
+    if(!G_UpdateTiles(len, descs, tiles)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to update the tiles. Tile coordinates may be out of bounds.");
+        goto fail;
+    }
+
+    Py_INCREF(Py_None);
+    ret = Py_None;
+
+fail:
+    MEM_Free(tiles);
+    MEM_Free(descs);
+    return ret;
+}
+
+static PyObject *PyPf_update_tile_region(PyObject *self, PyObject *args)
+{
+    struct tile_desc origin;
+    int rows, cols;
+    PyObject *tiles_obj;
+
+    if(!PyArg_ParseTuple(args, "(ii)(ii)(ii)O", &origin.chunk_r, &origin.chunk_c, 
+                         &origin.tile_r, &origin.tile_c, &rows, &cols, &tiles_obj)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be three tuples of two integers and a pf.Tile object "
+            "or a list of them.");
+        return NULL;
+    }
+
+    const struct tile *tile;
+    if((tile = S_Tile_GetTile(tiles_obj))) {
+
+        if(!G_UpdateTileRegion(&origin, rows, cols, 1, tile)) {
+            PyErr_SetString(PyExc_RuntimeError, "Unable to update the tiles. The region may not fit in the map.");
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+
+    if(!PyList_Check(tiles_obj)) {
+        PyErr_SetString(PyExc_TypeError, "Last argument must be a pf.Tile object or a list of them.");
+        return NULL;
+    }
+
+    Py_ssize_t len = PyList_Size(tiles_obj);
+    struct tile *tiles = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(struct tile) + 1);
+    PyObject *ret = NULL;
+
+    if(!tiles) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < len; i++) {
+
+        if(NULL == (tile = S_Tile_GetTile(PyList_GetItem(tiles_obj, i)))) {
+            PyErr_SetString(PyExc_TypeError, "Last argument must be a pf.Tile object or a list of them.");
+            goto fail;
+        }
+        tiles[i] = *tile;
+    }
+
+    if(!G_UpdateTileRegion(&origin, rows, cols, len, tiles)) {
+        PyErr_SetString(PyExc_RuntimeError, "Unable to update the tiles. The region may not fit in the map, "
+            "or the number of tiles may not match its' size.");
+        goto fail;
+    }
+
+    Py_INCREF(Py_None);
+    ret = Py_None;
+
+fail:
+    MEM_Free(tiles);
+    return ret;
+}
+
+static PyObject *PyPf_begin_map_edit(PyObject *self)
+{
+    if(G_MapEditBegin())
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_end_map_edit(PyObject *self)
+{
+    if(G_MapEditEnd())
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *s_map_edit_step(bool redo)
+{
+    struct map_resolution res;
+    if(!G_MapResolution(&res))
+        Py_RETURN_NONE;
+
+    size_t *chunks = malloc(res.chunk_w * res.chunk_h * sizeof(size_t));
+    if(!chunks)
+        return PyErr_NoMemory();
+
+    size_t num_chunks;
+    bool done = redo ? G_MapEditRedo(&num_chunks, chunks) 
+                     : G_MapEditUndo(&num_chunks, chunks);
+    if(!done) {
+        free(chunks);
+        Py_RETURN_NONE;
+    }
+
+    PyObject *ret = PyList_New(num_chunks);
+    if(!ret)
+        goto fail;
+
+    for(int i = 0; i < num_chunks; i++) {
+        PyObject *coords = Py_BuildValue("(ii)", (int)(chunks[i] / res.chunk_w), (int)(chunks[i] % res.chunk_w));
+        if(!coords) {
+            Py_CLEAR(ret);
+            goto fail;
+        }
+        PyList_SET_ITEM(ret, i, coords);
+    }
+
+fail:
+    free(chunks);
+    return ret;
+}
+
+static PyObject *PyPf_undo_map_edit(PyObject *self)
+{
+    return s_map_edit_step(false);
+}
+
+static PyObject *PyPf_redo_map_edit(PyObject *self)
+{
+    return s_map_edit_step(true);
+}
+
+static PyObject *PyPf_clear_map_edits(PyObject *self)
+{
+    G_MapEditClear();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_map_edit_stats(PyObject *self)
+{
+    struct map_edit_stats stats;
+    if(!G_MapEditStats(&stats))
+        Py_RETURN_NONE;
+
+    return Py_BuildValue("{s:n, s:n, s:n}", 
+        "undo",  (Py_ssize_t)stats.undo,
+        "redo",  (Py_ssize_t)stats.redo,
+        "bytes", (Py_ssize_t)stats.bytes);
+}
+
+static PyObject *PyPf_save_map(PyObject *self, PyObject *args)
+{
+    const char *path;
+
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(!G_SaveMap(path)) {
+        PyErr_Format(PyExc_RuntimeError, "Unable to save the map to '%s'.", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static bool s_constraint_float(PyObject *dict, const char *key, float *out)
+{
+    PyObject *val = PyDict_GetItemString(dict, key);
+    if(!val)
+        return true;
+
+    double d = PyFloat_AsDouble(val);
+    if(d == -1.0 && PyErr_Occurred()) {
+        PyErr_Format(PyExc_TypeError, "The '%s' constraint must be a number.", key);
+        return false;
+    }
+    *out = d;
+    return true;
+}
+
+static bool s_constraint_bool(PyObject *dict, const char *key, bool *out)
+{
+    PyObject *val = PyDict_GetItemString(dict, key);
+    if(!val)
+        return true;
+
+    int result = PyObject_IsTrue(val);
+    if(result == -1)
+        return false;
+    *out = result;
+    return true;
+}
+
+static PyObject *PyPf_scatter_static(PyObject *self, PyObject *args)
+{
+    const char *path;
+    PyObject *constraints = NULL;
+    struct scatter_desc desc = (struct scatter_desc){
+        .tiles       = SCATTER_TILES_ANY,
+        .min_spacing = 0.0f,
+        .min_scale   = 1.0f,
+        .max_scale   = 1.0f,
+        .random_yaw  = true,
+        .collision   = true,
+    };
+
+    if(!PyArg_ParseTuple(args, "s((ff)(ff))fI|O!", &path, &desc.xz_min.x, &desc.xz_min.y, 
+                         &desc.xz_max.x, &desc.xz_max.y, &desc.density, &desc.seed, 
+                         &PyDict_Type, &constraints)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string, a pair of (x, z) tuples, "
+            "a float, an integer and optionally a dictionary.");
+        return NULL;
+    }
+
+    if(constraints) {
+
+        PyObject *tiles = PyDict_GetItemString(constraints, "tiles");
+        if(tiles) {
+            long val = PyInt_AsLong(tiles);
+            if(val < SCATTER_TILES_ANY || val > SCATTER_TILES_UNPATHABLE) {
+                PyErr_Clear();
+                PyErr_SetString(PyExc_TypeError, "The 'tiles' constraint must be one of the "
+                    "SCATTER_TILES_ constants.");
+                return NULL;
+            }
+            desc.tiles = val;
+        }
+
+        PyObject *scale = PyDict_GetItemString(constraints, "scale");
+        if(scale && !PyArg_ParseTuple(scale, "ff", &desc.min_scale, &desc.max_scale)) {
+            PyErr_SetString(PyExc_TypeError, "The 'scale' constraint must be a (min, max) tuple.");
+            return NULL;
+        }
+
+        if(!s_constraint_float(constraints, "min_spacing", &desc.min_spacing)
+        || !s_constraint_bool(constraints, "random_yaw", &desc.random_yaw)
+        || !s_constraint_bool(constraints, "collision", &desc.collision))
+            return NULL;
+    }
+
+    size_t placed;
+    if(!G_Scatter_Static(path, &desc, &placed)) {
+        PyErr_Format(PyExc_RuntimeError, "Unable to scatter '%s' (%zu props placed).", path, placed);
+        return NULL;
+    }
+    return PyInt_FromSize_t(placed);
+}
+
+static PyObject *PyPf_save_snapshot(PyObject *self, PyObject *args)
+{
+    const char *path;
+
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(!G_Snapshot_Save(path)) {
+        PyErr_Format(PyExc_RuntimeError, "Unable to save a snapshot to '%s'.", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_load_snapshot(PyObject *self, PyObject *args)
+{
+    const char *path;
+
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(!G_Snapshot_Load(path)) {
+        PyErr_Format(PyExc_RuntimeError, "Unable to load the snapshot from '%s'.", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args)
+{
+    int size;
+
+    if(!PyArg_ParseTuple(args, "i", &size)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer.");
+        return NULL;
+    }
+
+    M_Raycast_SetHighlightSize(size);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_minimap_position(PyObject *self, PyObject *args)
+{
+    float x, y;
+
+    if(!PyArg_ParseTuple(args, "ff", &x, &y)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two floats.");
+        return NULL;
+    }
+
+    G_SetMinimapPos(x, y);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_minimap_unit_rate(PyObject *self, PyObject *args)
+{
+    int hz;
+
+    if(!PyArg_ParseTuple(args, "i", &hz)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    G_SetMinimapUnitRate(hz);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_anim_lod(PyObject *self, PyObject *args)
+{
+    float dist;
+    int hz;
+
+    if(!PyArg_ParseTuple(args, "fi", &dist, &hz)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a float and an integer.");
+        return NULL;
+    }
+
+    G_SetAnimLOD(dist, hz);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_mesh_lod(PyObject *self, PyObject *args)
+{
+    float bias, impostor_size;
+
+    if(!PyArg_ParseTuple(args, "ff", &bias, &impostor_size)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two floats.");
+        return NULL;
+    }
+
+    G_SetMeshLOD(bias, impostor_size);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_crowd_anim_distance(PyObject *self, PyObject *args)
+{
+    float dist;
+
+    if(!PyArg_ParseTuple(args, "f", &dist)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a float.");
+        return NULL;
+    }
+
+    G_SetCrowdAnimDistance(dist);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_mouse_over_minimap(PyObject *self)
+{
+    bool result = G_MouseOverMinimap();
+    if(result) 
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_map_height_at_point(PyObject *self, PyObject *args)
+{
+    float x, z;
+
+    if(!PyArg_ParseTuple(args, "ff", &x, &z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two floats.");
+        return NULL;
+    }
+
+    float height;
+    bool result = G_MapHeightAtPoint((vec2_t){x, z}, &height);
+    if(!result)
+        Py_RETURN_NONE;
+    else
+        return Py_BuildValue("f", height);
+}
+
+/* The points are read in place and the heights are returned in a buffer of their own */
+static PyObject *map_heights_at_points_buffer(PyObject *obj)
+{
+    Py_buffer view;
+    if(0 != PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+        return NULL;
+
+    PyObject *ret = NULL;
+    if(view.itemsize != sizeof(float) || !view.format || 0 != strcmp(view.format, "f")
+    || (view.len % sizeof(vec2_t)) != 0) {
+        PyErr_SetString(PyExc_TypeError, "Buffer must hold float32 (X, Z) pairs.");
+        goto out;
+    }
+
+    size_t count = view.len / sizeof(vec2_t);
+    float *heights = MEM_Malloc(MEM_TAG_SCRIPT, count * sizeof(float) + 1);
+    if(!heights) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    G_MapHeightsAtPoints(view.buf, heights, count);
+    ret = S_Tile_FloatBuffer(heights, count);
+
+out:
+    PyBuffer_Release(&view);
+    return ret;
+}
+
+static PyObject *PyPf_map_heights_at_points(PyObject *self, PyObject *args)
+{
+    PyObject *list;
+
+    if(!PyArg_ParseTuple(args, "O", &list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of (X, Z) tuples or a buffer.");
+        return NULL;
+    }
+
+    if(PyObject_CheckBuffer(list))
+        return map_heights_at_points_buffer(list);
+
+    if(!PyList_Check(list)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a list of (X, Z) tuples or a buffer.");
+        return NULL;
+    }
+
+    Py_ssize_t len = PyList_Size(list);
+    vec2_t *points = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(vec2_t) + 1);
+    float *heights = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(float) + 1);
+    PyObject *ret = NULL;
+
+    if(!points || !heights) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+
+    for(int i = 0; i < len; i++) {
+
+        PyObject *item = PyList_GetItem(list, i);
+        if(!PyTuple_Check(item) || !PyArg_ParseTuple(item, "ff", &points[i].raw[0], &points[i].raw[1])) {
+            PyErr_SetString(PyExc_TypeError, "List items must be tuples of two floats.");
+            goto fail;
+        }
+    }
+
+    G_MapHeightsAtPoints(points, heights, len);
+
+    if(!(ret = PyList_New(len)))
+        goto fail;
+
+    for(int i = 0; i < len; i++) {
+
+        PyObject *height;
+        if(isnan(heights[i])) {
+            Py_INCREF(Py_None);
+            height = Py_None;
+        }else if(!(height = PyFloat_FromDouble(heights[i]))) {
+            Py_CLEAR(ret);
+            goto fail;
+        }
+        PyList_SetItem(ret, i, height); /* steals reference */
+    }
+
+fail:
+    MEM_Free(points);
+    MEM_Free(heights);
+    return ret;
+}
+
+static PyObject *PyPf_map_chunk_tiles(PyObject *self, PyObject *args)
+{
+    int chunk_r, chunk_c;
+
+    if(!PyArg_ParseTuple(args, "(ii)", &chunk_r, &chunk_c)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a tuple of two integers.");
+        return NULL;
+    }
+
+    return S_Tile_ChunkTilesView(chunk_r, chunk_c);
+}
+
+static PyObject *PyPf_map_heightfield(PyObject *self)
+{
+    return S_Tile_HeightfieldView();
+}
+
+static PyObject *PyPf_map_pos_under_cursor(PyObject *self)
+{
+    vec3_t pos;
+    if(M_Raycast_IntersecCoordinate(&pos))
+        return Py_BuildValue("[fff]", pos.x, pos.y, pos.z);
+    else
+        Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_map_raycast(PyObject *self, PyObject *args)
+{
+    vec3_t origin, dir;
+
+    if(!PyArg_ParseTuple(args, "(fff)(fff)", &origin.x, &origin.y, &origin.z, 
+                         &dir.x, &dir.y, &dir.z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two tuples of 3 floats.");
+        return NULL;
+    }
+
+    vec3_t pos;
+    if(G_MapRaycast(origin, dir, &pos))
+        return Py_BuildValue("[fff]", pos.x, pos.y, pos.z);
+    else
+        Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_map_stream_stats(PyObject *self)
+{
+    struct map_stream_stats stats;
+    if(!G_MapStreamStats(&stats))
+        Py_RETURN_NONE;
+
+    return Py_BuildValue("{s:K, s:K, s:K, s:K, s:K, s:K, s:n}", 
+        "hits",          (unsigned long long)stats.hits,
+        "prefetch_hits", (unsigned long long)stats.prefetch_hits,
+        "late_loads",    (unsigned long long)stats.late_loads,
+        "late_bakes",    (unsigned long long)stats.late_bakes,
+        "prefetched",    (unsigned long long)stats.prefetched,
+        "wasted",        (unsigned long long)stats.wasted,
+        "resident",      (Py_ssize_t)stats.resident);
+}
+
+static PyObject *PyPf_nav_cache_stats(PyObject *self)
+{
+    struct nav_cache_stats stats;
+    N_GetCacheStats(&stats);
+
+    return Py_BuildValue("{s:K, s:K, s:K, s:n, s:n}", 
+        "hits",      (unsigned long long)stats.hits,
+        "misses",    (unsigned long long)stats.misses,
+        "evictions", (unsigned long long)stats.evictions,
+        "bytes",     (Py_ssize_t)stats.bytes_resident,
+        "budget",    (Py_ssize_t)stats.bytes_budget);
+}
+
+static PyObject *PyPf_set_nav_cache_budget(PyObject *self, PyObject *args)
+{
+    Py_ssize_t bytes;
+
+    if(!PyArg_ParseTuple(args, "n", &bytes)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    if(bytes < 0) {
+        PyErr_SetString(PyExc_ValueError, "The budget must not be negative.");
+        return NULL;
+    }
+
+    N_SetCacheBudget(bytes);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_nav_flow_window(PyObject *self, PyObject *args)
+{
+    int chunks;
+    float budget_ms = 2.0f;
+
+    if(!PyArg_ParseTuple(args, "i|f", &chunks, &budget_ms) || chunks < 0 || budget_ms < 0.0f) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a non-negative integer and an optional "
+            "non-negative float.");
+        return NULL;
+    }
+
+    N_SetFlowWindow(chunks, budget_ms);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_nav_goal_region(PyObject *self, PyObject *args)
+{
+    int tiles;
+
+    if(!PyArg_ParseTuple(args, "i", &tiles) || tiles < 0) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a non-negative integer.");
+        return NULL;
+    }
+
+    N_SetGoalRegion(tiles);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_nav_path_budget(PyObject *self, PyObject *args)
+{
+    float ms;
+
+    if(!PyArg_ParseTuple(args, "f", &ms) || ms < 0.0f) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a non-negative float.");
+        return NULL;
+    }
+
+    N_SetPathBudget(ms);
+    Py_RETURN_NONE;
+}
+
+/* Reads either a single (X, Z) tuple or a list of them into a new buffer */
+static bool nav_parse_points(PyObject *obj, vec2_t **out, size_t *out_n, bool *out_single)
+{
+    if(PyTuple_Check(obj)) {
+
+        vec2_t point;
+        if(!PyArg_ParseTuple(obj, "ff", &point.raw[0], &point.raw[1]))
+            return false;
+        if(!(*out = MEM_Malloc(MEM_TAG_SCRIPT, sizeof(vec2_t)))) {
+            PyErr_NoMemory();
+            return false;
+        }
+        **out = point;
+        *out_n = 1;
+        *out_single = true;
+        return true;
+    }
+
+    if(!PyList_Check(obj)) {
+        PyErr_SetString(PyExc_TypeError, "Points must be an (X, Z) tuple or a list of them.");
+        return false;
+    }
+
+    Py_ssize_t len = PyList_Size(obj);
+    if(!(*out = MEM_Malloc(MEM_TAG_SCRIPT, len * sizeof(vec2_t) + 1))) {
+        PyErr_NoMemory();
+        return false;
+    }
+
+    for(int i = 0; i < len; i++) {
+
+        PyObject *item = PyList_GetItem(obj, i);
+        if(!PyTuple_Check(item) || !PyArg_ParseTuple(item, "ff", &(*out)[i].raw[0], &(*out)[i].raw[1])) {
+            PyErr_SetString(PyExc_TypeError, "List items must be tuples of two floats.");
+            MEM_Free(*out);
+            return false;
+        }
+    }
+    *out_n = len;
+    *out_single = false;
+    return true;
+}
+
+/* Reads the sources and destinations of a batched query. A single point on 
+ * either side is paired up with every point on the other. */
+static bool nav_parse_pairs(PyObject *a, PyObject *b, vec2_t **out_srcs, vec2_t **out_dests, 
+                            size_t *out_n, bool *out_single)
+{
+    vec2_t *srcs = NULL, *dests = NULL;
+    size_t num_srcs, num_dests;
+    bool single_src, single_dest;
+
+    if(!nav_parse_points(a, &srcs, &num_srcs, &single_src))
+        return false;
+    if(!nav_parse_points(b, &dests, &num_dests, &single_dest))
+        goto fail;
+
+    if(single_src != single_dest) {
+
+        vec2_t **single = single_src ? &srcs : &dests;
+        size_t n = single_src ? num_dests : num_srcs;
+        vec2_t *expanded = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(vec2_t) + 1);
+        if(!expanded) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        for(size_t i = 0; i < n; i++)
+            expanded[i] = **single;
+        MEM_Free(*single);
+        *single = expanded;
+        num_srcs = num_dests = n;
+    }
+
+    if(num_srcs != num_dests) {
+        PyErr_SetString(PyExc_TypeError, "Lists of sources and destinations must be of the same length.");
+        goto fail;
+    }
+
+    *out_srcs = srcs;
+    *out_dests = dests;
+    *out_n = num_srcs;
+    *out_single = single_src && single_dest;
+    return true;
+
+fail:
+    MEM_Free(srcs);
+    MEM_Free(dests);
+    return false;
+}
+
+static PyObject *nav_bool_results(const bool *results, size_t n, bool single)
+{
+    if(single)
+        return PyBool_FromLong(results[0]);
+
+    PyObject *ret = PyList_New(n);
+    if(!ret)
+        return NULL;
+    for(size_t i = 0; i < n; i++)
+        PyList_SetItem(ret, i, PyBool_FromLong(results[i])); /* steals reference */
+    return ret;
+}
+
+static PyObject *PyPf_path_exists(PyObject *self, PyObject *args)
+{
+    PyObject *a, *b;
+    float radius = 0.0f;
+
+    if(!PyArg_ParseTuple(args, "OO|f", &a, &b, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two points or lists of points and an optional radius.");
+        return NULL;
+    }
+
+    vec2_t *srcs, *dests;
+    size_t n;
+    bool single;
+    if(!nav_parse_pairs(a, b, &srcs, &dests, &n, &single))
+        return NULL;
+
+    PyObject *ret = NULL;
+    bool *found = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(bool) + 1);
+    if(!found) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    G_NavPathsExist(n, srcs, dests, radius, found);
+    ret = nav_bool_results(found, n, single);
+
+out:
+    MEM_Free(srcs);
+    MEM_Free(dests);
+    MEM_Free(found);
+    return ret;
+}
+
+static PyObject *PyPf_path_cost(PyObject *self, PyObject *args)
+{
+    PyObject *a, *b;
+    float radius = 0.0f;
+
+    if(!PyArg_ParseTuple(args, "OO|f", &a, &b, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two points or lists of points and an optional radius.");
+        return NULL;
+    }
+
+    vec2_t *srcs, *dests;
+    size_t n;
+    bool single;
+    if(!nav_parse_pairs(a, b, &srcs, &dests, &n, &single))
+        return NULL;
+
+    PyObject *ret = NULL;
+    float *costs = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(float) + 1);
+    if(!costs) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    G_NavPathCosts(n, srcs, dests, radius, costs);
+
+    if(single) {
+        if(isinf(costs[0])) {
+            Py_INCREF(Py_None);
+            ret = Py_None;
+        }else{
+            ret = PyFloat_FromDouble(costs[0]);
+        }
+        goto out;
+    }
+
+    if(!(ret = PyList_New(n)))
+        goto out;
+
+    for(size_t i = 0; i < n; i++) {
+
+        PyObject *cost;
+        if(isinf(costs[i])) {
+            Py_INCREF(Py_None);
+            cost = Py_None;
+        }else{
+            cost = PyFloat_FromDouble(costs[i]);
+        }
+        PyList_SetItem(ret, i, cost); /* steals reference */
+    }
+
+out:
+    MEM_Free(srcs);
+    MEM_Free(dests);
+    MEM_Free(costs);
+    return ret;
+}
+
+static PyObject *PyPf_pathable(PyObject *self, PyObject *args)
+{
+    PyObject *obj;
+    float radius = 0.0f;
+
+    if(!PyArg_ParseTuple(args, "O|f", &obj, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a point or a list of points and an optional radius.");
+        return NULL;
+    }
+
+    vec2_t *points;
+    size_t n;
+    bool single;
+    if(!nav_parse_points(obj, &points, &n, &single))
+        return NULL;
+
+    PyObject *ret = NULL;
+    bool *pathable = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(bool) + 1);
+    if(!pathable) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    G_NavPositionsPathable(n, points, radius, pathable);
+    ret = nav_bool_results(pathable, n, single);
+
+out:
+    MEM_Free(points);
+    MEM_Free(pathable);
+    return ret;
+}
+
+static PyObject *PyPf_nav_raycast(PyObject *self, PyObject *args)
+{
+    PyObject *a, *b;
+    float radius = 0.0f;
+
+    if(!PyArg_ParseTuple(args, "OO|f", &a, &b, &radius)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two points or lists of points and an optional radius.");
+        return NULL;
+    }
+
+    vec2_t *srcs, *dests;
+    size_t n;
+    bool single;
+    if(!nav_parse_pairs(a, b, &srcs, &dests, &n, &single))
+        return NULL;
+
+    PyObject *ret = NULL;
+    bool *hits = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(bool) + 1);
+    vec2_t *positions = MEM_Malloc(MEM_TAG_SCRIPT, n * sizeof(vec2_t) + 1);
+    if(!hits || !positions) {
+        PyErr_NoMemory();
+        goto out;
+    }
+
+    G_NavRaycasts(n, srcs, dests, radius, hits, positions);
+
+    if(single) {
+        if(hits[0])
+            ret = Py_BuildValue("(ff)", positions[0].raw[0], positions[0].raw[1]);
+        else {
+            Py_INCREF(Py_None);
+            ret = Py_None;
+        }
+        goto out;
+    }
+
+    if(!(ret = PyList_New(n)))
+        goto out;
+
+    for(size_t i = 0; i < n; i++) {
+
+        PyObject *hit;
+        if(hits[i]) {
+            hit = Py_BuildValue("(ff)", positions[i].raw[0], positions[i].raw[1]);
+        }else{
+            Py_INCREF(Py_None);
+            hit = Py_None;
+        }
+        if(!hit) {
+            Py_CLEAR(ret);
+            goto out;
+        }
+        PyList_SetItem(ret, i, hit); /* steals reference */
+    }
+
+out:
+    MEM_Free(srcs);
+    MEM_Free(dests);
+    MEM_Free(hits);
+    MEM_Free(positions);
+    return ret;
+}
+
+static PyObject *PyPf_set_move_avoidance(PyObject *self, PyObject *args)
+{
+    int mode;
+
+    if(!PyArg_ParseTuple(args, "i", &mode) || mode < 0 || mode >= MOVE_AVOID_MAX) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be one of the MOVE_AVOID_ constants.");
+        return NULL;
+    }
+
+    G_Move_SetAvoidance(mode);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_move_waypoint_group(PyObject *self, PyObject *args)
+{
+    int size;
+
+    if(!PyArg_ParseTuple(args, "i", &size) || size < 0) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a non-negative integer.");
+        return NULL;
+    }
+
+    G_Move_SetWaypointGroup(size);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_deterministic_movement(PyObject *self)
+{
+    G_Move_SetDeterministic(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_deterministic_movement(PyObject *self)
+{
+    G_Move_SetDeterministic(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_move_order(PyObject *self, PyObject *args)
+{
+    PyObject *entities;
+    float x, z;
+    unsigned int tick;
+
+    if(!PyArg_ParseTuple(args, "O(ff)I", &entities, &x, &z, &tick)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of entities, an (X, Z) tuple and an integer.");
+        return NULL;
+    }
+
+    PyObject *seq = PySequence_Fast(entities, "First argument must be a sequence of entities.");
+    if(!seq)
+        return NULL;
+
+    pentity_kvec_t ents;
+    kv_init(ents);
+    PyObject *ret = NULL;
+
+    for(int i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+
+        struct entity *ent = S_Entity_ForObj(PySequence_Fast_GET_ITEM(seq, i));
+        if(!ent) {
+            PyErr_SetString(PyExc_TypeError, "First argument must be a sequence of entities.");
+            goto out;
+        }
+        kv_push(struct entity*, ents, ent);
+    }
+
+    if(!G_Move_Order(&ents, (vec2_t){x, z}, tick)) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to schedule the move order.");
+        goto out;
+    }
+    Py_INCREF(Py_None);
+    ret = Py_None;
+
+out:
+    kv_destroy(ents);
+    Py_DECREF(seq);
+    return ret;
+}
+
+static PyObject *PyPf_movement_checksum(PyObject *self)
+{
+    return Py_BuildValue("(II)", (unsigned int)G_Move_Tick(), (unsigned int)G_Move_Checksum());
+}
+
+static PyObject *PyPf_net_start(PyObject *self, PyObject *args)
+{
+    int player, delay;
+    unsigned short port;
+    PyObject *peers_list;
+
+    if(!PyArg_ParseTuple(args, "iHO!i", &player, &port, &PyList_Type, &peers_list, &delay)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be two integers, a list of (player, host, port) tuples and an integer.");
+        return NULL;
+    }
+
+    size_t num_peers = PyList_GET_SIZE(peers_list);
+    struct net_peer peers[num_peers + 1];
+
+    for(int i = 0; i < num_peers; i++) {
+
+        if(!PyArg_ParseTuple(PyList_GET_ITEM(peers_list, i), "isH", 
+            &peers[i].player, &peers[i].host, &peers[i].port)) {
+            PyErr_SetString(PyExc_TypeError, "Peers must be (player, host, port) tuples.");
+            return NULL;
+        }
+    }
+
+    if(Net_Start(player, port, num_peers, peers, delay))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_net_stop(PyObject *self)
+{
+    Net_Stop();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_net_move_order(PyObject *self, PyObject *args)
+{
+    PyObject *entities;
+    float x, z;
+
+    if(!PyArg_ParseTuple(args, "O(ff)", &entities, &x, &z)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a sequence of entities and an (X, Z) tuple.");
+        return NULL;
+    }
+
+    PyObject *seq = PySequence_Fast(entities, "First argument must be a sequence of entities.");
+    if(!seq)
+        return NULL;
+
+    pentity_kvec_t ents;
+    kv_init(ents);
+    PyObject *ret = NULL;
+
+    for(int i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+
+        struct entity *ent = S_Entity_ForObj(PySequence_Fast_GET_ITEM(seq, i));
+        if(!ent) {
+            PyErr_SetString(PyExc_TypeError, "First argument must be a sequence of entities.");
+            goto out;
+        }
+        kv_push(struct entity*, ents, ent);
+    }
+
+    bool queued = Net_Active() ? Net_QueueMove(&ents, (vec2_t){x, z})
+                               : G_Move_Order(&ents, (vec2_t){x, z}, G_Move_Tick());
+    ret = PyBool_FromLong(queued);
+
+out:
+    kv_destroy(ents);
+    Py_DECREF(seq);
+    return ret;
+}
+
+static PyObject *PyPf_net_global_event(PyObject *self, PyObject *args)
+{
+    enum eventtype event;
+    PyObject *arg;
+
+    if(!PyArg_ParseTuple(args, "iO", &event, &arg)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must a tuple of an integer and one object.");
+        return NULL;
+    }
+
+    if(!Net_Active()) {
+        Py_INCREF(arg);
+        E_Global_Notify(event, arg, ES_SCRIPT);
+        Py_RETURN_TRUE;
+    }
+
+    PyObject *data = PyMarshal_WriteObjectToString(arg, Py_MARSHAL_VERSION);
+    if(!data)
+        return NULL;
+
+    bool queued = Net_QueueEvent(event, PyString_AS_STRING(data), PyString_GET_SIZE(data));
+    Py_DECREF(data);
+    return PyBool_FromLong(queued);
+}
+
+static PyObject *PyPf_net_stats(PyObject *self)
+{
+    struct net_stats stats;
+    Net_GetStats(&stats);
+
+    return Py_BuildValue("{s:I, s:I, s:K, s:K, s:K, s:K, s:K, s:L, s:i}",
+        "turn",             (unsigned int)stats.turn,
+        "stalled_turns",    (unsigned int)stats.stalled_turns,
+        "packets_sent",     (unsigned long long)stats.packets_sent,
+        "packets_recvd",    (unsigned long long)stats.packets_recvd,
+        "packets_dropped",  (unsigned long long)stats.packets_dropped,
+        "bytes_sent",       (unsigned long long)stats.bytes_sent,
+        "bytes_recvd",      (unsigned long long)stats.bytes_recvd,
+        "desync_turn",      (long long)stats.desync_turn,
+        "desync_player",    stats.desync_player);
+}
+
+static PyObject *PyPf_move_avoidance_stats(PyObject *self, PyObject *args)
+{
+    int mode;
+
+    if(!PyArg_ParseTuple(args, "i", &mode) || mode < 0 || mode >= MOVE_AVOID_MAX) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be one of the MOVE_AVOID_ constants.");
+        return NULL;
+    }
+
+    struct move_avoid_stats stats;
+    G_Move_GetAvoidanceStats(mode, &stats);
+
+    return Py_BuildValue("{s:K, s:K, s:K, s:K}", 
+        "flocks_arrived", (unsigned long long)stats.flocks_arrived,
+        "arrival_ms",     (unsigned long long)stats.arrival_ms,
+        "steer_updates",  (unsigned long long)stats.steer_updates,
+        "steer_us",       (unsigned long long)stats.steer_us);
+}
+
+static PyObject *PyPf_enable_occlusion_culling(PyObject *self)
+{
+    G_SetOcclusionCulling(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_occlusion_culling(PyObject *self)
+{
+    G_SetOcclusionCulling(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_depth_prepass(PyObject *self)
+{
+    G_SetDepthPrepass(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_depth_prepass(PyObject *self)
+{
+    G_SetDepthPrepass(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_heightfield_terrain(PyObject *self)
+{
+    G_SetHeightfieldTerrain(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_heightfield_terrain(PyObject *self)
+{
+    G_SetHeightfieldTerrain(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_preskinning(PyObject *self)
+{
+    R_GL_PreskinEnable(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_preskinning(PyObject *self)
+{
+    R_GL_PreskinEnable(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_occlusion_cull_stats(PyObject *self)
+{
+    struct occlusion_stats stats;
+    R_GL_OcclusionGetStats(&stats);
+
+    return Py_BuildValue("{s:n, s:n, s:n, s:n}", 
+        "tested",   (Py_ssize_t)stats.tested,
+        "occluded", (Py_ssize_t)stats.occluded,
+        "issued",   (Py_ssize_t)stats.issued,
+        "tracked",  (Py_ssize_t)stats.tracked);
+}
+
+static PyObject *PyPf_enable_gpu_culling(PyObject *self)
+{
+    if(G_SetGPUCulling(true))
+        Py_RETURN_TRUE;
+    Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_disable_gpu_culling(PyObject *self)
+{
+    G_SetGPUCulling(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_gpu_cull_stats(PyObject *self)
+{
+    struct gpucull_stats stats;
+    R_GL_GPUCullGetStats(&stats);
+
+    return Py_BuildValue("{s:n, s:n, s:n}", 
+        "instances", (Py_ssize_t)stats.instances,
+        "groups",    (Py_ssize_t)stats.groups,
+        "draws",     (Py_ssize_t)stats.draws);
+}
+
+static PyObject *PyPf_enable_fog_of_war(PyObject *self)
+{
+    if(!G_Fog_Enable()) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not enable the fog of war.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_fog_of_war(PyObject *self)
+{
+    G_Fog_Disable();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_fog_height_los(PyObject *self, PyObject *args)
+{
+    PyObject *on;
+
+    if(!PyArg_ParseTuple(args, "O", &on)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a boolean.");
+        return NULL;
+    }
+
+    if(!G_Fog_SetHeightLOS(PyObject_IsTrue(on))) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not sample the terrain heights.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_enable_shadows(PyObject *self)
+{
+    if(!G_Shadows_Enable()) {
+        PyErr_SetString(PyExc_RuntimeError, "Could not enable the shadows. Is a map loaded?");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_shadows(PyObject *self)
+{
+    G_Shadows_Disable();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_unit_overlay(PyObject *self, PyObject *args)
+{
+    PyObject *entity;
+    float fill;
+    int fg[4] = {0, 200, 0, 255};
+    int bg[4] = {0, 0, 0, 160};
+    struct unit_overlay overlay = (struct unit_overlay){
+        .size = (vec2_t){40.0f, 5.0f},
+        .height = -1.0f
+    };
+
+    if(!PyArg_ParseTuple(args, "Of|(iiii)(iiii)(ff)f", &entity, &fill, 
+        &fg[0], &fg[1], &fg[2], &fg[3], &bg[0], &bg[1], &bg[2], &bg[3],
+        &overlay.size.x, &overlay.size.y, &overlay.height)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be an entity, a float and optionally two "
+            "(R, G, B, A) tuples, a (width, height) tuple and a float.");
+        return NULL;
+    }
+
+    struct entity *ent = S_Entity_ForObj(entity);
+    if(!ent) {
+        PyErr_SetString(PyExc_TypeError, "First argument must be an entity.");
         return NULL;
+    }
+
+    overlay.fill = fill;
+    for(int i = 0; i < 4; i++) {
+        overlay.fg_color.raw[i] = fg[i] / 255.0f;
+        overlay.bg_color.raw[i] = bg[i] / 255.0f;
+    }
 
+    if(!G_Overlay_Set(ent, &overlay)) {
+        PyErr_SetString(PyExc_MemoryError, "Unable to set the overlay.");
+        return NULL;
+    }
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_set_map_highlight_size(PyObject *self, PyObject *args)
+static PyObject *PyPf_clear_unit_overlay(PyObject *self, PyObject *args)
 {
-    int size;
+    PyObject *entity;
 
-    if(!PyArg_ParseTuple(args, "i", &size)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be an integer.");
+    if(!PyArg_ParseTuple(args, "O", &entity)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an entity.");
         return NULL;
     }
 
-    M_Raycast_SetHighlightSize(size);
+    struct entity *ent = S_Entity_ForObj(entity);
+    if(!ent) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an entity.");
+        return NULL;
+    }
+
+    G_Overlay_Remove(ent);
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_set_minimap_position(PyObject *self, PyObject *args)
+static PyObject *PyPf_set_render_scale(PyObject *self, PyObject *args)
 {
-    float x, y;
+    float scale;
 
-    if(!PyArg_ParseTuple(args, "ff", &x, &y)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be two floats.");
+    if(!PyArg_ParseTuple(args, "f", &scale)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a float.");
         return NULL;
     }
 
-    G_SetMinimapPos(x, y);
+    R_GL_SetRenderScale(scale);
     Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_mouse_over_minimap(PyObject *self)
+static PyObject *PyPf_enable_dynamic_resolution(PyObject *self, PyObject *args)
 {
-    bool result = G_MouseOverMinimap();
-    if(result) 
+    float target_ms;
+    float min_scale = CONFIG_MIN_RENDER_SCALE;
+
+    if(!PyArg_ParseTuple(args, "f|f", &target_ms, &min_scale)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a float and an optional float.");
+        return NULL;
+    }
+
+    if(target_ms <= 0.0f) {
+        PyErr_SetString(PyExc_ValueError, "The target time must be positive.");
+        return NULL;
+    }
+
+    R_GL_SetDynamicResolution(target_ms, min_scale);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_dynamic_resolution(PyObject *self)
+{
+    R_GL_SetDynamicResolution(0.0f, CONFIG_MIN_RENDER_SCALE);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_render_scale_stats(PyObject *self)
+{
+    struct render_scale_stats stats;
+    R_GL_GetRenderScaleStats(&stats);
+
+    return Py_BuildValue("{s:f, s:f}", 
+        "scale",    stats.scale,
+        "scene_ms", stats.scene_ms);
+}
+
+static PyObject *PyPf_render_stats(PyObject *self)
+{
+    struct render_stats stats;
+    R_GL_GetRenderStats(&stats);
+
+    PyObject *gpu_ms = PyDict_New();
+    if(!gpu_ms)
+        return NULL;
+
+    for(int i = 0; i < GPU_PASS_COUNT; i++) {
+
+        PyObject *ms = PyFloat_FromDouble(stats.pass_ms[i]);
+        if(!ms || PyDict_SetItemString(gpu_ms, R_GL_PassName(i), ms) < 0) {
+            Py_XDECREF(ms);
+            Py_DECREF(gpu_ms);
+            return NULL;
+        }
+        Py_DECREF(ms);
+    }
+
+    return Py_BuildValue("{s:n, s:n, s:n, s:n, s:N}", 
+        "draw_calls",    (Py_ssize_t)stats.draw_calls,
+        "vertices",      (Py_ssize_t)stats.vertices,
+        "program_binds", (Py_ssize_t)stats.program_binds,
+        "texture_binds", (Py_ssize_t)stats.texture_binds,
+        "gpu_ms",        gpu_ms);
+}
+
+static PyObject *PyPf_enable_perf_overlay(PyObject *self)
+{
+    Perf_SetOverlayEnabled(true);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_disable_perf_overlay(PyObject *self)
+{
+    Perf_SetOverlayEnabled(false);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_capture_perf_trace(PyObject *self, PyObject *args)
+{
+    const char *path;
+    int num_frames = 300;
+
+    if(!PyArg_ParseTuple(args, "s|i", &path, &num_frames)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a string and an optional integer.");
+        return NULL;
+    }
+
+    if(Perf_CaptureTrace(path, num_frames))
         Py_RETURN_TRUE;
     else
         Py_RETURN_FALSE;
 }
 
-static PyObject *PyPf_map_height_at_point(PyObject *self, PyObject *args)
+static PyObject *PyPf_perf_totals(PyObject *self)
 {
-    float x, z;
+    struct perf_frame_totals frames;
+    size_t n = Perf_GetTotals(NULL, 0, &frames);
+    struct perf_zone_totals *totals = malloc(n * sizeof(struct perf_zone_totals) + 1);
+    if(!totals)
+        return PyErr_NoMemory();
 
-    if(!PyArg_ParseTuple(args, "ff", &x, &z)) {
-        PyErr_SetString(PyExc_TypeError, "Arguments must be two floats.");
+    Perf_GetTotals(totals, n, &frames);
+
+    PyObject *ret = NULL;
+    PyObject *zones = PyDict_New();
+    if(!zones)
+        goto out;
+
+    for(int i = 0; i < n; i++) {
+
+        PyObject *zone = Py_BuildValue("{s:d, s:d, s:K}", 
+            "total_ms", totals[i].total_ms,
+            "max_ms",   totals[i].max_frame_ms,
+            "calls",    totals[i].calls);
+
+        if(!zone || 0 != PyDict_SetItemString(zones, totals[i].name, zone)) {
+            Py_XDECREF(zone);
+            goto out;
+        }
+        Py_DECREF(zone);
+    }
+
+    ret = Py_BuildValue("{s:I, s:d, s:O}", 
+        "frames",   frames.num_frames,
+        "frame_ms", frames.total_ms,
+        "zones",    zones);
+
+out:
+    Py_XDECREF(zones);
+    free(totals);
+    return ret;
+}
+
+static PyObject *PyPf_reset_perf_totals(PyObject *self)
+{
+    Perf_ResetTotals();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_spike_capture(PyObject *self, PyObject *args)
+{
+    double threshold_ms;
+    const char *dir = ".";
+
+    if(!PyArg_ParseTuple(args, "d|s", &threshold_ms, &dir)) {
+        PyErr_SetString(PyExc_TypeError, "Arguments must be a float and an optional string.");
         return NULL;
     }
 
-    float height;
-    bool result = G_MapHeightAtPoint((vec2_t){x, z}, &height);
-    if(!result)
-        Py_RETURN_NONE;
-    else
-        return Py_BuildValue("f", height);
+    if(!Perf_SetSpikeCapture(threshold_ms, dir)) {
+        PyErr_SetString(PyExc_ValueError, "The directory name is too long.");
+        return NULL;
+    }
+    Py_RETURN_NONE;
 }
 
-static PyObject *PyPf_map_pos_under_cursor(PyObject *self)
+static PyObject *PyPf_start_telemetry(PyObject *self, PyObject *args)
 {
-    vec3_t pos;
-    if(M_Raycast_IntersecCoordinate(&pos))
-        return Py_BuildValue("[fff]", pos.x, pos.y, pos.z);
+    const char *path;
+
+    if(!PyArg_ParseTuple(args, "s", &path)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a string.");
+        return NULL;
+    }
+
+    if(Telemetry_Start(path))
+        Py_RETURN_TRUE;
     else
-        Py_RETURN_NONE;
+        Py_RETURN_FALSE;
+}
+
+static PyObject *PyPf_stop_telemetry(PyObject *self)
+{
+    Telemetry_Stop();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_memory_stats(PyObject *self)
+{
+    PyObject *ret = PyDict_New();
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+
+        struct mem_stats stats;
+        MEM_GetStats(i, &stats);
+
+        PyObject *tag = Py_BuildValue("{s:n, s:n, s:n}", 
+            "live",   (Py_ssize_t)stats.live,
+            "peak",   (Py_ssize_t)stats.peak,
+            "allocs", (Py_ssize_t)stats.num_allocs);
+
+        if(!tag || 0 != PyDict_SetItemString(ret, MEM_TagName(i), tag)) {
+            Py_XDECREF(tag);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(tag);
+    }
+    return ret;
+}
+
+static int s_compare_handler_stats(const void *a, const void *b)
+{
+    const struct script_handler_stats *sa = a, *sb = b;
+    return (sa->total_ms < sb->total_ms) - (sa->total_ms > sb->total_ms);
+}
+
+static PyObject *PyPf_script_profile(PyObject *self)
+{
+    size_t n = E_GetScriptHandlerStats(NULL, 0);
+    struct script_handler_stats *stats = malloc(n * sizeof(struct script_handler_stats) + 1);
+    if(!stats)
+        return PyErr_NoMemory();
+
+    E_GetScriptHandlerStats(stats, n);
+    qsort(stats, n, sizeof(struct script_handler_stats), s_compare_handler_stats);
+
+    PyObject *ret = PyList_New(n);
+    if(!ret)
+        goto out;
+
+    for(int i = 0; i < n; i++) {
+
+        PyObject *entry = Py_BuildValue("(OKdd)", (PyObject*)stats[i].callable,
+            (unsigned PY_LONG_LONG)stats[i].calls, stats[i].total_ms, stats[i].max_ms);
+        if(!entry) {
+            Py_CLEAR(ret);
+            goto out;
+        }
+        PyList_SET_ITEM(ret, i, entry);
+    }
+
+out:
+    free(stats);
+    return ret;
+}
+
+static PyObject *PyPf_reset_script_profile(PyObject *self)
+{
+    E_ResetScriptHandlerStats();
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_set_script_budget(PyObject *self, PyObject *args)
+{
+    double ms;
+
+    if(!PyArg_ParseTuple(args, "d", &ms)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a float.");
+        return NULL;
+    }
+
+    E_SetScriptBudget(ms);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_gc_stats(PyObject *self)
+{
+    struct gc_gen_stats stats[3];
+    S_GC_GetStats(stats);
+
+    return Py_BuildValue("[{s:K, s:d, s:d, s:d}, {s:K, s:d, s:d, s:d}, {s:K, s:d, s:d, s:d}]",
+        "collections", (unsigned PY_LONG_LONG)stats[0].collections,
+        "last_ms", stats[0].last_ms, "max_ms", stats[0].max_ms, "total_ms", stats[0].total_ms,
+        "collections", (unsigned PY_LONG_LONG)stats[1].collections,
+        "last_ms", stats[1].last_ms, "max_ms", stats[1].max_ms, "total_ms", stats[1].total_ms,
+        "collections", (unsigned PY_LONG_LONG)stats[2].collections,
+        "last_ms", stats[2].last_ms, "max_ms", stats[2].max_ms, "total_ms", stats[2].total_ms);
+}
+
+static PyObject *PyPf_set_gc_budget(PyObject *self, PyObject *args)
+{
+    double ms;
+
+    if(!PyArg_ParseTuple(args, "d", &ms)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be a float.");
+        return NULL;
+    }
+
+    S_GC_SetBudget(ms);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_frame_time_stats(PyObject *self)
+{
+    struct frame_stats stats;
+    Pace_GetStats(&stats);
+
+    return Py_BuildValue("{s:i, s:f, s:f, s:f, s:f, s:f, s:f}", 
+        "frames",      stats.num_frames,
+        "avg_ms",      stats.avg_ms,
+        "p50_ms",      stats.p50_ms,
+        "p99_ms",      stats.p99_ms,
+        "max_ms",      stats.max_ms,
+        "busy_p50_ms", stats.busy_p50_ms,
+        "busy_p99_ms", stats.busy_p99_ms);
+}
+
+static PyObject *PyPf_set_frame_rate_limit(PyObject *self, PyObject *args)
+{
+    int fps;
+
+    if(!PyArg_ParseTuple(args, "i", &fps)) {
+        PyErr_SetString(PyExc_TypeError, "Argument must be an integer.");
+        return NULL;
+    }
+
+    if(fps < 0) {
+        PyErr_SetString(PyExc_ValueError, "The frame rate limit must not be negative.");
+        return NULL;
+    }
+
+    Pace_SetTargetFPS(fps);
+    Py_RETURN_NONE;
+}
+
+static PyObject *PyPf_get_frame_rate_limit(PyObject *self)
+{
+    return Py_BuildValue("i", Pace_GetTargetFPS());
 }
 
 static PyObject *PyPf_multiply_quaternions(PyObject *self, PyObject *args)
@@ -631,9 +3404,9 @@ static PyObject *PyPf_multiply_quaternions(PyObject *self, PyObject *args)
         return NULL;
     }
 
-    if(!s_quat_from_pylist_arg(q1_list, &q1))
+    if(!S_Quat_Get(q1_list, &q1))
         return NULL;
-    if(!s_quat_from_pylist_arg(q2_list, &q2))
+    if(!S_Quat_Get(q2_list, &q2))
         return NULL;
 
     PFM_Quat_MultQuat(&q1, &q2, &ret);
@@ -667,6 +3440,85 @@ static bool s_sys_path_add_dir(const char *filename)
     return true;
 }
 
+/* The bundle of 'path' is the file with its' '.py' extension replaced by 
+ * '.pfbundle', written by 'scripts/compile_scripts.py' */
+static bool s_bundle_path(const char *path, char *out, size_t size)
+{
+    size_t len = strlen(path);
+    if(len < 3 || strcmp(path + len - 3, ".py"))
+        return false;
+
+    int written = snprintf(out, size, "%.*s.pfbundle", (int)(len - 3), path);
+    if(written < 0 || written >= size)
+        return false;
+
+    FILE *file = fopen(out, "rb");
+    if(!file)
+        return false;
+    fclose(file);
+    return true;
+}
+
+/* Runs the precompiled code of the script from its' bundle, which is put 
+ * at the front of 'sys.path' so that the modules it imports are loaded 
+ * from there too, by 'zipimport'. Returns false if the code could not be 
+ * read from the bundle, in which case it is left out of 'sys.path'. */
+static bool s_run_bundled(const char *path, const char *bundle)
+{
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char modname[256];
+    if(strlen(name) - 3 >= sizeof(modname))
+        return false;
+    strncpy(modname, name, strlen(name) - 3);
+    modname[strlen(name) - 3] = '\0';
+
+    PyObject *sys_path = PySys_GetObject("path");
+    assert(sys_path);
+
+    PyObject *entry = NULL, *zipimport = NULL, *importer = NULL, *code = NULL;
+
+    if(!(entry = PyString_FromString(bundle))
+    || !(zipimport = PyImport_ImportModule("zipimport"))
+    || !(importer = PyObject_CallMethod(zipimport, "zipimporter", "O", entry))
+    || !(code = PyObject_CallMethod(importer, "get_code", "s", modname))
+    || !PyCode_Check(code)
+    || 0 != PyList_Insert(sys_path, 0, entry))
+        goto fail;
+
+    PyObject *main_dict = PyModule_GetDict(PyImport_AddModule("__main__"));
+    PyObject *file = PyString_FromString(path);
+    if(!file || 0 != PyDict_SetItemString(main_dict, "__file__", file)) {
+        Py_XDECREF(file);
+        PySequence_DelItem(sys_path, 0);
+        goto fail;
+    }
+    Py_DECREF(file);
+
+    /* As with 'PyRun_SimpleFile', an uncaught exception is printed */
+    PyObject *ret = PyEval_EvalCode((PyCodeObject*)code, main_dict, main_dict);
+    if(!ret)
+        PyErr_Print();
+    Py_XDECREF(ret);
+
+    Py_DECREF(code);
+    Py_DECREF(importer);
+    Py_DECREF(zipimport);
+    Py_DECREF(entry);
+    return true;
+
+fail:
+    if(PyErr_Occurred())
+        PyErr_Print();
+    fprintf(stderr, "Could not run %s from the bundle %s - running the source file instead.\n", 
+        modname, bundle);
+    Py_XDECREF(code);
+    Py_XDECREF(importer);
+    Py_XDECREF(zipimport);
+    Py_XDECREF(entry);
+    return false;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -681,6 +3533,7 @@ PyMODINIT_FUNC initpf(void)
     S_Entity_PyRegister(module);
     S_UI_PyRegister(module);
     S_Tile_PyRegister(module);
+    S_Vec_PyRegister(module);
     S_Constants_Expose(module); 
 }
 
@@ -693,6 +3546,14 @@ bool S_Init(char *progname, const char *base_path, struct nk_context *ctx)
         return false;
     if(!S_Entity_Init())
         return false;
+    if(!S_Sched_Init())
+        return false;
+    if(!S_AI_Init())
+        return false;
+    if(!S_Component_Init())
+        return false;
+    if(!S_GC_Init())
+        return false;
 
     initpf();
     return true;
@@ -700,6 +3561,18 @@ bool S_Init(char *progname, const char *base_path, struct nk_context *ctx)
 
 void S_Shutdown(void)
 {
+    Scene_CancelLoads();
+    S_AI_Shutdown();
+    S_GC_Shutdown();
+    S_Sched_Shutdown();
+    S_Component_Shutdown();
+
+    for(int i = 0; i < SDL_NUM_SCANCODES; i++)
+        Py_CLEAR(s_key_args[i]);
+    for(int i = 0; i <= UINT8_MAX; i++) {
+        Py_CLEAR(s_button_args[i][0]);
+        Py_CLEAR(s_button_args[i][1]);
+    }
     Py_Finalize();
     S_UI_Shutdown();
     S_Entity_Shutdown();
@@ -716,8 +3589,21 @@ bool S_RunFile(const char *path)
     if(!s_sys_path_add_dir(path))
         return false;
 
-    PyObject *PyFileObject = PyFile_FromString((char*)path, "r");
-    PyRun_SimpleFile(PyFile_AsFile(PyFileObject), path);
+    char bundle[512];
+    bool bundled = CONFIG_SCRIPT_BUNDLE && s_bundle_path(path, bundle, sizeof(bundle));
+
+    if(bundled) {
+        Perf_StartupPush("s_run_bundled", bundle);
+        bundled = s_run_bundled(path, bundle);
+        Perf_StartupPop();
+    }
+
+    if(!bundled) {
+        Perf_StartupPush("PyRun_SimpleFile", path);
+        PyObject *PyFileObject = PyFile_FromString((char*)path, "r");
+        PyRun_SimpleFile(PyFile_AsFile(PyFileObject), path);
+        Perf_StartupPop();
+    }
 
     fclose(script);
     return true;
@@ -754,30 +3640,44 @@ void S_Release(script_opaque_t obj)
     Py_XDECREF(obj);
 }
 
+void S_Retain(script_opaque_t obj)
+{
+    Py_XINCREF(obj);
+}
+
 script_opaque_t S_WrapEngineEventArg(enum eventtype e, void *arg)
 {
     switch(e) {
         case SDL_KEYDOWN:
         case SDL_KEYUP:
-            return Py_BuildValue("(i)", 
-                ((SDL_Event*)arg)->key.keysym.scancode);
-
+        {
+            SDL_Scancode code = ((SDL_Event*)arg)->key.keysym.scancode;
+            if(code < 0 || code >= SDL_NUM_SCANCODES)
+                return Py_BuildValue("(i)", code);
+
+            if(!s_key_args[code])
+                s_key_args[code] = Py_BuildValue("(i)", code);
+            Py_XINCREF(s_key_args[code]);
+            return s_key_args[code];
+        }
         case SDL_MOUSEMOTION:
             return Py_BuildValue("(i,i), (i,i)",
                 ((SDL_Event*)arg)->motion.x,
                 ((SDL_Event*)arg)->motion.y,
                 ((SDL_Event*)arg)->motion.xrel,
-                ((SDL_Event*)arg)->motion.xrel);
+                ((SDL_Event*)arg)->motion.yrel);
 
         case SDL_MOUSEBUTTONDOWN:
-            return Py_BuildValue("(i, i)",
-                ((SDL_Event*)arg)->button.button,
-                ((SDL_Event*)arg)->button.state);
-
         case SDL_MOUSEBUTTONUP:
-            return Py_BuildValue("(i, i)",
-                ((SDL_Event*)arg)->button.button,
-                ((SDL_Event*)arg)->button.state);
+        {
+            Uint8 button = ((SDL_Event*)arg)->button.button;
+            Uint8 state = !!((SDL_Event*)arg)->button.state;
+
+            if(!s_button_args[button][state])
+                s_button_args[button][state] = Py_BuildValue("(i, i)", button, state);
+            Py_XINCREF(s_button_args[button][state]);
+            return s_button_args[button][state];
+        }
 
         case SDL_MOUSEWHEEL:
         {
@@ -795,13 +3695,56 @@ script_opaque_t S_WrapEngineEventArg(enum eventtype e, void *arg)
                 ((struct tile_desc*)arg)->tile_r,
                 ((struct tile_desc*)arg)->tile_c);
 
+        case EVENT_ENTER_RANGE:
+        case EVENT_LEAVE_RANGE:
+        {
+            /* The other entity may be gone by the time the event is handled */
+            PyObject *ret = S_Entity_ObjForUID((uintptr_t)arg);
+            if(!ret)
+                Py_RETURN_NONE;
+            Py_INCREF(ret);
+            return ret;
+        }
+
         default:
             Py_RETURN_NONE;
     }
 }
 
+script_opaque_t S_WrapEntityBatch(size_t count, const uint32_t uids[], 
+                                  const script_opaque_t args[])
+{
+    PyObject *ret = PyList_New(0);
+    if(!ret)
+        return NULL;
+
+    for(int i = 0; i < count; i++) {
+
+        PyObject *ent = S_Entity_ObjForUID(uids[i]);
+        if(!ent)
+            continue;
+
+        PyObject *pair = Py_BuildValue("(OO)", ent, (PyObject*)args[i]);
+        if(!pair || 0 != PyList_Append(ret, pair)) {
+            Py_XDECREF(pair);
+            Py_DECREF(ret);
+            return NULL;
+        }
+        Py_DECREF(pair);
+    }
+    return ret;
+}
+
 bool S_ObjectsEqual(script_opaque_t a, script_opaque_t b)
 {
     return (1 == PyObject_RichCompareBool(a, b, Py_EQ));
 }
 
+script_opaque_t S_UnmarshalArg(const void *data, size_t size)
+{
+    PyObject *ret = PyMarshal_ReadObjectFromString((char*)data, size);
+    if(!ret)
+        PyErr_Clear();
+    return ret;
+}
+
@@ -34,10 +34,13 @@
  */
 
 #include "script_constants.h"
+#include "component_script.h"
 #include "../lib/public/nuklear.h"
 #include "../event.h"
 #include "../map/public/map.h"
 #include "../map/public/tile.h"
+#include "../game/public/game.h"
+#include "../entity.h"
 
 #include <SDL.h>
 
@@ -418,19 +421,47 @@ static void s_expose_event_constants(PyObject *module)
     PY_EXPOSE_ENUM(module, EVENT_ANIM_FINISHED);
     PY_EXPOSE_ENUM(module, EVENT_MOTION_START);
     PY_EXPOSE_ENUM(module, EVENT_MOTION_END);
+    PY_EXPOSE_ENUM(module, EVENT_ENTER_RANGE);
+    PY_EXPOSE_ENUM(module, EVENT_LEAVE_RANGE);
     PY_EXPOSE_ENUM(module, EVENT_ENGINE_LAST);
+
+    PY_EXPOSE_ENUM(module, ENTITY_FLAG_ANIMATED);
+    PY_EXPOSE_ENUM(module, ENTITY_FLAG_COLLISION);
+    PY_EXPOSE_ENUM(module, ENTITY_FLAG_SELECTABLE);
+    PY_EXPOSE_ENUM(module, ENTITY_FLAG_STATIC);
+
+    PY_EXPOSE_ENUM(module, COMPONENT_FLOAT);
+    PY_EXPOSE_ENUM(module, COMPONENT_INT);
+    PY_EXPOSE_ENUM(module, COMPONENT_VEC2);
+    PY_EXPOSE_ENUM(module, COMPONENT_ENTITY);
+
+    PY_EXPOSE_ENUM(module, EC_NONE);
+    PY_EXPOSE_ENUM(module, EC_KEEP_LATEST);
+    PY_EXPOSE_ENUM(module, EC_SUM_DELTAS);
+    PY_EXPOSE_ENUM(module, EC_DROP_DUPLICATES);
 }
 
 static void s_expose_map_constants(PyObject *module)
 {
     PY_EXPOSE_ENUM(module, CHUNK_RENDER_MODE_PREBAKED);
     PY_EXPOSE_ENUM(module, CHUNK_RENDER_MODE_REALTIME_BLEND);
+    PY_EXPOSE_ENUM(module, CHUNK_RENDER_MODE_REALTIME_SPLAT);
+    PY_EXPOSE_ENUM(module, CHUNK_RENDER_MODE_HYBRID);
     PY_EXPOSE_ENUM(module, MATERIALS_PER_CHUNK);
     PY_EXPOSE_ENUM(module, TILES_PER_CHUNK_WIDTH);
     PY_EXPOSE_ENUM(module, TILES_PER_CHUNK_HEIGHT);
     PY_EXPOSE_ENUM(module, MINIMAP_SIZE);
 }
 
+static void s_expose_game_constants(PyObject *module)
+{
+    PY_EXPOSE_ENUM(module, MOVE_AVOID_FORCES);
+    PY_EXPOSE_ENUM(module, MOVE_AVOID_ORCA);
+    PY_EXPOSE_ENUM(module, SCATTER_TILES_ANY);
+    PY_EXPOSE_ENUM(module, SCATTER_TILES_PATHABLE);
+    PY_EXPOSE_ENUM(module, SCATTER_TILES_UNPATHABLE);
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -441,5 +472,6 @@ void S_Constants_Expose(PyObject *module)
     s_expose_nuklear_constants(module);
     s_expose_event_constants(module);
     s_expose_map_constants(module);
+    s_expose_game_constants(module);
 }
 
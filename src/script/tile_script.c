@@ -36,6 +36,8 @@
 #include "tile_script.h"
 #include "../map/public/tile.h"
 #include "../map/public/map.h"
+#include "../game/public/game.h"
+#include "../mem.h"
 
 #include <structmember.h>
 
@@ -44,27 +46,43 @@ typedef struct {
     struct tile tile; 
 }PyTileObject;
 
+typedef struct {
+    PyObject_HEAD
+    /* Points into the map when 'owned' is NULL */
+    const void *data;
+    void       *owned;
+    uint32_t    map_generation;
+    const char *format;
+    Py_ssize_t  itemsize;
+    int         ndim;
+    Py_ssize_t  shape[2];
+    Py_ssize_t  strides[2];
+}PyMapBufferObject;
+
 
 static int PyTile_init(PyTileObject *self, PyObject *args);
 static PyObject *PyTile_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
 
+static void PyMapBuffer_dealloc(PyMapBufferObject *self);
+static int PyMapBuffer_getbuffer(PyMapBufferObject *self, Py_buffer *view, int flags);
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
 #define BASE (offsetof(PyTileObject, tile))
 static PyMemberDef PyTileMembers[] = {
-    {"pathable",        T_INT, BASE + offsetof(struct tile, pathable),         0,
+    {"pathable",        T_UBYTE, BASE + offsetof(struct tile, pathable),            0,
     "Whether or not units can travel through this tile."},
-    {"type",            T_INT, BASE + offsetof(struct tile, type),             0,
+    {"type",            T_UBYTE, BASE + offsetof(struct tile, type),                0,
     "Integer value specifying whether this tile is a ramp, which direction it faces, etc."},
-    {"base_height",     T_INT, BASE + offsetof(struct tile, base_height),      0,
+    {"base_height",     T_BYTE,  BASE + offsetof(struct tile, base_height),         0,
     "The height level of the bottom plane of the tile."},
-    {"top_mat_idx",     T_INT, BASE + offsetof(struct tile, top_mat_idx),      0,
+    {"top_mat_idx",     T_UBYTE, BASE + offsetof(struct tile, top_mat_idx),         0,
     "Material index for the top face of the tile."},
-    {"sides_mat_idx",   T_INT, BASE + offsetof(struct tile, sides_mat_idx),    0,
+    {"sides_mat_idx",   T_UBYTE, BASE + offsetof(struct tile, sides_mat_idx),       0,
     "Material index for the side faces of the tile."},
-    {"ramp_height",     T_INT, BASE + offsetof(struct tile, ramp_height),      0,
+    {"ramp_height",     T_BYTE,  BASE + offsetof(struct tile, ramp_height),         0,
     "The height of the top edge of the ramp or corner above the base_height."},
     {NULL}  /* Sentinel */
 };
@@ -80,6 +98,29 @@ static PyTypeObject PyTile_type = {
     .tp_new         = PyTile_new,
 };
 
+/* The struct layouts, in the syntax of the 'struct' module, so that numpy 
+ * can expose the fields by name */
+static const char *s_tile_format = 
+    "T{B:pathable:B:type:b:base_height:b:ramp_height:B:top_mat_idx:B:sides_mat_idx:}";
+static const char *s_heights_format = 
+    "T{i:kind:f:nw:f:ne:f:sw:f:se:}";
+
+static PyBufferProcs PyMapBuffer_as_buffer = {
+    .bf_getbuffer   = (getbufferproc)PyMapBuffer_getbuffer,
+};
+
+static PyTypeObject PyMapBuffer_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.MapBuffer",
+    .tp_basicsize   = sizeof(PyMapBufferObject),
+    .tp_dealloc     = (destructor)PyMapBuffer_dealloc,
+    .tp_as_buffer   = &PyMapBuffer_as_buffer,
+    .tp_flags       = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,
+    .tp_doc         = "Read-only view of map data, exposed through the buffer protocol. Wrap it "
+                      "in a 'memoryview' or pass it to 'numpy.asarray' to read it without "
+                      "copying. Views of the map become unusable once the map is unloaded.",
+};
+
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -102,6 +143,62 @@ static PyObject *PyTile_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     return self;
 }
 
+static PyMapBufferObject *map_buffer_new(const void *data, const char *format, Py_ssize_t itemsize,
+                                         Py_ssize_t rows, Py_ssize_t cols)
+{
+    PyMapBufferObject *ret = PyObject_New(PyMapBufferObject, &PyMapBuffer_type);
+    if(!ret)
+        return NULL;
+
+    ret->data = data;
+    ret->owned = NULL;
+    ret->map_generation = G_MapGeneration();
+    ret->format = format;
+    ret->itemsize = itemsize;
+    ret->ndim = (rows > 0) ? 2 : 1;
+    ret->shape[0] = (rows > 0) ? rows : cols;
+    ret->shape[1] = cols;
+    ret->strides[0] = (rows > 0) ? cols * itemsize : itemsize;
+    ret->strides[1] = itemsize;
+    return ret;
+}
+
+static void PyMapBuffer_dealloc(PyMapBufferObject *self)
+{
+    MEM_Free(self->owned);
+    PyObject_Del(self);
+}
+
+static int PyMapBuffer_getbuffer(PyMapBufferObject *self, Py_buffer *view, int flags)
+{
+    if(!self->owned && self->map_generation != G_MapGeneration()) {
+        PyErr_SetString(PyExc_BufferError, "The map this view was made for has been unloaded.");
+        return -1;
+    }
+    if(flags & PyBUF_WRITABLE) {
+        PyErr_SetString(PyExc_BufferError, "Map buffers are read-only.");
+        return -1;
+    }
+
+    Py_ssize_t len = self->itemsize;
+    for(int i = 0; i < self->ndim; i++)
+        len *= self->shape[i];
+
+    Py_INCREF(self);
+    view->obj = (PyObject*)self;
+    view->buf = (void*)self->data;
+    view->len = len;
+    view->readonly = 1;
+    view->itemsize = self->itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? (char*)self->format : NULL;
+    view->ndim = self->ndim;
+    view->shape = (flags & PyBUF_ND) ? self->shape : NULL;
+    view->strides = ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : NULL;
+    view->suboffsets = NULL;
+    view->internal = NULL;
+    return 0;
+}
+
 /*****************************************************************************/
 /* EXTERN FUNCTIONS                                                          */
 /*****************************************************************************/
@@ -112,6 +209,11 @@ void S_Tile_PyRegister(PyObject *module)
         return;
     Py_INCREF(&PyTile_type);
     PyModule_AddObject(module, "Tile", (PyObject*)&PyTile_type);
+
+    if(PyType_Ready(&PyMapBuffer_type) < 0)
+        return;
+    Py_INCREF(&PyMapBuffer_type);
+    PyModule_AddObject(module, "MapBuffer", (PyObject*)&PyMapBuffer_type);
 }
 
 const struct tile *S_Tile_GetTile(PyObject *tile_obj)
@@ -122,3 +224,40 @@ const struct tile *S_Tile_GetTile(PyObject *tile_obj)
     return &((PyTileObject*)tile_obj)->tile;
 }
 
+PyObject *S_Tile_ChunkTilesView(int chunk_r, int chunk_c)
+{
+    const struct tile *tiles = G_MapChunkTiles(chunk_r, chunk_c);
+    if(!tiles) {
+        PyErr_SetString(PyExc_IndexError, "Chunk coordinates are outside the map.");
+        return NULL;
+    }
+
+    return (PyObject*)map_buffer_new(tiles, s_tile_format, sizeof(struct tile), 
+        TILES_PER_CHUNK_HEIGHT, TILES_PER_CHUNK_WIDTH);
+}
+
+PyObject *S_Tile_HeightfieldView(void)
+{
+    int rows, cols;
+    const struct tile_heights *heights = G_MapHeightfield(&rows, &cols);
+    if(!heights)
+        Py_RETURN_NONE;
+
+    return (PyObject*)map_buffer_new(heights, s_heights_format, sizeof(struct tile_heights), rows, cols);
+}
+
+PyObject *S_Tile_FloatBuffer(float *data, size_t count)
+{
+    return S_Tile_RecordBuffer(data, "f", sizeof(float), count);
+}
+
+PyObject *S_Tile_RecordBuffer(void *data, const char *format, size_t itemsize, size_t count)
+{
+    PyMapBufferObject *ret = map_buffer_new(data, format, itemsize, 0, count);
+    if(!ret) {
+        MEM_Free(data);
+        return NULL;
+    }
+    ret->owned = data;
+    return (PyObject*)ret;
+}
@@ -43,4 +43,17 @@ struct tile;
 void               S_Tile_PyRegister(PyObject *module);
 const struct tile *S_Tile_GetTile(PyObject *tile_obj);
 
+/* Read-only 'pf.MapBuffer' views of the current map's data, exposed through 
+ * the buffer protocol without copying. Taking a buffer from a view fails 
+ * once the map it was made for has been freed. */
+PyObject          *S_Tile_ChunkTilesView(int chunk_r, int chunk_c);
+PyObject          *S_Tile_HeightfieldView(void);
+/* A 'pf.MapBuffer' of 'count' floats, which takes ownership of 'data'. It 
+ * must have been allocated with 'MEM_Malloc'. */
+PyObject          *S_Tile_FloatBuffer(float *data, size_t count);
+/* As above, for 'count' records of 'itemsize' bytes. 'format' describes a 
+ * record in the syntax of the 'struct' module and must outlive the buffer. */
+PyObject          *S_Tile_RecordBuffer(void *data, const char *format, size_t itemsize, 
+                                       size_t count);
+
 #endif
@@ -0,0 +1,282 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#include "vec_script.h"
+
+#include <structmember.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Vectors are plain values - the floats are stored inline, so reading and 
+ * writing the components never allocates anything beyond the float objects
+ * that Python hands out. */
+typedef struct {
+    PyObject_HEAD
+    int   len;
+    float raw[4];
+}PyVecObject;
+
+static PyObject  *PyVec_new(PyTypeObject *type, PyObject *args, PyObject *kwds);
+static PyObject  *PyVec_repr(PyVecObject *self);
+static Py_ssize_t PyVec_len(PyVecObject *self);
+static PyObject  *PyVec_item(PyVecObject *self, Py_ssize_t i);
+static int        PyVec_ass_item(PyVecObject *self, Py_ssize_t i, PyObject *value);
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+#define BASE(i) (offsetof(PyVecObject, raw) + (i) * sizeof(float))
+static PyMemberDef PyVec3_members[] = {
+    {"x", T_FLOAT, BASE(0), 0, "The X component."},
+    {"y", T_FLOAT, BASE(1), 0, "The Y component."},
+    {"z", T_FLOAT, BASE(2), 0, "The Z component."},
+    {NULL}  /* Sentinel */
+};
+
+static PyMemberDef PyQuat_members[] = {
+    {"x", T_FLOAT, BASE(0), 0, "The X component."},
+    {"y", T_FLOAT, BASE(1), 0, "The Y component."},
+    {"z", T_FLOAT, BASE(2), 0, "The Z component."},
+    {"w", T_FLOAT, BASE(3), 0, "The W component."},
+    {NULL}  /* Sentinel */
+};
+#undef BASE
+
+static PySequenceMethods PyVec_sequence = {
+    .sq_length      = (lenfunc)PyVec_len,
+    .sq_item        = (ssizeargfunc)PyVec_item,
+    .sq_ass_item    = (ssizeobjargproc)PyVec_ass_item,
+};
+
+static PyTypeObject PyVec3_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.Vec3",
+    .tp_basicsize   = sizeof(PyVecObject),
+    .tp_flags       = Py_TPFLAGS_DEFAULT,
+    .tp_doc         = "XYZ vector of floats. Can be constructed from 3 numbers or from any sequence "
+                      "of 3 numbers, and indexed and unpacked like a sequence.",
+    .tp_repr        = (reprfunc)PyVec_repr,
+    .tp_as_sequence = &PyVec_sequence,
+    .tp_members     = PyVec3_members,
+    .tp_new         = PyVec_new,
+};
+
+static PyTypeObject PyQuat_type = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name        = "pf.Quat",
+    .tp_basicsize   = sizeof(PyVecObject),
+    .tp_flags       = Py_TPFLAGS_DEFAULT,
+    .tp_doc         = "XYZW quaternion of floats. Can be constructed from 4 numbers or from any "
+                      "sequence of 4 numbers, and indexed and unpacked like a sequence. Defaults "
+                      "to the identity rotation.",
+    .tp_repr        = (reprfunc)PyVec_repr,
+    .tp_as_sequence = &PyVec_sequence,
+    .tp_members     = PyQuat_members,
+    .tp_new         = PyVec_new,
+};
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static bool s_get_floats(PyObject *obj, PyTypeObject *type, int len, float *out)
+{
+    if(PyObject_TypeCheck(obj, type)) {
+        memcpy(out, ((PyVecObject*)obj)->raw, len * sizeof(float));
+        return true;
+    }
+
+    PyObject *seq = PySequence_Fast(obj, "Argument must be a vector or a sequence of numbers.");
+    if(!seq)
+        return false;
+
+    if(PySequence_Fast_GET_SIZE(seq) != len) {
+        PyErr_Format(PyExc_TypeError, "Argument must have a size of %d.", len);
+        Py_DECREF(seq);
+        return false;
+    }
+
+    PyObject **items = PySequence_Fast_ITEMS(seq);
+    for(int i = 0; i < len; i++) {
+
+        double val = PyFloat_AsDouble(items[i]);
+        if(val == -1.0 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return false;
+        }
+        out[i] = val;
+    }
+
+    Py_DECREF(seq);
+    return true;
+}
+
+static PyObject *s_new(PyTypeObject *type, const float *raw)
+{
+    PyVecObject *ret = (PyVecObject*)type->tp_alloc(type, 0);
+    if(!ret)
+        return NULL;
+
+    ret->len = (type == &PyQuat_type) ? 4 : 3;
+    memcpy(ret->raw, raw, ret->len * sizeof(float));
+    return (PyObject*)ret;
+}
+
+static bool s_set(PyObject *obj, PyTypeObject *type, const float *raw)
+{
+    if(!PyObject_TypeCheck(obj, type)) {
+        PyErr_Format(PyExc_TypeError, "Argument must be a %s.", type->tp_name);
+        return false;
+    }
+
+    PyVecObject *vec = (PyVecObject*)obj;
+    memcpy(vec->raw, raw, vec->len * sizeof(float));
+    return true;
+}
+
+static PyObject *PyVec_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    int len = (type == &PyQuat_type) ? 4 : 3;
+    float raw[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+    Py_ssize_t nargs = PyTuple_GET_SIZE(args);
+    if(nargs == 1) {
+        if(!s_get_floats(PyTuple_GET_ITEM(args, 0), type, len, raw))
+            return NULL;
+    }else if(nargs == len) {
+        if(!s_get_floats(args, type, len, raw))
+            return NULL;
+    }else if(nargs != 0) {
+        PyErr_Format(PyExc_TypeError, "Expected %d numbers or a sequence of them.", len);
+        return NULL;
+    }
+
+    return s_new(type, raw);
+}
+
+static PyObject *PyVec_repr(PyVecObject *self)
+{
+    char buff[128];
+    if(self->len == 4)
+        snprintf(buff, sizeof(buff), "%s(%g, %g, %g, %g)", Py_TYPE(self)->tp_name, 
+            self->raw[0], self->raw[1], self->raw[2], self->raw[3]);
+    else
+        snprintf(buff, sizeof(buff), "%s(%g, %g, %g)", Py_TYPE(self)->tp_name, 
+            self->raw[0], self->raw[1], self->raw[2]);
+    return PyString_FromString(buff);
+}
+
+static Py_ssize_t PyVec_len(PyVecObject *self)
+{
+    return self->len;
+}
+
+static PyObject *PyVec_item(PyVecObject *self, Py_ssize_t i)
+{
+    if(i < 0 || i >= self->len) {
+        PyErr_SetString(PyExc_IndexError, "Vector index out of range.");
+        return NULL;
+    }
+    return PyFloat_FromDouble(self->raw[i]);
+}
+
+static int PyVec_ass_item(PyVecObject *self, Py_ssize_t i, PyObject *value)
+{
+    if(i < 0 || i >= self->len) {
+        PyErr_SetString(PyExc_IndexError, "Vector index out of range.");
+        return -1;
+    }
+
+    if(!value) {
+        PyErr_SetString(PyExc_TypeError, "Vector components cannot be deleted.");
+        return -1;
+    }
+
+    double val = PyFloat_AsDouble(value);
+    if(val == -1.0 && PyErr_Occurred())
+        return -1;
+
+    self->raw[i] = val;
+    return 0;
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+void S_Vec_PyRegister(PyObject *module)
+{
+    if(PyType_Ready(&PyVec3_type) < 0)
+        return;
+    Py_INCREF(&PyVec3_type);
+    PyModule_AddObject(module, "Vec3", (PyObject*)&PyVec3_type);
+
+    if(PyType_Ready(&PyQuat_type) < 0)
+        return;
+    Py_INCREF(&PyQuat_type);
+    PyModule_AddObject(module, "Quat", (PyObject*)&PyQuat_type);
+}
+
+PyObject *S_Vec3_New(const vec3_t *v)
+{
+    return s_new(&PyVec3_type, v->raw);
+}
+
+PyObject *S_Quat_New(const quat_t *q)
+{
+    return s_new(&PyQuat_type, q->raw);
+}
+
+bool S_Vec3_Get(PyObject *obj, vec3_t *out)
+{
+    return s_get_floats(obj, &PyVec3_type, 3, out->raw);
+}
+
+bool S_Quat_Get(PyObject *obj, quat_t *out)
+{
+    return s_get_floats(obj, &PyQuat_type, 4, out->raw);
+}
+
+bool S_Vec3_Set(PyObject *obj, const vec3_t *v)
+{
+    return s_set(obj, &PyVec3_type, v->raw);
+}
+
+bool S_Quat_Set(PyObject *obj, const quat_t *q)
+{
+    return s_set(obj, &PyQuat_type, q->raw);
+}
+
@@ -0,0 +1,61 @@
+/*
+ *  This file is part of Permafrost Engine. 
+ *  Copyright (C) 2018 Eduard Permyakov 
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  Linking this software statically or dynamically with other modules is making 
+ *  a combined work based on this software. Thus, the terms and conditions of 
+ *  the GNU General Public License cover the whole combination. 
+ *  
+ *  As a special exception, the copyright holders of Permafrost Engine give 
+ *  you permission to link Permafrost Engine with independent modules to produce 
+ *  an executable, regardless of the license terms of these independent 
+ *  modules, and to copy and distribute the resulting executable under 
+ *  terms of your choice, provided that you also meet, for each linked 
+ *  independent module, the terms and conditions of the license of that 
+ *  module. An independent module is a module which is not derived from 
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may 
+ *  extend this exception to your version of Permafrost Engine, but you are not 
+ *  obliged to do so. If you do not wish to do so, delete this exception 
+ *  statement from your version.
+ *
+ */
+
+#ifndef VEC_SCRIPT_H
+#define VEC_SCRIPT_H
+
+#include <Python.h> /* Must be first */
+#include "../pf_math.h"
+
+#include <stdbool.h>
+
+void      S_Vec_PyRegister(PyObject *module);
+
+/* New pf.Vec3 and pf.Quat objects holding a copy of the value */
+PyObject *S_Vec3_New(const vec3_t *v);
+PyObject *S_Quat_New(const quat_t *q);
+
+/* Accept a pf.Vec3 (or pf.Quat), or any other sequence of 3 (or 4) numbers.
+ * A Python exception is set when false is returned. */
+bool      S_Vec3_Get(PyObject *obj, vec3_t *out);
+bool      S_Quat_Get(PyObject *obj, quat_t *out);
+
+/* Copy the value into an existing pf.Vec3 (or pf.Quat) object, without 
+ * allocating anything. A Python exception is set when false is returned. */
+bool      S_Vec3_Set(PyObject *obj, const vec3_t *v);
+bool      S_Quat_Set(PyObject *obj, const quat_t *q);
+
+#endif
+
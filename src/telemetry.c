@@ -0,0 +1,304 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#include "telemetry.h"
+#include "mem.h"
+#include "game/public/game.h"
+#include "navigation/public/nav.h"
+#include "render/public/render.h"
+#include "lib/public/mpsc_queue.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+
+#define ROW_INTERVAL_MS     (1000)
+/* Frames past this many in a single row are left out of its' percentiles */
+#define MAX_ROW_FRAMES      (4096)
+/* Rows waiting for the writer - must be a power of two */
+#define ROW_QUEUE_SIZE      (64)
+#define MIN(a, b)           ((a) < (b) ? (a) : (b))
+
+struct row{
+    double            time_s;
+    unsigned          num_frames;
+    float             p50_ms;
+    float             p99_ms;
+    float             max_ms;
+    struct game_stats game;
+    size_t            cache_bytes;
+    /* NAN when the cache was not used during the row */
+    float             cache_hit_rate;
+    size_t            mem_bytes[MEM_TAG_COUNT];
+    float             draw_calls;
+    float             gpu_ms[GPU_PASS_COUNT];
+};
+
+/*****************************************************************************/
+/* STATIC VARIABLES                                                          */
+/*****************************************************************************/
+
+static bool           s_running;
+static FILE          *s_file;
+static SDL_Thread    *s_writer;
+static SDL_sem       *s_wake;
+static SDL_atomic_t   s_quit;
+static mpsc_queue_t  *s_rows;
+static unsigned       s_dropped;
+
+static uint64_t       s_begin;
+static uint64_t       s_last_frame;
+static uint64_t       s_row_begin;
+static float          s_frame_ms[MAX_ROW_FRAMES];
+static unsigned       s_num_frames;
+static float          s_max_ms;
+static size_t         s_draw_calls;
+static uint64_t       s_cache_hits;
+static uint64_t       s_cache_misses;
+
+/*****************************************************************************/
+/* STATIC FUNCTIONS                                                          */
+/*****************************************************************************/
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static void telemetry_write_header(void)
+{
+    fprintf(s_file, "time_s,frames,frame_p50_ms,frame_p99_ms,frame_max_ms,"
+        "entities,dynamic_entities,visible_entities,flocks,field_cache_bytes,field_cache_hit_rate");
+    for(int i = 0; i < MEM_TAG_COUNT; i++)
+        fprintf(s_file, ",mem_%s_bytes", MEM_TagName(i));
+    fprintf(s_file, ",draw_calls");
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        fprintf(s_file, ",gpu_%s_ms", R_GL_PassName(i));
+    fprintf(s_file, "\n");
+    fflush(s_file);
+}
+
+static void telemetry_write_row(const struct row *row)
+{
+    fprintf(s_file, "%.3f,%u,%.3f,%.3f,%.3f,%zu,%zu,%zu,%zu,%zu,", 
+        row->time_s, row->num_frames, row->p50_ms, row->p99_ms, row->max_ms, 
+        row->game.entities, row->game.dynamic, row->game.visible, row->game.flocks, 
+        row->cache_bytes);
+    if(!isnan(row->cache_hit_rate))
+        fprintf(s_file, "%.4f", row->cache_hit_rate);
+    for(int i = 0; i < MEM_TAG_COUNT; i++)
+        fprintf(s_file, ",%zu", row->mem_bytes[i]);
+    fprintf(s_file, ",%.1f", row->draw_calls);
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        fprintf(s_file, ",%.3f", row->gpu_ms[i]);
+    fprintf(s_file, "\n");
+}
+
+static int telemetry_writer(void *arg)
+{
+    bool quit = false;
+    while(!quit) {
+
+        SDL_SemWait(s_wake);
+        /* Rows are pushed before the quit flag is set, so all of them are 
+         * written before exiting */
+        quit = SDL_AtomicGet(&s_quit);
+
+        struct row row;
+        while(0 == mpsc_queue_pop(s_rows, &row))
+            telemetry_write_row(&row);
+        fflush(s_file);
+    }
+    return 0;
+}
+
+static void telemetry_reset_row(uint64_t now)
+{
+    s_row_begin = now;
+    s_num_frames = 0;
+    s_max_ms = 0.0f;
+    s_draw_calls = 0;
+}
+
+/* Everything but the frame times is sampled as the row is ended */
+static void telemetry_end_row(uint64_t now)
+{
+    struct row row = {0};
+    row.time_s = (now - s_begin) / (double)SDL_GetPerformanceFrequency();
+    row.num_frames = s_num_frames;
+    row.max_ms = s_max_ms;
+
+    unsigned num_kept = MIN(s_num_frames, MAX_ROW_FRAMES);
+    if(num_kept > 0) {
+        qsort(s_frame_ms, num_kept, sizeof(float), compare_float);
+        row.p50_ms = s_frame_ms[num_kept / 2];
+        row.p99_ms = s_frame_ms[MIN(num_kept - 1, (unsigned)(num_kept * 0.99f))];
+        row.draw_calls = s_draw_calls / (float)s_num_frames;
+    }
+
+    G_GetStats(&row.game);
+
+    struct nav_cache_stats cache;
+    N_GetCacheStats(&cache);
+    uint64_t lookups = (cache.hits - s_cache_hits) + (cache.misses - s_cache_misses);
+    row.cache_bytes = cache.bytes_resident;
+    row.cache_hit_rate = lookups ? (cache.hits - s_cache_hits) / (float)lookups : NAN;
+    s_cache_hits = cache.hits;
+    s_cache_misses = cache.misses;
+
+    for(int i = 0; i < MEM_TAG_COUNT; i++) {
+        struct mem_stats stats;
+        MEM_GetStats(i, &stats);
+        row.mem_bytes[i] = stats.live;
+    }
+
+    struct render_stats rstats;
+    R_GL_GetRenderStats(&rstats);
+    for(int i = 0; i < GPU_PASS_COUNT; i++)
+        row.gpu_ms[i] = rstats.pass_ms[i];
+
+    if(0 == mpsc_queue_push(s_rows, &row))
+        SDL_SemPost(s_wake);
+    else
+        s_dropped++;
+
+    telemetry_reset_row(now);
+}
+
+/*****************************************************************************/
+/* EXTERN FUNCTIONS                                                          */
+/*****************************************************************************/
+
+bool Telemetry_Start(const char *path)
+{
+    if(s_running)
+        return false;
+
+    s_file = fopen(path, "w");
+    if(!s_file)
+        goto fail_open;
+
+    s_rows = mpsc_queue_init(sizeof(struct row), ROW_QUEUE_SIZE);
+    if(!s_rows)
+        goto fail_queue;
+
+    s_wake = SDL_CreateSemaphore(0);
+    if(!s_wake)
+        goto fail_sem;
+
+    telemetry_write_header();
+    SDL_AtomicSet(&s_quit, 0);
+
+    s_writer = SDL_CreateThread(telemetry_writer, "telemetry", NULL);
+    if(!s_writer)
+        goto fail_thread;
+
+    struct nav_cache_stats cache;
+    N_GetCacheStats(&cache);
+    s_cache_hits = cache.hits;
+    s_cache_misses = cache.misses;
+
+    s_dropped = 0;
+    s_begin = SDL_GetPerformanceCounter();
+    s_last_frame = s_begin;
+    telemetry_reset_row(s_begin);
+
+    s_running = true;
+    return true;
+
+fail_thread:
+    SDL_DestroySemaphore(s_wake);
+fail_sem:
+    mpsc_queue_free(s_rows);
+fail_queue:
+    fclose(s_file);
+fail_open:
+    fprintf(stderr, "Could not start writing telemetry to '%s'.\n", path);
+    return false;
+}
+
+void Telemetry_Stop(void)
+{
+    if(!s_running)
+        return;
+
+    if(s_num_frames > 0)
+        telemetry_end_row(SDL_GetPerformanceCounter());
+
+    SDL_AtomicSet(&s_quit, 1);
+    SDL_SemPost(s_wake);
+    SDL_WaitThread(s_writer, NULL);
+
+    if(s_dropped)
+        fprintf(stderr, "%u telemetry rows were dropped, as the writer fell behind.\n", s_dropped);
+
+    SDL_DestroySemaphore(s_wake);
+    mpsc_queue_free(s_rows);
+    fclose(s_file);
+    s_running = false;
+}
+
+bool Telemetry_Running(void)
+{
+    return s_running;
+}
+
+void Telemetry_FrameEnd(void)
+{
+    if(!s_running)
+        return;
+
+    uint64_t now = SDL_GetPerformanceCounter();
+    float ms = (now - s_last_frame) * 1000.0f / SDL_GetPerformanceFrequency();
+    s_last_frame = now;
+
+    if(s_num_frames < MAX_ROW_FRAMES)
+        s_frame_ms[s_num_frames] = ms;
+    s_num_frames++;
+    s_max_ms = ms > s_max_ms ? ms : s_max_ms;
+
+    struct render_stats rstats;
+    R_GL_GetRenderStats(&rstats);
+    s_draw_calls += rstats.draw_calls;
+
+    if((now - s_row_begin) * 1000 >= ROW_INTERVAL_MS * SDL_GetPerformanceFrequency())
+        telemetry_end_row(now);
+}
+
@@ -0,0 +1,73 @@
+/*
+ *  This file is part of Permafrost Engine.
+ *  Copyright (C) 2018 Eduard Permyakov
+ *
+ *  Permafrost Engine is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  Permafrost Engine is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Linking this software statically or dynamically with other modules is making
+ *  a combined work based on this software. Thus, the terms and conditions of
+ *  the GNU General Public License cover the whole combination.
+ *
+ *  As a special exception, the copyright holders of Permafrost Engine give
+ *  you permission to link Permafrost Engine with independent modules to produce
+ *  an executable, regardless of the license terms of these independent
+ *  modules, and to copy and distribute the resulting executable under
+ *  terms of your choice, provided that you also meet, for each linked
+ *  independent module, the terms and conditions of the license of that
+ *  module. An independent module is a module which is not derived from
+ *  or based on Permafrost Engine. If you modify Permafrost Engine, you may
+ *  extend this exception to your version of Permafrost Engine, but you are not
+ *  obliged to do so. If you do not wish to do so, delete this exception
+ *  statement from your version.
+ *
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdbool.h>
+
+/* ------------------------------------------------------------------------
+ * Telemetry for long running sessions. Once a second, a row of aggregates 
+ * is appended to a CSV file: the frame time percentiles, the entity and 
+ * flock counts, the navigation field cache's size and hit rate, the memory
+ * held by each subsystem, the draw calls and the GPU pass times. The rows
+ * are written out by a background thread. If it falls behind, rows are 
+ * dropped rather than holding up the frame.
+ * ------------------------------------------------------------------------
+ */
+
+/* ------------------------------------------------------------------------
+ * Creates the file (replacing any existing one) and writes the header. 
+ * Returns false if the telemetry is already running or the file could not
+ * be created. Must be called from the main thread.
+ * ------------------------------------------------------------------------
+ */
+bool Telemetry_Start(const char *path);
+
+/* ------------------------------------------------------------------------
+ * Waits for the rows gathered so far to be written and closes the file.
+ * ------------------------------------------------------------------------
+ */
+void Telemetry_Stop(void);
+bool Telemetry_Running(void);
+
+/* ------------------------------------------------------------------------
+ * Marks the end of a frame. Must be called from the main thread. 
+ * ------------------------------------------------------------------------
+ */
+void Telemetry_FrameEnd(void);
+
+#endif
+
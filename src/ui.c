@@ -36,10 +36,14 @@
 #include "ui.h"
 #include "config.h"
 #include "event.h"
+#include "mem.h"
+#include "render/public/render.h"
 
 #include "lib/public/pf_nuklear.h"
 #include "lib/public/nuklear_sdl_gl3.h"
 #include "lib/public/kvec.h"
+#include "lib/public/khash.h"
+#include "lib/public/mem_arena.h"
 
 #include <stdbool.h>
 #include <string.h>
@@ -47,6 +51,9 @@
 
 #define MAX_VERTEX_MEMORY  (512 * 1024)
 #define MAX_ELEMENT_MEMORY (128 * 1024)
+/* The glyphs of this many different label strings are kept before they're
+ * all thrown out */
+#define MAX_CACHED_TEXTS   (1024)
 
 struct text_desc{
     char        text[256];
@@ -54,46 +61,199 @@ struct text_desc{
     struct rgba rgba;
 };
 
+/* A glyph of a label string laid out at the origin */
+struct label_glyph{
+    float x0, y0, x1, y1;
+    float u0, v0, u1, v1;
+    /* The width of the string up to and including this glyph */
+    float advance;
+};
+
+struct glyph_run{
+    size_t first, count;
+};
+
+struct labels_render_args{
+    int num_quads;
+    int changed;
+};
+
+typedef kvec_t(struct text_desc) label_kvec_t;
+
+KHASH_MAP_INIT_STR(run, struct glyph_run)
+
 /*****************************************************************************/
 /* STATIC VARIABLES                                                          */
 /*****************************************************************************/
 
-static struct nk_context        *s_nk_ctx;
-static kvec_t(struct text_desc)  s_curr_frame_labels;
+static struct nk_context          *s_nk_ctx;
+static label_kvec_t                s_curr_frame_labels;
+/* The labels are only laid out again when they differ from the last set */
+static label_kvec_t                s_last_frame_labels;
+static khash_t(run)               *s_glyph_runs;
+static kvec_t(struct label_glyph)  s_glyphs;
+static kvec_t(struct nk_sdl_vertex) s_label_verts;
+static bool                        s_labels_changed;
 
 /*****************************************************************************/
 /* STATIC FUNCTIONS                                                          */
 /*****************************************************************************/
 
-static void ui_draw_text(const struct text_desc desc)
+/* Nuklear never grows allocations in place, so 'old' is of no use */
+static void *ui_alloc(nk_handle unused, void *old, nk_size size)
 {
-    struct nk_command_buffer *canvas = nk_window_get_canvas(s_nk_ctx);
-    assert(canvas);
+    return MEM_Malloc(MEM_TAG_UI, size);
+}
 
-    struct nk_rect  rect = nk_rect(desc.rect.x, desc.rect.y, desc.rect.w, desc.rect.h);
-    struct nk_color rgba = nk_rgba(desc.rgba.r, desc.rgba.g, desc.rgba.b, desc.rgba.a);
+static void ui_free(nk_handle unused, void *ptr)
+{
+    MEM_Free(ptr);
+}
 
-    nk_draw_text(canvas, rect, desc.text, strlen(desc.text), s_nk_ctx->style.font,
-        (struct nk_color){0,0,0,255}, rgba);
+static void ui_flush_glyph_runs(void)
+{
+    for(khiter_t k = kh_begin(s_glyph_runs); k != kh_end(s_glyph_runs); k++) {
+        if(!kh_exist(s_glyph_runs, k))
+            continue;
+        MEM_Free((char*)kh_key(s_glyph_runs, k));
+    }
+    kh_clear(run, s_glyph_runs);
+    kv_reset(s_glyphs);
 }
 
-static void on_update_ui(void *user, void *event)
+/* Lays out the string the same way as Nuklear's draw list does, once for 
+ * every different string */
+static const struct glyph_run *ui_glyph_run(const char *text)
+{
+    khiter_t k = kh_get(run, s_glyph_runs, text);
+    if(k != kh_end(s_glyph_runs))
+        return &kh_value(s_glyph_runs, k);
+
+    if(kh_size(s_glyph_runs) >= MAX_CACHED_TEXTS)
+        ui_flush_glyph_runs();
+
+    size_t len = strlen(text);
+    char *key = MEM_Malloc(MEM_TAG_UI, len + 1);
+    if(!key)
+        return NULL;
+    memcpy(key, text, len + 1);
+
+    int status;
+    k = kh_put(run, s_glyph_runs, key, &status);
+    if(status == -1) {
+        MEM_Free(key);
+        return NULL;
+    }
+
+    const struct nk_user_font *font = s_nk_ctx->style.font;
+    struct glyph_run run = (struct glyph_run){kv_size(s_glyphs), 0};
+    float x = 0.0f;
+    int text_len = 0;
+    nk_rune unicode, next;
+    int glyph_len = nk_utf_decode(text, &unicode, len);
+
+    while(text_len < len && glyph_len && unicode != NK_UTF_INVALID) {
+
+        int next_glyph_len = nk_utf_decode(text + text_len + glyph_len, &next, len - text_len);
+        struct nk_user_font_glyph g;
+        font->query(font->userdata, font->height, &g, unicode, (next == NK_UTF_INVALID) ? '\0' : next);
+
+        x += g.xadvance;
+        kv_push(struct label_glyph, s_glyphs, ((struct label_glyph){
+            x - g.xadvance + g.offset.x, g.offset.y, 
+            x - g.xadvance + g.offset.x + g.width, g.offset.y + g.height,
+            g.uv[0].x, g.uv[0].y, g.uv[1].x, g.uv[1].y, 
+            x
+        }));
+        run.count++;
+
+        text_len += glyph_len;
+        glyph_len = next_glyph_len;
+        unicode = next;
+    }
+
+    kh_value(s_glyph_runs, k) = run;
+    return &kh_value(s_glyph_runs, k);
+}
+
+static void ui_push_quad(const struct label_glyph *g, float x, float y, struct rgba rgba)
+{
+    const float pos[4][2] = {{g->x0, g->y0}, {g->x1, g->y0}, {g->x1, g->y1}, {g->x0, g->y1}};
+    const float uv[4][2]  = {{g->u0, g->v0}, {g->u1, g->v0}, {g->u1, g->v1}, {g->u0, g->v1}};
+
+    for(int i = 0; i < 4; i++) {
+        kv_push(struct nk_sdl_vertex, s_label_verts, ((struct nk_sdl_vertex){
+            {x + pos[i][0], y + pos[i][1]}, 
+            {uv[i][0], uv[i][1]}, 
+            {rgba.r, rgba.g, rgba.b, rgba.a}
+        }));
+    }
+}
+
+static void ui_layout_labels(void)
 {
-    struct nk_style *s = &s_nk_ctx->style;
-    nk_style_push_color(s_nk_ctx, &s->window.background, nk_rgba(0,0,0,0));
-    nk_style_push_style_item(s_nk_ctx, &s->window.fixed_background, nk_style_item_color(nk_rgba(0,0,0,0)));
+    kv_reset(s_label_verts);
+
+    for(int i = 0; i < kv_size(s_curr_frame_labels); i++) {
+
+        const struct text_desc *desc = &kv_A(s_curr_frame_labels, i);
+        if(desc->rect.x + desc->rect.w < 0 || desc->rect.x > CONFIG_RES_X
+        || desc->rect.y + desc->rect.h < 0 || desc->rect.y > CONFIG_RES_Y)
+            continue;
+
+        const struct glyph_run *run = ui_glyph_run(desc->text);
+        if(!run)
+            continue;
+
+        /* Nuklear snaps the text to whole pixels and cuts it off at the 
+         * width of its rect */
+        float x = (short)desc->rect.x;
+        float y = (short)desc->rect.y;
+        float width = (unsigned short)desc->rect.w;
+
+        for(int j = 0; j < run->count; j++) {
 
-    if(nk_begin(s_nk_ctx, "__labels__", nk_rect(0, 0, CONFIG_RES_X, CONFIG_RES_Y), 
-       NK_WINDOW_NO_INPUT | NK_WINDOW_BACKGROUND | NK_WINDOW_NO_SCROLLBAR)) {
-    
-       for(int i = 0; i < kv_size(s_curr_frame_labels); i++)
-            ui_draw_text(kv_A(s_curr_frame_labels, i)); 
+            const struct label_glyph *g = &kv_A(s_glyphs, run->first + j);
+            if(g->advance > width)
+                break;
+            ui_push_quad(g, x, y, desc->rgba);
+        }
     }
-    nk_end(s_nk_ctx);
+}
+
+/* The commands are converted into vertices as they're drawn, so the context 
+ * mustn't be touched until then. The labels go under everything else. */
+static void ui_render_exec(const void *arg)
+{
+    const struct labels_render_args *args = arg;
+    const struct nk_sdl_vertex *verts = (const struct nk_sdl_vertex*)(args + 1);
+
+    nk_sdl_render_quads(verts, args->num_quads, args->changed);
+    nk_sdl_render(NK_ANTI_ALIASING_ON, MAX_VERTEX_MEMORY, MAX_ELEMENT_MEMORY);
+}
+
+static bool ui_labels_equal(const label_kvec_t *a, const label_kvec_t *b)
+{
+    if(kv_size(*a) != kv_size(*b))
+        return false;
+    if(!kv_size(*a))
+        return true;
+    return 0 == memcmp(a->a, b->a, kv_size(*a) * sizeof(struct text_desc));
+}
+
+/* Labels which are the same as last frame's are drawn from the quads that 
+ * are already on the GPU */
+static void on_update_ui(void *user, void *event)
+{
+    if(!ui_labels_equal(&s_curr_frame_labels, &s_last_frame_labels)) {
 
-    nk_style_pop_color(s_nk_ctx);
-    nk_style_pop_style_item(s_nk_ctx);
+        ui_layout_labels();
+        s_labels_changed = true;
 
+        label_kvec_t tmp = s_last_frame_labels;
+        s_last_frame_labels = s_curr_frame_labels;
+        s_curr_frame_labels = tmp;
+    }
     kv_reset(s_curr_frame_labels);
 }
 
@@ -103,7 +263,11 @@ static void on_update_ui(void *user, void *event)
 
 struct nk_context *UI_Init(const char *basedir, SDL_Window *win)
 {
-    struct nk_context *ctx = nk_sdl_init(win);
+    struct nk_allocator alloc = (struct nk_allocator){
+        .alloc = ui_alloc,
+        .free = ui_free,
+    };
+    struct nk_context *ctx = nk_sdl_init(win, &alloc);
     if(!ctx)
         return NULL;
 
@@ -119,7 +283,17 @@ struct nk_context *UI_Init(const char *basedir, SDL_Window *win)
     atlas->default_font = optimus_princeps;
     nk_sdl_font_stash_end();
 
+    s_glyph_runs = kh_init(run);
+    if(!s_glyph_runs) {
+        nk_sdl_shutdown();
+        return NULL;
+    }
+
     kv_init(s_curr_frame_labels);
+    kv_init(s_last_frame_labels);
+    kv_init(s_glyphs);
+    kv_init(s_label_verts);
+    s_labels_changed = false;
     E_Global_Register(EVENT_UPDATE_UI, on_update_ui, NULL);
 
     s_nk_ctx = ctx;
@@ -129,7 +303,12 @@ struct nk_context *UI_Init(const char *basedir, SDL_Window *win)
 void UI_Shutdown(void)
 {
     E_Global_Unregister(EVENT_UPDATE_UI, on_update_ui);
+    ui_flush_glyph_runs();
+    kh_destroy(run, s_glyph_runs);
     kv_destroy(s_curr_frame_labels);
+    kv_destroy(s_last_frame_labels);
+    kv_destroy(s_glyphs);
+    kv_destroy(s_label_verts);
     nk_sdl_shutdown();
 }
 
@@ -145,7 +324,29 @@ void UI_InputEnd(struct nk_context *ctx)
 
 void UI_Render(void)
 {
-    nk_sdl_render(NK_ANTI_ALIASING_ON, MAX_VERTEX_MEMORY, MAX_ELEMENT_MEMORY);
+    size_t nverts = s_labels_changed ? kv_size(s_label_verts) : 0;
+    size_t argsize = sizeof(struct labels_render_args) + nverts * sizeof(struct nk_sdl_vertex);
+
+    struct labels_render_args *args = arena_alloc(MEM_FrameArena(), argsize);
+    if(!args) {
+        /* Draw last frame's labels and upload the new ones next time */
+        struct labels_render_args stale = (struct labels_render_args){0, false};
+        R_Thread_Push(ui_render_exec, &stale, sizeof(stale));
+        return;
+    }
+
+    args->num_quads = nverts / 4;
+    args->changed = s_labels_changed;
+    if(nverts)
+        memcpy(args + 1, s_label_verts.a, nverts * sizeof(struct nk_sdl_vertex));
+
+    R_Thread_Push(ui_render_exec, args, argsize);
+    s_labels_changed = false;
+}
+
+void UI_Discard(void)
+{
+    nk_clear(s_nk_ctx);
 }
 
 void UI_HandleEvent(SDL_Event *event)
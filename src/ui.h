@@ -53,6 +53,8 @@ void               UI_Shutdown(void);
 void               UI_InputBegin(struct nk_context *ctx);
 void               UI_InputEnd(struct nk_context *ctx);
 void               UI_Render(void);
+/* Drop the frame's UI without drawing it, for running headless */
+void               UI_Discard(void);
 void               UI_HandleEvent(SDL_Event *event);
 void               UI_DrawText(const char *text, struct rect rect, struct rgba rgba);
 